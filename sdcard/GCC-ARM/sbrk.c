@@ -8,37 +8,23 @@
 #undef errno
 extern int errno;
 
-#define FreeRTOS
-#define MAX_STACK_SIZE 0x200
-#define VTOR 0xE000ED08
-
-#ifndef FreeRTOS
-  register char * stack_ptr asm("sp");
-#endif
-
 caddr_t _sbrk		_PARAMS ((int));
 
 caddr_t _sbrk(int incr)
 {
 	extern char end asm("end");
+	extern char _eheap asm("_eheap");	/* end of _Min_Heap_Size (stm32_flash.ld) */
 	static char *heap_end;
-	char *prev_heap_end,*min_stack_ptr;
+	char *prev_heap_end;
 
 	if (heap_end == 0)
 		heap_end = &end;
 
 	prev_heap_end = heap_end;
 
-#ifdef FreeRTOS
-	/* Use the NVIC offset register to locate the main stack pointer. */
-	min_stack_ptr = *(unsigned int *)(*(unsigned int *)VTOR);
-	/* Locate the STACK bottom address */
-	min_stack_ptr -= MAX_STACK_SIZE;
-
-	if (heap_end + incr > min_stack_ptr)
-#else
-	if (heap_end + incr > stack_ptr)
-#endif
+	/* The sector cache is placed after the heap and the main stack is
+	   only _Min_Stack_Size deep, neither may be taken */
+	if (heap_end + incr > &_eheap)
 	{
 //		write(1, "Heap and stack collision\n", 25);
 //		abort();
@@ -16,38 +16,52 @@
 #include <unistd.h>
 #include <sys/wait.h>
 
+#include "FreeRTOS.h"
+#include "task.h"
+
 #undef errno
 extern int errno;
 
-#define FreeRTOS
-#define MAX_STACK_SIZE 0x800
+/*
+ * Locks of newlib: its malloc heap (and _sbrk below) and the environment are
+ * shared by all tasks, the scheduler is suspended while a task uses them.
+ * Suspension nests, as newlib takes the locks recursively. Not for interrupts.
+ * */
+void __malloc_lock(struct _reent *r)
+{
+	vTaskSuspendAll();
+}
 
-#ifndef FreeRTOS
-  register char * stack_ptr asm("sp");
-#endif
+void __malloc_unlock(struct _reent *r)
+{
+	xTaskResumeAll();
+}
+
+void __env_lock(struct _reent *r)
+{
+	vTaskSuspendAll();
+}
+
+void __env_unlock(struct _reent *r)
+{
+	xTaskResumeAll();
+}
 
 caddr_t _sbrk(int incr)
 {
 	extern char end asm("end");
+	extern char _eheap asm("_eheap");	/* end of _Min_Heap_Size (stm32_flash.ld) */
 	static char *heap_end;
-	char *prev_heap_end,*min_stack_ptr;
+	char *prev_heap_end;
 
 	if (heap_end == 0)
 		heap_end = &end;
 
 	prev_heap_end = heap_end;
 
-#ifdef FreeRTOS
-	/* Use the NVIC offset register to locate the main stack pointer. */
-	min_stack_ptr = (char*)(*(unsigned int *)*(unsigned int *)0xE000ED08);
-
-	/* Locate the STACK bottom address */
-	min_stack_ptr -= MAX_STACK_SIZE;
-
-	if (heap_end + incr > min_stack_ptr)
-#else
-	if (heap_end + incr > stack_ptr)
-#endif
+	/* The sector cache is placed after the heap and the main stack is
+	   only _Min_Stack_Size deep, neither may be taken */
+	if (heap_end + incr > &_eheap)
 	{
 //		write(1, "Heap and stack collision\n", 25);
 //		abort();
@@ -0,0 +1,38 @@
+/**
+ ******************************************************************************
+ * @file    FreeRTOS.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Scheduler types for the host simulation build. There is one
+ *          thread and the scheduler is never started, so code under test
+ *          takes its single task paths; the tick count is simulated time.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef SIM_FREERTOS_H
+#define SIM_FREERTOS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t portTickType;
+typedef long portBASE_TYPE;
+typedef void* xTaskHandle;
+typedef struct SIM_Semaphore* xSemaphoreHandle;
+typedef xSemaphoreHandle xQueueHandle;
+typedef struct { uint8_t Unused; } xStaticSemaphore;	/* semaphores come from SIM_SemaphoreCreate */
+
+#define pdTRUE					( 1 )
+#define pdFALSE					( 0 )
+#define pdPASS					( 1 )
+#define pdFAIL					( 0 )
+
+#define portMAX_DELAY			( (portTickType)0xFFFFFFFF )
+#define portTICK_RATE_MS		( (portTickType)1 )
+
+#define configMINIMAL_STACK_SIZE	( (unsigned short)128 )
+#define configTICK_RATE_HZ		( (portTickType)1000 )
+#define tskIDLE_PRIORITY		( 0 )
+
+#endif /* SIM_FREERTOS_H */
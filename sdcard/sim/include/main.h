@@ -0,0 +1,38 @@
+/**
+ ******************************************************************************
+ * @file    main.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Settings of the host simulation build: the firmware settings of
+ *          src/main.h without the options which need board hardware.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef SIM_MAIN_H
+#define SIM_MAIN_H
+
+#include "../../src/main.h"
+
+/* one card on one bus, no external SRAM nor LCD */
+#undef USE_LCD
+#undef USE_TOUCHSCREEN
+#undef USE_EXT_SRAM
+#undef USE_SD_CARD2
+#undef USE_SD_RAID
+#undef USE_SD_RAID_MIRROR
+#undef USE_SD_SDIO
+#undef USE_RTC_CALENDAR
+#undef USE_DISK_CRYPT
+#undef USE_WATCHDOG
+
+/* make RAID=1 (SIM_RAID 1) builds the striped array of two card images, RAID=mirror (SIM_RAID 2) the mirror */
+#ifdef SIM_RAID
+#define USE_SD_CARD2
+#define USE_SD_RAID
+#if SIM_RAID == 2
+#define USE_SD_RAID_MIRROR
+#endif /* SIM_RAID == 2 */
+#endif /* SIM_RAID */
+
+#endif /* SIM_MAIN_H */
@@ -0,0 +1,27 @@
+/**
+ ******************************************************************************
+ * @file    semphr.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Semaphores of the host simulation build: counters, a take which
+ *          would block only waits out its timeout (nobody else can give).
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef SIM_SEMPHR_H
+#define SIM_SEMPHR_H
+
+#include "FreeRTOS.h"
+
+xSemaphoreHandle SIM_SemaphoreCreate( uint32_t count );
+portBASE_TYPE xSemaphoreTake( xSemaphoreHandle sem, portTickType timeout );
+portBASE_TYPE xSemaphoreGive( xSemaphoreHandle sem );
+void vQueueDelete( xQueueHandle queue );
+
+#define xSemaphoreCreateMutex()		SIM_SemaphoreCreate( 1 )
+#define vSemaphoreCreateBinary( s )	( (s) = SIM_SemaphoreCreate( 1 ) )
+#define xSemaphoreCreateMutexStatic( b )		( (void)(b), SIM_SemaphoreCreate( 1 ) )
+#define vSemaphoreCreateBinaryStatic( s, b )	( (void)(b), (s) = SIM_SemaphoreCreate( 1 ) )
+
+#endif /* SIM_SEMPHR_H */
@@ -0,0 +1,24 @@
+/**
+ ******************************************************************************
+ * @file    stm32_dwt.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Cycle counter of the host simulation build: it defines the include
+ *          guard of sys/BSP/stm32_dwt.h and counts simulated time at 120 MHz
+ *          (without the 32 bit wrap, DWORD of the host is 64 bit).
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32_DWT_H
+#define STM32_DWT_H
+
+#include <stdint.h>
+
+#include "sim.h"
+
+#define DWT_Enable()			do { } while ( 0 )
+#define DWT_GetCycles()			( SIM_Now() * 120 )
+#define DWT_CyclesToUs( c )		( (uint32_t)(c) / 120 )
+
+#endif /* STM32_DWT_H */
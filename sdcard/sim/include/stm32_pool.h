@@ -0,0 +1,29 @@
+/**
+ ******************************************************************************
+ * @file    stm32_pool.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Block pool of the host simulation build. It defines the include
+ *          guard of sys/BSP/stm32_pool.h, the blocks are static arrays of
+ *          sim_platform.c. Keep the sizes in sync with the board header.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32_POOL_H
+#define STM32_POOL_H
+
+#include <stdint.h>
+
+#define POOL_BLOCK_SIZE			512
+#ifndef POOL_BLOCKS
+#define POOL_BLOCKS				8
+#endif /* POOL_BLOCKS */
+
+void POOL_Init( void );
+void* POOL_Alloc( void );
+void POOL_Free( void* block );
+uint32_t POOL_FreeCount( void );
+uint32_t POOL_MinFreeCount( void );
+
+#endif /* STM32_POOL_H */
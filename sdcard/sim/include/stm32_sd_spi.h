@@ -0,0 +1,68 @@
+/**
+ ******************************************************************************
+ * @file    stm32_sd_spi.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   SD Card types of the host simulation build. It defines the
+ *          include guard of sys/BSP/stm32_sd_spi.h, so headers including the
+ *          driver header (stm32_sd_io.h) get these types instead of the board
+ *          definitions. Keep SD_Error in sync with the driver. The 2nd
+ *          card (USE_SD_CARD2) has just the driver functions of diskio.c.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32_SD_SPI_H
+#define STM32_SD_SPI_H
+
+#include "main.h"
+
+#include <stdint.h>
+
+typedef enum _SD_Error
+{
+	SD_RESPONSE_NO_ERROR	= 0x00,
+	SD_IN_IDLE_STATE		= 0x01,
+	SD_ERASE_RESET			= 0x02,
+	SD_ILLEGAL_COMMAND		= 0x04,
+	SD_COMMAND_CRC_ERROR	= 0x08,
+	SD_ERASE_SEQUENCE_ERROR	= 0x10,
+	SD_ADDRESS_ERROR		= 0x20,
+	SD_PARAMETER_ERROR		= 0x40,
+	SD_CHECK_BIT			= 0x80,
+	SD_DATA_WRITE_ERROR		= 0xFC,
+	SD_DATA_MISMATCH		= 0xFD,
+	SD_DATA_CRC_ERROR		= 0xFE,
+	SD_RESPONSE_FAILURE		= 0xFF
+} SD_Error;
+
+typedef struct _SD_CardInfo
+{
+	uint8_t  CSD[ 16 ];				/*!< CSD register */
+	uint8_t  CID[ 16 ];				/*!< CID register */
+	uint8_t  SCR[ 8 ];				/*!< SCR register */
+	uint32_t CardCapacity;			/*!< Card Capacity (Kbytes, as the driver reports it) */
+	uint32_t CardBlockSize;			/*!< Card Block Size */
+} SD_CardInfo;
+
+#define SD_BLOCK_SIZE		0x200
+
+#define SD_PRESENT			((uint8_t)0x01)
+#define SD_NOT_PRESENT		((uint8_t)0x00)
+
+#ifdef USE_SD_CARD2
+typedef struct _SD_Handle
+{
+	uint8_t  Bus;					/*!< Not used by the card model */
+} SD_Handle;
+
+extern SD_Handle SD_Card2;			/* 2nd card of the array (sim_card.c) */
+
+uint8_t SD_Detect( SD_Handle* hsd );
+SD_Error SD_Init( SD_Handle* hsd );
+SD_Error SD_GetCardInfo( SD_Handle* hsd, SD_CardInfo *cardinfo );
+SD_Error SD_SectorsRead( SD_Handle* hsd, uint32_t readAddr, uint8_t* pBuffer, uint32_t nbSectors );
+SD_Error SD_SectorsWrite( SD_Handle* hsd, uint32_t writeAddr, const uint8_t* pBuffer, uint32_t nbSectors );
+#endif /* USE_SD_CARD2 */
+
+#endif /* STM32_SD_SPI_H */
@@ -0,0 +1,27 @@
+/**
+ ******************************************************************************
+ * @file    task.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Task functions of the host simulation build (sim/sim_platform.c)
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef SIM_TASK_H
+#define SIM_TASK_H
+
+#include "FreeRTOS.h"
+
+#define taskSCHEDULER_NOT_STARTED	0
+#define taskSCHEDULER_RUNNING		1
+#define taskSCHEDULER_SUSPENDED		2
+
+#define taskENTER_CRITICAL()
+#define taskEXIT_CRITICAL()
+
+portBASE_TYPE xTaskGetSchedulerState( void );
+portTickType xTaskGetTickCount( void );
+void vTaskDelay( portTickType ticks );
+
+#endif /* SIM_TASK_H */
@@ -0,0 +1,64 @@
+/**
+ ******************************************************************************
+ * @file    sim.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Host simulation of the FatFs + diskio stack: simulated clock and
+ *          the SD Card model behind the SD I/O interface (stm32_sd_io.h).
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+/**
+ * @brief  Timing of a card, in SPI byte times ("tries" of the driver) as
+ *         listed for card models in sys/BSP/stm32_sd_spi.c
+ */
+typedef struct
+{
+	const char*	Name;
+	uint32_t	ReadTries;		/*!< Wait for the data token of each block */
+	uint32_t	WriteTries;		/*!< BUSY after a write transfer (single block or end of stream) */
+	uint32_t	BlockTries;		/*!< BUSY between blocks of a multiple block write */
+	uint32_t	AuTries;		/*!< Extra BUSY when a write enters another allocation unit */
+	uint32_t	EraseTries;		/*!< BUSY of an erase */
+} SIM_CardTiming;
+
+/**
+ * @brief  Counters of the card model
+ */
+typedef struct
+{
+	uint32_t	Commands;		/*!< Commands sent (a continued stream sends none) */
+	uint32_t	Reads;			/*!< Read requests */
+	uint32_t	Writes;			/*!< Write requests */
+	uint32_t	Syncs;			/*!< Sync requests */
+	uint32_t	Discards;		/*!< Discarded ranges */
+	uint64_t	SectorsRead;
+	uint64_t	SectorsWritten;
+	uint64_t	BusyUs;			/*!< Time the caller spent waiting for BUSY */
+} SIM_CardStats;
+
+/* Simulated clock (sim_platform.c) */
+uint64_t SIM_Now( void );
+void SIM_Advance( uint64_t us );
+
+/* Power-on reset of volume snapshots (sim_platform.c) */
+void SIM_StateDrop( void );
+
+/* Card model (sim_card.c) */
+const SIM_CardTiming* SIM_CardProfile( const char* name );
+void SIM_CardProfiles( void );
+int SIM_CardInit( uint32_t sectors, const SIM_CardTiming* timing, uint32_t byte_ns, uint32_t au_sectors );
+uint8_t* SIM_CardData( void );
+uint32_t SIM_CardSectors( void );
+const SIM_CardStats* SIM_CardGetStats( void );
+void SIM_CardResetStats( void );
+uint32_t SIM_CardPending( void );
+const SIM_CardStats* SIM_Card2GetStats( void );	/* USE_SD_CARD2 builds */
+
+#endif /* SIM_H */
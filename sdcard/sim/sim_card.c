@@ -0,0 +1,485 @@
+/**
+ ******************************************************************************
+ * @file    sim_card.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   SD Card model behind the SD I/O interface for the host build.
+ *          Requests are executed at once on a RAM image and charge the
+ *          simulated clock like the SPI driver would spend them: command,
+ *          data token wait, block transfers at the SPI byte rate and BUSY
+ *          periods. With USE_SD_WRITE_STREAM consecutive writes continue one
+ *          multiple block write (no command, short BUSY between blocks), the
+ *          long BUSY is paid when the stream is closed by another request or
+ *          sync; a stream left open longer than SD I/O task does it is closed
+ *          in idle time at no cost to the caller. Discarded ranges are erased
+ *          in idle time too, so they are only counted.
+ *          With USE_SD_CARD2 (make RAID=1 or RAID=mirror) the 2nd card of
+ *          the array is another image behind the driver functions diskio.c
+ *          calls on SD_Card2; its transfers overlap the ones of the 1st card
+ *          on the other SPI bus, so they are counted, not timed.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "sim.h"
+#include "stm32_sd_spi.h"
+#include "stm32_sd_io.h"
+
+#include "FreeRTOS.h"
+#include "semphr.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+
+/* Command frame, response wait and R1 in bytes */
+#define SIM_CMD_BYTES			( 6 + 2 + 1 )
+
+/* Data block with its token and CRC */
+#define SIM_BLOCK_BYTES			( 1 + SD_BLOCK_SIZE + 2 )
+
+/* Card initialization (CMD0, ACMD41 loop, CSD/CID/SCR) in microseconds */
+#define SIM_INIT_US				100000
+
+/* SD I/O task closes streaming write if no request comes within this time (SD_IO_STREAM_IDLE_TICKS) */
+#define SIM_STREAM_IDLE_US		100000
+
+/* Speed class of the simulated card in Mb/s (SD_IO_SpeedClass) */
+#define SIM_SPEED_CLASS			10
+
+/* Private variables ---------------------------------------------------------*/
+
+/* Card models of the driver comments (sys/BSP/stm32_sd_spi.c), tries of SD_NUM_TRIES_READ/WRITE/ERASE,
+   the BUSY between blocks is the ~60 us of SD_NUM_TRIES_BUSY_FAST */
+static const SIM_CardTiming SIM_Profiles[] = {
+	/*  name        read  write  block     AU  erase */
+	{ "kingston4",   600,  6100,   120,     0,  6100 },
+	{ "lexar4",      300,  4600,   120,     0,  5200 },
+	{ "sp4",         900,  9000,   120, 80000, 10300 },	/* 80000 at times, 9000 usually */
+	{ "sandisk1",    300, 10000,   120,     0, 10000 },
+	{ "samsung8",    500,119000,   120,     0,120000 },
+};
+
+static uint8_t* SIM_Data;			/* card image */
+static uint32_t SIM_Sectors;		/* card size */
+static SIM_CardTiming SIM_Timing;
+static uint32_t SIM_ByteNs;			/* one byte on SPI bus (one "try") */
+static uint32_t SIM_AuSectors;		/* allocation unit */
+static uint8_t SIM_Ready;			/* SD_IO_INIT is done */
+static SIM_CardStats SIM_Stats;
+
+#ifdef USE_SD_WRITE_STREAM
+static uint8_t SIM_Streaming;		/* multiple block write is open */
+static uint32_t SIM_StreamNext;		/* sector which continues it */
+static uint64_t SIM_StreamTime;		/* end of its last request */
+static uint32_t SIM_StreamPending;	/* sectors written since it was opened */
+#endif /* USE_SD_WRITE_STREAM */
+
+#ifdef USE_SD_CARD2
+SD_Handle SD_Card2;
+static uint8_t* SIM_Data2;			/* image of the 2nd card, as large as the 1st one */
+static uint8_t SIM_Ready2;			/* SD_Init() is done */
+static SIM_CardStats SIM_Stats2;
+#endif /* USE_SD_CARD2 */
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Charges SPI bytes to the simulated clock
+ * @param  bytes: Number of bytes
+ * @retval None
+ */
+static void SIM_Bytes( uint64_t bytes )
+{
+	SIM_Advance( bytes * SIM_ByteNs / 1000 );
+}
+
+/**
+ * @brief  Charges BUSY period of the card
+ * @param  tries: BUSY length in byte times
+ * @retval None
+ */
+static void SIM_Busy( uint32_t tries )
+{
+	uint64_t us = (uint64_t)tries * SIM_ByteNs / 1000;
+
+	SIM_Advance( us );
+	SIM_Stats.BusyUs += us;
+}
+
+/**
+ * @brief  Ends multiple block write: stop token and the long BUSY
+ * @param  None
+ * @retval None
+ */
+static void SIM_StreamClose( void )
+{
+#ifdef USE_SD_WRITE_STREAM
+	if ( !SIM_Streaming )
+		return;
+	SIM_Streaming = 0;
+	SIM_StreamPending = 0;
+	if ( SIM_Now() - SIM_StreamTime >= SIM_STREAM_IDLE_US )
+		return;		/* closed by SD I/O task while it was idle */
+	SIM_Bytes( 2 );
+	SIM_Busy( SIM_Timing.WriteTries );
+#endif /* USE_SD_WRITE_STREAM */
+}
+
+/**
+ * @brief  Writes sectors, charging transfer and BUSY
+ * @param  sector: First sector
+ * @param  count: Number of sectors
+ * @retval None
+ */
+static void SIM_Write( uint32_t sector, uint32_t count )
+{
+	uint32_t i;
+
+#ifdef USE_SD_WRITE_STREAM
+	if ( !SIM_Streaming || sector != SIM_StreamNext || SIM_Now() - SIM_StreamTime >= SIM_STREAM_IDLE_US )
+	{
+		SIM_StreamClose();
+		SIM_Bytes( SIM_CMD_BYTES );
+		++SIM_Stats.Commands;
+		SIM_Streaming = 1;
+	}
+#else
+	SIM_Bytes( SIM_CMD_BYTES );
+	++SIM_Stats.Commands;
+#endif /* USE_SD_WRITE_STREAM */
+	for ( i = 0; i < count; ++i )
+	{
+		SIM_Bytes( SIM_BLOCK_BYTES );
+		if ( SIM_AuSectors != 0 && ( sector + i ) % SIM_AuSectors == 0 )
+			SIM_Busy( SIM_Timing.AuTries );
+		else if ( i + 1 < count )
+			SIM_Busy( SIM_Timing.BlockTries );
+	}
+#ifdef USE_SD_WRITE_STREAM
+	SIM_Busy( SIM_Timing.BlockTries );
+	SIM_StreamNext = sector + count;
+	SIM_StreamTime = SIM_Now();
+	SIM_StreamPending += count;
+#else
+	SIM_Busy( SIM_Timing.WriteTries );
+#endif /* USE_SD_WRITE_STREAM */
+}
+
+/**
+ * @brief  Reads sectors, charging command, token waits and transfer
+ * @param  count: Number of sectors
+ * @retval None
+ */
+static void SIM_Read( uint32_t count )
+{
+	SIM_StreamClose();
+	SIM_Bytes( SIM_CMD_BYTES + ( count > 1 ? SIM_CMD_BYTES : 0 ) );		/* CMD12 ends multiple block read */
+	++SIM_Stats.Commands;
+	SIM_Bytes( (uint64_t)count * ( SIM_Timing.ReadTries + SIM_BLOCK_BYTES ) );
+}
+
+/**
+ * @brief  Executes request on the card image
+ * @param  req: Request
+ * @retval The SD Response
+ */
+static SD_Error SIM_Execute( SD_IO_Request* req )
+{
+	SD_CardInfo* info;
+
+	if ( req->Op != SD_IO_INIT && !SIM_Ready )
+		return SD_RESPONSE_FAILURE;
+	switch ( req->Op )
+	{
+	case SD_IO_INIT:
+		if ( !SIM_Ready )
+			SIM_Advance( SIM_INIT_US );
+		SIM_Ready = 1;
+		return SD_RESPONSE_NO_ERROR;
+	case SD_IO_READ:
+		if ( req->Sector + req->Count > SIM_Sectors || req->Sector + req->Count < req->Sector )
+			return SD_ADDRESS_ERROR;
+		SIM_Read( req->Count );
+		memcpy( req->Buffer, SIM_Data + (uint64_t)req->Sector * SD_BLOCK_SIZE, (size_t)req->Count * SD_BLOCK_SIZE );
+		++SIM_Stats.Reads;
+		SIM_Stats.SectorsRead += req->Count;
+		return SD_RESPONSE_NO_ERROR;
+	case SD_IO_WRITE:
+		if ( req->Sector + req->Count > SIM_Sectors || req->Sector + req->Count < req->Sector )
+			return SD_ADDRESS_ERROR;
+		SIM_Write( req->Sector, req->Count );
+		memcpy( SIM_Data + (uint64_t)req->Sector * SD_BLOCK_SIZE, req->Buffer, (size_t)req->Count * SD_BLOCK_SIZE );
+		++SIM_Stats.Writes;
+		SIM_Stats.SectorsWritten += req->Count;
+		return SD_RESPONSE_NO_ERROR;
+	case SD_IO_ERASE:
+		SIM_StreamClose();
+		SIM_Bytes( 3 * SIM_CMD_BYTES );
+		SIM_Stats.Commands += 3;
+		SIM_Busy( SIM_Timing.EraseTries );
+		return SD_RESPONSE_NO_ERROR;
+	case SD_IO_INFO:
+		info = (SD_CardInfo*)req->Buffer;
+		memset( info, 0, sizeof( SD_CardInfo ) );
+		info->CardBlockSize = SD_BLOCK_SIZE;
+		info->CardCapacity = SIM_Sectors / 2;		/* Kbytes, as SD_CalcCardCapacity */
+		return SD_RESPONSE_NO_ERROR;
+	case SD_IO_SYNC:
+		SIM_StreamClose();
+		++SIM_Stats.Syncs;
+		return SD_RESPONSE_NO_ERROR;
+	case SD_IO_RECORD:
+		SIM_StreamClose();
+		SIM_Bytes( SIM_CMD_BYTES );		/* speed class control */
+		++SIM_Stats.Commands;
+		return ( (uint32_t)SIM_SPEED_CLASS * 1000000 >= req->Count ) ? SD_RESPONSE_NO_ERROR : SD_RESPONSE_FAILURE;
+	case SD_IO_VERIFY:
+		if ( req->Sector + req->Count > SIM_Sectors || req->Sector + req->Count < req->Sector )
+			return SD_ADDRESS_ERROR;
+		SIM_Read( req->Count );		/* blocks are clocked out as by a read */
+		++SIM_Stats.Reads;
+		SIM_Stats.SectorsRead += req->Count;
+		return memcmp( req->Buffer, SIM_Data + (uint64_t)req->Sector * SD_BLOCK_SIZE, (size_t)req->Count * SD_BLOCK_SIZE ) == 0 ?
+				SD_RESPONSE_NO_ERROR : SD_DATA_MISMATCH;
+	}
+	return SD_RESPONSE_FAILURE;
+}
+
+/* Public functions ----------------------------------------------------------*/
+
+/**
+ * @brief  Finds card model by name
+ * @param  name: Name of the model
+ * @retval Timing of the model, NULL if there is no such model
+ */
+const SIM_CardTiming* SIM_CardProfile( const char* name )
+{
+	uint32_t i;
+
+	for ( i = 0; i < sizeof( SIM_Profiles ) / sizeof( SIM_Profiles[ 0 ] ); ++i )
+	{
+		if ( strcmp( SIM_Profiles[ i ].Name, name ) == 0 )
+			return &SIM_Profiles[ i ];
+	}
+	return NULL;
+}
+
+/**
+ * @brief  Prints the card models
+ * @param  None
+ * @retval None
+ */
+void SIM_CardProfiles( void )
+{
+	uint32_t i;
+
+	for ( i = 0; i < sizeof( SIM_Profiles ) / sizeof( SIM_Profiles[ 0 ] ); ++i )
+		printf( "  %-10s read %6u  write %6u  block %4u  AU %6u  erase %6u tries\n", SIM_Profiles[ i ].Name,
+				SIM_Profiles[ i ].ReadTries, SIM_Profiles[ i ].WriteTries, SIM_Profiles[ i ].BlockTries,
+				SIM_Profiles[ i ].AuTries, SIM_Profiles[ i ].EraseTries );
+}
+
+/**
+ * @brief  Creates blank card image
+ * @param  sectors: Card size
+ * @param  timing: Card model
+ * @param  byte_ns: Duration of one SPI byte in nanoseconds
+ * @param  au_sectors: Allocation unit in sectors, 0 if the card has no AU penalty
+ * @retval Nonzero on success
+ */
+int SIM_CardInit( uint32_t sectors, const SIM_CardTiming* timing, uint32_t byte_ns, uint32_t au_sectors )
+{
+	SIM_Data = calloc( sectors, SD_BLOCK_SIZE );
+	if ( SIM_Data == NULL )
+		return 0;
+#ifdef USE_SD_CARD2
+	SIM_Data2 = calloc( sectors, SD_BLOCK_SIZE );
+	if ( SIM_Data2 == NULL )
+		return 0;
+#endif /* USE_SD_CARD2 */
+	SIM_Sectors = sectors;
+	SIM_Timing = *timing;
+	SIM_ByteNs = byte_ns;
+	SIM_AuSectors = au_sectors;
+	return 1;
+}
+
+uint8_t* SIM_CardData( void )
+{
+	return SIM_Data;
+}
+
+uint32_t SIM_CardSectors( void )
+{
+	return SIM_Sectors;
+}
+
+const SIM_CardStats* SIM_CardGetStats( void )
+{
+	return &SIM_Stats;
+}
+
+void SIM_CardResetStats( void )
+{
+	memset( &SIM_Stats, 0, sizeof( SIM_Stats ) );
+#ifdef USE_SD_CARD2
+	memset( &SIM_Stats2, 0, sizeof( SIM_Stats2 ) );
+#endif /* USE_SD_CARD2 */
+}
+
+/**
+ * @brief  Written sectors which are not on the card yet: the ones of the open
+ *         multiple block write (its stop token and BUSY are still due)
+ * @param  None
+ * @retval Number of sectors
+ */
+uint32_t SIM_CardPending( void )
+{
+#ifdef USE_SD_WRITE_STREAM
+	if ( SIM_Streaming && SIM_Now() - SIM_StreamTime < SIM_STREAM_IDLE_US )
+		return SIM_StreamPending;
+#endif /* USE_SD_WRITE_STREAM */
+	return 0;
+}
+
+#ifdef USE_SD_CARD2
+const SIM_CardStats* SIM_Card2GetStats( void )
+{
+	return &SIM_Stats2;
+}
+#endif /* USE_SD_CARD2 */
+
+/* SD I/O interface (stm32_sd_io.h) ------------------------------------------*/
+
+#ifdef USE_SD_IO_TASK
+void SD_IO_Init( void )
+{
+}
+#endif /* USE_SD_IO_TASK */
+
+void SD_IO_RequestInit( SD_IO_Request* req )
+{
+	memset( req, 0, sizeof( SD_IO_Request ) );
+	vSemaphoreCreateBinary( req->Done );
+	if ( req->Done != NULL )
+		xSemaphoreTake( req->Done, 0 );
+}
+
+SD_Error SD_IO_Submit( SD_IO_Request* req )
+{
+	if ( req->Done != NULL )
+		xSemaphoreTake( req->Done, 0 );
+	req->Result = SIM_Execute( req );
+	if ( req->Callback != NULL )
+		req->Callback( req );
+	if ( req->Done != NULL )
+		xSemaphoreGive( req->Done );
+	return SD_RESPONSE_NO_ERROR;
+}
+
+SD_Error SD_IO_Wait( SD_IO_Request* req, portTickType timeout )
+{
+	if ( req->Done == NULL || xSemaphoreTake( req->Done, timeout ) != pdTRUE )
+		return SD_RESPONSE_FAILURE;
+	return req->Result;
+}
+
+SD_Error SD_IO_Execute( SD_IO_Request* req )
+{
+	SD_IO_Submit( req );
+	return SD_IO_Wait( req, portMAX_DELAY );
+}
+
+SD_Error SD_IO_Discard( uint32_t sector, uint32_t count )
+{
+	if ( count == 0 || sector + count > SIM_Sectors )
+		return SD_RESPONSE_FAILURE;
+	++SIM_Stats.Discards;
+	return SD_RESPONSE_NO_ERROR;
+}
+
+uint8_t SD_IO_Detect( void )
+{
+	return ( SIM_Data != NULL ) ? SD_PRESENT : SD_NOT_PRESENT;
+}
+
+uint8_t SD_IO_Ready( void )
+{
+	return SIM_Ready;
+}
+
+uint32_t SD_IO_CardChanges( void )
+{
+	return 0;
+}
+
+uint32_t SD_IO_AuSize( void )
+{
+	return SIM_AuSectors;
+}
+
+uint8_t SD_IO_SpeedClass( void )
+{
+	return SIM_SPEED_CLASS;
+}
+
+#ifdef USE_SD_CARD2
+/* SD Card driver functions on SD_Card2 (stm32_sd_spi.h) ---------------------*/
+
+uint8_t SD_Detect( SD_Handle* hsd )
+{
+	return ( hsd == &SD_Card2 && SIM_Data2 != NULL ) ? SD_PRESENT : SD_NOT_PRESENT;
+}
+
+SD_Error SD_Init( SD_Handle* hsd )
+{
+	if ( SD_Detect( hsd ) != SD_PRESENT )
+		return SD_RESPONSE_FAILURE;
+	if ( !SIM_Ready2 )
+		SIM_Advance( SIM_INIT_US );
+	SIM_Ready2 = 1;
+	return SD_RESPONSE_NO_ERROR;
+}
+
+SD_Error SD_GetCardInfo( SD_Handle* hsd, SD_CardInfo *cardinfo )
+{
+	if ( SD_Detect( hsd ) != SD_PRESENT || !SIM_Ready2 )
+		return SD_RESPONSE_FAILURE;
+	memset( cardinfo, 0, sizeof( SD_CardInfo ) );
+	cardinfo->CardBlockSize = SD_BLOCK_SIZE;
+	cardinfo->CardCapacity = SIM_Sectors / 2;
+	return SD_RESPONSE_NO_ERROR;
+}
+
+SD_Error SD_SectorsRead( SD_Handle* hsd, uint32_t readAddr, uint8_t* pBuffer, uint32_t nbSectors )
+{
+	if ( SD_Detect( hsd ) != SD_PRESENT || !SIM_Ready2 )
+		return SD_RESPONSE_FAILURE;
+	if ( readAddr + nbSectors > SIM_Sectors || readAddr + nbSectors < readAddr )
+		return SD_ADDRESS_ERROR;
+	memcpy( pBuffer, SIM_Data2 + (uint64_t)readAddr * SD_BLOCK_SIZE, (size_t)nbSectors * SD_BLOCK_SIZE );
+	++SIM_Stats2.Commands;
+	++SIM_Stats2.Reads;
+	SIM_Stats2.SectorsRead += nbSectors;
+	return SD_RESPONSE_NO_ERROR;
+}
+
+SD_Error SD_SectorsWrite( SD_Handle* hsd, uint32_t writeAddr, const uint8_t* pBuffer, uint32_t nbSectors )
+{
+	if ( SD_Detect( hsd ) != SD_PRESENT || !SIM_Ready2 )
+		return SD_RESPONSE_FAILURE;
+	if ( writeAddr + nbSectors > SIM_Sectors || writeAddr + nbSectors < writeAddr )
+		return SD_ADDRESS_ERROR;
+	memcpy( SIM_Data2 + (uint64_t)writeAddr * SD_BLOCK_SIZE, pBuffer, (size_t)nbSectors * SD_BLOCK_SIZE );
+	++SIM_Stats2.Commands;
+	++SIM_Stats2.Writes;
+	SIM_Stats2.SectorsWritten += nbSectors;
+	return SD_RESPONSE_NO_ERROR;
+}
+#endif /* USE_SD_CARD2 */
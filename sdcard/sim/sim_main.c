@@ -0,0 +1,979 @@
+/**
+ ******************************************************************************
+ * @file    sim_main.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Host benchmark of the firmware FatFs + diskio stack (sector
+ *          cache, write policy, allocation) over the simulated SD Card.
+ *          The card is formatted as one FAT32 volume (-x: exFAT) without
+ *          partition table (-k: by f_mkfs of the firmware, partitioned and
+ *          aligned to the AU), workloads run on it and each phase reports
+ *          simulated time, throughput and card/cache counters, so two
+ *          builds of ff.c or diskio.c are compared by the same numbers on
+ *          every run. The sync workload (-w sync, not part of all) checks
+ *          that f_sync leaves no written sector buffered on a card, with
+ *          the array builds (make RAID=1 or RAID=mirror) on both of them.
+ *
+ *            make -C sim && sim/sdsim -c samsung8 -w log -m 16
+ *            sim/sdsim -l                            (card models)
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "sim.h"
+
+#include "ff.h"
+#include "diskio.h"
+#ifdef USE_FAT_PACK
+#include "ffpack.h"
+#endif /* USE_FAT_PACK */
+#ifdef USE_FAT_TABLE
+#include "fftable.h"
+#endif /* USE_FAT_TABLE */
+#ifdef USE_FAT_KV
+#include "ffkv.h"
+#endif /* USE_FAT_KV */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Private define ------------------------------------------------------------*/
+
+/* Sector of the volume: card blocks of diskio (DISK_BLOCKS of them) */
+#define SIM_SECTOR				_MAX_SS
+
+/* Default card: 256 Mb, SPI at 15 MHz (30 MHz APB1 / 2), AU of 4 Mb */
+#define SIM_DEFAULT_CARD		"kingston4"
+#define SIM_DEFAULT_MB			256
+#define SIM_DEFAULT_BYTE_NS		533
+#define SIM_DEFAULT_AU			8192
+
+/* Chunk of f_write/f_read calls of the file workload */
+#define SIM_CHUNK				4096
+
+/* Files appended at the same time by the streams workload */
+#define SIM_STREAMS				4
+
+/* Keys and size of the store of the key-value workload */
+#define SIM_KV_KEYS				300
+#define SIM_KV_BYTES			( 128 * 1024 )
+
+/* Private variables ---------------------------------------------------------*/
+
+static FATFS SIM_Fs;
+static FIL SIM_File;
+static uint8_t SIM_Buffer[ SIM_CHUNK ];
+
+static uint64_t SIM_PhaseTime;
+static SIM_CardStats SIM_PhaseStats;
+
+/* Private functions ---------------------------------------------------------*/
+
+static void SIM_Put16( uint8_t* p, uint16_t v )
+{
+	p[ 0 ] = (uint8_t)v;
+	p[ 1 ] = (uint8_t)( v >> 8 );
+}
+
+static void SIM_Put32( uint8_t* p, uint32_t v )
+{
+	SIM_Put16( p, (uint16_t)v );
+	SIM_Put16( p + 2, (uint16_t)( v >> 16 ) );
+}
+
+static uint32_t SIM_Get16( const uint8_t* p )
+{
+	return p[ 0 ] | ( p[ 1 ] << 8 );
+}
+
+static uint32_t SIM_Get32( const uint8_t* p )
+{
+	return SIM_Get16( p ) | ( SIM_Get16( p + 2 ) << 16 );
+}
+
+/**
+ * @brief  Formats the card image as FAT32 volume without partition table
+ *         (fixed layout of the reference numbers, -k runs f_mkfs instead)
+ * @param  None
+ * @retval Nonzero on success
+ */
+static int SIM_Format( void )
+{
+	uint8_t* d = SIM_CardData();
+	uint32_t total = SIM_CardSectors() / DISK_BLOCKS;
+	uint32_t rsv = 32, spc = 1, fatsz = 0, clusters = 0, prev, data;
+	uint8_t* bs;
+	uint8_t* fat;
+	int i;
+
+	/* the largest cluster (up to 32K) keeping FAT32 above 65525 clusters */
+	while ( spc * SIM_SECTOR < 32768 && total / ( spc * 2 ) > 65525 + 1024 )
+		spc *= 2;
+	do
+	{
+		prev = fatsz;
+		data = total - rsv - 2 * fatsz;
+		clusters = data / spc;
+		fatsz = ( ( clusters + 2 ) * 4 + SIM_SECTOR - 1 ) / SIM_SECTOR;
+	} while ( fatsz != prev );
+	if ( clusters < 65526 )
+		return 0;
+
+	bs = d;
+	bs[ 0 ] = 0xEB; bs[ 1 ] = 0x58; bs[ 2 ] = 0x90;
+	memcpy( bs + 3, "SIMFAT  ", 8 );
+	SIM_Put16( bs + 11, SIM_SECTOR );
+	bs[ 13 ] = (uint8_t)spc;
+	SIM_Put16( bs + 14, (uint16_t)rsv );
+	bs[ 16 ] = 2;						/* number of FATs */
+	bs[ 21 ] = 0xF8;					/* media */
+	SIM_Put16( bs + 24, 63 );
+	SIM_Put16( bs + 26, 255 );
+	SIM_Put32( bs + 32, total );
+	SIM_Put32( bs + 36, fatsz );
+	SIM_Put32( bs + 44, 2 );			/* root directory cluster */
+	SIM_Put16( bs + 48, 1 );			/* FSInfo sector */
+	SIM_Put16( bs + 50, 6 );			/* backup boot sector */
+	bs[ 64 ] = 0x80;
+	bs[ 66 ] = 0x29;
+	SIM_Put32( bs + 67, 0x53494D30 );
+	memcpy( bs + 71, "NO NAME    FAT32   ", 19 );
+	bs[ 510 ] = 0x55; bs[ 511 ] = 0xAA;
+	memcpy( d + 6 * SIM_SECTOR, bs, SIM_SECTOR );
+
+	bs = d + SIM_SECTOR;				/* FSInfo: counts are unknown, FatFs scans the FAT */
+	SIM_Put32( bs, 0x41615252 );
+	SIM_Put32( bs + 484, 0x61417272 );
+	SIM_Put32( bs + 488, 0xFFFFFFFF );
+	SIM_Put32( bs + 492, 0xFFFFFFFF );
+	SIM_Put32( bs + 508, 0xAA550000 );
+
+	for ( i = 0; i < 2; ++i )
+	{
+		fat = d + (uint64_t)( rsv + i * fatsz ) * SIM_SECTOR;
+		SIM_Put32( fat, 0x0FFFFFF8 );
+		SIM_Put32( fat + 4, 0x0FFFFFFF );
+		SIM_Put32( fat + 8, 0x0FFFFFFF );	/* root directory */
+	}
+	printf( "FAT32 : %u clusters of %u sectors, FAT of %u sectors\n", clusters, spc, fatsz );
+	return 1;
+}
+
+/**
+ * @brief  Formats the card image as exFAT volume without partition table:
+ *         allocation bitmap, up-case table (ASCII only) and root directory
+ *         in the first clusters, 32K clusters
+ * @param  None
+ * @retval Nonzero on success
+ */
+static int SIM_FormatExFat( void )
+{
+	uint8_t* d = SIM_CardData();
+	uint32_t total = SIM_CardSectors() / DISK_BLOCKS;
+	uint32_t spc = 32768 / SIM_SECTOR, fatofs = 24, fatsz, heap, clusters, bmclust, i, sum;
+	uint8_t shift, *ent, *p;
+	uint8_t* upcase;
+
+	for ( shift = 0; ( 1u << shift ) < SIM_SECTOR; ++shift )
+		;
+	clusters = ( total - fatofs ) / spc;
+	fatsz = ( ( clusters + 2 ) * 4 + SIM_SECTOR - 1 ) / SIM_SECTOR;
+	heap = ( fatofs + fatsz + spc - 1 ) / spc * spc;
+	clusters = ( total - heap ) / spc;
+	bmclust = ( ( clusters + 7 ) / 8 + spc * SIM_SECTOR - 1 ) / ( spc * SIM_SECTOR );
+	if ( clusters < 16 )
+		return 0;
+
+	p = d;								/* main boot region: boot sector, 8 extended boot sectors, OEM, reserved, checksum */
+	p[ 0 ] = 0xEB; p[ 1 ] = 0x76; p[ 2 ] = 0x90;
+	memcpy( p + 3, "EXFAT   ", 8 );
+	SIM_Put32( p + 72, total );
+	SIM_Put32( p + 80, fatofs );
+	SIM_Put32( p + 84, fatsz );
+	SIM_Put32( p + 88, heap );
+	SIM_Put32( p + 92, clusters );
+	SIM_Put32( p + 96, 2 + bmclust + 1 );	/* root directory after bitmap and up-case table */
+	SIM_Put32( p + 100, 0x53494D30 );
+	SIM_Put16( p + 104, 0x0100 );
+	p[ 108 ] = shift;
+	p[ 109 ] = (uint8_t)( 15 - shift );
+	p[ 110 ] = 1;
+	p[ 111 ] = 0x80;
+	p[ 510 ] = 0x55; p[ 511 ] = 0xAA;
+	for ( i = 1; i <= 8; ++i )
+		SIM_Put32( d + i * SIM_SECTOR + SIM_SECTOR - 4, 0xAA550000 );
+	for ( i = sum = 0; i < 11 * SIM_SECTOR; ++i )
+	{
+		if ( i == 106 || i == 107 || i == 112 )
+			continue;
+		sum = ( ( sum & 1 ) ? 0x80000000 : 0 ) + ( sum >> 1 ) + d[ i ];
+	}
+	for ( i = 0; i < SIM_SECTOR; i += 4 )
+		SIM_Put32( d + 11 * SIM_SECTOR + i, sum );
+	memcpy( d + 12 * SIM_SECTOR, d, 12 * SIM_SECTOR );	/* backup boot region */
+
+	p = d + (uint64_t)fatofs * SIM_SECTOR;
+	SIM_Put32( p, 0xFFFFFFF8 );
+	SIM_Put32( p + 4, 0xFFFFFFFF );
+	for ( i = 2; i < 2 + bmclust; ++i )	/* bitmap, up-case table and root have FAT chains */
+		SIM_Put32( p + i * 4, ( i + 1 < 2 + bmclust ) ? i + 1 : 0xFFFFFFFF );
+	SIM_Put32( p + ( 2 + bmclust ) * 4, 0xFFFFFFFF );
+	SIM_Put32( p + ( 3 + bmclust ) * 4, 0xFFFFFFFF );
+
+	p = d + (uint64_t)heap * SIM_SECTOR;	/* bitmap */
+	for ( i = 0; i < bmclust + 2; ++i )
+		p[ i / 8 ] |= (uint8_t)( 1 << ( i % 8 ) );
+
+	upcase = d + (uint64_t)( heap + bmclust * spc ) * SIM_SECTOR;
+	for ( i = sum = 0; i < 128; ++i )
+	{
+		SIM_Put16( upcase + i * 2, (uint16_t)( ( i >= 'a' && i <= 'z' ) ? i - 0x20 : i ) );
+		sum = ( ( sum & 1 ) ? 0x80000000 : 0 ) + ( sum >> 1 ) + upcase[ i * 2 ];
+		sum = ( ( sum & 1 ) ? 0x80000000 : 0 ) + ( sum >> 1 ) + upcase[ i * 2 + 1 ];
+	}
+
+	ent = d + (uint64_t)( heap + ( bmclust + 1 ) * spc ) * SIM_SECTOR;	/* root: label, bitmap, up-case table */
+	ent[ 0 ] = 0x83;					/* empty volume label */
+	ent[ 32 ] = 0x81;
+	SIM_Put32( ent + 32 + 20, 2 );
+	SIM_Put32( ent + 32 + 24, ( clusters + 7 ) / 8 );
+	ent[ 64 ] = 0x82;
+	SIM_Put32( ent + 64 + 4, sum );
+	SIM_Put32( ent + 64 + 20, 2 + bmclust );
+	SIM_Put32( ent + 64 + 24, 256 );
+	printf( "exFAT : %u clusters of %u sectors, FAT of %u sectors\n", clusters, spc, fatsz );
+	return 1;
+}
+
+/**
+ * @brief  Starts measurement of a phase
+ * @param  None
+ * @retval None
+ */
+static void SIM_PhaseBegin( void )
+{
+	SIM_PhaseTime = SIM_Now();
+	SIM_PhaseStats = *SIM_CardGetStats();
+#if _FS_STATS
+	f_getstats( NULL, 1 );
+#endif /* _FS_STATS */
+}
+
+/**
+ * @brief  Prints results of a phase
+ * @param  name: Phase name
+ * @param  bytes: Payload moved by the phase
+ * @retval None
+ */
+static void SIM_PhaseEnd( const char* name, uint64_t bytes )
+{
+	const SIM_CardStats* s = SIM_CardGetStats();
+	uint64_t us = SIM_Now() - SIM_PhaseTime;
+#ifdef USE_DISK_CACHE
+	DWORD cache[ 3 ];
+#endif /* USE_DISK_CACHE */
+#if _FS_STATS
+	static const char* const names[ FFS_COUNT ] = { FFS_NAMES };
+	FFSTAT stats[ FFS_COUNT ];
+	int i;
+#endif /* _FS_STATS */
+
+	if ( us == 0 )
+		us = 1;
+	printf( "%-12s %9.1f ms %9.1f KB/s  cmd %6u  rd %6u/%-8llu wr %6u/%-8llu sync %4u  discard %4u  busy %8.1f ms\n",
+			name, us / 1000.0, bytes * 1000000.0 / 1024 / us,
+			s->Commands - SIM_PhaseStats.Commands,
+			s->Reads - SIM_PhaseStats.Reads, (unsigned long long)( s->SectorsRead - SIM_PhaseStats.SectorsRead ),
+			s->Writes - SIM_PhaseStats.Writes, (unsigned long long)( s->SectorsWritten - SIM_PhaseStats.SectorsWritten ),
+			s->Syncs - SIM_PhaseStats.Syncs, s->Discards - SIM_PhaseStats.Discards,
+			( s->BusyUs - SIM_PhaseStats.BusyUs ) / 1000.0 );
+#ifdef USE_DISK_CACHE
+	if ( disk_ioctl( 0, CTRL_CACHE_STATS, cache ) == RES_OK )
+		printf( "%-12s cache %u hits, %u misses so far\n", "", (unsigned)cache[ 0 ], (unsigned)cache[ 1 ] );
+#endif /* USE_DISK_CACHE */
+#if _FS_STATS
+	f_getstats( stats, 0 );
+	for ( i = 0; i < FFS_COUNT; ++i )
+	{
+		if ( stats[ i ].calls )
+			printf( "%-12s %-14s %8u calls %8u sectors %10.1f ms\n", "", names[ i ], (unsigned)stats[ i ].calls,
+					(unsigned)stats[ i ].sectors, stats[ i ].cycles / 120000.0 );
+	}
+#endif /* _FS_STATS */
+}
+
+#if _USE_MKFS
+/**
+ * @brief  Formats the card by f_mkfs of the firmware (partition table, automatic
+ *         cluster size, layout aligned to the AU) and prints the layout
+ * @param  None
+ * @retval FatFs result
+ */
+static FRESULT SIM_Mkfs( void )
+{
+#ifdef USE_SD_RAID
+	static uint8_t d[ 2 * SIM_SECTOR ];	/* sectors of the array are spread over the card images */
+#else
+	const uint8_t* d = SIM_CardData();
+#endif /* USE_SD_RAID */
+	const uint8_t* bs;
+	uint32_t vol, rsv, fatsz, dir, fat32;
+	FRESULT res;
+
+	SIM_PhaseBegin();
+	res = f_mkfs( 0, 0, 0 );
+	SIM_PhaseEnd( "mkfs", 0 );
+	if ( res != FR_OK )
+		return res;
+
+#ifdef USE_SD_RAID
+	if ( disk_read( 0, d, 0, 1 ) != RES_OK )
+		return FR_DISK_ERR;
+	vol = SIM_Get32( d + 446 + 8 );
+	if ( disk_read( 0, d + SIM_SECTOR, vol, 1 ) != RES_OK )
+		return FR_DISK_ERR;
+	bs = d + SIM_SECTOR;
+#else
+	vol = SIM_Get32( d + 446 + 8 );
+	bs = d + (uint64_t)vol * SIM_SECTOR;
+#endif /* USE_SD_RAID */
+	rsv = SIM_Get16( bs + 14 );
+	fat32 = ( SIM_Get16( bs + 22 ) == 0 );
+	fatsz = fat32 ? SIM_Get32( bs + 36 ) : SIM_Get16( bs + 22 );
+	dir = SIM_Get16( bs + 17 ) * 32 / SIM_SECTOR;
+	printf( "%.5s : %u sectors per cluster, partition at %u, FAT at %u (%u sectors), data at %u\n",
+			bs + ( fat32 ? 82 : 54 ), bs[ 13 ], vol, vol + rsv, fatsz, vol + rsv + bs[ 16 ] * fatsz + dir );
+	return FR_OK;
+}
+#endif /* _USE_MKFS */
+
+/**
+ * @brief  Mount after a reset: the first access mounts the volume
+ * @param  name: Phase name
+ * @param  warm: Nonzero to keep volume snapshots (warm reset), zero to drop them (power-on)
+ * @retval FatFs result
+ */
+static FRESULT SIM_MountPhase( const char* name, int warm )
+{
+	FRESULT res;
+#ifdef USE_DISK_CACHE
+	DWORD range[ 2 ] = { 0, 0xFFFFFFFF };
+
+	disk_ioctl( 0, CTRL_CACHE_DROP, range );	/* RAM is lost by the reset */
+#endif /* USE_DISK_CACHE */
+	if ( !warm )
+		SIM_StateDrop();
+	f_mount( 0, &SIM_Fs );
+	SIM_PhaseBegin();
+	res = f_open( &SIM_File, "", FA_READ | FA_OPEN_EXISTING );	/* mounts, but looks nothing up */
+	SIM_PhaseEnd( name, 0 );
+	if ( res == FR_INVALID_NAME )
+		res = FR_OK;
+	f_mount( 0, NULL );
+	return res;
+}
+
+/**
+ * @brief  Data logger: fixed size records appended to one file, synced periodically
+ * @param  total: Bytes to log
+ * @param  record: Record size
+ * @param  sync: Records between f_sync calls, 0 for none
+ * @retval FatFs result
+ */
+static FRESULT SIM_LogWorkload( uint64_t total, UINT record, UINT sync )
+{
+	FRESULT res;
+	uint64_t done = 0;
+	UINT n, count = 0;
+
+	if ( record == 0 || record > sizeof( SIM_Buffer ) )
+		return FR_INVALID_PARAMETER;
+	SIM_PhaseBegin();
+	res = f_open( &SIM_File, "LOG.BIN", FA_WRITE | FA_CREATE_ALWAYS );
+	while ( res == FR_OK && done < total )
+	{
+		memset( SIM_Buffer, (BYTE)count, record );
+		res = f_write( &SIM_File, SIM_Buffer, record, &n );
+		if ( res == FR_OK && n != record )
+			res = FR_DENIED;
+		done += record;
+		if ( res == FR_OK && sync != 0 && ++count % sync == 0 )
+			res = f_sync( &SIM_File );
+	}
+	if ( res == FR_OK )
+		res = f_close( &SIM_File );
+	SIM_PhaseEnd( "log write", done );
+	return res;
+}
+
+/**
+ * @brief  Sync check: records appended to one file, each one synced; no written sector
+ *         may be left buffered on a card (open multiple block write) when f_sync returns,
+ *         then the file is read back
+ * @param  total: Bytes to write
+ * @param  record: Record size
+ * @retval FatFs result, FR_DISK_ERR if a sync was not done or the data differ
+ */
+static FRESULT SIM_SyncWorkload( uint64_t total, UINT record )
+{
+	FRESULT res;
+	uint64_t done = 0;
+	uint32_t syncs, left = 0, count = 0, wrong = 0;
+	UINT n, i;
+
+	if ( record == 0 || record > sizeof( SIM_Buffer ) )
+		return FR_INVALID_PARAMETER;
+	SIM_PhaseBegin();
+	res = f_open( &SIM_File, "SYNC.BIN", FA_WRITE | FA_CREATE_ALWAYS );
+	while ( res == FR_OK && done < total )
+	{
+		memset( SIM_Buffer, (BYTE)count++, record );
+		res = f_write( &SIM_File, SIM_Buffer, record, &n );
+		if ( res == FR_OK && n != record )
+			res = FR_DENIED;
+		done += record;
+		syncs = SIM_CardGetStats()->Syncs;
+		if ( res == FR_OK )
+			res = f_sync( &SIM_File );
+		if ( res == FR_OK && ( SIM_CardGetStats()->Syncs == syncs || SIM_CardPending() != 0 ) )
+			++left;
+	}
+	if ( res == FR_OK )
+		res = f_close( &SIM_File );
+	SIM_PhaseEnd( "sync write", done );
+	if ( res != FR_OK )
+		return res;
+
+	SIM_PhaseBegin();
+	res = f_open( &SIM_File, "SYNC.BIN", FA_READ );
+	for ( count = 0; res == FR_OK && (uint64_t)count * record < done; ++count )
+	{
+		res = f_read( &SIM_File, SIM_Buffer, record, &n );
+		if ( res == FR_OK && n != record )
+			res = FR_DENIED;
+		for ( i = 0; res == FR_OK && i < record; ++i )
+		{
+			if ( SIM_Buffer[ i ] != (BYTE)count )
+			{
+				++wrong;
+				break;
+			}
+		}
+	}
+	if ( res == FR_OK )
+		res = f_close( &SIM_File );
+	SIM_PhaseEnd( "sync read", done );
+#ifdef USE_SD_CARD2
+	printf( "%-12s 2nd card: %u reads (%u sectors), %u writes (%u sectors)\n", "",
+			(unsigned)SIM_Card2GetStats()->Reads, (unsigned)SIM_Card2GetStats()->SectorsRead,
+			(unsigned)SIM_Card2GetStats()->Writes, (unsigned)SIM_Card2GetStats()->SectorsWritten );
+#endif /* USE_SD_CARD2 */
+	printf( "%-12s %s: %u of %u syncs left sectors buffered, %u records differ\n", "",
+			( left == 0 && wrong == 0 ) ? "ok" : "failed", left, count, wrong );
+	if ( res == FR_OK && ( left != 0 || wrong != 0 ) )
+		res = FR_DISK_ERR;
+	return res;
+}
+
+/**
+ * @brief  Many files: written in chunks, then read back
+ * @param  total: Bytes of all files
+ * @param  size: Size of each file
+ * @retval FatFs result
+ */
+static FRESULT SIM_FilesWorkload( uint64_t total, uint32_t size )
+{
+	FRESULT res = FR_OK;
+	TCHAR name[ 16 ];
+	uint32_t files = (uint32_t)( total / size ), i, j;
+	UINT n;
+
+	SIM_PhaseBegin();
+	for ( i = 0; i < files && res == FR_OK; ++i )
+	{
+		snprintf( name, sizeof( name ), "F%04u.BIN", i );
+		res = f_open( &SIM_File, name, FA_WRITE | FA_CREATE_ALWAYS );
+		for ( j = 0; j < size && res == FR_OK; j += n )
+		{
+			res = f_write( &SIM_File, SIM_Buffer, ( size - j < SIM_CHUNK ) ? size - j : SIM_CHUNK, &n );
+			if ( res == FR_OK && n == 0 )
+				res = FR_DENIED;
+		}
+		if ( res == FR_OK )
+			res = f_close( &SIM_File );
+	}
+	SIM_PhaseEnd( "files write", (uint64_t)i * size );
+	if ( res != FR_OK )
+		return res;
+
+	SIM_PhaseBegin();
+	for ( i = 0; i < files && res == FR_OK; ++i )
+	{
+		snprintf( name, sizeof( name ), "F%04u.BIN", i );
+		res = f_open( &SIM_File, name, FA_READ );
+		for ( j = 0; j < size && res == FR_OK; j += n )
+		{
+			res = f_read( &SIM_File, SIM_Buffer, SIM_CHUNK, &n );
+			if ( res == FR_OK && n == 0 )
+				res = FR_DENIED;
+		}
+		if ( res == FR_OK )
+			res = f_close( &SIM_File );
+	}
+	SIM_PhaseEnd( "files read", (uint64_t)i * size );
+	return res;
+}
+
+/**
+ * @brief  Concurrent streams: files appended in turns by chunks, then each read back
+ * @param  total: Bytes of all files
+ * @param  streams: Number of files (up to SIM_STREAMS)
+ * @retval FatFs result
+ */
+static FRESULT SIM_StreamsWorkload( uint64_t total, uint32_t streams )
+{
+	static FIL files[ SIM_STREAMS ];
+	FRESULT res = FR_OK;
+	TCHAR name[ 16 ];
+	uint64_t done = 0;
+	uint32_t i;
+	UINT n;
+
+	if ( streams == 0 || streams > SIM_STREAMS )
+		return FR_INVALID_PARAMETER;
+	SIM_PhaseBegin();
+	for ( i = 0; i < streams && res == FR_OK; ++i )
+	{
+		snprintf( name, sizeof( name ), "S%u.BIN", i );
+		res = f_open( &files[ i ], name, FA_WRITE | FA_CREATE_ALWAYS );
+	}
+	for ( i = 0; res == FR_OK && done < total; i = ( i + 1 ) % streams, done += SIM_CHUNK )
+	{
+		res = f_write( &files[ i ], SIM_Buffer, SIM_CHUNK, &n );
+		if ( res == FR_OK && n != SIM_CHUNK )
+			res = FR_DENIED;
+	}
+	for ( i = 0; i < streams && res == FR_OK; ++i )
+		res = f_close( &files[ i ] );
+	SIM_PhaseEnd( "streams wr", done );
+	if ( res != FR_OK )
+		return res;
+
+	SIM_PhaseBegin();
+	for ( i = 0; i < streams && res == FR_OK; ++i )
+	{
+		snprintf( name, sizeof( name ), "S%u.BIN", i );
+		res = f_open( &SIM_File, name, FA_READ );
+		while ( res == FR_OK )
+		{
+			res = f_read( &SIM_File, SIM_Buffer, SIM_CHUNK, &n );
+			if ( n == 0 )
+				break;
+		}
+		if ( res == FR_OK )
+			res = f_close( &SIM_File );
+	}
+	SIM_PhaseEnd( "streams rd", done );
+	return res;
+}
+
+#ifdef USE_FAT_PACK
+/**
+ * @brief  Packed logs: sensor samples (slow wave and noise) as 32-bit words through delta
+ *         coding, the same samples as CSV text lines through LZ4
+ * @param  total: Raw bytes of each log
+ * @retval FatFs result
+ */
+static FRESULT SIM_PackWorkload( uint64_t total )
+{
+	static const char* const names[ 2 ] = { "PACK.DLT", "PACK.LZ4" };
+	static const uint8_t codecs[ 2 ] = { PACK_DELTA, PACK_LZ4 };
+	PACK_Stream ps;
+	FRESULT res = FR_OK;
+	uint32_t seed = 1, t, i, len;
+	int32_t v;
+	uint8_t k;
+
+	for ( k = 0; k < 2 && res == FR_OK; ++k )
+	{
+		memset( &ps, 0, sizeof( ps ) );
+		SIM_PhaseBegin();
+		res = f_open( &SIM_File, names[ k ], FA_WRITE | FA_CREATE_ALWAYS );
+		if ( res == FR_OK )
+			res = PACK_Open( &ps, &SIM_File, codecs[ k ] );
+		for ( t = 0; res == FR_OK && ps.Raw < total; t += SIM_CHUNK / 4 )
+		{
+			for ( i = 0, len = 0; i < SIM_CHUNK / 4 && len + 32 <= SIM_CHUNK; ++i )
+			{
+				seed = seed * 1103515245 + 12345;
+				v = (int32_t)( ( t + i ) % 2000 ) - 1000;		/* sawtooth */
+				v = ( v < 0 ? -v : v ) + (int32_t)( ( seed >> 16 ) & 7 );
+				if ( codecs[ k ] == PACK_DELTA )
+				{
+					SIM_Put32( SIM_Buffer + len, (uint32_t)v );
+					len += 4;
+				}
+				else
+					len += snprintf( (char*)SIM_Buffer + len, SIM_CHUNK - len, "t=%u adc=%d st=ok\n", t + i, (int)v );
+			}
+			res = PACK_Write( &ps, SIM_Buffer, len );
+		}
+		if ( res == FR_OK )
+			res = PACK_Close( &ps );
+		else if ( ps.In != NULL )
+			PACK_Close( &ps );
+		if ( res == FR_OK )
+			res = f_close( &SIM_File );
+		SIM_PhaseEnd( ( k == 0 ) ? "pack delta" : "pack lz4", ps.Raw );
+		if ( res == FR_OK )
+			printf( "%-12s %u bytes -> %u sectors, ratio %.2f\n", "", (unsigned)ps.Raw, (unsigned)ps.Sectors,
+					(double)ps.Raw / ( ps.Sectors * PACK_SECTOR ) );
+	}
+	return res;
+}
+#endif /* USE_FAT_PACK */
+
+#if _USE_VIEW
+/**
+ * @brief  Lookup table: file of 16-byte records written once, then scanned by f_read into
+ *         a buffer and by f_view in place, both scans have to see the same records
+ * @param  size: Size of the table in bytes
+ * @retval FatFs result
+ */
+static FRESULT SIM_ViewWorkload( uint32_t size )
+{
+	FRESULT res;
+	FVIEW view;
+	uint32_t sum[ 2 ] = { 0, 0 }, i, j;
+	UINT n;
+	uint8_t k;
+
+	SIM_PhaseBegin();
+	res = f_open( &SIM_File, "TABLE.BIN", FA_WRITE | FA_CREATE_ALWAYS );
+	for ( i = 0; res == FR_OK && i < size; i += n )
+	{
+		for ( j = 0; j < SIM_CHUNK; j += 16 )
+		{
+			SIM_Put32( SIM_Buffer + j, ( i + j ) / 16 );
+			SIM_Put32( SIM_Buffer + j + 4, ( i + j ) * 2654435761u );
+			memset( SIM_Buffer + j + 8, 0, 8 );
+		}
+		res = f_write( &SIM_File, SIM_Buffer, ( size - i < SIM_CHUNK ) ? size - i : SIM_CHUNK, &n );
+		if ( res == FR_OK && n == 0 )
+			res = FR_DENIED;
+	}
+	if ( res == FR_OK )
+		res = f_close( &SIM_File );
+	SIM_PhaseEnd( "table write", size );
+
+	for ( k = 0; k < 2 && res == FR_OK; ++k )
+	{
+		SIM_PhaseBegin();
+		res = f_open( &SIM_File, "TABLE.BIN", FA_READ );
+		while ( res == FR_OK )
+		{
+			if ( k == 0 )
+			{
+				res = f_read( &SIM_File, SIM_Buffer, SIM_SECTOR, &n );
+				for ( j = 0; res == FR_OK && j + 16 <= n; j += 16 )
+					sum[ k ] += SIM_Get32( SIM_Buffer + j ) ^ SIM_Get32( SIM_Buffer + j + 4 );
+			}
+			else
+			{
+				res = f_view( &SIM_File, &view, SIM_SECTOR, &n );
+				for ( j = 0; res == FR_OK && j + 16 <= n; j += 16 )
+					sum[ k ] += SIM_Get32( view.data + j ) ^ SIM_Get32( view.data + j + 4 );
+				if ( res == FR_OK )
+					res = f_unview( &view );
+			}
+			if ( n == 0 )
+				break;
+		}
+		if ( res == FR_OK )
+			res = f_close( &SIM_File );
+		SIM_PhaseEnd( ( k == 0 ) ? "table read" : "table view", size );
+	}
+	if ( res == FR_OK && sum[ 0 ] != sum[ 1 ] )
+	{
+		printf( "%-12s records differ: 0x%08X read, 0x%08X mapped\n", "", (unsigned)sum[ 0 ], (unsigned)sum[ 1 ] );
+		res = FR_INT_ERR;
+	}
+	return res;
+}
+#endif /* _USE_VIEW */
+
+#ifdef USE_FAT_TABLE
+/**
+ * @brief  Lookup table: sorted 8-byte records (key, value) built by TABLE_Append, then random
+ *         lookups of present and absent keys with the full index and with every 8th sector
+ *         in it, the values found have to match the keys
+ * @param  records: Number of records
+ * @param  lookups: Number of lookups of each pass
+ * @retval FatFs result
+ */
+static FRESULT SIM_TableWorkload( uint32_t records, uint32_t lookups )
+{
+	FRESULT res;
+	TABLE_File table;
+	uint32_t len = TABLE_IndexLen( 8, records );
+	uint32_t* index = (uint32_t*)malloc( len * sizeof( uint32_t ) );
+	uint32_t i, key, seed = 1;
+	uint8_t rec[ 8 ], k;
+
+	if ( index == NULL )
+		return FR_NOT_ENOUGH_CORE;
+	SIM_PhaseBegin();
+	res = TABLE_Create( &table, "CALIB.TBL", 8, index, len );
+	for ( i = 0; res == FR_OK && i < records; ++i )
+	{	/* keys 0, 3, 6, ...: the key between two of them is absent */
+		SIM_Put32( rec, i * 3 );
+		SIM_Put32( rec + 4, i * 3 * 2654435761u );
+		res = TABLE_Append( &table, rec );
+	}
+	if ( res == FR_OK )
+		res = TABLE_Close( &table );
+	SIM_PhaseEnd( "table build", (uint64_t)records * 8 );
+
+	for ( k = 0; k < 2 && res == FR_OK; ++k )
+	{
+		SIM_PhaseBegin();
+		res = TABLE_Open( &table, "CALIB.TBL", index, ( k == 0 ) ? len : ( len + 7 ) / 8 );
+		for ( i = 0; res == FR_OK && i < lookups; ++i )
+		{
+			seed = seed * 1103515245 + 12345;
+			key = ( seed >> 8 ) % ( records * 3 );
+			res = TABLE_Find( &table, key, rec, 1 );
+			if ( key % 3 != 0 && res == FR_NO_FILE )
+				res = TABLE_Find( &table, key, rec, 0 );
+			if ( res == FR_OK && ( SIM_Get32( rec ) != key - key % 3 ||
+					SIM_Get32( rec + 4 ) != SIM_Get32( rec ) * 2654435761u ) )
+			{
+				printf( "%-12s wrong record of key %u: key %u\n", "", (unsigned)key, (unsigned)SIM_Get32( rec ) );
+				res = FR_INT_ERR;
+			}
+		}
+		if ( res == FR_OK )
+			res = TABLE_Close( &table );
+		SIM_PhaseEnd( ( k == 0 ) ? "table find" : "table sparse", 0 );
+	}
+	free( index );
+	return res;
+}
+#endif /* USE_FAT_TABLE */
+
+#ifdef USE_FAT_KV
+/**
+ * @brief  Settings: random updates of small values, the same updates rewritten in place in
+ *         a settings file (read-modify-write of its sector) and appended to the key-value
+ *         store, then the store is reopened and all values have to be the last ones set
+ * @param  updates: Number of updates
+ * @retval FatFs result
+ */
+static FRESULT SIM_KvWorkload( uint32_t updates )
+{
+	static KV_Store kv;
+	static uint32_t values[ SIM_KV_KEYS ];
+	FRESULT res;
+	uint32_t i, seed = 1, n;
+	uint16_t key, len;
+	uint8_t v[ 8 ], k;
+	UINT bw;
+
+	/* baseline: each update goes to the slot of the key in SETTINGS.BIN, synced as the store */
+	SIM_PhaseBegin();
+	memset( SIM_Buffer, 0, SIM_CHUNK );
+	res = f_open( &SIM_File, "SETTINGS.BIN", FA_WRITE | FA_CREATE_ALWAYS );
+	for ( i = 0; res == FR_OK && i < SIM_KV_KEYS * 8; i += n )
+	{
+		n = ( SIM_KV_KEYS * 8 - i < SIM_CHUNK ) ? SIM_KV_KEYS * 8 - i : SIM_CHUNK;
+		res = f_write( &SIM_File, SIM_Buffer, n, &bw );
+	}
+	for ( i = 0; res == FR_OK && i < updates; ++i )
+	{
+		seed = seed * 1103515245 + 12345;
+		key = ( seed >> 8 ) % SIM_KV_KEYS;
+		SIM_Put32( v, key );
+		SIM_Put32( v + 4, i );
+		res = f_lseek( &SIM_File, key * 8 );
+		if ( res == FR_OK )
+			res = f_write( &SIM_File, v, 8, &bw );
+		if ( res == FR_OK && i % 16 == 15 )
+			res = f_sync( &SIM_File );
+	}
+	if ( res == FR_OK )
+		res = f_close( &SIM_File );
+	SIM_PhaseEnd( "kv file", (uint64_t)updates * 8 );
+
+	SIM_PhaseBegin();
+	seed = 1;
+	memset( values, 0xFF, sizeof( values ) );
+	res = KV_Open( &kv, "SETTINGS.KV", SIM_KV_BYTES, 4 );
+	for ( i = 0; res == FR_OK && i < updates; ++i )
+	{
+		seed = seed * 1103515245 + 12345;
+		key = ( seed >> 8 ) % SIM_KV_KEYS;
+		if ( i % 97 == 96 && values[ key ] != 0xFFFFFFFF )
+		{
+			res = KV_Delete( &kv, key, i % 16 == 15 );
+			values[ key ] = 0xFFFFFFFF;
+		}
+		else
+		{
+			SIM_Put32( v, key );
+			SIM_Put32( v + 4, i );
+			res = KV_Set( &kv, key, v, 8, i % 16 == 15 );
+			values[ key ] = i;
+		}
+		if ( res == FR_OK && i % 256 == 255 )
+			res = KV_Compact( &kv, 4 );		/* idle time of the owner */
+	}
+	if ( res == FR_OK )
+	{
+		printf( "%-12s %u pages, %u free, %u keys, %u pages compacted\n", "", (unsigned)kv.Pages,
+				(unsigned)KV_FreePages( &kv ), (unsigned)kv.Keys, (unsigned)kv.Compacted );
+		res = KV_Close( &kv );
+	}
+	SIM_PhaseEnd( "kv store", (uint64_t)updates * 8 );
+
+	for ( k = 0; k < 2 && res == FR_OK; ++k )
+	{
+		SIM_PhaseBegin();
+		if ( k == 1 )
+			res = KV_Open( &kv, "SETTINGS.KV", 0, 4 );
+		for ( key = 0; res == FR_OK && k == 1 && key < SIM_KV_KEYS; ++key )
+		{
+			res = KV_Get( &kv, key, v, sizeof( v ), &len );
+			if ( res == FR_NO_FILE && values[ key ] == 0xFFFFFFFF )
+				res = FR_OK;
+			else if ( res == FR_OK && ( len != 8 || SIM_Get32( v ) != key || SIM_Get32( v + 4 ) != values[ key ] ) )
+			{
+				printf( "%-12s wrong value of key %u\n", "", key );
+				res = FR_INT_ERR;
+			}
+		}
+		if ( res == FR_OK && k == 1 )
+			res = KV_Close( &kv );
+		if ( k == 1 )
+			SIM_PhaseEnd( "kv reopen", 0 );
+	}
+	return res;
+}
+#endif /* USE_FAT_KV */
+
+static void SIM_Usage( void )
+{
+	printf( "usage: sdsim [-c card] [-s card_mb] [-n spi_byte_ns] [-u au_sectors] [-w log|files|streams|pack|view|table|kv|sync|all]\n"
+			"             [-m data_mb] [-r record] [-y records_per_sync] [-f file_kb] [-o image] [-x] [-k]\n"
+			"       sdsim -l\n" );
+}
+
+/* Public functions ----------------------------------------------------------*/
+
+int main( int argc, char** argv )
+{
+	const char* card = SIM_DEFAULT_CARD;
+	const char* workload = "all";
+	const char* image = NULL;
+	const SIM_CardTiming* timing;
+	uint32_t mb = SIM_DEFAULT_MB, byte_ns = SIM_DEFAULT_BYTE_NS, au = SIM_DEFAULT_AU;
+	uint32_t data_mb = 8, record = 512, sync = 16, file_kb = 64;
+	FRESULT res = FR_OK;
+	FILE* f;
+	int opt, exfat = 0, mkfs = 0;
+
+	while ( ( opt = getopt( argc, argv, "c:s:n:u:w:m:r:y:f:o:xklh" ) ) != -1 )
+	{
+		switch ( opt )
+		{
+		case 'c': card = optarg; break;
+		case 's': mb = (uint32_t)strtoul( optarg, NULL, 0 ); break;
+		case 'n': byte_ns = (uint32_t)strtoul( optarg, NULL, 0 ); break;
+		case 'u': au = (uint32_t)strtoul( optarg, NULL, 0 ); break;
+		case 'w': workload = optarg; break;
+		case 'm': data_mb = (uint32_t)strtoul( optarg, NULL, 0 ); break;
+		case 'r': record = (uint32_t)strtoul( optarg, NULL, 0 ); break;
+		case 'y': sync = (uint32_t)strtoul( optarg, NULL, 0 ); break;
+		case 'f': file_kb = (uint32_t)strtoul( optarg, NULL, 0 ); break;
+		case 'o': image = optarg; break;
+		case 'x': exfat = 1; break;
+		case 'k': mkfs = 1; break;
+		case 'l':
+			SIM_CardProfiles();
+			return 0;
+		default:
+			SIM_Usage();
+			return 2;
+		}
+	}
+	timing = SIM_CardProfile( card );
+	if ( timing == NULL || mb == 0 || file_kb == 0 )
+	{
+		SIM_Usage();
+		return 2;
+	}
+	if ( !SIM_CardInit( mb * 2048, timing, byte_ns, au ) || ( !mkfs && !( exfat ? SIM_FormatExFat() : SIM_Format() ) ) )
+	{
+		printf( "Can't create %u Mb card\n", mb );
+		return 1;
+	}
+	printf( "Card  : %s, %u Mb, SPI byte %u ns, AU %u sectors\n", timing->Name, mb, byte_ns, au );
+
+	f_mount( 0, &SIM_Fs );
+#if _USE_MKFS
+	if ( mkfs )
+		res = SIM_Mkfs();
+#endif /* _USE_MKFS */
+	if ( res == FR_OK && ( strcmp( workload, "log" ) == 0 || strcmp( workload, "all" ) == 0 ) )
+		res = SIM_LogWorkload( (uint64_t)data_mb << 20, record, sync );
+	if ( res == FR_OK && ( strcmp( workload, "files" ) == 0 || strcmp( workload, "all" ) == 0 ) )
+		res = SIM_FilesWorkload( (uint64_t)data_mb << 20, file_kb * 1024 );
+	if ( res == FR_OK && ( strcmp( workload, "streams" ) == 0 || strcmp( workload, "all" ) == 0 ) )
+		res = SIM_StreamsWorkload( (uint64_t)data_mb << 20, SIM_STREAMS );
+#ifdef USE_FAT_PACK
+	if ( res == FR_OK && ( strcmp( workload, "pack" ) == 0 || strcmp( workload, "all" ) == 0 ) )
+		res = SIM_PackWorkload( (uint64_t)data_mb << 20 );
+#endif /* USE_FAT_PACK */
+#if _USE_VIEW
+	if ( res == FR_OK && strcmp( workload, "view" ) == 0 )
+		res = SIM_ViewWorkload( file_kb * 1024 );
+#endif /* _USE_VIEW */
+#ifdef USE_FAT_TABLE
+	if ( res == FR_OK && strcmp( workload, "table" ) == 0 )
+		res = SIM_TableWorkload( file_kb * 1024 / 8, 1000 );
+#endif /* USE_FAT_TABLE */
+#ifdef USE_FAT_KV
+	if ( res == FR_OK && strcmp( workload, "kv" ) == 0 )
+		res = SIM_KvWorkload( data_mb * 2500 );
+#endif /* USE_FAT_KV */
+	if ( res == FR_OK && strcmp( workload, "sync" ) == 0 )
+		res = SIM_SyncWorkload( (uint64_t)data_mb << 20, record );
+	if ( res == FR_OK )
+	{	/* written back cache and FSInfo are part of the cost */
+		SIM_PhaseBegin();
+		f_mount( 0, NULL );
+		disk_ioctl( 0, CTRL_SYNC, NULL );
+		SIM_PhaseEnd( "unmount", 0 );
+	}
+	if ( res == FR_OK )
+		res = SIM_MountPhase( "mount cold", 0 );
+	if ( res == FR_OK )
+		res = SIM_MountPhase( "mount warm", 1 );
+	if ( res != FR_OK )
+		printf( "FatFs error %d\n", res );
+	printf( "Total : %.1f ms simulated\n", SIM_Now() / 1000.0 );
+
+	if ( image != NULL )
+	{	/* the volume can be checked by fsck.vfat or mounted by loop device */
+		f = fopen( image, "wb" );
+		if ( f == NULL || fwrite( SIM_CardData(), SIM_SECTOR / DISK_BLOCKS, SIM_CardSectors(), f ) != SIM_CardSectors() )
+			printf( "Can't write %s\n", image );
+		if ( f != NULL )
+			fclose( f );
+	}
+	return ( res == FR_OK ) ? 0 : 1;
+}
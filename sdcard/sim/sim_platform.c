@@ -0,0 +1,219 @@
+/**
+ ******************************************************************************
+ * @file    sim_platform.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Scheduler and linker symbols of the host simulation build.
+ *          Time advances only when the card model charges it (or by
+ *          vTaskDelay), so runs are repeatable whatever the host does.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "sim.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#include "ff.h"
+#include "stm32_chksum.h"
+#include "stm32_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Private typedef -----------------------------------------------------------*/
+
+struct SIM_Semaphore
+{
+	uint32_t	Count;
+};
+
+/* Private define ------------------------------------------------------------*/
+
+/* SRAM1 left between the sections and the main stack of the board with the 4K main stack
+   (stm32_flash.ld), USE_SPARE_RAM_CACHE lays the sector cache out there */
+#ifndef SIM_SPARE_BYTES
+#define SIM_SPARE_BYTES			( 48 * 1024 )
+#endif /* SIM_SPARE_BYTES */
+
+#define SIM_STR_( x )			#x
+#define SIM_STR( x )			SIM_STR_( x )
+
+/* Private variables ---------------------------------------------------------*/
+
+#if _FS_WARM
+/* Volume snapshots, they survive "resets" of the simulation (remounts) like backup SRAM */
+static FFSTATE SIM_State[ _VOLUMES ];
+static uint8_t SIM_StateValid[ _VOLUMES ];
+#endif /* _FS_WARM */
+
+static uint64_t SIM_Time;		/* simulated microseconds */
+
+/* Block pool (stm32_pool.c on the board) */
+static uint8_t SIM_Pool[ POOL_BLOCKS ][ POOL_BLOCK_SIZE ] __attribute__(( aligned( 4 ) ));
+static uint8_t SIM_PoolUsed[ POOL_BLOCKS ];
+static uint32_t SIM_PoolPeak;	/* most blocks taken at once */
+
+/* _sspare.._espare of the linker script */
+uint8_t SIM_Spare[ SIM_SPARE_BYTES ] __attribute__(( aligned( 8 ) ));
+__asm__( ".globl _sspare\n.set _sspare, SIM_Spare\n"
+		 ".globl _espare\n.set _espare, SIM_Spare + " SIM_STR( SIM_SPARE_BYTES ) "\n" );
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Simulated time
+ * @param  None
+ * @retval Microseconds since start
+ */
+uint64_t SIM_Now( void )
+{
+	return SIM_Time;
+}
+
+/**
+ * @brief  Moves simulated time on
+ * @param  us: Microseconds
+ * @retval None
+ */
+void SIM_Advance( uint64_t us )
+{
+	SIM_Time += us;
+}
+
+portBASE_TYPE xTaskGetSchedulerState( void )
+{
+	return taskSCHEDULER_NOT_STARTED;
+}
+
+portTickType xTaskGetTickCount( void )
+{
+	return (portTickType)( SIM_Time / 1000 );
+}
+
+void vTaskDelay( portTickType ticks )
+{
+	SIM_Advance( (uint64_t)ticks * 1000 );
+}
+
+xSemaphoreHandle SIM_SemaphoreCreate( uint32_t count )
+{
+	xSemaphoreHandle sem = malloc( sizeof( struct SIM_Semaphore ) );
+
+	if ( sem != NULL )
+		sem->Count = count;
+	return sem;
+}
+
+portBASE_TYPE xSemaphoreTake( xSemaphoreHandle sem, portTickType timeout )
+{
+	if ( sem->Count == 0 )
+	{	/* nobody else runs to give it */
+		if ( timeout != portMAX_DELAY )
+			vTaskDelay( timeout );
+		return pdFALSE;
+	}
+	--sem->Count;
+	return pdTRUE;
+}
+
+portBASE_TYPE xSemaphoreGive( xSemaphoreHandle sem )
+{
+	if ( sem->Count > 0 )
+		return pdFALSE;		/* binary semaphores and mutexes only */
+	sem->Count = 1;
+	return pdTRUE;
+}
+
+void vQueueDelete( xQueueHandle queue )
+{
+	free( queue );
+}
+
+#if _FS_WARM
+/* Volume snapshot storage of FatFs (ffstate.c on the board) */
+const FFSTATE* ff_state_get( BYTE vol )
+{
+	return SIM_StateValid[ vol ] ? &SIM_State[ vol ] : NULL;
+}
+
+FFSTATE* ff_state_begin( BYTE vol )
+{
+	SIM_StateValid[ vol ] = 0;
+	return &SIM_State[ vol ];
+}
+
+void ff_state_end( BYTE vol )
+{
+	SIM_StateValid[ vol ] = 1;
+}
+#endif /* _FS_WARM */
+
+void SIM_StateDrop( void )
+{
+#if _FS_WARM
+	memset( SIM_StateValid, 0, sizeof( SIM_StateValid ) );
+#endif /* _FS_WARM */
+}
+
+/* Block pool: first free block, the board pool is a stack of free blocks but the order doesn't matter */
+void POOL_Init( void )
+{
+	memset( SIM_PoolUsed, 0, sizeof( SIM_PoolUsed ) );
+	SIM_PoolPeak = 0;
+}
+
+void* POOL_Alloc( void )
+{
+	uint32_t i;
+
+	for ( i = 0; i < POOL_BLOCKS; ++i )
+	{
+		if ( !SIM_PoolUsed[ i ] )
+		{
+			SIM_PoolUsed[ i ] = 1;
+			if ( POOL_BLOCKS - POOL_FreeCount() > SIM_PoolPeak )
+				SIM_PoolPeak = POOL_BLOCKS - POOL_FreeCount();
+			return SIM_Pool[ i ];
+		}
+	}
+	return NULL;
+}
+
+void POOL_Free( void* block )
+{
+	SIM_PoolUsed[ ( (uint8_t*)block - SIM_Pool[ 0 ] ) / POOL_BLOCK_SIZE ] = 0;
+}
+
+uint32_t POOL_FreeCount( void )
+{
+	uint32_t i, n = 0;
+
+	for ( i = 0; i < POOL_BLOCKS; ++i )
+		n += !SIM_PoolUsed[ i ];
+	return n;
+}
+
+uint32_t POOL_MinFreeCount( void )
+{
+	return POOL_BLOCKS - SIM_PoolPeak;
+}
+
+/* CRC unit (stm32_chksum.c on the board): zlib crc32 bit by bit */
+uint32_t CHK_Crc32( const void* buf, uint32_t len )
+{
+	const uint8_t* p = (const uint8_t*)buf;
+	uint32_t crc = 0xFFFFFFFF;
+	int i;
+
+	while ( len-- )
+	{
+		crc ^= *p++;
+		for ( i = 0; i < 8; ++i )
+			crc = ( crc >> 1 ) ^ ( 0xEDB88320 & -( crc & 1 ) );
+	}
+	return ~crc;
+}
@@ -0,0 +1,286 @@
+/**
+ ******************************************************************************
+ * @file    adc_logger.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   ADC data logger. The file is allocated as one block before the
+ *          sampling starts, so f_write of a whole aligned sector goes straight
+ *          to the card (no FAT updates, no copy with _FS_TINY). Each block is
+ *          returned to the pool as soon as its f_write returns. The capture
+ *          side holds two blocks, the rest of the pool is the backlog the card
+ *          may fall behind by; the report compares the worst f_write and the
+ *          deepest backlog with the block period and the pool, and prints the
+ *          verdict "SUSTAINED" if no sample was lost.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "adc_logger.h"
+
+#ifdef USE_ADC_LOGGER
+
+#include "stm32_sampler.h"
+#include "stm32_pool.h"
+#include "stm32_sd_io.h"
+#include "stm32_dwt.h"
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "FAT/ff.h"
+
+/* Standard includes */
+#include <stdio.h>
+#include <string.h>
+
+#if !_USE_EXPAND || _FS_MINIMIZE > 2 || _FS_READONLY
+#error USE_ADC_LOGGER needs f_expand, f_lseek and writing functions of FatFs (see ffconf.h)
+#endif
+
+/* Private typedef -----------------------------------------------------------*/
+
+/* Header of the file, sector 0 (all fields are little endian) */
+typedef struct
+{
+	uint32_t	Magic;				/* ADCLOG_MAGIC */
+	uint32_t	Channels;			/* Samples of a scan */
+	uint32_t	Rate;				/* Scans per second (actual timer rate) */
+	uint32_t	Scans;				/* Whole scans of a sector */
+	uint32_t	Sectors;			/* Data sectors stored */
+	uint32_t	Lost;				/* Blocks lost (not stored) */
+	uint32_t	FirstGap;			/* Data sector followed by the first lost block, 0xFFFFFFFF if none */
+	uint8_t		Reserved[ 512 - 28 ];
+} ADCLOG_Header;
+
+/* Private define ------------------------------------------------------------*/
+
+/* Recording file and the recording time */
+#define ADCLOG_FILE				"ADC.BIN"
+#define ADCLOG_SECONDS			10
+
+/* Marker of the header ("ADCL") */
+#define ADCLOG_MAGIC			0x4C434441
+
+/* Scans of a sector and data sectors of the file (5% more for timer rounding) */
+#define ADCLOG_SCANS			SAMPLER_BlockScans( ADC_LOGGER_CHANNELS )
+#define ADCLOG_SECTORS			( (uint32_t)ADC_LOGGER_RATE_HZ * ADCLOG_SECONDS / ADCLOG_SCANS * 21 / 20 + 1 )
+
+/* Blocks the card may fall behind by: the pool minus the two capture targets */
+#define ADCLOG_BACKLOG			( POOL_BLOCKS - 2 )
+
+/* Wait for a block, the end of recording is checked after it */
+#define ADCLOG_WAIT_TICKS		( 100 / portTICK_RATE_MS )
+
+/* Bytes per second written to the card at the configured rate */
+#define ADCLOG_RATE_BYTES		( (uint32_t)( (uint64_t)ADC_LOGGER_RATE_HZ * POOL_BLOCK_SIZE / ADCLOG_SCANS ) )
+
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+
+static FATFS ADCLOG_Fs;
+static FIL ADCLOG_File;
+static ADCLOG_Header ADCLOG_Hdr;
+static uint32_t ADCLOG_Seq;			/* block expected next */
+static uint32_t ADCLOG_MaxWrite;	/* longest f_write, in microseconds */
+static uint32_t ADCLOG_WriteUs;		/* all f_write, in microseconds */
+static SD_IO_Request ADCLOG_Req;		/* real-time recording start */
+
+/* Private function prototypes -----------------------------------------------*/
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Creates the file as one contiguous block and moves to its first data sector
+ * @param  None
+ * @retval FatFs result
+ */
+static FRESULT ADCLOG_Open( void )
+{
+	FRESULT res;
+
+	res = f_mount( 0, &ADCLOG_Fs );
+	if ( res == FR_OK )
+		res = f_open( &ADCLOG_File, ADCLOG_FILE, FA_WRITE | FA_CREATE_ALWAYS );
+	if ( res != FR_OK )
+		return res;
+	/* at an AU of the card if there is room for it: speed class holds for whole AUs */
+	res = f_expand( &ADCLOG_File, ( 1 + ADCLOG_SECTORS ) * POOL_BLOCK_SIZE, 3 );
+	if ( res == FR_DENIED )
+		res = f_expand( &ADCLOG_File, ( 1 + ADCLOG_SECTORS ) * POOL_BLOCK_SIZE, 1 );
+	if ( res == FR_OK )
+		res = f_lseek( &ADCLOG_File, ( 1 + ADCLOG_SECTORS ) * POOL_BLOCK_SIZE );
+	if ( res == FR_OK && ADCLOG_File.fsize != ( 1 + ADCLOG_SECTORS ) * POOL_BLOCK_SIZE )
+		res = FR_DENIED;	/* no contiguous space */
+	if ( res == FR_OK )
+		res = f_lseek( &ADCLOG_File, POOL_BLOCK_SIZE );
+	if ( res != FR_OK )
+		f_close( &ADCLOG_File );
+	return res;
+}
+
+/**
+ * @brief  Stores a block, it is returned to the pool
+ * @param  blk: Block from the capture queue
+ * @retval FatFs result
+ */
+static FRESULT ADCLOG_Put( const SAMPLER_Block* blk )
+{
+	FRESULT res = FR_OK;
+	UINT n;
+	uint32_t start, us;
+
+	if ( blk->Seq != ADCLOG_Seq )
+	{	/* blocks lost before this one */
+		if ( ADCLOG_Hdr.Lost == 0 )
+			ADCLOG_Hdr.FirstGap = ADCLOG_Hdr.Sectors;
+		ADCLOG_Hdr.Lost += blk->Seq - ADCLOG_Seq;
+	}
+	ADCLOG_Seq = blk->Seq + 1;
+
+	if ( ADCLOG_Hdr.Sectors < ADCLOG_SECTORS )
+	{
+		memset( blk->Data + ADCLOG_SCANS * ADC_LOGGER_CHANNELS, 0,
+				POOL_BLOCK_SIZE - ADCLOG_SCANS * ADC_LOGGER_CHANNELS * sizeof( uint16_t ) );
+		start = DWT_GetCycles();
+		res = f_write( &ADCLOG_File, blk->Data, POOL_BLOCK_SIZE, &n );
+		us = DWT_CyclesToUs( DWT_GetCycles() - start );
+		if ( res == FR_OK && n != POOL_BLOCK_SIZE )
+			res = FR_DENIED;
+		if ( res == FR_OK )
+			ADCLOG_Hdr.Sectors++;
+		ADCLOG_WriteUs += us;
+		if ( us > ADCLOG_MaxWrite )
+			ADCLOG_MaxWrite = us;
+	}
+	POOL_Free( blk->Data );
+	return res;
+}
+
+/**
+ * @brief  Writes the header and closes the file
+ * @param  None
+ * @retval FatFs result
+ */
+static FRESULT ADCLOG_Close( void )
+{
+	FRESULT res;
+	UINT n;
+
+	res = f_lseek( &ADCLOG_File, 0 );
+	if ( res == FR_OK )
+		res = f_write( &ADCLOG_File, &ADCLOG_Hdr, sizeof( ADCLOG_Hdr ), &n );
+	if ( res == FR_OK && n != sizeof( ADCLOG_Hdr ) )
+		res = FR_DENIED;
+	if ( res == FR_OK )
+		res = f_close( &ADCLOG_File );
+	else
+		f_close( &ADCLOG_File );
+	return res;
+}
+
+/* Public functions ----------------------------------------------------------*/
+
+/**
+ * @brief  Logs ADCLOG_SECONDS of samples and prints whether the rate was sustained
+ * @param  None
+ * @retval None
+ */
+void ADCLog_Run( void )
+{
+	SAMPLER_Block blk;
+	SAMPLER_Stats stats;
+	FRESULT res, r;
+	portTickType start, ms;
+	uint32_t rate, period, need, left;
+
+	if ( SD_IO_Detect() == SD_NOT_PRESENT )
+	{
+		printf( "SDCard isn't detected\n" );
+		return;
+	}
+	res = ADCLOG_Open();
+	if ( res != FR_OK )
+	{
+		printf( "ADC file " ADCLOG_FILE " failed with code %d\n", res );
+		return;
+	}
+	memset( &ADCLOG_Hdr, 0, sizeof( ADCLOG_Hdr ) );
+	ADCLOG_Hdr.Magic = ADCLOG_MAGIC;
+	ADCLOG_Hdr.Channels = ADC_LOGGER_CHANNELS;
+	ADCLOG_Hdr.Scans = ADCLOG_SCANS;
+	ADCLOG_Hdr.FirstGap = 0xFFFFFFFF;
+	ADCLOG_Seq = ADCLOG_MaxWrite = ADCLOG_WriteUs = 0;
+	DWT_Enable();
+
+	/* speed class control, the card is warned before the samples are */
+	if ( ADCLOG_Req.Done == NULL )
+		SD_IO_RequestInit( &ADCLOG_Req );
+	ADCLOG_Req.Op = SD_IO_RECORD;
+	ADCLOG_Req.Count = ADCLOG_RATE_BYTES;
+	if ( SD_IO_Execute( &ADCLOG_Req ) != SD_RESPONSE_NO_ERROR )
+		printf( "ADC : WARNING, card of speed class %u doesn't guarantee %lu bytes/s, samples may be lost\n",
+				SD_IO_SpeedClass(), ADCLOG_RATE_BYTES );
+
+	rate = SAMPLER_Start( ADC_LOGGER_CHANNELS, ADC_LOGGER_RATE_HZ );
+	if ( rate == 0 )
+	{
+		printf( "ADC sampling can't start: rate too high or no free sector buffers\n" );
+		f_close( &ADCLOG_File );
+		return;
+	}
+	ADCLOG_Hdr.Rate = rate;
+#ifdef USE_SD_IO_PRIORITY
+	/* a block has to be on the card before the backlog behind it fills the pool */
+	SD_IO_SetTaskClass( NULL, SD_IO_BULK,
+		(portTickType)( (uint64_t)ADCLOG_BACKLOG * ADCLOG_SCANS * 1000 / rate / portTICK_RATE_MS ) + 1 );
+#endif /* USE_SD_IO_PRIORITY */
+
+	start = xTaskGetTickCount();
+	while ( res == FR_OK && ADCLOG_Hdr.Sectors < ADCLOG_SECTORS &&
+			( xTaskGetTickCount() - start ) < ADCLOG_SECONDS * 1000 / portTICK_RATE_MS )
+	{
+		if ( SAMPLER_Receive( &blk, ADCLOG_WAIT_TICKS ) == SUCCESS )
+			res = ADCLOG_Put( &blk );
+	}
+	SAMPLER_Stop();
+	ms = ( xTaskGetTickCount() - start ) * portTICK_RATE_MS;
+
+	/* blocks captured before the stop */
+	while ( SAMPLER_Receive( &blk, 0 ) == SUCCESS )
+	{
+		if ( res == FR_OK )
+			res = ADCLOG_Put( &blk );
+		else
+			POOL_Free( blk.Data );
+	}
+	r = ADCLOG_Close();
+	if ( res == FR_OK )
+		res = r;
+#ifdef USE_SD_IO_PRIORITY
+	SD_IO_SetTaskClass( NULL, SD_IO_BULK, 0 );
+#endif /* USE_SD_IO_PRIORITY */
+
+	SAMPLER_GetStats( &stats );
+	period = (uint32_t)( (uint64_t)ADCLOG_SCANS * 1000000 / rate );
+	need = (uint32_t)( (uint64_t)rate * POOL_BLOCK_SIZE / ADCLOG_SCANS );
+	printf( "ADC : %u channels at %u Hz asked, %lu Hz set, %lu bytes/s to the card\n",
+			ADC_LOGGER_CHANNELS, ADC_LOGGER_RATE_HZ, rate, need );
+	printf( "ADC : %lu scans in %lu sectors stored in %lu ms, %lu blocks lost, %lu overruns\n",
+			ADCLOG_Hdr.Sectors * ADCLOG_SCANS, ADCLOG_Hdr.Sectors, ms, stats.Lost, stats.Overruns );
+	printf( "ADC : f_write max %lu us of %lu us block period, average %lu bytes/s, backlog max %lu of %u blocks\n",
+			ADCLOG_MaxWrite, period,
+			ADCLOG_WriteUs ? (uint32_t)( (uint64_t)ADCLOG_Hdr.Sectors * POOL_BLOCK_SIZE * 1000000 / ADCLOG_WriteUs ) : 0,
+			stats.MaxQueued, ADCLOG_BACKLOG );
+	left = ( stats.MaxQueued < ADCLOG_BACKLOG ) ? ADCLOG_BACKLOG - stats.MaxQueued : 0;
+	if ( stats.Lost == 0 && res == FR_OK )
+		printf( "ADC : SUSTAINED, margin %lu blocks (%lu us) of backlog left\n", left, left * period );
+	else
+		printf( "ADC : NOT SUSTAINED, first gap after data sector %lu\n", ADCLOG_Hdr.FirstGap );
+	if ( res != FR_OK )
+		printf( "ADC file " ADCLOG_FILE " failed with code %d\n", res );
+}
+
+#endif /* USE_ADC_LOGGER */
@@ -0,0 +1,39 @@
+/**
+ ******************************************************************************
+ * @file    adc_logger.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   ADC data logger: ADC_LOGGER_CHANNELS inputs scanned ADC_LOGGER_RATE_HZ
+ *          times a second (sys/BSP/stm32_sampler.h) are written, one pool block
+ *          per sector, to the contiguous file ADC.BIN. Sector 0 is the header
+ *          (see adc_logger.c), sectors from 1 on hold whole scans of 12-bit
+ *          samples (little endian, channel 0 first), the tail of a sector
+ *          after the last whole scan is zero. At the end the logger reports
+ *          whether the SD Card has kept up with the rate.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef ADC_LOGGER_H
+#define ADC_LOGGER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include <stdint.h>
+
+/* Exported types ------------------------------------------------------------*/
+/* Exported constants --------------------------------------------------------*/
+/* Exported macro ------------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+
+void ADCLog_Run( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ADC_LOGGER_H */
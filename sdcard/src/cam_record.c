@@ -0,0 +1,206 @@
+/**
+ ******************************************************************************
+ * @file    cam_record.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Camera recorder. Blocks come from the capture queue in order; the
+ *          sectors of a frame are written to the ring as they arrive and taken
+ *          back (RING_Discard) if the frame turns out incomplete, so the ring
+ *          holds whole frames only. A block is returned to the pool after the
+ *          next RING_Write: its write has completed by then. At the end the
+ *          stored, dropped and lost frames and the achieved fps are printed.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "cam_record.h"
+
+#ifdef USE_CAMERA_RECORD
+
+#include "stm32_camera.h"
+#include "stm32_pool.h"
+#include "stm32_sd_io.h"
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "FAT/ff.h"
+#include "FAT/ffring.h"
+
+/* Standard includes */
+#include <stdio.h>
+
+#if CAMERA_FRAME_BYTES % POOL_BLOCK_SIZE != 0
+#error CAMERA_FRAME_BYTES has to be a multiple of the sector size (see main.h)
+#endif
+
+/* Private typedef -----------------------------------------------------------*/
+/* Private define ------------------------------------------------------------*/
+
+/* Recording file, its size in frames (created on the first run) and the recording time */
+#define CAMREC_FILE				"CAMERA.BIN"
+#define CAMREC_FRAMES			256
+#define CAMREC_SECONDS			10
+
+/* Sectors of a frame */
+#define CAMREC_FRAME_SECTORS	( CAMERA_FRAME_BYTES / POOL_BLOCK_SIZE )
+
+/* Wait for a block, the end of recording is checked after it */
+#define CAMREC_WAIT_TICKS		( 100 / portTICK_RATE_MS )
+
+/* Bytes per second written to the card at the frame rate of the sensor */
+#define CAMREC_RATE_BYTES		( (uint32_t)CAMERA_FRAME_BYTES * CAMERA_FPS )
+
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+
+static FATFS CAMREC_Fs;
+static RING_File CAMREC_Ring;
+static uint8_t* CAMREC_Prev;		/* block of the last write, in flight */
+static uint32_t CAMREC_Frame;		/* frame being stored */
+static uint32_t CAMREC_Count;		/* its sectors written */
+static uint32_t CAMREC_Stored;		/* whole frames written */
+static SD_IO_Request CAMREC_Req;	/* real-time recording start */
+
+/* Private function prototypes -----------------------------------------------*/
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Stores a block of a frame
+ * @param  blk: Block from the capture queue, it is returned to the pool
+ * @retval FatFs result
+ */
+static FRESULT CAMREC_Put( const CAMERA_Block* blk )
+{
+	FRESULT res = FR_OK;
+
+	if ( blk->Frame != CAMREC_Frame || blk->Index != CAMREC_Count )
+	{	/* frame being stored was dropped or lost: take its sectors back */
+		if ( CAMREC_Count != 0 )
+			res = RING_Discard( &CAMREC_Ring, CAMREC_Count );
+		CAMREC_Frame = blk->Frame;
+		CAMREC_Count = 0;
+	}
+	if ( res != FR_OK || ( blk->Index != 0 && CAMREC_Count == 0 ) )
+	{	/* the beginning of this frame is missing, wait for the next one */
+		POOL_Free( blk->Data );
+		CAMREC_Frame = blk->Frame + 1;
+		return res;
+	}
+
+	res = RING_Write( &CAMREC_Ring, blk->Data, 1 );
+	POOL_Free( CAMREC_Prev );
+	CAMREC_Prev = blk->Data;
+	if ( res == FR_OK && ++CAMREC_Count == CAMREC_FRAME_SECTORS )
+	{
+		CAMREC_Stored++;
+		CAMREC_Frame++;
+		CAMREC_Count = 0;
+	}
+	return res;
+}
+
+/**
+ * @brief  Opens the ring file, its capacity has to hold whole frames
+ * @param  None
+ * @retval FatFs result
+ */
+static FRESULT CAMREC_Open( void )
+{
+	FRESULT res;
+
+	res = f_mount( 0, &CAMREC_Fs );
+	if ( res == FR_OK )
+		res = RING_Open( &CAMREC_Ring, CAMREC_FILE, ( 2 + CAMREC_FRAMES * CAMREC_FRAME_SECTORS ) * POOL_BLOCK_SIZE );
+	if ( res != FR_OK )
+		return res;
+	if ( CAMREC_Ring.Capacity % CAMREC_FRAME_SECTORS != 0 )
+		res = FR_DENIED;			/* made for another frame size, delete it */
+	if ( res == FR_OK )				/* part of a frame of an interrupted recording */
+		res = RING_Discard( &CAMREC_Ring, CAMREC_Ring.Total % CAMREC_FRAME_SECTORS );
+	if ( res != FR_OK )
+		RING_Close( &CAMREC_Ring );
+	return res;
+}
+
+/* Public functions ----------------------------------------------------------*/
+
+/**
+ * @brief  Records CAMREC_SECONDS of camera frames and prints the results
+ * @param  None
+ * @retval None
+ */
+void CamRecord_Run( void )
+{
+	CAMERA_Block blk;
+	CAMERA_Stats stats;
+	FRESULT res, r;
+	portTickType start, ms;
+
+	if ( SD_IO_Detect() == SD_NOT_PRESENT )
+	{
+		printf( "SDCard isn't detected\n" );
+		return;
+	}
+	res = CAMREC_Open();
+	if ( res != FR_OK )
+	{
+		printf( "Camera file " CAMREC_FILE " failed with code %d\n", res );
+		return;
+	}
+	CAMREC_Prev = NULL;
+	CAMREC_Frame = CAMREC_Count = CAMREC_Stored = 0;
+
+	/* speed class control, the card is warned before the frames are */
+	if ( CAMREC_Req.Done == NULL )
+		SD_IO_RequestInit( &CAMREC_Req );
+	CAMREC_Req.Op = SD_IO_RECORD;
+	CAMREC_Req.Count = CAMREC_RATE_BYTES;
+	if ( SD_IO_Execute( &CAMREC_Req ) != SD_RESPONSE_NO_ERROR )
+		printf( "Camera : WARNING, card of speed class %u doesn't guarantee %lu bytes/s, frames may be dropped\n",
+				SD_IO_SpeedClass(), CAMREC_RATE_BYTES );
+	if ( CAMERA_Start( CAMREC_FRAME_SECTORS ) != SUCCESS )
+	{
+		printf( "Camera capture can't start: no free sector buffers\n" );
+		RING_Close( &CAMREC_Ring );
+		return;
+	}
+
+	start = xTaskGetTickCount();
+	while ( res == FR_OK && ( xTaskGetTickCount() - start ) < CAMREC_SECONDS * 1000 / portTICK_RATE_MS )
+	{
+		if ( CAMERA_Receive( &blk, CAMREC_WAIT_TICKS ) == SUCCESS )
+			res = CAMREC_Put( &blk );
+	}
+	CAMERA_Stop();
+	ms = ( xTaskGetTickCount() - start ) * portTICK_RATE_MS;
+
+	/* blocks captured before the stop, then the incomplete frame is taken back */
+	while ( CAMERA_Receive( &blk, 0 ) == SUCCESS )
+	{
+		if ( res == FR_OK )
+			res = CAMREC_Put( &blk );
+		else
+			POOL_Free( blk.Data );
+	}
+	if ( res == FR_OK && CAMREC_Count != 0 )
+		res = RING_Discard( &CAMREC_Ring, CAMREC_Count );
+	r = RING_Close( &CAMREC_Ring );
+	if ( res == FR_OK )
+		res = r;
+	POOL_Free( CAMREC_Prev );
+
+	CAMERA_GetStats( &stats );
+	printf( "Camera : %lu frames of %u bytes stored in %lu ms (%lu.%02lu fps), %lu dropped, %lu lost to errors\n",
+			CAMREC_Stored, CAMERA_FRAME_BYTES, ms,
+			CAMREC_Stored * 1000 / ms, CAMREC_Stored * 100000 / ms % 100,
+			stats.Dropped, stats.Errors );
+	if ( res != FR_OK )
+		printf( "Camera file " CAMREC_FILE " failed with code %d\n", res );
+}
+
+#endif /* USE_CAMERA_RECORD */
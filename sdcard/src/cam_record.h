@@ -0,0 +1,37 @@
+/**
+ ******************************************************************************
+ * @file    cam_record.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Camera recorder: frames captured by DCMI (sys/BSP/stm32_camera.h)
+ *          are written block by block, without a copy, into the raw ring file
+ *          CAMERA.BIN (sys/FAT/ffring.h). Each frame takes the same number of
+ *          sectors of the ring, so frame n of the file is at data sector
+ *          n * frame sectors; dropped and incomplete frames are not stored.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef CAM_RECORD_H
+#define CAM_RECORD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include <stdint.h>
+
+/* Exported types ------------------------------------------------------------*/
+/* Exported constants --------------------------------------------------------*/
+/* Exported macro ------------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+
+void CamRecord_Run( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CAM_RECORD_H */
@@ -14,11 +14,33 @@
 
 #include "stm32_buttons.h"
 #include "stm32_spi.h"
+#include "stm32_sd_io.h"
+#include "stm32_sram.h"
+#include "stm32_pool.h"
+#include "stm32_calendar.h"
+#include "stm32_chksum.h"
+#include "stm32_bootcache.h"
+#include "stm32_crypt.h"
+#include "stm32_camera.h"
+#include "stm32_sampler.h"
 
 #include "FreeRTOS.h"
 #include "task.h"
 
 #include "serial_debug.h"
+#include "event_trace.h"
+#include "power.h"
+#include "power_fail.h"
+#include "watchdog.h"
+#include "task_stats.h"
+#include "init_profile.h"
+#include "ffserv.h"
+#include "ffmaint.h"
+#include "ffwq.h"
+#include "metrics.h"
+#include "ffmsc.h"
+#include "ffnet.h"
+#include "ffstate.h"
 #include "tasks_misc.h"
 
 #include <stdio.h>
@@ -28,9 +50,31 @@
 /*--------------- Tasks Priority -------------*/
 
 #define BTN_TASK_PRIO   ( tskIDLE_PRIORITY + 1 )
+/* Buttons run FatFs and printf, see their high-water mark in task statistics */
+#ifdef USE_TINY_PRINTF
+#define BTN_TASK_STACK  ( configMINIMAL_STACK_SIZE * 2 )
+#else
+#define BTN_TASK_STACK  ( configMINIMAL_STACK_SIZE * 3 )
+#endif /* USE_TINY_PRINTF */
+
+#define SHELL_TASK_PRIO   ( tskIDLE_PRIORITY + 1 )
+/* Shell commands are the button ones, the same stack */
+#define SHELL_TASK_STACK  BTN_TASK_STACK
+
+#if !configSUPPORT_STATIC_ALLOCATION
+#error Tasks, queues and semaphores are created in static memory, set configSUPPORT_STATIC_ALLOCATION (see FreeRTOSConfig.h)
+#endif
 
 /* Private macro -------------------------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
+
+static xStaticTask BTN_TaskBuffer;
+static portSTACK_TYPE BTN_TaskStack[ BTN_TASK_STACK ];
+#ifdef USE_CONSOLE_SHELL
+static xStaticTask SHELL_TaskBuffer;
+static portSTACK_TYPE SHELL_TaskStack[ SHELL_TASK_STACK ];
+#endif /* USE_CONSOLE_SHELL */
+
 /* Private function prototypes -----------------------------------------------*/
 
 /**
@@ -47,30 +91,177 @@ int main( void )
        system_stm32f2xx.c file
      */
 
+#ifdef USE_TASK_STATS
+	/* Depth of the main stack is measured from now on */
+	TaskStats_PaintMainStack();
+#endif /* USE_TASK_STATS */
+
+	/* Startup timeline counts from here */
+	INIT_MARK( "main" );
+
+	/* All priority bits are preemption priority, as FreeRTOS port expects */
+	NVIC_PriorityGroupConfig( NVIC_PriorityGroup_4 );
+
+	/* Shared sector buffers, before anything can take one */
+	POOL_Init();
+
+	/* CRC unit for log frames and file service frames */
+	CHK_Init();
+
 	/* USART Configuration */
 	DebugComPort_Init();
+	INIT_MARK( "pools, CRC, COM port" );
 
-	/* Initialize buttons */
+#ifdef USE_WATCHDOG
+	/* Watchdog runs from here on: card identification below kicks it in its waits */
+	Watchdog_Init();
+	if ( Watchdog_CausedReset() )
+		printf( "Reset by watchdog\n" );
+#endif /* USE_WATCHDOG */
+
+#ifdef USE_LOW_POWER_IDLE
+	/* Idle hook sleeps between ticks which are due */
+	Power_Init();
+#endif /* USE_LOW_POWER_IDLE */
+
+#ifdef USE_EVENT_TRACE
+	/* Binary trace of the SD layer */
+	EventTrace_Init();
+#endif /* USE_EVENT_TRACE */
+	INIT_MARK( "power, trace" );
+
+	/* Initialize buttons, their interrupts wake up the button task */
+	HandleButtons_Init();
 	STM_EVAL_PBInit( BUTTON_WAKEUP, BUTTON_MODE_EXTI );
 	STM_EVAL_PBInit( BUTTON_TAMPER, BUTTON_MODE_EXTI );
 	STM_EVAL_PBInit( BUTTON_KEY   , BUTTON_MODE_EXTI );
+#ifndef USE_EXT_SRAM
 	STM_EVAL_PBInit( BUTTON_RIGHT , BUTTON_MODE_EXTI );
+#else
+	/* External SRAM before anything is cached there (RIGHT button pin is FSMC A18) */
+	if ( STM_EVAL_SRAM_Init() != SUCCESS )
+		printf( "External SRAM test failed, sector cache works without it\n" );
+#endif /* USE_EXT_SRAM */
+	INIT_MARK( "buttons, SRAM" );
 
 	/* Initialize SPI */
-	STM_EVAL_SPI_Init();
+	STM_EVAL_SPI_Init( &SPIx_Bus );
+#ifdef USE_SD_CARD2
+	STM_EVAL_SPI_Init( &SPIy_Bus );
+#endif /* USE_SD_CARD2 */
+	INIT_MARK( "SPI" );
+
+#ifdef USE_RTC_CALENDAR
+	/* File timestamps, before FatFs writes a directory entry */
+	if ( CALENDAR_Init() != SUCCESS )
+		printf( "LSE doesn't start, files are stamped 1980-01-01\n" );
+#endif /* USE_RTC_CALENDAR */
+	INIT_MARK( "calendar" );
+
+#ifdef USE_DISK_CRYPT
+	/* Sector encryption, without its key the card isn't accessed */
+	if ( CRYPT_Init() != SUCCESS )
+		printf( "No disk key in OTP, SD Card is not accessed\n" );
+#endif /* USE_DISK_CRYPT */
+
+#ifdef USE_BOOT_CACHE
+	/* Records kept in FLASH over power-off (needs the checksum unit) */
+	BOOT_Init();
+#endif /* USE_BOOT_CACHE */
+
+	/* Volume snapshots survive only warm resets (and in the boot cache) */
+	FF_StateInit();
+	INIT_MARK( "disk key, boot cache, volume state" );
+
+#ifdef USE_SD_IO_TASK
+	/* Create SD I/O task serving SD Card requests */
+	SD_IO_Init();
+#endif /* USE_SD_IO_TASK */
+
+#ifdef USE_SD_DETECT_EXTI
+	/* Track SD Card insertion and removal */
+	SD_IO_DetectInit();
+#endif /* USE_SD_DETECT_EXTI */
+
+#ifdef USE_POWER_FAIL
+	/* Commit the volumes when the supply fails, the time it takes is printed once started */
+	PowerFail_Init();
+#endif /* USE_POWER_FAIL */
+
+#ifdef USE_FILE_SERVICE
+	/* Serve files of mounted volumes to the host */
+	FSERV_Init();
+#endif /* USE_FILE_SERVICE */
+
+#ifdef USE_FAT_MAINTENANCE
+	/* Pre-erase and FSInfo updates of mounted volumes while the card is idle */
+	FMAINT_Init();
+#endif /* USE_FAT_MAINTENANCE */
+
+#ifdef USE_FAT_WRITE_QUEUE
+	/* Writer task of queued files */
+	FWQ_Init();
+#endif /* USE_FAT_WRITE_QUEUE */
+
+#ifdef USE_METRICS
+	/* Periodic records of storage counters */
+	Metrics_Init();
+#endif /* USE_METRICS */
+
+#ifdef USE_USB_MSC
+	/* Mass storage export of the card to a USB host */
+	FMSC_Init();
+#endif /* USE_USB_MSC */
+
+#ifdef USE_NET_FILE_SERVICE
+	/* Serve files of mounted volumes over Ethernet */
+	FNET_Init();
+#endif /* USE_NET_FILE_SERVICE */
+	INIT_MARK( "SD I/O task, card detect, file service" );
+
+#ifdef USE_CAMERA_RECORD
+	/* Camera interface, capture runs only while recording */
+	if ( CAMERA_Init() != SUCCESS )
+		printf( "Camera capture queue can't be created\n" );
+#endif /* USE_CAMERA_RECORD */
+
+#ifdef USE_ADC_LOGGER
+	/* ADC, its trigger and DMA, sampling runs only while logging */
+	if ( SAMPLER_Init() != SUCCESS )
+		printf( "ADC sampling queue can't be created\n" );
+#endif /* USE_ADC_LOGGER */
 
 printf("\ntest tracing from embedded code\n");
 
 	/* Handle buttons */
-	xTaskCreate( HandleButtons_task, (const signed char* const)"BTN", configMINIMAL_STACK_SIZE, NULL, BTN_TASK_PRIO, NULL );
+	xTaskCreateStatic( HandleButtons_task, (const signed char* const)"BTN", BTN_TASK_STACK, NULL, BTN_TASK_PRIO, NULL,
+			BTN_TaskStack, &BTN_TaskBuffer );
+#ifdef USE_CONSOLE_SHELL
+	/* Command shell on the console */
+	xTaskCreateStatic( Shell_task, (const signed char* const)"SH", SHELL_TASK_STACK, NULL, SHELL_TASK_PRIO, NULL,
+			SHELL_TaskStack, &SHELL_TaskBuffer );
+#endif /* USE_CONSOLE_SHELL */
 
 	/* Start scheduler */
+	INIT_MARK( "camera, ADC, tasks" );
 	vTaskStartScheduler();
 
 	/* We should never get here as control is now taken by the scheduler */
 	for(;;);
 }
 
+/**
+ * @brief  Called by the kernel when pvPortMalloc fails. Kernel objects are static,
+ *         only benchmarks take memory from the heap at run time: this reports
+ *         a heap too small for them (configTOTAL_HEAP_SIZE)
+ * @param  None
+ * @retval None
+ */
+void vApplicationMallocFailedHook( void )
+{
+	printf( "Heap exhausted, %u bytes free\n", (unsigned)xPortGetFreeHeapSize() );
+}
+
 #ifdef USE_FULL_ASSERT
 
 /**
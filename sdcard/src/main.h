@@ -28,15 +28,336 @@ extern "C" {
 /* Enable SD Card slot */
 #define USE_SDCARD
 
+/* Move SD Card data blocks over SPI bus by DMA instead of polling every byte */
+#define USE_SPI_DMA
+
+/* Polled block transfers (without USE_SPI_DMA or for short blocks) use 16-bit SPI frames
+   for the even part of data, so there are half as many waits per block */
+//#define USE_SPI_PIO_16BIT
+
+/* Compile the card I/O path (SPI and SD Card drivers, SD I/O task, FatFs and diskio) at -O2 whatever
+   the optimization level of the build configuration, e.g. in Debug builds (see PROFILE of the benchmark) */
+//#define USE_FAST_IO_CODE
+
+/* Run the innermost loops (polled block transfers, CRC16 of data blocks) from SRAM (section .ramfunc,
+   copied with .data at startup) instead of FLASH with its wait states */
+//#define USE_RAM_FUNC
+
+/* Service SD Card requests (FatFs disk I/O) by dedicated SD I/O task, see stm32_sd_io.h */
+#define USE_SD_IO_TASK
+
+/* Serve requests of interactive tasks (SD_IO_SetTaskClass) before bulk ones, long bulk transfers
+   are preempted between batches of sectors, requests with a due deadline go first (needs USE_SD_IO_TASK) */
+//#define USE_SD_IO_PRIORITY
+
+/* Protect SD Card commands and data blocks on SPI bus by CRC (CMD59), corrupted blocks are retried */
+#define USE_SD_CRC
+
+/* Keep multiple block write open while FatFs writes consecutive sectors (closed by CTRL_SYNC,
+   other requests or SD I/O task idle timeout) */
+#define USE_SD_WRITE_STREAM
+
+/* Keep multiple block read open while FatFs reads consecutive sectors and prefetch
+   following ones while SD I/O task is idle (needs USE_SD_IO_TASK) */
+#define USE_SD_READ_AHEAD
+
+/* Collect written sectors into AU-aligned window (sized from SD Status) and write it by
+   one burst when complete, on CTRL_SYNC or on SD I/O task idle timeout (needs USE_SD_IO_TASK) */
+#define USE_SD_WRITE_BUFFER
+
+/* Build SPI SD Card driver for one card type (SDCardType of stm32_sd_spi.h, SD_Card_SDHC covers
+   SDXC too): addressing and command variants are resolved at compile time, SD_Init fails other cards */
+//#define USE_SD_FIXED_TYPE	SD_Card_SDHC
+
+/* Collect SD Card driver statistics (latencies, errors), see SD_GetStats() */
+#define USE_SD_STATS
+
+/* Verbose SD_DumpCardInfo/SD_DumpStatus for diagnostic builds, otherwise card registers are
+   printed by the table driven formatter of stm32_sd_info.h */
+//#define USE_SD_DUMP
+
+/* Watch SD Card detect pin by EXTI interrupt: removed card fails pending and following
+   requests at once and FatFs volumes report STA_NOINIT, see SD_IO_DetectInit() */
+#define USE_SD_DETECT_EXTI
+
+/* Identify the card present at startup by SD I/O task as soon as the scheduler runs, instead of on
+   the first FatFs access: the ACMD41 loop sleeps between tries, so other tasks proceed meanwhile */
+#define USE_SD_EARLY_INIT
+
+/* Sector cache under FatFs shared by all volumes of a card (size and write policy are set in
+   sys/FAT/diskio.c), hit and miss counters are read by CTRL_CACHE_STATS of disk_ioctl() */
+#define USE_DISK_CACHE
+
+/* 2 Mb of SRAM on FSMC (MEMORY_B1 of stm32_flash.ld) are the second tier of the sector cache,
+   it keeps clean sectors evicted from the first one (RIGHT button is not used: PD13 is FSMC A18) */
+//#define USE_EXT_SRAM
+
+/* Sector cache takes all SRAM1 left between data and the main stack (_sspare.._espare of
+   stm32_flash.ld) instead of a fixed number of slots, about 90 sectors with the 4K main stack */
+#define USE_SPARE_RAM_CACHE
+
+/* Written sectors of SD drives are read back and compared with the data (by CRC16 of the blocks sent
+   by the card with USE_SD_CRC, the data are not stored), a mismatch fails the write like a write error.
+   CTRL_VERIFY of disk_ioctl() turns it off and on around writes which don't need it, see sys/FAT/diskio.c */
+//#define USE_DISK_VERIFY
+
+/* Bad block remap table of SD drives in a contiguous file (REMAP.BIN of volume 0): a card block which fails
+   to be written (or verified) while the card responds is replaced by a spare block of the file, see sys/FAT/ffremap.h */
+//#define USE_DISK_REMAP
+
+/* Enable journaled append-only log files on FatFs, see sys/FAT/fflog.h */
+#define USE_FAT_LOG
+
+/* Enable raw ring buffer files written around FatFs by SD I/O requests, see sys/FAT/ffring.h */
+#define USE_FAT_RING
+
+/* Background maintenance of mounted volumes while the card is idle: free cluster count after mount,
+   pre-erase of free clusters ahead of the allocation point and FSInfo updates, see sys/FAT/ffmaint.h */
+//#define USE_FAT_MAINTENANCE
+
+/* Write queues of files served round-robin by one writer task: producers of a high rate data file and
+   of low rate logs only copy into their queues, each turn writes up to the quantum of one file in whole
+   sectors, so the files don't evict each other from the FatFs window, see sys/FAT/ffwq.h */
+//#define USE_FAT_WRITE_QUEUE
+
+/* Enable compression stage in front of f_write for log data: LZ4, or delta + varint of 32-bit samples,
+   packed into self-contained sector-aligned chunks (tools/pack_decode.py unpacks), see sys/FAT/ffpack.h */
+#define USE_FAT_PACK
+
+/* Enable lookup tables on the card: records sorted by 32-bit key, sparse index of the first key per
+   sector in RAM, lookup is one seek and one sector mapped from the cache (tools/table_build.py creates
+   them on a PC), see sys/FAT/fftable.h */
+#define USE_FAT_TABLE
+
+/* Enable log-structured key-value store for settings and counters: updates are appended to pages
+   going around a preallocated file, hash index in pool blocks, tail pages compacted on demand and
+   by KV_Compact in idle time, see sys/FAT/ffkv.h */
+#define USE_FAT_KV
+
+/* Enable boot cache of card state in on-chip FLASH (sectors 10 and 11, reserved by GCC-ARM/stm32_flash.ld):
+   learned card timing, volume state saved after unmount (mount after power-on reads neither the partition
+   table nor the FAT if FSInfo still matches it) and small config files, see sys/BSP/stm32_bootcache.h */
+#define USE_BOOT_CACHE
+
+/* SD Card throughput benchmark on BTN2: loopback verification of multiple block writes, then raw and FatFs,
+   sequential and random transfers of 1..128 sectors inside the contiguous file BENCH.BIN (8 Mb, created
+   on the first run), see src/sd_bench.c */
+#define USE_SD_BENCH
+
+/* Kernel latency benchmark, the shell command rtos: cycles of a task switch by yield, of a notification
+   waking a higher priority task and of an interrupt waking a task (HASH_RNG vector as a software interrupt),
+   see src/rtos_bench.c */
+//#define USE_RTOS_BENCH
+
+/* Camera recorder on BTN3 (instead of SD Card dump): DCMI frames of CAMERA_FRAME_BYTES (a multiple of
+   512, the sensor is set up for it by its own control bus) go by DMA into pool blocks which are written
+   to the raw ring file CAMERA.BIN without a copy, then fps and dropped frames are printed.
+   CAMERA_FPS is the frame rate of the sensor, the speed class of the card is checked against it.
+   It needs USE_FAT_RING, and the pins of SDIO and of the second SD Card, see sys/BSP/stm32_camera.h */
+//#define USE_CAMERA_RECORD
+#define CAMERA_FRAME_BYTES		( 160 * 120 * 2 )
+#define CAMERA_FPS				30
+
+/* ADC data logger on BTN4 (instead of SD Card FAT test): TIM3 triggers scans of ADC_LOGGER_CHANNELS
+   inputs (PF6..PF10) ADC_LOGGER_RATE_HZ times a second, DMA fills pool blocks alternately and they are
+   written to the contiguous file ADC.BIN, then the logger reports if the card has kept up with the rate.
+   See sys/BSP/stm32_sampler.h and src/adc_logger.c */
+//#define USE_ADC_LOGGER
+#define ADC_LOGGER_CHANNELS		4
+#define ADC_LOGGER_RATE_HZ		10000
+
+/* RTC calendar on LSE (kept across resets by the backup domain) stamps files, the packed FAT time
+   is refreshed by the RTC wakeup interrupt once a second, see sys/BSP/stm32_calendar.h */
+#define USE_RTC_CALENDAR
+
+/* Serial file service: a PC lists, downloads and deletes files of mounted volumes over COM port
+   FILE_SERVICE_PORT (tools/ffserv.py is the host side), frames are sent by DMA at FILE_SERVICE_BAUDRATE.
+   It needs _FS_MINIMIZE 0 in ffconf.h and its own COM port, see sys/FAT/ffserv.h */
+//#define USE_FILE_SERVICE
+#define FILE_SERVICE_PORT		2
+#define FILE_SERVICE_BAUDRATE	3000000
+
+/* USB mass storage: a PC connected to OTG FS (PA11/PA12) reads and writes the whole SD Card at
+   full speed, the volumes see no card from the configuration by the host until it ejects the card
+   or the cable is pulled, then they are mounted again. See sys/FAT/ffmsc.h */
+//#define USE_USB_MSC
+
+/* Network file service: files of mounted volumes are served by HTTP/1.0 GET on TCP port 80 of
+   the MAC and static IP address below (e.g. curl -O http://192.168.0.20/0:/LOG.TXT), the MAC
+   sends the data from the f_read ring by DMA. Directories are listed if _FS_MINIMIZE <= 1,
+   see sys/FAT/ffnet.h */
+//#define USE_NET_FILE_SERVICE
+
+/* SHA-1 of each file service download computed by the HASH processor while the data are sent,
+   checked by tools/ffserv.py (STM32F21x only: STM32F20x have no HASH processor) */
+//#define USE_HW_HASH
+
+/* Sectors of the SD Card are AES-128 encrypted under FatFs by the CRYP processor with DMA, the key
+   is read from OTP (STM32F21x only, the card is readable only by the device), see sys/BSP/stm32_crypt.h */
+//#define USE_DISK_CRYPT
+
+/* Second SD Card on its own SPIy bus (pins in stm32_pins.h), driven in parallel with the first one,
+   see SD_Card2 in stm32_sd_spi.h */
+//#define USE_SD_CARD2
+
+/* Both SD Cards form one array under FatFs drives 0 and 1 (needs USE_SD_CARD2 and USE_SD_IO_TASK):
+   sectors are striped across the cards (RAID-0), or mirrored on both of them (RAID-1)
+   if USE_SD_RAID_MIRROR is defined, the mirror goes on with one card, see sys/FAT/diskio.c */
+//#define USE_SD_RAID
+//#define USE_SD_RAID_MIRROR
+
+/* Enable native 4-bit SDIO bus for SD Card (SPI bus is used if card doesn't respond on it) */
+//#define USE_SD_SDIO
+
 #if !defined(USE_LCD) && defined(USE_TOUCHSCREEN)
 #error USE_TOUCHSCREEN can be defined only if USE_CLD is defined too!
 #endif /* !USE_LCD &&  USE_TOUCHSCREEN */
 
+/* Uncomment SERIAL_DEBUG to retarget of printf() to COM port for debugging */
+#define SERIAL_DEBUG
+
+/* COM port of the console: 1 (UART5 on APB1, up to 3.75 Mbaud) or 2 (USART1 on APB2, up to 7.5 Mbaud),
+   and its initial baud rate, it can be changed later by DebugComPort_SetBaudRate() */
+#define SERIAL_DEBUG_PORT		1
+#define SERIAL_DEBUG_BAUDRATE	115200
+
+/* printf() only copies characters to a ring buffer which is sent by COM port TXE interrupt,
+   the caller doesn't wait for the port (overflow policy is in sys/serial_debug.c, buffer size in storage_conf.h) */
+#define USE_SERIAL_TX_RING
+
+/* Command shell on the console: characters received by COM port RXNE interrupt are read by the shell task,
+   commands bench, rtos, stats, cache, tasks, heap, ls, cat, dump (help lists them), see src/tasks_misc.c */
+//#define USE_CONSOLE_SHELL
+
+/* printf(), sprintf() and their v and n variants of the C library are replaced by a small formatter
+   in sys/serial_debug.c: it needs a few hundred bytes of stack (task stacks are smaller then) and no heap,
+   the console gets whole chunks. USE_TINY_PRINTF_FLOAT adds %f (double arithmetic, slow on Cortex-M3) */
+//#define USE_TINY_PRINTF
+//#define USE_TINY_PRINTF_FLOAT
+
+/* Binary trace of SD Card commands, data transfers and busy periods in a RAM ring, streamed to
+   ITM stimulus port 1 (SWO) when debugger enables it, see sys/event_trace.h and tools/trace_decode.py */
+#define USE_EVENT_TRACE
+
+/* Idle task stops the core by WFI with the tick interrupt suppressed until the next task is due,
+   see sys/power.h. With USE_LOW_POWER_STOP it enters STOP mode when all tasks wait without a timeout
+   and no driver holds a busy token (DMA transfer, card programming): EXTI lines (buttons, card detect)
+   wake it up, COM ports and the tick don't run meanwhile */
+#define USE_LOW_POWER_IDLE
+//#define USE_LOW_POWER_STOP
+
+/* Independent watchdog resets the board when the idle task doesn't run for WATCHDOG_TIMEOUT_MS,
+   long storage operations (card erase, f_getfree) kick it while they progress, see sys/watchdog.h */
+//#define USE_WATCHDOG
+
+/* Programmable voltage detector interrupts when the supply fails: writes of other tasks are refused,
+   watched files, FatFs metadata and dirty sectors of the cache are written within the hold-up time
+   (POWER_FAIL_HOLDUP_US), the time this takes is measured on PFAIL.BIN at start, see sys/power_fail.h */
+//#define USE_POWER_FAIL
+
+/* CPU time of each task measured by TIM2 and stack high-water marks, printed by TaskStats_Print()
+   on BTN1 (see sys/task_stats.h). The counter doesn't run in STOP mode */
+#define USE_TASK_STATS
+
+/* Storage metrics record every METRICS_PERIOD_MS (driver error counters, cache hits, SD I/O queue
+   and latencies, free heap and pool, lowest stack mark) and the identity of each new card, as CSV
+   lines or binary frames (METRICS_FORMAT: METRICS_CSV or METRICS_BINARY, see sys/metrics.h and
+   tools/metrics_decode.py) to the console, and appended to METRICS_FILE on volume 0 if defined */
+//#define USE_METRICS
+#define METRICS_PERIOD_MS	10000
+#define METRICS_FORMAT		METRICS_CSV
+//#define METRICS_FILE		"METRICS.CSV"
+
+/* Timestamps of startup phases (main() init blocks, card identification), printed by
+   InitProfile_Print() on BTN1, see sys/init_profile.h */
+#define USE_INIT_PROFILE
+
+/* Level of driver tracing to COM port: TRACE_LEVEL_OFF, TRACE_LEVEL_ERROR, TRACE_LEVEL_INFO
+   or TRACE_LEVEL_VERBOSE (levels are defined in serial_debug.h) */
+#define TRACE_LEVEL		TRACE_LEVEL_ERROR
+
+#if defined(USE_SD_SDIO) && defined(SERIAL_DEBUG) && SERIAL_DEBUG_PORT == 1
+#error USE_SD_SDIO can not be used together with SERIAL_DEBUG on COM1: SDIO CK/CMD pins are COM1 (UART5) TX/RX!
+#endif /* USE_SD_SDIO && SERIAL_DEBUG && SERIAL_DEBUG_PORT == 1 */
+
+#if defined(USE_FILE_SERVICE) && defined(SERIAL_DEBUG) && FILE_SERVICE_PORT == SERIAL_DEBUG_PORT
+#error USE_FILE_SERVICE and SERIAL_DEBUG can not share a COM port!
+#endif /* USE_FILE_SERVICE && SERIAL_DEBUG && FILE_SERVICE_PORT == SERIAL_DEBUG_PORT */
+
+#if defined(USE_FILE_SERVICE) && defined(USE_SD_SDIO) && FILE_SERVICE_PORT == 1
+#error USE_SD_SDIO can not be used together with USE_FILE_SERVICE on COM1: SDIO CK/CMD pins are COM1 (UART5) TX/RX!
+#endif /* USE_FILE_SERVICE && USE_SD_SDIO && FILE_SERVICE_PORT == 1 */
+
+#if defined(USE_SPARE_RAM_CACHE) && !defined(USE_DISK_CACHE)
+#error USE_SPARE_RAM_CACHE needs USE_DISK_CACHE: spare SRAM is given to the sector cache!
+#endif /* USE_SPARE_RAM_CACHE && !USE_DISK_CACHE */
+
+#if defined(USE_CONSOLE_SHELL) && !defined(SERIAL_DEBUG)
+#error USE_CONSOLE_SHELL needs SERIAL_DEBUG: the shell runs on the console COM port!
+#endif /* USE_CONSOLE_SHELL && !SERIAL_DEBUG */
+
+#if defined(USE_TINY_PRINTF) && !defined(SERIAL_DEBUG)
+#error USE_TINY_PRINTF needs SERIAL_DEBUG: the formatter prints to the console COM port!
+#endif /* USE_TINY_PRINTF && !SERIAL_DEBUG */
+
+#if defined(USE_SD_BENCH) && !defined(USE_SDCARD)
+#error USE_SD_BENCH needs USE_SDCARD!
+#endif /* USE_SD_BENCH && !USE_SDCARD */
+
+#if defined(USE_LOW_POWER_STOP) && !defined(USE_LOW_POWER_IDLE)
+#error USE_LOW_POWER_STOP needs USE_LOW_POWER_IDLE: STOP mode is entered by the idle hook!
+#endif /* USE_LOW_POWER_STOP && !USE_LOW_POWER_IDLE */
+
+#if defined(USE_WATCHDOG) && defined(USE_LOW_POWER_STOP)
+#error USE_WATCHDOG can not be used together with USE_LOW_POWER_STOP: the watchdog keeps counting in STOP mode!
+#endif /* USE_WATCHDOG && USE_LOW_POWER_STOP */
+
+#if defined(USE_SD_IO_PRIORITY) && !defined(USE_SD_IO_TASK)
+#error USE_SD_IO_PRIORITY needs USE_SD_IO_TASK: requests are ordered by SD I/O task!
+#endif /* USE_SD_IO_PRIORITY && !USE_SD_IO_TASK */
+
+#if defined(USE_FAT_MAINTENANCE) && !defined(USE_SD_IO_TASK)
+#error USE_FAT_MAINTENANCE needs USE_SD_IO_TASK: idle time of the card and erases are taken from SD I/O task!
+#endif /* USE_FAT_MAINTENANCE && !USE_SD_IO_TASK */
+
+#if defined(USE_SD_EARLY_INIT) && !defined(USE_SD_IO_TASK)
+#error USE_SD_EARLY_INIT needs USE_SD_IO_TASK: the card is identified by SD I/O task!
+#endif /* USE_SD_EARLY_INIT && !USE_SD_IO_TASK */
+
+#if defined(USE_SD_RAID) && ( !defined(USE_SD_CARD2) || !defined(USE_SD_IO_TASK) )
+#error USE_SD_RAID needs USE_SD_CARD2 and USE_SD_IO_TASK: cards are accessed in parallel by SD I/O task and caller!
+#endif /* USE_SD_RAID && !( USE_SD_CARD2 && USE_SD_IO_TASK ) */
+
+#if defined(USE_DISK_CRYPT) && ( !defined(USE_SD_IO_TASK) || defined(USE_SD_CARD2) || defined(USE_FAT_RING) )
+#error USE_DISK_CRYPT needs USE_SD_IO_TASK, and excludes USE_SD_CARD2 (DMA2 Stream5) and USE_FAT_RING (ring data bypass diskio)!
+#endif /* USE_DISK_CRYPT && ( !USE_SD_IO_TASK || USE_SD_CARD2 || USE_FAT_RING ) */
+
+#if ( defined(USE_DISK_VERIFY) || defined(USE_DISK_REMAP) ) && defined(USE_SD_RAID)
+#error USE_DISK_VERIFY and USE_DISK_REMAP exclude USE_SD_RAID: only the drives of a single card verify and remap blocks!
+#endif /* ( USE_DISK_VERIFY || USE_DISK_REMAP ) && USE_SD_RAID */
+
+#if defined(USE_DISK_VERIFY) && defined(USE_DISK_CRYPT)
+#error USE_DISK_VERIFY excludes USE_DISK_CRYPT: the card holds encrypted data, not the written ones!
+#endif /* USE_DISK_VERIFY && USE_DISK_CRYPT */
+
+#if defined(USE_USB_MSC) && ( !defined(USE_SD_IO_TASK) || defined(USE_DISK_CRYPT) || defined(USE_DISK_REMAP) || defined(USE_SD_RAID) )
+#error USE_USB_MSC needs USE_SD_IO_TASK, and excludes USE_DISK_CRYPT, USE_DISK_REMAP and USE_SD_RAID: the host gets the blocks of the card as they are!
+#endif /* USE_USB_MSC && ( !USE_SD_IO_TASK || USE_DISK_CRYPT || USE_DISK_REMAP || USE_SD_RAID ) */
+
+#if defined(USE_CAMERA_RECORD) && ( !defined(USE_FAT_RING) || defined(USE_SD_SDIO) || defined(USE_SD_CARD2) )
+#error USE_CAMERA_RECORD needs USE_FAT_RING, and excludes USE_SD_SDIO (DCMI D2..D4 on PC8..PC11) and USE_SD_CARD2 (VSYNC on PB7)!
+#endif /* USE_CAMERA_RECORD && ( !USE_FAT_RING || USE_SD_SDIO || USE_SD_CARD2 ) */
+
+#if defined(USE_ADC_LOGGER) && !defined(USE_SDCARD)
+#error USE_ADC_LOGGER needs USE_SDCARD: samples are written to a file!
+#endif /* USE_ADC_LOGGER && !USE_SDCARD */
+
 /* Enable DHCP, if disabled static address is used */
 //#define USE_DHCP
 
-/* Uncomment SERIAL_DEBUG to retarget of printf() to COM port for debugging */
-#define SERIAL_DEBUG
+#if defined(USE_NET_FILE_SERVICE) && defined(USE_DHCP)
+#error USE_NET_FILE_SERVICE uses the static IP address: it has no DHCP client!
+#endif /* USE_NET_FILE_SERVICE && USE_DHCP */
 
 /* Use HW cryptographic processor: AES, TDES, RNG, SHA-1 and MD5.
    !!! This line should be left uncommented !!! */
@@ -97,6 +418,9 @@ extern "C" {
     +==========================================================================================+
 */
 
+/* Sizes of buffers, caches and queues of the storage stack */
+#include "storage_conf.h"
+
 /* Exported macro ------------------------------------------------------------*/
 /* Exported functions ------------------------------------------------------- */
 /* Exported function prototypes ----------------------------------------------*/
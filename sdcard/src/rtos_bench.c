@@ -0,0 +1,220 @@
+/**
+ ******************************************************************************
+ * @file    rtos_bench.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Kernel latency benchmark. A partner task is created for the run
+ *          and each test repeats RTOSBENCH_ROUNDS times (after one warm-up
+ *          round), then prints min, average and max cycles and a line for
+ *          scripts:
+ *            RTOS,test,rounds,min,avg,max
+ *          - yield: the partner of the same priority stamps the counter and
+ *            yields, the caller reads it once it runs again (one switch)
+ *          - notify: the caller stamps it and gives a notification to the
+ *            partner of higher priority, which reads it (give, switch)
+ *          - irq entry, irq wake: the caller stamps it and pends the software
+ *            interrupt, the handler stamps it and gives the notification,
+ *            the partner reads it (interrupt entry, then give from interrupt
+ *            and switch by PendSV). The interrupt has the priority of SD DMA.
+ *          Ticks and other interrupts fall into some rounds: they are the max.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "rtos_bench.h"
+
+#ifdef USE_RTOS_BENCH
+
+#include "stm32_dwt.h"
+#include "stm32_irq.h"
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Standard includes */
+#include <stdio.h>
+
+#if !configUSE_TASK_NOTIFICATIONS || !INCLUDE_vTaskDelete || !INCLUDE_vTaskPrioritySet || !INCLUDE_uxTaskPriorityGet
+#error USE_RTOS_BENCH needs task notifications, vTaskDelete, vTaskPrioritySet and uxTaskPriorityGet (see FreeRTOSConfig.h)
+#endif
+
+/* Private typedef -----------------------------------------------------------*/
+
+/* Cycles of one test */
+typedef struct
+{
+	uint32_t	Min;
+	uint32_t	Max;
+	uint64_t	Total;
+} RTOSBENCH_Stat;
+
+/* Private define ------------------------------------------------------------*/
+
+/* Measured rounds of each test */
+#define RTOSBENCH_ROUNDS		1000
+
+/* Software interrupt of the benchmark: the vector of HASH and RNG, neither is used */
+#define RTOSBENCH_IRQ			HASH_RNG_IRQn
+
+/* What the partner task does */
+#define RTOSBENCH_WAIT			0	/* waits for notifications, stamps the wakeup */
+#define RTOSBENCH_YIELD			1	/* stamps and yields */
+#define RTOSBENCH_STOP			2	/* deletes itself */
+
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+
+static xTaskHandle volatile RTOSBENCH_Partner;
+static volatile uint8_t RTOSBENCH_Mode;
+static volatile uint32_t RTOSBENCH_Stamp;		/* stamp of the partner */
+static volatile uint32_t RTOSBENCH_IrqStamp;	/* stamp of the interrupt handler */
+
+/* Private function prototypes -----------------------------------------------*/
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Partner task, runs RTOSBENCH_Mode
+ * @param  pvParameters: Not used
+ * @retval None
+ */
+static void RTOSBENCH_Task( void* pvParameters )
+{
+	(void)pvParameters;
+
+	while ( RTOSBENCH_Mode != RTOSBENCH_STOP )
+	{
+		if ( RTOSBENCH_Mode == RTOSBENCH_YIELD )
+		{
+			RTOSBENCH_Stamp = DWT_GetCycles();
+			taskYIELD();
+			continue;
+		}
+		ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+		RTOSBENCH_Stamp = DWT_GetCycles();
+	}
+	RTOSBENCH_Partner = NULL;
+	vTaskDelete( NULL );
+}
+
+/**
+ * @brief  Adds a round to the test, the warm-up round isn't counted
+ * @param  st: Test
+ * @param  round: Number of the round, 0 is the warm-up one
+ * @param  cycles: Cycles of the round
+ * @retval None
+ */
+static void RTOSBENCH_Add( RTOSBENCH_Stat* st, uint32_t round, uint32_t cycles )
+{
+	if ( round == 0 )
+	{
+		st->Min = 0xFFFFFFFF;
+		st->Max = 0;
+		st->Total = 0;
+		return;
+	}
+	if ( cycles < st->Min )
+		st->Min = cycles;
+	if ( cycles > st->Max )
+		st->Max = cycles;
+	st->Total += cycles;
+}
+
+/**
+ * @brief  Prints results of the test
+ * @param  name: Test
+ * @param  st: Cycles of the test
+ * @retval None
+ */
+static void RTOSBENCH_Print( const char* name, const RTOSBENCH_Stat* st )
+{
+	uint32_t avg = (uint32_t)( st->Total / RTOSBENCH_ROUNDS );
+
+	printf( "%-10s %7lu %7lu %7lu %5lu.%02lu\n", name, st->Min, avg, st->Max,
+			DWT_CyclesToUs( avg ), DWT_CyclesToUs( avg * 100 ) % 100 );
+	printf( "RTOS,%s,%u,%lu,%lu,%lu\n", name, RTOSBENCH_ROUNDS, st->Min, avg, st->Max );
+}
+
+/**
+ * @brief  Runs the tests in the calling task (its priority has to be below the highest one)
+ * @param  None
+ * @retval None
+ */
+void RTOSBench_Run( void )
+{
+	unsigned portBASE_TYPE prio = uxTaskPriorityGet( NULL );
+	RTOSBENCH_Stat yield, notify, entry, wake;
+	uint32_t i, start;
+
+	if ( prio + 1 >= configMAX_PRIORITIES )
+	{
+		printf( "Benchmark task priority is too high\n" );
+		return;
+	}
+	DWT_Enable();
+	RTOSBENCH_Mode = RTOSBENCH_WAIT;
+	if ( xTaskCreate( RTOSBENCH_Task, (const signed char* const)"RTB", configMINIMAL_STACK_SIZE, NULL,
+					  prio + 1, (xTaskHandle*)&RTOSBENCH_Partner ) != pdPASS )
+	{
+		printf( "No heap for the benchmark task\n" );
+		return;
+	}
+	IRQ_Enable( RTOSBENCH_IRQ, IRQ_PRIO_SD_DMA );
+
+	/* the partner runs at once: it waits for notifications now */
+	for ( i = 0; i <= RTOSBENCH_ROUNDS; ++i )
+	{
+		start = DWT_GetCycles();
+		xTaskNotifyGive( RTOSBENCH_Partner );
+		RTOSBENCH_Add( &notify, i, RTOSBENCH_Stamp - start );
+	}
+	for ( i = 0; i <= RTOSBENCH_ROUNDS; ++i )
+	{
+		start = DWT_GetCycles();
+		NVIC_SetPendingIRQ( RTOSBENCH_IRQ );
+		__DSB();
+		__ISB();
+		RTOSBENCH_Add( &entry, i, RTOSBENCH_IrqStamp - start );
+		RTOSBENCH_Add( &wake, i, RTOSBENCH_Stamp - RTOSBENCH_IrqStamp );
+	}
+	NVIC_DisableIRQ( RTOSBENCH_IRQ );
+
+	/* the partner at the priority of the caller yields until it is stopped */
+	vTaskPrioritySet( RTOSBENCH_Partner, prio );
+	RTOSBENCH_Mode = RTOSBENCH_YIELD;
+	xTaskNotifyGive( RTOSBENCH_Partner );
+	for ( i = 0; i <= RTOSBENCH_ROUNDS; ++i )
+	{
+		taskYIELD();
+		RTOSBENCH_Add( &yield, i, DWT_GetCycles() - RTOSBENCH_Stamp );
+	}
+	RTOSBENCH_Mode = RTOSBENCH_STOP;
+	while ( RTOSBENCH_Partner != NULL )
+		taskYIELD();
+
+	printf( "task selection: %s\n", configUSE_PORT_OPTIMISED_TASK_SELECTION ? "CLZ of ready bit map" : "priority scan" );
+	printf( "test        min(c)  avg(c)  max(c) avg(us)\n" );
+	RTOSBENCH_Print( "yield", &yield );
+	RTOSBENCH_Print( "notify", &notify );
+	RTOSBENCH_Print( "irq entry", &entry );
+	RTOSBENCH_Print( "irq wake", &wake );
+}
+
+/**
+ * @brief  Software interrupt of the benchmark: wakes the partner task
+ * @param  None
+ * @retval None
+ */
+void RTOSBench_IRQHandler( void )
+{
+	signed portBASE_TYPE woken = pdFALSE;
+
+	RTOSBENCH_IrqStamp = DWT_GetCycles();
+	vTaskNotifyGiveFromISR( RTOSBENCH_Partner, &woken );
+	portYIELD_FROM_ISR( woken );
+}
+
+#endif /* USE_RTOS_BENCH */
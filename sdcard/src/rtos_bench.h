@@ -0,0 +1,37 @@
+/**
+ ******************************************************************************
+ * @file    rtos_bench.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Kernel latency benchmark: cycles of a task switch by yield, of
+ *          a task notification waking a higher priority task and of an
+ *          interrupt waking a task (the path of SD transfer completions),
+ *          measured by the DWT cycle counter.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef RTOS_BENCH_H
+#define RTOS_BENCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include <stdint.h>
+
+/* Exported types ------------------------------------------------------------*/
+/* Exported constants --------------------------------------------------------*/
+/* Exported macro ------------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+
+void RTOSBench_Run( void );
+void RTOSBench_IRQHandler( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RTOS_BENCH_H */
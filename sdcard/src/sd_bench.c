@@ -0,0 +1,558 @@
+/**
+ ******************************************************************************
+ * @file    sd_bench.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   SD Card throughput benchmark. Each test repeats transfers of one
+ *          size and prints a table row (MB/s, IOPS, latency percentiles of
+ *          the DWT cycle counter) and a "BENCH," line for scripts:
+ *            BENCH,path,pattern,op,sectors,transfers,KB/s,IOPS,p50,p90,p99,max
+ *          with latencies in microseconds. Transfers longer than the buffer
+ *          are made of buffer sized requests kept in flight together (raw:
+ *          SD I/O task merges them into one multiple block transfer) or of
+ *          consecutive f_read/f_write calls (FatFs).
+ *          Before the tests a loopback run writes BENCH_VERIFY_SECTORS by
+ *          multiple block requests, reads them back and compares them, then
+ *          compares them once more by SD_IO_VERIFY requests (the cost of
+ *          verify after write, CRC16 compare without a copy with CRC on):
+ *            VERIFY,sectors,write KB/s,read KB/s,verify KB/s,first bad sector or -1
+ *          The first line tells the code profile of the build and how close
+ *          a polled block transfer of the SPI driver comes to the bus time
+ *          of its clocks (CPU overhead of the loop), so the runs of builds
+ *          before and after a change are compared (tools/bench_compare.py):
+ *            PROFILE,fast I/O code,RAM functions,block cycles,bus cycles
+ *          It is preceded by the identity of the card, the baselines of
+ *          tools/bench_regress.py are kept per CID, and the run ends with a
+ *          line telling whether each test has completed:
+ *            CARD,CID in hex,capacity KB,speed class
+ *            DONE,1 or 0
+ *          Random offsets start from the same seed in each run, so runs of
+ *          the same build on the same card repeat the same transfers.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "sd_bench.h"
+
+#ifdef USE_SD_BENCH
+
+#include "stm32_sd_io.h"
+#include "stm32_sd_spi.h"
+#include "stm32_spi.h"
+#include "stm32_dwt.h"
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "FAT/ff.h"
+#include "FAT/diskio.h"
+
+/* Standard includes */
+#include <stdio.h>
+
+#if !_USE_EXPAND || _FS_MINIMIZE > 2 || _FS_READONLY
+#error USE_SD_BENCH needs f_expand, f_lseek and writing functions of FatFs (see ffconf.h)
+#endif
+
+/* Private typedef -----------------------------------------------------------*/
+
+/* Test of one transfer size */
+typedef struct
+{
+	uint8_t		Fat;			/* 0: SD I/O requests, 1: FatFs */
+	uint8_t		Random;			/* 0: sequential, 1: random offsets */
+	uint8_t		Write;			/* 0: read, 1: write */
+	uint32_t	Sectors;		/* sectors per transfer */
+} BENCH_Test;
+
+/* Private define ------------------------------------------------------------*/
+
+/* Benchmark file and its size in sectors (8 Mb, allocated once as one contiguous block) */
+#define BENCH_FILE				"BENCH.BIN"
+#define BENCH_FILE_SECTORS		16384
+
+/* Data buffer from the heap (4 Kb): the largest request passed to SD I/O or FatFs */
+#define BENCH_BUFFER_SECTORS	8
+
+/* Requests of a raw transfer in flight at once (SD I/O queue keeps room for others) */
+#define BENCH_WINDOW			4
+
+/* Each test moves about this many sectors (1 Mb), in BENCH_MIN..BENCH_MAX transfers */
+#define BENCH_TEST_SECTORS		2048
+#define BENCH_MIN_TRANSFERS		16
+#define BENCH_MAX_TRANSFERS		128
+
+/* Loopback verification: sectors written by requests of the whole buffer (multiple block write),
+   each word holds its position and a stamp of the run, so stale data of a previous run fail */
+#define BENCH_VERIFY_SECTORS	1024
+
+/* Seed of the random offsets */
+#define BENCH_SEED				1
+
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+
+static const uint32_t BENCH_Sizes[] = { 1, 4, 8, 32, 128 };
+
+static FATFS BENCH_Fs;
+static FIL BENCH_File;
+static uint8_t* BENCH_Buffer;
+static uint32_t BENCH_Base;			/* first card block of the file (sectors of the benchmark are card blocks) */
+static uint32_t BENCH_Seed;			/* random offsets (LCG), BENCH_SEED at the start of each run */
+static SD_IO_Request BENCH_Req[ BENCH_WINDOW ];
+static SD_IO_Region BENCH_Region;		/* sectors of the file, claimed during raw tests */
+static uint32_t BENCH_Latency[ BENCH_MAX_TRANSFERS ];	/* microseconds, sorted after the test */
+
+/* Private function prototypes -----------------------------------------------*/
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Next pseudo random number
+ * @param  None
+ * @retval Random number
+ */
+static uint32_t BENCH_Random( void )
+{
+	BENCH_Seed = BENCH_Seed * 1664525 + 1013904223;
+	return BENCH_Seed >> 8;
+}
+
+/**
+ * @brief  Transfers sectors of the file by SD I/O requests, up to BENCH_WINDOW of them in flight
+ * @param  write: Nonzero to write
+ * @param  sector: First sector within the file
+ * @param  count: Number of sectors
+ * @retval The SD Response
+ */
+static SD_Error BENCH_RawTransfer( uint8_t write, uint32_t sector, uint32_t count )
+{
+	SD_Error res = SD_RESPONSE_NO_ERROR;
+	SD_Error r;
+	SD_IO_Request* req;
+	uint32_t done = 0;
+	uint8_t head = 0, busy = 0;
+
+	while ( done < count || busy > 0 )
+	{
+		if ( done < count && busy < BENCH_WINDOW )
+		{
+			req = &BENCH_Req[ ( head + busy ) % BENCH_WINDOW ];
+			req->Op = write ? SD_IO_WRITE : SD_IO_READ;
+			req->Sector = BENCH_Base + sector + done;
+			req->Count = ( count - done > BENCH_BUFFER_SECTORS ) ? BENCH_BUFFER_SECTORS : count - done;
+			req->Buffer = BENCH_Buffer;
+			if ( SD_IO_Submit( req ) == SD_RESPONSE_NO_ERROR )
+			{
+				done += req->Count;
+				++busy;
+				continue;
+			}
+			if ( busy == 0 )
+			{	/* queue is full of requests of other tasks */
+				vTaskDelay( 1 );
+				continue;
+			}
+		}
+		r = SD_IO_Wait( &BENCH_Req[ head ], portMAX_DELAY );
+		if ( r != SD_RESPONSE_NO_ERROR )
+			res = r;
+		head = ( head + 1 ) % BENCH_WINDOW;
+		--busy;
+	}
+	return res;
+}
+
+/**
+ * @brief  Transfers sectors of the file by FatFs
+ * @param  write: Nonzero to write
+ * @param  sector: First sector within the file
+ * @param  count: Number of sectors
+ * @retval FatFs result
+ */
+static FRESULT BENCH_FatTransfer( uint8_t write, uint32_t sector, uint32_t count )
+{
+	FRESULT res;
+	UINT len, n;
+
+	res = f_lseek( &BENCH_File, sector * SD_BLOCK_SIZE );
+	while ( res == FR_OK && count > 0 )
+	{
+		len = ( count > BENCH_BUFFER_SECTORS ) ? BENCH_BUFFER_SECTORS : count;
+		if ( write )
+			res = f_write( &BENCH_File, BENCH_Buffer, len * SD_BLOCK_SIZE, &n );
+		else
+			res = f_read( &BENCH_File, BENCH_Buffer, len * SD_BLOCK_SIZE, &n );
+		if ( res == FR_OK && n != len * SD_BLOCK_SIZE )
+			res = FR_DENIED;
+		count -= len;
+	}
+	return res;
+}
+
+/**
+ * @brief  Executes one raw request of the whole buffer or less
+ * @param  op: SD_IO_READ or SD_IO_WRITE
+ * @param  sector: First sector within the file
+ * @param  count: Number of sectors (up to BENCH_BUFFER_SECTORS)
+ * @retval The SD Response
+ */
+static SD_Error BENCH_RawExecute( SD_IO_Op op, uint32_t sector, uint32_t count )
+{
+	BENCH_Req[ 0 ].Op = op;
+	BENCH_Req[ 0 ].Sector = BENCH_Base + sector;
+	BENCH_Req[ 0 ].Count = count;
+	BENCH_Req[ 0 ].Buffer = BENCH_Buffer;
+	return SD_IO_Execute( &BENCH_Req[ 0 ] );
+}
+
+/**
+ * @brief  Fills the buffer with the pattern of the sectors or compares it with the pattern
+ * @param  check: 0 to fill, nonzero to compare
+ * @param  sector: First sector within the file
+ * @param  count: Number of sectors in the buffer
+ * @param  stamp: Stamp of the run
+ * @retval Number of the first sector which doesn't match plus 1, 0 if all match
+ */
+static uint32_t BENCH_Pattern( uint8_t check, uint32_t sector, uint32_t count, uint32_t stamp )
+{
+	uint32_t* word = (uint32_t*)BENCH_Buffer;
+	uint32_t i, v;
+
+	for ( i = 0; i < count * SD_BLOCK_SIZE / 4; ++i )
+	{
+		v = stamp ^ ( ( sector + i / ( SD_BLOCK_SIZE / 4 ) ) << 8 ) ^ ( i % ( SD_BLOCK_SIZE / 4 ) );
+		if ( !check )
+			word[ i ] = v;
+		else if ( word[ i ] != v )
+			return sector + i / ( SD_BLOCK_SIZE / 4 ) + 1;
+	}
+	return 0;
+}
+
+/**
+ * @brief  Writes sectors by multiple block requests, reads them back and compares them
+ * @param  None
+ * @retval Nonzero if all sectors were written and read back intact
+ */
+static uint8_t BENCH_Verify( void )
+{
+	uint32_t stamp = BENCH_Random() ^ DWT_GetCycles();		/* offsets repeat in each run, stamps don't */
+	uint32_t i, start, wr, rd, vf, bad = 0;
+	SD_Error res;
+
+	start = DWT_GetCycles();
+	for ( i = 0, res = SD_RESPONSE_NO_ERROR; i < BENCH_VERIFY_SECTORS && res == SD_RESPONSE_NO_ERROR; i += BENCH_BUFFER_SECTORS )
+	{
+		BENCH_Pattern( 0, i, BENCH_BUFFER_SECTORS, stamp );
+		res = BENCH_RawExecute( SD_IO_WRITE, i, BENCH_BUFFER_SECTORS );
+	}
+	if ( res == SD_RESPONSE_NO_ERROR )	/* buffered sectors go to the card, reads come from it */
+		res = BENCH_RawExecute( SD_IO_SYNC, 0, 0 );
+	wr = DWT_CyclesToUs( DWT_GetCycles() - start );
+
+	start = DWT_GetCycles();
+	for ( i = 0; i < BENCH_VERIFY_SECTORS && res == SD_RESPONSE_NO_ERROR && bad == 0; i += BENCH_BUFFER_SECTORS )
+	{
+		res = BENCH_RawExecute( SD_IO_READ, i, BENCH_BUFFER_SECTORS );
+		if ( res == SD_RESPONSE_NO_ERROR )
+			bad = BENCH_Pattern( 1, i, BENCH_BUFFER_SECTORS, stamp );
+	}
+	rd = DWT_CyclesToUs( DWT_GetCycles() - start );
+
+	start = DWT_GetCycles();
+	for ( i = 0; i < BENCH_VERIFY_SECTORS && res == SD_RESPONSE_NO_ERROR && bad == 0; i += BENCH_BUFFER_SECTORS )
+	{	/* the pattern is made again as the writer has its data */
+		BENCH_Pattern( 0, i, BENCH_BUFFER_SECTORS, stamp );
+		res = BENCH_RawExecute( SD_IO_VERIFY, i, BENCH_BUFFER_SECTORS );
+	}
+	vf = DWT_CyclesToUs( DWT_GetCycles() - start );
+
+	if ( res != SD_RESPONSE_NO_ERROR )
+	{
+		printf( "raw seq vfy %3u : failed with code %d before sector %lu\n", BENCH_BUFFER_SECTORS, res, i );
+		return 0;
+	}
+	if ( wr == 0 )
+		wr = 1;
+	if ( rd == 0 )
+		rd = 1;
+	if ( vf == 0 )
+		vf = 1;
+	wr = (uint32_t)( (uint64_t)BENCH_VERIFY_SECTORS * SD_BLOCK_SIZE * 1000000 / 1024 / wr );
+	rd = (uint32_t)( (uint64_t)BENCH_VERIFY_SECTORS * SD_BLOCK_SIZE * 1000000 / 1024 / rd );
+	vf = ( bad == 0 ) ? (uint32_t)( (uint64_t)BENCH_VERIFY_SECTORS * SD_BLOCK_SIZE * 1000000 / 1024 / vf ) : 0;
+	if ( bad != 0 )
+		printf( "raw seq vfy %3u : sector %lu doesn't match\n", BENCH_BUFFER_SECTORS, bad - 1 );
+	else
+		printf( "raw seq vfy %3u : %u sectors match, write %lu.%02lu MB/s, read %lu.%02lu MB/s, verify %lu.%02lu MB/s\n",
+				BENCH_BUFFER_SECTORS, BENCH_VERIFY_SECTORS, wr / 1024, ( wr % 1024 ) * 100 / 1024, rd / 1024, ( rd % 1024 ) * 100 / 1024,
+				vf / 1024, ( vf % 1024 ) * 100 / 1024 );
+	printf( "VERIFY,%u,%lu,%lu,%lu,%ld\n", BENCH_VERIFY_SECTORS, wr, rd, vf, (long)bad - 1 );
+	return ( bad == 0 );
+}
+
+/**
+ * @brief  Prints the code profile of the build and times one polled block transfer on SPI bus
+ *         of the card (its clock, the card is not selected: it ignores the dummy bytes)
+ * @param  None
+ * @retval None
+ */
+static void BENCH_Profile( void )
+{
+	RCC_ClocksTypeDef RCC_Clocks;
+	SPI_Bus* bus = SD_Card.Spi.Bus;
+	uint32_t start, cycles, bus_cycles, hz;
+	uint8_t fast = 0, ram = 0;
+
+#ifdef USE_FAST_IO_CODE
+	fast = 1;
+#endif /* USE_FAST_IO_CODE */
+#ifdef USE_RAM_FUNC
+	ram = 1;
+#endif /* USE_RAM_FUNC */
+
+	STM_EVAL_SPI_Lock( &SD_Card.Spi );
+	start = DWT_GetCycles();
+	STM_EVAL_SPI_PIO_Transfer( bus, NULL, NULL, SD_BLOCK_SIZE );
+	cycles = DWT_GetCycles() - start;
+	/* bus clock = APB clock / 2^(BR+1) */
+	RCC_GetClocksFreq( &RCC_Clocks );
+	hz = ( bus->SPIx == SPI1 ) ? RCC_Clocks.PCLK2_Frequency : RCC_Clocks.PCLK1_Frequency;
+	hz >>= ( ( bus->SPIx->CR1 & SPI_CR1_BR ) >> 3 ) + 1;
+	STM_EVAL_SPI_Unlock( &SD_Card.Spi );
+
+	bus_cycles = (uint32_t)( (uint64_t)SD_BLOCK_SIZE * 8 * RCC_Clocks.HCLK_Frequency / hz );
+	printf( "code: fast I/O %s, RAM functions %s, polled block %lu cycles (bus %lu cycles at %lu kHz)\n",
+			fast ? "on" : "off", ram ? "on" : "off", cycles, bus_cycles, hz / 1000 );
+	printf( "PROFILE,%u,%u,%lu,%lu\n", fast, ram, cycles, bus_cycles );
+}
+
+/**
+ * @brief  Prints identity of the card the results belong to
+ * @param  None
+ * @retval None
+ */
+static void BENCH_Identify( void )
+{
+	SD_CardInfo info;
+	uint8_t i;
+
+	if ( SD_GetCardInfo( &SD_Card, &info ) != SD_RESPONSE_NO_ERROR )
+		return;
+	printf( "card: CID " );
+	for ( i = 0; i < 16; ++i )
+		printf( "%02X", info.CID[ i ] );
+	printf( ", %lu KB, speed class %u\n", (uint32_t)info.CardCapacity, SD_IO_SpeedClass() );
+	printf( "CARD," );
+	for ( i = 0; i < 16; ++i )
+		printf( "%02X", info.CID[ i ] );
+	printf( ",%lu,%u\n", (uint32_t)info.CardCapacity, SD_IO_SpeedClass() );
+}
+
+/**
+ * @brief  Sorts latencies of the test
+ * @param  n: Number of transfers
+ * @retval None
+ */
+static void BENCH_Sort( uint32_t n )
+{
+	uint32_t i, j, v;
+
+	for ( i = 1; i < n; ++i )
+	{
+		v = BENCH_Latency[ i ];
+		for ( j = i; j > 0 && BENCH_Latency[ j - 1 ] > v; --j )
+			BENCH_Latency[ j ] = BENCH_Latency[ j - 1 ];
+		BENCH_Latency[ j ] = v;
+	}
+}
+
+/**
+ * @brief  Runs one test and prints its results
+ * @param  t: Test
+ * @retval Nonzero if all transfers succeeded
+ */
+static uint8_t BENCH_RunTest( const BENCH_Test* t )
+{
+	const char* path = t->Fat ? "fat" : "raw";
+	const char* pattern = t->Random ? "rnd" : "seq";
+	const char* op = t->Write ? "wr" : "rd";
+	uint32_t n = BENCH_TEST_SECTORS / t->Sectors;
+	uint32_t i, start, sector, kbps, iops;
+	uint64_t total = 0;
+	uint8_t ok = 1;
+
+	if ( n < BENCH_MIN_TRANSFERS )
+		n = BENCH_MIN_TRANSFERS;
+	if ( n > BENCH_MAX_TRANSFERS )
+		n = BENCH_MAX_TRANSFERS;
+
+	for ( i = 0; i < n && ok; ++i )
+	{
+		if ( t->Random )
+			sector = ( BENCH_Random() % ( BENCH_FILE_SECTORS / t->Sectors ) ) * t->Sectors;
+		else
+			sector = ( i * t->Sectors ) % BENCH_FILE_SECTORS;
+		start = DWT_GetCycles();
+		if ( t->Fat )
+			ok = ( BENCH_FatTransfer( t->Write, sector, t->Sectors ) == FR_OK );
+		else
+			ok = ( BENCH_RawTransfer( t->Write, sector, t->Sectors ) == SD_RESPONSE_NO_ERROR );
+		BENCH_Latency[ i ] = DWT_CyclesToUs( DWT_GetCycles() - start );
+		total += BENCH_Latency[ i ];
+	}
+	if ( ok && t->Fat && t->Write )
+		ok = ( f_sync( &BENCH_File ) == FR_OK );
+	if ( !ok )
+	{
+		printf( "%s %s %s %3lu : failed at transfer %lu\n", path, pattern, op, t->Sectors, i );
+		return 0;
+	}
+
+	if ( total == 0 )
+		total = 1;
+	kbps = (uint32_t)( ( (uint64_t)n * t->Sectors * SD_BLOCK_SIZE * 1000000 / 1024 ) / total );
+	iops = (uint32_t)( (uint64_t)n * 1000000 / total );
+	BENCH_Sort( n );
+	printf( "%s %s %s %3lu %5lu.%02lu %6lu %7lu %7lu %7lu %8lu\n", path, pattern, op, t->Sectors,
+			kbps / 1024, ( kbps % 1024 ) * 100 / 1024, iops,
+			BENCH_Latency[ n / 2 ], BENCH_Latency[ n * 9 / 10 ], BENCH_Latency[ n * 99 / 100 ], BENCH_Latency[ n - 1 ] );
+	printf( "BENCH,%s,%s,%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n", path, pattern, op, t->Sectors, n, kbps, iops,
+			BENCH_Latency[ n / 2 ], BENCH_Latency[ n * 9 / 10 ], BENCH_Latency[ n * 99 / 100 ], BENCH_Latency[ n - 1 ] );
+	return 1;
+}
+
+/**
+ * @brief  Opens the benchmark file, creates it as one contiguous block if it doesn't exist
+ * @param  None
+ * @retval FatFs result
+ */
+static FRESULT BENCH_Open( void )
+{
+	FRESULT res;
+
+	res = f_open( &BENCH_File, BENCH_FILE, FA_READ | FA_WRITE | FA_OPEN_ALWAYS );
+	if ( res != FR_OK )
+		return res;
+	if ( BENCH_File.fsize == 0 )
+	{
+		res = f_expand( &BENCH_File, (DWORD)BENCH_FILE_SECTORS * SD_BLOCK_SIZE, 1 );
+		if ( res == FR_OK )
+			res = f_lseek( &BENCH_File, (DWORD)BENCH_FILE_SECTORS * SD_BLOCK_SIZE );
+	}
+	if ( res == FR_OK && BENCH_File.fsize != (DWORD)BENCH_FILE_SECTORS * SD_BLOCK_SIZE )
+		res = FR_DENIED;	/* no contiguous space or file of other size */
+	if ( res == FR_OK )
+		BENCH_Base = clust2sect( BENCH_File.fs, BENCH_File.sclust ) * DISK_BLOCKS;
+	if ( res == FR_OK && BENCH_Base == 0 )
+		res = FR_DENIED;
+	if ( res != FR_OK )
+		f_close( &BENCH_File );
+	return res;
+}
+
+/**
+ * @brief  Ends raw tests: releases sectors of the file and drops their copies held by
+ *         FatFs and diskio, raw writes go around them
+ * @param  None
+ * @retval None
+ */
+static void BENCH_DropCache( void )
+{
+	DWORD first = BENCH_Base / DISK_BLOCKS;
+
+	SD_IO_Release( &BENCH_Region );
+	f_invalidate( BENCH_File.fs->drv, first, ( BENCH_Base + BENCH_FILE_SECTORS - 1 ) / DISK_BLOCKS - first + 1 );
+}
+
+/**
+ * @brief  Runs loopback verification, then all tests: raw before FatFs, writes before reads of the same pattern
+ * @param  None
+ * @retval Nonzero if all tests have completed
+ */
+static uint8_t BENCH_Suite( void )
+{
+	BENCH_Test t;
+	FRESULT res;
+	uint8_t i, ok = 1;
+
+	if ( SD_IO_Detect() == SD_NOT_PRESENT )
+	{
+		printf( "SDCard isn't detected\n" );
+		return 0;
+	}
+	BENCH_Buffer = pvPortMalloc( BENCH_BUFFER_SECTORS * SD_BLOCK_SIZE );
+	if ( BENCH_Buffer == NULL )
+	{
+		printf( "No heap for the benchmark buffer\n" );
+		return 0;
+	}
+	for ( i = 0; i < BENCH_WINDOW; ++i )
+	{
+		if ( BENCH_Req[ i ].Done == NULL )
+			SD_IO_RequestInit( &BENCH_Req[ i ] );
+		BENCH_Req[ i ].Region = &BENCH_Region;
+	}
+	DWT_Enable();
+
+	res = f_mount( 0, &BENCH_Fs );
+	if ( res == FR_OK )
+		res = BENCH_Open();
+	if ( res == FR_OK && SD_IO_Claim( &BENCH_Region, BENCH_Base, BENCH_FILE_SECTORS ) != SD_RESPONSE_NO_ERROR )
+	{
+		f_close( &BENCH_File );
+		res = FR_DENIED;	/* file is used by another raw user */
+	}
+	if ( res != FR_OK )
+	{
+		printf( "Benchmark file " BENCH_FILE " failed with code %d\n", res );
+		vPortFree( BENCH_Buffer );
+		return 0;
+	}
+
+	BENCH_Identify();
+	BENCH_Profile();
+	/* throughput means nothing if data don't come back intact */
+	ok = BENCH_Verify();
+
+	printf( "path pat op sect   MB/s   IOPS p50(us) p90(us) p99(us)  max(us)\n" );
+	for ( t.Fat = 0; t.Fat < 2 && ok; ++t.Fat )
+	{
+		if ( t.Fat )
+			BENCH_DropCache();
+		for ( t.Random = 0; t.Random < 2 && ok; ++t.Random )
+			for ( t.Write = 2; t.Write-- > 0 && ok; )
+				for ( i = 0; i < sizeof( BENCH_Sizes ) / sizeof( BENCH_Sizes[ 0 ] ) && ok; ++i )
+				{
+					t.Sectors = BENCH_Sizes[ i ];
+					ok = BENCH_RunTest( &t );
+				}
+	}
+
+	BENCH_DropCache();		/* if stopped in raw tests (does no harm otherwise) */
+	f_close( &BENCH_File );
+	vPortFree( BENCH_Buffer );
+	return ok;
+}
+
+/* Public functions ----------------------------------------------------------*/
+
+/**
+ * @brief  Runs the benchmark and tells its end to scripts (tools/bench_regress.py)
+ * @param  None
+ * @retval None
+ */
+void SDBench_Run( void )
+{
+	uint8_t ok;
+
+	BENCH_Seed = BENCH_SEED;
+	ok = BENCH_Suite();
+	printf( "DONE,%u\n", ok );
+}
+
+#endif /* USE_SD_BENCH */
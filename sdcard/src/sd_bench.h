@@ -0,0 +1,36 @@
+/**
+ ******************************************************************************
+ * @file    sd_bench.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   SD Card throughput benchmark: sequential and random reads and
+ *          writes of 1 to 128 sectors, by SD I/O requests (raw) and by
+ *          FatFs, inside a preallocated contiguous file BENCH.BIN, so the
+ *          file system and other files are never touched.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef SD_BENCH_H
+#define SD_BENCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include <stdint.h>
+
+/* Exported types ------------------------------------------------------------*/
+/* Exported constants --------------------------------------------------------*/
+/* Exported macro ------------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+
+void SDBench_Run( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SD_BENCH_H */
@@ -0,0 +1,135 @@
+/**
+ ******************************************************************************
+ * @file    storage_conf.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Sizes of the buffers, caches and queues of the storage stack
+ *          (SD I/O task, sector cache, buffer pool, debug rings) in one
+ *          place, with the RAM each of them takes. Every size may be set
+ *          by the build (e.g. DEFS="-DPOOL_BLOCKS=16" of GCC-ARM/Makefile).
+ *
+ *          RAM budget of the STM32F207 (see GCC-ARM/stm32_flash.ld):
+ *          - SRAM1 112 Kb: .data, .dma_buffers (pool, DMA buffers), .bss
+ *            (FreeRTOS heap of configTOTAL_HEAP_SIZE with the task stacks,
+ *            FatFs objects, rings), newlib heap, .fs_cache (sector cache),
+ *            spare SRAM, main stack of 4 Kb at the end
+ *          - SRAM2 16 Kb: .fast_stacks
+ *          With USE_SPARE_RAM_CACHE the sector cache takes all the spare
+ *          SRAM, so every byte saved here is one more cached sector per 512.
+ *          "make footprint" of GCC-ARM/Makefile prints for each profile the
+ *          sections, the largest objects and the spare SRAM from the map.
+ *
+ *          Besides the sizes below each FATFS object holds a window of
+ *          _MAX_SS bytes and each FIL one more unless _FS_TINY (ffconf.h);
+ *          tasks calling FatFs need stack for the SD_CardInfo of disk_ioctl
+ *          (about 100 bytes) and the 64-byte status of SD_GetStatus.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STORAGE_CONF_H
+#define STORAGE_CONF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Exported constants --------------------------------------------------------*/
+
+/* Sector sized blocks of the buffer pool (stm32_pool.h), 512 bytes each in .dma_buffers,
+   they also size the queues of the camera and the ADC sampler */
+#ifndef POOL_BLOCKS
+#define POOL_BLOCKS				8
+#endif /* POOL_BLOCKS */
+
+/* Pending requests of the SD I/O task, 4 bytes each in the queue (FreeRTOS heap, twice with
+   USE_SD_IO_PRIORITY: bulk and interactive queues), also the longest batch of merged writes */
+#ifndef SD_IO_QUEUE_LEN
+#define SD_IO_QUEUE_LEN			8
+#endif /* SD_IO_QUEUE_LEN */
+
+/* Stack of the SD I/O task in words (FreeRTOS heap, 4 bytes per word) */
+#ifndef SD_IO_TASK_STACK
+#define SD_IO_TASK_STACK		( configMINIMAL_STACK_SIZE * 2 )
+#endif /* SD_IO_TASK_STACK */
+
+/* Pending discarded ranges of the SD I/O task, 8 bytes each in .bss */
+#ifndef SD_IO_DISCARD_LEN
+#define SD_IO_DISCARD_LEN		8
+#endif /* SD_IO_DISCARD_LEN */
+
+/* Sectors prefetched by streaming reads (USE_SD_READ_AHEAD), 512 bytes each in .dma_buffers */
+#if defined( USE_SD_READ_AHEAD ) && !defined( SD_IO_READ_AHEAD_LEN )
+#define SD_IO_READ_AHEAD_LEN	8
+#endif /* USE_SD_READ_AHEAD && !SD_IO_READ_AHEAD_LEN */
+
+/* Write-back buffer of the SD I/O task in sectors (USE_SD_WRITE_BUFFER), power of two up to
+   the smallest AU (32 sectors = 16 Kb), so it never spans two AUs, 512 bytes each in .dma_buffers */
+#if defined( USE_SD_WRITE_BUFFER ) && !defined( SD_IO_WRITE_BUFFER_LEN )
+#define SD_IO_WRITE_BUFFER_LEN	32
+#endif /* USE_SD_WRITE_BUFFER && !SD_IO_WRITE_BUFFER_LEN */
+
+/* Sectors of the diskio cache (USE_DISK_CACHE), _MAX_SS bytes and 16 bytes of the slot each:
+   in .fs_cache 8 Kb, at least 4 sectors (up to 254), or up to this number of sectors laid out
+   in the spare SRAM with USE_SPARE_RAM_CACHE */
+#ifndef DISK_CACHE_SLOTS
+#ifndef USE_SPARE_RAM_CACHE
+#define DISK_CACHE_SLOTS		( _MAX_SS <= 2048 ? 8192 / _MAX_SS : 4 )
+#else
+#define DISK_CACHE_SLOTS		254
+#endif /* USE_SPARE_RAM_CACHE */
+#endif /* DISK_CACHE_SLOTS */
+
+/* Hash chains of the diskio cache (power of 2), one byte each in .bss */
+#ifndef DISK_CACHE_HASH
+#ifndef USE_SPARE_RAM_CACHE
+#define DISK_CACHE_HASH			16
+#else
+#define DISK_CACHE_HASH			64
+#endif /* USE_SPARE_RAM_CACHE */
+#endif /* DISK_CACHE_HASH */
+
+/* Second tier of the diskio cache in external SRAM (USE_EXT_SRAM), sets of ways: 3968 sectors
+   of 512 bytes, tags and data take 2 Mb of the external SRAM and nothing of SRAM1 */
+#ifndef DISK_CACHE2_WAYS
+#define DISK_CACHE2_WAYS		4
+#endif /* DISK_CACHE2_WAYS */
+#ifndef DISK_CACHE2_SETS
+#define DISK_CACHE2_SETS		( 992 * 512 / _MAX_SS )
+#endif /* DISK_CACHE2_SETS */
+
+/* Sectors of each of the two buffers of USB mass storage (USE_USB_MSC), 512 bytes each in
+   .dma_buffers: a READ(10) or WRITE(10) moves this many sectors per card request while the other
+   buffer is on the bus, 4 Kb take 3.4 ms at full speed */
+#ifndef FMSC_BUFFER_SECTORS
+#define FMSC_BUFFER_SECTORS		8
+#endif /* FMSC_BUFFER_SECTORS */
+
+/* Body ring of the network file service (USE_NET_FILE_SERVICE) in sectors of 512 bytes in
+   .dma_buffers, also the largest TCP send window: 16 Kb are 1.3 ms at 100 Mbit/s */
+#ifndef FNET_BUFFER_SECTORS
+#define FNET_BUFFER_SECTORS		32
+#endif /* FNET_BUFFER_SECTORS */
+
+/* Receive buffers of the Ethernet MAC (USE_NET_FILE_SERVICE), 1536 bytes each in .dma_buffers:
+   8 buffers are 1 ms of back to back full size frames */
+#ifndef EMAC_RX_BUFFERS
+#define EMAC_RX_BUFFERS			8
+#endif /* EMAC_RX_BUFFERS */
+
+/* Transmit ring of the serial console (USE_SERIAL_TX_RING) in bytes (power of 2) in .bss,
+   1 Kb is 89 ms of output at 115200 baud */
+#ifndef DEBUG_TX_SIZE
+#define DEBUG_TX_SIZE			1024
+#endif /* DEBUG_TX_SIZE */
+
+/* Records of the event trace ring (USE_EVENT_TRACE, power of 2), 16 bytes each in .bss */
+#ifndef EVENT_TRACE_SIZE
+#define EVENT_TRACE_SIZE		256
+#endif /* EVENT_TRACE_SIZE */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STORAGE_CONF_H */
@@ -16,37 +16,222 @@
 
 #include "stm32_buttons.h"
 #include "stm32_sd_spi.h"
+#include "stm32_sd_io.h"
+#include "stm32_sd_info.h"
+#include "stm32_pool.h"
+#include "stm32_dwt.h"
+#include "stm32_chksum.h"
+#include "stm32_bootcache.h"
+#include "task_stats.h"
+#include "init_profile.h"
+#include "serial_debug.h"
+#include "sd_bench.h"
+#include "rtos_bench.h"
+#include "cam_record.h"
+#include "adc_logger.h"
 
 /* Scheduler */
 #include "FreeRTOS.h"
 #include "task.h"
+#include "semphr.h"
+#if configUSE_TIMERS
+#include "timers.h"
+#endif
 
 #include "FAT/ff.h"
+#include "FAT/diskio.h"
+#include "FAT/ffstate.h"
+#include "FAT/ffremap.h"
 
 /* Standard includes */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 /* Private typedef -----------------------------------------------------------*/
+
+/* Timing learned for the card, stored on the card itself (or in the boot cache) */
+typedef struct
+{
+	uint8_t		CID[ 16 ];
+	SD_Timing	Timing;
+} SDCard_TimingRecord;
+
 /* Private define ------------------------------------------------------------*/
+
+/* Button state is read again this long after its last edge (contacts bounce) */
+#define BTN_DEBOUNCE_TICKS		( 20 / portTICK_RATE_MS )
+
+/* Bad block remap file of volume 0 and its spare blocks (32 Kb, created on the first mount) */
+#define SDCARD_REMAP_FILE		"REMAP.BIN"
+#define SDCARD_REMAP_SPARES		64
+
+#ifdef USE_CONSOLE_SHELL
+/* Longest command line of the console shell */
+#define SHELL_LINE_SIZE			64
+
+/* Buttons and shell commands use the same objects (fs, f), they run one at a time */
+#define CMD_LOCK()				xSemaphoreTake( Cmd_mutex, portMAX_DELAY )
+#define CMD_UNLOCK()			xSemaphoreGive( Cmd_mutex )
+#else
+#define CMD_LOCK()				do {} while ( 0 )
+#define CMD_UNLOCK()			do {} while ( 0 )
+#endif /* USE_CONSOLE_SHELL */
+
 /* Private macro -------------------------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
+
+/**
+ * Bitmask with flags for buttons pressed and touchscreen, set by EXTI handlers
+ * Bit 0 - BTN1
+ * Bit 1 - BTN2
+ * Bit 2 - BTN3
+ * Bit 3 - BTN4
+ * Bit 4 - Touch screen
+ */
+static volatile uint8_t PB_Touch_flag;
+static xSemaphoreHandle PB_Touch_sem;		/* given on each edge (by debounce timer), the task sleeps on it */
+static xStaticSemaphore PB_Touch_sem_buf;
+#if configUSE_TIMERS
+static xTimerHandle PB_Debounce_timer;		/* restarted on each edge, expires BTN_DEBOUNCE_TICKS later */
+static xStaticTimer PB_Debounce_timer_buf;
+#endif
+#ifdef USE_CONSOLE_SHELL
+static xSemaphoreHandle Cmd_mutex;			/* held while a button or shell command runs */
+static xStaticSemaphore Cmd_mutex_buf;
+#endif /* USE_CONSOLE_SHELL */
+
 /* Private functions ---------------------------------------------------------*/
 
 static const TCHAR filename[ 12 + 1 ] = { 'T', 'E', 'S', 'T', '_', 'S', 'D', 'C', '.', 'T', 'X', 'T', '\0' };
 static const TCHAR filecontext[ 15 ] = { 'U', 'C', 'A', 'N', '-', 'S', 'T', 'M', '3', '2', 'F', '2', '1', '7', '\0' };
 static FATFS fs;
 static FIL f;
+#ifdef USE_DISK_REMAP
+static REMAP_File remap;
+#endif /* USE_DISK_REMAP */
+
+/**
+ * @brief  Initializes the card through SD I/O only if it isn't initialized yet:
+ *         card information is read once by the driver and served from its copy
+ * @param  None
+ * @retval The SD Response
+ */
+static SD_Error SDCard_Ready( void )
+{
+	static SD_IO_Request req;
+
+	if ( SD_IO_Ready() )
+		return SD_RESPONSE_NO_ERROR;
+	if ( req.Done == NULL )
+		SD_IO_RequestInit( &req );
+	req.Op = SD_IO_INIT;
+	return SD_IO_Execute( &req );
+}
+
+#ifdef USE_BOOT_CACHE
+/**
+ * @brief  Restores timing stored for this card by SDCard_TimingSave: it is in FLASH,
+ *         so it applies before the volume is mounted
+ * @param  None
+ * @retval None
+ */
+static void SDCard_TimingLoad( void )
+{
+	const SDCard_TimingRecord* rec;
+	SD_CardInfo info;
+	uint16_t len;
+
+	if ( SDCard_Ready() != SD_RESPONSE_NO_ERROR || SD_GetCardInfo( &SD_Card, &info ) != SD_RESPONSE_NO_ERROR )
+		return;
+	rec = (const SDCard_TimingRecord*)BOOT_Find( BOOT_TAG_TIMING, CHK_Crc32( info.CID, sizeof( info.CID ) ), &len );
+	if ( rec != NULL && len == sizeof( *rec ) && memcmp( rec->CID, info.CID, sizeof( rec->CID ) ) == 0 )
+	{
+		SD_SetTiming( &SD_Card, &rec->Timing );
+		printf( "SDCard timing restored\n" );
+	}
+}
+
+/**
+ * @brief  Stores timing learned for this card (FLASH is written only if it has changed)
+ * @param  None
+ * @retval None
+ */
+static void SDCard_TimingSave( void )
+{
+	SDCard_TimingRecord rec;
+	SD_CardInfo info;
+
+	if ( SD_GetCardInfo( &SD_Card, &info ) != SD_RESPONSE_NO_ERROR )
+		return;
+	memcpy( rec.CID, info.CID, sizeof( rec.CID ) );
+	SD_GetTiming( &SD_Card, &rec.Timing );
+	if ( BOOT_Put( BOOT_TAG_TIMING, CHK_Crc32( rec.CID, sizeof( rec.CID ) ), NULL, 0, &rec, sizeof( rec ) ) != SUCCESS )
+		printf( "SDCard timing wasn't stored\n" );
+}
+#else
+/* File of SDCard_TimingRecord, it is used only for the same card (CID) */
+static const TCHAR timingname[ 12 + 1 ] = { 'S', 'D', 'T', 'I', 'M', 'I', 'N', 'G', '.', 'B', 'I', 'N', '\0' };
 
-static uint8_t buff[ 512 ];
-static uint8_t buff1[ 512 ];
+/**
+ * @brief  Restores timing stored for this card by SDCard_TimingSave
+ * @param  None
+ * @retval None
+ */
+static void SDCard_TimingLoad( void )
+{
+	SDCard_TimingRecord rec;
+	SD_CardInfo info;
+	UINT nb;
+
+	if ( f_open( &f, timingname, FA_OPEN_EXISTING | FA_READ ) != FR_OK )
+		return;
+	if ( SD_GetCardInfo( &SD_Card, &info ) != SD_RESPONSE_NO_ERROR )
+	{	/* card is initialized by f_open */
+		f_close( &f );
+		return;
+	}
+	if ( f_read( &f, &rec, sizeof( rec ), &nb ) == FR_OK && nb == sizeof( rec ) &&
+		 memcmp( rec.CID, info.CID, sizeof( rec.CID ) ) == 0 )
+	{
+		SD_SetTiming( &SD_Card, &rec.Timing );
+		printf( "SDCard timing restored\n" );
+	}
+	f_close( &f );
+}
+
+/**
+ * @brief  Stores timing learned for this card
+ * @param  None
+ * @retval None
+ */
+static void SDCard_TimingSave( void )
+{
+	SDCard_TimingRecord rec;
+	SD_CardInfo info;
+	UINT nb;
+
+	if ( f_open( &f, timingname, FA_CREATE_ALWAYS | FA_WRITE ) != FR_OK )
+		return;
+	if ( SD_GetCardInfo( &SD_Card, &info ) != SD_RESPONSE_NO_ERROR )
+	{	/* card is initialized by f_open */
+		f_close( &f );
+		return;
+	}
+	memcpy( rec.CID, info.CID, sizeof( rec.CID ) );
+	SD_GetTiming( &SD_Card, &rec.Timing );
+	if ( f_write( &f, &rec, sizeof( rec ), &nb ) != FR_OK || nb != sizeof( rec ) )
+		printf( "SDCard timing wasn't stored\n" );
+	f_close( &f );
+}
+#endif /* USE_BOOT_CACHE */
 
 static void SDCard_Run( void )
 {
 	UINT nb;
 	FRESULT rs;
 
-	if ( SD_Detect() == SD_NOT_PRESENT )
+	if ( SD_Detect( &SD_Card ) == SD_NOT_PRESENT )
 	{
 		printf( "SDCard isn't detected\n" );
 		return;
@@ -60,6 +245,14 @@ static void SDCard_Run( void )
 		return;
 	}
 	printf( "OK\n" );
+	SDCard_TimingLoad();
+#ifdef USE_DISK_REMAP
+	rs = REMAP_Open( &remap, SDCARD_REMAP_FILE, SDCARD_REMAP_SPARES );
+	if ( rs == FR_OK )
+		printf( "Remap table: %lu of %lu spare blocks taken\n", remap.Table.Used, remap.Table.Spares );
+	else
+		printf( "Remap table isn't attached, code %d\n", rs );
+#endif /* USE_DISK_REMAP */
 
 	printf( "f_open() ... " );
 	rs = f_open( &f, filename, FA_OPEN_ALWAYS | FA_READ | FA_WRITE );
@@ -87,15 +280,31 @@ static void SDCard_Run( void )
 		return;
 	}
 	printf( " OK\n" );
+	SDCard_TimingSave();
+
+#if defined(USE_BOOT_CACHE) && _FS_WARM
+	/* pending FSInfo is written by unmount, the next power-on mounts from the saved state
+	   unless the card is written in between */
+	f_mount( 0, NULL );
+	if ( FF_StateSave( 0 ) == SUCCESS )
+		printf( "Volume state saved\n" );
+#endif /* USE_BOOT_CACHE && _FS_WARM */
 }
 
 static void SDCard_Dump( void )
 {
+	static SD_IO_Request req;
 	SD_Error res;
 	SD_CardInfo cardinfo;
-	uint8_t i, j;
+	uint8_t* buff = POOL_Alloc();
+
+	if ( buff == NULL )
+	{
+		printf( "No free sector buffer\n" );
+		return;
+	}
 
-	if ( SD_Detect() == SD_NOT_PRESENT )
+	if ( SD_Detect( &SD_Card ) == SD_NOT_PRESENT )
 	{
 		printf( "SDCard isn't detected\n" );
 	}
@@ -104,29 +313,37 @@ static void SDCard_Dump( void )
 		printf( "SDCard detected\n" );
 		memset( &cardinfo, 0, sizeof(cardinfo) );
 
-		// initialize SD Card...
-		res = SD_Init();
+		// initialize SD Card if it isn't yet...
+		res = SDCard_Ready();
 		if ( res == SD_RESPONSE_NO_ERROR )
 		{
-			res = SD_GetCardInfo( &cardinfo );
+			res = SD_GetCardInfo( &SD_Card, &cardinfo );
 			if ( res == SD_RESPONSE_NO_ERROR )
 			{
+#ifdef USE_SD_DUMP
 				SD_DumpCardInfo( &cardinfo );
+#else
+				SD_InfoPrint( &cardinfo, NULL );
+#endif /* USE_SD_DUMP */
 			}
 			else
 			{
 				printf( "SDCard information retrieval failed with code %d\n", res );
 			}
-			res = SD_SectorRead( 0, buff );
+			/* through SD I/O queue: sees writes still buffered there, in order with raw writers */
+			if ( req.Done == NULL )
+				SD_IO_RequestInit( &req );
+			req.Op = SD_IO_READ;
+			req.Sector = 0;
+			req.Count = 1;
+			req.Buffer = buff;
+			res = SD_IO_Execute( &req );
 			if ( res == SD_RESPONSE_NO_ERROR )
 			{
 				printf( "Sector 0:\n" );
-				for ( i=0; i<32; ++i )
-				{
-					for ( j=0; j<16; ++j )
-						printf( " %02X", buff[ 16*i + j ] );
-					printf("\n");
-				}
+#ifdef SERIAL_DEBUG
+				DebugComPort_HexDump( buff, SD_BLOCK_SIZE, 0 );
+#endif /* SERIAL_DEBUG */
 			}
 			else
 			{
@@ -138,94 +355,41 @@ static void SDCard_Dump( void )
 			printf( "SDCard initialization failed with code %d\n", res );
 		}
 	}
+	POOL_Free( buff );
 }
 
-static void SDCard_Erase( void )
+static void Cache_Print( void )
 {
-	SD_Error res;
-
-	if ( SD_Detect() == SD_NOT_PRESENT )
-	{
-		printf( "SDCard isn't detected\n" );
-	}
-	else
-	{
-		printf( "SDCard detected\n" );
-
-		// initialize SD Card...
-		res = SD_Init();
-		if ( res == SD_RESPONSE_NO_ERROR )
-		{
-			uint32_t ReadAddr = 123;
-			uint8_t i, j;
-
-			res = SD_SectorRead( ReadAddr, buff );
-			if ( res == SD_RESPONSE_NO_ERROR )
-			{
-				printf( "Sector %lu:\n", ReadAddr );
-				for ( i=0; i<32; ++i )
-				{
-					for ( j=0; j<16; ++j )
-						printf( " %02X", buff[ 16*i + j ] );
-					printf("\n");
-				}
-			}
-			else
-				printf( "SDCard read sector %lu failed\n", ReadAddr );
-
-			res = SD_SectorErase( ReadAddr );
-			if ( res == SD_RESPONSE_NO_ERROR )
-				printf( "Sector erase succeeded\n" );
-			else
-				printf( "Sector erase failed\n" );
-
-			res = SD_SectorRead( ReadAddr, buff1 );
-			if ( res == SD_RESPONSE_NO_ERROR )
-			{
-				printf( "Sector %lu:\n", ReadAddr );
-				for ( i=0; i<32; ++i )
-				{
-					for ( j=0; j<16; ++j )
-						printf( " %02X", buff[ 16*i + j ] );
-					printf("\n");
-				}
-			}
-			else
-				printf( "SDCard read sector %lu failed\n", ReadAddr );
-
-//			memset( buff, 0x00, sizeof(buff) );
-
-			res = SD_SectorWrite( ReadAddr, buff );
-			if ( res == SD_RESPONSE_NO_ERROR )
-				printf( "Sector write succeeded\n" );
-			else
-				printf( "Sector write failed\n" );
-
-			res = SD_SectorRead( ReadAddr, buff1 );
-			if ( res == SD_RESPONSE_NO_ERROR )
-			{
-				printf( "Sector %lu:\n", ReadAddr );
-				for ( i=0; i<32; ++i )
-				{
-					for ( j=0; j<16; ++j )
-						printf( " %02X", buff[ 16*i + j ] );
-					printf("\n");
-				}
-			}
-			else
-				printf( "SDCard read sector %lu failed\n", ReadAddr );
-		}
-		else
-			printf( "SDCard initialization failed with code %d\n", res );
-	}
+#ifdef USE_DISK_CACHE
+	DWORD cache[ 3 ];
+
+	if ( disk_ioctl( 0, CTRL_CACHE_STATS, cache ) == RES_OK )
+		printf( "Sector cache : %lu hits (%lu in external SRAM), %lu misses\n", cache[ 0 ], cache[ 2 ], cache[ 1 ] );
+#else
+	printf( "Sector cache isn't enabled (USE_DISK_CACHE)\n" );
+#endif /* USE_DISK_CACHE */
 }
 
 static void SDCard_Status( void )
 {
 	SD_Error res;
 	SD_Status SD_status;
-
-	if ( SD_Detect() == SD_NOT_PRESENT )
+	SD_Timing timing;
+#ifdef USE_SD_STATS
+	SD_Stats sd_stats;
+#endif /* USE_SD_STATS */
+#ifdef USE_SD_IO_PRIORITY
+	static const char* const classes[ SD_IO_CLASSES ] = { "bulk", "interactive" };
+	SD_IO_ClassStats io;
+	uint8_t k;
+#endif /* USE_SD_IO_PRIORITY */
+#if _FS_STATS
+	static const char* const names[ FFS_COUNT ] = { FFS_NAMES };
+	FFSTAT stats[ FFS_COUNT ];
+	int i;
+#endif /* _FS_STATS */
+
+	if ( SD_Detect( &SD_Card ) == SD_NOT_PRESENT )
 	{
 		printf( "SDCard isn't detected\n" );
 	}
@@ -233,26 +397,75 @@ static void SDCard_Status( void )
 	{
 		printf( "SDCard detected\n" );
 
-		// initialize SD Card...
-		res = SD_Init();
+		// initialize SD Card if it isn't yet...
+		res = SDCard_Ready();
 		if ( res == SD_RESPONSE_NO_ERROR )
 		{
-			res = SD_GetStatus( &SD_status );
+			res = SD_GetStatus( &SD_Card, &SD_status );
 			if ( res == SD_RESPONSE_NO_ERROR )
 			{
+#ifdef USE_SD_DUMP
 				SD_DumpStatus( &SD_status );
+#else
+				SD_InfoPrint( NULL, &SD_status );
+#endif /* USE_SD_DUMP */
 			}
 			else
 				printf( "SDCard status retrieval failed with code %d\n", res );
+			SD_GetTiming( &SD_Card, &timing );
+			SD_DumpTiming( &timing );
+#ifdef USE_SD_STATS
+			SD_GetStats( &SD_Card, &sd_stats );
+			printf( "SD errors : %lu cmd, %lu crc, %lu write, %lu timeouts\n",
+					sd_stats.CmdErrors, sd_stats.CrcErrors, sd_stats.WriteErrors, sd_stats.Timeouts );
+			printf( "SD recovery : %lu retries, %lu status queries, %lu reinits, %lu unrecovered\n",
+					sd_stats.Retries, sd_stats.StatusQueries, sd_stats.Reinits, sd_stats.Unrecovered );
+#endif /* USE_SD_STATS */
+			Cache_Print();
+#ifdef USE_SD_IO_PRIORITY
+			for ( k = 0; k < SD_IO_CLASSES; ++k )
+			{
+				SD_IO_GetClassStats( (SD_IO_Class)k, &io );
+				printf( "SD I/O %s : %lu requests, latency %lu ms average, %lu ms max, %lu deadlines missed, %lu preempted\n",
+						classes[ k ], io.Requests, io.Requests ? io.TotalTicks / io.Requests * portTICK_RATE_MS : 0,
+						io.MaxTicks * portTICK_RATE_MS, io.Missed, io.Preempted );
+			}
+#endif /* USE_SD_IO_PRIORITY */
+#if _FS_STATS
+			/* counters since the previous dump, cycles include nested calls */
+			f_getstats( stats, 1 );
+			printf( "FatFs function     calls    sectors        us\n" );
+			for ( i = 0; i < FFS_COUNT; ++i )
+			{
+				if ( stats[ i ].calls )
+					printf( "%-14s %9lu  %9lu %9lu\n", names[ i ], stats[ i ].calls, stats[ i ].sectors,
+							(unsigned long)DWT_CyclesToUs( stats[ i ].cycles ) );
+			}
+#endif /* _FS_STATS */
 		}
 		else
 			printf( "SDCard initialization failed with code %d\n", res );
 	}
 }
 
+static void Heap_Print( void )
+{
+	printf( "Heap : %u bytes free (%u at least so far), largest block %u bytes\n",
+			(unsigned)xPortGetFreeHeapSize(), (unsigned)xPortGetMinimumEverFreeHeapSize(),
+			(unsigned)xPortGetLargestFreeBlock() );
+	printf( "Sector buffers : %lu of %u free (%lu at least so far)\n", POOL_FreeCount(), POOL_BLOCKS, POOL_MinFreeCount() );
+}
+
 static void OnBTN1( void )
 {
 	printf("BTN1 was pressed\n");
+	Heap_Print();
+#ifdef USE_TASK_STATS
+	TaskStats_Print();
+#endif /* USE_TASK_STATS */
+#ifdef USE_INIT_PROFILE
+	InitProfile_Print();
+#endif /* USE_INIT_PROFILE */
 #ifdef USE_SDCARD
 	printf( "Get SDCard status info\n" );
 	SDCard_Status();
@@ -262,16 +475,19 @@ static void OnBTN1( void )
 static void OnBTN2( void )
 {
 	printf("BTN2 was pressed\n");
-#ifdef USE_SDCARD
-	printf( "Erase sectors on SDCard\n" );
-	SDCard_Erase();
-#endif /* USE_SDCARD */
+#ifdef USE_SD_BENCH
+	printf( "Run SDCard benchmark\n" );
+	SDBench_Run();
+#endif /* USE_SD_BENCH */
 }
 
 static void OnBTN3( void )
 {
 	printf("BTN3 was pressed\n");
-#ifdef USE_SDCARD
+#ifdef USE_CAMERA_RECORD
+	printf( "Record camera frames\n" );
+	CamRecord_Run();
+#elif defined(USE_SDCARD)
 	printf( "Dump SDCard information\n" );
 	/* Initialize SD Card and dump its information */
 	SDCard_Dump();
@@ -281,7 +497,10 @@ static void OnBTN3( void )
 static void OnBTN4( void )
 {
 	printf( "BTN4 was pressed\n" );
-#ifdef USE_SDCARD
+#ifdef USE_ADC_LOGGER
+	printf( "Log ADC samples\n" );
+	ADCLog_Run();
+#elif defined(USE_SDCARD)
 	printf( "Write test text file on SDCard FAT\n" );
 	/* Initialize SD Card and write file on it */
 	SDCard_Run();
@@ -295,82 +514,347 @@ static void OnTOUCH( int16_t x, int16_t y )
 }
 #endif /* USE_TOUCHSCREEN */
 
+#ifdef USE_CONSOLE_SHELL
+/**
+ * @brief  Lists a directory of volume 0 (registered again, like the buttons do)
+ * @param  path: Directory, root if empty
+ * @retval None
+ */
+static void Shell_Ls( const char* path )
+{
+#if _FS_MINIMIZE <= 1
+	FRESULT rs;
+	DIR dir;
+	FILINFO fno;
+
+#if _USE_LFN
+	fno.lfname = NULL;
+	fno.lfsize = 0;
+#endif /* _USE_LFN */
+	f_mount( 0, &fs );
+	rs = f_opendir( &dir, path );
+	while ( rs == FR_OK )
+	{
+		rs = f_readdir( &dir, &fno );
+		if ( rs != FR_OK || fno.fname[ 0 ] == 0 )
+			break;
+		printf( "%10lu %c %s\n", fno.fsize, ( fno.fattrib & AM_DIR ) ? 'd' : '-', fno.fname );
+	}
+	if ( rs != FR_OK )
+		printf( "ls failed with code %d\n", rs );
+#else
+	(void)path;
+	printf( "ls needs f_opendir and f_readdir (_FS_MINIMIZE <= 1 in ffconf.h)\n" );
+#endif /* _FS_MINIMIZE */
+}
+
+/**
+ * @brief  Prints a file of volume 0 to the console
+ * @param  path: File name
+ * @retval None
+ */
+static void Shell_Cat( const char* path )
+{
+	uint8_t* buff = POOL_Alloc();
+	FRESULT rs;
+	UINT nb;
+
+	if ( buff == NULL )
+	{
+		printf( "No free sector buffer\n" );
+		return;
+	}
+	f_mount( 0, &fs );
+	rs = f_open( &f, path, FA_READ | FA_OPEN_EXISTING );
+	while ( rs == FR_OK )
+	{
+		rs = f_read( &f, buff, POOL_BLOCK_SIZE, &nb );
+		if ( rs != FR_OK || nb == 0 )
+			break;
+		DebugComPort_Write( (const char*)buff, nb );
+	}
+	if ( rs != FR_OK )
+		printf( "cat failed with code %d\n", rs );
+	else
+		f_close( &f );
+	POOL_Free( buff );
+}
+
+/**
+ * @brief  Prints sectors of the card as hex dump, read by SD I/O requests one by one
+ * @param  arg: First sector number and optionally number of sectors
+ * @retval None
+ */
+static void Shell_Dump( const char* arg )
+{
+	static SD_IO_Request req;
+	uint8_t* buff = POOL_Alloc();
+	char* end;
+	uint32_t sector, count, i;
+	SD_Error res;
+
+	if ( buff == NULL )
+	{
+		printf( "No free sector buffer\n" );
+		return;
+	}
+	sector = strtoul( arg, &end, 0 );
+	count = strtoul( end, NULL, 0 );
+	if ( count == 0 )
+		count = 1;
+	if ( req.Done == NULL )
+		SD_IO_RequestInit( &req );
+	res = SDCard_Ready();
+	for ( i = 0; i < count && res == SD_RESPONSE_NO_ERROR; ++i )
+	{
+		req.Op = SD_IO_READ;
+		req.Sector = sector + i;
+		req.Count = 1;
+		req.Buffer = buff;
+		res = SD_IO_Execute( &req );
+		if ( res == SD_RESPONSE_NO_ERROR )
+		{
+			printf( "Sector %lu:\n", sector + i );
+			DebugComPort_HexDump( buff, SD_BLOCK_SIZE, i * SD_BLOCK_SIZE );
+		}
+	}
+	if ( res != SD_RESPONSE_NO_ERROR )
+		printf( "dump failed with code %d\n", res );
+	POOL_Free( buff );
+}
+
+/**
+ * @brief  Executes a command line of the shell
+ * @param  line: Command and its argument separated by spaces (modified)
+ * @retval None
+ */
+static void Shell_Execute( char* line )
+{
+	char* arg;
+
+	while ( *line == ' ' )
+		++line;
+	arg = strchr( line, ' ' );
+	if ( arg != NULL )
+	{
+		*arg++ = 0;
+		while ( *arg == ' ' )
+			++arg;
+	}
+	else
+		arg = line + strlen( line );
+
+	if ( *line == 0 )
+		return;
+	if ( strcmp( line, "bench" ) == 0 )
+	{
+#ifdef USE_SD_BENCH
+		SDBench_Run();
+#else
+		printf( "Benchmark isn't enabled (USE_SD_BENCH)\n" );
+#endif /* USE_SD_BENCH */
+	}
+	else if ( strcmp( line, "rtos" ) == 0 )
+	{
+#ifdef USE_RTOS_BENCH
+		RTOSBench_Run();
+#else
+		printf( "Kernel benchmark isn't enabled (USE_RTOS_BENCH)\n" );
+#endif /* USE_RTOS_BENCH */
+	}
+	else if ( strcmp( line, "stats" ) == 0 )
+		SDCard_Status();
+	else if ( strcmp( line, "cache" ) == 0 )
+		Cache_Print();
+	else if ( strcmp( line, "tasks" ) == 0 )
+	{
+#ifdef USE_TASK_STATS
+		TaskStats_Print();
+#else
+		printf( "Task statistics aren't enabled (USE_TASK_STATS)\n" );
+#endif /* USE_TASK_STATS */
+	}
+	else if ( strcmp( line, "heap" ) == 0 )
+		Heap_Print();
+	else if ( strcmp( line, "ls" ) == 0 )
+		Shell_Ls( arg );
+	else if ( strcmp( line, "cat" ) == 0 && *arg != 0 )
+		Shell_Cat( arg );
+	else if ( strcmp( line, "dump" ) == 0 && *arg != 0 )
+		Shell_Dump( arg );
+	else
+		printf( "Commands: bench, rtos, stats, cache, tasks, heap, ls [dir], cat <file>, dump <sector> [count]\n" );
+}
+
+/**
+ * @brief  Reads a command line from the console, typed characters are echoed
+ * @param  line: Buffer for the line
+ * @param  size: Size of the buffer
+ * @retval None
+ */
+static void Shell_ReadLine( char* line, uint16_t size )
+{
+	uint16_t n = 0;
+	int ch;
+
+	for ( ;; )
+	{
+		ch = DebugComPort_GetChar( portMAX_DELAY );
+		if ( ch == '\r' || ch == '\n' )
+		{
+			if ( n == 0 && ch == '\n' )
+				continue;	/* LF of CR LF */
+			break;
+		}
+		if ( ( ch == '\b' || ch == 0x7F ) && n > 0 )
+		{
+			--n;
+			printf( "\b \b" );
+		}
+		else if ( ch >= ' ' && ch < 0x7F && n < size - 1 )
+		{
+			line[ n++ ] = (char)ch;
+			putchar( ch );
+		}
+	}
+	line[ n ] = 0;
+	printf( "\n" );
+}
+#endif /* USE_CONSOLE_SHELL */
+
 /* Private task functions ----------------------------------------------------*/
 
 /**
- * @brief  Show message every time button is pressed
+ * @brief  Takes the flag of an input if it is set
+ * @param  mask: Flag of the input in PB_Touch_flag
+ * @retval Nonzero if the input had an edge
+ */
+static uint8_t HandleButtons_Take( uint8_t mask )
+{
+	uint8_t set;
+
+	taskENTER_CRITICAL();
+	set = PB_Touch_flag & mask;
+	PB_Touch_flag &= ~mask;
+	taskEXIT_CRITICAL();
+	return set;
+}
+
+#if configUSE_TIMERS
+/**
+ * @brief  Timer service: no edge for BTN_DEBOUNCE_TICKS, wakes the button task
+ * @param  timer: Debounce timer
+ * @retval None
+ */
+static void HandleButtons_Settled( xTimerHandle timer )
+{
+	(void)timer;
+	xSemaphoreGive( PB_Touch_sem );
+}
+#endif
+
+/**
+ * @brief  Creates the event semaphore (and debounce timer), call before button interrupts are enabled
+ * @param  None
+ * @retval None
+ */
+void HandleButtons_Init( void )
+{
+	vSemaphoreCreateBinaryStatic( PB_Touch_sem, &PB_Touch_sem_buf );
+	xSemaphoreTake( PB_Touch_sem, 0 );
+#if configUSE_TIMERS
+	PB_Debounce_timer = xTimerCreateStatic( (const signed char*)"BTN", BTN_DEBOUNCE_TICKS, pdFALSE, NULL, HandleButtons_Settled, &PB_Debounce_timer_buf );
+#endif
+#ifdef USE_CONSOLE_SHELL
+	Cmd_mutex = xSemaphoreCreateMutexStatic( &Cmd_mutex_buf );
+#endif /* USE_CONSOLE_SHELL */
+}
+
+/**
+ * @brief  Called by EXTI handlers on an edge of a button or touch screen input
+ * @param  mask: Flag of the input in PB_Touch_flag
+ * @retval None
+ */
+void HandleButtons_Signal( uint8_t mask )
+{
+	portBASE_TYPE woken = pdFALSE;
+
+	PB_Touch_flag |= mask;
+#if configUSE_TIMERS
+	xTimerResetFromISR( PB_Debounce_timer, &woken );
+#else
+	xSemaphoreGiveFromISR( PB_Touch_sem, &woken );
+#endif
+	portYIELD_FROM_ISR( woken );
+}
+
+/**
+ * @brief  Show message every time button is pressed. The task sleeps until contacts
+ *         have settled after an edge (debounce timer, or its own delay without timers)
+ *         and handles inputs which are still active (edges during the wait are absorbed)
  * @param  pvParameters not used
  * @retval None
  */
-extern uint8_t PB_Touch_flag;
 void HandleButtons_task( void* pvParameters )
 {
-	portTickType xLastWakeTime;
-	const portTickType xFrequency = 20;
-
 	// we set a flag because writing on LCD from interrupt handler would break
 	while(1)
 	{
-		uint8_t mask = 0x1;
-		if ( PB_Touch_flag & mask )
+		xSemaphoreTake( PB_Touch_sem, portMAX_DELAY );
+#if !configUSE_TIMERS
+		vTaskDelay( BTN_DEBOUNCE_TICKS );
+#endif
+		CMD_LOCK();
+
+		if ( HandleButtons_Take( 0x1 ) && STM_EVAL_PBGetState(BUTTON_WAKEUP) == Bit_SET )
 		{
-			xLastWakeTime = xTaskGetTickCount();
-			vTaskDelayUntil( &xLastWakeTime, xFrequency );
-			if ( STM_EVAL_PBGetState(BUTTON_WAKEUP) == Bit_SET )
-			{
-				OnBTN1();
-			}
-			PB_Touch_flag &= ~mask;
+			OnBTN1();
 		}
-		mask <<= 1;
-		if ( PB_Touch_flag & mask )
+		if ( HandleButtons_Take( 0x1 << 1 ) && STM_EVAL_PBGetState(BUTTON_TAMPER) == Bit_SET )
 		{
-			xLastWakeTime = xTaskGetTickCount();
-			vTaskDelayUntil( &xLastWakeTime, xFrequency );
-			if ( STM_EVAL_PBGetState(BUTTON_TAMPER) == Bit_SET )
-			{
-				OnBTN2();
-			}
-			PB_Touch_flag &= ~mask;
+			OnBTN2();
 		}
-		mask <<= 1;
-		if ( PB_Touch_flag & mask )
+		if ( HandleButtons_Take( 0x1 << 2 ) && STM_EVAL_PBGetState(BUTTON_KEY) == Bit_SET )
 		{
-			xLastWakeTime = xTaskGetTickCount();
-			vTaskDelayUntil( &xLastWakeTime, xFrequency );
-			if ( STM_EVAL_PBGetState(BUTTON_KEY) == Bit_SET )
-			{
-				OnBTN3();
-			}
-			PB_Touch_flag &= ~mask;
+			OnBTN3();
 		}
-		mask <<= 1;
-		if ( PB_Touch_flag & mask )
+		if ( HandleButtons_Take( 0x1 << 3 ) && STM_EVAL_PBGetState(BUTTON_RIGHT) == Bit_SET )
 		{
-			xLastWakeTime = xTaskGetTickCount();
-			vTaskDelayUntil( &xLastWakeTime, xFrequency );
-			if ( STM_EVAL_PBGetState(BUTTON_RIGHT) == Bit_SET )
-			{
-				OnBTN4();
-			}
-			PB_Touch_flag &= ~mask;
+			OnBTN4();
 		}
 #ifdef USE_TOUCHSCREEN
-		mask <<= 1;
-		if ( PB_Touch_flag & mask )
+		if ( HandleButtons_Take( 0x1 << 4 ) && STM_EVAL_TouchScreen_GetState() == Bit_SET )
 		{
-			xLastWakeTime = xTaskGetTickCount();
-			vTaskDelayUntil( &xLastWakeTime, xFrequency );
-			if (STM_EVAL_TouchScreen_GetState() == Bit_SET)
+			Point p_touched;
+			if ( LCD_TouchScreen_Read(&p_touched) == 1 )
 			{
-				Point p_touched;
-				if ( LCD_TouchScreen_Read(&p_touched) == 1 )
-				{
-					OnTOUCH( p_touched.X, p_touched.Y );
-				}
+				OnTOUCH( p_touched.X, p_touched.Y );
 			}
-			PB_Touch_flag &= ~mask;
 		}
 #endif /* USE_TOUCHSCREEN */
+		CMD_UNLOCK();
+	}
+}
+
+#ifdef USE_CONSOLE_SHELL
+/**
+ * @brief  Console shell: reads command lines and runs them, so the instrumentation
+ *         is reachable in the field without buttons nor reflashing
+ * @param  pvParameters not used
+ * @retval None
+ */
+void Shell_task( void* pvParameters )
+{
+	char line[ SHELL_LINE_SIZE ];
+
+	(void)pvParameters;
+	for ( ;; )
+	{
+		printf( "> " );
+		Shell_ReadLine( line, sizeof( line ) );
+		CMD_LOCK();
+		Shell_Execute( line );
+		CMD_UNLOCK();
 	}
 }
+#endif /* USE_CONSOLE_SHELL */
@@ -17,12 +17,22 @@ extern "C" {
 #endif
 
 /* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include <stdint.h>
+
 /* Exported types ------------------------------------------------------------*/
 /* Exported constants --------------------------------------------------------*/
 /* Exported macro ------------------------------------------------------------*/
 /* Exported functions ------------------------------------------------------- */
 
+void HandleButtons_Init( void );
+void HandleButtons_Signal( uint8_t mask );
 void HandleButtons_task( void* pvParameters );
+#ifdef USE_CONSOLE_SHELL
+void Shell_task( void* pvParameters );
+#endif /* USE_CONSOLE_SHELL */
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,433 @@
+/**
+ ******************************************************************************
+ * @file    stm32_bootcache.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Boot cache in on-chip FLASH: a log of records in one of two
+ *          sectors. The active sector starts with a header carrying its
+ *          generation, records follow it and end at the first erased word.
+ *          A record is programmed header word first and CRC word last, so
+ *          a record torn by reset fails its CRC and is skipped, while its
+ *          length still leads to the next one. A full sector is compacted
+ *          into the other one, which gets its header (the higher generation)
+ *          only after all records are copied: reset in the middle of it
+ *          leaves the old sector active.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#ifdef USE_BOOT_CACHE
+
+#include "stm32_bootcache.h"
+#include "stm32_chksum.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "semphr.h"
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  Marker of the active sector ("BOOT")
+ */
+#define BOOT_MAGIC				0x544F4F42
+
+/**
+ * @brief  Sectors of the cache (the last two of 1 Mb FLASH, see GCC-ARM/stm32_flash.ld)
+ */
+#define BOOT_SECTOR_BYTES		0x20000
+#define BOOT_SECTOR_BASE( s )	( 0x080C0000 + (s) * BOOT_SECTOR_BYTES )
+#define BOOT_SECTOR_ID( s )		( (s) ? FLASH_Sector_11 : FLASH_Sector_10 )
+
+/**
+ * @brief  Value of an erased word
+ */
+#define BOOT_ERASED				0xFFFFFFFF
+
+/**
+ * @brief  Fields and data of a record, space taken by the data (records are word aligned)
+ */
+#define BOOT_TAG( r )			( (uint16_t)(r)->Info )
+#define BOOT_LEN( r )			( (uint16_t)( (r)->Info >> 16 ) )
+#define BOOT_DATA( r )			( (const uint8_t*)( (r) + 1 ) )
+#define BOOT_ALIGN( len )		( ( (uint32_t)(len) + 3 ) & ~3 )
+
+/**
+ * @brief  Error flags cleared before programming
+ */
+#define BOOT_FLASH_FLAGS		( FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | \
+								  FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR )
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Types
+ * @{
+ */
+
+/**
+ * @brief  Header at the start of the active sector
+ */
+typedef struct
+{
+	uint32_t	Magic;				/*!< BOOT_MAGIC */
+	uint32_t	Gen;				/*!< Incremented on each compaction, the newer sector wins */
+	uint32_t	Check;				/*!< Inverted XOR of the words above */
+} BOOT_SectorHeader;
+
+/**
+ * @brief  Header of a record, its data follow
+ */
+typedef struct
+{
+	uint32_t	Info;				/*!< Tag in the low half, data length in the high half (programmed first) */
+	uint32_t	Key;				/*!< Key of the record within its tag */
+	uint32_t	Crc;				/*!< CRC32 of Info, Key and data (programmed last) */
+} BOOT_Record;
+
+/**
+ * @}
+ *//* STM32_Private_Types */
+
+
+/** @defgroup STM32_Private_Variables
+ * @{
+ */
+
+static int8_t BOOT_Active = -1;			/* active sector, -1 if none yet */
+static uint32_t BOOT_End;				/* address after the last record of the active sector */
+static xSemaphoreHandle BOOT_Mutex;		/* serializes lookups and updates */
+static xStaticSemaphore BOOT_MutexBuffer;
+
+/**
+ * @}
+ *//* STM32_Private_Variables */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Checks header of a sector
+ * @param  s: Sector (0, 1)
+ * @param  gen: Receives generation of the sector
+ * @retval Nonzero if the sector is a valid cache sector
+ */
+static uint8_t BOOT_SectorValid( uint8_t s, uint32_t* gen )
+{
+	const BOOT_SectorHeader* hdr = (const BOOT_SectorHeader*)BOOT_SECTOR_BASE( s );
+
+	if ( hdr->Magic != BOOT_MAGIC || hdr->Check != ~( hdr->Magic ^ hdr->Gen ) )
+		return 0;
+	*gen = hdr->Gen;
+	return 1;
+}
+
+/**
+ * @brief  Gets the record after the given location of a sector
+ * @param  s: Sector
+ * @param  addr: Location of the record (after its predecessor)
+ * @retval Record, NULL at the end of the log
+ */
+static const BOOT_Record* BOOT_At( uint8_t s, uint32_t addr )
+{
+	const BOOT_Record* r = (const BOOT_Record*)addr;
+
+	if ( addr + sizeof( BOOT_Record ) > BOOT_SECTOR_BASE( s ) + BOOT_SECTOR_BYTES || r->Info == BOOT_ERASED )
+		return NULL;
+	return r;
+}
+
+#define BOOT_First( s )			BOOT_At( s, BOOT_SECTOR_BASE( s ) + sizeof( BOOT_SectorHeader ) )
+#define BOOT_Next( s, r )		BOOT_At( s, (uint32_t)( (r) + 1 ) + BOOT_ALIGN( BOOT_LEN( r ) ) )
+
+/**
+ * @brief  Checks that a record is complete
+ * @param  s: Sector of the record
+ * @param  r: Record
+ * @retval Nonzero if the record is valid
+ */
+static uint8_t BOOT_Valid( uint8_t s, const BOOT_Record* r )
+{
+	if ( BOOT_LEN( r ) > BOOT_RECORD_MAX ||
+		 (uint32_t)BOOT_DATA( r ) + BOOT_LEN( r ) > BOOT_SECTOR_BASE( s ) + BOOT_SECTOR_BYTES )
+		return 0;
+	CHK_Crc32Start();
+	CHK_Crc32Update( r, offsetof( BOOT_Record, Crc ) );
+	CHK_Crc32Update( BOOT_DATA( r ), BOOT_LEN( r ) );
+	return ( CHK_Crc32Finish() == r->Crc );
+}
+
+/**
+ * @brief  Finds the latest valid record of the tag and key in the active sector
+ * @param  tag: Tag of the record
+ * @param  key: Key of the record
+ * @retval Record, NULL if there is none
+ */
+static const BOOT_Record* BOOT_Search( uint16_t tag, uint32_t key )
+{
+	const BOOT_Record *r, *found = NULL;
+
+	if ( BOOT_Active < 0 )
+		return NULL;
+	for ( r = BOOT_First( BOOT_Active ); r != NULL; r = BOOT_Next( BOOT_Active, r ) )
+	{
+		if ( BOOT_TAG( r ) == tag && r->Key == key && BOOT_Valid( BOOT_Active, r ) )
+			found = r;
+	}
+	return found;
+}
+
+/**
+ * @brief  Programs bytes into erased FLASH, the last partial word is padded with erased bytes
+ * @param  addr: Address (word aligned)
+ * @param  buf: Data
+ * @param  len: Number of bytes
+ * @retval Nonzero on success
+ */
+static uint8_t BOOT_Program( uint32_t addr, const void* buf, uint32_t len )
+{
+	const uint8_t* p = (const uint8_t*)buf;
+	uint32_t w, n;
+
+	for ( ; len > 0; addr += 4, p += n, len -= n )
+	{
+		n = ( len < 4 ) ? len : 4;
+		w = BOOT_ERASED;
+		memcpy( &w, p, n );
+		if ( FLASH_ProgramWord( addr, w ) != FLASH_COMPLETE )
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * @brief  Programs a record (FLASH is unlocked)
+ * @param  addr: Address of the record (erased space)
+ * @param  tag: Tag
+ * @param  key: Key
+ * @param  head: First part of data
+ * @param  head_len: Its length (a multiple of 4 if data follow)
+ * @param  data: Second part of data
+ * @param  data_len: Its length
+ * @retval Nonzero on success
+ */
+static uint8_t BOOT_Append( uint32_t addr, uint16_t tag, uint32_t key,
+							const void* head, uint16_t head_len, const void* data, uint16_t data_len )
+{
+	BOOT_Record rec;
+
+	rec.Info = tag | (uint32_t)( head_len + data_len ) << 16;
+	rec.Key = key;
+	CHK_Crc32Start();
+	CHK_Crc32Update( &rec, offsetof( BOOT_Record, Crc ) );
+	CHK_Crc32Update( head, head_len );
+	CHK_Crc32Update( data, data_len );
+	rec.Crc = CHK_Crc32Finish();
+
+	return ( BOOT_Program( addr, &rec.Info, 8 ) &&
+			 BOOT_Program( addr + sizeof( BOOT_Record ), head, head_len ) &&
+			 BOOT_Program( addr + sizeof( BOOT_Record ) + head_len, data, data_len ) &&
+			 BOOT_Program( addr + offsetof( BOOT_Record, Crc ), &rec.Crc, 4 ) );
+}
+
+/**
+ * @brief  Drops FLASH contents kept by the data cache of the ART accelerator
+ * @param  None
+ * @retval None
+ */
+static void BOOT_FlushCache( void )
+{
+	if ( FLASH->ACR & FLASH_ACR_DCEN )
+	{
+		FLASH_DataCacheCmd( DISABLE );
+		FLASH_DataCacheReset();
+		FLASH_DataCacheCmd( ENABLE );
+	}
+}
+
+/**
+ * @brief  Copies the latest records of the active sector into the other one and makes it
+ *         active (FLASH is unlocked), also creates the first active sector
+ * @param  tag: Tag of the record replaced by the caller (not copied)
+ * @param  key: Key of that record
+ * @retval Nonzero on success
+ */
+static uint8_t BOOT_Compact( uint16_t tag, uint32_t key )
+{
+	int8_t from = BOOT_Active;
+	uint8_t to = ( from == 0 ) ? 1 : 0;
+	uint32_t gen = 0, addr = BOOT_SECTOR_BASE( to ) + sizeof( BOOT_SectorHeader );
+	const BOOT_Record *r, *n;
+	BOOT_SectorHeader hdr;
+
+	if ( FLASH_EraseSector( BOOT_SECTOR_ID( to ), VoltageRange_3 ) != FLASH_COMPLETE )
+		return 0;
+	BOOT_FlushCache();
+	if ( from >= 0 )
+	{
+		BOOT_SectorValid( from, &gen );
+		for ( r = BOOT_First( from ); r != NULL; r = BOOT_Next( from, r ) )
+		{
+			if ( BOOT_LEN( r ) == 0 || ( BOOT_TAG( r ) == tag && r->Key == key ) || !BOOT_Valid( from, r ) )
+				continue;
+			/* a later record of the same tag and key supersedes it */
+			for ( n = BOOT_Next( from, r ); n != NULL; n = BOOT_Next( from, n ) )
+			{
+				if ( BOOT_TAG( n ) == BOOT_TAG( r ) && n->Key == r->Key && BOOT_Valid( from, n ) )
+					break;
+			}
+			if ( n != NULL )
+				continue;
+			if ( !BOOT_Append( addr, BOOT_TAG( r ), r->Key, BOOT_DATA( r ), BOOT_LEN( r ), NULL, 0 ) )
+				return 0;
+			addr += sizeof( BOOT_Record ) + BOOT_ALIGN( BOOT_LEN( r ) );
+		}
+	}
+
+	/* the copy is complete, its header makes it the newer sector */
+	hdr.Magic = BOOT_MAGIC;
+	hdr.Gen = gen + 1;
+	hdr.Check = ~( hdr.Magic ^ hdr.Gen );
+	if ( !BOOT_Program( BOOT_SECTOR_BASE( to ), &hdr, sizeof( hdr ) ) )
+		return 0;
+	BOOT_FlushCache();
+	BOOT_Active = to;
+	BOOT_End = addr;
+	return 1;
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Finds the active sector and the end of its log, call it at startup
+ *         before the cache is used
+ * @param  None
+ * @retval None
+ */
+void BOOT_Init( void )
+{
+	const BOOT_Record* r;
+	uint32_t gen[ 2 ];
+	uint8_t valid[ 2 ], s;
+
+	for ( s = 0; s < 2; ++s )
+		valid[ s ] = BOOT_SectorValid( s, &gen[ s ] );
+	if ( valid[ 0 ] && valid[ 1 ] )
+		BOOT_Active = ( (int32_t)( gen[ 1 ] - gen[ 0 ] ) > 0 ) ? 1 : 0;
+	else if ( valid[ 0 ] || valid[ 1 ] )
+		BOOT_Active = valid[ 0 ] ? 0 : 1;
+
+	if ( BOOT_Active >= 0 )
+	{	/* torn record at the end still takes its space */
+		BOOT_End = BOOT_SECTOR_BASE( BOOT_Active ) + sizeof( BOOT_SectorHeader );
+		for ( r = BOOT_First( BOOT_Active ); r != NULL; r = BOOT_Next( BOOT_Active, r ) )
+			BOOT_End = (uint32_t)( r + 1 ) + BOOT_ALIGN( BOOT_LEN( r ) );
+	}
+	BOOT_Mutex = xSemaphoreCreateMutexStatic( &BOOT_MutexBuffer );
+}
+
+/**
+ * @brief  Finds the latest record of the tag and key
+ * @param  tag: Tag of the record (BOOT_TAG_*)
+ * @param  key: Key of the record
+ * @param  len: Receives length of the data, may be NULL
+ * @retval Data of the record in FLASH (word aligned, valid until the second BOOT_Put
+ *         after this call), NULL if there is none
+ */
+const void* BOOT_Find( uint16_t tag, uint32_t key, uint16_t* len )
+{
+	const BOOT_Record* r;
+
+	xSemaphoreTake( BOOT_Mutex, portMAX_DELAY );
+	r = BOOT_Search( tag, key );
+	xSemaphoreGive( BOOT_Mutex );
+	if ( r == NULL || BOOT_LEN( r ) == 0 )
+		return NULL;
+	if ( len != NULL )
+		*len = BOOT_LEN( r );
+	return BOOT_DATA( r );
+}
+
+/**
+ * @brief  Stores a record of the tag and key which supersedes the previous one, nothing
+ *         is written if the data are the same. Data are passed in two parts, e.g. header
+ *         of the caller and a buffer. Execution from FLASH stalls while it programs.
+ * @param  tag: Tag of the record (BOOT_TAG_*)
+ * @param  key: Key of the record
+ * @param  head: First part of data
+ * @param  head_len: Its length (a multiple of 4 if data follow)
+ * @param  data: Second part of data
+ * @param  data_len: Its length (both parts up to BOOT_RECORD_MAX, 0 drops the record)
+ * @retval ERROR if programming (or erase of the full sector) failed
+ */
+ErrorStatus BOOT_Put( uint16_t tag, uint32_t key, const void* head, uint16_t head_len, const void* data, uint16_t data_len )
+{
+	const BOOT_Record* r;
+	uint32_t len = head_len + data_len, need = sizeof( BOOT_Record ) + BOOT_ALIGN( len );
+	uint8_t ok = 1;
+
+	if ( len > BOOT_RECORD_MAX || ( data_len != 0 && ( head_len & 3 ) != 0 ) )
+		return ERROR;
+
+	xSemaphoreTake( BOOT_Mutex, portMAX_DELAY );
+	r = BOOT_Search( tag, key );
+	if ( r == NULL || BOOT_LEN( r ) != len ||
+		 ( head_len != 0 && memcmp( BOOT_DATA( r ), head, head_len ) != 0 ) ||
+		 ( data_len != 0 && memcmp( BOOT_DATA( r ) + head_len, data, data_len ) != 0 ) )
+	{
+		if ( r != NULL || len != 0 )
+		{
+			FLASH_Unlock();
+			FLASH_ClearFlag( BOOT_FLASH_FLAGS );
+			if ( BOOT_Active < 0 || BOOT_End + need > BOOT_SECTOR_BASE( BOOT_Active ) + BOOT_SECTOR_BYTES )
+				ok = BOOT_Compact( tag, key );
+			if ( ok && BOOT_End + need > BOOT_SECTOR_BASE( BOOT_Active ) + BOOT_SECTOR_BYTES )
+				ok = 0;
+			if ( ok )
+			{	/* the space is taken even if programming fails */
+				r = (const BOOT_Record*)BOOT_End;
+				BOOT_End += need;
+				ok = BOOT_Append( (uint32_t)r, tag, key, head, head_len, data, data_len );
+			}
+			FLASH_Lock();
+			BOOT_FlushCache();
+			if ( ok )
+				ok = BOOT_Valid( BOOT_Active, r );
+		}
+	}
+	xSemaphoreGive( BOOT_Mutex );
+	return ok ? SUCCESS : ERROR;
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#endif /* USE_BOOT_CACHE */
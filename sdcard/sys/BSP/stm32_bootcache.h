@@ -0,0 +1,86 @@
+/**
+ ******************************************************************************
+ * @file    stm32_bootcache.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Boot cache in on-chip FLASH: small records (learned card timing,
+ *          volume state of FatFs, contents of config files) which make a cold
+ *          boot ready without reading the card for them. Records are appended
+ *          to a log in FLASH sector 10 or 11 (128 Kb each, reserved in the
+ *          linker script), the newer record of a tag and key supersedes the
+ *          older ones. When the active sector is full, the latest records are
+ *          copied into the other sector, so each sector is erased only once
+ *          per hundreds of updates. Writing stalls execution from FLASH (all
+ *          tasks and interrupts): up to 100 us for a record, 1-2 s for the
+ *          sector erase, so records have to be updated rarely (at unmount,
+ *          after a setting has changed), never on every sync.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32_BOOTCACHE_H
+#define STM32_BOOTCACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "stm32f2xx.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Constants
+ * @{
+ */
+
+/**
+ * @brief  Tags of records (key of each tag in parentheses)
+ */
+#define BOOT_TAG_TIMING			1		/*!< SD Card timing (CRC32 of the card CID) */
+#define BOOT_TAG_STATE			2		/*!< FatFs volume state snapshot (logical drive number) */
+#define BOOT_TAG_CONFIG			3		/*!< Contents of a file (CRC32 of its path) */
+
+/**
+ * @brief  Largest record data in bytes
+ */
+#define BOOT_RECORD_MAX			2048
+
+/**
+ * @}
+ *//* STM32_Exported_Constants */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+void BOOT_Init( void );
+const void* BOOT_Find( uint16_t tag, uint32_t key, uint16_t* len );
+ErrorStatus BOOT_Put( uint16_t tag, uint32_t key, const void* head, uint16_t head_len, const void* data, uint16_t data_len );
+
+/**
+ * @brief  Drops the record of the tag and key
+ */
+#define BOOT_Drop( tag, key )	BOOT_Put( tag, key, NULL, 0, NULL, 0 )
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32_BOOTCACHE_H */
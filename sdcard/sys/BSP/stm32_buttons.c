@@ -13,6 +13,7 @@
 #include "main.h"
 
 #include "stm32_buttons.h"
+#include "stm32_irq.h"
 
 /** @addtogroup Utilities
  * @{
@@ -160,7 +161,6 @@ void STM_EVAL_PBInit( Button_TypeDef Button, ButtonMode_TypeDef Button_Mode )
 {
 	GPIO_InitTypeDef GPIO_InitStructure;
 	EXTI_InitTypeDef EXTI_InitStructure;
-	NVIC_InitTypeDef NVIC_InitStructure;
 
 	/* Enable the BUTTON Clock */
 	BUTTON_GPIO_CLK_INIT( BUTTON_CLK[ Button ], ENABLE );
@@ -186,11 +186,7 @@ void STM_EVAL_PBInit( Button_TypeDef Button, ButtonMode_TypeDef Button_Mode )
 		EXTI_Init( &EXTI_InitStructure );
 
 		/* Enable and set Button EXTI Interrupt to the lowest priority */
-		NVIC_InitStructure.NVIC_IRQChannel = BUTTON_IRQn[ Button ];
-		NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0x0F;
-		NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0x0F;
-		NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
-		NVIC_Init( &NVIC_InitStructure );
+		IRQ_Enable( (IRQn_Type)BUTTON_IRQn[ Button ], IRQ_PRIO_EXTI );
 	}
 }
 
@@ -0,0 +1,232 @@
+/**
+ ******************************************************************************
+ * @file    stm32_calendar.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   RTC calendar for FatFs timestamps. The calendar is set up once
+ *          (marked in a backup register), later resets find it running and
+ *          keep the date. The wakeup timer counts the 1 Hz calendar clock and
+ *          interrupts on each second; the handler reads time then date (the
+ *          order which unlocks the shadow registers) and stores the packed
+ *          FAT timestamp, it doesn't call FreeRTOS.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#ifdef USE_RTC_CALENDAR
+
+#include "stm32_calendar.h"
+#include "stm32_irq.h"
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  Backup register value marking the calendar as set up
+ */
+#define CALENDAR_BKP_REG		RTC_BKP_DR0
+#define CALENDAR_BKP_MAGIC		0x32F2
+
+/**
+ * @brief  Prescalers of 32768 Hz LSE down to 1 Hz calendar clock
+ */
+#define CALENDAR_ASYNCH_PREDIV	0x7F
+#define CALENDAR_SYNCH_PREDIV	0xFF
+
+/**
+ * @brief  Number of polls of LSE ready flag (~2 s at 120 MHz, crystal starts in less than 1 s)
+ */
+#define CALENDAR_LSE_TRIES		20000000
+
+/**
+ * @brief  Date and time the calendar starts from until it is set (CALENDAR_Set)
+ */
+#define CALENDAR_DEFAULT_YEAR	2012
+#define CALENDAR_DEFAULT_MONTH	1
+#define CALENDAR_DEFAULT_DAY	1
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Variables
+ * @{
+ */
+
+volatile uint32_t CALENDAR_FatTime;
+
+/**
+ * @}
+ *//* STM32_Private_Variables */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Reads the calendar and stores it packed in FAT format
+ * @param  None
+ * @retval None
+ */
+static void CALENDAR_Refresh( void )
+{
+	RTC_TimeTypeDef time;
+	RTC_DateTypeDef date;
+
+	/* reading time locks date shadow register until date is read */
+	RTC_GetTime( RTC_Format_BIN, &time );
+	RTC_GetDate( RTC_Format_BIN, &date );
+	CALENDAR_FatTime = ( (uint32_t)( date.RTC_Year + 2000 - 1980 ) << 25 ) |
+		( (uint32_t)date.RTC_Month << 21 ) | ( (uint32_t)date.RTC_Date << 16 ) |
+		( (uint32_t)time.RTC_Hours << 11 ) | ( (uint32_t)time.RTC_Minutes << 5 ) |
+		( time.RTC_Seconds >> 1 );
+}
+
+/**
+ * @brief  Starts the wakeup timer interrupting once a second
+ * @param  None
+ * @retval None
+ */
+static void CALENDAR_WakeupInit( void )
+{
+	EXTI_InitTypeDef EXTI_InitStructure;
+
+	RTC_WakeUpCmd( DISABLE );
+	RTC_WakeUpClockConfig( RTC_WakeUpClock_CK_SPRE_16bits );
+	RTC_SetWakeUpCounter( 0 );
+
+	/* EXTI line 22 is connected to the RTC wakeup event */
+	EXTI_ClearITPendingBit( EXTI_Line22 );
+	EXTI_InitStructure.EXTI_Line = EXTI_Line22;
+	EXTI_InitStructure.EXTI_Mode = EXTI_Mode_Interrupt;
+	EXTI_InitStructure.EXTI_Trigger = EXTI_Trigger_Rising;
+	EXTI_InitStructure.EXTI_LineCmd = ENABLE;
+	EXTI_Init( &EXTI_InitStructure );
+	IRQ_Enable( RTC_WKUP_IRQn, IRQ_PRIO_RTC );
+
+	RTC_ClearITPendingBit( RTC_IT_WUT );
+	RTC_ITConfig( RTC_IT_WUT, ENABLE );
+	RTC_WakeUpCmd( ENABLE );
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Starts the calendar on LSE, or keeps it running if it was set up before the reset
+ * @param  None
+ * @retval ERROR if LSE doesn't start (timestamps stay 0)
+ */
+ErrorStatus CALENDAR_Init( void )
+{
+	RTC_InitTypeDef RTC_InitStructure;
+	uint32_t tries;
+
+	RCC_APB1PeriphClockCmd( RCC_APB1Periph_PWR, ENABLE );
+	PWR_BackupAccessCmd( ENABLE );
+
+	if ( RTC_ReadBackupRegister( CALENDAR_BKP_REG ) != CALENDAR_BKP_MAGIC )
+	{
+		/* new backup domain: clock the RTC from LSE and start from the default date */
+		RCC_LSEConfig( RCC_LSE_ON );
+		for ( tries = CALENDAR_LSE_TRIES; RCC_GetFlagStatus( RCC_FLAG_LSERDY ) == RESET; --tries )
+		{
+			if ( tries == 0 )
+				return ERROR;
+		}
+		RCC_RTCCLKConfig( RCC_RTCCLKSource_LSE );
+		RCC_RTCCLKCmd( ENABLE );
+		RTC_WaitForSynchro();
+
+		RTC_InitStructure.RTC_HourFormat = RTC_HourFormat_24;
+		RTC_InitStructure.RTC_AsynchPrediv = CALENDAR_ASYNCH_PREDIV;
+		RTC_InitStructure.RTC_SynchPrediv = CALENDAR_SYNCH_PREDIV;
+		if ( RTC_Init( &RTC_InitStructure ) != SUCCESS ||
+				CALENDAR_Set( CALENDAR_DEFAULT_YEAR, CALENDAR_DEFAULT_MONTH, CALENDAR_DEFAULT_DAY, 0, 0, 0 ) != SUCCESS )
+			return ERROR;
+	}
+	else
+	{
+		/* calendar runs, only the registers of the reset APB1 side have to resync */
+		RTC_WaitForSynchro();
+		CALENDAR_Refresh();
+	}
+
+	CALENDAR_WakeupInit();
+	return SUCCESS;
+}
+
+/**
+ * @brief  Sets the calendar and the FAT timestamp
+ * @param  year: 2000 .. 2099
+ * @param  month: 1 .. 12
+ * @param  day: 1 .. 31
+ * @param  hour: 0 .. 23
+ * @param  min: 0 .. 59
+ * @param  sec: 0 .. 59
+ * @retval ERROR if the date is out of range or the RTC doesn't enter init mode
+ */
+ErrorStatus CALENDAR_Set( uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t min, uint8_t sec )
+{
+	RTC_TimeTypeDef time;
+	RTC_DateTypeDef date;
+
+	if ( year < 2000 || year > 2099 || month < 1 || month > 12 || day < 1 || day > 31 ||
+			hour > 23 || min > 59 || sec > 59 )
+		return ERROR;
+
+	time.RTC_H12 = RTC_H12_AM;
+	time.RTC_Hours = hour;
+	time.RTC_Minutes = min;
+	time.RTC_Seconds = sec;
+	date.RTC_WeekDay = RTC_Weekday_Monday;		/* not used by FAT timestamps */
+	date.RTC_Month = month;
+	date.RTC_Date = day;
+	date.RTC_Year = (uint8_t)( year - 2000 );
+	if ( RTC_SetTime( RTC_Format_BIN, &time ) != SUCCESS || RTC_SetDate( RTC_Format_BIN, &date ) != SUCCESS )
+		return ERROR;
+	RTC_WriteBackupRegister( CALENDAR_BKP_REG, CALENDAR_BKP_MAGIC );
+	CALENDAR_Refresh();
+	return SUCCESS;
+}
+
+/**
+ * @brief  RTC wakeup interrupt handler: refreshes the FAT timestamp once a second
+ * @param  None
+ * @retval None
+ */
+void CALENDAR_IRQHandler( void )
+{
+	if ( RTC_GetITStatus( RTC_IT_WUT ) != RESET )
+	{
+		CALENDAR_Refresh();
+		RTC_ClearITPendingBit( RTC_IT_WUT );
+	}
+	EXTI_ClearITPendingBit( EXTI_Line22 );
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#endif /* USE_RTC_CALENDAR */
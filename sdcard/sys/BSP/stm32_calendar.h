@@ -0,0 +1,79 @@
+/**
+ ******************************************************************************
+ * @file    stm32_calendar.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Calendar of the RTC (LSE clock, kept by the backup domain across
+ *          resets) for FatFs timestamps. The wakeup timer interrupts once a
+ *          second and packs the date and time into the FAT format, so
+ *          get_fattime only reads one word: FatFs stamps directory entries
+ *          without BCD conversions or waiting for the shadow registers.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32_CALENDAR_H
+#define STM32_CALENDAR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f2xx.h"
+
+#include <stdint.h>
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Variables
+ * @{
+ */
+
+/**
+ * @brief  Current date and time in FAT format (see get_fattime), 0 until
+ *         the calendar runs
+ */
+extern volatile uint32_t CALENDAR_FatTime;
+
+/**
+ * @}
+ *//* STM32_Exported_Variables */
+
+/** @defgroup STM32_Exported_Macros
+ * @{
+ */
+
+/**
+ * @brief  Current date and time in FAT format, safe in any context
+ *         (the word is written at once by the wakeup interrupt)
+ */
+#define CALENDAR_GetFatTime()	( CALENDAR_FatTime )
+
+/**
+ * @}
+ *//* STM32_Exported_Macros */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+ErrorStatus CALENDAR_Init( void );
+ErrorStatus CALENDAR_Set( uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t min, uint8_t sec );
+void CALENDAR_IRQHandler( void );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32_CALENDAR_H */
@@ -0,0 +1,372 @@
+/**
+ ******************************************************************************
+ * @file    stm32_camera.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Camera frame capture by DCMI in continuous mode. The DMA stream
+ *          moves DCMI words into two blocks alternately; on transfer complete
+ *          the DMA is already filling the other block, so the handler queues
+ *          the filled one and sets a fresh block in its place before that
+ *          block is done. Frames are counted in blocks, the frame interrupt
+ *          only checks that a frame has ended on a block boundary: otherwise
+ *          (wrong frame size, overrun, late handler) the DMA is restarted and
+ *          the next frame starts from the first block again.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#ifdef USE_CAMERA_RECORD
+
+#include "stm32_camera.h"
+#include "stm32_pins.h"
+#include "stm32_pool.h"
+#include "stm32_irq.h"
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  DMA transfers of a block (DCMI data register is 32-bit)
+ */
+#define CAMERA_BLOCK_WORDS		( POOL_BLOCK_SIZE / 4 )
+
+/**
+ * @brief  Filled blocks waiting for the consumer (there are no more blocks in the pool)
+ */
+#define CAMERA_QUEUE_SIZE		POOL_BLOCKS
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Variables
+ * @{
+ */
+
+static xQueueHandle CAMERA_Queue;						/* filled blocks */
+static xStaticQueue CAMERA_QueueBuffer;
+static uint8_t CAMERA_QueueStorage[ CAMERA_QUEUE_SIZE * sizeof( CAMERA_Block ) ];
+static uint32_t CAMERA_Scrap[ CAMERA_BLOCK_WORDS ];		/* target of dropped data */
+static uint8_t* CAMERA_Buf[ 2 ];						/* blocks of memory targets 0 and 1 */
+static uint32_t CAMERA_FrameBlocks;						/* blocks of a frame */
+static uint32_t CAMERA_Frame;							/* frame being captured */
+static uint32_t CAMERA_Index;							/* block of the frame being filled */
+static uint8_t CAMERA_Dropping;							/* rest of the frame is dropped */
+static uint8_t CAMERA_Lost;								/* DMA error or overrun: the blocks are out of step */
+static uint8_t CAMERA_Running;
+static CAMERA_Stats CAMERA_Counters;
+
+/**
+ * @}
+ *//* STM32_Private_Variables */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Next block for the DMA: a free pool block or the scrap buffer
+ * @param  None
+ * @retval Block
+ */
+static uint8_t* CAMERA_TakeBlock( void )
+{
+	uint8_t* block = POOL_Alloc();
+
+	return ( block != NULL ) ? block : (uint8_t*)CAMERA_Scrap;
+}
+
+/**
+ * @brief  Passes the filled block to the consumer and replaces it (DMA transfer complete)
+ * @param  woken: Set to pdTRUE if the consumer has to run
+ * @retval None
+ */
+static void CAMERA_BlockDone( signed portBASE_TYPE* woken )
+{
+	uint32_t done = ( DMA_GetCurrentMemoryTarget( CAMERA_DMA_STREAM ) == 0 ) ? 1 : 0;	/* DMA has gone on to the other one */
+	uint8_t* data = CAMERA_Buf[ done ];
+	CAMERA_Block blk;
+
+	if ( data == (uint8_t*)CAMERA_Scrap || CAMERA_Dropping )
+		CAMERA_Dropping = 1;
+	else
+	{
+		blk.Data = data;
+		blk.Frame = CAMERA_Frame;
+		blk.Index = CAMERA_Index;
+		if ( xQueueSendFromISR( CAMERA_Queue, &blk, woken ) == pdTRUE )
+			data = CAMERA_TakeBlock();
+		else
+			CAMERA_Dropping = 1;		/* the block is filled again */
+	}
+
+	/* while a frame is dropped, the scrap buffer does until the block of the next frame */
+	if ( data == (uint8_t*)CAMERA_Scrap && ( !CAMERA_Dropping || CAMERA_Index + 2 >= CAMERA_FrameBlocks ) )
+		data = CAMERA_TakeBlock();
+	CAMERA_Buf[ done ] = data;
+	DMA_MemoryTargetConfig( CAMERA_DMA_STREAM, (uint32_t)data, done ? DMA_Memory_1 : DMA_Memory_0 );
+
+	if ( ++CAMERA_Index == CAMERA_FrameBlocks )
+	{
+		if ( CAMERA_Dropping )
+			CAMERA_Counters.Dropped++;
+		else
+			CAMERA_Counters.Frames++;
+		CAMERA_Index = 0;
+		CAMERA_Frame++;
+		CAMERA_Dropping = 0;
+	}
+}
+
+/**
+ * @brief  Starts the DMA stream from memory target 0 and the capture from the next frame
+ * @param  None
+ * @retval None
+ */
+static void CAMERA_Enable( void )
+{
+	DMA_ClearFlag( CAMERA_DMA_STREAM, CAMERA_DMA_FLAGS );
+	DMA_SetCurrDataCounter( CAMERA_DMA_STREAM, CAMERA_BLOCK_WORDS );
+	CAMERA_DMA_STREAM->M0AR = (uint32_t)CAMERA_Buf[ 0 ];
+	CAMERA_DMA_STREAM->M1AR = (uint32_t)CAMERA_Buf[ 1 ];
+	CAMERA_DMA_STREAM->CR &= ~DMA_SxCR_CT;
+	DMA_Cmd( CAMERA_DMA_STREAM, ENABLE );
+	DCMI_Cmd( ENABLE );
+	DCMI_CaptureCmd( ENABLE );
+}
+
+/**
+ * @brief  Stops the capture and the DMA stream, data in the FIFOs are dropped
+ * @param  None
+ * @retval None
+ */
+static void CAMERA_Disable( void )
+{
+	DCMI_CaptureCmd( DISABLE );
+	DCMI_Cmd( DISABLE );
+	DMA_Cmd( CAMERA_DMA_STREAM, DISABLE );
+	while ( DMA_GetCmdStatus( CAMERA_DMA_STREAM ) != DISABLE ) ;
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Configures pins, DCMI (8-bit data, hardware syncs) and its DMA stream
+ * @param  None
+ * @retval ERROR if the queue can't be created
+ */
+ErrorStatus CAMERA_Init( void )
+{
+	DCMI_InitTypeDef DCMI_InitStructure;
+	DMA_InitTypeDef DMA_InitStructure;
+
+	CAMERA_Queue = xQueueCreateStatic( CAMERA_QUEUE_SIZE, sizeof( CAMERA_Block ), CAMERA_QueueStorage, &CAMERA_QueueBuffer );
+	if ( CAMERA_Queue == NULL )
+		return ERROR;
+
+	CAMERA_GPIO_PORTS_INIT( CAMERA_GPIO_PORTS, ENABLE );
+	DCMI_config_pins();
+	RCC_AHB2PeriphClockCmd( RCC_AHB2Periph_DCMI, ENABLE );
+	CAMERA_DMA_CLK_INIT( CAMERA_DMA_CLK, ENABLE );
+
+	DCMI_DeInit();
+	DCMI_InitStructure.DCMI_CaptureMode = DCMI_CaptureMode_Continuous;
+	DCMI_InitStructure.DCMI_SynchroMode = DCMI_SynchroMode_Hardware;
+	DCMI_InitStructure.DCMI_PCKPolarity = DCMI_PCKPolarity_Falling;
+	DCMI_InitStructure.DCMI_VSPolarity = DCMI_VSPolarity_High;
+	DCMI_InitStructure.DCMI_HSPolarity = DCMI_HSPolarity_High;
+	DCMI_InitStructure.DCMI_CaptureRate = DCMI_CaptureRate_All_Frame;
+	DCMI_InitStructure.DCMI_ExtendedDataMode = DCMI_ExtendedDataMode_8b;
+	DCMI_Init( &DCMI_InitStructure );
+
+	/* FIFO takes up the AHB latency, single transfers never cross a 1 Kb boundary */
+	DMA_DeInit( CAMERA_DMA_STREAM );
+	DMA_InitStructure.DMA_Channel = CAMERA_DMA_CHANNEL;
+	DMA_InitStructure.DMA_PeripheralBaseAddr = CAMERA_DR_ADDRESS;
+	DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t)CAMERA_Scrap;
+	DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralToMemory;
+	DMA_InitStructure.DMA_BufferSize = CAMERA_BLOCK_WORDS;
+	DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+	DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+	DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word;
+	DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Word;
+	DMA_InitStructure.DMA_Mode = DMA_Mode_Circular;
+	DMA_InitStructure.DMA_Priority = DMA_Priority_VeryHigh;
+	DMA_InitStructure.DMA_FIFOMode = DMA_FIFOMode_Enable;
+	DMA_InitStructure.DMA_FIFOThreshold = DMA_FIFOThreshold_Full;
+	DMA_InitStructure.DMA_MemoryBurst = DMA_MemoryBurst_Single;
+	DMA_InitStructure.DMA_PeripheralBurst = DMA_PeripheralBurst_Single;
+	DMA_Init( CAMERA_DMA_STREAM, &DMA_InitStructure );
+	DMA_DoubleBufferModeConfig( CAMERA_DMA_STREAM, (uint32_t)CAMERA_Scrap, DMA_Memory_0 );
+	DMA_DoubleBufferModeCmd( CAMERA_DMA_STREAM, ENABLE );
+	DMA_ITConfig( CAMERA_DMA_STREAM, DMA_IT_TC | DMA_IT_TE | DMA_IT_FE, ENABLE );
+	DCMI_ITConfig( DCMI_IT_FRAME | DCMI_IT_OVF, ENABLE );
+	return SUCCESS;
+}
+
+/**
+ * @brief  Starts capture from the next frame
+ * @param  frame_blocks: Size of a frame in blocks (sectors) of the pool
+ * @retval ERROR if capture is running already, or the pool has no 2 free blocks
+ */
+ErrorStatus CAMERA_Start( uint32_t frame_blocks )
+{
+	if ( CAMERA_Running || frame_blocks == 0 )
+		return ERROR;
+	CAMERA_Buf[ 0 ] = POOL_Alloc();
+	CAMERA_Buf[ 1 ] = POOL_Alloc();
+	if ( CAMERA_Buf[ 0 ] == NULL || CAMERA_Buf[ 1 ] == NULL )
+	{
+		POOL_Free( CAMERA_Buf[ 0 ] );
+		POOL_Free( CAMERA_Buf[ 1 ] );
+		return ERROR;
+	}
+	CAMERA_FrameBlocks = frame_blocks;
+	CAMERA_Frame = CAMERA_Index = 0;
+	CAMERA_Dropping = CAMERA_Lost = 0;
+	CAMERA_Counters.Frames = CAMERA_Counters.Dropped = CAMERA_Counters.Errors = 0;
+	CAMERA_Running = 1;
+
+	DCMI_ClearITPendingBit( DCMI_IT_FRAME | DCMI_IT_OVF );
+	IRQ_Enable( CAMERA_DMA_IRQn, IRQ_PRIO_CAMERA );
+	IRQ_Enable( DCMI_IRQn, IRQ_PRIO_CAMERA );
+	CAMERA_Enable();
+	return SUCCESS;
+}
+
+/**
+ * @brief  Stops capture. Blocks queued already stay in the queue: the consumer
+ *         takes them by CAMERA_Receive and returns them to the pool
+ * @param  None
+ * @retval None
+ */
+void CAMERA_Stop( void )
+{
+	if ( !CAMERA_Running )
+		return;
+	NVIC_DisableIRQ( DCMI_IRQn );
+	NVIC_DisableIRQ( CAMERA_DMA_IRQn );
+	CAMERA_Disable();
+	CAMERA_Running = 0;
+	if ( CAMERA_Buf[ 0 ] != (uint8_t*)CAMERA_Scrap )
+		POOL_Free( CAMERA_Buf[ 0 ] );
+	if ( CAMERA_Buf[ 1 ] != (uint8_t*)CAMERA_Scrap )
+		POOL_Free( CAMERA_Buf[ 1 ] );
+	CAMERA_Buf[ 0 ] = CAMERA_Buf[ 1 ] = NULL;
+}
+
+/**
+ * @brief  Takes the next filled block
+ * @param  blk: Receives the block
+ * @param  timeout: Timeout in ticks
+ * @retval ERROR on timeout
+ */
+ErrorStatus CAMERA_Receive( CAMERA_Block* blk, portTickType timeout )
+{
+	return ( xQueueReceive( CAMERA_Queue, blk, timeout ) == pdTRUE ) ? SUCCESS : ERROR;
+}
+
+/**
+ * @brief  Gets frame counters
+ * @param  stats: Receives the counters
+ * @retval None
+ */
+void CAMERA_GetStats( CAMERA_Stats* stats )
+{
+	taskENTER_CRITICAL();
+	*stats = CAMERA_Counters;
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief  DCMI interrupt handler: end of frame and overrun
+ * @param  None
+ * @retval None
+ */
+void CAMERA_IRQHandler( void )
+{
+	signed portBASE_TYPE woken = pdFALSE;
+
+	if ( DCMI_GetITStatus( DCMI_IT_OVF ) != RESET )
+	{
+		DCMI_ClearITPendingBit( DCMI_IT_OVF );
+		CAMERA_Lost = 1;
+	}
+	if ( DCMI_GetITStatus( DCMI_IT_FRAME ) != RESET )
+	{
+		DCMI_ClearITPendingBit( DCMI_IT_FRAME );
+		if ( DMA_GetITStatus( CAMERA_DMA_STREAM, CAMERA_DMA_IT_TCIF ) != RESET )
+		{	/* the last block of the frame */
+			DMA_ClearITPendingBit( CAMERA_DMA_STREAM, CAMERA_DMA_IT_TCIF );
+			CAMERA_BlockDone( &woken );
+		}
+		if ( CAMERA_Lost || CAMERA_Index != 0 ||
+				DMA_GetCurrDataCounter( CAMERA_DMA_STREAM ) != CAMERA_BLOCK_WORDS ||
+				DMA_GetCmdStatus( CAMERA_DMA_STREAM ) == DISABLE )
+		{	/* blocks are out of step with frames: restart them with the next frame */
+			CAMERA_Disable();
+			CAMERA_Counters.Errors++;
+			if ( CAMERA_Index != 0 || CAMERA_Lost )
+				CAMERA_Frame++;
+			CAMERA_Index = 0;
+			CAMERA_Dropping = CAMERA_Lost = 0;
+			CAMERA_Enable();
+		}
+	}
+	portYIELD_FROM_ISR( woken );
+}
+
+/**
+ * @brief  DMA stream interrupt handler: block filled, transfer and FIFO errors
+ * @param  None
+ * @retval None
+ */
+void CAMERA_DMA_IRQHandler( void )
+{
+	signed portBASE_TYPE woken = pdFALSE;
+
+	if ( DMA_GetITStatus( CAMERA_DMA_STREAM, CAMERA_DMA_IT_TEIF ) != RESET ||
+			DMA_GetITStatus( CAMERA_DMA_STREAM, CAMERA_DMA_IT_FEIF ) != RESET )
+	{	/* late handler (target written while in use) or FIFO overrun, the frame end resyncs */
+		DMA_ClearITPendingBit( CAMERA_DMA_STREAM, CAMERA_DMA_IT_TEIF | CAMERA_DMA_IT_FEIF );
+		CAMERA_Lost = 1;
+	}
+	if ( DMA_GetITStatus( CAMERA_DMA_STREAM, CAMERA_DMA_IT_TCIF ) != RESET )
+	{
+		DMA_ClearITPendingBit( CAMERA_DMA_STREAM, CAMERA_DMA_IT_TCIF );
+		CAMERA_BlockDone( &woken );
+	}
+	portYIELD_FROM_ISR( woken );
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#endif /* USE_CAMERA_RECORD */
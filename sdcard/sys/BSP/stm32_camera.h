@@ -0,0 +1,91 @@
+/**
+ ******************************************************************************
+ * @file    stm32_camera.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Camera frame capture by DCMI. The DMA stream runs in double
+ *          buffer mode over blocks of the pool: each filled block is passed
+ *          to the consumer task by a queue and replaced by a free block, so
+ *          a frame arrives as a sequence of sector sized blocks which go to
+ *          the card as they are (e.g. RING_Write), without a copy. If there
+ *          is no free block or no room in the queue, the rest of the frame
+ *          goes to a scrap buffer and the frame is counted as dropped.
+ *          The sensor has to be set up (by its own control bus) to send
+ *          frames of the size passed to CAMERA_Start.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32_CAMERA_H
+#define STM32_CAMERA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f2xx.h"
+
+#include <stdint.h>
+
+/* Scheduler */
+#include "FreeRTOS.h"
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Types
+ * @{
+ */
+
+/**
+ * @brief  Filled block of a frame
+ */
+typedef struct
+{
+	uint8_t*	Data;			/*!< Pool block of POOL_BLOCK_SIZE bytes, the consumer returns it by POOL_Free */
+	uint32_t	Frame;			/*!< Frame number since CAMERA_Start */
+	uint32_t	Index;			/*!< Block number within the frame */
+} CAMERA_Block;
+
+/**
+ * @brief  Frame counters since CAMERA_Start
+ */
+typedef struct
+{
+	uint32_t	Frames;			/*!< Frames passed whole to the consumer */
+	uint32_t	Dropped;		/*!< Frames dropped: no free block or the queue was full */
+	uint32_t	Errors;			/*!< Frames lost to DMA errors, DCMI overruns or unexpected frame size */
+} CAMERA_Stats;
+
+/**
+ * @}
+ *//* STM32_Exported_Types */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+ErrorStatus CAMERA_Init( void );
+ErrorStatus CAMERA_Start( uint32_t frame_blocks );
+void CAMERA_Stop( void );
+ErrorStatus CAMERA_Receive( CAMERA_Block* blk, portTickType timeout );
+void CAMERA_GetStats( CAMERA_Stats* stats );
+
+void CAMERA_IRQHandler( void );
+void CAMERA_DMA_IRQHandler( void );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32_CAMERA_H */
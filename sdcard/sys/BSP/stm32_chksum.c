@@ -0,0 +1,264 @@
+/**
+ ******************************************************************************
+ * @file    stm32_chksum.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Hardware checksums. The CRC unit computes CRC-32 (polynomial
+ *          0x04C11DB7, initial value 0xFFFFFFFF) of 32-bit words MSB first,
+ *          zlib crc32 processes bytes LSB first: with each little endian
+ *          word bit reversed on the way in and the register bit reversed on
+ *          the way out both are the same, so files and frames keep their
+ *          format. The unit takes a word per bus write (128 writes per
+ *          sector instead of a table lookup per nibble), the last 1..3 bytes
+ *          are folded in by software. Words are fed by the CPU: DMA can't
+ *          reverse the bits, and a sector is done before a DMA transfer
+ *          would be set up. A CRC of data in pieces keeps the unit from
+ *          Start to Finish, like the HASH processor below.
+ *          The HASH processor takes message words through its FIFO (byte
+ *          swapped by the unit, HASH_DataType_8b), bytes left over between
+ *          updates wait in a word until the next one.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "stm32f2xx.h"
+#include "stm32_chksum.h"
+
+#include <string.h>
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Constants
+ * @{
+ */
+
+/**
+ * @brief  CRC32 (IEEE 802.3, reflected) nibble-wise lookup table for the bytes after the last word
+ */
+static const uint32_t CHK_Crc32Table[ 16 ] =
+{
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+/**
+ * @}
+ *//* STM32_Private_Constants */
+
+
+/** @defgroup STM32_Private_Variables
+ * @{
+ */
+
+static xSemaphoreHandle CHK_CrcMutex;		/* owner of the CRC unit */
+static xStaticSemaphore CHK_CrcMutexBuffer;
+static uint32_t CHK_CrcTail;				/* bytes not fed yet (less than a word) */
+static uint8_t CHK_CrcTailLen;
+#ifdef USE_HW_HASH
+static xSemaphoreHandle CHK_HashMutex;		/* owner of the HASH processor, from Start to Finish */
+static xStaticSemaphore CHK_HashMutexBuffer;
+static uint32_t CHK_HashTail;				/* bytes of the message not fed yet (less than a word) */
+static uint8_t CHK_HashTailLen;
+#endif /* USE_HW_HASH */
+
+/**
+ * @}
+ *//* STM32_Private_Variables */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Enables clocks of the units and creates their mutexes, call it at startup
+ * @param  None
+ * @retval None
+ */
+void CHK_Init( void )
+{
+	RCC_AHB1PeriphClockCmd( RCC_AHB1Periph_CRC, ENABLE );
+	CHK_CrcMutex = xSemaphoreCreateMutexStatic( &CHK_CrcMutexBuffer );
+#ifdef USE_HW_HASH
+	RCC_AHB2PeriphClockCmd( RCC_AHB2Periph_HASH, ENABLE );
+	CHK_HashMutex = xSemaphoreCreateMutexStatic( &CHK_HashMutexBuffer );
+#endif /* USE_HW_HASH */
+}
+
+/**
+ * @brief  Calculates CRC32 of the buffer (as zlib crc32)
+ * @param  buf: Data (any alignment)
+ * @param  len: Number of bytes
+ * @retval CRC32
+ */
+uint32_t CHK_Crc32( const void* buf, uint32_t len )
+{
+	CHK_Crc32Start();
+	CHK_Crc32Update( buf, len );
+	return CHK_Crc32Finish();
+}
+
+/**
+ * @brief  Starts CRC32 of data passed in pieces, the caller owns the CRC unit until CHK_Crc32Finish
+ * @param  None
+ * @retval None
+ */
+void CHK_Crc32Start( void )
+{
+	xSemaphoreTake( CHK_CrcMutex, portMAX_DELAY );
+	CRC_ResetDR();
+	CHK_CrcTail = 0;
+	CHK_CrcTailLen = 0;
+}
+
+/**
+ * @brief  Adds bytes to the CRC
+ * @param  buf: Data (any alignment)
+ * @param  len: Number of bytes
+ * @retval None
+ */
+void CHK_Crc32Update( const void* buf, uint32_t len )
+{
+	const uint8_t* p = (const uint8_t*)buf;
+	uint32_t w;
+
+	/* complete the word left over by the previous update */
+	while ( CHK_CrcTailLen != 0 && len > 0 )
+	{
+		CHK_CrcTail |= (uint32_t)*p++ << ( 8 * CHK_CrcTailLen );
+		--len;
+		if ( ++CHK_CrcTailLen == 4 )
+		{
+			CRC->DR = __RBIT( CHK_CrcTail );
+			CHK_CrcTail = 0;
+			CHK_CrcTailLen = 0;
+		}
+	}
+	for ( ; len >= 4; len -= 4, p += 4 )
+	{
+		memcpy( &w, p, 4 );		/* unaligned load, Cortex-M3 handles it */
+		CRC->DR = __RBIT( w );
+	}
+	for ( ; len > 0; --len )
+		CHK_CrcTail |= (uint32_t)*p++ << ( 8 * CHK_CrcTailLen++ );
+}
+
+/**
+ * @brief  Completes the CRC and releases the CRC unit
+ * @param  None
+ * @retval CRC32 of all bytes since CHK_Crc32Start
+ */
+uint32_t CHK_Crc32Finish( void )
+{
+	uint32_t crc, tail = CHK_CrcTail;
+	uint8_t len = CHK_CrcTailLen;
+
+	crc = __RBIT( CRC->DR );
+	xSemaphoreGive( CHK_CrcMutex );
+
+	for ( ; len > 0; --len, tail >>= 8 )
+	{
+		crc = CHK_Crc32Table[ ( crc ^ tail ) & 0x0F ] ^ ( crc >> 4 );
+		crc = CHK_Crc32Table[ ( crc ^ ( tail >> 4 ) ) & 0x0F ] ^ ( crc >> 4 );
+	}
+	return ~crc;
+}
+
+#ifdef USE_HW_HASH
+/**
+ * @brief  Starts SHA-1 digest of a message, the caller owns the HASH processor until CHK_Sha1Finish
+ * @param  None
+ * @retval None
+ */
+void CHK_Sha1Start( void )
+{
+	HASH_InitTypeDef HASH_InitStructure;
+
+	xSemaphoreTake( CHK_HashMutex, portMAX_DELAY );
+	HASH_DeInit();
+	HASH_InitStructure.HASH_AlgoSelection = HASH_AlgoSelection_SHA1;
+	HASH_InitStructure.HASH_AlgoMode = HASH_AlgoMode_HASH;
+	HASH_InitStructure.HASH_DataType = HASH_DataType_8b;
+	HASH_InitStructure.HASH_HMACKeyType = HASH_HMACKeyType_ShortKey;
+	HASH_Init( &HASH_InitStructure );
+	CHK_HashTail = 0;
+	CHK_HashTailLen = 0;
+}
+
+/**
+ * @brief  Adds bytes to the message
+ * @param  buf: Data (any alignment)
+ * @param  len: Number of bytes
+ * @retval None
+ */
+void CHK_Sha1Update( const void* buf, uint32_t len )
+{
+	const uint8_t* p = (const uint8_t*)buf;
+	uint32_t w;
+
+	/* complete the word left over by the previous update */
+	while ( CHK_HashTailLen != 0 && len > 0 )
+	{
+		CHK_HashTail |= (uint32_t)*p++ << ( 8 * CHK_HashTailLen );
+		--len;
+		if ( ++CHK_HashTailLen == 4 )
+		{
+			HASH->DIN = CHK_HashTail;
+			CHK_HashTail = 0;
+			CHK_HashTailLen = 0;
+		}
+	}
+	for ( ; len >= 4; len -= 4, p += 4 )
+	{
+		memcpy( &w, p, 4 );
+		HASH->DIN = w;		/* the bus waits while the FIFO is full */
+	}
+	for ( ; len > 0; --len )
+		CHK_HashTail |= (uint32_t)*p++ << ( 8 * CHK_HashTailLen++ );
+}
+
+/**
+ * @brief  Completes the digest and releases the HASH processor
+ * @param  digest: Buffer of CHK_SHA1_SIZE bytes
+ * @retval None
+ */
+void CHK_Sha1Finish( uint8_t* digest )
+{
+	HASH_MsgDigest md;
+	uint32_t w;
+	uint8_t i;
+
+	if ( CHK_HashTailLen != 0 )
+		HASH->DIN = CHK_HashTail;
+	HASH_SetLastWordValidBitsNbr( 8 * CHK_HashTailLen );
+	HASH_StartDigest();
+	while ( HASH_GetFlagStatus( HASH_FLAG_BUSY ) != RESET )
+		;
+	HASH_GetDigest( &md );
+	xSemaphoreGive( CHK_HashMutex );
+
+	for ( i = 0; i < CHK_SHA1_SIZE / 4; ++i )
+	{
+		w = __REV( md.Data[ i ] );		/* digest words are big endian */
+		memcpy( digest + 4 * i, &w, 4 );
+	}
+}
+#endif /* USE_HW_HASH */
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
@@ -0,0 +1,72 @@
+/**
+ ******************************************************************************
+ * @file    stm32_chksum.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Checksums of stored and transferred data by the hardware units:
+ *          CRC32 (as zlib crc32) by the CRC calculation unit, and SHA-1 by
+ *          the HASH processor of STM32F21x (USE_HW_HASH). Both are shared
+ *          by tasks: a mutex serializes the users of each unit.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32_CHKSUM_H
+#define STM32_CHKSUM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include <stdint.h>
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Constants
+ * @{
+ */
+
+/**
+ * @brief  Size of SHA-1 digest in bytes
+ */
+#define CHK_SHA1_SIZE			20
+
+/**
+ * @}
+ *//* STM32_Exported_Constants */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+void CHK_Init( void );
+uint32_t CHK_Crc32( const void* buf, uint32_t len );
+void CHK_Crc32Start( void );
+void CHK_Crc32Update( const void* buf, uint32_t len );
+uint32_t CHK_Crc32Finish( void );
+
+#ifdef USE_HW_HASH
+void CHK_Sha1Start( void );
+void CHK_Sha1Update( const void* buf, uint32_t len );
+void CHK_Sha1Finish( uint8_t* digest );
+#endif /* USE_HW_HASH */
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32_CHKSUM_H */
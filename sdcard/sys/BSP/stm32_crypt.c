@@ -0,0 +1,333 @@
+/**
+ ******************************************************************************
+ * @file    stm32_crypt.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Sector encryption by the CRYP processor. For each sector the IV
+ *          key encrypts the sector number (ECB, one block fed by the CPU),
+ *          then the data key runs CBC over the sector while DMA2 Stream6
+ *          feeds the IN FIFO and DMA2 Stream5 drains the OUT FIFO (channel 2,
+ *          fixed by the DMA request mapping). A sector takes a few us, less
+ *          than waking a task up, so completion is polled. Decryption works
+ *          in place: a block is written out only after it has been read in.
+ *          The key is read at startup from OTP block CRYPT_OTP_BLOCK, it is
+ *          programmed once per device (and the block locked) at production.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#ifdef USE_DISK_CRYPT
+
+#include "stm32_crypt.h"
+#include "stm32_pins.h"
+
+#include <string.h>
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#ifdef SD_SDIO_DMA_STREAM6
+#error CRYP IN DMA is DMA2 Stream6, move SDIO DMA to Stream3 (see stm32_pins.h)
+#endif
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  DMA streams of the CRYP processor (DMA2 channel 2)
+ */
+#define CRYPT_DMA_CLK			RCC_AHB1Periph_DMA2
+#define CRYPT_DMA_CHANNEL		DMA_Channel_2
+#define CRYPT_DMA_STREAM_IN		DMA2_Stream6
+#define CRYPT_DMA_STREAM_OUT	DMA2_Stream5
+#define CRYPT_DMA_FLAGS_IN		( DMA_FLAG_FEIF6 | DMA_FLAG_DMEIF6 | DMA_FLAG_TEIF6 | DMA_FLAG_HTIF6 | DMA_FLAG_TCIF6 )
+#define CRYPT_DMA_FLAGS_OUT		( DMA_FLAG_FEIF5 | DMA_FLAG_DMEIF5 | DMA_FLAG_TEIF5 | DMA_FLAG_HTIF5 | DMA_FLAG_TCIF5 )
+
+/**
+ * @brief  OTP block holding the key (16 blocks of 32 bytes from 0x1FFF7800)
+ */
+#define CRYPT_OTP_BLOCK			0
+#define CRYPT_OTP_KEY			( (const uint8_t*)( 0x1FFF7800 + CRYPT_OTP_BLOCK * CRYPT_KEY_SIZE ) )
+
+/**
+ * @brief  Number of polls of the processor and DMA (a sector is done in less than 1000)
+ */
+#define CRYPT_TIMEOUT			100000
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Variables
+ * @{
+ */
+
+static CRYP_KeyInitTypeDef CRYPT_DataKey;	/* key registers of the data key */
+static CRYP_KeyInitTypeDef CRYPT_IVKey;		/* key registers of the IV key */
+static uint8_t CRYPT_Keyed;					/* key is set */
+static xSemaphoreHandle CRYPT_Mutex;		/* owner of the processor */
+static xStaticSemaphore CRYPT_MutexBuffer;
+
+/**
+ * @}
+ *//* STM32_Private_Variables */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Fills key registers of AES-128 key
+ * @param  regs: Key registers
+ * @param  key: 16 bytes of the key
+ * @retval None
+ */
+static void CRYPT_KeyRegs( CRYP_KeyInitTypeDef* regs, const uint8_t* key )
+{
+	uint32_t w[ 4 ];
+
+	memcpy( w, key, sizeof( w ) );
+	CRYP_KeyStructInit( regs );
+	regs->CRYP_Key2Left = __REV( w[ 0 ] );
+	regs->CRYP_Key2Right = __REV( w[ 1 ] );
+	regs->CRYP_Key3Left = __REV( w[ 2 ] );
+	regs->CRYP_Key3Right = __REV( w[ 3 ] );
+}
+
+/**
+ * @brief  Sets up the processor for the algorithm (it is disabled: setup is allowed)
+ * @param  dir: CRYP_AlgoDir_*
+ * @param  mode: CRYP_AlgoMode_*
+ * @param  type: CRYP_DataType_*
+ * @retval None
+ */
+static void CRYPT_Setup( uint16_t dir, uint16_t mode, uint16_t type )
+{
+	CRYP_InitTypeDef CRYP_InitStructure;
+
+	CRYP_InitStructure.CRYP_AlgoDir = dir;
+	CRYP_InitStructure.CRYP_AlgoMode = mode;
+	CRYP_InitStructure.CRYP_DataType = type;
+	CRYP_InitStructure.CRYP_KeySize = CRYP_KeySize_128b;
+	CRYP_Init( &CRYP_InitStructure );
+}
+
+/**
+ * @brief  Waits until the processor is idle
+ * @param  None
+ * @retval ERROR on timeout
+ */
+static ErrorStatus CRYPT_WaitIdle( void )
+{
+	uint32_t tries;
+
+	for ( tries = CRYPT_TIMEOUT; CRYP_GetFlagStatus( CRYP_FLAG_BUSY ) != RESET; --tries )
+	{
+		if ( tries == 0 )
+			return ERROR;
+	}
+	return SUCCESS;
+}
+
+/**
+ * @brief  Calculates IV of the sector: its number encrypted by the IV key
+ * @param  sector: Sector number
+ * @param  iv: Receives IV registers
+ * @retval ERROR on timeout
+ */
+static ErrorStatus CRYPT_SectorIV( uint32_t sector, CRYP_IVInitTypeDef* iv )
+{
+	CRYP_FIFOFlush();
+	CRYPT_Setup( CRYP_AlgoDir_Encrypt, CRYP_AlgoMode_AES_ECB, CRYP_DataType_32b );
+	CRYP_KeyInit( &CRYPT_IVKey );
+	CRYP_Cmd( ENABLE );
+	CRYP_DataIn( sector );
+	CRYP_DataIn( 0 );
+	CRYP_DataIn( 0 );
+	CRYP_DataIn( 0 );
+	if ( CRYPT_WaitIdle() != SUCCESS )
+		return ERROR;
+	iv->CRYP_IV0Left = CRYP_DataOut();
+	iv->CRYP_IV0Right = CRYP_DataOut();
+	iv->CRYP_IV1Left = CRYP_DataOut();
+	iv->CRYP_IV1Right = CRYP_DataOut();
+	CRYP_Cmd( DISABLE );
+	return SUCCESS;
+}
+
+/**
+ * @brief  Runs the prepared CBC pass over one sector by DMA and waits for it
+ * @param  in: Source
+ * @param  out: Destination
+ * @retval ERROR on timeout or DMA error
+ */
+static ErrorStatus CRYPT_Transfer( const void* in, void* out )
+{
+	ErrorStatus res = SUCCESS;
+	uint32_t tries;
+
+	DMA_ClearFlag( CRYPT_DMA_STREAM_IN, CRYPT_DMA_FLAGS_IN );
+	DMA_ClearFlag( CRYPT_DMA_STREAM_OUT, CRYPT_DMA_FLAGS_OUT );
+	CRYPT_DMA_STREAM_IN->M0AR = (uint32_t)in;
+	CRYPT_DMA_STREAM_OUT->M0AR = (uint32_t)out;
+	DMA_SetCurrDataCounter( CRYPT_DMA_STREAM_IN, CRYPT_SECTOR_SIZE / 4 );
+	DMA_SetCurrDataCounter( CRYPT_DMA_STREAM_OUT, CRYPT_SECTOR_SIZE / 4 );
+	DMA_Cmd( CRYPT_DMA_STREAM_OUT, ENABLE );
+	DMA_Cmd( CRYPT_DMA_STREAM_IN, ENABLE );
+	CRYP_DMACmd( CRYP_DMAReq_DataIN | CRYP_DMAReq_DataOUT, ENABLE );
+	CRYP_Cmd( ENABLE );
+
+	for ( tries = CRYPT_TIMEOUT; DMA_GetFlagStatus( CRYPT_DMA_STREAM_OUT, DMA_FLAG_TCIF5 ) == RESET; --tries )
+	{
+		if ( tries == 0 || DMA_GetFlagStatus( CRYPT_DMA_STREAM_OUT, DMA_FLAG_TEIF5 ) != RESET ||
+				DMA_GetFlagStatus( CRYPT_DMA_STREAM_IN, DMA_FLAG_TEIF6 ) != RESET )
+		{
+			res = ERROR;
+			break;
+		}
+	}
+
+	CRYP_Cmd( DISABLE );
+	CRYP_DMACmd( CRYP_DMAReq_DataIN | CRYP_DMAReq_DataOUT, DISABLE );
+	DMA_Cmd( CRYPT_DMA_STREAM_IN, DISABLE );
+	DMA_Cmd( CRYPT_DMA_STREAM_OUT, DISABLE );
+	return res;
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Enables the processor and its DMA streams, reads the key from OTP
+ * @param  None
+ * @retval ERROR if OTP block of the key is blank (drives stay not ready until CRYPT_SetKey)
+ */
+ErrorStatus CRYPT_Init( void )
+{
+	DMA_InitTypeDef DMA_InitStructure;
+	uint8_t i;
+
+	RCC_AHB2PeriphClockCmd( RCC_AHB2Periph_CRYP, ENABLE );
+	RCC_AHB1PeriphClockCmd( CRYPT_DMA_CLK, ENABLE );
+	CRYPT_Mutex = xSemaphoreCreateMutexStatic( &CRYPT_MutexBuffer );
+
+	DMA_InitStructure.DMA_Channel            = CRYPT_DMA_CHANNEL;
+	DMA_InitStructure.DMA_BufferSize         = CRYPT_SECTOR_SIZE / 4;
+	DMA_InitStructure.DMA_PeripheralInc      = DMA_PeripheralInc_Disable;
+	DMA_InitStructure.DMA_MemoryInc          = DMA_MemoryInc_Enable;
+	DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word;
+	DMA_InitStructure.DMA_MemoryDataSize     = DMA_MemoryDataSize_Word;
+	DMA_InitStructure.DMA_Mode               = DMA_Mode_Normal;
+	DMA_InitStructure.DMA_Priority           = DMA_Priority_High;
+	DMA_InitStructure.DMA_FIFOMode           = DMA_FIFOMode_Disable;
+	DMA_InitStructure.DMA_FIFOThreshold      = DMA_FIFOThreshold_Full;
+	DMA_InitStructure.DMA_MemoryBurst        = DMA_MemoryBurst_Single;
+	DMA_InitStructure.DMA_PeripheralBurst    = DMA_PeripheralBurst_Single;
+
+	DMA_DeInit( CRYPT_DMA_STREAM_IN );
+	DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&CRYP->DR;
+	DMA_InitStructure.DMA_Memory0BaseAddr    = 0;
+	DMA_InitStructure.DMA_DIR                = DMA_DIR_MemoryToPeripheral;
+	DMA_Init( CRYPT_DMA_STREAM_IN, &DMA_InitStructure );
+
+	DMA_DeInit( CRYPT_DMA_STREAM_OUT );
+	DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&CRYP->DOUT;
+	DMA_InitStructure.DMA_DIR                = DMA_DIR_PeripheralToMemory;
+	DMA_Init( CRYPT_DMA_STREAM_OUT, &DMA_InitStructure );
+
+	for ( i = 0; i < CRYPT_KEY_SIZE && CRYPT_OTP_KEY[ i ] == 0xFF; ++i ) ;
+	if ( i == CRYPT_KEY_SIZE )
+		return ERROR;
+	CRYPT_SetKey( CRYPT_OTP_KEY );
+	return SUCCESS;
+}
+
+/**
+ * @brief  Sets the key (instead of the one in OTP), call it before the drives are initialized
+ * @param  key: CRYPT_KEY_SIZE bytes: data key, then IV key
+ * @retval None
+ */
+void CRYPT_SetKey( const uint8_t* key )
+{
+	CRYPT_KeyRegs( &CRYPT_DataKey, key );
+	CRYPT_KeyRegs( &CRYPT_IVKey, key + CRYPT_KEY_SIZE / 2 );
+	CRYPT_Keyed = 1;
+}
+
+/**
+ * @brief  Check if the key is set
+ * @param  None
+ * @retval Nonzero if sectors can be encrypted
+ */
+uint8_t CRYPT_HasKey( void )
+{
+	return CRYPT_Keyed;
+}
+
+/**
+ * @brief  Encrypts or decrypts one sector
+ * @param  dir: CRYPT_ENCRYPT or CRYPT_DECRYPT
+ * @param  sector: Sector number on the medium (sets the IV)
+ * @param  in: Source, word aligned DMA capable memory
+ * @param  out: Destination (may be the source), word aligned DMA capable memory
+ * @retval ERROR if there is no key or the processor doesn't complete
+ */
+ErrorStatus CRYPT_Sector( uint8_t dir, uint32_t sector, const void* in, void* out )
+{
+	CRYP_IVInitTypeDef iv;
+	ErrorStatus res;
+
+	if ( !CRYPT_Keyed )
+		return ERROR;
+	xSemaphoreTake( CRYPT_Mutex, portMAX_DELAY );
+	res = CRYPT_SectorIV( sector, &iv );
+	if ( res == SUCCESS && dir == CRYPT_DECRYPT )
+	{	/* decryption key schedule is prepared from the data key */
+		CRYPT_Setup( CRYP_AlgoDir_Decrypt, CRYP_AlgoMode_AES_Key, CRYP_DataType_32b );
+		CRYP_KeyInit( &CRYPT_DataKey );
+		CRYP_Cmd( ENABLE );
+		res = CRYPT_WaitIdle();
+		CRYP_Cmd( DISABLE );
+	}
+	else if ( res == SUCCESS )
+		CRYP_KeyInit( &CRYPT_DataKey );
+	if ( res == SUCCESS )
+	{
+		CRYPT_Setup( ( dir == CRYPT_DECRYPT ) ? CRYP_AlgoDir_Decrypt : CRYP_AlgoDir_Encrypt,
+				CRYP_AlgoMode_AES_CBC, CRYP_DataType_8b );
+		CRYP_IVInit( &iv );
+		CRYP_FIFOFlush();
+		res = CRYPT_Transfer( in, out );
+	}
+	CRYP_Cmd( DISABLE );
+	xSemaphoreGive( CRYPT_Mutex );
+	return res;
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#endif /* USE_DISK_CRYPT */
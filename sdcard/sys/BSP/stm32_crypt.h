@@ -0,0 +1,78 @@
+/**
+ ******************************************************************************
+ * @file    stm32_crypt.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Sector encryption by the CRYP processor of STM32F21x for diskio.
+ *          Each sector is AES-128-CBC encrypted with its own IV: the IV is
+ *          the AES-128 encryption of the sector number (the first 4 bytes,
+ *          big endian, followed by 12 zero bytes) with a separate IV key,
+ *          as ESSIV of disk encryption, so equal sectors at different
+ *          places differ and IVs can't be predicted without the key.
+ *          Sector data go through the processor by DMA (in and out).
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32_CRYPT_H
+#define STM32_CRYPT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f2xx.h"
+
+#include <stdint.h>
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Constants
+ * @{
+ */
+
+/**
+ * @brief  Size of the key: data key (16 bytes) followed by IV key (16 bytes)
+ */
+#define CRYPT_KEY_SIZE			32
+
+/**
+ * @brief  Size of the unit encrypted with one IV (sector)
+ */
+#define CRYPT_SECTOR_SIZE		512
+
+/**
+ * @brief  Directions of CRYPT_Sector
+ */
+#define CRYPT_ENCRYPT			0
+#define CRYPT_DECRYPT			1
+
+/**
+ * @}
+ *//* STM32_Exported_Constants */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+ErrorStatus CRYPT_Init( void );
+void CRYPT_SetKey( const uint8_t* key );
+uint8_t CRYPT_HasKey( void );
+ErrorStatus CRYPT_Sector( uint8_t dir, uint32_t sector, const void* in, void* out );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32_CRYPT_H */
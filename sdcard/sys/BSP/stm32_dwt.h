@@ -0,0 +1,71 @@
+/**
+ ******************************************************************************
+ * @file    stm32_dwt.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Cortex-M3 DWT cycle counter, used for timing of driver operations.
+ *          CMSIS v1.3 core header has no DWT definitions, so registers are
+ *          defined here.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32_DWT_H
+#define STM32_DWT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f2xx.h"
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Constants
+ * @{
+ */
+
+#define DWT_CTRL				(*(volatile uint32_t*)0xE0001000)	/*!< DWT control register */
+#define DWT_CYCCNT				(*(volatile uint32_t*)0xE0001004)	/*!< DWT cycle counter */
+#define DWT_CTRL_CYCCNTENA		((uint32_t)0x00000001)				/*!< cycle counter enable bit */
+
+/**
+ * @}
+ *//* STM32_Exported_Constants */
+
+/** @defgroup STM32_Exported_Macros
+ * @{
+ */
+
+/**
+ * @brief  Start cycle counter (it keeps running if it was started before)
+ */
+#define DWT_Enable()			do { CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk; \
+									 DWT_CTRL |= DWT_CTRL_CYCCNTENA; } while ( 0 )
+
+/**
+ * @brief  Current value of cycle counter (wraps around every ~35 s at 120MHz)
+ */
+#define DWT_GetCycles()			( DWT_CYCCNT )
+
+/**
+ * @brief  Convert number of core clock cycles to microseconds
+ */
+#define DWT_CyclesToUs( c )		( (uint32_t)(c) / ( SystemCoreClock / 1000000 ) )
+
+/**
+ * @}
+ *//* STM32_Exported_Macros */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32_DWT_H */
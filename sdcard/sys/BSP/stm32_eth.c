@@ -0,0 +1,455 @@
+/**
+ ******************************************************************************
+ * @file    stm32_eth.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Ethernet MAC and DMA driven by registers (the peripheral library
+ *          has no Ethernet driver). Both descriptor lists are rings of the
+ *          normal 16-byte descriptors: a transmit descriptor points at its
+ *          header slot and at the payload, a receive descriptor at its own
+ *          buffer. Store and forward is on in both directions, so checksums
+ *          are inserted into whole frames and received frames are checked
+ *          before the DMA writes their status.
+ *          The PHY is reached through its standard registers only (reset,
+ *          auto-negotiation, link), so the DP83848 of the evaluation board
+ *          and the RTL8201 of the reworked one are both served; speed and
+ *          duplex of the MAC follow the abilities both link partners have.
+ *          The interrupt handler only wakes the network task on a received
+ *          or a sent frame, the task does the rest.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#ifdef USE_NET_FILE_SERVICE
+
+#include "stm32_eth.h"
+#include "stm32_pins.h"
+#include "stm32_irq.h"
+#include "stm32_mem.h"
+
+#include <stddef.h>
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Types
+ * @{
+ */
+
+/**
+ * @brief  Normal DMA descriptor (RM0033 28.6.7, ring mode: buffer 2 isn't a link)
+ */
+typedef struct
+{
+	__IO uint32_t	Status;			/*!< TDES0 / RDES0, OWN bit passes it to the DMA */
+	__IO uint32_t	Size;			/*!< TDES1 / RDES1, sizes of buffers 1 and 2 */
+	__IO uint32_t	Buffer1;		/*!< TDES2 / RDES2 */
+	__IO uint32_t	Buffer2;		/*!< TDES3 / RDES3 */
+} EMAC_Desc;
+
+/**
+ * @}
+ *//* STM32_Private_Types */
+
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  Transmit descriptor bits: the whole frame is in one descriptor, the MAC
+ *         inserts IPv4 header and payload checksums (pseudo-header included)
+ */
+#define EMAC_TDES0_OWN			0x80000000
+#define EMAC_TDES0_IC			0x40000000
+#define EMAC_TDES0_LS			0x20000000
+#define EMAC_TDES0_FS			0x10000000
+#define EMAC_TDES0_CIC_FULL		0x00C00000
+#define EMAC_TDES0_TER			0x00200000
+#define EMAC_TDES1_SIZE( b1, b2 )	( ( (uint32_t)( b2 ) << 16 ) | ( b1 ) )
+
+/**
+ * @brief  Receive descriptor bits. With checksum offload FT marks an IPv4/IPv6 frame,
+ *         IPHCE and PCE report its header and payload checksum errors then.
+ */
+#define EMAC_RDES0_OWN			0x80000000
+#define EMAC_RDES0_FL( s )		( ( ( s ) >> 16 ) & 0x3FFF )
+#define EMAC_RDES0_DE			0x00004000
+#define EMAC_RDES0_OE			0x00000800
+#define EMAC_RDES0_FS			0x00000200
+#define EMAC_RDES0_LS			0x00000100
+#define EMAC_RDES0_IPHCE		0x00000080
+#define EMAC_RDES0_LCO			0x00000040
+#define EMAC_RDES0_FT			0x00000020
+#define EMAC_RDES0_RWT			0x00000010
+#define EMAC_RDES0_RE			0x00000008
+#define EMAC_RDES0_CE			0x00000002
+#define EMAC_RDES0_PCE			0x00000001
+#define EMAC_RDES0_ERRORS		( EMAC_RDES0_DE | EMAC_RDES0_OE | EMAC_RDES0_LCO | EMAC_RDES0_RWT | EMAC_RDES0_RE | EMAC_RDES0_CE )
+#define EMAC_RDES1_RER			0x00008000
+
+/**
+ * @brief  Standard PHY registers and bits (IEEE 802.3 clause 22)
+ */
+#define EMAC_PHY_BMCR			0
+#define EMAC_PHY_BMSR			1
+#define EMAC_PHY_ANAR			4
+#define EMAC_PHY_ANLPAR			5
+#define EMAC_BMCR_RESET			0x8000
+#define EMAC_BMCR_ANEN			0x1000
+#define EMAC_BMCR_ANRESTART		0x0200
+#define EMAC_BMSR_ANDONE		0x0020
+#define EMAC_BMSR_LINK			0x0004
+#define EMAC_AN_100FD			0x0100
+#define EMAC_AN_100HD			0x0080
+#define EMAC_AN_10FD			0x0040
+
+/**
+ * @brief  PHY address on the management bus (stm32_pins.h)
+ */
+#define EMAC_PHY				DP83848_PHY_ADDRESS
+
+/**
+ * @brief  Busy wait limits: a management frame takes 26 us at 2.4 MHz MDC, the PHY
+ *         resets in under 1 ms, the DMA reset needs both clocks of the PHY
+ */
+#define EMAC_MII_TIMEOUT		0x4000
+#define EMAC_RESET_TIMEOUT		0x100000
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Variables
+ * @{
+ */
+
+static EMAC_Desc EMAC_TxDesc[ EMAC_TX_FRAMES ] MEM_DMA_BUFFER;
+static EMAC_Desc EMAC_RxDesc[ EMAC_RX_BUFFERS ] MEM_DMA_BUFFER;
+static uint8_t EMAC_TxSlots[ EMAC_TX_FRAMES ][ EMAC_TX_SLOT ] MEM_DMA_BUFFER;
+static uint8_t EMAC_RxBuffers[ EMAC_RX_BUFFERS ][ EMAC_RX_SIZE ] MEM_DMA_BUFFER;
+static uint32_t EMAC_TxTags[ EMAC_TX_FRAMES ];		/* tags of the frames in the descriptors */
+static uint8_t EMAC_TxNext;							/* descriptor of the next frame to send */
+static uint8_t EMAC_RxNext;							/* descriptor of the next received frame */
+static uint8_t EMAC_LinkUp;
+static uint32_t EMAC_MiiClock;						/* CR field of MACMIIAR for HCLK */
+static xTaskHandle EMAC_Task;						/* notified on each received or sent frame */
+
+/**
+ * @}
+ *//* STM32_Private_Variables */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Waits until the management frame is over
+ * @param  None
+ * @retval ERROR if the MAC doesn't finish it
+ */
+static ErrorStatus EMAC_MiiWait( void )
+{
+	uint32_t n;
+
+	for ( n = 0; n < EMAC_MII_TIMEOUT; ++n )
+		if ( !( ETH->MACMIIAR & ETH_MACMIIAR_MB ) )
+			return SUCCESS;
+	return ERROR;
+}
+
+/**
+ * @brief  Reads PHY register
+ * @param  reg: Register
+ * @retval Value, 0 on a management bus timeout (no link, no abilities)
+ */
+static uint16_t EMAC_PhyRead( uint8_t reg )
+{
+	ETH->MACMIIAR = ( EMAC_PHY << 11 ) | ( (uint32_t)reg << 6 ) | EMAC_MiiClock | ETH_MACMIIAR_MB;
+	if ( EMAC_MiiWait() != SUCCESS )
+		return 0;
+	return (uint16_t)ETH->MACMIIDR;
+}
+
+/**
+ * @brief  Writes PHY register
+ * @param  reg: Register
+ * @param  value: Value
+ * @retval None
+ */
+static void EMAC_PhyWrite( uint8_t reg, uint16_t value )
+{
+	ETH->MACMIIDR = value;
+	ETH->MACMIIAR = ( EMAC_PHY << 11 ) | ( (uint32_t)reg << 6 ) | EMAC_MiiClock | ETH_MACMIIAR_MW | ETH_MACMIIAR_MB;
+	EMAC_MiiWait();
+}
+
+/**
+ * @brief  Gives the receive descriptor back to the DMA and resumes reception
+ *         if it stopped for want of buffers
+ * @param  d: Descriptor
+ * @retval None
+ */
+static void EMAC_RxGive( EMAC_Desc* d )
+{
+	d->Status = EMAC_RDES0_OWN;
+	if ( ETH->DMASR & ETH_DMASR_RBUS )
+	{
+		ETH->DMASR = ETH_DMASR_RBUS;
+		ETH->DMARPDR = 0;
+	}
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Configures the pins, the MAC with its DMA and the PHY, and starts
+ *         auto-negotiation (EMAC_Link reports its result)
+ * @param  mac: MAC address, 6 bytes
+ * @param  task: Task notified on each received or sent frame
+ * @retval ERROR if the DMA doesn't leave reset: no clocks from the PHY
+ */
+ErrorStatus EMAC_Init( const uint8_t* mac, xTaskHandle task )
+{
+	uint32_t n;
+
+	EMAC_Task = task;
+	ETH_GPIO_PORTS_INIT( ETH_GPIO_PORTS, ENABLE );
+	ETH_config_pins();
+
+	/* interface type is latched while the MAC is in reset */
+	RCC_APB2PeriphClockCmd( RCC_APB2Periph_SYSCFG, ENABLE );
+#ifdef RMII_MODE
+	SYSCFG_ETH_MediaInterfaceConfig( SYSCFG_ETH_MediaInterface_RMII );
+#else
+	SYSCFG_ETH_MediaInterfaceConfig( SYSCFG_ETH_MediaInterface_MII );
+#endif /* RMII_MODE */
+#ifdef PHY_CLOCK_MCO
+	RCC_MCO1Config( RCC_MCO1Source_HSE, RCC_MCO1Div_1 );		/* 25 MHz of HSE to the PHY */
+#endif /* PHY_CLOCK_MCO */
+	RCC_AHB1PeriphClockCmd( RCC_AHB1Periph_ETH_MAC | RCC_AHB1Periph_ETH_MAC_Tx | RCC_AHB1Periph_ETH_MAC_Rx, ENABLE );
+	RCC_AHB1PeriphResetCmd( RCC_AHB1Periph_ETH_MAC, ENABLE );
+	RCC_AHB1PeriphResetCmd( RCC_AHB1Periph_ETH_MAC, DISABLE );
+
+	ETH->DMABMR |= ETH_DMABMR_SR;
+	for ( n = 0; ETH->DMABMR & ETH_DMABMR_SR; ++n )
+		if ( n == EMAC_RESET_TIMEOUT )
+			return ERROR;
+
+	/* MDC up to 2.5 MHz */
+	if ( SystemCoreClock < 35000000 )
+		EMAC_MiiClock = ETH_MACMIIAR_CR_Div16;
+	else if ( SystemCoreClock < 60000000 )
+		EMAC_MiiClock = ETH_MACMIIAR_CR_Div26;
+	else if ( SystemCoreClock < 100000000 )
+		EMAC_MiiClock = ETH_MACMIIAR_CR_Div42;
+	else
+		EMAC_MiiClock = ETH_MACMIIAR_CR_Div62;
+
+	EMAC_PhyWrite( EMAC_PHY_BMCR, EMAC_BMCR_RESET );
+	for ( n = 0; n < EMAC_RESET_TIMEOUT && ( EMAC_PhyRead( EMAC_PHY_BMCR ) & EMAC_BMCR_RESET ); ++n ) ;
+	EMAC_PhyWrite( EMAC_PHY_BMCR, EMAC_BMCR_ANEN | EMAC_BMCR_ANRESTART );
+	EMAC_LinkUp = 0;
+
+	/* address filter passes frames to the address and broadcasts */
+	ETH->MACA0HR = ( (uint32_t)mac[ 5 ] << 8 ) | mac[ 4 ];
+	ETH->MACA0LR = ( (uint32_t)mac[ 3 ] << 24 ) | ( (uint32_t)mac[ 2 ] << 16 ) | ( (uint32_t)mac[ 1 ] << 8 ) | mac[ 0 ];
+	ETH->MACFFR = 0;
+	ETH->MACCR = ETH_MACCR_IPCO | ETH_MACCR_FES | ETH_MACCR_DM;
+
+	for ( n = 0; n < EMAC_TX_FRAMES; ++n )
+	{
+		EMAC_TxDesc[ n ].Status = ( n == EMAC_TX_FRAMES - 1 ) ? EMAC_TDES0_TER : 0;
+		EMAC_TxDesc[ n ].Size = 0;
+		EMAC_TxDesc[ n ].Buffer1 = (uint32_t)EMAC_TxSlots[ n ];
+		EMAC_TxDesc[ n ].Buffer2 = 0;
+		EMAC_TxTags[ n ] = EMAC_NO_TAG;
+	}
+	for ( n = 0; n < EMAC_RX_BUFFERS; ++n )
+	{
+		EMAC_RxDesc[ n ].Size = EMAC_RX_SIZE | ( ( n == EMAC_RX_BUFFERS - 1 ) ? EMAC_RDES1_RER : 0 );
+		EMAC_RxDesc[ n ].Buffer1 = (uint32_t)EMAC_RxBuffers[ n ];
+		EMAC_RxDesc[ n ].Buffer2 = 0;
+		EMAC_RxDesc[ n ].Status = EMAC_RDES0_OWN;
+	}
+	EMAC_TxNext = EMAC_RxNext = 0;
+
+	ETH->DMABMR = ETH_DMABMR_AAB | ETH_DMABMR_FB | ETH_DMABMR_USP | ETH_DMABMR_RDP_32Beat | ETH_DMABMR_PBL_32Beat;
+	ETH->DMATDLAR = (uint32_t)EMAC_TxDesc;
+	ETH->DMARDLAR = (uint32_t)EMAC_RxDesc;
+	ETH->DMAOMR = ETH_DMAOMR_RSF | ETH_DMAOMR_TSF | ETH_DMAOMR_OSF;
+	ETH->DMAIER = ETH_DMAIER_NISE | ETH_DMAIER_RIE | ETH_DMAIER_TIE;
+	IRQ_Enable( ETH_IRQn, IRQ_PRIO_ETH );
+
+	ETH->MACCR |= ETH_MACCR_TE;
+	ETH->DMAOMR |= ETH_DMAOMR_FTF;
+	while ( ETH->DMAOMR & ETH_DMAOMR_FTF ) ;
+	ETH->DMAOMR |= ETH_DMAOMR_ST;
+	ETH->MACCR |= ETH_MACCR_RE;
+	ETH->DMAOMR |= ETH_DMAOMR_SR;
+	return SUCCESS;
+}
+
+/**
+ * @brief  Polls the link, sets speed and duplex of the MAC when it comes up
+ * @param  None
+ * @retval Nonzero while the link is up and auto-negotiation is complete
+ */
+uint8_t EMAC_Link( void )
+{
+	uint16_t bmsr, common;
+	uint32_t maccr;
+
+	EMAC_PhyRead( EMAC_PHY_BMSR );			/* link status is latched low */
+	bmsr = EMAC_PhyRead( EMAC_PHY_BMSR );
+	if ( ( bmsr & ( EMAC_BMSR_LINK | EMAC_BMSR_ANDONE ) ) != ( EMAC_BMSR_LINK | EMAC_BMSR_ANDONE ) )
+	{
+		EMAC_LinkUp = 0;
+		return 0;
+	}
+	if ( !EMAC_LinkUp )
+	{
+		common = EMAC_PhyRead( EMAC_PHY_ANAR ) & EMAC_PhyRead( EMAC_PHY_ANLPAR );
+		maccr = ETH->MACCR & ~( ETH_MACCR_FES | ETH_MACCR_DM );
+		if ( common & EMAC_AN_100FD )
+			maccr |= ETH_MACCR_FES | ETH_MACCR_DM;
+		else if ( common & EMAC_AN_100HD )
+			maccr |= ETH_MACCR_FES;
+		else if ( common & EMAC_AN_10FD )
+			maccr |= ETH_MACCR_DM;
+		ETH->MACCR = maccr;
+		EMAC_LinkUp = 1;
+	}
+	return 1;
+}
+
+/**
+ * @brief  Gets the next intact received frame, it stays in its buffer until EMAC_Release
+ *         (frames cut by errors, not fitting a buffer or with a bad checksum are dropped)
+ * @param  frame: Receives the start of the frame (destination address)
+ * @retval Length of the frame without CRC, 0 if there is none
+ */
+uint32_t EMAC_Receive( uint8_t** frame )
+{
+	EMAC_Desc* d;
+	uint32_t s;
+
+	for ( ;; )
+	{
+		d = &EMAC_RxDesc[ EMAC_RxNext ];
+		s = d->Status;
+		if ( s & EMAC_RDES0_OWN )
+			return 0;
+		if ( ( s & ( EMAC_RDES0_FS | EMAC_RDES0_LS ) ) == ( EMAC_RDES0_FS | EMAC_RDES0_LS ) &&
+				!( s & EMAC_RDES0_ERRORS ) && EMAC_RDES0_FL( s ) > 4 &&
+				!( ( s & EMAC_RDES0_FT ) && ( s & ( EMAC_RDES0_IPHCE | EMAC_RDES0_PCE ) ) ) )
+		{
+			*frame = (uint8_t*)d->Buffer1;
+			return EMAC_RDES0_FL( s ) - 4;
+		}
+		EMAC_RxGive( d );
+		EMAC_RxNext = ( EMAC_RxNext + 1 ) % EMAC_RX_BUFFERS;
+	}
+}
+
+/**
+ * @brief  Returns the buffer of the frame got by EMAC_Receive to the DMA
+ * @param  None
+ * @retval None
+ */
+void EMAC_Release( void )
+{
+	EMAC_RxGive( &EMAC_RxDesc[ EMAC_RxNext ] );
+	EMAC_RxNext = ( EMAC_RxNext + 1 ) % EMAC_RX_BUFFERS;
+}
+
+/**
+ * @brief  Gets the header slot of the next transmit descriptor
+ * @param  None
+ * @retval Slot of EMAC_TX_SLOT bytes, NULL while all descriptors are being sent
+ */
+uint8_t* EMAC_TxSlot( void )
+{
+	if ( EMAC_TxDesc[ EMAC_TxNext ].Status & EMAC_TDES0_OWN )
+		return NULL;
+	return EMAC_TxSlots[ EMAC_TxNext ];
+}
+
+/**
+ * @brief  Sends the frame built in the slot got by EMAC_TxSlot
+ * @param  hlen: Number of bytes in the slot (headers, checksum fields zero)
+ * @param  data: Payload sent after them, unchanged until the frame is sent
+ * @param  dlen: Number of payload bytes, 0 if none
+ * @param  tag: Reported by EMAC_TxPending until the frame is sent, EMAC_NO_TAG if none
+ * @retval None
+ */
+void EMAC_Transmit( uint32_t hlen, const void* data, uint32_t dlen, uint32_t tag )
+{
+	EMAC_Desc* d = &EMAC_TxDesc[ EMAC_TxNext ];
+
+	EMAC_TxTags[ EMAC_TxNext ] = tag;
+	d->Size = EMAC_TDES1_SIZE( hlen, dlen );
+	d->Buffer2 = (uint32_t)data;
+	__DSB();
+	d->Status = EMAC_TDES0_OWN | EMAC_TDES0_IC | EMAC_TDES0_LS | EMAC_TDES0_FS | EMAC_TDES0_CIC_FULL |
+			( ( EMAC_TxNext == EMAC_TX_FRAMES - 1 ) ? EMAC_TDES0_TER : 0 );
+	EMAC_TxNext = ( EMAC_TxNext + 1 ) % EMAC_TX_FRAMES;
+
+	ETH->DMASR = ETH_DMASR_TBUS;			/* resume the DMA if it ran out of frames */
+	ETH->DMATPDR = 0;
+}
+
+/**
+ * @brief  Tells which frames are still being sent
+ * @param  tag: Receives the lowest tag of them, EMAC_NO_TAG if none
+ * @retval Number of frames still being sent
+ */
+uint32_t EMAC_TxPending( uint32_t* tag )
+{
+	uint32_t n, count = 0;
+
+	*tag = EMAC_NO_TAG;
+	for ( n = 0; n < EMAC_TX_FRAMES; ++n )
+	{
+		if ( !( EMAC_TxDesc[ n ].Status & EMAC_TDES0_OWN ) )
+			continue;
+		++count;
+		if ( EMAC_TxTags[ n ] < *tag )
+			*tag = EMAC_TxTags[ n ];
+	}
+	return count;
+}
+
+/**
+ * @brief  Handles Ethernet DMA interrupt: wakes the task on a received or sent frame
+ * @param  None
+ * @retval None
+ */
+void EMAC_IRQHandler( void )
+{
+	ETH->DMASR = ETH_DMASR_NIS | ETH_DMASR_RS | ETH_DMASR_TS;
+	IRQ_Notify( EMAC_Task );
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#endif /* USE_NET_FILE_SERVICE */
@@ -0,0 +1,94 @@
+/**
+ ******************************************************************************
+ * @file    stm32_eth.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Ethernet MAC with its DMA and the PHY (MII or RMII as selected in
+ *          main.h, pins in stm32_pins.h). Received frames are handed out in
+ *          place in the receive buffers and given back to the DMA by the
+ *          reader. Each frame to send takes one transmit descriptor with two
+ *          buffers: the headers are built in a small slot of the descriptor,
+ *          the payload is sent by the DMA from wherever it is (zero copy),
+ *          so it has to stay unchanged until the descriptor is done, which
+ *          EMAC_TxPending tells by the tags given to EMAC_Transmit.
+ *          IPv4 header and TCP/UDP/ICMP checksums are inserted and checked
+ *          by the MAC: the checksum fields of frames to send are left zero,
+ *          received frames with a bad checksum are dropped.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32_ETH_H
+#define STM32_ETH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f2xx.h"
+
+#include <stdint.h>
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Constants
+ * @{
+ */
+
+/**
+ * @brief  Transmit descriptors and size of the header slot of each of them
+ *         (Ethernet, IPv4 and TCP headers with options, or a small frame as a whole)
+ */
+#define EMAC_TX_FRAMES			8
+#define EMAC_TX_SLOT			128
+
+/**
+ * @brief  Size of each receive buffer, a whole frame with its CRC fits in one
+ */
+#define EMAC_RX_SIZE			1536
+
+/**
+ * @brief  Tag of frames whose payload doesn't have to be tracked
+ */
+#define EMAC_NO_TAG				0xFFFFFFFF
+
+/**
+ * @}
+ *//* STM32_Exported_Constants */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+ErrorStatus EMAC_Init( const uint8_t* mac, xTaskHandle task );
+uint8_t EMAC_Link( void );
+
+uint32_t EMAC_Receive( uint8_t** frame );
+void EMAC_Release( void );
+
+uint8_t* EMAC_TxSlot( void );
+void EMAC_Transmit( uint32_t hlen, const void* data, uint32_t dlen, uint32_t tag );
+uint32_t EMAC_TxPending( uint32_t* tag );
+
+void EMAC_IRQHandler( void );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32_ETH_H */
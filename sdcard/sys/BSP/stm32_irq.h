@@ -0,0 +1,155 @@
+/**
+ ******************************************************************************
+ * @file    stm32_irq.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Preemption priorities of all interrupts of the board in one table,
+ *          and completion helpers for handlers which wake up tasks.
+ *          All NVIC priority bits are preemption priority (NVIC_PriorityGroup_4
+ *          is set by main), 0 is the most urgent level. Handlers which call
+ *          FreeRTOS *FromISR functions must not be more urgent than
+ *          IRQ_PRIO_SYSCALL (configMAX_SYSCALL_INTERRUPT_PRIORITY): the kernel
+ *          masks only the levels from it on in its critical sections, a more
+ *          urgent handler entering the kernel corrupts its lists. Handlers do
+ *          the least work possible (clear the flags, note the status) and defer
+ *          the rest to the task they wake up.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32_IRQ_H
+#define STM32_IRQ_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "stm32f2xx.h"
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Constants
+ * @{
+ */
+
+/**
+ * @brief  The most urgent level which may call FreeRTOS API (11)
+ */
+#define IRQ_PRIO_SYSCALL		( configMAX_SYSCALL_INTERRUPT_PRIORITY >> ( 8 - __NVIC_PRIO_BITS ) )
+
+/**
+ * @brief  Preemption priorities of the interrupts, from the most urgent one on:
+ *         - PVD: supply falls below the threshold, the volumes have only the hold-up time
+ *           of the supply to be committed
+ *         - SD_DMA: SPI RX DMA streams and SDIO, each sector transfer of SD I/O task
+ *           waits for them, so they get the most urgent level allowed
+ *         - CAMERA: DCMI DMA stream, the next buffer has to be set before the DMA
+ *           fills the current one (a sector takes 40 us at 12 MHz pixel clock)
+ *         - SAMPLER: ADC DMA stream, a block of samples takes milliseconds, the
+ *           next buffer has to be set before it is filled
+ *         - USB: OTG FS, the CPU moves each packet through the FIFOs, a bulk
+ *           packet takes 43 us on the bus
+ *         - ETH: Ethernet DMA, only wakes the network task, the receive ring
+ *           holds a millisecond of full size frames
+ *         - COM_DMA: TX DMA streams of COM ports (file service)
+ *         - COM: COM port RX/TX, a byte takes 3.3 us even at 3 Mbaud
+ *         - EXTI: buttons and card detect (EXTI15_10 serves both), human scale
+ *         - RTC: calendar wakeup once a second, only packs the FAT timestamp
+ *         - KERNEL: SysTick and PendSV, set by the port (configKERNEL_INTERRUPT_PRIORITY)
+ */
+#define IRQ_PRIO_PVD			11
+#define IRQ_PRIO_SD_DMA			11
+#define IRQ_PRIO_CAMERA			11
+#define IRQ_PRIO_SAMPLER		12
+#define IRQ_PRIO_USB			12
+#define IRQ_PRIO_ETH			12
+#define IRQ_PRIO_COM_DMA		13
+#define IRQ_PRIO_COM			14
+#define IRQ_PRIO_EXTI			15
+#define IRQ_PRIO_RTC			15
+#define IRQ_PRIO_KERNEL			( configKERNEL_INTERRUPT_PRIORITY >> ( 8 - __NVIC_PRIO_BITS ) )
+
+#if IRQ_PRIO_PVD < IRQ_PRIO_SYSCALL || IRQ_PRIO_SD_DMA < IRQ_PRIO_SYSCALL || IRQ_PRIO_CAMERA < IRQ_PRIO_SYSCALL || IRQ_PRIO_SAMPLER < IRQ_PRIO_SYSCALL || \
+	IRQ_PRIO_USB < IRQ_PRIO_SYSCALL || IRQ_PRIO_ETH < IRQ_PRIO_SYSCALL || IRQ_PRIO_COM_DMA < IRQ_PRIO_SYSCALL || IRQ_PRIO_COM < IRQ_PRIO_SYSCALL || IRQ_PRIO_EXTI < IRQ_PRIO_SYSCALL
+#error Interrupts calling FreeRTOS API must not be more urgent than configMAX_SYSCALL_INTERRUPT_PRIORITY!
+#endif
+
+/**
+ * @}
+ *//* STM32_Exported_Constants */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+/**
+ * @brief  Sets preemption priority of the interrupt and enables it
+ * @param  irq: Interrupt
+ * @param  prio: One of IRQ_PRIO_*
+ * @retval None
+ */
+static __INLINE void IRQ_Enable( IRQn_Type irq, uint8_t prio )
+{
+	NVIC_InitTypeDef NVIC_InitStructure;
+
+	assert_param( prio >= IRQ_PRIO_SYSCALL );
+	NVIC_InitStructure.NVIC_IRQChannel = irq;
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = prio;
+	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_Init( &NVIC_InitStructure );
+}
+
+/**
+ * @brief  Wakes up the task waiting for completion from an interrupt handler: the
+ *         semaphore is given and, if the task is more urgent than the one interrupted,
+ *         the context switch is done as soon as the handler returns (it may go on)
+ * @param  sem: Binary semaphore the task waits on
+ * @retval None
+ */
+static __INLINE void IRQ_Complete( xSemaphoreHandle sem )
+{
+	portBASE_TYPE woken = pdFALSE;
+
+	xSemaphoreGiveFromISR( sem, &woken );
+	portYIELD_FROM_ISR( woken );
+}
+
+/**
+ * @brief  Wakes up the task waiting in ulTaskNotifyTake from an interrupt handler,
+ *         cheaper than IRQ_Complete: there is no semaphore (queue) in between.
+ *         The task must check the completion status after it wakes up, a late
+ *         notification of an earlier transfer (after its timeout) is still counted.
+ * @param  task: Task to notify
+ * @retval None
+ */
+static __INLINE void IRQ_Notify( xTaskHandle task )
+{
+	signed portBASE_TYPE woken = pdFALSE;
+
+	vTaskNotifyGiveFromISR( task, &woken );
+	portYIELD_FROM_ISR( woken );
+}
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32_IRQ_H */
@@ -0,0 +1,83 @@
+/**
+ ******************************************************************************
+ * @file    stm32_mem.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Placement of buffers and code in memory regions (sections of stm32_flash.ld).
+ *          SRAM1 (112K) holds data, DMA buffers and file system caches, SRAM2
+ *          (16K) is a separate slave of the bus matrix which is accessed by CPU
+ *          only, so task stacks placed there never wait for DMA streams.
+ *          External SRAM on FSMC is usable only after FSMC is configured.
+ *          These sections are not cleared by startup code: buffers placed
+ *          there must not rely on zero initialization.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32_MEM_H
+#define STM32_MEM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Macros
+ * @{
+ */
+
+#ifdef __GNUC__
+/**
+ * @brief  Buffer accessed by DMA streams (SPI, SDIO): aligned for 4-word FIFO bursts
+ */
+#define MEM_DMA_BUFFER			__attribute__(( section( ".dma_buffers" ), aligned( 16 ) ))
+
+/**
+ * @brief  Sector cache of file system
+ */
+#define MEM_FS_CACHE			__attribute__(( section( ".fs_cache" ), aligned( 4 ) ))
+
+/**
+ * @brief  Task stacks (FreeRTOS heap) in SRAM2
+ */
+#define MEM_FAST_STACK			__attribute__(( section( ".fast_stacks" ), aligned( 8 ) ))
+
+/**
+ * @brief  Large buffer in external SRAM on FSMC
+ */
+#define MEM_EXT_SRAM			__attribute__(( section( ".ext_sram" ), aligned( 4 ) ))
+
+/**
+ * @brief  Function executed from SRAM1 with USE_RAM_FUNC: no FLASH wait states for its code.
+ *         It is called by an absolute address (SRAM is out of BL range of FLASH), so it
+ *         should be a leaf loop: its own calls to FLASH go through linker veneers.
+ */
+#ifdef USE_RAM_FUNC
+#define MEM_RAM_FUNC			__attribute__(( section( ".ramfunc" ), long_call, noinline ))
+#else
+#define MEM_RAM_FUNC
+#endif /* USE_RAM_FUNC */
+#else
+#define MEM_DMA_BUFFER
+#define MEM_FS_CACHE
+#define MEM_FAST_STACK
+#define MEM_EXT_SRAM
+#define MEM_RAM_FUNC
+#endif /* __GNUC__ */
+
+/**
+ * @}
+ *//* STM32_Exported_Macros */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32_MEM_H */
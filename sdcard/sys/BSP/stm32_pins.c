@@ -143,6 +143,14 @@ void ETH_config_pins( void )
 	GPIO_PinAFConfig( GPIOG, GPIO_PinSource11, GPIO_AF_ETH );
 	GPIO_PinAFConfig( GPIOG, GPIO_PinSource13, GPIO_AF_ETH );
 	GPIO_PinAFConfig( GPIOG, GPIO_PinSource14, GPIO_AF_ETH );
+
+#ifdef PHY_CLOCK_MCO
+	/* Configure PA8: MCO1 clocks the PHY (it is TOUCH_PEN otherwise) */
+	GPIO_InitStructure.GPIO_Pin =
+		GPIO_Pin_8;
+	GPIO_Init( GPIOA, &GPIO_InitStructure );
+	GPIO_PinAFConfig( GPIOA, GPIO_PinSource8, GPIO_AF_MCO );
+#endif /* PHY_CLOCK_MCO */
 }
 
 void SRAM_config_pins( void )
@@ -161,7 +169,8 @@ void SRAM_config_pins( void )
  | PD10 <-> FSMC_D15 | PE12 <-> FSMC_D9   | PF13 <-> FSMC_A7 |------------------+
  | PD11 <-> FSMC_A16 | PE13 <-> FSMC_D10  | PF14 <-> FSMC_A8 |
  | PD12 <-> FSMC_A17 | PE14 <-> FSMC_D11  | PF15 <-> FSMC_A9 |
- | PD14 <-> FSMC_D0  | PE15 <-> FSMC_D12  |------------------+
+ | PD13 <-> FSMC_A18 | PE15 <-> FSMC_D12  |------------------+
+ | PD14 <-> FSMC_D0  | PE3  <-> FSMC_A19  |
  | PD15 <-> FSMC_D1	 |--------------------+
  +-------------------+
 */
@@ -176,7 +185,8 @@ void SRAM_config_pins( void )
 	GPIO_InitStructure.GPIO_Pin =
 		GPIO_Pin_0  | GPIO_Pin_1  | GPIO_Pin_4  | GPIO_Pin_5  |
 		GPIO_Pin_7  | GPIO_Pin_8  | GPIO_Pin_9  | GPIO_Pin_10 |
-		GPIO_Pin_11 | GPIO_Pin_12 | GPIO_Pin_14 | GPIO_Pin_15;
+		GPIO_Pin_11 | GPIO_Pin_12 | GPIO_Pin_13 | GPIO_Pin_14 |
+		GPIO_Pin_15;
 	GPIO_Init( GPIOD, &GPIO_InitStructure );
 	GPIO_PinAFConfig( GPIOD, GPIO_PinSource0 , GPIO_AF_FSMC );
 	GPIO_PinAFConfig( GPIOD, GPIO_PinSource1 , GPIO_AF_FSMC );
@@ -188,17 +198,19 @@ void SRAM_config_pins( void )
 	GPIO_PinAFConfig( GPIOD, GPIO_PinSource10, GPIO_AF_FSMC );
 	GPIO_PinAFConfig( GPIOD, GPIO_PinSource11, GPIO_AF_FSMC );
 	GPIO_PinAFConfig( GPIOD, GPIO_PinSource12, GPIO_AF_FSMC );
+	GPIO_PinAFConfig( GPIOD, GPIO_PinSource13, GPIO_AF_FSMC );
 	GPIO_PinAFConfig( GPIOD, GPIO_PinSource14, GPIO_AF_FSMC );
 	GPIO_PinAFConfig( GPIOD, GPIO_PinSource15, GPIO_AF_FSMC );
 
 	/* GPIOE configuration */
 	GPIO_InitStructure.GPIO_Pin =
-		GPIO_Pin_0  | GPIO_Pin_1  | GPIO_Pin_7 |
+		GPIO_Pin_0  | GPIO_Pin_1  | GPIO_Pin_3  | GPIO_Pin_7 |
 		GPIO_Pin_8  | GPIO_Pin_9  | GPIO_Pin_10 | GPIO_Pin_11 |
 		GPIO_Pin_12 | GPIO_Pin_13 | GPIO_Pin_14 | GPIO_Pin_15;
 	GPIO_Init( GPIOE, &GPIO_InitStructure );
 	GPIO_PinAFConfig( GPIOE, GPIO_PinSource0 , GPIO_AF_FSMC );
 	GPIO_PinAFConfig( GPIOE, GPIO_PinSource1 , GPIO_AF_FSMC );
+	GPIO_PinAFConfig( GPIOE, GPIO_PinSource3 , GPIO_AF_FSMC );
 	GPIO_PinAFConfig( GPIOE, GPIO_PinSource7 , GPIO_AF_FSMC );
 	GPIO_PinAFConfig( GPIOE, GPIO_PinSource8 , GPIO_AF_FSMC );
 	GPIO_PinAFConfig( GPIOE, GPIO_PinSource9 , GPIO_AF_FSMC );
@@ -251,7 +263,8 @@ void SRAM_unconfig_pins( void )
 	GPIO_InitStructure.GPIO_Pin =
 		GPIO_Pin_0  | GPIO_Pin_1  | GPIO_Pin_4  | GPIO_Pin_5  |
 		GPIO_Pin_7  | GPIO_Pin_8  | GPIO_Pin_9  | GPIO_Pin_10 |
-		GPIO_Pin_11 | GPIO_Pin_12 | GPIO_Pin_14 | GPIO_Pin_15;
+		GPIO_Pin_11 | GPIO_Pin_12 | GPIO_Pin_13 | GPIO_Pin_14 |
+		GPIO_Pin_15;
 	GPIO_Init( GPIOD, &GPIO_InitStructure );
 	GPIO_PinAFConfig( GPIOD, GPIO_PinSource0 , GPIO_AF_MCO );
 	GPIO_PinAFConfig( GPIOD, GPIO_PinSource1 , GPIO_AF_MCO );
@@ -263,17 +276,19 @@ void SRAM_unconfig_pins( void )
 	GPIO_PinAFConfig( GPIOD, GPIO_PinSource10, GPIO_AF_MCO );
 	GPIO_PinAFConfig( GPIOD, GPIO_PinSource11, GPIO_AF_MCO );
 	GPIO_PinAFConfig( GPIOD, GPIO_PinSource12, GPIO_AF_MCO );
+	GPIO_PinAFConfig( GPIOD, GPIO_PinSource13, GPIO_AF_MCO );
 	GPIO_PinAFConfig( GPIOD, GPIO_PinSource14, GPIO_AF_MCO );
 	GPIO_PinAFConfig( GPIOD, GPIO_PinSource15, GPIO_AF_MCO );
 
 	/* GPIOE configuration */
 	GPIO_InitStructure.GPIO_Pin =
-		GPIO_Pin_0  | GPIO_Pin_1  | GPIO_Pin_7  | GPIO_Pin_8  |
-		GPIO_Pin_9  | GPIO_Pin_10 | GPIO_Pin_11 | GPIO_Pin_12 |
-		GPIO_Pin_13 | GPIO_Pin_14 | GPIO_Pin_15;
+		GPIO_Pin_0  | GPIO_Pin_1  | GPIO_Pin_3  | GPIO_Pin_7  |
+		GPIO_Pin_8  | GPIO_Pin_9  | GPIO_Pin_10 | GPIO_Pin_11 |
+		GPIO_Pin_12 | GPIO_Pin_13 | GPIO_Pin_14 | GPIO_Pin_15;
 	GPIO_Init( GPIOE, &GPIO_InitStructure );
 	GPIO_PinAFConfig( GPIOE, GPIO_PinSource0 , GPIO_AF_MCO );
 	GPIO_PinAFConfig( GPIOE, GPIO_PinSource1 , GPIO_AF_MCO );
+	GPIO_PinAFConfig( GPIOE, GPIO_PinSource3 , GPIO_AF_MCO );
 	GPIO_PinAFConfig( GPIOE, GPIO_PinSource7 , GPIO_AF_MCO );
 	GPIO_PinAFConfig( GPIOE, GPIO_PinSource8 , GPIO_AF_MCO );
 	GPIO_PinAFConfig( GPIOE, GPIO_PinSource9 , GPIO_AF_MCO );
@@ -315,6 +330,93 @@ void SRAM_unconfig_pins( void )
 	GPIO_PinAFConfig( GPIOG, GPIO_PinSource9 , GPIO_AF_MCO );
 }
 
+void DCMI_config_pins( void )
+{
+/*
+   DCMI_HSYNC -----------------------> PA4
+   DCMI_PIXCLK ----------------------> PA6
+   DCMI_VSYNC -----------------------> PB7
+   DCMI_D0 --------------------------> PC6
+   DCMI_D1 --------------------------> PC7
+   DCMI_D2 --------------------------> PC8
+   DCMI_D3 --------------------------> PC9
+   DCMI_D4 --------------------------> PC11
+   DCMI_D5 --------------------------> PB6
+   DCMI_D6 --------------------------> PE5
+   DCMI_D7 --------------------------> PE6
+ */
+	GPIO_InitTypeDef GPIO_InitStructure;
+
+	GPIO_InitStructure.GPIO_Speed = GPIO_Speed_100MHz;
+	GPIO_InitStructure.GPIO_Mode  = GPIO_Mode_AF;
+	GPIO_InitStructure.GPIO_OType = GPIO_OType_PP;
+	GPIO_InitStructure.GPIO_PuPd  = GPIO_PuPd_UP;
+
+	/* GPIOA configuration */
+	GPIO_InitStructure.GPIO_Pin = GPIO_Pin_4 | GPIO_Pin_6;
+	GPIO_Init( GPIOA, &GPIO_InitStructure );
+	GPIO_PinAFConfig( GPIOA, GPIO_PinSource4 , GPIO_AF_DCMI );
+	GPIO_PinAFConfig( GPIOA, GPIO_PinSource6 , GPIO_AF_DCMI );
+
+	/* GPIOB configuration */
+	GPIO_InitStructure.GPIO_Pin = GPIO_Pin_6 | GPIO_Pin_7;
+	GPIO_Init( GPIOB, &GPIO_InitStructure );
+	GPIO_PinAFConfig( GPIOB, GPIO_PinSource6 , GPIO_AF_DCMI );
+	GPIO_PinAFConfig( GPIOB, GPIO_PinSource7 , GPIO_AF_DCMI );
+
+	/* GPIOC configuration */
+	GPIO_InitStructure.GPIO_Pin =
+		GPIO_Pin_6 | GPIO_Pin_7 | GPIO_Pin_8 | GPIO_Pin_9 |
+		GPIO_Pin_11;
+	GPIO_Init( GPIOC, &GPIO_InitStructure );
+	GPIO_PinAFConfig( GPIOC, GPIO_PinSource6 , GPIO_AF_DCMI );
+	GPIO_PinAFConfig( GPIOC, GPIO_PinSource7 , GPIO_AF_DCMI );
+	GPIO_PinAFConfig( GPIOC, GPIO_PinSource8 , GPIO_AF_DCMI );
+	GPIO_PinAFConfig( GPIOC, GPIO_PinSource9 , GPIO_AF_DCMI );
+	GPIO_PinAFConfig( GPIOC, GPIO_PinSource11, GPIO_AF_DCMI );
+
+	/* GPIOE configuration */
+	GPIO_InitStructure.GPIO_Pin = GPIO_Pin_5 | GPIO_Pin_6;
+	GPIO_Init( GPIOE, &GPIO_InitStructure );
+	GPIO_PinAFConfig( GPIOE, GPIO_PinSource5 , GPIO_AF_DCMI );
+	GPIO_PinAFConfig( GPIOE, GPIO_PinSource6 , GPIO_AF_DCMI );
+}
+
+void ADC_config_pins( void )
+{
+/*
+   ADC3_IN4 -------------------------> PF6
+   ADC3_IN5 -------------------------> PF7
+   ADC3_IN6 -------------------------> PF8
+   ADC3_IN7 -------------------------> PF9
+   ADC3_IN8 -------------------------> PF10
+ */
+	GPIO_InitTypeDef GPIO_InitStructure;
+
+	GPIO_InitStructure.GPIO_Pin  = SAMPLER_GPIO_PINS;
+	GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AN;
+	GPIO_InitStructure.GPIO_PuPd = GPIO_PuPd_NOPULL;
+	GPIO_Init( SAMPLER_GPIO_PORT, &GPIO_InitStructure );
+}
+
+void USB_config_pins( void )
+{
+/*
+   OTG_FS_DM ------------------------> PA11
+   OTG_FS_DP ------------------------> PA12
+ */
+	GPIO_InitTypeDef GPIO_InitStructure;
+
+	GPIO_InitStructure.GPIO_Pin   = GPIO_Pin_11 | GPIO_Pin_12;
+	GPIO_InitStructure.GPIO_Speed = GPIO_Speed_100MHz;
+	GPIO_InitStructure.GPIO_Mode  = GPIO_Mode_AF;
+	GPIO_InitStructure.GPIO_OType = GPIO_OType_PP;
+	GPIO_InitStructure.GPIO_PuPd  = GPIO_PuPd_NOPULL;
+	GPIO_Init( GPIOA, &GPIO_InitStructure );
+	GPIO_PinAFConfig( GPIOA, GPIO_PinSource11, GPIO_AF_OTG_FS );
+	GPIO_PinAFConfig( GPIOA, GPIO_PinSource12, GPIO_AF_OTG_FS );
+}
+
 /**
  * @}
  *//* STM32_Public_Functions */
@@ -62,15 +62,15 @@ extern "C" {
  * @{
  */
 
-#define COMn                             1
+#define COMn                             2
 #define COM_GPIO_CLK_INIT                RCC_AHB1PeriphClockCmd
-#define COM_RxTx_GPIO_CLK_INIT           RCC_APB1PeriphClockCmd
 
 /**
  * @brief Definition for COM port 1, connected to UART5
  */
 #define EVAL_COM1                        UART5
 #define EVAL_COM1_CLK                    RCC_APB1Periph_UART5
+#define EVAL_COM1_CLK_INIT               RCC_APB1PeriphClockCmd
 #define EVAL_COM1_TX_PIN                 GPIO_Pin_12
 #define EVAL_COM1_TX_GPIO_PORT           GPIOC
 #define EVAL_COM1_TX_GPIO_CLK            RCC_AHB1Periph_GPIOC
@@ -82,6 +82,48 @@ extern "C" {
 #define EVAL_COM1_RX_SOURCE              GPIO_PinSource2
 #define EVAL_COM1_RX_AF                  GPIO_AF_UART5
 #define EVAL_COM1_IRQn                   UART5_IRQn
+#define EVAL_COM1_IRQHandler             UART5_IRQHandler	/* priorities of all interrupts are in stm32_irq.h */
+
+/**
+ * @brief Definition for COM port 2, connected to USART1 (on APB2: up to PCLK2 / 8 = 7.5 Mbaud)
+ */
+#define EVAL_COM2                        USART1
+#define EVAL_COM2_CLK                    RCC_APB2Periph_USART1
+#define EVAL_COM2_CLK_INIT               RCC_APB2PeriphClockCmd
+#define EVAL_COM2_TX_PIN                 GPIO_Pin_9
+#define EVAL_COM2_TX_GPIO_PORT           GPIOA
+#define EVAL_COM2_TX_GPIO_CLK            RCC_AHB1Periph_GPIOA
+#define EVAL_COM2_TX_SOURCE              GPIO_PinSource9
+#define EVAL_COM2_TX_AF                  GPIO_AF_USART1
+#define EVAL_COM2_RX_PIN                 GPIO_Pin_10
+#define EVAL_COM2_RX_GPIO_PORT           GPIOA
+#define EVAL_COM2_RX_GPIO_CLK            RCC_AHB1Periph_GPIOA
+#define EVAL_COM2_RX_SOURCE              GPIO_PinSource10
+#define EVAL_COM2_RX_AF                  GPIO_AF_USART1
+#define EVAL_COM2_IRQn                   USART1_IRQn
+#define EVAL_COM2_IRQHandler             USART1_IRQHandler
+
+/**
+ * @brief COM ports TX DMA streams (UART5_TX is on DMA1 Stream7, USART1_TX is on DMA2 Stream7, both channel 4),
+ *        used by the file service (sys/FAT/ffserv.c)
+ */
+#define EVAL_COM1_DMA_CLK                RCC_AHB1Periph_DMA1
+#define EVAL_COM1_DMA_CHANNEL            DMA_Channel_4
+#define EVAL_COM1_DMA_STREAM_TX          DMA1_Stream7
+#define EVAL_COM1_DMA_TX_IRQn            DMA1_Stream7_IRQn
+#define EVAL_COM1_DMA_TX_IRQHandler      DMA1_Stream7_IRQHandler
+#define EVAL_COM2_DMA_CLK                RCC_AHB1Periph_DMA2
+#define EVAL_COM2_DMA_CHANNEL            DMA_Channel_4
+#define EVAL_COM2_DMA_STREAM_TX          DMA2_Stream7
+#define EVAL_COM2_DMA_TX_IRQn            DMA2_Stream7_IRQn
+#define EVAL_COM2_DMA_TX_IRQHandler      DMA2_Stream7_IRQHandler
+
+#define EVAL_COM_TX_DMA_FLAG_FEIF        DMA_FLAG_FEIF7
+#define EVAL_COM_TX_DMA_FLAG_DMEIF       DMA_FLAG_DMEIF7
+#define EVAL_COM_TX_DMA_FLAG_TEIF        DMA_FLAG_TEIF7
+#define EVAL_COM_TX_DMA_FLAG_HTIF        DMA_FLAG_HTIF7
+#define EVAL_COM_TX_DMA_FLAG_TCIF        DMA_FLAG_TCIF7
+#define EVAL_COM_TX_DMA_IT_TCIF          DMA_IT_TCIF7
 
 /**
  * @}
@@ -193,6 +235,20 @@ extern "C" {
 #define SD_DETECT_PIN                   GPIO_Pin_12
 #define SD_DETECT_GPIO_CLK              RCC_AHB1Periph_GPIOB
 #define SD_DETECT_GPIO_CLK_INIT         RCC_AHB1PeriphClockCmd
+#define SD_DETECT_EXTI_LINE             EXTI_Line12
+#define SD_DETECT_EXTI_PORT_SOURCE      EXTI_PortSourceGPIOB
+#define SD_DETECT_EXTI_PIN_SOURCE       EXTI_PinSource12
+#define SD_DETECT_EXTI_IRQn             EXTI15_10_IRQn
+
+/**
+ * @brief Second SD Card (USE_SD_CARD2) on its own SPIy bus: Chip Select and presence detection pins
+ */
+#define SD2_CS_GPIO_PORT                GPIOB
+#define SD2_CS_PIN                      GPIO_Pin_7
+#define SD2_CS_GPIO_CLK                 RCC_AHB1Periph_GPIOB
+#define SD2_DETECT_GPIO_PORT            GPIOB
+#define SD2_DETECT_PIN                  GPIO_Pin_8
+#define SD2_DETECT_GPIO_CLK             RCC_AHB1Periph_GPIOB
 
 /**
  * @}
@@ -232,55 +288,133 @@ extern "C" {
 #define SPIx_SPI_MOSI_SOURCE            GPIO_PinSource15
 #define SPIx_SPI_MOSI_AF                GPIO_AF_SPI2
 
+/**
+ * @brief SPI DMA streams (SPI2_RX is on DMA1 Stream3, SPI2_TX is on DMA1 Stream4, both channel 0)
+ */
+#define SPIx_SPI_DR_ADDRESS             ((uint32_t)&( SPI2->DR ))
+
+#define SPIx_SPI_DMA                    DMA1
+#define SPIx_SPI_DMA_CLK                RCC_AHB1Periph_DMA1
+#define SPIx_SPI_DMA_CLK_INIT           RCC_AHB1PeriphClockCmd
+#define SPIx_SPI_DMA_CHANNEL            DMA_Channel_0
+#define SPIx_SPI_DMA_STREAM_RX          DMA1_Stream3
+#define SPIx_SPI_DMA_STREAM_TX          DMA1_Stream4
+
+#define SPIx_SPI_DMA_RX_IRQn            DMA1_Stream3_IRQn
+#define SPIx_SPI_DMA_RX_IRQHandler      DMA1_Stream3_IRQHandler
+
+#define SPIx_RX_DMA_FLAG_FEIF           DMA_FLAG_FEIF3
+#define SPIx_RX_DMA_FLAG_DMEIF          DMA_FLAG_DMEIF3
+#define SPIx_RX_DMA_FLAG_TEIF           DMA_FLAG_TEIF3
+#define SPIx_RX_DMA_FLAG_HTIF           DMA_FLAG_HTIF3
+#define SPIx_RX_DMA_FLAG_TCIF           DMA_FLAG_TCIF3
+#define SPIx_TX_DMA_FLAG_FEIF           DMA_FLAG_FEIF4
+#define SPIx_TX_DMA_FLAG_DMEIF          DMA_FLAG_DMEIF4
+#define SPIx_TX_DMA_FLAG_TEIF           DMA_FLAG_TEIF4
+#define SPIx_TX_DMA_FLAG_HTIF           DMA_FLAG_HTIF4
+#define SPIx_TX_DMA_FLAG_TCIF           DMA_FLAG_TCIF4
+
+/**
+ * @brief Second SPI interface for the second SD Card (USE_SD_CARD2): SPI1 on PB3/PB4/PB5,
+ *        JTAG pins JTDO and NJTRST are lost, SWD debugging is still available
+ */
+#define SPIy_SPI                        SPI1
+#define SPIy_SPI_CLK                    RCC_APB2Periph_SPI1
+#define SPIy_SPI_CLK_INIT               RCC_APB2PeriphClockCmd
+
+#define SPIy_SPI_SCLK_GPIO_PORT         GPIOB		/* MISO and MOSI are on the same port */
+#define SPIy_SPI_SCLK_GPIO_CLK          RCC_AHB1Periph_GPIOB
+#define SPIy_SPI_SCLK_SOURCE            GPIO_PinSource3
+#define SPIy_SPI_MISO_SOURCE            GPIO_PinSource4
+#define SPIy_SPI_MOSI_SOURCE            GPIO_PinSource5
+#define SPIy_SPI_SCLK_AF                GPIO_AF_SPI1
+
+/**
+ * @brief Second SPI DMA streams (SPI1_RX is on DMA2 Stream2, SPI1_TX is on DMA2 Stream5, both channel 3;
+ *        DMA2 Stream3 is left to SDIO)
+ */
+#define SPIy_SPI_DMA_CLK                RCC_AHB1Periph_DMA2
+#define SPIy_SPI_DMA_CHANNEL            DMA_Channel_3
+#define SPIy_SPI_DMA_STREAM_RX          DMA2_Stream2
+#define SPIy_SPI_DMA_STREAM_TX          DMA2_Stream5
+
+#define SPIy_SPI_DMA_RX_IRQn            DMA2_Stream2_IRQn
+#define SPIy_SPI_DMA_RX_IRQHandler      DMA2_Stream2_IRQHandler
+
+#define SPIy_RX_DMA_FLAG_FEIF           DMA_FLAG_FEIF2
+#define SPIy_RX_DMA_FLAG_DMEIF          DMA_FLAG_DMEIF2
+#define SPIy_RX_DMA_FLAG_TEIF           DMA_FLAG_TEIF2
+#define SPIy_RX_DMA_FLAG_HTIF           DMA_FLAG_HTIF2
+#define SPIy_RX_DMA_FLAG_TCIF           DMA_FLAG_TCIF2
+#define SPIy_TX_DMA_FLAG_FEIF           DMA_FLAG_FEIF5
+#define SPIy_TX_DMA_FLAG_DMEIF          DMA_FLAG_DMEIF5
+#define SPIy_TX_DMA_FLAG_TEIF           DMA_FLAG_TEIF5
+#define SPIy_TX_DMA_FLAG_HTIF           DMA_FLAG_HTIF5
+#define SPIy_TX_DMA_FLAG_TCIF           DMA_FLAG_TCIF5
+
 /**
  * @}
  *//* STM32_SPI */
 
-///** @addtogroup STM32_SD_FLASH
-// * @{
-// */
-//
-//#define SDIO_FIFO_ADDRESS                ((uint32_t)0x40012C80)
-///**
-// * @brief  SDIO Initialization Frequency (400KHz max)
-// */
-//#define SDIO_INIT_CLK_DIV                0x76
-///**
-// * @brief  SDIO Data Transfer Frequency (25MHz max)
-// */
-//#define SDIO_TRANSFER_CLK_DIV            0x00
-//
-//#define SD_SDIO_DMA                   DMA2
-//#define SD_SDIO_DMA_CLK               RCC_AHB1Periph_DMA2
-//
-//#define SD_SDIO_DMA_STREAM3	          3
-////#define SD_SDIO_DMA_STREAM6           6
-//
-//#ifdef SD_SDIO_DMA_STREAM3
-// #define SD_SDIO_DMA_STREAM            DMA2_Stream3
-// #define SD_SDIO_DMA_CHANNEL           DMA_Channel_4
-// #define SD_SDIO_DMA_FLAG_FEIF         DMA_FLAG_FEIF3
-// #define SD_SDIO_DMA_FLAG_DMEIF        DMA_FLAG_DMEIF3
-// #define SD_SDIO_DMA_FLAG_TEIF         DMA_FLAG_TEIF3
-// #define SD_SDIO_DMA_FLAG_HTIF         DMA_FLAG_HTIF3
-// #define SD_SDIO_DMA_FLAG_TCIF         DMA_FLAG_TCIF3
-// #define SD_SDIO_DMA_IRQn              DMA2_Stream3_IRQn
-// #define SD_SDIO_DMA_IRQHANDLER        DMA2_Stream3_IRQHandler
-//#elif defined SD_SDIO_DMA_STREAM6
-// #define SD_SDIO_DMA_STREAM            DMA2_Stream6
-// #define SD_SDIO_DMA_CHANNEL           DMA_Channel_4
-// #define SD_SDIO_DMA_FLAG_FEIF         DMA_FLAG_FEIF6
-// #define SD_SDIO_DMA_FLAG_DMEIF        DMA_FLAG_DMEIF6
-// #define SD_SDIO_DMA_FLAG_TEIF         DMA_FLAG_TEIF6
-// #define SD_SDIO_DMA_FLAG_HTIF         DMA_FLAG_HTIF6
-// #define SD_SDIO_DMA_FLAG_TCIF         DMA_FLAG_TCIF6
-// #define SD_SDIO_DMA_IRQn              DMA2_Stream6_IRQn
-// #define SD_SDIO_DMA_IRQHANDLER        DMA2_Stream6_IRQHandler
-//#endif /* SD_SDIO_DMA_STREAM3 */
-//
-///**
-// * @}
-// *//* STM32_SD_FLASH */
+/** @addtogroup STM32_SD_SDIO
+ * @{
+ */
+
+/**
+ * @brief  SD Card SDIO Interface pins (4-bit bus)
+ *         Beware: CK (PC12) and CMD (PD2) pins are shared with COM1 (UART5)
+ */
+#define SD_SDIO_D0_PIN                   GPIO_Pin_8                  /* PC8 */
+#define SD_SDIO_D1_PIN                   GPIO_Pin_9                  /* PC9 */
+#define SD_SDIO_D2_PIN                   GPIO_Pin_10                 /* PC10 */
+#define SD_SDIO_D3_PIN                   GPIO_Pin_11                 /* PC11 */
+#define SD_SDIO_CK_PIN                   GPIO_Pin_12                 /* PC12 */
+#define SD_SDIO_DATA_GPIO_PORT           GPIOC
+#define SD_SDIO_DATA_GPIO_CLK            RCC_AHB1Periph_GPIOC
+#define SD_SDIO_CMD_PIN                  GPIO_Pin_2                  /* PD2 */
+#define SD_SDIO_CMD_GPIO_PORT            GPIOD
+#define SD_SDIO_CMD_GPIO_CLK             RCC_AHB1Periph_GPIOD
+#define SD_SDIO_GPIO_CLK_INIT            RCC_AHB1PeriphClockCmd
+
+#define SDIO_FIFO_ADDRESS                ((uint32_t)0x40012C80)
+/**
+ * @brief  SDIO Initialization Frequency (400KHz max): 48MHz / (0x76 + 2) = 400KHz
+ */
+#define SDIO_INIT_CLK_DIV                0x76
+/**
+ * @brief  SDIO Data Transfer Frequency (25MHz max): 48MHz / (0 + 2) = 24MHz
+ *         (48MHz with bypassed divider once card is switched to High Speed mode)
+ */
+#define SDIO_TRANSFER_CLK_DIV            0x00
+
+#define SD_SDIO_DMA                      DMA2
+#define SD_SDIO_DMA_CLK                  RCC_AHB1Periph_DMA2
+#define SD_SDIO_DMA_CLK_INIT             RCC_AHB1PeriphClockCmd
+
+#define SD_SDIO_DMA_STREAM3              3
+//#define SD_SDIO_DMA_STREAM6              6
+
+#ifdef SD_SDIO_DMA_STREAM3
+ #define SD_SDIO_DMA_STREAM              DMA2_Stream3
+ #define SD_SDIO_DMA_CHANNEL             DMA_Channel_4
+ #define SD_SDIO_DMA_FLAG_FEIF           DMA_FLAG_FEIF3
+ #define SD_SDIO_DMA_FLAG_DMEIF          DMA_FLAG_DMEIF3
+ #define SD_SDIO_DMA_FLAG_TEIF           DMA_FLAG_TEIF3
+ #define SD_SDIO_DMA_FLAG_HTIF           DMA_FLAG_HTIF3
+ #define SD_SDIO_DMA_FLAG_TCIF           DMA_FLAG_TCIF3
+#elif defined SD_SDIO_DMA_STREAM6
+ #define SD_SDIO_DMA_STREAM              DMA2_Stream6
+ #define SD_SDIO_DMA_CHANNEL             DMA_Channel_4
+ #define SD_SDIO_DMA_FLAG_FEIF           DMA_FLAG_FEIF6
+ #define SD_SDIO_DMA_FLAG_DMEIF          DMA_FLAG_DMEIF6
+ #define SD_SDIO_DMA_FLAG_TEIF           DMA_FLAG_TEIF6
+ #define SD_SDIO_DMA_FLAG_HTIF           DMA_FLAG_HTIF6
+ #define SD_SDIO_DMA_FLAG_TCIF           DMA_FLAG_TCIF6
+#endif /* SD_SDIO_DMA_STREAM3 */
+
+/**
+ * @}
+ *//* STM32_SD_SDIO */
 
 /** @addtogroup STM32_I2C_EE
  * @{
@@ -338,6 +472,101 @@ extern "C" {
  * @}
  *//* STM32_I2C_EE */
 
+/** @addtogroup STM32_DCMI
+ * @{
+ */
+
+/**
+ * @brief  Camera interface (8-bit data, hardware syncs) on pins free of FSMC and Ethernet.
+ *         Beware: D2..D4 (PC8, PC9, PC11) are SDIO data lines, VSYNC (PB7) is CS of
+ *         the second SD Card, D5 (PB6) is SCL of I2C EEPROM
+ */
+#define CAMERA_GPIO_PORTS				RCC_AHB1Periph_GPIOA | \
+										RCC_AHB1Periph_GPIOB | \
+										RCC_AHB1Periph_GPIOC | \
+										RCC_AHB1Periph_GPIOE
+#define CAMERA_GPIO_PORTS_INIT			RCC_AHB1PeriphClockCmd
+
+#define CAMERA_DR_ADDRESS				((uint32_t)0x50050028)
+
+/**
+ * @brief  DCMI DMA stream (DCMI is on DMA2 Stream1 and Stream7 channel 1, Stream7 is COM2 TX)
+ */
+#define CAMERA_DMA_CLK					RCC_AHB1Periph_DMA2
+#define CAMERA_DMA_CLK_INIT				RCC_AHB1PeriphClockCmd
+#define CAMERA_DMA_CHANNEL				DMA_Channel_1
+#define CAMERA_DMA_STREAM				DMA2_Stream1
+#define CAMERA_DMA_IRQn					DMA2_Stream1_IRQn
+#define CAMERA_DMA_STREAM_IRQHandler	DMA2_Stream1_IRQHandler
+#define CAMERA_DMA_FLAGS				( DMA_FLAG_FEIF1 | DMA_FLAG_DMEIF1 | DMA_FLAG_TEIF1 | DMA_FLAG_HTIF1 | DMA_FLAG_TCIF1 )
+#define CAMERA_DMA_IT_TCIF				DMA_IT_TCIF1
+#define CAMERA_DMA_IT_TEIF				DMA_IT_TEIF1
+#define CAMERA_DMA_IT_FEIF				DMA_IT_FEIF1
+
+/**
+ * @}
+ *//* STM32_DCMI */
+
+/** @addtogroup STM32_ADC
+ * @{
+ */
+
+/**
+ * @brief  Sampler inputs: ADC3_IN4..IN8 on PF6..PF10 (the rest of GPIOF is FSMC address lines),
+ *         scanned in this order, the first SAMPLER_MAX_CHANNELS of them at most
+ */
+#define SAMPLER_ADC						ADC3
+#define SAMPLER_ADC_CLK					RCC_APB2Periph_ADC3
+#define SAMPLER_ADC_CLK_INIT			RCC_APB2PeriphClockCmd
+#define SAMPLER_DR_ADDRESS				((uint32_t)0x4001224C)
+#define SAMPLER_MAX_CHANNELS			5
+#define SAMPLER_CHANNEL_LIST			{ ADC_Channel_4, ADC_Channel_5, ADC_Channel_6, ADC_Channel_7, ADC_Channel_8 }
+#define SAMPLER_GPIO_PINS				GPIO_Pin_6 | GPIO_Pin_7 | GPIO_Pin_8 | GPIO_Pin_9 | GPIO_Pin_10
+#define SAMPLER_GPIO_PORT				GPIOF
+#define SAMPLER_GPIO_CLK				RCC_AHB1Periph_GPIOF
+#define SAMPLER_GPIO_CLK_INIT			RCC_AHB1PeriphClockCmd
+
+/**
+ * @brief  Trigger of the scans (TIM3 update event, TIM2 is the run time counter of tasks)
+ */
+#define SAMPLER_TIM						TIM3
+#define SAMPLER_TIM_CLK					RCC_APB1Periph_TIM3
+#define SAMPLER_TIM_CLK_INIT			RCC_APB1PeriphClockCmd
+#define SAMPLER_ADC_TRIGGER				ADC_ExternalTrigConv_T3_TRGO
+
+/**
+ * @brief  ADC3 DMA stream (ADC3 is on DMA2 Stream0 and Stream1 channel 2, Stream1 is DCMI)
+ */
+#define SAMPLER_DMA_CLK					RCC_AHB1Periph_DMA2
+#define SAMPLER_DMA_CLK_INIT			RCC_AHB1PeriphClockCmd
+#define SAMPLER_DMA_CHANNEL				DMA_Channel_2
+#define SAMPLER_DMA_STREAM				DMA2_Stream0
+#define SAMPLER_DMA_IRQn				DMA2_Stream0_IRQn
+#define SAMPLER_DMA_STREAM_IRQHandler	DMA2_Stream0_IRQHandler
+#define SAMPLER_DMA_FLAGS				( DMA_FLAG_FEIF0 | DMA_FLAG_DMEIF0 | DMA_FLAG_TEIF0 | DMA_FLAG_HTIF0 | DMA_FLAG_TCIF0 )
+#define SAMPLER_DMA_IT_TCIF				DMA_IT_TCIF0
+#define SAMPLER_DMA_IT_TEIF				DMA_IT_TEIF0
+#define SAMPLER_DMA_IT_DMEIF			DMA_IT_DMEIF0
+
+/**
+ * @}
+ *//* STM32_ADC */
+
+/** @addtogroup STM32_USB
+ * @{
+ */
+
+/**
+ * @brief  USB OTG FS device: DM on PA11, DP on PA12. VBUS (PA9) and ID (PA10) aren't
+ *         used: VBUS sensing is off and device mode is forced, they stay COM2 pins
+ */
+#define USB_GPIO_PORTS					RCC_AHB1Periph_GPIOA
+#define USB_GPIO_PORTS_INIT				RCC_AHB1PeriphClockCmd
+
+/**
+ * @}
+ *//* STM32_USB */
+
 /** @addtogroup STM32_ETH
  * @{
  */
@@ -407,7 +636,13 @@ extern "C" {
 //#define Bank2_NAND_ADDR			0x70000000
 //#define Bank3_NAND_ADDR			0x80000000
 #define FSMC_SRAM_ADDR			Bank1_SRAM1_ADDR
-#define FSMC_Bank1_NORSRAM		FSMC_Bank1_NORSRAM2	//FSMC_Bank1_NORSRAM1
+#define FSMC_Bank1_NORSRAM		FSMC_Bank1_NORSRAM1	//FSMC_Bank1_NORSRAM2
+
+/**
+ * @brief  Size of SRAM (1M x 16, address lines A0..A19, MEMORY_B1 of stm32_flash.ld).
+ *         A18 is PD13 of RIGHT button, the button is not used with USE_EXT_SRAM.
+ */
+#define FSMC_SRAM_SIZE			0x200000
 
 /**
  * @}
@@ -448,6 +683,10 @@ void ETH_config_pins( void );
 void SRAM_config_pins( void );
 void SRAM_unconfig_pins( void );
 
+void DCMI_config_pins( void );
+void ADC_config_pins( void );
+void USB_config_pins( void );
+
 /**
  * @}
  *//* STM32_Exported_Functions */
@@ -0,0 +1,146 @@
+/**
+ ******************************************************************************
+ * @file    stm32_pool.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Pool of sector sized blocks: free blocks form a stack linked
+ *          through their first word.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "stm32_pool.h"
+#include "stm32_mem.h"
+
+#include <stddef.h>
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Types
+ * @{
+ */
+
+/**
+ * @brief  Block of the pool, its first word links free blocks
+ */
+typedef union POOL_Block
+{
+	union POOL_Block*	Next;
+	uint8_t				Data[ POOL_BLOCK_SIZE ];
+} POOL_Block;
+
+/**
+ * @}
+ *//* STM32_Private_Types */
+
+
+/** @defgroup STM32_Private_Variables
+ * @{
+ */
+
+static POOL_Block POOL_Blocks[ POOL_BLOCKS ] MEM_DMA_BUFFER;
+static POOL_Block* volatile POOL_FreeList;		/* top of the stack of free blocks */
+static volatile uint32_t POOL_Free_;			/* number of free blocks */
+static uint32_t POOL_MinFree;					/* lowest number of free blocks so far */
+
+/**
+ * @}
+ *//* STM32_Private_Variables */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Puts all blocks into the free list, call before the pool is used
+ *         (DMA buffer section isn't cleared by startup code)
+ * @param  None
+ * @retval None
+ */
+void POOL_Init( void )
+{
+	uint32_t i;
+
+	POOL_FreeList = NULL;
+	for ( i = POOL_BLOCKS; i > 0; --i )
+	{
+		POOL_Blocks[ i - 1 ].Next = POOL_FreeList;
+		POOL_FreeList = &POOL_Blocks[ i - 1 ];
+	}
+	POOL_Free_ = POOL_MinFree = POOL_BLOCKS;
+}
+
+/**
+ * @brief  Takes a block (callable from interrupt handlers)
+ * @param  None
+ * @retval Block of POOL_BLOCK_SIZE bytes, NULL if the pool is exhausted
+ */
+void* POOL_Alloc( void )
+{
+	uint32_t primask = __get_PRIMASK();
+	POOL_Block* block;
+
+	__disable_irq();
+	block = POOL_FreeList;
+	if ( block != NULL )
+	{
+		POOL_FreeList = block->Next;
+		if ( --POOL_Free_ < POOL_MinFree )
+			POOL_MinFree = POOL_Free_;
+	}
+	__set_PRIMASK( primask );
+	return block;
+}
+
+/**
+ * @brief  Returns a block taken by POOL_Alloc (callable from interrupt handlers)
+ * @param  block: Block, NULL is ignored
+ * @retval None
+ */
+void POOL_Free( void* block )
+{
+	uint32_t primask;
+
+	if ( block == NULL )
+		return;
+	primask = __get_PRIMASK();
+	__disable_irq();
+	( (POOL_Block*)block )->Next = POOL_FreeList;
+	POOL_FreeList = (POOL_Block*)block;
+	++POOL_Free_;
+	__set_PRIMASK( primask );
+}
+
+/**
+ * @brief  Number of free blocks
+ * @param  None
+ * @retval Number of blocks
+ */
+uint32_t POOL_FreeCount( void )
+{
+	return POOL_Free_;
+}
+
+/**
+ * @brief  Lowest number of free blocks since POOL_Init, for sizing POOL_BLOCKS
+ * @param  None
+ * @retval Number of blocks
+ */
+uint32_t POOL_MinFreeCount( void )
+{
+	return POOL_MinFree;
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
@@ -0,0 +1,69 @@
+/**
+ ******************************************************************************
+ * @file    stm32_pool.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Pool of sector sized blocks for transient buffers. Blocks are
+ *          aligned for DMA bursts and placed with other DMA buffers, they
+ *          are taken and returned in constant time from tasks and interrupt
+ *          handlers (the free list is guarded by masking interrupts for a
+ *          few instructions), so components share one budget instead of
+ *          keeping their own static buffers, without heap fragmentation.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32_POOL_H
+#define STM32_POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "main.h"
+
+#include "stm32f2xx.h"
+
+#include <stdint.h>
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Constants
+ * @{
+ */
+
+/**
+ * @brief  Size of a block (one sector), number of blocks POOL_BLOCKS is in storage_conf.h
+ */
+#define POOL_BLOCK_SIZE			512
+
+/**
+ * @}
+ *//* STM32_Exported_Constants */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+void POOL_Init( void );
+void* POOL_Alloc( void );
+void POOL_Free( void* block );
+uint32_t POOL_FreeCount( void );
+uint32_t POOL_MinFreeCount( void );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32_POOL_H */
@@ -0,0 +1,402 @@
+/**
+ ******************************************************************************
+ * @file    stm32_sampler.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Timer triggered ADC sampling into pool blocks. TIM3 update event
+ *          (TRGO) starts a scan of the regular sequence, ADC requests DMA
+ *          after each conversion, the stream alternates between two blocks
+ *          and on transfer complete the handler queues the filled block and
+ *          sets a new one in its place while the DMA fills the other one. On
+ *          ADC overrun or DMA error the ADC and the stream are restarted from
+ *          channel 0 and the first block, so blocks always hold whole scans.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#ifdef USE_ADC_LOGGER
+
+#include "stm32_sampler.h"
+#include "stm32_pins.h"
+#include "stm32_pool.h"
+#include "stm32_irq.h"
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  ADC clock cycles of a conversion: sampling time and 12-bit conversion
+ *         (ADCCLK is PCLK2 / 4 = 15 MHz, 1.8 us per channel)
+ */
+#define SAMPLER_SAMPLE_TIME		ADC_SampleTime_15Cycles
+#define SAMPLER_CONV_CYCLES		( 15 + 12 )
+#define SAMPLER_ADC_PRESCALER	4
+
+/**
+ * @brief  Filled blocks waiting for the consumer (there are no more blocks in the pool)
+ */
+#define SAMPLER_QUEUE_SIZE		POOL_BLOCKS
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Constants
+ * @{
+ */
+
+static const uint8_t SAMPLER_Channels[ SAMPLER_MAX_CHANNELS ] = SAMPLER_CHANNEL_LIST;
+
+/**
+ * @}
+ *//* STM32_Private_Constants */
+
+
+/** @defgroup STM32_Private_Variables
+ * @{
+ */
+
+static xQueueHandle SAMPLER_Queue;							/* filled blocks */
+static xStaticQueue SAMPLER_QueueBuffer;
+static uint8_t SAMPLER_QueueStorage[ SAMPLER_QUEUE_SIZE * sizeof( SAMPLER_Block ) ];
+static uint16_t SAMPLER_Scrap[ POOL_BLOCK_SIZE / 2 ];		/* target of lost samples */
+static uint16_t* SAMPLER_Buf[ 2 ];							/* blocks of memory targets 0 and 1 */
+static uint16_t SAMPLER_BlockSamples;						/* DMA transfers of a block */
+static uint32_t SAMPLER_Seq;								/* block being filled */
+static uint8_t SAMPLER_Running;
+static SAMPLER_Stats SAMPLER_Counters;
+
+/**
+ * @}
+ *//* STM32_Private_Variables */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Next block for the DMA: a free pool block or the scrap buffer
+ * @param  None
+ * @retval Block
+ */
+static uint16_t* SAMPLER_TakeBlock( void )
+{
+	uint16_t* block = POOL_Alloc();
+
+	return ( block != NULL ) ? block : SAMPLER_Scrap;
+}
+
+/**
+ * @brief  Passes the filled block to the consumer and replaces it (DMA transfer complete)
+ * @param  woken: Set to pdTRUE if the consumer has to run
+ * @retval None
+ */
+static void SAMPLER_BlockDone( signed portBASE_TYPE* woken )
+{
+	uint32_t done = ( DMA_GetCurrentMemoryTarget( SAMPLER_DMA_STREAM ) == 0 ) ? 1 : 0;	/* DMA has gone on to the other one */
+	uint16_t* data = SAMPLER_Buf[ done ];
+	SAMPLER_Block blk;
+	uint32_t queued;
+
+	SAMPLER_Counters.Blocks++;
+	blk.Data = data;
+	blk.Seq = SAMPLER_Seq++;
+	if ( data != SAMPLER_Scrap && xQueueSendFromISR( SAMPLER_Queue, &blk, woken ) == pdTRUE )
+	{
+		queued = uxQueueMessagesWaitingFromISR( SAMPLER_Queue );
+		if ( queued > SAMPLER_Counters.MaxQueued )
+			SAMPLER_Counters.MaxQueued = queued;
+		data = SAMPLER_TakeBlock();
+	}
+	else
+	{	/* the block is filled again */
+		SAMPLER_Counters.Lost++;
+		if ( data == SAMPLER_Scrap )
+			data = SAMPLER_TakeBlock();
+	}
+	SAMPLER_Buf[ done ] = data;
+	DMA_MemoryTargetConfig( SAMPLER_DMA_STREAM, (uint32_t)data, done ? DMA_Memory_1 : DMA_Memory_0 );
+}
+
+/**
+ * @brief  Starts the DMA stream from memory target 0, then the ADC from channel 0
+ * @param  None
+ * @retval None
+ */
+static void SAMPLER_Enable( void )
+{
+	DMA_ClearFlag( SAMPLER_DMA_STREAM, SAMPLER_DMA_FLAGS );
+	DMA_SetCurrDataCounter( SAMPLER_DMA_STREAM, SAMPLER_BlockSamples );
+	SAMPLER_DMA_STREAM->M0AR = (uint32_t)SAMPLER_Buf[ 0 ];
+	SAMPLER_DMA_STREAM->M1AR = (uint32_t)SAMPLER_Buf[ 1 ];
+	SAMPLER_DMA_STREAM->CR &= ~DMA_SxCR_CT;
+	DMA_Cmd( SAMPLER_DMA_STREAM, ENABLE );
+	ADC_ClearFlag( SAMPLER_ADC, ADC_FLAG_OVR );
+	ADC_DMACmd( SAMPLER_ADC, ENABLE );
+	ADC_Cmd( SAMPLER_ADC, ENABLE );
+}
+
+/**
+ * @brief  Stops the ADC (its sequence starts from channel 0 again) and the DMA stream
+ * @param  None
+ * @retval None
+ */
+static void SAMPLER_Disable( void )
+{
+	ADC_Cmd( SAMPLER_ADC, DISABLE );
+	ADC_DMACmd( SAMPLER_ADC, DISABLE );
+	DMA_Cmd( SAMPLER_DMA_STREAM, DISABLE );
+	while ( DMA_GetCmdStatus( SAMPLER_DMA_STREAM ) != DISABLE ) ;
+}
+
+/**
+ * @brief  Restarts sampling after overrun or DMA error, the partly filled block is lost
+ * @param  None
+ * @retval None
+ */
+static void SAMPLER_Restart( void )
+{
+	SAMPLER_Disable();
+	SAMPLER_Counters.Overruns++;
+	SAMPLER_Counters.Blocks++;
+	SAMPLER_Counters.Lost++;
+	SAMPLER_Seq++;
+	SAMPLER_Enable();
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Configures pins and clocks of the ADC, its DMA stream and the timer
+ * @param  None
+ * @retval ERROR if the queue can't be created
+ */
+ErrorStatus SAMPLER_Init( void )
+{
+	ADC_CommonInitTypeDef ADC_CommonInitStructure;
+	DMA_InitTypeDef DMA_InitStructure;
+
+	SAMPLER_Queue = xQueueCreateStatic( SAMPLER_QUEUE_SIZE, sizeof( SAMPLER_Block ), SAMPLER_QueueStorage, &SAMPLER_QueueBuffer );
+	if ( SAMPLER_Queue == NULL )
+		return ERROR;
+
+	SAMPLER_GPIO_CLK_INIT( SAMPLER_GPIO_CLK, ENABLE );
+	ADC_config_pins();
+	SAMPLER_ADC_CLK_INIT( SAMPLER_ADC_CLK, ENABLE );
+	SAMPLER_TIM_CLK_INIT( SAMPLER_TIM_CLK, ENABLE );
+	SAMPLER_DMA_CLK_INIT( SAMPLER_DMA_CLK, ENABLE );
+
+	ADC_CommonInitStructure.ADC_Mode = ADC_Mode_Independent;
+	ADC_CommonInitStructure.ADC_Prescaler = ADC_Prescaler_Div4;
+	ADC_CommonInitStructure.ADC_DMAAccessMode = ADC_DMAAccessMode_Disabled;
+	ADC_CommonInitStructure.ADC_TwoSamplingDelay = ADC_TwoSamplingDelay_5Cycles;
+	ADC_CommonInit( &ADC_CommonInitStructure );
+
+	/* direct mode: each conversion is stored as it comes */
+	DMA_DeInit( SAMPLER_DMA_STREAM );
+	DMA_InitStructure.DMA_Channel = SAMPLER_DMA_CHANNEL;
+	DMA_InitStructure.DMA_PeripheralBaseAddr = SAMPLER_DR_ADDRESS;
+	DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t)SAMPLER_Scrap;
+	DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralToMemory;
+	DMA_InitStructure.DMA_BufferSize = POOL_BLOCK_SIZE / 2;
+	DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+	DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+	DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
+	DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_HalfWord;
+	DMA_InitStructure.DMA_Mode = DMA_Mode_Circular;
+	DMA_InitStructure.DMA_Priority = DMA_Priority_High;
+	DMA_InitStructure.DMA_FIFOMode = DMA_FIFOMode_Disable;
+	DMA_InitStructure.DMA_FIFOThreshold = DMA_FIFOThreshold_HalfFull;
+	DMA_InitStructure.DMA_MemoryBurst = DMA_MemoryBurst_Single;
+	DMA_InitStructure.DMA_PeripheralBurst = DMA_PeripheralBurst_Single;
+	DMA_Init( SAMPLER_DMA_STREAM, &DMA_InitStructure );
+	DMA_DoubleBufferModeConfig( SAMPLER_DMA_STREAM, (uint32_t)SAMPLER_Scrap, DMA_Memory_0 );
+	DMA_DoubleBufferModeCmd( SAMPLER_DMA_STREAM, ENABLE );
+	DMA_ITConfig( SAMPLER_DMA_STREAM, DMA_IT_TC | DMA_IT_TE | DMA_IT_DME, ENABLE );
+	return SUCCESS;
+}
+
+/**
+ * @brief  Starts sampling at the rate nearest to the one asked for
+ * @param  channels: Number of channels scanned (1 .. SAMPLER_MAX_CHANNELS)
+ * @param  rate: Scans per second
+ * @retval Actual scans per second the timer makes, 0 if sampling is running already,
+ *         ADC can't scan that fast or the pool has no 2 free blocks
+ */
+uint32_t SAMPLER_Start( uint8_t channels, uint32_t rate )
+{
+	ADC_InitTypeDef ADC_InitStructure;
+	TIM_TimeBaseInitTypeDef TIM_TimeBaseStructure;
+	RCC_ClocksTypeDef clocks;
+	uint32_t clk, div, psc;
+	uint8_t i;
+
+	RCC_GetClocksFreq( &clocks );
+	if ( SAMPLER_Running || channels == 0 || channels > SAMPLER_MAX_CHANNELS || rate == 0 ||
+			(uint64_t)rate * channels * SAMPLER_CONV_CYCLES * SAMPLER_ADC_PRESCALER > clocks.PCLK2_Frequency )
+		return 0;
+
+	/* APB1 timers run at twice PCLK1 if APB1 is divided */
+	clk = clocks.PCLK1_Frequency * ( ( RCC->CFGR & RCC_CFGR_PPRE1_2 ) ? 2 : 1 );
+	div = ( clk + rate / 2 ) / rate;
+	psc = ( div - 1 ) / 65536 + 1;
+	div = ( div + psc / 2 ) / psc;
+	if ( div < 2 )
+		return 0;
+
+	SAMPLER_Buf[ 0 ] = POOL_Alloc();
+	SAMPLER_Buf[ 1 ] = POOL_Alloc();
+	if ( SAMPLER_Buf[ 0 ] == NULL || SAMPLER_Buf[ 1 ] == NULL )
+	{
+		POOL_Free( SAMPLER_Buf[ 0 ] );
+		POOL_Free( SAMPLER_Buf[ 1 ] );
+		return 0;
+	}
+	SAMPLER_BlockSamples = SAMPLER_BlockScans( channels ) * channels;
+	SAMPLER_Seq = 0;
+	SAMPLER_Counters.Blocks = SAMPLER_Counters.Lost = 0;
+	SAMPLER_Counters.Overruns = SAMPLER_Counters.MaxQueued = 0;
+	SAMPLER_Running = 1;
+
+	ADC_InitStructure.ADC_Resolution = ADC_Resolution_12b;
+	ADC_InitStructure.ADC_ScanConvMode = ENABLE;
+	ADC_InitStructure.ADC_ContinuousConvMode = DISABLE;
+	ADC_InitStructure.ADC_ExternalTrigConvEdge = ADC_ExternalTrigConvEdge_Rising;
+	ADC_InitStructure.ADC_ExternalTrigConv = SAMPLER_ADC_TRIGGER;
+	ADC_InitStructure.ADC_DataAlign = ADC_DataAlign_Right;
+	ADC_InitStructure.ADC_NbrOfConversion = channels;
+	ADC_Init( SAMPLER_ADC, &ADC_InitStructure );
+	for ( i = 0; i < channels; ++i )
+		ADC_RegularChannelConfig( SAMPLER_ADC, SAMPLER_Channels[ i ], i + 1, SAMPLER_SAMPLE_TIME );
+	ADC_DMARequestAfterLastTransferCmd( SAMPLER_ADC, ENABLE );
+	ADC_ITConfig( SAMPLER_ADC, ADC_IT_OVR, ENABLE );
+
+	TIM_TimeBaseStructure.TIM_Prescaler = psc - 1;
+	TIM_TimeBaseStructure.TIM_Period = div - 1;
+	TIM_TimeBaseStructure.TIM_ClockDivision = TIM_CKD_DIV1;
+	TIM_TimeBaseStructure.TIM_CounterMode = TIM_CounterMode_Up;
+	TIM_TimeBaseStructure.TIM_RepetitionCounter = 0;
+	TIM_TimeBaseInit( SAMPLER_TIM, &TIM_TimeBaseStructure );
+	TIM_SelectOutputTrigger( SAMPLER_TIM, TIM_TRGOSource_Update );
+
+	IRQ_Enable( SAMPLER_DMA_IRQn, IRQ_PRIO_SAMPLER );
+	IRQ_Enable( ADC_IRQn, IRQ_PRIO_SAMPLER );
+	SAMPLER_Enable();
+	TIM_Cmd( SAMPLER_TIM, ENABLE );
+	return ( clk + psc * div / 2 ) / ( psc * div );
+}
+
+/**
+ * @brief  Stops sampling. Blocks queued already stay in the queue: the consumer
+ *         takes them by SAMPLER_Receive and returns them to the pool
+ * @param  None
+ * @retval None
+ */
+void SAMPLER_Stop( void )
+{
+	if ( !SAMPLER_Running )
+		return;
+	TIM_Cmd( SAMPLER_TIM, DISABLE );
+	NVIC_DisableIRQ( ADC_IRQn );
+	NVIC_DisableIRQ( SAMPLER_DMA_IRQn );
+	SAMPLER_Disable();
+	ADC_ITConfig( SAMPLER_ADC, ADC_IT_OVR, DISABLE );
+	SAMPLER_Running = 0;
+	if ( SAMPLER_Buf[ 0 ] != SAMPLER_Scrap )
+		POOL_Free( SAMPLER_Buf[ 0 ] );
+	if ( SAMPLER_Buf[ 1 ] != SAMPLER_Scrap )
+		POOL_Free( SAMPLER_Buf[ 1 ] );
+	SAMPLER_Buf[ 0 ] = SAMPLER_Buf[ 1 ] = NULL;
+}
+
+/**
+ * @brief  Takes the next filled block
+ * @param  blk: Receives the block
+ * @param  timeout: Timeout in ticks
+ * @retval ERROR on timeout
+ */
+ErrorStatus SAMPLER_Receive( SAMPLER_Block* blk, portTickType timeout )
+{
+	return ( xQueueReceive( SAMPLER_Queue, blk, timeout ) == pdTRUE ) ? SUCCESS : ERROR;
+}
+
+/**
+ * @brief  Gets the counters
+ * @param  stats: Receives the counters
+ * @retval None
+ */
+void SAMPLER_GetStats( SAMPLER_Stats* stats )
+{
+	taskENTER_CRITICAL();
+	*stats = SAMPLER_Counters;
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief  ADC interrupt handler (ADC1, ADC2 and ADC3 share it): overrun
+ * @param  None
+ * @retval None
+ */
+void SAMPLER_IRQHandler( void )
+{
+	if ( ADC_GetITStatus( SAMPLER_ADC, ADC_IT_OVR ) != RESET )
+	{
+		ADC_ClearITPendingBit( SAMPLER_ADC, ADC_IT_OVR );
+		SAMPLER_Restart();
+	}
+}
+
+/**
+ * @brief  DMA stream interrupt handler: block filled, transfer and direct mode errors
+ * @param  None
+ * @retval None
+ */
+void SAMPLER_DMA_IRQHandler( void )
+{
+	signed portBASE_TYPE woken = pdFALSE;
+
+	if ( DMA_GetITStatus( SAMPLER_DMA_STREAM, SAMPLER_DMA_IT_TEIF ) != RESET ||
+			DMA_GetITStatus( SAMPLER_DMA_STREAM, SAMPLER_DMA_IT_DMEIF ) != RESET )
+	{	/* late handler (target written while in use) or lost request */
+		DMA_ClearITPendingBit( SAMPLER_DMA_STREAM, SAMPLER_DMA_IT_TEIF | SAMPLER_DMA_IT_DMEIF );
+		SAMPLER_Restart();
+	}
+	else if ( DMA_GetITStatus( SAMPLER_DMA_STREAM, SAMPLER_DMA_IT_TCIF ) != RESET )
+	{
+		DMA_ClearITPendingBit( SAMPLER_DMA_STREAM, SAMPLER_DMA_IT_TCIF );
+		SAMPLER_BlockDone( &woken );
+	}
+	portYIELD_FROM_ISR( woken );
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#endif /* USE_ADC_LOGGER */
@@ -0,0 +1,104 @@
+/**
+ ******************************************************************************
+ * @file    stm32_sampler.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Timer triggered multi-channel ADC sampling. Each timer event
+ *          starts a scan of the channels, DMA stores the 12-bit results into
+ *          blocks of the pool (double buffer mode, circular), and each filled
+ *          block goes to the consumer task by a queue and is replaced by a
+ *          free block. A block holds whole scans only (channel 0 first), the
+ *          rest of it is not written. If there is no free block or no room in
+ *          the queue, the samples go to a scrap buffer: the block is lost and
+ *          the next block sent has a sequence number further on.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32_SAMPLER_H
+#define STM32_SAMPLER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f2xx.h"
+#include "stm32_pool.h"
+
+#include <stdint.h>
+
+/* Scheduler */
+#include "FreeRTOS.h"
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Types
+ * @{
+ */
+
+/**
+ * @brief  Filled block of samples
+ */
+typedef struct
+{
+	uint16_t*	Data;			/*!< Pool block, SAMPLER_BlockScans scans, the consumer returns it by POOL_Free */
+	uint32_t	Seq;			/*!< Block number since SAMPLER_Start, a gap tells lost blocks */
+} SAMPLER_Block;
+
+/**
+ * @brief  Counters since SAMPLER_Start
+ */
+typedef struct
+{
+	uint32_t	Blocks;			/*!< Blocks filled */
+	uint32_t	Lost;			/*!< Blocks lost: no free block, the queue was full or ADC overrun */
+	uint32_t	Overruns;		/*!< ADC overruns and DMA errors, the sampling restarted after each */
+	uint32_t	MaxQueued;		/*!< Most blocks waiting for the consumer at once */
+} SAMPLER_Stats;
+
+/**
+ * @}
+ *//* STM32_Exported_Types */
+
+/** @defgroup STM32_Exported_Macros
+ * @{
+ */
+
+/**
+ * @brief  Number of scans in a block, for the number of channels
+ */
+#define SAMPLER_BlockScans( channels )	( POOL_BLOCK_SIZE / 2 / (channels) )
+
+/**
+ * @}
+ *//* STM32_Exported_Macros */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+ErrorStatus SAMPLER_Init( void );
+uint32_t SAMPLER_Start( uint8_t channels, uint32_t rate );
+void SAMPLER_Stop( void );
+ErrorStatus SAMPLER_Receive( SAMPLER_Block* blk, portTickType timeout );
+void SAMPLER_GetStats( SAMPLER_Stats* stats );
+
+void SAMPLER_IRQHandler( void );
+void SAMPLER_DMA_IRQHandler( void );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32_SAMPLER_H */
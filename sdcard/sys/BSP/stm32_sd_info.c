@@ -0,0 +1,442 @@
+/**
+ ******************************************************************************
+ * @file    stm32_sd_info.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Table driven formatter of SD Card registers (see stm32_sd_info.h).
+ *          Fields are read from the registers as received from the card by
+ *          SD_GetField, names are those of SD specification, so a line is
+ *          a few dozen bytes of code and table instead of a printf call.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "stm32_sd_info.h"
+#include "serial_debug.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  Register of a field, and the cards which have the field
+ */
+#define SD_INFO_CID				0
+#define SD_INFO_CSD				1
+#define SD_INFO_SCR				2		/*!< Only SD cards have it */
+#define SD_INFO_SSR				3		/*!< First 16 bytes of SD status (SD_Status.Raw) */
+#define SD_INFO_REG				0x03
+#define SD_INFO_V1				0x10	/*!< Only in CSD v1 (SDSC) */
+#define SD_INFO_V2				0x20	/*!< Only in CSD v2 and later (SDHC, SDXC) */
+
+/**
+ * @brief  How the value of a field is shown
+ */
+#define SD_INFO_DEC				0		/*!< Decimal, Text is the unit */
+#define SD_INFO_HEX				1		/*!< Hexadecimal */
+#define SD_INFO_FLAG			2		/*!< "yes" or "no" */
+#define SD_INFO_CHARS			3		/*!< ASCII bytes (byte aligned field of any width) */
+#define SD_INFO_POW2			4		/*!< 2 to the power of the value, Text is the unit */
+#define SD_INFO_REV				5		/*!< BCD revision n.m */
+#define SD_INFO_DATE			6		/*!< Manufacturing date of CID (year - 2000, month) */
+#define SD_INFO_ENUM			7		/*!< Text names values 0, 1, .. separated by '|' */
+
+/**
+ * @brief  Size of a line of SD_InfoPrint, longer lines are cut
+ */
+#define SD_INFO_LINE			64
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Types
+ * @{
+ */
+
+/**
+ * @brief  Field shown to the user
+ */
+typedef struct
+{
+	const char*		Name;			/*!< Name of the field in SD specification */
+	const char*		Text;			/*!< Unit or names of the values, may be NULL */
+	uint16_t		Field;			/*!< SD_FIELD( lowest bit, width ) */
+	uint8_t			Reg;			/*!< SD_INFO_CID .. SD_INFO_SSR, SD_INFO_V1 or SD_INFO_V2 */
+	uint8_t			Format;			/*!< SD_INFO_DEC .. SD_INFO_ENUM */
+} SD_InfoField;
+
+/**
+ * @brief  Line being formatted
+ */
+typedef struct
+{
+	char*			Buf;
+	uint32_t		Len;
+	uint32_t		Size;			/*!< Room for characters (terminating zero excluded) */
+} SD_InfoLine;
+
+/**
+ * @}
+ *//* STM32_Private_Types */
+
+
+/** @defgroup STM32_Private_Variables
+ * @{
+ */
+
+static const char SD_InfoCurrentR[] = "0.5|1|5|10|25|35|60|100";
+static const char SD_InfoCurrentW[] = "1|5|10|25|35|45|80|200";
+static const char SD_InfoAU[] = "none|16K|32K|64K|128K|256K|512K|1M|2M|4M|8M|12M|16M|24M|32M|64M";
+
+/**
+ * @brief  All fields shown, in the order of the lines
+ */
+static const SD_InfoField SD_InfoFields[] =
+{
+	{ "MID",					NULL,		SD_FIELD( 120, 8 ),	SD_INFO_CID,				SD_INFO_HEX },
+	{ "OID",					NULL,		SD_FIELD( 104, 16 ), SD_INFO_CID,				SD_INFO_CHARS },
+	{ "PNM",					NULL,		SD_FIELD( 64, 40 ),	SD_INFO_CID,				SD_INFO_CHARS },
+	{ "PRV",					NULL,		SD_FIELD( 56, 8 ),	SD_INFO_CID,				SD_INFO_REV },
+	{ "PSN",					NULL,		SD_FIELD( 24, 32 ),	SD_INFO_CID,				SD_INFO_HEX },
+	{ "MDT",					NULL,		SD_FIELD( 8, 12 ),	SD_INFO_CID,				SD_INFO_DATE },
+
+	{ "CSD_STRUCTURE",			"1.0|2.0|3.0", SD_FIELD( 126, 2 ), SD_INFO_CSD,			SD_INFO_ENUM },
+	{ "TAAC",					NULL,		SD_FIELD( 112, 8 ),	SD_INFO_CSD | SD_INFO_V1,	SD_INFO_HEX },
+	{ "NSAC",					"x100 clk",	SD_FIELD( 104, 8 ),	SD_INFO_CSD | SD_INFO_V1,	SD_INFO_DEC },
+	{ "TRAN_SPEED",				NULL,		SD_FIELD( 96, 8 ),	SD_INFO_CSD,				SD_INFO_HEX },
+	{ "CCC",					NULL,		SD_FIELD( 84, 12 ),	SD_INFO_CSD,				SD_INFO_HEX },
+	{ "READ_BL_LEN",			"bytes",	SD_FIELD( 80, 4 ),	SD_INFO_CSD,				SD_INFO_POW2 },
+	{ "READ_BL_PARTIAL",		NULL,		SD_FIELD( 79, 1 ),	SD_INFO_CSD | SD_INFO_V1,	SD_INFO_FLAG },
+	{ "WRITE_BLK_MISALIGN",		NULL,		SD_FIELD( 78, 1 ),	SD_INFO_CSD | SD_INFO_V1,	SD_INFO_FLAG },
+	{ "READ_BLK_MISALIGN",		NULL,		SD_FIELD( 77, 1 ),	SD_INFO_CSD | SD_INFO_V1,	SD_INFO_FLAG },
+	{ "DSR_IMP",				NULL,		SD_FIELD( 76, 1 ),	SD_INFO_CSD,				SD_INFO_FLAG },
+	{ "C_SIZE",					NULL,		SD_FIELD( 62, 12 ),	SD_INFO_CSD | SD_INFO_V1,	SD_INFO_DEC },
+	{ "C_SIZE",					NULL,		SD_FIELD( 48, 22 ),	SD_INFO_CSD | SD_INFO_V2,	SD_INFO_DEC },
+	{ "VDD_R_CURR_MIN",			SD_InfoCurrentR, SD_FIELD( 59, 3 ), SD_INFO_CSD | SD_INFO_V1, SD_INFO_ENUM },
+	{ "VDD_R_CURR_MAX",			SD_InfoCurrentR, SD_FIELD( 56, 3 ), SD_INFO_CSD | SD_INFO_V1, SD_INFO_ENUM },
+	{ "VDD_W_CURR_MIN",			SD_InfoCurrentW, SD_FIELD( 53, 3 ), SD_INFO_CSD | SD_INFO_V1, SD_INFO_ENUM },
+	{ "VDD_W_CURR_MAX",			SD_InfoCurrentW, SD_FIELD( 50, 3 ), SD_INFO_CSD | SD_INFO_V1, SD_INFO_ENUM },
+	{ "C_SIZE_MULT",			NULL,		SD_FIELD( 47, 3 ),	SD_INFO_CSD | SD_INFO_V1,	SD_INFO_DEC },
+	{ "ERASE_BLK_EN",			NULL,		SD_FIELD( 46, 1 ),	SD_INFO_CSD,				SD_INFO_FLAG },
+	{ "SECTOR_SIZE",			NULL,		SD_FIELD( 39, 7 ),	SD_INFO_CSD,				SD_INFO_DEC },
+	{ "WP_GRP_SIZE",			NULL,		SD_FIELD( 32, 7 ),	SD_INFO_CSD | SD_INFO_V1,	SD_INFO_DEC },
+	{ "WP_GRP_ENABLE",			NULL,		SD_FIELD( 31, 1 ),	SD_INFO_CSD | SD_INFO_V1,	SD_INFO_FLAG },
+	{ "R2W_FACTOR",				NULL,		SD_FIELD( 26, 3 ),	SD_INFO_CSD,				SD_INFO_POW2 },
+	{ "WRITE_BL_LEN",			"bytes",	SD_FIELD( 22, 4 ),	SD_INFO_CSD,				SD_INFO_POW2 },
+	{ "WRITE_BL_PARTIAL",		NULL,		SD_FIELD( 21, 1 ),	SD_INFO_CSD,				SD_INFO_FLAG },
+	{ "FILE_FORMAT_GRP",		NULL,		SD_FIELD( 15, 1 ),	SD_INFO_CSD | SD_INFO_V1,	SD_INFO_DEC },
+	{ "COPY",					NULL,		SD_FIELD( 14, 1 ),	SD_INFO_CSD,				SD_INFO_FLAG },
+	{ "PERM_WRITE_PROTECT",		NULL,		SD_FIELD( 13, 1 ),	SD_INFO_CSD,				SD_INFO_FLAG },
+	{ "TMP_WRITE_PROTECT",		NULL,		SD_FIELD( 12, 1 ),	SD_INFO_CSD,				SD_INFO_FLAG },
+	{ "FILE_FORMAT",			"partitions|boot sector|universal|other", SD_FIELD( 10, 2 ), SD_INFO_CSD | SD_INFO_V1, SD_INFO_ENUM },
+
+	{ "SCR_STRUCTURE",			NULL,		SD_FIELD( 60, 4 ),	SD_INFO_SCR,				SD_INFO_DEC },
+	{ "SD_SPEC",				"1.0|1.10|2.00", SD_FIELD( 56, 4 ), SD_INFO_SCR,			SD_INFO_ENUM },
+	{ "SD_SPEC3",				NULL,		SD_FIELD( 47, 1 ),	SD_INFO_SCR,				SD_INFO_FLAG },
+	{ "DATA_STAT_AFTER_ERASE",	"0x00|0xFF", SD_FIELD( 55, 1 ),	SD_INFO_SCR,				SD_INFO_ENUM },
+	{ "SD_SECURITY",			"none|not used|1.01|2.00|3.xx", SD_FIELD( 52, 3 ), SD_INFO_SCR, SD_INFO_ENUM },
+	{ "SD_BUS_WIDTHS",			NULL,		SD_FIELD( 48, 4 ),	SD_INFO_SCR,				SD_INFO_HEX },
+	{ "EX_SECURITY",			NULL,		SD_FIELD( 43, 4 ),	SD_INFO_SCR,				SD_INFO_DEC },
+	{ "CMD23_SUPPORT",			NULL,		SD_FIELD( 33, 1 ),	SD_INFO_SCR,				SD_INFO_FLAG },
+	{ "CMD20_SUPPORT",			NULL,		SD_FIELD( 32, 1 ),	SD_INFO_SCR,				SD_INFO_FLAG },
+
+	{ "DAT_BUS_WIDTH",			"1 bit|reserved|4 bits", SD_FIELD( 126, 2 ), SD_INFO_SSR,	SD_INFO_ENUM },
+	{ "SECURED_MODE",			NULL,		SD_FIELD( 125, 1 ),	SD_INFO_SSR,				SD_INFO_FLAG },
+	{ "SD_CARD_TYPE",			"regular|ROM|OTP", SD_FIELD( 96, 16 ), SD_INFO_SSR,			SD_INFO_ENUM },
+	{ "SIZE_OF_PROTECTED_AREA",	NULL,		SD_FIELD( 64, 32 ),	SD_INFO_SSR,				SD_INFO_DEC },
+	{ "SPEED_CLASS",			"0|2|4|6|10", SD_FIELD( 56, 8 ),	SD_INFO_SSR,				SD_INFO_ENUM },
+	{ "PERFORMANCE_MOVE",		"Mb/sec",	SD_FIELD( 48, 8 ),	SD_INFO_SSR,				SD_INFO_DEC },
+	{ "AU_SIZE",				SD_InfoAU,	SD_FIELD( 44, 4 ),	SD_INFO_SSR,				SD_INFO_ENUM },
+	{ "ERASE_SIZE",				"AU",		SD_FIELD( 24, 16 ),	SD_INFO_SSR,				SD_INFO_DEC },
+	{ "ERASE_TIMEOUT",			"s",		SD_FIELD( 18, 6 ),	SD_INFO_SSR,				SD_INFO_DEC },
+	{ "ERASE_OFFSET",			"s",		SD_FIELD( 16, 2 ),	SD_INFO_SSR,				SD_INFO_DEC },
+	{ "UHS_SPEED_GRADE",		NULL,		SD_FIELD( 12, 4 ),	SD_INFO_SSR,				SD_INFO_DEC },
+	{ "UHS_AU_SIZE",			SD_InfoAU,	SD_FIELD( 8, 4 ),	SD_INFO_SSR,				SD_INFO_ENUM },
+};
+
+#define SD_INFO_FIELDS			( sizeof( SD_InfoFields ) / sizeof( SD_InfoFields[ 0 ] ) )
+
+static const char* const SD_InfoRegNames[] = { "CID ", "CSD ", "SCR ", "SSR " };
+
+/**
+ * @}
+ *//* STM32_Private_Variables */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Appends characters to the line (as many as fit)
+ * @param  line: Line
+ * @param  s: Characters
+ * @param  n: Number of characters
+ * @retval None
+ */
+static void SD_InfoPut( SD_InfoLine* line, const char* s, uint32_t n )
+{
+	if ( n > line->Size - line->Len )
+		n = line->Size - line->Len;
+	memcpy( line->Buf + line->Len, s, n );
+	line->Len += n;
+}
+
+/**
+ * @brief  Appends a string to the line
+ * @param  line: Line
+ * @param  s: String
+ * @retval None
+ */
+static void SD_InfoStr( SD_InfoLine* line, const char* s )
+{
+	SD_InfoPut( line, s, strlen( s ) );
+}
+
+/**
+ * @brief  Appends a number to the line
+ * @param  line: Line
+ * @param  value: Number
+ * @param  base: 10 or 16
+ * @param  digits: Least number of digits (leading zeros)
+ * @retval None
+ */
+static void SD_InfoNum( SD_InfoLine* line, uint32_t value, uint8_t base, uint8_t digits )
+{
+	char text[ 10 ];
+	uint8_t n = 0;
+
+	do
+	{
+		text[ sizeof( text ) - ++n ] = "0123456789ABCDEF"[ value % base ];
+		value /= base;
+	} while ( ( value != 0 || n < digits ) && n < sizeof( text ) );
+	SD_InfoPut( line, text + sizeof( text ) - n, n );
+}
+
+/**
+ * @brief  Ends the line (a line cut to the buffer is still ended)
+ * @param  line: Line
+ * @retval Length of the line
+ */
+static uint32_t SD_InfoEnd( SD_InfoLine* line )
+{
+	if ( line->Len == line->Size )
+		--line->Len;
+	line->Buf[ line->Len++ ] = '\n';
+	line->Buf[ line->Len ] = '\0';
+	return line->Len;
+}
+
+/**
+ * @brief  Finds the register of a field, if the card has the field
+ * @param  cardinfo: Card information, or NULL
+ * @param  status: SD status, or NULL
+ * @param  reg: Reg of the field
+ * @param  size: Receives the size of the register in bytes
+ * @retval Register as received from the card, NULL if the field isn't shown
+ */
+static const uint8_t* SD_InfoRegister( const SD_CardInfo* cardinfo, const SD_Status* status, uint8_t reg, uint8_t* size )
+{
+	if ( ( reg & SD_INFO_REG ) == SD_INFO_SSR )
+	{
+		*size = sizeof( status->Raw );
+		return ( status != NULL ) ? status->Raw : NULL;
+	}
+	if ( cardinfo == NULL )
+		return NULL;
+	if ( ( reg & SD_INFO_V1 ) && SD_CSD_Get( cardinfo, SD_CSD_STRUCTURE ) != 0 )
+		return NULL;
+	if ( ( reg & SD_INFO_V2 ) && SD_CSD_Get( cardinfo, SD_CSD_STRUCTURE ) == 0 )
+		return NULL;
+	switch ( reg & SD_INFO_REG )
+	{
+	case SD_INFO_CID:
+		*size = sizeof( cardinfo->CID );
+		return cardinfo->CID;
+	case SD_INFO_CSD:
+		*size = sizeof( cardinfo->CSD );
+		return cardinfo->CSD;
+	default:	/* SCR isn't read from MMC cards, while any SD card supports 1-bit bus */
+		*size = sizeof( cardinfo->SCR );
+		return ( SD_SCR_Get( cardinfo, SD_SCR_BUS_WIDTHS ) & 0x01 ) ? cardinfo->SCR : NULL;
+	}
+}
+
+/**
+ * @brief  Formats value of a field
+ * @param  line: Line
+ * @param  f: Field
+ * @param  reg: Register of the field
+ * @param  size: Size of the register in bytes
+ * @retval None
+ */
+static void SD_InfoValue( SD_InfoLine* line, const SD_InfoField* f, const uint8_t* reg, uint8_t size )
+{
+	uint8_t width = (uint8_t)f->Field;
+	const char* text = f->Text;
+	const char* end;
+	uint32_t v, i;
+
+	if ( f->Format == SD_INFO_CHARS )
+	{	/* byte aligned, MSB first */
+		reg += size - ( ( ( f->Field >> 8 ) + width ) >> 3 );
+		for ( i = 0; i < width / 8u; ++i )
+			SD_InfoPut( line, ( reg[ i ] >= ' ' && reg[ i ] < 0x7F ) ? (const char*)&reg[ i ] : ".", 1 );
+		return;
+	}
+	v = SD_GetField( reg, size, f->Field );
+	switch ( f->Format )
+	{
+	case SD_INFO_HEX:
+		SD_InfoStr( line, "0x" );
+		SD_InfoNum( line, v, 16, ( width + 3 ) / 4 );
+		return;
+	case SD_INFO_FLAG:
+		SD_InfoStr( line, v ? "yes" : "no" );
+		return;
+	case SD_INFO_POW2:
+		v = 1 << v;
+		break;
+	case SD_INFO_REV:
+		SD_InfoNum( line, v >> 4, 10, 1 );
+		SD_InfoStr( line, "." );
+		SD_InfoNum( line, v & 0x0F, 10, 1 );
+		return;
+	case SD_INFO_DATE:
+		SD_InfoNum( line, 2000 + ( v >> 4 ), 10, 4 );
+		SD_InfoStr( line, "-" );
+		SD_InfoNum( line, v & 0x0F, 10, 2 );
+		return;
+	case SD_INFO_ENUM:
+		for ( i = 0; i < v && text != NULL; ++i )
+		{
+			text = strchr( text, '|' );
+			if ( text != NULL )
+				++text;
+		}
+		if ( text == NULL )
+			break;		/* reserved: the number itself */
+		end = strchr( text, '|' );
+		SD_InfoPut( line, text, ( end != NULL ) ? (uint32_t)( end - text ) : strlen( text ) );
+		return;
+	default:
+		break;
+	}
+	SD_InfoNum( line, v, 10, 1 );
+	if ( f->Format != SD_INFO_ENUM && text != NULL )
+	{
+		SD_InfoStr( line, " " );
+		SD_InfoStr( line, text );
+	}
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Formats the next line of card information: type and capacity of the card,
+ *         then the fields of its registers one per line ("CSD READ_BL_LEN : 512 bytes")
+ * @param  cardinfo: Card information (SD_GetCardInfo), NULL to format the status only
+ * @param  status: SD status (SD_GetStatus), NULL to format the card information only
+ * @param  pos: Position in the lines, 0 before the first call
+ * @param  buf: Buffer of the line, zero terminated
+ * @param  size: Size of the buffer, longer lines are cut
+ * @retval Length of the line, 0 after the last one
+ */
+uint32_t SD_InfoFormat( const SD_CardInfo* cardinfo, const SD_Status* status, uint16_t* pos, char* buf, uint32_t size )
+{
+	SD_InfoLine line;
+	const SD_InfoField* f;
+	const uint8_t* reg;
+	uint8_t regsize;
+
+	if ( size < 2 )
+		return 0;
+	line.Buf = buf;
+	line.Len = 0;
+	line.Size = size - 1;
+	if ( *pos == 0 )
+	{
+		++*pos;
+		if ( cardinfo != NULL )
+		{	/* some cards report wrong CSD structure, capacity tells SDHC and SDXC apart */
+			SD_InfoStr( &line, "Card : " );
+			if ( !( SD_SCR_Get( cardinfo, SD_SCR_BUS_WIDTHS ) & 0x01 ) )
+				SD_InfoStr( &line, "MMC" );
+			else if ( SD_CSD_Get( cardinfo, SD_CSD_STRUCTURE ) == 0 )
+				SD_InfoStr( &line, "SDSC" );
+			else
+				SD_InfoStr( &line, ( cardinfo->CardCapacity > SD_SDHC_MAX_KB ) ? "SDXC" : "SDHC" );
+			SD_InfoStr( &line, ", " );
+			SD_InfoNum( &line, cardinfo->CardCapacity, 10, 1 );
+			SD_InfoStr( &line, " Kbytes, blocks of " );
+			SD_InfoNum( &line, cardinfo->CardBlockSize, 10, 1 );
+			SD_InfoStr( &line, " bytes" );
+			return SD_InfoEnd( &line );
+		}
+	}
+	while ( *pos <= SD_INFO_FIELDS )
+	{
+		f = &SD_InfoFields[ *pos - 1 ];
+		++*pos;
+		reg = SD_InfoRegister( cardinfo, status, f->Reg, &regsize );
+		if ( reg == NULL )
+			continue;
+		SD_InfoStr( &line, SD_InfoRegNames[ f->Reg & SD_INFO_REG ] );
+		SD_InfoStr( &line, f->Name );
+		SD_InfoStr( &line, " : " );
+		SD_InfoValue( &line, f, reg, regsize );
+		return SD_InfoEnd( &line );
+	}
+	return 0;
+}
+
+/**
+ * @brief  Prints card information to the console: lines are formatted one at a time
+ *         into the console ring buffer, nothing waits for the UART while it has room
+ * @param  cardinfo: Card information (SD_GetCardInfo), or NULL
+ * @param  status: SD status (SD_GetStatus), or NULL
+ * @retval None
+ */
+void SD_InfoPrint( const SD_CardInfo* cardinfo, const SD_Status* status )
+{
+	char line[ SD_INFO_LINE ];
+	uint16_t pos = 0;
+	uint32_t n;
+
+	while ( ( n = SD_InfoFormat( cardinfo, status, &pos, line, sizeof( line ) ) ) != 0 )
+	{
+#ifdef SERIAL_DEBUG
+		DebugComPort_Write( line, n );
+#else
+		fwrite( line, 1, n, stdout );
+#endif /* SERIAL_DEBUG */
+	}
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
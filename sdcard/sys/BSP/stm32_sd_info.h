@@ -0,0 +1,55 @@
+/**
+ ******************************************************************************
+ * @file    stm32_sd_info.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Compact formatter of SD Card registers: one table describes all
+ *          fields of CID, CSD, SCR and SD status shown to the user (field
+ *          of the raw register, name, how the value is shown), the
+ *          formatter turns one entry at a time into a text line without
+ *          printf. SD_InfoPrint passes the lines to the console ring buffer
+ *          as they are formatted. The verbose SD_DumpCardInfo/SD_DumpStatus
+ *          of the driver are left for diagnostic builds (USE_SD_DUMP).
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32_SD_INFO_H
+#define STM32_SD_INFO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "stm32_sd_spi.h"
+
+#include <stdint.h>
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+uint32_t SD_InfoFormat( const SD_CardInfo* cardinfo, const SD_Status* status, uint16_t* pos, char* buf, uint32_t size );
+void SD_InfoPrint( const SD_CardInfo* cardinfo, const SD_Status* status );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32_SD_INFO_H */
@@ -0,0 +1,1689 @@
+/**
+ ******************************************************************************
+ * @file    stm32_sd_io.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Request queue and SD I/O task in front of SD Card drivers.
+ *          The task is the only owner of the card once scheduler is running,
+ *          choice of the bus (SDIO or SPI) is made by SD_IO_INIT request.
+ *          Card that stops responding or is removed fails all requests at
+ *          once until SD_IO_INIT, which keeps cached card information and
+ *          buffered data if it finds the same card (CID) again.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "stm32_sd_io.h"
+#include "stm32_sd_spi.h"
+#include "serial_debug.h"
+#include "event_trace.h"
+#include "stm32_mem.h"
+#include "stm32_irq.h"
+#include "init_profile.h"
+#include "watchdog.h"
+#ifdef USE_SD_SDIO
+#include "stm32_sd_sdio.h"
+#endif /* USE_SD_SDIO */
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+
+#include <string.h>
+
+#if defined( SD_IO_WRITE_BUFFER_LEN ) && ( SD_IO_WRITE_BUFFER_LEN > 32 || ( SD_IO_WRITE_BUFFER_LEN & ( SD_IO_WRITE_BUFFER_LEN - 1 ) ) != 0 )
+#error SD_IO_WRITE_BUFFER_LEN has to be a power of two up to 32 sectors: windows of the write buffer stay within the smallest AU (see storage_conf.h)
+#endif
+
+#if defined( USE_SD_IO_TASK ) && !configUSE_TASK_NOTIFICATIONS
+#error SD I/O task needs configUSE_TASK_NOTIFICATIONS (see FreeRTOSConfig.h)
+#endif
+
+#ifdef USE_FAST_IO_CODE
+#pragma GCC optimize ( "O2" )
+#endif /* USE_FAST_IO_CODE */
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  Erase is split into aligned chunks of this number of sectors (power of 2, 4 Mb is
+ *         the largest AU of SDHC cards): the progress callback is called and the watchdog
+ *         is kicked after each one, BUSY of a chunk is limited by Erase Timeout of the card
+ */
+#define SD_IO_ERASE_CHUNK		8192
+
+#ifdef USE_SD_IO_TASK
+/**
+ * @brief  SD I/O task priority, it sleeps most of the time waiting for DMA completion
+ *         or card BUSY end, so it runs above application tasks (queue length, stack
+ *         and buffer sizes are in storage_conf.h)
+ */
+#define SD_IO_TASK_PRIO			( tskIDLE_PRIORITY + 2 )
+
+/**
+ * @brief  Maximum number of pending write requests merged into one batch
+ */
+#define SD_IO_BATCH_LEN			SD_IO_QUEUE_LEN
+
+/**
+ * @brief  Discarded ranges are erased if no request comes within this time (in RTOS ticks),
+ *         so ranges freed by one FatFs operation are merged first
+ */
+#define SD_IO_DISCARD_IDLE_TICKS	((portTickType)( 50 / portTICK_RATE_MS ))
+
+#ifdef USE_SD_WRITE_BUFFER
+/**
+ * @brief  Buffered data is written if no request comes within this time (in RTOS ticks)
+ */
+#define SD_IO_BUFFER_IDLE_TICKS	((portTickType)( 1000 / portTICK_RATE_MS ))
+#endif /* USE_SD_WRITE_BUFFER */
+
+#if defined( USE_SD_WRITE_STREAM ) || defined( USE_SD_READ_AHEAD )
+/**
+ * @brief  Streaming transfers are closed if no request comes within this time (in RTOS ticks)
+ */
+#define SD_IO_STREAM_IDLE_TICKS	((portTickType)( 100 / portTICK_RATE_MS ))
+#endif /* USE_SD_WRITE_STREAM || USE_SD_READ_AHEAD */
+
+#ifdef USE_SD_IO_PRIORITY
+/**
+ * @brief  Bulk reads and writes are done in batches of this number of sectors (16 Kb),
+ *         waiting interactive requests are served between them
+ */
+#define SD_IO_PREEMPT_SECTORS	32
+
+/**
+ * @brief  Bulk request at the head of the queue goes before interactive ones (and isn't
+ *         preempted) if its deadline is within this time (in RTOS ticks)
+ */
+#define SD_IO_DEADLINE_TICKS	((portTickType)( 20 / portTICK_RATE_MS ))
+
+/**
+ * @brief  Number of tasks with a class or deadline budget set by SD_IO_SetTaskClass
+ */
+#define SD_IO_TASK_CLASSES		4
+#endif /* USE_SD_IO_PRIORITY */
+#endif /* USE_SD_IO_TASK */
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Macros
+ * @{
+ */
+
+/**
+ * @brief  Nonzero if requests have to be passed to SD I/O task
+ */
+#ifdef USE_SD_IO_TASK
+#define SD_IO_RUNNING()			( SD_IO_Queue != NULL && xTaskGetSchedulerState() == taskSCHEDULER_RUNNING )
+#else
+#define SD_IO_RUNNING()			( 0 )
+#endif /* USE_SD_IO_TASK */
+
+#ifdef USE_SD_IO_PRIORITY
+/**
+ * @brief  Nonzero if interactive requests are waiting
+ */
+#define SD_IO_URGENT()			( uxQueueMessagesWaiting( SD_IO_UrgentQueue ) > 0 )
+
+/**
+ * @brief  Nonzero if the deadline of request is close (or over)
+ */
+#define SD_IO_DUE( req )		( (req)->Deadline != 0 && \
+								  (int32_t)( (req)->Deadline - xTaskGetTickCount() ) <= (int32_t)SD_IO_DEADLINE_TICKS )
+
+/**
+ * @brief  Number of requests waiting in both queues
+ */
+#define SD_IO_WAITING()			( uxQueueMessagesWaiting( SD_IO_Queue ) + uxQueueMessagesWaiting( SD_IO_UrgentQueue ) )
+#else
+#define SD_IO_URGENT()			( 0 )
+#define SD_IO_WAITING()			( uxQueueMessagesWaiting( SD_IO_Queue ) )
+#endif /* USE_SD_IO_PRIORITY */
+
+/**
+ * @}
+ *//* STM32_Private_Macros */
+
+
+/** @defgroup STM32_Private_Variables
+ * @{
+ */
+
+#ifdef USE_SD_IO_TASK
+static xQueueHandle SD_IO_Queue = NULL;	/* pointers to pending requests */
+static xStaticQueue SD_IO_QueueBuffer;
+static uint8_t SD_IO_QueueStorage[ SD_IO_QUEUE_LEN * sizeof( SD_IO_Request* ) ];
+static xTaskHandle SD_IO_TaskHandle = NULL;	/* notified after requests and discarded ranges are queued */
+static xStaticTask SD_IO_TaskBuffer;
+static portSTACK_TYPE SD_IO_TaskStack[ SD_IO_TASK_STACK ];
+static SD_IO_Request* SD_IO_Batch[ SD_IO_BATCH_LEN ];		/* write requests being served, ordered by sectors */
+static SD_BufferSegment SD_IO_Segments[ SD_IO_BATCH_LEN ];	/* buffers of adjacent write requests */
+static uint32_t SD_IO_DiscardFrom[ SD_IO_DISCARD_LEN ];	/* first sectors of discarded ranges */
+static uint32_t SD_IO_DiscardTo[ SD_IO_DISCARD_LEN ];	/* sectors following discarded ranges */
+static volatile uint8_t SD_IO_DiscardCount;			/* number of pending discarded ranges */
+static volatile uint8_t SD_IO_Serving;				/* nonzero while a request is served */
+static volatile portTickType SD_IO_LastServed;		/* time the last request was served */
+#endif /* USE_SD_IO_TASK */
+
+#ifdef USE_SD_IO_PRIORITY
+static xQueueHandle SD_IO_UrgentQueue = NULL;	/* pointers to pending interactive requests */
+static xStaticQueue SD_IO_UrgentQueueBuffer;
+static uint8_t SD_IO_UrgentQueueStorage[ SD_IO_QUEUE_LEN * sizeof( SD_IO_Request* ) ];
+static xTaskHandle SD_IO_ClassTask[ SD_IO_TASK_CLASSES ];		/* tasks with class or deadline budget */
+static uint8_t SD_IO_ClassOf[ SD_IO_TASK_CLASSES ];			/* their request class */
+static portTickType SD_IO_BudgetOf[ SD_IO_TASK_CLASSES ];		/* their deadlines relative to submission, 0 if none */
+static SD_IO_ClassStats SD_IO_Stats[ SD_IO_CLASSES ];
+#endif /* USE_SD_IO_PRIORITY */
+
+static uint32_t SD_IO_EraseUnit = 1;	/* erasable unit of the card in sectors (from CSD) */
+static uint32_t SD_IO_AuSectors;		/* Allocation Unit of the card in sectors (from SD Status), 0 if unknown */
+static uint8_t SD_IO_SpeedMBs;			/* write speed guaranteed by speed class in Mb/s (from SD Status), 0 if none */
+
+#ifdef SD_IO_READ_AHEAD_LEN
+static uint8_t SD_IO_Ahead[ SD_IO_READ_AHEAD_LEN ][ SD_BLOCK_SIZE ] MEM_DMA_BUFFER;	/* ring of prefetched sectors */
+static uint32_t SD_IO_AheadSector;	/* sector number of the oldest prefetched sector */
+static uint8_t SD_IO_AheadHead;		/* ring index of the oldest prefetched sector */
+static uint8_t SD_IO_AheadCount;	/* number of prefetched sectors */
+#endif /* SD_IO_READ_AHEAD_LEN */
+
+#ifdef SD_IO_WRITE_BUFFER_LEN
+static uint8_t SD_IO_Buffer[ SD_IO_WRITE_BUFFER_LEN ][ SD_BLOCK_SIZE ] MEM_DMA_BUFFER;	/* data of buffered window */
+static uint8_t SD_IO_BufferValid[ SD_IO_WRITE_BUFFER_LEN ];	/* nonzero for buffered sectors of the window */
+static uint32_t SD_IO_BufferBase;		/* first sector of the window */
+static uint32_t SD_IO_BufferWindow = SD_IO_WRITE_BUFFER_LEN;	/* sectors in the window (buffer size or card burst) */
+static uint32_t SD_IO_BufferCount;		/* number of buffered sectors */
+#endif /* SD_IO_WRITE_BUFFER_LEN */
+
+#ifdef USE_SD_SDIO
+static uint8_t SD_IO_sdio;				/* nonzero if card was initialized on SDIO bus */
+static uint8_t SD_IO_VerifyBlock[ SD_BLOCK_SIZE ] MEM_DMA_BUFFER;	/* sector read back by SDIO verify */
+#endif /* USE_SD_SDIO */
+
+static volatile uint8_t SD_IO_Ok;		/* nonzero while card is initialized and responds */
+static volatile uint8_t SD_IO_InfoValid;	/* nonzero if SD_IO_Info belongs to the card in the slot */
+static volatile uint32_t SD_IO_Changes;	/* incremented when card is removed or other card is initialized */
+static SD_CardInfo SD_IO_Info;			/* CSD, CID and SCR of the card, read on its first initialization */
+static SD_IO_Region* SD_IO_Regions;		/* sectors claimed by raw users */
+
+/**
+ * @}
+ *//* STM32_Private_Variables */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Initializes card: native SDIO bus is probed first (if enabled),
+ *         SPI bus is used if card doesn't respond on it
+ * @param  None
+ * @retval The SD Response
+ */
+static SD_Error SD_IO_CardInit( void )
+{
+#ifdef USE_SD_SDIO
+	SD_IO_sdio = ( SD_SDIO_Init() == SD_RESPONSE_NO_ERROR );
+	if ( SD_IO_sdio )
+		return SD_RESPONSE_NO_ERROR;
+	SD_SDIO_DeInit();
+#endif /* USE_SD_SDIO */
+	return SD_Init( &SD_Card );
+}
+
+/**
+ * @brief  Marks card as lost if it doesn't respond: following requests fail at once
+ *         (without full command retries and timeouts) until the card is initialized again
+ * @param  res: Result of card operation
+ * @retval res
+ */
+static SD_Error SD_IO_Check( SD_Error res )
+{
+	if ( res == SD_RESPONSE_FAILURE )
+		SD_IO_Ok = 0;
+	return res;
+}
+
+/**
+ * @brief  Forgets the card after it was removed: it can be another card next time
+ * @param  None
+ * @retval None
+ */
+static void SD_IO_Removed( void )
+{
+	SD_IO_Ok = 0;
+	if ( SD_IO_InfoValid )
+	{
+		SD_IO_InfoValid = 0;
+		++SD_IO_Changes;
+	}
+}
+
+/**
+ * @brief  Reads erase geometry of initialized card from cached CSD: card without single block
+ *         erase (EraseBlockEnable = 0) erases whole erase sectors containing given blocks
+ * @param  None
+ * @retval None
+ */
+static void SD_IO_EraseSetup( void )
+{
+	SD_IO_EraseUnit = 1;
+	if ( SD_IO_InfoValid && !SD_CSD_Get( &SD_IO_Info, SD_CSD_ERASE_BLK_EN ) )
+		SD_IO_EraseUnit = ( ( SD_CSD_Get( &SD_IO_Info, SD_CSD_SECTOR_SIZE ) + 1 ) <<
+				SD_CSD_Get( &SD_IO_Info, SD_CSD_WRITE_BL_LEN ) ) / SD_BLOCK_SIZE;
+	if ( SD_IO_EraseUnit == 0 )
+		SD_IO_EraseUnit = 1;
+}
+
+/**
+ * @brief  Writes consecutive sectors from several buffers on SPI bus: they are appended
+ *         to open streaming write if it expects them, otherwise new one is opened
+ *         (or one multiple block write is done if USE_SD_WRITE_STREAM isn't defined)
+ * @param  sector: First sector number
+ * @param  segments: Buffers with the data, in order of sectors
+ * @param  n: Number of buffers
+ * @retval The SD Response
+ */
+static SD_Error SD_IO_WriteSegments( uint32_t sector, const SD_BufferSegment* segments, uint8_t n )
+{
+#ifdef USE_SD_WRITE_STREAM
+	SD_Error res = SD_RESPONSE_NO_ERROR;
+	uint32_t count = 0;
+	uint8_t i;
+#endif /* USE_SD_WRITE_STREAM */
+
+#ifdef SD_IO_READ_AHEAD_LEN
+	SD_IO_AheadCount = 0;	/* prefetched data may become stale */
+#endif /* SD_IO_READ_AHEAD_LEN */
+	if ( !SD_IO_Ok )
+		return SD_RESPONSE_FAILURE;
+#ifdef USE_SD_WRITE_STREAM
+	for ( i = 0; i < n; ++i )
+		count += segments[ i ].Count;
+	SD_TransactionBegin( &SD_Card );	/* card stays selected over the stream calls */
+	if ( SD_WriteStreamNext( &SD_Card ) != sector )
+		res = SD_WriteStreamBegin( &SD_Card, sector, count );	/* at least these sectors are pre-erased */
+	for ( i = 0; i < n && res == SD_RESPONSE_NO_ERROR; ++i )
+		res = SD_WriteStreamAppend( &SD_Card, segments[ i ].Buffer, segments[ i ].Count );
+	SD_TransactionEnd( &SD_Card );
+	return SD_IO_Check( res );
+#else
+	return SD_IO_Check( SD_SectorsWriteGather( &SD_Card, sector, segments, n ) );
+#endif /* USE_SD_WRITE_STREAM */
+}
+
+#ifdef SD_IO_READ_AHEAD_LEN
+/**
+ * @brief  Reads sectors on SPI bus: prefetched sectors are taken from the ring,
+ *         the rest is read from streaming read (it is opened if it doesn't expect them)
+ * @param  sector: First sector number
+ * @param  buffer: Buffer for the data
+ * @param  count: Number of sectors
+ * @retval The SD Response
+ */
+static SD_Error SD_IO_Read( uint32_t sector, uint8_t* buffer, uint32_t count )
+{
+	SD_Error res = SD_RESPONSE_NO_ERROR;
+
+	if ( SD_IO_AheadCount > 0 && SD_IO_AheadSector != sector )
+		SD_IO_AheadCount = 0;	/* not sequential access => prefetched sectors are useless */
+	for ( ; count > 0 && SD_IO_AheadCount > 0; --count, ++sector, buffer += SD_BLOCK_SIZE )
+	{
+		memcpy( buffer, SD_IO_Ahead[ SD_IO_AheadHead ], SD_BLOCK_SIZE );
+		SD_IO_AheadHead = ( SD_IO_AheadHead + 1 ) % SD_IO_READ_AHEAD_LEN;
+		--SD_IO_AheadCount;
+		++SD_IO_AheadSector;
+	}
+	if ( count == 0 )
+		return SD_RESPONSE_NO_ERROR;
+
+	SD_TransactionBegin( &SD_Card );	/* card stays selected over the stream calls */
+	if ( SD_ReadStreamNext( &SD_Card ) != sector )
+		res = SD_ReadStreamBegin( &SD_Card, sector );
+	if ( res == SD_RESPONSE_NO_ERROR )
+		res = SD_ReadStreamRead( &SD_Card, buffer, count );
+	SD_TransactionEnd( &SD_Card );
+	SD_IO_AheadSector = sector + count;	/* ring is empty, next prefetched sector follows these ones */
+	return res;
+}
+
+/**
+ * @brief  Prefetches one sector from open streaming read into the ring
+ * @param  None
+ * @retval None
+ */
+static void SD_IO_ReadAhead( void )
+{
+	uint8_t slot = ( SD_IO_AheadHead + SD_IO_AheadCount ) % SD_IO_READ_AHEAD_LEN;
+
+	if ( SD_IO_Check( SD_ReadStreamRead( &SD_Card, SD_IO_Ahead[ slot ], 1 ) ) == SD_RESPONSE_NO_ERROR )
+		++SD_IO_AheadCount;
+	else
+		SD_IO_AheadCount = 0;	/* stream is closed on error, next read opens it again */
+}
+
+/**
+ * @brief  Nonzero if streaming read is open and there is free place in the ring
+ */
+#define SD_IO_READ_AHEAD_PENDING()	( SD_IO_Ok && SD_IO_AheadCount < SD_IO_READ_AHEAD_LEN && SD_ReadStreamNext( &SD_Card ) != SD_STREAM_CLOSED )
+#endif /* SD_IO_READ_AHEAD_LEN */
+
+/**
+ * @brief  Reads sectors by SD Card driver of the bus the card was initialized on
+ * @param  sector: First sector number
+ * @param  buffer: Buffer for the data
+ * @param  count: Number of sectors
+ * @retval The SD Response
+ */
+static SD_Error SD_IO_ReadSectors( uint32_t sector, uint8_t* buffer, uint32_t count )
+{
+	if ( !SD_IO_Ok )
+		return SD_RESPONSE_FAILURE;
+#ifdef USE_SD_SDIO
+	if ( SD_IO_sdio )
+		return SD_IO_Check( SD_SDIO_SectorsRead( sector, buffer, count ) );
+#endif /* USE_SD_SDIO */
+#ifdef SD_IO_READ_AHEAD_LEN
+	return SD_IO_Check( SD_IO_Read( sector, buffer, count ) );
+#endif /* SD_IO_READ_AHEAD_LEN */
+	if ( count == 1 )
+		return SD_IO_Check( SD_SectorRead( &SD_Card, sector, buffer ) );
+	return SD_IO_Check( SD_SectorsRead( &SD_Card, sector, buffer, count ) );
+}
+
+/**
+ * @brief  Writes sectors by SD Card driver of the bus the card was initialized on
+ * @param  sector: First sector number
+ * @param  buffer: Data to be written
+ * @param  count: Number of sectors
+ * @retval The SD Response
+ */
+static SD_Error SD_IO_WriteSectors( uint32_t sector, const uint8_t* buffer, uint32_t count )
+{
+	SD_BufferSegment segment;
+
+#ifdef USE_SD_SDIO
+	if ( SD_IO_sdio )
+		return SD_IO_Ok ? SD_IO_Check( SD_SDIO_SectorsWrite( sector, buffer, count ) ) : SD_RESPONSE_FAILURE;
+#endif /* USE_SD_SDIO */
+	segment.Buffer = buffer;
+	segment.Count = count;
+	return SD_IO_WriteSegments( sector, &segment, 1 );
+}
+
+/**
+ * @brief  Compares sectors on the card with the data written (verify after write): SPI driver
+ *         compares CRC16 of the blocks sent by the card if CRC is on, SDIO reads sectors back
+ * @param  sector: First sector number
+ * @param  buffer: Expected data
+ * @param  count: Number of sectors
+ * @retval The SD Response:
+ *         - SD_DATA_MISMATCH: Sectors hold other data
+ */
+static SD_Error SD_IO_VerifySectors( uint32_t sector, const uint8_t* buffer, uint32_t count )
+{
+#ifdef USE_SD_SDIO
+	SD_Error res = SD_RESPONSE_NO_ERROR;
+
+	if ( SD_IO_sdio )
+	{	/* SDIO checks CRC of each block in hardware, the data are compared */
+		for ( ; count > 0 && res != SD_RESPONSE_FAILURE; --count, ++sector, buffer += SD_BLOCK_SIZE )
+		{
+			if ( SD_IO_Check( SD_SDIO_SectorsRead( sector, SD_IO_VerifyBlock, 1 ) ) != SD_RESPONSE_NO_ERROR )
+				res = SD_RESPONSE_FAILURE;
+			else if ( memcmp( SD_IO_VerifyBlock, buffer, SD_BLOCK_SIZE ) != 0 )
+				res = SD_DATA_MISMATCH;
+		}
+		return res;
+	}
+#endif /* USE_SD_SDIO */
+	SD_ReadStreamEnd( &SD_Card );
+	return SD_IO_Check( SD_SectorsVerify( &SD_Card, sector, buffer, count ) );
+}
+
+/**
+ * @brief  Reads Allocation Unit size and speed class of initialized card from SD Status
+ * @param  None
+ * @retval None
+ */
+static void SD_IO_AuSetup( void )
+{
+	/* AU_Size Ah..Fh in sectors: 8, 12, 16, 24, 32 and 64 Mb */
+	static const uint32_t large[ 6 ] = { 16384, 24576, 32768, 49152, 65536, 131072 };
+	/* SPEED_CLASS 0..4: class 0, 2, 4, 6 and 10 in Mb/s */
+	static const uint8_t speed[ 5 ] = { 0, 2, 4, 6, 10 };
+	SD_Status status;
+	SD_Error res;
+
+	SD_IO_AuSectors = 0;
+	SD_IO_SpeedMBs = 0;
+#ifdef USE_SD_SDIO
+	if ( SD_IO_sdio )
+		res = SD_SDIO_GetStatus( &status );
+	else
+#endif /* USE_SD_SDIO */
+	res = SD_GetStatus( &SD_Card, &status );
+	if ( res != SD_RESPONSE_NO_ERROR )
+		return;
+	if ( status.SpeedClass < sizeof( speed ) )
+		SD_IO_SpeedMBs = speed[ status.SpeedClass ];
+	if ( status.UHS_SpeedGrade == 1 && SD_IO_SpeedMBs < 10 )	/* UHS speed grade 1 is 10 Mb/s, 3 is 30 Mb/s */
+		SD_IO_SpeedMBs = 10;
+	else if ( status.UHS_SpeedGrade == 3 )
+		SD_IO_SpeedMBs = 30;
+	if ( status.AU_Size == 0 )
+		return;
+	/* AU_Size 1h..9h is 16 Kb..4 Mb (power of two) */
+	if ( status.AU_Size < 0x0A )
+		SD_IO_AuSectors = (uint32_t)32 << ( status.AU_Size - 1 );
+	else
+		SD_IO_AuSectors = large[ ( status.AU_Size & 0x0F ) - 0x0A ];
+}
+
+#ifdef SD_IO_WRITE_BUFFER_LEN
+/**
+ * @brief  Sizes window of write-back buffer: the whole buffer is within any Allocation Unit
+ *         (16 Kb at least, bigger ones are multiples of it), so its bursts are sequential
+ *         writes within AU the card guarantees its speed class for; timing of SPI card
+ *         may ask for smaller bursts (SD_Timing.BatchSectors)
+ * @param  None
+ * @retval None
+ */
+static void SD_IO_BufferSetup( void )
+{
+	SD_IO_BufferWindow = SD_IO_WRITE_BUFFER_LEN;
+#ifdef USE_SD_SDIO
+	if ( !SD_IO_sdio )
+#endif /* USE_SD_SDIO */
+	{	/* card model may write best in smaller bursts (power of two keeps them AU-aligned) */
+		uint32_t batch = SD_Card.Timing.BatchSectors;
+		if ( batch != 0 && ( batch & ( batch - 1 ) ) == 0 && batch < SD_IO_BufferWindow )
+			SD_IO_BufferWindow = batch;
+	}
+	TRACE_INFO( "SD I/O: write buffer window %lu sectors\n", SD_IO_BufferWindow );
+}
+
+/**
+ * @brief  Writes buffered sectors to the card (runs of consecutive sectors by one transfer)
+ *         and empties the buffer, buffered data is dropped on error, but it is kept
+ *         if the card is lost (the same card may be initialized again)
+ * @param  None
+ * @retval The SD Response
+ */
+static SD_Error SD_IO_BufferFlush( void )
+{
+	SD_Error res = SD_RESPONSE_NO_ERROR;
+	SD_Error err;
+	uint32_t i = 0;
+	uint32_t j;
+
+	if ( !SD_IO_Ok )
+		return SD_RESPONSE_FAILURE;
+	while ( SD_IO_BufferCount > 0 && i < SD_IO_BufferWindow )
+	{
+		if ( !SD_IO_BufferValid[ i ] )
+		{
+			++i;
+			continue;
+		}
+		for ( j = i + 1; j < SD_IO_BufferWindow && SD_IO_BufferValid[ j ]; ++j ) {}
+		err = SD_IO_WriteSectors( SD_IO_BufferBase + i, SD_IO_Buffer[ i ], j - i );
+		if ( err != SD_RESPONSE_NO_ERROR )
+			res = err;
+		if ( !SD_IO_Ok )
+			return res;
+		i = j;
+	}
+	memset( SD_IO_BufferValid, 0, sizeof( SD_IO_BufferValid ) );
+	SD_IO_BufferCount = 0;
+	return res;
+}
+
+/**
+ * @brief  Puts sectors into write-back buffer, the buffer is flushed when the data
+ *         leaves its window and when the window is complete
+ * @param  sector: First sector number
+ * @param  buffer: Data to be written
+ * @param  count: Number of sectors
+ * @retval The SD Response (of flushes done)
+ */
+static SD_Error SD_IO_BufferWrite( uint32_t sector, const uint8_t* buffer, uint32_t count )
+{
+	SD_Error res = SD_RESPONSE_NO_ERROR;
+	SD_Error err;
+	uint32_t i;
+
+	for ( ; count > 0; --count, ++sector, buffer += SD_BLOCK_SIZE )
+	{
+		if ( sector - SD_IO_BufferBase >= SD_IO_BufferWindow )
+		{	/* sector is out of the window => write buffered data and move the window */
+			err = SD_IO_BufferFlush();
+			if ( err != SD_RESPONSE_NO_ERROR )
+				res = err;
+			if ( !SD_IO_Ok )
+				return res;		/* window is still buffered */
+			SD_IO_BufferBase = sector - sector % SD_IO_BufferWindow;
+		}
+		i = sector - SD_IO_BufferBase;
+		memcpy( SD_IO_Buffer[ i ], buffer, SD_BLOCK_SIZE );
+		if ( !SD_IO_BufferValid[ i ] )
+		{
+			SD_IO_BufferValid[ i ] = 1;
+			++SD_IO_BufferCount;
+		}
+		if ( SD_IO_BufferCount == SD_IO_BufferWindow )
+		{	/* the whole window is buffered => write it by one burst */
+			err = SD_IO_BufferFlush();
+			if ( err != SD_RESPONSE_NO_ERROR )
+				res = err;
+		}
+	}
+	return res;
+}
+
+/**
+ * @brief  Copies buffered sectors over the data read from the card (buffer is newer),
+ *         or drops them (clear != 0) when the sectors are erased
+ * @param  sector: First sector number
+ * @param  buffer: Data read from the card or NULL
+ * @param  count: Number of sectors
+ * @param  clear: Nonzero to drop buffered sectors
+ * @retval None
+ */
+static void SD_IO_BufferMerge( uint32_t sector, uint8_t* buffer, uint32_t count, uint8_t clear )
+{
+	uint32_t i;
+
+	for ( ; count > 0 && SD_IO_BufferCount > 0; --count, ++sector, buffer += SD_BLOCK_SIZE )
+	{
+		i = sector - SD_IO_BufferBase;
+		if ( i >= SD_IO_BufferWindow || !SD_IO_BufferValid[ i ] )
+			continue;
+		if ( clear )
+		{
+			SD_IO_BufferValid[ i ] = 0;
+			--SD_IO_BufferCount;
+		}
+		else
+			memcpy( buffer, SD_IO_Buffer[ i ], SD_BLOCK_SIZE );
+	}
+}
+#endif /* SD_IO_WRITE_BUFFER_LEN */
+
+/**
+ * @brief  Erases sectors by SD Card driver of the bus the card was initialized on,
+ *         in chunks of SD_IO_ERASE_CHUNK sectors
+ * @param  sector: First sector number
+ * @param  count: Number of sectors
+ * @param  req: Request to report progress of, or NULL
+ * @retval The SD Response
+ */
+static SD_Error SD_IO_EraseSectors( uint32_t sector, uint32_t count, SD_IO_Request* req )
+{
+	SD_Error res = SD_RESPONSE_NO_ERROR;
+	uint32_t done, n;
+
+	if ( !SD_IO_Ok )
+		return SD_RESPONSE_FAILURE;
+#ifdef SD_IO_READ_AHEAD_LEN
+	SD_IO_AheadCount = 0;	/* prefetched data may become stale */
+#endif /* SD_IO_READ_AHEAD_LEN */
+#ifdef SD_IO_WRITE_BUFFER_LEN
+	SD_IO_BufferMerge( sector, NULL, count, 1 );	/* erase is newer than buffered data */
+#endif /* SD_IO_WRITE_BUFFER_LEN */
+	for ( done = 0; done < count && res == SD_RESPONSE_NO_ERROR; done += n )
+	{
+		n = SD_IO_ERASE_CHUNK - ( ( sector + done ) & ( SD_IO_ERASE_CHUNK - 1 ) );
+		if ( n > count - done )
+			n = count - done;
+#ifdef USE_SD_SDIO
+		if ( SD_IO_sdio )
+			res = SD_IO_Check( SD_SDIO_SectorsErase( sector + done, sector + done + n - 1 ) );
+		else
+#endif /* USE_SD_SDIO */
+		res = SD_IO_Check( SD_SectorsErase( &SD_Card, sector + done, sector + done + n - 1 ) );
+		WATCHDOG_KICK();
+		if ( res == SD_RESPONSE_NO_ERROR && req != NULL && req->Progress != NULL )
+			req->Progress( req, done + n );
+	}
+	return res;
+}
+
+/**
+ * @brief  Erases discarded sectors: the range is shrunk to whole erasable units,
+ *         so sectors sharing erase sector with the range aren't touched
+ * @param  sector: First sector number
+ * @param  count: Number of sectors
+ * @retval The SD Response (SD_RESPONSE_NO_ERROR if there is nothing to erase)
+ */
+static SD_Error SD_IO_DiscardRange( uint32_t sector, uint32_t count )
+{
+	uint32_t from = ( sector + SD_IO_EraseUnit - 1 ) / SD_IO_EraseUnit * SD_IO_EraseUnit;
+	uint32_t to = ( sector + count ) / SD_IO_EraseUnit * SD_IO_EraseUnit;
+
+	if ( from >= to )
+		return SD_RESPONSE_NO_ERROR;
+	return SD_IO_EraseSectors( from, to - from, NULL );
+}
+
+/**
+ * @brief  Starts real-time recording (SD_IO_RECORD): pending writes go first, then speed class
+ *         control tells SPI card that recording starts (CMD20, just a hint, cards without it
+ *         record as well; SDIO driver doesn't send it)
+ * @param  rate: Recording rate in bytes per second
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Speed class of the card doesn't guarantee the rate
+ *         - SD_RESPONSE_NO_ERROR: Card keeps up with the rate
+ */
+static SD_Error SD_IO_Record( uint32_t rate )
+{
+	SD_Error res = SD_RESPONSE_NO_ERROR;
+
+#ifdef SD_IO_WRITE_BUFFER_LEN
+	res = SD_IO_BufferFlush();
+#endif /* SD_IO_WRITE_BUFFER_LEN */
+#ifdef USE_SD_SDIO
+	if ( !SD_IO_sdio )
+#endif /* USE_SD_SDIO */
+	if ( res == SD_RESPONSE_NO_ERROR )
+		SD_SpeedClassControl( &SD_Card, SD_SPEED_CLASS_START_REC );
+	if ( res == SD_RESPONSE_NO_ERROR && (uint32_t)SD_IO_SpeedMBs * 1000000 < rate )
+		res = SD_RESPONSE_FAILURE;
+	return res;
+}
+
+/**
+ * @brief  Initializes card (SD_IO_INIT). The same card found again (after it stopped
+ *         responding) keeps cached information, buffered data and pending discards,
+ *         for other card they are dropped and its information is read
+ * @param  None
+ * @retval The SD Response
+ */
+static SD_Error SD_IO_CardSetup( void )
+{
+	SD_CardInfo info;
+	SD_Error res;
+
+	SD_IO_Ok = 0;
+	res = SD_IO_CardInit();
+	if ( res != SD_RESPONSE_NO_ERROR )
+		return res;
+	/* registers are read by the driver during initialization, this is a copy */
+#ifdef USE_SD_SDIO
+	if ( SD_IO_sdio )
+		res = SD_SDIO_GetCardInfo( &info );
+	else
+#endif /* USE_SD_SDIO */
+	res = SD_GetCardInfo( &SD_Card, &info );
+	if ( res != SD_RESPONSE_NO_ERROR )
+		return res;
+	/* all CID bytes but the last one (CRC) identify the card */
+	if ( SD_IO_InfoValid && memcmp( info.CID, SD_IO_Info.CID, sizeof( info.CID ) - 1 ) == 0 )
+	{	/* the same card */
+		SD_IO_Ok = 1;
+		return SD_RESPONSE_NO_ERROR;
+	}
+
+	/* other card: buffered data and pending discards belong to the previous one */
+	SD_IO_InfoValid = 0;
+	++SD_IO_Changes;
+#ifdef SD_IO_WRITE_BUFFER_LEN
+	SD_IO_BufferMerge( SD_IO_BufferBase, NULL, SD_IO_BufferWindow, 1 );
+#endif /* SD_IO_WRITE_BUFFER_LEN */
+#ifdef USE_SD_IO_TASK
+	SD_IO_DiscardCount = 0;
+#endif /* USE_SD_IO_TASK */
+	SD_IO_Info = info;
+	SD_IO_InfoValid = 1;
+	SD_IO_Ok = 1;
+	SD_IO_EraseSetup();
+	SD_IO_AuSetup();
+#ifdef SD_IO_WRITE_BUFFER_LEN
+	SD_IO_BufferSetup();
+#endif /* SD_IO_WRITE_BUFFER_LEN */
+	return res;
+}
+
+/**
+ * @brief  Executes request by SD Card driver of the bus the card was initialized on
+ * @param  req: Request to execute
+ * @retval The SD Response
+ */
+static SD_Error SD_IO_Dispatch( SD_IO_Request* req )
+{
+	SD_Error res;
+
+#ifdef SD_IO_READ_AHEAD_LEN
+	if ( req->Op != SD_IO_READ )
+		SD_IO_AheadCount = 0;	/* prefetched data may become stale */
+#endif /* SD_IO_READ_AHEAD_LEN */
+#ifdef USE_SD_EARLY_INIT
+	if ( req->Op == SD_IO_INIT && SD_IO_Ok )
+		return SD_RESPONSE_NO_ERROR;	/* submitted while the card was identified at startup */
+#endif /* USE_SD_EARLY_INIT */
+	if ( req->Op == SD_IO_INIT )
+		return SD_IO_CardSetup();
+	if ( !SD_IO_Ok )
+		return SD_RESPONSE_FAILURE;		/* card is lost, it has to be initialized again */
+	if ( req->Op == SD_IO_SYNC )
+	{
+#ifdef SD_IO_WRITE_BUFFER_LEN
+		res = SD_IO_BufferFlush();
+#else
+		res = SD_RESPONSE_NO_ERROR;
+#endif /* SD_IO_WRITE_BUFFER_LEN */
+#ifdef USE_SD_SDIO
+		if ( SD_IO_sdio )
+			return res;
+#endif /* USE_SD_SDIO */
+		SD_ReadStreamEnd( &SD_Card );
+		if ( SD_WriteStreamEnd( &SD_Card ) != SD_RESPONSE_NO_ERROR )
+			res = SD_RESPONSE_FAILURE;
+		return res;
+	}
+	if ( req->Op == SD_IO_RECORD )
+		return SD_IO_Record( req->Count );
+	if ( req->Op == SD_IO_INFO )
+	{
+		if ( !SD_IO_InfoValid )
+			return SD_RESPONSE_FAILURE;
+		memcpy( req->Buffer, &SD_IO_Info, sizeof( SD_CardInfo ) );
+		return SD_RESPONSE_NO_ERROR;
+	}
+
+	if ( req->Count == 0 )
+		return SD_RESPONSE_FAILURE;
+
+	switch ( req->Op )
+	{
+	case SD_IO_READ:
+		res = SD_IO_ReadSectors( req->Sector, (uint8_t*)req->Buffer, req->Count );
+#ifdef SD_IO_WRITE_BUFFER_LEN
+		if ( res == SD_RESPONSE_NO_ERROR )
+			SD_IO_BufferMerge( req->Sector, (uint8_t*)req->Buffer, req->Count, 0 );
+#endif /* SD_IO_WRITE_BUFFER_LEN */
+		return res;
+	case SD_IO_WRITE:
+#ifdef SD_IO_WRITE_BUFFER_LEN
+		return SD_IO_BufferWrite( req->Sector, (const uint8_t*)req->Buffer, req->Count );
+#endif /* SD_IO_WRITE_BUFFER_LEN */
+		return SD_IO_WriteSectors( req->Sector, (const uint8_t*)req->Buffer, req->Count );
+	case SD_IO_ERASE:
+		return SD_IO_EraseSectors( req->Sector, req->Count, req );
+	case SD_IO_VERIFY:
+#ifdef SD_IO_WRITE_BUFFER_LEN
+		res = SD_IO_BufferFlush();	/* buffered sectors have to be on the card */
+		if ( res != SD_RESPONSE_NO_ERROR )
+			return res;
+#endif /* SD_IO_WRITE_BUFFER_LEN */
+		return SD_IO_VerifySectors( req->Sector, (const uint8_t*)req->Buffer, req->Count );
+	default:
+		return SD_RESPONSE_FAILURE;
+	}
+}
+
+/**
+ * @brief  Reports completion of request
+ * @param  req: Completed request
+ * @param  res: Result of request
+ * @retval None
+ */
+static void SD_IO_Complete( SD_IO_Request* req, SD_Error res )
+{
+#ifdef USE_SD_IO_PRIORITY
+	SD_IO_ClassStats* stats = &SD_IO_Stats[ req->Class < SD_IO_CLASSES ? req->Class : SD_IO_BULK ];
+	portTickType now = xTaskGetTickCount();
+
+	stats->Requests++;
+	stats->TotalTicks += now - req->Queued;
+	if ( stats->MaxTicks < now - req->Queued )
+		stats->MaxTicks = now - req->Queued;
+	if ( req->Deadline != 0 && (int32_t)( now - req->Deadline ) > 0 )
+		stats->Missed++;
+#endif /* USE_SD_IO_PRIORITY */
+	req->Result = res;
+	if ( req->Callback != NULL )
+		req->Callback( req );
+	if ( req->Done != NULL )
+		xSemaphoreGive( req->Done );
+}
+
+#ifdef USE_SD_IO_PRIORITY
+static void SD_IO_Process( SD_IO_Request* req );
+static uint8_t SD_IO_DiscardHits( uint32_t sector, uint32_t count );
+static void SD_IO_ProcessDiscards( uint8_t all );
+
+/**
+ * @brief  Serves waiting interactive requests in the middle of a bulk transfer:
+ *         open multiple block transfers are closed first (STOP_TRAN / CMD12)
+ * @param  None
+ * @retval None
+ */
+static void SD_IO_Preempt( void )
+{
+	SD_IO_Request* req;
+
+#ifdef USE_SD_SDIO
+	if ( !SD_IO_sdio )
+#endif /* USE_SD_SDIO */
+	if ( SD_IO_Ok )
+	{
+		SD_WriteStreamEnd( &SD_Card );
+		SD_ReadStreamEnd( &SD_Card );
+	}
+	while ( xQueueReceive( SD_IO_UrgentQueue, &req, 0 ) == pdTRUE )
+	{
+		if ( req->Op == SD_IO_WRITE && SD_IO_DiscardHits( req->Sector, req->Count ) )
+			SD_IO_ProcessDiscards( 1 );	/* sectors are reused => erase them before they are written */
+		SD_IO_Process( req );
+	}
+}
+
+/**
+ * @brief  Executes bulk read or write in batches of SD_IO_PREEMPT_SECTORS sectors,
+ *         waiting interactive requests are served between the batches unless
+ *         the deadline of the bulk request is due
+ * @param  req: Request to execute
+ * @retval The SD Response
+ */
+static SD_Error SD_IO_DispatchBatches( SD_IO_Request* req )
+{
+	SD_IO_Request part = *req;
+	SD_Error res = SD_RESPONSE_NO_ERROR;
+	uint32_t left = req->Count;
+
+	while ( left > 0 && res == SD_RESPONSE_NO_ERROR )
+	{
+		part.Count = ( left < SD_IO_PREEMPT_SECTORS ) ? left : SD_IO_PREEMPT_SECTORS;
+		res = SD_IO_Dispatch( &part );
+		left -= part.Count;
+		part.Sector += part.Count;
+		part.Buffer = (uint8_t*)part.Buffer + part.Count * SD_BLOCK_SIZE;
+		if ( left > 0 && SD_IO_URGENT() && !SD_IO_DUE( req ) )
+		{
+			SD_IO_Stats[ SD_IO_BULK ].Preempted++;
+			SD_IO_Preempt();
+		}
+	}
+	return res;
+}
+#endif /* USE_SD_IO_PRIORITY */
+
+/**
+ * @brief  Executes request and reports its completion
+ * @param  req: Request to execute
+ * @retval None
+ */
+static void SD_IO_Process( SD_IO_Request* req )
+{
+	SD_Error res;
+
+	TRACE_EVENT( EVT_IO_BEGIN, req->Sector, req->Op | ( req->Count << 8 ) );
+#ifdef USE_SD_IO_PRIORITY
+	if ( req->Class == SD_IO_BULK && ( req->Op == SD_IO_READ || req->Op == SD_IO_WRITE ) && SD_IO_RUNNING() )
+		res = SD_IO_DispatchBatches( req );
+	else
+#endif /* USE_SD_IO_PRIORITY */
+	res = SD_IO_Dispatch( req );
+	TRACE_EVENT( EVT_IO_END, req->Sector, res );
+	SD_IO_Complete( req, res );
+}
+
+#ifdef USE_SD_IO_TASK
+/**
+ * @brief  Checks if write request overlaps any request of the batch
+ * @param  req: Write request
+ * @param  n: Number of requests in the batch
+ * @retval Nonzero if sectors of requests overlap
+ */
+static uint8_t SD_IO_Overlaps( const SD_IO_Request* req, uint8_t n )
+{
+	while ( n-- > 0 )
+	{
+		if ( req->Sector < SD_IO_Batch[ n ]->Sector + SD_IO_Batch[ n ]->Count &&
+			 SD_IO_Batch[ n ]->Sector < req->Sector + req->Count )
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * @brief  Takes write requests following the given one from the queue (up to the first
+ *         request of other kind or overlapping one) and orders them by sector numbers
+ * @param  req: Write request just taken from the queue
+ * @retval Number of requests in the batch
+ */
+static uint8_t SD_IO_CollectWrites( SD_IO_Request* req )
+{
+	SD_IO_Request* next;
+	uint8_t n = 0;
+	uint8_t i;
+
+	SD_IO_Batch[ n++ ] = req;
+	while ( n < SD_IO_BATCH_LEN && xQueuePeek( SD_IO_Queue, &next, 0 ) == pdTRUE )
+	{	/* later writes to the same sectors have to stay after earlier ones */
+		if ( next == NULL || next->Op != SD_IO_WRITE || next->Count == 0 || SD_IO_Overlaps( next, n ) || SD_IO_URGENT() )
+			break;
+		xQueueReceive( SD_IO_Queue, &next, 0 );
+		/* insertion sort: batch is always ordered by sector numbers (elevator order) */
+		for ( i = n++; i > 0 && SD_IO_Batch[ i - 1 ]->Sector > next->Sector; --i )
+			SD_IO_Batch[ i ] = SD_IO_Batch[ i - 1 ];
+		SD_IO_Batch[ i ] = next;
+	}
+	return n;
+}
+
+/**
+ * @brief  Executes batch of write requests: requests to adjacent sectors are merged
+ *         into one multiple block write (SPI bus only, SDIO writes them one by one)
+ * @param  n: Number of requests in the batch
+ * @retval None
+ */
+static void SD_IO_ProcessWrites( uint8_t n )
+{
+	SD_Error res;
+	uint8_t i = 0;
+	uint8_t j, k;
+
+	while ( i < n )
+	{
+		for ( j = i + 1; j < n && SD_IO_Batch[ j ]->Sector == SD_IO_Batch[ j - 1 ]->Sector + SD_IO_Batch[ j - 1 ]->Count; ++j ) {}
+#ifdef USE_SD_SDIO
+		if ( SD_IO_sdio )
+			j = i + 1;
+#endif /* USE_SD_SDIO */
+#ifdef SD_IO_WRITE_BUFFER_LEN
+		j = i + 1;	/* write-back buffer merges them */
+#endif /* SD_IO_WRITE_BUFFER_LEN */
+		if ( j - i == 1 )
+			SD_IO_Process( SD_IO_Batch[ i ] );
+		else
+		{
+			for ( k = i; k < j; ++k )
+			{
+				SD_IO_Segments[ k - i ].Buffer = (const uint8_t*)SD_IO_Batch[ k ]->Buffer;
+				SD_IO_Segments[ k - i ].Count = SD_IO_Batch[ k ]->Count;
+			}
+			TRACE_EVENT( EVT_IO_BEGIN, SD_IO_Batch[ i ]->Sector,
+				SD_IO_WRITE | ( ( SD_IO_Batch[ j - 1 ]->Sector + SD_IO_Batch[ j - 1 ]->Count - SD_IO_Batch[ i ]->Sector ) << 8 ) );
+			res = SD_IO_WriteSegments( SD_IO_Batch[ i ]->Sector, SD_IO_Segments, j - i );
+			TRACE_EVENT( EVT_IO_END, SD_IO_Batch[ i ]->Sector, res );
+			for ( k = i; k < j; ++k )
+				SD_IO_Complete( SD_IO_Batch[ k ], res );
+		}
+		i = j;
+#ifdef USE_SD_IO_PRIORITY
+		if ( i < n && SD_IO_URGENT() && !SD_IO_DUE( SD_IO_Batch[ i ] ) )
+		{	/* the batch is ordered by sectors already, interactive requests don't join it */
+			SD_IO_Stats[ SD_IO_BULK ].Preempted++;
+			SD_IO_Preempt();
+		}
+#endif /* USE_SD_IO_PRIORITY */
+	}
+}
+
+/**
+ * @brief  Checks if sectors overlap pending discarded range
+ * @param  sector: First sector number
+ * @param  count: Number of sectors
+ * @retval Nonzero if sectors overlap
+ */
+static uint8_t SD_IO_DiscardHits( uint32_t sector, uint32_t count )
+{
+	uint8_t i;
+
+	for ( i = 0; i < SD_IO_DiscardCount; ++i )
+	{
+		if ( sector < SD_IO_DiscardTo[ i ] && SD_IO_DiscardFrom[ i ] < sector + count )
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * @brief  Checks if any write request of the batch overlaps pending discarded range
+ * @param  n: Number of requests in the batch
+ * @retval Nonzero if sectors overlap
+ */
+static uint8_t SD_IO_DiscardOverlaps( uint8_t n )
+{
+	while ( n-- > 0 )
+	{
+		if ( SD_IO_DiscardHits( SD_IO_Batch[ n ]->Sector, SD_IO_Batch[ n ]->Count ) )
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * @brief  Erases pending discarded ranges by chunks of SD_IO_ERASE_CHUNK sectors
+ * @param  all: Nonzero to erase all of them, zero to stop when a request is waiting
+ *         (erase of a large range is done between the requests)
+ * @retval None
+ */
+static void SD_IO_ProcessDiscards( uint8_t all )
+{
+	uint32_t from, n;
+
+	while ( SD_IO_DiscardCount > 0 && ( all || SD_IO_WAITING() == 0 ) )
+	{
+		taskENTER_CRITICAL();
+		from = SD_IO_DiscardFrom[ SD_IO_DiscardCount - 1 ];
+		n = SD_IO_ERASE_CHUNK - ( from & ( SD_IO_ERASE_CHUNK - 1 ) );
+		if ( n < SD_IO_DiscardTo[ SD_IO_DiscardCount - 1 ] - from )
+			SD_IO_DiscardFrom[ SD_IO_DiscardCount - 1 ] = from + n;
+		else
+			n = SD_IO_DiscardTo[ --SD_IO_DiscardCount ] - from;
+		taskEXIT_CRITICAL();
+		SD_IO_DiscardRange( from, n );
+	}
+}
+
+/**
+ * @brief  Takes a queued request without waiting: interactive ones go first,
+ *         unless the deadline of the bulk request at the head of the queue is due
+ * @param  req: Receives the request
+ * @retval Nonzero if a request was taken
+ */
+static uint8_t SD_IO_Take( SD_IO_Request** req )
+{
+#ifdef USE_SD_IO_PRIORITY
+	SD_IO_Request* head;
+
+	if ( !( xQueuePeek( SD_IO_Queue, &head, 0 ) == pdTRUE && SD_IO_DUE( head ) ) &&
+		 xQueueReceive( SD_IO_UrgentQueue, req, 0 ) == pdTRUE )
+		return 1;
+#endif /* USE_SD_IO_PRIORITY */
+	return ( xQueueReceive( SD_IO_Queue, req, 0 ) == pdTRUE );
+}
+
+/**
+ * @brief  Takes the next request: interactive ones go first, unless the deadline
+ *         of the bulk request at the head of the queue is due
+ * @param  req: Receives the request (NULL if the task was only woken up)
+ * @param  timeout: Maximum time to wait for a request (in RTOS ticks)
+ * @retval pdTRUE if a request was taken or the task was woken up
+ */
+static portBASE_TYPE SD_IO_Receive( SD_IO_Request** req, portTickType timeout )
+{
+	/* queues are looked at before sleeping: a notification taken by a DMA wait
+	   is not lost, and a stale one only makes the task look at them again */
+	if ( SD_IO_Take( req ) )
+		return pdTRUE;
+	if ( ulTaskNotifyTake( pdTRUE, timeout ) == 0 )
+		return pdFALSE;
+	if ( !SD_IO_Take( req ) )
+		*req = NULL;		/* woken up by SD_IO_Discard */
+	return pdTRUE;
+}
+
+/**
+ * @brief  SD I/O task: services queued requests in order of their submission,
+ *         except consecutive write requests which are served in order of sectors;
+ *         sectors following sequential reads are prefetched while the queue is empty;
+ *         with USE_SD_IO_PRIORITY interactive requests go before bulk ones
+ * @param  pvParameters not used
+ * @retval None
+ */
+static void SD_IO_Task( void* pvParameters )
+{
+	SD_IO_Request* req;
+	uint8_t n;
+
+#ifdef USE_SD_EARLY_INIT
+	/* identify the card while other tasks start, the first mount finds it ready */
+	if ( SD_Detect( &SD_Card ) == SD_PRESENT )
+	{
+		INIT_MARK( "SD card identification" );
+		if ( SD_IO_CardSetup() == SD_RESPONSE_NO_ERROR )
+			INIT_MARK( "SD card ready" );
+		else
+			INIT_MARK( "SD card failed" );
+	}
+#endif /* USE_SD_EARLY_INIT */
+
+	while ( 1 )
+	{
+		if ( SD_IO_Ok && SD_IO_DiscardCount > 0 )
+		{	/* card is idle => erase discarded sectors, so they are written fast later */
+			if ( SD_IO_Receive( &req, SD_IO_DISCARD_IDLE_TICKS ) != pdTRUE )
+			{
+				SD_IO_ProcessDiscards( 0 );
+				continue;
+			}
+		}
+		else
+#ifdef SD_IO_READ_AHEAD_LEN
+		if ( SD_IO_READ_AHEAD_PENDING() )
+		{	/* requests go first, sectors are prefetched one by one between them */
+			if ( SD_IO_Receive( &req, 0 ) != pdTRUE )
+			{
+				SD_IO_ReadAhead();
+				continue;
+			}
+		}
+		else
+#endif /* SD_IO_READ_AHEAD_LEN */
+#ifdef SD_IO_STREAM_IDLE_TICKS
+		if ( SD_IO_Ok && ( SD_WriteStreamNext( &SD_Card ) != SD_STREAM_CLOSED || SD_ReadStreamNext( &SD_Card ) != SD_STREAM_CLOSED ) )
+		{	/* card is idle => close streaming transfers, so the data doesn't wait in the card */
+			if ( SD_IO_Receive( &req, SD_IO_STREAM_IDLE_TICKS ) != pdTRUE )
+			{
+				SD_WriteStreamEnd( &SD_Card );
+				SD_ReadStreamEnd( &SD_Card );
+				continue;
+			}
+		}
+		else
+#endif /* SD_IO_STREAM_IDLE_TICKS */
+#ifdef SD_IO_WRITE_BUFFER_LEN
+		if ( SD_IO_Ok && SD_IO_BufferCount > 0 )
+		{	/* card is idle => write buffered data, so it isn't kept in RAM for long */
+			if ( SD_IO_Receive( &req, SD_IO_BUFFER_IDLE_TICKS ) != pdTRUE )
+			{
+				SD_IO_BufferFlush();
+				continue;
+			}
+		}
+		else
+#endif /* SD_IO_WRITE_BUFFER_LEN */
+		if ( SD_IO_Receive( &req, portMAX_DELAY ) != pdTRUE )
+			continue;
+		if ( req == NULL )
+			continue;		/* wake up by SD_IO_Discard */
+		SD_IO_Serving = 1;
+		if ( req->Op == SD_IO_WRITE && req->Count > 0 )
+		{
+			n = SD_IO_CollectWrites( req );
+			if ( SD_IO_DiscardOverlaps( n ) )
+				SD_IO_ProcessDiscards( 1 );	/* sectors are reused => erase them before they are written */
+			SD_IO_ProcessWrites( n );
+		}
+		else
+			SD_IO_Process( req );
+		SD_IO_LastServed = xTaskGetTickCount();
+		SD_IO_Serving = 0;
+	}
+}
+#endif /* USE_SD_IO_TASK */
+
+/**
+ * @brief  Checks ownership of sectors to be written or erased: sectors of a claimed region
+ *         are written only by requests of the region, which don't write outside of it
+ * @param  sector: First sector number
+ * @param  count: Number of sectors
+ * @param  region: Region of the writer, NULL if it doesn't own sectors
+ * @retval Nonzero if the writer may change the sectors
+ */
+static uint8_t SD_IO_Permitted( uint32_t sector, uint32_t count, const SD_IO_Region* region )
+{
+	const SD_IO_Region* r;
+	uint8_t running = ( xTaskGetSchedulerState() == taskSCHEDULER_RUNNING );
+	uint8_t ok = 1;
+
+	if ( region != NULL )
+		return ( sector >= region->Sector && count <= region->Count && sector - region->Sector <= region->Count - count );
+	if ( running )
+		taskENTER_CRITICAL();
+	for ( r = SD_IO_Regions; r != NULL && ok; r = r->Next )
+		ok = ( sector + count <= r->Sector || r->Sector + r->Count <= sector );
+	if ( running )
+		taskEXIT_CRITICAL();
+	return ok;
+}
+
+/**
+ * @brief  Passes request to SD I/O task or executes it immediately
+ * @param  req: Request
+ * @param  timeout: Maximum time to wait for free place in the queue (in RTOS ticks)
+ * @retval SD_RESPONSE_NO_ERROR if request was accepted (or executed), SD_RESPONSE_FAILURE if queue is full
+ */
+static SD_Error SD_IO_Enqueue( SD_IO_Request* req, portTickType timeout )
+{
+	if ( req->Done != NULL )
+		xSemaphoreTake( req->Done, 0 );	/* forget previous completion of this request */
+	req->Queued = xTaskGetTickCount();
+
+	if ( ( req->Op == SD_IO_WRITE || req->Op == SD_IO_ERASE ) &&
+			!SD_IO_Permitted( req->Sector, req->Count, req->Region ) )
+	{	/* completed at once: the submitter sees the error where it looks for results */
+		SD_IO_Complete( req, SD_ADDRESS_ERROR );
+		return SD_RESPONSE_NO_ERROR;
+	}
+	if ( !SD_IO_RUNNING() )
+	{
+		SD_IO_Process( req );
+		return SD_RESPONSE_NO_ERROR;
+	}
+#ifdef USE_SD_IO_PRIORITY
+	if ( req->Class == SD_IO_INTERACTIVE )
+	{
+		if ( xQueueSend( SD_IO_UrgentQueue, &req, timeout ) != pdTRUE )
+			return SD_RESPONSE_FAILURE;
+		xTaskNotifyGive( SD_IO_TaskHandle );	/* SD I/O task may sleep on empty queues */
+		return SD_RESPONSE_NO_ERROR;
+	}
+#endif /* USE_SD_IO_PRIORITY */
+#ifdef USE_SD_IO_TASK
+	if ( xQueueSend( SD_IO_Queue, &req, timeout ) != pdTRUE )
+		return SD_RESPONSE_FAILURE;
+	xTaskNotifyGive( SD_IO_TaskHandle );
+#endif /* USE_SD_IO_TASK */
+	return SD_RESPONSE_NO_ERROR;
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+#ifdef USE_SD_IO_TASK
+/**
+ * @brief  Creates request queue and SD I/O task (in static memory, not the heap),
+ *         has to be called before scheduler is started
+ * @param  None
+ * @retval None
+ */
+void SD_IO_Init( void )
+{
+	if ( SD_IO_Queue != NULL )
+		return;
+	SD_IO_Queue = xQueueCreateStatic( SD_IO_QUEUE_LEN, sizeof( SD_IO_Request* ), SD_IO_QueueStorage, &SD_IO_QueueBuffer );
+#ifdef USE_SD_IO_PRIORITY
+	SD_IO_UrgentQueue = xQueueCreateStatic( SD_IO_QUEUE_LEN, sizeof( SD_IO_Request* ), SD_IO_UrgentQueueStorage, &SD_IO_UrgentQueueBuffer );
+#endif /* USE_SD_IO_PRIORITY */
+	xTaskCreateStatic( SD_IO_Task, (const signed char* const)"SDIO", SD_IO_TASK_STACK, NULL, SD_IO_TASK_PRIO, &SD_IO_TaskHandle, SD_IO_TaskStack, &SD_IO_TaskBuffer );
+}
+
+/**
+ * @brief  Time SD I/O task has had no request to serve, e.g. for background work
+ *         which should only use the card while the application doesn't
+ * @param  None
+ * @retval Ticks since the last request was served, 0 while requests are pending
+ */
+portTickType SD_IO_IdleTime( void )
+{
+	if ( SD_IO_Queue == NULL || SD_IO_Serving || SD_IO_WAITING() > 0 )
+		return 0;
+	return xTaskGetTickCount() - SD_IO_LastServed;
+}
+
+/**
+ * @brief  Number of requests submitted and not taken by SD I/O task yet (for statistics)
+ * @param  None
+ * @retval Requests waiting in the queues, the one being served isn't counted
+ */
+uint32_t SD_IO_QueueDepth( void )
+{
+	if ( SD_IO_Queue == NULL )
+		return 0;
+	return SD_IO_WAITING();
+}
+#endif /* USE_SD_IO_TASK */
+
+#ifdef USE_SD_IO_PRIORITY
+/**
+ * @brief  Sets class of requests the task submits through FatFs (diskio calls SD_IO_Classify),
+ *         e.g. SD_IO_INTERACTIVE for user interface, or the deadline budget of real-time capture
+ * @param  task: Task, NULL for the calling task
+ * @param  cls: Request class
+ * @param  budget: Time requests have to complete within (in RTOS ticks), 0 if no deadline;
+ *         SD_IO_BULK without budget removes the task from the table
+ * @retval None
+ */
+void SD_IO_SetTaskClass( xTaskHandle task, SD_IO_Class cls, portTickType budget )
+{
+	uint8_t i, slot = SD_IO_TASK_CLASSES;
+
+	if ( task == NULL )
+		task = xTaskGetCurrentTaskHandle();
+	taskENTER_CRITICAL();
+	for ( i = 0; i < SD_IO_TASK_CLASSES; ++i )
+	{
+		if ( SD_IO_ClassTask[ i ] == task || ( SD_IO_ClassTask[ i ] == NULL && slot == SD_IO_TASK_CLASSES ) )
+			slot = i;
+		if ( SD_IO_ClassTask[ i ] == task )
+			break;
+	}
+	if ( slot < SD_IO_TASK_CLASSES )
+	{
+		SD_IO_ClassTask[ slot ] = ( cls == SD_IO_BULK && budget == 0 ) ? NULL : task;
+		SD_IO_ClassOf[ slot ] = cls;
+		SD_IO_BudgetOf[ slot ] = budget;
+	}
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief  Sets class and deadline of request by the calling task (see SD_IO_SetTaskClass)
+ * @param  req: Request to be submitted
+ * @retval None
+ */
+void SD_IO_Classify( SD_IO_Request* req )
+{
+	xTaskHandle task = xTaskGetCurrentTaskHandle();
+	uint8_t i;
+
+	req->Class = SD_IO_BULK;
+	req->Deadline = 0;
+	for ( i = 0; i < SD_IO_TASK_CLASSES; ++i )
+	{
+		if ( SD_IO_ClassTask[ i ] == task )
+		{
+			req->Class = SD_IO_ClassOf[ i ];
+			if ( SD_IO_BudgetOf[ i ] != 0 )
+				req->Deadline = ( xTaskGetTickCount() + SD_IO_BudgetOf[ i ] ) | 1;	/* 0 means no deadline */
+			break;
+		}
+	}
+}
+
+/**
+ * @brief  Gets latency statistics of request class
+ * @param  cls: Request class
+ * @param  stats: Receives the statistics
+ * @retval None
+ */
+void SD_IO_GetClassStats( SD_IO_Class cls, SD_IO_ClassStats* stats )
+{
+	taskENTER_CRITICAL();
+	*stats = SD_IO_Stats[ cls ];
+	taskEXIT_CRITICAL();
+}
+#endif /* USE_SD_IO_PRIORITY */
+
+/**
+ * @brief  Checks if card is in the slot, removal found here or by card detect interrupt
+ *         fails all requests at once until the card is initialized again
+ * @param  None
+ * @retval SD_PRESENT or SD_NOT_PRESENT
+ */
+uint8_t SD_IO_Detect( void )
+{
+	if ( SD_Detect( &SD_Card ) == SD_PRESENT )
+		return SD_PRESENT;
+	SD_IO_Removed();
+	return SD_NOT_PRESENT;
+}
+
+/**
+ * @brief  Checks if card is initialized and responds (SD_IO_INIT is needed otherwise)
+ * @param  None
+ * @retval Nonzero if card is ready
+ */
+uint8_t SD_IO_Ready( void )
+{
+	return SD_IO_Ok;
+}
+
+/**
+ * @brief  Counter of card changes: it is incremented when card is removed and when
+ *         SD_IO_INIT finds other card, so data cached from the card (e.g. mounted
+ *         file system) are valid while the counter stays the same
+ * @param  None
+ * @retval Counter value
+ */
+uint32_t SD_IO_CardChanges( void )
+{
+	return SD_IO_Changes;
+}
+
+/**
+ * @brief  Allocation Unit of the card, read on its initialization: the erase block
+ *         file system structures are aligned to (see GET_BLOCK_SIZE of diskio)
+ * @param  None
+ * @retval AU size in sectors, 0 if it is unknown
+ */
+uint32_t SD_IO_AuSize( void )
+{
+	return SD_IO_AuSectors;
+}
+
+/**
+ * @brief  Write speed the card guarantees for sequential writes within free AUs,
+ *         read on its initialization (speed class or UHS speed grade of SD Status)
+ * @param  None
+ * @retval Speed in Mb/s (millions of bytes), 0 if the card has no speed class
+ */
+uint8_t SD_IO_SpeedClass( void )
+{
+	return SD_IO_SpeedMBs;
+}
+
+#ifdef USE_SD_DETECT_EXTI
+/**
+ * @brief  Configures card detect pin and its EXTI line (both edges), so card removal
+ *         is seen at once (see SD_IO_DetectIRQHandler)
+ * @param  None
+ * @retval None
+ */
+void SD_IO_DetectInit( void )
+{
+	GPIO_InitTypeDef GPIO_InitStructure;
+	EXTI_InitTypeDef EXTI_InitStructure;
+
+	SD_DETECT_GPIO_CLK_INIT( SD_DETECT_GPIO_CLK, ENABLE );
+	RCC_APB2PeriphClockCmd( RCC_APB2Periph_SYSCFG, ENABLE );
+
+	/* card detect switch closes to ground when card is in the slot */
+	GPIO_InitStructure.GPIO_Pin = SD_DETECT_PIN;
+	GPIO_InitStructure.GPIO_Mode = GPIO_Mode_IN;
+	GPIO_InitStructure.GPIO_PuPd = GPIO_PuPd_UP;
+	GPIO_Init( SD_DETECT_GPIO_PORT, &GPIO_InitStructure );
+
+	SYSCFG_EXTILineConfig( SD_DETECT_EXTI_PORT_SOURCE, SD_DETECT_EXTI_PIN_SOURCE );
+	EXTI_InitStructure.EXTI_Line = SD_DETECT_EXTI_LINE;
+	EXTI_InitStructure.EXTI_Mode = EXTI_Mode_Interrupt;
+	EXTI_InitStructure.EXTI_Trigger = EXTI_Trigger_Rising_Falling;
+	EXTI_InitStructure.EXTI_LineCmd = ENABLE;
+	EXTI_Init( &EXTI_InitStructure );
+
+	IRQ_Enable( SD_DETECT_EXTI_IRQn, IRQ_PRIO_EXTI );	/* shared with buttons on EXTI15_10 */
+}
+
+/**
+ * @brief  Handles card detect interrupt: removed card is forgotten at once, inserted
+ *         card is initialized by the next SD_IO_INIT (FatFs mounts the volume again)
+ * @param  None
+ * @retval None
+ */
+void SD_IO_DetectIRQHandler( void )
+{
+	if ( SD_Detect( &SD_Card ) == SD_NOT_PRESENT )
+		SD_IO_Removed();	/* contact bounce only repeats it */
+}
+#endif /* USE_SD_DETECT_EXTI */
+
+/**
+ * @brief  Clears request and creates its completion semaphore (held in the request),
+ *         has to be called once for every request object used with SD_IO_Wait/SD_IO_Execute
+ * @param  req: Request
+ * @retval None
+ */
+void SD_IO_RequestInit( SD_IO_Request* req )
+{
+	memset( req, 0, sizeof( SD_IO_Request ) );
+	vSemaphoreCreateBinaryStatic( req->Done, &req->DoneBuffer );
+	if ( req->Done != NULL )
+		xSemaphoreTake( req->Done, 0 );	/* semaphore is created 'given' */
+}
+
+/**
+ * @brief  Submits request without waiting, completion is reported by req->Callback and/or req->Done
+ * @param  req: Request, it is owned by SD I/O task until it is completed
+ * @retval SD_RESPONSE_NO_ERROR if request was accepted, SD_RESPONSE_FAILURE if queue is full
+ */
+SD_Error SD_IO_Submit( SD_IO_Request* req )
+{
+	return SD_IO_Enqueue( req, 0 );
+}
+
+/**
+ * @brief  Discards sectors which don't hold data anymore: they are erased later, when SD I/O task
+ *         is idle (adjacent ranges are merged), so following writes to them run at full speed.
+ *         Only whole erasable units of the range are erased.
+ * @param  sector: First sector number
+ * @param  count: Number of sectors
+ * @retval SD_RESPONSE_NO_ERROR if range was accepted (or erased), SD_RESPONSE_FAILURE if too many ranges are pending,
+ *         SD_ADDRESS_ERROR if the range overlaps a claimed region
+ */
+SD_Error SD_IO_Discard( uint32_t sector, uint32_t count )
+{
+#ifdef USE_SD_IO_TASK
+	SD_Error res = SD_RESPONSE_NO_ERROR;
+	uint8_t first = 0;
+	uint8_t i;
+
+	if ( count == 0 )
+		return SD_RESPONSE_FAILURE;
+	if ( !SD_IO_Permitted( sector, count, NULL ) )
+		return SD_ADDRESS_ERROR;
+	if ( !SD_IO_RUNNING() )
+		return SD_IO_DiscardRange( sector, count );
+
+	taskENTER_CRITICAL();
+	for ( i = 0; i < SD_IO_DiscardCount; ++i )
+	{	/* merge with adjacent or overlapping range */
+		if ( sector <= SD_IO_DiscardTo[ i ] && SD_IO_DiscardFrom[ i ] <= sector + count )
+			break;
+	}
+	if ( i < SD_IO_DiscardCount )
+	{
+		if ( SD_IO_DiscardFrom[ i ] > sector )
+			SD_IO_DiscardFrom[ i ] = sector;
+		if ( SD_IO_DiscardTo[ i ] < sector + count )
+			SD_IO_DiscardTo[ i ] = sector + count;
+	}
+	else if ( SD_IO_DiscardCount < SD_IO_DISCARD_LEN )
+	{
+		first = ( SD_IO_DiscardCount == 0 );
+		SD_IO_DiscardFrom[ SD_IO_DiscardCount ] = sector;
+		SD_IO_DiscardTo[ SD_IO_DiscardCount ] = sector + count;
+		++SD_IO_DiscardCount;
+	}
+	else
+		res = SD_RESPONSE_FAILURE;
+	taskEXIT_CRITICAL();
+
+	if ( first )	/* SD I/O task may sleep on empty queues */
+		xTaskNotifyGive( SD_IO_TaskHandle );
+	return res;
+#else
+	if ( count == 0 )
+		return SD_RESPONSE_FAILURE;
+	if ( !SD_IO_Permitted( sector, count, NULL ) )
+		return SD_ADDRESS_ERROR;
+	return SD_IO_DiscardRange( sector, count );
+#endif /* USE_SD_IO_TASK */
+}
+
+/**
+ * @brief  Claims sectors for a raw user: from now on they are written and erased only
+ *         by requests with Region set to this region (and discards don't reach them).
+ *         Pending writes of others to the sectors (e.g. dirty sectors of diskio cache)
+ *         have to be finished before, and their cached copies dropped after the raw
+ *         user has written them (f_invalidate).
+ * @param  region: Region object, owned by SD I/O until SD_IO_Release
+ * @param  sector: First sector number
+ * @param  count: Number of sectors
+ * @retval SD_RESPONSE_NO_ERROR if the region is claimed, SD_ADDRESS_ERROR if it overlaps
+ *         another claimed region or is empty
+ */
+SD_Error SD_IO_Claim( SD_IO_Region* region, uint32_t sector, uint32_t count )
+{
+	const SD_IO_Region* r;
+	SD_Error res = SD_RESPONSE_NO_ERROR;
+
+	if ( count == 0 )
+		return SD_ADDRESS_ERROR;
+	/* a claimed region is read by SD I/O task, so it is only changed when it isn't linked */
+	taskENTER_CRITICAL();
+	for ( r = SD_IO_Regions; r != NULL && res == SD_RESPONSE_NO_ERROR; r = r->Next )
+	{
+		if ( r == region || ( sector < r->Sector + r->Count && r->Sector < sector + count ) )
+			res = SD_ADDRESS_ERROR;
+	}
+	if ( res == SD_RESPONSE_NO_ERROR )
+	{
+		region->Sector = sector;
+		region->Count = count;
+		region->Next = SD_IO_Regions;
+		SD_IO_Regions = region;
+	}
+	taskEXIT_CRITICAL();
+	return res;
+}
+
+/**
+ * @brief  Releases claimed sectors, requests of the region still pending are checked already
+ * @param  region: Claimed region (releasing a region which isn't claimed does nothing)
+ * @retval None
+ */
+void SD_IO_Release( SD_IO_Region* region )
+{
+	SD_IO_Region** r;
+
+	taskENTER_CRITICAL();
+	for ( r = &SD_IO_Regions; *r != NULL; r = &(*r)->Next )
+	{
+		if ( *r == region )
+		{
+			*r = region->Next;
+			break;
+		}
+	}
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief  Waits for completion of previously submitted request
+ * @param  req: Request initialized by SD_IO_RequestInit
+ * @param  timeout: Maximum time to wait (in RTOS ticks)
+ * @retval Result of request, SD_RESPONSE_FAILURE on timeout
+ */
+SD_Error SD_IO_Wait( SD_IO_Request* req, portTickType timeout )
+{
+	if ( req->Done == NULL || xSemaphoreTake( req->Done, timeout ) != pdTRUE )
+		return SD_RESPONSE_FAILURE;
+	return req->Result;
+}
+
+/**
+ * @brief  Executes request and waits for its completion (blocking equivalent of SD_IO_Submit)
+ * @param  req: Request initialized by SD_IO_RequestInit
+ * @retval Result of request
+ */
+SD_Error SD_IO_Execute( SD_IO_Request* req )
+{
+	SD_Error res = SD_IO_Enqueue( req, portMAX_DELAY );
+	if ( res != SD_RESPONSE_NO_ERROR )
+		return res;
+	return SD_IO_Wait( req, portMAX_DELAY );
+}
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
@@ -0,0 +1,186 @@
+/**
+ ******************************************************************************
+ * @file    stm32_sd_io.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Request queue in front of SD Card drivers (SPI or SDIO bus).
+ *          Dedicated SD I/O task owns the card (SD_Card on SPI bus) and services read/write/erase
+ *          requests one by one, so producers can submit a buffer and keep
+ *          working. Completion is reported by callback (called in SD I/O
+ *          task context) and/or by binary semaphore of the request.
+ *          If USE_SD_IO_TASK is not defined or scheduler is not running yet,
+ *          requests are executed directly in caller's context.
+ *          Card that stops responding or is removed fails requests at once
+ *          until SD_IO_INIT, see SD_IO_Ready and SD_IO_CardChanges.
+ *          With USE_SD_IO_PRIORITY interactive requests overtake bulk ones
+ *          (the submitters of both classes must not depend on the order of
+ *          their requests to the same sectors), see SD_IO_SetTaskClass.
+ *          Raw users own their sectors by SD_IO_Claim: writes and erases of
+ *          a claimed region are accepted only from requests of the region,
+ *          which in turn stay inside it, so raw data and FatFs volumes can
+ *          share the card (cached copies are dropped by f_invalidate).
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32_SD_IO_H
+#define STM32_SD_IO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "stm32_sd_spi.h"
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Types
+ * @{
+ */
+
+/**
+ * @brief  SD I/O request operations
+ */
+typedef enum
+{
+	SD_IO_INIT		= 0,	/*!< Initialize card (SDIO bus is probed first if enabled), no parameters */
+	SD_IO_READ		= 1,	/*!< Read Count sectors from Sector to Buffer */
+	SD_IO_WRITE		= 2,	/*!< Write Count sectors from Buffer to Sector */
+	SD_IO_ERASE		= 3,	/*!< Erase Count sectors starting from Sector */
+	SD_IO_INFO		= 4,	/*!< Get card information, Buffer points to SD_CardInfo structure */
+	SD_IO_SYNC		= 5,	/*!< Finish pending writes (close streaming write), no parameters */
+	SD_IO_VERIFY	= 6,	/*!< Compare Count sectors from Sector with Buffer (pending writes go first),
+								 SD_DATA_MISMATCH if they differ */
+	SD_IO_RECORD	= 7		/*!< Start real-time recording at Count bytes/s (speed class control),
+								 SD_RESPONSE_FAILURE if speed class of the card is lower */
+} SD_IO_Op;
+
+/**
+ * @brief  SD I/O request classes (USE_SD_IO_PRIORITY)
+ */
+typedef enum
+{
+	SD_IO_BULK			= 0,	/*!< Served in order of submission (default) */
+	SD_IO_INTERACTIVE	= 1		/*!< Served before bulk requests, preempts long bulk transfers */
+} SD_IO_Class;
+
+#define SD_IO_CLASSES	2
+
+/**
+ * @brief  Latency statistics of a request class (USE_SD_IO_PRIORITY), in RTOS ticks
+ *         from submission to completion
+ */
+typedef struct
+{
+	uint32_t	Requests;		/*!< Requests completed */
+	uint32_t	TotalTicks;		/*!< Sum of latencies */
+	uint32_t	MaxTicks;		/*!< Longest latency */
+	uint32_t	Missed;			/*!< Requests completed after their deadline */
+	uint32_t	Preempted;		/*!< Transfers interrupted by interactive requests */
+} SD_IO_ClassStats;
+
+typedef struct _SD_IO_Request SD_IO_Request;
+
+/**
+ * @brief  Sectors owned by a raw user (see SD_IO_Claim), has to stay valid until it is released
+ */
+typedef struct _SD_IO_Region
+{
+	uint32_t				Sector;		/*!< First sector number */
+	uint32_t				Count;		/*!< Number of sectors */
+	struct _SD_IO_Region*	Next;		/*!< Next claimed region, managed by SD I/O */
+} SD_IO_Region;
+
+/**
+ * @brief  Completion callback, called in SD I/O task context
+ */
+typedef void ( *SD_IO_Callback )( SD_IO_Request* req );
+
+/**
+ * @brief  Progress callback of long operations (SD_IO_ERASE is done in chunks), called
+ *         in SD I/O task context after each chunk with the number of sectors done so far
+ */
+typedef void ( *SD_IO_Progress )( SD_IO_Request* req, uint32_t done );
+
+/**
+ * @brief  SD I/O request, has to stay valid until it is completed
+ */
+struct _SD_IO_Request
+{
+	SD_IO_Op			Op;			/*!< Operation */
+	uint32_t			Sector;		/*!< First sector number */
+	uint32_t			Count;		/*!< Number of sectors */
+	void*				Buffer;		/*!< Data buffer (Count * SD_BLOCK_SIZE bytes) */
+	SD_IO_Callback		Callback;	/*!< Completion callback or NULL */
+	void*				Context;	/*!< Parameter for callback, not used by SD I/O task */
+	xSemaphoreHandle	Done;		/*!< Given on completion if not NULL (see SD_IO_RequestInit) */
+	volatile SD_Error	Result;		/*!< Result of operation, valid after completion */
+	SD_IO_Progress		Progress;	/*!< Progress callback or NULL */
+	uint8_t				Class;		/*!< SD_IO_Class (USE_SD_IO_PRIORITY, see SD_IO_Classify) */
+	portTickType		Deadline;	/*!< Tick count to complete by, 0 if none (USE_SD_IO_PRIORITY) */
+	portTickType		Queued;		/*!< Tick count of submission, set by SD I/O */
+	SD_IO_Region*		Region;		/*!< Claimed region the request writes to, NULL for unowned sectors */
+	xStaticSemaphore	DoneBuffer;	/*!< Memory of Done semaphore */
+};
+
+/**
+ * @}
+ *//* STM32_Exported_Types */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+#ifdef USE_SD_IO_TASK
+void SD_IO_Init( void );
+portTickType SD_IO_IdleTime( void );
+uint32_t SD_IO_QueueDepth( void );
+#endif /* USE_SD_IO_TASK */
+#ifdef USE_SD_IO_PRIORITY
+void SD_IO_SetTaskClass( xTaskHandle task, SD_IO_Class cls, portTickType budget );
+void SD_IO_Classify( SD_IO_Request* req );
+void SD_IO_GetClassStats( SD_IO_Class cls, SD_IO_ClassStats* stats );
+#endif /* USE_SD_IO_PRIORITY */
+
+void SD_IO_RequestInit( SD_IO_Request* req );
+SD_Error SD_IO_Submit( SD_IO_Request* req );
+SD_Error SD_IO_Wait( SD_IO_Request* req, portTickType timeout );
+SD_Error SD_IO_Execute( SD_IO_Request* req );
+SD_Error SD_IO_Discard( uint32_t sector, uint32_t count );
+SD_Error SD_IO_Claim( SD_IO_Region* region, uint32_t sector, uint32_t count );
+void SD_IO_Release( SD_IO_Region* region );
+
+uint8_t SD_IO_Detect( void );
+uint8_t SD_IO_Ready( void );
+uint32_t SD_IO_CardChanges( void );
+uint32_t SD_IO_AuSize( void );
+uint8_t SD_IO_SpeedClass( void );
+#ifdef USE_SD_DETECT_EXTI
+void SD_IO_DetectInit( void );
+void SD_IO_DetectIRQHandler( void );
+#endif /* USE_SD_DETECT_EXTI */
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32_SD_IO_H */
@@ -0,0 +1,389 @@
+/**
+ ******************************************************************************
+ * @file    stm32_sd_pipe.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Multiple buffered pipeline to consecutive sectors of the card.
+ *          Buffers are used round robin: each one is written by its own
+ *          SD I/O request, whose completion callback (in SD I/O task
+ *          context) frees the buffer and records write latency and errors.
+ *          Without SD I/O task the writes run in producer's context and the
+ *          pipe works as a single buffer.
+ *          The latency histogram is filled by the callback and evaluated by
+ *          the producer when a window is over, so buffers are borrowed and
+ *          returned only in producer's context.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "stm32_sd_pipe.h"
+#include "stm32_pool.h"
+
+#include <stddef.h>
+
+/* Scheduler */
+#include "task.h"
+#include "semphr.h"
+
+#if POOL_BLOCK_SIZE != SD_BLOCK_SIZE
+#error SD pipe buffers are single blocks of the pool, POOL_BLOCK_SIZE has to be the sector size
+#endif
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  A block is borrowed when 99.9th percentile of latency exceeds 3/4 of the time
+ *         the buffers last, one is returned when it stays below 1/4 of it
+ */
+#define SD_PIPE_GROW( p, cap )		( (p) * 4 >= (cap) * 3 )
+#define SD_PIPE_CALM( p, cap )		( (p) * 4 < (cap) )
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Completion callback of buffer writes (SD I/O task context)
+ * @param  req: Write request of the buffer
+ * @retval None
+ */
+static void SD_PIPE_Done( SD_IO_Request* req )
+{
+	SD_PIPE_Slot* slot = (SD_PIPE_Slot*)req;
+	SD_Pipe* pipe = (SD_Pipe*)req->Context;
+	portTickType latency = xTaskGetTickCount() - slot->Submitted;
+	uint8_t b = 0;
+
+	if ( latency > pipe->MaxLatency )
+		pipe->MaxLatency = latency;
+	while ( b < SD_PIPE_HIST_BUCKETS - 1 && ( latency >> b ) != 0 )
+		++b;
+	pipe->Hist[ b ]++;
+	if ( req->Result != SD_RESPONSE_NO_ERROR && pipe->Error == SD_RESPONSE_NO_ERROR )
+		pipe->Error = req->Result;
+	slot->Busy = 0;
+}
+
+/**
+ * @brief  Returns buffers of the pipe to the pool
+ * @param  pipe: Pipe object
+ * @retval None
+ */
+static void SD_PIPE_FreeBuffers( SD_Pipe* pipe )
+{
+	uint8_t i;
+
+	for ( i = 0; i < SD_PIPE_DEPTH_MAX; ++i )
+	{
+		POOL_Free( pipe->Slot[ i ].Req.Buffer );
+		pipe->Slot[ i ].Req.Buffer = NULL;
+	}
+}
+
+/**
+ * @brief  Borrows another buffer from the pool, it becomes the next one for the producer
+ * @param  pipe: Pipe object
+ * @retval Nonzero if the buffer was added
+ */
+static uint8_t SD_PIPE_Grow( SD_Pipe* pipe )
+{
+	SD_PIPE_Slot* slot = &pipe->Slot[ pipe->Depth ];
+
+	if ( pipe->Depth >= SD_PIPE_DEPTH_MAX || pipe->Filling )
+		return 0;
+	if ( slot->Req.Done == NULL )
+		SD_IO_RequestInit( &slot->Req );
+	if ( slot->Req.Done == NULL || ( slot->Req.Buffer = POOL_Alloc() ) == NULL )
+		return 0;
+	slot->Req.Callback = SD_PIPE_Done;
+	slot->Req.Context = pipe;
+	slot->Req.Region = &pipe->Region;
+	slot->Busy = 0;
+	/* order of the buffers doesn't matter: each one gets its sector when it is submitted */
+	pipe->Next = pipe->Depth++;
+	++pipe->Borrowed;
+	return 1;
+}
+
+/**
+ * @brief  Returns the last borrowed buffer to the pool if it is free and not the next one
+ * @param  pipe: Pipe object
+ * @retval None
+ */
+static void SD_PIPE_Shrink( SD_Pipe* pipe )
+{
+	SD_PIPE_Slot* slot = &pipe->Slot[ pipe->Depth - 1 ];
+
+	if ( pipe->Depth <= pipe->BaseDepth || slot->Busy || pipe->Next == pipe->Depth - 1 )
+		return;
+	POOL_Free( slot->Req.Buffer );
+	slot->Req.Buffer = NULL;
+	--pipe->Depth;
+}
+
+/**
+ * @brief  Latency bound of the percentile from the histogram
+ * @param  hist: Histogram of the window
+ * @param  total: Number of writes in the histogram
+ * @param  permille: Percentile in 1/1000
+ * @retval Upper bound of the bucket holding the percentile, in ticks
+ */
+static portTickType SD_PIPE_Percentile( const uint16_t* hist, uint32_t total, uint32_t permille )
+{
+	uint32_t sum = 0;
+	uint8_t b;
+
+	for ( b = 0; b < SD_PIPE_HIST_BUCKETS - 1; ++b )
+	{
+		sum += hist[ b ];
+		if ( sum * 1000 >= total * permille )
+			break;
+	}
+	return ( (portTickType)1 << b ) - 1;
+}
+
+/**
+ * @brief  Ends the latency window: percentiles of write latency are compared with the time
+ *         the buffers last at the producer rate, blocks are borrowed, returned or data shed
+ * @param  pipe: Pipe object
+ * @param  now: Tick count
+ * @retval None
+ */
+static void SD_PIPE_Window( SD_Pipe* pipe, portTickType now )
+{
+	uint16_t hist[ SD_PIPE_HIST_BUCKETS ];
+	uint32_t total = 0;
+	uint8_t b;
+
+	taskENTER_CRITICAL();	/* the callback adds latencies in SD I/O task */
+	for ( b = 0; b < SD_PIPE_HIST_BUCKETS; ++b )
+	{
+		hist[ b ] = pipe->Hist[ b ];
+		pipe->Hist[ b ] = 0;
+		total += hist[ b ];
+	}
+	taskEXIT_CRITICAL();
+
+	if ( total > 0 && pipe->WindowPuts > 0 )
+	{
+		pipe->P99 = SD_PIPE_Percentile( hist, total, 990 );
+		pipe->P999 = SD_PIPE_Percentile( hist, total, 999 );
+		pipe->Capacity = pipe->Depth * ( now - pipe->WindowStart ) / pipe->WindowPuts;
+		if ( SD_PIPE_GROW( pipe->P999, pipe->Capacity ) )
+			pipe->Shedding = !SD_PIPE_Grow( pipe );
+		else if ( SD_PIPE_CALM( pipe->P999, pipe->Capacity ) )
+		{
+			pipe->Shedding = 0;
+			SD_PIPE_Shrink( pipe );
+		}
+	}
+	pipe->WindowStart = now;
+	pipe->WindowPuts = 0;
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Opens the pipe: takes its buffers from the block pool and clears the report
+ * @param  pipe: Pipe object
+ * @param  sector: First sector of the range written by the pipe
+ * @param  count: Number of sectors in the range
+ * @param  depth: Number of buffers (2 .. SD_PIPE_DEPTH_MAX, 1 works as a single buffer)
+ * @retval SD_RESPONSE_FAILURE if parameters are invalid or the pool has too few free blocks,
+ *         SD_ADDRESS_ERROR if the range overlaps sectors claimed by another raw user
+ */
+SD_Error SD_PIPE_Open( SD_Pipe* pipe, uint32_t sector, uint32_t count, uint8_t depth )
+{
+	uint8_t i;
+
+	if ( depth == 0 || depth > SD_PIPE_DEPTH_MAX || count == 0 )
+		return SD_RESPONSE_FAILURE;
+	for ( i = 0; i < depth; ++i )
+	{
+		SD_PIPE_Slot* slot = &pipe->Slot[ i ];
+
+		if ( slot->Req.Done == NULL )
+			SD_IO_RequestInit( &slot->Req );
+		slot->Req.Buffer = POOL_Alloc();
+		if ( slot->Req.Done == NULL || slot->Req.Buffer == NULL )
+		{
+			SD_PIPE_FreeBuffers( pipe );
+			return SD_RESPONSE_FAILURE;
+		}
+		slot->Req.Callback = SD_PIPE_Done;
+		slot->Req.Context = pipe;
+		slot->Req.Region = &pipe->Region;
+		slot->Busy = 0;
+	}
+	if ( SD_IO_Claim( &pipe->Region, sector, count ) != SD_RESPONSE_NO_ERROR )
+	{
+		SD_PIPE_FreeBuffers( pipe );
+		return SD_ADDRESS_ERROR;
+	}
+	pipe->Sector = sector;
+	pipe->End = sector + count;
+	pipe->Depth = depth;
+	pipe->Next = 0;
+	pipe->Filling = 0;
+	pipe->Error = SD_RESPONSE_NO_ERROR;
+	pipe->Written = pipe->Stalls = pipe->Overruns = 0;
+	pipe->MaxInFlight = 0;
+	pipe->MaxLatency = 0;
+	pipe->BaseDepth = depth;
+	pipe->Shedding = 0;
+	for ( i = 0; i < SD_PIPE_HIST_BUCKETS; ++i )
+		pipe->Hist[ i ] = 0;
+	pipe->WindowStart = xTaskGetTickCount();
+	pipe->WindowPuts = 0;
+	pipe->P99 = pipe->P999 = pipe->Capacity = 0;
+	pipe->Borrowed = pipe->Shed = 0;
+	return SD_RESPONSE_NO_ERROR;
+}
+
+/**
+ * @brief  Gets the next buffer for the producer, waits if all buffers are in flight
+ *         and no block can be borrowed from the pool
+ * @param  pipe: Pipe object
+ * @param  timeout: Maximum time to wait for a free buffer (in RTOS ticks), 0 for producers
+ *         which can't wait (data are dropped); waiting is counted in Stalls, failure in Overruns
+ * @retval Buffer of SD_BLOCK_SIZE bytes, NULL on overrun or if the range of the pipe is full
+ */
+void* SD_PIPE_Get( SD_Pipe* pipe, portTickType timeout )
+{
+	SD_PIPE_Slot* slot = &pipe->Slot[ pipe->Next ];
+
+	if ( pipe->Filling )
+		return slot->Req.Buffer;
+	if ( pipe->Sector >= pipe->End )
+		return NULL;
+	if ( slot->Busy && SD_PIPE_Grow( pipe ) )
+		slot = &pipe->Slot[ pipe->Next ];	/* the card stalls => buffer it instead of waiting */
+	if ( slot->Busy )
+	{
+		++pipe->Stalls;
+		/* completion semaphore may be left given by the previous write => check Busy again */
+		while ( slot->Busy && xSemaphoreTake( slot->Req.Done, timeout ) == pdTRUE ) {}
+		if ( slot->Busy )
+		{
+			++pipe->Overruns;
+			return NULL;
+		}
+	}
+	pipe->Filling = 1;
+	return slot->Req.Buffer;
+}
+
+/**
+ * @brief  Gets the next buffer for low priority data: refused without waiting while the pipe
+ *         can't borrow blocks for latency spikes, so the card keeps up with the other data
+ * @param  pipe: Pipe object
+ * @retval Buffer of SD_BLOCK_SIZE bytes, NULL if the data has to be dropped
+ */
+void* SD_PIPE_GetLow( SD_Pipe* pipe )
+{
+	if ( pipe->Shedding && !pipe->Filling )
+	{
+		++pipe->Shed;
+		return NULL;
+	}
+	return SD_PIPE_Get( pipe, 0 );
+}
+
+/**
+ * @brief  Submits the buffer filled by the producer to the next sector of the range
+ * @param  pipe: Pipe object
+ * @retval First error of the writes completed so far (the buffer isn't written after an error),
+ *         SD_RESPONSE_FAILURE if no buffer was taken by SD_PIPE_Get
+ */
+SD_Error SD_PIPE_Put( SD_Pipe* pipe )
+{
+	SD_PIPE_Slot* slot = &pipe->Slot[ pipe->Next ];
+	portTickType now;
+	uint8_t i, n = 0;
+
+	if ( !pipe->Filling )
+		return SD_RESPONSE_FAILURE;
+	pipe->Filling = 0;
+	if ( pipe->Error != SD_RESPONSE_NO_ERROR )
+		return pipe->Error;
+
+	slot->Req.Op = SD_IO_WRITE;
+	slot->Req.Sector = pipe->Sector++;
+	slot->Req.Count = 1;
+	slot->Submitted = xTaskGetTickCount();
+	slot->Busy = 1;		/* before submission: the write may complete before it returns */
+	while ( SD_IO_Submit( &slot->Req ) != SD_RESPONSE_NO_ERROR )
+		vTaskDelay( 1 );
+	++pipe->Written;
+	++pipe->WindowPuts;
+	pipe->Next = ( pipe->Next + 1 ) % pipe->Depth;
+
+	for ( i = 0; i < pipe->Depth; ++i )
+		n += pipe->Slot[ i ].Busy;
+	if ( n > pipe->MaxInFlight )
+		pipe->MaxInFlight = n;
+
+	now = xTaskGetTickCount();
+	if ( now - pipe->WindowStart >= SD_PIPE_WINDOW_TICKS )
+		SD_PIPE_Window( pipe, now );
+	return pipe->Error;
+}
+
+/**
+ * @brief  Closes the pipe: waits for buffers in flight, finishes the streaming write,
+ *         returns the buffers to the pool (buffer held by the producer is dropped)
+ *         and releases the range
+ * @param  pipe: Pipe object
+ * @retval First error of the writes
+ */
+SD_Error SD_PIPE_Close( SD_Pipe* pipe )
+{
+	SD_IO_Request* req = &pipe->Slot[ 0 ].Req;
+	SD_Error res;
+	uint8_t i;
+
+	for ( i = 0; i < pipe->Depth; ++i )
+	{
+		while ( pipe->Slot[ i ].Busy )
+			xSemaphoreTake( pipe->Slot[ i ].Req.Done, portMAX_DELAY );
+	}
+	pipe->Filling = 0;
+
+	req->Op = SD_IO_SYNC;
+	req->Callback = NULL;
+	res = SD_IO_Execute( req );
+	if ( res != SD_RESPONSE_NO_ERROR && pipe->Error == SD_RESPONSE_NO_ERROR )
+		pipe->Error = res;
+	SD_PIPE_FreeBuffers( pipe );
+	SD_IO_Release( &pipe->Region );
+	return pipe->Error;
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
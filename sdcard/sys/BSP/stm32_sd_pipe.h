@@ -0,0 +1,148 @@
+/**
+ ******************************************************************************
+ * @file    stm32_sd_pipe.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Multiple buffered pipeline from a data producer to consecutive
+ *          sectors of the card. The pipe owns Depth sector buffers of the
+ *          block pool: the producer fills one of them while the others are
+ *          written by SD I/O task, which keeps one streaming write (CMD25)
+ *          open for consecutive sectors, so the card is busy all the time.
+ *          When the card stalls longer than the buffers last (busy waits
+ *          of the card after an AU is completed), the producer finds no
+ *          free buffer: it is counted as a stall, and as an overrun if the
+ *          buffer didn't come free within the timeout of SD_PIPE_Get,
+ *          then the producer drops its data instead of blocking.
+ *          Write latency is watched over windows of SD_PIPE_WINDOW_TICKS:
+ *          when its 99.9th percentile comes near to the time the buffers
+ *          last at the producer rate, or the producer stalls, the pipe
+ *          borrows another block from the pool (up to SD_PIPE_DEPTH_MAX);
+ *          with no block to borrow it sheds low priority data (producers
+ *          of such data use SD_PIPE_GetLow). Borrowed blocks are returned
+ *          one per calm window and on SD_PIPE_Close.
+ *          The range of the pipe is claimed in SD I/O while the pipe is open.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32_SD_PIPE_H
+#define STM32_SD_PIPE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "stm32_sd_io.h"
+
+/* Scheduler */
+#include "FreeRTOS.h"
+
+#include <stdint.h>
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Constants
+ * @{
+ */
+
+/**
+ * @brief  Maximum number of buffers of a pipe, including the borrowed ones (up to POOL_BLOCKS
+ *         in total), each slot takes 56 bytes in the pipe object
+ */
+#ifndef SD_PIPE_DEPTH_MAX
+#define SD_PIPE_DEPTH_MAX		8
+#endif /* SD_PIPE_DEPTH_MAX */
+
+/**
+ * @brief  Length of latency windows in RTOS ticks, number of latency histogram buckets
+ *         (bucket b counts writes of 2^(b-1) .. 2^b - 1 ticks, the last one all longer writes)
+ */
+#define SD_PIPE_WINDOW_TICKS	((portTickType)( 1000 / portTICK_RATE_MS ))
+#define SD_PIPE_HIST_BUCKETS	12
+
+/**
+ * @}
+ *//* STM32_Exported_Constants */
+
+/** @defgroup STM32_Exported_Types
+ * @{
+ */
+
+/**
+ * @brief  Buffer of the pipe with its write request
+ */
+typedef struct
+{
+	SD_IO_Request		Req;			/*!< Write request of the buffer (has to be the first field) */
+	volatile uint8_t	Busy;			/*!< Nonzero while the request is in flight */
+	portTickType		Submitted;		/*!< Tick count when the request was submitted */
+} SD_PIPE_Slot;
+
+/**
+ * @brief  Pipe object, zero it before the first SD_PIPE_Open (requests are created once)
+ */
+typedef struct
+{
+	uint32_t			Sector;			/*!< Sector written by the next buffer */
+	uint32_t			End;			/*!< Sector following the range of the pipe */
+	uint8_t				Depth;			/*!< Number of buffers */
+	uint8_t				Next;			/*!< Buffer returned by the next SD_PIPE_Get */
+	uint8_t				Filling;		/*!< Nonzero while the producer holds buffer Next */
+	volatile uint8_t	InFlight;		/*!< Number of buffers being written */
+	volatile SD_Error	Error;			/*!< First error of completed writes */
+	SD_PIPE_Slot		Slot[ SD_PIPE_DEPTH_MAX ];	/*!< Buffers */
+	SD_IO_Region		Region;			/*!< Range of the pipe, claimed until SD_PIPE_Close */
+
+	/* backpressure report */
+	uint32_t			Written;		/*!< Number of sectors submitted */
+	uint32_t			Stalls;			/*!< SD_PIPE_Get found all buffers in flight */
+	uint32_t			Overruns;		/*!< ... and no buffer came free within its timeout */
+	uint8_t				MaxInFlight;	/*!< Most buffers in flight at once */
+	volatile portTickType	MaxLatency;	/*!< Longest write of one buffer (submission to completion) in ticks */
+
+	/* latency monitor */
+	uint8_t				BaseDepth;		/*!< Depth given to SD_PIPE_Open, buffers above it are borrowed */
+	volatile uint8_t	Shedding;		/*!< Nonzero while SD_PIPE_GetLow drops low priority data */
+	volatile uint16_t	Hist[ SD_PIPE_HIST_BUCKETS ];	/*!< Latencies of the current window */
+	portTickType		WindowStart;	/*!< Tick count the current window started at */
+	uint32_t			WindowPuts;		/*!< Buffers submitted in the current window */
+	portTickType		P99;			/*!< 99th percentile of latency in the last window (bucket bound, ticks) */
+	portTickType		P999;			/*!< 99.9th percentile of latency in the last window */
+	portTickType		Capacity;		/*!< Time the buffers lasted at the producer rate in the last window */
+	uint32_t			Borrowed;		/*!< Blocks borrowed from the pool so far */
+	uint32_t			Shed;			/*!< Buffers refused by SD_PIPE_GetLow */
+} SD_Pipe;
+
+/**
+ * @}
+ *//* STM32_Exported_Types */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+SD_Error SD_PIPE_Open( SD_Pipe* pipe, uint32_t sector, uint32_t count, uint8_t depth );
+void* SD_PIPE_Get( SD_Pipe* pipe, portTickType timeout );
+void* SD_PIPE_GetLow( SD_Pipe* pipe );
+SD_Error SD_PIPE_Put( SD_Pipe* pipe );
+SD_Error SD_PIPE_Close( SD_Pipe* pipe );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32_SD_PIPE_H */
@@ -0,0 +1,967 @@
+/******************************************************************************
+ * @file    stm32_sd_sdio.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   High-level communication layer for read/write SD Card mounted on SDIO bus.
+ *
++--------------------------------------------------------------+
+|                     Pin assignment                           |
++-------------------------+---------------+-------------+------+
+|  STM32 SDIO Pins        |     SD        |    Pin      | uCos |
++-------------------------+---------------+-------------+------+
+| SD_SDIO_D3_PIN          |   Data 3      |    1        | PC11 |
+| SD_SDIO_CMD_PIN         |   Cmd/Reply   |    2        | PD2  |
+|                         |   GND         |    3 (0 V)  |      |
+|                         |   VDD         |    4 (3.3 V)|      |
+| SD_SDIO_CK_PIN          |   Clock       |    5        | PC12 |
+|                         |   GND         |    6 (0 V)  |      |
+| SD_SDIO_D0_PIN          |   Data 0      |    7        | PC8  |
+| SD_SDIO_D1_PIN          |   Data 1      |    8        | PC9  |
+| SD_SDIO_D2_PIN          |   Data 2      |    9        | PC10 |
++-------------------------+---------------+-------------+------+
+ *
+ * SDIOCLK is 48MHz (PLL48CLK), card is initialized at 400KHz and then works
+ * at 24MHz (default speed) or 48MHz (High Speed mode, if card supports it).
+ * Only SD cards are supported here (legacy MMC cards are handled by SPI driver).
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "stm32_sd_sdio.h"
+#include "serial_debug.h"
+#include "stm32_irq.h"
+#include "power.h"
+#include "watchdog.h"
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#include <string.h>
+
+#ifdef USE_SD_SDIO
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+
+/** @defgroup STM32_Private_Types
+ * @{
+ */
+
+/**
+ * @brief  Commands used in SD mode (see stm32_sd_spi.c for command classes)
+ */
+typedef enum _SD_SDIO_CMD
+{
+	SD_SDIO_CMD_GO_IDLE_STATE		=  0, /*!< CMD0,  no response */
+	SD_SDIO_CMD_ALL_SEND_CID		=  2, /*!< CMD2,  R2 */
+	SD_SDIO_CMD_SEND_RELATIVE_ADDR	=  3, /*!< CMD3,  R6 */
+	SD_SDIO_CMD_SWITCH_FUNC			=  6, /*!< CMD6,  R1 + 64 bytes of data */
+	SD_SDIO_CMD_SELECT_CARD			=  7, /*!< CMD7,  R1b */
+	SD_SDIO_CMD_SEND_IF_COND		=  8, /*!< CMD8,  R7 */
+	SD_SDIO_CMD_SEND_CSD			=  9, /*!< CMD9,  R2 */
+	SD_SDIO_CMD_STOP_TRANSMISSION	= 12, /*!< CMD12, R1b */
+	SD_SDIO_CMD_SEND_STATUS			= 13, /*!< CMD13, R1 */
+	SD_SDIO_CMD_SET_BLOCKLEN		= 16, /*!< CMD16, R1 */
+	SD_SDIO_CMD_READ_SINGLE_BLOCK	= 17, /*!< CMD17, R1 */
+	SD_SDIO_CMD_READ_MULT_BLOCK		= 18, /*!< CMD18, R1 */
+	SD_SDIO_CMD_WRITE_SINGLE_BLOCK	= 24, /*!< CMD24, R1 */
+	SD_SDIO_CMD_WRITE_MULT_BLOCK	= 25, /*!< CMD25, R1 */
+	SD_SDIO_CMD_ERASE_BLOCK_START	= 32, /*!< CMD32, R1 */
+	SD_SDIO_CMD_ERASE_BLOCK_END		= 33, /*!< CMD33, R1 */
+	SD_SDIO_CMD_ERASE				= 38, /*!< CMD38, R1b */
+	SD_SDIO_CMD_APP_CMD				= 55, /*!< CMD55, R1 */
+	SD_SDIO_CMD_SET_BUS_WIDTH		=  6, /*!< ACMD6,  R1 */
+	SD_SDIO_CMD_SD_STATUS			= 13, /*!< ACMD13, R1 + 64 bytes of data */
+	SD_SDIO_CMD_SD_SEND_OP_COND		= 41, /*!< ACMD41, R3 */
+	SD_SDIO_CMD_SEND_SCR			= 51  /*!< ACMD51, R1 + 8 bytes of data */
+} SD_SDIO_CMD;
+
+/**
+ * @}
+ *//* STM32_Private_Types */
+
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  Switch card to High Speed mode (48MHz) if it supports it
+ */
+#define SD_SDIO_HIGH_SPEED
+
+/**
+ * @brief  Maximum number of polls of SDIO status register until command is sent
+ */
+#define SD_SDIO_NUM_TRIES_CMD		((uint32_t)0x00010000)
+
+/**
+ * @brief  Number of card status polls at full speed before the waiting task goes to sleep
+ */
+#define SD_SDIO_NUM_TRIES_FAST		((uint32_t)16)
+
+/**
+ * @brief  Maximum time (in milliseconds) until ACMD41 initializes SD card
+ */
+#define SD_SDIO_TIMEOUT_INIT_MS		((uint32_t)1000)
+
+/**
+ * @brief  Maximum time (in milliseconds) to transfer data blocks
+ */
+#define SD_SDIO_TIMEOUT_DATA_MS		((uint32_t)500)
+
+/**
+ * @brief  Maximum time (in milliseconds) until SD card writes data
+ */
+#define SD_SDIO_TIMEOUT_WRITE_MS	((uint32_t)500)
+
+/**
+ * @brief  Maximum time (in milliseconds) until SD card erases data
+ */
+#define SD_SDIO_TIMEOUT_ERASE_MS	((uint32_t)5000)
+
+/**
+ * @brief  Data timeout of SDIO peripheral (in card bus clock periods),
+ *         real timeout is controlled by SD_SDIO_TIMEOUT_DATA_MS
+ */
+#define SD_SDIO_DATATIMEOUT			((uint32_t)0xFFFFFFFF)
+
+/**
+ * @brief  Card status (R1 response) bits
+ */
+#define SD_SDIO_R1_ERRORS			((uint32_t)0xFDFFE008)	/*!< all error bits */
+#define SD_SDIO_R1_ADDRESS_ERRORS	((uint32_t)0xC0000000)	/*!< OUT_OF_RANGE and ADDRESS_ERROR */
+#define SD_SDIO_R1_READY_FOR_DATA	((uint32_t)0x00000100)
+#define SD_SDIO_R1_STATE( r1 )		( ( (r1) >> 9 ) & 0x0F )
+#define SD_SDIO_STATE_TRAN			4
+#define SD_SDIO_R6_ERRORS			((uint32_t)0x0000E000)	/*!< COM_CRC_ERROR, ILLEGAL_COMMAND, ERROR */
+
+/**
+ * @brief  OCR register bits and ACMD41/CMD8 arguments
+ */
+#define SD_SDIO_OCR_BUSY			((uint32_t)0x80000000)	/*!< card power up status bit (0 - busy) */
+#define SD_SDIO_OCR_HCS				((uint32_t)0x40000000)	/*!< card capacity status (high capacity) */
+#define SD_SDIO_OCR_VOLTAGE			((uint32_t)0x00FF8000)	/*!< 2.7-3.6V */
+#define SD_SDIO_CHECK_PATTERN		((uint32_t)0x000001AA)	/*!< 2.7-3.6V, check pattern 0xAA */
+#define SD_SDIO_WIDE_BUS			((uint32_t)0x00000002)	/*!< ACMD6 argument for 4-bit bus */
+#define SD_SDIO_SWITCH_HIGH_SPEED	((uint32_t)0x80FFFFF1)	/*!< CMD6: set access mode to High Speed */
+#define SD_SDIO_CCC_SWITCH			((uint16_t)0x0400)		/*!< command class 10 (switch) */
+
+/**
+ * @brief  SDIO flags
+ */
+#define SD_SDIO_STATIC_FLAGS		((uint32_t)0x000005FF)
+#define SD_SDIO_CMD_FLAGS			( SDIO_FLAG_CCRCFAIL | SDIO_FLAG_CTIMEOUT | SDIO_FLAG_CMDREND )
+#define SD_SDIO_DATA_ERRORS			( SDIO_FLAG_DCRCFAIL | SDIO_FLAG_DTIMEOUT | SDIO_FLAG_TXUNDERR | \
+									  SDIO_FLAG_RXOVERR | SDIO_FLAG_STBITERR )
+#define SD_SDIO_DATA_IT				( SDIO_IT_DATAEND | SDIO_IT_DCRCFAIL | SDIO_IT_DTIMEOUT | \
+									  SDIO_IT_TXUNDERR | SDIO_IT_RXOVERR | SDIO_IT_STBITERR )
+
+#define SD_SDIO_DMA_FLAGS			( SD_SDIO_DMA_FLAG_FEIF | SD_SDIO_DMA_FLAG_DMEIF | SD_SDIO_DMA_FLAG_TEIF | \
+									  SD_SDIO_DMA_FLAG_HTIF | SD_SDIO_DMA_FLAG_TCIF )
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Variables
+ * @{
+ */
+
+static uint8_t SDIO_CardSDHC;				/* nonzero for High Capacity card (sector addresses) */
+static uint32_t SDIO_RCA;					/* Relative Card Address, shifted to the upper half-word */
+static uint8_t SDIO_CSD_Tab[ 16 ];			/* raw CSD register, received during initialization */
+static uint8_t SDIO_CID_Tab[ 16 ];			/* raw CID register, received during initialization */
+static SD_CardInfo SDIO_Info;				/* decoded registers and capacity, filled by SD_SDIO_Init */
+static uint8_t SDIO_InfoValid;				/* nonzero if SDIO_Info belongs to the initialized card */
+
+static xTaskHandle volatile SDIO_Waiter;	/* notified by SDIO ISR when transfer is over, NULL if polled */
+static volatile uint32_t SDIO_DataStatus;	/* set by SDIO ISR: status flags ending the transfer */
+
+/**
+ * @}
+ *//* STM32_Private_Variables */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Wait ~1 millisecond: sleep if scheduler is running, spin otherwise
+ * @param  None
+ * @retval None
+ */
+static void SD_SDIO_Delay( void )
+{
+	volatile uint32_t i;
+	if ( xTaskGetSchedulerState() == taskSCHEDULER_RUNNING )
+		vTaskDelay( 1 );
+	else
+		for ( i = SystemCoreClock / 8000; i > 0; --i ) {}
+}
+
+/**
+ * @brief  Configure SDIO clock and data bus width
+ * @param  clkdiv: Clock divider (SDIOCLK / (clkdiv + 2))
+ * @param  bypass: SDIO_ClockBypass_Enable to clock the card by SDIOCLK directly
+ * @param  width: Bus width (SDIO_BusWide_1b or SDIO_BusWide_4b)
+ * @retval None
+ */
+static void SD_SDIO_SetBus( uint8_t clkdiv, uint32_t bypass, uint32_t width )
+{
+	SDIO_InitTypeDef SDIO_InitStructure;
+
+	SDIO_InitStructure.SDIO_ClockDiv = clkdiv;
+	SDIO_InitStructure.SDIO_ClockEdge = SDIO_ClockEdge_Rising;
+	SDIO_InitStructure.SDIO_ClockBypass = bypass;
+	SDIO_InitStructure.SDIO_ClockPowerSave = SDIO_ClockPowerSave_Disable;
+	SDIO_InitStructure.SDIO_BusWide = width;
+	SDIO_InitStructure.SDIO_HardwareFlowControl = SDIO_HardwareFlowControl_Disable;	/* see errata */
+	SDIO_Init( &SDIO_InitStructure );
+}
+
+/**
+ * @brief  Initialize SDIO pins, clocks, DMA and interrupt
+ * @param  None
+ * @retval None
+ */
+static void SD_SDIO_LowLevel_Init( void )
+{
+	GPIO_InitTypeDef GPIO_InitStructure;
+
+	SD_SDIO_GPIO_CLK_INIT( SD_SDIO_DATA_GPIO_CLK | SD_SDIO_CMD_GPIO_CLK, ENABLE );
+
+	GPIO_PinAFConfig( SD_SDIO_DATA_GPIO_PORT, GPIO_PinSource8, GPIO_AF_SDIO );
+	GPIO_PinAFConfig( SD_SDIO_DATA_GPIO_PORT, GPIO_PinSource9, GPIO_AF_SDIO );
+	GPIO_PinAFConfig( SD_SDIO_DATA_GPIO_PORT, GPIO_PinSource10, GPIO_AF_SDIO );
+	GPIO_PinAFConfig( SD_SDIO_DATA_GPIO_PORT, GPIO_PinSource11, GPIO_AF_SDIO );
+	GPIO_PinAFConfig( SD_SDIO_DATA_GPIO_PORT, GPIO_PinSource12, GPIO_AF_SDIO );
+	GPIO_PinAFConfig( SD_SDIO_CMD_GPIO_PORT, GPIO_PinSource2, GPIO_AF_SDIO );
+
+	/* configure D0..D3 and CMD lines (pulled up by specification) */
+	GPIO_InitStructure.GPIO_Pin = SD_SDIO_D0_PIN | SD_SDIO_D1_PIN | SD_SDIO_D2_PIN | SD_SDIO_D3_PIN;
+	GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF;
+	GPIO_InitStructure.GPIO_OType = GPIO_OType_PP;
+	GPIO_InitStructure.GPIO_PuPd = GPIO_PuPd_UP;
+	GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
+	GPIO_Init( SD_SDIO_DATA_GPIO_PORT, &GPIO_InitStructure );
+
+	GPIO_InitStructure.GPIO_Pin = SD_SDIO_CMD_PIN;
+	GPIO_Init( SD_SDIO_CMD_GPIO_PORT, &GPIO_InitStructure );
+
+	/* configure CK line */
+	GPIO_InitStructure.GPIO_Pin = SD_SDIO_CK_PIN;
+	GPIO_InitStructure.GPIO_PuPd = GPIO_PuPd_NOPULL;
+	GPIO_Init( SD_SDIO_DATA_GPIO_PORT, &GPIO_InitStructure );
+
+	/* enable SDIO and DMA clocks */
+	RCC_APB2PeriphClockCmd( RCC_APB2Periph_SDIO, ENABLE );
+	SD_SDIO_DMA_CLK_INIT( SD_SDIO_DMA_CLK, ENABLE );
+
+	IRQ_Enable( SDIO_IRQn, IRQ_PRIO_SD_DMA );
+}
+
+/**
+ * @brief  Send a command to SD card and receive its response
+ * @param  cmd: Command index
+ * @param  arg: Command argument
+ * @param  resp: Response type (SDIO_Response_No, SDIO_Response_Short or SDIO_Response_Long)
+ * @param  presp: Pointer to variable for the first word of response (can be NULL)
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+static SD_Error SD_SDIO_SendCmd( uint8_t cmd, uint32_t arg, uint32_t resp, uint32_t* presp )
+{
+	SDIO_CmdInitTypeDef SDIO_CmdInitStructure;
+	uint32_t i = SD_SDIO_NUM_TRIES_CMD;
+	uint32_t mask, status;
+
+	SDIO_ClearFlag( SD_SDIO_STATIC_FLAGS );
+
+	SDIO_CmdInitStructure.SDIO_Argument = arg;
+	SDIO_CmdInitStructure.SDIO_CmdIndex = cmd;
+	SDIO_CmdInitStructure.SDIO_Response = resp;
+	SDIO_CmdInitStructure.SDIO_Wait = SDIO_Wait_No;
+	SDIO_CmdInitStructure.SDIO_CPSM = SDIO_CPSM_Enable;
+	SDIO_SendCommand( &SDIO_CmdInitStructure );
+
+	mask = ( resp == SDIO_Response_No ) ? SDIO_FLAG_CMDSENT : SD_SDIO_CMD_FLAGS;
+	do {
+		status = SDIO->STA;
+	} while ( ( status & mask ) == 0 && i-- > 0 );
+	SDIO_ClearFlag( SD_SDIO_STATIC_FLAGS );
+
+	if ( ( status & mask ) == 0 || ( status & SDIO_FLAG_CTIMEOUT ) != 0 )
+		return SD_RESPONSE_FAILURE;
+	if ( resp == SDIO_Response_No )
+		return SD_RESPONSE_NO_ERROR;
+	/* R3 response (OCR register) has no CRC, the others must be valid */
+	if ( ( status & SDIO_FLAG_CCRCFAIL ) != 0 && cmd != SD_SDIO_CMD_SD_SEND_OP_COND )
+		return SD_COMMAND_CRC_ERROR;
+	if ( presp != NULL )
+		*presp = SDIO_GetResponse( SDIO_RESP1 );
+	return SD_RESPONSE_NO_ERROR;
+}
+
+/**
+ * @brief  Send a command with R1 response and check card status in it
+ * @param  cmd: Command index
+ * @param  arg: Command argument
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_ADDRESS_ERROR: Address is out of range or misaligned
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+static SD_Error SD_SDIO_SendCmdR1( uint8_t cmd, uint32_t arg )
+{
+	SD_Error state;
+	uint32_t r1;
+
+	state = SD_SDIO_SendCmd( cmd, arg, SDIO_Response_Short, &r1 );
+	if ( state != SD_RESPONSE_NO_ERROR )
+		return state;
+	if ( SDIO_GetCommandResponse() != cmd )
+		return SD_RESPONSE_FAILURE;
+	if ( ( r1 & SD_SDIO_R1_ADDRESS_ERRORS ) != 0 )
+		return SD_ADDRESS_ERROR;
+	if ( ( r1 & SD_SDIO_R1_ERRORS ) != 0 )
+		return SD_RESPONSE_FAILURE;
+	return SD_RESPONSE_NO_ERROR;
+}
+
+/**
+ * @brief  Send an application specific command (CMD55 + ACMDx) with R1 response
+ * @param  cmd: Application command index
+ * @param  arg: Command argument
+ * @retval The SD Response (see SD_SDIO_SendCmdR1)
+ */
+static SD_Error SD_SDIO_SendAppCmdR1( uint8_t cmd, uint32_t arg )
+{
+	SD_Error state = SD_SDIO_SendCmdR1( SD_SDIO_CMD_APP_CMD, SDIO_RCA );
+	if ( state == SD_RESPONSE_NO_ERROR )
+		state = SD_SDIO_SendCmdR1( cmd, arg );
+	return state;
+}
+
+/**
+ * @brief  Receive 128-bit R2 response (CID or CSD register) in bus order
+ * @param  tab: 16-bytes buffer
+ * @retval None
+ */
+static void SD_SDIO_GetResponse16b( uint8_t* tab )
+{
+	uint32_t i, w;
+	for ( i = 0; i < 4; ++i )
+	{
+		w = SDIO_GetResponse( SDIO_RESP1 + 4 * i );
+		tab[ 4 * i + 0 ] = (uint8_t)( w >> 24 );
+		tab[ 4 * i + 1 ] = (uint8_t)( w >> 16 );
+		tab[ 4 * i + 2 ] = (uint8_t)( w >> 8 );
+		tab[ 4 * i + 3 ] = (uint8_t)w;
+	}
+}
+
+/**
+ * @brief  Wait until card is ready for data (it is in transfer state),
+ *         i.e. it finished programming or erasing flash.
+ *         After a short burst of polling the calling task sleeps between polls,
+ *         the watchdog is kicked meanwhile (erase may last for seconds).
+ * @param  timeout: Maximum waiting time in milliseconds
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+static SD_Error SD_SDIO_WaitReady( uint32_t timeout )
+{
+	SD_Error state = SD_RESPONSE_FAILURE;
+	uint32_t i, r1;
+
+	POWER_BUSY();
+	for ( i = 0; ; ++i )
+	{
+		if ( SD_SDIO_SendCmd( SD_SDIO_CMD_SEND_STATUS, SDIO_RCA, SDIO_Response_Short, &r1 )
+				!= SD_RESPONSE_NO_ERROR )
+			break;
+		if ( ( r1 & SD_SDIO_R1_READY_FOR_DATA ) != 0 &&
+				SD_SDIO_R1_STATE( r1 ) == SD_SDIO_STATE_TRAN )
+		{
+			state = SD_RESPONSE_NO_ERROR;
+			break;
+		}
+		if ( i >= SD_SDIO_NUM_TRIES_FAST )
+		{
+			if ( i - SD_SDIO_NUM_TRIES_FAST >= timeout )
+				break;
+			SD_SDIO_Delay();
+			WATCHDOG_KICK();
+		}
+	}
+	POWER_RELEASE();
+	return state;
+}
+
+/**
+ * @brief  Prepare DMA stream and SDIO data path for data transfer.
+ *         Word-aligned buffer is accessed by words in bursts of 4. Other
+ *         buffers are accessed by single bytes: DMA FIFO packs them into
+ *         words for SDIO FIFO, so no bounce buffer is needed (byte bursts
+ *         could cross 1KB boundary at odd addresses, so they are not used).
+ * @param  buf: Data buffer, any alignment
+ * @param  len: Number of bytes (multiple of SD_BLOCK_SIZE)
+ * @param  dir: SDIO_TransferDir_ToSDIO for reading, SDIO_TransferDir_ToCard for writing
+ * @retval None
+ */
+static void SD_SDIO_StartData( uint8_t* buf, uint32_t len, uint32_t dir )
+{
+	DMA_InitTypeDef DMA_InitStructure;
+	SDIO_DataInitTypeDef SDIO_DataInitStructure;
+	uint8_t aligned = ( ( (uint32_t)buf & 0x03 ) == 0 );
+
+	/* DMA stream: SDIO side moves words in bursts of 4, SDIO is flow controller */
+	DMA_Cmd( SD_SDIO_DMA_STREAM, DISABLE );
+	while ( DMA_GetCmdStatus( SD_SDIO_DMA_STREAM ) != DISABLE ) {}
+	DMA_ClearFlag( SD_SDIO_DMA_STREAM, SD_SDIO_DMA_FLAGS );
+	DMA_DeInit( SD_SDIO_DMA_STREAM );
+
+	DMA_InitStructure.DMA_Channel = SD_SDIO_DMA_CHANNEL;
+	DMA_InitStructure.DMA_PeripheralBaseAddr = SDIO_FIFO_ADDRESS;
+	DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t)buf;
+	DMA_InitStructure.DMA_DIR = ( dir == SDIO_TransferDir_ToSDIO )
+		? DMA_DIR_PeripheralToMemory : DMA_DIR_MemoryToPeripheral;
+	DMA_InitStructure.DMA_BufferSize = len / 4;	/* ignored, SDIO controls the flow */
+	DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+	DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+	DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word;
+	DMA_InitStructure.DMA_MemoryDataSize = aligned ? DMA_MemoryDataSize_Word : DMA_MemoryDataSize_Byte;
+	DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+	DMA_InitStructure.DMA_Priority = DMA_Priority_VeryHigh;
+	DMA_InitStructure.DMA_FIFOMode = DMA_FIFOMode_Enable;
+	DMA_InitStructure.DMA_FIFOThreshold = DMA_FIFOThreshold_Full;
+	DMA_InitStructure.DMA_MemoryBurst = aligned ? DMA_MemoryBurst_INC4 : DMA_MemoryBurst_Single;
+	DMA_InitStructure.DMA_PeripheralBurst = DMA_PeripheralBurst_INC4;
+	DMA_Init( SD_SDIO_DMA_STREAM, &DMA_InitStructure );
+	DMA_FlowControllerConfig( SD_SDIO_DMA_STREAM, DMA_FlowCtrl_Peripheral );
+	DMA_Cmd( SD_SDIO_DMA_STREAM, ENABLE );
+
+	/* arm completion interrupt, STOP mode would halt the transfer */
+	POWER_BUSY();
+	SDIO_DataStatus = 0;
+	SDIO_Waiter = ( xTaskGetSchedulerState() == taskSCHEDULER_RUNNING ) ? xTaskGetCurrentTaskHandle() : NULL;
+	SDIO_ClearFlag( SD_SDIO_STATIC_FLAGS );
+	SDIO_ITConfig( SD_SDIO_DATA_IT, ENABLE );
+	SDIO_DMACmd( ENABLE );
+
+	/* SDIO data path */
+	SDIO_DataInitStructure.SDIO_DataTimeOut = SD_SDIO_DATATIMEOUT;
+	SDIO_DataInitStructure.SDIO_DataLength = len;
+	SDIO_DataInitStructure.SDIO_DataBlockSize = SDIO_DataBlockSize_512b;
+	SDIO_DataInitStructure.SDIO_TransferDir = dir;
+	SDIO_DataInitStructure.SDIO_TransferMode = SDIO_TransferMode_Block;
+	SDIO_DataInitStructure.SDIO_DPSM = SDIO_DPSM_Enable;
+	SDIO_DataConfig( &SDIO_DataInitStructure );
+}
+
+/**
+ * @brief  Wait until data transfer started by SD_SDIO_StartData() is over.
+ *         Calling task sleeps until SDIO interrupt wakes it up.
+ * @param  None
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+static SD_Error SD_SDIO_WaitData( void )
+{
+	SD_Error state = SD_RESPONSE_NO_ERROR;
+	uint32_t i;
+
+	if ( SDIO_Waiter != NULL )
+	{	/* a late notification of an earlier transfer only makes us look at the status again */
+		while ( SDIO_DataStatus == 0 )
+		{
+			if ( ulTaskNotifyTake( pdTRUE, SD_SDIO_TIMEOUT_DATA_MS / portTICK_RATE_MS ) == 0 )
+			{
+				state = SD_RESPONSE_FAILURE;
+				break;
+			}
+		}
+	}
+	else
+	{
+		for ( i = 0; SDIO_DataStatus == 0 && i < SD_SDIO_TIMEOUT_DATA_MS; ++i )
+			SD_SDIO_Delay();
+	}
+	if ( SDIO_DataStatus == 0 || ( SDIO_DataStatus & SD_SDIO_DATA_ERRORS ) != 0 )
+		state = SD_RESPONSE_FAILURE;
+
+	SDIO_ITConfig( SD_SDIO_DATA_IT, DISABLE );
+	SDIO_Waiter = NULL;
+
+	if ( state != SD_RESPONSE_NO_ERROR )
+	{	/* abort data path and DMA */
+		SDIO->DCTRL = 0;
+		DMA_Cmd( SD_SDIO_DMA_STREAM, DISABLE );
+	}
+	/* received data may still be in DMA FIFO... */
+	for ( i = SD_SDIO_NUM_TRIES_CMD; DMA_GetCmdStatus( SD_SDIO_DMA_STREAM ) != DISABLE && i > 0; --i ) {}
+	if ( i == 0 )
+		state = SD_RESPONSE_FAILURE;
+
+	SDIO_DMACmd( DISABLE );
+	SDIO_ClearFlag( SD_SDIO_STATIC_FLAGS );
+	POWER_RELEASE();
+	return state;
+}
+
+/**
+ * @brief  Read short data (SCR register, SD status, switch status) by polling SDIO FIFO
+ * @param  cmd: Command index
+ * @param  arg: Command argument
+ * @param  app: Nonzero for application specific command
+ * @param  data: Buffer for data (in bus order)
+ * @param  len: Number of bytes (8 or 64)
+ * @param  blockSize: SDIO_DataBlockSize_8b or SDIO_DataBlockSize_64b
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+static SD_Error SD_SDIO_ReadShort( uint8_t cmd, uint32_t arg, uint8_t app,
+		uint8_t* data, uint32_t len, uint32_t blockSize )
+{
+	SDIO_DataInitTypeDef SDIO_DataInitStructure;
+	SD_Error state;
+	uint32_t i = 0, tries = SD_SDIO_NUM_TRIES_CMD, w;
+
+	SDIO_DataInitStructure.SDIO_DataTimeOut = SD_SDIO_DATATIMEOUT;
+	SDIO_DataInitStructure.SDIO_DataLength = len;
+	SDIO_DataInitStructure.SDIO_DataBlockSize = blockSize;
+	SDIO_DataInitStructure.SDIO_TransferDir = SDIO_TransferDir_ToSDIO;
+	SDIO_DataInitStructure.SDIO_TransferMode = SDIO_TransferMode_Block;
+	SDIO_DataInitStructure.SDIO_DPSM = SDIO_DPSM_Enable;
+	SDIO_DataConfig( &SDIO_DataInitStructure );
+
+	if ( app )
+		state = SD_SDIO_SendAppCmdR1( cmd, arg );
+	else
+		state = SD_SDIO_SendCmdR1( cmd, arg );
+	if ( state != SD_RESPONSE_NO_ERROR )
+	{
+		SDIO->DCTRL = 0;
+		return state;
+	}
+
+	/* FIFO word keeps the first received byte in its lowest bits */
+	while ( ( SDIO->STA & ( SD_SDIO_DATA_ERRORS | SDIO_FLAG_DBCKEND ) ) == 0 && tries-- > 0 )
+	{
+		if ( SDIO_GetFlagStatus( SDIO_FLAG_RXDAVL ) != RESET && i < len )
+		{
+			w = SDIO_ReadData();
+			memcpy( data + i, &w, 4 );
+			i += 4;
+		}
+	}
+	while ( SDIO_GetFlagStatus( SDIO_FLAG_RXDAVL ) != RESET && i < len )
+	{
+		w = SDIO_ReadData();
+		memcpy( data + i, &w, 4 );
+		i += 4;
+	}
+
+	state = ( ( SDIO->STA & SD_SDIO_DATA_ERRORS ) != 0 || i < len )
+		? SD_RESPONSE_FAILURE : SD_RESPONSE_NO_ERROR;
+	SDIO_ClearFlag( SD_SDIO_STATIC_FLAGS );
+	return state;
+}
+
+#ifdef SD_SDIO_HIGH_SPEED
+/**
+ * @brief  Switch card into High Speed mode (up to 50MHz) if it supports it
+ * @param  None
+ * @retval Nonzero if card is switched to High Speed mode
+ */
+static uint8_t SD_SDIO_SwitchHighSpeed( void )
+{
+	uint8_t status[ 64 ];
+
+	if ( ( SD_GetField( SDIO_CSD_Tab, 16, SD_CSD_CCC ) & SD_SDIO_CCC_SWITCH ) == 0 )
+		return 0;	/* card doesn't support CMD6 (spec v1.0 card) */
+
+	if ( SD_SDIO_ReadShort( SD_SDIO_CMD_SWITCH_FUNC, SD_SDIO_SWITCH_HIGH_SPEED, 0,
+			status, 64, SDIO_DataBlockSize_64b ) != SD_RESPONSE_NO_ERROR )
+		return 0;
+	/* bits 379:376 (byte 16) hold function selected in group 1 */
+	return ( ( status[ 16 ] & 0x0F ) == 0x01 );
+}
+#endif /* SD_SDIO_HIGH_SPEED */
+
+/**
+ * @brief  Read sectors to buffer
+ * @param  readAddr: Sector number
+ * @param  pBuffer: Data buffer, any alignment
+ * @param  nbSectors: Number of sectors
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+static SD_Error SD_SDIO_ReadBlocks( uint32_t readAddr, uint8_t* pBuffer, uint32_t nbSectors )
+{
+	SD_Error state, stop;
+
+	/* non High Capacity cards use byte-oriented addresses */
+	if ( !SDIO_CardSDHC )
+		readAddr <<= 9;
+
+	/* data path has to be ready before card starts sending data... */
+	SD_SDIO_StartData( pBuffer, nbSectors * SD_BLOCK_SIZE, SDIO_TransferDir_ToSDIO );
+	state = SD_SDIO_SendCmdR1( ( nbSectors > 1 ) ? SD_SDIO_CMD_READ_MULT_BLOCK : SD_SDIO_CMD_READ_SINGLE_BLOCK,
+			readAddr );
+	if ( state == SD_RESPONSE_NO_ERROR )
+		state = SD_SDIO_WaitData();
+	else
+		SD_SDIO_WaitData();	/* just abort the transfer */
+
+	if ( nbSectors > 1 )
+	{	/* transmission is open-ended => send CMD12 to stop it */
+		stop = SD_SDIO_SendCmdR1( SD_SDIO_CMD_STOP_TRANSMISSION, 0x00000000 );
+		if ( state == SD_RESPONSE_NO_ERROR )
+			state = stop;
+	}
+	return state;
+}
+
+/**
+ * @brief  Write sectors from buffer and wait until card finishes writing
+ * @param  writeAddr: Sector number
+ * @param  pBuffer: Data buffer, any alignment
+ * @param  nbSectors: Number of sectors
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+static SD_Error SD_SDIO_WriteBlocks( uint32_t writeAddr, const uint8_t* pBuffer, uint32_t nbSectors )
+{
+	SD_Error state, stop;
+
+	/* non High Capacity cards use byte-oriented addresses */
+	if ( !SDIO_CardSDHC )
+		writeAddr <<= 9;
+
+	state = SD_SDIO_SendCmdR1( ( nbSectors > 1 ) ? SD_SDIO_CMD_WRITE_MULT_BLOCK : SD_SDIO_CMD_WRITE_SINGLE_BLOCK,
+			writeAddr );
+	if ( state == SD_RESPONSE_NO_ERROR )
+	{
+		SD_SDIO_StartData( (uint8_t*)pBuffer, nbSectors * SD_BLOCK_SIZE, SDIO_TransferDir_ToCard );
+		state = SD_SDIO_WaitData();
+	}
+
+	if ( nbSectors > 1 )
+	{	/* notify SD card that we finished sending data to write on it */
+		stop = SD_SDIO_SendCmdR1( SD_SDIO_CMD_STOP_TRANSMISSION, 0x00000000 );
+		if ( state == SD_RESPONSE_NO_ERROR )
+			state = stop;
+	}
+
+	/* card is now processing data and it is BUSY, wait until it finishes... */
+	stop = SD_SDIO_WaitReady( SD_SDIO_TIMEOUT_WRITE_MS );
+	if ( state == SD_RESPONSE_NO_ERROR )
+		state = stop;
+	return state;
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  DeInitializes the SD Card and SDIO peripheral
+ * @param  None
+ * @retval None
+ */
+void SD_SDIO_DeInit( void )
+{
+	SDIO_ClockCmd( DISABLE );
+	SDIO_SetPowerState( SDIO_PowerState_OFF );
+	SDIO_DeInit();
+	RCC_APB2PeriphClockCmd( RCC_APB2Periph_SDIO, DISABLE );
+}
+
+/**
+ * @brief  Initializes the SD Card on SDIO bus
+ * @param  None
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+SD_Error SD_SDIO_Init( void )
+{
+	SD_Error state;
+	uint32_t res = 0, ocr = 0, i;
+	uint32_t hcs = 0, bypass = SDIO_ClockBypass_Disable;
+
+	SDIO_InfoValid = 0;
+
+	/* step 0:
+	 * Check if SD card is present... */
+	if ( SD_Detect( &SD_Card ) == SD_NOT_PRESENT )
+		return SD_RESPONSE_FAILURE;
+
+	/* step 1:
+	 * Power up SDIO at 400KHz on 1-bit bus, supply at least 74 clock cycles */
+	SD_SDIO_LowLevel_Init();
+	SDIO_DeInit();
+	SD_SDIO_SetBus( SDIO_INIT_CLK_DIV, SDIO_ClockBypass_Disable, SDIO_BusWide_1b );
+	SDIO_SetPowerState( SDIO_PowerState_ON );
+	SDIO_ClockCmd( ENABLE );
+	SD_SDIO_Delay();
+	SD_SDIO_Delay();
+	SDIO_RCA = 0;
+
+	/* step 2:
+	 * Reset card (CMD0), offer voltage 2.7-3.6V with check pattern (CMD8) */
+	SD_SDIO_SendCmd( SD_SDIO_CMD_GO_IDLE_STATE, 0x00000000, SDIO_Response_No, NULL );
+	state = SD_SDIO_SendCmd( SD_SDIO_CMD_SEND_IF_COND, SD_SDIO_CHECK_PATTERN, SDIO_Response_Short, &res );
+	if ( state == SD_RESPONSE_NO_ERROR )
+	{	/* card v2 accepts CMD8 and echoes check pattern back */
+		if ( ( res & 0x00000FFF ) != SD_SDIO_CHECK_PATTERN )
+			return SD_RESPONSE_FAILURE;
+		hcs = SD_SDIO_OCR_HCS;
+	}
+
+	/* step 3:
+	 * CMD55(0) -> ACMD41 until card finishes its power up */
+	for ( i = 0; i < SD_SDIO_TIMEOUT_INIT_MS; ++i )
+	{
+		state = SD_SDIO_SendCmdR1( SD_SDIO_CMD_APP_CMD, 0x00000000 );
+		if ( state != SD_RESPONSE_NO_ERROR )
+			return SD_RESPONSE_FAILURE;	/* not an SD card, legacy MMC should go to SPI driver */
+		state = SD_SDIO_SendCmd( SD_SDIO_CMD_SD_SEND_OP_COND, SD_SDIO_OCR_VOLTAGE | hcs,
+				SDIO_Response_Short, &ocr );
+		if ( state != SD_RESPONSE_NO_ERROR )
+			return SD_RESPONSE_FAILURE;
+		if ( ( ocr & SD_SDIO_OCR_BUSY ) != 0 )
+			break;
+		SD_SDIO_Delay();
+	}
+	if ( ( ocr & SD_SDIO_OCR_BUSY ) == 0 )
+		return SD_RESPONSE_FAILURE;
+	SDIO_CardSDHC = ( ( ocr & SD_SDIO_OCR_HCS ) != 0 );
+
+	/* step 4:
+	 * Get CID (CMD2) and relative address (CMD3), then CSD (CMD9) and select card (CMD7) */
+	if ( SD_SDIO_SendCmd( SD_SDIO_CMD_ALL_SEND_CID, 0x00000000, SDIO_Response_Long, NULL )
+			!= SD_RESPONSE_NO_ERROR )
+		return SD_RESPONSE_FAILURE;
+	SD_SDIO_GetResponse16b( SDIO_CID_Tab );
+
+	if ( SD_SDIO_SendCmd( SD_SDIO_CMD_SEND_RELATIVE_ADDR, 0x00000000, SDIO_Response_Short, &res )
+			!= SD_RESPONSE_NO_ERROR || ( res & SD_SDIO_R6_ERRORS ) != 0 )
+		return SD_RESPONSE_FAILURE;
+	SDIO_RCA = res & 0xFFFF0000;
+
+	if ( SD_SDIO_SendCmd( SD_SDIO_CMD_SEND_CSD, SDIO_RCA, SDIO_Response_Long, NULL )
+			!= SD_RESPONSE_NO_ERROR )
+		return SD_RESPONSE_FAILURE;
+	SD_SDIO_GetResponse16b( SDIO_CSD_Tab );
+
+	state = SD_SDIO_SendCmdR1( SD_SDIO_CMD_SELECT_CARD, SDIO_RCA );
+	if ( state == SD_RESPONSE_NO_ERROR )
+		state = SD_SDIO_WaitReady( SD_SDIO_TIMEOUT_WRITE_MS );
+
+	/* step 5:
+	 * Switch card to 4-bit bus (ACMD6), force sector size to SD_BLOCK_SIZE for SDSC (CMD16) */
+	if ( state == SD_RESPONSE_NO_ERROR )
+		state = SD_SDIO_SendAppCmdR1( SD_SDIO_CMD_SET_BUS_WIDTH, SD_SDIO_WIDE_BUS );
+	if ( state == SD_RESPONSE_NO_ERROR && !SDIO_CardSDHC )
+		state = SD_SDIO_SendCmdR1( SD_SDIO_CMD_SET_BLOCKLEN, SD_BLOCK_SIZE );
+	if ( state != SD_RESPONSE_NO_ERROR )
+		return state;
+	SD_SDIO_SetBus( SDIO_INIT_CLK_DIV, SDIO_ClockBypass_Disable, SDIO_BusWide_4b );
+
+	/* step 6:
+	 * Set transfer clock */
+#ifdef SD_SDIO_HIGH_SPEED
+	if ( SD_SDIO_SwitchHighSpeed() )
+		bypass = SDIO_ClockBypass_Enable;
+#endif /* SD_SDIO_HIGH_SPEED */
+	SD_SDIO_SetBus( SDIO_TRANSFER_CLK_DIV, bypass, SDIO_BusWide_4b );
+
+	/* step 7:
+	 * Keep registers for SD_SDIO_GetCardInfo, SCR is read in transfer state */
+	memcpy( SDIO_Info.CSD, SDIO_CSD_Tab, sizeof( SDIO_Info.CSD ) );
+	memcpy( SDIO_Info.CID, SDIO_CID_Tab, sizeof( SDIO_Info.CID ) );
+	state = SD_SDIO_ReadShort( SD_SDIO_CMD_SEND_SCR, 0x00000000, 1, SDIO_Info.SCR, 8, SDIO_DataBlockSize_8b );
+	if ( state != SD_RESPONSE_NO_ERROR )
+		return state;
+	SD_CalcCardCapacity( &SDIO_Info );
+	SDIO_InfoValid = 1;
+
+	TRACE_INFO( "%s card initialized successfully on 4-bit SDIO bus at %s MHz\n",
+			!SDIO_CardSDHC ? "SDSC (byte address)" :
+			( SDIO_Info.CardCapacity > SD_SDHC_MAX_KB ) ? "SDXC (block address)" : "SDHC (block address)",
+			( bypass == SDIO_ClockBypass_Enable ) ? "48" : "24" );
+
+	return SD_RESPONSE_NO_ERROR;
+}
+
+/**
+ * @brief  Reads a sector of SD_BLOCK_SIZE bytes from the SD card
+ * @param  readAddr: SD's internal address to read from (sector number)
+ * @param  pBuffer: pointer to the buffer that receives the data read from SD.
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+SD_Error SD_SDIO_SectorRead( uint32_t readAddr, uint8_t* pBuffer )
+{
+	return SD_SDIO_SectorsRead( readAddr, pBuffer, 1 );
+}
+
+/**
+ * @brief  Reads multiple sectors of SD_BLOCK_SIZE bytes from the SD card
+ * @param  readAddr: SD's internal address to read from (sector number)
+ * @param  pBuffer: pointer to the buffer that receives the data read from SD
+ *         (DMA fills it directly, its contents are undefined if reading fails).
+ * @param  nbSectors: number of blocks to be read.
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+SD_Error SD_SDIO_SectorsRead( uint32_t readAddr, uint8_t* pBuffer, uint32_t nbSectors )
+{
+	return SD_SDIO_ReadBlocks( readAddr, pBuffer, nbSectors );
+}
+
+/**
+ * @brief  Writes a sector of SD_BLOCK_SIZE bytes on the SD card
+ * @param  writeAddr: address to write on (sector number)
+ * @param  pBuffer: pointer to the buffer with the data to be written on SD.
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+SD_Error SD_SDIO_SectorWrite( uint32_t writeAddr, const uint8_t* pBuffer )
+{
+	return SD_SDIO_SectorsWrite( writeAddr, pBuffer, 1 );
+}
+
+/**
+ * @brief  Writes multiple sectors of SD_BLOCK_SIZE bytes on the SD card
+ * @param  writeAddr: address to write on (sector number)
+ * @param  pBuffer: pointer to the buffer with the data to be written on the SD.
+ * @param  nbSectors: number of blocks to be written.
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+SD_Error SD_SDIO_SectorsWrite( uint32_t writeAddr, const uint8_t* pBuffer, uint32_t nbSectors )
+{
+	return SD_SDIO_WriteBlocks( writeAddr, pBuffer, nbSectors );
+}
+
+/**
+ * @brief  Erase specified range of sectors on SD card
+ * @param  eraseAddrFrom: Starting sector number
+ * @param  eraseAddrTo: End sector number
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+SD_Error SD_SDIO_SectorsErase( uint32_t eraseAddrFrom, uint32_t eraseAddrTo )
+{
+	SD_Error state;
+
+	/* non High Capacity cards use byte-oriented addresses */
+	if ( !SDIO_CardSDHC )
+	{
+		eraseAddrFrom <<= 9;
+		eraseAddrTo <<= 9;
+	}
+
+	state = SD_SDIO_SendCmdR1( SD_SDIO_CMD_ERASE_BLOCK_START, eraseAddrFrom );
+	if ( state == SD_RESPONSE_NO_ERROR )
+		state = SD_SDIO_SendCmdR1( SD_SDIO_CMD_ERASE_BLOCK_END, eraseAddrTo );
+	if ( state == SD_RESPONSE_NO_ERROR )
+		state = SD_SDIO_SendCmdR1( SD_SDIO_CMD_ERASE, 0x00000000 );
+	if ( state == SD_RESPONSE_NO_ERROR )
+		state = SD_SDIO_WaitReady( SD_SDIO_TIMEOUT_ERASE_MS );
+	return state;
+}
+
+/**
+ * @brief  Retrieve current SD card status structure
+ * @param  SD_status: pointer on an SD_Status structure
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+SD_Error SD_SDIO_GetStatus( SD_Status* SD_status )
+{
+	SD_Error state;
+	uint8_t status[ 64 ];
+
+	state = SD_SDIO_ReadShort( SD_SDIO_CMD_SD_STATUS, 0x00000000, 1, status, 64, SDIO_DataBlockSize_64b );
+	if ( state == SD_RESPONSE_NO_ERROR )
+		SD_DecodeStatus( status, SD_status );
+	return state;
+}
+
+/**
+ * @brief  Returns information about specific card: registers are got once by SD_SDIO_Init,
+ *         so this doesn't communicate with the card.
+ * @param  cardinfo: pointer to a SD_CardInfo structure that contains all SD
+ *         card information.
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Card is not initialized
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+SD_Error SD_SDIO_GetCardInfo( SD_CardInfo *cardinfo )
+{
+	if ( !SDIO_InfoValid )
+		return SD_RESPONSE_FAILURE;
+	memcpy( cardinfo, &SDIO_Info, sizeof( SD_CardInfo ) );
+	return SD_RESPONSE_NO_ERROR;
+}
+
+/**
+ * @brief  Handles SDIO interrupt: data transfer is over or it has failed
+ * @param  None
+ * @retval None
+ */
+void SD_SDIO_IRQHandler( void )
+{
+	uint32_t status = SDIO->STA & SD_SDIO_DATA_IT;
+
+	if ( status != 0 )
+	{
+		SDIO_ITConfig( SD_SDIO_DATA_IT, DISABLE );
+		SDIO_ClearITPendingBit( status );
+		SDIO_DataStatus = status;
+		if ( SDIO_Waiter != NULL )
+			IRQ_Notify( SDIO_Waiter );
+	}
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#endif /* USE_SD_SDIO */
@@ -0,0 +1,68 @@
+/**
+ ******************************************************************************
+ * @file    stm32_sd_sdio.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   High-level communication layer for read/write SD Card mounted on
+ *          native SDIO bus (4-bit wide, 24MHz or 48MHz in High Speed mode).
+ *          SDIO and GPIO pins are defined in stm32_pins.h file.
+ *          Data blocks are moved by DMA, card registers are decoded by
+ *          the same functions as in SPI driver (stm32_sd_spi.h).
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32_SD_SDIO_H
+#define STM32_SD_SDIO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "stm32_sd_spi.h"
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+void SD_SDIO_DeInit( void );
+SD_Error SD_SDIO_Init( void );
+SD_Error SD_SDIO_GetCardInfo( SD_CardInfo *cardinfo );
+SD_Error SD_SDIO_GetStatus( SD_Status* SD_status );
+
+/**
+ * Read/Write/Erase by sectors of SD_BLOCK_SIZE (=512) bytes
+ * All addresses are sector numbers
+ * All buffers have to be pre-allocated to have 512 bytes,
+ * word-aligned buffers are transferred without intermediate copying
+ */
+SD_Error SD_SDIO_SectorRead( uint32_t readAddr, uint8_t* pBuffer );
+SD_Error SD_SDIO_SectorWrite( uint32_t writeAddr, const uint8_t* pBuffer );
+SD_Error SD_SDIO_SectorsRead( uint32_t readAddr, uint8_t* pBuffer, uint32_t nbSectors );
+SD_Error SD_SDIO_SectorsWrite( uint32_t writeAddr, const uint8_t* pBuffer, uint32_t nbSectors );
+SD_Error SD_SDIO_SectorsErase( uint32_t eraseAddrFrom, uint32_t eraseAddrTo );
+
+/**
+ * SDIO interrupt handler (data transfer end or error)
+ */
+void SD_SDIO_IRQHandler( void );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32_SD_SDIO_H */
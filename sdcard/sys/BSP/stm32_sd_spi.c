@@ -46,7 +46,25 @@ Pin	| Name    I/O   Desc            | Name    I/O     Desc            | Name
 #include "stm32_sd_spi.h"
 
 #include "stm32_spi.h"
+#include "serial_debug.h"
+#include "event_trace.h"
+#include "power.h"
+#include "watchdog.h"
+#include "stm32_mem.h"
+#ifdef USE_SD_STATS
+#include "stm32_dwt.h"
+#endif /* USE_SD_STATS */
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+
 #include <stdio.h>
+#include <string.h>
+
+#ifdef USE_FAST_IO_CODE
+#pragma GCC optimize ( "O2" )
+#endif /* USE_FAST_IO_CODE */
 
 /** @addtogroup Utilities
  * @{
@@ -57,17 +75,6 @@ Pin	| Name    I/O   Desc            | Name    I/O     Desc            | Name
  * @{
  */
 
-/**
- * @brief  Type of SD card
- */
-typedef enum _SDCardType
-{
-	SD_Card_MMC,	/*!< Multimedia card (no CMD8, no ACMD41, but CMD1, uses byte-addressing) */
-	SD_Card_SDSC_v1,/*!< Standard Capacity card v1 (no CMD8, but ACMD41, uses byte-addressing) */
-	SD_Card_SDSC_v2,/*!< Standard Capacity card v2 (has CMD8+ACMD41, uses byte-addressing) */
-	SD_Card_SDHC	/*!< High Capacity card (has CMD8+ACMD41, uses sector-addressing) */
-} SDCardType;
-
 /**
  * @brief  Data response sent for CMD24
  */
@@ -123,6 +130,7 @@ typedef enum _SD_CMD
 {
 	SD_CMD_GO_IDLE_STATE		=  0, /*!< CMD0  = 0x40, ARG=0x00000000, CRC=0x95 */
 	SD_CMD_SEND_OP_COND			=  1, /*!< CMD1  = 0x41 */
+	SD_CMD_SWITCH_FUNC			=  6, /*!< CMD6  = 0x46, R1 + 64 bytes of data */
 	SD_CMD_SEND_IF_COND			=  8, /*!< CMD8  = 0x48, ARG=0x000001AA, CRC=0x87 */
 	SD_CMD_SEND_APP				= 55, /*!< CMD55 = 0x77, ARG=0x00000000, CRC=0x65 */
 	SD_CMD_ACTIVATE_INIT		= 41, /*!< ACMD41= 0x69, ARG=0x40000000, CRC=0x77 */
@@ -131,11 +139,16 @@ typedef enum _SD_CMD
 	SD_CMD_SEND_CID				= 10, /*!< CMD10 = 0x4A */
 	SD_CMD_SEND_SCR				= 51, /*!< ACMD51= 0x73 */
 	SD_CMD_STATUS				= 13, /*!< ACMD13= 0x4D */
+	SD_CMD_SEND_STATUS			= 13, /*!< CMD13 = 0x4D (R2 response) */
 	SD_CMD_STOP_TRANSMISSION	= 12, /*!< CMD12 = 0x4C */
 	SD_CMD_SET_BLOCKLEN			= 16, /*!< CMD16 = 0x50 */
 	SD_CMD_READ_SINGLE_BLOCK	= 17, /*!< CMD17 = 0x51 */
 	SD_CMD_READ_MULT_BLOCK		= 18, /*!< CMD18 = 0x52 */
-	SD_CMD_SET_BLOCK_COUNT		= 23, /*!< CMD23 = 0x57 */
+	SD_CMD_SPEED_CLASS_CONTROL	= 20, /*!< CMD20 = 0x54, R1b (SD cards only if SCR CMD_SUPPORT says so) */
+	SD_CMD_SET_BLOCK_COUNT		= 23, /*!< CMD23 = 0x57 (MMC, SD cards only if SCR CMD_SUPPORT says so) */
+	SD_CMD_SET_WR_BLK_ERASE_COUNT=23, /*!< ACMD23= 0x57 (number of blocks to pre-erase before writing) */
+	SD_CMD_SEND_NUM_WR_BLOCKS	= 22, /*!< ACMD22= 0x56 (number of well written blocks, 4-byte data block) */
+	SD_CMD_CRC_ON_OFF			= 59, /*!< CMD59 = 0x7B, ARG=0x00000001 (CRC on) */
 	SD_CMD_WRITE_SINGLE_BLOCK	= 24, /*!< CMD24 = 0x58 */
 	SD_CMD_WRITE_MULT_BLOCK		= 25, /*!< CMD25 = 0x59 */
 	SD_CMD_ERASE_BLOCK_START	= 32, /*!< CMD32 = 0x60 */
@@ -158,9 +171,31 @@ typedef enum _SD_CMD
 #define SD_DUMMY_BYTE		0xFF
 
 /**
- * @brief  Number of 8-bit cycles for RUMP UP phase
+ * @brief  Number of 8-bit cycles for RUMP UP phase (at least 74 clock cycles are required)
+ */
+#define SD_NUM_TRIES_RUMPUP	((uint32_t)10)
+
+/**
+ * @brief  Maximum SPI bus clock in SPI mode (default speed), used if CSD TRAN_SPEED allows more
+ */
+#define SD_SPI_MAX_SPEED_HZ	((uint32_t)25000000)
+
+/**
+ * @brief  Switch card to High Speed mode (CMD6) if it supports it,
+ *         SPI bus clock is limited by SD_SPI_HS_MAX_SPEED_HZ then
+ */
+#define SD_SPI_HIGH_SPEED
+#define SD_SPI_HS_MAX_SPEED_HZ	((uint32_t)50000000)
+
+/**
+ * @brief  CMD6 argument: set access mode (function group 1) to High Speed, keep other groups
+ */
+#define SD_SWITCH_HIGH_SPEED	((uint32_t)0x80FFFFF1)
+
+/**
+ * @brief  Card command class 10 (switch) in CSD CCC field
  */
-#define SD_NUM_TRIES_RUMPUP	((uint32_t)2500)
+#define SD_CCC_SWITCH			((uint16_t)0x0400)
 
 /**
  * @brief  Maximum number of tries to send a command
@@ -177,6 +212,20 @@ typedef enum _SD_CMD
  */
 #define SD_NUM_TRIES_INIT	((uint16_t)20000)
 
+/**
+ * @brief  Maximum time (in milliseconds) until ACMD41/CMD1 initializes SD card
+ * Used instead of SD_NUM_TRIES_INIT when scheduler is running, the task sleeps
+ * between tries (SD specification allows 1 s, twice that is taken to be safe)
+ */
+#define SD_TIMEOUT_INIT_MS	((uint32_t)2000)
+
+/**
+ * @brief  Longest sleep (in milliseconds) between ACMD41/CMD1 tries: the sleep starts
+ * at a tick and doubles after each try up to this, so a card ready in a few
+ * milliseconds is seen at once and a slow one costs a try per this period
+ */
+#define SD_INIT_BACKOFF_MAX_MS	((uint32_t)16)
+
 /**
  * @brief  Maximum number of tries to receive data transmission token
  * It means a time before data transmission starts
@@ -213,6 +262,35 @@ typedef enum _SD_CMD
  */
 #define SD_NUM_TRIES_ERASE	((uint32_t)1000000)
 
+/**
+ * @brief  Maximum time (in milliseconds) until SD card writes data
+ * Used instead of SD_NUM_TRIES_WRITE when scheduler is running
+ * (SD specification allows up to 250 ms for SDHC, 500 ms is taken to be safe)
+ */
+#define SD_TIMEOUT_WRITE_MS	((uint32_t)500)
+
+/**
+ * @brief  Maximum time (in milliseconds) until SD card erases data
+ * Used instead of SD_NUM_TRIES_ERASE when scheduler is running
+ */
+#define SD_TIMEOUT_ERASE_MS	((uint32_t)5000)
+
+/**
+ * @brief  Number of bytes polled at full speed before the waiting task goes to sleep,
+ * short BUSY periods (~60 us) end without a context switch
+ */
+#define SD_NUM_TRIES_BUSY_FAST	((uint32_t)128)
+
+/**
+ * @brief  Limits of card timing are kept at this multiple of the longest delay seen
+ */
+#define SD_TIMING_MARGIN	((uint32_t)3)
+
+/**
+ * @brief  Number of BUSY periods learned before the model decides how long to sleep
+ */
+#define SD_BUSY_MODEL_MIN_SAMPLES	((uint32_t)8)
+
 /**
  * @brief  Start Data tokens:
  *         Tokens (necessary because at nop/idle (and CS active) only 0xff is
@@ -223,6 +301,37 @@ typedef enum _SD_CMD
 #define SD_DATA_MULTIPLE_BLOCK_WRITE_START 0xFC  /*!< Data token start byte, Start Multiple Block Write */
 #define SD_DATA_MULTIPLE_BLOCK_WRITE_STOP  0xFD  /*!< Data token stop byte, Stop Multiple Block Write */
 
+/**
+ * @brief  Maximum number of recoveries (see SD_Recover) of a failed transfer
+ */
+#define SD_NUM_TRIES_RECOVER	((uint8_t)3)
+
+/**
+ * @brief  Bits of the second byte of R2 response (CMD13) which make a transfer fail for good
+ */
+#define SD_R2_CARD_LOCKED	0x01
+#define SD_R2_WP_VIOLATION	0x20
+#define SD_R2_OUT_OF_RANGE	0x80
+
+/**
+ * @brief  Bits of the second byte of R2 response (CMD13) reporting failed programming of accepted blocks
+ */
+#define SD_R2_ERROR			0x04
+#define SD_R2_CC_ERROR		0x08
+#define SD_R2_CARD_ECC_FAILED	0x10
+
+#ifdef USE_SPI_DMA
+/**
+ * @brief  Shorter data transfers are not worth DMA setup, they are done byte by byte
+ */
+#define SD_DMA_MIN_LEN		32
+#endif /* USE_SPI_DMA */
+
+/**
+ * @brief  Bytes read back and compared at once by SD_SectorsVerify without CRC (on stack)
+ */
+#define SD_VERIFY_CHUNK		32
+
 /**
  * @}
  *//* STM32_Private_Defines */
@@ -231,30 +340,148 @@ typedef enum _SD_CMD
  * @{
  */
 
+/**
+ * @brief  Statistics collection: start timer, add measured duration, increment counter
+ *         (statistics of the card handled by hsd)
+ */
+#ifdef USE_SD_STATS
+#define SD_STATS_TIMER( t )			uint32_t t = DWT_GetCycles()
+#define SD_STATS_ADD( lat, t )		SD_StatsAdd( &hsd->Stats.lat, DWT_GetCycles() - (t) )
+#define SD_STATS_INC( cnt )			( ++hsd->Stats.cnt )
+#else
+#define SD_STATS_TIMER( t )
+#define SD_STATS_ADD( lat, t )		do {} while ( 0 )
+#define SD_STATS_INC( cnt )			do {} while ( 0 )
+#endif /* USE_SD_STATS */
+
+/**
+ * @brief  CRC16 of a data block to be sent (see SD_SendDataBlock)
+ */
+#ifdef USE_SD_CRC
+#define SD_BLOCK_CRC( data )	SD_CRC16( (data), SD_BLOCK_SIZE )
+#else
+#define SD_BLOCK_CRC( data )	0
+#endif /* USE_SD_CRC */
+
+/**
+ * @brief  Card type checks of commands and addressing: with USE_SD_FIXED_TYPE they are
+ *         constants, so the compiler drops the code of other card types
+ *         (SD_Card_SDHC stands for SDXC cards too, both use sector addresses)
+ */
+#ifdef USE_SD_FIXED_TYPE
+#define SD_TYPE( hsd )			( (SDCardType)( USE_SD_FIXED_TYPE ) )
+#define SD_TYPE_ACCEPTED( hsd )	( ( SD_TYPE( hsd ) == SD_Card_SDHC ) ? (hsd)->Type >= SD_Card_SDHC : (hsd)->Type == SD_TYPE( hsd ) )
+#else
+#define SD_TYPE( hsd )			( (hsd)->Type )
+#endif /* USE_SD_FIXED_TYPE */
+#define SD_IS_MMC( hsd )		( SD_TYPE( hsd ) == SD_Card_MMC )
+#define SD_BYTE_ADDR( hsd )		( SD_TYPE( hsd ) < SD_Card_SDHC )
+
+/**
+ * @brief  Step of card addresses per sector: non High Capacity cards use byte addresses
+ */
+#define SD_ADDR_STEP( hsd )		( SD_BYTE_ADDR( hsd ) ? SD_BLOCK_SIZE : 1 )
+
 /**
  * @brief  Write a byte on the SD.
+ * @param  hsd: SD Card handle
  * @param  Data: byte to send.
  * @retval None
  */
-#define SD_WriteByte( b )	STM_EVAL_SPI_Send_Recieve_Data( (b) )
+#define SD_WriteByte( hsd, b )	STM_EVAL_SPI_Exchange( (hsd)->Spi.Bus, (b) )
 
 /**
  * @brief  Read a byte from the SD.
- * @param  None
+ * @param  hsd: SD Card handle
  * @retval The received byte.
  */
-#define SD_ReadByte()		STM_EVAL_SPI_Send_Recieve_Data( SD_DUMMY_BYTE )
+#define SD_ReadByte( hsd )		STM_EVAL_SPI_Exchange( (hsd)->Spi.Bus, SD_DUMMY_BYTE )
+
+/**
+ * @brief  Card handle from its pins: on the given SPI bus, SPI mode 3, clock is set by SD_Init,
+ *         the state of the card starts zeroed
+ */
+#define SD_HANDLE_INIT( bus, cs, det )	{ { &bus, cs##_GPIO_PORT, cs##_PIN, SPI_BaudRatePrescaler_2, SPI_CPOL_High, SPI_CPHA_2Edge }, \
+										  cs##_GPIO_CLK, det##_GPIO_PORT, det##_PIN, det##_GPIO_CLK }
 
 /**
  * @}
  *//* STM32_Private_Macros */
 
 
+/** @defgroup STM32_Private_Constants
+ * @{
+ */
+
+#ifdef USE_SD_CRC
+/**
+ * @brief  CRC16-CCITT (x^16 + x^12 + x^5 + 1) of data blocks, byte-wise lookup table
+ */
+static const uint16_t SD_CRC16_Table[ 256 ] =
+{
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+	0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+	0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+	0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+	0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+	0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+	0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+	0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+	0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+	0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+	0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+	0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+	0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+	0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+	0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+	0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+	0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+	0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+	0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+	0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+	0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+	0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+	0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+	0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+	0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+	0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+	0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+	0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+	0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+	0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+	0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+#endif /* USE_SD_CRC */
+
+/**
+ * @brief  Timing profiles of known card models, selected by CID manufacturer and OEM ID:
+ *         data token is awaited SD_TIMING_MARGIN times the delay measured (see SD_NUM_TRIES_READ),
+ *         slow writers (see SD_NUM_TRIES_WRITE) are polled less often, BUSY limits follow
+ *         SD specification (250 ms for writes). The first one is the default for other cards.
+ */
+static const SD_Timing SD_TimingProfiles[] =
+{	/* MID  OEM ID  read tries          fast tries              poll batch write ms             erase ms */
+	{ 0x00, 0x0000, SD_NUM_TRIES_READ,  SD_NUM_TRIES_BUSY_FAST, 1,   0,    SD_TIMEOUT_WRITE_MS, SD_TIMEOUT_ERASE_MS },
+	{ 0x03, 0x5344, 300 * 3,            SD_NUM_TRIES_BUSY_FAST, 1,   0,    250,                 SD_TIMEOUT_ERASE_MS },	/* SanDisk "SD" */
+	{ 0x1B, 0x534D, 500 * 3,            SD_NUM_TRIES_BUSY_FAST, 4,   0,    SD_TIMEOUT_WRITE_MS, SD_TIMEOUT_ERASE_MS },	/* Samsung "SM" */
+	{ 0x28, 0x4245, 300 * 3,            SD_NUM_TRIES_BUSY_FAST, 1,   0,    250,                 SD_TIMEOUT_ERASE_MS },	/* Lexar "BE" */
+	{ 0x41, 0x3432, 600 * 3,            SD_NUM_TRIES_BUSY_FAST, 1,   0,    250,                 SD_TIMEOUT_ERASE_MS },	/* Kingston "42" */
+};
+
+/**
+ * @}
+ *//* STM32_Private_Constants */
+
+
 /** @defgroup STM32_Private_Variables
  * @{
  */
 
-SDCardType cardType;
+SD_Handle SD_Card = SD_HANDLE_INIT( SPIx_Bus, SD_CS, SD_DETECT );		/* shares SPIx bus with touch screen */
+#ifdef USE_SD_CARD2
+SD_Handle SD_Card2 = SD_HANDLE_INIT( SPIy_Bus, SD2_CS, SD2_DETECT );	/* has SPIy bus for itself */
+#endif /* USE_SD_CARD2 */
 
 /**
  * @}
@@ -273,72 +500,152 @@ SDCardType cardType;
  * @{
  */
 
+#ifdef USE_SD_CRC
+/**
+ * @brief  Calculates CRC7 (x^7 + x^3 + 1) of command
+ * @param  data: Command bytes
+ * @param  len: Number of bytes
+ * @retval CRC7 in bits 7..1, end bit 0 is set
+ */
+static uint8_t SD_CRC7( const uint8_t* data, uint8_t len )
+{
+	uint8_t crc = 0;
+	uint8_t i;
+
+	while ( len-- > 0 )
+	{
+		crc ^= *data++;
+		for ( i = 0; i < 8; ++i )
+			crc = ( crc & 0x80 ) ? ( ( crc << 1 ) ^ ( 0x09 << 1 ) ) : ( crc << 1 );
+	}
+	return crc | 0x01;
+}
+
+/**
+ * @brief  Calculates CRC16 of data block
+ * @param  data: Data
+ * @param  len: Number of bytes
+ * @retval CRC16
+ */
+static uint16_t MEM_RAM_FUNC SD_CRC16( const uint8_t* data, uint16_t len )
+{
+	uint16_t crc = 0;
+
+	while ( len-- > 0 )
+		crc = ( crc << 8 ) ^ SD_CRC16_Table[ (uint8_t)( crc >> 8 ) ^ *data++ ];
+	return crc;
+}
+#endif /* USE_SD_CRC */
+
+#ifdef USE_SD_STATS
+/**
+ * @brief  Add measured operation duration to statistics
+ * @param  lat: Statistics of this kind of operations
+ * @param  cycles: Duration in core clock cycles
+ * @retval None
+ */
+static void SD_StatsAdd( SD_Latency* lat, uint32_t cycles )
+{
+	uint32_t us = DWT_CyclesToUs( cycles );
+	uint8_t bin = 0;
+
+	if ( lat->Count == 0 || us < lat->MinUs )
+		lat->MinUs = us;
+	if ( us > lat->MaxUs )
+		lat->MaxUs = us;
+	++lat->Count;
+	lat->TotalUs += us;
+	while ( ( us >> ( bin + 1 ) ) != 0 && bin < SD_STATS_HIST_BINS - 1 )
+		++bin;
+	++lat->Histogram[ bin ];
+}
+#endif /* USE_SD_STATS */
+
 /**
  * @brief  Send a command to SD card and receive R1 response
+ * @param  hsd: SD Card handle
  * @param  Cmd: Command to send to SD card
  * @param  Arg: Command argument
- * @param  Crc: CRC
+ * @param  Crc: CRC (calculated by driver itself if USE_SD_CRC is defined)
  * @retval R1 response byte
  */
-static SD_Error SD_SendCmd( uint8_t cmd, uint32_t arg, uint8_t crc )
+static SD_Error SD_SendCmd( SD_Handle* hsd, uint8_t cmd, uint32_t arg, uint8_t crc )
 {
 	uint8_t res;
 	uint16_t i = SD_NUM_TRIES;
+	SD_STATS_TIMER( t );
+#ifdef USE_SD_CRC
+	uint8_t frame[ 5 ] = { (cmd & 0x3F) | 0x40, (uint8_t)(arg >> 24), (uint8_t)(arg >> 16), (uint8_t)(arg >> 8), (uint8_t)arg };
+	crc = SD_CRC7( frame, sizeof( frame ) );	/* given CRC is ignored, valid one is always sent */
+#endif /* USE_SD_CRC */
+	TRACE_EVENT( EVT_SD_CMD, cmd, arg );
 	/* send a command */
-	SD_WriteByte( (cmd & 0x3F) | 0x40 );	/*!< byte 1 */
-	SD_WriteByte( (uint8_t)(arg >> 24) );	/*!< byte 2 */
-	SD_WriteByte( (uint8_t)(arg >> 16) );	/*!< byte 3 */
-	SD_WriteByte( (uint8_t)(arg >> 8) );	/*!< byte 4 */
-	SD_WriteByte( (uint8_t)arg );			/*!< byte 5 */
-	SD_WriteByte( crc | 0x01 );				/*!< byte 6: CRC */
+	SD_WriteByte( hsd, (cmd & 0x3F) | 0x40 );	/*!< byte 1 */
+	SD_WriteByte( hsd, (uint8_t)(arg >> 24) );	/*!< byte 2 */
+	SD_WriteByte( hsd, (uint8_t)(arg >> 16) );	/*!< byte 3 */
+	SD_WriteByte( hsd, (uint8_t)(arg >> 8) );	/*!< byte 4 */
+	SD_WriteByte( hsd, (uint8_t)arg );			/*!< byte 5 */
+	SD_WriteByte( hsd, crc | 0x01 );				/*!< byte 6: CRC */
 	/* a byte received immediately after CMD12 should be discarded... */
 	if ( cmd == SD_CMD_STOP_TRANSMISSION )
-		SD_ReadByte();
+		SD_ReadByte( hsd );
 	/* SD Card responds within Ncr (response time),
 	   which is 0-8 bytes for SDSC cards, 1-8 bytes for MMC cards */
 	do {
-		res = SD_ReadByte();
+		res = SD_ReadByte( hsd );
 		/* R1 response always starts with 7th bit set to 0 */
 	} while ( ( res & SD_CHECK_BIT ) != 0x00 && i-- > 0);
+	if ( ( res & SD_CHECK_BIT ) != 0x00 )
+		SD_STATS_INC( CmdErrors );
+	else
+	{
+		SD_STATS_ADD( Command, t );
+		if ( ( res & SD_COMMAND_CRC_ERROR ) != 0x00 )
+			SD_STATS_INC( CrcErrors );
+	}
+	TRACE_EVENT( EVT_SD_RESP, cmd, res );
 	return (SD_Error)res;
 }
 
 /**
  * @brief  Get 4 bytes of R3 or R7 response
+ * @param  hsd: SD Card handle
  * @param  pres: Pointer to uint32_t variable for result
  * @retval None
  */
-static void SD_GetResponse4b( uint8_t* pres )
+static void SD_GetResponse4b( SD_Handle* hsd, uint8_t* pres )
 {
-	pres[ 3 ] = SD_ReadByte();
-	pres[ 2 ] = SD_ReadByte();
-	pres[ 1 ] = SD_ReadByte();
-	pres[ 0 ] = SD_ReadByte();
+	pres[ 3 ] = SD_ReadByte( hsd );
+	pres[ 2 ] = SD_ReadByte( hsd );
+	pres[ 1 ] = SD_ReadByte( hsd );
+	pres[ 0 ] = SD_ReadByte( hsd );
 }
 
 /**
  * @brief  Set SD Card sector size to SD_CMD_SET_BLOCKLEN (512 bytes)
+ * @param  hsd: SD Card handle
  * @param  New sector size
  * @retval The SD Response:
  *         - SD_RESPONSE_FAILURE: Sequence failed
  *         - SD_RESPONSE_NO_ERROR: Sequence succeed
  */
-static SD_Error SD_FixSectorSize( uint16_t ssize )
+static SD_Error SD_FixSectorSize( SD_Handle* hsd, uint16_t ssize )
 {
-	return SD_SendCmd( SD_CMD_SET_BLOCKLEN, (uint32_t)ssize, 0xFF );
+	return SD_SendCmd( hsd, SD_CMD_SET_BLOCKLEN, (uint32_t)ssize, 0xFF );
 }
 
 /**
  * @brief  Some commands take longer time and respond with R1b response,
  *         so we have to wait until 0xFF recieved (MISO is set to HIGH)
+ * @param  hsd: SD Card handle
  * @retval Nonzero if required state wasn't recieved
  */
-static SD_Error SD_WaitReady( void )
+static SD_Error SD_WaitReady( SD_Handle* hsd )
 {
 	uint16_t i = SD_NUM_TRIES;
 	while ( i-- > 0 )
 	{
-		if ( SD_ReadByte() == 0xFF )
+		if ( SD_ReadByte( hsd ) == 0xFF )
 		{
 //printf( " [[ WAIT delay %d ]] ", SD_NUM_TRIES - i );
 			return SD_RESPONSE_NO_ERROR;
@@ -348,318 +655,872 @@ static SD_Error SD_WaitReady( void )
 	return SD_RESPONSE_FAILURE;
 }
 
+/**
+ * @brief  Stretch a limit of card timing after a delay longer than seen before
+ * @param  pmax: Longest delay seen so far
+ * @param  plimit: Limit of the delay
+ * @param  delay: Delay just seen
+ * @param  cap: Worst-case limit of the driver
+ * @retval None
+ */
+static void SD_TimingLearn( uint32_t* pmax, uint32_t* plimit, uint32_t delay, uint32_t cap )
+{
+	if ( delay <= *pmax )
+		return;
+	*pmax = delay;
+	delay = ( delay < cap / SD_TIMING_MARGIN ) ? delay * SD_TIMING_MARGIN : cap;
+	if ( *plimit < delay )
+		*plimit = delay;
+}
+
+/**
+ * @brief  Add duration of BUSY period to its model
+ * @param  model: Model of BUSY durations
+ * @param  delay: Duration in milliseconds
+ * @retval None
+ */
+static void SD_BusyModelAdd( SD_BusyModel* model, uint32_t delay )
+{
+	int32_t err = (int32_t)( delay * 16 ) - (int32_t)model->Mean16;
+
+	if ( model->Samples++ == 0 )
+	{
+		model->Mean16 = delay * 16;
+		model->Dev16 = delay * 8;
+		return;
+	}
+	model->Mean16 = (uint32_t)( (int32_t)model->Mean16 + err / 8 );
+	if ( err < 0 )
+		err = -err;
+	model->Dev16 = (uint32_t)( (int32_t)model->Dev16 + ( err - (int32_t)model->Dev16 ) / 4 );
+}
+
 /**
  * @brief  Wait until data transmission token is received
+ * @param  hsd: SD Card handle
  * @retval Data transmission token or 0xFF if timeout occured
  */
-static uint8_t SD_WaitBytesRead( void )
+static uint8_t SD_WaitBytesRead( SD_Handle* hsd )
 {
-	uint16_t i = SD_NUM_TRIES_READ;
+	uint32_t i = hsd->Timing.ReadTries;
 	uint8_t b;
+	SD_STATS_TIMER( t );
 	do {
-		b = SD_ReadByte();
+		b = SD_ReadByte( hsd );
 	} while ( b == 0xFF && i-- > 0 );
 
 	if ( b != 0xFF )
-		printf( " [[ READ delay %d ]] ", SD_NUM_TRIES_READ - i );
+	{
+		SD_STATS_ADD( ReadToken, t );
+		TRACE_VERBOSE( " [[ READ delay %lu ]] ", hsd->Timing.ReadTries - i );
+		SD_TimingLearn( &hsd->Timing.ReadMax, &hsd->Timing.ReadTries, hsd->Timing.ReadTries - i, SD_NUM_TRIES_READ );
+	}
 	else
-		printf( " [[ READ delay was not enough ]] " );
+	{
+		SD_STATS_INC( Timeouts );
+		TRACE_ERROR( " [[ READ delay was not enough ]] " );
+		hsd->Timing.ReadTries = SD_NUM_TRIES_READ;
+	}
 
 	return b;
 }
 
+/**
+ * @brief  Wait while SD card is BUSY (MISO is held LOW) after R1b response.
+ *         After a short burst of polling the calling task sleeps, so other tasks run while
+ *         card is programming flash: with a model of BUSY durations it sleeps through the
+ *         expected part of BUSY at once and then polls every tick, without a model it sleeps
+ *         Timing.PollTicks between polls. Before scheduler is started, MISO is polled continuously.
+ *         The watchdog is kicked while waiting: BUSY of erase may last for seconds.
+ * @param  hsd: SD Card handle
+ * @param  timeout: Maximum waiting time in milliseconds (scheduler is running)
+ * @param  tries: Maximum number of polled bytes (scheduler is not running)
+ * @param  model: Model of BUSY durations, NULL if there is none
+ * @param  pdelay: Pointer to variable for waiting time (in milliseconds or tries)
+ * @retval Nonzero if required state wasn't recieved
+ */
+static SD_Error SD_WaitBusy( SD_Handle* hsd, uint32_t timeout, uint32_t tries, SD_BusyModel* model, uint32_t* pdelay )
+{
+	uint32_t i, first, poll;
+	portTickType start, timeoutTicks;
+
+	/* most BUSY periods are short: poll at full speed first... */
+	for ( i = 0; i < hsd->Timing.BusyFastTries; ++i )
+	{
+		if ( SD_ReadByte( hsd ) == 0xFF )
+		{
+			*pdelay = 0;
+			return SD_RESPONSE_NO_ERROR;
+		}
+	}
+
+	if ( xTaskGetSchedulerState() != taskSCHEDULER_RUNNING )
+	{	/* system tick isn't running, the only measure of time is number of tries */
+		for ( ; i < tries; ++i )
+		{
+			WATCHDOG_KICK();
+			if ( SD_ReadByte( hsd ) == 0xFF )
+			{
+				*pdelay = i;
+				return SD_RESPONSE_NO_ERROR;
+			}
+		}
+		*pdelay = i;
+		return SD_RESPONSE_FAILURE;
+	}
+
+	/* ...then sleep through the expected part of BUSY and poll until deadline */
+	first = poll = hsd->Timing.PollTicks;
+	if ( model != NULL )
+	{
+		poll = 1;
+		if ( model->Samples >= SD_BUSY_MODEL_MIN_SAMPLES )
+		{
+			first = ( model->Mean16 > model->Dev16 ) ? ( model->Mean16 - model->Dev16 ) / 16 / portTICK_RATE_MS : 0;
+			if ( first == 0 )
+				first = 1;
+		}
+	}
+	timeoutTicks = (portTickType)( timeout / portTICK_RATE_MS );
+	start = xTaskGetTickCount();
+	for ( i = 0; ; ++i )
+	{
+		vTaskDelay( ( i == 0 ) ? first : poll );
+		WATCHDOG_KICK();
+		if ( SD_ReadByte( hsd ) == 0xFF )
+		{
+			*pdelay = ( xTaskGetTickCount() - start ) * portTICK_RATE_MS;
+			if ( model != NULL )
+			{
+				model->Polls += i + 1;
+				if ( i == 0 )
+					model->FirstPoll++;
+			}
+			return SD_RESPONSE_NO_ERROR;
+		}
+		if ( (portTickType)( xTaskGetTickCount() - start ) > timeoutTicks )
+			break;
+	}
+	*pdelay = ( xTaskGetTickCount() - start ) * portTICK_RATE_MS;
+	return SD_RESPONSE_FAILURE;
+}
+
+/**
+ * @brief  Decides on one more try of ACMD41/CMD1 while card performs initialization:
+ *         if scheduler is running the task sleeps before it with exponential backoff
+ *         (other tasks proceed while the card powers up) and time is limited, otherwise
+ *         number of tries is. The last try is sent after the time limit has passed.
+ * @param  start: Tick count when the first try was sent
+ * @param  tries: Remaining number of tries, used if scheduler isn't running
+ * @param  backoff: Sleep before the next try in ticks (1 at the first call), doubled
+ * @retval Nonzero if one more try can be sent
+ */
+static uint8_t SD_InitRetry( portTickType start, uint16_t* tries, portTickType* backoff )
+{
+	if ( xTaskGetSchedulerState() != taskSCHEDULER_RUNNING )
+		return ( (*tries)-- > 0 );
+	if ( (portTickType)( xTaskGetTickCount() - start ) > (portTickType)( SD_TIMEOUT_INIT_MS / portTICK_RATE_MS ) )
+		return 0;
+	vTaskDelay( *backoff );
+	if ( *backoff < (portTickType)( SD_INIT_BACKOFF_MAX_MS / portTICK_RATE_MS ) )
+		*backoff *= 2;
+	return 1;
+}
+
 /**
  * @brief  Writing data into flash takes even longer time and it responds with R1b response,
  *         so we have to wait until 0xFF recieved (MISO is set to HIGH)
+ * @param  hsd: SD Card handle
  * @retval Nonzero if required state wasn't recieved
  */
-static SD_Error SD_WaitBytesWritten( void )
+static SD_Error SD_WaitBytesWritten( SD_Handle* hsd )
 {
-	uint32_t i = SD_NUM_TRIES_WRITE;
-	while ( i-- > 0 )
+	uint32_t delay;
+	SD_Error res;
+	SD_STATS_TIMER( t );
+	TRACE_EVENT( EVT_SD_BUSY_BEGIN, hsd->Timing.WriteTimeoutMs, 0 );
+	POWER_BUSY();		/* card is programming: no STOP mode until it is done */
+	res = SD_WaitBusy( hsd, hsd->Timing.WriteTimeoutMs, SD_NUM_TRIES_WRITE, &hsd->Timing.WriteModel, &delay );
+	POWER_RELEASE();
+	TRACE_EVENT( EVT_SD_BUSY_END, delay, res );
+	if ( res == SD_RESPONSE_NO_ERROR )
 	{
-		if ( SD_ReadByte() == 0xFF )
+		SD_STATS_ADD( WriteBusy, t );
+		TRACE_VERBOSE( " [[ WRITE delay %lu ]] ", delay );
+		if ( xTaskGetSchedulerState() == taskSCHEDULER_RUNNING )	/* delay is in milliseconds */
 		{
-			printf( " [[ WRITE delay %lu ]] ", SD_NUM_TRIES_WRITE - i );
-			return SD_RESPONSE_NO_ERROR;
+			SD_TimingLearn( &hsd->Timing.WriteMaxMs, &hsd->Timing.WriteTimeoutMs, delay, SD_TIMEOUT_WRITE_MS );
+			SD_BusyModelAdd( &hsd->Timing.WriteModel, delay );
 		}
+		return SD_RESPONSE_NO_ERROR;
 	}
-	printf( " [[ WRITE delay was not enough ]] " );
+	SD_STATS_INC( Timeouts );
+	TRACE_ERROR( " [[ WRITE delay was not enough ]] " );
+	hsd->Timing.WriteTimeoutMs = SD_TIMEOUT_WRITE_MS;
 	return SD_RESPONSE_FAILURE;
 }
 
 /**
  * @brief  Erasing data into flash takes some time and it responds with R1b response,
  *         so we have to wait until 0xFF recieved (MISO is set to HIGH)
+ * @param  hsd: SD Card handle
  * @retval Nonzero if required state wasn't recieved
  */
-static SD_Error SD_WaitBytesErased( void )
+static SD_Error SD_WaitBytesErased( SD_Handle* hsd )
 {
-	uint32_t i = SD_NUM_TRIES_ERASE;
-	while ( i-- > 0 )
+	uint32_t delay;
+	SD_Error res;
+	SD_STATS_TIMER( t );
+	TRACE_EVENT( EVT_SD_BUSY_BEGIN, hsd->Timing.EraseTimeoutMs, 0 );
+	POWER_BUSY();		/* card is programming: no STOP mode until it is done */
+	res = SD_WaitBusy( hsd, hsd->Timing.EraseTimeoutMs, SD_NUM_TRIES_ERASE, NULL, &delay );
+	POWER_RELEASE();
+	TRACE_EVENT( EVT_SD_BUSY_END, delay, res );
+	if ( res == SD_RESPONSE_NO_ERROR )
+	{
+		SD_STATS_ADD( EraseBusy, t );
+		TRACE_VERBOSE( " [[ ERASE delay %lu ]] ", delay );
+		if ( xTaskGetSchedulerState() == taskSCHEDULER_RUNNING )	/* delay is in milliseconds */
+			SD_TimingLearn( &hsd->Timing.EraseMaxMs, &hsd->Timing.EraseTimeoutMs, delay, SD_TIMEOUT_ERASE_MS );
+		return SD_RESPONSE_NO_ERROR;
+	}
+	SD_STATS_INC( Timeouts );
+	TRACE_ERROR( " [[ ERASE delay was not enough ]] " );
+	hsd->Timing.EraseTimeoutMs = SD_TIMEOUT_ERASE_MS;
+	return SD_RESPONSE_FAILURE;
+}
+
+/**
+ * @brief  Select timing profile of the card model by CID manufacturer and OEM ID
+ * @param  hsd: SD Card handle with CID read
+ * @retval None
+ */
+static void SD_TimingSelect( SD_Handle* hsd )
+{
+	uint8_t mid = (uint8_t)SD_CID_Get( &hsd->Info, SD_CID_MID );
+	uint16_t oid = (uint16_t)SD_CID_Get( &hsd->Info, SD_CID_OID );
+	uint8_t i;
+
+	for ( i = 1; i < sizeof( SD_TimingProfiles ) / sizeof( SD_TimingProfiles[ 0 ] ); ++i )
 	{
-		if ( SD_ReadByte() == 0xFF )
+		if ( SD_TimingProfiles[ i ].ManufacturerID == mid && SD_TimingProfiles[ i ].OEM_AppliID == oid )
 		{
-			printf( " [[ ERASE delay %lu ]] ", SD_NUM_TRIES_ERASE - i );
-			return SD_RESPONSE_NO_ERROR;
+			hsd->Timing = SD_TimingProfiles[ i ];
+			break;
 		}
 	}
-	printf( " [[ ERASE delay was not enough ]] " );
-	return SD_RESPONSE_FAILURE;
+	TRACE_INFO( "SD timing profile %02X/%04X\n", hsd->Timing.ManufacturerID, hsd->Timing.OEM_AppliID );
 }
 
 /**
- * @brief  Hold SPI bus for SD card
- * @param  None
+ * @brief  Hold SPI bus for SD card (nested holds of a transaction only count)
+ * @param  hsd: SD Card handle
  * @retval None
  */
-static void SD_Bus_Hold( void )
-{	/* Select SD Card: set SD chip select pin low */
-	GPIO_ResetBits( SD_CS_GPIO_PORT, SD_CS_PIN );
+static void SD_Bus_Hold( SD_Handle* hsd )
+{
+	if ( hsd->BusHeld++ != 0 )
+		return;
+	/* wait for other devices to release the bus, apply SD Card clock and mode... */
+	STM_EVAL_SPI_Lock( &hsd->Spi );
+	/* Select SD Card: set SD chip select pin low */
+	STM_EVAL_SPI_Select( &hsd->Spi );
 }
 
 /**
- * @brief  Release SPI bus used by SD card
- * @param  None
+ * @brief  Release SPI bus used by SD card (when the outermost hold ends)
+ * @param  hsd: SD Card handle
  * @retval None
  */
-static void SD_Bus_Release( void )
-{	/* Deselect SD Card: set SD chip select pin high */
-	GPIO_SetBits( SD_CS_GPIO_PORT, SD_CS_PIN );
-	SD_ReadByte();	/* send dummy byte: 8 Clock pulses of delay */
+static void SD_Bus_Release( SD_Handle* hsd )
+{
+	if ( --hsd->BusHeld != 0 )
+		return;
+	/* Deselect SD Card: set SD chip select pin high */
+	STM_EVAL_SPI_Deselect( &hsd->Spi );
+	SD_ReadByte( hsd );	/* send dummy byte: 8 Clock pulses of delay */
+	/* let other devices use the bus */
+	STM_EVAL_SPI_Unlock( &hsd->Spi );
 }
 
 /**
  * @brief  Put SD in Idle state.
- * @param  None
+ * @param  hsd: SD Card handle
  * @retval The SD Response:
  *         - SD_RESPONSE_FAILURE: Sequence failed
  *         - SD_RESPONSE_NO_ERROR: Sequence succeed
  */
-static SD_Error SD_GoIdleState( void )
+static SD_Error SD_GoIdleState( SD_Handle* hsd )
 {
 	uint32_t res = 0;
+	portTickType start, backoff;
 	uint16_t i;
-	uint8_t state;
+	uint8_t state, ready;
 
-	/* --- put SD card in SPI mode */
-	SD_Bus_Hold();
+	/* --- put SD card in SPI mode (bus is held by the caller) */
+#ifdef USE_SD_CRC
+	hsd->CrcOn = 0;	/* CMD0 turns CRC checking off */
+#endif /* USE_SD_CRC */
 
 	i = SD_NUM_TRIES;	/* reset try count... */
 	do {	/* loop until In Idle State Response (in R1 format) confirmation */
-		state = SD_SendCmd( SD_CMD_GO_IDLE_STATE, 0x00000000, 0x95 ); /* valid CRC is mandatory here */
+		state = SD_SendCmd( hsd, SD_CMD_GO_IDLE_STATE, 0x00000000, 0x95 ); /* valid CRC is mandatory here */
+		if ( state != SD_IN_IDLE_STATE )
+			SD_STATS_INC( Retries );
 	} while ( state != SD_IN_IDLE_STATE && i-- > 0 );
 	/* still no Idle State Response => return response failure */
 	if ( state != SD_IN_IDLE_STATE )
 		return SD_RESPONSE_FAILURE;
 
+#ifdef USE_SD_CRC
+	/* --- CRC checking is off in SPI mode by default, turn it on (send CMD59)... */
+	state = SD_SendCmd( hsd, SD_CMD_CRC_ON_OFF, 0x00000001, 0xFF );
+	hsd->CrcOn = ( state == SD_IN_IDLE_STATE );
+	if ( !hsd->CrcOn )
+		TRACE_ERROR( "CRC checking is not supported by card\n" );
+#endif /* USE_SD_CRC */
+
 	/* --- SD card is now in idle state and in SPI mode, activate it and get its type */
-	cardType = SD_Card_SDSC_v2;
+	hsd->Type = SD_Card_SDSC_v2;
 
-	state = SD_WaitReady();	/* make sure card is ready before we go further... */
+	state = SD_WaitReady( hsd );	/* make sure card is ready before we go further... */
 
 	/* --- try to send CMD8 to offer voltage 2.7-3.6V with check pattern 0xAA */
 	i = SD_NUM_TRIES;	/* reset try count... */
 	do {
-		state = SD_SendCmd( SD_CMD_SEND_IF_COND, 0x000001AA, 0x87 ); /* valid CRC is mandatory here */
+		state = SD_SendCmd( hsd, SD_CMD_SEND_IF_COND, 0x000001AA, 0x87 ); /* valid CRC is mandatory here */
 		if ( ( state & SD_ILLEGAL_COMMAND ) != 0 )
 		{	/* SD card doesn't accept CMD8 => it's SDSC or MMC card... */
-			cardType = SD_Card_SDSC_v1;
+			hsd->Type = SD_Card_SDSC_v1;
 			break;
 		}
 		else/* SD card accepts CMD8 => it's SDHC or SDXC card... */
 		{	/* get R7 response and verify pattern for sanity check... */
-			SD_GetResponse4b( (uint8_t*)&res );
+			SD_GetResponse4b( hsd, (uint8_t*)&res );
 			if ( ( res & 0x0000FFFF ) == 0x000001AA )
 				break;	/* check pattern is OK, card accepted offered voltage... */
 			/* else specification recommends to retry CMD8 again */
+			SD_STATS_INC( Retries );
 		}
 	} while ( i-- > 0 );
 	if ( i == 0 )
 		return SD_RESPONSE_FAILURE;	/* error occurred... */
 
-	state = SD_WaitReady();	/* make sure card is ready before we go further... */
+	state = SD_WaitReady( hsd );	/* make sure card is ready before we go further... */
 
 	/* --- activate card initialization sequence... */
 	/* CMD55(0) -> ACMD41(0) -> ... */
 	i = SD_NUM_TRIES_INIT;	/* reset try count... */
+	start = xTaskGetTickCount();
+	backoff = 1;
 	do {
-		state = SD_SendCmd( SD_CMD_SEND_APP, 0x00000000, 0x65 );
+		state = SD_SendCmd( hsd, SD_CMD_SEND_APP, 0x00000000, 0x65 );
 		if ( state != SD_IN_IDLE_STATE )
 		{	/* error occurred => last chance is to try it as a legacy MMC card */
-			cardType = SD_Card_MMC;
+			hsd->Type = SD_Card_MMC;
 			break;
 		}
 
-		state = SD_WaitReady();	/* make sure card is ready before we go further... */
+		state = SD_WaitReady( hsd );	/* make sure card is ready before we go further... */
 
-		if ( cardType == SD_Card_SDSC_v1 )		/* HCS bit (0 here) is ignored by SDSC card */
-			state = SD_SendCmd( SD_CMD_ACTIVATE_INIT, 0x00000000, 0xFF );
+		if ( hsd->Type == SD_Card_SDSC_v1 )		/* HCS bit (0 here) is ignored by SDSC card */
+			state = SD_SendCmd( hsd, SD_CMD_ACTIVATE_INIT, 0x00000000, 0xFF );
 		else
-			state = SD_SendCmd( SD_CMD_ACTIVATE_INIT, 0x40000000, 0x77 );
+			state = SD_SendCmd( hsd, SD_CMD_ACTIVATE_INIT, 0x40000000, 0x77 );
 		/* loop while SD_IN_IDLE_STATE bit is set, meaning card is still performing initialization */
-	} while ( ( state & SD_IN_IDLE_STATE ) != 0x00 && i-- > 0 );
+	} while ( ( state & SD_IN_IDLE_STATE ) != 0x00 && SD_InitRetry( start, &i, &backoff ) );
+	ready = ( ( state & SD_IN_IDLE_STATE ) == 0x00 );
 	/* it might be legacy MMC card... */
-	if ( cardType == SD_Card_SDSC_v1 &&
+	if ( hsd->Type == SD_Card_SDSC_v1 &&
 			( state & SD_IN_IDLE_STATE ) != 0x00 )
-		cardType = SD_Card_MMC;
+		hsd->Type = SD_Card_MMC;
 
-	state = SD_WaitReady();	/* make sure card is ready before we go further... */
+	state = SD_WaitReady( hsd );	/* make sure card is ready before we go further... */
 
-	if ( cardType == SD_Card_MMC )	/* legacy MMC card is initialized with CMD1... */
+	if ( hsd->Type == SD_Card_MMC )	/* legacy MMC card is initialized with CMD1... */
 	{	/* -> CMD1(0) -> ... */
 		i = SD_NUM_TRIES_INIT; /* reset try count... */
+		start = xTaskGetTickCount();
+		backoff = 1;
 		do {
-			state = SD_SendCmd( SD_CMD_SEND_OP_COND, 0x00000000, 0xFF );
-		} while ( ( state & SD_IN_IDLE_STATE ) != 0x00 && i-- > 0 );
-		if ( i == 0 )
+			state = SD_SendCmd( hsd, SD_CMD_SEND_OP_COND, 0x00000000, 0xFF );
+		} while ( ( state & SD_IN_IDLE_STATE ) != 0x00 && SD_InitRetry( start, &i, &backoff ) );
+		if ( ( state & SD_IN_IDLE_STATE ) != 0x00 )
 			return SD_RESPONSE_FAILURE;	/* error occurred... */
 	}
-	else if ( cardType == SD_Card_SDSC_v2 ) /* recent cards support byte-addressing, check it... */
+	else if ( hsd->Type == SD_Card_SDSC_v2 ) /* recent cards support byte-addressing, check it... */
 	{	/* -> CMD58(0)... */
-		if ( i == 0 )	/* first check if timeout occured during its initialization... */
+		if ( !ready )	/* first check if timeout occured during its initialization... */
 			return SD_RESPONSE_FAILURE;	/* error occurred... */
 		/* request OCR register (send CMD58)... */
-		state = SD_SendCmd( SD_CMD_READ_OCR, 0x00000000, 0xFF );
+		state = SD_SendCmd( hsd, SD_CMD_READ_OCR, 0x00000000, 0xFF );
 		if ( state == SD_RESPONSE_NO_ERROR )
 		{ /* get OCR register (R3 response) and check its CCS (bit 30) */
-			SD_GetResponse4b( (uint8_t*)&res );
-			cardType = ( res & 0x40000000 ) ? SD_Card_SDHC : SD_Card_SDSC_v2;
+			SD_GetResponse4b( hsd, (uint8_t*)&res );
+			hsd->Type = ( res & 0x40000000 ) ? SD_Card_SDHC : SD_Card_SDSC_v2;
 		}
 	}
-	/* else cardType == SD_Card_SDSC_v1 */
+	/* else hsd->Type == SD_Card_SDSC_v1 */
 
-	state = SD_WaitReady();	/* make sure card is ready before we go further... */
+	state = SD_WaitReady( hsd );	/* make sure card is ready before we go further... */
 
 	/* print out detected SD card type... */
-	switch ( cardType )
+	switch ( hsd->Type )
 	{
-	case SD_Card_SDSC_v1:	printf( "SDSC v1 (byte address)" ); break;
-	case SD_Card_SDSC_v2:	printf( "SDSC v2 (byte address)" ); break;
-	case SD_Card_SDHC:		printf( "SDHC (512-bytes sector address)" ); break;
-	case SD_Card_MMC:		printf( "MMC (byte address)" ); break;
-	default:				printf( "UNKNOWN" ); break;
+	case SD_Card_SDSC_v1:	TRACE_INFO( "SDSC v1 (byte address)" ); break;
+	case SD_Card_SDSC_v2:	TRACE_INFO( "SDSC v2 (byte address)" ); break;
+	case SD_Card_SDHC:		TRACE_INFO( "SDHC (512-bytes sector address)" ); break;
+	case SD_Card_SDXC:		TRACE_INFO( "SDXC (512-bytes sector address)" ); break;
+	case SD_Card_MMC:		TRACE_INFO( "MMC (byte address)" ); break;
+	default:				TRACE_INFO( "UNKNOWN" ); break;
 	}
-	printf( " card initialized successfully\n" );
+	TRACE_INFO( " card initialized successfully\n" );
 
 	return SD_RESPONSE_NO_ERROR;
 }
 
 /**
  * @brief  Recieve data from SD Card
+ * @param  hsd: SD Card handle
  * @param  data: Pre-allocated data buffer
  * @param  len: Number of bytes to receive
  * @retval The SD Response:
  *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_DATA_CRC_ERROR: Data corrupted (CRC mismatch)
  *         - SD_RESPONSE_NO_ERROR: Sequence succeed
  */
-static SD_Error SD_ReceiveData( uint8_t *data, uint16_t len )
+static SD_Error SD_ReceiveData( SD_Handle* hsd, uint8_t *data, uint16_t len )
 {
 	uint16_t i = 0;
 	uint8_t b;
 
 	/* some cards need time before transmitting the data... */
-	b = SD_WaitBytesRead();
+	b = SD_WaitBytesRead( hsd );
 
 	if ( b != 0xFF )
 	{	/* most cards send transmission start token, don't fail if it's not the case... */
+		TRACE_EVENT( EVT_SD_RX_BEGIN, len, 0 );
 		data[ i ] = b;
 		if ( data[ i ] == SD_DATA_BLOCK_READ_START ) /* 0xFE */
-			data[ i ] = SD_ReadByte();	/* just get the next byte... */
+			data[ i ] = SD_ReadByte( hsd );	/* just get the next byte... */
 
 		/* receive the rest of data... */
-		for ( i = 1; i < len; ++i )
-			data[ i ] = SD_ReadByte();
-
+#ifdef USE_SPI_DMA
+		if ( len >= SD_DMA_MIN_LEN )
+		{
+			if ( STM_EVAL_SPI_DMA_Transfer( hsd->Spi.Bus, data + 1, NULL, len - 1 ) != SUCCESS )
+				return SD_RESPONSE_FAILURE;
+		}
+		else
+#endif /* USE_SPI_DMA */
+		STM_EVAL_SPI_PIO_Transfer( hsd->Spi.Bus, data + 1, NULL, len - 1 );
+
+#ifdef USE_SD_CRC
+		/* get CRC bytes and verify them... */
+		i = (uint16_t)SD_ReadByte( hsd ) << 8;
+		i |= SD_ReadByte( hsd );
+		if ( hsd->CrcOn && i != SD_CRC16( data, len ) )
+		{
+			SD_STATS_INC( CrcErrors );
+			TRACE_EVENT( EVT_SD_RX_END, len, SD_DATA_CRC_ERROR );
+			return SD_DATA_CRC_ERROR;
+		}
+#else
 		/* get CRC bytes (not really needed by us, but required by SD) */
-		SD_ReadByte();
-		SD_ReadByte();
+		SD_ReadByte( hsd );
+		SD_ReadByte( hsd );
+#endif /* USE_SD_CRC */
 
+		TRACE_EVENT( EVT_SD_RX_END, len, SD_RESPONSE_NO_ERROR );
 		return SD_RESPONSE_NO_ERROR;
 	}
 	return SD_RESPONSE_FAILURE;
 }
 
 /**
- * @brief  Read the CSD card register.
- *         Reading the contents of the CSD register in SPI mode is a simple
- *         read-block transaction.
- * @param  SD_csd: pointer on an SCD register structure
+ * @brief  Recieve data block from SD Card and compare it with the expected data.
+ *         With CRC on, the data are clocked out without storing them (by DMA if enabled)
+ *         and only CRC16 sent by the card is compared with CRC16 of the expected data,
+ *         otherwise the data are read in chunks of SD_VERIFY_CHUNK bytes and compared.
+ * @param  hsd: SD Card handle
+ * @param  data: Expected data
+ * @param  len: Number of bytes to receive
  * @retval The SD Response:
  *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_DATA_MISMATCH: Data differ from the expected ones
  *         - SD_RESPONSE_NO_ERROR: Sequence succeed
  */
-static SD_Error SD_GetCSDRegister( SD_CSD* SD_csd )
+static SD_Error SD_CompareData( SD_Handle* hsd, const uint8_t *data, uint16_t len )
 {
-	SD_Error state;
-	uint8_t CSD_Tab[ 16 ];
+	uint8_t chunk[ SD_VERIFY_CHUNK ];
+	SD_Error res = SD_RESPONSE_NO_ERROR;
+	uint16_t i, n;
+	uint8_t b;
 
-	state = SD_WaitReady();	/* make sure card is ready before we go further... */
-	if ( state != SD_RESPONSE_NO_ERROR )
+	b = SD_WaitBytesRead( hsd );
+	if ( b == 0xFF )
 		return SD_RESPONSE_FAILURE;
+	/* most cards send transmission start token, the first data byte follows it... */
+	TRACE_EVENT( EVT_SD_RX_BEGIN, len, 0 );
+	if ( b == SD_DATA_BLOCK_READ_START ) /* 0xFE */
+		b = SD_ReadByte( hsd );
+	if ( b != data[ 0 ] )
+		res = SD_DATA_MISMATCH;
+
+#ifdef USE_SD_CRC
+	if ( hsd->CrcOn )
+	{	/* the data don't have to be stored: CRC16 of the card covers them */
+#ifdef USE_SPI_DMA
+		if ( len >= SD_DMA_MIN_LEN )
+		{
+			if ( STM_EVAL_SPI_DMA_Transfer( hsd->Spi.Bus, NULL, NULL, len - 1 ) != SUCCESS )
+				return SD_RESPONSE_FAILURE;
+		}
+		else
+#endif /* USE_SPI_DMA */
+		STM_EVAL_SPI_PIO_Transfer( hsd->Spi.Bus, NULL, NULL, len - 1 );
+		i = (uint16_t)SD_ReadByte( hsd ) << 8;
+		i |= SD_ReadByte( hsd );
+		if ( i != SD_CRC16( data, len ) )
+			res = SD_DATA_MISMATCH;
+		TRACE_EVENT( EVT_SD_RX_END, len, res );
+		return res;
+	}
+#endif /* USE_SD_CRC */
 
-	/* request CSD register (send CMD9)... */
-	state = SD_SendCmd( SD_CMD_SEND_CSD, 0x00000000, 0xFF );
-	if ( state != SD_RESPONSE_NO_ERROR )
-		return SD_RESPONSE_FAILURE;
-	state = SD_ReceiveData( CSD_Tab, 16 );	/* receive CSD register data */
+	for ( i = 1; i < len; i += n )
+	{
+		n = ( len - i < SD_VERIFY_CHUNK ) ? len - i : SD_VERIFY_CHUNK;
+		STM_EVAL_SPI_PIO_Transfer( hsd->Spi.Bus, chunk, NULL, n );
+		if ( memcmp( chunk, data + i, n ) != 0 )
+			res = SD_DATA_MISMATCH;
+	}
+	/* get CRC bytes (not really needed by us, but required by SD) */
+	SD_ReadByte( hsd );
+	SD_ReadByte( hsd );
 
-	SD_csd->CSDStruct = ( CSD_Tab[ 0 ] & 0xC0 ) >> 6;				/* Byte 0 */
-	SD_csd->SysSpecVersion = ( CSD_Tab[ 0 ] & 0x3C ) >> 2;
-	SD_csd->Reserved1 = CSD_Tab[ 0 ] & 0x03;
-	SD_csd->TAAC = CSD_Tab[ 1 ];									/* Byte 1 */
-	SD_csd->NSAC = CSD_Tab[ 2 ];									/* Byte 2 */
-	SD_csd->MaxBusClkFrec = CSD_Tab[ 3 ];							/* Byte 3 */
-	SD_csd->CardComdClasses = CSD_Tab[ 4 ] << 4;					/* Byte 4 */
-	SD_csd->CardComdClasses |= ( CSD_Tab[ 5 ] & 0xF0 ) >> 4;		/* Byte 5 */
-	SD_csd->RdBlockLen = CSD_Tab[ 5 ] & 0x0F;
-	SD_csd->PartBlockRead = ( CSD_Tab[ 6 ] & 0x80 ) >> 7;			/* Byte 6 */
-	SD_csd->WrBlockMisalign = ( CSD_Tab[ 6 ] & 0x40 ) >> 6;
-	SD_csd->RdBlockMisalign = ( CSD_Tab[ 6 ] & 0x20 ) >> 5;
-	SD_csd->DSRImpl = ( CSD_Tab[ 6 ] & 0x10 ) >> 4;
-	SD_csd->Reserved2 = ( CSD_Tab[ 6 ] & 0x0C ) >> 2;
-	if ( SD_csd->CSDStruct == 0 )
-	{	/* v1 */
-		SD_csd->DeviceSize = ( CSD_Tab[ 6 ] & 0x03 ) << 10;	/* DeviceSize has 12 bits here */
-		SD_csd->DeviceSize |= CSD_Tab[ 7 ] << 2;					/* Byte 7 */
-		SD_csd->DeviceSize |= ( CSD_Tab[ 8 ] & 0xC0 ) >> 6;			/* Byte 8 */
-		SD_csd->MaxRdCurrentVDDMin = ( CSD_Tab[ 8 ] & 0x38 ) >> 3;
-		SD_csd->MaxRdCurrentVDDMax = CSD_Tab[ 8 ] & 0x07;
-		SD_csd->MaxWrCurrentVDDMin = ( CSD_Tab[ 9 ] & 0xE0 ) >> 5;	/* Byte 9 */
-		SD_csd->MaxWrCurrentVDDMax = ( CSD_Tab[ 9 ] & 0x1C ) >> 2;
-		SD_csd->DeviceSizeMul = ( CSD_Tab[ 9 ] & 0x03 ) << 1;
-		SD_csd->DeviceSizeMul |= ( CSD_Tab[ 10 ] & 0x80 ) >> 7;		/* Byte 10 */
+	TRACE_EVENT( EVT_SD_RX_END, len, res );
+	return res;
+}
+
+/**
+ * @brief  Send a data packet of SD_BLOCK_SIZE bytes to SD Card and wait until it is written.
+ *         CRC16 of the next block is calculated while the card is busy writing this one,
+ *         so the next packet follows the first ready byte at once.
+ * @param  hsd: SD Card handle
+ * @param  token: Data token (start of single or multiple block write)
+ * @param  data: Data to be sent
+ * @param  next: Data of the block to be sent next or NULL
+ * @param  crc: CRC16 of data (SD_BLOCK_CRC), receives CRC16 of next if data is accepted
+ *         (it is kept for the block rejected by card, which is sent again)
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_DATA_CRC_ERROR: Data block was rejected by card because of CRC error
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+static SD_Error SD_SendDataBlock( SD_Handle* hsd, uint8_t token, const uint8_t *data, const uint8_t* next, uint16_t* crc )
+{
+	SD_DataResponse res;
+
+	/* send data token to signify the start of data transmission... */
+	TRACE_EVENT( EVT_SD_TX_BEGIN, token, 0 );
+	SD_WriteByte( hsd, token );
+	/* send data... */
+#ifdef USE_SPI_DMA
+	if ( STM_EVAL_SPI_DMA_Transfer( hsd->Spi.Bus, NULL, data, SD_BLOCK_SIZE ) != SUCCESS )
+		return SD_RESPONSE_FAILURE;
+#else
+	STM_EVAL_SPI_PIO_Transfer( hsd->Spi.Bus, NULL, data, SD_BLOCK_SIZE );
+#endif /* USE_SPI_DMA */
+#ifdef USE_SD_CRC
+	/* put 2 CRC bytes... */
+	SD_WriteByte( hsd, (uint8_t)( *crc >> 8 ) );
+	SD_WriteByte( hsd, (uint8_t)*crc );
+#else
+	/* put 2 CRC bytes (not really needed by us, but required by SD) */
+	SD_ReadByte( hsd );
+	SD_ReadByte( hsd );
+#endif /* USE_SD_CRC */
+	/* check data response... */
+	res = (SD_DataResponse)( SD_ReadByte( hsd ) & SD_RESPONSE_MASK );	/* mask unused bits */
+	TRACE_EVENT( EVT_SD_TX_END, token, res );
+	if ( ( res & SD_RESPONSE_ACCEPTED ) != 0 )
+	{	/* card is now processing data and goes to BUSY mode, prepare the next block meanwhile... */
+		if ( next != NULL )
+			*crc = SD_BLOCK_CRC( next );
+		/* ...and wait until it finishes */
+		return SD_WaitBytesWritten( hsd );	/* make sure card is ready before we go further... */
 	}
-	else
-	{	/* v2 */
-		SD_csd->Reserved5 = ( CSD_Tab[ 6 ] & 0x03 ) << 2;
-		SD_csd->Reserved5 |= ( CSD_Tab[ 7 ] & 0xC0 ) >> 6;			/* Byte 7 */
-		SD_csd->DeviceSize = ( CSD_Tab[ 7 ] & 0x3F ) << 16;	/* DeviceSize has 22 bits here */
-		SD_csd->DeviceSize |= CSD_Tab[ 8 ] << 8;					/* Byte 8 */
-		SD_csd->DeviceSize |= CSD_Tab[ 9 ];							/* Byte 9 */
-		SD_csd->Reserved6 = ( CSD_Tab[ 10 ] & 0x80 ) >> 7;			/* Byte 10 */
+	if ( res == SD_RESPONSE_REJECTED_CRC )
+	{
+		SD_STATS_INC( CrcErrors );
+		return SD_DATA_CRC_ERROR;
 	}
-	SD_csd->EraseBlockEnable = ( CSD_Tab[ 10 ] & 0x40 ) >> 6;
-	SD_csd->EraseSectorSize = ( CSD_Tab[ 10 ] & 0x3F ) << 1;
-	SD_csd->EraseSectorSize |= ( CSD_Tab[ 11 ] & 0x80 ) >> 7;		/* Byte 11 */
-	SD_csd->WrProtectGrSize = CSD_Tab[ 11 ] & 0x7F;
-	SD_csd->WrProtectGrEnable = ( CSD_Tab[ 12 ] & 0x80 ) >> 7;		/* Byte 12 */
-	SD_csd->ManDeflECC = ( CSD_Tab[ 12 ] & 0x60 ) >> 5;
-	SD_csd->WrSpeedFact = ( CSD_Tab[ 12 ] & 0x1C ) >> 2;
-	SD_csd->MaxWrBlockLen = ( CSD_Tab[ 12 ] & 0x03 ) << 2;
-	SD_csd->MaxWrBlockLen |= ( CSD_Tab[ 13 ] & 0xC0 ) >> 6;			/* Byte 13 */
-	SD_csd->WriteBlockPaPartial = ( CSD_Tab[ 13 ] & 0x20 ) >> 5;
-	SD_csd->Reserved3 = CSD_Tab[ 13 ] & 0x1E;
-	SD_csd->ContentProtectAppli = CSD_Tab[ 13 ] & 0x01;
-	SD_csd->FileFormatGroup = ( CSD_Tab[ 14 ] & 0x80 ) >> 7;		/* Byte 14 */
-	SD_csd->CopyFlag = ( CSD_Tab[ 14 ] & 0x40 ) >> 6;
-	SD_csd->PermWrProtect = ( CSD_Tab[ 14 ] & 0x20 ) >> 5;
-	SD_csd->TempWrProtect = ( CSD_Tab[ 14 ] & 0x10 ) >> 4;
-	SD_csd->FileFormat = ( CSD_Tab[ 14 ] & 0x0C ) >> 2;
-	SD_csd->ECC = CSD_Tab[ 14 ] & 0x03;
-	SD_csd->CSD_CRC = ( CSD_Tab[ 15 ] & 0xFE ) >> 1;				/* Byte 15 */
-	SD_csd->Reserved4 = CSD_Tab[ 15 ] & 0x01;
+	SD_STATS_INC( WriteErrors );
+	return SD_RESPONSE_FAILURE;
+}
+
+/**
+ * @brief  Notifies SD card about the number of blocks to be written by the following CMD25
+ *         (send ACMD23) to let it pre-erase them, then writing takes less time
+ * @param  hsd: SD Card handle
+ * @param  nbSectors: Number of blocks, 0 if it's unknown (nothing is sent then)
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+static SD_Error SD_PreErase( SD_Handle* hsd, uint32_t nbSectors )
+{
+	SD_Error state;
 
+	if ( SD_IS_MMC( hsd ) || nbSectors == 0 )
+		return SD_RESPONSE_NO_ERROR;	/* MMC cards have no ACMD23 */
+	state = SD_SendCmd( hsd, SD_CMD_SEND_APP, 0x00000000, 0x65 );
+	if ( state == SD_RESPONSE_NO_ERROR )
+		state = SD_SendCmd( hsd, SD_CMD_SET_WR_BLK_ERASE_COUNT, nbSectors & 0x007FFFFF, 0xFF );
+	return state;
+}
+
+/**
+ * @brief  Checks that a finished multiple block write has really been programmed: card accepts
+ *         blocks before it programs them, so their write errors are reported only by card
+ *         status (send CMD13). On error the card tells the number of well written blocks
+ *         of the last write command (send ACMD22), so only the blocks after them are repeated.
+ * @param  hsd: SD Card handle
+ * @param  nbWritten: Receives the number of well written blocks on error (0 if it is unknown)
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Card doesn't respond
+ *         - SD_ADDRESS_ERROR: Blocks are out of range or write protected (permanent error)
+ *         - SD_DATA_WRITE_ERROR: Card failed programming some blocks
+ *         - SD_RESPONSE_NO_ERROR: All blocks are written
+ */
+static SD_Error SD_CheckWritten( SD_Handle* hsd, uint32_t* nbWritten )
+{
+	SD_Error state;
+	uint8_t r2, num[ 4 ];
+
+	state = SD_SendCmd( hsd, SD_CMD_SEND_STATUS, 0x00000000, 0xFF );
+	r2 = SD_ReadByte( hsd );
+	*nbWritten = 0;
+	if ( ( state & SD_CHECK_BIT ) != 0 )
+		return SD_RESPONSE_FAILURE;
+	if ( state == SD_RESPONSE_NO_ERROR &&
+			( r2 & ( SD_R2_ERROR | SD_R2_CC_ERROR | SD_R2_CARD_ECC_FAILED | SD_R2_WP_VIOLATION | SD_R2_OUT_OF_RANGE ) ) == 0 )
+		return SD_RESPONSE_NO_ERROR;
+
+	SD_STATS_INC( WriteErrors );
+	if ( !SD_IS_MMC( hsd ) )	/* MMC cards have no ACMD22 */
+	{
+		SD_WaitReady( hsd );
+		state = SD_SendCmd( hsd, SD_CMD_SEND_APP, 0x00000000, 0x65 );
+		if ( state == SD_RESPONSE_NO_ERROR )
+			state = SD_SendCmd( hsd, SD_CMD_SEND_NUM_WR_BLOCKS, 0x00000000, 0xFF );
+		if ( state == SD_RESPONSE_NO_ERROR )
+			state = SD_ReceiveData( hsd, num, sizeof( num ) );
+		if ( state == SD_RESPONSE_NO_ERROR )	/* MSB first */
+			*nbWritten = ( (uint32_t)num[ 0 ] << 24 ) | ( (uint32_t)num[ 1 ] << 16 ) | ( (uint32_t)num[ 2 ] << 8 ) | num[ 3 ];
+	}
+	TRACE_ERROR( "write error (R2 %02X), %lu blocks written\n", r2, *nbWritten );
+
+	if ( ( r2 & ( SD_R2_WP_VIOLATION | SD_R2_OUT_OF_RANGE ) ) != 0 )
+		return SD_ADDRESS_ERROR;
+	return SD_DATA_WRITE_ERROR;
+}
+
+/**
+ * @brief  Closes streaming write and streaming read if they are open
+ * @param  hsd: SD Card handle
+ * @retval None
+ */
+static void SD_StreamsEnd( SD_Handle* hsd )
+{
+	SD_WriteStreamEnd( hsd );
+	SD_ReadStreamEnd( hsd );
+}
+
+/**
+ * @brief  Decodes maximum data transfer rate (TRAN_SPEED field of CSD)
+ * @param  tranSpeed: TRAN_SPEED byte (0x32 for 25MHz, 0x5A for 50MHz)
+ * @retval Maximum bus clock frequency in Hz, 0 for reserved values
+ */
+static uint32_t SD_TranSpeedHz( uint8_t tranSpeed )
+{
+	/* time value multiplied by 10: 1.0, 1.2, 1.3, 1.5, 2.0, 2.5, 3.0, 3.5, 4.0, 4.5, 5.0, 5.5, 6.0, 7.0, 8.0 */
+	static const uint8_t value[ 16 ] = { 0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80 };
+	/* transfer rate unit divided by 10: 100kbit/s, 1Mbit/s, 10Mbit/s, 100Mbit/s */
+	static const uint32_t unit[ 4 ] = { 10000, 100000, 1000000, 10000000 };
+
+	if ( ( tranSpeed & 0x07 ) > 3 )
+		return 0;
+	return value[ ( tranSpeed >> 3 ) & 0x0F ] * unit[ tranSpeed & 0x07 ];
+}
+
+/**
+ * @brief  Switches to the fastest SPI bus clock allowed by card (TRAN_SPEED of the CSD read already)
+ * @param  hsd: SD Card handle
+ * @retval Bus clock frequency set in Hz
+ */
+static uint32_t SD_SetFastSpeed( SD_Handle* hsd )
+{
+	uint32_t speed = SD_TranSpeedHz( SD_CSD_Get( &hsd->Info, SD_CSD_TRAN_SPEED ) );
+	uint32_t max = SD_SPI_MAX_SPEED_HZ;
+
+#ifdef SD_SPI_HIGH_SPEED
+	if ( hsd->HighSpeed )
+		max = SD_SPI_HS_MAX_SPEED_HZ;
+#endif /* SD_SPI_HIGH_SPEED */
+	if ( speed == 0 || speed > max )
+		speed = max;
+	return STM_EVAL_SPI_Set_Speed( &hsd->Spi, speed );
+}
+
+#ifdef SD_SPI_HIGH_SPEED
+/**
+ * @brief  Switch card into High Speed mode (up to 50MHz) if it supports it (send CMD6),
+ *         the CSD read already tells if it has switch commands
+ * @param  hsd: SD Card handle
+ * @retval Nonzero if card is switched to High Speed mode
+ */
+static uint8_t SD_SwitchHighSpeed( SD_Handle* hsd )
+{
+	uint8_t status[ 64 ];
+
+	if ( SD_IS_MMC( hsd ) || ( SD_CSD_Get( &hsd->Info, SD_CSD_CCC ) & SD_CCC_SWITCH ) == 0 )
+		return 0;	/* card doesn't support CMD6 (spec v1.0 card) */
+
+	SD_WaitReady( hsd );
+	if ( SD_SendCmd( hsd, SD_CMD_SWITCH_FUNC, SD_SWITCH_HIGH_SPEED, 0xFF ) != SD_RESPONSE_NO_ERROR )
+		return 0;
+	if ( SD_ReceiveData( hsd, status, sizeof( status ) ) != SD_RESPONSE_NO_ERROR )
+		return 0;
+	/* bits 379:376 (byte 16) hold function selected in group 1, the switch takes 8 clocks */
+	SD_ReadByte( hsd );
+	return ( ( status[ 16 ] & 0x0F ) == 0x01 );
+}
+#endif /* SD_SPI_HIGH_SPEED */
+
+/**
+ * @brief  Fast reinitialization of the card which stopped responding in the middle of a transfer:
+ *         rump up, soft reset and identification as SD_Init does it, but registers are known
+ *         already, so the bus goes back to full speed at once. The bus is held by the caller.
+ * @param  hsd: SD Card handle
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed or another card is in the slot
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+static SD_Error SD_Reinit( SD_Handle* hsd )
+{
+	SDCardType type = hsd->Type;
+	SD_Error state;
+	uint32_t i = 0;
+
+	hsd->WrStreamOpen = 0;	/* card is reset, streaming transfers can't go on */
+	hsd->RdStreamOpen = 0;
+
+	STM_EVAL_SPI_Deselect( &hsd->Spi );
+	STM_EVAL_SPI_Low_Speed( &hsd->Spi );
+	while ( i++ < SD_NUM_TRIES_RUMPUP )
+		SD_WriteByte( hsd, SD_DUMMY_BYTE );
+	STM_EVAL_SPI_Select( &hsd->Spi );
+
+	state = SD_GoIdleState( hsd );
+	/* CCS bit doesn't tell SDXC from SDHC (see SD_Init) */
+	if ( hsd->Type == SD_Card_SDHC && type == SD_Card_SDXC )
+		hsd->Type = SD_Card_SDXC;
+	if ( state == SD_RESPONSE_NO_ERROR && hsd->Type != type )
+		state = SD_RESPONSE_FAILURE;
+	if ( state == SD_RESPONSE_NO_ERROR && SD_BYTE_ADDR( hsd ) )
+		state = SD_FixSectorSize( hsd, (uint16_t)SD_BLOCK_SIZE );
+#ifdef SD_SPI_HIGH_SPEED
+	/* reset card is back in default speed mode */
+	if ( state == SD_RESPONSE_NO_ERROR && hsd->HighSpeed )
+		hsd->HighSpeed = SD_SwitchHighSpeed( hsd );
+#endif /* SD_SPI_HIGH_SPEED */
+	if ( state == SD_RESPONSE_NO_ERROR )
+		SD_SetFastSpeed( hsd );
+	return state;
+}
+
+/**
+ * @brief  Recovers from a failed transfer (the bus is held, the transmission is stopped
+ *         already), so the caller repeats it from the failed block. Corrupted block is just
+ *         repeated, so are blocks the card failed to program (SD_CheckWritten); a command
+ *         refused because of its address fails for good; otherwise the card is asked for
+ *         its status (send CMD13): if it answers,
+ *         the block is repeated unless the error is permanent (address out of range, write
+ *         protection, locked card); if it doesn't, the card is reinitialized (SD_Reinit).
+ *         Successful transfers never get here, so they don't lose any time.
+ * @param  hsd: SD Card handle
+ * @param  state: Result of the failed transfer
+ * @param  tries: Recoveries left, decremented
+ * @retval Nonzero if the transfer has to be repeated from the failed block
+ */
+static uint8_t SD_Recover( SD_Handle* hsd, SD_Error state, uint8_t* tries )
+{
+	uint8_t r2;
+
+	if ( state == SD_RESPONSE_NO_ERROR )
+		return 0;
+	if ( *tries == 0 ||
+			( ( state & SD_CHECK_BIT ) == 0 && ( state & ( SD_ADDRESS_ERROR | SD_PARAMETER_ERROR ) ) != 0 ) )
+	{	/* no tries left or the command was refused because of its address */
+		SD_STATS_INC( Unrecovered );
+		return 0;
+	}
+	--*tries;
+	SD_STATS_INC( Retries );
+	if ( state == SD_DATA_CRC_ERROR || state == SD_DATA_WRITE_ERROR )
+		return 1;	/* card has told what is wrong already */
+
+	/* ask the card what has happened (R2 response: R1 and one more byte)... */
+	SD_STATS_INC( StatusQueries );
+	SD_WaitReady( hsd );
+	state = SD_SendCmd( hsd, SD_CMD_SEND_STATUS, 0x00000000, 0xFF );
+	r2 = SD_ReadByte( hsd );
+	if ( ( state & ( SD_CHECK_BIT | SD_IN_IDLE_STATE ) ) == 0 )
+	{	/* card is alive, it tells permanent errors from transient ones */
+		if ( ( state & ( SD_ADDRESS_ERROR | SD_PARAMETER_ERROR ) ) != 0 ||
+				( r2 & ( SD_R2_OUT_OF_RANGE | SD_R2_WP_VIOLATION | SD_R2_CARD_LOCKED ) ) != 0 )
+		{
+			TRACE_ERROR( "permanent error (R2 %02X %02X)\n", state, r2 );
+			SD_STATS_INC( Unrecovered );
+			return 0;
+		}
+		return 1;
+	}
+
+	/* card is silent or has lost its state (power glitch) => reset it */
+	SD_STATS_INC( Reinits );
+	if ( SD_Reinit( hsd ) == SD_RESPONSE_NO_ERROR )
+		return 1;
+	TRACE_ERROR( "card reinitialization failed\n" );
+	SD_STATS_INC( Unrecovered );
+	return 0;
+}
+
+/**
+ * @brief  Read the CSD card register.
+ *         Reading the contents of the CSD register in SPI mode is a simple
+ *         read-block transaction.
+ * @param  hsd: SD Card handle
+ * @param  CSD_Tab: buffer for raw register (16 bytes)
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+static SD_Error SD_GetCSDRegister( SD_Handle* hsd, uint8_t* CSD_Tab )
+{
+	SD_Error state;
+
+	state = SD_WaitReady( hsd );	/* make sure card is ready before we go further... */
+	if ( state != SD_RESPONSE_NO_ERROR )
+		return SD_RESPONSE_FAILURE;
+
+	/* request CSD register (send CMD9)... */
+	state = SD_SendCmd( hsd, SD_CMD_SEND_CSD, 0x00000000, 0xFF );
+	if ( state != SD_RESPONSE_NO_ERROR )
+		return SD_RESPONSE_FAILURE;
+	state = SD_ReceiveData( hsd, CSD_Tab, 16 );	/* receive CSD register data */
 	return state;
 }
 
@@ -667,45 +1528,25 @@ static SD_Error SD_GetCSDRegister( SD_CSD* SD_csd )
  * @brief  Read the CID card register.
  *         Reading the contents of the CID register in SPI mode is a simple
  *         read-block transaction.
- * @param  SD_cid: pointer on an CID register structure
+ * @param  hsd: SD Card handle
+ * @param  CID_Tab: buffer for raw register (16 bytes)
  * @retval The SD Response:
  *         - SD_RESPONSE_FAILURE: Sequence failed
  *         - SD_RESPONSE_NO_ERROR: Sequence succeed
  */
-static SD_Error SD_GetCIDRegister( SD_CID* SD_cid )
+static SD_Error SD_GetCIDRegister( SD_Handle* hsd, uint8_t* CID_Tab )
 {
 	SD_Error state;
-	uint8_t CID_Tab[ 16 ];
 
-	state = SD_WaitReady();	/* make sure card is ready before we go further... */
+	state = SD_WaitReady( hsd );	/* make sure card is ready before we go further... */
 	if ( state != SD_RESPONSE_NO_ERROR )
 		return SD_RESPONSE_FAILURE;
 
 	/* request CID register (send CMD10)... */
-	state = SD_SendCmd( SD_CMD_SEND_CID, 0x00000000, 0xFF );
+	state = SD_SendCmd( hsd, SD_CMD_SEND_CID, 0x00000000, 0xFF );
 	if ( state != SD_RESPONSE_NO_ERROR )
 		return SD_RESPONSE_FAILURE;
-	state = SD_ReceiveData( CID_Tab, 16 );	/* receive CID register data */
-
-	SD_cid->ManufacturerID = CID_Tab[ 0 ];				/* Byte 0 */
-	SD_cid->OEM_AppliID = CID_Tab[ 1 ] << 8;			/* Byte 1 */
-	SD_cid->OEM_AppliID |= CID_Tab[ 2 ];				/* Byte 2 */
-	SD_cid->ProdName1 = CID_Tab[ 3 ] << 24;				/* Byte 3 */
-	SD_cid->ProdName1 |= CID_Tab[ 4 ] << 16;			/* Byte 4 */
-	SD_cid->ProdName1 |= CID_Tab[ 5 ] << 8;				/* Byte 5 */
-	SD_cid->ProdName1 |= CID_Tab[ 6 ];					/* Byte 6 */
-	SD_cid->ProdName2 = CID_Tab[ 7 ];					/* Byte 7 */
-	SD_cid->ProdRev = CID_Tab[ 8 ];						/* Byte 8 */
-	SD_cid->ProdSN = CID_Tab[ 9 ] << 24;				/* Byte 9 */
-	SD_cid->ProdSN |= CID_Tab[ 10 ] << 16;				/* Byte 10 */
-	SD_cid->ProdSN |= CID_Tab[ 11 ] << 8;				/* Byte 11 */
-	SD_cid->ProdSN |= CID_Tab[ 12 ];					/* Byte 12 */
-	SD_cid->Reserved1 |= ( CID_Tab[ 13 ] & 0xF0 ) >> 4;	/* Byte 13 */
-	SD_cid->ManufactDate = ( CID_Tab[ 13 ] & 0x0F ) << 8;
-	SD_cid->ManufactDate |= CID_Tab[ 14 ];				/* Byte 14 */
-	SD_cid->CID_CRC = ( CID_Tab[ 15 ] & 0xFE ) >> 1;	/* Byte 15 */
-	SD_cid->Reserved2 = 1;
-
+	state = SD_ReceiveData( hsd, CID_Tab, 16 );	/* receive CID register data */
 	return state;
 }
 
@@ -713,50 +1554,33 @@ static SD_Error SD_GetCIDRegister( SD_CID* SD_cid )
  * @brief  Read the SCR card register.
  *         Reading the contents of the SCR register in SPI mode is a simple
  *         read-block transaction.
- * @param  SD_scr: pointer on an SCR register structure
+ * @param  hsd: SD Card handle
+ * @param  SCR_Tab: buffer for raw register (8 bytes)
  * @retval The SD Response:
  *         - SD_RESPONSE_FAILURE: Sequence failed
  *         - SD_RESPONSE_NO_ERROR: Sequence succeed
  */
-static SD_Error SD_GetSCRRegister( SD_SCR* SD_scr )
+static SD_Error SD_GetSCRRegister( SD_Handle* hsd, uint8_t* SCR_Tab )
 {
 	SD_Error state;
-	uint8_t SCR_Tab[ 8 ];
 
-	if ( cardType == SD_Card_MMC )
+	if ( SD_IS_MMC( hsd ) )
 	{
-		printf( "SCR Register is not available for MMC cards\n" );
+		TRACE_ERROR( "SCR Register is not available for MMC cards\n" );
 		return SD_ILLEGAL_COMMAND;
 	}
 
-	state = SD_WaitReady();	/* make sure card is ready before we go further... */
+	state = SD_WaitReady( hsd );	/* make sure card is ready before we go further... */
 	if ( state != SD_RESPONSE_NO_ERROR )
 		return SD_RESPONSE_FAILURE;
 
 	/* request SCR register (send ACMD51)... */
-	state = SD_SendCmd( SD_CMD_SEND_APP, 0x00000000, 0x65 );
+	state = SD_SendCmd( hsd, SD_CMD_SEND_APP, 0x00000000, 0x65 );
 	if ( state == SD_RESPONSE_NO_ERROR )
-		state = SD_SendCmd( SD_CMD_SEND_SCR, 0x00000000, 0xFF );
+		state = SD_SendCmd( hsd, SD_CMD_SEND_SCR, 0x00000000, 0xFF );
 	if ( state != SD_RESPONSE_NO_ERROR )
 		return SD_RESPONSE_FAILURE;
-	state = SD_ReceiveData( SCR_Tab, 8 );	/* receive SCR register data */
-
-	SD_scr->SCR_Version = ( SCR_Tab[ 0 ] & 0xF0 ) >> 4;		/* Byte 0 */
-	SD_scr->SpecVersion = SCR_Tab[ 0 ] & 0x0F;
-	SD_scr->StateAfterErase = ( SCR_Tab[ 1 ] & 0x80 ) >> 7;	/* Byte 1 */
-	SD_scr->Security = ( SCR_Tab[ 1 ] & 0x70 ) >> 4;
-	SD_scr->BusWidth = SCR_Tab[ 1 ] & 0x0F;
-	SD_scr->SpecVersion3 = ( SCR_Tab[ 2 ] & 0x80 ) >> 7;	/* Byte 2 */
-	SD_scr->ExSecurity = ( SCR_Tab[ 2 ] & 0x78 ) >> 3;
-	SD_scr->Reserved1 = ( SCR_Tab[ 2 ] & 0x07 ) << 6;
-	SD_scr->Reserved1 |= ( SCR_Tab[ 3 ] & 0xFC ) >> 2;		/* Byte 3 */
-	SD_scr->CmdSupport1 = ( SCR_Tab[ 3 ] & 0x02 ) >> 1;
-	SD_scr->CmdSupport2 = SCR_Tab[ 3 ] & 0x01;
-	SD_scr->Reserved2 = SCR_Tab[ 4 ] << 24;					/* Byte 4 */
-	SD_scr->Reserved2 |= SCR_Tab[ 5 ] << 16;				/* Byte 5 */
-	SD_scr->Reserved2 |= SCR_Tab[ 6 ] << 8;					/* Byte 6 */
-	SD_scr->Reserved2 |= SCR_Tab[ 7 ];						/* Byte 7 */
-
+	state = SD_ReceiveData( hsd, SCR_Tab, 8 );	/* receive SCR register data */
 	return state;
 }
 
@@ -771,123 +1595,208 @@ static SD_Error SD_GetSCRRegister( SD_SCR* SD_scr )
 
 /**
  * @brief  Detect if SD card is correctly plugged in the memory slot.
- * @param  None
+ * @param  hsd: SD Card handle
  * @retval Return if SD is detected or not
  */
-uint8_t SD_Detect( void )
+uint8_t SD_Detect( SD_Handle* hsd )
 {	/* check GPIO to detect SD */
-	if ( GPIO_ReadInputData( SD_DETECT_GPIO_PORT ) & SD_DETECT_PIN )
+	if ( GPIO_ReadInputData( hsd->Detect_Port ) & hsd->Detect_Pin )
 		return SD_NOT_PRESENT;
 	return SD_PRESENT;
 }
 
 /**
  * @brief  DeInitializes the SD Card
- * @param  None
+ * @param  hsd: SD Card handle
  * @retval None
  */
-void SD_DeInit( void )
+void SD_DeInit( SD_Handle* hsd )
 {	/* just shutdown SPI bus - disable SD CS Clock */
-	SD_CS_GPIO_CLK_INIT( SD_CS_GPIO_CLK, DISABLE );
+	RCC_AHB1PeriphClockCmd( hsd->CS_Clk, DISABLE );
 }
 
 /**
  * @brief  Initializes the SD Card
- * @param  None
+ * @param  hsd: SD Card handle
  * @retval The SD Response:
  *         - SD_RESPONSE_FAILURE: Sequence failed
  *         - SD_RESPONSE_NO_ERROR: Sequence succeed
  */
-SD_Error SD_Init( void )
+SD_Error SD_Init( SD_Handle* hsd )
 {
 	GPIO_InitTypeDef GPIO_InitStructure;
 	SD_Error state;
 	uint32_t i = 0;
 
+	hsd->Timing = SD_TimingProfiles[ 0 ];	/* until the card tells its model */
+	hsd->WrStreamOpen = 0;	/* card is reset, streaming transfers can't go on */
+	hsd->RdStreamOpen = 0;
+	hsd->Cmd23 = 0;
+	hsd->HighSpeed = 0;
+	hsd->InfoValid = 0;
+	memset( &hsd->Info, 0, sizeof( hsd->Info ) );
+
 	/* step 0:
-	 * Check if SD card is present... */
-	if ( SD_Detect() == SD_NOT_PRESENT )
+	 * Check if SD card is present (detect pin is pulled up, card in the slot pulls it low)... */
+	RCC_AHB1PeriphClockCmd( hsd->Detect_Clk, ENABLE );
+	GPIO_InitStructure.GPIO_Pin = hsd->Detect_Pin;
+	GPIO_InitStructure.GPIO_Mode = GPIO_Mode_IN;
+	GPIO_InitStructure.GPIO_PuPd = GPIO_PuPd_UP;
+	GPIO_InitStructure.GPIO_Speed = GPIO_Speed_2MHz;
+	GPIO_Init( hsd->Detect_Port, &GPIO_InitStructure );
+	if ( SD_Detect( hsd ) == SD_NOT_PRESENT )
 		return SD_RESPONSE_FAILURE;
 
+#ifdef USE_SD_STATS
+	DWT_Enable();	/* cycle counter is used to measure durations of operations */
+#endif /* USE_SD_STATS */
+
 	/* step 1:
 	 * Initialize SD card-related pins on SPI bus */
-	SD_CS_GPIO_CLK_INIT( SD_CS_GPIO_CLK, ENABLE );	/* enable SD CS clock... */
-	GPIO_InitStructure.GPIO_Pin = SD_CS_PIN;		/* configure SD CS pin... */
+	RCC_AHB1PeriphClockCmd( hsd->CS_Clk, ENABLE );	/* enable SD CS clock... */
+	GPIO_InitStructure.GPIO_Pin = hsd->Spi.CS_Pin;	/* configure SD CS pin... */
 	GPIO_InitStructure.GPIO_Mode = GPIO_Mode_OUT;
 	GPIO_InitStructure.GPIO_OType = GPIO_OType_PP;
 	GPIO_InitStructure.GPIO_PuPd = GPIO_PuPd_UP;
 	GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
-	GPIO_Init( SD_CS_GPIO_PORT, &GPIO_InitStructure );
+	GPIO_Init( hsd->Spi.CS_Port, &GPIO_InitStructure );
 
 	/* step 2:
 	 * Card is now powered up (i.e. 1ms at least elapsed at 0.5V),
 	 * Supply rump up time (set MOSI HIGH) to let voltage reach stable 2.2V at least.
-	 * According to the specs it must be 74 SPI clock cycles minimum at 100-400Khz
-	 * At 25Mhz it'll be 250 times more cycles => send 2500 times 0xFF byte.
+	 * According to the specs it must be 74 SPI clock cycles minimum at 100-400Khz,
+	 * identification is done at this low speed too.
 	 * Chip Select pin should be set HIGH too. */
+	STM_EVAL_SPI_Low_Speed( &hsd->Spi );
+	STM_EVAL_SPI_Lock( &hsd->Spi );
 
 	/* set SD chip select pin high */
-	GPIO_SetBits( SD_CS_GPIO_PORT, SD_CS_PIN );
-	/* send dummy byte 0xFF (rise MOSI high for 2500*8 SPI bus clock cycles) */
+	STM_EVAL_SPI_Deselect( &hsd->Spi );
+	/* send dummy byte 0xFF (rise MOSI high for SD_NUM_TRIES_RUMPUP*8 SPI bus clock cycles) */
 	while ( i++ < SD_NUM_TRIES_RUMPUP )
-		SD_WriteByte( SD_DUMMY_BYTE );
+		SD_WriteByte( hsd, SD_DUMMY_BYTE );
+
+	STM_EVAL_SPI_Unlock( &hsd->Spi );
 
 	/* step 3:
 	 * Put SD in SPI mode & perform soft reset */
-	state = SD_GoIdleState();
+	SD_Bus_Hold( hsd );
+	state = SD_GoIdleState( hsd );
 
 	/* step 4:
 	 * Force sector size to SD_BLOCK_SIZE (i.e. 512 bytes) */
-	if ( state == SD_RESPONSE_NO_ERROR && cardType != SD_Card_SDHC )
-		state = SD_FixSectorSize( (uint16_t)SD_BLOCK_SIZE );
+	if ( state == SD_RESPONSE_NO_ERROR && SD_BYTE_ADDR( hsd ) )
+		state = SD_FixSectorSize( hsd, (uint16_t)SD_BLOCK_SIZE );
 
 	/* step 5:
+	 * Switch to the fastest SPI bus clock allowed by card (TRAN_SPEED of CSD),
+	 * High Speed mode raises it (CSD is read again then),
+	 * CSD, CID and SCR are kept for SD_GetCardInfo */
+	if ( state == SD_RESPONSE_NO_ERROR )
+		state = SD_GetCSDRegister( hsd, hsd->Info.CSD );
+#ifdef SD_SPI_HIGH_SPEED
+	if ( state == SD_RESPONSE_NO_ERROR )
+		hsd->HighSpeed = SD_SwitchHighSpeed( hsd );
+	if ( state == SD_RESPONSE_NO_ERROR && hsd->HighSpeed )
+	{
+		TRACE_INFO( "High Speed mode\n" );
+		state = SD_GetCSDRegister( hsd, hsd->Info.CSD );
+	}
+#endif /* SD_SPI_HIGH_SPEED */
+	if ( state == SD_RESPONSE_NO_ERROR )
+		TRACE_INFO( "SPI bus clock %lu Hz\n", SD_SetFastSpeed( hsd ) );
+
+	if ( state == SD_RESPONSE_NO_ERROR )
+		state = SD_GetCIDRegister( hsd, hsd->Info.CID );
+	if ( state == SD_RESPONSE_NO_ERROR )
+		SD_TimingSelect( hsd );
+
+	/* step 6:
+	 * Check if SD card supports CMD23 (set block count) for multiple block writes */
+	memset( hsd->Info.SCR, 0, sizeof( hsd->Info.SCR ) );
+	if ( state == SD_RESPONSE_NO_ERROR && !SD_IS_MMC( hsd ) )
+	{
+		state = SD_GetSCRRegister( hsd, hsd->Info.SCR );
+		hsd->Cmd23 = ( state == SD_RESPONSE_NO_ERROR && SD_SCR_Get( &hsd->Info, SD_SCR_CMD23 ) );
+	}
+	if ( state == SD_RESPONSE_NO_ERROR )
+	{
+		SD_CalcCardCapacity( &hsd->Info );
+		hsd->InfoValid = 1;
+		/* CCS bit doesn't tell SDXC from SDHC, the capacity does */
+		if ( hsd->Type == SD_Card_SDHC && hsd->Info.CardCapacity > SD_SDHC_MAX_KB )
+		{
+			hsd->Type = SD_Card_SDXC;
+			TRACE_INFO( "SDXC card, %lu Mb\n", hsd->Info.CardCapacity / 1024 );
+		}
+	}
+#ifdef USE_SD_FIXED_TYPE
+	/* driver is built for one card type, others would be addressed wrongly */
+	if ( state == SD_RESPONSE_NO_ERROR && !SD_TYPE_ACCEPTED( hsd ) )
+	{
+		TRACE_ERROR( "Card type %d is not supported by this build\n", hsd->Type );
+		hsd->InfoValid = 0;
+		state = SD_RESPONSE_FAILURE;
+	}
+#endif /* USE_SD_FIXED_TYPE */
+
+	/* step 7:
 	 * Release SPI bus for other devices */
-	SD_Bus_Release();
+	SD_Bus_Release( hsd );
 
 	return state;
 }
 
 /**
  * @brief  Reads a sector of SD_BLOCK_SIZE bytes from the SD card
+ * @param  hsd: SD Card handle
  * @param  pBuffer: pointer to the buffer that receives the data read from SD.
  * @param  readAddr: SD's internal address to read from (sector number)
  * @retval The SD Response:
  *         - SD_RESPONSE_FAILURE: Sequence failed
  *         - SD_RESPONSE_NO_ERROR: Sequence succeed
  */
-SD_Error SD_SectorRead( uint32_t readAddr, uint8_t* pBuffer )
+SD_Error SD_SectorRead( SD_Handle* hsd, uint32_t readAddr, uint8_t* pBuffer )
 {
 	SD_Error state;
+	uint8_t tries = SD_NUM_TRIES_RECOVER;
 
-	printf( "--> reading sector %lu ...", readAddr );
+	TRACE_VERBOSE( "--> reading sector %lu ...", readAddr );
 
 	/* non High Capacity cards use byte-oriented addresses */
-	if ( cardType != SD_Card_SDHC )
+	if ( SD_BYTE_ADDR( hsd ) )
 		readAddr <<= 9;
 
-	SD_Bus_Hold();		/* hold SPI bus... */
+	SD_StreamsEnd( hsd );	/* other commands can't be sent while streaming transfer is open */
+	SD_Bus_Hold( hsd );		/* hold SPI bus... */
 
-	state = SD_WaitReady();	/* make sure card is ready before we go further... */
+	while ( 1 )
+	{
+		state = SD_WaitReady( hsd );	/* make sure card is ready before we go further... */
 
-	/* send CMD17 (SD_CMD_READ_SINGLE_BLOCK) to read one block */
-	state = SD_SendCmd( SD_CMD_READ_SINGLE_BLOCK, readAddr, 0xFF );
-	/* receive data if command acknowledged... */
-	if ( state == SD_RESPONSE_NO_ERROR )
-		state = SD_ReceiveData( pBuffer, SD_BLOCK_SIZE );
+		/* send CMD17 (SD_CMD_READ_SINGLE_BLOCK) to read one block */
+		state = SD_SendCmd( hsd, SD_CMD_READ_SINGLE_BLOCK, readAddr, 0xFF );
+		/* receive data if command acknowledged... */
+		if ( state == SD_RESPONSE_NO_ERROR )
+			state = SD_ReceiveData( hsd, pBuffer, SD_BLOCK_SIZE );
+		/* failed data block is read again... */
+		if ( !SD_Recover( hsd, state, &tries ) )
+			break;
+	}
 
-	SD_Bus_Release();	/* release SPI bus... */
+	SD_Bus_Release( hsd );	/* release SPI bus... */
 
 	if ( state == SD_RESPONSE_NO_ERROR )
-		printf( "OK\n" );
+		TRACE_VERBOSE( "OK\n" );
 	else
-		printf( "KO(%d)\n", state );
+		TRACE_ERROR( "KO(%d) reading sector\n", state );
 
 	return state;
 }
 
 /**
  * @brief  Reads multiple sectors of SD_BLOCK_SIZE bytes from the SD card
+ * @param  hsd: SD Card handle
  * @param  pBuffer: pointer to the buffer that receives the data read from SD.
  * @param  readAddr: SD's internal address to read from.
  * @param  nbSectors: number of blocks to be read.
@@ -895,107 +1804,182 @@ SD_Error SD_SectorRead( uint32_t readAddr, uint8_t* pBuffer )
  *         - SD_RESPONSE_FAILURE: Sequence failed
  *         - SD_RESPONSE_NO_ERROR: Sequence succeed
  */
-SD_Error SD_SectorsRead( uint32_t readAddr, uint8_t* pBuffer, uint32_t nbSectors )
+SD_Error SD_SectorsRead( SD_Handle* hsd, uint32_t readAddr, uint8_t* pBuffer, uint32_t nbSectors )
 {
-	SD_Error state;
+	SD_Error state, stop;
+	uint8_t tries = SD_NUM_TRIES_RECOVER;
+	uint32_t step = SD_BLOCK_SIZE;
+
+	TRACE_VERBOSE( "--> reading %lu sectors from %lu ...", nbSectors, readAddr );
+
+	/* non High Capacity cards use byte-oriented addresses */
+	if ( SD_BYTE_ADDR( hsd ) )
+		readAddr <<= 9;
+	else
+		step = 1;
+
+	SD_StreamsEnd( hsd );	/* other commands can't be sent while streaming transfer is open */
+	SD_Bus_Hold( hsd );		/* hold SPI bus... */
+
+	while ( 1 )
+	{
+		state = SD_WaitReady( hsd );	/* make sure card is ready before we go further... */
+
+		/* send CMD18 (SD_CMD_READ_MULT_BLOCK) to read multiple blocks */
+		state = SD_SendCmd( hsd, SD_CMD_READ_MULT_BLOCK, readAddr, 0xFF );
+		if ( state == SD_RESPONSE_NO_ERROR )
+		{	/* receive data... */
+			while ( nbSectors > 0 )
+			{
+				state = SD_ReceiveData( hsd, pBuffer, SD_BLOCK_SIZE );
+				if ( state != SD_RESPONSE_NO_ERROR )
+					break;
+				pBuffer += SD_BLOCK_SIZE;
+				readAddr += step;
+				--nbSectors;
+			}
+			/* transmission is open-ended (no block count was set) =>
+			 * send CMD12 (SD_CMD_STOP_TRANSMISSION) to stop it... */
+			stop = SD_SendCmd( hsd, SD_CMD_STOP_TRANSMISSION, 0x00000000, 0xFF );
+			if ( state == SD_RESPONSE_NO_ERROR )
+				state = stop;
+		}
+		/* reading is restarted from failed data block (all blocks read => CMD12 failed only)... */
+		if ( nbSectors == 0 || !SD_Recover( hsd, state, &tries ) )
+			break;
+	}
+
+	SD_Bus_Release( hsd );	/* release SPI bus... */
+
+	if ( state == SD_RESPONSE_NO_ERROR )
+		TRACE_VERBOSE( "OK\n" );
+	else
+		TRACE_ERROR( "KO(%d) reading sectors\n", state );
+
+	return state;
+}
 
-	printf( "--> reading %lu sectors from %lu ...", nbSectors, readAddr );
+/**
+ * @brief  Reads sectors back from the SD card and compares them with the data written
+ *         (verify after write). With CRC on, CRC16 of each block sent by the card is
+ *         compared instead of the data, so the blocks are not stored anywhere.
+ * @param  hsd: SD Card handle
+ * @param  readAddr: Address of the first sector
+ * @param  pBuffer: Expected data of the sectors
+ * @param  nbSectors: Number of sectors
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_DATA_MISMATCH: Sectors hold other data (all the sectors are read anyway)
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+SD_Error SD_SectorsVerify( SD_Handle* hsd, uint32_t readAddr, const uint8_t* pBuffer, uint32_t nbSectors )
+{
+	SD_Error state, stop, res = SD_RESPONSE_NO_ERROR;
+	uint32_t step = SD_BLOCK_SIZE;
+
+	TRACE_VERBOSE( "--> verifying %lu sectors from %lu ...", nbSectors, readAddr );
 
 	/* non High Capacity cards use byte-oriented addresses */
-	if ( cardType != SD_Card_SDHC )
+	if ( SD_BYTE_ADDR( hsd ) )
 		readAddr <<= 9;
+	else
+		step = 1;
 
-	SD_Bus_Hold();		/* hold SPI bus... */
+	SD_StreamsEnd( hsd );	/* written data have to be programmed before they are read back */
+	SD_Bus_Hold( hsd );		/* hold SPI bus... */
 
-	state = SD_WaitReady();	/* make sure card is ready before we go further... */
+	state = SD_WaitReady( hsd );	/* make sure card is ready before we go further... */
 
 	/* send CMD18 (SD_CMD_READ_MULT_BLOCK) to read multiple blocks */
-	state = SD_SendCmd( SD_CMD_READ_MULT_BLOCK, readAddr, 0xFF );
+	state = SD_SendCmd( hsd, SD_CMD_READ_MULT_BLOCK, readAddr, 0xFF );
 	if ( state == SD_RESPONSE_NO_ERROR )
-	{	/* receive data... */
-		while ( nbSectors-- > 0 )
+	{
+		/* receive data... */
+		while ( nbSectors > 0 )
 		{
-			state = SD_ReceiveData( pBuffer, SD_BLOCK_SIZE );
-			if ( state != SD_RESPONSE_NO_ERROR )
+			state = SD_CompareData( hsd, pBuffer, SD_BLOCK_SIZE );
+			if ( state == SD_DATA_MISMATCH )
+				res = state;	/* a bad block doesn't stop the others */
+			else if ( state != SD_RESPONSE_NO_ERROR )
 				break;
 			pBuffer += SD_BLOCK_SIZE;
+			readAddr += step;
+			--nbSectors;
 		}
 		/* transmission is open-ended (no block count was set) =>
 		 * send CMD12 (SD_CMD_STOP_TRANSMISSION) to stop it... */
-		state = SD_SendCmd( SD_CMD_STOP_TRANSMISSION, 0x00000000, 0xFF );
+		stop = SD_SendCmd( hsd, SD_CMD_STOP_TRANSMISSION, 0x00000000, 0xFF );
+		if ( state == SD_RESPONSE_NO_ERROR || state == SD_DATA_MISMATCH )
+			state = ( stop != SD_RESPONSE_NO_ERROR ) ? stop : res;
 	}
 
-	SD_Bus_Release();	/* release SPI bus... */
+	SD_Bus_Release( hsd );	/* release SPI bus... */
 
 	if ( state == SD_RESPONSE_NO_ERROR )
-		printf( "OK\n" );
+		TRACE_VERBOSE( "OK\n" );
 	else
-		printf( "KO(%d)\n", state );
+		TRACE_ERROR( "KO(%d) verifying sectors\n", state );
 
 	return state;
 }
 
 /**
  * @brief  Writes a sector of SD_BLOCK_SIZE bytes on the SD card
+ * @param  hsd: SD Card handle
  * @param  pBuffer: pointer to the buffer with the data to be written on SD.
  * @param  writeAddr: address to write on.
  * @retval The SD Response:
  *         - SD_RESPONSE_FAILURE: Sequence failed
  *         - SD_RESPONSE_NO_ERROR: Sequence succeed
  */
-SD_Error SD_SectorWrite( uint32_t writeAddr, const uint8_t* pBuffer )
+SD_Error SD_SectorWrite( SD_Handle* hsd, uint32_t writeAddr, const uint8_t* pBuffer )
 {
 	SD_Error state;
-	SD_DataResponse res;
-	uint16_t BlockSize = SD_BLOCK_SIZE;
+	uint8_t tries = SD_NUM_TRIES_RECOVER;
+	uint16_t crc;
 
-	printf( "--> writing sector %lu ...", writeAddr );
+	TRACE_VERBOSE( "--> writing sector %lu ...", writeAddr );
 
 	/* non High Capacity cards use byte-oriented addresses */
-	if ( cardType != SD_Card_SDHC )
+	if ( SD_BYTE_ADDR( hsd ) )
 		writeAddr <<= 9;
 
-	SD_Bus_Hold();		/* hold SPI bus... */
+	SD_StreamsEnd( hsd );	/* other commands can't be sent while streaming transfer is open */
+	crc = SD_BLOCK_CRC( pBuffer );	/* before the bus is held, other devices on it don't wait for this */
+	SD_Bus_Hold( hsd );		/* hold SPI bus... */
 
-	state = SD_WaitReady();	/* make sure card is ready before we go further... */
+	while ( 1 )
+	{
+		state = SD_WaitReady( hsd );	/* make sure card is ready before we go further... */
 
-	/* send CMD24 (SD_CMD_WRITE_SINGLE_BLOCK) to write single block */
-	state = SD_SendCmd( SD_CMD_WRITE_SINGLE_BLOCK, writeAddr, 0xFF );
-	if ( state == SD_RESPONSE_NO_ERROR )
-	{	/* wait at least 8 clock cycles (send >=1 0xFF bytes) before transmission starts */
-		SD_ReadByte();
-		SD_ReadByte();
-		SD_ReadByte();
-		/* send data token to signify the start of data transmission... */
-		SD_WriteByte( SD_DATA_SINGLE_BLOCK_WRITE_START ); /* 0xFE */
-		/* send data... */
-		while ( BlockSize-- > 0 )
-			SD_WriteByte( *pBuffer++ );
-		/* put 2 CRC bytes (not really needed by us, but required by SD) */
-		SD_ReadByte();
-		SD_ReadByte();
-		/* check data response... */
-		res = (SD_DataResponse)( SD_ReadByte() & SD_RESPONSE_MASK );	/* mask unused bits */
-		if ( ( res & SD_RESPONSE_ACCEPTED ) != 0 )
-		{	/* card is now processing data and goes to BUSY mode, wait until it finishes... */
-			state = SD_WaitBytesWritten();	/* make sure card is ready before we go further... */
+		/* send CMD24 (SD_CMD_WRITE_SINGLE_BLOCK) to write single block */
+		state = SD_SendCmd( hsd, SD_CMD_WRITE_SINGLE_BLOCK, writeAddr, 0xFF );
+		if ( state == SD_RESPONSE_NO_ERROR )
+		{	/* wait at least 8 clock cycles (send >=1 0xFF bytes) before transmission starts */
+			SD_ReadByte( hsd );
+			SD_ReadByte( hsd );
+			SD_ReadByte( hsd );
+			/* send data packet and wait until card finishes writing it... */
+			state = SD_SendDataBlock( hsd, SD_DATA_SINGLE_BLOCK_WRITE_START, pBuffer, NULL, &crc ); /* 0xFE */
 		}
-		else
-			state = SD_RESPONSE_FAILURE;
+		/* failed data block is sent again... */
+		if ( !SD_Recover( hsd, state, &tries ) )
+			break;
 	}
 
-	SD_Bus_Release();	/* release SPI bus... */
+	SD_Bus_Release( hsd );	/* release SPI bus... */
 
 	if ( state == SD_RESPONSE_NO_ERROR )
-		printf( "OK\n" );
+		TRACE_VERBOSE( "OK\n" );
 	else
-		printf( "KO(%d)\n", state );
+		TRACE_ERROR( "KO(%d) writing sector\n", state );
 
 	return state;
 }
 
 /**
  * @brief  Writes multiple sectors of SD_BLOCK_SIZE bytes on the SD card
+ * @param  hsd: SD Card handle
  * @param  pBuffer: pointer to the buffer with the data to be written on the SD.
  * @param  writeAddr: address to write on.
  * @param  nbSectors: number of blocks to be written.
@@ -1003,169 +1987,748 @@ SD_Error SD_SectorWrite( uint32_t writeAddr, const uint8_t* pBuffer )
  *         - SD_RESPONSE_FAILURE: Sequence failed
  *         - SD_RESPONSE_NO_ERROR: Sequence succeed
  */
-SD_Error SD_SectorsWrite( uint32_t writeAddr, const uint8_t* pBuffer, uint32_t nbSectors )
+SD_Error SD_SectorsWrite( SD_Handle* hsd, uint32_t writeAddr, const uint8_t* pBuffer, uint32_t nbSectors )
+{
+	SD_BufferSegment segment;
+
+	segment.Buffer = pBuffer;
+	segment.Count = nbSectors;
+	return SD_SectorsWriteGather( hsd, writeAddr, &segment, 1 );
+}
+
+/**
+ * @brief  Writes consecutive sectors taken from several buffers on the SD card
+ *         by one multiple block write command
+ * @param  hsd: SD Card handle
+ * @param  writeAddr: address to write on.
+ * @param  segments: buffers with the data to be written on the SD, in order of sectors.
+ * @param  nbSegments: number of buffers.
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+SD_Error SD_SectorsWriteGather( SD_Handle* hsd, uint32_t writeAddr, const SD_BufferSegment* segments, uint32_t nbSegments )
 {
 	SD_Error state;
-	SD_DataResponse res;
-	uint16_t BlockSize = SD_BLOCK_SIZE;
+	uint8_t tries = SD_NUM_TRIES_RECOVER;
+	uint32_t step = SD_BLOCK_SIZE;
+	uint32_t nbSectors = 0;
+	uint32_t i, n, count, first, written;
+	const uint8_t* next;
+	uint16_t crc;
+
+	for ( i = 0; i < nbSegments; ++i )
+		nbSectors += segments[ i ].Count;
+	count = nbSectors;
 
-	printf( "--> writing %lu sectors at %lu ...", nbSectors, writeAddr );
+	TRACE_VERBOSE( "--> writing %lu sectors (%lu buffers) at %lu ...", nbSectors, nbSegments, writeAddr );
 
 	/* non High Capacity cards use byte-oriented addresses */
-	if ( cardType != SD_Card_SDHC )
+	if ( SD_BYTE_ADDR( hsd ) )
 		writeAddr <<= 9;
+	else
+		step = 1;
 
-	SD_Bus_Hold();		/* hold SPI bus... */
+	SD_StreamsEnd( hsd );	/* other commands can't be sent while streaming transfer is open */
+	crc = ( nbSectors > 0 ) ? SD_BLOCK_CRC( segments[ 0 ].Buffer ) : 0;	/* before the bus is held */
+	SD_Bus_Hold( hsd );		/* hold SPI bus... */
 
-	state = SD_WaitReady();	/* make sure card is ready before we go further... */
+	/* position of the next block to send: segment i, block n in it */
+	i = 0;
+	n = 0;
+	while ( 1 )
+	{
+		first = count - nbSectors;		/* block sent first by this write command */
+		state = SD_WaitReady( hsd );	/* make sure card is ready before we go further... */
+
+		/* it is recommended to specify in advance the number of blocks being written
+		 * to let SD card erase needed number of blocks, write operation should take less time then */
+		if ( hsd->Cmd23 )	/* set the number of blocks (send CMD23), transmission ends by itself then... */
+			state = SD_SendCmd( hsd, SD_CMD_SET_BLOCK_COUNT, (uint32_t)nbSectors, 0xFF );
+		else			/* only hint the number of blocks to pre-erase (send ACMD23)... */
+			state = SD_PreErase( hsd, nbSectors );
+
+		/* request writing data starting from the given address (send CMD25)... */
+		if ( state == SD_RESPONSE_NO_ERROR )
+			state = SD_SendCmd( hsd, SD_CMD_WRITE_MULT_BLOCK, writeAddr, 0xFF );
+		if ( state == SD_RESPONSE_NO_ERROR )
+		{	/* send some dummy bytes before transmission starts... */
+			SD_ReadByte( hsd );
+			SD_ReadByte( hsd );
+			SD_ReadByte( hsd );
+			/* transfer data... */
+			while ( nbSectors > 0 )
+			{	/* block which follows it, prepared while card is busy */
+				if ( nbSectors == 1 )
+					next = NULL;
+				else if ( n + 1 < segments[ i ].Count )
+					next = segments[ i ].Buffer + ( n + 1 ) * SD_BLOCK_SIZE;
+				else
+					next = segments[ i + 1 ].Buffer;
+				/* send data packet and wait until card finishes writing it... */
+				state = SD_SendDataBlock( hsd, SD_DATA_MULTIPLE_BLOCK_WRITE_START, segments[ i ].Buffer + n * SD_BLOCK_SIZE, next, &crc ); /* 0xFC */
+				if ( state != SD_RESPONSE_NO_ERROR )
+					break;
+				writeAddr += step;
+				--nbSectors;
+				if ( ++n == segments[ i ].Count )
+				{	/* next buffer... */
+					++i;
+					n = 0;
+				}
+			}
+			if ( state != SD_RESPONSE_NO_ERROR )
+			{	/* block failed => stop transmission (send CMD12), blocks before it are written */
+				SD_SendCmd( hsd, SD_CMD_STOP_TRANSMISSION, 0x00000000, 0xFF );
+				SD_WaitBytesWritten( hsd );
+			}
+			else if ( !hsd->Cmd23 )
+			{	/* notify SD card that we finished sending data to write on it */
+				SD_WriteByte( hsd, SD_DATA_MULTIPLE_BLOCK_WRITE_STOP ); /* 0xFD */
+				SD_ReadByte( hsd ); /* read and discard 1 byte from card */
+				/* card is now processing data and goes to BUSY mode, wait until it finishes... */
+				if ( SD_WaitBytesWritten( hsd ) != SD_RESPONSE_NO_ERROR )
+					state = SD_RESPONSE_FAILURE;
+			}
+			/* else all blocks set by CMD23 are written, transmission is over */
+			if ( state == SD_RESPONSE_NO_ERROR )
+			{	/* card may still fail programming accepted blocks... */
+				state = SD_CheckWritten( hsd, &written );
+				if ( state != SD_RESPONSE_NO_ERROR && written < count - first )
+				{	/* ...go back to the first block it hasn't programmed */
+					nbSectors = count - first - written;
+					writeAddr -= nbSectors * step;
+					for ( i = 0, n = count - nbSectors; n >= segments[ i ].Count; ++i )
+						n -= segments[ i ].Count;
+				}
+			}
+		}
+		/* writing is restarted from failed data block (all blocks sent => the last BUSY failed only),
+		 * its CRC is calculated again: it is the one of the next block if the card has accepted it */
+		if ( nbSectors == 0 || !SD_Recover( hsd, state, &tries ) )
+			break;
+		crc = SD_BLOCK_CRC( segments[ i ].Buffer + n * SD_BLOCK_SIZE );
+	}
+
+	SD_Bus_Release( hsd );	/* release SPI bus... */
+
+	if ( state == SD_RESPONSE_NO_ERROR )
+		TRACE_VERBOSE( "OK\n" );
+	else
+		TRACE_ERROR( "KO(%d) writing sectors\n", state );
+
+	return state;
+}
+
+/**
+ * @brief  Opens streaming write: multiple block write (CMD25) stays open
+ *         while consecutive sectors are appended by SD_WriteStreamAppend.
+ *         SPI bus is released between calls, any other operation on SD card
+ *         closes the stream.
+ * @param  hsd: SD Card handle
+ * @param  writeAddr: first sector number to write on.
+ * @param  nbSectors: expected number of sectors to pre-erase (ACMD23), 0 if it's unknown.
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+SD_Error SD_WriteStreamBegin( SD_Handle* hsd, uint32_t writeAddr, uint32_t nbSectors )
+{
+	SD_Error state;
+
+	SD_StreamsEnd( hsd );
+
+	TRACE_VERBOSE( "--> opening write stream at %lu ...", writeAddr );
+
+	hsd->WrStreamNext = writeAddr;
+	/* non High Capacity cards use byte-oriented addresses */
+	if ( SD_BYTE_ADDR( hsd ) )
+		writeAddr <<= 9;
+	hsd->WrStreamAddr = writeAddr;
+
+	SD_Bus_Hold( hsd );		/* hold SPI bus... */
+
+	state = SD_WaitReady( hsd );	/* make sure card is ready before we go further... */
+	state = SD_PreErase( hsd, nbSectors );
+	/* request writing data starting from the given address (send CMD25)... */
+	if ( state == SD_RESPONSE_NO_ERROR )
+		state = SD_SendCmd( hsd, SD_CMD_WRITE_MULT_BLOCK, writeAddr, 0xFF );
+	hsd->WrStreamOpen = ( state == SD_RESPONSE_NO_ERROR );
+	hsd->WrStreamCount = 0;
+
+	SD_Bus_Release( hsd );	/* release SPI bus... */
+
+	if ( state == SD_RESPONSE_NO_ERROR )
+		TRACE_VERBOSE( "OK\n" );
+	else
+		TRACE_ERROR( "KO(%d) opening write stream\n", state );
+
+	return state;
+}
+
+/**
+ * @brief  Writes sectors following the ones already written by open streaming write
+ * @param  hsd: SD Card handle
+ * @param  pBuffer: pointer to the buffer with the data to be written on the SD.
+ * @param  nbSectors: number of blocks to be written.
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed (stream is closed then)
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+SD_Error SD_WriteStreamAppend( SD_Handle* hsd, const uint8_t* pBuffer, uint32_t nbSectors )
+{
+	SD_Error state = SD_RESPONSE_NO_ERROR;
+	uint8_t tries = SD_NUM_TRIES_RECOVER;
+	uint16_t crc;
 
-	/* it is recommended to specify in advance the number of blocks being written
-	 * to let SD card erase needed number of blocks, write operation should take less time then */
-	if ( cardType != SD_Card_MMC )
-	{	/* notify card about the total number of blocks to be sent (send CMD23)... */
-		state = SD_SendCmd( SD_CMD_SET_BLOCK_COUNT, (uint32_t)nbSectors, 0xFF );
-		if ( state != SD_RESPONSE_NO_ERROR )
+	if ( !hsd->WrStreamOpen )
+		return SD_RESPONSE_FAILURE;
+
+	TRACE_VERBOSE( "--> appending %lu sectors at %lu ...", nbSectors, hsd->WrStreamNext );
+
+	crc = ( nbSectors > 0 ) ? SD_BLOCK_CRC( pBuffer ) : 0;	/* before the bus is held */
+	SD_Bus_Hold( hsd );		/* hold SPI bus... */
+
+	SD_ReadByte( hsd );	/* send dummy byte before transmission starts... */
+	while ( nbSectors > 0 )
+	{
+		if ( !hsd->WrStreamOpen )
+		{	/* transmission was stopped by recovery => restart it from the failed block (send CMD25) */
+			crc = SD_BLOCK_CRC( pBuffer );
+			state = SD_WaitReady( hsd );
+			state = SD_SendCmd( hsd, SD_CMD_WRITE_MULT_BLOCK, hsd->WrStreamAddr, 0xFF );
+			hsd->WrStreamOpen = ( state == SD_RESPONSE_NO_ERROR );
+			hsd->WrStreamCount = 0;
+			if ( hsd->WrStreamOpen )
+				SD_ReadByte( hsd );
+		}
+		if ( hsd->WrStreamOpen )
+		{	/* send data packet (the next one is prepared meanwhile) and wait until card finishes writing it... */
+			state = SD_SendDataBlock( hsd, SD_DATA_MULTIPLE_BLOCK_WRITE_START, pBuffer,
+					( nbSectors > 1 ) ? pBuffer + SD_BLOCK_SIZE : NULL, &crc ); /* 0xFC */
+			if ( state == SD_RESPONSE_NO_ERROR )
+			{
+				pBuffer += SD_BLOCK_SIZE;
+				hsd->WrStreamAddr += SD_ADDR_STEP( hsd );
+				++hsd->WrStreamNext;
+				++hsd->WrStreamCount;
+				--nbSectors;
+				continue;
+			}
+			/* block failed => stop transmission (send CMD12), blocks before it are written */
+			SD_SendCmd( hsd, SD_CMD_STOP_TRANSMISSION, 0x00000000, 0xFF );
+			SD_WaitBytesWritten( hsd );
+			hsd->WrStreamOpen = 0;
+		}
+		/* stream is over unless the card recovers */
+		if ( !SD_Recover( hsd, state, &tries ) )
+			break;
+	}
+
+	SD_Bus_Release( hsd );	/* release SPI bus... */
+
+	if ( state == SD_RESPONSE_NO_ERROR )
+		TRACE_VERBOSE( "OK\n" );
+	else
+		TRACE_ERROR( "KO(%d) appending to write stream\n", state );
+
+	return state;
+}
+
+/**
+ * @brief  Closes streaming write (if it's open) and waits until card writes all data
+ * @param  hsd: SD Card handle
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+SD_Error SD_WriteStreamEnd( SD_Handle* hsd )
+{
+	SD_Error state = SD_RESPONSE_NO_ERROR;
+	uint32_t written;
+
+	if ( !hsd->WrStreamOpen )
+		return SD_RESPONSE_NO_ERROR;
+	hsd->WrStreamOpen = 0;
+
+	SD_Bus_Hold( hsd );		/* hold SPI bus... */
+
+	/* notify SD card that we finished sending data to write on it */
+	SD_WriteByte( hsd, SD_DATA_MULTIPLE_BLOCK_WRITE_STOP ); /* 0xFD */
+	SD_ReadByte( hsd ); /* read and discard 1 byte from card */
+	/* card is now processing data and goes to BUSY mode, wait until it finishes... */
+	if ( SD_WaitBytesWritten( hsd ) != SD_RESPONSE_NO_ERROR )
+		state = SD_RESPONSE_FAILURE;
+	/* ...and check that it has programmed all blocks appended since CMD25 */
+	if ( state == SD_RESPONSE_NO_ERROR && hsd->WrStreamCount > 0 )
+	{
+		state = SD_CheckWritten( hsd, &written );
+		if ( state != SD_RESPONSE_NO_ERROR && written < hsd->WrStreamCount )
+			TRACE_ERROR( "sectors %lu..%lu are not written\n",
+					hsd->WrStreamNext - ( hsd->WrStreamCount - written ), hsd->WrStreamNext - 1 );
+	}
+
+	SD_Bus_Release( hsd );	/* release SPI bus... */
+
+	if ( state != SD_RESPONSE_NO_ERROR )
+		TRACE_ERROR( "KO(%d) closing write stream\n", state );
+
+	return state;
+}
+
+/**
+ * @brief  Returns sector number expected by open streaming write
+ * @param  hsd: SD Card handle
+ * @retval Next sector number, SD_STREAM_CLOSED if streaming write isn't open
+ */
+uint32_t SD_WriteStreamNext( SD_Handle* hsd )
+{
+	return hsd->WrStreamOpen ? hsd->WrStreamNext : SD_STREAM_CLOSED;
+}
+
+/**
+ * @brief  Opens streaming read: multiple block read (CMD18) stays open
+ *         while consecutive sectors are taken by SD_ReadStreamRead.
+ *         SPI bus is released between calls (card sends data only when clocked),
+ *         any other operation on SD card closes the stream.
+ * @param  hsd: SD Card handle
+ * @param  readAddr: first sector number to read from.
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+SD_Error SD_ReadStreamBegin( SD_Handle* hsd, uint32_t readAddr )
+{
+	SD_Error state;
+
+	SD_StreamsEnd( hsd );
+
+	TRACE_VERBOSE( "--> opening read stream at %lu ...", readAddr );
+
+	hsd->RdStreamNext = readAddr;
+	/* non High Capacity cards use byte-oriented addresses */
+	if ( SD_BYTE_ADDR( hsd ) )
+		readAddr <<= 9;
+	hsd->RdStreamAddr = readAddr;
+
+	SD_Bus_Hold( hsd );		/* hold SPI bus... */
+
+	state = SD_WaitReady( hsd );	/* make sure card is ready before we go further... */
+	/* send CMD18 (SD_CMD_READ_MULT_BLOCK) to read multiple blocks */
+	state = SD_SendCmd( hsd, SD_CMD_READ_MULT_BLOCK, readAddr, 0xFF );
+	hsd->RdStreamOpen = ( state == SD_RESPONSE_NO_ERROR );
+
+	SD_Bus_Release( hsd );	/* release SPI bus... */
+
+	if ( state == SD_RESPONSE_NO_ERROR )
+		TRACE_VERBOSE( "OK\n" );
+	else
+		TRACE_ERROR( "KO(%d) opening read stream\n", state );
+
+	return state;
+}
+
+/**
+ * @brief  Reads sectors following the ones already read by open streaming read
+ * @param  hsd: SD Card handle
+ * @param  pBuffer: pointer to the buffer that receives the data read from SD.
+ * @param  nbSectors: number of blocks to be read.
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed (stream is closed then)
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+SD_Error SD_ReadStreamRead( SD_Handle* hsd, uint8_t* pBuffer, uint32_t nbSectors )
+{
+	SD_Error state = SD_RESPONSE_NO_ERROR;
+	uint8_t tries = SD_NUM_TRIES_RECOVER;
+
+	if ( !hsd->RdStreamOpen )
+		return SD_RESPONSE_FAILURE;
+
+	TRACE_VERBOSE( "--> streaming %lu sectors from %lu ...", nbSectors, hsd->RdStreamNext );
+
+	SD_Bus_Hold( hsd );		/* hold SPI bus... */
+
+	while ( nbSectors > 0 )
+	{
+		if ( !hsd->RdStreamOpen )
+		{	/* transmission was stopped by recovery => restart it from the failed block (send CMD18) */
+			state = SD_WaitReady( hsd );
+			state = SD_SendCmd( hsd, SD_CMD_READ_MULT_BLOCK, hsd->RdStreamAddr, 0xFF );
+			hsd->RdStreamOpen = ( state == SD_RESPONSE_NO_ERROR );
+		}
+		if ( hsd->RdStreamOpen )
 		{
-			SD_Bus_Release();	/* release SPI bus... */
-			return state;
+			state = SD_ReceiveData( hsd, pBuffer, SD_BLOCK_SIZE );
+			if ( state == SD_RESPONSE_NO_ERROR )
+			{
+				pBuffer += SD_BLOCK_SIZE;
+				hsd->RdStreamAddr += SD_ADDR_STEP( hsd );
+				++hsd->RdStreamNext;
+				--nbSectors;
+				continue;
+			}
+			/* block failed => stop transmission (send CMD12) */
+			SD_SendCmd( hsd, SD_CMD_STOP_TRANSMISSION, 0x00000000, 0xFF );
+			SD_WaitReady( hsd );
+			hsd->RdStreamOpen = 0;
 		}
+		/* stream is over unless the card recovers */
+		if ( !SD_Recover( hsd, state, &tries ) )
+			break;
 	}
 
-	/* request writing data starting from the given address (send CMD25)... */
-	state = SD_SendCmd( SD_CMD_WRITE_MULT_BLOCK, writeAddr, 0xFF );
-	if ( state == SD_RESPONSE_NO_ERROR )
-	{
-		/* send some dummy bytes before transmission starts... */
-		SD_ReadByte();
-		SD_ReadByte();
-		SD_ReadByte();
-		/* transfer data... */
-		while ( nbSectors-- > 0 && state != SD_RESPONSE_FAILURE )
-		{	/* --- {{ send data packet */
-			SD_WriteByte( SD_DATA_MULTIPLE_BLOCK_WRITE_START ); /* 0xFC */
-			/* send data... */
-			while ( BlockSize-- > 0 )
-				SD_WriteByte( *pBuffer++ );
-			/* put CRC bytes (not really needed by us, but required by SD) */
-			SD_ReadByte();
-			SD_ReadByte();
-			/* --- }} */
-			/* check data response... */
-			res = (SD_DataResponse)( SD_ReadByte() & SD_RESPONSE_MASK );	/* mask unused bits */
-			if ( ( res & SD_RESPONSE_ACCEPTED ) != 0 )
-			{	/* card is now processing data and goes to BUSY mode, wait until it finishes... */
-				state = SD_WaitBytesWritten();	/* make sure card is ready before we go further... */
-			}
-			else
-				state = SD_RESPONSE_FAILURE;
-		}
-		/* notify SD card that we finished sending data to write on it */
-		SD_WriteByte( SD_DATA_MULTIPLE_BLOCK_WRITE_STOP ); /* 0xFD */
-		SD_ReadByte(); /* read and discard 1 byte from card */
-		/* card is now processing data and goes to BUSY mode, wait until it finishes... */
-		state = SD_WaitReady();	/* make sure card is ready before we go further... */
-	}
+	SD_Bus_Release( hsd );	/* release SPI bus... */
+
+	if ( state == SD_RESPONSE_NO_ERROR )
+		TRACE_VERBOSE( "OK\n" );
+	else
+		TRACE_ERROR( "KO(%d) reading from read stream\n", state );
+
+	return state;
+}
+
+/**
+ * @brief  Closes streaming read (if it's open)
+ * @param  hsd: SD Card handle
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+SD_Error SD_ReadStreamEnd( SD_Handle* hsd )
+{
+	SD_Error state;
+
+	if ( !hsd->RdStreamOpen )
+		return SD_RESPONSE_NO_ERROR;
+	hsd->RdStreamOpen = 0;
 
-	SD_Bus_Release();	/* release SPI bus... */
+	SD_Bus_Hold( hsd );		/* hold SPI bus... */
+	/* transmission is open-ended => send CMD12 (SD_CMD_STOP_TRANSMISSION) to stop it... */
+	state = SD_SendCmd( hsd, SD_CMD_STOP_TRANSMISSION, 0x00000000, 0xFF );
+	SD_Bus_Release( hsd );	/* release SPI bus... */
 
-	if ( state == SD_RESPONSE_NO_ERROR )
-		printf( "OK\n" );
-	else
-		printf( "KO(%d)\n", state );
+	if ( state != SD_RESPONSE_NO_ERROR )
+		TRACE_ERROR( "KO(%d) closing read stream\n", state );
 
 	return state;
 }
 
+/**
+ * @brief  Returns sector number expected by open streaming read
+ * @param  hsd: SD Card handle
+ * @retval Next sector number, SD_STREAM_CLOSED if streaming read isn't open
+ */
+uint32_t SD_ReadStreamNext( SD_Handle* hsd )
+{
+	return hsd->RdStreamOpen ? hsd->RdStreamNext : SD_STREAM_CLOSED;
+}
+
 /**
  * @brief  Erase specified range of sectors on SD card
+ * @param  hsd: SD Card handle
  * @param  eraseAddrFrom: Starting sector number
  * @param  eraseAddrTo: End sector number
  * @retval The SD Response:
  *         - SD_RESPONSE_FAILURE: Sequence failed
  *         - SD_RESPONSE_NO_ERROR: Sequence succeed
  */
-SD_Error SD_SectorsErase( uint32_t eraseAddrFrom, uint32_t eraseAddrTo )
+SD_Error SD_SectorsErase( SD_Handle* hsd, uint32_t eraseAddrFrom, uint32_t eraseAddrTo )
 {
 	SD_Error state;
 
-	if ( cardType == SD_Card_MMC )
+	if ( SD_IS_MMC( hsd ) )
 	{
-		printf( "--> erasing sectors is not supported for MMC cards\n" );
+		TRACE_ERROR( "--> erasing sectors is not supported for MMC cards\n" );
 		return SD_ILLEGAL_COMMAND;
 	}
 
-	printf( "--> erasing sectors from %lu to %lu ...", eraseAddrFrom, eraseAddrTo );
+	TRACE_VERBOSE( "--> erasing sectors from %lu to %lu ...", eraseAddrFrom, eraseAddrTo );
 
 	/* non High Capacity cards use byte-oriented addresses */
-	if ( cardType != SD_Card_SDHC )
+	if ( SD_BYTE_ADDR( hsd ) )
 	{
 		eraseAddrFrom <<= 9;
 		eraseAddrTo <<= 9;
 	}
 
-	SD_Bus_Hold();		/* hold SPI bus... */
+	SD_StreamsEnd( hsd );	/* other commands can't be sent while streaming transfer is open */
+	SD_Bus_Hold( hsd );		/* hold SPI bus... */
 
-	state = SD_WaitReady();	/* make sure card is ready before we go further... */
+	state = SD_WaitReady( hsd );	/* make sure card is ready before we go further... */
 
 	/* send starting block address (CMD32)... */
-	state = SD_SendCmd( SD_CMD_ERASE_BLOCK_START, (uint32_t)eraseAddrFrom, 0xFF );
+	state = SD_SendCmd( hsd, SD_CMD_ERASE_BLOCK_START, (uint32_t)eraseAddrFrom, 0xFF );
 	if ( state == SD_RESPONSE_NO_ERROR )
 	{	/* send end block address (CMD33)... */
-		state = SD_SendCmd( SD_CMD_ERASE_BLOCK_END, (uint32_t)eraseAddrTo, 0xFF );
+		state = SD_SendCmd( hsd, SD_CMD_ERASE_BLOCK_END, (uint32_t)eraseAddrTo, 0xFF );
 		if ( state == SD_RESPONSE_NO_ERROR )
 		{	/* erase all selected blocks (CMD38)... */
-			state = SD_SendCmd( SD_CMD_ERASE, 0x00000000, 0xFF );
+			state = SD_SendCmd( hsd, SD_CMD_ERASE, 0x00000000, 0xFF );
 			if ( state == SD_RESPONSE_NO_ERROR )
 			{	/* wait until sectors get erased... */
-				state = SD_WaitBytesErased();	/* make sure card is ready before we go further... */
+				state = SD_WaitBytesErased( hsd );	/* make sure card is ready before we go further... */
 			}
 		}
 	}
 
-	SD_Bus_Release();	/* release SPI bus... */
+	SD_Bus_Release( hsd );	/* release SPI bus... */
+
+	if ( state == SD_RESPONSE_NO_ERROR )
+		TRACE_VERBOSE( "OK\n" );
+	else
+		TRACE_ERROR( "KO(%d) erasing sectors\n", state );
+
+	return state;
+}
+
+/**
+ * @brief  Speed class control (send CMD20): tells the card that real-time recording starts,
+ *         so it keeps its speed class for the following sequential writes
+ * @param  hsd: SD Card handle
+ * @param  ctrl: Speed class control argument (SD_SPEED_CLASS_START_REC)
+ * @retval The SD Response:
+ *         - SD_ILLEGAL_COMMAND: Card doesn't support CMD20 (SCR CMD_SUPPORT bit)
+ *         - SD_RESPONSE_FAILURE: Sequence failed
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+SD_Error SD_SpeedClassControl( SD_Handle* hsd, uint32_t ctrl )
+{
+	SD_Error state;
+
+	if ( SD_IS_MMC( hsd ) || !hsd->InfoValid || !SD_SCR_Get( &hsd->Info, SD_SCR_CMD20 ) )
+		return SD_ILLEGAL_COMMAND;
+
+	TRACE_VERBOSE( "--> speed class control %08lX ...", ctrl );
+
+	SD_StreamsEnd( hsd );	/* other commands can't be sent while streaming transfer is open */
+	SD_Bus_Hold( hsd );		/* hold SPI bus... */
+
+	state = SD_WaitReady( hsd );	/* make sure card is ready before we go further... */
+	state = SD_SendCmd( hsd, SD_CMD_SPEED_CLASS_CONTROL, ctrl, 0xFF );
+	if ( state == SD_RESPONSE_NO_ERROR )	/* R1b: wait until card gets ready */
+		state = SD_WaitBytesWritten( hsd );
+
+	SD_Bus_Release( hsd );	/* release SPI bus... */
 
 	if ( state == SD_RESPONSE_NO_ERROR )
-		printf( "OK\n" );
+		TRACE_VERBOSE( "OK\n" );
 	else
-		printf( "KO(%d)\n", state );
+		TRACE_ERROR( "KO(%d) speed class control\n", state );
 
 	return state;
 }
 
+/**
+ * @brief  Starts a transaction: holds SPI bus and selects the card until SD_TransactionEnd,
+ *         e.g. around a burst of stream calls. Other devices on the bus wait meanwhile.
+ * @param  hsd: SD Card handle
+ * @retval None
+ */
+void SD_TransactionBegin( SD_Handle* hsd )
+{
+	SD_Bus_Hold( hsd );
+}
+
+/**
+ * @brief  Ends the transaction: deselects the card, sends the trailing clocks and
+ *         releases SPI bus (if it is the outermost transaction)
+ * @param  hsd: SD Card handle
+ * @retval None
+ */
+void SD_TransactionEnd( SD_Handle* hsd )
+{
+	SD_Bus_Release( hsd );
+}
+
 /**
  * @brief  Retrieve current SD card status structure
+ * @param  hsd: SD Card handle
  * @param  SD_status: pointer on an SD_Status structure
  * @retval The SD Response:
  *         - SD_RESPONSE_FAILURE: Sequence failed
  *         - SD_RESPONSE_NO_ERROR: Sequence succeed
  */
-SD_Error SD_GetStatus( SD_Status* SD_status )
+SD_Error SD_GetStatus( SD_Handle* hsd, SD_Status* SD_status )
 {
 	SD_Error state;
 	uint8_t status[ 64 ];
 
-	if ( cardType == SD_Card_MMC )
+	if ( SD_IS_MMC( hsd ) )
 	{
-		printf( "SD card status is not available for MMC cards\n" );
+		TRACE_ERROR( "SD card status is not available for MMC cards\n" );
 		return SD_ILLEGAL_COMMAND;
 	}
 
-	SD_Bus_Hold();		/* hold SPI bus... */
+	SD_StreamsEnd( hsd );	/* other commands can't be sent while streaming transfer is open */
+	SD_Bus_Hold( hsd );		/* hold SPI bus... */
 
-	state = SD_WaitReady();	/* make sure card is ready before we go further... */
-	if ( state != SD_RESPONSE_NO_ERROR )
-		return SD_RESPONSE_FAILURE;
+	state = SD_WaitReady( hsd );	/* make sure card is ready before we go further... */
+	if ( state == SD_RESPONSE_NO_ERROR )
+	{	/* request SD card status (send ACMD13)... */
+		state = SD_SendCmd( hsd, SD_CMD_SEND_APP, 0x00000000, 0x65 );
+		if ( state == SD_RESPONSE_NO_ERROR )
+			state = SD_SendCmd( hsd, SD_CMD_STATUS, 0x00000000, 0xFF );
+		if ( state == SD_RESPONSE_NO_ERROR )
+			state = SD_ReceiveData( hsd, status, 64 );	/* receive SD card status data */
+		else
+			state = SD_RESPONSE_FAILURE;
+	}
+	else
+		state = SD_RESPONSE_FAILURE;
+
+	SD_Bus_Release( hsd );	/* release SPI bus... */
 
-	/* request SD card status (send ACMD13)... */
-	state = SD_SendCmd( SD_CMD_SEND_APP, 0x00000000, 0x65 );
 	if ( state == SD_RESPONSE_NO_ERROR )
-		state = SD_SendCmd( SD_CMD_STATUS, 0x00000000, 0xFF );
-	if ( state != SD_RESPONSE_NO_ERROR )
+		SD_DecodeStatus( status, SD_status );
+
+	return state;
+}
+
+/**
+ * @brief  Returns information about specific card: registers are read once by SD_Init,
+ *         so this doesn't communicate with the card.
+ * @param  hsd: SD Card handle
+ * @param  cardinfo: pointer to a SD_CardInfo structure that contains all SD
+ *         card information.
+ * @retval The SD Response:
+ *         - SD_RESPONSE_FAILURE: Card is not initialized
+ *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ */
+SD_Error SD_GetCardInfo( SD_Handle* hsd, SD_CardInfo *cardinfo )
+{
+	if ( !hsd->InfoValid )
 		return SD_RESPONSE_FAILURE;
-	state = SD_ReceiveData( status, 64 );	/* receive SD card status data */
+	memcpy( cardinfo, &hsd->Info, sizeof( SD_CardInfo ) );
+	return SD_RESPONSE_NO_ERROR;
+}
+
+/**
+ * @brief  Decode raw CSD register (16 bytes in bus order)
+ * @param  CSD_Tab: Raw register data
+ * @param  SD_csd: pointer on an SCD register structure
+ * @retval None
+ */
+void SD_DecodeCSD( const uint8_t* CSD_Tab, SD_CSD* SD_csd )
+{
+	SD_csd->CSDStruct = ( CSD_Tab[ 0 ] & 0xC0 ) >> 6;				/* Byte 0 */
+	SD_csd->SysSpecVersion = ( CSD_Tab[ 0 ] & 0x3C ) >> 2;
+	SD_csd->Reserved1 = CSD_Tab[ 0 ] & 0x03;
+	SD_csd->TAAC = CSD_Tab[ 1 ];									/* Byte 1 */
+	SD_csd->NSAC = CSD_Tab[ 2 ];									/* Byte 2 */
+	SD_csd->MaxBusClkFrec = CSD_Tab[ 3 ];							/* Byte 3 */
+	SD_csd->CardComdClasses = CSD_Tab[ 4 ] << 4;					/* Byte 4 */
+	SD_csd->CardComdClasses |= ( CSD_Tab[ 5 ] & 0xF0 ) >> 4;		/* Byte 5 */
+	SD_csd->RdBlockLen = CSD_Tab[ 5 ] & 0x0F;
+	SD_csd->PartBlockRead = ( CSD_Tab[ 6 ] & 0x80 ) >> 7;			/* Byte 6 */
+	SD_csd->WrBlockMisalign = ( CSD_Tab[ 6 ] & 0x40 ) >> 6;
+	SD_csd->RdBlockMisalign = ( CSD_Tab[ 6 ] & 0x20 ) >> 5;
+	SD_csd->DSRImpl = ( CSD_Tab[ 6 ] & 0x10 ) >> 4;
+	SD_csd->Reserved2 = ( CSD_Tab[ 6 ] & 0x0C ) >> 2;
+	if ( SD_csd->CSDStruct == 0 )
+	{	/* v1 */
+		SD_csd->DeviceSize = ( CSD_Tab[ 6 ] & 0x03 ) << 10;	/* DeviceSize has 12 bits here */
+		SD_csd->DeviceSize |= CSD_Tab[ 7 ] << 2;					/* Byte 7 */
+		SD_csd->DeviceSize |= ( CSD_Tab[ 8 ] & 0xC0 ) >> 6;			/* Byte 8 */
+		SD_csd->MaxRdCurrentVDDMin = ( CSD_Tab[ 8 ] & 0x38 ) >> 3;
+		SD_csd->MaxRdCurrentVDDMax = CSD_Tab[ 8 ] & 0x07;
+		SD_csd->MaxWrCurrentVDDMin = ( CSD_Tab[ 9 ] & 0xE0 ) >> 5;	/* Byte 9 */
+		SD_csd->MaxWrCurrentVDDMax = ( CSD_Tab[ 9 ] & 0x1C ) >> 2;
+		SD_csd->DeviceSizeMul = ( CSD_Tab[ 9 ] & 0x03 ) << 1;
+		SD_csd->DeviceSizeMul |= ( CSD_Tab[ 10 ] & 0x80 ) >> 7;		/* Byte 10 */
+	}
+	else
+	{	/* v2 */
+		SD_csd->Reserved5 = ( CSD_Tab[ 6 ] & 0x03 ) << 2;
+		SD_csd->Reserved5 |= ( CSD_Tab[ 7 ] & 0xC0 ) >> 6;			/* Byte 7 */
+		SD_csd->DeviceSize = ( CSD_Tab[ 7 ] & 0x3F ) << 16;	/* DeviceSize has 22 bits here */
+		SD_csd->DeviceSize |= CSD_Tab[ 8 ] << 8;					/* Byte 8 */
+		SD_csd->DeviceSize |= CSD_Tab[ 9 ];							/* Byte 9 */
+		SD_csd->Reserved6 = ( CSD_Tab[ 10 ] & 0x80 ) >> 7;			/* Byte 10 */
+	}
+	SD_csd->EraseBlockEnable = ( CSD_Tab[ 10 ] & 0x40 ) >> 6;
+	SD_csd->EraseSectorSize = ( CSD_Tab[ 10 ] & 0x3F ) << 1;
+	SD_csd->EraseSectorSize |= ( CSD_Tab[ 11 ] & 0x80 ) >> 7;		/* Byte 11 */
+	SD_csd->WrProtectGrSize = CSD_Tab[ 11 ] & 0x7F;
+	SD_csd->WrProtectGrEnable = ( CSD_Tab[ 12 ] & 0x80 ) >> 7;		/* Byte 12 */
+	SD_csd->ManDeflECC = ( CSD_Tab[ 12 ] & 0x60 ) >> 5;
+	SD_csd->WrSpeedFact = ( CSD_Tab[ 12 ] & 0x1C ) >> 2;
+	SD_csd->MaxWrBlockLen = ( CSD_Tab[ 12 ] & 0x03 ) << 2;
+	SD_csd->MaxWrBlockLen |= ( CSD_Tab[ 13 ] & 0xC0 ) >> 6;			/* Byte 13 */
+	SD_csd->WriteBlockPaPartial = ( CSD_Tab[ 13 ] & 0x20 ) >> 5;
+	SD_csd->Reserved3 = CSD_Tab[ 13 ] & 0x1E;
+	SD_csd->ContentProtectAppli = CSD_Tab[ 13 ] & 0x01;
+	SD_csd->FileFormatGroup = ( CSD_Tab[ 14 ] & 0x80 ) >> 7;		/* Byte 14 */
+	SD_csd->CopyFlag = ( CSD_Tab[ 14 ] & 0x40 ) >> 6;
+	SD_csd->PermWrProtect = ( CSD_Tab[ 14 ] & 0x20 ) >> 5;
+	SD_csd->TempWrProtect = ( CSD_Tab[ 14 ] & 0x10 ) >> 4;
+	SD_csd->FileFormat = ( CSD_Tab[ 14 ] & 0x0C ) >> 2;
+	SD_csd->ECC = CSD_Tab[ 14 ] & 0x03;
+	SD_csd->CSD_CRC = ( CSD_Tab[ 15 ] & 0xFE ) >> 1;				/* Byte 15 */
+	SD_csd->Reserved4 = CSD_Tab[ 15 ] & 0x01;
+}
+
+/**
+ * @brief  Decode raw CID register (16 bytes in bus order)
+ * @param  CID_Tab: Raw register data
+ * @param  SD_cid: pointer on an CID register structure
+ * @retval None
+ */
+void SD_DecodeCID( const uint8_t* CID_Tab, SD_CID* SD_cid )
+{
+	SD_cid->ManufacturerID = CID_Tab[ 0 ];				/* Byte 0 */
+	SD_cid->OEM_AppliID = CID_Tab[ 1 ] << 8;			/* Byte 1 */
+	SD_cid->OEM_AppliID |= CID_Tab[ 2 ];				/* Byte 2 */
+	SD_cid->ProdName1 = CID_Tab[ 3 ] << 24;				/* Byte 3 */
+	SD_cid->ProdName1 |= CID_Tab[ 4 ] << 16;			/* Byte 4 */
+	SD_cid->ProdName1 |= CID_Tab[ 5 ] << 8;				/* Byte 5 */
+	SD_cid->ProdName1 |= CID_Tab[ 6 ];					/* Byte 6 */
+	SD_cid->ProdName2 = CID_Tab[ 7 ];					/* Byte 7 */
+	SD_cid->ProdRev = CID_Tab[ 8 ];						/* Byte 8 */
+	SD_cid->ProdSN = CID_Tab[ 9 ] << 24;				/* Byte 9 */
+	SD_cid->ProdSN |= CID_Tab[ 10 ] << 16;				/* Byte 10 */
+	SD_cid->ProdSN |= CID_Tab[ 11 ] << 8;				/* Byte 11 */
+	SD_cid->ProdSN |= CID_Tab[ 12 ];					/* Byte 12 */
+	SD_cid->Reserved1 |= ( CID_Tab[ 13 ] & 0xF0 ) >> 4;	/* Byte 13 */
+	SD_cid->ManufactDate = ( CID_Tab[ 13 ] & 0x0F ) << 8;
+	SD_cid->ManufactDate |= CID_Tab[ 14 ];				/* Byte 14 */
+	SD_cid->CID_CRC = ( CID_Tab[ 15 ] & 0xFE ) >> 1;	/* Byte 15 */
+	SD_cid->Reserved2 = 1;
+}
 
-	SD_Bus_Release();	/* release SPI bus... */
+/**
+ * @brief  Decode raw SCR register (8 bytes in bus order)
+ * @param  SCR_Tab: Raw register data
+ * @param  SD_scr: pointer on an SCR register structure
+ * @retval None
+ */
+void SD_DecodeSCR( const uint8_t* SCR_Tab, SD_SCR* SD_scr )
+{
+	SD_scr->SCR_Version = ( SCR_Tab[ 0 ] & 0xF0 ) >> 4;		/* Byte 0 */
+	SD_scr->SpecVersion = SCR_Tab[ 0 ] & 0x0F;
+	SD_scr->StateAfterErase = ( SCR_Tab[ 1 ] & 0x80 ) >> 7;	/* Byte 1 */
+	SD_scr->Security = ( SCR_Tab[ 1 ] & 0x70 ) >> 4;
+	SD_scr->BusWidth = SCR_Tab[ 1 ] & 0x0F;
+	SD_scr->SpecVersion3 = ( SCR_Tab[ 2 ] & 0x80 ) >> 7;	/* Byte 2 */
+	SD_scr->ExSecurity = ( SCR_Tab[ 2 ] & 0x78 ) >> 3;
+	SD_scr->Reserved1 = ( SCR_Tab[ 2 ] & 0x07 ) << 6;
+	SD_scr->Reserved1 |= ( SCR_Tab[ 3 ] & 0xFC ) >> 2;		/* Byte 3 */
+	SD_scr->CmdSupport1 = ( SCR_Tab[ 3 ] & 0x02 ) >> 1;
+	SD_scr->CmdSupport2 = SCR_Tab[ 3 ] & 0x01;
+	SD_scr->Reserved2 = SCR_Tab[ 4 ] << 24;					/* Byte 4 */
+	SD_scr->Reserved2 |= SCR_Tab[ 5 ] << 16;				/* Byte 5 */
+	SD_scr->Reserved2 |= SCR_Tab[ 6 ] << 8;					/* Byte 6 */
+	SD_scr->Reserved2 |= SCR_Tab[ 7 ];						/* Byte 7 */
+}
 
+/**
+ * @brief  Decode raw SD card status (64 bytes in bus order)
+ * @param  status: Raw status data
+ * @param  SD_status: pointer on an SD_Status structure
+ * @retval None
+ */
+void SD_DecodeStatus( const uint8_t* status, SD_Status* SD_status )
+{
 	SD_status->BusWidth = ( status[ 0 ] & 0xC0 ) >> 6;		/* Byte 0 */
 	SD_status->InSecuredMode = ( status[ 0 ] & 0x20 ) >> 5;
 	SD_status->Reserved1 = ( status[ 0 ] & 0x1F ) << 8;
@@ -1186,98 +2749,194 @@ SD_Error SD_GetStatus( SD_Status* SD_status )
 	SD_status->EraseOffset = status[ 13 ] & 0x03;
 	SD_status->UHS_SpeedGrade = ( status[ 14 ] & 0xF0 ) >> 4;/* Byte 14 */
 	SD_status->UHS_AU_Size = status[ 14 ] & 0x0F;
-
-	return state;
+	memcpy( SD_status->Raw, status, sizeof( SD_status->Raw ) );
 }
 
 /**
- * @brief  Returns information about specific card.
- * @param  cardinfo: pointer to a SD_CardInfo structure that contains all SD
- *         card information.
- * @retval The SD Response:
- *         - SD_RESPONSE_FAILURE: Sequence failed
- *         - SD_RESPONSE_NO_ERROR: Sequence succeed
+ * @brief  Extract a field of raw card register
+ * @param  reg: Register as received from the card (MSB first)
+ * @param  size: Size of the register in bytes
+ * @param  field: SD_FIELD( lowest bit, width ) of the field (up to 32 bits)
+ * @retval Value of the field
  */
-SD_Error SD_GetCardInfo( SD_CardInfo *cardinfo )
+uint32_t SD_GetField( const uint8_t* reg, uint8_t size, uint16_t field )
 {
-	SD_Error status;
-
-	SD_Bus_Hold();		/* hold SPI bus... */
+	uint8_t bit = (uint8_t)( field >> 8 ) + (uint8_t)field;	/* above the highest bit of the field */
+	uint32_t value = 0;
 
-	status = SD_GetCSDRegister( &(cardinfo->SD_csd) );
-	if ( status == SD_RESPONSE_NO_ERROR )
-		status = SD_GetCIDRegister( &(cardinfo->SD_cid) );
-	if ( status == SD_RESPONSE_NO_ERROR && cardType != SD_Card_MMC )
-		status = SD_GetSCRRegister( &(cardinfo->SD_scr) );
-
-	SD_Bus_Release();	/* release SPI bus... */
+	while ( bit-- > (uint8_t)( field >> 8 ) )
+		value = ( value << 1 ) | ( ( reg[ size - 1 - ( bit >> 3 ) ] >> ( bit & 7 ) ) & 1 );
+	return value;
+}
 
-	if ( status == SD_RESPONSE_NO_ERROR )
-	{	/* to avoid overflow, card capacity is calculated in Kbytes */
-		if ( cardinfo->SD_csd.CSDStruct == 0 )
-		{	// v1:
-			cardinfo->CardCapacity = cardinfo->SD_csd.DeviceSize + 1;
-			cardinfo->CardCapacity *= ( 1 << ( cardinfo->SD_csd.DeviceSizeMul + 2 ) );
-			cardinfo->CardBlockSize = 1 << cardinfo->SD_csd.RdBlockLen;
-			if ( cardinfo->SD_csd.RdBlockLen > 10 )
-				cardinfo->CardCapacity *= ( 1 << ( cardinfo->SD_csd.RdBlockLen - 10 ) );
-			else
-				cardinfo->CardCapacity /= ( 1 << ( 10 - cardinfo->SD_csd.RdBlockLen ) );
-		}
+/**
+ * @brief  Calculate card capacity and block size from CSD register
+ * @param  cardinfo: pointer to a SD_CardInfo structure with CSD field filled
+ * @retval None
+ */
+void SD_CalcCardCapacity( SD_CardInfo *cardinfo )
+{	/* to avoid overflow, card capacity is calculated in Kbytes */
+	uint8_t blockLen = SD_CSD_Get( cardinfo, SD_CSD_READ_BL_LEN );
+
+	cardinfo->CardBlockSize = 1 << blockLen;
+	if ( SD_CSD_Get( cardinfo, SD_CSD_STRUCTURE ) == 0 )
+	{	// v1:
+		cardinfo->CardCapacity = SD_CSD_Get( cardinfo, SD_CSD_C_SIZE_V1 ) + 1;
+		cardinfo->CardCapacity *= ( 1 << ( SD_CSD_Get( cardinfo, SD_CSD_C_SIZE_MULT ) + 2 ) );
+		if ( blockLen > 10 )
+			cardinfo->CardCapacity *= ( 1 << ( blockLen - 10 ) );
 		else
-		{	// v2:
-			cardinfo->CardCapacity = cardinfo->SD_csd.DeviceSize + 1;
-			cardinfo->CardBlockSize = 1 << cardinfo->SD_csd.RdBlockLen;
-			cardinfo->CardCapacity *= cardinfo->CardBlockSize;
-		}
+			cardinfo->CardCapacity /= ( 1 << ( 10 - blockLen ) );
+	}
+	else
+	{	// v2: ( C_SIZE + 1 ) * 512 Kbytes, C_SIZE has 22 bits, so 2 Tb of SDXC is the limit
+		cardinfo->CardCapacity = SD_CSD_Get( cardinfo, SD_CSD_C_SIZE_V2 ) + 1;
+		cardinfo->CardCapacity *= cardinfo->CardBlockSize;
 	}
+}
+
+#ifdef USE_SD_STATS
+/**
+ * @brief  Returns SD driver statistics collected since start or last SD_ResetStats( hsd )
+ * @param  hsd: SD Card handle
+ * @param  stats: Pointer to structure to be filled in
+ * @retval None
+ */
+void SD_GetStats( SD_Handle* hsd, SD_Stats* stats )
+{
+	SD_Latency* lat[] = { &stats->Command, &stats->ReadToken, &stats->WriteBusy, &stats->EraseBusy };
+	uint8_t i;
+
+	taskENTER_CRITICAL();
+	memcpy( stats, &hsd->Stats, sizeof( SD_Stats ) );
+	stats->WriteModel = hsd->Timing.WriteModel;
+	taskEXIT_CRITICAL();
+	for ( i = 0; i < sizeof( lat ) / sizeof( lat[ 0 ] ); ++i )
+		lat[ i ]->AvgUs = lat[ i ]->Count ? (uint32_t)( lat[ i ]->TotalUs / lat[ i ]->Count ) : 0;
+}
+
+/**
+ * @brief  Clears SD driver statistics
+ * @param  hsd: SD Card handle
+ * @retval None
+ */
+void SD_ResetStats( SD_Handle* hsd )
+{
+	DWT_Enable();
+	taskENTER_CRITICAL();
+	memset( &hsd->Stats, 0, sizeof( SD_Stats ) );
+	taskEXIT_CRITICAL();
+}
+#endif /* USE_SD_STATS */
+
+/**
+ * @brief  Returns timing limits of the card and the longest delays seen, e.g. to store them
+ * @param  hsd: SD Card handle
+ * @param  timing: Pointer to structure to be filled in
+ * @retval None
+ */
+void SD_GetTiming( SD_Handle* hsd, SD_Timing* timing )
+{
+	taskENTER_CRITICAL();
+	memcpy( timing, &hsd->Timing, sizeof( SD_Timing ) );
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief  Replaces timing of the initialized card, e.g. by values stored for the same card
+ *         (the caller checks CID), limits are kept within the worst-case constants
+ * @param  hsd: SD Card handle
+ * @param  timing: Timing to use
+ * @retval None
+ */
+void SD_SetTiming( SD_Handle* hsd, const SD_Timing* timing )
+{
+	SD_Timing t = *timing;
+
+	if ( t.ReadTries == 0 || t.ReadTries > SD_NUM_TRIES_READ )
+		t.ReadTries = SD_NUM_TRIES_READ;
+	if ( t.WriteTimeoutMs == 0 || t.WriteTimeoutMs > SD_TIMEOUT_WRITE_MS )
+		t.WriteTimeoutMs = SD_TIMEOUT_WRITE_MS;
+	if ( t.EraseTimeoutMs == 0 || t.EraseTimeoutMs > SD_TIMEOUT_ERASE_MS )
+		t.EraseTimeoutMs = SD_TIMEOUT_ERASE_MS;
+	if ( t.PollTicks == 0 )
+		t.PollTicks = 1;
+	taskENTER_CRITICAL();
+	hsd->Timing = t;
+	taskEXIT_CRITICAL();
+}
 
-	return status;
+/**
+ * @brief  Prints out timing of the card
+ * @param  timing: Previously retrieved timing structure
+ * @retval None
+ */
+void SD_DumpTiming( const SD_Timing* timing )
+{
+	printf( "Timing profile : %02X/%04X\n", timing->ManufacturerID, timing->OEM_AppliID );
+	printf( "Data token : %lu tries (longest %lu)\n", timing->ReadTries, timing->ReadMax );
+	printf( "Write BUSY : %lu ms (longest %lu ms)\n", timing->WriteTimeoutMs, timing->WriteMaxMs );
+	printf( "Erase BUSY : %lu ms (longest %lu ms)\n", timing->EraseTimeoutMs, timing->EraseMaxMs );
+	printf( "BUSY polling : %lu tries, then after %lu ticks\n", timing->BusyFastTries, timing->PollTicks );
+	printf( "Write burst : %lu sectors\n", timing->BatchSectors );
+	printf( "Write BUSY model : %lu periods, mean %lu.%02lu ms, deviation %lu.%02lu ms, %lu polls (%lu on the first one)\n",
+			timing->WriteModel.Samples, timing->WriteModel.Mean16 / 16, timing->WriteModel.Mean16 % 16 * 100 / 16,
+			timing->WriteModel.Dev16 / 16, timing->WriteModel.Dev16 % 16 * 100 / 16,
+			timing->WriteModel.Polls, timing->WriteModel.FirstPoll );
 }
 
+#ifdef USE_SD_DUMP
 /**
  * @brief  Prints out human-readable information about SD Card
  * @param  Previously retrieved card info structure
  * @retval None
  */
 void SD_DumpCardInfo( const SD_CardInfo *cardinfo )
-{
-	uint8_t is_OSRv1 = ( cardinfo->SD_csd.CSDStruct == 0 );
+{	/* registers are fully unpacked only here */
+	SD_CSD csd;
+	SD_CID cid;
+	SD_SCR scr;
+	uint8_t is_OSRv1;
+
+	SD_DecodeCSD( cardinfo->CSD, &csd );
+	SD_DecodeCID( cardinfo->CID, &cid );
+	SD_DecodeSCR( cardinfo->SCR, &scr );
+	is_OSRv1 = ( csd.CSDStruct == 0 );
 	printf( "\nDumping SD Card information:\n\n    GLOBAL INFO\nSD Card type : " );
 	/* some cards report wrong CSDStruct field in CSR register => use detected card type instead... */
 	if ( is_OSRv1 != 0 )
 		printf( "SDSC (v1 or v2)\n" );
 	else
-		printf( "SDHC or SDXC\n" );
+		printf( ( cardinfo->CardCapacity > SD_SDHC_MAX_KB ) ? "SDXC\n" : "SDHC\n" );
 	printf( "Card Capacity : %lu Kbytes\n", cardinfo->CardCapacity );
 	printf( "Card Block Size : %lu bytes\n", cardinfo->CardBlockSize );
 
 	printf( "\n    Card identification register (CID)\n" );
-	printf( "Manufacturer ID : %d\n", cardinfo->SD_cid.ManufacturerID );
+	printf( "Manufacturer ID : %d\n", cid.ManufacturerID );
 	printf( "OEM / Application ID : %c%c\n",
-		((char*)&( cardinfo->SD_cid.OEM_AppliID ))[ 1 ],
-		((char*)&( cardinfo->SD_cid.OEM_AppliID ))[ 0 ] );
+		((char*)&( cid.OEM_AppliID ))[ 1 ],
+		((char*)&( cid.OEM_AppliID ))[ 0 ] );
 	printf( "Product Name : %c%c%c%c%c\n",
-		((char*)&( cardinfo->SD_cid.ProdName1 ))[ 3 ],
-		((char*)&( cardinfo->SD_cid.ProdName1 ))[ 2 ],
-		((char*)&( cardinfo->SD_cid.ProdName1 ))[ 1 ],
-		((char*)&( cardinfo->SD_cid.ProdName1 ))[ 0 ],
-		(char)(    cardinfo->SD_cid.ProdName2 )	);
+		((char*)&( cid.ProdName1 ))[ 3 ],
+		((char*)&( cid.ProdName1 ))[ 2 ],
+		((char*)&( cid.ProdName1 ))[ 1 ],
+		((char*)&( cid.ProdName1 ))[ 0 ],
+		(char)(    cid.ProdName2 )	);
 	printf( "Product Revision : %d.%d\n",
-		( cardinfo->SD_cid.ProdRev & 0xF0 ) >> 4,
-		( cardinfo->SD_cid.ProdRev & 0x0F ) );
+		( cid.ProdRev & 0xF0 ) >> 4,
+		( cid.ProdRev & 0x0F ) );
 	printf( "Product Serial Number : %lu\n",
-		cardinfo->SD_cid.ProdSN );
+		cid.ProdSN );
 	printf( "Manufacturing Date (YYYY-MM) : %d-%d\n",
-		2000 + ( ( cardinfo->SD_cid.ManufactDate & 0x0FF0 ) >> 4 ),
-		cardinfo->SD_cid.ManufactDate & 0x000F );
-	printf( "CID CRC : %d\n", cardinfo->SD_cid.CID_CRC & 0x7F );
+		2000 + ( ( cid.ManufactDate & 0x0FF0 ) >> 4 ),
+		cid.ManufactDate & 0x000F );
+	printf( "CID CRC : %d\n", cid.CID_CRC & 0x7F );
 
 	printf( "\n    Card-specific data register (CSD)\n" );
 	if ( is_OSRv1 != 0 )
 	{
 		printf( "Data read access-time : " );
-		switch ( (cardinfo->SD_csd.TAAC & 0x78) >> 3 )
+		switch ( (csd.TAAC & 0x78) >> 3 )
 		{
 		case 0x0: printf( "0.0" ); break;
 		case 0x1: printf( "1.0" ); break;
@@ -1298,7 +2957,7 @@ void SD_DumpCardInfo( const SD_CardInfo *cardinfo )
 		default: break;
 		}
 		printf( " x 1" );
-		switch ( cardinfo->SD_csd.TAAC & 0x07 )
+		switch ( csd.TAAC & 0x07 )
 		{
 		case 0: printf( "n" ); break;
 		case 1: printf( "0n" ); break;
@@ -1310,10 +2969,10 @@ void SD_DumpCardInfo( const SD_CardInfo *cardinfo )
 		case 7: printf( "0m" ); break;
 		default: break;
 		}
-		printf( "s\nData read access-time in CLK cycles : %d\n", cardinfo->SD_csd.NSAC );
+		printf( "s\nData read access-time in CLK cycles : %d\n", csd.NSAC );
 	}
-	printf( "Max. bus clock frequency : %x", cardinfo->SD_csd.MaxBusClkFrec );
-	switch ( cardinfo->SD_csd.MaxBusClkFrec )
+	printf( "Max. bus clock frequency : %x", csd.MaxBusClkFrec );
+	switch ( csd.MaxBusClkFrec )
 	{
 	case 0x32: printf( " (25Mhz)\n" ); break;
 	case 0x5A: printf( " (50Mhz)\n" ); break;
@@ -1322,28 +2981,28 @@ void SD_DumpCardInfo( const SD_CardInfo *cardinfo )
 	default:   printf( "\n" ); break;
 	}
 	printf( "\nCard command classes :" );
-	if ( cardinfo->SD_csd.CardComdClasses & ( 0x001 ))	printf( " 0(basic)" );
-	if ( cardinfo->SD_csd.CardComdClasses & (1 << 1) )	printf( " 1" );
-	if ( cardinfo->SD_csd.CardComdClasses & (1 << 2) )	printf( " 2(read)" );
-	if ( cardinfo->SD_csd.CardComdClasses & (1 << 3) )	printf( " 3" );
-	if ( cardinfo->SD_csd.CardComdClasses & (1 << 4) )	printf( " 4(write)" );
-	if ( cardinfo->SD_csd.CardComdClasses & (1 << 5) )	printf( " 5(erase)" );
-	if ( cardinfo->SD_csd.CardComdClasses & (1 << 6) )	printf( " 6(protect)" );
-	if ( cardinfo->SD_csd.CardComdClasses & (1 << 7) )	printf( " 7(lock)" );
-	if ( cardinfo->SD_csd.CardComdClasses & (1 << 8) )	printf( " 8(app)" );
-	if ( cardinfo->SD_csd.CardComdClasses & (1 << 9) )	printf( " 9(i/o)" );
-	if ( cardinfo->SD_csd.CardComdClasses & (1 <<10) )	printf( " 10(switch)" );
-	if ( cardinfo->SD_csd.CardComdClasses & (1 <<11) )	printf( " 11" );
+	if ( csd.CardComdClasses & ( 0x001 ))	printf( " 0(basic)" );
+	if ( csd.CardComdClasses & (1 << 1) )	printf( " 1" );
+	if ( csd.CardComdClasses & (1 << 2) )	printf( " 2(read)" );
+	if ( csd.CardComdClasses & (1 << 3) )	printf( " 3" );
+	if ( csd.CardComdClasses & (1 << 4) )	printf( " 4(write)" );
+	if ( csd.CardComdClasses & (1 << 5) )	printf( " 5(erase)" );
+	if ( csd.CardComdClasses & (1 << 6) )	printf( " 6(protect)" );
+	if ( csd.CardComdClasses & (1 << 7) )	printf( " 7(lock)" );
+	if ( csd.CardComdClasses & (1 << 8) )	printf( " 8(app)" );
+	if ( csd.CardComdClasses & (1 << 9) )	printf( " 9(i/o)" );
+	if ( csd.CardComdClasses & (1 <<10) )	printf( " 10(switch)" );
+	if ( csd.CardComdClasses & (1 <<11) )	printf( " 11" );
 	printf( "\n" );
 
 	if ( is_OSRv1 != 0 )
 	{
 		printf( "Max. read data block length : %d ( %d bytes )\n",
-			cardinfo->SD_csd.RdBlockLen,
-			1 << (cardinfo->SD_csd.RdBlockLen) );
-		printf( "Partial blocks for read allowed : %d\n", cardinfo->SD_csd.PartBlockRead );
-		printf( "Write block misalignment : %d\n", cardinfo->SD_csd.WrBlockMisalign );
-		printf( "Read block misalignment : %d\n", cardinfo->SD_csd.RdBlockMisalign );
+			csd.RdBlockLen,
+			1 << (csd.RdBlockLen) );
+		printf( "Partial blocks for read allowed : %d\n", csd.PartBlockRead );
+		printf( "Write block misalignment : %d\n", csd.WrBlockMisalign );
+		printf( "Read block misalignment : %d\n", csd.RdBlockMisalign );
 	}
 	else
 	{
@@ -1351,13 +3010,13 @@ void SD_DumpCardInfo( const SD_CardInfo *cardinfo )
 		printf( "Partial blocks for read are not allowed\n" );
 		printf( "Read/Write block misalignment is not allowed\n" );
 	}
-	printf( "DSR implemented : %d\n", cardinfo->SD_csd.DSRImpl );
-	printf( "Device Size (4112 <= and <= 65375): %lu\n", cardinfo->SD_csd.DeviceSize );
+	printf( "DSR implemented : %d\n", csd.DSRImpl );
+	printf( "Device Size (4112 <= and <= 65375): %lu\n", csd.DeviceSize );
 
 	if ( is_OSRv1 != 0 )
 	{
 		printf( "Max. read current at VDD min : " );
-		switch ( cardinfo->SD_csd.MaxRdCurrentVDDMin )
+		switch ( csd.MaxRdCurrentVDDMin )
 		{
 		case 0: printf( "0.5" ); break;
 		case 1: printf( "1" ); break;
@@ -1370,7 +3029,7 @@ void SD_DumpCardInfo( const SD_CardInfo *cardinfo )
 		default: break;
 		}
 		printf( "mA\nMax. read current at VDD max : " );
-		switch ( cardinfo->SD_csd.MaxRdCurrentVDDMax )
+		switch ( csd.MaxRdCurrentVDDMax )
 		{
 		case 0: printf( "0.5" ); break;
 		case 1: printf( "1" ); break;
@@ -1383,7 +3042,7 @@ void SD_DumpCardInfo( const SD_CardInfo *cardinfo )
 		default: break;
 		}
 		printf( "mA\nMax. write current at VDD min : " );
-		switch ( cardinfo->SD_csd.MaxWrCurrentVDDMin )
+		switch ( csd.MaxWrCurrentVDDMin )
 		{
 		case 0: printf( "1" ); break;
 		case 1: printf( "5" ); break;
@@ -1396,7 +3055,7 @@ void SD_DumpCardInfo( const SD_CardInfo *cardinfo )
 		default: break;
 		}
 		printf( "mA\nMax. write current at VDD max : " );
-		switch ( cardinfo->SD_csd.MaxWrCurrentVDDMax )
+		switch ( csd.MaxWrCurrentVDDMax )
 		{
 		case 0: printf( "1" ); break;
 		case 1: printf( "5" ); break;
@@ -1408,18 +3067,18 @@ void SD_DumpCardInfo( const SD_CardInfo *cardinfo )
 		case 7: printf( "200" ); break;
 		default: break;
 		}
-		printf( "mA\nDevice size multiplier : %d\n", cardinfo->SD_csd.DeviceSizeMul );
-		if ( cardinfo->SD_csd.EraseBlockEnable == 0 )
-			printf( "Erase size : 1 or more units of %d bytes each\n", cardinfo->SD_csd.EraseSectorSize );
+		printf( "mA\nDevice size multiplier : %d\n", csd.DeviceSizeMul );
+		if ( csd.EraseBlockEnable == 0 )
+			printf( "Erase size : 1 or more units of %d bytes each\n", csd.EraseSectorSize );
 		else
 			printf( "Erase size : 1 or more blocks of 512 bytes each\n" );
 
-		printf( "Write protect group size : %d\n", cardinfo->SD_csd.WrProtectGrSize );
-		printf( "Write protect group enable : %d\n", cardinfo->SD_csd.WrProtectGrEnable );
-		printf( "Write speed factor (Twrite/Tread) : %d\n", 1 << ( cardinfo->SD_csd.WrSpeedFact & 0x3F ) );
-		printf( "Max. write data block length : %d\n", 1 << ( cardinfo->SD_csd.MaxWrBlockLen & 0xF ) );
-		printf( "Partial blocks for write allowed : %d\n", cardinfo->SD_csd.WriteBlockPaPartial );
-		printf( "File format group : %d\n", cardinfo->SD_csd.FileFormatGroup );
+		printf( "Write protect group size : %d\n", csd.WrProtectGrSize );
+		printf( "Write protect group enable : %d\n", csd.WrProtectGrEnable );
+		printf( "Write speed factor (Twrite/Tread) : %d\n", 1 << ( csd.WrSpeedFact & 0x3F ) );
+		printf( "Max. write data block length : %d\n", 1 << ( csd.MaxWrBlockLen & 0xF ) );
+		printf( "Partial blocks for write allowed : %d\n", csd.WriteBlockPaPartial );
+		printf( "File format group : %d\n", csd.FileFormatGroup );
 	}
 	else
 	{
@@ -1429,14 +3088,14 @@ void SD_DumpCardInfo( const SD_CardInfo *cardinfo )
 		printf( "Max. write data block length : 512 bytes\n" );
 		printf( "Partial blocks for write are not allowed\n" );
 	}
-	printf( "Copy flag (OTP) : %d\n", cardinfo->SD_csd.CopyFlag );
-	printf( "Permanent write protection : %d\n", cardinfo->SD_csd.PermWrProtect );
-	printf( "Temporary write protection : %d\n", cardinfo->SD_csd.TempWrProtect );
+	printf( "Copy flag (OTP) : %d\n", csd.CopyFlag );
+	printf( "Permanent write protection : %d\n", csd.PermWrProtect );
+	printf( "Temporary write protection : %d\n", csd.TempWrProtect );
 
 	if ( is_OSRv1 != 0 )
 	{
 		printf( "File Format : " );
-		switch ( cardinfo->SD_csd.FileFormat )
+		switch ( csd.FileFormat )
 		{
 		case 0: printf( "HDD-like file system with partition table\n" ); break;
 		case 1: printf( "DOS FAT (FDD-like) with boot sector only (no partition table)\n" ); break;
@@ -1445,23 +3104,24 @@ void SD_DumpCardInfo( const SD_CardInfo *cardinfo )
 		default: break;
 		}
 	}
-	printf( "CSD CRC : %d\n", cardinfo->SD_csd.CSD_CRC );
+	printf( "CSD CRC : %d\n", csd.CSD_CRC );
 
-	if ( cardType != SD_Card_MMC )
+	/* SCR isn't read from MMC cards, while any SD card supports 1-bit bus */
+	if ( ( scr.BusWidth & 0x01 ) != 0 )
 	{
 		printf( "\n    SD Card configuration register (SCR)\n" );
-		printf( "SCR structure version : %d\n", cardinfo->SD_scr.SCR_Version );
+		printf( "SCR structure version : %d\n", scr.SCR_Version );
 		printf( "Physical layer specification version number : " );
-		switch ( cardinfo->SD_scr.SpecVersion )
+		switch ( scr.SpecVersion )
 		{
 		case 0: printf( "Version 1.0 and 1.01" ); break;
 		case 1: printf( "Version 1.10" ); break;
-		case 2:	printf( "Version %s", ( cardinfo->SD_scr.SpecVersion3 == 0 ) ? "2.00" : "3.0x" ); break;
+		case 2:	printf( "Version %s", ( scr.SpecVersion3 == 0 ) ? "2.00" : "3.0x" ); break;
 		default:printf( "reserved" ); break;
 		}
-		printf( "\nState of bits after sector erase : 0x%s\n", cardinfo->SD_scr.StateAfterErase ? "FF" : "00" );
+		printf( "\nState of bits after sector erase : 0x%s\n", scr.StateAfterErase ? "FF" : "00" );
 		printf( "CPRM security version : " );
-		switch ( cardinfo->SD_scr.Security )
+		switch ( scr.Security )
 		{
 		case 0: printf( "no security" ); break;
 		case 1: printf( "not used" ); break;
@@ -1471,11 +3131,11 @@ void SD_DumpCardInfo( const SD_CardInfo *cardinfo )
 		default:printf( "reserved" ); break;
 		}
 		printf( "\nSupported data bus width :" );
-		if ( cardinfo->SD_scr.BusWidth & 0x01 ) printf( " 1 bit" );
-		if ( cardinfo->SD_scr.BusWidth & 0x04 ) printf( " 4 bit" );
-		printf( "\nExtended security is%s supported\n", ( cardinfo->SD_scr.ExSecurity == 0 ) ? " not" : "" );
-		printf( "Support of CMD23 (set block count) : %c\n", cardinfo->SD_scr.CmdSupport1 ? 'Y' : 'N' );
-		printf( "Support of CMD20 (speed class control) : %c\n", cardinfo->SD_scr.CmdSupport2 ? 'Y' : 'N' );
+		if ( scr.BusWidth & 0x01 ) printf( " 1 bit" );
+		if ( scr.BusWidth & 0x04 ) printf( " 4 bit" );
+		printf( "\nExtended security is%s supported\n", ( scr.ExSecurity == 0 ) ? " not" : "" );
+		printf( "Support of CMD23 (set block count) : %c\n", scr.CmdSupport1 ? 'Y' : 'N' );
+		printf( "Support of CMD20 (speed class control) : %c\n", scr.CmdSupport2 ? 'Y' : 'N' );
 	}
 	printf( "\nDONE\n" );
 }
@@ -1487,87 +3147,86 @@ void SD_DumpCardInfo( const SD_CardInfo *cardinfo )
  */
 void SD_DumpStatus( const SD_Status* SD_status )
 {
+	/* status is retrieved from SD cards only, MMC cards don't have it */
 	printf( "\nDumping SD Card status information:\n\n" );
-	if ( cardType != SD_Card_MMC )
+	printf( "Bus width : " );
+	switch( SD_status->BusWidth )
 	{
-		printf( "Bus width : " );
-		switch( SD_status->BusWidth )
-		{
-		case 0x00: printf( "1 bit" ); break;
-		case 0x02: printf( "4 bits" ); break;
-		default: printf( "reserved" ); break;
-		}
-		printf( "\nSD card is%s in secured mode\n", SD_status->InSecuredMode ? "" : " not" );
-		printf( "Card Type : " );
-		switch ( SD_status->CardType )
-		{
-		case 0x0000: printf( "Regular SD card" ); break;
-		case 0x0001: printf( "SD ROM card" ); break;
-		case 0x0002: printf( "OTP card" ); break;
-		default: printf( "other card" ); break;
-		}
-		printf( "\nSize of protected area : %lu\n", SD_status->SizeProtectedArea );
-		printf( "Speed class : " );
-		switch( SD_status->SpeedClass )
-		{
-		case 0x00: printf( "Class 0"  ); break;
-		case 0x01: printf( "Class 2"  ); break;
-		case 0x02: printf( "Class 4"  ); break;
-		case 0x03: printf( "Class 6"  ); break;
-		case 0x04: printf( "Class 10" ); break;
-		default:   printf( "Reserved" ); break;
-		}
-		printf( "\nPerformance move : " );
-		switch( SD_status->PerformanceMove )
-		{
-		case 0x00: printf( "Sequential write" ); break;
-		case 0xFF: printf( "Infinity" ); break;
-		default: printf( "%d Mb/sec", SD_status->PerformanceMove ); break;
-		}
-		printf( "\nAllocation Unit size : " );
-		switch( SD_status->AU_Size )
-		{
-		case 0x00: printf( "not defined" ); break;
-		case 0x01: printf( "16 Kb" ); break;
-		case 0x02: printf( "32 Kb" ); break;
-		case 0x03: printf( "64 Kb" ); break;
-		case 0x04: printf( "128 Kb" ); break;
-		case 0x05: printf( "256 Kb" ); break;
-		case 0x06: printf( "512 Kb" ); break;
-		case 0x07: printf( "1 Mb" ); break;
-		case 0x08: printf( "2 Mb" ); break;
-		case 0x09: printf( "4 Mb" ); break;
-		case 0x0A: printf( "8 Mb" ); break;
-		case 0x0B: printf( "12 Mb" ); break;
-		case 0x0C: printf( "16 Mb" ); break;
-		case 0x0D: printf( "24 Mb" ); break;
-		case 0x0E: printf( "32 Mb" ); break;
-		case 0x0F: printf( "64 Mb" ); break;
-		default: break;
-		}
-		printf( "\nErase Size : %d AU blocks\n", SD_status->EraseSize );
-		printf( "Erase Timeout : %d seconds\n", SD_status->EraseTimeout );
-		printf( "Erase Offset : %d seconds\n", SD_status->EraseOffset );
-		printf( "Speed Grade for UHS mode : %s\n",
-			( SD_status->UHS_SpeedGrade == 0 ) ? "< 10 Mb/sec" : "> 10 Mb/sec" );
-		printf( "Allocation Unit size for UHS mode : " );
-		switch( SD_status->UHS_AU_Size )
-		{
-		case 0x00: printf( "not defined" ); break;
-		case 0x07: printf( "1 Mb" ); break;
-		case 0x08: printf( "2 Mb" ); break;
-		case 0x09: printf( "4 Mb" ); break;
-		case 0x0A: printf( "8 Mb" ); break;
-		case 0x0B: printf( "12 Mb" ); break;
-		case 0x0C: printf( "16 Mb" ); break;
-		case 0x0D: printf( "24 Mb" ); break;
-		case 0x0E: printf( "32 Mb" ); break;
-		case 0x0F: printf( "64 Mb" ); break;
-		default:   printf( "not used" ); break;
-		}
+	case 0x00: printf( "1 bit" ); break;
+	case 0x02: printf( "4 bits" ); break;
+	default: printf( "reserved" ); break;
+	}
+	printf( "\nSD card is%s in secured mode\n", SD_status->InSecuredMode ? "" : " not" );
+	printf( "Card Type : " );
+	switch ( SD_status->CardType )
+	{
+	case 0x0000: printf( "Regular SD card" ); break;
+	case 0x0001: printf( "SD ROM card" ); break;
+	case 0x0002: printf( "OTP card" ); break;
+	default: printf( "other card" ); break;
+	}
+	printf( "\nSize of protected area : %lu\n", SD_status->SizeProtectedArea );
+	printf( "Speed class : " );
+	switch( SD_status->SpeedClass )
+	{
+	case 0x00: printf( "Class 0"  ); break;
+	case 0x01: printf( "Class 2"  ); break;
+	case 0x02: printf( "Class 4"  ); break;
+	case 0x03: printf( "Class 6"  ); break;
+	case 0x04: printf( "Class 10" ); break;
+	default:   printf( "Reserved" ); break;
+	}
+	printf( "\nPerformance move : " );
+	switch( SD_status->PerformanceMove )
+	{
+	case 0x00: printf( "Sequential write" ); break;
+	case 0xFF: printf( "Infinity" ); break;
+	default: printf( "%d Mb/sec", SD_status->PerformanceMove ); break;
+	}
+	printf( "\nAllocation Unit size : " );
+	switch( SD_status->AU_Size )
+	{
+	case 0x00: printf( "not defined" ); break;
+	case 0x01: printf( "16 Kb" ); break;
+	case 0x02: printf( "32 Kb" ); break;
+	case 0x03: printf( "64 Kb" ); break;
+	case 0x04: printf( "128 Kb" ); break;
+	case 0x05: printf( "256 Kb" ); break;
+	case 0x06: printf( "512 Kb" ); break;
+	case 0x07: printf( "1 Mb" ); break;
+	case 0x08: printf( "2 Mb" ); break;
+	case 0x09: printf( "4 Mb" ); break;
+	case 0x0A: printf( "8 Mb" ); break;
+	case 0x0B: printf( "12 Mb" ); break;
+	case 0x0C: printf( "16 Mb" ); break;
+	case 0x0D: printf( "24 Mb" ); break;
+	case 0x0E: printf( "32 Mb" ); break;
+	case 0x0F: printf( "64 Mb" ); break;
+	default: break;
+	}
+	printf( "\nErase Size : %d AU blocks\n", SD_status->EraseSize );
+	printf( "Erase Timeout : %d seconds\n", SD_status->EraseTimeout );
+	printf( "Erase Offset : %d seconds\n", SD_status->EraseOffset );
+	printf( "Speed Grade for UHS mode : %s\n",
+		( SD_status->UHS_SpeedGrade == 0 ) ? "< 10 Mb/sec" : "> 10 Mb/sec" );
+	printf( "Allocation Unit size for UHS mode : " );
+	switch( SD_status->UHS_AU_Size )
+	{
+	case 0x00: printf( "not defined" ); break;
+	case 0x07: printf( "1 Mb" ); break;
+	case 0x08: printf( "2 Mb" ); break;
+	case 0x09: printf( "4 Mb" ); break;
+	case 0x0A: printf( "8 Mb" ); break;
+	case 0x0B: printf( "12 Mb" ); break;
+	case 0x0C: printf( "16 Mb" ); break;
+	case 0x0D: printf( "24 Mb" ); break;
+	case 0x0E: printf( "32 Mb" ); break;
+	case 0x0F: printf( "64 Mb" ); break;
+	default:   printf( "not used" ); break;
 	}
 	printf( "\n\nDONE\n" );
 }
+#endif /* USE_SD_DUMP */
 
 /**
  * @}
@@ -8,6 +8,9 @@
  *          SPI and GPIO pins are defined in stm32_pins.h file.
  *          SPI bus is initialized in STM_EVAL_SPI_Init() in stm32_spi.c file.
  *          This driver can be tuned for any development board in stm32_pins.h.
+ *          All state of a card is kept in its SD_Handle, so cards on different
+ *          SPI buses (SD_Card, SD_Card2) are driven by different tasks in parallel,
+ *          one card is driven by one task at a time.
  ******************************************************************************
  */
 
@@ -20,9 +23,12 @@ extern "C" {
 #endif
 
 /* Includes ------------------------------------------------------------------*/
+#include "main.h"
+
 #include "stm32f2xx.h"
 
 #include "stm32_pins.h"
+#include "stm32_spi.h"
 
 /** @addtogroup Utilities
  * @{
@@ -136,14 +142,15 @@ typedef struct _SD_CID
 } SD_CID;
 
 /**
- * @brief SD Card information
+ * @brief SD Card information: raw registers as received from the card (MSB first),
+ *        fields are read by SD_CSD_Get/SD_CID_Get/SD_SCR_Get, SD_Decode* unpack all of them
  */
 typedef struct _SD_CardInfo
 {
-	SD_CSD SD_csd;
-	SD_CID SD_cid;
-	SD_SCR SD_scr;
-	uint32_t CardCapacity;			/*!< Card Capacity */
+	uint8_t  CSD[ 16 ];				/*!< CSD register */
+	uint8_t  CID[ 16 ];				/*!< CID register */
+	uint8_t  SCR[ 8 ];				/*!< SCR register (zero for MMC) */
+	uint32_t CardCapacity;			/*!< Card Capacity in Kbytes (2 Tb of SDXC fits) */
 	uint32_t CardBlockSize;			/*!< Card Block Size */
 } SD_CardInfo;
 
@@ -205,6 +212,7 @@ typedef struct _SD_Status
 										Dh - 24 Mb
 										Eh - 32 Mb
 										Fh - 64 Mb */
+	uint8_t		Raw[ 16 ];			/*!< First 16 bytes of the status as received (fields above, see SD_InfoFormat) */
 } SD_Status;
 
 /**
@@ -221,9 +229,146 @@ typedef enum _SD_Error
 	SD_ADDRESS_ERROR		= 0x20,
 	SD_PARAMETER_ERROR		= 0x40,
 	SD_CHECK_BIT			= 0x80,	/*!< this bit must be set to 0 */
+	SD_DATA_WRITE_ERROR		= 0xFC,	/*!< card failed programming accepted data blocks (not R1 bit, reported by driver) */
+	SD_DATA_MISMATCH		= 0xFD,	/*!< data read back differ from the expected ones (not R1 bit, reported by SD_SectorsVerify) */
+	SD_DATA_CRC_ERROR		= 0xFE,	/*!< data block CRC mismatch (not R1 bit, reported by driver) */
 	SD_RESPONSE_FAILURE		= 0xFF
 } SD_Error;
 
+/**
+ * @brief  Data buffer of consecutive sectors (see SD_SectorsWriteGather)
+ */
+typedef struct _SD_BufferSegment
+{
+	const uint8_t*	Buffer;				/*!< Data, Count * SD_BLOCK_SIZE bytes */
+	uint32_t		Count;				/*!< Number of sectors */
+} SD_BufferSegment;
+
+/**
+ * @brief  Learned distribution of BUSY durations while scheduler is running: running mean and
+ *         mean deviation in 1/16 ms (estimated as TCP estimates round trip time). The waiting
+ *         task sleeps through mean - deviation at once, then polls the card every tick.
+ */
+typedef struct _SD_BusyModel
+{
+	uint32_t	Samples;			/*!< Number of BUSY periods learned */
+	uint32_t	Mean16;				/*!< Mean duration in 1/16 ms */
+	uint32_t	Dev16;				/*!< Mean deviation in 1/16 ms */
+	uint32_t	Polls;				/*!< Polls after sleeping (one byte each), one per BUSY is ideal */
+	uint32_t	FirstPoll;			/*!< BUSY periods ended by the first poll (card may have been ready earlier) */
+} SD_BusyModel;
+
+#ifdef USE_SD_STATS
+/**
+ * @brief  Number of histogram bins of operation durations
+ */
+#define SD_STATS_HIST_BINS		16
+
+/**
+ * @brief  Duration statistics of one kind of operations (measured by DWT cycle counter)
+ */
+typedef struct _SD_Latency
+{
+	uint32_t	Count;				/*!< Number of measured operations */
+	uint32_t	MinUs;				/*!< Shortest duration in microseconds */
+	uint32_t	MaxUs;				/*!< Longest duration in microseconds */
+	uint32_t	AvgUs;				/*!< Average duration in microseconds (filled in by SD_GetStats) */
+	uint64_t	TotalUs;			/*!< Sum of all durations in microseconds */
+	uint32_t	Histogram[ SD_STATS_HIST_BINS ];	/*!< Bin N counts durations of 2^N..2^(N+1)-1 us
+										(bin 0 includes 0 us, the last bin includes all longer ones) */
+} SD_Latency;
+
+/**
+ * @brief  SD driver statistics
+ */
+typedef struct _SD_Stats
+{
+	SD_Latency	Command;			/*!< Command sent -> R1 response received */
+	SD_Latency	ReadToken;			/*!< Read command acknowledged -> data transmission token received */
+	SD_Latency	WriteBusy;			/*!< Data block accepted -> card finished writing (BUSY end) */
+	SD_Latency	EraseBusy;			/*!< Erase command acknowledged -> card finished erasing (BUSY end) */
+	uint32_t	CmdErrors;			/*!< Commands without valid R1 response */
+	uint32_t	CrcErrors;			/*!< Commands and data blocks rejected because of CRC error */
+	uint32_t	WriteErrors;		/*!< Data blocks rejected because of write error */
+	uint32_t	Timeouts;			/*!< Data token or BUSY end waits exceeding their limits */
+	uint32_t	Retries;			/*!< Repeated commands and transfers */
+	uint32_t	StatusQueries;		/*!< Failed transfers diagnosed by card status (CMD13) */
+	uint32_t	Reinits;			/*!< Fast reinitializations of the card which stopped responding */
+	uint32_t	Unrecovered;		/*!< Failed transfers given up (permanent error or no tries left) */
+	SD_BusyModel WriteModel;		/*!< Learned model of write BUSY (kept by SD_ResetStats, see SD_Timing) */
+} SD_Stats;
+#endif /* USE_SD_STATS */
+
+/**
+ * @brief  Timing of the card: starts from the profile of its model (CID manufacturer and
+ *         OEM ID), each delay longer than seen before stretches its limit (up to the
+ *         worst-case constants of the driver), so the limits can be saved and restored
+ *         by SD_SetTiming for the same card. Limits apply while scheduler is running,
+ *         before that (tick isn't counting) BUSY is limited by the worst-case tries.
+ */
+typedef struct _SD_Timing
+{
+	uint8_t		ManufacturerID;		/*!< CID manufacturer of the profile (0 - default profile) */
+	uint16_t	OEM_AppliID;		/*!< CID OEM/Application ID of the profile */
+	uint32_t	ReadTries;			/*!< Bytes polled for data transmission token */
+	uint32_t	BusyFastTries;		/*!< Bytes polled at full speed before the task sleeps on BUSY */
+	uint32_t	PollTicks;			/*!< Ticks slept before polling BUSY until its model is learned (between polls of erase BUSY) */
+	uint32_t	BatchSectors;		/*!< Sectors collected for one write burst (0 - AU size) */
+	uint32_t	WriteTimeoutMs;		/*!< Limit of BUSY after a data block */
+	uint32_t	EraseTimeoutMs;		/*!< Limit of BUSY after erase */
+	uint32_t	ReadMax;			/*!< Longest wait for data token seen, in polled bytes */
+	uint32_t	WriteMaxMs;			/*!< Longest BUSY after a data block seen */
+	uint32_t	EraseMaxMs;			/*!< Longest BUSY after erase seen */
+	SD_BusyModel WriteModel;		/*!< Durations of BUSY after data blocks */
+} SD_Timing;
+
+/**
+ * @brief  Type of SD card
+ */
+typedef enum _SDCardType
+{
+	SD_Card_MMC,	/*!< Multimedia card (no CMD8, no ACMD41, but CMD1, uses byte-addressing) */
+	SD_Card_SDSC_v1,/*!< Standard Capacity card v1 (no CMD8, but ACMD41, uses byte-addressing) */
+	SD_Card_SDSC_v2,/*!< Standard Capacity card v2 (has CMD8+ACMD41, uses byte-addressing) */
+	SD_Card_SDHC,	/*!< High Capacity card (has CMD8+ACMD41, uses sector-addressing) */
+	SD_Card_SDXC	/*!< Extended Capacity card (SDHC over 32 Gb, uses sector-addressing, exFAT formatted) */
+} SDCardType;
+
+/**
+ * @brief  SD Card context: card pins on its SPI bus and everything the driver knows about the card
+ *         (see SD_Card and SD_Card2, fields are managed by the driver)
+ */
+typedef struct _SD_Handle
+{
+	SPI_Device		Spi;			/*!< Card on its SPI bus: bus, chip select pin, clock and mode */
+	uint32_t		CS_Clk;			/*!< AHB1 clock of chip select pin port */
+	GPIO_TypeDef*	Detect_Port;	/*!< Presence detection pin port */
+	uint16_t		Detect_Pin;		/*!< Presence detection pin (low if card is in the slot) */
+	uint32_t		Detect_Clk;		/*!< AHB1 clock of presence detection pin port */
+
+	SDCardType		Type;			/*!< Type of initialized card */
+	uint8_t			Cmd23;			/*!< Nonzero if SD card supports CMD23 (SCR CMD_SUPPORT bit) */
+	uint8_t			HighSpeed;		/*!< Nonzero if SD card is switched to High Speed mode (CMD6) */
+	uint8_t			InfoValid;		/*!< Nonzero if Info belongs to the initialized card */
+	uint8_t			BusHeld;		/*!< Nesting depth of bus holds, card is selected while nonzero */
+	SD_CardInfo		Info;			/*!< CSD, CID, SCR and capacity of the card, read by SD_Init */
+	SD_Timing		Timing;			/*!< Timing limits of the card, selected by SD_Init */
+
+	uint8_t			WrStreamOpen;	/*!< Nonzero while streaming write (CMD25) is open */
+	uint32_t		WrStreamAddr;	/*!< Card address of the next block of streaming write */
+	uint32_t		WrStreamNext;	/*!< Sector number of the next block of streaming write */
+	uint32_t		WrStreamCount;	/*!< Blocks appended since streaming write (CMD25) was (re)started */
+	uint8_t			RdStreamOpen;	/*!< Nonzero while streaming read (CMD18) is open */
+	uint32_t		RdStreamAddr;	/*!< Card address of the next block of streaming read */
+	uint32_t		RdStreamNext;	/*!< Sector number of the next block of streaming read */
+#ifdef USE_SD_CRC
+	uint8_t			CrcOn;			/*!< Nonzero if card accepted CMD59 and checks CRC of commands and data */
+#endif /* USE_SD_CRC */
+#ifdef USE_SD_STATS
+	SD_Stats		Stats;			/*!< Statistics of the card */
+#endif /* USE_SD_STATS */
+} SD_Handle;
+
 /**
  * @}
  *//* STM32_Exported_Types */
@@ -237,12 +382,74 @@ typedef enum _SD_Error
  */
 #define SD_BLOCK_SIZE		0x200
 
+/**
+ * @brief  Largest SDHC card (32 Gb) in Kbytes, larger CSD v2 cards are SDXC
+ */
+#define SD_SDHC_MAX_KB		0x2000000
+
 /**
  * @brief  SD detection on its memory slot
  */
 #define SD_PRESENT			((uint8_t)0x01)
 #define SD_NOT_PRESENT		((uint8_t)0x00)
 
+/**
+ * @}
+ *//* STM32_Exported_Constants */
+
+/** @defgroup STM32_Exported_Variables
+ * @{
+ */
+
+extern SD_Handle SD_Card;			/* card on SPIx bus (SD_CS, SD_DETECT pins) */
+#ifdef USE_SD_CARD2
+extern SD_Handle SD_Card2;			/* card on SPIy bus (SD2_CS, SD2_DETECT pins) */
+#endif /* USE_SD_CARD2 */
+
+/**
+ * @}
+ *//* STM32_Exported_Variables */
+
+/** @defgroup STM32_Exported_Constants
+ * @{
+ */
+
+/**
+ * @brief  Register fields read by the drivers: SD_FIELD( lowest bit, width ), bits are
+ *         numbered as in SD specification (bit 0 is LSB of the last byte of the register)
+ */
+#define SD_FIELD( lsb, width )		( ( (uint16_t)( lsb ) << 8 ) | ( width ) )
+
+#define SD_CSD_STRUCTURE			SD_FIELD( 126, 2 )	/*!< CSD structure version (0: v1, 1: v2) */
+#define SD_CSD_TRAN_SPEED			SD_FIELD( 96, 8 )	/*!< Max. bus clock frequency */
+#define SD_CSD_CCC					SD_FIELD( 84, 12 )	/*!< Card command classes */
+#define SD_CSD_READ_BL_LEN			SD_FIELD( 80, 4 )	/*!< Max. read data block length */
+#define SD_CSD_C_SIZE_V1			SD_FIELD( 62, 12 )	/*!< Device size (v1) */
+#define SD_CSD_C_SIZE_MULT			SD_FIELD( 47, 3 )	/*!< Device size multiplier (v1) */
+#define SD_CSD_C_SIZE_V2			SD_FIELD( 48, 22 )	/*!< Device size (v2) */
+#define SD_CSD_ERASE_BLK_EN			SD_FIELD( 46, 1 )	/*!< Erase single block enable */
+#define SD_CSD_SECTOR_SIZE			SD_FIELD( 39, 7 )	/*!< Erase sector size */
+#define SD_CSD_WRITE_BL_LEN			SD_FIELD( 22, 4 )	/*!< Max. write data block length */
+
+#define SD_CID_MID					SD_FIELD( 120, 8 )	/*!< Manufacturer ID */
+#define SD_CID_OID					SD_FIELD( 104, 16 )	/*!< OEM/Application ID */
+
+#define SD_SCR_BUS_WIDTHS			SD_FIELD( 48, 4 )	/*!< Supported data bus widths */
+#define SD_SCR_CMD23				SD_FIELD( 33, 1 )	/*!< Support of CMD23 (set block count) */
+#define SD_SCR_CMD20				SD_FIELD( 32, 1 )	/*!< Support of CMD20 (speed class control) */
+
+/**
+ * @brief  Speed class control (CMD20) argument: start recording
+ */
+#define SD_SPEED_CLASS_START_REC	((uint32_t)0x00000000)
+
+/**
+ * @brief  Field of a register in card information
+ */
+#define SD_CSD_Get( cardinfo, field )	SD_GetField( (cardinfo)->CSD, 16, (field) )
+#define SD_CID_Get( cardinfo, field )	SD_GetField( (cardinfo)->CID, 16, (field) )
+#define SD_SCR_Get( cardinfo, field )	SD_GetField( (cardinfo)->SCR, 8, (field) )
+
 /**
  * @}
  *//* STM32_Exported_Constants */
@@ -251,28 +458,71 @@ typedef enum _SD_Error
  * @{
  */
 
-uint8_t SD_Detect( void );
+uint8_t SD_Detect( SD_Handle* hsd );
 
-void SD_DeInit( void );
-SD_Error SD_Init( void );
+void SD_DeInit( SD_Handle* hsd );
+SD_Error SD_Init( SD_Handle* hsd );
 
-SD_Error SD_GetCardInfo( SD_CardInfo *cardinfo );
+SD_Error SD_GetCardInfo( SD_Handle* hsd, SD_CardInfo *cardinfo );
+SD_Error SD_GetStatus( SD_Handle* hsd, SD_Status* SD_status );
+#ifdef USE_SD_DUMP
 void SD_DumpCardInfo( const SD_CardInfo *cardinfo );
-
-SD_Error SD_GetStatus( SD_Status* SD_status );
 void SD_DumpStatus( const SD_Status* SD_status );
+#endif /* USE_SD_DUMP */
+#ifdef USE_SD_STATS
+void SD_GetStats( SD_Handle* hsd, SD_Stats* stats );
+void SD_ResetStats( SD_Handle* hsd );
+#endif /* USE_SD_STATS */
+void SD_GetTiming( SD_Handle* hsd, SD_Timing* timing );
+void SD_SetTiming( SD_Handle* hsd, const SD_Timing* timing );
+void SD_DumpTiming( const SD_Timing* timing );
+
+/**
+ * Decoding of raw card registers (shared by SPI and SDIO drivers)
+ */
+void SD_DecodeCSD( const uint8_t* CSD_Tab, SD_CSD* SD_csd );
+void SD_DecodeCID( const uint8_t* CID_Tab, SD_CID* SD_cid );
+void SD_DecodeSCR( const uint8_t* SCR_Tab, SD_SCR* SD_scr );
+void SD_DecodeStatus( const uint8_t* status, SD_Status* SD_status );
+uint32_t SD_GetField( const uint8_t* reg, uint8_t size, uint16_t field );
+void SD_CalcCardCapacity( SD_CardInfo *cardinfo );
 
 /**
  * Read/Write/Erase by sectors of SD_BLOCK_SIZE (=512) bytes
  * All addresses are sector numbers
  * All buffers have to be pre-allocated to have 512 bytes
  */
-SD_Error SD_SectorRead( uint32_t readAddr, uint8_t* pBuffer );
-SD_Error SD_SectorWrite( uint32_t writeAddr, const uint8_t* pBuffer );
-SD_Error SD_SectorsRead( uint32_t readAddr, uint8_t* pBuffer, uint32_t nbSectors );
-SD_Error SD_SectorsWrite( uint32_t writeAddr, const uint8_t* pBuffer, uint32_t nbSectors );
-SD_Error SD_SectorsErase( uint32_t eraseAddrFrom, uint32_t eraseAddrTo );
-#define SD_SectorErase( eraseAddr )		SD_SectorsErase( (eraseAddr), (eraseAddr) )
+SD_Error SD_SectorRead( SD_Handle* hsd, uint32_t readAddr, uint8_t* pBuffer );
+SD_Error SD_SectorWrite( SD_Handle* hsd, uint32_t writeAddr, const uint8_t* pBuffer );
+SD_Error SD_SectorsRead( SD_Handle* hsd, uint32_t readAddr, uint8_t* pBuffer, uint32_t nbSectors );
+SD_Error SD_SectorsWrite( SD_Handle* hsd, uint32_t writeAddr, const uint8_t* pBuffer, uint32_t nbSectors );
+SD_Error SD_SectorsWriteGather( SD_Handle* hsd, uint32_t writeAddr, const SD_BufferSegment* segments, uint32_t nbSegments );
+SD_Error SD_SectorsVerify( SD_Handle* hsd, uint32_t readAddr, const uint8_t* pBuffer, uint32_t nbSectors );
+
+/**
+ * Streaming write/read: one multiple block write (CMD25) or read (CMD18) is kept
+ * open across calls while consecutive sectors are transferred, any other operation closes it
+ */
+#define SD_STREAM_CLOSED		((uint32_t)0xFFFFFFFF)
+SD_Error SD_WriteStreamBegin( SD_Handle* hsd, uint32_t writeAddr, uint32_t nbSectors );
+SD_Error SD_WriteStreamAppend( SD_Handle* hsd, const uint8_t* pBuffer, uint32_t nbSectors );
+SD_Error SD_WriteStreamEnd( SD_Handle* hsd );
+uint32_t SD_WriteStreamNext( SD_Handle* hsd );
+SD_Error SD_ReadStreamBegin( SD_Handle* hsd, uint32_t readAddr );
+SD_Error SD_ReadStreamRead( SD_Handle* hsd, uint8_t* pBuffer, uint32_t nbSectors );
+SD_Error SD_ReadStreamEnd( SD_Handle* hsd );
+uint32_t SD_ReadStreamNext( SD_Handle* hsd );
+SD_Error SD_SectorsErase( SD_Handle* hsd, uint32_t eraseAddrFrom, uint32_t eraseAddrTo );
+#define SD_SectorErase( hsd, eraseAddr )	SD_SectorsErase( (hsd), (eraseAddr), (eraseAddr) )
+SD_Error SD_SpeedClassControl( SD_Handle* hsd, uint32_t ctrl );
+
+/**
+ * Transaction: the card stays selected and owns its SPI bus from Begin to End, so
+ * the commands in between don't toggle chip select and the trailing clocks are sent
+ * once at End (transactions nest, SD_Init and SD_DeInit must not be called inside)
+ */
+void SD_TransactionBegin( SD_Handle* hsd );
+void SD_TransactionEnd( SD_Handle* hsd );
 
 /**
  * @}
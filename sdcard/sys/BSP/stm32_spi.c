@@ -13,6 +13,18 @@
 #include "main.h"
 
 #include "stm32_spi.h"
+#include "stm32_mem.h"
+#include "stm32_irq.h"
+#include "power.h"
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#ifdef USE_FAST_IO_CODE
+#pragma GCC optimize ( "O2" )
+#endif /* USE_FAST_IO_CODE */
 
 /** @addtogroup Utilities
  * @{
@@ -29,6 +41,39 @@
 /** @defgroup STM32_Private_Defines
  * @{
  */
+
+#ifdef USE_SPI_DMA
+/**
+ * @brief  Maximum time to wait for DMA transfer completion (in RTOS ticks)
+ */
+#define SPI_DMA_TIMEOUT_TICKS	((portTickType)20)
+
+/**
+ * @brief  Maximum number of polls of DMA completion flag when scheduler is not running yet
+ */
+#define SPI_DMA_TIMEOUT_TRIES	((uint32_t)1000000)
+
+/**
+ * @brief  DMA part of SPI bus description (see SPI_BUS_INIT)
+ */
+#define SPI_BUS_DMA_INIT( x )	x##_SPI_DMA_STREAM_RX, x##_SPI_DMA_STREAM_TX, x##_SPI_DMA_CLK, x##_SPI_DMA_CHANNEL, \
+								( x##_RX_DMA_FLAG_FEIF | x##_RX_DMA_FLAG_DMEIF | x##_RX_DMA_FLAG_TEIF | \
+								  x##_RX_DMA_FLAG_HTIF | x##_RX_DMA_FLAG_TCIF ), \
+								( x##_TX_DMA_FLAG_FEIF | x##_TX_DMA_FLAG_DMEIF | x##_TX_DMA_FLAG_TEIF | \
+								  x##_TX_DMA_FLAG_HTIF | x##_TX_DMA_FLAG_TCIF ), \
+								x##_RX_DMA_FLAG_TCIF, x##_RX_DMA_FLAG_TEIF, x##_SPI_DMA_RX_IRQn,
+#else
+#define SPI_BUS_DMA_INIT( x )
+#endif /* USE_SPI_DMA */
+
+/**
+ * @brief  Description of SPI bus from its x_SPI_* definitions in stm32_pins.h
+ *         (SCK, MISO and MOSI are on the same port), state fields start zeroed
+ */
+#define SPI_BUS_INIT( x )		{ x##_SPI, x##_SPI_CLK_INIT, x##_SPI_CLK, x##_SPI_SCLK_GPIO_PORT, x##_SPI_SCLK_GPIO_CLK, \
+								  { x##_SPI_SCLK_SOURCE, x##_SPI_MISO_SOURCE, x##_SPI_MOSI_SOURCE }, x##_SPI_SCLK_AF, \
+								  SPI_BUS_DMA_INIT( x ) }
+
 /**
  * @}
  *//* STM32_Private_Defines */
@@ -53,6 +98,17 @@
 /** @defgroup STM32_Private_Variables
  * @{
  */
+
+SPI_Bus SPIx_Bus = SPI_BUS_INIT( SPIx );			/* SD Card and touch screen */
+#ifdef USE_SD_CARD2
+SPI_Bus SPIy_Bus = SPI_BUS_INIT( SPIy );			/* second SD Card */
+#endif /* USE_SD_CARD2 */
+
+#ifdef USE_SPI_DMA
+static uint8_t SPI_DMA_DummyTx = 0xFF;			/* source of 0xFF stream clocked out while receiving (read only, shared) */
+static uint8_t SPI_DMA_DummyRx MEM_DMA_BUFFER;				/* sink of bytes received while transmitting (never read, shared) */
+#endif /* USE_SPI_DMA */
+
 /**
  * @}
  *//* STM32_Private_Variables */
@@ -66,50 +122,140 @@
  *//* STM32_Private_FunctionPrototypes */
 
 
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Applies clock and mode of the device to SPI peripheral (if it isn't applied yet)
+ * @param  dev: Device profile
+ * @retval None
+ */
+static void STM_EVAL_SPI_Apply( SPI_Device* dev )
+{
+	SPI_TypeDef* spi = dev->Bus->SPIx;
+	uint16_t cr1 = ( spi->CR1 & ~( SPI_CR1_BR | SPI_CR1_CPOL | SPI_CR1_CPHA ) ) |
+				   dev->Prescaler | dev->CPOL | dev->CPHA;
+
+	dev->Bus->Profile = dev;
+	if ( cr1 == spi->CR1 )
+		return;
+	/* clock and mode can be changed only when communication is over and SPI is disabled */
+	while ( SPI_I2S_GetFlagStatus( spi, SPI_I2S_FLAG_TXE ) == RESET ) {}
+	while ( SPI_I2S_GetFlagStatus( spi, SPI_I2S_FLAG_BSY ) == SET ) {}
+	SPI_Cmd( spi, DISABLE );
+	spi->CR1 = cr1 & ~SPI_CR1_SPE;
+	SPI_Cmd( spi, ENABLE );
+}
+
+#ifdef USE_SPI_DMA
+/**
+ * @brief  Initialize DMA streams of SPI bus (RX and TX, both peripheral <-> memory, byte wide)
+ *         Streams are configured once, every transfer only updates memory address,
+ *         memory increment and counter registers.
+ * @param  bus: SPI bus
+ * @retval None
+ */
+static void STM_EVAL_SPI_DMA_Init( SPI_Bus* bus )
+{
+	DMA_InitTypeDef  DMA_InitStructure;
+
+	/* Enable the DMA clock */
+	RCC_AHB1PeriphClockCmd( bus->DmaClk, ENABLE );
+
+	DMA_DeInit( bus->StreamRx );
+	DMA_DeInit( bus->StreamTx );
+
+	DMA_InitStructure.DMA_Channel            = bus->DmaChannel;
+	DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&( bus->SPIx->DR );
+	DMA_InitStructure.DMA_BufferSize         = 1;
+	DMA_InitStructure.DMA_PeripheralInc      = DMA_PeripheralInc_Disable;
+	DMA_InitStructure.DMA_MemoryInc          = DMA_MemoryInc_Enable;
+	DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+	DMA_InitStructure.DMA_MemoryDataSize     = DMA_MemoryDataSize_Byte;
+	DMA_InitStructure.DMA_Mode               = DMA_Mode_Normal;
+	DMA_InitStructure.DMA_FIFOMode           = DMA_FIFOMode_Disable;
+	DMA_InitStructure.DMA_FIFOThreshold      = DMA_FIFOThreshold_Full;
+	DMA_InitStructure.DMA_MemoryBurst        = DMA_MemoryBurst_Single;
+	DMA_InitStructure.DMA_PeripheralBurst    = DMA_PeripheralBurst_Single;
+
+	/* RX stream has higher priority, so received byte is always taken before the next one arrives */
+	DMA_InitStructure.DMA_Memory0BaseAddr    = (uint32_t)&SPI_DMA_DummyRx;
+	DMA_InitStructure.DMA_DIR                = DMA_DIR_PeripheralToMemory;
+	DMA_InitStructure.DMA_Priority           = DMA_Priority_VeryHigh;
+	DMA_Init( bus->StreamRx, &DMA_InitStructure );
+
+	DMA_InitStructure.DMA_Memory0BaseAddr    = (uint32_t)&SPI_DMA_DummyTx;
+	DMA_InitStructure.DMA_DIR                = DMA_DIR_MemoryToPeripheral;
+	DMA_InitStructure.DMA_Priority           = DMA_Priority_High;
+	DMA_Init( bus->StreamTx, &DMA_InitStructure );
+
+	/* the last byte received means the whole transfer is over => only RX stream interrupts */
+	DMA_ITConfig( bus->StreamRx, DMA_IT_TC | DMA_IT_TE, ENABLE );
+
+	IRQ_Enable( (IRQn_Type)bus->IRQn, IRQ_PRIO_SD_DMA );
+}
+
+/**
+ * @brief  Point DMA stream to a memory buffer (stream has to be disabled)
+ * @param  stream: DMA stream
+ * @param  mem: buffer address
+ * @param  inc: nonzero for memory address increment, 0 for repeatedly using the same byte
+ * @param  len: number of bytes
+ * @retval None
+ */
+static void STM_EVAL_SPI_DMA_Setup( DMA_Stream_TypeDef* stream, uint32_t mem, uint8_t inc, uint16_t len )
+{
+	if ( inc )
+		stream->CR |= DMA_SxCR_MINC;
+	else
+		stream->CR &= ~DMA_SxCR_MINC;
+	stream->M0AR = mem;
+	stream->NDTR = len;
+}
+#endif /* USE_SPI_DMA */
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
 /** @defgroup STM32_Public_Functions
  * @{
  */
 
 /**
- * @brief  Initialize SPI
- * @param  None
+ * @brief  Initialize SPI bus
+ * @param  bus: SPI bus
  * @retval None
  */
-void STM_EVAL_SPI_Init( void )
+void STM_EVAL_SPI_Init( SPI_Bus* bus )
 {
 	SPI_InitTypeDef  SPI_InitStructure;
 	GPIO_InitTypeDef GPIO_InitStructure;
+	uint8_t i;
 
 	/* Enable the SPI clock */
-	SPIx_SPI_CLK_INIT( SPIx_SPI_CLK, ENABLE );
+	bus->ClkCmd( bus->Clk, ENABLE );
 
-	/* Enable GPIO clocks (they are all on GPIOB) */
-	SPIx_SPI_SCLK_GPIO_CLK_INIT( SPIx_SPI_SCLK_GPIO_CLK, ENABLE );
-
-	/* Connect SPI pins to AF5 */
-	GPIO_PinAFConfig( SPIx_SPI_SCLK_GPIO_PORT, SPIx_SPI_SCLK_SOURCE, SPIx_SPI_SCLK_AF );
-	GPIO_PinAFConfig( SPIx_SPI_MISO_GPIO_PORT, SPIx_SPI_MISO_SOURCE, SPIx_SPI_MISO_AF );
-	GPIO_PinAFConfig( SPIx_SPI_MOSI_GPIO_PORT, SPIx_SPI_MOSI_SOURCE, SPIx_SPI_MOSI_AF );
+	/* Enable GPIO clock (all pins of the bus are on the same port) */
+	RCC_AHB1PeriphClockCmd( bus->PortClk, ENABLE );
 
 	GPIO_InitStructure.GPIO_Mode  = GPIO_Mode_AF;
 	GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;	/* base clock is set to 50Mhz */
 	GPIO_InitStructure.GPIO_OType = GPIO_OType_PP;
 	GPIO_InitStructure.GPIO_PuPd  = GPIO_PuPd_DOWN;
 
-	/* SPI SCK pin configuration */
-	GPIO_InitStructure.GPIO_Pin = SPIx_SPI_SCLK_PIN;
-	GPIO_Init( SPIx_SPI_SCLK_GPIO_PORT, &GPIO_InitStructure );
-
-	/* SPI  MISO pin configuration */
-	GPIO_InitStructure.GPIO_Pin = SPIx_SPI_MISO_PIN;
-	GPIO_Init( SPIx_SPI_MISO_GPIO_PORT, &GPIO_InitStructure );
-
-	/* SPI  MOSI pin configuration */
-	GPIO_InitStructure.GPIO_Pin =  SPIx_SPI_MOSI_PIN;
-	GPIO_Init( SPIx_SPI_MOSI_GPIO_PORT, &GPIO_InitStructure );
+	/* Connect SPI SCK, MISO and MOSI pins to their AF and configure them */
+	for ( i = 0; i < 3; ++i )
+	{
+		GPIO_PinAFConfig( bus->Port, bus->Source[ i ], bus->AF );
+		GPIO_InitStructure.GPIO_Pin = (uint16_t)( 1 << bus->Source[ i ] );
+		GPIO_Init( bus->Port, &GPIO_InitStructure );
+	}
 
 	/* SPI configuration -------------------------------------------------------*/
-	SPI_I2S_DeInit( SPIx_SPI );
+	SPI_I2S_DeInit( bus->SPIx );
 
 	/* Initializes the SPI communication */
 	SPI_InitStructure.SPI_Direction         = SPI_Direction_2Lines_FullDuplex;
@@ -117,36 +263,360 @@ void STM_EVAL_SPI_Init( void )
 	SPI_InitStructure.SPI_CPOL              = SPI_CPOL_High;
 	SPI_InitStructure.SPI_CPHA              = SPI_CPHA_2Edge;
 	SPI_InitStructure.SPI_NSS               = SPI_NSS_Soft;
-	SPI_InitStructure.SPI_BaudRatePrescaler =
-#ifdef USE_TOUCHSCREEN
-		SPI_BaudRatePrescaler_16;
-#else
-		SPI_BaudRatePrescaler_2;	/* actual speed of SPI bus is half of base clock */
-#endif /* USE_TOUCHSCREEN */
+	/* clock and mode are changed later to the ones of device taking the bus (see SPI_Device) */
+	SPI_InitStructure.SPI_BaudRatePrescaler = SPI_BaudRatePrescaler_2;	/* actual speed of SPI bus is half of base clock */
 	SPI_InitStructure.SPI_FirstBit          = SPI_FirstBit_MSB;
 	SPI_InitStructure.SPI_CRCPolynomial     = 7;
 	SPI_InitStructure.SPI_Mode              = SPI_Mode_Master;
-	SPI_Init( SPIx_SPI, &SPI_InitStructure );
+	SPI_Init( bus->SPIx, &SPI_InitStructure );
 
 	/* The Data transfer is performed in the SPI interrupt routine */
-	SPI_Cmd( SPIx_SPI, ENABLE );  /* Enable the SPI peripheral */
+	SPI_Cmd( bus->SPIx, ENABLE );  /* Enable the SPI peripheral */
+	bus->Profile = NULL;
+
+	if ( bus->Mutex == NULL )
+		bus->Mutex = xSemaphoreCreateMutexStatic( &bus->MutexBuffer );
+
+#ifdef USE_SPI_DMA
+	STM_EVAL_SPI_DMA_Init( bus );
+#endif /* USE_SPI_DMA */
+}
+
+/**
+ * @brief  Takes SPI bus for the device: waits until other task releases it
+ *         and applies the device profile (clock and mode)
+ * @param  dev: Device profile
+ * @retval None
+ */
+void STM_EVAL_SPI_Lock( SPI_Device* dev )
+{
+	SPI_Bus* bus = dev->Bus;
+
+	/* there is only one task before scheduler is started, mutex can't be taken yet */
+	if ( bus->Mutex != NULL && xTaskGetSchedulerState() == taskSCHEDULER_RUNNING )
+	{
+		xSemaphoreTake( bus->Mutex, portMAX_DELAY );
+		bus->Locked = 1;		/* only the owner of the bus changes it */
+	}
+	STM_EVAL_SPI_Apply( dev );
+}
+
+/**
+ * @brief  Releases SPI bus taken by STM_EVAL_SPI_Lock
+ * @param  dev: Device profile
+ * @retval None
+ */
+void STM_EVAL_SPI_Unlock( SPI_Device* dev )
+{
+	SPI_Bus* bus = dev->Bus;
+
+	if ( bus->Locked )
+	{
+		bus->Locked = 0;
+		xSemaphoreGive( bus->Mutex );
+	}
+}
+
+/**
+ * @brief  Sets the fastest SPI bus clock of the device not exceeding the given frequency,
+ *         the slowest one (base clock / 256) is set if no one fits.
+ *         New clock is applied immediately if the device owns the bus.
+ * @param  dev: Device profile
+ * @param  maxHz: Maximum SPI bus clock frequency in Hz
+ * @retval Actual SPI bus clock frequency in Hz
+ */
+uint32_t STM_EVAL_SPI_Set_Speed( SPI_Device* dev, uint32_t maxHz )
+{
+	RCC_ClocksTypeDef RCC_Clocks;
+	uint32_t hz;
+	uint16_t br = 0;	/* baud rate control: bus clock = base clock / 2^(br+1) */
+
+	RCC_GetClocksFreq( &RCC_Clocks );
+	hz = ( dev->Bus->SPIx == SPI1 ) ? RCC_Clocks.PCLK2_Frequency : RCC_Clocks.PCLK1_Frequency;
+	hz >>= 1;
+	while ( hz > maxHz && br < 7 )
+	{
+		hz >>= 1;
+		++br;
+	}
+
+	dev->Prescaler = br << 3;
+	if ( dev->Bus->Profile == dev )
+		STM_EVAL_SPI_Apply( dev );
+
+	return hz;
 }
 
 /**
  * @brief  Sends a byte on SPI bus and receives a byte of response
- * @see SD_WriteByte() and SD_ReadByte() from stm32_eval_spi_sd.c
+ *         (out of line STM_EVAL_SPI_Exchange for callers outside of hot loops)
+ * @param  bus: SPI bus
  * @param  Byte to send
  * @retval Received data
  */
-uint16_t STM_EVAL_SPI_Send_Recieve_Data( uint8_t data )
+uint16_t STM_EVAL_SPI_Send_Recieve_Data( SPI_Bus* bus, uint8_t data )
+{
+	return STM_EVAL_SPI_Exchange( bus, data );
+}
+
+/**
+ * @brief  One step of pipelined polled transfer: the next frame is put to TX buffer while
+ *         the previous one is shifted out, then the previous received frame is taken,
+ *         so the bus never waits for CPU between frames (at most 2 frames are in flight)
+ */
+#define SPI_PIO_STEP( spi, out, in ) \
+	do { \
+		while ( ( (spi)->SR & SPI_I2S_FLAG_TXE ) == 0 ) {} \
+		(spi)->DR = ( out ); \
+		while ( ( (spi)->SR & SPI_I2S_FLAG_RXNE ) == 0 ) {} \
+		( in ) = (spi)->DR; \
+	} while ( 0 )
+
+/**
+ * @brief  Exchanges a block of bytes on SPI bus by polling (8-bit frames)
+ * @param  spi: SPI peripheral
+ * @param  rxbuf: buffer for received bytes or NULL to discard them
+ * @param  txbuf: bytes to send or NULL to send 0xFF dummy bytes
+ * @param  len: number of bytes (1..65535)
+ * @retval None
+ */
+static void MEM_RAM_FUNC STM_EVAL_SPI_PIO_Transfer8( SPI_TypeDef* spi, uint8_t* rxbuf, const uint8_t* txbuf, uint16_t len )
+{
+	uint16_t i, n = len - 1;
+	uint16_t b;
+
+	while ( ( spi->SR & SPI_I2S_FLAG_TXE ) == 0 ) {}
+	spi->DR = ( txbuf != NULL ) ? txbuf[ 0 ] : 0xFF;
+
+	/* separate loops, so none of them checks buffers per byte; 4 bytes per iteration */
+	if ( rxbuf != NULL && txbuf != NULL )
+	{
+		for ( i = 0; i + 4 <= n; i += 4 )
+		{
+			SPI_PIO_STEP( spi, txbuf[ i + 1 ], rxbuf[ i ] );
+			SPI_PIO_STEP( spi, txbuf[ i + 2 ], rxbuf[ i + 1 ] );
+			SPI_PIO_STEP( spi, txbuf[ i + 3 ], rxbuf[ i + 2 ] );
+			SPI_PIO_STEP( spi, txbuf[ i + 4 ], rxbuf[ i + 3 ] );
+		}
+		for ( ; i < n; ++i )
+			SPI_PIO_STEP( spi, txbuf[ i + 1 ], rxbuf[ i ] );
+	}
+	else if ( rxbuf != NULL )
+	{
+		for ( i = 0; i + 4 <= n; i += 4 )
+		{
+			SPI_PIO_STEP( spi, 0xFF, rxbuf[ i ] );
+			SPI_PIO_STEP( spi, 0xFF, rxbuf[ i + 1 ] );
+			SPI_PIO_STEP( spi, 0xFF, rxbuf[ i + 2 ] );
+			SPI_PIO_STEP( spi, 0xFF, rxbuf[ i + 3 ] );
+		}
+		for ( ; i < n; ++i )
+			SPI_PIO_STEP( spi, 0xFF, rxbuf[ i ] );
+	}
+	else if ( txbuf != NULL )
+	{
+		for ( i = 0; i + 4 <= n; i += 4 )
+		{
+			SPI_PIO_STEP( spi, txbuf[ i + 1 ], b );
+			SPI_PIO_STEP( spi, txbuf[ i + 2 ], b );
+			SPI_PIO_STEP( spi, txbuf[ i + 3 ], b );
+			SPI_PIO_STEP( spi, txbuf[ i + 4 ], b );
+		}
+		for ( ; i < n; ++i )
+			SPI_PIO_STEP( spi, txbuf[ i + 1 ], b );
+	}
+	else
+	{
+		for ( i = 0; i < n; ++i )
+			SPI_PIO_STEP( spi, 0xFF, b );
+	}
+
+	/* the last byte */
+	while ( ( spi->SR & SPI_I2S_FLAG_RXNE ) == 0 ) {}
+	b = spi->DR;
+	if ( rxbuf != NULL )
+		rxbuf[ n ] = (uint8_t)b;
+}
+
+#ifdef USE_SPI_PIO_16BIT
+/**
+ * @brief  Exchanges a block of 16-bit frames on SPI bus by polling, bytes go MSB first
+ *         as in 8-bit frames (SPI has to be idle in 16-bit mode)
+ * @param  spi: SPI peripheral
+ * @param  rxbuf: buffer for received bytes or NULL to discard them
+ * @param  txbuf: bytes to send or NULL to send 0xFF dummy bytes
+ * @param  len: number of frames (1..32767)
+ * @retval None
+ */
+static void MEM_RAM_FUNC STM_EVAL_SPI_PIO_Transfer16( SPI_TypeDef* spi, uint8_t* rxbuf, const uint8_t* txbuf, uint16_t len )
+{
+	uint16_t i, n = len - 1;
+	uint16_t w;
+
+	while ( ( spi->SR & SPI_I2S_FLAG_TXE ) == 0 ) {}
+	spi->DR = ( txbuf != NULL ) ? ( (uint16_t)txbuf[ 0 ] << 8 ) | txbuf[ 1 ] : 0xFFFF;
+	for ( i = 0; i < n; ++i )
+	{
+		SPI_PIO_STEP( spi, ( txbuf != NULL ) ? ( (uint16_t)txbuf[ 2 * i + 2 ] << 8 ) | txbuf[ 2 * i + 3 ] : 0xFFFF, w );
+		if ( rxbuf != NULL )
+		{
+			rxbuf[ 2 * i ] = (uint8_t)( w >> 8 );
+			rxbuf[ 2 * i + 1 ] = (uint8_t)w;
+		}
+	}
+	while ( ( spi->SR & SPI_I2S_FLAG_RXNE ) == 0 ) {}
+	w = spi->DR;
+	if ( rxbuf != NULL )
+	{
+		rxbuf[ 2 * n ] = (uint8_t)( w >> 8 );
+		rxbuf[ 2 * n + 1 ] = (uint8_t)w;
+	}
+}
+#endif /* USE_SPI_PIO_16BIT */
+
+/**
+ * @brief  Exchanges a block of bytes on SPI bus by polling (for buses without DMA streams
+ *         and blocks too short for DMA). Transmission runs one byte ahead of reception,
+ *         so the bytes follow each other without gaps.
+ * @param  bus: SPI bus
+ * @param  rxbuf: buffer for received bytes or NULL to discard them
+ * @param  txbuf: bytes to send or NULL to send 0xFF dummy bytes
+ * @param  len: number of bytes (0..65535)
+ * @retval None
+ */
+void STM_EVAL_SPI_PIO_Transfer( SPI_Bus* bus, uint8_t* rxbuf, const uint8_t* txbuf, uint16_t len )
+{
+	SPI_TypeDef* spi = bus->SPIx;
+
+	if ( len == 0 )
+		return;
+#ifdef USE_SPI_PIO_16BIT
+	if ( len >= 4 )
+	{	/* data frame format can be changed only while SPI is disabled */
+		while ( ( spi->SR & SPI_I2S_FLAG_TXE ) == 0 ) {}
+		while ( spi->SR & SPI_I2S_FLAG_BSY ) {}
+		spi->CR1 &= ~SPI_CR1_SPE;
+		spi->CR1 |= SPI_DataSize_16b;
+		spi->CR1 |= SPI_CR1_SPE;
+
+		STM_EVAL_SPI_PIO_Transfer16( spi, rxbuf, txbuf, len >> 1 );
+
+		while ( spi->SR & SPI_I2S_FLAG_BSY ) {}
+		spi->CR1 &= ~SPI_CR1_SPE;
+		spi->CR1 &= ~SPI_DataSize_16b;
+		spi->CR1 |= SPI_CR1_SPE;
+		if ( ( len & 1 ) == 0 )
+			return;
+		/* odd byte in 8-bit frame */
+		if ( rxbuf != NULL )
+			rxbuf += len - 1;
+		if ( txbuf != NULL )
+			txbuf += len - 1;
+		len = 1;
+	}
+#endif /* USE_SPI_PIO_16BIT */
+	STM_EVAL_SPI_PIO_Transfer8( spi, rxbuf, txbuf, len );
+}
+
+#ifdef USE_SPI_DMA
+/**
+ * @brief  Exchanges a block of bytes on SPI bus by DMA.
+ *         Calling task sleeps until the transfer completes (it busy-waits only if
+ *         scheduler isn't started yet).
+ * @param  bus: SPI bus
+ * @param  rxbuf: buffer for received bytes or NULL to discard them
+ * @param  txbuf: bytes to send or NULL to send 0xFF dummy bytes
+ * @param  len: number of bytes (1..65535)
+ * @retval SUCCESS if all bytes were exchanged, ERROR otherwise
+ */
+ErrorStatus STM_EVAL_SPI_DMA_Transfer( SPI_Bus* bus, uint8_t* rxbuf, const uint8_t* txbuf, uint16_t len )
+{
+	SPI_TypeDef* spi = bus->SPIx;
+	ErrorStatus res = SUCCESS;
+	uint32_t i;
+
+	if ( len == 0 )
+		return SUCCESS;
+
+	/* make sure the last polled byte is taken, so DMA doesn't get a stale one */
+	while ( SPI_I2S_GetFlagStatus( spi, SPI_I2S_FLAG_TXE ) == RESET ) {}
+	while ( SPI_I2S_GetFlagStatus( spi, SPI_I2S_FLAG_BSY ) == SET ) {}
+	if ( SPI_I2S_GetFlagStatus( spi, SPI_I2S_FLAG_RXNE ) == SET )
+		SPI_I2S_ReceiveData( spi );
+
+	DMA_ClearFlag( bus->StreamRx, bus->FlagsRx );
+	DMA_ClearFlag( bus->StreamTx, bus->FlagsTx );
+
+	if ( rxbuf != NULL )
+		STM_EVAL_SPI_DMA_Setup( bus->StreamRx, (uint32_t)rxbuf, 1, len );
+	else
+		STM_EVAL_SPI_DMA_Setup( bus->StreamRx, (uint32_t)&SPI_DMA_DummyRx, 0, len );
+	if ( txbuf != NULL )
+		STM_EVAL_SPI_DMA_Setup( bus->StreamTx, (uint32_t)txbuf, 1, len );
+	else
+		STM_EVAL_SPI_DMA_Setup( bus->StreamTx, (uint32_t)&SPI_DMA_DummyTx, 0, len );
+
+	bus->Done = 0;
+	bus->Waiter = ( xTaskGetSchedulerState() == taskSCHEDULER_RUNNING ) ? xTaskGetCurrentTaskHandle() : NULL;
+	POWER_BUSY();
+
+	/* receiver first, then transmitter starts clocking the bus */
+	DMA_Cmd( bus->StreamRx, ENABLE );
+	DMA_Cmd( bus->StreamTx, ENABLE );
+	SPI_I2S_DMACmd( spi, SPI_I2S_DMAReq_Rx | SPI_I2S_DMAReq_Tx, ENABLE );
+
+	if ( bus->Waiter != NULL )
+	{	/* CPU is free for other tasks until DMA interrupt wakes us up (a late
+		   notification of an earlier transfer only makes us look at Done again) */
+		while ( bus->Done == 0 )
+		{
+			if ( ulTaskNotifyTake( pdTRUE, SPI_DMA_TIMEOUT_TICKS ) == 0 )
+			{
+				res = ERROR;
+				break;
+			}
+		}
+	}
+	else
+	{
+		i = SPI_DMA_TIMEOUT_TRIES;
+		while ( bus->Done == 0 && i-- > 0 ) {}
+	}
+	if ( bus->Done != 1 )
+		res = ERROR;
+
+	SPI_I2S_DMACmd( spi, SPI_I2S_DMAReq_Rx | SPI_I2S_DMAReq_Tx, DISABLE );
+	if ( res != SUCCESS )
+	{	/* streams are disabled by hardware after normal completion, not after errors */
+		DMA_Cmd( bus->StreamTx, DISABLE );
+		DMA_Cmd( bus->StreamRx, DISABLE );
+		while ( DMA_GetCmdStatus( bus->StreamRx ) != DISABLE ) {}
+	}
+	/* TX stream completes before the last byte leaves the shift register */
+	while ( DMA_GetCmdStatus( bus->StreamTx ) != DISABLE ) {}
+
+	bus->Waiter = NULL;
+	POWER_RELEASE();
+	return res;
+}
+
+/**
+ * @brief  Handles DMA interrupt of SPI RX stream (transfer complete or error)
+ * @param  bus: SPI bus of the stream
+ * @retval None
+ */
+void STM_EVAL_SPI_DMA_IRQHandler( SPI_Bus* bus )
 {
-	/* Wait until the transmit buffer is empty */
-	while ( SPI_I2S_GetFlagStatus( SPIx_SPI, SPI_I2S_FLAG_TXE ) == RESET ) {}
-	SPI_I2S_SendData( SPIx_SPI, data );	/* Send byte to SPI bus */
-	/* Wait to receive a byte */
-	while ( SPI_I2S_GetFlagStatus( SPIx_SPI, SPI_I2S_FLAG_RXNE ) == RESET ) {}
-	return SPI_I2S_ReceiveData( SPIx_SPI );	/* Read byte from SPI bus */
+	if ( DMA_GetFlagStatus( bus->StreamRx, bus->FlagTEIF ) == SET )
+		bus->Done = 2;
+	else if ( DMA_GetFlagStatus( bus->StreamRx, bus->FlagTCIF ) == SET )
+		bus->Done = 1;
+	DMA_ClearFlag( bus->StreamRx, bus->FlagsRx );
+
+	if ( bus->Done != 0 && bus->Waiter != NULL )
+		IRQ_Notify( bus->Waiter );
 }
+#endif /* USE_SPI_DMA */
 
 //void STM_EVAL_SPI_Low_Speed()
 //{
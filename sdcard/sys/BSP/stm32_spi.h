@@ -17,10 +17,17 @@ extern "C" {
 #endif
 
 /* Includes ------------------------------------------------------------------*/
+#include "main.h"
+
 #include "stm32f2xx.h"
 
 #include "stm32_pins.h"
 
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
 /** @addtogroup Utilities
  * @{
  */
@@ -28,6 +35,57 @@ extern "C" {
 /** @defgroup STM32_Exported_Types
  * @{
  */
+
+struct _SPI_Device;
+
+/**
+ * @brief  SPI bus: peripheral, its pins and DMA streams (see SPI_BUS_INIT in stm32_spi.c)
+ *         and the state of bus arbitration and DMA transfer. Devices on different buses
+ *         are driven in parallel, devices on the same bus take it in turns.
+ */
+typedef struct _SPI_Bus
+{
+	SPI_TypeDef*		SPIx;			/*!< SPI peripheral */
+	void				( *ClkCmd )( uint32_t, FunctionalState );	/*!< RCC_APBxPeriphClockCmd of SPI peripheral */
+	uint32_t			Clk;			/*!< SPI peripheral clock */
+	GPIO_TypeDef*		Port;			/*!< Port of SCK, MISO and MOSI pins */
+	uint32_t			PortClk;		/*!< AHB1 clock of the port */
+	uint8_t				Source[ 3 ];	/*!< Pin sources of SCK, MISO and MOSI */
+	uint8_t				AF;				/*!< Alternate function of the pins */
+#ifdef USE_SPI_DMA
+	DMA_Stream_TypeDef*	StreamRx;		/*!< DMA stream of SPI RX */
+	DMA_Stream_TypeDef*	StreamTx;		/*!< DMA stream of SPI TX */
+	uint32_t			DmaClk;			/*!< AHB1 clock of DMA controller */
+	uint32_t			DmaChannel;		/*!< DMA channel of both streams */
+	uint32_t			FlagsRx;		/*!< All flags of RX stream */
+	uint32_t			FlagsTx;		/*!< All flags of TX stream */
+	uint32_t			FlagTCIF;		/*!< Transfer complete flag of RX stream */
+	uint32_t			FlagTEIF;		/*!< Transfer error flag of RX stream */
+	uint8_t				IRQn;			/*!< Interrupt of RX stream (IRQ_PRIO_SD_DMA) */
+
+	xTaskHandle volatile	Waiter;		/*!< Task notified by DMA ISR when transfer is over, NULL if it polls */
+	volatile uint8_t	Done;			/*!< Set by DMA ISR: 1 - completed, 2 - failed */
+#endif /* USE_SPI_DMA */
+
+	xSemaphoreHandle	Mutex;			/*!< Taken by the task owning the bus */
+	struct _SPI_Device*	Profile;		/*!< Device whose profile is applied to SPI peripheral */
+	uint8_t				Locked;			/*!< Nonzero if Mutex was taken by Lock */
+	xStaticSemaphore	MutexBuffer;	/*!< Memory of Mutex */
+} SPI_Bus;
+
+/**
+ * @brief  Profile of a device on the shared SPI bus, applied every time the device takes the bus
+ */
+typedef struct _SPI_Device
+{
+	SPI_Bus*		Bus;			/*!< SPI bus the device is connected to */
+	GPIO_TypeDef*	CS_Port;		/*!< Chip select pin port */
+	uint16_t		CS_Pin;			/*!< Chip select pin (active low) */
+	uint16_t		Prescaler;		/*!< SPI_BaudRatePrescaler_x, see also STM_EVAL_SPI_Set_Speed */
+	uint16_t		CPOL;			/*!< SPI_CPOL_Low or SPI_CPOL_High */
+	uint16_t		CPHA;			/*!< SPI_CPHA_1Edge or SPI_CPHA_2Edge */
+} SPI_Device;
+
 /**
  * @}
  *//* STM32_Exported_Types */
@@ -35,18 +93,90 @@ extern "C" {
 /** @defgroup STM32_Exported_Constants
  * @{
  */
+
+/**
+ * @brief  Maximum SPI bus clock during SD Card identification (specification requires 100-400KHz)
+ */
+#define SPI_LOW_SPEED_HZ		((uint32_t)400000)
+
 /**
  * @}
  *//* STM32_Exported_Constants */
 
+/** @defgroup STM32_Exported_Variables
+ * @{
+ */
+
+extern SPI_Bus SPIx_Bus;
+#ifdef USE_SD_CARD2
+extern SPI_Bus SPIy_Bus;
+#endif /* USE_SD_CARD2 */
+
+/**
+ * @}
+ *//* STM32_Exported_Variables */
+
 /** @defgroup STM32_Exported_Functions
  * @{
  */
 
-void STM_EVAL_SPI_Init( void );
-uint16_t STM_EVAL_SPI_Send_Recieve_Data( uint8_t data );
-//void STM_EVAL_SPI_High_Speed( void );
-//void STM_EVAL_SPI_Low_Speed( void );
+void STM_EVAL_SPI_Init( SPI_Bus* bus );
+uint16_t STM_EVAL_SPI_Send_Recieve_Data( SPI_Bus* bus, uint8_t data );
+void STM_EVAL_SPI_PIO_Transfer( SPI_Bus* bus, uint8_t* rxbuf, const uint8_t* txbuf, uint16_t len );
+#ifdef USE_SPI_DMA
+ErrorStatus STM_EVAL_SPI_DMA_Transfer( SPI_Bus* bus, uint8_t* rxbuf, const uint8_t* txbuf, uint16_t len );
+void STM_EVAL_SPI_DMA_IRQHandler( SPI_Bus* bus );
+#endif /* USE_SPI_DMA */
+
+/**
+ * Shared bus arbitration: device owns its bus between Lock and Unlock
+ * (other tasks wait on mutex of the bus), Select/Deselect drive its chip select pin
+ * (inline, see below)
+ */
+void STM_EVAL_SPI_Lock( SPI_Device* dev );
+void STM_EVAL_SPI_Unlock( SPI_Device* dev );
+
+uint32_t STM_EVAL_SPI_Set_Speed( SPI_Device* dev, uint32_t maxHz );
+#define STM_EVAL_SPI_Low_Speed( dev )		STM_EVAL_SPI_Set_Speed( (dev), SPI_LOW_SPEED_HZ )
+#define STM_EVAL_SPI_High_Speed( dev )		STM_EVAL_SPI_Set_Speed( (dev), 0xFFFFFFFF )
+
+/**
+ * @brief  Selects the device: sets its chip select pin low (one store to BSRR)
+ * @param  dev: Device profile
+ * @retval None
+ */
+static __INLINE void STM_EVAL_SPI_Select( SPI_Device* dev )
+{
+	dev->CS_Port->BSRRH = dev->CS_Pin;
+}
+
+/**
+ * @brief  Deselects the device: sets its chip select pin high (one store to BSRR)
+ * @param  dev: Device profile
+ * @retval None
+ */
+static __INLINE void STM_EVAL_SPI_Deselect( SPI_Device* dev )
+{
+	dev->CS_Port->BSRRL = dev->CS_Pin;
+}
+
+/**
+ * @brief  Sends a byte on SPI bus and receives a byte of response by direct access
+ *         to SPI registers: no SPL calls and parameter checks per byte, so only a few
+ *         cycles are added to the frame (byte-wise commands and responses of SD Card)
+ * @param  bus: SPI bus (owned by the caller, 8-bit frames)
+ * @param  data: Byte to send
+ * @retval Received byte
+ */
+static __INLINE uint8_t STM_EVAL_SPI_Exchange( SPI_Bus* bus, uint8_t data )
+{
+	SPI_TypeDef* spi = bus->SPIx;
+
+	while ( ( spi->SR & SPI_I2S_FLAG_TXE ) == 0 ) {}
+	spi->DR = data;
+	while ( ( spi->SR & SPI_I2S_FLAG_RXNE ) == 0 ) {}
+	return (uint8_t)spi->DR;
+}
 
 /**
  * @}
@@ -0,0 +1,151 @@
+/**
+ ******************************************************************************
+ * @file    stm32_sram.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   External SRAM on FSMC Bank 1 NOR/SRAM (asynchronous, 16-bit).
+ *          The memory is tested once after FSMC is configured: if the chip
+ *          is missing or a line is broken, users of the SRAM (the second
+ *          tier of diskio sector cache) have to do without it.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "stm32_sram.h"
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Variables
+ * @{
+ */
+
+static uint8_t SRAM_Ready = 0;
+
+/**
+ * @}
+ *//* STM32_Private_Variables */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Checks data lines, byte lanes and address lines of the SRAM (contents are lost)
+ * @param  None
+ * @retval SUCCESS if the memory works
+ */
+static ErrorStatus SRAM_Test( void )
+{
+	volatile uint16_t* mem = (volatile uint16_t*)FSMC_SRAM_ADDR;
+	volatile uint8_t* mem8 = (volatile uint8_t*)FSMC_SRAM_ADDR;
+	uint32_t a;
+	uint16_t k;
+
+	/* data lines: walking one */
+	for ( k = 0; k < 16; ++k )
+	{
+		mem[ 0 ] = 1 << k;
+		if ( mem[ 0 ] != ( 1 << k ) )
+			return ERROR;
+	}
+
+	/* byte lanes: NBL0 and NBL1 */
+	mem[ 0 ] = 0x0000;
+	mem8[ 1 ] = 0xA5;
+	if ( mem[ 0 ] != 0xA500 )
+		return ERROR;
+	mem8[ 0 ] = 0x5A;
+	if ( mem[ 0 ] != 0xA55A )
+		return ERROR;
+
+	/* address lines: each power of 2 word keeps its own value */
+	mem[ 0 ] = 0xFFFF;
+	for ( a = 1, k = 0; a < FSMC_SRAM_SIZE / 2; a <<= 1, ++k )
+		mem[ a ] = k;
+	if ( mem[ 0 ] != 0xFFFF )
+		return ERROR;
+	for ( a = 1, k = 0; a < FSMC_SRAM_SIZE / 2; a <<= 1, ++k )
+	{
+		if ( mem[ a ] != k )
+			return ERROR;
+	}
+	return SUCCESS;
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Configures FSMC pins and Bank 1 NOR/SRAM timings, then tests the memory
+ * @param  None
+ * @retval SUCCESS if the SRAM is usable
+ */
+ErrorStatus STM_EVAL_SRAM_Init( void )
+{
+	FSMC_NORSRAMInitTypeDef FSMC_NORSRAMInitStructure;
+	FSMC_NORSRAMTimingInitTypeDef p;
+
+	SRAM_GPIO_PORTS_INIT( SRAM_GPIO_PORTS, ENABLE );
+	SRAM_config_pins();
+	RCC_AHB3PeriphClockCmd( RCC_AHB3Periph_FSMC, ENABLE );
+
+	/* 10 ns SRAM at HCLK 120 MHz: 2 cycles of address setup, 5 cycles of data */
+	p.FSMC_AddressSetupTime = 1;
+	p.FSMC_AddressHoldTime = 0;
+	p.FSMC_DataSetupTime = 4;
+	p.FSMC_BusTurnAroundDuration = 1;
+	p.FSMC_CLKDivision = 0;
+	p.FSMC_DataLatency = 0;
+	p.FSMC_AccessMode = FSMC_AccessMode_A;
+
+	FSMC_NORSRAMInitStructure.FSMC_Bank = FSMC_Bank1_NORSRAM;
+	FSMC_NORSRAMInitStructure.FSMC_DataAddressMux = FSMC_DataAddressMux_Disable;
+	FSMC_NORSRAMInitStructure.FSMC_MemoryType = FSMC_MemoryType_SRAM;
+	FSMC_NORSRAMInitStructure.FSMC_MemoryDataWidth = FSMC_MemoryDataWidth_16b;
+	FSMC_NORSRAMInitStructure.FSMC_BurstAccessMode = FSMC_BurstAccessMode_Disable;
+	FSMC_NORSRAMInitStructure.FSMC_AsynchronousWait = FSMC_AsynchronousWait_Disable;
+	FSMC_NORSRAMInitStructure.FSMC_WaitSignalPolarity = FSMC_WaitSignalPolarity_Low;
+	FSMC_NORSRAMInitStructure.FSMC_WrapMode = FSMC_WrapMode_Disable;
+	FSMC_NORSRAMInitStructure.FSMC_WaitSignalActive = FSMC_WaitSignalActive_BeforeWaitState;
+	FSMC_NORSRAMInitStructure.FSMC_WriteOperation = FSMC_WriteOperation_Enable;
+	FSMC_NORSRAMInitStructure.FSMC_WaitSignal = FSMC_WaitSignal_Disable;
+	FSMC_NORSRAMInitStructure.FSMC_ExtendedMode = FSMC_ExtendedMode_Disable;
+	FSMC_NORSRAMInitStructure.FSMC_WriteBurst = FSMC_WriteBurst_Disable;
+	FSMC_NORSRAMInitStructure.FSMC_ReadWriteTimingStruct = &p;
+	FSMC_NORSRAMInitStructure.FSMC_WriteTimingStruct = &p;
+	FSMC_NORSRAMInit( &FSMC_NORSRAMInitStructure );
+	FSMC_NORSRAMCmd( FSMC_Bank1_NORSRAM, ENABLE );
+
+	SRAM_Ready = ( SRAM_Test() == SUCCESS );
+	return SRAM_Ready ? SUCCESS : ERROR;
+}
+
+/**
+ * @brief  Tells if the SRAM has passed the test of STM_EVAL_SRAM_Init
+ * @param  None
+ * @retval Nonzero if the SRAM is usable
+ */
+uint8_t STM_EVAL_SRAM_Ready( void )
+{
+	return SRAM_Ready;
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
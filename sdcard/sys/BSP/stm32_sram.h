@@ -0,0 +1,48 @@
+/**
+ ******************************************************************************
+ * @file    stm32_sram.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   External SRAM on FSMC Bank 1 NOR/SRAM (asynchronous, 16-bit).
+ *          Buffers placed there by MEM_EXT_SRAM (stm32_mem.h) are usable
+ *          after STM_EVAL_SRAM_Init has returned SUCCESS.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32_SRAM_H
+#define STM32_SRAM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f2xx.h"
+
+#include "stm32_pins.h"
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+ErrorStatus STM_EVAL_SRAM_Init( void );
+uint8_t STM_EVAL_SRAM_Ready( void );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32_SRAM_H */
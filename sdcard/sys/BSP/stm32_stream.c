@@ -0,0 +1,237 @@
+/**
+ ******************************************************************************
+ * @file    stm32_stream.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Single producer, single consumer stream buffer: the producer
+ *          writes only Head, the consumer writes only Tail, data are stored
+ *          before Head moves and read before Tail moves (memory barrier), so
+ *          both sides always see a consistent ring without masking
+ *          interrupts. A waiting side re-arms its task handle before each
+ *          check, the other side takes the handle before notifying, so a
+ *          wakeup is neither lost nor repeated for the same wait.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "stm32_stream.h"
+
+#include <stddef.h>
+
+#if !configUSE_TASK_NOTIFICATIONS || !INCLUDE_xTaskGetCurrentTaskHandle
+#error Stream buffer needs configUSE_TASK_NOTIFICATIONS and INCLUDE_xTaskGetCurrentTaskHandle (see FreeRTOSConfig.h)
+#endif
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  Completes memory accesses to the ring data before an index is moved
+ *         (also keeps the compiler from moving them, CMSIS __DMB() doesn't)
+ */
+#define STREAM_BARRIER()		__ASM volatile ( "dmb" : : : "memory" )
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Takes the consumer to wake after Head has moved
+ * @param  s: Stream buffer
+ * @retval Consumer task, NULL if it isn't waiting or not enough data yet
+ */
+static xTaskHandle STREAM_TakeReader( STREAM_Buffer* s )
+{
+	xTaskHandle task = s->Reader;
+
+	if ( task == NULL || STREAM_Available( s ) < s->Threshold )
+		return NULL;
+	s->Reader = NULL;
+	return task;
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Initializes empty stream buffer
+ * @param  s: Stream buffer
+ * @param  buf: Storage (DMA capable memory if DMA fills or drains it)
+ * @param  size: Size of the storage in bytes, power of 2
+ * @param  threshold: Bytes available which wake the consumer (1 .. size),
+ *         e.g. sector size for the consumer writing whole sectors
+ * @retval ERROR if size or threshold is invalid
+ */
+ErrorStatus STREAM_Init( STREAM_Buffer* s, void* buf, uint32_t size, uint32_t threshold )
+{
+	if ( size == 0 || ( size & ( size - 1 ) ) != 0 || threshold == 0 || threshold > size )
+		return ERROR;
+	s->Buffer = (uint8_t*)buf;
+	s->Size = size;
+	s->Threshold = threshold;
+	s->Head = s->Tail = 0;
+	s->Space = 0;
+	s->Reader = s->Writer = NULL;
+	return SUCCESS;
+}
+
+/**
+ * @brief  Gets free region for the producer: it ends at the end of the storage
+ *         or at the oldest data, the rest of free space follows the next commit
+ * @param  s: Stream buffer
+ * @param  region: Receives the start of the region
+ * @retval Size of the region in bytes, 0 if the buffer is full
+ */
+uint32_t STREAM_Acquire( STREAM_Buffer* s, void** region )
+{
+	uint32_t pos = s->Head & ( s->Size - 1 );
+	uint32_t n = STREAM_Free( s );
+
+	if ( n > s->Size - pos )
+		n = s->Size - pos;
+	*region = s->Buffer + pos;
+	return n;
+}
+
+/**
+ * @brief  Passes filled part of the acquired region to the consumer
+ * @param  s: Stream buffer
+ * @param  len: Number of bytes (up to the size returned by STREAM_Acquire)
+ * @retval None
+ */
+void STREAM_Commit( STREAM_Buffer* s, uint32_t len )
+{
+	xTaskHandle task;
+
+	STREAM_BARRIER();
+	s->Head += len;
+	task = STREAM_TakeReader( s );
+	if ( task != NULL )
+		xTaskNotifyGive( task );
+}
+
+/**
+ * @brief  STREAM_Commit for interrupt handlers (up to configMAX_SYSCALL_INTERRUPT_PRIORITY)
+ * @param  s: Stream buffer
+ * @param  len: Number of bytes
+ * @param  woken: Set to pdTRUE if the consumer has to run, pass to portYIELD_FROM_ISR
+ * @retval None
+ */
+void STREAM_CommitFromISR( STREAM_Buffer* s, uint32_t len, signed portBASE_TYPE* woken )
+{
+	xTaskHandle task;
+
+	STREAM_BARRIER();
+	s->Head += len;
+	task = STREAM_TakeReader( s );
+	if ( task != NULL )
+		vTaskNotifyGiveFromISR( task, woken );
+}
+
+/**
+ * @brief  Waits until the consumer frees enough space (producer task only)
+ * @param  s: Stream buffer
+ * @param  len: Number of free bytes needed (up to Size)
+ * @param  timeout: Timeout of each wait in ticks
+ * @retval Number of free bytes, less than len on timeout
+ */
+uint32_t STREAM_WaitSpace( STREAM_Buffer* s, uint32_t len, portTickType timeout )
+{
+	s->Space = len;
+	for ( ;; )
+	{
+		s->Writer = xTaskGetCurrentTaskHandle();
+		if ( STREAM_Free( s ) >= len )
+			break;
+		if ( ulTaskNotifyTake( pdTRUE, timeout ) == 0 )
+			break;
+	}
+	s->Writer = NULL;
+	return STREAM_Free( s );
+}
+
+/**
+ * @brief  Gets filled region for the consumer: it ends at the end of the storage
+ *         or at Head, the rest of data follows the next release
+ * @param  s: Stream buffer
+ * @param  region: Receives the start of the region
+ * @retval Size of the region in bytes, 0 if the buffer is empty
+ */
+uint32_t STREAM_Peek( STREAM_Buffer* s, void** region )
+{
+	uint32_t pos = s->Tail & ( s->Size - 1 );
+	uint32_t n = STREAM_Available( s );
+
+	if ( n > s->Size - pos )
+		n = s->Size - pos;
+	*region = s->Buffer + pos;
+	return n;
+}
+
+/**
+ * @brief  Returns consumed part of the region to the producer
+ * @param  s: Stream buffer
+ * @param  len: Number of bytes (up to the size returned by STREAM_Peek)
+ * @retval None
+ */
+void STREAM_Release( STREAM_Buffer* s, uint32_t len )
+{
+	xTaskHandle task;
+
+	STREAM_BARRIER();
+	s->Tail += len;
+	task = s->Writer;
+	if ( task != NULL && STREAM_Free( s ) >= s->Space )
+	{
+		s->Writer = NULL;
+		xTaskNotifyGive( task );
+	}
+}
+
+/**
+ * @brief  Waits until Threshold bytes are available (consumer task only)
+ * @param  s: Stream buffer
+ * @param  timeout: Timeout of each wait in ticks, on timeout the consumer
+ *         may drain what is there (e.g. the tail of a burst)
+ * @retval Number of bytes available, less than Threshold on timeout
+ */
+uint32_t STREAM_WaitData( STREAM_Buffer* s, portTickType timeout )
+{
+	for ( ;; )
+	{
+		s->Reader = xTaskGetCurrentTaskHandle();
+		if ( STREAM_Available( s ) >= s->Threshold )
+			break;
+		if ( ulTaskNotifyTake( pdTRUE, timeout ) == 0 )
+			break;
+	}
+	s->Reader = NULL;
+	return STREAM_Available( s );
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
@@ -0,0 +1,104 @@
+/**
+ ******************************************************************************
+ * @file    stm32_stream.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Single producer, single consumer stream buffer of bytes.
+ *          Unlike a queue, data aren't copied in and out: the producer gets
+ *          the contiguous free region of the ring, fills it (by CPU or DMA)
+ *          and commits it, the consumer gets the contiguous filled region,
+ *          passes it straight to f_write, RING_Write or DMA and releases it.
+ *          Each side moves only its own index, so no locking is needed; the
+ *          waiting side is woken by task notification when the other side
+ *          has moved its index far enough (the consumer when Threshold bytes
+ *          are available). Producer may be an interrupt handler.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32_STREAM_H
+#define STM32_STREAM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f2xx.h"
+
+#include <stdint.h>
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Types
+ * @{
+ */
+
+/**
+ * @brief  Stream buffer object. Indices run freely and wrap at 2^32, so the
+ *         amount of data is always Head - Tail and Size has to be a power of 2.
+ */
+typedef struct
+{
+	uint8_t*				Buffer;			/*!< Storage of the ring */
+	uint32_t				Size;			/*!< Size of the storage in bytes (power of 2) */
+	uint32_t				Threshold;		/*!< Bytes available which wake the consumer */
+	volatile uint32_t		Head;			/*!< Bytes committed so far, moved only by the producer */
+	volatile uint32_t		Tail;			/*!< Bytes released so far, moved only by the consumer */
+	volatile uint32_t		Space;			/*!< Free bytes the blocked producer waits for */
+	xTaskHandle volatile	Reader;			/*!< Consumer task blocked in STREAM_WaitData, or NULL */
+	xTaskHandle volatile	Writer;			/*!< Producer task blocked in STREAM_WaitSpace, or NULL */
+} STREAM_Buffer;
+
+/**
+ * @}
+ *//* STM32_Exported_Types */
+
+/** @defgroup STM32_Exported_Macros
+ * @{
+ */
+
+/**
+ * @brief  Number of bytes available to the consumer and free for the producer
+ */
+#define STREAM_Available( s )	( (s)->Head - (s)->Tail )
+#define STREAM_Free( s )		( (s)->Size - STREAM_Available( s ) )
+
+/**
+ * @}
+ *//* STM32_Exported_Macros */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+ErrorStatus STREAM_Init( STREAM_Buffer* s, void* buf, uint32_t size, uint32_t threshold );
+
+uint32_t STREAM_Acquire( STREAM_Buffer* s, void** region );
+void STREAM_Commit( STREAM_Buffer* s, uint32_t len );
+void STREAM_CommitFromISR( STREAM_Buffer* s, uint32_t len, signed portBASE_TYPE* woken );
+uint32_t STREAM_WaitSpace( STREAM_Buffer* s, uint32_t len, portTickType timeout );
+
+uint32_t STREAM_Peek( STREAM_Buffer* s, void** region );
+void STREAM_Release( STREAM_Buffer* s, uint32_t len );
+uint32_t STREAM_WaitData( STREAM_Buffer* s, portTickType timeout );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32_STREAM_H */
@@ -51,20 +51,22 @@
  */
 
 /*const, but USART_Init() takes non-const parameter */
-USART_TypeDef* COM_USART[ COMn ] = { EVAL_COM1 };
+USART_TypeDef* COM_USART[ COMn ] = { EVAL_COM1, EVAL_COM2 };
 /*const, but GPIO_PinAFConfig() takes non-const parameter */
-GPIO_TypeDef* COM_TX_PORT[ COMn ] = { EVAL_COM1_TX_GPIO_PORT };
+GPIO_TypeDef* COM_TX_PORT[ COMn ] = { EVAL_COM1_TX_GPIO_PORT, EVAL_COM2_TX_GPIO_PORT };
 /*const, but GPIO_PinAFConfig() takes non-const parameter */
-GPIO_TypeDef* COM_RX_PORT[ COMn ] = { EVAL_COM1_RX_GPIO_PORT };
-const uint32_t COM_USART_CLK[ COMn ] = { EVAL_COM1_CLK };
-const uint32_t COM_TX_PORT_CLK[ COMn ] = { EVAL_COM1_TX_GPIO_CLK };
-const uint32_t COM_RX_PORT_CLK[ COMn ] = { EVAL_COM1_RX_GPIO_CLK };
-const uint16_t COM_TX_PIN[ COMn ] = { EVAL_COM1_TX_PIN };
-const uint16_t COM_RX_PIN[ COMn ] = { EVAL_COM1_RX_PIN };
-const uint8_t COM_TX_PIN_SOURCE[ COMn ] = { EVAL_COM1_TX_SOURCE };
-const uint8_t COM_RX_PIN_SOURCE[ COMn ] = { EVAL_COM1_RX_SOURCE };
-const uint8_t COM_TX_AF[ COMn ] = { EVAL_COM1_TX_AF };
-const uint8_t COM_RX_AF[ COMn ] = { EVAL_COM1_RX_AF };
+GPIO_TypeDef* COM_RX_PORT[ COMn ] = { EVAL_COM1_RX_GPIO_PORT, EVAL_COM2_RX_GPIO_PORT };
+const uint32_t COM_USART_CLK[ COMn ] = { EVAL_COM1_CLK, EVAL_COM2_CLK };
+void ( * const COM_USART_CLK_INIT[ COMn ] )( uint32_t, FunctionalState ) = { EVAL_COM1_CLK_INIT, EVAL_COM2_CLK_INIT };
+const uint32_t COM_TX_PORT_CLK[ COMn ] = { EVAL_COM1_TX_GPIO_CLK, EVAL_COM2_TX_GPIO_CLK };
+const uint32_t COM_RX_PORT_CLK[ COMn ] = { EVAL_COM1_RX_GPIO_CLK, EVAL_COM2_RX_GPIO_CLK };
+const uint16_t COM_TX_PIN[ COMn ] = { EVAL_COM1_TX_PIN, EVAL_COM2_TX_PIN };
+const uint16_t COM_RX_PIN[ COMn ] = { EVAL_COM1_RX_PIN, EVAL_COM2_RX_PIN };
+const uint8_t COM_TX_PIN_SOURCE[ COMn ] = { EVAL_COM1_TX_SOURCE, EVAL_COM2_TX_SOURCE };
+const uint8_t COM_RX_PIN_SOURCE[ COMn ] = { EVAL_COM1_RX_SOURCE, EVAL_COM2_RX_SOURCE };
+const uint8_t COM_TX_AF[ COMn ] = { EVAL_COM1_TX_AF, EVAL_COM2_TX_AF };
+const uint8_t COM_RX_AF[ COMn ] = { EVAL_COM1_RX_AF, EVAL_COM2_RX_AF };
+const uint8_t COM_IRQn[ COMn ] = { EVAL_COM1_IRQn, EVAL_COM2_IRQn };
 
 /**
  * @}
@@ -91,6 +93,30 @@ const uint8_t COM_RX_AF[ COMn ] = { EVAL_COM1_RX_AF };
  *//* STM32_Private_FunctionPrototypes */
 
 
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Returns clock of the bus of COM port: USART1 and USART6 are on APB2, others on APB1
+ * @param  COM: COM port
+ * @retval Peripheral clock in Hz
+ */
+static uint32_t STM_EVAL_COMClock( COM_TypeDef COM )
+{
+	RCC_ClocksTypeDef clocks;
+
+	RCC_GetClocksFreq( &clocks );
+	if ( COM_USART[ COM ] == USART1 || COM_USART[ COM ] == USART6 )
+		return clocks.PCLK2_Frequency;
+	return clocks.PCLK1_Frequency;
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
 /** @defgroup STM32_Public_Functions
  * @{
  */
@@ -112,8 +138,8 @@ void STM_EVAL_COMInit( COM_TypeDef COM, USART_InitTypeDef* USART_InitStruct )
 	/* Enable GPIO clock */
 	COM_GPIO_CLK_INIT( COM_TX_PORT_CLK[ COM ] | COM_RX_PORT_CLK[ COM ], ENABLE );
 
-	if ( COM == COM1 ) /* TODO: can be done better here */
-		COM_RxTx_GPIO_CLK_INIT( COM_USART_CLK[ COM ], ENABLE );	/* Enable USART clock */
+	/* Enable USART clock (APB1 or APB2) */
+	COM_USART_CLK_INIT[ COM ]( COM_USART_CLK[ COM ], ENABLE );
 
 	/* connect GPIO port to USARTx_Tx */
 	GPIO_PinAFConfig( COM_TX_PORT[ COM ], COM_TX_PIN_SOURCE[ COM ], COM_TX_AF[ COM ] );
@@ -134,13 +160,58 @@ void STM_EVAL_COMInit( COM_TypeDef COM, USART_InitTypeDef* USART_InitStruct )
 	GPIO_InitStructure.GPIO_Pin = COM_RX_PIN[COM];
 	GPIO_Init( COM_RX_PORT[ COM ], &GPIO_InitStructure );
 
-	/* USART configuration */
+	/* USART configuration: rates above PCLK / 16 need oversampling by 8 */
+	USART_OverSampling8Cmd( COM_USART[ COM ],
+		( USART_InitStruct->USART_BaudRate > STM_EVAL_COMClock( COM ) / 16 ) ? ENABLE : DISABLE );
 	USART_Init( COM_USART[ COM ], USART_InitStruct );
 
 	/* enable USART */
 	USART_Cmd( COM_USART[ COM ], ENABLE );
 }
 
+/**
+ * @brief  Changes baud rate of initialized COM port, the character being sent is finished first
+ * @param  COM: Specifies the COM port
+ * @param  baudRate: New baud rate (up to STM_EVAL_COMMaxBaudRate)
+ * @retval ERROR if the rate is out of range of the port
+ */
+ErrorStatus STM_EVAL_COMSetBaudRate( COM_TypeDef COM, uint32_t baudRate )
+{
+	USART_TypeDef* usart = COM_USART[ COM ];
+	uint32_t pclk = STM_EVAL_COMClock( COM );
+	uint32_t over8, div, mantissa, fraction;
+
+	if ( baudRate == 0 || baudRate > pclk / 8 )
+		return ERROR;
+	over8 = ( baudRate > pclk / 16 );
+
+	/* USARTDIV * 100, as USART_Init() calculates it */
+	div = ( 25 * pclk ) / ( ( over8 ? 2 : 4 ) * baudRate );
+	mantissa = div / 100;
+	fraction = div - 100 * mantissa;
+	if ( over8 )
+		fraction = ( ( fraction * 8 + 50 ) / 100 ) & 0x07;
+	else
+		fraction = ( ( fraction * 16 + 50 ) / 100 ) & 0x0F;
+
+	while ( ( usart->CR1 & USART_CR1_UE ) && USART_GetFlagStatus( usart, USART_FLAG_TC ) == RESET ) {}
+	USART_Cmd( usart, DISABLE );
+	USART_OverSampling8Cmd( usart, over8 ? ENABLE : DISABLE );
+	usart->BRR = (uint16_t)( ( mantissa << 4 ) | fraction );
+	USART_Cmd( usart, ENABLE );
+	return SUCCESS;
+}
+
+/**
+ * @brief  Returns the highest baud rate of COM port (PCLK / 8 with oversampling by 8)
+ * @param  COM: Specifies the COM port
+ * @retval Baud rate
+ */
+uint32_t STM_EVAL_COMMaxBaudRate( COM_TypeDef COM )
+{
+	return STM_EVAL_COMClock( COM ) / 8;
+}
+
 /**
  * @}
  *//* STM32_Public_Functions */
@@ -31,8 +31,8 @@ extern "C" {
 
 typedef enum _COM_TypeDef
 {
-  COM1 = 0
-// ,COM2 = 1
+  COM1 = 0,
+  COM2 = 1
 } COM_TypeDef;
 
 /**
@@ -42,6 +42,10 @@ typedef enum _COM_TypeDef
 /** @defgroup STM32_Exported_Constants
  * @{
  */
+
+extern USART_TypeDef* COM_USART[ COMn ];
+extern const uint8_t COM_IRQn[ COMn ];
+
 /**
  * @}
  *//* STM32_Exported_Constants */
@@ -51,6 +55,8 @@ typedef enum _COM_TypeDef
  */
 
 void STM_EVAL_COMInit( COM_TypeDef COM, USART_InitTypeDef* USART_InitStruct );
+ErrorStatus STM_EVAL_COMSetBaudRate( COM_TypeDef COM, uint32_t baudRate );
+uint32_t STM_EVAL_COMMaxBaudRate( COM_TypeDef COM );
 
 /**
  * @}
@@ -0,0 +1,955 @@
+/**
+ ******************************************************************************
+ * @file    stm32_usb.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   USB device on the OTG FS core, slave mode (the CPU moves packets).
+ *          All received packets come through the shared RX FIFO: its level
+ *          interrupt pops each one into the buffer of its OUT transfer (or
+ *          the SETUP packet), the endpoint interrupt then reports the end
+ *          of the transfer or of the setup stage. IN transfers are written
+ *          into the TX FIFO of the endpoint as far as it has room and go on
+ *          from its empty interrupt, so transfers of any size take one call.
+ *          Control transfers are answered in the interrupt handler: IN data
+ *          of up to 127 bytes (3 packets), OUT data stages are stalled (the
+ *          class requests which have them aren't supported).
+ *          CMSIS has no register definitions of the OTG cores for STM32F2,
+ *          they are here after RM0033.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#ifdef USE_USB_MSC
+
+#include "stm32_usb.h"
+#include "stm32_pins.h"
+#include "stm32_irq.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Types
+ * @{
+ */
+
+/**
+ * @brief  Core global registers
+ */
+typedef struct
+{
+	__IO uint32_t	GOTGCTL;
+	__IO uint32_t	GOTGINT;
+	__IO uint32_t	GAHBCFG;
+	__IO uint32_t	GUSBCFG;
+	__IO uint32_t	GRSTCTL;
+	__IO uint32_t	GINTSTS;
+	__IO uint32_t	GINTMSK;
+	__IO uint32_t	GRXSTSR;
+	__IO uint32_t	GRXSTSP;
+	__IO uint32_t	GRXFSIZ;
+	__IO uint32_t	DIEPTXF0;
+	__IO uint32_t	GNPTXSTS;
+	uint32_t		Reserved0[ 2 ];
+	__IO uint32_t	GCCFG;
+	__IO uint32_t	CID;
+	uint32_t		Reserved1[ 48 ];
+	__IO uint32_t	HPTXFSIZ;
+	__IO uint32_t	DIEPTXF[ USB_ENDPOINTS - 1 ];
+} USB_GlobalRegs;
+
+/**
+ * @brief  Device mode registers
+ */
+typedef struct
+{
+	__IO uint32_t	DCFG;
+	__IO uint32_t	DCTL;
+	__IO uint32_t	DSTS;
+	uint32_t		Reserved0;
+	__IO uint32_t	DIEPMSK;
+	__IO uint32_t	DOEPMSK;
+	__IO uint32_t	DAINT;
+	__IO uint32_t	DAINTMSK;
+	uint32_t		Reserved1[ 2 ];
+	__IO uint32_t	DVBUSDIS;
+	__IO uint32_t	DVBUSPULSE;
+	uint32_t		Reserved2;
+	__IO uint32_t	DIEPEMPMSK;
+} USB_DeviceRegs;
+
+/**
+ * @brief  Registers of an IN or OUT endpoint (TXFSTS only for IN)
+ */
+typedef struct
+{
+	__IO uint32_t	CTL;
+	uint32_t		Reserved0;
+	__IO uint32_t	INT;
+	uint32_t		Reserved1;
+	__IO uint32_t	TSIZ;
+	uint32_t		Reserved2;
+	__IO uint32_t	TXFSTS;
+	uint32_t		Reserved3;
+} USB_EndpointRegs;
+
+/**
+ * @brief  Transfer of an endpoint
+ */
+typedef struct
+{
+	uint8_t*		Buf;		/*!< Data */
+	uint32_t		Len;		/*!< Bytes to be transferred */
+	uint32_t		Count;		/*!< Bytes written into the TX FIFO (IN) or received (OUT) */
+	uint16_t		Size;		/*!< Packet size */
+} USB_Transfer;
+
+/**
+ * @}
+ *//* STM32_Private_Types */
+
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  Registers of OTG FS
+ */
+#define USB_BASE				((uint32_t)0x50000000)
+#define USB_GLOBAL				((USB_GlobalRegs*)USB_BASE)
+#define USB_DEV					((USB_DeviceRegs*)( USB_BASE + 0x800 ))
+#define USB_IN( n )				((USB_EndpointRegs*)( USB_BASE + 0x900 + ( n ) * 0x20 ))
+#define USB_OUT( n )			((USB_EndpointRegs*)( USB_BASE + 0xB00 + ( n ) * 0x20 ))
+#define USB_PCGCCTL				(*(__IO uint32_t*)( USB_BASE + 0xE00 ))
+#define USB_FIFO( n )			((__IO uint32_t*)( USB_BASE + 0x1000 + ( n ) * 0x1000 ))
+
+#define USB_GAHBCFG_GINTMSK		((uint32_t)0x00000001)
+#define USB_GAHBCFG_TXFELVL		((uint32_t)0x00000080)
+
+#define USB_GUSBCFG_PHYSEL		((uint32_t)0x00000040)
+#define USB_GUSBCFG_FDMOD		((uint32_t)0x40000000)
+#define USB_GUSBCFG_TRDT( n )	((uint32_t)( n ) << 10 )
+#define USB_GUSBCFG_TOCAL( n )	((uint32_t)( n ))
+
+#define USB_GRSTCTL_CSRST		((uint32_t)0x00000001)
+#define USB_GRSTCTL_RXFFLSH		((uint32_t)0x00000010)
+#define USB_GRSTCTL_TXFFLSH		((uint32_t)0x00000020)
+#define USB_GRSTCTL_TXFNUM( n )	((uint32_t)( n ) << 6 )
+#define USB_GRSTCTL_AHBIDL		((uint32_t)0x80000000)
+
+#define USB_GINT_RXFLVL			((uint32_t)0x00000010)
+#define USB_GINT_USBSUSP		((uint32_t)0x00000800)
+#define USB_GINT_USBRST			((uint32_t)0x00001000)
+#define USB_GINT_ENUMDNE		((uint32_t)0x00002000)
+#define USB_GINT_IEPINT			((uint32_t)0x00040000)
+#define USB_GINT_OEPINT			((uint32_t)0x00080000)
+#define USB_GINT_WKUPINT		((uint32_t)0x80000000)
+
+#define USB_GRXSTS_EPNUM( s )	( (s) & 0xF )
+#define USB_GRXSTS_BCNT( s )	( ( (s) >> 4 ) & 0x7FF )
+#define USB_GRXSTS_PKTSTS( s )	( ( (s) >> 17 ) & 0xF )
+#define USB_PKTSTS_OUT_DATA		2
+#define USB_PKTSTS_SETUP_DATA	6
+
+#define USB_GCCFG_PWRDWN		((uint32_t)0x00010000)
+#define USB_GCCFG_NOVBUSSENS	((uint32_t)0x00200000)
+
+#define USB_DCFG_DSPD_FS		((uint32_t)0x00000003)
+#define USB_DCFG_DAD			((uint32_t)0x000007F0)
+
+#define USB_DCTL_RWUSIG			((uint32_t)0x00000001)
+#define USB_DCTL_SDIS			((uint32_t)0x00000002)
+#define USB_DCTL_CGINAK			((uint32_t)0x00000100)
+
+#define USB_EPCTL_MPSIZ			((uint32_t)0x000007FF)
+#define USB_EPCTL_USBAEP		((uint32_t)0x00008000)
+#define USB_EPCTL_TYPE( t )		((uint32_t)( t ) << 18 )
+#define USB_EPCTL_STALL			((uint32_t)0x00200000)
+#define USB_EPCTL_TXFNUM( n )	((uint32_t)( n ) << 22 )
+#define USB_EPCTL_CNAK			((uint32_t)0x04000000)
+#define USB_EPCTL_SNAK			((uint32_t)0x08000000)
+#define USB_EPCTL_SD0PID		((uint32_t)0x10000000)
+#define USB_EPCTL_EPDIS			((uint32_t)0x40000000)
+#define USB_EPCTL_EPENA			((uint32_t)0x80000000)
+
+#define USB_EPINT_XFRC			((uint32_t)0x00000001)
+#define USB_EPINT_EPDISD		((uint32_t)0x00000002)
+#define USB_EPINT_STUP			((uint32_t)0x00000008)
+#define USB_EPINT_TOC			((uint32_t)0x00000008)
+#define USB_EPINT_TXFE			((uint32_t)0x00000080)
+
+#define USB_TSIZ_PKTCNT( n )	((uint32_t)( n ) << 19 )
+#define USB_TSIZ_STUPCNT( n )	((uint32_t)( n ) << 29 )
+
+/**
+ * @brief  FIFO RAM of 320 words: RX FIFO (SETUP packets, a bulk packet and status words),
+ *         TX FIFOs of endpoint 0, of the bulk IN endpoint 1 (4 packets) and of the rest
+ */
+#define USB_RX_FIFO				128
+#define USB_TX0_FIFO			32
+#define USB_TX1_FIFO			128
+#define USB_TXn_FIFO			16
+
+/**
+ * @brief  Turnaround time in PHY clocks for AHB clock of 120 MHz, timeout calibration
+ */
+#define USB_TRDT				5
+#define USB_TOCAL				7
+
+/**
+ * @brief  Largest IN data of a control transfer: 7 bits of XFRSIZ of endpoint 0
+ */
+#define USB_EP0_MAX				127
+
+/**
+ * @brief  Standard requests and features
+ */
+#define USB_GET_STATUS			0
+#define USB_CLEAR_FEATURE		1
+#define USB_SET_FEATURE			3
+#define USB_SET_ADDRESS			5
+#define USB_GET_DESCRIPTOR		6
+#define USB_GET_CONFIGURATION	8
+#define USB_SET_CONFIGURATION	9
+#define USB_GET_INTERFACE		10
+#define USB_SET_INTERFACE		11
+#define USB_FEATURE_HALT		0
+
+/**
+ * @brief  Registers shared with the interrupt handler are changed by tasks with the
+ *         interrupt masked (the handler itself may call the same functions)
+ */
+#define USB_LOCK()				do { NVIC_DisableIRQ( OTG_FS_IRQn ); __DSB(); __ISB(); } while ( 0 )
+#define USB_UNLOCK()			NVIC_EnableIRQ( OTG_FS_IRQn )
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Variables
+ * @{
+ */
+
+static const USB_Class* USB_Cls;
+static USB_Transfer USB_In[ USB_ENDPOINTS ];
+static USB_Transfer USB_Out[ USB_ENDPOINTS ];
+static USB_Request USB_Setup __attribute__(( aligned( 4 ) ));	/* the last SETUP packet */
+static uint8_t USB_Answer[ 2 ];			/* data of standard requests */
+static uint8_t USB_Config;				/* configuration set by the host, 0 if none */
+static uint8_t USB_Ep0Data;				/* IN data stage is being sent, the status stage follows */
+static uint8_t USB_Ep0Zlp;				/* IN data stage is shorter than asked and ends on a packet boundary */
+
+/**
+ * @}
+ *//* STM32_Private_Variables */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Flushes all TX FIFOs and the RX FIFO
+ * @param  None
+ * @retval None
+ */
+static void USB_FlushFifos( void )
+{
+	USB_GLOBAL->GRSTCTL = USB_GRSTCTL_TXFFLSH | USB_GRSTCTL_TXFNUM( 0x10 );
+	while ( USB_GLOBAL->GRSTCTL & USB_GRSTCTL_TXFFLSH ) ;
+	USB_GLOBAL->GRSTCTL = USB_GRSTCTL_RXFFLSH;
+	while ( USB_GLOBAL->GRSTCTL & USB_GRSTCTL_RXFFLSH ) ;
+}
+
+/**
+ * @brief  Copies a packet into the TX FIFO of the endpoint (it has room for it)
+ * @param  n: Endpoint number
+ * @param  src: Data
+ * @param  len: Number of bytes
+ * @retval None
+ */
+static void USB_WritePacket( uint8_t n, const uint8_t* src, uint32_t len )
+{
+	__IO uint32_t* fifo = USB_FIFO( n );
+	uint32_t w;
+
+	if ( ( (uint32_t)src & 3 ) == 0 )
+	{
+		for ( ; len >= 4; len -= 4, src += 4 )
+			*fifo = *(const uint32_t*)src;
+	}
+	for ( ; len >= 4; len -= 4, src += 4 )
+	{
+		memcpy( &w, src, 4 );
+		*fifo = w;
+	}
+	if ( len > 0 )
+	{
+		w = 0;
+		memcpy( &w, src, len );
+		*fifo = w;
+	}
+}
+
+/**
+ * @brief  Pops a received packet from the RX FIFO, bytes beyond the room are dropped
+ * @param  dst: Buffer
+ * @param  len: Number of bytes of the packet
+ * @param  room: Room in the buffer
+ * @retval None
+ */
+static void USB_ReadPacket( uint8_t* dst, uint32_t len, uint32_t room )
+{
+	__IO uint32_t* fifo = USB_FIFO( 0 );
+	uint32_t w, n, m;
+
+	if ( room >= len && ( (uint32_t)dst & 3 ) == 0 )
+	{
+		for ( ; len >= 4; len -= 4, dst += 4 )
+			*(uint32_t*)dst = *fifo;
+	}
+	for ( ; len > 0; len -= n )
+	{
+		w = *fifo;
+		n = ( len < 4 ) ? len : 4;
+		m = ( n < room ) ? n : room;
+		if ( m > 0 )
+		{
+			memcpy( dst, &w, m );
+			dst += m;
+			room -= m;
+		}
+	}
+}
+
+/**
+ * @brief  Writes packets of the IN transfer while the TX FIFO has room for them
+ * @param  n: Endpoint number
+ * @retval None
+ */
+static void USB_FillFifo( uint8_t n )
+{
+	USB_Transfer* t = &USB_In[ n ];
+	uint32_t len;
+
+	while ( t->Count < t->Len )
+	{
+		len = t->Len - t->Count;
+		if ( len > t->Size )
+			len = t->Size;
+		if ( ( USB_IN( n )->TXFSTS & 0xFFFF ) < ( len + 3 ) / 4 )
+			return;		/* the empty interrupt comes again */
+		USB_WritePacket( n, t->Buf + t->Count, len );
+		t->Count += len;
+	}
+	USB_DEV->DIEPEMPMSK &= ~( 1UL << n );
+}
+
+/**
+ * @brief  Stops the IN transfer of the endpoint and drops what it has left in the TX FIFO
+ * @param  n: Endpoint number
+ * @retval None
+ */
+static void USB_StopIn( uint8_t n )
+{
+	uint32_t i;
+
+	if ( USB_IN( n )->CTL & USB_EPCTL_EPENA )
+	{
+		USB_IN( n )->CTL |= USB_EPCTL_SNAK;
+		USB_IN( n )->CTL |= USB_EPCTL_EPDIS;
+		for ( i = 0; i < 10000 && !( USB_IN( n )->INT & USB_EPINT_EPDISD ); ++i ) ;
+		USB_IN( n )->INT = USB_EPINT_EPDISD;
+	}
+	USB_GLOBAL->GRSTCTL = USB_GRSTCTL_TXFFLSH | USB_GRSTCTL_TXFNUM( n );
+	while ( USB_GLOBAL->GRSTCTL & USB_GRSTCTL_TXFFLSH ) ;
+	USB_DEV->DIEPEMPMSK &= ~( 1UL << n );
+	USB_In[ n ].Len = USB_In[ n ].Count = 0;
+}
+
+/**
+ * @brief  Prepares endpoint 0 for SETUP packets (up to 3 back to back)
+ * @param  None
+ * @retval None
+ */
+static void USB_SetupStart( void )
+{
+	USB_OUT( 0 )->TSIZ = USB_TSIZ_STUPCNT( 3 ) | USB_TSIZ_PKTCNT( 1 ) | ( 3 * sizeof( USB_Request ) );
+}
+
+/**
+ * @brief  Closes the endpoints of the class
+ * @param  None
+ * @retval None
+ */
+static void USB_CloseEndpoints( void )
+{
+	uint8_t n;
+
+	for ( n = 1; n < USB_ENDPOINTS; ++n )
+	{
+		USB_IN( n )->CTL = ( USB_IN( n )->CTL & USB_EPCTL_EPENA ) ? ( USB_EPCTL_EPDIS | USB_EPCTL_SNAK ) : 0;
+		USB_OUT( n )->CTL = ( USB_OUT( n )->CTL & USB_EPCTL_EPENA ) ? ( USB_EPCTL_EPDIS | USB_EPCTL_SNAK ) : 0;
+		USB_IN( n )->INT = 0xFF;
+		USB_OUT( n )->INT = 0xFF;
+		USB_GLOBAL->GRSTCTL = USB_GRSTCTL_TXFFLSH | USB_GRSTCTL_TXFNUM( n );
+		while ( USB_GLOBAL->GRSTCTL & USB_GRSTCTL_TXFFLSH ) ;
+		USB_In[ n ].Len = USB_Out[ n ].Len = 0;
+	}
+	USB_DEV->DIEPEMPMSK &= 1;
+	USB_DEV->DAINTMSK = ( 1 << 0 ) | ( 1 << 16 );
+}
+
+/**
+ * @brief  Bus reset: endpoint 0 is set up again and waits for SETUP, the address is 0
+ * @param  None
+ * @retval None
+ */
+static void USB_Reset( void )
+{
+	USB_DEV->DCTL &= ~USB_DCTL_RWUSIG;
+	USB_CloseEndpoints();
+	USB_FlushFifos();
+	USB_IN( 0 )->INT = 0xFF;
+	USB_OUT( 0 )->INT = 0xFF;
+	USB_DEV->DIEPEMPMSK = 0;
+	USB_DEV->DOEPMSK = USB_EPINT_XFRC | USB_EPINT_STUP;
+	USB_DEV->DIEPMSK = USB_EPINT_XFRC | USB_EPINT_TOC;
+	USB_DEV->DCFG &= ~USB_DCFG_DAD;
+	USB_In[ 0 ].Size = USB_Out[ 0 ].Size = USB_EP0_SIZE;
+	USB_In[ 0 ].Len = USB_Out[ 0 ].Len = 0;
+	USB_Ep0Data = USB_Ep0Zlp = 0;
+	USB_SetupStart();
+	USB_Config = 0;
+	if ( USB_Cls->Event != NULL )
+		USB_Cls->Event( USB_EVENT_RESET );
+}
+
+/**
+ * @brief  Finds the descriptor asked for by GET_DESCRIPTOR
+ * @param  value: wValue, type in the high byte and index in the low one
+ * @param  data: Receives the descriptor
+ * @retval Length of the descriptor, -1 if there is none
+ */
+static int32_t USB_Descriptor( uint16_t value, const uint8_t** data )
+{
+	uint8_t index = (uint8_t)value;
+
+	switch ( value >> 8 )
+	{
+	case USB_DESC_DEVICE:
+		*data = USB_Cls->Device;
+		return USB_Cls->Device[ 0 ];
+	case USB_DESC_CONFIG:
+		*data = USB_Cls->Config;
+		return USB_Cls->Config[ 2 ] | ( USB_Cls->Config[ 3 ] << 8 );
+	case USB_DESC_STRING:
+		if ( index >= USB_Cls->StringCount )
+			return -1;
+		*data = USB_Cls->Strings[ index ];
+		return USB_Cls->Strings[ index ][ 0 ];
+	}
+	return -1;		/* e.g. device qualifier: full speed only */
+}
+
+/**
+ * @brief  Answers a standard request
+ * @param  req: SETUP packet
+ * @param  data: Receives IN data
+ * @retval Length of IN data, -1 stalls the request
+ */
+static int32_t USB_Standard( const USB_Request* req, const uint8_t** data )
+{
+	uint8_t ep = (uint8_t)req->wIndex;
+	uint8_t recipient = req->bmRequestType & USB_REQ_RECIPIENT;
+	uint8_t halt = ( recipient == USB_REQ_ENDPOINT && req->wValue == USB_FEATURE_HALT && ( ep & 0x7F ) != 0 &&
+			( ep & 0x7F ) < USB_ENDPOINTS );
+
+	*data = USB_Answer;
+	switch ( req->bRequest )
+	{
+	case USB_GET_STATUS:
+		USB_Answer[ 0 ] = ( recipient == USB_REQ_DEVICE ) ? 1 :		/* self powered */
+				( ( recipient == USB_REQ_ENDPOINT && USB_EP_Stalled( ep ) ) ? 1 : 0 );
+		USB_Answer[ 1 ] = 0;
+		return 2;
+	case USB_CLEAR_FEATURE:
+		if ( halt )
+		{
+			USB_EP_ClearStall( ep );
+			if ( USB_Cls->Cleared != NULL )
+				USB_Cls->Cleared( ep );
+		}
+		return 0;
+	case USB_SET_FEATURE:
+		if ( !halt )
+			return -1;
+		USB_EP_Stall( ep );
+		return 0;
+	case USB_SET_ADDRESS:
+		/* this core takes the address before the status stage */
+		USB_DEV->DCFG = ( USB_DEV->DCFG & ~USB_DCFG_DAD ) | ( ( req->wValue & 0x7F ) << 4 );
+		return 0;
+	case USB_GET_DESCRIPTOR:
+		return USB_Descriptor( req->wValue, data );
+	case USB_GET_CONFIGURATION:
+		USB_Answer[ 0 ] = USB_Config;
+		return 1;
+	case USB_SET_CONFIGURATION:
+		if ( req->wValue > 1 )
+			return -1;
+		if ( USB_Config != 0 )
+		{
+			USB_CloseEndpoints();
+			if ( USB_Cls->Event != NULL )
+				USB_Cls->Event( USB_EVENT_RESET );
+		}
+		USB_Config = (uint8_t)req->wValue;
+		if ( USB_Config != 0 && USB_Cls->Event != NULL )
+			USB_Cls->Event( USB_EVENT_CONFIGURED );
+		return 0;
+	case USB_GET_INTERFACE:
+		USB_Answer[ 0 ] = 0;
+		return 1;
+	case USB_SET_INTERFACE:
+		return ( req->wValue == 0 ) ? 0 : -1;
+	}
+	return -1;
+}
+
+/**
+ * @brief  Setup stage is complete: the request is answered by IN data or the status stage
+ * @param  None
+ * @retval None
+ */
+static void USB_SetupStage( void )
+{
+	const USB_Request* req = &USB_Setup;
+	const uint8_t* data = NULL;
+	int32_t len = -1;
+
+	if ( ( req->bmRequestType & USB_REQ_TYPE ) == USB_REQ_STANDARD )
+		len = USB_Standard( req, &data );
+	else if ( USB_Cls->Request != NULL )
+		len = USB_Cls->Request( req, &data );
+
+	if ( len < 0 || ( !( req->bmRequestType & USB_DIR_IN ) && req->wLength != 0 ) )
+	{	/* the core clears the stall on the next SETUP */
+		USB_IN( 0 )->CTL |= USB_EPCTL_STALL;
+		USB_OUT( 0 )->CTL |= USB_EPCTL_STALL;
+		return;
+	}
+	if ( req->bmRequestType & USB_DIR_IN )
+	{
+		if ( len > req->wLength )
+			len = req->wLength;
+		if ( len > USB_EP0_MAX )
+			len = USB_EP0_MAX;
+		USB_Ep0Zlp = ( len > 0 && len < req->wLength && len % USB_EP0_SIZE == 0 );
+		USB_Ep0Data = 1;
+		USB_EP_Transmit( 0, data, len );
+	}
+	else
+	{
+		USB_Ep0Data = 0;
+		USB_EP_Transmit( 0, NULL, 0 );
+	}
+}
+
+/**
+ * @brief  IN transfer of endpoint 0 is complete: data go on by a zero length packet,
+ *         or the status stage is received
+ * @param  None
+ * @retval None
+ */
+static void USB_Ep0Sent( void )
+{
+	if ( USB_Ep0Zlp )
+	{
+		USB_Ep0Zlp = 0;
+		USB_EP_Transmit( 0, NULL, 0 );
+	}
+	else if ( USB_Ep0Data )
+	{
+		USB_Ep0Data = 0;
+		USB_EP_Receive( 0, NULL, 0 );
+	}
+}
+
+/**
+ * @brief  Pops the packet at the top of the RX FIFO
+ * @param  None
+ * @retval None
+ */
+static void USB_RxPacket( void )
+{
+	uint32_t sts = USB_GLOBAL->GRXSTSP;
+	uint32_t len = USB_GRXSTS_BCNT( sts );
+	USB_Transfer* t = &USB_Out[ USB_GRXSTS_EPNUM( sts ) ];
+	uint32_t room;
+
+	switch ( USB_GRXSTS_PKTSTS( sts ) )
+	{
+	case USB_PKTSTS_OUT_DATA:
+		room = ( t->Count < t->Len ) ? t->Len - t->Count : 0;
+		USB_ReadPacket( t->Buf + t->Count, len, room );
+		t->Count += ( len < room ) ? len : room;
+		break;
+	case USB_PKTSTS_SETUP_DATA:
+		USB_ReadPacket( (uint8_t*)&USB_Setup, len, sizeof( USB_Setup ) );
+		break;
+	}
+}
+
+/**
+ * @brief  Handles interrupts of OUT endpoints
+ * @param  None
+ * @retval None
+ */
+static void USB_OutEndpoints( void )
+{
+	uint32_t daint = USB_DEV->DAINT & USB_DEV->DAINTMSK;
+	uint32_t flags;
+	uint8_t n;
+
+	for ( n = 0; n < USB_ENDPOINTS; ++n )
+	{
+		if ( !( daint & ( 1UL << ( 16 + n ) ) ) )
+			continue;
+		flags = USB_OUT( n )->INT & USB_DEV->DOEPMSK;
+		USB_OUT( n )->INT = flags;
+		if ( flags & USB_EPINT_XFRC )
+		{
+			if ( n == 0 )
+				USB_SetupStart();		/* status stage is over */
+			else if ( USB_Cls->Transferred != NULL )
+				USB_Cls->Transferred( n );
+		}
+		if ( flags & USB_EPINT_STUP )
+		{
+			USB_SetupStage();
+			USB_SetupStart();
+		}
+	}
+}
+
+/**
+ * @brief  Handles interrupts of IN endpoints
+ * @param  None
+ * @retval None
+ */
+static void USB_InEndpoints( void )
+{
+	uint32_t daint = USB_DEV->DAINT & USB_DEV->DAINTMSK;
+	uint32_t flags;
+	uint8_t n;
+
+	for ( n = 0; n < USB_ENDPOINTS; ++n )
+	{
+		if ( !( daint & ( 1UL << n ) ) )
+			continue;
+		flags = USB_IN( n )->INT & ( USB_DEV->DIEPMSK | ( ( ( USB_DEV->DIEPEMPMSK >> n ) & 1 ) << 7 ) );
+		if ( flags & USB_EPINT_TOC )
+			USB_IN( n )->INT = USB_EPINT_TOC;
+		if ( flags & USB_EPINT_TXFE )
+			USB_FillFifo( n );
+		if ( flags & USB_EPINT_XFRC )
+		{
+			USB_IN( n )->INT = USB_EPINT_XFRC;
+			USB_DEV->DIEPEMPMSK &= ~( 1UL << n );
+			if ( n == 0 )
+				USB_Ep0Sent();
+			else if ( USB_Cls->Transferred != NULL )
+				USB_Cls->Transferred( USB_DIR_IN | n );
+		}
+	}
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Configures the pins and the core in device mode, the device stays disconnected
+ *         until USB_Connect. Called by a task: forcing device mode takes 25 ms.
+ * @param  cls: Class of the device (has to stay valid)
+ * @retval None
+ */
+void USB_Init( const USB_Class* cls )
+{
+	uint8_t n;
+
+	USB_Cls = cls;
+	USB_GPIO_PORTS_INIT( USB_GPIO_PORTS, ENABLE );
+	USB_config_pins();
+	RCC_AHB2PeriphClockCmd( RCC_AHB2Periph_OTG_FS, ENABLE );
+
+	/* core reset, the FS core has only its internal PHY */
+	USB_GLOBAL->GUSBCFG |= USB_GUSBCFG_PHYSEL;
+	while ( !( USB_GLOBAL->GRSTCTL & USB_GRSTCTL_AHBIDL ) ) ;
+	USB_GLOBAL->GRSTCTL |= USB_GRSTCTL_CSRST;
+	while ( USB_GLOBAL->GRSTCTL & USB_GRSTCTL_CSRST ) ;
+
+	/* transceiver on, pull-up without VBUS sensing (PA9 stays free) */
+	USB_GLOBAL->GCCFG = USB_GCCFG_PWRDWN | USB_GCCFG_NOVBUSSENS;
+	USB_GLOBAL->GUSBCFG = USB_GUSBCFG_PHYSEL | USB_GUSBCFG_FDMOD | USB_GUSBCFG_TRDT( USB_TRDT ) | USB_GUSBCFG_TOCAL( USB_TOCAL );
+	vTaskDelay( 25 / portTICK_RATE_MS + 1 );
+
+	USB_PCGCCTL = 0;
+	USB_DEV->DCFG = USB_DCFG_DSPD_FS;
+	USB_DEV->DCTL = USB_DCTL_SDIS;
+
+	USB_GLOBAL->GRXFSIZ = USB_RX_FIFO;
+	USB_GLOBAL->DIEPTXF0 = ( USB_TX0_FIFO << 16 ) | USB_RX_FIFO;
+	USB_GLOBAL->DIEPTXF[ 0 ] = ( USB_TX1_FIFO << 16 ) | ( USB_RX_FIFO + USB_TX0_FIFO );
+	for ( n = 1; n < USB_ENDPOINTS - 1; ++n )
+		USB_GLOBAL->DIEPTXF[ n ] = ( USB_TXn_FIFO << 16 ) | ( USB_RX_FIFO + USB_TX0_FIFO + USB_TX1_FIFO + ( n - 1 ) * USB_TXn_FIFO );
+	USB_FlushFifos();
+
+	USB_DEV->DIEPMSK = 0;
+	USB_DEV->DOEPMSK = 0;
+	USB_DEV->DAINTMSK = 0;
+	USB_DEV->DIEPEMPMSK = 0;
+	for ( n = 0; n < USB_ENDPOINTS; ++n )
+	{
+		USB_IN( n )->CTL = ( USB_IN( n )->CTL & USB_EPCTL_EPENA ) ? ( USB_EPCTL_EPDIS | USB_EPCTL_SNAK ) : 0;
+		USB_OUT( n )->CTL = ( USB_OUT( n )->CTL & USB_EPCTL_EPENA ) ? ( USB_EPCTL_EPDIS | USB_EPCTL_SNAK ) : 0;
+		USB_IN( n )->TSIZ = USB_OUT( n )->TSIZ = 0;
+		USB_IN( n )->INT = USB_OUT( n )->INT = 0xFF;
+	}
+
+	USB_GLOBAL->GINTSTS = 0xFFFFFFFF;
+	USB_GLOBAL->GINTMSK = USB_GINT_USBRST | USB_GINT_ENUMDNE | USB_GINT_USBSUSP | USB_GINT_WKUPINT |
+			USB_GINT_RXFLVL | USB_GINT_IEPINT | USB_GINT_OEPINT;
+	USB_GLOBAL->GAHBCFG = USB_GAHBCFG_GINTMSK | USB_GAHBCFG_TXFELVL;
+	IRQ_Enable( OTG_FS_IRQn, IRQ_PRIO_USB );
+}
+
+/**
+ * @brief  Connects the device to the bus (D+ pull-up) or disconnects it
+ * @param  state: ENABLE or DISABLE
+ * @retval None
+ */
+void USB_Connect( FunctionalState state )
+{
+	if ( state != DISABLE )
+		USB_DEV->DCTL &= ~USB_DCTL_SDIS;
+	else
+		USB_DEV->DCTL |= USB_DCTL_SDIS;
+}
+
+/**
+ * @brief  Opens an endpoint of the class (on USB_EVENT_CONFIGURED), it gets DATA0
+ * @param  ep: Endpoint address (USB_DIR_IN for IN), 1 .. USB_ENDPOINTS - 1
+ * @param  type: USB_EP_BULK or USB_EP_INTERRUPT
+ * @param  size: Packet size (64 for bulk)
+ * @retval None
+ */
+void USB_EP_Open( uint8_t ep, uint8_t type, uint16_t size )
+{
+	uint8_t n = ep & 0x7F;
+
+	USB_LOCK();
+	if ( ep & USB_DIR_IN )
+	{
+		USB_In[ n ].Size = size;
+		USB_IN( n )->CTL = size | USB_EPCTL_TYPE( type ) | USB_EPCTL_TXFNUM( n ) | USB_EPCTL_SD0PID | USB_EPCTL_USBAEP;
+		USB_DEV->DAINTMSK |= 1UL << n;
+	}
+	else
+	{
+		USB_Out[ n ].Size = size;
+		USB_OUT( n )->CTL = size | USB_EPCTL_TYPE( type ) | USB_EPCTL_SD0PID | USB_EPCTL_USBAEP;
+		USB_DEV->DAINTMSK |= 1UL << ( 16 + n );
+	}
+	USB_UNLOCK();
+}
+
+/**
+ * @brief  Starts an IN transfer, its end is reported by Transferred of the class
+ * @param  ep: Endpoint address (USB_DIR_IN set or not)
+ * @param  buf: Data, has to stay valid until the transfer is complete
+ * @param  len: Number of bytes (up to 1023 packets), 0 sends a zero length packet
+ * @retval None
+ */
+void USB_EP_Transmit( uint8_t ep, const void* buf, uint32_t len )
+{
+	uint8_t n = ep & 0x7F;
+	USB_Transfer* t = &USB_In[ n ];
+	uint32_t packets = ( len + t->Size - 1 ) / t->Size;
+
+	USB_LOCK();
+	t->Buf = (uint8_t*)buf;
+	t->Len = len;
+	t->Count = 0;
+	USB_IN( n )->TSIZ = USB_TSIZ_PKTCNT( packets ? packets : 1 ) | len;
+	USB_IN( n )->CTL |= USB_EPCTL_CNAK | USB_EPCTL_EPENA;
+	if ( len > 0 )
+		USB_DEV->DIEPEMPMSK |= 1UL << n;
+	USB_UNLOCK();
+}
+
+/**
+ * @brief  Starts an OUT transfer: it ends when len bytes or a short packet are received,
+ *         reported by Transferred of the class (bytes by USB_EP_Count)
+ * @param  ep: Endpoint address
+ * @param  buf: Buffer, has to stay valid until the transfer is complete
+ * @param  len: Number of bytes (up to 1023 packets), more bytes of the last packet are dropped
+ * @retval None
+ */
+void USB_EP_Receive( uint8_t ep, void* buf, uint32_t len )
+{
+	uint8_t n = ep & 0x7F;
+	USB_Transfer* t = &USB_Out[ n ];
+	uint32_t packets = ( len + t->Size - 1 ) / t->Size;
+
+	if ( packets == 0 )
+		packets = 1;
+	USB_LOCK();
+	t->Buf = (uint8_t*)buf;
+	t->Len = len;
+	t->Count = 0;
+	USB_OUT( n )->TSIZ = ( n == 0 ? USB_TSIZ_STUPCNT( 3 ) : 0 ) | USB_TSIZ_PKTCNT( packets ) | ( packets * t->Size );
+	USB_OUT( n )->CTL |= USB_EPCTL_CNAK | USB_EPCTL_EPENA;
+	USB_UNLOCK();
+}
+
+/**
+ * @brief  Bytes transferred by the last transfer of the endpoint
+ * @param  ep: Endpoint address
+ * @retval Bytes received (OUT) or written into the TX FIFO (IN)
+ */
+uint32_t USB_EP_Count( uint8_t ep )
+{
+	return ( ep & USB_DIR_IN ) ? USB_In[ ep & 0x7F ].Count : USB_Out[ ep & 0x7F ].Count;
+}
+
+/**
+ * @brief  Drops the pending IN transfer of the endpoint (e.g. on a class reset),
+ *         it isn't reported as transferred
+ * @param  ep: Endpoint address of an IN endpoint
+ * @retval None
+ */
+void USB_EP_Flush( uint8_t ep )
+{
+	USB_LOCK();
+	USB_StopIn( ep & 0x7F );
+	USB_UNLOCK();
+}
+
+/**
+ * @brief  Halts the endpoint: the host gets STALL until it clears the halt,
+ *         a pending IN transfer is dropped
+ * @param  ep: Endpoint address
+ * @retval None
+ */
+void USB_EP_Stall( uint8_t ep )
+{
+	uint8_t n = ep & 0x7F;
+
+	USB_LOCK();
+	if ( ep & USB_DIR_IN )
+	{
+		USB_StopIn( n );
+		USB_IN( n )->CTL |= USB_EPCTL_STALL;
+	}
+	else
+		USB_OUT( n )->CTL |= USB_EPCTL_STALL;
+	USB_UNLOCK();
+}
+
+/**
+ * @brief  Clears the halt of the endpoint, the next packet is DATA0
+ * @param  ep: Endpoint address
+ * @retval None
+ */
+void USB_EP_ClearStall( uint8_t ep )
+{
+	__IO uint32_t* ctl = ( ep & USB_DIR_IN ) ? &USB_IN( ep & 0x7F )->CTL : &USB_OUT( ep & 0x7F )->CTL;
+
+	USB_LOCK();
+	*ctl = ( *ctl & ~USB_EPCTL_STALL ) | USB_EPCTL_SD0PID;
+	USB_UNLOCK();
+}
+
+/**
+ * @brief  Checks if the endpoint is halted
+ * @param  ep: Endpoint address
+ * @retval Nonzero if it is
+ */
+uint8_t USB_EP_Stalled( uint8_t ep )
+{
+	if ( ( ep & 0x7F ) >= USB_ENDPOINTS )
+		return 0;
+	return ( ( ( ep & USB_DIR_IN ) ? USB_IN( ep & 0x7F )->CTL : USB_OUT( ep & 0x7F )->CTL ) & USB_EPCTL_STALL ) != 0;
+}
+
+/**
+ * @brief  Handles OTG FS interrupt
+ * @param  None
+ * @retval None
+ */
+void USB_IRQHandler( void )
+{
+	uint32_t sts = USB_GLOBAL->GINTSTS & USB_GLOBAL->GINTMSK;
+
+	if ( sts & USB_GINT_RXFLVL )
+	{
+		while ( USB_GLOBAL->GINTSTS & USB_GINT_RXFLVL )
+			USB_RxPacket();
+	}
+	if ( sts & USB_GINT_OEPINT )
+		USB_OutEndpoints();
+	if ( sts & USB_GINT_IEPINT )
+		USB_InEndpoints();
+	if ( sts & USB_GINT_USBRST )
+	{
+		USB_GLOBAL->GINTSTS = USB_GINT_USBRST;
+		USB_Reset();
+	}
+	if ( sts & USB_GINT_ENUMDNE )
+	{	/* full speed: packets of endpoint 0 are 64 bytes (MPSIZ 0) */
+		USB_GLOBAL->GINTSTS = USB_GINT_ENUMDNE;
+		USB_IN( 0 )->CTL &= ~USB_EPCTL_MPSIZ;
+		USB_DEV->DCTL |= USB_DCTL_CGINAK;
+	}
+	if ( sts & USB_GINT_USBSUSP )
+	{
+		USB_GLOBAL->GINTSTS = USB_GINT_USBSUSP;
+		if ( USB_Cls->Event != NULL )
+			USB_Cls->Event( USB_EVENT_SUSPEND );
+	}
+	if ( sts & USB_GINT_WKUPINT )
+	{
+		USB_GLOBAL->GINTSTS = USB_GINT_WKUPINT;
+		if ( USB_Cls->Event != NULL )
+			USB_Cls->Event( USB_EVENT_RESUME );
+	}
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#endif /* USE_USB_MSC */
@@ -0,0 +1,162 @@
+/**
+ ******************************************************************************
+ * @file    stm32_usb.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   USB device on the OTG FS core (full speed, internal PHY on
+ *          PA11/PA12, no VBUS sensing). The driver answers the standard
+ *          requests of endpoint 0 from the descriptors of one class, passes
+ *          class requests to it and moves the data of its bulk endpoints:
+ *          packets go between the core FIFOs and the transfer buffers in the
+ *          interrupt handler, the class gets a callback (interrupt context)
+ *          when a whole transfer is done, so a task queues transfers of
+ *          kilobytes and waits for one notification per transfer.
+ *          The core has no DMA (OTG HS has, but needs an external ULPI PHY
+ *          for high speed): full speed bulk transfers top out at 19 packets
+ *          of 64 bytes per 1 ms frame, about 1.2 Mbytes/s.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef STM32_USB_H
+#define STM32_USB_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32f2xx.h"
+
+#include <stdint.h>
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Constants
+ * @{
+ */
+
+/**
+ * @brief  Endpoints of the core (0 is the control endpoint) and packet size of endpoint 0
+ */
+#define USB_ENDPOINTS			4
+#define USB_EP0_SIZE			64
+
+/**
+ * @brief  Endpoint types (bmAttributes of endpoint descriptors)
+ */
+#define USB_EP_CONTROL			0
+#define USB_EP_ISOCHRONOUS		1
+#define USB_EP_BULK				2
+#define USB_EP_INTERRUPT		3
+
+/**
+ * @brief  Direction bit of endpoint addresses and bmRequestType
+ */
+#define USB_DIR_IN				0x80
+
+/**
+ * @brief  Type and recipient fields of bmRequestType
+ */
+#define USB_REQ_TYPE			0x60
+#define USB_REQ_STANDARD		0x00
+#define USB_REQ_CLASS			0x20
+#define USB_REQ_VENDOR			0x40
+#define USB_REQ_RECIPIENT		0x1F
+#define USB_REQ_DEVICE			0x00
+#define USB_REQ_INTERFACE		0x01
+#define USB_REQ_ENDPOINT		0x02
+
+/**
+ * @brief  Descriptor types
+ */
+#define USB_DESC_DEVICE			1
+#define USB_DESC_CONFIG			2
+#define USB_DESC_STRING			3
+#define USB_DESC_INTERFACE		4
+#define USB_DESC_ENDPOINT		5
+
+/**
+ * @}
+ *//* STM32_Exported_Constants */
+
+/** @defgroup STM32_Exported_Types
+ * @{
+ */
+
+/**
+ * @brief  SETUP packet of a control transfer
+ */
+typedef struct
+{
+	uint8_t		bmRequestType;
+	uint8_t		bRequest;
+	uint16_t	wValue;
+	uint16_t	wIndex;
+	uint16_t	wLength;
+} USB_Request;
+
+/**
+ * @brief  Bus events passed to the class
+ */
+typedef enum
+{
+	USB_EVENT_RESET = 0,		/*!< Bus reset or SET_CONFIGURATION 0: endpoints of the class are closed */
+	USB_EVENT_CONFIGURED,		/*!< SET_CONFIGURATION 1: the class opens its endpoints */
+	USB_EVENT_SUSPEND,			/*!< No bus activity for 3 ms: the host suspended the bus or the cable was pulled */
+	USB_EVENT_RESUME			/*!< Bus activity after the suspend */
+} USB_Event;
+
+/**
+ * @brief  Class of the device: its descriptors and callbacks, all called in interrupt context
+ */
+typedef struct
+{
+	const uint8_t*			Device;			/*!< Device descriptor */
+	const uint8_t*			Config;			/*!< Configuration descriptor followed by the interface and endpoint ones */
+	const uint8_t* const*	Strings;		/*!< String descriptors, the first one is the list of languages */
+	uint8_t					StringCount;	/*!< Number of string descriptors */
+	void ( *Event )( USB_Event ev );
+	int32_t ( *Request )( const USB_Request* req, const uint8_t** data );	/*!< Class request: length of IN data at *data
+															   (0 if none), -1 stalls the request (NULL stalls them all) */
+	void ( *Transferred )( uint8_t ep );	/*!< Transfer of the endpoint (address, USB_DIR_IN for IN) is complete */
+	void ( *Cleared )( uint8_t ep );		/*!< Host has cleared the halt of the endpoint */
+} USB_Class;
+
+/**
+ * @}
+ *//* STM32_Exported_Types */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+void USB_Init( const USB_Class* cls );
+void USB_Connect( FunctionalState state );
+
+void USB_EP_Open( uint8_t ep, uint8_t type, uint16_t size );
+void USB_EP_Transmit( uint8_t ep, const void* buf, uint32_t len );
+void USB_EP_Receive( uint8_t ep, void* buf, uint32_t len );
+uint32_t USB_EP_Count( uint8_t ep );
+void USB_EP_Flush( uint8_t ep );
+void USB_EP_Stall( uint8_t ep );
+void USB_EP_ClearStall( uint8_t ep );
+uint8_t USB_EP_Stalled( uint8_t ep );
+
+void USB_IRQHandler( void );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32_USB_H */
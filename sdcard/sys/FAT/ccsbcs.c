@@ -0,0 +1,87 @@
+/*------------------------------------------------------------------------*/
+/* Unicode - OEM code bidirectional converter for FatFs  (CP437)          */
+/*------------------------------------------------------------------------*/
+/* This module provides ff_convert and ff_wtoupper for the LFN feature of */
+/* FatFs on the U.S. OEM code page (_CODE_PAGE 437). Characters 0x00-0x7F */
+/* are the same in both codes, the upper half is converted by the table.  */
+/* Upper case conversion covers ASCII, Latin-1, Greek and Cyrillic which  */
+/* are the letters representable on this code page and its neighbours.   */
+/*------------------------------------------------------------------------*/
+
+#include "ff.h"
+
+
+#if _USE_LFN
+
+#if _CODE_PAGE != 437
+#error This file supports only _CODE_PAGE 437
+#endif
+
+
+static
+const WCHAR Tbl[] = {	/*  CP437(0x80-0xFF) to Unicode conversion table */
+	0x00C7, 0x00FC, 0x00E9, 0x00E2, 0x00E4, 0x00E0, 0x00E5, 0x00E7,
+	0x00EA, 0x00EB, 0x00E8, 0x00EF, 0x00EE, 0x00EC, 0x00C4, 0x00C5,
+	0x00C9, 0x00E6, 0x00C6, 0x00F4, 0x00F6, 0x00F2, 0x00FB, 0x00F9,
+	0x00FF, 0x00D6, 0x00DC, 0x00A2, 0x00A3, 0x00A5, 0x20A7, 0x0192,
+	0x00E1, 0x00ED, 0x00F3, 0x00FA, 0x00F1, 0x00D1, 0x00AA, 0x00BA,
+	0x00BF, 0x2310, 0x00AC, 0x00BD, 0x00BC, 0x00A1, 0x00AB, 0x00BB,
+	0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x2561, 0x2562, 0x2556,
+	0x2555, 0x2563, 0x2551, 0x2557, 0x255D, 0x255C, 0x255B, 0x2510,
+	0x2514, 0x2534, 0x252C, 0x251C, 0x2500, 0x253C, 0x255E, 0x255F,
+	0x255A, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256C, 0x2567,
+	0x2568, 0x2564, 0x2565, 0x2559, 0x2558, 0x2552, 0x2553, 0x256B,
+	0x256A, 0x2518, 0x250C, 0x2588, 0x2584, 0x258C, 0x2590, 0x2580,
+	0x03B1, 0x00DF, 0x0393, 0x03C0, 0x03A3, 0x03C3, 0x00B5, 0x03C4,
+	0x03A6, 0x0398, 0x03A9, 0x03B4, 0x221E, 0x03C6, 0x03B5, 0x2229,
+	0x2261, 0x00B1, 0x2265, 0x2264, 0x2320, 0x2321, 0x00F7, 0x2248,
+	0x00B0, 0x2219, 0x00B7, 0x221A, 0x207F, 0x00B2, 0x25A0, 0x00A0
+};
+
+
+
+
+WCHAR ff_convert (	/* Converted character, Returns zero on error */
+	WCHAR	src,	/* Character code to be converted */
+	UINT	dir		/* 0: Unicode to OEMCP, 1: OEMCP to Unicode */
+)
+{
+	WCHAR c;
+
+
+	if (src < 0x80) {	/* ASCII */
+		c = src;
+
+	} else {
+		if (dir) {		/* OEMCP to Unicode */
+			c = (src >= 0x100) ? 0 : Tbl[src - 0x80];
+
+		} else {		/* Unicode to OEMCP */
+			for (c = 0; c < 0x80; c++) {
+				if (src == Tbl[c]) break;
+			}
+			c = (c + 0x80) & 0xFF;
+		}
+	}
+
+	return c;
+}
+
+
+
+
+WCHAR ff_wtoupper (	/* Upper converted character */
+	WCHAR chr		/* Input character */
+)
+{
+	if (chr >= 'a' && chr <= 'z') return chr - 0x20;			/* ASCII */
+	if (chr < 0x80) return chr;
+	if (chr >= 0xE0 && chr <= 0xFE && chr != 0xF7) return chr - 0x20;	/* Latin-1 */
+	if (chr == 0xFF) return 0x178;
+	if (chr >= 0x3B1 && chr <= 0x3C9 && chr != 0x3C2) return chr - 0x20;	/* Greek */
+	if (chr >= 0x430 && chr <= 0x44F) return chr - 0x20;		/* Cyrillic */
+	if (chr >= 0x450 && chr <= 0x45F) return chr - 0x50;
+	return chr;
+}
+
+#endif /* _USE_LFN */
@@ -8,7 +8,1681 @@
 #include "diskio.h"
 
 #include "ffconf.h"
+#include "main.h"
 #include "stm32_sd_spi.h"
+#include "stm32_sd_io.h"
+#include "stm32_mem.h"
+#ifdef USE_DISK_CRYPT
+#include "stm32_crypt.h"
+#include "stm32_pool.h"
+#endif /* USE_DISK_CRYPT */
+#ifdef USE_RTC_CALENDAR
+#include "stm32_calendar.h"
+#endif /* USE_RTC_CALENDAR */
+#ifdef USE_EXT_SRAM
+#include "stm32_sram.h"
+#endif /* USE_EXT_SRAM */
+#if _FS_STATS
+#include "stm32_dwt.h"
+#endif /* _FS_STATS */
+#ifdef USE_DISK_REMAP
+#include "ffremap.h"
+#endif /* USE_DISK_REMAP */
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#if configUSE_TIMERS
+#include "timers.h"
+#endif
+
+#include "ff.h"
+
+#include <string.h>
+
+#ifdef USE_FAST_IO_CODE
+#pragma GCC optimize ( "O2" )
+#endif /* USE_FAST_IO_CODE */
+
+#if _MULTI_PARTITION
+/* Volumes on the SD Card: 0 is bulk data (1st partition or SFD), 1 is config/metadata (2nd partition) */
+PARTITION VolToPart[] = {
+	{ 0, 0 },
+	{ 1, 2 }
+};
+#endif
+
+/*-----------------------------------------------------------------------*/
+/* SD Card (physical drives 0 and 1)                                     */
+/*-----------------------------------------------------------------------*/
+
+/* Each volume on the card has its own drive number, so each of them
+   sees removal or change of the card and is mounted again after it */
+#define SD_DRIVES		2
+
+/* Requests to the SD I/O task, each volume holding its lock may have one pending request */
+static SD_IO_Request sd_req[ _VOLUMES ];
+static volatile BYTE sd_busy[ _VOLUMES ];
+
+static volatile DSTATUS sd_stat[ SD_DRIVES ] = { STA_NOINIT, STA_NOINIT };
+static DWORD sd_card[ SD_DRIVES ];	/* sd_changes() when the drive was initialized */
+
+/* Drives handed over to another user of the card (CTRL_EJECT) see no card, each hand back
+   counts as a card change: the card may have been written meanwhile */
+static BYTE sd_ejected[ SD_DRIVES ];
+static DWORD sd_ejects;
+
+/* Passes request to the SD I/O task, it is completed by sd_wait() */
+static SD_IO_Request* sd_submit (
+	SD_IO_Op op,	/* Operation */
+	DWORD sector,	/* First sector number */
+	DWORD count,	/* Number of sectors */
+	void *buff		/* Data buffer */
+)
+{
+	SD_IO_Request* req;
+	uint8_t i;
+
+	/* claim a free request: there are no more callers than volumes */
+	if ( xTaskGetSchedulerState() == taskSCHEDULER_RUNNING )
+		taskENTER_CRITICAL();
+	for ( i = 0; i < _VOLUMES - 1 && sd_busy[ i ]; ++i ) ;
+	sd_busy[ i ] = 1;
+	if ( xTaskGetSchedulerState() == taskSCHEDULER_RUNNING )
+		taskEXIT_CRITICAL();
+
+	req = &sd_req[ i ];
+	if ( req->Done == NULL )
+		SD_IO_RequestInit( req );
+	req->Op = op;
+	req->Sector = sector;
+	req->Count = count;
+	req->Buffer = buff;
+#ifdef USE_SD_IO_PRIORITY
+	SD_IO_Classify( req );
+#endif /* USE_SD_IO_PRIORITY */
+	while ( SD_IO_Submit( req ) != SD_RESPONSE_NO_ERROR )
+		vTaskDelay( 1 );	/* queue is full */
+	return req;
+}
+
+/* Waits for completion of submitted request and frees it */
+static SD_Error sd_wait ( SD_IO_Request* req )
+{
+	SD_Error res = SD_IO_Wait( req, portMAX_DELAY );
+	sd_busy[ req - sd_req ] = 0;
+	return res;
+}
+
+/* Executes request to the SD I/O task */
+static SD_Error sd_execute (
+	SD_IO_Op op,	/* Operation */
+	DWORD sector,	/* First sector number */
+	DWORD count,	/* Number of sectors */
+	void *buff		/* Data buffer */
+)
+{
+	return sd_wait( sd_submit( op, sector, count, buff ) );
+}
+
+#ifdef USE_DISK_CRYPT
+/* Requests of encrypted transfers of each drive: one sector is encrypted (decrypted)
+   while the SD I/O task writes (reads) the other one */
+static SD_IO_Request crypt_req[ SD_DRIVES ][ 2 ];
+
+/* Passes request of one sector to the SD I/O task */
+static void crypt_submit ( SD_IO_Request* req, SD_IO_Op op, DWORD sector, void *buff )
+{
+	if ( req->Done == NULL )
+		SD_IO_RequestInit( req );
+	req->Op = op;
+	req->Sector = sector;
+	req->Count = 1;
+	req->Buffer = buff;
+#ifdef USE_SD_IO_PRIORITY
+	SD_IO_Classify( req );
+#endif /* USE_SD_IO_PRIORITY */
+	while ( SD_IO_Submit( req ) != SD_RESPONSE_NO_ERROR )
+		vTaskDelay( 1 );	/* queue is full */
+}
+
+/* Reads sectors and decrypts them in place, sector N + 1 is read while sector N is decrypted */
+static SD_Error crypt_read ( BYTE drv, DWORD sector, DWORD count, BYTE *buff )
+{
+	SD_IO_Request* req = crypt_req[ drv ];
+	SD_Error res;
+	DWORD i;
+
+	crypt_submit( &req[ 0 ], SD_IO_READ, sector, buff );
+	for ( i = 0; i < count; ++i )
+	{
+		res = SD_IO_Wait( &req[ i & 1 ], portMAX_DELAY );
+		if ( res != SD_RESPONSE_NO_ERROR )
+			return res;		/* the next sector is not submitted yet */
+		if ( i + 1 < count )
+			crypt_submit( &req[ ( i + 1 ) & 1 ], SD_IO_READ, sector + i + 1, buff + ( i + 1 ) * SD_BLOCK_SIZE );
+		if ( CRYPT_Sector( CRYPT_DECRYPT, sector + i, buff + i * SD_BLOCK_SIZE, buff + i * SD_BLOCK_SIZE ) != SUCCESS )
+		{
+			if ( i + 1 < count )
+				SD_IO_Wait( &req[ ( i + 1 ) & 1 ], portMAX_DELAY );
+			return SD_RESPONSE_FAILURE;
+		}
+	}
+	return SD_RESPONSE_NO_ERROR;
+}
+
+/* Encrypts sectors into two pool blocks alternately and writes them from there (the caller's
+   data stay plain), sector N + 1 is encrypted while sector N is written */
+static SD_Error crypt_write ( BYTE drv, DWORD sector, DWORD count, const BYTE *buff )
+{
+	SD_IO_Request* req = crypt_req[ drv ];
+	BYTE* bounce[ 2 ] = { NULL, NULL };
+	SD_Error res = SD_RESPONSE_NO_ERROR, r;
+	DWORD i;
+	BYTE k, pending = 0;
+
+	for ( i = 0; i < count && res == SD_RESPONSE_NO_ERROR; ++i )
+	{
+		k = i & 1;
+		if ( pending & ( 1 << k ) )
+		{	/* block of sector N - 2 is free when its write is done */
+			pending &= ~( 1 << k );
+			res = SD_IO_Wait( &req[ k ], portMAX_DELAY );
+		}
+		while ( bounce[ k ] == NULL && ( bounce[ k ] = POOL_Alloc() ) == NULL )
+			vTaskDelay( 1 );
+		if ( res == SD_RESPONSE_NO_ERROR &&
+				CRYPT_Sector( CRYPT_ENCRYPT, sector + i, buff + i * SD_BLOCK_SIZE, bounce[ k ] ) != SUCCESS )
+			res = SD_RESPONSE_FAILURE;
+		if ( res == SD_RESPONSE_NO_ERROR )
+		{
+			crypt_submit( &req[ k ], SD_IO_WRITE, sector + i, bounce[ k ] );
+			pending |= 1 << k;
+		}
+	}
+	for ( k = 0; k < 2; ++k )
+	{
+		if ( pending & ( 1 << k ) )
+		{
+			r = SD_IO_Wait( &req[ k ], portMAX_DELAY );
+			if ( res == SD_RESPONSE_NO_ERROR )
+				res = r;
+		}
+		if ( bounce[ k ] != NULL )
+			POOL_Free( bounce[ k ] );
+	}
+	return res;
+}
+#endif /* USE_DISK_CRYPT */
+
+/* Executes transfer of the drive in card blocks, they are encrypted with USE_DISK_CRYPT */
+static SD_Error sd_transfer ( BYTE drv, SD_IO_Op op, DWORD sector, DWORD count, void *buff )
+{
+#ifdef USE_DISK_CRYPT
+	if ( op == SD_IO_READ )
+		return crypt_read( drv, sector, count, buff );
+	if ( op == SD_IO_WRITE )
+		return crypt_write( drv, sector, count, buff );
+#else
+	(void)drv;
+#endif /* USE_DISK_CRYPT */
+	return sd_execute( op, sector, count, buff );
+}
+
+#ifdef USE_DISK_VERIFY
+/* Verify after write of each drive (CTRL_VERIFY), the SD I/O task compares CRC16 of the
+   blocks sent by the card with the data if CRC is on, so it costs a read without storing it */
+static BYTE sd_verify[ SD_DRIVES ] = { 1, 1 };
+#endif /* USE_DISK_VERIFY */
+
+/* Writes card blocks of the drive and reads them back if verify after write is on */
+static SD_Error sd_store ( BYTE drv, DWORD sector, DWORD count, const BYTE *buff )
+{
+	SD_Error res = sd_transfer( drv, SD_IO_WRITE, sector, count, (void*)buff );
+
+#ifdef USE_DISK_VERIFY
+	if ( res == SD_RESPONSE_NO_ERROR && sd_verify[ drv ] )
+		res = sd_execute( SD_IO_VERIFY, sector, count, (void*)buff );
+#endif /* USE_DISK_VERIFY */
+	return res;
+}
+
+#ifdef USE_DISK_REMAP
+/* Remap table attached to each drive (CTRL_REMAP), drives are called by the task holding the volume */
+static REMAP_Table* sd_remap[ SD_DRIVES ];
+
+/* Finds the first remapped block of the range, the newest entry of the block wins */
+static DWORD remap_find (
+	const REMAP_Table* table,	/* Remap table */
+	DWORD sector,				/* First card block */
+	DWORD count,				/* Number of card blocks */
+	DWORD *spare				/* Receives spare block of the found block */
+)
+{
+	DWORD first = count;
+	DWORD i;
+
+	for ( i = table->Used; i-- > 0; )
+	{
+		if ( table->From[ i ] - sector < first )
+		{
+			first = table->From[ i ] - sector;
+			*spare = table->Base + 2 + i;
+		}
+	}
+	return first;		/* count if no block of the range is remapped */
+}
+
+/* Gives failed block the next spare block which takes its data, then stores the table
+   into the older copy (spare blocks which fail themselves are used up) */
+static SD_Error remap_block ( BYTE drv, DWORD sector, const BYTE *buff )
+{
+	REMAP_Table* table = sd_remap[ drv ];
+	SD_Error res = SD_RESPONSE_FAILURE;
+	DWORD used = table->Used;
+
+	while ( res != SD_RESPONSE_NO_ERROR && table->Used < table->Spares && SD_IO_Ready() )
+	{
+		res = sd_store( drv, table->Base + 2 + table->Used, 1, buff );
+		table->From[ table->Used++ ] = ( res == SD_RESPONSE_NO_ERROR ) ? sector : REMAP_BAD;
+	}
+	if ( table->Used == used )
+		return res;		/* no spare block left or card is lost */
+
+	table->Seq++;
+	table->Check = REMAP_Check( table );
+	if ( sd_transfer( drv, SD_IO_WRITE, table->Base + ( table->Seq & 1 ), 1, table ) != SD_RESPONSE_NO_ERROR ||
+			sd_execute( SD_IO_SYNC, 0, 0, 0 ) != SD_RESPONSE_NO_ERROR )
+		res = SD_RESPONSE_FAILURE;
+	return res;
+}
+
+/* Transfers card blocks of the drive with remap table: runs of blocks which are not remapped go
+   by one transfer, remapped blocks go to their spare blocks one by one. Blocks of a failed write
+   are written one by one again if the card responds, each block which fails takes a spare block. */
+static SD_Error remap_transfer ( BYTE drv, SD_IO_Op op, DWORD sector, DWORD count, void *buff )
+{
+	const REMAP_Table* table = sd_remap[ drv ];
+	BYTE *data = (BYTE*)buff;
+	SD_Error res = SD_RESPONSE_NO_ERROR;
+	DWORD n, at, k;
+
+	while ( count > 0 && res == SD_RESPONSE_NO_ERROR )
+	{
+		n = remap_find( table, sector, count, &at );
+		if ( n == 0 )
+			n = 1;		/* remapped block */
+		else
+			at = sector;
+		if ( op == SD_IO_READ )
+			res = sd_transfer( drv, op, at, n, data );
+		else
+			res = sd_store( drv, at, n, data );
+		if ( res != SD_RESPONSE_NO_ERROR && op == SD_IO_WRITE && SD_IO_Ready() )
+		{	/* card responds, so some blocks don't take the data */
+			for ( k = 0, res = SD_RESPONSE_NO_ERROR; k < n && res == SD_RESPONSE_NO_ERROR; ++k )
+			{
+				if ( sd_store( drv, at + k, 1, data + k * SD_BLOCK_SIZE ) != SD_RESPONSE_NO_ERROR && SD_IO_Ready() )
+					res = remap_block( drv, sector + k, data + k * SD_BLOCK_SIZE );
+			}
+		}
+		sector += n;
+		data += n * SD_BLOCK_SIZE;
+		count -= n;
+	}
+	return res;
+}
+#endif /* USE_DISK_REMAP */
+
+/* Transfers card blocks of the drive: remapped blocks go to their spare blocks, written blocks are verified */
+static SD_Error sd_access ( BYTE drv, SD_IO_Op op, DWORD sector, DWORD count, void *buff )
+{
+#ifdef USE_DISK_REMAP
+	if ( sd_remap[ drv ] != NULL && ( op == SD_IO_READ || op == SD_IO_WRITE ) )
+		return remap_transfer( drv, op, sector, count, buff );
+#endif /* USE_DISK_REMAP */
+	if ( op == SD_IO_WRITE )
+		return sd_store( drv, sector, count, buff );
+	return sd_transfer( drv, op, sector, count, buff );
+}
+
+/* Number of card changes: cached sectors of another card are dropped */
+static DWORD sd_changes ( BYTE drv )
+{
+	(void)drv;
+	return SD_IO_CardChanges() + sd_ejects;
+}
+
+/* Updates drive status: removed card fails requests at once, changed card has to be mounted again */
+static DSTATUS sd_check ( BYTE drv )
+{
+	if ( SD_IO_Detect() == SD_NOT_PRESENT || sd_ejected[ drv ] )
+		sd_stat[ drv ] = STA_NOINIT | STA_NODISK;
+	else if ( sd_card[ drv ] != sd_changes( drv ) )
+		sd_stat[ drv ] |= STA_NOINIT;
+	return sd_stat[ drv ];
+}
+
+static DSTATUS sd_initialize ( BYTE drv )
+{
+	if ( SD_IO_Detect() == SD_NOT_PRESENT || sd_ejected[ drv ] )
+		return sd_stat[ drv ] = STA_NOINIT | STA_NODISK;
+#ifdef USE_DISK_CRYPT
+	/* nothing goes to the card in plain */
+	if ( !CRYPT_HasKey() )
+		return sd_stat[ drv ] = STA_NOINIT;
+#endif /* USE_DISK_CRYPT */
+
+	/* volumes on the card are mounted one by one: the card is initialized once,
+	   native SDIO bus is probed first (if enabled), SPI bus is used if card doesn't respond on it */
+	if ( !SD_IO_Ready() && sd_execute( SD_IO_INIT, 0, 0, 0 ) != SD_RESPONSE_NO_ERROR )
+		return sd_stat[ drv ] = STA_NOINIT;
+	sd_card[ drv ] = sd_changes( drv );
+	return sd_stat[ drv ] = 0;
+}
+
+static DSTATUS sd_status ( BYTE drv )
+{
+	return sd_check( drv );
+}
+
+/* Executes request of mounted drive: card which stopped responding (glitch) is initialized
+   again once and the request is repeated if it is the same card, so the volume stays mounted */
+static DRESULT sd_request ( BYTE drv, SD_IO_Op op, DWORD sector, DWORD count, void *buff )
+{
+	if ( sd_check( drv ) & STA_NOINIT )
+		return RES_NOTRDY;
+	if ( sd_access( drv, op, sector, count, buff ) == SD_RESPONSE_NO_ERROR )
+		return RES_OK;
+
+	if ( !SD_IO_Ready() && sd_execute( SD_IO_INIT, 0, 0, 0 ) != SD_RESPONSE_NO_ERROR )
+		sd_stat[ drv ] |= STA_NOINIT;
+	if ( sd_check( drv ) & STA_NOINIT )
+		return RES_NOTRDY;
+	return ( sd_access( drv, op, sector, count, buff ) == SD_RESPONSE_NO_ERROR ) ? RES_OK : RES_ERROR;
+}
+
+/* Sectors of the disk functions are DISK_BLOCKS card blocks each */
+static DRESULT sd_read ( BYTE drv, BYTE *buff, DWORD sector, UINT count )
+{
+	return sd_request( drv, SD_IO_READ, sector * DISK_BLOCKS, (DWORD)count * DISK_BLOCKS, buff );
+}
+
+#if _READONLY == 0
+static DRESULT sd_write ( BYTE drv, const BYTE *buff, DWORD sector, UINT count )
+{
+	return sd_request( drv, SD_IO_WRITE, sector * DISK_BLOCKS, (DWORD)count * DISK_BLOCKS, (void*)buff );
+}
+#endif /* _READONLY */
+
+/* Erase block for f_mkfs: Allocation Unit of the card in sectors, 1 if it is unknown */
+static DWORD sd_erase_block ( void )
+{
+	DWORD n = SD_IO_AuSize() / DISK_BLOCKS;
+
+	return ( n != 0 ) ? n : 1;
+}
+
+static DRESULT sd_ioctl ( BYTE drv, BYTE ctrl, void *buff )
+{
+	SD_CardInfo cardinfo;
+	DRESULT res;
+#ifdef USE_DISK_VERIFY
+	BYTE on;
+#endif /* USE_DISK_VERIFY */
+
+	switch( ctrl )
+	{
+	case CTRL_SYNC:
+		/* close streaming write, so all written data is on the card */
+		res = sd_request( drv, SD_IO_SYNC, 0, 0, 0 );
+		break;
+	case GET_SECTOR_SIZE:
+		*(WORD*)buff = _MAX_SS;
+		res = RES_OK;
+		break;
+	case GET_BLOCK_SIZE:
+		*(DWORD*)buff = sd_erase_block();
+		res = RES_OK;
+		break;
+	case GET_SECTOR_COUNT:
+		res = sd_request( drv, SD_IO_INFO, 0, 0, &cardinfo );
+		if ( res == RES_OK )
+		{
+			*(DWORD*)buff = cardinfo.CardCapacity * 2 / DISK_BLOCKS;	/* Kbytes to card blocks */
+			res = ( *(DWORD*)buff > 0 ) ? RES_OK : RES_PARERR;
+		}
+		break;
+	case MMC_GET_CID:
+		res = sd_request( drv, SD_IO_INFO, 0, 0, &cardinfo );
+		if ( res == RES_OK )
+			memcpy( buff, cardinfo.CID, sizeof( cardinfo.CID ) );
+		break;
+	case CTRL_ERASE_SECTOR:
+		/* FatFs frees the sectors (remove_chain), they are erased later by SD I/O task */
+		res = ( SD_IO_Discard( ((DWORD*)buff)[ 0 ] * DISK_BLOCKS,
+				( ((DWORD*)buff)[ 1 ] - ((DWORD*)buff)[ 0 ] + 1 ) * DISK_BLOCKS ) == SD_RESPONSE_NO_ERROR ) ? RES_OK : RES_PARERR;
+		break;
+#ifdef USE_DISK_VERIFY
+	case CTRL_VERIFY:
+		/* bypass for some writes: the caller puts the previous setting back after them
+		   (sectors written back by the cache later are verified by the setting of that time) */
+		on = sd_verify[ drv ];
+		sd_verify[ drv ] = ( *(BYTE*)buff != 0 );
+		*(BYTE*)buff = on;
+		res = RES_OK;
+		break;
+#endif /* USE_DISK_VERIFY */
+#ifdef USE_DISK_REMAP
+	case CTRL_REMAP:
+		sd_remap[ drv ] = (REMAP_Table*)buff;
+		res = RES_OK;
+		break;
+#endif /* USE_DISK_REMAP */
+	case CTRL_EJECT:
+		/* 1 hands the card over (f_eject has synced the volumes of the drive), 0 takes it back */
+		if ( *(BYTE*)buff )
+			sd_ejected[ drv ] = 1;
+		else if ( sd_ejected[ drv ] )
+		{
+			sd_ejected[ drv ] = 0;
+			++sd_ejects;
+		}
+		sd_stat[ drv ] = STA_NOINIT | ( sd_ejected[ drv ] ? STA_NODISK : 0 );
+		res = RES_OK;
+		break;
+	default:
+		res = RES_PARERR;
+		break;
+	}
+
+	return res;
+}
+
+#ifdef USE_SD_RAID
+/*-----------------------------------------------------------------------*/
+/* Array of two SD Cards (physical drives 0 and 1)                       */
+/*-----------------------------------------------------------------------*/
+
+/* The 1st card is accessed through the SD I/O task, the 2nd one directly
+   by the calling task, so a request spanning both cards keeps both SPI
+   buses (and their DMA streams) busy at the same time. The array is
+   partitioned as a single card, both volumes are on it. The mirror (RAID-1)
+   goes on with one card (degraded) when the other one is missing or fails:
+   a card dropped from it stays out until restart, as its copy is out of date
+   (it has to be copied from the other card before both are used again). */
+
+/* Striping unit (RAID-0): sectors of the array go to the cards by chunks alternately */
+#define RAID_CHUNK		16
+
+static volatile BYTE raid_ready2;	/* 2nd card is initialized */
+#ifdef USE_SD_RAID_MIRROR
+static volatile BYTE raid_failed;	/* Cards dropped from the mirror: bit 0 for the 1st card, bit 1 for the 2nd one */
+static BYTE raid_turn;				/* Card of the last single sector read of the mirror */
+#endif /* USE_SD_RAID_MIRROR */
+
+/* Executes request on the 2nd card */
+static SD_Error raid_execute2 ( SD_IO_Op op, DWORD sector, DWORD count, BYTE *buff )
+{
+	SD_Error res;
+
+	switch ( op )
+	{
+	case SD_IO_READ:
+		res = SD_SectorsRead( &SD_Card2, sector, buff, count );
+		break;
+	case SD_IO_WRITE:
+		res = SD_SectorsWrite( &SD_Card2, sector, buff, count );
+		break;
+	default:
+		/* written sectors are on the card already (no streaming on the 2nd card) */
+		res = SD_RESPONSE_NO_ERROR;
+		break;
+	}
+	if ( res != SD_RESPONSE_NO_ERROR )
+		raid_ready2 = 0;	/* initialized again by raid_request() */
+	return res;
+}
+
+/* Transfers parts of a request on both cards in parallel (count of unused part is 0),
+   returns the cards which failed: bit 0 for the 1st card, bit 1 for the 2nd one */
+static BYTE raid_transfer (
+	SD_IO_Op op,		/* Operation */
+	const DWORD *sect,	/* First sector on the card, for each card */
+	const DWORD *cnt,	/* Number of sectors, for each card */
+	BYTE * const *buf	/* Data buffer, for each card */
+)
+{
+	SD_IO_Request* req = NULL;
+	BYTE fail = 0;
+
+	if ( cnt[ 0 ] )
+		req = sd_submit( op, sect[ 0 ], cnt[ 0 ], buf[ 0 ] );
+	if ( cnt[ 1 ] && raid_execute2( op, sect[ 1 ], cnt[ 1 ], buf[ 1 ] ) != SD_RESPONSE_NO_ERROR )
+		fail |= 2;
+	if ( req != NULL && sd_wait( req ) != SD_RESPONSE_NO_ERROR )
+		fail |= 1;
+	return fail;
+}
+
+/* Syncs the cards of the array: the SD I/O task closes the write stream and writes the buffered
+   sectors of the 1st card, sectors of the 2nd one are on it already; returns the cards which failed */
+static BYTE raid_sync ( BYTE cards )
+{
+	BYTE fail = 0;
+
+	if ( ( cards & 1 ) && sd_execute( SD_IO_SYNC, 0, 0, 0 ) != SD_RESPONSE_NO_ERROR )
+		fail |= 1;
+	if ( ( cards & 2 ) && raid_execute2( SD_IO_SYNC, 0, 0, 0 ) != SD_RESPONSE_NO_ERROR )
+		fail |= 2;
+	return fail;
+}
+
+/* Initializes the 2nd card once for all volumes of the array */
+static SD_Error raid_init2 ( void )
+{
+	if ( raid_ready2 )
+		return SD_RESPONSE_NO_ERROR;
+	if ( SD_Init( &SD_Card2 ) != SD_RESPONSE_NO_ERROR )
+		return SD_RESPONSE_FAILURE;
+	raid_ready2 = 1;
+	return SD_RESPONSE_NO_ERROR;
+}
+
+#ifndef USE_SD_RAID_MIRROR
+/* Executes request of the array */
+static SD_Error raid_execute ( SD_IO_Op op, DWORD sector, DWORD count, BYTE *buff )
+{
+	DWORD sect[ 2 ], cnt[ 2 ];
+	BYTE* buf[ 2 ];
+	DWORD n;
+	SD_Error res = SD_RESPONSE_NO_ERROR;
+	BYTE i, k;
+
+	if ( op != SD_IO_READ && op != SD_IO_WRITE )
+		return ( raid_sync( 3 ) == 0 ) ? SD_RESPONSE_NO_ERROR : SD_RESPONSE_FAILURE;
+	/* each step takes two adjacent chunks, they are always on different cards */
+	while ( count && res == SD_RESPONSE_NO_ERROR )
+	{
+		cnt[ 0 ] = cnt[ 1 ] = 0;
+		for ( i = 0; i < 2 && count; ++i )
+		{
+			k = ( sector / RAID_CHUNK ) & 1;
+			n = RAID_CHUNK - sector % RAID_CHUNK;
+			if ( n > count )
+				n = count;
+			sect[ k ] = sector / ( 2 * RAID_CHUNK ) * RAID_CHUNK + sector % RAID_CHUNK;
+			cnt[ k ] = n;
+			buf[ k ] = buff;
+			sector += n;
+			count -= n;
+			buff += n * SD_BLOCK_SIZE;
+		}
+		res = ( raid_transfer( op, sect, cnt, buf ) == 0 ) ? SD_RESPONSE_NO_ERROR : SD_RESPONSE_FAILURE;
+	}
+	return res;
+}
+
+/* Updates drive status: the array is not ready if any of the cards is not */
+static DSTATUS raid_check ( BYTE drv )
+{
+	if ( SD_Detect( &SD_Card2 ) == SD_NOT_PRESENT )
+	{
+		raid_ready2 = 0;
+		sd_stat[ drv ] = STA_NOINIT | STA_NODISK;
+	}
+	return sd_check( drv );
+}
+#else
+/* Initializes the cards of the mirror which failed again once (glitch), returns the ones
+   which are back with the same card */
+static BYTE raid_recover ( BYTE drv, BYTE fail )
+{
+	BYTE back = 0;
+
+	if ( ( fail & 1 ) && ( SD_IO_Ready() || sd_execute( SD_IO_INIT, 0, 0, 0 ) == SD_RESPONSE_NO_ERROR ) &&
+			sd_card[ drv ] == sd_changes( drv ) )
+		back |= 1;
+	if ( ( fail & 2 ) && raid_init2() == SD_RESPONSE_NO_ERROR )
+		back |= 2;
+	return back;
+}
+
+/* Executes request on the cards of the mirror, sync goes to each of them;
+   returns the cards which failed */
+static BYTE raid_copies ( BYTE cards, SD_IO_Op op, DWORD sector, DWORD count, BYTE *buff )
+{
+	DWORD sect[ 2 ], cnt[ 2 ];
+	BYTE* buf[ 2 ];
+
+	if ( op != SD_IO_READ && op != SD_IO_WRITE )
+		return raid_sync( cards );
+	sect[ 0 ] = sect[ 1 ] = sector;
+	buf[ 0 ] = buf[ 1 ] = buff;
+	cnt[ 0 ] = ( cards & 1 ) ? count : 0;
+	cnt[ 1 ] = ( cards & 2 ) ? count : 0;
+	/* both copies are written; a read is split in halves read from the cards in parallel (as the
+	   chunks of the striped array), a single sector goes to them in turn */
+	if ( op == SD_IO_READ && cards == 3 )
+	{
+		if ( count == 1 )
+			cnt[ raid_turn ^= 1 ] = 0;
+		else
+		{
+			cnt[ 0 ] = count - count / 2;
+			cnt[ 1 ] = count / 2;
+			sect[ 1 ] = sector + cnt[ 0 ];
+			buf[ 1 ] = buff + cnt[ 0 ] * SD_BLOCK_SIZE;
+		}
+	}
+	return raid_transfer( op, sect, cnt, buf );
+}
+
+/* Executes request of the mirror: a card which fails again after it is initialized again
+   is dropped, the request goes on with the other one */
+static SD_Error raid_execute ( BYTE drv, SD_IO_Op op, DWORD sector, DWORD count, BYTE *buff )
+{
+	BYTE live, back, fail;
+
+	while ( ( live = ~raid_failed & 3 ) != 0 )
+	{
+		fail = raid_copies( live, op, sector, count, buff );
+		if ( fail != 0 )
+		{
+			back = raid_recover( drv, fail );
+			fail = ( fail & ~back ) | raid_copies( back, op, sector, count, buff );
+		}
+		if ( fail == 0 )
+			return SD_RESPONSE_NO_ERROR;
+		raid_failed |= fail;
+		if ( op != SD_IO_READ )
+			return ( fail != live ) ? SD_RESPONSE_NO_ERROR : SD_RESPONSE_FAILURE;
+	}
+	return SD_RESPONSE_FAILURE;
+}
+
+/* Updates drive status: the mounted mirror drops a missing or changed card, it is not ready
+   when both cards are dropped */
+static DSTATUS raid_check ( BYTE drv )
+{
+	if ( SD_Detect( &SD_Card2 ) == SD_NOT_PRESENT )
+	{
+		raid_ready2 = 0;
+		if ( !( sd_stat[ drv ] & STA_NOINIT ) )
+			raid_failed |= 2;
+	}
+	if ( !( sd_stat[ drv ] & STA_NOINIT ) )
+	{
+		if ( SD_IO_Detect() == SD_NOT_PRESENT || sd_card[ drv ] != sd_changes( drv ) )
+			raid_failed |= 1;
+		if ( raid_failed == 3 )
+			sd_stat[ drv ] |= STA_NOINIT;
+	}
+	return sd_stat[ drv ];
+}
+#endif /* USE_SD_RAID_MIRROR */
+
+static DSTATUS raid_initialize ( BYTE drv )
+{
+#ifdef USE_SD_RAID_MIRROR
+	BYTE failed;
+
+	/* the mirror is mounted with one card if the other one is missing or was dropped
+	   (both cards are tried again if both were dropped) */
+	if ( raid_failed == 3 )
+		raid_failed = 0;
+	failed = raid_failed;
+	if ( !( failed & 2 ) && ( SD_Detect( &SD_Card2 ) == SD_NOT_PRESENT || raid_init2() != SD_RESPONSE_NO_ERROR ) )
+		failed |= 2;
+	if ( !( failed & 1 ) && sd_initialize( drv ) != 0 )
+		failed |= 1;
+	if ( failed == 3 )
+		return sd_stat[ drv ] = STA_NOINIT |
+				( ( SD_Detect( &SD_Card2 ) == SD_NOT_PRESENT && SD_IO_Detect() == SD_NOT_PRESENT ) ? STA_NODISK : 0 );
+	raid_failed = failed;
+	return sd_stat[ drv ] = 0;
+#else
+	if ( SD_Detect( &SD_Card2 ) == SD_NOT_PRESENT )
+		return sd_stat[ drv ] = STA_NOINIT | STA_NODISK;
+	if ( raid_init2() != SD_RESPONSE_NO_ERROR )
+		return sd_stat[ drv ] = STA_NOINIT;
+	return sd_initialize( drv );
+#endif /* USE_SD_RAID_MIRROR */
+}
+
+static DSTATUS raid_status ( BYTE drv )
+{
+	return raid_check( drv );
+}
+
+/* Executes request of mounted drive, each card is initialized again once as in sd_request() */
+static DRESULT raid_request ( BYTE drv, SD_IO_Op op, DWORD sector, DWORD count, void *buff )
+{
+	if ( raid_check( drv ) & STA_NOINIT )
+		return RES_NOTRDY;
+#ifdef USE_SD_RAID_MIRROR
+	return ( raid_execute( drv, op, sector, count, buff ) == SD_RESPONSE_NO_ERROR ) ? RES_OK : RES_ERROR;
+#else
+	if ( raid_execute( op, sector, count, buff ) == SD_RESPONSE_NO_ERROR )
+		return RES_OK;
+
+	if ( !SD_IO_Ready() && sd_execute( SD_IO_INIT, 0, 0, 0 ) != SD_RESPONSE_NO_ERROR )
+		sd_stat[ drv ] |= STA_NOINIT;
+	if ( raid_init2() != SD_RESPONSE_NO_ERROR )
+		sd_stat[ drv ] |= STA_NOINIT;
+	if ( raid_check( drv ) & STA_NOINIT )
+		return RES_NOTRDY;
+	return ( raid_execute( op, sector, count, buff ) == SD_RESPONSE_NO_ERROR ) ? RES_OK : RES_ERROR;
+#endif /* USE_SD_RAID_MIRROR */
+}
+
+static DRESULT raid_read ( BYTE drv, BYTE *buff, DWORD sector, UINT count )
+{
+	return raid_request( drv, SD_IO_READ, sector * DISK_BLOCKS, (DWORD)count * DISK_BLOCKS, buff );
+}
+
+#if _READONLY == 0
+static DRESULT raid_write ( BYTE drv, const BYTE *buff, DWORD sector, UINT count )
+{
+	return raid_request( drv, SD_IO_WRITE, sector * DISK_BLOCKS, (DWORD)count * DISK_BLOCKS, (void*)buff );
+}
+#endif /* _READONLY */
+
+static DRESULT raid_ioctl ( BYTE drv, BYTE ctrl, void *buff )
+{
+	SD_CardInfo cardinfo;
+	DWORD size;
+	DRESULT res;
+
+	switch( ctrl )
+	{
+	case CTRL_SYNC:
+		res = raid_request( drv, SD_IO_SYNC, 0, 0, 0 );
+		break;
+	case GET_SECTOR_SIZE:
+		*(WORD*)buff = _MAX_SS;
+		res = RES_OK;
+		break;
+	case GET_BLOCK_SIZE:
+		/* AU of the 1st card, striping puts two of them side by side */
+#ifndef USE_SD_RAID_MIRROR
+		*(DWORD*)buff = sd_erase_block() * 2;
+#else
+		*(DWORD*)buff = sd_erase_block();
+#endif /* USE_SD_RAID_MIRROR */
+		res = RES_OK;
+		break;
+	case GET_SECTOR_COUNT:
+		/* the smaller card limits the array */
+#ifdef USE_SD_RAID_MIRROR
+		if ( raid_check( drv ) & STA_NOINIT )
+		{
+			res = RES_NOTRDY;
+			break;
+		}
+		/* a degraded mirror is as large as its card */
+		size = 0xFFFFFFFF;
+		if ( !( raid_failed & 1 ) && sd_execute( SD_IO_INFO, 0, 0, &cardinfo ) == SD_RESPONSE_NO_ERROR )
+			size = cardinfo.CardCapacity;
+		if ( !( raid_failed & 2 ) && SD_GetCardInfo( &SD_Card2, &cardinfo ) == SD_RESPONSE_NO_ERROR &&
+				size > cardinfo.CardCapacity )
+			size = cardinfo.CardCapacity;
+		res = ( size != 0xFFFFFFFF ) ? RES_OK : RES_ERROR;
+		cardinfo.CardCapacity = size;
+#else
+		res = sd_request( drv, SD_IO_INFO, 0, 0, &cardinfo );
+		if ( res == RES_OK )
+		{
+			size = cardinfo.CardCapacity;
+			res = ( SD_GetCardInfo( &SD_Card2, &cardinfo ) == SD_RESPONSE_NO_ERROR ) ? RES_OK : RES_ERROR;
+		}
+#endif /* USE_SD_RAID_MIRROR */
+		if ( res == RES_OK )
+		{
+			if ( size > cardinfo.CardCapacity )
+				size = cardinfo.CardCapacity;
+			size *= 2;					/* Kbytes to card blocks */
+#ifndef USE_SD_RAID_MIRROR
+			size = size / RAID_CHUNK * RAID_CHUNK * 2;
+#endif /* USE_SD_RAID_MIRROR */
+			*(DWORD*)buff = size / DISK_BLOCKS;
+			res = ( size > 0 ) ? RES_OK : RES_PARERR;
+		}
+		break;
+	default:
+		/* CTRL_ERASE_SECTOR is only a hint, the freed sectors are left as they are on the array */
+		res = RES_PARERR;
+		break;
+	}
+
+	return res;
+}
+#endif /* USE_SD_RAID */
+
+/*-----------------------------------------------------------------------*/
+/* Physical drives                                                       */
+/*-----------------------------------------------------------------------*/
+
+/* Driver of a physical drive */
+typedef struct {
+	DSTATUS ( *initialize )( BYTE drv );
+	DSTATUS ( *status )( BYTE drv );
+	DRESULT ( *read )( BYTE drv, BYTE *buff, DWORD sector, UINT count );
+#if _READONLY == 0
+	DRESULT ( *write )( BYTE drv, const BYTE *buff, DWORD sector, UINT count );
+#endif
+	DRESULT ( *ioctl )( BYTE drv, BYTE ctrl, void *buff );
+	DWORD ( *changes )( BYTE drv );	/* Number of medium changes (for the sector cache) */
+	BYTE medium;					/* Drives on the same medium share cached sectors */
+} DISK_DRIVER;
+
+#if _READONLY == 0
+#define SD_DRIVER		{ sd_initialize, sd_status, sd_read, sd_write, sd_ioctl, sd_changes, 0 }
+#else
+#define SD_DRIVER		{ sd_initialize, sd_status, sd_read, sd_ioctl, sd_changes, 0 }
+#endif
+
+#ifdef USE_SD_RAID
+#if _READONLY == 0
+#define RAID_DRIVER		{ raid_initialize, raid_status, raid_read, raid_write, raid_ioctl, sd_changes, 0 }
+#else
+#define RAID_DRIVER		{ raid_initialize, raid_status, raid_read, raid_ioctl, sd_changes, 0 }
+#endif
+#endif /* USE_SD_RAID */
+
+/* Physical drive number is the index, another device (e.g. SPI flash) is added as drive 2 */
+static const DISK_DRIVER drivers[] = {
+#ifndef USE_SD_RAID
+	SD_DRIVER,
+	SD_DRIVER
+#else
+	RAID_DRIVER,
+	RAID_DRIVER
+#endif /* USE_SD_RAID */
+};
+
+#define DISK_DRIVES		( sizeof( drivers ) / sizeof( drivers[ 0 ] ) )
+
+#ifdef USE_DISK_CACHE
+/*-----------------------------------------------------------------------*/
+/* Sector cache                                                          */
+/*-----------------------------------------------------------------------*/
+
+/* Write policies of the cache */
+#define CACHE_WRITE_THROUGH		0	/* Written sectors go to the drive at once, the cache keeps copies */
+#define CACHE_WRITE_BACK_TIMED	1	/* Dirty sectors are written on sync, on eviction or CACHE_FLUSH_MS after the first one */
+#define CACHE_WRITE_BACK		2	/* Dirty sectors are written on sync or on eviction only */
+
+#define CACHE_POLICY			CACHE_WRITE_BACK_TIMED
+#define CACHE_FLUSH_MS			1000
+#define CACHE_SLOTS				DISK_CACHE_SLOTS	/* Number of cached sectors (up to 254, see storage_conf.h) */
+#define CACHE_HASH				DISK_CACHE_HASH		/* Number of hash chains (power of 2) */
+#define CACHE_MAX_RUN			4	/* Longer transfers bypass the cache (file data, not metadata) */
+#define CACHE_TASK_PRIO			( tskIDLE_PRIORITY + 2 )	/* Cache task does the work of the flush timer and read ahead */
+#define CACHE_TASK_STACK		( configMINIMAL_STACK_SIZE * 2 )
+
+#define CACHE_NONE				0xFF
+
+/* Slot of the cache */
+typedef struct {
+	DWORD sector;	/* Sector number on the medium */
+	DWORD media;	/* Medium changes of the drive when the sector was cached */
+	DWORD used;		/* Time of last use (for LRU eviction) */
+	BYTE drv;		/* Drive the sector was cached for (it is written back to it) */
+	BYTE state;		/* 0: free, 1: clean, 2: dirty */
+	BYTE next;		/* Next slot in the hash chain */
+	BYTE pins;		/* Pins of its data by CTRL_CACHE_PIN, the slot is not replaced while they last */
+} CACHE_SLOT;
+
+#define CACHE_FREE		0
+#define CACHE_CLEAN		1
+#define CACHE_DIRTY		2
+
+#define CACHE_HASH_OF( sector )		( (BYTE)( (sector) & ( CACHE_HASH - 1 ) ) )
+
+#ifndef USE_SPARE_RAM_CACHE
+static CACHE_SLOT cache_slot[ CACHE_SLOTS ];
+static BYTE cache_data[ CACHE_SLOTS ][ _MAX_SS ] MEM_FS_CACHE;
+#define cache_slots				CACHE_SLOTS
+#else
+/* Slots and their data are laid out in SRAM1 left between the sections and the main stack */
+extern BYTE _sspare[], _espare[];			/* stm32_flash.ld */
+static CACHE_SLOT* cache_slot;
+static BYTE ( *cache_data )[ _MAX_SS ];
+static BYTE cache_slots;					/* Number of slots */
+#endif /* USE_SPARE_RAM_CACHE */
+static BYTE cache_head[ CACHE_HASH ];		/* First slot of each hash chain */
+static BYTE cache_ready;					/* Hash chains are set up */
+static DWORD cache_clock;					/* Use counter */
+static DWORD cache_stats[ 3 ];				/* Sector hits, misses and hits of the second tier (CTRL_CACHE_STATS) */
+#if CACHE_POLICY == CACHE_WRITE_BACK_TIMED
+static BYTE cache_dirty;					/* Number of dirty slots */
+static DWORD cache_dirty_msec;				/* Time of the oldest dirty slot */
+#if configUSE_TIMERS
+static xTimerHandle cache_timer;			/* Expires CACHE_FLUSH_MS after the oldest dirty slot */
+static xStaticTimer cache_timer_buf;
+#endif
+#endif
+#if configUSE_TIMERS
+static xTaskHandle cache_task;				/* Woken up by the flush timer and read ahead hints, it accesses the drives for them */
+static xStaticTask cache_task_buf;
+static portSTACK_TYPE cache_task_stack[ CACHE_TASK_STACK ];
+#endif
+static xSemaphoreHandle cache_mutex;		/* Drives are called by tasks of different volumes */
+static xStaticSemaphore cache_mutex_buf;
+#if configUSE_TIMERS
+static DWORD cache_ahead[ 2 ];				/* First and last sector of the pending hint of CTRL_CACHE_READ_AHEAD, last is 0 if none */
+static BYTE cache_ahead_drv;
+#endif
+
+#ifdef USE_EXT_SRAM
+/* Second tier in external SRAM keeps clean copies of sectors evicted from the first one
+   and is looked up on its misses, written sectors are dropped from it. Each sector has
+   its set of CACHE2_WAYS slots, the least recently used slot of the set is replaced. */
+#define CACHE2_WAYS				DISK_CACHE2_WAYS
+#define CACHE2_SETS				DISK_CACHE2_SETS	/* 3968 sectors of 512 bytes: tags and data take 2 Mb of SRAM */
+
+/* Set of the second tier */
+typedef struct {
+	DWORD sector[ CACHE2_WAYS ];	/* Sector number on the medium */
+	DWORD media[ CACHE2_WAYS ];		/* Medium changes of the drive when the sector was cached */
+	DWORD used[ CACHE2_WAYS ];		/* Time of last use */
+	BYTE medium[ CACHE2_WAYS ];		/* Medium of the sector, CACHE_NONE: free slot */
+} CACHE2_SET;
+
+static CACHE2_SET cache2_set[ CACHE2_SETS ] MEM_EXT_SRAM;
+static BYTE cache2_data[ CACHE2_SETS ][ CACHE2_WAYS ][ _MAX_SS ] MEM_EXT_SRAM;
+static BYTE cache2_on;						/* External SRAM has passed its test */
+
+/* Frees all slots of the second tier if the external SRAM is usable */
+static void cache2_init ( void )
+{
+	DWORD i;
+
+	cache2_on = STM_EVAL_SRAM_Ready();
+	for ( i = 0; cache2_on && i < CACHE2_SETS; ++i )
+		memset( cache2_set[ i ].medium, CACHE_NONE, CACHE2_WAYS );
+}
+
+/* Finds slot of the sector in its set, sectors of removed medium are dropped */
+static BYTE cache2_find ( BYTE drv, DWORD sector, CACHE2_SET** set )
+{
+	BYTE w;
+
+	*set = &cache2_set[ sector % CACHE2_SETS ];
+	for ( w = 0; cache2_on && w < CACHE2_WAYS; ++w )
+	{
+		if ( (*set)->medium[ w ] != drivers[ drv ].medium || (*set)->sector[ w ] != sector )
+			continue;
+		if ( (*set)->media[ w ] != drivers[ drv ].changes( drv ) )
+		{
+			(*set)->medium[ w ] = CACHE_NONE;
+			return CACHE_NONE;
+		}
+		return w;
+	}
+	return CACHE_NONE;
+}
+
+/* Checks if the second tier has the sector */
+static BYTE cache2_has ( BYTE drv, DWORD sector )
+{
+	CACHE2_SET* set;
+
+	return ( cache2_find( drv, sector, &set ) != CACHE_NONE );
+}
+
+/* Copies the sector from the second tier, returns 0 if it is not there */
+static BYTE cache2_load ( BYTE drv, DWORD sector, BYTE *buff )
+{
+	CACHE2_SET* set;
+	BYTE w = cache2_find( drv, sector, &set );
+
+	if ( w == CACHE_NONE )
+		return 0;
+	set->used[ w ] = ++cache_clock;
+	memcpy( buff, cache2_data[ set - cache2_set ][ w ], _MAX_SS );
+	return 1;
+}
+
+/* Stores clean copy of the sector cached when the medium had the given number of changes */
+static void cache2_store ( BYTE drv, DWORD sector, DWORD media, const BYTE *buff )
+{
+	CACHE2_SET* set;
+	BYTE w, i;
+
+	if ( !cache2_on || media != drivers[ drv ].changes( drv ) )
+		return;		/* the copy belongs to the previous medium */
+	w = cache2_find( drv, sector, &set );
+	if ( w == CACHE_NONE )
+	{
+		for ( i = w = 0; i < CACHE2_WAYS; ++i )
+		{
+			if ( set->medium[ i ] == CACHE_NONE )
+			{
+				w = i;
+				break;
+			}
+			if ( (long)( set->used[ i ] - set->used[ w ] ) < 0 )
+				w = i;
+		}
+	}
+	set->sector[ w ] = sector;
+	set->media[ w ] = media;
+	set->used[ w ] = ++cache_clock;
+	set->medium[ w ] = drivers[ drv ].medium;
+	memcpy( cache2_data[ set - cache2_set ][ w ], buff, _MAX_SS );
+}
+
+/* Drops copy of the sector from the second tier */
+static void cache2_drop ( BYTE drv, DWORD sector )
+{
+	CACHE2_SET* set;
+	BYTE w = cache2_find( drv, sector, &set );
+
+	if ( w != CACHE_NONE )
+		set->medium[ w ] = CACHE_NONE;
+}
+
+/* Drops copies of the range of sectors of the medium of the drive */
+static void cache2_drop_range ( BYTE drv, DWORD first, DWORD last )
+{
+	DWORD i;
+	BYTE w;
+
+	for ( i = 0; cache2_on && i < CACHE2_SETS; ++i )
+	{
+		for ( w = 0; w < CACHE2_WAYS; ++w )
+		{
+			if ( cache2_set[ i ].medium[ w ] == drivers[ drv ].medium &&
+					cache2_set[ i ].sector[ w ] >= first && cache2_set[ i ].sector[ w ] <= last )
+				cache2_set[ i ].medium[ w ] = CACHE_NONE;
+		}
+	}
+}
+#else
+#define cache2_has( drv, sector )					0
+#define cache2_load( drv, sector, buff )			0
+#define cache2_store( drv, sector, media, buff )	((void)0)
+#define cache2_drop( drv, sector )					((void)0)
+#define cache2_drop_range( drv, first, last )		((void)0)
+#endif /* USE_EXT_SRAM */
+
+/* Takes the cache (there is no other task before scheduler is started) */
+static void cache_lock ( void )
+{
+	BYTE i;
+#ifdef USE_SPARE_RAM_CACHE
+	DWORD n;
+#endif /* USE_SPARE_RAM_CACHE */
+
+	if ( !cache_ready )
+	{
+		for ( i = 0; i < CACHE_HASH; ++i )
+			cache_head[ i ] = CACHE_NONE;
+#ifdef USE_SPARE_RAM_CACHE
+		n = ( _espare - _sspare ) / ( _MAX_SS + sizeof( CACHE_SLOT ) );
+		cache_slots = ( n > CACHE_SLOTS ) ? CACHE_SLOTS : n;
+		cache_data = (BYTE (*)[ _MAX_SS ])_sspare;
+		cache_slot = (CACHE_SLOT*)( _sspare + cache_slots * _MAX_SS );
+		memset( cache_slot, 0, cache_slots * sizeof( CACHE_SLOT ) );
+#endif /* USE_SPARE_RAM_CACHE */
+#ifdef USE_EXT_SRAM
+		cache2_init();
+#endif /* USE_EXT_SRAM */
+		cache_ready = 1;
+	}
+	if ( xTaskGetSchedulerState() != taskSCHEDULER_RUNNING )
+		return;
+	if ( cache_mutex == NULL )
+	{
+		taskENTER_CRITICAL();
+		if ( cache_mutex == NULL )
+			cache_mutex = xSemaphoreCreateMutexStatic( &cache_mutex_buf );
+		taskEXIT_CRITICAL();
+	}
+	xSemaphoreTake( cache_mutex, portMAX_DELAY );
+}
+
+static void cache_unlock ( void )
+{
+	if ( xTaskGetSchedulerState() == taskSCHEDULER_RUNNING )
+		xSemaphoreGive( cache_mutex );
+}
+
+/* Removes slot from its hash chain and frees it */
+static void cache_drop ( BYTE s )
+{
+	BYTE* link = &cache_head[ CACHE_HASH_OF( cache_slot[ s ].sector ) ];
+
+	while ( *link != s )
+		link = &cache_slot[ *link ].next;
+	*link = cache_slot[ s ].next;
+#if CACHE_POLICY == CACHE_WRITE_BACK_TIMED
+	if ( cache_slot[ s ].state == CACHE_DIRTY )
+		--cache_dirty;
+#endif
+	cache_slot[ s ].state = CACHE_FREE;
+}
+
+/* Finds slot of the sector on the medium of the drive, sectors of removed medium are dropped */
+static BYTE cache_find ( BYTE drv, DWORD sector )
+{
+	BYTE s = cache_head[ CACHE_HASH_OF( sector ) ];
+	BYTE next;
+
+	for ( ; s != CACHE_NONE; s = next )
+	{
+		next = cache_slot[ s ].next;
+		if ( cache_slot[ s ].sector != sector || drivers[ cache_slot[ s ].drv ].medium != drivers[ drv ].medium )
+			continue;
+		if ( cache_slot[ s ].media != drivers[ drv ].changes( drv ) )
+		{
+			cache_drop( s );
+			continue;
+		}
+		cache_slot[ s ].used = ++cache_clock;
+		return s;
+	}
+	return CACHE_NONE;
+}
+
+#if _READONLY == 0
+/* Marks slot clean */
+static void cache_clean ( BYTE s )
+{
+#if CACHE_POLICY == CACHE_WRITE_BACK_TIMED
+	if ( cache_slot[ s ].state == CACHE_DIRTY )
+		--cache_dirty;
+#endif
+	cache_slot[ s ].state = CACHE_CLEAN;
+}
+
+/* Writes dirty sectors of the medium of the drive in ascending order, sectors held
+   by adjacent slots go in one request, the following ones continue the same write
+   stream of SD I/O task (USE_SD_WRITE_STREAM) */
+static DRESULT cache_flush ( BYTE drv )
+{
+	DRESULT res = RES_OK;
+	BYTE s, i, n;
+
+	while ( 1 )
+	{
+		s = CACHE_NONE;
+		for ( i = 0; i < cache_slots; ++i )
+		{
+			if ( cache_slot[ i ].state == CACHE_DIRTY && drivers[ cache_slot[ i ].drv ].medium == drivers[ drv ].medium &&
+					( s == CACHE_NONE || cache_slot[ i ].sector < cache_slot[ s ].sector ) )
+				s = i;
+		}
+		if ( s == CACHE_NONE )
+			return res;
+		if ( cache_slot[ s ].media != drivers[ cache_slot[ s ].drv ].changes( cache_slot[ s ].drv ) )
+		{	/* the medium was changed, the data belong to the previous one */
+			cache_drop( s );
+			continue;
+		}
+		for ( n = 1; s + n < cache_slots && cache_slot[ s + n ].state == CACHE_DIRTY &&
+				cache_slot[ s + n ].sector == cache_slot[ s ].sector + n &&
+				drivers[ cache_slot[ s + n ].drv ].medium == drivers[ drv ].medium; ++n ) ;
+		if ( drivers[ cache_slot[ s ].drv ].write( cache_slot[ s ].drv, cache_data[ s ], cache_slot[ s ].sector, n ) != RES_OK )
+		{	/* the data are lost, other sectors are still written */
+			res = RES_ERROR;
+			for ( i = 0; i < n; ++i )
+				cache_drop( s + i );
+			continue;
+		}
+		for ( i = 0; i < n; ++i )
+			cache_clean( s + i );
+	}
+}
+
+/* Writes all dirty sectors */
+static DRESULT cache_flush_all ( void )
+{
+	DRESULT res = RES_OK;
+	BYTE i;
+
+	for ( i = 0; i < cache_slots; ++i )
+	{
+		if ( cache_slot[ i ].state == CACHE_DIRTY && cache_flush( cache_slot[ i ].drv ) != RES_OK )
+			res = RES_ERROR;
+	}
+	return res;
+}
+#endif /* _READONLY */
+
+/* Takes a slot for the sector which isn't cached: a free one or the least recently used
+   one which isn't pinned. The slot is clean, CACHE_NONE if there is no slot to take. */
+static BYTE cache_claim ( BYTE drv, DWORD sector )
+{
+	BYTE s = CACHE_NONE;
+	BYTE i;
+
+	for ( i = 0; i < cache_slots; ++i )
+	{
+		if ( cache_slot[ i ].pins )
+			continue;		/* a view reads its data */
+		if ( cache_slot[ i ].state == CACHE_FREE )
+		{
+			s = i;
+			break;
+		}
+		if ( s == CACHE_NONE || (long)( cache_slot[ i ].used - cache_slot[ s ].used ) < 0 )
+			s = i;
+	}
+	if ( s == CACHE_NONE )
+		return s;
+#if _READONLY == 0
+	if ( cache_slot[ s ].state == CACHE_DIRTY )
+	{	/* all dirty sectors of its medium go together */
+		cache_flush( cache_slot[ s ].drv );
+	}
+#endif
+	if ( cache_slot[ s ].state == CACHE_CLEAN )
+		cache2_store( cache_slot[ s ].drv, cache_slot[ s ].sector, cache_slot[ s ].media, cache_data[ s ] );
+	if ( cache_slot[ s ].state != CACHE_FREE )
+		cache_drop( s );
+	cache_slot[ s ].sector = sector;
+	cache_slot[ s ].drv = drv;
+	cache_slot[ s ].media = drivers[ drv ].changes( drv );
+	cache_slot[ s ].used = ++cache_clock;
+	cache_slot[ s ].state = CACHE_CLEAN;
+	cache_slot[ s ].next = cache_head[ CACHE_HASH_OF( sector ) ];
+	cache_head[ CACHE_HASH_OF( sector ) ] = s;
+	return s;
+}
+
+/* Writes dirty sectors back once the oldest of them waits for CACHE_FLUSH_MS */
+static void cache_expire ( void )
+{
+#if CACHE_POLICY == CACHE_WRITE_BACK_TIMED && _READONLY == 0
+	if ( cache_dirty && get_msec() - cache_dirty_msec >= CACHE_FLUSH_MS )
+		cache_flush_all();
+#endif
+}
+
+#if configUSE_TIMERS
+static void cache_work ( void *pvParameters );
+
+/* Creates the cache task on first use (the cache is locked) */
+static void cache_spawn ( void )
+{
+	if ( cache_task == NULL )
+		xTaskCreateStatic( cache_work, (const signed char* const)"CACHE", CACHE_TASK_STACK, NULL, CACHE_TASK_PRIO, &cache_task, cache_task_stack, &cache_task_buf );
+}
+#endif
+
+#if CACHE_POLICY == CACHE_WRITE_BACK_TIMED && _READONLY == 0 && configUSE_TIMERS
+/* Timer service: the deadline has passed */
+static void cache_timer_expired ( xTimerHandle timer )
+{
+	(void)timer;
+	xTaskNotifyGive( cache_task );
+}
+#endif
+
+#if CACHE_POLICY == CACHE_WRITE_BACK_TIMED
+/* Starts the deadline of the first dirty slot, without timers it is checked by the next request */
+static void cache_arm ( void )
+{
+#if _READONLY == 0 && configUSE_TIMERS
+	cache_spawn();
+	if ( cache_timer == NULL )
+		cache_timer = xTimerCreateStatic( (const signed char*)"CACHE", CACHE_FLUSH_MS / portTICK_RATE_MS, pdFALSE, NULL, cache_timer_expired, &cache_timer_buf );
+	if ( cache_timer != NULL )
+		xTimerStart( cache_timer, 0 );
+#endif
+}
+#endif
+
+/* Stores the sector in the cache, the least recently used slot is replaced if there is no free one */
+static DRESULT cache_store ( BYTE drv, DWORD sector, const BYTE *buff, BYTE state )
+{
+	BYTE s = cache_find( drv, sector );
+
+	if ( s == CACHE_NONE )
+		s = cache_claim( drv, sector );
+	if ( s == CACHE_NONE )
+	{	/* no spare SRAM or each slot is pinned, only clean copies can be left out */
+#if _READONLY == 0
+		if ( state == CACHE_DIRTY )
+			return drivers[ drv ].write( drv, buff, sector, 1 );
+#endif
+		return RES_OK;
+	}
+#if CACHE_POLICY == CACHE_WRITE_BACK_TIMED
+	if ( cache_slot[ s ].state != CACHE_DIRTY && state == CACHE_DIRTY && cache_dirty++ == 0 )
+	{
+		cache_dirty_msec = get_msec();
+		cache_arm();
+	}
+	if ( cache_slot[ s ].state == CACHE_DIRTY && state != CACHE_DIRTY )
+		--cache_dirty;
+#endif
+	cache_slot[ s ].state = state;
+	cache_slot[ s ].drv = drv;
+	memcpy( cache_data[ s ], buff, _MAX_SS );
+	return RES_OK;
+}
+
+/* Reads sectors through the cache, each run of missing sectors is read at once */
+static DRESULT cache_read ( BYTE drv, BYTE *buff, DWORD sector, UINT count )
+{
+	DRESULT res = RES_OK;
+	UINT i, k, n;
+	BYTE s;
+
+	cache_lock();
+	cache_expire();
+	for ( i = 0; i < count && res == RES_OK; i += n )
+	{
+		s = cache_find( drv, sector + i );
+		if ( s != CACHE_NONE )
+		{
+			memcpy( buff + i * _MAX_SS, cache_data[ s ], _MAX_SS );
+			++cache_stats[ 0 ];
+			n = 1;
+			continue;
+		}
+		if ( cache2_load( drv, sector + i, buff + i * _MAX_SS ) )
+		{	/* the first tier gets it back */
+			++cache_stats[ 0 ];
+			++cache_stats[ 2 ];
+			if ( count <= CACHE_MAX_RUN )
+				cache_store( drv, sector + i, buff + i * _MAX_SS, CACHE_CLEAN );
+			n = 1;
+			continue;
+		}
+		for ( n = 1; i + n < count && cache_find( drv, sector + i + n ) == CACHE_NONE &&
+				!cache2_has( drv, sector + i + n ); ++n ) ;
+		cache_stats[ 1 ] += n;
+		res = drivers[ drv ].read( drv, buff + i * _MAX_SS, sector + i, n );
+		if ( res == RES_OK && count <= CACHE_MAX_RUN )
+		{
+			for ( k = 0; k < n; ++k )
+				cache_store( drv, sector + i + k, buff + ( i + k ) * _MAX_SS, CACHE_CLEAN );
+		}
+	}
+	cache_unlock();
+	return res;
+}
+
+/* Reads the sectors missing from the cache (up to CACHE_MAX_RUN) in one request straight
+   into adjacent slots: the run of clean or free slots used least recently is replaced */
+static DRESULT cache_prefetch ( BYTE drv, DWORD first, DWORD last )
+{
+	DRESULT res;
+	BYTE s, i, k, n;
+	DWORD idle, best = 0;
+
+	while ( first <= last && ( cache_find( drv, first ) != CACHE_NONE || cache2_has( drv, first ) ) )
+		++first;
+	for ( n = 0; first + n <= last && n < CACHE_MAX_RUN && n < cache_slots &&
+			( n == 0 || ( cache_find( drv, first + n ) == CACHE_NONE && !cache2_has( drv, first + n ) ) ); ++n ) ;
+	if ( n < 2 )
+		return RES_OK;		/* nothing to gain over a plain read */
+
+	for ( s = CACHE_NONE, i = 0; i + n <= cache_slots; ++i )
+	{	/* the run is as idle as its most recently used slot */
+		for ( idle = 0xFFFFFFFF, k = 0; k < n && cache_slot[ i + k ].state != CACHE_DIRTY && !cache_slot[ i + k ].pins; ++k )
+		{
+			if ( cache_slot[ i + k ].state == CACHE_CLEAN && cache_clock - cache_slot[ i + k ].used < idle )
+				idle = cache_clock - cache_slot[ i + k ].used;
+		}
+		if ( k == n && ( s == CACHE_NONE || idle > best ) )
+		{
+			s = i;
+			best = idle;
+		}
+	}
+	if ( s == CACHE_NONE )
+		return RES_OK;		/* dirty slots everywhere, sectors are read on demand */
+
+	for ( k = 0; k < n; ++k )
+	{
+		if ( cache_slot[ s + k ].state == CACHE_CLEAN )
+		{
+			cache2_store( cache_slot[ s + k ].drv, cache_slot[ s + k ].sector, cache_slot[ s + k ].media, cache_data[ s + k ] );
+			cache_drop( s + k );
+		}
+	}
+	cache_stats[ 1 ] += n;
+	res = drivers[ drv ].read( drv, cache_data[ s ], first, n );
+	for ( k = 0; k < n && res == RES_OK; ++k )
+	{
+		cache_slot[ s + k ].sector = first + k;
+		cache_slot[ s + k ].drv = drv;
+		cache_slot[ s + k ].media = drivers[ drv ].changes( drv );
+		cache_slot[ s + k ].used = ++cache_clock;
+		cache_slot[ s + k ].state = CACHE_CLEAN;
+		cache_slot[ s + k ].next = cache_head[ CACHE_HASH_OF( first + k ) ];
+		cache_head[ CACHE_HASH_OF( first + k ) ] = s + k;
+	}
+	return res;
+}
+
+#if configUSE_TIMERS
+/* Cache task: writes the sectors whose deadline has passed even if no request comes and
+   reads the sectors of the pending hint (a read of the caller meanwhile waits for the cache
+   until they are in), the timer service task only wakes it up, so the other timers don't
+   wait for the drives */
+static void cache_work ( void *pvParameters )
+{
+	DWORD first, last;
+
+	(void)pvParameters;
+	for ( ;; )
+	{
+		ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+		cache_lock();
+		cache_expire();
+		first = cache_ahead[ 0 ];
+		last = cache_ahead[ 1 ];
+		cache_ahead[ 1 ] = 0;
+		if ( last != 0 )
+			cache_prefetch( cache_ahead_drv, first, last );
+		cache_unlock();
+	}
+}
+#endif
+
+/* Passes the sectors to the cache task (a newer hint replaces the pending one),
+   without timers or before scheduler is started they are read at once */
+static DRESULT cache_read_ahead ( BYTE drv, DWORD first, DWORD last )
+{
+#if configUSE_TIMERS
+	if ( xTaskGetSchedulerState() == taskSCHEDULER_RUNNING )
+	{
+		cache_spawn();
+		if ( cache_task != NULL )
+		{
+			cache_ahead[ 0 ] = first;
+			cache_ahead[ 1 ] = last;
+			cache_ahead_drv = drv;
+			xTaskNotifyGive( cache_task );
+			return RES_OK;
+		}
+	}
+#endif
+	return cache_prefetch( drv, first, last );
+}
+
+/* Pins the sector in its slot for a view of the data, the sector is read if it isn't cached */
+static DRESULT cache_pin ( BYTE drv, DISK_PIN *pin )
+{
+	DRESULT res = RES_OK;
+	BYTE s = cache_find( drv, pin->sector );
+
+	if ( s != CACHE_NONE )
+		++cache_stats[ 0 ];
+	else
+	{
+		s = cache_claim( drv, pin->sector );
+		if ( s == CACHE_NONE )
+			return RES_NOTRDY;		/* each slot is pinned, the caller reads a copy */
+		if ( cache2_load( drv, pin->sector, cache_data[ s ] ) )
+		{
+			++cache_stats[ 0 ];
+			++cache_stats[ 2 ];
+		}
+		else
+		{
+			++cache_stats[ 1 ];
+			res = drivers[ drv ].read( drv, cache_data[ s ], pin->sector, 1 );
+		}
+		if ( res != RES_OK )
+		{
+			cache_drop( s );
+			return res;
+		}
+	}
+	if ( cache_slot[ s ].pins == 0xFF )
+		return RES_NOTRDY;
+	++cache_slot[ s ].pins;
+	pin->slot = s;
+	pin->data = cache_data[ s ];
+	return RES_OK;
+}
+
+#if _READONLY == 0
+/* Writes sectors through the cache according to CACHE_POLICY */
+static DRESULT cache_write ( BYTE drv, const BYTE *buff, DWORD sector, UINT count )
+{
+	DRESULT res = RES_OK;
+	UINT i;
+	BYTE s;
+
+	cache_lock();
+	cache_expire();
+	for ( i = 0; i < count; ++i )
+		cache2_drop( drv, sector + i );
+	if ( CACHE_POLICY == CACHE_WRITE_THROUGH || count > CACHE_MAX_RUN || cache_slots == 0 )
+	{
+		res = drivers[ drv ].write( drv, buff, sector, count );
+		/* cached copies are the same as the drive now */
+		for ( i = 0; i < count; ++i )
+		{
+			s = cache_find( drv, sector + i );
+			if ( s == CACHE_NONE )
+				continue;
+			if ( res == RES_OK )
+				cache_store( drv, sector + i, buff + i * _MAX_SS, CACHE_CLEAN );
+			else
+				cache_drop( s );
+		}
+	}
+	else
+	{
+		for ( i = 0; i < count && res == RES_OK; ++i )
+			res = cache_store( drv, sector + i, buff + i * _MAX_SS, CACHE_DIRTY );
+	}
+	cache_unlock();
+	return res;
+}
+#endif /* _READONLY */
+
+/* Handles control codes which concern cached sectors before the drive gets them */
+static DRESULT cache_ioctl ( BYTE drv, BYTE ctrl, void *buff )
+{
+	DRESULT res = RES_OK;
+	BYTE i, own = 0;
+
+	cache_lock();
+	switch ( ctrl )
+	{
+#if _READONLY == 0
+	case CTRL_SYNC:
+		res = cache_flush( drv );
+		break;
+#endif
+	case CTRL_ERASE_SECTOR:		/* freed sectors don't have to be written */
+	case CTRL_CACHE_DROP:		/* sectors were written around the cache */
+		for ( i = 0; i < cache_slots; ++i )
+		{
+			if ( cache_slot[ i ].state != CACHE_FREE && drivers[ cache_slot[ i ].drv ].medium == drivers[ drv ].medium &&
+					cache_slot[ i ].sector >= ((DWORD*)buff)[ 0 ] && cache_slot[ i ].sector <= ((DWORD*)buff)[ 1 ] )
+				cache_drop( i );
+		}
+		cache2_drop_range( drv, ((DWORD*)buff)[ 0 ], ((DWORD*)buff)[ 1 ] );
+		own = ( ctrl == CTRL_CACHE_DROP );
+		break;
+	case CTRL_CACHE_PREFETCH:
+		res = cache_prefetch( drv, ((DWORD*)buff)[ 0 ], ((DWORD*)buff)[ 1 ] );
+		own = 1;
+		break;
+	case CTRL_CACHE_READ_AHEAD:
+		res = cache_read_ahead( drv, ((DWORD*)buff)[ 0 ], ((DWORD*)buff)[ 1 ] );
+		own = 1;
+		break;
+	case CTRL_CACHE_PIN:
+		res = cache_pin( drv, (DISK_PIN*)buff );
+		own = 1;
+		break;
+	case CTRL_CACHE_UNPIN:		/* the slot may be dropped already (medium change), it is free then */
+		i = ((DISK_PIN*)buff)->slot;
+		if ( i < cache_slots && cache_slot[ i ].pins )
+			--cache_slot[ i ].pins;
+		else
+			res = RES_PARERR;
+		own = 1;
+		break;
+	case CTRL_CACHE_STATS:
+		((DWORD*)buff)[ 0 ] = cache_stats[ 0 ];
+		((DWORD*)buff)[ 1 ] = cache_stats[ 1 ];
+		((DWORD*)buff)[ 2 ] = cache_stats[ 2 ];
+		own = 1;
+		break;
+	}
+	cache_unlock();
+	if ( res != RES_OK || own )
+		return res;
+	return drivers[ drv ].ioctl( drv, ctrl, buff );
+}
+#endif /* USE_DISK_CACHE */
+
+#ifdef USE_POWER_FAIL
+/*-----------------------------------------------------------------------*/
+/* Power failure                                                         */
+/*-----------------------------------------------------------------------*/
+
+static volatile BYTE disk_power;			/* DISK_POWER_* (CTRL_POWER_FAIL) */
+static xTaskHandle disk_power_task;			/* Task which commits the volumes in DISK_POWER_HOLD */
+
+/* Writes are refused once the emergency path has started, except its own ones until the end */
+#define disk_power_denied()		( disk_power != DISK_POWER_ON && \
+		( disk_power == DISK_POWER_DOWN || xTaskGetCurrentTaskHandle() != disk_power_task ) )
+
+/* Sets power state of all drives. Syncs of FatFs in DISK_POWER_HOLD are gathered into one
+   flush of the cache on DISK_POWER_DOWN (sectors of a medium in ascending order, adjacent
+   ones in one request), then each drive is synced: SD I/O task closes its write stream
+   and writes its buffer. The writer holding a volume doesn't wait: its write fails. */
+static DRESULT disk_power_set ( BYTE state )
+{
+	DRESULT res = RES_OK;
+	BYTE drv;
+
+	if ( state > DISK_POWER_DOWN )
+		return RES_PARERR;
+	disk_power_task = xTaskGetCurrentTaskHandle();
+	if ( state == DISK_POWER_DOWN )
+	{
+#ifdef USE_DISK_CACHE
+		cache_lock();
+		res = cache_flush_all();
+		cache_unlock();
+#endif /* USE_DISK_CACHE */
+		for ( drv = 0; drv < DISK_DRIVES; ++drv )
+		{
+			if ( !( drivers[ drv ].status( drv ) & STA_NOINIT ) && drivers[ drv ].ioctl( drv, CTRL_SYNC, 0 ) != RES_OK )
+				res = RES_ERROR;
+		}
+	}
+	disk_power = state;
+	return res;
+}
+#endif /* USE_POWER_FAIL */
 
 /*-----------------------------------------------------------------------*/
 /* Initialize a Drive                                                    */
@@ -17,16 +1691,9 @@ DSTATUS disk_initialize (
 	BYTE drv				/* Physical drive number (0..) */
 )
 {
-	if ( drv )
-		return STA_NOINIT;
-
-	if ( SD_Detect() == SD_NOT_PRESENT )
-		return STA_NODISK;
-
-	if ( SD_Init() != SD_RESPONSE_NO_ERROR )
+	if ( drv >= DISK_DRIVES )
 		return STA_NOINIT;
-
-	return 0;
+	return drivers[ drv ].initialize( drv );
 }
 
 /*-----------------------------------------------------------------------*/
@@ -36,9 +1703,9 @@ DSTATUS disk_status (
 	BYTE drv		/* Physical drive number (0..) */
 )
 {
-	if ( drv )
+	if ( drv >= DISK_DRIVES )
 		return STA_NOINIT;
-	return 0;
+	return drivers[ drv ].status( drv );
 }
 
 /*-----------------------------------------------------------------------*/
@@ -48,21 +1715,16 @@ DRESULT disk_read (
 	BYTE drv,		/* Physical drive number (0..) */
 	BYTE *buff,		/* Data buffer to store read data */
 	DWORD sector,	/* Sector address (LBA) */
-	BYTE count		/* Number of sectors to read (1..255) */
+	UINT count		/* Number of sectors to read (1..) */
 )
 {
-	DRESULT res;
-	if ( drv || !count )
+	if ( drv >= DISK_DRIVES || !count )
 		return RES_PARERR;
-
-	if ( count == 1 )
-		res = (DRESULT)SD_SectorRead( sector, buff );
-	else
-		res = (DRESULT)SD_SectorsRead( sector, buff, count );
-
-	if ( res == 0x00 )
-		return RES_OK;
-	return RES_ERROR;
+#ifdef USE_DISK_CACHE
+	return cache_read( drv, buff, sector, count );
+#else
+	return drivers[ drv ].read( drv, buff, sector, count );
+#endif /* USE_DISK_CACHE */
 }
 
 /*-----------------------------------------------------------------------*/
@@ -73,21 +1735,20 @@ DRESULT disk_write (
 	BYTE drv,			/* Physical drive number (0..) */
 	const BYTE *buff,	/* Data to be written */
 	DWORD sector,		/* Sector address (LBA) */
-	BYTE count			/* Number of sectors to write (1..255) */
+	UINT count			/* Number of sectors to write (1..) */
 )
 {
-	DRESULT res;
-	if ( drv || !count )
+	if ( drv >= DISK_DRIVES || !count )
 		return RES_PARERR;
-
-	if ( count == 1 )
-		res = (DRESULT)SD_SectorWrite( sector, buff );
-	else
-		res = (DRESULT)SD_SectorsWrite( sector, buff, count );
-
-	if ( res == 0 )
-		return RES_OK;
-	return RES_ERROR;
+#ifdef USE_POWER_FAIL
+	if ( disk_power_denied() )
+		return RES_WRPRT;
+#endif /* USE_POWER_FAIL */
+#ifdef USE_DISK_CACHE
+	return cache_write( drv, buff, sector, count );
+#else
+	return drivers[ drv ].write( drv, buff, sector, count );
+#endif /* USE_DISK_CACHE */
 }
 #endif /* _READONLY */
 
@@ -101,40 +1762,19 @@ DRESULT disk_ioctl (
 	void *buff		/* Buffer to send/receive control data */
 )
 {
-	SD_CardInfo cardinfo;
-	DRESULT res;
-	if ( drv )
+	if ( drv >= DISK_DRIVES )
 		return RES_PARERR;
-
-	switch( ctrl )
-	{
-	case CTRL_SYNC:
-//		res = ( SD_WaitReady() == SD_RESPONSE_NO_ERROR ) ? RES_OK : RES_ERROR
-		res = RES_OK;
-		break;
-	case GET_BLOCK_SIZE:
-		*(WORD*)buff = _MAX_SS;
-		res = RES_OK;
-		break;
-	case GET_SECTOR_COUNT:
-		if ( SD_GetCardInfo( &cardinfo ) != SD_RESPONSE_NO_ERROR )
-			res = RES_ERROR;
-		else
-		{
-			*(DWORD*)buff = cardinfo.CardCapacity;
-			res = ( *(DWORD*)buff > 0 ) ? RES_OK : RES_PARERR;
-		}
-		break;
-	case CTRL_ERASE_SECTOR:
-		res = ( SD_SectorsErase( ((DWORD*)buff)[ 0 ], ((DWORD*)buff)[ 1 ] ) == SD_RESPONSE_NO_ERROR )
-			? RES_OK : RES_PARERR;
-		break;
-	default:
-		res = RES_PARERR;
-		break;
-	}
-
-	return res;
+#ifdef USE_POWER_FAIL
+	if ( ctrl == CTRL_POWER_FAIL )
+		return disk_power_set( *(BYTE*)buff );
+	if ( ctrl == CTRL_SYNC && disk_power == DISK_POWER_HOLD )
+		return RES_OK;		/* DISK_POWER_DOWN writes them */
+#endif /* USE_POWER_FAIL */
+#ifdef USE_DISK_CACHE
+	return cache_ioctl( drv, ctrl, buff );
+#else
+	return drivers[ drv ].ioctl( drv, ctrl, buff );
+#endif /* USE_DISK_CACHE */
 }
 
 #if !_FS_READONLY
@@ -145,9 +1785,34 @@ DRESULT disk_ioctl (
  * +--------------------|-----------|--------------|--------------|-----------------|--------------+
  * |Year(0-127 org.1980)|Month(1-12)|   Day(1-31)  |  Hour(0-23)  |   Minute(0-59)  | Second(0-59) |
  * +-----------------------------------------------------------------------------------------------+
+ * The calendar keeps it packed (RTC wakeup interrupt), so updates of directory entries
+ * by f_sync and f_close don't touch the RTC.
  */
 DWORD get_fattime( void )
 {
+#ifdef USE_RTC_CALENDAR
+	return CALENDAR_GetFatTime();
+#else
 	return 0;
+#endif /* USE_RTC_CALENDAR */
+}
+
+/**
+ * Millisecond counter (used in ff.c for deferred directory entry and FSInfo updates)
+ */
+DWORD get_msec( void )
+{
+	return xTaskGetTickCount() * portTICK_RATE_MS;
 }
 #endif /* _FS_READONLY */
+
+#if _FS_STATS
+/**
+ * Core clock cycle counter (used in ff.c for counters of internal functions, the SD Card
+ * driver starts it on initialization)
+ */
+DWORD get_cycles( void )
+{
+	return DWT_GetCycles();
+}
+#endif /* _FS_STATS */
@@ -10,6 +10,12 @@
 #include "integer.h"
 
 
+/* SD Card blocks (512 bytes) in a sector of the disk functions: _MAX_SS above
+   512 presents larger logical sectors, each one moved by one multiple block
+   transfer (the volume has to be formatted with this sector size) */
+#define DISK_BLOCKS		( _MAX_SS / 512 )
+
+
 /* Status of Disk Functions */
 typedef BYTE	DSTATUS;
 
@@ -29,9 +35,9 @@ typedef enum {
 int assign_drives (int, int);
 DSTATUS disk_initialize (BYTE);
 DSTATUS disk_status (BYTE);
-DRESULT disk_read (BYTE, BYTE*, DWORD, BYTE);
+DRESULT disk_read (BYTE, BYTE*, DWORD, UINT);
 #if	_READONLY == 0
-DRESULT disk_write (BYTE, const BYTE*, DWORD, BYTE);
+DRESULT disk_write (BYTE, const BYTE*, DWORD, UINT);
 #endif
 DRESULT disk_ioctl (BYTE, BYTE, void*);
 
@@ -73,6 +79,34 @@ DRESULT disk_ioctl (BYTE, BYTE, void*);
 /* NAND specific ioctl command */
 #define NAND_FORMAT			30	/* Create physical format */
 
+/* Sector cache of diskio.c (USE_DISK_CACHE) */
+#define CTRL_CACHE_STATS	40	/* Get sector hits, misses and hits of the second tier since start (DWORD[3]) */
+#define CTRL_CACHE_DROP		41	/* Forget sectors written around diskio (DWORD[2]: first and last sector) */
+#define CTRL_CACHE_PREFETCH	42	/* Read sectors into the cache at once (DWORD[2]: first and last sector) */
+#define CTRL_CACHE_PIN		43	/* Keep the sector in a slot and get its data (DISK_PIN, sector is set) */
+#define CTRL_CACHE_UNPIN	44	/* Release the slot got by CTRL_CACHE_PIN (DISK_PIN) */
+#define CTRL_CACHE_READ_AHEAD	47	/* Read sectors into the cache in the background (DWORD[2]: first and last sector) */
+
+/* SD drives of diskio.c (USE_DISK_VERIFY, USE_DISK_REMAP) */
+#define CTRL_VERIFY			45	/* Set verify after write and get the previous setting (BYTE: 0 off, 1 on) */
+#define CTRL_REMAP			46	/* Attach bad block remap table (REMAP_Table of ffremap.h, NULL detaches it) */
+
+/* Power failure of diskio.c (USE_POWER_FAIL), the state is common to all drives */
+#define CTRL_POWER_FAIL		48	/* Set power state of the disks (BYTE: DISK_POWER_*) */
+
+/* Power states of the disks (CTRL_POWER_FAIL) */
+#define DISK_POWER_ON		0	/* Normal operation */
+#define DISK_POWER_HOLD		1	/* Writes of tasks other than the caller are refused, syncs wait for DISK_POWER_DOWN */
+#define DISK_POWER_DOWN		2	/* Dirty sectors are written and each drive is synced, then each write is refused */
+
+/* Sector pinned in the cache for reading without copy (CTRL_CACHE_PIN): the slot is not
+   replaced until each pin of it is released, writes of the sector update its data */
+typedef struct {
+	DWORD sector;		/* Sector number */
+	const BYTE *data;	/* Sector data in the slot */
+	BYTE slot;			/* Slot of the sector */
+} DISK_PIN;
+
 
 #define _DISKIO
 #endif
@@ -95,6 +95,10 @@
 #include "ff.h"			/* FatFs configurations and declarations */
 #include "diskio.h"		/* Declarations of low level disk I/O functions */
 
+#ifdef USE_FAST_IO_CODE
+#pragma GCC optimize ( "O2" )	/* file access is on the card I/O path (see main.h) */
+#endif
+
 
 /*--------------------------------------------------------------------------
 
@@ -120,9 +124,6 @@
 
 /* Reentrancy related */
 #if _FS_REENTRANT
-#if _USE_LFN == 1
-#error Static LFN work area must not be used in re-entrant configuration.
-#endif
 #define	ENTER_FF(fs)		{ if (!lock_fs(fs)) return FR_TIMEOUT; }
 #define	LEAVE_FF(fs, res)	{ unlock_fs(fs, res); return res; }
 #else
@@ -147,6 +148,15 @@ typedef struct {
 #endif
 
 
+/* Free cluster map */
+#if _FS_FMAP
+#define FMAP_GRP(fs,cl)		((cl) / (fs)->fmgrp)	/* Group of a cluster */
+#define FMAP_TEST(fs,cl)	((fs)->fmap[FMAP_GRP(fs,cl) / 8] & (1 << (FMAP_GRP(fs,cl) % 8)))
+#define FMAP_SET(fs,cl)		((fs)->fmap[FMAP_GRP(fs,cl) / 8] |= (BYTE)(1 << (FMAP_GRP(fs,cl) % 8)))
+#define FMAP_CLR(fs,cl)		((fs)->fmap[FMAP_GRP(fs,cl) / 8] &= (BYTE)~(1 << (FMAP_GRP(fs,cl) % 8)))
+#endif
+
+
 /* Misc definitions */
 #define LD_CLUST(dir)	(((DWORD)LD_WORD(dir+DIR_FstClusHI)<<16) | LD_WORD(dir+DIR_FstClusLO))
 #define ST_CLUST(dir,cl) {ST_WORD(dir+DIR_FstClusLO, cl); ST_WORD(dir+DIR_FstClusHI, (DWORD)cl>>16);}
@@ -426,6 +436,18 @@ typedef struct {
 #define BS_VolID32			67	/* Volume serial number (4) */
 #define BS_VolLab32			71	/* Volume label (8) */
 #define BS_FilSysType32		82	/* File system type (1) */
+#define BPB_ZeroedEx		11	/* exFAT: Must be zero (53) */
+#define BPB_TotSecEx		72	/* exFAT: Volume size [sector] (8) */
+#define BPB_FatOfsEx		80	/* exFAT: FAT offset from top of the volume [sector] (4) */
+#define BPB_FatSzEx			84	/* exFAT: FAT size [sector] (4) */
+#define BPB_DataOfsEx		88	/* exFAT: Data offset from top of the volume [sector] (4) */
+#define BPB_NumClusEx		92	/* exFAT: Number of clusters (4) */
+#define BPB_RootClusEx		96	/* exFAT: Root directory first cluster (4) */
+#define BPB_VolIDEx			100	/* exFAT: Volume serial number (4) */
+#define BPB_FSVerEx			104	/* exFAT: File system version (2) */
+#define BPB_BytsPerSecEx	108	/* exFAT: Log2 of sector size in unit of byte (1) */
+#define BPB_SecPerClusEx	109	/* exFAT: Log2 of cluster size in unit of sector (1) */
+#define BPB_NumFATsEx		110	/* exFAT: Number of FATs (1) */
 #define	FSI_LeadSig			0	/* FSI: Leading signature (4) */
 #define	FSI_StrucSig		484	/* FSI: Structure signature (4) */
 #define	FSI_Free_Count		488	/* FSI: Number of free clusters (4) */
@@ -449,6 +471,26 @@ typedef struct {
 #define	LDIR_Type			12	/* LFN type (1) */
 #define	LDIR_Chksum			13	/* Sum of corresponding SFN entry */
 #define	LDIR_FstClusLO		26	/* Filled by zero (0) */
+#define	XDIR_Type			0	/* exFAT: Type of exFAT directory entry (1) */
+#define	XDIR_NumSec			1	/* exFAT: Number of secondary entries (1) */
+#define	XDIR_SetSum			2	/* exFAT: Sum of the set of directory entries (2) */
+#define	XDIR_Attr			4	/* exFAT: File attribute (2) */
+#define	XDIR_CrtTime		8	/* exFAT: Created time (4) */
+#define	XDIR_ModTime		12	/* exFAT: Modified time (4) */
+#define	XDIR_AccTime		16	/* exFAT: Last accessed time (4) */
+#define	XDIR_CrtTime10		20	/* exFAT: Created time subsecond (1) */
+#define	XDIR_ModTime10		21	/* exFAT: Modified time subsecond (1) */
+#define	XDIR_CrtTZ			22	/* exFAT: Created timezone (1) */
+#define	XDIR_ModTZ			23	/* exFAT: Modified timezone (1) */
+#define	XDIR_AccTZ			24	/* exFAT: Last accessed timezone (1) */
+#define	XDIR_GenFlags		33	/* exFAT: General secondary flags of the stream entry (1) */
+#define	XDIR_NumName		35	/* exFAT: Number of file name characters (1) */
+#define	XDIR_NameHash		36	/* exFAT: Hash of file name (2) */
+#define XDIR_ValidFileSize	40	/* exFAT: Valid file size (8) */
+#define	XDIR_FstClus		52	/* exFAT: First cluster of the file data (4) */
+#define	XDIR_FileSize		56	/* exFAT: File/Directory size (8) */
+#define	XDIR_BmpFstClus		20	/* exFAT: First cluster of the allocation bitmap in its entry (4) */
+#define	XDIR_BmpSize		24	/* exFAT: Size of the allocation bitmap in its entry (8) */
 #define	SZ_DIR				32		/* Size of a directory entry */
 #define	LLE					0x40	/* Last long entry flag in LDIR_Ord */
 #define	DDE					0xE5	/* Deleted directory enrty mark in DIR_Name[0] */
@@ -489,9 +531,14 @@ FILESEM	Files[_FS_SHARE];	/* File lock semaphores */
 #define	FREE_BUF()
 
 #elif _USE_LFN == 1			/* LFN feature with static working buffer */
+#if _FS_REENTRANT				/* One buffer in each file system object, used under its lock */
+#define	DEF_NAMEBUF			BYTE sfn[12]
+#define INIT_BUF(dobj)		{ (dobj).fn = sfn; (dobj).lfn = (dobj).fs->lfnbuf; }
+#else
 static WCHAR LfnBuf[_MAX_LFN+1];
 #define	DEF_NAMEBUF			BYTE sfn[12]
 #define INIT_BUF(dobj)		{ (dobj).fn = sfn; (dobj).lfn = LfnBuf; }
+#endif
 #define	FREE_BUF()
 
 #elif _USE_LFN == 2 		/* LFN feature with dynamic working buffer on the stack */
@@ -510,6 +557,23 @@ static WCHAR LfnBuf[_MAX_LFN+1];
 #error Wrong LFN configuration.
 #endif
 
+#if _FS_STATS
+static
+FFSTAT Stats[FFS_COUNT];	/* Counters of internal functions */
+
+static
+DWORD StatSects;		/* Sectors transferred by disk functions so far */
+
+/* Count a call of an internal function with the sectors and cycles of nested calls.
+   Each function gets its macro right after its body, so calls from later code are counted. */
+#define	STAT_CALL(id, call)		({ DWORD st_c = get_cycles(), st_s = StatSects; \
+								   __typeof__(call) st_r = (call); \
+								   Stats[id].calls++; Stats[id].sectors += StatSects - st_s; \
+								   Stats[id].cycles += get_cycles() - st_c; st_r; })
+#define	disk_read(d, b, s, n)	STAT_CALL(FFS_DISK_READ, (StatSects += (n), (disk_read)(d, b, s, n)))
+#define	disk_write(d, b, s, n)	STAT_CALL(FFS_DISK_WRITE, (StatSects += (n), (disk_write)(d, b, s, n)))
+#endif
+
 
 
 
@@ -524,19 +588,71 @@ static WCHAR LfnBuf[_MAX_LFN+1];
 /* String functions                                                      */
 /*-----------------------------------------------------------------------*/
 
+#if defined(__GNUC__) && defined(__ARM_FEATURE_UNALIGNED)
+/* Word at any address: a single LDR (never merged into LDM/LDRD, which fault if unaligned) */
+typedef struct { UINT w; } __attribute__((packed)) MEM_UWORD;
+#define MEM_LDU(p)	(((const MEM_UWORD*)(p))->w)
+#define MEM_UNALIGNED	1
+#else
+#define MEM_UNALIGNED	0
+#endif
+
+/* First four bytes of a name (SFN pre-check of directory search) */
+#if MEM_UNALIGNED
+#define LD_HEAD(p)	MEM_LDU(p)
+#else
+#define LD_HEAD(p)	LD_DWORD(p)
+#endif
+
+#if _USE_LIBC_MEM
+#include <string.h>
+#define mem_cpy(dst,src,cnt)	memcpy(dst,src,cnt)
+#define mem_set(dst,val,cnt)	memset(dst,val,cnt)
+#define mem_cmp(dst,src,cnt)	memcmp(dst,src,cnt)
+#else
+
+#define MEM_WSZ		sizeof(UINT)	/* Bytes of a word */
+#define MEM_ALIGNED(p)	(!((unsigned long)(p) & (MEM_WSZ - 1)))
+
 /* Copy memory to memory */
 static
 void mem_cpy (void* dst, const void* src, UINT cnt) {
 	BYTE *d = (BYTE*)dst;
 	const BYTE *s = (const BYTE*)src;
+	UINT *dw;
+	const UINT *sw;
+	UINT w0, w1, w2, w3;
 
-#if _WORD_ACCESS == 1
-	while (cnt >= sizeof(int)) {
-		*(int*)d = *(int*)s;
-		d += sizeof(int); s += sizeof(int);
-		cnt -= sizeof(int);
-	}
+	if (cnt >= 2 * MEM_WSZ && (MEM_UNALIGNED || !(((unsigned long)d ^ (unsigned long)s) & (MEM_WSZ - 1)))) {
+		while (!MEM_ALIGNED(d)) {	/* Align the destination */
+			*d++ = *s++; cnt--;
+		}
+		dw = (UINT*)d;
+		if (MEM_ALIGNED(s)) {		/* Both aligned: four words per step (LDM/STM) */
+			sw = (const UINT*)s;
+			for (; cnt >= 4 * MEM_WSZ; cnt -= 4 * MEM_WSZ) {
+				w0 = sw[0]; w1 = sw[1]; w2 = sw[2]; w3 = sw[3];
+				dw[0] = w0; dw[1] = w1; dw[2] = w2; dw[3] = w3;
+				dw += 4; sw += 4;
+			}
+			for (; cnt >= MEM_WSZ; cnt -= MEM_WSZ)
+				*dw++ = *sw++;
+			s = (const BYTE*)sw;
+		}
+#if MEM_UNALIGNED
+		else {						/* Unaligned source: word loads at any address */
+			for (; cnt >= 4 * MEM_WSZ; cnt -= 4 * MEM_WSZ) {
+				w0 = MEM_LDU(s); w1 = MEM_LDU(s + MEM_WSZ); w2 = MEM_LDU(s + 2 * MEM_WSZ); w3 = MEM_LDU(s + 3 * MEM_WSZ);
+				dw[0] = w0; dw[1] = w1; dw[2] = w2; dw[3] = w3;
+				dw += 4; s += 4 * MEM_WSZ;
+			}
+			for (; cnt >= MEM_WSZ; cnt -= MEM_WSZ) {
+				*dw++ = MEM_LDU(s); s += MEM_WSZ;
+			}
+		}
 #endif
+		d = (BYTE*)dw;
+	}
 	while (cnt--)
 		*d++ = *s++;
 }
@@ -545,7 +661,23 @@ void mem_cpy (void* dst, const void* src, UINT cnt) {
 static
 void mem_set (void* dst, int val, UINT cnt) {
 	BYTE *d = (BYTE*)dst;
+	UINT *dw;
+	UINT w;
 
+	if (cnt >= 2 * MEM_WSZ) {
+		while (!MEM_ALIGNED(d)) {	/* Align the destination */
+			*d++ = (BYTE)val; cnt--;
+		}
+		w = (BYTE)val * (~0U / 0xFF);	/* The byte in each byte of the word */
+		dw = (UINT*)d;
+		for (; cnt >= 4 * MEM_WSZ; cnt -= 4 * MEM_WSZ) {	/* Four words per step (STM) */
+			dw[0] = w; dw[1] = w; dw[2] = w; dw[3] = w;
+			dw += 4;
+		}
+		for (; cnt >= MEM_WSZ; cnt -= MEM_WSZ)
+			*dw++ = w;
+		d = (BYTE*)dw;
+	}
 	while (cnt--)
 		*d++ = (BYTE)val;
 }
@@ -556,9 +688,24 @@ int mem_cmp (const void* dst, const void* src, UINT cnt) {
 	const BYTE *d = (const BYTE *)dst, *s = (const BYTE *)src;
 	int r = 0;
 
+	if (cnt >= 2 * MEM_WSZ && (MEM_UNALIGNED || !(((unsigned long)d ^ (unsigned long)s) & (MEM_WSZ - 1)))) {
+		while (!MEM_ALIGNED(d)) {	/* Align the first buffer */
+			if ((r = *d++ - *s++) != 0) return r;
+			cnt--;
+		}
+		for (; cnt >= MEM_WSZ; cnt -= MEM_WSZ) {	/* Skip equal words, the bytes below find the difference */
+#if MEM_UNALIGNED
+			if (*(const UINT*)d != MEM_LDU(s)) break;
+#else
+			if (*(const UINT*)d != *(const UINT*)s) break;
+#endif
+			d += MEM_WSZ; s += MEM_WSZ;
+		}
+	}
 	while (cnt-- && (r = *d++ - *s++) == 0) ;
 	return r;
 }
+#endif /* _USE_LIBC_MEM */
 
 /* Check if chr is contained in the string */
 static
@@ -711,6 +858,202 @@ void clear_lock (	/* Clear lock entries of the volume */
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Write back a sector of the window or the cache                        */
+/*-----------------------------------------------------------------------*/
+#if !_FS_READONLY
+static
+FRESULT write_sect (
+	FATFS *fs,			/* File system object */
+	const BYTE *buf,	/* Sector data */
+	DWORD sect			/* Sector number */
+)
+{
+	BYTE nf;
+
+
+	if (disk_write(fs->drv, buf, sect, 1) != RES_OK)
+		return FR_DISK_ERR;
+	if (sect < (fs->fatbase + fs->fsize)) {	/* In FAT area */
+		for (nf = fs->n_fats; nf > 1; nf--) {	/* Reflect the change to all FAT copies */
+			sect += fs->fsize;
+			disk_write(fs->drv, buf, sect, 1);
+		}
+	}
+	return FR_OK;
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Sector cache behind the window                                        */
+/*-----------------------------------------------------------------------*/
+#if _FS_CACHE
+
+/* Get range of cache entries (way) for a sector */
+static
+void cache_way (
+	FATFS *fs,		/* File system object */
+	DWORD sect,		/* Sector number */
+	UINT *first,	/* First entry of the way */
+	UINT *last		/* Entry next to the way */
+)
+{
+	if (sect < fs->fatbase + fs->fsize * fs->n_fats) {			/* Reserved and FAT area */
+		*first = 0;
+		*last = _FS_CACHE_FAT;
+	} else if (fs->fs_type < FS_FAT32 && sect < fs->database) {	/* Root directory (FAT12/16) */
+		*first = _FS_CACHE_FAT;
+		*last = _FS_CACHE_FAT + _FS_CACHE_DIR;
+	} else {	/* Data area (FAT32/exFAT directories are in it, so data takes the root directory way too) */
+		*first = (fs->fs_type >= FS_FAT32) ? _FS_CACHE_FAT : _FS_CACHE_FAT + _FS_CACHE_DIR;
+		*last = _FS_CACHE;
+	}
+}
+
+
+/* Keep the window in the cache (it becomes free to load other sector) */
+static
+FRESULT cache_put (	/* FR_OK: successful, FR_DISK_ERR: failed */
+	FATFS *fs		/* File system object */
+)
+{
+	UINT i, n, v;
+	FCACHE *c;
+
+
+	cache_way(fs, fs->winsect, &i, &n);
+	if (i == n) {	/* No way for this sector, write it back if needed */
+		return (fs->wflag) ? write_sect(fs, fs->win, fs->winsect) : FR_OK;
+	}
+	for (v = i; i < n; i++) {	/* Find the stale copy of the sector, an empty entry or the least recently used one */
+		c = &fs->cache[i];
+		if (c->sect == fs->winsect) { v = i; break; }
+		if (!c->sect || (fs->cache[v].sect && c->age < fs->cache[v].age)) v = i;
+	}
+	c = &fs->cache[v];
+	if (c->dirty && c->sect != fs->winsect) {	/* Write back the replaced sector */
+		if (write_sect(fs, c->buf, c->sect) != FR_OK)
+			return FR_DISK_ERR;
+	}
+	mem_cpy(c->buf, fs->win, SS(fs));
+	c->sect = fs->winsect;
+	c->dirty = fs->wflag;
+	c->age = ++fs->cage;
+	fs->wflag = 0;
+	return FR_OK;
+}
+
+
+/* Load a sector to the window from the cache */
+static
+int cache_get (	/* 1: loaded, 0: the sector is not in the cache */
+	FATFS *fs,		/* File system object */
+	DWORD sect		/* Sector number */
+)
+{
+	UINT i;
+	FCACHE *c;
+
+
+	for (i = 0; i < _FS_CACHE; i++) {
+		c = &fs->cache[i];
+		if (c->sect == sect) {	/* The sector moves to the window with its dirty flag */
+			mem_cpy(fs->win, c->buf, SS(fs));
+			fs->wflag = c->dirty;
+			c->sect = 0;
+			c->dirty = 0;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/* Forget cached copies of sectors overwritten on the disk */
+static
+void cache_drop (
+	FATFS *fs,		/* File system object */
+	DWORD sect,		/* First sector number */
+	DWORD cnt		/* Number of sectors */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < _FS_CACHE; i++) {
+		if (fs->cache[i].sect && fs->cache[i].sect - sect < cnt) {
+			fs->cache[i].sect = 0;
+			fs->cache[i].dirty = 0;
+		}
+	}
+}
+
+
+/* Replace sectors read from the disk with dirty cached ones */
+static
+void cache_fix (
+	FATFS *fs,		/* File system object */
+	BYTE *buf,		/* Sectors read from the disk */
+	DWORD sect,		/* First sector number */
+	DWORD cnt		/* Number of sectors */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < _FS_CACHE; i++) {
+		if (fs->cache[i].dirty && fs->cache[i].sect - sect < cnt)
+			mem_cpy(buf + (fs->cache[i].sect - sect) * SS(fs), fs->cache[i].buf, SS(fs));
+	}
+}
+
+
+/* Write back all dirty cached sectors in order of sector numbers */
+static
+FRESULT cache_flush (	/* FR_OK: successful, FR_DISK_ERR: failed */
+	FATFS *fs		/* File system object */
+)
+{
+	UINT i, n;
+
+
+	for (;;) {
+		for (n = _FS_CACHE, i = 0; i < _FS_CACHE; i++) {
+			if (fs->cache[i].dirty && (n == _FS_CACHE || fs->cache[i].sect < fs->cache[n].sect)) n = i;
+		}
+		if (n == _FS_CACHE) return FR_OK;
+		if (write_sect(fs, fs->cache[n].buf, fs->cache[n].sect) != FR_OK)
+			return FR_DISK_ERR;
+		fs->cache[n].dirty = 0;
+	}
+}
+
+
+#if _FS_TINY
+/* Move window to a sector which is going to be overwritten entirely (not read) */
+static
+FRESULT fresh_window (	/* FR_OK: successful, FR_DISK_ERR: failed */
+	FATFS *fs,		/* File system object */
+	DWORD sector	/* Sector number to make appearance in the fs->win[] */
+)
+{
+	if (fs->winsect != sector) {
+		if (fs->winsect && cache_put(fs) != FR_OK)
+			return FR_DISK_ERR;
+		cache_drop(fs, sector, 1);
+		fs->winsect = sector;
+	}
+	return FR_OK;
+}
+#endif	/* _FS_TINY */
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Change window offset                                                  */
 /*-----------------------------------------------------------------------*/
@@ -726,29 +1069,126 @@ FRESULT move_window (
 
 	wsect = fs->winsect;
 	if (wsect != sector) {	/* Changed current window */
+#if _FS_CACHE
+		if (sector && wsect) {	/* Keep leaving sector in the cache, dirty one is written back later */
+			if (cache_put(fs) != FR_OK)
+				return FR_DISK_ERR;
+		}
+#endif
 #if !_FS_READONLY
 		if (fs->wflag) {	/* Write back dirty window if needed */
-			if (disk_write(fs->drv, fs->win, wsect, 1) != RES_OK)
+			if (write_sect(fs, fs->win, wsect) != FR_OK)
 				return FR_DISK_ERR;
 			fs->wflag = 0;
-			if (wsect < (fs->fatbase + fs->fsize)) {	/* In FAT area */
-				BYTE nf;
-				for (nf = fs->n_fats; nf > 1; nf--) {	/* Reflect the change to all FAT copies */
-					wsect += fs->fsize;
-					disk_write(fs->drv, fs->win, wsect, 1);
-				}
-			}
+#if _FS_CACHE
+			cache_drop(fs, wsect, 1);	/* Cached copy is stale */
+#endif
 		}
 #endif
 		if (sector) {
-			if (disk_read(fs->drv, fs->win, sector, 1) != RES_OK)
+#if _FS_CACHE
+			if (!cache_get(fs, sector))
+#endif
+			if (disk_read(fs->drv, fs->win, sector, 1) != RES_OK) {
+				fs->winsect = 0;	/* Window holds a part of the failed read, not the previous sector */
 				return FR_DISK_ERR;
+			}
 			fs->winsect = sector;
 		}
 	}
 
 	return FR_OK;
 }
+#if _FS_STATS
+#define	move_window(fs, sect)	STAT_CALL(FFS_MOVE_WINDOW, (move_window)(fs, sect))
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Change FAT window offset                                              */
+/*-----------------------------------------------------------------------*/
+/* FAT and allocation bitmap sectors go through FAT_WIN(fs). With _FS_FATWIN
+/  it is the fatwin[], so data and directory sectors moving through the win[]
+/  do not evict the current FAT sector (tiny cfg), else it is the win[]. */
+
+#if _FS_FATWIN
+static
+FRESULT move_fatwin (
+	FATFS *fs,		/* File system object */
+	DWORD sector	/* Sector number to make appearance in the fs->fatwin[] */
+)					/* Move to zero only writes back dirty window */
+{
+	if (fs->fatsect != sector) {	/* Changed current window */
+#if !_FS_READONLY
+		if (fs->fwflag) {	/* Write back dirty window if needed (to all FAT copies) */
+			if (write_sect(fs, fs->fatwin, fs->fatsect) != FR_OK)
+				return FR_DISK_ERR;
+			fs->fwflag = 0;
+		}
+#endif
+		if (sector) {
+			if (disk_read(fs->drv, fs->fatwin, sector, 1) != RES_OK) {
+				fs->fatsect = 0;	/* Window holds a part of the failed read, not the previous sector */
+				return FR_DISK_ERR;
+			}
+			fs->fatsect = sector;
+		}
+	}
+
+	return FR_OK;
+}
+#if _FS_STATS
+#define	move_fatwin(fs, sect)	STAT_CALL(FFS_MOVE_FATWIN, (move_fatwin)(fs, sect))
+#endif
+#define	FAT_WIN(fs)		((fs)->fatwin)
+#define	FAT_SECT(fs)	((fs)->fatsect)
+#define	FAT_DIRTY(fs)	((fs)->fwflag)
+#else
+#define	move_fatwin(fs, sect)	move_window(fs, sect)
+#define	FAT_WIN(fs)		((fs)->win)
+#define	FAT_SECT(fs)	((fs)->winsect)
+#define	FAT_DIRTY(fs)	((fs)->wflag)
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Store snapshot of the volume state (flushed to the disk)              */
+/*-----------------------------------------------------------------------*/
+#if _FS_WARM
+static
+void state_save (
+	FATFS *fs	/* File system object */
+)
+{
+	FFSTATE *st;
+	BYTE vol;
+
+
+	if (!fs->st_ok) return;				/* The drive can't be identified */
+	for (vol = 0; vol < _VOLUMES && FatFs[vol] != fs; vol++) ;
+	if (vol == _VOLUMES) return;
+	st = ff_state_begin(vol);
+	if (!st) return;
+	mem_cpy(st->cid, fs->st_cid, sizeof(st->cid));
+	st->volid = fs->st_volid;
+	st->bsect = fs->st_bsect;
+	st->n_fatent = fs->n_fatent;
+	st->database = fs->database;
+	st->last_clust = fs->last_clust;
+	st->free_clust = fs->free_clust;
+	st->fsi_free = fs->st_fsi_free;
+	st->fsi_next = fs->st_fsi_next;
+	st->cold = 0;
+#if _FS_FMAP
+	mem_cpy(st->fmap, fs->fmap, _FS_FMAP);
+#endif
+	ff_state_end(vol);
+}
+#endif
 
 
 
@@ -759,16 +1199,31 @@ FRESULT move_window (
 #if !_FS_READONLY
 static
 FRESULT sync (	/* FR_OK: successful, FR_DISK_ERR: failed */
-	FATFS *fs	/* File system object */
+	FATFS *fs,	/* File system object */
+	BYTE fsi	/* FSInfo update: 0:Leave it pending, 1:When it is due, 2:Now */
 )
 {
 	FRESULT res;
 
 
+#if _FS_FSYNC
+	if (fsi == 1 && get_msec() - fs->fsi_time < _FS_FSI_SYNC_MS)
+		fsi = 0;	/* FSInfo update is not due yet */
+#endif
+#if _FS_FATWIN
+	res = move_fatwin(fs, 0);	/* FAT first, the directory entry may link to the new chain */
+	if (res == FR_OK)
+		res = move_window(fs, 0);
+#else
 	res = move_window(fs, 0);
+#endif
+#if _FS_CACHE
+	if (res == FR_OK)
+		res = cache_flush(fs);
+#endif
 	if (res == FR_OK) {
 		/* Update FSInfo sector if needed */
-		if (fs->fs_type == FS_FAT32 && fs->fsi_flag) {
+		if (fs->fs_type == FS_FAT32 && fs->fsi_flag && fsi) {
 			fs->winsect = 0;
 			/* Create FSInfo structure */
 			mem_set(fs->win, 0, 512);
@@ -780,14 +1235,28 @@ FRESULT sync (	/* FR_OK: successful, FR_DISK_ERR: failed */
 			/* Write it into the FSInfo sector */
 			disk_write(fs->drv, fs->win, fs->fsi_sector, 1);
 			fs->fsi_flag = 0;
+#if _FS_WARM
+			fs->st_fsi_free = fs->free_clust;
+			fs->st_fsi_next = fs->last_clust;
+#endif
+#if _FS_FSYNC
+			fs->fsi_time = get_msec();
+#endif
 		}
 		/* Make sure that no pending write process in the physical drive */
 		if (disk_ioctl(fs->drv, CTRL_SYNC, 0) != RES_OK)
 			res = FR_DISK_ERR;
 	}
+#if _FS_WARM
+	if (res == FR_OK)
+		state_save(fs);		/* The disk matches the volume state */
+#endif
 
 	return res;
 }
+#if _FS_STATS
+#define	sync(fs, fsi)	STAT_CALL(FFS_SYNC, (sync)(fs, fsi))
+#endif
 #endif
 
 
@@ -815,6 +1284,15 @@ DWORD clust2sect (	/* !=0: Sector number, 0: Failed - invalid cluster# */
 /* FAT access - Read value of a FAT entry                                */
 /*-----------------------------------------------------------------------*/
 
+/* FAT32 entry in the win[]: word aligned, as the win[] follows DWORD members of the FATFS */
+#if defined __BYTE_ORDER__ && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && __SIZEOF_INT__ == 4
+#define LD_FAT32(p)		(*(UINT*)(void*)(p) & 0x0FFFFFFF)
+#define ST_FAT32(p,v)	(*(UINT*)(void*)(p) = (*(UINT*)(void*)(p) & 0xF0000000) | (UINT)(v))
+#else
+#define LD_FAT32(p)		(LD_DWORD(p) & 0x0FFFFFFF)
+#define ST_FAT32(p,v)	ST_DWORD(p, (LD_DWORD(p) & 0xF0000000) | (v))
+#endif
+
 
 DWORD get_fat (	/* 0xFFFFFFFF:Disk error, 1:Internal error, Else:Cluster status */
 	FATFS *fs,	/* File system object */
@@ -822,34 +1300,85 @@ DWORD get_fat (	/* 0xFFFFFFFF:Disk error, 1:Internal error, Else:Cluster status
 )
 {
 	UINT wc, bc;
+	DWORD sect;
 	BYTE *p;
 
 
 	if (clst < 2 || clst >= fs->n_fatent)	/* Chack range */
 		return 1;
 
+	if (fs->fs_type == FS_FAT32) {	/* The most frequent case first, no call if the entry is in the window */
+		sect = fs->fatbase + (clst / (SS(fs) / 4));
+		if (sect != FAT_SECT(fs) && move_fatwin(fs, sect)) return 0xFFFFFFFF;
+		return LD_FAT32(&FAT_WIN(fs)[clst * 4 % SS(fs)]);
+	}
+
 	switch (fs->fs_type) {
 	case FS_FAT12 :
 		bc = (UINT)clst; bc += bc / 2;
-		if (move_window(fs, fs->fatbase + (bc / SS(fs)))) break;
-		wc = fs->win[bc % SS(fs)]; bc++;
-		if (move_window(fs, fs->fatbase + (bc / SS(fs)))) break;
-		wc |= fs->win[bc % SS(fs)] << 8;
+		if (move_fatwin(fs, fs->fatbase + (bc / SS(fs)))) break;
+		wc = FAT_WIN(fs)[bc % SS(fs)]; bc++;
+		if (move_fatwin(fs, fs->fatbase + (bc / SS(fs)))) break;
+		wc |= FAT_WIN(fs)[bc % SS(fs)] << 8;
 		return (clst & 1) ? (wc >> 4) : (wc & 0xFFF);
 
 	case FS_FAT16 :
-		if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 2)))) break;
-		p = &fs->win[clst * 2 % SS(fs)];
+		if (move_fatwin(fs, fs->fatbase + (clst / (SS(fs) / 2)))) break;
+		p = &FAT_WIN(fs)[clst * 2 % SS(fs)];
 		return LD_WORD(p);
-
-	case FS_FAT32 :
-		if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 4)))) break;
-		p = &fs->win[clst * 4 % SS(fs)];
-		return LD_DWORD(p) & 0x0FFFFFFF;
+#if _FS_EXFAT
+	case FS_EXFAT :		/* Only FAT chained objects, EOC (0xFFFFFFFF) becomes >= n_fatent */
+		if (move_fatwin(fs, fs->fatbase + (clst / (SS(fs) / 4)))) break;
+		p = &FAT_WIN(fs)[clst * 4 % SS(fs)];
+		return LD_DWORD(p) & 0x7FFFFFFF;
+#endif
 	}
 
 	return 0xFFFFFFFF;	/* An error occurred at the disk I/O layer */
 }
+#if _FS_STATS
+#define	get_fat(fs, clst)	STAT_CALL(FFS_GET_FAT, (get_fat)(fs, clst))
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT access - Follow a cluster chain                                   */
+/*-----------------------------------------------------------------------*/
+/* Consecutive FAT32 entries are read straight from the window, the
+/  window is moved only when the chain leaves its FAT sector. */
+
+#if _USE_EXPAND || _USE_FASTSEEK || _FS_MINIMIZE <= 2
+static
+DWORD walk_chain (	/* 0xFFFFFFFF:Disk error, 1:Internal error, Else:Cluster reached */
+	FATFS *fs,		/* File system object */
+	DWORD clst,		/* Cluster# to start from */
+	DWORD *n,		/* Links to follow, decremented by the links followed (not zero: chain ended) */
+	BYTE cont		/* 1:Stop at a link to other than the following cluster */
+)
+{
+	DWORD nxt, sect;
+
+
+	while (*n) {
+		if (clst < 2 || clst >= fs->n_fatent) return 1;
+		if (fs->fs_type == FS_FAT32) {
+			sect = fs->fatbase + (clst / (SS(fs) / 4));
+			if (sect != FAT_SECT(fs) && move_fatwin(fs, sect)) return 0xFFFFFFFF;
+			nxt = LD_FAT32(&FAT_WIN(fs)[clst * 4 % SS(fs)]);
+		} else {
+			nxt = get_fat(fs, clst);
+			if (nxt == 0xFFFFFFFF) return nxt;
+		}
+		if (nxt < 2) return 1;				/* Free or invalid cluster in the chain */
+		if (nxt >= fs->n_fatent || (cont && nxt != clst + 1)) break;	/* End of the chain or of the contiguous run */
+		clst = nxt; (*n)--;
+	}
+
+	return clst;
+}
+#endif
 
 
 
@@ -866,6 +1395,7 @@ FRESULT put_fat (
 )
 {
 	UINT bc;
+	DWORD sect;
 	BYTE *p;
 	FRESULT res;
 
@@ -877,72 +1407,251 @@ FRESULT put_fat (
 		switch (fs->fs_type) {
 		case FS_FAT12 :
 			bc = clst; bc += bc / 2;
-			res = move_window(fs, fs->fatbase + (bc / SS(fs)));
+			res = move_fatwin(fs, fs->fatbase + (bc / SS(fs)));
 			if (res != FR_OK) break;
-			p = &fs->win[bc % SS(fs)];
+			p = &FAT_WIN(fs)[bc % SS(fs)];
 			*p = (clst & 1) ? ((*p & 0x0F) | ((BYTE)val << 4)) : (BYTE)val;
 			bc++;
-			fs->wflag = 1;
-			res = move_window(fs, fs->fatbase + (bc / SS(fs)));
+			FAT_DIRTY(fs) = 1;
+			res = move_fatwin(fs, fs->fatbase + (bc / SS(fs)));
 			if (res != FR_OK) break;
-			p = &fs->win[bc % SS(fs)];
+			p = &FAT_WIN(fs)[bc % SS(fs)];
 			*p = (clst & 1) ? (BYTE)(val >> 4) : ((*p & 0xF0) | ((BYTE)(val >> 8) & 0x0F));
 			break;
 
 		case FS_FAT16 :
-			res = move_window(fs, fs->fatbase + (clst / (SS(fs) / 2)));
+			res = move_fatwin(fs, fs->fatbase + (clst / (SS(fs) / 2)));
 			if (res != FR_OK) break;
-			p = &fs->win[clst * 2 % SS(fs)];
+			p = &FAT_WIN(fs)[clst * 2 % SS(fs)];
 			ST_WORD(p, (WORD)val);
 			break;
 
 		case FS_FAT32 :
-			res = move_window(fs, fs->fatbase + (clst / (SS(fs) / 4)));
+			sect = fs->fatbase + (clst / (SS(fs) / 4));
+			res = (sect == FAT_SECT(fs)) ? FR_OK : move_fatwin(fs, sect);
 			if (res != FR_OK) break;
-			p = &fs->win[clst * 4 % SS(fs)];
-			val |= LD_DWORD(p) & 0xF0000000;
-			ST_DWORD(p, val);
+			ST_FAT32(&FAT_WIN(fs)[clst * 4 % SS(fs)], val);
 			break;
+#if _FS_EXFAT
+		case FS_EXFAT :
+			res = move_fatwin(fs, fs->fatbase + (clst / (SS(fs) / 4)));
+			if (res != FR_OK) break;
+			ST_DWORD(&FAT_WIN(fs)[clst * 4 % SS(fs)], val);
+			break;
+#endif
 
 		default :
 			res = FR_INT_ERR;
 		}
-		fs->wflag = 1;
+		FAT_DIRTY(fs) = 1;
+#if _FS_FMAP
+		if (val == 0) FMAP_SET(fs, clst);	/* The group has a free cluster now */
+#endif
 	}
 
 	return res;
 }
+#if _FS_STATS
+#define	put_fat(fs, clst, val)	STAT_CALL(FFS_PUT_FAT, (put_fat)(fs, clst, val))
+#endif
 #endif /* !_FS_READONLY */
 
 
 
 
 /*-----------------------------------------------------------------------*/
-/* FAT handling - Remove a cluster chain                                 */
+/* exFAT handling - Allocation bitmap                                    */
 /*-----------------------------------------------------------------------*/
-#if !_FS_READONLY
+/* On exFAT the bitmap tells which clusters are in use, the FAT holds only
+/  the links of fragmented objects. An object allocated in one piece has
+/  no FAT chain at all (NoFatChain flag), so it is stretched by marking the
+/  next cluster in the bitmap; the FAT chain is written only when a new
+/  cluster is not the following one. */
+
+#if _FS_EXFAT && !_FS_READONLY
 static
-FRESULT remove_chain (
-	FATFS *fs,			/* File system object */
-	DWORD clst			/* Cluster# to remove a chain from */
+DWORD find_bitmap (	/* 0:No free block, 0xFFFFFFFF:Disk error, >=2:First cluster of the block */
+	FATFS *fs,		/* File system object */
+	DWORD clst,		/* Cluster# to start the search from */
+	DWORD ncl		/* Number of contiguous free clusters to find */
 )
 {
-	FRESULT res;
-	DWORD nxt;
-#if _USE_ERASE
-	DWORD scl = clst, ecl = clst, resion[2];
-#endif
-
-	if (clst < 2 || clst >= fs->n_fatent) {	/* Check range */
-		res = FR_INT_ERR;
-
+	DWORD val, nbit, n, ctr, sect;
+	BYTE bv;
+
+
+	nbit = fs->n_fatent - 2;		/* Bit 0 of the bitmap is cluster 2 */
+	val = clst - 2;
+	if (val >= nbit) val = 0;
+	ctr = 0;
+	for (n = nbit; n; ) {
+		sect = fs->bitbase + val / 8 / SS(fs);
+		if (sect != FAT_SECT(fs) && move_fatwin(fs, sect)) return 0xFFFFFFFF;
+		bv = FAT_WIN(fs)[val / 8 % SS(fs)];
+		if (val % 8 == 0 && n >= 8 && val + 8 <= nbit && (bv == 0xFF || (bv == 0 && ctr + 8 < ncl))) {
+			ctr = bv ? 0 : ctr + 8;	/* Whole byte in use or free */
+			val += 8; n -= 8;
+		} else {
+			if (bv & (1 << (val % 8))) {
+				ctr = 0;
+			} else if (++ctr == ncl) {
+				return val + 3 - ncl;	/* Block found (cluster# of its first bit) */
+			}
+			val++; n--;
+		}
+		if (val >= nbit) {			/* Wrap around, a block doesn't */
+			val = 0; ctr = 0;
+		}
+	}
+
+	return 0;
+}
+
+
+static
+FRESULT change_bitmap (
+	FATFS *fs,		/* File system object */
+	DWORD clst,		/* First cluster# to change */
+	DWORD ncl,		/* Number of clusters */
+	BYTE bv			/* 1:Mark "in use", 0:Mark "free" */
+)
+{
+	DWORD val, sect;
+	BYTE *p, bm;
+
+
+	for (val = clst - 2; ncl; ) {
+		sect = fs->bitbase + val / 8 / SS(fs);
+		if (sect != FAT_SECT(fs) && move_fatwin(fs, sect)) return FR_DISK_ERR;
+		p = &FAT_WIN(fs)[val / 8 % SS(fs)];
+		if (val % 8 == 0 && ncl >= 8) {		/* Whole byte */
+			if (*p != (bv ? 0 : 0xFF)) return FR_INT_ERR;
+			*p = bv ? 0xFF : 0;
+			val += 8; ncl -= 8;
+		} else {
+			bm = (BYTE)(1 << (val % 8));
+			if (!(*p & bm) == !bv) return FR_INT_ERR;	/* The cluster is in the state already */
+			*p ^= bm;
+			val++; ncl--;
+		}
+		FAT_DIRTY(fs) = 1;
+	}
+
+	return FR_OK;
+}
+
+
+/* Write FAT chain of a contiguous block */
+static
+FRESULT fill_fat (
+	FATFS *fs,		/* File system object */
+	DWORD clst,		/* First cluster# of the block */
+	DWORD ncl,		/* Number of clusters */
+	DWORD nxt		/* Link of the last cluster */
+)
+{
+	FRESULT res;
+
+
+	for ( ; ncl > 1; ncl--, clst++) {
+		res = put_fat(fs, clst, clst + 1);
+		if (res != FR_OK) return res;
+	}
+
+	return put_fat(fs, clst, nxt);
+}
+
+
+static
+DWORD create_xchain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:New cluster# */
+	FATFS *fs,			/* File system object */
+	DWORD sclst,		/* Start cluster of the chain */
+	DWORD clst,			/* Cluster# to stretch. 0 means create a new chain. */
+	DWORD *ncont		/* Clusters of the chain if it has no FAT chain (0:FAT chain), updated */
+)
+{
+	DWORD cs, ncl;
+	FRESULT res;
+
+
+	if (clst && !*ncont) {			/* FAT chain may be followed by next cluster already */
+		cs = get_fat(fs, clst);
+		if (cs < 2) return 1;
+		if (cs == 0xFFFFFFFF || cs < fs->n_fatent) return cs;
+	}
+	ncl = find_bitmap(fs, clst ? clst + 1 : fs->last_clust + 1, 1);	/* The following cluster if it is free */
+	if (ncl == 0 || ncl == 0xFFFFFFFF) return ncl;
+
+	res = change_bitmap(fs, ncl, 1, 1);
+	if (res == FR_OK) {
+		if (!clst) {
+			*ncont = 1;				/* A new chain is contiguous */
+		} else if (*ncont && ncl == clst + 1) {
+			(*ncont)++;				/* It stays contiguous */
+		} else {
+			if (*ncont) {			/* Fragmented now: the contiguous part gets its FAT chain */
+				res = fill_fat(fs, sclst, *ncont, ncl);
+				*ncont = 0;
+			} else {
+				res = put_fat(fs, clst, ncl);
+			}
+			if (res == FR_OK) res = put_fat(fs, ncl, 0xFFFFFFFF);
+		}
+	}
+	if (res == FR_OK) {
+		fs->last_clust = ncl;
+		if (fs->free_clust != 0xFFFFFFFF)
+			fs->free_clust--;
+	} else {
+		ncl = (res == FR_DISK_ERR) ? 0xFFFFFFFF : 1;
+	}
+
+	return ncl;
+}
+#endif /* _FS_EXFAT && !_FS_READONLY */
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Remove a cluster chain                                 */
+/*-----------------------------------------------------------------------*/
+#if !_FS_READONLY
+static
+FRESULT remove_chain (
+	FATFS *fs,			/* File system object */
+	DWORD clst,			/* Cluster# to remove a chain from */
+	DWORD ncont			/* Clusters of a contiguous chain without FAT chain (exFAT), 0:Follow the FAT */
+)
+{
+	FRESULT res;
+	DWORD nxt;
+#if _USE_ERASE
+	DWORD scl = clst, ecl = clst, resion[2];
+#endif
+
+	if (clst < 2 || clst >= fs->n_fatent) {	/* Check range */
+		res = FR_INT_ERR;
+
 	} else {
 		res = FR_OK;
 		while (clst < fs->n_fatent) {			/* Not a last link? */
+#if _FS_EXFAT
+			if (ncont) {						/* The chain is the following clusters */
+				nxt = (--ncont) ? clst + 1 : fs->n_fatent;
+			} else
+#endif
+			{
 			nxt = get_fat(fs, clst);			/* Get cluster status */
 			if (nxt == 0) break;				/* Empty cluster? */
 			if (nxt == 1) { res = FR_INT_ERR; break; }	/* Internal error? */
 			if (nxt == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }	/* Disk error? */
+			}
+#if _FS_EXFAT
+			if (fs->fs_type == FS_EXFAT)
+				res = change_bitmap(fs, clst, 1, 0);	/* Mark the cluster "empty" in the bitmap (FAT entry is left) */
+			else
+#endif
 			res = put_fat(fs, clst, 0);			/* Mark the cluster "empty" */
 			if (res != FR_OK) break;
 			if (fs->free_clust != 0xFFFFFFFF) {	/* Update FSInfo */
@@ -955,6 +1664,9 @@ FRESULT remove_chain (
 			} else {				/* End of contiguous clusters */ 
 				resion[0] = clust2sect(fs, scl);					/* Start sector */
 				resion[1] = clust2sect(fs, ecl) + fs->csize - 1;	/* End sector */
+#if _FS_CACHE
+				cache_drop(fs, resion[0], resion[1] - resion[0] + 1);	/* Do not write back freed sectors */
+#endif
 				disk_ioctl(fs->drv, CTRL_ERASE_SECTOR, resion);		/* Erase the block */
 				scl = ecl = nxt;
 			}
@@ -965,6 +1677,9 @@ FRESULT remove_chain (
 
 	return res;
 }
+#if _FS_STATS
+#define	remove_chain(fs, clst, ncont)	STAT_CALL(FFS_REMOVE_CHAIN, (remove_chain)(fs, clst, ncont))
+#endif
 #endif
 
 
@@ -982,6 +1697,10 @@ DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk err
 {
 	DWORD cs, ncl, scl;
 	FRESULT res;
+#if _FS_FMAP
+	DWORD ecl;
+	BYTE whole = 0;
+#endif
 
 
 	if (clst == 0) {		/* Create a new chain */
@@ -1002,10 +1721,26 @@ DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk err
 			ncl = 2;
 			if (ncl > scl) return 0;	/* No free cluster */
 		}
+#if _FS_FMAP
+		ecl = (ncl / fs->fmgrp + 1) * fs->fmgrp;	/* First cluster of the next group */
+		if (ecl > fs->n_fatent) ecl = fs->n_fatent;
+		if (!FMAP_TEST(fs, ncl)) {		/* No free cluster in this group, skip it */
+			if (scl >= ncl && scl < ecl) return 0;	/* No free cluster (start point is skipped) */
+			ncl = ecl - 1;
+			continue;
+		}
+		if (ncl == 2 || ncl % fs->fmgrp == 0) whole = 1;	/* The group is scanned from its start */
+#endif
 		cs = get_fat(fs, ncl);			/* Get the cluster status */
 		if (cs == 0) break;				/* Found a free cluster */
 		if (cs == 0xFFFFFFFF || cs == 1)/* An error occurred */
 			return cs;
+#if _FS_FMAP
+		if (ncl + 1 == ecl) {			/* End of the group */
+			if (whole) FMAP_CLR(fs, ncl);	/* Whole group is scanned and has no free cluster */
+			whole = 0;
+		}
+#endif
 		if (ncl == scl) return 0;		/* No free cluster */
 	}
 
@@ -1015,16 +1750,121 @@ DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk err
 	}
 	if (res == FR_OK) {
 		fs->last_clust = ncl;			/* Update FSINFO */
-		if (fs->free_clust != 0xFFFFFFFF) {
+		if (fs->free_clust != 0xFFFFFFFF)
 			fs->free_clust--;
-			fs->fsi_flag = 1;
-		}
+		fs->fsi_flag = 1;				/* Next free cluster is kept even if free count is unknown */
 	} else {
 		ncl = (res == FR_DISK_ERR) ? 0xFFFFFFFF : 1;
 	}
 
 	return ncl;		/* Return new cluster number or error code */
 }
+#if _FS_STATS
+#define	create_chain(fs, clst)	STAT_CALL(FFS_CREATE_CHAIN, (create_chain)(fs, clst))
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Stretch or Create the cluster chain of a file          */
+/*-----------------------------------------------------------------------*/
+/* Each file appending takes its new clusters from its own window of
+/  _FS_RESERVE clusters, and the allocation point of the volume is moved
+/  past the window, so files written at the same time don't interleave.
+/  The window is not marked in the FAT: a cluster taken by someone else
+/  on wrap-around is just skipped and nothing is lost on power failure. */
+
+#if _FS_RESERVE
+static
+DWORD file_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:New cluster# */
+	FIL *fp,			/* File object */
+	DWORD clst			/* Last cluster of the file. 0 means create a new chain. */
+)
+{
+	FATFS *fs = fp->fs;
+	DWORD cs, ncl, lcl;
+	FRESULT res;
+
+
+	if (clst) {
+		cs = get_fat(fs, clst);			/* Check the cluster status */
+		if (cs < 2) return 1;			/* It is an invalid cluster */
+		if (cs == 0xFFFFFFFF || cs < fs->n_fatent) return cs;	/* Disk error or already followed by next cluster */
+	}
+
+	ncl = fp->rsv_clust;
+	if (ncl && ncl < fp->rsv_end) {		/* Next cluster of the window if it is still free */
+		cs = get_fat(fs, ncl);
+		if (cs == 0xFFFFFFFF || cs == 1) return cs;
+		if (cs == 0) {
+			res = put_fat(fs, ncl, 0x0FFFFFFF);
+			if (res == FR_OK && clst != 0)
+				res = put_fat(fs, clst, ncl);
+			if (res != FR_OK) return (res == FR_DISK_ERR) ? 0xFFFFFFFF : 1;
+			fp->rsv_clust = ncl + 1;
+			if (fs->free_clust != 0xFFFFFFFF) {
+				fs->free_clust--;
+				fs->fsi_flag = 1;
+			}
+			return ncl;
+		}
+	}
+
+	/* New window: right after the file if that cluster is free, else at the allocation point */
+	lcl = fs->last_clust;
+	if (!lcl || lcl >= fs->n_fatent) lcl = 1;	/* Allocation point is not known */
+	ncl = 0;
+	if (clst && clst + 1 < fs->n_fatent) {
+		cs = get_fat(fs, clst + 1);
+		if (cs == 0xFFFFFFFF || cs == 1) return cs;
+		if (cs == 0) ncl = create_chain(fs, clst);
+	}
+	if (!ncl) {
+		ncl = create_chain(fs, 0);		/* Next free cluster from the allocation point */
+		if (ncl >= 2 && ncl != 0xFFFFFFFF && clst != 0) {
+			res = put_fat(fs, clst, ncl);	/* Link it to the file */
+			if (res != FR_OK) return (res == FR_DISK_ERR) ? 0xFFFFFFFF : 1;
+		}
+	}
+	if (ncl < 2 || ncl == 0xFFFFFFFF) return ncl;
+	fp->rsv_clust = ncl + 1;
+	fp->rsv_end = (ncl < fs->n_fatent - _FS_RESERVE) ? ncl + _FS_RESERVE : fs->n_fatent;
+	if (ncl < lcl)
+		fs->last_clust = lcl;			/* Window in a hole behind the allocation point */
+	else
+		fs->last_clust = fp->rsv_end - 1;	/* Others allocate after the window */
+
+	return ncl;
+}
+#define FAT_CHAIN(fp, clst)		file_chain(fp, clst)
+#else
+#define FAT_CHAIN(fp, clst)		create_chain((fp)->fs, clst)
+#endif
+
+#if _FS_EXFAT
+static
+DWORD file_xchain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:New cluster# */
+	FIL *fp,			/* File object on exFAT volume */
+	DWORD clst			/* Last cluster of the file. 0 means create a new chain. */
+)
+{
+	DWORD ncl, ncont;
+
+
+	ncont = (clst && fp->xstat) ? fp->eclust - fp->sclust + 1 : 0;
+	ncl = create_xchain(fp->fs, fp->sclust, clst, &ncont);
+	if (ncl >= 2 && ncl != 0xFFFFFFFF) {
+		fp->xstat = ncont ? 2 : 0;
+		if (ncont) fp->eclust = ncl;	/* Contiguous chain ends at the new cluster */
+	}
+
+	return ncl;
+}
+#define FILE_CHAIN(fp, clst)	(((fp)->fs->fs_type == FS_EXFAT) ? file_xchain(fp, clst) : FAT_CHAIN(fp, clst))
+#else
+#define FILE_CHAIN(fp, clst)	FAT_CHAIN(fp, clst)
+#endif
 #endif /* !_FS_READONLY */
 
 
@@ -1053,10 +1893,146 @@ DWORD clmt_clust (	/* <2:Error, >=2:Cluster number */
 	}
 	return cl + *tbl;	/* Return the cluster number */
 }
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Create link map table of the file                      */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT create_clmt (	/* FR_NOT_ENOUGH_CORE: Given table is too small */
+	FIL* fp				/* Pointer to the file object with cltbl set */
+)
+{
+	DWORD cl, pcl, ncl, tcl, tlen, ulen, *tbl;
+
+
+	tbl = fp->cltbl;
+	tlen = *tbl++; ulen = 2;	/* Given table size and required table size */
+	cl = fp->sclust;			/* Top of the chain */
+#if _FS_EXFAT
+	if (cl && fp->xstat) {		/* Contiguous chain without FAT chain is one fragment */
+		ulen += 2;
+		if (ulen <= tlen) {
+			*tbl++ = fp->eclust - cl + 1; *tbl++ = cl;
+		}
+	} else
+#endif
+	if (cl) {
+		do {
+			/* Get a fragment */
+			tcl = cl; ulen += 2;	/* Top, length and used items */
+			ncl = 0xFFFFFFFF;
+			pcl = walk_chain(fp->fs, cl, &ncl, 1);	/* Last cluster of the fragment */
+			if (pcl == 1) return FR_INT_ERR;
+			if (pcl == 0xFFFFFFFF) return FR_DISK_ERR;
+			ncl = pcl - tcl + 1;
+			cl = get_fat(fp->fs, pcl);		/* Top of the next fragment or end of chain */
+			if (cl <= 1) return FR_INT_ERR;
+			if (cl == 0xFFFFFFFF) return FR_DISK_ERR;
+			if (ulen <= tlen) {		/* Store the length and top of the fragment */
+				*tbl++ = ncl; *tbl++ = tcl;
+			}
+		} while (cl < fp->fs->n_fatent);	/* Repeat until end of chain */
+	}
+	*fp->cltbl = ulen;	/* Number of items used */
+	if (ulen > tlen) return FR_NOT_ENOUGH_CORE;	/* Given table size is smaller than required */
+	*tbl = 0;			/* Terminate table */
+	return FR_OK;
+}
+
+
+
+
+#if _FS_CLMT_FILES
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Attach/detach automatic link map table                 */
+/*-----------------------------------------------------------------------*/
+
+static
+void clmt_detach (
+	FIL* fp		/* Pointer to the file object */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < _FS_CLMT_FILES; i++) {
+		if (fp->fs->clmt_owner[i] == fp) {	/* Return the table to the pool of the volume */
+			fp->fs->clmt_owner[i] = 0;
+			fp->cltbl = 0;
+		}
+	}
+}
+
+
+static
+void clmt_attach (
+	FIL* fp		/* Pointer to the opened file object */
+)
+{
+	UINT i;
+
+
+	clmt_detach(fp);	/* The object may have been reused without f_close */
+	if (!fp->sclust) return;	/* No chain to be mapped */
+	for (i = 0; i < _FS_CLMT_FILES && fp->fs->clmt_owner[i]; i++) ;
+	if (i == _FS_CLMT_FILES) return;	/* Pool is exhausted, normal seek mode */
+	fp->fs->clmt[i][0] = _FS_CLMT_SIZE;
+	fp->cltbl = fp->fs->clmt[i];
+	if (create_clmt(fp) == FR_OK)
+		fp->fs->clmt_owner[i] = fp;
+	else
+		fp->cltbl = 0;	/* Too fragmented or chain error, normal seek mode */
+}
+#endif	/* _FS_CLMT_FILES */
 #endif	/* _USE_FASTSEEK */
 
 
 
+
+#if _FS_WCOMB
+/*-----------------------------------------------------------------------*/
+/* File buffer - Write-combining of sequentially written sectors         */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT wc_flush (	/* FR_OK: successful, FR_DISK_ERR: failed */
+	FIL *fp		/* Pointer to the file object */
+)
+{
+	if (fp->wccnt) {
+		if (disk_write(fp->fs->drv, fp->wcbuf, fp->wcsect, fp->wccnt) != RES_OK)
+			return FR_DISK_ERR;
+#if _FS_CACHE
+		cache_drop(fp->fs, fp->wcsect, fp->wccnt);
+#endif
+		fp->wccnt = 0;
+	}
+	return FR_OK;
+}
+
+
+static
+FRESULT wc_put (	/* FR_OK: successful, FR_DISK_ERR: failed */
+	FIL *fp		/* Pointer to the file object with dirty buf[] */
+)
+{
+	if (fp->wccnt && fp->dsect != fp->wcsect + fp->wccnt) {	/* Not sequential to the held sectors */
+		if (wc_flush(fp) != FR_OK) return FR_DISK_ERR;
+	}
+	if (!fp->wccnt) fp->wcsect = fp->dsect;
+	mem_cpy(&fp->wcbuf[fp->wccnt * SS(fp->fs)], fp->buf, SS(fp->fs));
+	if (++fp->wccnt >= _FS_WCOMB)	/* Write the buffer when it gets full */
+		return wc_flush(fp);
+	return FR_OK;
+}
+#endif	/* _FS_WCOMB */
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Directory handling - Set directory index                              */
 /*-----------------------------------------------------------------------*/
@@ -1075,7 +2051,7 @@ FRESULT dir_sdi (
 	clst = dj->sclust;
 	if (clst == 1 || clst >= dj->fs->n_fatent)	/* Check start cluster range */
 		return FR_INT_ERR;
-	if (!clst && dj->fs->fs_type == FS_FAT32)	/* Replace cluster# 0 with root cluster# if in FAT32 */
+	if (!clst && dj->fs->fs_type >= FS_FAT32)	/* Replace cluster# 0 with root cluster# if in FAT32/exFAT */
 		clst = dj->fs->dirbase;
 
 	if (clst == 0) {	/* Static table (root-dir in FAT12/16) */
@@ -1086,6 +2062,13 @@ FRESULT dir_sdi (
 	}
 	else {				/* Dynamic table (sub-dirs or root-dir in FAT32) */
 		ic = SS(dj->fs) / SZ_DIR * dj->fs->csize;	/* Entries per cluster */
+#if _FS_EXFAT
+		if (dj->xclen) {	/* Contiguous table without FAT chain */
+			if (idx / ic >= dj->xclen) return FR_INT_ERR;
+			clst += idx / ic;
+			idx %= ic;
+		}
+#endif
 		while (idx >= ic) {	/* Follow cluster chain */
 			clst = get_fat(dj->fs, clst);				/* Get next cluster */
 			if (clst == 0xFFFFFFFF) return FR_DISK_ERR;	/* Disk error */
@@ -1109,6 +2092,10 @@ FRESULT dir_sdi (
 /* Directory handling - Move directory index next                        */
 /*-----------------------------------------------------------------------*/
 
+#if _FS_EXFAT && !_FS_READONLY
+static FRESULT xdir_grow (DIR *dj);
+#endif
+
 static
 FRESULT dir_next (	/* FR_OK:Succeeded, FR_NO_FILE:End of table, FR_DENIED:EOT and could not stretch */
 	DIR *dj,		/* Pointer to directory object */
@@ -1133,13 +2120,23 @@ FRESULT dir_next (	/* FR_OK:Succeeded, FR_NO_FILE:End of table, FR_DENIED:EOT an
 		}
 		else {					/* Dynamic table */
 			if (((i / (SS(dj->fs) / SZ_DIR)) & (dj->fs->csize - 1)) == 0) {	/* Cluster changed? */
+#if _FS_EXFAT
+				if (dj->xclen)									/* Contiguous table: next cluster or end */
+					clst = (dj->clust + 1 - dj->sclust < dj->xclen) ? dj->clust + 1 : dj->fs->n_fatent;
+				else
+#endif
 				clst = get_fat(dj->fs, dj->clust);				/* Get next cluster */
 				if (clst <= 1) return FR_INT_ERR;
 				if (clst == 0xFFFFFFFF) return FR_DISK_ERR;
 				if (clst >= dj->fs->n_fatent) {					/* When it reached end of dynamic table */
 #if !_FS_READONLY
-					BYTE c;
+					WORD c;
 					if (!stretch) return FR_NO_FILE;			/* When do not stretch, report EOT */
+#if _FS_EXFAT
+					if (dj->fs->fs_type == FS_EXFAT)			/* Stretch keeping the table contiguous if it can */
+						clst = create_xchain(dj->fs, dj->sclust, dj->clust, &dj->xclen);
+					else
+#endif
 					clst = create_chain(dj->fs, dj->clust);		/* Stretch cluster chain */
 					if (clst == 0) return FR_DENIED;			/* No free cluster */
 					if (clst == 1) return FR_INT_ERR;
@@ -1154,6 +2151,12 @@ FRESULT dir_next (	/* FR_OK:Succeeded, FR_NO_FILE:End of table, FR_DENIED:EOT an
 						dj->fs->winsect++;
 					}
 					dj->fs->winsect -= c;						/* Rewind window address */
+#if _FS_EXFAT
+					if (dj->fs->fs_type == FS_EXFAT && dj->sclust) {	/* Sub-directory size is in its entry */
+						FRESULT res = xdir_grow(dj);
+						if (res != FR_OK) return res;
+					}
+#endif
 #else
 					return FR_NO_FILE;			/* Report EOT */
 #endif
@@ -1169,6 +2172,9 @@ FRESULT dir_next (	/* FR_OK:Succeeded, FR_NO_FILE:End of table, FR_DENIED:EOT an
 
 	return FR_OK;
 }
+#if _FS_STATS
+#define	dir_next(dj, st)	STAT_CALL(FFS_DIR_NEXT, (dir_next)(dj, st))
+#endif
 
 
 
@@ -1182,226 +2188,932 @@ const BYTE LfnOfs[] = {1,3,5,7,9,14,16,18,20,22,24,28,30};	/* Offset of LFN char
 
 
 static
-int cmp_lfn (			/* 1:Matched, 0:Not matched */
-	WCHAR *lfnbuf,		/* Pointer to the LFN to be compared */
-	BYTE *dir			/* Pointer to the directory entry containing a part of LFN */
+int cmp_lfn (			/* 1:Matched, 0:Not matched */
+	WCHAR *lfnbuf,		/* Pointer to the LFN to be compared */
+	BYTE *dir			/* Pointer to the directory entry containing a part of LFN */
+)
+{
+	UINT i, s;
+	WCHAR wc, uc;
+
+
+	i = ((dir[LDIR_Ord] & ~LLE) - 1) * 13;	/* Get offset in the LFN buffer */
+	s = 0; wc = 1;
+	do {
+		uc = LD_WORD(dir+LfnOfs[s]);	/* Pick an LFN character from the entry */
+		if (wc) {	/* Last char has not been processed */
+			wc = ff_wtoupper(uc);		/* Convert it to upper case */
+			if (i >= _MAX_LFN || wc != ff_wtoupper(lfnbuf[i++]))	/* Compare it */
+				return 0;				/* Not matched */
+		} else {
+			if (uc != 0xFFFF) return 0;	/* Check filler */
+		}
+	} while (++s < 13);				/* Repeat until all chars in the entry are checked */
+
+	if ((dir[LDIR_Ord] & LLE) && wc && lfnbuf[i])	/* Last segment matched but different length */
+		return 0;
+
+	return 1;						/* The part of LFN matched */
+}
+
+
+#if _FS_MINIMIZE <= 1
+static
+int pick_lfn (			/* 1:Succeeded, 0:Buffer overflow */
+	WCHAR *lfnbuf,		/* Pointer to the Unicode-LFN buffer */
+	BYTE *dir			/* Pointer to the directory entry */
+)
+{
+	UINT i, s;
+	WCHAR wc, uc;
+
+
+	i = ((dir[LDIR_Ord] & 0x3F) - 1) * 13;	/* Offset in the LFN buffer */
+
+	s = 0; wc = 1;
+	do {
+		uc = LD_WORD(dir+LfnOfs[s]);		/* Pick an LFN character from the entry */
+		if (wc) {	/* Last char has not been processed */
+			if (i >= _MAX_LFN) return 0;	/* Buffer overflow? */
+			lfnbuf[i++] = wc = uc;			/* Store it */
+		} else {
+			if (uc != 0xFFFF) return 0;		/* Check filler */
+		}
+	} while (++s < 13);						/* Read all character in the entry */
+
+	if (dir[LDIR_Ord] & LLE) {				/* Put terminator if it is the last LFN part */
+		if (i >= _MAX_LFN) return 0;		/* Buffer overflow? */
+		lfnbuf[i] = 0;
+	}
+
+	return 1;
+}
+#endif
+
+
+#if !_FS_READONLY
+static
+void fit_lfn (
+	const WCHAR *lfnbuf,	/* Pointer to the LFN buffer */
+	BYTE *dir,				/* Pointer to the directory entry */
+	BYTE ord,				/* LFN order (1-20) */
+	BYTE sum				/* SFN sum */
+)
+{
+	UINT i, s;
+	WCHAR wc;
+
+
+	dir[LDIR_Chksum] = sum;			/* Set check sum */
+	dir[LDIR_Attr] = AM_LFN;		/* Set attribute. LFN entry */
+	dir[LDIR_Type] = 0;
+	ST_WORD(dir+LDIR_FstClusLO, 0);
+
+	i = (ord - 1) * 13;				/* Get offset in the LFN buffer */
+	s = wc = 0;
+	do {
+		if (wc != 0xFFFF) wc = lfnbuf[i++];	/* Get an effective char */
+		ST_WORD(dir+LfnOfs[s], wc);	/* Put it */
+		if (!wc) wc = 0xFFFF;		/* Padding chars following last char */
+	} while (++s < 13);
+	if (wc == 0xFFFF || !lfnbuf[i]) ord |= LLE;	/* Bottom LFN part is the start of LFN sequence */
+	dir[LDIR_Ord] = ord;			/* Set the LFN order */
+}
+
+#endif
+#endif
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Create numbered name                                                  */
+/*-----------------------------------------------------------------------*/
+#if _USE_LFN
+void gen_numname (
+	BYTE *dst,			/* Pointer to generated SFN */
+	const BYTE *src,	/* Pointer to source SFN to be modified */
+	const WCHAR *lfn,	/* Pointer to LFN */
+	WORD seq			/* Sequence number */
+)
+{
+	BYTE ns[8], c;
+	UINT i, j;
+
+
+	mem_cpy(dst, src, 11);
+
+	if (seq > 5) {	/* On many collisions, generate a hash number instead of sequential number */
+		do seq = (seq >> 1) + (seq << 15) + (WORD)*lfn++; while (*lfn);
+	}
+
+	/* itoa (hexdecimal) */
+	i = 7;
+	do {
+		c = (seq % 16) + '0';
+		if (c > '9') c += 7;
+		ns[i--] = c;
+		seq /= 16;
+	} while (seq);
+	ns[i] = '~';
+
+	/* Append the number */
+	for (j = 0; j < i && dst[j] != ' '; j++) {
+		if (IsDBCS1(dst[j])) {
+			if (j == i - 1) break;
+			j++;
+		}
+	}
+	do {
+		dst[j++] = (i < 8) ? ns[i++] : ' ';
+	} while (j < 8);
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Calculate sum of an SFN                                               */
+/*-----------------------------------------------------------------------*/
+#if _USE_LFN
+static
+BYTE sum_sfn (
+	const BYTE *dir		/* Ptr to directory entry */
+)
+{
+	BYTE sum = 0;
+	UINT n = 11;
+
+	do sum = (sum >> 1) + (sum << 7) + *dir++; while (--n);
+	return sum;
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Find an object in the directory                  */
+/*-----------------------------------------------------------------------*/
+
+#if _FS_DIR_PREFETCH
+#define	DIR_PREFETCH_FROM	(_FS_DIR_PREFETCH * (SS(dj->fs) / SZ_DIR))	/* Searches read ahead from the second group on */
+
+/* Read the sectors of a group ahead when a search enters its first one */
+static
+void dir_prefetch (
+	DIR *dj,		/* Pointer to the directory object at the first entry of a sector */
+	WORD from		/* Index the read-ahead starts at (small directories are read on demand) */
+)
+{
+	FATFS *fs = dj->fs;
+	DWORD rng[2], ofs, n;
+
+
+	if (dj->index < from || dj->sect == fs->winsect)
+		return;										/* Small directory so far or the sector is in the window */
+	if (dj->clust) {								/* Rest of the cluster */
+		ofs = dj->sect - clust2sect(fs, dj->clust);
+		n = fs->csize - ofs;
+	} else {										/* Rest of the static table */
+		ofs = dj->sect - fs->dirbase;
+		n = fs->n_rootdir / (SS(fs) / SZ_DIR) - ofs;
+	}
+	if (ofs % _FS_DIR_PREFETCH) return;				/* Read by the previous group */
+	if (n > _FS_DIR_PREFETCH) n = _FS_DIR_PREFETCH;
+	if (n < 2) return;
+	rng[0] = dj->sect; rng[1] = dj->sect + n - 1;
+	disk_ioctl(fs->drv, CTRL_CACHE_PREFETCH, rng);	/* Only a hint */
+}
+#endif
+
+
+/* Pass entries which can not start a match (deleted entries, volume label and, outside
+/  of an LFN sequence, LFN entries) up to the last entry of the window */
+static
+void dir_skip (
+	DIR *dj			/* Pointer to the directory object */
+)
+{
+	BYTE *dir = dj->dir, *last = dj->fs->win + SS(dj->fs) - SZ_DIR;
+	WORD n = 0;
+
+
+	while (dir < last && dir[DIR_Name] && (dir[DIR_Name] == DDE ||
+#if _USE_LFN
+			((dir[DIR_Attr] & AM_MASK) == AM_LFN ? !(dir[LDIR_Ord] & LLE) : (dir[DIR_Attr] & AM_VOL)))) {
+#else
+			(dir[DIR_Attr] & AM_VOL))) {
+#endif
+		dir += SZ_DIR; n++;
+	}
+	dj->dir = dir;
+	dj->index += n;
+}
+
+
+static
+FRESULT dir_scan (
+	DIR *dj,		/* Pointer to the directory object linked to the file name */
+	WORD idx,		/* Index of the entry to start the search */
+	BYTE one		/* 0:Search to the end of table, 1:Stop at the first SFN entry */
+)
+{
+	FRESULT res;
+	BYTE c, *dir;
+	DWORD head;
+#if _USE_LFN
+	BYTE a, ord, sum;
+#endif
+
+	res = dir_sdi(dj, idx);			/* Go to the first entry to be checked */
+	if (res != FR_OK) return res;
+
+	head = LD_HEAD(dj->fn);			/* An SFN is compared only if it starts with these bytes */
+#if _USE_LFN
+	ord = sum = 0xFF;
+#endif
+	do {
+#if _FS_DIR_PREFETCH
+		if (!(dj->index % (SS(dj->fs) / SZ_DIR))) dir_prefetch(dj, DIR_PREFETCH_FROM);
+#endif
+		res = move_window(dj->fs, dj->sect);
+		if (res != FR_OK) break;
+#if _USE_LFN
+		if (ord == 0xFF) dir_skip(dj);
+#else
+		dir_skip(dj);
+#endif
+		dir = dj->dir;					/* Ptr to the directory entry of current index */
+		c = dir[DIR_Name];
+		if (c == 0) { res = FR_NO_FILE; break; }	/* Reached to end of table */
+#if _USE_LFN	/* LFN configuration */
+		a = dir[DIR_Attr] & AM_MASK;
+		if (c == DDE || ((a & AM_VOL) && a != AM_LFN)) {	/* An entry without valid data */
+			ord = 0xFF;
+		} else {
+			if (a == AM_LFN) {			/* An LFN entry is found */
+				if (dj->lfn) {
+					if (c & LLE) {		/* Is it start of LFN sequence? */
+						sum = dir[LDIR_Chksum];
+						c &= ~LLE; ord = c;	/* LFN start order */
+						dj->lfn_idx = dj->index;
+					}
+					/* Check validity of the LFN entry and compare it with given name */
+					ord = (c == ord && sum == dir[LDIR_Chksum] && cmp_lfn(dj->lfn, dir)) ? ord - 1 : 0xFF;
+				}
+			} else {					/* An SFN entry is found */
+				if (!ord && sum == sum_sfn(dir)) break;	/* LFN matched? */
+				ord = 0xFF; dj->lfn_idx = 0xFFFF;	/* Reset LFN sequence */
+				if (!(dj->fn[NS] & NS_LOSS) && LD_HEAD(dir) == head && !mem_cmp(dir, dj->fn, 11)) break;	/* SFN matched? */
+				if (one) { res = FR_NO_FILE; break; }	/* The object did not match */
+			}
+		}
+#else		/* Non LFN configuration */
+		if (!(dir[DIR_Attr] & AM_VOL) && LD_HEAD(dir) == head && !mem_cmp(dir, dj->fn, 11)) /* Is it a valid entry? */
+			break;
+		if (one) { res = FR_NO_FILE; break; }	/* The object did not match */
+#endif
+		res = dir_next(dj, 0);		/* Next entry */
+	} while (res == FR_OK);
+
+	return res;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Name index of a directory                        */
+/*-----------------------------------------------------------------------*/
+#if _FS_DIRINDEX
+#if _FS_DIRINDEX & (_FS_DIRINDEX - 1)
+#error _FS_DIRINDEX must be a power of 2
+#endif
+#define	DIDX_MASK	(_FS_DIRINDEX - 1)
+#define	DIDX_MAX	(_FS_DIRINDEX - _FS_DIRINDEX / 4)	/* Maximum number of used slots */
+#define	DIDX_MIN	64		/* A directory is indexed when a search passes this number of entries */
+#define	DIDX_NONE	0
+#define	DIDX_VALID	1
+#define	DIDX_FULL	2
+
+/* Each object is put in the index under the case insensitive hash of its name
+/  (LFN, or SFN in "NAME.EXT" form if it has no LFN), a slot holds the index of
+/  the first entry of the object. The hash is a sum of the character hashes, so
+/  LFN entries are hashed in any order. A slot is only a hint, the entries are
+/  compared as without index. A numbered SFN (with '~') which is not found in
+/  the index may be an alias of an LFN, so it is searched without index.
+/  Small directories are searched without index, so path lookups through them
+/  do not drop the index of a large directory. */
+
+static
+WORD hash_chr (			/* Hash of a character at the position in the name */
+	WCHAR chr,
+	UINT pos
+)
+{
+	DWORD x;
+
+
+	x = (DWORD)(chr + 1) * 0x9E3779B1 ^ (DWORD)(pos + 1) * 0x85EBCA6B;
+	x ^= x >> 15; x *= 0x2C1B3C6D; x ^= x >> 12;	/* Mix so that the sum depends on the order */
+	return (WORD)(x >> 16);
+}
+
+
+static
+WORD hash_sfn (
+	const BYTE *sfn		/* Pointer to the SFN in directory form */
+)
+{
+	WORD h = 0;
+	UINT i, n = 0;
+	WCHAR c;
+
+
+	for (i = 0; i < 11; i++) {
+		if (i == 8 && sfn[8] != ' ') h += hash_chr('.', n++);	/* Extension follows */
+		c = sfn[i];
+		if (c == ' ') continue;
+		if (i == 0 && c == NDDE) c = DDE;
+#if _USE_LFN
+		c = ff_wtoupper(ff_convert(c, 1));
+#endif
+		h += hash_chr(c, n++);
+	}
+	return h;
+}
+
+
+#if _USE_LFN
+static
+WORD hash_lfn (
+	const WCHAR *lfn	/* Pointer to the LFN (null terminated) */
+)
+{
+	WORD h = 0;
+	UINT i;
+
+
+	for (i = 0; lfn[i]; i++) h += hash_chr(ff_wtoupper(lfn[i]), i);
+	return h;
+}
+
+
+static
+WORD hash_lfn_ent (
+	const BYTE *dir		/* Pointer to the directory entry containing a part of LFN */
+)
+{
+	WORD h = 0;
+	UINT i, s;
+	WCHAR wc;
+
+
+	i = ((dir[LDIR_Ord] & ~LLE) - 1) * 13;	/* Offset of the part in the LFN */
+	for (s = 0; s < 13; s++) {
+		wc = LD_WORD(dir+LfnOfs[s]);
+		if (!wc) break;					/* End of the LFN */
+		h += hash_chr(ff_wtoupper(wc), i + s);
+	}
+	return h;
+}
+#endif
+
+
+static
+void didx_put (
+	FATFS *fs,		/* File system object holding the index */
+	WORD hash,		/* Hash of the name */
+	WORD idx		/* Index of the first entry of the object */
+)
+{
+	UINT i;
+
+
+	if (fs->didx_stat != DIDX_VALID) return;
+	for (i = hash & DIDX_MASK; fs->didx[i] != 0xFFFF; i = (i + 1) & DIDX_MASK) {
+		if (fs->didx[i] == idx) return;	/* Already on the way from the hash */
+	}
+	if (fs->didx_n >= DIDX_MAX) {		/* Rebuild the index without stale slots */
+		fs->didx_stat = DIDX_NONE;
+		return;
+	}
+	fs->didx[i] = idx;
+	fs->didx_n++;
+}
+
+
+static
+FRESULT didx_build (
+	DIR *dj			/* Directory object to be indexed */
+)
+{
+	FRESULT res;
+	FATFS *fs = dj->fs;
+	BYTE c, *dir;
+	UINT i;
+#if _USE_LFN
+	BYTE a, ord = 0xFF, sum = 0xFF;
+	WORD h = 0, is = 0;
+#endif
+
+
+	for (i = 0; i < _FS_DIRINDEX; i++) fs->didx[i] = 0xFFFF;
+	fs->didx_n = 0;
+	fs->didx_clust = dj->sclust;
+	fs->didx_stat = DIDX_VALID;
+
+	res = dir_sdi(dj, 0);
+	while (res == FR_OK) {
+#if _FS_DIR_PREFETCH
+		if (!(dj->index % (SS(fs) / SZ_DIR))) dir_prefetch(dj, DIR_PREFETCH_FROM);
+#endif
+		res = move_window(fs, dj->sect);
+		if (res != FR_OK) break;
+		dir = dj->dir;
+		c = dir[DIR_Name];
+		if (c == 0) { res = FR_NO_FILE; break; }	/* Reached to end of table */
+#if _USE_LFN
+		a = dir[DIR_Attr] & AM_MASK;
+		if (c == DDE || ((a & AM_VOL) && a != AM_LFN)) {	/* An entry without valid data */
+			ord = 0xFF;
+		} else if (a == AM_LFN) {		/* An LFN entry (checked as by dir_scan) */
+			if (c & LLE) {				/* Start of LFN sequence */
+				sum = dir[LDIR_Chksum];
+				c &= ~LLE; ord = c;
+				is = dj->index; h = 0;
+			}
+			if (c == ord && sum == dir[LDIR_Chksum]) {
+				h += hash_lfn_ent(dir);
+				ord--;
+			} else {
+				ord = 0xFF;
+			}
+		} else {						/* An SFN entry */
+			if (!ord && sum == sum_sfn(dir))
+				didx_put(fs, h, is);
+			else
+				didx_put(fs, hash_sfn(dir), dj->index);
+			ord = 0xFF;
+		}
+#else
+		if (c != DDE && !(dir[DIR_Attr] & AM_VOL))
+			didx_put(fs, hash_sfn(dir), dj->index);
+#endif
+		res = dir_next(dj, 0);			/* Next entry */
+	}
+
+	if (res != FR_NO_FILE) {
+		fs->didx_stat = DIDX_NONE;
+		return res;
+	}
+	if (fs->didx_stat != DIDX_VALID) fs->didx_stat = DIDX_FULL;	/* Search it without index */
+	return FR_OK;
+}
+
+
+static
+FRESULT didx_find (
+	DIR *dj			/* Pointer to the directory object linked to the file name */
+)
+{
+	FRESULT res;
+	FATFS *fs = dj->fs;
+	WORD h;
+	UINT i;
+
+
+#if _USE_LFN
+	h = dj->lfn ? hash_lfn(dj->lfn) : hash_sfn(dj->fn);
+#else
+	h = hash_sfn(dj->fn);
+#endif
+	for (i = h & DIDX_MASK; fs->didx[i] != 0xFFFF; i = (i + 1) & DIDX_MASK) {
+		res = dir_scan(dj, fs->didx[i], 1);
+		if (res != FR_NO_FILE) return res;	/* Found or error */
+	}
+#if _USE_LFN
+	if (!(dj->fn[NS] & NS_LOSS)) {		/* May be a numbered SFN of an object with LFN */
+		for (i = 0; i < 11 && dj->fn[i] != '~'; i++) ;
+		if (i < 11) return dir_scan(dj, 0, 0);
+	}
+#endif
+	return FR_NO_FILE;
+}
+#endif /* _FS_DIRINDEX */
+
+
+/*-----------------------------------------------------------------------*/
+/* exFAT handling - Entry sets                                           */
+/*-----------------------------------------------------------------------*/
+/* An exFAT object is a set of entries: file entry (attribute, time stamps),
+/  stream entry (cluster, size, NoFatChain flag) and 1-17 name entries of 15
+/  characters. The set is loaded into the dirbuf[] and stored back as a whole
+/  with its checksum; the SFN entry made of it in the xsfn[] lets the FAT
+/  code read attribute, size, cluster and time of the object as usual. */
+
+#if _FS_EXFAT
+static
+WORD xdir_sum (		/* Get checksum of the entry set */
+	const BYTE *dirb	/* Entry set */
+)
+{
+	UINT i, szblk;
+	WORD sum = 0;
+
+
+	szblk = (dirb[XDIR_NumSec] + 1) * SZ_DIR;
+	for (i = 0; i < szblk; i++) {
+		if (i == XDIR_SetSum) {		/* Skip the checksum field */
+			i++; continue;
+		}
+		sum = ((sum & 1) ? 0x8000 : 0) + (sum >> 1) + dirb[i];
+	}
+	return sum;
+}
+
+
+static
+WORD xname_sum (	/* Get hash of the name (up-case characters) */
+	const WCHAR *name	/* File name */
+)
+{
+	WCHAR chr;
+	WORD sum = 0;
+
+
+	while ((chr = *name++) != 0) {
+		chr = ff_wtoupper(chr);
+		sum = ((sum & 1) ? 0x8000 : 0) + (sum >> 1) + (chr & 0xFF);
+		sum = ((sum & 1) ? 0x8000 : 0) + (sum >> 1) + (chr >> 8);
+	}
+	return sum;
+}
+
+
+static
+int xname_cmp (		/* 1:Matched, 0:Not matched */
+	const BYTE *dirb,	/* Entry set (name length is checked by the caller) */
+	const WCHAR *name	/* File name */
+)
+{
+	UINT di;
+
+
+	for (di = SZ_DIR * 2 + 2; *name; name++, di += 2) {
+		if (di % SZ_DIR == 0) di += 2;		/* Skip type and flags of the next name entry */
+		if (ff_wtoupper(LD_WORD(dirb + di)) != ff_wtoupper(*name)) return 0;
+	}
+	return 1;
+}
+
+
+static
+void xname_get (
+	const BYTE *dirb,	/* Entry set */
+	WCHAR *lfn			/* LFN working buffer (empty if the name is longer) */
+)
+{
+	UINT i, di, nc;
+
+
+	nc = dirb[XDIR_NumName];
+	if (nc > _MAX_LFN) nc = 0;
+	for (i = 0, di = SZ_DIR * 2 + 2; i < nc; i++, di += 2) {
+		if (di % SZ_DIR == 0) di += 2;
+		lfn[i] = LD_WORD(dirb + di);
+	}
+	lfn[i] = 0;
+}
+
+
+static
+BYTE* xdir_sfn (	/* Make the SFN entry of the entry set in the dirbuf[] */
+	FATFS *fs		/* File system object */
+)
+{
+	BYTE *dir = fs->xsfn, *dirb = fs->dirbuf;
+
+
+	mem_set(dir, ' ', 11);
+	mem_set(dir + 11, 0, SZ_DIR - 11);
+	dir[DIR_Attr] = dirb[XDIR_Attr] & (AM_RDO | AM_HID | AM_SYS | AM_DIR | AM_ARC);
+	ST_DWORD(dir+DIR_CrtTime, LD_DWORD(dirb+XDIR_CrtTime));	/* Same format as FAT date and time */
+	ST_DWORD(dir+DIR_WrtTime, LD_DWORD(dirb+XDIR_ModTime));
+	ST_CLUST(dir, LD_DWORD(dirb+XDIR_FstClus));
+	ST_DWORD(dir+DIR_FileSize, LD_DWORD(dirb+XDIR_FileSize+4) ? 0xFFFFFFFF : LD_DWORD(dirb+XDIR_FileSize));
+	return dir;
+}
+
+
+static
+DWORD xdir_ncont (	/* Clusters of the object if it has no FAT chain, 0:FAT chain */
+	FATFS *fs		/* File system object with the entry set in the dirbuf[] */
+)
+{
+	DWORD bcs, lo;
+
+
+	if (!(fs->dirbuf[XDIR_GenFlags] & 2)) return 0;
+	bcs = (DWORD)fs->csize * SS(fs);
+	lo = LD_DWORD(fs->dirbuf+XDIR_FileSize);
+	return LD_DWORD(fs->dirbuf+XDIR_FileSize+4) * (0x80000000 / bcs * 2) + lo / bcs + ((lo & (bcs - 1)) ? 1 : 0);
+}
+
+
+static
+void xdir_enter (	/* Go into the sub-directory of the entry set in the dirbuf[] */
+	DIR *dj			/* Directory object at its entry, the start cluster is set by the caller */
+)
+{
+	dj->pclust = dj->sclust;	/* The parent entry gets the size of the sub-directory on stretch */
+	dj->pxclen = dj->xclen;
+	dj->pidx = dj->index;
+	dj->xclen = xdir_ncont(dj->fs);
+}
+
+
+static
+FRESULT load_xdir (	/* FR_INT_ERR: Broken entry set */
+	DIR *dj			/* Directory object at the file entry, it is left at the last entry of the set */
+)
+{
+	FRESULT res;
+	UINT i, sz;
+	BYTE *dirb = dj->fs->dirbuf;
+
+
+	res = move_window(dj->fs, dj->sect);
+	if (res != FR_OK) return res;
+	if (dj->dir[XDIR_Type] != 0x85) return FR_INT_ERR;
+	sz = (dj->dir[XDIR_NumSec] + 1) * SZ_DIR;
+	if (sz < 3 * SZ_DIR || sz > 19 * SZ_DIR) return FR_INT_ERR;
+	mem_cpy(dirb, dj->dir, SZ_DIR);
+	for (i = SZ_DIR; i < sz; i += SZ_DIR) {
+		res = dir_next(dj, 0);
+		if (res == FR_NO_FILE) res = FR_INT_ERR;
+		if (res == FR_OK) res = move_window(dj->fs, dj->sect);
+		if (res != FR_OK) return res;
+		mem_cpy(dirb + i, dj->dir, SZ_DIR);
+	}
+	if (dirb[SZ_DIR+XDIR_Type] != 0xC0 || sz < (2 + (dirb[XDIR_NumName] + 14) / 15) * SZ_DIR)
+		return FR_INT_ERR;			/* Stream entry and enough name entries */
+	if (LD_WORD(dirb+XDIR_SetSum) != xdir_sum(dirb)) return FR_INT_ERR;
+	return FR_OK;
+}
+
+
+static
+FRESULT xdir_find (
+	DIR *dj			/* Directory object with the name in the lfn, left at the file entry */
+)
+{
+	FRESULT res;
+	WORD is, hash;
+	UINT nc;
+	BYTE *dirb = dj->fs->dirbuf;
+
+
+	for (nc = 0; dj->lfn[nc]; nc++) ;
+	hash = xname_sum(dj->lfn);
+	res = dir_sdi(dj, 0);
+	while (res == FR_OK) {
+#if _FS_DIR_PREFETCH
+		if (!(dj->index % (SS(dj->fs) / SZ_DIR))) dir_prefetch(dj, DIR_PREFETCH_FROM);
+#endif
+		res = move_window(dj->fs, dj->sect);
+		if (res != FR_OK) break;
+		if (dj->dir[XDIR_Type] == 0) { res = FR_NO_FILE; break; }	/* Reached to end of table */
+		if (dj->dir[XDIR_Type] == 0x85) {	/* File entry: load the set, check hash and length first */
+			is = dj->index;
+			res = load_xdir(dj);
+			if (res != FR_OK) break;
+			if (dirb[XDIR_NumName] == nc && LD_WORD(dirb+XDIR_NameHash) == hash && xname_cmp(dirb, dj->lfn)) {
+				res = dir_sdi(dj, is);
+				if (res == FR_OK) dj->dir = xdir_sfn(dj->fs);
+				break;
+			}
+		}
+		res = dir_next(dj, 0);
+	}
+	return res;
+}
+
+
+#if _FS_MINIMIZE <= 1
+static
+FRESULT xdir_read (
+	DIR *dj			/* Directory object, left at the last entry of the object read */
 )
 {
-	UINT i, s;
-	WCHAR wc, uc;
+	FRESULT res = FR_NO_FILE;
+	WORD is;
 
 
-	i = ((dir[LDIR_Ord] & ~LLE) - 1) * 13;	/* Get offset in the LFN buffer */
-	s = 0; wc = 1;
-	do {
-		uc = LD_WORD(dir+LfnOfs[s]);	/* Pick an LFN character from the entry */
-		if (wc) {	/* Last char has not been processed */
-			wc = ff_wtoupper(uc);		/* Convert it to upper case */
-			if (i >= _MAX_LFN || wc != ff_wtoupper(lfnbuf[i++]))	/* Compare it */
-				return 0;				/* Not matched */
-		} else {
-			if (uc != 0xFFFF) return 0;	/* Check filler */
+	while (dj->sect) {
+		res = move_window(dj->fs, dj->sect);
+		if (res != FR_OK) break;
+		if (dj->dir[XDIR_Type] == 0) { res = FR_NO_FILE; break; }	/* Reached to end of table */
+		if (dj->dir[XDIR_Type] == 0x85) {	/* File entry (others are bitmap, up-case table, label or deleted) */
+			is = dj->index;
+			res = load_xdir(dj);
+			if (res == FR_OK) {
+				xname_get(dj->fs->dirbuf, dj->lfn);
+				dj->lfn_idx = is;
+				dj->dir = xdir_sfn(dj->fs);
+			}
+			break;
 		}
-	} while (++s < 13);				/* Repeat until all chars in the entry are checked */
-
-	if ((dir[LDIR_Ord] & LLE) && wc && lfnbuf[i])	/* Last segment matched but different length */
-		return 0;
-
-	return 1;						/* The part of LFN matched */
+		res = dir_next(dj, 0);
+		if (res != FR_OK) break;
+	}
+	if (res != FR_OK) dj->sect = 0;
+	return res;
 }
+#endif
 
 
-
+#if !_FS_READONLY
 static
-int pick_lfn (			/* 1:Succeeded, 0:Buffer overflow */
-	WCHAR *lfnbuf,		/* Pointer to the Unicode-LFN buffer */
-	BYTE *dir			/* Pointer to the directory entry */
+FRESULT store_xdir (
+	DIR *dj			/* Directory object at the file entry of the set in the dirbuf[], left there */
 )
 {
-	UINT i, s;
-	WCHAR wc, uc;
-
-
-	i = ((dir[LDIR_Ord] & 0x3F) - 1) * 13;	/* Offset in the LFN buffer */
+	FRESULT res;
+	UINT n;
+	WORD is = dj->index;
+	BYTE *dirb = dj->fs->dirbuf;
 
-	s = 0; wc = 1;
-	do {
-		uc = LD_WORD(dir+LfnOfs[s]);		/* Pick an LFN character from the entry */
-		if (wc) {	/* Last char has not been processed */
-			if (i >= _MAX_LFN) return 0;	/* Buffer overflow? */
-			lfnbuf[i++] = wc = uc;			/* Store it */
-		} else {
-			if (uc != 0xFFFF) return 0;		/* Check filler */
-		}
-	} while (++s < 13);						/* Read all character in the entry */
 
-	if (dir[LDIR_Ord] & LLE) {				/* Put terminator if it is the last LFN part */
-		if (i >= _MAX_LFN) return 0;		/* Buffer overflow? */
-		lfnbuf[i] = 0;
+	ST_WORD(dirb+XDIR_SetSum, xdir_sum(dirb));
+	res = dir_sdi(dj, is);		/* The entry pointer may be the xsfn[] */
+	for (n = dirb[XDIR_NumSec] + 1; res == FR_OK; dirb += SZ_DIR) {
+		res = move_window(dj->fs, dj->sect);
+		if (res != FR_OK) break;
+		mem_cpy(dj->dir, dirb, SZ_DIR);
+		dj->fs->wflag = 1;
+		if (--n == 0) break;
+		res = dir_next(dj, 0);
+		if (res != FR_OK) break;
 	}
-
-	return 1;
+	if (res == FR_NO_FILE) res = FR_INT_ERR;
+	if (res == FR_OK) res = dir_sdi(dj, is);	/* Back to the file entry */
+	return res;
 }
 
 
-#if !_FS_READONLY
 static
-void fit_lfn (
-	const WCHAR *lfnbuf,	/* Pointer to the LFN buffer */
-	BYTE *dir,				/* Pointer to the directory entry */
-	BYTE ord,				/* LFN order (1-20) */
-	BYTE sum				/* SFN sum */
+FRESULT xdir_grow (
+	DIR *dj			/* Sub-directory stretched by a cluster: its entry in the parent is updated */
 )
 {
-	UINT i, s;
-	WCHAR wc;
-
+	FRESULT res;
+	DIR pdj;
+	DWORD sz;
+	BYTE *dirb = dj->fs->dirbuf;
 
-	dir[LDIR_Chksum] = sum;			/* Set check sum */
-	dir[LDIR_Attr] = AM_LFN;		/* Set attribute. LFN entry */
-	dir[LDIR_Type] = 0;
-	ST_WORD(dir+LDIR_FstClusLO, 0);
 
-	i = (ord - 1) * 13;				/* Get offset in the LFN buffer */
-	s = wc = 0;
-	do {
-		if (wc != 0xFFFF) wc = lfnbuf[i++];	/* Get an effective char */
-		ST_WORD(dir+LfnOfs[s], wc);	/* Put it */
-		if (!wc) wc = 0xFFFF;		/* Padding chars following last char */
-	} while (++s < 13);
-	if (wc == 0xFFFF || !lfnbuf[i]) ord |= LLE;	/* Bottom LFN part is the start of LFN sequence */
-	dir[LDIR_Ord] = ord;			/* Set the LFN order */
+	pdj.fs = dj->fs; pdj.sclust = dj->pclust; pdj.xclen = dj->pxclen;
+	res = dir_sdi(&pdj, dj->pidx);
+	if (res == FR_OK) res = load_xdir(&pdj);
+	if (res == FR_OK) res = dir_sdi(&pdj, dj->pidx);
+	if (res == FR_OK) {
+		sz = LD_DWORD(dirb+XDIR_FileSize) + (DWORD)dj->fs->csize * SS(dj->fs);
+		ST_DWORD(dirb+XDIR_FileSize, sz);		/* Directories are always valid to the end */
+		ST_DWORD(dirb+XDIR_ValidFileSize, sz);
+		dirb[XDIR_GenFlags] = dj->xclen ? 3 : 1;
+		res = store_xdir(&pdj);
+	}
+	return res;
 }
 
-#endif
-#endif
-
 
-
-/*-----------------------------------------------------------------------*/
-/* Create numbered name                                                  */
-/*-----------------------------------------------------------------------*/
-#if _USE_LFN
-void gen_numname (
-	BYTE *dst,			/* Pointer to generated SFN */
-	const BYTE *src,	/* Pointer to source SFN to be modified */
-	const WCHAR *lfn,	/* Pointer to LFN */
-	WORD seq			/* Sequence number */
+static
+FRESULT xdir_register (
+	DIR *dj			/* Directory object with the name in the lfn, left at the file entry */
 )
 {
-	BYTE ns[8], c;
-	UINT i, j;
+	FRESULT res;
+	UINT nc, ne, n, di, i;
+	WORD is;
+	DWORD tm;
+	BYTE *dirb = dj->fs->dirbuf;
 
 
-	mem_cpy(dst, src, 11);
+	if (dj->fn[NS] & NS_DOT) return FR_INVALID_NAME;	/* No dot entries on exFAT */
+	for (nc = 0; dj->lfn[nc]; nc++) ;
+	ne = (nc + 14) / 15 + 2;		/* File, stream and name entries */
 
-	if (seq > 5) {	/* On many collisions, generate a hash number instead of sequential number */
-		do seq = (seq >> 1) + (seq << 15) + (WORD)*lfn++; while (*lfn);
+	/* Reserve contiguous entries (unused or deleted: bit 7 of the type is clear) */
+	res = dir_sdi(dj, 0);
+	n = is = 0;
+	while (res == FR_OK) {
+#if _FS_DIR_PREFETCH
+		if (!(dj->index % (SS(dj->fs) / SZ_DIR))) dir_prefetch(dj, DIR_PREFETCH_FROM);
+#endif
+		res = move_window(dj->fs, dj->sect);
+		if (res != FR_OK) break;
+		if (!(dj->dir[XDIR_Type] & 0x80)) {
+			if (n == 0) is = dj->index;
+			if (++n == ne) break;
+		} else {
+			n = 0;
+		}
+		res = dir_next(dj, 1);		/* Next entry with table stretch */
 	}
+	if (res != FR_OK) return res;
 
-	/* itoa (hexdecimal) */
-	i = 7;
-	do {
-		c = (seq % 16) + '0';
-		if (c > '9') c += 7;
-		ns[i--] = c;
-		seq /= 16;
-	} while (seq);
-	ns[i] = '~';
-
-	/* Append the number */
-	for (j = 0; j < i && dst[j] != ' '; j++) {
-		if (IsDBCS1(dst[j])) {
-			if (j == i - 1) break;
-			j++;
+	/* Create the entry set of an empty file */
+	mem_set(dirb, 0, ne * SZ_DIR);
+	dirb[XDIR_Type] = 0x85;
+	dirb[XDIR_NumSec] = (BYTE)(ne - 1);
+	tm = get_fattime();
+	ST_DWORD(dirb+XDIR_CrtTime, tm);
+	ST_DWORD(dirb+XDIR_ModTime, tm);
+	ST_DWORD(dirb+XDIR_AccTime, tm);
+	dirb[SZ_DIR+XDIR_Type] = 0xC0;
+	dirb[XDIR_GenFlags] = 1;		/* AllocationPossible */
+	dirb[XDIR_NumName] = (BYTE)nc;
+	ST_WORD(dirb+XDIR_NameHash, xname_sum(dj->lfn));
+	for (i = 0, di = SZ_DIR * 2; i < nc; i++, di += 2) {
+		if (di % SZ_DIR == 0) {		/* Name entry header */
+			dirb[di] = 0xC1; di += 2;
 		}
+		ST_WORD(dirb + di, dj->lfn[i]);
 	}
-	do {
-		dst[j++] = (i < 8) ? ns[i++] : ' ';
-	} while (j < 8);
+	res = dir_sdi(dj, is);
+	if (res == FR_OK) res = store_xdir(dj);
+	if (res == FR_OK) dj->dir = xdir_sfn(dj->fs);
+	return res;
 }
-#endif
-
 
 
-
-/*-----------------------------------------------------------------------*/
-/* Calculate sum of an SFN                                               */
-/*-----------------------------------------------------------------------*/
-#if _USE_LFN
+#if !_FS_MINIMIZE
 static
-BYTE sum_sfn (
-	const BYTE *dir		/* Ptr to directory entry */
+FRESULT xdir_remove (
+	DIR *dj			/* Directory object at the file entry of the object */
 )
 {
-	BYTE sum = 0;
-	UINT n = 11;
+	FRESULT res;
+	UINT n;
 
-	do sum = (sum >> 1) + (sum << 7) + *dir++; while (--n);
-	return sum;
+
+	res = dir_sdi(dj, dj->index);
+	if (res == FR_OK) res = move_window(dj->fs, dj->sect);
+	if (res != FR_OK) return res;
+	for (n = dj->dir[XDIR_NumSec] + 1; ; ) {
+		dj->dir[XDIR_Type] &= 0x7F;		/* Clear InUse bit of each entry */
+		dj->fs->wflag = 1;
+		if (--n == 0) break;
+		res = dir_next(dj, 0);
+		if (res == FR_OK) res = move_window(dj->fs, dj->sect);
+		if (res != FR_OK) break;
+	}
+	return (res == FR_NO_FILE) ? FR_INT_ERR : res;
 }
 #endif
+#endif /* !_FS_READONLY */
+#endif /* _FS_EXFAT */
 
 
 
 
-/*-----------------------------------------------------------------------*/
-/* Directory handling - Find an object in the directory                  */
-/*-----------------------------------------------------------------------*/
-
 static
 FRESULT dir_find (
 	DIR *dj			/* Pointer to the directory object linked to the file name */
 )
 {
-	FRESULT res;
-	BYTE c, *dir;
-#if _USE_LFN
-	BYTE a, ord, sum;
+#if _FS_DIRINDEX
+	FRESULT res, rb;
+	DIR sdj;
 #endif
 
-	res = dir_sdi(dj, 0);			/* Rewind directory object */
-	if (res != FR_OK) return res;
 
-#if _USE_LFN
-	ord = sum = 0xFF;
-#endif
-	do {
-		res = move_window(dj->fs, dj->sect);
-		if (res != FR_OK) break;
-		dir = dj->dir;					/* Ptr to the directory entry of current index */
-		c = dir[DIR_Name];
-		if (c == 0) { res = FR_NO_FILE; break; }	/* Reached to end of table */
-#if _USE_LFN	/* LFN configuration */
-		a = dir[DIR_Attr] & AM_MASK;
-		if (c == DDE || ((a & AM_VOL) && a != AM_LFN)) {	/* An entry without valid data */
-			ord = 0xFF;
-		} else {
-			if (a == AM_LFN) {			/* An LFN entry is found */
-				if (dj->lfn) {
-					if (c & LLE) {		/* Is it start of LFN sequence? */
-						sum = dir[LDIR_Chksum];
-						c &= ~LLE; ord = c;	/* LFN start order */
-						dj->lfn_idx = dj->index;
-					}
-					/* Check validity of the LFN entry and compare it with given name */
-					ord = (c == ord && sum == dir[LDIR_Chksum] && cmp_lfn(dj->lfn, dir)) ? ord - 1 : 0xFF;
-				}
-			} else {					/* An SFN entry is found */
-				if (!ord && sum == sum_sfn(dir)) break;	/* LFN matched? */
-				ord = 0xFF; dj->lfn_idx = 0xFFFF;	/* Reset LFN sequence */
-				if (!(dj->fn[NS] & NS_LOSS) && !mem_cmp(dir, dj->fn, 11)) break;	/* SFN matched? */
-			}
-		}
-#else		/* Non LFN configuration */
-		if (!(dir[DIR_Attr] & AM_VOL) && !mem_cmp(dir, dj->fn, 11)) /* Is it a valid entry? */
-			break;
+#if _FS_EXFAT
+	if (dj->fs->fs_type == FS_EXFAT) return xdir_find(dj);
 #endif
-		res = dir_next(dj, 0);		/* Next entry */
-	} while (res == FR_OK);
+#if _FS_DIRINDEX
 
+	if (dj->fs->didx_clust == dj->sclust) {
+		if (dj->fs->didx_stat == DIDX_VALID) return didx_find(dj);
+		if (dj->fs->didx_stat == DIDX_FULL) return dir_scan(dj, 0, 0);
+	}
+	res = dir_scan(dj, 0, 0);
+	if ((res == FR_OK || res == FR_NO_FILE) && dj->index >= DIDX_MIN) {
+		mem_cpy(&sdj, dj, sizeof(DIR));	/* Large directory: index it for the next searches */
+		rb = didx_build(&sdj);
+		if (rb == FR_OK && res == FR_OK) rb = move_window(dj->fs, dj->sect);	/* Restore the found entry */
+		if (rb != FR_OK) res = rb;
+	}
 	return res;
+#else
+	return dir_scan(dj, 0, 0);
+#endif
 }
+#if _FS_STATS
+#define	dir_find(dj)	STAT_CALL(FFS_DIR_FIND, (dir_find)(dj))
+#endif
 
 
 
@@ -1421,6 +3133,9 @@ FRESULT dir_read (
 	BYTE a, ord = 0xFF, sum = 0xFF;
 #endif
 
+#if _FS_EXFAT
+	if (dj->fs->fs_type == FS_EXFAT) return xdir_read(dj);
+#endif
 	res = FR_NO_FILE;
 	while (dj->sect) {
 		res = move_window(dj->fs, dj->sect);
@@ -1480,6 +3195,9 @@ FRESULT dir_register (	/* FR_OK:Successful, FR_DENIED:No free entry or too many
 	WCHAR *lfn;
 
 
+#if _FS_EXFAT
+	if (dj->fs->fs_type == FS_EXFAT) return xdir_register(dj);
+#endif
 	fn = dj->fn; lfn = dj->lfn;
 	mem_cpy(sn, fn, 12);
 
@@ -1510,6 +3228,9 @@ FRESULT dir_register (	/* FR_OK:Successful, FR_DENIED:No free entry or too many
 	if (res != FR_OK) return res;
 	n = is = 0;
 	do {
+#if _FS_DIR_PREFETCH
+		if (!(dj->index % (SS(dj->fs) / SZ_DIR))) dir_prefetch(dj, DIR_PREFETCH_FROM);
+#endif
 		res = move_window(dj->fs, dj->sect);
 		if (res != FR_OK) break;
 		c = *dj->dir;				/* Check the entry status */
@@ -1541,6 +3262,9 @@ FRESULT dir_register (	/* FR_OK:Successful, FR_DENIED:No free entry or too many
 	res = dir_sdi(dj, 0);
 	if (res == FR_OK) {
 		do {	/* Find a blank entry for the SFN */
+#if _FS_DIR_PREFETCH
+			if (!(dj->index % (SS(dj->fs) / SZ_DIR))) dir_prefetch(dj, DIR_PREFETCH_FROM);
+#endif
 			res = move_window(dj->fs, dj->sect);
 			if (res != FR_OK) break;
 			c = *dj->dir;
@@ -1560,11 +3284,24 @@ FRESULT dir_register (	/* FR_OK:Successful, FR_DENIED:No free entry or too many
 			dir[DIR_NTres] = *(dj->fn+NS) & (NS_BODY | NS_EXT);	/* Put NT flag */
 #endif
 			dj->fs->wflag = 1;
+#if _FS_DIRINDEX
+			if (dj->fs->didx_clust == dj->sclust) {	/* Add the object to the index of the directory */
+#if _USE_LFN
+				if (sn[NS] & NS_LFN)
+					didx_put(dj->fs, hash_lfn(dj->lfn), is);
+				else
+#endif
+				didx_put(dj->fs, hash_sfn(dir), dj->index);
+			}
+#endif
 		}
 	}
 
 	return res;
 }
+#if _FS_STATS
+#define	dir_register(dj)	STAT_CALL(FFS_DIR_REGISTER, (dir_register)(dj))
+#endif
 #endif /* !_FS_READONLY */
 
 
@@ -1583,6 +3320,9 @@ FRESULT dir_remove (	/* FR_OK: Successful, FR_DISK_ERR: A disk error */
 #if _USE_LFN	/* LFN configuration */
 	WORD i;
 
+#if _FS_EXFAT
+	if (dj->fs->fs_type == FS_EXFAT) return xdir_remove(dj);
+#endif
 	i = dj->index;	/* SFN index */
 	res = dir_sdi(dj, (WORD)((dj->lfn_idx == 0xFFFF) ? i : dj->lfn_idx));	/* Goto the SFN or top of the LFN entries */
 	if (res == FR_OK) {
@@ -1847,6 +3587,21 @@ void get_fileinfo (		/* No return code */
 	p = fno->fname;
 	if (dj->sect) {
 		dir = dj->dir;
+#if _FS_EXFAT
+		if (dj->fs->fs_type == FS_EXFAT) {	/* No SFN on exFAT: the name if it is short, else "?" */
+			WCHAR w;
+			for (i = 0; dj->lfn[i] && i < 12; i++) {
+				w = dj->lfn[i];
+#if !_LFN_UNICODE
+				w = ff_convert(w, 0);
+				if (!w || w >= 0x100) break;
+#endif
+				p[i] = (TCHAR)w;
+			}
+			if (i && !dj->lfn[i]) p += i; else *p++ = '?';
+		} else
+#endif
+		{
 		nt = dir[DIR_NTres];		/* NT flag */
 		for (i = 0; i < 8; i++) {	/* Copy name body */
 			c = dir[i];
@@ -1876,6 +3631,7 @@ void get_fileinfo (		/* No return code */
 				*p++ = c;
 			}
 		}
+		}
 		fno->fattrib = dir[DIR_Attr];				/* Attribute */
 		fno->fsize = LD_DWORD(dir+DIR_FileSize);	/* Size */
 		fno->fdate = LD_WORD(dir+DIR_WrtDate);		/* Date */
@@ -1936,6 +3692,9 @@ FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 		path++;
 	dj->sclust = 0;						/* Start from the root dir */
 #endif
+#if _FS_EXFAT
+	dj->xclen = 0;						/* Root or current dir has a FAT chain (exFAT) */
+#endif
 
 	if ((UINT)*path < ' ') {			/* Nul path means the start directory itself */
 		res = dir_sdi(dj, 0);
@@ -1952,6 +3711,9 @@ FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 				/* Object not found */
 				if (_FS_RPATH && (ns & NS_DOT)) {	/* If dot entry is not exit */
 					dj->sclust = 0; dj->dir = 0;	/* It is the root dir */
+#if _FS_EXFAT
+					dj->xclen = 0;
+#endif
 					res = FR_OK;
 					if (!(ns & NS_LAST)) continue;
 				} else {							/* Could not find the object */
@@ -1964,12 +3726,18 @@ FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 			if (!(dir[DIR_Attr] & AM_DIR)) {	/* Cannot follow because it is a file */
 				res = FR_NO_PATH; break;
 			}
+#if _FS_EXFAT
+			if (dj->fs->fs_type == FS_EXFAT) xdir_enter(dj);
+#endif
 			dj->sclust = LD_CLUST(dir);
 		}
 	}
 
 	return res;
 }
+#if _FS_STATS
+#define	follow_path(dj, path)	STAT_CALL(FFS_FOLLOW_PATH, (follow_path)(dj, path))
+#endif
 
 
 
@@ -1979,7 +3747,7 @@ FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 /*-----------------------------------------------------------------------*/
 
 static
-BYTE check_fs (	/* 0:FAT-VBR, 1:Valid BR but not FAT, 2:Not a BR, 3:Disk error */
+BYTE check_fs (	/* 0:FAT/exFAT-VBR, 1:Valid BR but not FAT, 2:Not a BR, 3:Disk error */
 	FATFS *fs,	/* File system object */
 	DWORD sect	/* Sector# (lba) to check if it is an FAT boot record or not */
 )
@@ -1993,6 +3761,10 @@ BYTE check_fs (	/* 0:FAT-VBR, 1:Valid BR but not FAT, 2:Not a BR, 3:Disk error *
 		return 0;
 	if ((LD_DWORD(&fs->win[BS_FilSysType32]) & 0xFFFFFF) == 0x544146)
 		return 0;
+#if _FS_EXFAT
+	if (!mem_cmp(&fs->win[BS_OEMName], "EXFAT   ", 8))	/* exFAT sets fs_type by itself, see chk_mounted */
+		return 0;
+#endif
 
 	return 1;
 }
@@ -2000,6 +3772,78 @@ BYTE check_fs (	/* 0:FAT-VBR, 1:Valid BR but not FAT, 2:Not a BR, 3:Disk error *
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Check the exFAT boot record and find the allocation bitmap            */
+/*-----------------------------------------------------------------------*/
+#if _FS_EXFAT
+static
+FRESULT xvol_init (	/* FR_OK(0): exFAT volume, FR_NO_FILESYSTEM: Invalid or not supported */
+	FATFS *fs,		/* File system object with the boot record in the win[] */
+	DWORD bsect		/* Sector# of the boot record */
+)
+{
+	FRESULT res;
+	DIR dj;
+	DWORD nclst, cl, nxt, ncl, sz, bcs;
+	UINT i;
+
+
+	for (i = BPB_ZeroedEx; i < BPB_ZeroedEx + 53 && !fs->win[i]; i++) ;
+	if (i < BPB_ZeroedEx + 53) return FR_NO_FILESYSTEM;				/* (No FAT BPB in exFAT) */
+	if (LD_WORD(fs->win+BPB_FSVerEx) != 0x100) return FR_NO_FILESYSTEM;	/* (Version 1.00) */
+	if (fs->win[BPB_BytsPerSecEx] > 12 || (1U << fs->win[BPB_BytsPerSecEx]) != SS(fs))
+		return FR_NO_FILESYSTEM;									/* (Must be equal to the physical sector size) */
+	if (LD_DWORD(fs->win+BPB_TotSecEx+4)) return FR_NO_FILESYSTEM;		/* (Sector# must fit a DWORD) */
+	if (fs->win[BPB_NumFATsEx] != 1) return FR_NO_FILESYSTEM;			/* (TexFAT is not supported) */
+	if (fs->win[BPB_BytsPerSecEx] + fs->win[BPB_SecPerClusEx] > 20)
+		return FR_NO_FILESYSTEM;									/* (Clusters up to 1 MB) */
+	nclst = LD_DWORD(fs->win+BPB_NumClusEx);
+	if (!nclst || nclst > 0x7FFFFFFD) return FR_NO_FILESYSTEM;		/* (Cluster# has 31 bits in get_fat) */
+
+	fs->csize = 1 << fs->win[BPB_SecPerClusEx];
+	fs->n_fatent = nclst + 2;
+	fs->fatbase = bsect + LD_DWORD(fs->win+BPB_FatOfsEx);
+	fs->fsize = LD_DWORD(fs->win+BPB_FatSzEx);
+	fs->n_fats = 1;
+	fs->n_rootdir = 0;
+	fs->database = bsect + LD_DWORD(fs->win+BPB_DataOfsEx);
+	fs->dirbase = LD_DWORD(fs->win+BPB_RootClusEx);					/* Root directory start cluster */
+	if (fs->fsize < (fs->n_fatent * 4 + (SS(fs) - 1)) / SS(fs))		/* (FAT must not be less than required) */
+		return FR_NO_FILESYSTEM;
+	if (fs->dirbase < 2 || fs->dirbase >= fs->n_fatent) return FR_NO_FILESYSTEM;
+
+	/* Find the allocation bitmap entry in the root directory */
+	fs->fs_type = FS_EXFAT;			/* Directory functions need it, the caller clears it on error */
+	dj.fs = fs; dj.sclust = 0; dj.xclen = 0;
+	res = dir_sdi(&dj, 0);
+	while (res == FR_OK) {
+		res = move_window(fs, dj.sect);
+		if (res != FR_OK) break;
+		if (dj.dir[XDIR_Type] == 0) { res = FR_NO_FILESYSTEM; break; }	/* (Bitmap must exist) */
+		if (dj.dir[XDIR_Type] == 0x81) break;
+		res = dir_next(&dj, 0);
+	}
+	if (res == FR_NO_FILE || res == FR_INT_ERR) res = FR_NO_FILESYSTEM;
+	if (res != FR_OK) return res;
+	cl = LD_DWORD(dj.dir+XDIR_BmpFstClus);
+	sz = LD_DWORD(dj.dir+XDIR_BmpSize);
+	bcs = (DWORD)fs->csize * SS(fs);
+	ncl = (sz + bcs - 1) / bcs;
+	if (LD_DWORD(dj.dir+XDIR_BmpSize+4) || sz < (nclst + 7) / 8 || cl < 2 || cl + ncl > fs->n_fatent)
+		return FR_NO_FILESYSTEM;									/* (Bitmap must cover the volume) */
+	fs->bitbase = clust2sect(fs, cl);
+	for ( ; ncl > 1; ncl--, cl++) {									/* (Bitmap must be contiguous) */
+		nxt = get_fat(fs, cl);
+		if (nxt == 0xFFFFFFFF) return FR_DISK_ERR;
+		if (nxt != cl + 1) return FR_NO_FILESYSTEM;
+	}
+	return FR_OK;
+}
+#endif /* _FS_EXFAT */
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Check if the file system object is valid or not                       */
 /*-----------------------------------------------------------------------*/
@@ -2018,6 +3862,13 @@ FRESULT chk_mounted (	/* FR_OK(0): successful, !=0: any error occurred */
 	WORD nrsv;
 	const TCHAR *p = *path;
 	FATFS *fs;
+#if _FS_WARM
+	const FFSTATE *st;
+	BYTE fsi_ok = 0;
+#endif
+#if _FS_EXFAT
+	FRESULT res;
+#endif
 
 	/* Get logical drive number from the path name */
 	vol = p[0] - '0';					/* Is there a drive number? */
@@ -2062,6 +3913,17 @@ FRESULT chk_mounted (	/* FR_OK(0): successful, !=0: any error occurred */
 	if (disk_ioctl(fs->drv, GET_SECTOR_SIZE, &fs->ssize) != RES_OK)
 		return FR_DISK_ERR;
 #endif
+#if _FS_WARM
+	/* Snapshot of this card gives the boot record of the volume (kept across resets) */
+	fs->st_ok = (disk_ioctl(fs->drv, MMC_GET_CID, fs->st_cid) == RES_OK);
+	st = fs->st_ok ? ff_state_get(vol) : 0;
+	if (st && (mem_cmp(st->cid, fs->st_cid, sizeof(st->cid)) || check_fs(fs, st->bsect)))
+		st = 0;
+	if (st) {
+		bsect = st->bsect; fmt = 0;
+	} else
+#endif
+	{
 	/* Search FAT partition on the drive. Supports only generic partitionings, FDISK and SFD. */
 	fmt = check_fs(fs, bsect = 0);		/* Load sector 0 and check if it is an FAT-VBR (in SFD) */
 	if (LD2PT(vol) && !fmt) fmt = 1;	/* Force non-SFD if the volume is forced partition */
@@ -2075,9 +3937,33 @@ FRESULT chk_mounted (	/* FR_OK(0): successful, !=0: any error occurred */
 			fmt = check_fs(fs, bsect);		/* Check the partition */
 		}
 	}
+	}
 	if (fmt == 3) return FR_DISK_ERR;
 	if (fmt) return FR_NO_FILESYSTEM;		/* No FAT volume is found */
+	fs->winsect = 0;		/* Invalidate sector cache */
+	fs->wflag = 0;
+#if _FS_FATWIN
+	fs->fatsect = 0;
+	fs->fwflag = 0;
+#endif
+#if _FS_CACHE
+	mem_set(fs->cache, 0, sizeof(fs->cache));
+#endif
 
+#if _FS_EXFAT
+	if (!mem_cmp(fs->win+BS_OEMName, "EXFAT   ", 8)) {	/* An exFAT volume is found */
+#if _FS_WARM
+		fs->st_volid = LD_DWORD(fs->win+BPB_VolIDEx);
+#endif
+		res = xvol_init(fs, bsect);
+		if (res != FR_OK) {
+			fs->fs_type = 0;
+			return res;
+		}
+		fmt = FS_EXFAT;
+	} else
+#endif
+	{
 	/* An FAT volume is found. Following code initializes the file system object */
 
 	if (LD_WORD(fs->win+BPB_BytsPerSec) != SS(fs))		/* (BPB_BytsPerSec must be equal to the physical sector size) */
@@ -2128,38 +4014,89 @@ FRESULT chk_mounted (	/* FR_OK(0): successful, !=0: any error occurred */
 	}
 	if (fs->fsize < (szbfat + (SS(fs) - 1)) / SS(fs))	/* (BPB_FATSz must not be less than required) */
 		return FR_NO_FILESYSTEM;
+#if _FS_WARM
+	fs->st_volid = LD_DWORD(fs->win + (fmt == FS_FAT32 ? BS_VolID32 : BS_VolID));
+#endif
+	}
 
+#if _FS_WARM
+	fs->st_bsect = bsect;
+	if (st && (st->volid != fs->st_volid || st->n_fatent != fs->n_fatent || st->database != fs->database))
+		st = 0;		/* The volume was formatted again */
+#endif
 #if !_FS_READONLY
 	/* Initialize cluster allocation information */
 	fs->free_clust = 0xFFFFFFFF;
 	fs->last_clust = 0;
+#if _USE_MAINTAIN
+	fs->pre_clust = 0;
+#endif
 
 	/* Get fsinfo if available */
+#if _FS_FSYNC
+	fs->fsi_time = get_msec();
+#endif
 	if (fmt == FS_FAT32) {
 	 	fs->fsi_flag = 0;
 		fs->fsi_sector = bsect + LD_WORD(fs->win+BPB_FSInfo);
+#if _FS_WARM
+		if (!st || st->cold)			/* Snapshot is newer than FSInfo (unless it is checked against it) */
+#endif
 		if (disk_read(fs->drv, fs->win, fs->fsi_sector, 1) == RES_OK &&
 			LD_WORD(fs->win+BS_55AA) == 0xAA55 &&
 			LD_DWORD(fs->win+FSI_LeadSig) == 0x41615252 &&
 			LD_DWORD(fs->win+FSI_StrucSig) == 0x61417272) {
 				fs->last_clust = LD_DWORD(fs->win+FSI_Nxt_Free);
 				fs->free_clust = LD_DWORD(fs->win+FSI_Free_Count);
+#if _FS_WARM
+				fsi_ok = 1;
+#endif
 		}
 	}
+#if _FS_WARM
+	fs->st_fsi_free = fs->free_clust;	/* FSInfo on the disk (initial values if there is none) */
+	fs->st_fsi_next = fs->last_clust;
+	if (st && st->cold && (!fsi_ok || st->fsi_free != fs->free_clust || st->fsi_next != fs->last_clust))
+		st = 0;		/* The disk was written after the snapshot, or it can't be told */
+	if (st) {
+		fs->last_clust = st->last_clust;
+		fs->free_clust = st->free_clust;
+		fs->st_fsi_free = st->fsi_free;
+		fs->st_fsi_next = st->fsi_next;
+	}
+	fs->st_used = (st != 0);
+#endif
 #endif
 	fs->fs_type = fmt;		/* FAT sub-type */
 	fs->id = ++Fsid;		/* File system mount ID */
-	fs->winsect = 0;		/* Invalidate sector cache */
-	fs->wflag = 0;
+#if _FS_DIRINDEX
+	fs->didx_stat = DIDX_NONE;	/* Directories are indexed on the first search */
+#endif
+#if _USE_FASTSEEK && _FS_CLMT_FILES
+	mem_set(fs->clmt_owner, 0, sizeof(fs->clmt_owner));	/* Files of the previous mount are invalid */
+#endif
+#if _FS_FMAP
+	fs->fmgrp = (fs->n_fatent + _FS_FMAP * 8 - 1) / (_FS_FMAP * 8);	/* Every group may have a free cluster */
+	mem_set(fs->fmap, 0xFF, _FS_FMAP);
+#if _FS_WARM
+	if (st) mem_cpy(fs->fmap, st->fmap, _FS_FMAP);	/* Full groups of the snapshot */
+#endif
+#endif
 #if _FS_RPATH
 	fs->cdir = 0;			/* Current directory (root dir) */
 #endif
 #if _FS_SHARE				/* Clear file lock semaphores */
 	clear_lock(fs);
 #endif
+#if _FS_WARM
+	if (!st) state_save(fs);	/* Snapshot of the fresh mount */
+#endif
 
 	return FR_OK;
 }
+#if _FS_STATS
+#define	chk_mounted(path, rfs, wp)	STAT_CALL(FFS_CHK_MOUNTED, (chk_mounted)(path, rfs, wp))
+#endif
 
 
 
@@ -2216,6 +4153,9 @@ FRESULT f_mount (
 #if _FS_SHARE
 		clear_lock(rfs);
 #endif
+#if _FS_FSYNC					/* Write deferred FSInfo of the current volume */
+		if (rfs->fs_type && rfs->fsi_flag && sync(rfs, 2) != FR_OK) return FR_DISK_ERR;
+#endif
 #if _FS_REENTRANT				/* Discard sync object of the current volume */
 		if (!ff_del_syncobj(rfs->sobj)) return FR_INT_ERR;
 #endif
@@ -2249,6 +4189,9 @@ FRESULT f_open (
 	FRESULT res;
 	DIR dj;
 	BYTE *dir;
+#if _FS_EXFAT
+	DWORD ncl;
+#endif
 	DEF_NAMEBUF;
 
 
@@ -2265,6 +4208,10 @@ FRESULT f_open (
 	if (res == FR_OK)
 		res = follow_path(&dj, path);	/* Follow the file path */
 	dir = dj.dir;
+#if _FS_EXFAT
+	if (res == FR_OK && dir && dj.fs->fs_type == FS_EXFAT && LD_DWORD(dj.fs->dirbuf+XDIR_FileSize+4))
+		res = FR_DENIED;				/* Files of 4 GB and larger can not be accessed */
+#endif
 
 #if !_FS_READONLY	/* R/W configuration */
 	if (res == FR_OK) {
@@ -2297,6 +4244,27 @@ FRESULT f_open (
 					res = FR_EXIST;
 			}
 		}
+#if _FS_EXFAT
+		if (res == FR_OK && (mode & FA_CREATE_ALWAYS) && dj.fs->fs_type == FS_EXFAT) {	/* Truncate the entry set */
+			BYTE *dirb = dj.fs->dirbuf;
+			cl = LD_CLUST(dir);
+			ncl = xdir_ncont(dj.fs);
+			dw = get_fattime();
+			ST_DWORD(dirb+XDIR_CrtTime, dw);
+			ST_DWORD(dirb+XDIR_ModTime, dw);
+			ST_WORD(dirb+XDIR_Attr, 0);
+			dirb[XDIR_GenFlags] = 1;
+			ST_DWORD(dirb+XDIR_FstClus, 0);
+			mem_set(dirb+XDIR_ValidFileSize, 0, 8);
+			mem_set(dirb+XDIR_FileSize, 0, 8);
+			res = store_xdir(&dj);
+			if (res == FR_OK && cl) {
+				res = remove_chain(dj.fs, cl, ncl);
+				if (res == FR_OK) dj.fs->last_clust = cl - 1;
+			}
+			dir = xdir_sfn(dj.fs);
+		} else
+#endif
 		if (res == FR_OK && (mode & FA_CREATE_ALWAYS)) {	/* Truncate it if overwrite mode */
 			dw = get_fattime();					/* Created time */
 			ST_DWORD(dir+DIR_CrtTime, dw);
@@ -2307,7 +4275,7 @@ FRESULT f_open (
 			dj.fs->wflag = 1;
 			if (cl) {							/* Remove the cluster chain if exist */
 				dw = dj.fs->winsect;
-				res = remove_chain(dj.fs, cl);
+				res = remove_chain(dj.fs, cl, 0);
 				if (res == FR_OK) {
 					dj.fs->last_clust = cl - 1;	/* Reuse the cluster hole */
 					res = move_window(dj.fs, dw);
@@ -2330,6 +4298,11 @@ FRESULT f_open (
 			mode |= FA__WRITTEN;
 		fp->dir_sect = dj.fs->winsect;			/* Pointer to the directory entry */
 		fp->dir_ptr = dir;
+#if _FS_EXFAT
+		fp->dir_sclust = dj.sclust;				/* Entry set is located by its index (exFAT) */
+		fp->dir_xclen = dj.xclen;
+		fp->dir_idx = dj.index;
+#endif
 #if _FS_SHARE
 		fp->lockid = inc_lock(&dj, (mode & ~FA_READ) ? 1 : 0);
 		if (!fp->lockid) res = FR_INT_ERR;
@@ -2352,12 +4325,44 @@ FRESULT f_open (
 		fp->flag = mode;					/* File access mode */
 		fp->sclust = LD_CLUST(dir);			/* File start cluster */
 		fp->fsize = LD_DWORD(dir+DIR_FileSize);	/* File size */
+#if _FS_EXFAT
+		if (dj.fs->fs_type == FS_EXFAT)		/* Written size, the allocation may be longer */
+			fp->fsize = LD_DWORD(dj.fs->dirbuf+XDIR_ValidFileSize);
+#endif
 		fp->fptr = 0;						/* File pointer */
 		fp->dsect = 0;
 #if _USE_FASTSEEK
 		fp->cltbl = 0;						/* Normal seek mode */
+#endif
+#if _FS_READ_AHEAD
+		fp->rdnext = 0;						/* Reading from the top is sequential */
+#endif
+#if _USE_EXPAND
+		fp->eclust = 0;						/* Contiguity of the chain is unknown */
+#endif
+#if _FS_EXFAT
+		fp->xstat = 0;
+		ncl = (dj.fs->fs_type == FS_EXFAT && fp->sclust) ? xdir_ncont(dj.fs) : 0;
+		if (ncl) {							/* Contiguous file without FAT chain */
+			fp->xstat = 2;
+			fp->eclust = fp->sclust + ncl - 1;
+		}
+#endif
+#if _FS_RESERVE
+		fp->rsv_clust = 0;					/* No allocation window */
+#endif
+#if _FS_WCOMB
+		fp->wccnt = 0;						/* Write-combining buffer is empty */
+#endif
+#if _FS_DSYNC
+		fp->dir_time = get_msec();			/* Directory entry is up to date */
+		fp->dir_size = fp->fsize;
 #endif
 		fp->fs = dj.fs; fp->id = dj.fs->id;	/* Validate file object */
+#if _USE_FASTSEEK && _FS_CLMT_FILES
+		if (!(mode & FA_WRITE))
+			clmt_attach(fp);				/* Build CLMT for fast random access */
+#endif
 	}
 
 	LEAVE_FF(dj.fs, res);
@@ -2366,6 +4371,59 @@ FRESULT f_open (
 
 
 
+#if _USE_EXPAND
+/*-----------------------------------------------------------------------*/
+/* Clip a direct transfer at the end of the contiguous chain             */
+/*-----------------------------------------------------------------------*/
+
+static
+UINT cont_sects (	/* Number of sectors to transfer */
+	FIL *fp,		/* Pointer to the file object */
+	UINT csect,		/* Sector offset in the current cluster */
+	UINT cc			/* Number of sectors requested */
+)
+{
+	DWORD n, ncl, cl;
+#if _USE_FASTSEEK
+	DWORD *tbl;
+#endif
+
+
+	n = fp->fs->csize - csect;			/* Sectors to the end of the current cluster */
+	if (fp->clust < fp->eclust) {		/* Following clusters are contiguous */
+		ncl = fp->eclust - fp->clust;
+	}
+#if _USE_FASTSEEK
+	else if (fp->cltbl) {				/* Rest of the current fragment in the CLMT */
+		tbl = fp->cltbl + 1;
+		cl = fp->fptr / SS(fp->fs) / fp->fs->csize;
+		while (*tbl && cl >= *tbl) {
+			cl -= *tbl; tbl += 2;
+		}
+		ncl = *tbl ? *tbl - cl - 1 : 0;
+	}
+#endif
+#if _FS_EXFAT
+	else if (fp->xstat) {				/* No FAT chain follows the contiguous one */
+		ncl = 0;
+	}
+#endif
+	else if (cc > n) {					/* Follow the FAT while the chain is contiguous */
+		ncl = (cc - n + fp->fs->csize - 1) / fp->fs->csize;	/* Following clusters needed */
+		cl = ncl;
+		walk_chain(fp->fs, fp->clust, &cl, 1);	/* Errors show up at the next cluster lookup */
+		ncl -= cl;
+	} else {
+		ncl = 0;
+	}
+	n += ncl * fp->fs->csize;			/* One disk function call for the whole run */
+	return (cc > n) ? (UINT)n : cc;
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Read File                                                             */
 /*-----------------------------------------------------------------------*/
@@ -2379,8 +4437,12 @@ FRESULT f_read (
 {
 	FRESULT res;
 	DWORD clst, sect, remain;
-	UINT rcnt, cc;
-	BYTE csect, *rbuff = buff;
+	UINT rcnt, cc, csect;
+	BYTE *rbuff = buff;
+#if _FS_READ_AHEAD
+	DWORD rng[2];
+	BYTE seq;
+#endif
 
 
 	*br = 0;	/* Initialize byte counter */
@@ -2391,13 +4453,21 @@ FRESULT f_read (
 		LEAVE_FF(fp->fs, FR_INT_ERR);
 	if (!(fp->flag & FA_READ)) 					/* Check access mode */
 		LEAVE_FF(fp->fs, FR_DENIED);
+#if _FS_WCOMB
+	if (wc_flush(fp) != FR_OK)					/* Data to be read may be held to be written */
+		ABORT(fp->fs, FR_DISK_ERR);
+#endif
 	remain = fp->fsize - fp->fptr;
 	if (btr > remain) btr = (UINT)remain;		/* Truncate btr by remaining bytes */
+#if _FS_READ_AHEAD
+	seq = (fp->fptr == fp->rdnext);				/* Continues the previous read? */
+	rng[1] = 0;
+#endif
 
 	for ( ;  btr;								/* Repeat until all data read */
 		rbuff += rcnt, fp->fptr += rcnt, *br += rcnt, btr -= rcnt) {
 		if ((fp->fptr % SS(fp->fs)) == 0) {		/* On the sector boundary? */
-			csect = (BYTE)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));	/* Sector offset in the cluster */
+			csect = (UINT)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));	/* Sector offset in the cluster */
 			if (!csect) {						/* On the cluster boundary? */
 				if (fp->fptr == 0) {			/* On the top of the file? */
 					clst = fp->sclust;			/* Follow from the origin */
@@ -2406,6 +4476,11 @@ FRESULT f_read (
 					if (fp->cltbl)
 						clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
 					else
+#endif
+#if _USE_EXPAND
+					if (fp->clust < fp->eclust)
+						clst = fp->clust + 1;				/* Next cluster of the contiguous chain */
+					else
 #endif
 						clst = get_fat(fp->fs, fp->clust);	/* Follow cluster chain on the FAT */
 				}
@@ -2418,10 +4493,18 @@ FRESULT f_read (
 			sect += csect;
 			cc = btr / SS(fp->fs);				/* When remaining bytes >= sector size, */
 			if (cc) {							/* Read maximum contiguous sectors directly */
+#if _USE_EXPAND
+				if (csect + cc > fp->fs->csize)	/* Clip at cluster boundary or at end of contiguous chain */
+					cc = cont_sects(fp, csect, cc);
+#else
 				if (csect + cc > fp->fs->csize)	/* Clip at cluster boundary */
 					cc = fp->fs->csize - csect;
-				if (disk_read(fp->fs->drv, rbuff, sect, (BYTE)cc) != RES_OK)
+#endif
+				if (disk_read(fp->fs->drv, rbuff, sect, cc) != RES_OK)
 					ABORT(fp->fs, FR_DISK_ERR);
+#if _USE_EXPAND
+				fp->clust += (csect + cc - 1) / fp->fs->csize;	/* Cluster of the last read sector */
+#endif
 #if !_FS_READONLY && _FS_MINIMIZE <= 2			/* Replace one of the read sectors with cached data if it contains a dirty sector */
 #if _FS_TINY
 				if (fp->fs->wflag && fp->fs->winsect - sect < cc)
@@ -2430,6 +4513,9 @@ FRESULT f_read (
 				if ((fp->flag & FA__DIRTY) && fp->dsect - sect < cc)
 					mem_cpy(rbuff + ((fp->dsect - sect) * SS(fp->fs)), fp->buf, SS(fp->fs));
 #endif
+#if _FS_CACHE
+				cache_fix(fp->fs, rbuff, sect, cc);
+#endif
 #endif
 				rcnt = SS(fp->fs) * cc;			/* Number of bytes transferred */
 				continue;
@@ -2448,6 +4534,17 @@ FRESULT f_read (
 			}
 #endif
 			fp->dsect = sect;
+#if _FS_READ_AHEAD
+			if (seq && !(csect % _FS_READ_AHEAD)) {	/* Sectors following this one in the run */
+				cc = fp->fs->csize - csect - 1;
+#if _USE_EXPAND
+				if (fp->clust < fp->eclust)
+					cc += (fp->eclust - fp->clust) * fp->fs->csize;
+#endif
+				if (cc > _FS_READ_AHEAD) cc = _FS_READ_AHEAD;
+				rng[0] = sect + 1; rng[1] = sect + cc;
+			}
+#endif
 		}
 		rcnt = SS(fp->fs) - (fp->fptr % SS(fp->fs));	/* Get partial sector data from sector buffer */
 		if (rcnt > btr) rcnt = btr;
@@ -2457,8 +4554,17 @@ FRESULT f_read (
 		mem_cpy(rbuff, &fp->fs->win[fp->fptr % SS(fp->fs)], rcnt);	/* Pick partial sector */
 #else
 		mem_cpy(rbuff, &fp->buf[fp->fptr % SS(fp->fs)], rcnt);	/* Pick partial sector */
+#endif
+#if _FS_READ_AHEAD
+		if (rng[1] && rng[1] >= rng[0]) {		/* The current sector is read, the card goes on with the next ones */
+			disk_ioctl(fp->fs->drv, CTRL_CACHE_READ_AHEAD, rng);	/* Only a hint */
+			rng[1] = 0;
+		}
 #endif
 	}
+#if _FS_READ_AHEAD
+	fp->rdnext = fp->fptr;
+#endif
 
 	LEAVE_FF(fp->fs, FR_OK);
 }
@@ -2480,9 +4586,8 @@ FRESULT f_write (
 {
 	FRESULT res;
 	DWORD clst, sect;
-	UINT wcnt, cc;
+	UINT wcnt, cc, csect;
 	const BYTE *wbuff = buff;
-	BYTE csect;
 
 
 	*bw = 0;	/* Initialize byte counter */
@@ -2498,19 +4603,24 @@ FRESULT f_write (
 	for ( ;  btw;							/* Repeat until all data written */
 		wbuff += wcnt, fp->fptr += wcnt, *bw += wcnt, btw -= wcnt) {
 		if ((fp->fptr % SS(fp->fs)) == 0) {	/* On the sector boundary? */
-			csect = (BYTE)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));	/* Sector offset in the cluster */
+			csect = (UINT)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));	/* Sector offset in the cluster */
 			if (!csect) {					/* On the cluster boundary? */
 				if (fp->fptr == 0) {		/* On the top of the file? */
 					clst = fp->sclust;		/* Follow from the origin */
 					if (clst == 0)			/* When no cluster is allocated, */
-						fp->sclust = clst = create_chain(fp->fs, 0);	/* Create a new cluster chain */
+						fp->sclust = clst = FILE_CHAIN(fp, 0);	/* Create a new cluster chain */
 				} else {					/* Middle or end of the file */
 #if _USE_FASTSEEK
 					if (fp->cltbl)
 						clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
 					else
 #endif
-						clst = create_chain(fp->fs, fp->clust);	/* Follow or stretch cluster chain on the FAT */
+#if _USE_EXPAND
+					if (fp->clust < fp->eclust)
+						clst = fp->clust + 1;				/* Next cluster of the contiguous chain */
+					else
+#endif
+						clst = FILE_CHAIN(fp, fp->clust);	/* Follow or stretch cluster chain on the FAT */
 				}
 				if (clst == 0) break;		/* Could not allocate a new cluster (disk full) */
 				if (clst == 1) ABORT(fp->fs, FR_INT_ERR);
@@ -2522,7 +4632,11 @@ FRESULT f_write (
 				ABORT(fp->fs, FR_DISK_ERR);
 #else
 			if (fp->flag & FA__DIRTY) {		/* Write-back sector cache */
+#if _FS_WCOMB
+				if (wc_put(fp) != FR_OK)	/* Hold it to be written with following sectors */
+#else
 				if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
+#endif
 					ABORT(fp->fs, FR_DISK_ERR);
 				fp->flag &= ~FA__DIRTY;
 			}
@@ -2532,10 +4646,25 @@ FRESULT f_write (
 			sect += csect;
 			cc = btw / SS(fp->fs);			/* When remaining bytes >= sector size, */
 			if (cc) {						/* Write maximum contiguous sectors directly */
+#if _FS_WCOMB
+				if (wc_flush(fp) != FR_OK)	/* Keep sectors in write order */
+					ABORT(fp->fs, FR_DISK_ERR);
+#endif
+#if _USE_EXPAND
+				if (csect + cc > fp->fs->csize)	/* Clip at cluster boundary or at end of contiguous chain */
+					cc = cont_sects(fp, csect, cc);
+#else
 				if (csect + cc > fp->fs->csize)	/* Clip at cluster boundary */
 					cc = fp->fs->csize - csect;
-				if (disk_write(fp->fs->drv, wbuff, sect, (BYTE)cc) != RES_OK)
+#endif
+				if (disk_write(fp->fs->drv, wbuff, sect, cc) != RES_OK)
 					ABORT(fp->fs, FR_DISK_ERR);
+#if _USE_EXPAND
+				fp->clust += (csect + cc - 1) / fp->fs->csize;	/* Cluster of the last written sector */
+#endif
+#if _FS_CACHE
+				cache_drop(fp->fs, sect, cc);
+#endif
 #if _FS_TINY
 				if (fp->fs->winsect - sect < cc) {	/* Refill sector cache if it gets invalidated by the direct write */
 					mem_cpy(fp->fs->win, wbuff + ((fp->fs->winsect - sect) * SS(fp->fs)), SS(fp->fs));
@@ -2552,8 +4681,12 @@ FRESULT f_write (
 			}
 #if _FS_TINY
 			if (fp->fptr >= fp->fsize) {	/* Avoid silly cache filling at growing edge */
+#if _FS_CACHE
+				if (fresh_window(fp->fs, sect)) ABORT(fp->fs, FR_DISK_ERR);
+#else
 				if (move_window(fp->fs, 0)) ABORT(fp->fs, FR_DISK_ERR);
 				fp->fs->winsect = sect;
+#endif
 			}
 #else
 			if (fp->dsect != sect) {		/* Fill sector cache with file data */
@@ -2590,8 +4723,51 @@ FRESULT f_write (
 /* Synchronize the File Object                                           */
 /*-----------------------------------------------------------------------*/
 
-FRESULT f_sync (
-	FIL *fp		/* Pointer to the file object */
+#if _FS_EXFAT
+static
+FRESULT xdir_sync (	/* Update the entry set of the file */
+	FIL *fp,		/* File object on exFAT volume */
+	DWORD tim		/* Modified time */
+)
+{
+	FRESULT res;
+	DIR dj;
+	DWORD bcs, ncl;
+	BYTE *dirb = fp->fs->dirbuf;
+
+
+	dj.fs = fp->fs; dj.sclust = fp->dir_sclust; dj.xclen = fp->dir_xclen;
+	res = dir_sdi(&dj, fp->dir_idx);
+	if (res == FR_OK) res = load_xdir(&dj);
+	if (res == FR_OK) res = dir_sdi(&dj, fp->dir_idx);
+	if (res == FR_OK) {
+		dirb[XDIR_Attr] |= AM_ARC;					/* Set archive bit */
+		ST_DWORD(dirb+XDIR_ModTime, tim);
+		dirb[XDIR_ModTime10] = 0;
+		dirb[XDIR_ModTZ] = 0;
+		ST_DWORD(dirb+XDIR_FstClus, fp->sclust);
+		dirb[XDIR_GenFlags] = fp->xstat ? 3 : 1;	/* AllocationPossible and NoFatChain */
+		ST_DWORD(dirb+XDIR_ValidFileSize, fp->fsize);
+		ST_DWORD(dirb+XDIR_FileSize, fp->fsize);
+		mem_set(dirb+XDIR_ValidFileSize+4, 0, 4);
+		mem_set(dirb+XDIR_FileSize+4, 0, 4);
+		if (fp->xstat) {	/* Clusters without FAT chain are counted by the size: keep an expanded allocation */
+			bcs = (DWORD)fp->fs->csize * SS(fp->fs);
+			ncl = fp->eclust - fp->sclust + 1;
+			if (ncl > fp->fsize / bcs + ((fp->fsize % bcs) ? 1 : 0)) {
+				ST_DWORD(dirb+XDIR_FileSize, ncl * bcs);
+			}
+		}
+		res = store_xdir(&dj);
+	}
+	return res;
+}
+#endif
+
+static
+FRESULT sync_file (
+	FIL *fp,	/* Pointer to the file object */
+	BYTE meta	/* Directory entry update: 0:Leave it pending, 1:When it is due, 2:Now */
 )
 {
 	FRESULT res;
@@ -2601,26 +4777,64 @@ FRESULT f_sync (
 
 	res = validate(fp->fs, fp->id);		/* Check validity of the object */
 	if (res == FR_OK) {
+#if _FS_RESERVE
+		if (meta == 2 && fp->rsv_clust && fp->fs->last_clust == fp->rsv_end - 1) {
+			fp->fs->last_clust = fp->rsv_clust - 1;	/* On close, give back the unused part of the window */
+			fp->rsv_clust = 0;
+		}
+#endif
 		if (fp->flag & FA__WRITTEN) {	/* Has the file been written? */
 #if !_FS_TINY	/* Write-back dirty buffer */
+#if _FS_WCOMB
+			if (wc_flush(fp) != FR_OK)
+				LEAVE_FF(fp->fs, FR_DISK_ERR);
+#endif
 			if (fp->flag & FA__DIRTY) {
 				if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
 					LEAVE_FF(fp->fs, FR_DISK_ERR);
 				fp->flag &= ~FA__DIRTY;
 			}
 #endif
+#if _FS_DSYNC
+			if (meta == 1) {			/* Deferred update: check if the directory entry is due */
+				meta = 0;
+#if _FS_DIR_SYNC_MS
+				if (get_msec() - fp->dir_time >= _FS_DIR_SYNC_MS) meta = 1;
+#endif
+#if _FS_DIR_SYNC_KB
+				if (fp->fsize - fp->dir_size >= (DWORD)_FS_DIR_SYNC_KB * 1024) meta = 1;
+#endif
+			}
+#endif
+			if (!meta) {
+				res = sync(fp->fs, 0);	/* Flush data and FAT, the directory entry stays pending */
+				LEAVE_FF(fp->fs, res);
+			}
 			/* Update the directory entry */
+			tim = get_fattime();						/* Update updated time */
+#if _FS_EXFAT
+			if (fp->fs->fs_type == FS_EXFAT) {
+				res = xdir_sync(fp, tim);
+			} else
+#endif
+			{
 			res = move_window(fp->fs, fp->dir_sect);
 			if (res == FR_OK) {
 				dir = fp->dir_ptr;
 				dir[DIR_Attr] |= AM_ARC;					/* Set archive bit */
 				ST_DWORD(dir+DIR_FileSize, fp->fsize);		/* Update file size */
 				ST_CLUST(dir, fp->sclust);					/* Update start cluster */
-				tim = get_fattime();						/* Update updated time */
 				ST_DWORD(dir+DIR_WrtTime, tim);
-				fp->flag &= ~FA__WRITTEN;
 				fp->fs->wflag = 1;
-				res = sync(fp->fs);
+			}
+			}
+			if (res == FR_OK) {
+				fp->flag &= ~FA__WRITTEN;
+#if _FS_DSYNC
+				fp->dir_time = get_msec();
+				fp->dir_size = fp->fsize;
+#endif
+				res = sync(fp->fs, 1);
 			}
 		}
 	}
@@ -2628,6 +4842,22 @@ FRESULT f_sync (
 	LEAVE_FF(fp->fs, res);
 }
 
+
+FRESULT f_sync (
+	FIL *fp		/* Pointer to the file object */
+)
+{
+	return sync_file(fp, 1);
+}
+
+
+FRESULT f_datasync (
+	FIL *fp		/* Pointer to the file object */
+)
+{
+	return sync_file(fp, 0);
+}
+
 #endif /* !_FS_READONLY */
 
 
@@ -2646,11 +4876,16 @@ FRESULT f_close (
 #if _FS_READONLY
 	FATFS *fs = fp->fs;
 	res = validate(fs, fp->id);
-	if (res == FR_OK) fp->fs = 0;	/* Discard file object */
+	if (res == FR_OK) {
+#if _USE_FASTSEEK && _FS_CLMT_FILES
+		clmt_detach(fp);	/* Return automatic CLMT */
+#endif
+		fp->fs = 0;			/* Discard file object */
+	}
 	LEAVE_FF(fs, res);
 
 #else
-	res = f_sync(fp);		/* Flush cached data */
+	res = sync_file(fp, 2);	/* Flush cached data and update the directory entry */
 #if _FS_SHARE
 	if (res == FR_OK) {		/* Decrement open counter */
 #if _FS_REENTRANT
@@ -2664,7 +4899,12 @@ FRESULT f_close (
 #endif
 	}
 #endif
-	if (res == FR_OK) fp->fs = 0;	/* Discard file object */
+	if (res == FR_OK) {
+#if _USE_FASTSEEK && _FS_CLMT_FILES
+		clmt_detach(fp);	/* Return automatic CLMT */
+#endif
+		fp->fs = 0;			/* Discard file object */
+	}
 	return res;
 #endif
 }
@@ -2709,10 +4949,12 @@ FRESULT f_chdir (
 			if (!dj.dir) {
 				dj.fs->cdir = dj.sclust;	/* Start directory itself */
 			} else {
-				if (dj.dir[DIR_Attr] & AM_DIR)	/* Reached to the directory */
-					dj.fs->cdir = LD_CLUST(dj.dir);
-				else
+				if (!(dj.dir[DIR_Attr] & AM_DIR))
 					res = FR_NO_PATH;		/* Reached but a file */
+				else if (dj.fs->fs_type == FS_EXFAT)
+					res = FR_DENIED;		/* The current directory is the root on exFAT */
+				else					/* Reached to the directory */
+					dj.fs->cdir = LD_CLUST(dj.dir);
 			}
 		}
 		if (res == FR_NO_FILE) res = FR_NO_PATH;
@@ -2813,35 +5055,18 @@ FRESULT f_lseek (
 	if (res != FR_OK) LEAVE_FF(fp->fs, res);
 	if (fp->flag & FA__ERROR)			/* Check abort flag */
 		LEAVE_FF(fp->fs, FR_INT_ERR);
+#if _FS_WCOMB
+	if (wc_flush(fp) != FR_OK)			/* Sectors around the new position may be held */
+		ABORT(fp->fs, FR_DISK_ERR);
+#endif
 
 #if _USE_FASTSEEK
 	if (fp->cltbl) {	/* Fast seek */
-		DWORD cl, pcl, ncl, tcl, dsc, tlen, ulen, *tbl;
+		DWORD dsc;
 
 		if (ofs == CREATE_LINKMAP) {	/* Create CLMT */
-			tbl = fp->cltbl;
-			tlen = *tbl++; ulen = 2;	/* Given table size and required table size */
-			cl = fp->sclust;			/* Top of the chain */
-			if (cl) {
-				do {
-					/* Get a fragment */
-					tcl = cl; ncl = 0; ulen += 2;	/* Top, length and used items */
-					do {
-						pcl = cl; ncl++;
-						cl = get_fat(fp->fs, cl);
-						if (cl <= 1) ABORT(fp->fs, FR_INT_ERR);
-						if (cl == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
-					} while (cl == pcl + 1);
-					if (ulen <= tlen) {		/* Store the length and top of the fragment */
-						*tbl++ = ncl; *tbl++ = tcl;
-					}
-				} while (cl < fp->fs->n_fatent);	/* Repeat until end of chain */
-			}
-			*fp->cltbl = ulen;	/* Number of items used */
-			if (ulen <= tlen)
-				*tbl = 0;		/* Terminate table */
-			else
-				res = FR_NOT_ENOUGH_CORE;	/* Given table size is smaller than required */
+			res = create_clmt(fp);
+			if (res == FR_INT_ERR || res == FR_DISK_ERR) ABORT(fp->fs, res);
 
 		} else {						/* Fast seek */
 			if (ofs > fp->fsize)		/* Clip offset at the file size */
@@ -2873,7 +5098,7 @@ FRESULT f_lseek (
 
 	/* Normal Seek */
 	{
-		DWORD clst, bcs, nsect, ifptr;
+		DWORD clst, bcs, nsect, ifptr, lnk;
 
 		if (ofs > fp->fsize					/* In read-only mode, clip offset with the file size */
 #if !_FS_READONLY
@@ -2894,7 +5119,7 @@ FRESULT f_lseek (
 				clst = fp->sclust;						/* start from the first cluster */
 #if !_FS_READONLY
 				if (clst == 0) {						/* If no cluster chain, create a new chain */
-					clst = create_chain(fp->fs, 0);
+					clst = FILE_CHAIN(fp, 0);
 					if (clst == 1) ABORT(fp->fs, FR_INT_ERR);
 					if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
 					fp->sclust = clst;
@@ -2904,15 +5129,27 @@ FRESULT f_lseek (
 			}
 			if (clst != 0) {
 				while (ofs > bcs) {						/* Cluster following loop */
+#if _USE_EXPAND
+					if (clst < fp->eclust)				/* Next cluster of the contiguous chain */
+						clst++;
+					else
+#endif
 #if !_FS_READONLY
 					if (fp->flag & FA_WRITE) {			/* Check if in write mode or not */
-						clst = create_chain(fp->fs, clst);	/* Force stretch if in write mode */
+						clst = FILE_CHAIN(fp, clst);	/* Force stretch if in write mode */
 						if (clst == 0) {				/* When disk gets full, clip file size */
 							ofs = bcs; break;
 						}
 					} else
 #endif
-						clst = get_fat(fp->fs, clst);	/* Follow cluster chain if not in write mode */
+					{									/* Follow cluster chain if not in write mode */
+						lnk = (ofs - 1) / bcs;			/* All the links up to the target at once */
+						clst = walk_chain(fp->fs, clst, &lnk, 0);
+						if (lnk && clst != 0xFFFFFFFF) clst = 1;	/* Chain is shorter than the file */
+						lnk = (ofs - 1) / bcs - 1;		/* The loop accounts for the last one */
+						fp->fptr += lnk * bcs;
+						ofs -= lnk * bcs;
+					}
 					if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
 					if (clst <= 1 || clst >= fp->fs->n_fatent) ABORT(fp->fs, FR_INT_ERR);
 					fp->clust = clst;
@@ -2927,30 +5164,323 @@ FRESULT f_lseek (
 				}
 			}
 		}
-		if (fp->fptr % SS(fp->fs) && nsect != fp->dsect) {	/* Fill sector cache if needed */
-#if !_FS_TINY
+		if (fp->fptr % SS(fp->fs) && nsect != fp->dsect) {	/* Fill sector cache if needed */
+#if !_FS_TINY
+#if !_FS_READONLY
+			if (fp->flag & FA__DIRTY) {			/* Write-back dirty sector cache */
+				if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
+					ABORT(fp->fs, FR_DISK_ERR);
+				fp->flag &= ~FA__DIRTY;
+			}
+#endif
+			if (disk_read(fp->fs->drv, fp->buf, nsect, 1) != RES_OK)	/* Fill sector cache */
+				ABORT(fp->fs, FR_DISK_ERR);
+#endif
+			fp->dsect = nsect;
+		}
+#if !_FS_READONLY
+		if (fp->fptr > fp->fsize) {			/* Set file change flag if the file size is extended */
+			fp->fsize = fp->fptr;
+			fp->flag |= FA__WRITTEN;
+		}
+#endif
+	}
+
+	LEAVE_FF(fp->fs, res);
+}
+
+
+
+#if _USE_EXPAND && !_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* Move the start of a free block to the next erase block boundary       */
+/*-----------------------------------------------------------------------*/
+
+static
+DWORD align_block (	/* Aligned start cluster (the block has acl - 1 clusters of slack) */
+	FATFS *fs,		/* File system object */
+	DWORD scl,		/* Start cluster of the free block */
+	DWORD acl		/* Alignment [cluster] */
+)
+{
+	DWORD n;
+
+
+	if (acl <= 1) return scl;
+	n = (acl * fs->csize - clust2sect(fs, scl) % (acl * fs->csize)) % (acl * fs->csize);
+	return (n % fs->csize) ? scl : scl + n / fs->csize;	/* (Data area off the grid can't be aligned) */
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* Allocate a Contiguous Block to the File                               */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_expand (
+	FIL *fp,		/* Pointer to the file object */
+	DWORD fsz,		/* File size to be expanded to */
+	BYTE opt		/* Operation mode 0:Find and prepare or 1:Find and allocate, +2:Start at an erase block */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD n, clst, stcl, scl, ncl, tcl, lclst, eb, acl;
+#if _FS_FMAP
+	DWORD ecl;
+#endif
+
+
+	res = validate(fp->fs, fp->id);		/* Check validity of the object */
+	if (res != FR_OK) LEAVE_FF(fp->fs, res);
+	if (fp->flag & FA__ERROR)			/* Check abort flag */
+		LEAVE_FF(fp->fs, FR_INT_ERR);
+	if (fsz == 0 || fp->fsize != 0 || fp->sclust != 0 || !(fp->flag & FA_WRITE))
+		LEAVE_FF(fp->fs, FR_DENIED);	/* Only an empty file without chain can be expanded */
+
+	fs = fp->fs;
+	n = (DWORD)fs->csize * SS(fs);		/* Cluster size */
+	tcl = fsz / n + ((fsz & (n - 1)) ? 1 : 0);	/* Number of clusters required */
+	stcl = fs->last_clust;				/* Start point of the search */
+	if (stcl < 2 || stcl >= fs->n_fatent) stcl = 2;
+	acl = 1;							/* Alignment of the block start [cluster] */
+	if ((opt & 2) && disk_ioctl(fs->drv, GET_BLOCK_SIZE, &eb) == RES_OK && eb > fs->csize && !(eb % fs->csize))
+		acl = eb / fs->csize;			/* Erase block (AU of SD Card): whole AUs are written sequentially */
+	tcl += acl - 1;						/* The search looks for the slack of alignment too */
+#if _FS_EXFAT
+	if (fs->fs_type == FS_EXFAT) {		/* Search the bitmap, the block needs no FAT chain */
+		if (fsz > 0xFFFFFFFF - n + 1)	/* (Allocation has to fit the 32-bit file size) */
+			LEAVE_FF(fs, FR_DENIED);
+		scl = find_bitmap(fs, stcl, tcl);
+		if (scl == 0) {
+			res = FR_DENIED;
+		} else if (scl == 0xFFFFFFFF) {
+			res = FR_DISK_ERR;
+		} else {
+			scl = align_block(fs, scl, acl);
+			tcl -= acl - 1;
+			if (opt & 1) {
+				res = change_bitmap(fs, scl, tcl, 1);
+				if (res == FR_OK) {
+					fs->last_clust = scl + tcl - 1;
+					fp->sclust = scl;			/* Contiguous file, its size counts the clusters */
+					fp->eclust = scl + tcl - 1;
+					fp->xstat = 2;
+					fp->flag |= FA__WRITTEN;
+					if (fs->free_clust != 0xFFFFFFFF)
+						fs->free_clust -= tcl;
+				}
+			} else {
+				fs->last_clust = scl - 1;
+			}
+		}
+		if (res != FR_OK && res != FR_DENIED) fp->flag |= FA__ERROR;
+		LEAVE_FF(fs, res);
+	}
+#endif
+	scl = clst = stcl; ncl = 0;
+	for (;;) {	/* Find a contiguous cluster block */
+#if _FS_FMAP
+		if (!FMAP_TEST(fs, clst)) {		/* No free cluster in this group, skip it */
+			ecl = (clst / fs->fmgrp + 1) * fs->fmgrp;
+			if (ecl > fs->n_fatent) ecl = fs->n_fatent;
+			if (stcl > clst && stcl < ecl) { res = FR_DENIED; break; }	/* The start point is skipped */
+			clst = (ecl >= fs->n_fatent) ? 2 : ecl;
+			scl = clst; ncl = 0;
+			if (clst == stcl) { res = FR_DENIED; break; }
+			continue;
+		}
+#endif
+		n = get_fat(fs, clst);
+		if (n == 1) { res = FR_INT_ERR; break; }
+		if (n == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+		if (++clst >= fs->n_fatent) clst = 2;
+		if (n == 0) {					/* Is it a free cluster? */
+			if (++ncl == tcl) break;	/* Break if a contiguous cluster block is found */
+			if (clst == 2) { scl = clst; ncl = 0; }	/* The block must not wrap around */
+		} else {
+			scl = clst; ncl = 0;		/* Not a free cluster */
+		}
+		if (clst == stcl) { res = FR_DENIED; break; }	/* No contiguous cluster block */
+	}
+
+	if (res == FR_OK) {
+		scl = align_block(fs, scl, acl);
+		tcl -= acl - 1;
+		if (opt & 1) {	/* Allocate the block as a cluster chain */
+			for (clst = scl, n = tcl; n; clst++, n--) {
+				res = put_fat(fs, clst, (n == 1) ? 0x0FFFFFFF : clst + 1);
+				if (res != FR_OK) break;
+			}
+			lclst = scl + tcl - 1;
+		} else {	/* Only set the allocation hint, following writes go to the block */
+			lclst = scl - 1;
+		}
+		if (res == FR_OK) {
+			fs->last_clust = lclst;
+			fs->fsi_flag = 1;
+			if (opt & 1) {
+				fp->sclust = scl;			/* The block becomes the chain of the file */
+				fp->eclust = lclst;
+				fp->flag |= FA__WRITTEN;	/* Directory entry gets the chain on sync */
+				if (fs->free_clust != 0xFFFFFFFF) {
+					fs->free_clust -= tcl;
+					fs->fsi_flag = 1;
+				}
+			}
+		}
+	}
+
+	if (res != FR_OK && res != FR_DENIED) fp->flag |= FA__ERROR;
+	LEAVE_FF(fp->fs, res);
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Forget Sectors Written around FatFs                                   */
+/*-----------------------------------------------------------------------*/
+/* Raw users of the disk (e.g. a ring in a contiguous file) call it after
+/  writing sectors: the windows and sector cache of each volume on the drive
+/  and the cache of diskio drop their copies, the next read gets the new data.
+/  Dirty copies are dropped too, the raw writer owns the sectors. Buffers of
+/  files open on the sectors (non-tiny cfg) have to be refilled by f_lseek. */
+
+FRESULT f_invalidate (
+	BYTE drv,		/* Physical drive number */
+	DWORD sect,		/* First sector number */
+	DWORD cnt		/* Number of sectors */
+)
+{
+	FATFS *fs;
+	DWORD range[2];
+	BYTE vol;
+
+
+	if (!cnt) return FR_OK;
+	for (vol = 0; vol < _VOLUMES; vol++) {
+		fs = FatFs[vol];
+		if (!fs || !fs->fs_type || fs->drv != drv) continue;
+		ENTER_FF(fs);
+		if (fs->winsect && fs->winsect - sect < cnt) {
+			fs->wflag = 0;
+			fs->winsect = 0;
+		}
+#if _FS_FATWIN
+		if (fs->fatsect && fs->fatsect - sect < cnt) {
+			fs->fwflag = 0;
+			fs->fatsect = 0;
+		}
+#endif
+#if _FS_CACHE
+		cache_drop(fs, sect, cnt);
+#endif
+#if _FS_REENTRANT
+		unlock_fs(fs, FR_OK);
+#endif
+	}
+	range[0] = sect;
+	range[1] = sect + cnt - 1;
+	disk_ioctl(drv, CTRL_CACHE_DROP, range);	/* (Drives without the cache ignore it) */
+
+	return FR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Hand the Drive over to Another User                                   */
+/*-----------------------------------------------------------------------*/
+/* For export of the whole disk (e.g. USB mass storage): each volume on the
+/  drive is synced and forgotten under its lock, then the drive shows no
+/  medium until it is taken back. The other user may change anything, so
+/  the volumes are mounted again from the disk and their snapshots are
+/  dropped. Files left open on the drive become invalid objects. */
+
+FRESULT f_eject (
+	BYTE drv,		/* Physical drive number */
+	BYTE eject		/* 1:Hand the drive over, 0:Take it back */
+)
+{
+	FATFS *fs;
+	FRESULT res = FR_OK;
+	BYTE vol;
+
+
+	if (eject) {
+		for (vol = 0; vol < _VOLUMES; vol++) {
+			fs = FatFs[vol];
+			if (!fs || LD2PD(vol) != drv) continue;
+			ENTER_FF(fs);
 #if !_FS_READONLY
-			if (fp->flag & FA__DIRTY) {			/* Write-back dirty sector cache */
-				if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
-					ABORT(fp->fs, FR_DISK_ERR);
-				fp->flag &= ~FA__DIRTY;
-			}
+			if (fs->fs_type && sync(fs, 2) != FR_OK)
+				res = FR_DISK_ERR;	/* (The drive is handed over anyway, e.g. the card is gone) */
 #endif
-			if (disk_read(fp->fs->drv, fp->buf, nsect, 1) != RES_OK)	/* Fill sector cache */
-				ABORT(fp->fs, FR_DISK_ERR);
+			fs->fs_type = 0;
+#if _FS_WARM
+			ff_state_begin(vol);
+#endif
+#if _FS_REENTRANT
+			unlock_fs(fs, FR_OK);
 #endif
-			fp->dsect = nsect;
 		}
+	}
+	if (disk_ioctl(drv, CTRL_EJECT, &eject) != RES_OK)
+		res = FR_INVALID_DRIVE;
+
+	return res;
+}
+
+
+
+
 #if !_FS_READONLY
-		if (fp->fptr > fp->fsize) {			/* Set file change flag if the file size is extended */
-			fp->fsize = fp->fptr;
-			fp->flag |= FA__WRITTEN;
+/*-----------------------------------------------------------------------*/
+/* Commit Deferred Metadata of All Volumes                               */
+/*-----------------------------------------------------------------------*/
+/* For the power failure path: data and directory entries of the files
+/  listed are written regardless of _FS_DIR_SYNC_MS/KB, then windows, cache
+/  and FSInfo of each mounted volume regardless of _FS_FSI_SYNC_MS. Closed
+/  files in the list are skipped, a volume which can't be locked is skipped
+/  too (FR_TIMEOUT) and the others are still written. */
+
+FRESULT f_commit (
+	FIL* const *files,	/* Files to be synced (null entries are skipped) */
+	UINT nf				/* Number of entries of the list */
+)
+{
+	FATFS *fs;
+	FRESULT res = FR_OK, rs;
+	UINT i;
+	BYTE vol;
+
+
+	for (i = 0; i < nf; i++) {
+		if (!files[i] || !files[i]->fs) continue;
+		rs = sync_file(files[i], 2);
+		if (rs != FR_OK && rs != FR_INVALID_OBJECT) res = rs;
+	}
+	for (vol = 0; vol < _VOLUMES; vol++) {
+		fs = FatFs[vol];
+		if (!fs || !fs->fs_type) continue;
+#if _FS_REENTRANT
+		if (!lock_fs(fs)) {
+			res = FR_TIMEOUT;
+			continue;
 		}
+#endif
+		if (fs->fs_type && sync(fs, 2) != FR_OK)
+			res = FR_DISK_ERR;
+#if _FS_REENTRANT
+		unlock_fs(fs, FR_OK);
 #endif
 	}
 
-	LEAVE_FF(fp->fs, res);
+	return res;
 }
+#endif /* !_FS_READONLY */
 
 
 
@@ -2976,6 +5506,9 @@ FRESULT f_opendir (
 		if (res == FR_OK) {						/* Follow completed */
 			if (dj->dir) {						/* It is not the root dir */
 				if (dj->dir[DIR_Attr] & AM_DIR) {	/* The object is a directory */
+#if _FS_EXFAT
+					if (dj->fs->fs_type == FS_EXFAT) xdir_enter(dj);
+#endif
 					dj->sclust = LD_CLUST(dj->dir);
 				} else {						/* The object is not a directory */
 					res = FR_NO_PATH;
@@ -3036,6 +5569,66 @@ FRESULT f_readdir (
 
 
 
+#if _FS_LISTNAME
+#if _FS_LISTNAME < 13 || _FS_LISTNAME > 256
+#error Wrong _FS_LISTNAME setting
+#endif
+/*-----------------------------------------------------------------------*/
+/* Read Directory Entries in Bulk                                        */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_listdir (
+	DIR *dj,			/* Pointer to the open directory object */
+	FILENT *ent,		/* Pointer to the array of entries to return */
+	UINT cnt,			/* Number of entries in the array */
+	UINT *n				/* Pointer to number of entries returned (less than cnt: end of directory) */
+)
+{
+	FRESULT res;
+	FILINFO fno;
+	UINT i;
+	DEF_NAMEBUF;
+
+
+	*n = 0;
+	res = validate(dj->fs, dj->id);			/* Check validity of the object */
+	if (res == FR_OK && dj->sect) {
+		INIT_BUF(*dj);
+		for (i = 0; i < cnt && res == FR_OK; i++, ent++) {
+#if _FS_DIR_PREFETCH
+			if (!(dj->index % (SS(dj->fs) / SZ_DIR))) dir_prefetch(dj, 0);	/* The whole table is read */
+#endif
+			res = dir_read(dj);					/* Read an directory item (in the window) */
+			if (res != FR_OK) break;
+#if _USE_LFN
+			fno.lfname = ent->fname;			/* The LFN if it fits, otherwise the SFN */
+			fno.lfsize = _FS_LISTNAME;
+#endif
+			get_fileinfo(dj, &fno);
+#if _USE_LFN
+			if (!ent->fname[0])
+#endif
+			mem_cpy(ent->fname, fno.fname, sizeof(fno.fname));
+			ent->fsize = fno.fsize;
+			ent->fdate = fno.fdate;
+			ent->ftime = fno.ftime;
+			ent->fattrib = fno.fattrib;
+			(*n)++;
+			res = dir_next(dj, 0);				/* Increment index for next */
+		}
+		if (res == FR_NO_FILE) {				/* Reached end of dir */
+			dj->sect = 0;
+			res = FR_OK;
+		}
+		FREE_BUF();
+	}
+
+	LEAVE_FF(dj->fs, res);
+}
+#endif
+
+
+
 #if _FS_MINIMIZE == 0
 /*-----------------------------------------------------------------------*/
 /* Get File Status                                                       */
@@ -3096,13 +5689,43 @@ FRESULT f_getfree (
 			/* Get number of free clusters */
 			fat = (*fatfs)->fs_type;
 			n = 0;
+#if _FS_FMAP
+			mem_set((*fatfs)->fmap, 0, _FS_FMAP);	/* The map is rebuilt by the scan */
+#endif
+#if _FS_EXFAT
+			if (fat == FS_EXFAT) {	/* Count clear bits of the allocation bitmap */
+				clst = (*fatfs)->n_fatent - 2;
+				sect = (*fatfs)->bitbase;
+				i = 0; p = 0;
+				do {
+					if (!i) {
+						res = move_fatwin(*fatfs, sect++);
+						if (res != FR_OK) break;
+#if _FS_PROGRESS
+						ff_progress(sect - (*fatfs)->bitbase, (((*fatfs)->n_fatent - 2 + 7) / 8 + SS(*fatfs) - 1) / SS(*fatfs));
+#endif
+						p = FAT_WIN(*fatfs);
+						i = SS(*fatfs);
+					}
+					for (stat = *p++ | 0x100; stat != 1 && clst; stat >>= 1, clst--) {
+						if (!(stat & 1)) n++;
+					}
+					i--;
+				} while (clst);
+			} else
+#endif
 			if (fat == FS_FAT12) {
 				clst = 2;
 				do {
 					stat = get_fat(*fatfs, clst);
 					if (stat == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
 					if (stat == 1) { res = FR_INT_ERR; break; }
-					if (stat == 0) n++;
+					if (stat == 0) {
+						n++;
+#if _FS_FMAP
+						FMAP_SET(*fatfs, clst);
+#endif
+					}
 				} while (++clst < (*fatfs)->n_fatent);
 			} else {
 				clst = (*fatfs)->n_fatent;
@@ -3110,20 +5733,32 @@ FRESULT f_getfree (
 				i = 0; p = 0;
 				do {
 					if (!i) {
-						res = move_window(*fatfs, sect++);
+						res = move_fatwin(*fatfs, sect++);
 						if (res != FR_OK) break;
-						p = (*fatfs)->win;
+#if _FS_PROGRESS
+						ff_progress(sect - (*fatfs)->fatbase, ((*fatfs)->n_fatent * (fat == FS_FAT16 ? 2 : 4) + SS(*fatfs) - 1) / SS(*fatfs));
+#endif
+						p = FAT_WIN(*fatfs);
 						i = SS(*fatfs);
 					}
 					if (fat == FS_FAT16) {
-						if (LD_WORD(p) == 0) n++;
+						stat = LD_WORD(p);
 						p += 2; i -= 2;
 					} else {
-						if ((LD_DWORD(p) & 0x0FFFFFFF) == 0) n++;
+						stat = LD_DWORD(p) & 0x0FFFFFFF;
 						p += 4; i -= 4;
 					}
+					if (stat == 0) {
+						n++;
+#if _FS_FMAP
+						FMAP_SET(*fatfs, (*fatfs)->n_fatent - clst);
+#endif
+					}
 				} while (--clst);
 			}
+#if _FS_FMAP
+			if (res != FR_OK) mem_set((*fatfs)->fmap, 0xFF, _FS_FMAP);	/* Incomplete scan */
+#endif
 			(*fatfs)->free_clust = n;
 			if (fat == FS_FAT32) (*fatfs)->fsi_flag = 1;
 			*nclst = n;
@@ -3135,6 +5770,97 @@ FRESULT f_getfree (
 
 
 
+#if _USE_MAINTAIN && _USE_ERASE
+/*-----------------------------------------------------------------------*/
+/* Idle-time Maintenance of the Volume                                   */
+/*-----------------------------------------------------------------------*/
+/* Free clusters of the next nblk erase blocks after the allocation point
+/  are erased ahead (CTRL_ERASE_SECTOR), so the writes filling them go to
+/  erased flash. The work is done once per allocation point, the clusters
+/  already done are skipped by the next call. Free runs which the drive
+/  does not accept now (its queue of erases is full) are retried by the
+/  next call. Then FSInfo is written if it is out of date. */
+
+static
+DRESULT erase_run (	/* RES_OK: Passed to the drive, others: Drive does not take it now */
+	FATFS *fs,		/* File system object */
+	DWORD scl,		/* First cluster of the free run */
+	DWORD ecl		/* Last cluster of the free run */
+)
+{
+	DWORD resion[2];
+
+
+	resion[0] = clust2sect(fs, scl);					/* Start sector */
+	resion[1] = clust2sect(fs, ecl) + fs->csize - 1;	/* End sector */
+#if _FS_CACHE
+	cache_drop(fs, resion[0], resion[1] - resion[0] + 1);	/* Nothing to write back there */
+#endif
+	return disk_ioctl(fs->drv, CTRL_ERASE_SECTOR, resion);
+}
+
+
+FRESULT f_maintain (
+	const TCHAR *path,	/* Pointer to the logical drive number (root dir) */
+	UINT nblk			/* Number of erase blocks to keep erased ahead */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD eb, ncl, clst, ecl, scl, nxt, stat;
+
+
+	res = chk_mounted(&path, &fs, 1);
+	if (res == FR_OK) {
+		if (disk_ioctl(fs->drv, GET_BLOCK_SIZE, &eb) != RES_OK || eb < fs->csize)
+			eb = fs->csize;
+		ncl = eb / fs->csize * nblk;			/* Clusters to keep erased */
+		clst = fs->last_clust;
+		if (clst < 2 || clst >= fs->n_fatent) clst = 1;	/* Allocation point is not known */
+		if (fs->pre_clust <= clst || fs->pre_clust > clst + 2 * ncl)
+			fs->pre_clust = clst;				/* Allocation point went past or back */
+		ecl = clst + ncl;
+		if (ecl >= fs->n_fatent) ecl = fs->n_fatent - 1;
+		scl = 0;
+		for (clst = fs->pre_clust + 1; clst <= ecl; clst++) {
+			nxt = clst;							/* Next free cluster */
+#if _FS_EXFAT
+			if (fs->fs_type == FS_EXFAT) {
+				nxt = find_bitmap(fs, clst, 1);
+				if (nxt == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+				if (nxt < clst) nxt = ecl + 1;	/* None ahead (the search wraps around) */
+			} else
+#endif
+			{
+				stat = get_fat(fs, clst);
+				if (stat == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+				if (stat == 1) { res = FR_INT_ERR; break; }
+				if (stat) nxt = clst + 1;
+			}
+			if (nxt == clst) {					/* Free cluster: the run goes on */
+				if (!scl) scl = clst;
+				continue;
+			}
+			if (scl) {							/* End of a free run */
+				if (erase_run(fs, scl, clst - 1) != RES_OK) break;
+				scl = 0;
+			}
+			clst = nxt - 1;						/* Skip used clusters */
+		}
+		if (res == FR_OK && scl && clst > ecl && erase_run(fs, scl, ecl) == RES_OK)
+			scl = 0;							/* Free run up to the end of the span */
+		if (res == FR_OK)
+			fs->pre_clust = scl ? scl - 1 : ecl;	/* Not taken runs are retried */
+		if (res == FR_OK && fs->fs_type == FS_FAT32 && fs->fsi_flag)
+			res = sync(fs, 2);					/* FSInfo is out of date */
+	}
+	LEAVE_FF(fs, res);
+}
+#endif /* _USE_MAINTAIN && _USE_ERASE */
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Truncate File                                                         */
 /*-----------------------------------------------------------------------*/
@@ -3156,23 +5882,51 @@ FRESULT f_truncate (
 				res = FR_DENIED;
 		}
 	}
+#if _FS_WCOMB
+	if (res == FR_OK && wc_flush(fp) != FR_OK)	/* Held sectors may be in the chain to be removed */
+		res = FR_DISK_ERR;
+#endif
 	if (res == FR_OK) {
 		if (fp->fsize > fp->fptr) {
 			fp->fsize = fp->fptr;	/* Set file size to current R/W point */
 			fp->flag |= FA__WRITTEN;
+#if _FS_EXFAT
+			if (fp->xstat) {		/* Contiguous file without FAT chain: free the clusters after the current one */
+				ncl = fp->fptr ? fp->clust + 1 : fp->sclust;
+				if (ncl <= fp->eclust) res = remove_chain(fp->fs, ncl, fp->eclust - ncl + 1);
+				if (fp->fptr) {
+					fp->eclust = fp->clust;
+				} else {
+					fp->sclust = fp->eclust = 0;
+					fp->xstat = 0;
+				}
+			} else
+#endif
+			{
+#if _USE_EXPAND
+			if (fp->eclust > fp->clust) fp->eclust = fp->clust;	/* Chain is contiguous up to the current cluster */
+#endif
 			if (fp->fptr == 0) {	/* When set file size to zero, remove entire cluster chain */
-				res = remove_chain(fp->fs, fp->sclust);
+				res = remove_chain(fp->fs, fp->sclust, 0);
 				fp->sclust = 0;
+#if _USE_EXPAND
+				fp->eclust = 0;
+#endif
 			} else {				/* When truncate a part of the file, remove remaining clusters */
 				ncl = get_fat(fp->fs, fp->clust);
 				res = FR_OK;
 				if (ncl == 0xFFFFFFFF) res = FR_DISK_ERR;
 				if (ncl == 1) res = FR_INT_ERR;
 				if (res == FR_OK && ncl < fp->fs->n_fatent) {
+#if _FS_EXFAT
+					res = put_fat(fp->fs, fp->clust, (fp->fs->fs_type == FS_EXFAT) ? 0xFFFFFFFF : 0x0FFFFFFF);
+#else
 					res = put_fat(fp->fs, fp->clust, 0x0FFFFFFF);
-					if (res == FR_OK) res = remove_chain(fp->fs, ncl);
+#endif
+					if (res == FR_OK) res = remove_chain(fp->fs, ncl, 0);
 				}
 			}
+			}
 		}
 		if (res != FR_OK) fp->flag |= FA__ERROR;
 	}
@@ -3194,7 +5948,7 @@ FRESULT f_unlink (
 	FRESULT res;
 	DIR dj, sdj;
 	BYTE *dir;
-	DWORD dclst;
+	DWORD dclst, ncont = 0;
 	DEF_NAMEBUF;
 
 
@@ -3216,13 +5970,20 @@ FRESULT f_unlink (
 					res = FR_DENIED;		/* Cannot remove R/O object */
 			}
 			dclst = LD_CLUST(dir);
+#if _FS_EXFAT
+			if (dj.fs->fs_type == FS_EXFAT)
+				ncont = xdir_ncont(dj.fs);	/* Clusters of the object if it has no FAT chain */
+#endif
 			if (res == FR_OK && (dir[DIR_Attr] & AM_DIR)) {	/* Is it a sub-dir? */
 				if (dclst < 2) {
 					res = FR_INT_ERR;
 				} else {
 					mem_cpy(&sdj, &dj, sizeof(DIR));	/* Check if the sub-dir is empty or not */
 					sdj.sclust = dclst;
-					res = dir_sdi(&sdj, 2);		/* Exclude dot entries */
+#if _FS_EXFAT
+					sdj.xclen = ncont;
+#endif
+					res = dir_sdi(&sdj, (sdj.fs->fs_type == FS_EXFAT) ? 0 : 2);	/* Exclude dot entries (none on exFAT) */
 					if (res == FR_OK) {
 						res = dir_read(&sdj);
 						if (res == FR_OK			/* Not empty dir */
@@ -3237,9 +5998,13 @@ FRESULT f_unlink (
 			if (res == FR_OK) {
 				res = dir_remove(&dj);		/* Remove the directory entry */
 				if (res == FR_OK) {
+#if _FS_DIRINDEX
+					if (dj.fs->didx_clust == dclst)	/* The clusters may become a new directory */
+						dj.fs->didx_stat = DIDX_NONE;
+#endif
 					if (dclst)				/* Remove the cluster chain if exist */
-						res = remove_chain(dj.fs, dclst);
-					if (res == FR_OK) res = sync(dj.fs);
+						res = remove_chain(dj.fs, dclst, ncont);
+					if (res == FR_OK) res = sync(dj.fs, 1);
 				}
 			}
 		}
@@ -3261,8 +6026,9 @@ FRESULT f_mkdir (
 {
 	FRESULT res;
 	DIR dj;
-	BYTE *dir, n;
-	DWORD dsc, dcl, pcl, tim = get_fattime();
+	BYTE *dir;
+	WORD n;
+	DWORD dsc, dcl, pcl, ncl = 0, tim = get_fattime();
 	DEF_NAMEBUF;
 
 
@@ -3274,6 +6040,11 @@ FRESULT f_mkdir (
 		if (_FS_RPATH && res == FR_NO_FILE && (dj.fn[NS] & NS_DOT))
 			res = FR_INVALID_NAME;
 		if (res == FR_NO_FILE) {				/* Can create a new directory */
+#if _FS_EXFAT
+			if (dj.fs->fs_type == FS_EXFAT)		/* Allocate a cluster without FAT chain */
+				dcl = create_xchain(dj.fs, 0, 0, &ncl);
+			else
+#endif
 			dcl = create_chain(dj.fs, 0);		/* Allocate a cluster for the new directory table */
 			res = FR_OK;
 			if (dcl == 0) res = FR_DENIED;		/* No space to allocate a new cluster */
@@ -3285,6 +6056,10 @@ FRESULT f_mkdir (
 				dsc = clust2sect(dj.fs, dcl);
 				dir = dj.fs->win;
 				mem_set(dir, 0, SS(dj.fs));
+#if _FS_EXFAT
+				if (dj.fs->fs_type != FS_EXFAT)		/* No dot entries on exFAT */
+#endif
+				{
 				mem_set(dir+DIR_Name, ' ', 8+3);	/* Create "." entry */
 				dir[DIR_Name] = '.';
 				dir[DIR_Attr] = AM_DIR;
@@ -3295,6 +6070,7 @@ FRESULT f_mkdir (
 				if (dj.fs->fs_type == FS_FAT32 && pcl == dj.fs->dirbase)
 					pcl = 0;
 				ST_CLUST(dir+SZ_DIR, pcl);
+				}
 				for (n = dj.fs->csize; n; n--) {	/* Write dot entries and clear following sectors */
 					dj.fs->winsect = dsc++;
 					dj.fs->wflag = 1;
@@ -3302,17 +6078,33 @@ FRESULT f_mkdir (
 					if (res != FR_OK) break;
 					mem_set(dir, 0, SS(dj.fs));
 				}
+#if _FS_CACHE
+				dj.fs->winsect = 0;		/* Window is cleared, it does not hold the last sector (must not be cached) */
+#endif
 			}
 			if (res == FR_OK) res = dir_register(&dj);	/* Register the object to the directoy */
 			if (res != FR_OK) {
-				remove_chain(dj.fs, dcl);			/* Could not register, remove cluster chain */
-			} else {
+				remove_chain(dj.fs, dcl, ncl);		/* Could not register, remove cluster chain */
+			} else
+#if _FS_EXFAT
+			if (dj.fs->fs_type == FS_EXFAT) {	/* Contiguous table of a cluster, its size is in the stream entry */
+				dir = dj.fs->dirbuf;
+				ST_WORD(dir+XDIR_Attr, AM_DIR);
+				dir[XDIR_GenFlags] = 3;
+				ST_DWORD(dir+XDIR_FstClus, dcl);
+				ST_DWORD(dir+XDIR_ValidFileSize, (DWORD)dj.fs->csize * SS(dj.fs));
+				ST_DWORD(dir+XDIR_FileSize, (DWORD)dj.fs->csize * SS(dj.fs));
+				res = store_xdir(&dj);
+				if (res == FR_OK) res = sync(dj.fs, 1);
+			} else
+#endif
+			{
 				dir = dj.dir;
 				dir[DIR_Attr] = AM_DIR;				/* Attribute */
 				ST_DWORD(dir+DIR_WrtTime, tim);		/* Created time */
 				ST_CLUST(dir, dcl);					/* Table start cluster */
 				dj.fs->wflag = 1;
-				res = sync(dj.fs);
+				res = sync(dj.fs, 1);
 			}
 		}
 		FREE_BUF();
@@ -3355,7 +6147,14 @@ FRESULT f_chmod (
 				mask &= AM_RDO|AM_HID|AM_SYS|AM_ARC;	/* Valid attribute mask */
 				dir[DIR_Attr] = (value & mask) | (dir[DIR_Attr] & (BYTE)~mask);	/* Apply attribute change */
 				dj.fs->wflag = 1;
-				res = sync(dj.fs);
+#if _FS_EXFAT
+				if (dj.fs->fs_type == FS_EXFAT) {	/* The xsfn[] goes back to the entry set */
+					dj.fs->dirbuf[XDIR_Attr] = dir[DIR_Attr];
+					res = store_xdir(&dj);
+				}
+				if (res == FR_OK)
+#endif
+				res = sync(dj.fs, 1);
 			}
 		}
 	}
@@ -3396,7 +6195,15 @@ FRESULT f_utime (
 				ST_WORD(dir+DIR_WrtTime, fno->ftime);
 				ST_WORD(dir+DIR_WrtDate, fno->fdate);
 				dj.fs->wflag = 1;
-				res = sync(dj.fs);
+#if _FS_EXFAT
+				if (dj.fs->fs_type == FS_EXFAT) {	/* The xsfn[] goes back to the entry set */
+					ST_DWORD(dj.fs->dirbuf+XDIR_ModTime, LD_DWORD(dir+DIR_WrtTime));
+					dj.fs->dirbuf[XDIR_ModTime10] = 0;
+					res = store_xdir(&dj);
+				}
+				if (res == FR_OK)
+#endif
+				res = sync(dj.fs, 1);
 			}
 		}
 	}
@@ -3420,6 +6227,9 @@ FRESULT f_rename (
 	DIR djo, djn;
 	BYTE buf[21], *dir;
 	DWORD dw;
+#if _FS_EXFAT
+	BYTE xbuf[2 * SZ_DIR];
+#endif
 	DEF_NAMEBUF;
 
 
@@ -3438,12 +6248,27 @@ FRESULT f_rename (
 				res = FR_NO_FILE;
 			} else {
 				mem_cpy(buf, djo.dir+DIR_Attr, 21);		/* Save the object information except for name */
+#if _FS_EXFAT
+				mem_cpy(xbuf, djo.fs->dirbuf, 2 * SZ_DIR);	/* File and stream entries (exFAT) */
+#endif
 				mem_cpy(&djn, &djo, sizeof(DIR));		/* Check new object */
 				res = follow_path(&djn, path_new);
 				if (res == FR_OK) res = FR_EXIST;		/* The new object name is already existing */
 				if (res == FR_NO_FILE) { 				/* Is it a valid path and no name collision? */
 /* Start critical section that any interruption or error can cause cross-link */
 					res = dir_register(&djn);			/* Register the new entry */
+#if _FS_EXFAT
+					if (res == FR_OK && djn.fs->fs_type == FS_EXFAT) {	/* New set gets all but the name */
+						dir = djn.fs->dirbuf;
+						mem_cpy(dir+XDIR_Attr, xbuf+XDIR_Attr, SZ_DIR - XDIR_Attr);
+						dir[XDIR_Attr] |= AM_ARC;
+						dir[XDIR_GenFlags] = xbuf[XDIR_GenFlags];
+						mem_cpy(dir+XDIR_ValidFileSize, xbuf+XDIR_ValidFileSize, 2 * SZ_DIR - XDIR_ValidFileSize);
+						res = store_xdir(&djn);			/* No dot entries to update */
+						if (res == FR_OK) res = dir_remove(&djo);
+						if (res == FR_OK) res = sync(djo.fs, 1);
+					} else
+#endif
 					if (res == FR_OK) {
 						dir = djn.dir;					/* Copy object information except for name */
 						mem_cpy(dir+13, buf+2, 19);
@@ -3466,7 +6291,7 @@ FRESULT f_rename (
 						if (res == FR_OK) {
 							res = dir_remove(&djo);		/* Remove old entry */
 							if (res == FR_OK)
-								res = sync(djo.fs);
+								res = sync(djo.fs, 1);
 						}
 					}
 /* End critical section */
@@ -3485,6 +6310,23 @@ FRESULT f_rename (
 
 
 
+#if _FS_STATS
+/*-----------------------------------------------------------------------*/
+/* Get Counters of Internal Functions                                    */
+/*-----------------------------------------------------------------------*/
+
+void f_getstats (
+	FFSTAT *st,		/* Pointer to the array of FFS_COUNT counters to receive (0:Don't get) */
+	BYTE clr		/* 1:Clear the counters */
+)
+{
+	if (st) mem_cpy(st, Stats, sizeof(Stats));
+	if (clr) mem_set(Stats, 0, sizeof(Stats));
+}
+#endif /* _FS_STATS */
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Forward data to the stream directly (available on only tiny cfg)      */
 /*-----------------------------------------------------------------------*/
@@ -3499,8 +6341,7 @@ FRESULT f_forward (
 {
 	FRESULT res;
 	DWORD remain, clst, sect;
-	UINT rcnt;
-	BYTE csect;
+	UINT rcnt, csect;
 
 
 	*bf = 0;	/* Initialize byte counter */
@@ -3517,9 +6358,14 @@ FRESULT f_forward (
 
 	for ( ;  btr && (*func)(0, 0);					/* Repeat until all data transferred or stream becomes busy */
 		fp->fptr += rcnt, *bf += rcnt, btr -= rcnt) {
-		csect = (BYTE)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));	/* Sector offset in the cluster */
+		csect = (UINT)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));	/* Sector offset in the cluster */
 		if ((fp->fptr % SS(fp->fs)) == 0) {			/* On the sector boundary? */
 			if (!csect) {							/* On the cluster boundary? */
+#if _USE_EXPAND
+				if (fp->fptr && fp->clust < fp->eclust)
+					clst = fp->clust + 1;			/* Next cluster of the contiguous chain */
+				else
+#endif
 				clst = (fp->fptr == 0) ?			/* On the top of the file? */
 					fp->sclust : get_fat(fp->fs, fp->clust);
 				if (clst <= 1) ABORT(fp->fs, FR_INT_ERR);
@@ -3545,12 +6391,130 @@ FRESULT f_forward (
 
 
 
+#if _USE_VIEW
+/*-----------------------------------------------------------------------*/
+/* Map File Data in the Disk Cache (read without copy)                   */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_view (
+	FIL *fp, 		/* Pointer to the file object (opened without FA_WRITE) */
+	FVIEW *vw,		/* Pointer to the view object to set (not holding a view) */
+	UINT btr,		/* Number of bytes to map (up to the end of the sector) */
+	UINT *br		/* Pointer to number of bytes mapped */
+)
+{
+	FRESULT res;
+	DWORD clst, sect, remain;
+	UINT rcnt, csect;
+	DISK_PIN pin;
+	DRESULT dr;
+
+
+	*br = 0;	/* Initialize byte counter */
+	vw->sect = 0; vw->data = 0;
+
+	res = validate(fp->fs, fp->id);				/* Check validity */
+	if (res != FR_OK) LEAVE_FF(fp->fs, res);
+	if (fp->flag & FA__ERROR)					/* Aborted file? */
+		LEAVE_FF(fp->fs, FR_INT_ERR);
+	if (!(fp->flag & FA_READ)) 					/* Check access mode */
+		LEAVE_FF(fp->fs, FR_DENIED);
+#if !_FS_READONLY
+	if (fp->flag & FA_WRITE)					/* Data to be mapped may be held by the file object */
+		LEAVE_FF(fp->fs, FR_DENIED);
+#endif
+	remain = fp->fsize - fp->fptr;
+	if (btr > remain) btr = (UINT)remain;		/* Truncate btr by remaining bytes */
+	if (!btr) LEAVE_FF(fp->fs, FR_OK);
+
+	clst = fp->clust;							/* Cluster of the view, kept until the sector is pinned */
+	if ((fp->fptr % SS(fp->fs)) == 0) {			/* On the sector boundary? */
+		csect = (UINT)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));	/* Sector offset in the cluster */
+		if (!csect) {							/* On the cluster boundary? */
+			if (fp->fptr == 0) {				/* On the top of the file? */
+				clst = fp->sclust;				/* Follow from the origin */
+			} else {							/* Middle or end of the file */
+#if _USE_FASTSEEK
+				if (fp->cltbl)
+					clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
+				else
+#endif
+#if _USE_EXPAND
+				if (fp->clust < fp->eclust)
+					clst = fp->clust + 1;				/* Next cluster of the contiguous chain */
+				else
+#endif
+					clst = get_fat(fp->fs, fp->clust);	/* Follow cluster chain on the FAT */
+			}
+			if (clst < 2) ABORT(fp->fs, FR_INT_ERR);
+			if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
+		}
+		sect = clust2sect(fp->fs, clst);		/* Get current sector */
+		if (!sect) ABORT(fp->fs, FR_INT_ERR);
+		sect += csect;
+	} else {
+		sect = fp->dsect;						/* Sector of the file pointer */
+	}
+
+	pin.sector = sect;							/* Pin the sector in the disk cache */
+	dr = disk_ioctl(fp->fs->drv, CTRL_CACHE_PIN, &pin);
+	if (dr == RES_ERROR) ABORT(fp->fs, FR_DISK_ERR);
+	if (dr != RES_OK)							/* No cache or no slot to pin, f_read has to be used */
+		LEAVE_FF(fp->fs, FR_DENIED);			/* (the file object is left as it was) */
+	fp->clust = clst;							/* Update current cluster */
+
+	rcnt = SS(fp->fs) - (fp->fptr % SS(fp->fs));	/* Map partial sector data */
+	if (rcnt > btr) rcnt = btr;
+	vw->data = pin.data + fp->fptr % SS(fp->fs);
+	vw->sect = sect;
+	vw->drv = fp->fs->drv;
+	vw->slot = pin.slot;
+#if _FS_TINY
+	fp->dsect = sect;
+#else
+	if ((fp->fptr + rcnt) % SS(fp->fs) && fp->dsect != sect) {	/* f_read continues from the sector buffer, fill it */
+		mem_cpy(fp->buf, pin.data, SS(fp->fs));
+		fp->dsect = sect;
+	}
+#endif
+	fp->fptr += rcnt;
+	*br = rcnt;
+
+	LEAVE_FF(fp->fs, FR_OK);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Release Mapped File Data                                              */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_unview (
+	FVIEW *vw		/* Pointer to the view object set by f_view */
+)
+{
+	DISK_PIN pin;
+
+
+	if (!vw->sect) return FR_OK;				/* No view (nothing was mapped) */
+	pin.sector = vw->sect;
+	pin.data = vw->data;
+	pin.slot = vw->slot;
+	vw->sect = 0; vw->data = 0;
+	return (disk_ioctl(vw->drv, CTRL_CACHE_UNPIN, &pin) == RES_OK) ? FR_OK : FR_INT_ERR;
+}
+#endif /* _USE_VIEW */
+
+
+
 #if _USE_MKFS && !_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* Create File System on the Drive                                       */
 /*-----------------------------------------------------------------------*/
 #define N_ROOTDIR	512		/* Number of root dir entries for FAT12/16 */
 #define N_FATS		1		/* Number of FAT copies (1 or 2) */
+#define N_ALIGN		32768	/* Max erase block size to align the layout to [sector] */
 
 
 FRESULT f_mkfs (
@@ -3559,13 +6523,14 @@ FRESULT f_mkfs (
 	UINT au			/* Allocation unit size [bytes] */
 )
 {
-	static const WORD vst[] = { 1024,   512,  256,  128,   64,    32,   16,    8,    4,    2,   0};
-	static const WORD cst[] = {32768, 16384, 8192, 4096, 2048, 16384, 8192, 4096, 2048, 1024, 512};
+	static const WORD vst[] = { 1024,     8,    0};	/* Volume size [MB] */
+	static const WORD cst[] = {32768, 16384, 8192};	/* Cluster size above it (SD File System Spec) */
 	BYTE fmt, md, sys, *tbl, pdrv, part;
 	DWORD n_clst, vs, n, wsect;
 	UINT i;
 	DWORD b_vol, b_fat, b_dir, b_data;	/* LBA */
 	DWORD n_vol, n_rsv, n_fat, n_dir;	/* Size */
+	DWORD n_eb;							/* Erase block size (AU of SD Card) */
 	FATFS *fs;
 	DSTATUS stat;
 
@@ -3588,6 +6553,12 @@ FRESULT f_mkfs (
 	if (disk_ioctl(pdrv, GET_SECTOR_SIZE, &SS(fs)) != RES_OK || SS(fs) > _MAX_SS)
 		return FR_DISK_ERR;
 #endif
+#if _FS_WARM
+	ff_state_begin(drv);			/* Invalidate snapshot of the old volume (VSN may repeat) */
+#endif
+	/* The layout is aligned to the erase block: clusters never straddle an AU of the card */
+	if (disk_ioctl(pdrv, GET_BLOCK_SIZE, &n_eb) != RES_OK || !n_eb || n_eb > N_ALIGN || (n_eb & (n_eb - 1)))
+		n_eb = 1;
 	if (_MULTI_PARTITION && part) {
 		/* Get partition information from partition table in the MBR */
 		if (disk_read(pdrv, fs->win, 0, 1) != RES_OK) return FR_DISK_ERR;
@@ -3600,14 +6571,16 @@ FRESULT f_mkfs (
 		/* Create a partition in this function */
 		if (disk_ioctl(pdrv, GET_SECTOR_COUNT, &n_vol) != RES_OK || n_vol < 128)
 			return FR_DISK_ERR;
-		b_vol = (sfd) ? 0 : 63;		/* Volume start sector */
+		b_vol = (sfd) ? 0 : (63 + n_eb - 1) & ~(n_eb - 1);	/* Volume start sector (erase block boundary) */
+		if (n_vol < b_vol + 128) return FR_MKFS_ABORTED;
 		n_vol -= b_vol;				/* Volume size */
 	}
 
-	if (!au) {				/* AU auto selection */
-		vs = n_vol / (2000 / (SS(fs) / 512));
-		for (i = 0; vs < vst[i]; i++) ;
+	if (!au) {				/* AU auto selection: the flash page of the card (8K-32K) */
+		vs = n_vol / (2048 / (SS(fs) / 512));
+		for (i = 0; vst[i] && vs <= vst[i]; i++) ;
 		au = cst[i];
+		if (n_eb > 1 && au > n_eb * SS(fs)) au = n_eb * SS(fs);
 	}
 	au /= SS(fs);		/* Number of sectors per cluster */
 	if (au == 0) au = 1;
@@ -3619,37 +6592,42 @@ FRESULT f_mkfs (
 	if (n_clst >= MIN_FAT16) fmt = FS_FAT16;
 	if (n_clst >= MIN_FAT32) fmt = FS_FAT32;
 
-	/* Determine offset and size of FAT structure */
-	if (fmt == FS_FAT32) {
-		n_fat = ((n_clst * 4) + 8 + SS(fs) - 1) / SS(fs);
-		n_rsv = 32;
-		n_dir = 0;
-	} else {
-		n_fat = (fmt == FS_FAT12) ? (n_clst * 3 + 1) / 2 + 3 : (n_clst * 2) + 4;
-		n_fat = (n_fat + SS(fs) - 1) / SS(fs);
-		n_rsv = 1;
-		n_dir = (DWORD)N_ROOTDIR * SZ_DIR / SS(fs);
-	}
-	b_fat = b_vol + n_rsv;				/* FAT area start sector */
-	b_dir = b_fat + n_fat * N_FATS;		/* Directory area start sector */
-	b_data = b_dir + n_dir;				/* Data area start sector */
-	if (n_vol < b_data + au - b_vol) return FR_MKFS_ABORTED;	/* Too small volume */
-
-	/* Align data start sector to erase block boundary (for flash memory media) */
-	if (disk_ioctl(pdrv, GET_BLOCK_SIZE, &n) != RES_OK || !n || n > 32768) n = 1;
-	n = (b_data + n - 1) & ~(n - 1);	/* Next nearest erase block from current data start */
-	n = (n - b_data) / N_FATS;
-	if (fmt == FS_FAT32) {		/* FAT32: Move FAT offset */
-		n_rsv += n;
-		b_fat += n;
-	} else {					/* FAT12/16: Expand FAT size */
-		n_fat += n;
-	}
-
-	/* Determine number of clusters and final check of validity of the FAT sub-type */
-	n_clst = (n_vol - n_rsv - n_fat * N_FATS - n_dir) / au;
-	if (   (fmt == FS_FAT16 && n_clst < MIN_FAT16)
-		|| (fmt == FS_FAT32 && n_clst < MIN_FAT32))
+	for (;;) {
+		/* Determine offset and size of FAT structure */
+		if (fmt == FS_FAT32) {
+			n_fat = ((n_clst * 4) + 8 + SS(fs) - 1) / SS(fs);
+			n_rsv = 32;
+			n_dir = 0;
+		} else {
+			n_fat = (fmt == FS_FAT12) ? (n_clst * 3 + 1) / 2 + 3 : (n_clst * 2) + 4;
+			n_fat = (n_fat + SS(fs) - 1) / SS(fs);
+			n_rsv = 1;
+			n_dir = (DWORD)N_ROOTDIR * SZ_DIR / SS(fs);
+		}
+
+		/* Align FAT start and data start sectors to erase block boundary (for flash memory media):
+		   reserved area is extended up to the FAT, the FAT is expanded up to the root dir/data */
+		b_fat = (b_vol + n_rsv + n_eb - 1) & ~(n_eb - 1);	/* FAT area start sector */
+		n_rsv = b_fat - b_vol;
+		n = (b_fat + n_fat * N_FATS + n_dir + n_eb - 1) & ~(n_eb - 1);
+		n_fat = (n - n_dir - b_fat) / N_FATS;
+		b_dir = b_fat + n_fat * N_FATS;		/* Directory area start sector */
+		b_data = b_dir + n_dir;				/* Data area start sector */
+		if (n_vol < b_data + au - b_vol) return FR_MKFS_ABORTED;	/* Too small volume */
+
+		/* Determine number of clusters, the alignment can take the FAT sub-type below its range */
+		n_clst = (n_vol - n_rsv - n_fat * N_FATS - n_dir) / au;
+		if (fmt == FS_FAT32 && n_clst < MIN_FAT32) {
+			fmt = FS_FAT16; continue;
+		}
+		if (fmt == FS_FAT16 && n_clst < MIN_FAT16) {
+			fmt = FS_FAT12; continue;
+		}
+		break;
+	}
+	/* Final check of validity of the FAT sub-type */
+	if (   (fmt == FS_FAT12 && n_clst >= MIN_FAT16)
+		|| (fmt == FS_FAT16 && n_clst >= MIN_FAT32))
 		return FR_MKFS_ABORTED;
 
 	switch (fmt) {	/* Determine system ID for partition table */
@@ -3670,15 +6648,16 @@ FRESULT f_mkfs (
 		} else {	/* Create partition table (FDISK) */
 			mem_set(fs->win, 0, SS(fs));
 			tbl = fs->win+MBR_Table;	/* Create partiton table for single partition in the drive */
-			tbl[1] = 1;						/* Partition start head */
-			tbl[2] = 1;						/* Partition start sector */
-			tbl[3] = 0;						/* Partition start cylinder */
+			n = b_vol / 63 / 255;
+			tbl[1] = (BYTE)(b_vol / 63 % 255);	/* Partition start head */
+			tbl[2] = (BYTE)(((n >> 2) & 0xC0) | (b_vol % 63 + 1));	/* Partition start sector */
+			tbl[3] = (BYTE)n;				/* Partition start cylinder */
 			tbl[4] = sys;					/* System type */
 			tbl[5] = 254;					/* Partition end head */
 			n = (b_vol + n_vol) / 63 / 255;
 			tbl[6] = (BYTE)((n >> 2) | 63);	/* Partiiton end sector */
 			tbl[7] = (BYTE)n;				/* End cylinder */
-			ST_DWORD(tbl+8, 63);			/* Partition start in LBA */
+			ST_DWORD(tbl+8, b_vol);			/* Partition start in LBA */
 			ST_DWORD(tbl+12, n_vol);		/* Partition size in LBA */
 			ST_WORD(fs->win+BS_55AA, 0xAA55);	/* MBR signature */
 			if (disk_write(pdrv, fs->win, 0, 1) != RES_OK)	/* Write it to the MBR sector */
@@ -28,6 +28,38 @@ extern "C" {
 #error Wrong configuration file (ffconf.h).
 #endif
 
+#if _FS_READONLY			/* Total number of cached sectors and size of free cluster map */
+#define _FS_CACHE	0
+#define _FS_FMAP	0
+#else
+#define _FS_CACHE	(_FS_CACHE_FAT + _FS_CACHE_DIR + _FS_CACHE_DATA)
+#define _FS_FMAP	_FS_FREEMAP
+#endif
+
+#if _FS_READONLY			/* Deferred directory entry and FSInfo updates */
+#define _FS_DSYNC	0
+#define _FS_FSYNC	0
+#else
+#define _FS_DSYNC	(_FS_DIR_SYNC_MS || _FS_DIR_SYNC_KB)
+#define _FS_FSYNC	_FS_FSI_SYNC_MS
+#endif
+
+#if _FS_READONLY || _FS_TINY	/* Sectors of write-combining buffer in file object */
+#define _FS_WCOMB	0
+#else
+#define _FS_WCOMB	_FS_WCOMBINE
+#endif
+
+#if _FS_READONLY			/* Volume state snapshot kept across resets */
+#define _FS_WARM	0
+#else
+#define _FS_WARM	_FS_WARMSTATE
+#endif
+
+#if _FS_EXFAT && (!_USE_LFN || !_USE_EXPAND)
+#error exFAT needs _USE_LFN and _USE_EXPAND (see ffconf.h)
+#endif
+
 
 
 /* Definitions of volume management */
@@ -72,15 +104,87 @@ typedef char TCHAR;
 
 
 
+/* Sector cache entry (FATFS) */
+
+#if _FS_CACHE
+typedef struct {
+	DWORD	sect;			/* Cached sector (0:Empty entry) */
+	DWORD	age;			/* LRU stamp of the last use */
+	BYTE	buf[_MAX_SS];	/* Sector data */
+	BYTE	dirty;			/* Dirty flag (1:must be written back) */
+} FCACHE;
+#endif
+
+
+
+/* Volume state snapshot (see _FS_WARMSTATE) */
+
+#if _FS_WARM
+typedef struct {
+	BYTE	cid[16];		/* CID of the card holding the volume */
+	DWORD	volid;			/* Volume serial number */
+	DWORD	bsect;			/* Volume boot record sector */
+	DWORD	n_fatent;		/* Number of FAT entries (the volume wasn't formatted again) */
+	DWORD	database;		/* Data start sector (the volume wasn't formatted again) */
+	DWORD	last_clust;		/* Last allocated cluster */
+	DWORD	free_clust;		/* Number of free clusters */
+	DWORD	fsi_free;		/* Free cluster count of FSInfo on the disk (FAT32) */
+	DWORD	fsi_next;		/* Next free cluster of FSInfo on the disk (FAT32) */
+	BYTE	cold;			/* Snapshot outlived a power-off: FSInfo on the disk has to match it */
+#if _FS_FMAP
+	BYTE	fmap[_FS_FMAP];	/* Free cluster map */
+#endif
+} FFSTATE;
+#endif
+
+
+
+/* Counters of an internal function (see _FS_STATS) */
+
+#if _FS_STATS
+typedef struct {
+	DWORD	calls;			/* Number of calls */
+	DWORD	sectors;		/* Sectors read or written by disk functions within the calls */
+	DWORD	cycles;			/* Cycles spent within the calls (get_cycles) */
+} FFSTAT;
+
+#define	FFS_DISK_READ		0
+#define	FFS_DISK_WRITE		1
+#define	FFS_MOVE_WINDOW		2
+#define	FFS_SYNC			3
+#define	FFS_GET_FAT			4
+#define	FFS_PUT_FAT			5
+#define	FFS_CREATE_CHAIN	6
+#define	FFS_REMOVE_CHAIN	7
+#define	FFS_DIR_NEXT		8
+#define	FFS_DIR_FIND		9
+#define	FFS_DIR_REGISTER	10
+#define	FFS_FOLLOW_PATH		11
+#define	FFS_CHK_MOUNTED		12
+#define	FFS_MOVE_FATWIN		13
+#define	FFS_COUNT			14
+#define	FFS_NAMES	"disk_read", "disk_write", "move_window", "sync", "get_fat", "put_fat", \
+					"create_chain", "remove_chain", "dir_next", "dir_find", "dir_register", \
+					"follow_path", "chk_mounted", "move_fatwin"	/* Initializer of the names of FFS_* */
+#endif
+
+
+
 /* File system object structure (FATFS) */
 
 typedef struct {
 	BYTE	fs_type;		/* FAT sub-type (0:Not mounted) */
 	BYTE	drv;			/* Physical drive number */
-	BYTE	csize;			/* Sectors per cluster (1,2,4...128) */
+	WORD	csize;			/* Sectors per cluster (1,2,4...128, exFAT up to 1 MB clusters) */
 	BYTE	n_fats;			/* Number of FAT copies (1,2) */
 	BYTE	wflag;			/* win[] dirty flag (1:must be written back) */
 	BYTE	fsi_flag;		/* fsinfo dirty flag (1:must be written back) */
+#if _USE_MAINTAIN
+	DWORD	pre_clust;		/* Free clusters after last_clust up to this one were pre-erased */
+#endif
+#if _FS_FATWIN
+	BYTE	fwflag;			/* fatwin[] dirty flag (1:must be written back) */
+#endif
 	WORD	id;				/* File system mount ID */
 	WORD	n_rootdir;		/* Number of root directory entries (FAT12/16) */
 #if _MAX_SS != 512
@@ -94,20 +198,77 @@ typedef struct {
 	DWORD	free_clust;		/* Number of free clusters */
 	DWORD	fsi_sector;		/* fsinfo sector (FAT32) */
 #endif
+#if _FS_FSYNC
+	DWORD	fsi_time;		/* Time of last fsinfo update (get_msec) */
+#endif
+#if _FS_WARM
+	BYTE	st_cid[16];		/* CID of the card (snapshot key) */
+	BYTE	st_ok;			/* The drive has CID, the snapshot is kept */
+	DWORD	st_volid;		/* Volume serial number (snapshot key) */
+	DWORD	st_bsect;		/* Volume boot record sector */
+	DWORD	st_fsi_free;	/* Free cluster count of FSInfo on the disk */
+	DWORD	st_fsi_next;	/* Next free cluster of FSInfo on the disk */
+	BYTE	st_used;		/* The mount took the volume state from a snapshot */
+#endif
 #if _FS_RPATH
 	DWORD	cdir;			/* Current directory start cluster (0:root) */
 #endif
 	DWORD	n_fatent;		/* Number of FAT entries (= number of clusters + 2) */
 	DWORD	fsize;			/* Sectors per FAT */
 	DWORD	fatbase;		/* FAT start sector */
-	DWORD	dirbase;		/* Root directory start sector (FAT32:Cluster#) */
+	DWORD	dirbase;		/* Root directory start sector (FAT32, exFAT:Cluster#) */
 	DWORD	database;		/* Data start sector */
+#if _FS_EXFAT
+	DWORD	bitbase;		/* Allocation bitmap start sector (exFAT) */
+#endif
 	DWORD	winsect;		/* Current sector appearing in the win[] */
 	BYTE	win[_MAX_SS];	/* Disk access window for Directory, FAT (and Data on tiny cfg) */
+#if _FS_FATWIN
+	DWORD	fatsect;		/* Current sector appearing in the fatwin[] */
+	BYTE	fatwin[_MAX_SS];	/* Window for FAT and allocation bitmap (exFAT), win[] does not hold them */
+#endif
+#if _FS_CACHE
+	DWORD	cage;			/* LRU clock of the sector cache */
+	FCACHE	cache[_FS_CACHE];	/* Sectors left the win[] */
+#endif
+#if _FS_FMAP
+	DWORD	fmgrp;			/* Number of clusters in a group of free cluster map */
+	BYTE	fmap[_FS_FMAP];	/* Free cluster map (1:group may have a free cluster) */
+#endif
+#if _USE_LFN == 1 && _FS_REENTRANT
+	WCHAR	lfnbuf[_MAX_LFN+1];	/* LFN working buffer (guarded by the volume lock) */
+#endif
+#if _FS_DIRINDEX
+	DWORD	didx_clust;		/* Start cluster of the indexed directory (0:Root dir) */
+	WORD	didx_n;			/* Number of used slots in the didx[] */
+	BYTE	didx_stat;		/* Index status (0:None, 1:Valid, 2:Directory too large) */
+	WORD	didx[_FS_DIRINDEX];	/* Name hash slots holding entry index numbers (0xFFFF:Empty) */
+#endif
+#if _USE_FASTSEEK && _FS_CLMT_FILES
+	DWORD	clmt[_FS_CLMT_FILES][_FS_CLMT_SIZE];	/* Automatic CLMT pool of the volume */
+	void*	clmt_owner[_FS_CLMT_FILES];	/* File object using the CLMT (0:Free) */
+#endif
+#if _FS_EXFAT
+	BYTE	dirbuf[19*32];	/* Entry set of the object being accessed (exFAT) */
+	BYTE	xsfn[32];		/* SFN entry made of the entry set, as FAT code expects it (exFAT) */
+#endif
 } FATFS;
 
 
 
+#if _USE_VIEW
+/* View of file data in the disk cache (FVIEW) */
+
+typedef struct {
+	const BYTE*	data;		/* Mapped data (valid until f_unview) */
+	DWORD	sect;			/* Pinned sector (0:No view) */
+	BYTE	drv;			/* Physical drive of the sector */
+	BYTE	slot;			/* Cache slot of the sector */
+} FVIEW;
+#endif
+
+
+
 /* File object structure (FIL) */
 
 typedef struct {
@@ -124,15 +285,42 @@ typedef struct {
 	DWORD	dir_sect;		/* Sector containing the directory entry */
 	BYTE*	dir_ptr;		/* Ponter to the directory entry in the window */
 #endif
+#if _FS_EXFAT && !_FS_READONLY
+	DWORD	dir_sclust;		/* Start cluster of the directory holding the entry set (exFAT, 0:Root dir) */
+	DWORD	dir_xclen;		/* Clusters of that directory if it is contiguous (exFAT, 0:FAT chain) */
+	WORD	dir_idx;		/* Index of the file entry in the directory (exFAT) */
+#endif
+#if _FS_DSYNC
+	DWORD	dir_time;		/* Time of last directory entry update (get_msec) */
+	DWORD	dir_size;		/* File size at last directory entry update */
+#endif
 #if _USE_FASTSEEK
 	DWORD*	cltbl;			/* Pointer to the cluster link map table (null on file open) */
 #endif
 #if _FS_SHARE
 	UINT	lockid;			/* File lock ID (index of file semaphore table) */
 #endif
+#if _USE_EXPAND
+	DWORD	eclust;			/* Last cluster of contiguous chain from sclust (0:unknown) */
+#endif
+#if _FS_EXFAT
+	BYTE	xstat;			/* Chain status on exFAT (0:FAT chain, 2:sclust..eclust without FAT chain) */
+#endif
+#if _FS_READ_AHEAD
+	DWORD	rdnext;			/* File pointer after the last f_read (sequential access detection) */
+#endif
+#if _FS_RESERVE && !_FS_READONLY
+	DWORD	rsv_clust;		/* Next cluster of the allocation window (0:no window) */
+	DWORD	rsv_end;		/* Cluster after the allocation window */
+#endif
 #if !_FS_TINY
 	BYTE	buf[_MAX_SS];	/* File data read/write buffer */
 #endif
+#if _FS_WCOMB
+	DWORD	wcsect;			/* First sector held in the wcbuf[] */
+	BYTE	wccnt;			/* Number of sectors held in the wcbuf[] (0:Empty) */
+	BYTE	wcbuf[_FS_WCOMB * _MAX_SS];	/* Write-combining buffer */
+#endif
 } FIL;
 
 
@@ -152,6 +340,12 @@ typedef struct {
 	WCHAR*	lfn;			/* Pointer to the LFN working buffer */
 	WORD	lfn_idx;		/* Last matched LFN index number (0xFFFF:No LFN) */
 #endif
+#if _FS_EXFAT
+	DWORD	xclen;			/* Clusters of the table if it is contiguous (exFAT, 0:FAT chain) */
+	DWORD	pclust;			/* Start cluster of the parent directory (exFAT, its entry is updated on stretch) */
+	DWORD	pxclen;			/* Clusters of the parent directory if it is contiguous (exFAT) */
+	WORD	pidx;			/* Index of the directory entry in the parent directory (exFAT) */
+#endif
 } DIR;
 
 
@@ -172,6 +366,20 @@ typedef struct {
 
 
 
+/* Directory entry of bulk listing (FILENT) */
+
+#if _FS_LISTNAME
+typedef struct {
+	DWORD	fsize;			/* File size */
+	WORD	fdate;			/* Last modified date */
+	WORD	ftime;			/* Last modified time */
+	BYTE	fattrib;		/* Attribute */
+	TCHAR	fname[_FS_LISTNAME];	/* Long file name if it fits, otherwise short file name (8.3 format) */
+} FILENT;
+#endif
+
+
+
 /* File function return code (FRESULT) */
 
 typedef enum {
@@ -209,11 +417,17 @@ FRESULT f_lseek (FIL*, DWORD);						/* Move file pointer of a file object */
 FRESULT f_close (FIL*);								/* Close an open file object */
 FRESULT f_opendir (DIR*, const TCHAR*);				/* Open an existing directory */
 FRESULT f_readdir (DIR*, FILINFO*);					/* Read a directory item */
+#if _FS_LISTNAME
+FRESULT f_listdir (DIR*, FILENT*, UINT, UINT*);		/* Read directory items in bulk */
+#endif
 FRESULT f_stat (const TCHAR*, FILINFO*);			/* Get file status */
 FRESULT f_write (FIL*, const void*, UINT, UINT*);	/* Write data to a file */
 FRESULT f_getfree (const TCHAR*, DWORD*, FATFS**);	/* Get number of free clusters on the drive */
 FRESULT f_truncate (FIL*);							/* Truncate file */
+FRESULT f_expand (FIL*, DWORD, BYTE);				/* Allocate a contiguous block to the file */
+FRESULT f_maintain (const TCHAR*, UINT);			/* Pre-erase free clusters ahead and update FSInfo */
 FRESULT f_sync (FIL*);								/* Flush cached data of a writing file */
+FRESULT f_datasync (FIL*);							/* Flush data of a writing file, defer its directory entry */
 FRESULT f_unlink (const TCHAR*);					/* Delete an existing file or directory */
 FRESULT	f_mkdir (const TCHAR*);						/* Create a new directory */
 FRESULT f_chmod (const TCHAR*, BYTE, BYTE);			/* Change attriburte of the file/dir */
@@ -223,12 +437,23 @@ FRESULT f_chdrive (BYTE);							/* Change current drive */
 FRESULT f_chdir (const TCHAR*);						/* Change current directory */
 FRESULT f_getcwd (TCHAR*, UINT);					/* Get current directory */
 FRESULT f_forward (FIL*, UINT(*)(const BYTE*,UINT), UINT, UINT*);	/* Forward data to the stream */
+#if _USE_VIEW
+FRESULT f_view (FIL*, FVIEW*, UINT, UINT*);			/* Map file data in the disk cache */
+FRESULT f_unview (FVIEW*);							/* Release mapped file data */
+#endif
 FRESULT f_mkfs (BYTE, BYTE, UINT);					/* Create a file system on the drive */
 FRESULT	f_fdisk (BYTE, const DWORD[], void*);		/* Divide a physical drive into some partitions */
 int f_putc (TCHAR, FIL*);							/* Put a character to the file */
 int f_puts (const TCHAR*, FIL*);					/* Put a string to the file */
 int f_printf (FIL*, const TCHAR*, ...);				/* Put a formatted string to the file */
 TCHAR* f_gets (TCHAR*, int, FIL*);					/* Get a string from the file */
+DWORD clust2sect (FATFS*, DWORD);					/* Get sector# of a cluster (raw access to contiguous files) */
+FRESULT f_invalidate (BYTE, DWORD, DWORD);			/* Forget cached copies of sectors written around FatFs */
+FRESULT f_eject (BYTE, BYTE);						/* Hand the drive over to another user and take it back */
+FRESULT f_commit (FIL* const*, UINT);				/* Write directory entries of the files and metadata of each volume now */
+#if _FS_STATS
+void f_getstats (FFSTAT*, BYTE);					/* Get (and clear) counters of internal functions */
+#endif
 
 #define f_eof(fp) (((fp)->fptr == (fp)->fsize) ? 1 : 0)
 #define f_error(fp) (((fp)->flag & FA__ERROR) ? 1 : 0)
@@ -248,6 +473,12 @@ TCHAR* f_gets (TCHAR*, int, FIL*);					/* Get a string from the file */
 #if !_FS_READONLY
 /* Real time clock */
 DWORD get_fattime (void);
+/* Millisecond counter for deferred metadata updates */
+DWORD get_msec (void);
+#endif
+#if _FS_STATS
+/* Cycle counter for the counters of internal functions */
+DWORD get_cycles (void);
 #endif
 
 /* Unicode support functions */
@@ -260,6 +491,12 @@ void ff_memfree (void*);			/* Free memory block */
 #endif
 #endif
 
+/* Progress functions of long operations */
+#if _FS_PROGRESS
+void ff_progress (DWORD, DWORD);	/* Report sectors done of their total */
+void ff_set_progress (void (*)(DWORD, DWORD));	/* Set callback of ff_progress (0:None) */
+#endif
+
 /* Sync functions */
 #if _FS_REENTRANT
 int ff_cre_syncobj (BYTE, _SYNC_t*);/* Create a sync object */
@@ -268,6 +505,13 @@ void ff_rel_grant (_SYNC_t);		/* Unlock sync object */
 int ff_del_syncobj (_SYNC_t);		/* Delete a sync object */
 #endif
 
+/* Volume state snapshot functions */
+#if _FS_WARM
+const FFSTATE* ff_state_get (BYTE);	/* Get valid snapshot of the volume (0:None) */
+FFSTATE* ff_state_begin (BYTE);		/* Invalidate snapshot and get its storage */
+void ff_state_end (BYTE);			/* Validate the snapshot written */
+#endif
+
 
 
 
@@ -296,6 +540,7 @@ int ff_del_syncobj (_SYNC_t);		/* Delete a sync object */
 #define FS_FAT12	1
 #define FS_FAT16	2
 #define FS_FAT32	3
+#define FS_EXFAT	4
 
 
 /* File attribute bits for directory entry */
@@ -10,6 +10,41 @@
 #define _FFCONF 6502	/* Revision ID */
 
 
+/*---------------------------------------------------------------------------/
+/ Build Profile
+/----------------------------------------------------------------------------*/
+
+#define	_FS_PROFILE		0	/* 0:Custom, 1:Minimal, 2:Logger or 3:Full */
+/* The _FS_PROFILE option selects a predefined set of the options below, the
+/  profile overrides them at the end of this file. 0 uses the options as they
+/  are set in this file.
+/
+/   1: Minimal. _FS_TINY, no sector cache, free cluster map, f_lseek nor
+/      f_expand. Only f_open, f_read, f_write, f_sync and f_close.
+/   2: Logger. File data buffer in each file object (appending does not evict
+/      FAT sectors) with 4 sector write-combining buffer, directory entry
+/      updated by f_sync once a second or each 64KB, FSInfo every 10 seconds,
+/      FAT sector cache, free cluster map, f_expand and
+/      _FS_MINIMIZE 0 (f_getfree, f_lseek, f_truncate, directories).
+/   3: Full. Logger plus fast seek with automatic CLMT, root directory and
+/      data sector cache and string functions.
+/   Profiles 2, 3 and 0 use LFN (code page 437), profiles 3 and 0 also use the
+/   directory name index (_FS_DIRINDEX).
+/
+/   RAM of FatFs objects (ILP32 layout as on Cortex-M3, bytes):
+/
+/   Profile  FATFS  FIL  Static  Volume + 1 file  + each more file
+/   -------  -----  ---  ------  ---------------  ----------------
+/   0        14924   60      12            14996                60
+/   1          564   36      12              612                36
+/   2         4636 2632      12             7280              2632
+/   3        14924  580      12            15516               580
+/   FATFS includes the LFN buffer (512), the directory name index (8200), the
+/   automatic CLMT pool (520) and the exFAT entry set (640), each more mounted
+/   volume takes one more FATFS. Flash and throughput have to be measured on
+/   the target build, they depend on compiler options. */
+
+
 /*---------------------------------------------------------------------------/
 / Functions and Buffer Configurations
 /----------------------------------------------------------------------------*/
@@ -20,13 +55,89 @@
 /  data transfer. This reduces memory consumption 512 bytes each file object. */
 
 
+#define	_FS_WCOMBINE	0	/* Sectors of write-combining buffer in file object (0:Disable) */
+/* When _FS_TINY is 0, small writes are collected in the sector buffer of the
+/  file object. With _FS_WCOMBINE set to 2 or more, sequentially written sectors
+/  which leave that buffer are also held in a write-combining buffer of the
+/  file object, so they are written by one multiple sector write when it is
+/  full or on f_sync/f_close/f_lseek/f_read/f_truncate. This takes
+/  _FS_WCOMBINE * _MAX_SS bytes of each file object. Not used when _FS_TINY is 1. */
+
+
+#define	_FS_FATWIN		0	/* 0:Disable or 1:Enable separate FAT window */
+/* When _FS_FATWIN is 1, FAT sectors (and the allocation bitmap of exFAT) are
+/  accessed through a second window of the file system object, which keeps the
+/  current FAT sector. A partial sector of file data moving through the win[]
+/  on tiny cfg then does not write back the FAT sector being allocated from,
+/  nor read it again on the next cluster. It takes _MAX_SS + 4 bytes of the
+/  file system object. FAT sectors do not enter the sector cache then, set
+/  _FS_CACHE_FAT to 0. */
+
+
+#define	_FS_CACHE_FAT	4	/* Number of cached sectors of FAT area */
+#define	_FS_CACHE_DIR	2	/* Number of cached sectors of root directory (FAT12/16) */
+#define	_FS_CACHE_DATA	2	/* Number of cached sectors of data area */
+/* Sectors leaving the window (win[] of the file system object) are kept in the
+/  LRU sector cache with separate ways for FAT, root directory and data sectors,
+/  dirty ones are written back on sync or when they are replaced. Each cached
+/  sector takes _MAX_SS + 12 bytes of the file system object. Directories of
+/  FAT32 are in data area, so on FAT32 volume data sectors use both last ways.
+/  Set all of them to 0 to disable the cache (it is not used on read only cfg). */
+
+
+#define	_FS_FREEMAP		256	/* Size of free cluster map in bytes (0:Disable) */
+/* The free cluster map has one bit for each group of n_fatent / (_FS_FREEMAP * 8)
+/  clusters, cleared bit means that the group has no free cluster, so cluster
+/  allocation skips it without reading its FAT sectors. The map is built lazily
+/  by the allocation itself (and completely by f_getfree). Hot FAT sectors stay
+/  resident in the FAT way of the sector cache (_FS_CACHE_FAT). */
+
+
+#define	_FS_PROGRESS	1	/* 0:Disable or 1:Enable progress function */
+/* With _FS_PROGRESS, the full scan of f_getfree calls ff_progress() after each
+/  FAT (or allocation bitmap) sector with the number of sectors done and their
+/  total. The function in syscall.c kicks the watchdog, so the scan of a large
+/  card doesn't reset the board, and passes the progress to the callback set by
+/  ff_set_progress() (e.g. for a progress bar). */
+
+
 #define _FS_READONLY	0	/* 0:Read/Write or 1:Read only */
 /* Setting _FS_READONLY to 1 defines read only configuration. This removes
 /  writing functions, f_write, f_sync, f_unlink, f_mkdir, f_chmod, f_rename,
 /  f_truncate and useless f_getfree. */
 
 
-#define _FS_MINIMIZE	3	/* 0 to 3 */
+#define	_FS_DIR_SYNC_MS	0	/* Interval of directory entry updates by f_sync in ms (0:Disable) */
+#define	_FS_DIR_SYNC_KB	0	/* File growth between directory entry updates by f_sync in KB (0:Disable) */
+#define	_FS_FSI_SYNC_MS	0	/* Interval of FSInfo updates in ms (0:Every sync) */
+/* When _FS_DIR_SYNC_MS or _FS_DIR_SYNC_KB is not zero, f_sync flushes file
+/  data and FAT every time, but rewrites the directory entry (size and time
+/  stamp) only when the interval has passed since its previous update or the
+/  file has grown by the given size, so data written after it is lost if the
+/  power fails before the next update. When _FS_FSI_SYNC_MS is not zero, the
+/  FSInfo sector of FAT32 volume is written only when the interval has passed,
+/  its free cluster count can be stale after power failure (f_getfree
+/  recounts it when it is out of range). f_close always updates the directory
+/  entry and f_mount(vol, 0) writes pending FSInfo. f_datasync flushes file
+/  data and FAT regardless of these options and never updates the directory
+/  entry. get_msec() function must be provided by the user. */
+
+
+#define	_FS_WARMSTATE	1	/* 0:Disable or 1:Enable */
+/* When _FS_WARMSTATE is 1, a snapshot of each mounted volume (its location,
+/  free cluster count, next free cluster and free cluster map) is kept in a
+/  memory which survives a reset and it is refreshed on every sync. The next
+/  mount of the same card (MMC_GET_CID) and volume (serial number) reads only
+/  the boot record: the partition table and FSInfo are not read and the free
+/  cluster count is trusted, so f_getfree doesn't scan the FAT. Functions
+/  ff_state_get, ff_state_begin and ff_state_end must be provided by the user
+/  (ffstate.c keeps the snapshots in backup SRAM). A cold snapshot, which
+/  outlived a power-off (ffstate.c copies it into FLASH), is taken only for a
+/  FAT32 volume whose FSInfo still holds the values written before the
+/  snapshot, at the cost of reading FSInfo. Not used on read only cfg. */
+
+
+#define _FS_MINIMIZE	2	/* 0 to 3 */
 /* The _FS_MINIMIZE option defines minimization level to remove some functions.
 /
 /   0: Full function.
@@ -36,28 +147,90 @@
 /   3: f_lseek is removed in addition to 2. */
 
 
+#define	_FS_LISTNAME	32	/* 0:Disable or 13-256:Enable */
+/* To enable f_listdir function, set _FS_LISTNAME to the size of the name in
+/  its entries (FILENT) and _FS_MINIMIZE to 0 or 1. f_listdir fills an array of
+/  entries under one lock of the volume and reads directory sectors ahead in
+/  one request (_FS_DIR_PREFETCH). An entry holds the long file name if it fits
+/  in _FS_LISTNAME, otherwise the short file name. */
+
+
 #define	_USE_STRFUNC	0	/* 0:Disable or 1-2:Enable */
 /* To enable string functions, set _USE_STRFUNC to 1 or 2. */
 
 
-#define	_USE_MKFS		0	/* 0:Disable or 1:Enable */
-/* To enable f_mkfs function, set _USE_MKFS to 1 and set _FS_READONLY to 0 */
+#define	_USE_MKFS		1	/* 0:Disable or 1:Enable */
+/* To enable f_mkfs function, set _USE_MKFS to 1 and set _FS_READONLY to 0.
+/  f_mkfs aligns the partition, the FAT and the data area to the erase block
+/  (GET_BLOCK_SIZE: AU of the SD Card from its SD Status) and with au = 0 it
+/  selects the cluster size of the SD File System Specification (8K up to
+/  8 MB, 16K up to 1 GB, 32K above: the flash page of the card), at most one
+/  AU, so no cluster straddles AUs. FAT32 of 32K clusters on SDXC cards. */
+
+
+#define	_USE_FORWARD	1	/* 0:Disable or 1:Enable */
+/* To enable f_forward function, set _USE_FORWARD to 1 and set _FS_TINY to 1.
+/  The file service (ffserv.c) sends READ data by DMA straight from the sector
+/  window then, without the 2 Kb DATA frame buffers. */
 
 
-#define	_USE_FORWARD	0	/* 0:Disable or 1:Enable */
-/* To enable f_forward function, set _USE_FORWARD to 1 and set _FS_TINY to 1. */
+#define	_USE_VIEW		1	/* 0:Disable or 1:Enable */
+/* To enable f_view and f_unview functions, set _USE_VIEW to 1. f_view maps file
+/  data of the current sector in the sector cache of the disk layer (diskio.c
+/  with USE_DISK_CACHE) instead of copying them, the slot is pinned until
+/  f_unview, so records are parsed in place. Views are read only, the file has
+/  to be opened without FA_WRITE. Without the cache f_view returns FR_DENIED. */
 
 
-#define	_USE_FASTSEEK	0	/* 0:Disable or 1:Enable */
+#define	_USE_FASTSEEK	1	/* 0:Disable or 1:Enable */
 /* To enable fast seek feature, set _USE_FASTSEEK to 1. */
 
 
+#define	_FS_CLMT_FILES	2	/* 0:Disable or >=1:Number of automatic CLMTs */
+#define	_FS_CLMT_SIZE	64	/* Size of each automatic CLMT in unit of DWORD */
+/* When _FS_CLMT_FILES is not zero, f_open builds the cluster link map table
+/  from a pool of _FS_CLMT_FILES tables in the FATFS for files opened without
+/  FA_WRITE, so f_lseek and f_read find clusters in O(fragments) instead of
+/  following the FAT chain. f_close returns the table to the pool. A table of
+/  _FS_CLMT_SIZE items maps (_FS_CLMT_SIZE - 2) / 2 fragments, more fragmented
+/  files are opened in normal seek mode. _USE_FASTSEEK must be 1. */
+
+
+#define	_USE_EXPAND		1	/* 0:Disable or 1:Enable */
+/* To enable f_expand function, set _USE_EXPAND to 1. f_expand allocates a
+/  contiguous cluster chain to an empty file, then file data is transferred
+/  across cluster boundaries by one multiple sector transfer without FAT lookups.
+/  With opt bit 1 (value 2) the block starts at an erase block (GET_BLOCK_SIZE),
+/  so a recording fills whole AUs of SD Card sequentially as speed class assumes. */
+
+
+#define	_USE_MAINTAIN	1	/* 0:Disable or 1:Enable */
+/* To enable f_maintain function, set _USE_MAINTAIN to 1. f_maintain is the
+/  idle-time work of a volume: free clusters of the next erase blocks after the
+/  allocation point are passed to CTRL_ERASE_SECTOR (once per allocation point),
+/  so the following writes go to erased flash, and an outdated FSInfo is
+/  written. _USE_ERASE must be 1. */
+
+
+#define	_FS_RESERVE		0	/* 0:Disable or >=2:Clusters reserved ahead of each file */
+/* When _FS_RESERVE is not zero, a file stretched by f_write or f_lseek takes
+/  new clusters from its own window of _FS_RESERVE clusters, the clusters
+/  for other files are searched after the window. So files appended at the
+/  same time stay contiguous in runs of the window size instead of being
+/  interleaved cluster by cluster. The window is only a hint kept in the
+/  FIL, it isn't marked in the FAT, and f_close gives back its unused part
+/  if nothing was allocated after it. It pays off when files are read in
+/  larger pieces than they were appended in; writes of several files get
+/  scattered over the card instead of following each other, which costs
+/  write time on cards tracking few open allocation units. */
+
+
 
 /*---------------------------------------------------------------------------/
 / Locale and Namespace Configurations
 /----------------------------------------------------------------------------*/
 
-#define _CODE_PAGE	1
+#define _CODE_PAGE	437
 /* The _CODE_PAGE specifies the OEM code page to be used on the target system.
 /  Incorrect setting of the code page can cause a file open failure.
 /
@@ -90,19 +263,51 @@
 */
 
 
-#define	_USE_LFN	0		/* 0 to 3 */
+#define	_USE_LFN	1		/* 0 to 3 */
 #define	_MAX_LFN	255		/* Maximum LFN length to handle (12 to 255) */
 /* The _USE_LFN option switches the LFN support.
 /
 /   0: Disable LFN feature. _MAX_LFN and _LFN_UNICODE have no effect.
-/   1: Enable LFN with static working buffer on the BSS. Always NOT reentrant.
+/   1: Enable LFN with static working buffer on the BSS. With _FS_REENTRANT
+/      the buffer is in the file system object, guarded by the volume lock.
 /   2: Enable LFN with dynamic working buffer on the STACK.
 /   3: Enable LFN with dynamic working buffer on the HEAP.
 /
 /  The LFN working buffer occupies (_MAX_LFN + 1) * 2 bytes. To enable LFN,
 /  Unicode handling functions ff_convert() and ff_wtoupper() must be added
-/  to the project. When enable to use heap, memory control functions
-/  ff_memalloc() and ff_memfree() must be added to the project. */
+/  to the project (ccsbcs.c, code page 437). When enable to use heap, memory
+/  control functions ff_memalloc() and ff_memfree() must be added to the project. */
+
+
+#define	_FS_DIRINDEX	4096	/* Number of slots of directory name index (0:Disable) */
+/* The name index makes repeated opens in a large directory independent of its
+/  size. When a search passes 64 entries of a directory, all its entries are
+/  scanned once and each object is put into the hash table of the file system
+/  object under its name, then a search reads only the entries of matching
+/  slots. The index covers the last such directory and is updated by object
+/  creation. Up to 3/4 of the slots are used (one for each object), a larger
+/  directory is searched without index. The value must be a power of 2, each
+/  slot takes 2 bytes of the file system object. */
+
+
+#define	_FS_DIR_PREFETCH	4	/* Directory sectors read ahead in one request (0:Disable) */
+/* When a directory search enters a sector at a multiple of _FS_DIR_PREFETCH
+/  from the start of the cluster, that sector and the following ones of the
+/  cluster are read into the sector cache of diskio in one request by
+/  disk_ioctl(CTRL_CACHE_PREFETCH), so the search doesn't wait for the card
+/  on every sector; a disk without cache ignores it. Up to 4 sectors are read
+/  at once (CACHE_MAX_RUN of diskio.c). */
+
+
+#define	_FS_READ_AHEAD	4	/* File data sectors read ahead of sequential f_read (0:Disable) */
+/* When f_read continues where the previous f_read of the file has ended and
+/  enters a sector at a multiple of _FS_READ_AHEAD from the start of the
+/  cluster by a read smaller than the sector, the following sectors of the
+/  cluster (and of the contiguous chain) are passed to diskio as a hint,
+/  disk_ioctl(CTRL_CACHE_READ_AHEAD). diskio reads them into its sector cache
+/  by its cache task, so the card works while the caller processes
+/  the current chunk and the next sectors are hits; without RTOS timers
+/  they are read at once, a disk without cache ignores the hint. */
 
 
 #define	_LFN_UNICODE	0	/* 0:ANSI/OEM or 1:Unicode */
@@ -120,13 +325,28 @@
 /  Note that output of the f_readdir fnction is affected by this option. */
 
 
+#define	_FS_EXFAT	1	/* 0:Disable or 1:Enable */
+/* When _FS_EXFAT is 1, exFAT volumes (SDXC cards are formatted so) are mounted
+/  in addition to FAT12/16/32. Free clusters are found in the allocation bitmap,
+/  and a file allocated in one piece (by f_expand or by appending to a file
+/  nobody else interleaves) is marked contiguous and gets no FAT chain at all,
+/  so its data go out without FAT updates. Files have to be under 4 GB (the
+/  file size is a DWORD), larger ones are refused by f_open. Names are compared
+/  by ff_wtoupper() instead of the up-case table of the volume. f_mkfs, f_chdir
+/  to sub-directories and f_getcwd work on FAT volumes only. _USE_LFN and
+/  _USE_EXPAND must be enabled; the file system object grows by 644 bytes. */
+
+
 
 /*---------------------------------------------------------------------------/
 / Physical Drive Configurations
 /----------------------------------------------------------------------------*/
 
-#define _VOLUMES	1
-/* Number of volumes (logical drives) to be used. */
+#define _VOLUMES	2
+/* Number of volumes (logical drives) to be used. Each volume has its own
+/  FATFS object, so its window, sector cache, free map, directory index and
+/  CLMT pool are independent of other volumes, and volumes are locked
+/  separately (files on both volumes are accessed concurrently). */
 
 
 #define	_MAX_SS		512		/* 512, 1024, 2048 or 4096 */
@@ -134,16 +354,31 @@
 /  Always set 512 for memory card and hard disk but a larger value may be
 /  required for on-board flash memory, floppy disk and optical disk.
 /  When _MAX_SS is larger than 512, it configures FatFs to variable sector size
-/  and GET_SECTOR_SIZE command must be implememted to the disk_ioctl function. */
+/  and GET_SECTOR_SIZE command must be implememted to the disk_ioctl function.
+/  diskio of the SD Card presents sectors of _MAX_SS bytes made of _MAX_SS / 512
+/  card blocks (DISK_BLOCKS), each sector is one multiple block transfer and one
+/  cache slot, so FatFs does 1/8 of the sector bookkeeping of large files with
+/  4096. The card has to be formatted with this sector size (f_mkfs, or e.g.
+/  mkfs.fat -S 4096 on a PC), and partition tables hold LBAs of these sectors.
+/  Cache of diskio keeps 8 Kb in fewer slots then, ffring and the benchmark
+/  still address 512 byte card blocks. */
 
 
-#define	_MULTI_PARTITION	0	/* 0:Single partition, 1/2:Enable multiple partition */
+#define	_MULTI_PARTITION	2	/* 0:Single partition, 1/2:Enable multiple partition */
 /* When set to 0, each volume is bound to the same physical drive number and
 / it can mount only first primaly partition. When it is set to 1, each volume
-/ is tied to the partitions listed in VolToPart[]. */
-
-
-#define	_USE_ERASE	0	/* 0:Disable or 1:Enable */
+/ is tied to the partitions listed in VolToPart[]. When it is set to 2, f_fdisk
+/ function is also available to create partitions on the drive (_USE_MKFS 1).
+/ VolToPart[] is defined in diskio.c: volume 0 is the data volume (the first
+/ partition or a card without partition table), volume 1 is the config
+/ volume on the second partition (drive numbers 0 and 1 are both the SD Card).
+/ Physical drives are listed in the driver table of diskio.c. Note that f_mkfs
+/ on a volume with auto detect (partition 0) writes a new single partition
+/ table, so a card divided by f_fdisk is formatted with VolToPart[0] set to
+/ partition 1. */
+
+
+#define	_USE_ERASE	1	/* 0:Disable or 1:Enable */
 /* To enable sector erase feature, set _USE_ERASE to 1. CTRL_ERASE_SECTOR command
 /  should be added to the disk_ioctl functio. */
 
@@ -166,13 +401,25 @@
 /  performance and code size.
 */
 
+#define _USE_LIBC_MEM	0	/* 0:FatFs memory functions or 1:C library */
+/* FatFs copies, fills and compares buffers by its own mem_cpy, mem_set and
+/  mem_cmp: they move four words per step between word aligned addresses, and
+/  on cores with unaligned word loads (Cortex-M3) also from any source address.
+/  Set 1 to use memcpy, memset and memcmp of the C library instead (e.g. the
+/  newlib built for speed rather than for size). */
+
 
 /* A header file that defines sync object types on the O/S, such as
 /  windows.h, ucos_ii.h and semphr.h, must be included prior to ff.h. */
 
-#define _FS_REENTRANT	0		/* 0:Disable or 1:Enable */
+#define _FS_REENTRANT	1		/* 0:Disable or 1:Enable */
 #define _FS_TIMEOUT		1000	/* Timeout period in unit of time ticks */
-#define	_SYNC_t			HANDLE	/* O/S dependent type of sync object. e.g. HANDLE, OS_EVENT*, ID and etc.. */
+#define	_SYNC_t			xSemaphoreHandle	/* O/S dependent type of sync object. e.g. HANDLE, OS_EVENT*, ID and etc.. */
+
+#if _FS_REENTRANT
+#include "FreeRTOS.h"	/* Sync objects are FreeRTOS mutexes (syscall.c) */
+#include "semphr.h"
+#endif
 
 /* The _FS_REENTRANT option switches the reentrancy (thread safe) of the FatFs module.
 /
@@ -187,4 +434,122 @@
    defines how many files can be opened simultaneously. */
 
 
+#define	_FS_STATS	0	/* 0:Disable or 1:Enable */
+/* When _FS_STATS is 1, calls of internal functions of ff.c (window moves, FAT
+/  access, cluster chains, directory search, path lookup) and disk_read and
+/  disk_write are counted: number of calls, sectors transferred by the disk
+/  functions and cycles spent, both including nested calls (FFS_* counters in
+/  ff.h). f_getstats copies and clears them, e.g. around one f_write to see
+/  its window moves. get_cycles function must be added to the project (diskio.c
+/  reads DWT cycle counter). Counters are shared by all volumes and tasks, and
+/  cycles include the time of preemption. Needs GCC (statement expressions). */
+
+
+/*---------------------------------------------------------------------------/
+/ Build Profile Overrides
+/----------------------------------------------------------------------------*/
+
+#if _FS_PROFILE == 1		/* Minimal */
+#undef	_FS_TINY
+#define	_FS_TINY		1
+#undef	_FS_CACHE_FAT
+#define	_FS_CACHE_FAT	0
+#undef	_FS_CACHE_DIR
+#define	_FS_CACHE_DIR	0
+#undef	_FS_CACHE_DATA
+#define	_FS_CACHE_DATA	0
+#undef	_FS_FREEMAP
+#define	_FS_FREEMAP		0
+#undef	_FS_MINIMIZE
+#define	_FS_MINIMIZE	3
+#undef	_USE_FASTSEEK
+#define	_USE_FASTSEEK	0
+#undef	_USE_EXPAND
+#define	_USE_EXPAND		0
+#undef	_USE_STRFUNC
+#define	_USE_STRFUNC	0
+#undef	_USE_LFN
+#define	_USE_LFN		0
+#undef	_FS_DIRINDEX
+#define	_FS_DIRINDEX	0
+#undef	_FS_DIR_PREFETCH
+#define	_FS_DIR_PREFETCH	0
+#undef	_FS_READ_AHEAD
+#define	_FS_READ_AHEAD	0
+#undef	_FS_WARMSTATE
+#define	_FS_WARMSTATE	0
+#undef	_FS_RESERVE
+#define	_FS_RESERVE		0
+#undef	_FS_EXFAT
+#define	_FS_EXFAT		0
+#undef	_USE_MKFS
+#define	_USE_MKFS		0
+#undef	_USE_VIEW
+#define	_USE_VIEW		0
+
+#elif _FS_PROFILE == 2		/* Logger */
+#undef	_FS_TINY
+#define	_FS_TINY		0
+#undef	_FS_WCOMBINE
+#define	_FS_WCOMBINE	4
+#undef	_FS_DIR_SYNC_MS
+#define	_FS_DIR_SYNC_MS	1000
+#undef	_FS_DIR_SYNC_KB
+#define	_FS_DIR_SYNC_KB	64
+#undef	_FS_FSI_SYNC_MS
+#define	_FS_FSI_SYNC_MS	10000
+#undef	_FS_CACHE_FAT
+#define	_FS_CACHE_FAT	4
+#undef	_FS_CACHE_DIR
+#define	_FS_CACHE_DIR	1
+#undef	_FS_CACHE_DATA
+#define	_FS_CACHE_DATA	0
+#undef	_FS_FREEMAP
+#define	_FS_FREEMAP		256
+#undef	_FS_MINIMIZE
+#define	_FS_MINIMIZE	0
+#undef	_USE_FASTSEEK
+#define	_USE_FASTSEEK	0
+#undef	_USE_EXPAND
+#define	_USE_EXPAND		1
+#undef	_USE_STRFUNC
+#define	_USE_STRFUNC	0
+#undef	_USE_LFN
+#define	_USE_LFN		1
+#undef	_FS_DIRINDEX
+#define	_FS_DIRINDEX	0
+
+#elif _FS_PROFILE == 3		/* Full */
+#undef	_FS_TINY
+#define	_FS_TINY		0
+#undef	_FS_CACHE_FAT
+#define	_FS_CACHE_FAT	4
+#undef	_FS_CACHE_DIR
+#define	_FS_CACHE_DIR	2
+#undef	_FS_CACHE_DATA
+#define	_FS_CACHE_DATA	2
+#undef	_FS_FREEMAP
+#define	_FS_FREEMAP		256
+#undef	_FS_MINIMIZE
+#define	_FS_MINIMIZE	0
+#undef	_USE_FASTSEEK
+#define	_USE_FASTSEEK	1
+#undef	_FS_CLMT_FILES
+#define	_FS_CLMT_FILES	2
+#undef	_USE_EXPAND
+#define	_USE_EXPAND		1
+#undef	_USE_STRFUNC
+#define	_USE_STRFUNC	1
+#undef	_USE_LFN
+#define	_USE_LFN		1
+#undef	_FS_DIRINDEX
+#define	_FS_DIRINDEX	4096
+#undef	_FS_RESERVE
+#define	_FS_RESERVE		16
+
+#elif _FS_PROFILE != 0
+#error Wrong _FS_PROFILE setting
+#endif
+
+
 #endif /* _FFCONFIG */
@@ -0,0 +1,822 @@
+/**
+ ******************************************************************************
+ * @file    ffkv.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Log-structured key-value store in a preallocated FatFs file.
+ *          Page Seq lives in slot Seq % Pages, the live pages are Tail ..
+ *          Page.Seq (the open page). The open page is written as a log
+ *          frame of fflog.c: into its own slot or into the next one, and
+ *          its latest copy goes into the own slot before the next page is
+ *          started. Each written page stores Tail, so KV_Open replays pages
+ *          from the Tail of the newest page. A slot behind Tail is reused
+ *          only when a page having that Tail is on the card (SyncedTail),
+ *          otherwise a power loss would find neither the compacted page nor
+ *          the copies of its records.
+ *          Compaction moves the latest records of the keys whose index
+ *          entries point to the tail page into the open page, deleted keys
+ *          and older values are dropped with the page.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#ifdef USE_FAT_KV
+
+#include "ffkv.h"
+#include "stm32_chksum.h"
+#include "stm32_pool.h"
+
+#include <string.h>
+
+#if !_USE_EXPAND || _FS_MINIMIZE > 2 || _FS_READONLY
+#error USE_FAT_KV needs f_expand, f_lseek and writing functions of FatFs (see ffconf.h)
+#endif
+
+#if POOL_BLOCK_SIZE < KV_PAGE_SIZE
+#error Index and page buffer of the store are pool blocks (see stm32_pool.h)
+#endif
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  Marker of store pages ("KVPG")
+ */
+#define KV_PAGE_MAGIC			0x4750564B
+
+/**
+ * @brief  Slots holding the latest copy of the open page (KV_Store.Shadow)
+ */
+#define KV_SLOT_NONE			0
+#define KV_SLOT_OWN				1
+#define KV_SLOT_SHADOW			2
+
+/**
+ * @brief  Record flags: the key is deleted (no value)
+ */
+#define KV_REC_DELETED			0x01
+
+/**
+ * @brief  Size of record header, size of a record with the value of len bytes
+ */
+#define KV_REC_HEADER			4
+#define KV_RecSize( len )		( ( KV_REC_HEADER + (len) + 3 ) & ~3u )
+
+/**
+ * @brief  Key which is not used: marks empty index entries
+ */
+#define KV_NO_KEY				0xFFFF
+#define KV_EMPTY				0xFFFFFFFF
+
+/**
+ * @brief  Index entries per pool block, keys which may be stored (load of the hash table)
+ */
+#define KV_BLOCK_ENTRIES		( POOL_BLOCK_SIZE / 4 )
+#define KV_MaxKeys( kv )		( (kv)->Entries - (kv)->Entries / 8 )
+
+/**
+ * @brief  Smallest store: the open page, its next slot and the reserve of compaction
+ */
+#define KV_MIN_PAGES			4
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Calculates CRC32 of the page (all words before Crc field) by the CRC unit
+ * @param  page: Page
+ * @retval CRC32
+ */
+static uint32_t KV_PageCrc( const KV_Page* page )
+{
+	return CHK_Crc32( page, KV_PAGE_SIZE - 4 );
+}
+
+/**
+ * @brief  Check if the page is intact
+ * @param  page: Page
+ * @retval Nonzero if page is valid
+ */
+static uint8_t KV_PageValid( const KV_Page* page )
+{
+	return ( page->Magic == KV_PAGE_MAGIC && page->Len <= KV_PAGE_DATA && page->Crc == KV_PageCrc( page ) );
+}
+
+/**
+ * @brief  Read page slot of the store file
+ * @param  kv: Store object
+ * @param  slot: Slot number (sector number in the file)
+ * @param  page: Buffer for the page
+ * @retval FatFs result
+ */
+static FRESULT KV_ReadSlot( KV_Store* kv, uint32_t slot, KV_Page* page )
+{
+	FRESULT res;
+	UINT br;
+
+	res = f_lseek( &kv->File, slot * KV_PAGE_SIZE );
+	if ( res == FR_OK )
+		res = f_read( &kv->File, page, KV_PAGE_SIZE, &br );
+	if ( res == FR_OK && br != KV_PAGE_SIZE )
+		res = FR_INT_ERR;
+	return res;
+}
+
+/**
+ * @brief  Write the open page into a slot of the store file (aligned whole sector goes
+ *         directly to the disk, FAT and directory entry are not touched)
+ * @param  kv: Store object
+ * @param  slot: Slot number
+ * @retval FatFs result
+ */
+static FRESULT KV_WriteSlot( KV_Store* kv, uint32_t slot )
+{
+	FRESULT res;
+	UINT bw;
+
+	res = f_lseek( &kv->File, slot * KV_PAGE_SIZE );
+	if ( res == FR_OK )
+		res = f_write( &kv->File, &kv->Page, KV_PAGE_SIZE, &bw );
+	if ( res == FR_OK && bw != KV_PAGE_SIZE )
+		res = FR_INT_ERR;
+	return res;
+}
+
+/**
+ * @brief  Write new version of the open page into the slot not holding its latest copy
+ * @param  kv: Store object
+ * @retval FatFs result
+ */
+static FRESULT KV_WritePage( KV_Store* kv )
+{
+	FRESULT res;
+	uint32_t seq;
+
+	if ( kv->Shadow != KV_SLOT_NONE )
+		kv->Page.Ver++;
+	kv->Page.Magic = KV_PAGE_MAGIC;
+	kv->Page.Tail = kv->Tail;
+	kv->Page.Reserved = 0;
+	kv->Page.Crc = KV_PageCrc( &kv->Page );
+
+	seq = kv->Page.Seq + ( ( kv->Shadow == KV_SLOT_OWN ) ? 1 : 0 );
+	res = KV_WriteSlot( kv, seq % kv->Pages );
+	if ( res == FR_OK )
+	{
+		kv->Shadow = ( seq == kv->Page.Seq ) ? KV_SLOT_OWN : KV_SLOT_SHADOW;
+		kv->Dirty = 0;
+		kv->WrittenTail = kv->Page.Tail;
+	}
+	return res;
+}
+
+/**
+ * @brief  Write the open page and sync the disk: written Tail frees the slots behind it
+ * @param  kv: Store object
+ * @param  force: Nonzero to write the page without new records (Tail has moved)
+ * @retval FatFs result
+ */
+static FRESULT KV_Flush( KV_Store* kv, uint8_t force )
+{
+	FRESULT res;
+
+	if ( !kv->Dirty && !force )
+		return FR_OK;
+	res = KV_WritePage( kv );
+	if ( res == FR_OK )
+		res = f_datasync( &kv->File );
+	if ( res == FR_OK )
+		kv->SyncedTail = kv->WrittenTail;
+	return res;
+}
+
+/**
+ * @brief  Finish the open page (its latest copy is placed into own slot) and start the next one
+ * @param  kv: Store object
+ * @retval FatFs result
+ */
+static FRESULT KV_NextPage( KV_Store* kv )
+{
+	FRESULT res = FR_OK;
+
+	if ( kv->Dirty )
+		res = KV_WritePage( kv );
+	if ( res == FR_OK && kv->Shadow == KV_SLOT_SHADOW )
+	{	/* next slot becomes own slot of the next page: own copy has to be on the card first */
+		res = KV_WriteSlot( kv, kv->Page.Seq % kv->Pages );
+		if ( res == FR_OK )
+			res = f_datasync( &kv->File );
+		if ( res == FR_OK )
+			kv->SyncedTail = kv->WrittenTail;
+	}
+	if ( res == FR_OK )
+	{
+		kv->Page.Seq++;
+		kv->Page.Ver = 0;
+		kv->Page.Len = 0;
+		kv->Shadow = KV_SLOT_NONE;
+	}
+	return res;
+}
+
+/**
+ * @brief  Append record to the open page, start the next page if it doesn't fit
+ * @param  kv: Store object
+ * @param  key: Key
+ * @param  flags: Record flags (KV_REC_*)
+ * @param  data: Value
+ * @param  len: Value length
+ * @param  reserve: Free pages which have to stay after the next page is started
+ * @retval FatFs result, FR_DENIED if the store is full
+ */
+static FRESULT KV_Append( KV_Store* kv, uint16_t key, uint8_t flags, const void* data, uint16_t len, uint32_t reserve )
+{
+	FRESULT res;
+	uint8_t* p;
+
+	if ( kv->Page.Len + KV_RecSize( len ) > KV_PAGE_DATA )
+	{
+		if ( KV_FreePages( kv ) < 1 + reserve )
+			return FR_DENIED;
+		res = KV_NextPage( kv );
+		if ( res != FR_OK )
+			return res;
+	}
+
+	p = kv->Page.Data + kv->Page.Len;
+	p[ 0 ] = (uint8_t)key;
+	p[ 1 ] = (uint8_t)( key >> 8 );
+	p[ 2 ] = (uint8_t)len;
+	p[ 3 ] = flags;
+	memcpy( p + KV_REC_HEADER, data, len );
+	memset( p + KV_REC_HEADER + len, 0, KV_RecSize( len ) - KV_REC_HEADER - len );
+	kv->Page.Len += KV_RecSize( len );
+	kv->Dirty = 1;
+	return FR_OK;
+}
+
+/**
+ * @brief  Find the latest record of the key in the page
+ * @param  page: Page
+ * @param  key: Key
+ * @retval Record, NULL if the page has no value of the key
+ */
+static const uint8_t* KV_PageFind( const KV_Page* page, uint16_t key )
+{
+	const uint8_t* rec = NULL;
+	const uint8_t* p;
+	uint16_t off;
+
+	for ( off = 0; off + KV_REC_HEADER <= page->Len; off += KV_RecSize( p[ 2 ] ) )
+	{
+		p = page->Data + off;
+		if ( off + KV_RecSize( p[ 2 ] ) > page->Len )
+			break;
+		if ( ( p[ 0 ] | ( p[ 1 ] << 8 ) ) == key )
+			rec = ( p[ 3 ] & KV_REC_DELETED ) ? NULL : p;
+	}
+	return rec;
+}
+
+/**
+ * @brief  Index entry
+ * @param  kv: Store object
+ * @param  i: Entry number
+ * @retval Pointer to the entry
+ */
+static uint32_t* KV_Entry( KV_Store* kv, uint32_t i )
+{
+	return &kv->Index[ i / KV_BLOCK_ENTRIES ][ i % KV_BLOCK_ENTRIES ];
+}
+
+/**
+ * @brief  Home entry of the key in the hash index
+ * @param  kv: Store object
+ * @param  key: Key
+ * @retval Entry number
+ */
+static uint32_t KV_Home( KV_Store* kv, uint16_t key )
+{
+	return ( ( key * 2654435761u ) >> 8 ) % kv->Entries;
+}
+
+/**
+ * @brief  Find the key in the hash index (linear probing, there is always an empty entry)
+ * @param  kv: Store object
+ * @param  key: Key
+ * @retval Number of the entry of the key, or of the empty entry it would take
+ */
+static uint32_t KV_Lookup( KV_Store* kv, uint16_t key )
+{
+	uint32_t i = KV_Home( kv, key );
+	uint32_t e;
+
+	for ( ;; )
+	{
+		e = *KV_Entry( kv, i );
+		if ( e == KV_EMPTY || ( e >> 16 ) == key )
+			return i;
+		if ( ++i == kv->Entries )
+			i = 0;
+	}
+}
+
+/**
+ * @brief  Store page slot of the key in the hash index
+ * @param  kv: Store object
+ * @param  key: Key
+ * @param  slot: Slot of the page with the latest value
+ * @retval FatFs result, FR_NOT_ENOUGH_CORE if the index is full
+ */
+static FRESULT KV_IndexSet( KV_Store* kv, uint16_t key, uint32_t slot )
+{
+	uint32_t* e = KV_Entry( kv, KV_Lookup( kv, key ) );
+
+	if ( *e == KV_EMPTY )
+	{
+		if ( kv->Keys >= KV_MaxKeys( kv ) )
+			return FR_NOT_ENOUGH_CORE;
+		kv->Keys++;
+	}
+	*e = ( (uint32_t)key << 16 ) | slot;
+	return FR_OK;
+}
+
+/**
+ * @brief  Remove the key from the hash index: following entries of the probe sequence
+ *         are shifted back, so lookups never stop at the removed entry
+ * @param  kv: Store object
+ * @param  key: Key
+ * @retval None
+ */
+static void KV_IndexDelete( KV_Store* kv, uint16_t key )
+{
+	uint32_t i = KV_Lookup( kv, key ), j = i, k;
+	uint32_t e;
+
+	if ( *KV_Entry( kv, i ) == KV_EMPTY )
+		return;
+	kv->Keys--;
+	for ( ;; )
+	{
+		if ( ++j == kv->Entries )
+			j = 0;
+		e = *KV_Entry( kv, j );
+		if ( e == KV_EMPTY )
+			break;
+		k = KV_Home( kv, (uint16_t)( e >> 16 ) );
+		/* entry j may move to the hole i if its home isn't cyclically in ( i, j ] */
+		if ( ( i < j ) ? ( k <= i || k > j ) : ( k <= i && k > j ) )
+		{
+			*KV_Entry( kv, i ) = e;
+			i = j;
+		}
+	}
+	*KV_Entry( kv, i ) = KV_EMPTY;
+}
+
+/**
+ * @brief  Apply records of the page to the index
+ * @param  kv: Store object
+ * @param  page: Page
+ * @param  slot: Slot of the page
+ * @retval FatFs result, FR_NOT_ENOUGH_CORE if the index is too small for the keys
+ */
+static FRESULT KV_Replay( KV_Store* kv, const KV_Page* page, uint32_t slot )
+{
+	FRESULT res = FR_OK;
+	const uint8_t* p;
+	uint16_t off, key;
+
+	for ( off = 0; off + KV_REC_HEADER <= page->Len && res == FR_OK; off += KV_RecSize( p[ 2 ] ) )
+	{
+		p = page->Data + off;
+		if ( off + KV_RecSize( p[ 2 ] ) > page->Len )
+			break;
+		key = p[ 0 ] | ( p[ 1 ] << 8 );
+		if ( p[ 3 ] & KV_REC_DELETED )
+			KV_IndexDelete( kv, key );
+		else
+			res = KV_IndexSet( kv, key, slot );
+	}
+	return res;
+}
+
+/**
+ * @brief  Rebuild the index: find the newest page, then replay pages from its Tail
+ * @param  kv: Store object, Pages is known
+ * @retval FatFs result, FR_DENIED if the file has no intact page
+ */
+static FRESULT KV_Recover( KV_Store* kv )
+{
+	FRESULT res = FR_OK;
+	uint32_t slot, seq, head = 0, tail = 0, best = 0;
+	uint16_t ver = 0;
+	uint8_t found = 0, shadow = 0;
+
+	/* a page is in its own slot or, being the open page, in the next one */
+	for ( slot = 0; slot < kv->Pages && res == FR_OK; ++slot )
+	{
+		res = KV_ReadSlot( kv, slot, kv->Read );
+		if ( res != FR_OK || !KV_PageValid( kv->Read ) )
+			continue;
+		seq = kv->Read->Seq;
+		if ( seq % kv->Pages != slot && ( seq + 1 ) % kv->Pages != slot )
+			continue;
+		if ( !found || seq > head || ( seq == head && (int16_t)( kv->Read->Ver - ver ) > 0 ) )
+		{
+			head = seq;
+			ver = kv->Read->Ver;
+			tail = kv->Read->Tail;
+			best = slot;
+			shadow = ( seq % kv->Pages != slot );
+			found = 1;
+		}
+	}
+	if ( res != FR_OK )
+		return res;
+	if ( !found || tail > head || head - tail + 2 > kv->Pages )
+		return FR_DENIED;
+
+	/* finished pages are in own slots, a damaged one loses its records */
+	for ( seq = tail; seq < head && res == FR_OK; ++seq )
+	{
+		res = KV_ReadSlot( kv, seq % kv->Pages, kv->Read );
+		if ( res == FR_OK && KV_PageValid( kv->Read ) && kv->Read->Seq == seq )
+			res = KV_Replay( kv, kv->Read, seq % kv->Pages );
+		else if ( res == FR_OK )
+			kv->Lost++;
+	}
+	if ( res == FR_OK )
+		res = KV_ReadSlot( kv, best, &kv->Page );
+	if ( res == FR_OK )
+		res = KV_Replay( kv, &kv->Page, head % kv->Pages );
+	kv->Tail = kv->SyncedTail = kv->WrittenTail = tail;
+	kv->Shadow = shadow ? KV_SLOT_SHADOW : KV_SLOT_OWN;
+	return res;
+}
+
+/**
+ * @brief  Create the store in the empty file: preallocate contiguous block, clear all
+ *         slots (stale pages of an older store in the same clusters) and write page 0
+ * @param  kv: Store object, file is open
+ * @param  size: Size of the store in bytes
+ * @retval FatFs result
+ */
+static FRESULT KV_Create( KV_Store* kv, uint32_t size )
+{
+	FRESULT res;
+	uint32_t slot;
+
+	res = f_expand( &kv->File, size, 1 );
+	if ( res == FR_OK )
+		res = f_lseek( &kv->File, size );
+	if ( res == FR_OK && kv->File.fsize != size )
+		res = FR_DENIED;
+	kv->Pages = size / KV_PAGE_SIZE;
+	memset( &kv->Page, 0, sizeof( kv->Page ) );
+	for ( slot = 0; slot < kv->Pages && res == FR_OK; ++slot )
+		res = KV_WriteSlot( kv, slot );
+	kv->Shadow = KV_SLOT_NONE;
+	if ( res == FR_OK )
+		res = KV_WritePage( kv );
+	if ( res == FR_OK )
+		res = f_sync( &kv->File );
+	return res;
+}
+
+/**
+ * @brief  Move live records of the tail page to the open page and free the tail page
+ *         (it is reused when the moved Tail is synced)
+ * @param  kv: Store object
+ * @retval FatFs result
+ */
+static FRESULT KV_CompactPage( KV_Store* kv )
+{
+	FRESULT res;
+	const uint8_t* p;
+	const uint8_t* rec;
+	uint32_t slot = kv->Tail % kv->Pages, e, i;
+	uint16_t off, key;
+
+	if ( kv->Tail == kv->Page.Seq )
+		return FR_OK;
+	res = KV_ReadSlot( kv, slot, kv->Read );
+	if ( res != FR_OK )
+		return res;
+	if ( KV_PageValid( kv->Read ) && kv->Read->Seq == kv->Tail )
+	{
+		for ( off = 0; off + KV_REC_HEADER <= kv->Read->Len && res == FR_OK; off += KV_RecSize( p[ 2 ] ) )
+		{
+			p = kv->Read->Data + off;
+			key = p[ 0 ] | ( p[ 1 ] << 8 );
+			e = *KV_Entry( kv, KV_Lookup( kv, key ) );
+			if ( e == KV_EMPTY || ( e & 0xFFFF ) != slot )
+				continue;		/* deleted, or a newer value is in a later page */
+			rec = KV_PageFind( kv->Read, key );
+			if ( rec == NULL )
+				continue;
+			res = KV_Append( kv, key, 0, rec + KV_REC_HEADER, rec[ 2 ], 0 );
+			if ( res == FR_OK )
+				res = KV_IndexSet( kv, key, kv->Page.Seq % kv->Pages );
+		}
+	}
+	else
+	{	/* damaged on the card since KV_Open: its keys are lost */
+		for ( i = 0; i < kv->Entries; ++i )
+		{
+			if ( *KV_Entry( kv, i ) != KV_EMPTY && ( *KV_Entry( kv, i ) & 0xFFFF ) == slot )
+			{
+				KV_IndexDelete( kv, (uint16_t)( *KV_Entry( kv, i ) >> 16 ) );
+				i--;		/* an entry may have been shifted back into i */
+			}
+		}
+		kv->Lost++;
+	}
+	if ( res == FR_OK )
+	{
+		kv->Tail++;
+		kv->Compacted++;
+	}
+	return res;
+}
+
+/**
+ * @brief  Make sure the record fits: compact tail pages while the ring has no free page
+ *         for it and for the reserve of compaction
+ * @param  kv: Store object
+ * @param  size: Record size
+ * @retval FatFs result, FR_DENIED if live records fill the ring
+ */
+static FRESULT KV_Room( KV_Store* kv, uint32_t size )
+{
+	FRESULT res;
+	uint32_t n;
+
+	for ( n = 0; kv->Page.Len + size > KV_PAGE_DATA && KV_FreePages( kv ) < 2; ++n )
+	{
+		if ( n == kv->Pages || kv->Tail == kv->Page.Seq )
+			return FR_DENIED;
+		res = KV_CompactPage( kv );
+		if ( res == FR_OK )
+			res = KV_Flush( kv, 1 );
+		if ( res != FR_OK )
+			return res;
+	}
+	return FR_OK;
+}
+
+/**
+ * @brief  Return pool blocks of the store
+ * @param  kv: Store object
+ * @retval None
+ */
+static void KV_Free( KV_Store* kv )
+{
+	uint8_t i;
+
+	for ( i = 0; i < KV_INDEX_BLOCKS; ++i )
+	{
+		if ( kv->Index[ i ] != NULL )
+			POOL_Free( kv->Index[ i ] );
+		kv->Index[ i ] = NULL;
+	}
+	if ( kv->Read != NULL )
+		POOL_Free( kv->Read );
+	kv->Read = NULL;
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Open the store file, create it if it doesn't exist. Existing store keeps its size,
+ *         the index is rebuilt from its pages (each slot is read once, live pages twice).
+ * @param  kv: Store object
+ * @param  path: File name
+ * @param  size: Size of the new store in bytes (rounded down to KV_PAGE_SIZE, at least 4 pages,
+ *         32 Mb at most), ignored if the store exists
+ * @param  index_blocks: Number of pool blocks of the index (1 .. KV_INDEX_BLOCKS), one more block
+ *         is the page buffer
+ * @retval FatFs result:
+ *         - FR_DENIED: No contiguous block for the new store or the file is not a store
+ *         - FR_NOT_ENOUGH_CORE: No free pool blocks or the index is too small for the keys
+ */
+FRESULT KV_Open( KV_Store* kv, const TCHAR* path, uint32_t size, uint8_t index_blocks )
+{
+	FRESULT res = FR_OK;
+	uint8_t i;
+
+	memset( kv, 0, sizeof( *kv ) );
+	size -= size % KV_PAGE_SIZE;
+	if ( index_blocks == 0 || index_blocks > KV_INDEX_BLOCKS )
+		return FR_INVALID_PARAMETER;
+	kv->Read = (KV_Page*)POOL_Alloc();
+	for ( i = 0; i < index_blocks; ++i )
+		kv->Index[ i ] = (uint32_t*)POOL_Alloc();
+	for ( i = 0; i < index_blocks; ++i )
+	{
+		if ( kv->Index[ i ] == NULL )
+			res = FR_NOT_ENOUGH_CORE;
+		else
+			memset( kv->Index[ i ], 0xFF, POOL_BLOCK_SIZE );
+	}
+	if ( kv->Read == NULL )
+		res = FR_NOT_ENOUGH_CORE;
+	kv->Entries = index_blocks * KV_BLOCK_ENTRIES;
+	if ( res == FR_OK )
+		res = f_open( &kv->File, path, FA_READ | FA_WRITE | FA_OPEN_ALWAYS );
+	if ( res != FR_OK )
+	{
+		KV_Free( kv );
+		return res;
+	}
+
+	if ( kv->File.fsize == 0 )
+		res = ( size < KV_MIN_PAGES * KV_PAGE_SIZE || size / KV_PAGE_SIZE > 0xFFFF ) ? FR_INVALID_PARAMETER :
+				KV_Create( kv, size );
+	else
+	{
+		kv->Pages = kv->File.fsize / KV_PAGE_SIZE;
+		res = ( kv->Pages < KV_MIN_PAGES || kv->Pages > 0xFFFF ) ? FR_DENIED : KV_Recover( kv );
+	}
+	if ( res != FR_OK )
+	{
+		f_close( &kv->File );
+		KV_Free( kv );
+	}
+	return res;
+}
+
+/**
+ * @brief  Get the value of the key
+ * @param  kv: Store object
+ * @param  key: Key
+ * @param  buf: Buffer for the value
+ * @param  size: Buffer size, longer value is truncated
+ * @param  len: Length of the value
+ * @retval FatFs result:
+ *         - FR_NO_FILE: No such key
+ *         - FR_INT_ERR: Page of the key is damaged on the card
+ */
+FRESULT KV_Get( KV_Store* kv, uint16_t key, void* buf, uint16_t size, uint16_t* len )
+{
+	FRESULT res;
+	const KV_Page* page = &kv->Page;
+	const uint8_t* rec;
+	uint32_t e, slot, head = kv->Page.Seq % kv->Pages;
+
+	*len = 0;
+	e = *KV_Entry( kv, KV_Lookup( kv, key ) );
+	if ( e == KV_EMPTY || key == KV_NO_KEY )
+		return FR_NO_FILE;
+	slot = e & 0xFFFF;
+	if ( slot != head )
+	{
+		res = KV_ReadSlot( kv, slot, kv->Read );
+		if ( res != FR_OK )
+			return res;
+		page = kv->Read;
+		if ( !KV_PageValid( page ) || page->Seq != kv->Page.Seq - ( head + kv->Pages - slot ) % kv->Pages )
+			return FR_INT_ERR;
+	}
+	rec = KV_PageFind( page, key );
+	if ( rec == NULL )
+		return FR_INT_ERR;
+	*len = rec[ 2 ];
+	memcpy( buf, rec + KV_REC_HEADER, ( *len < size ) ? *len : size );
+	return FR_OK;
+}
+
+/**
+ * @brief  Set the value of the key, tail pages are compacted first if the ring is full
+ * @param  kv: Store object
+ * @param  key: Key (0 .. 0xFFFE)
+ * @param  data: Value
+ * @param  len: Value length (up to KV_VALUE_MAX bytes)
+ * @param  commit: Nonzero to make the value durable before return (see KV_Commit)
+ * @retval FatFs result:
+ *         - FR_DENIED: Live values fill the store
+ *         - FR_NOT_ENOUGH_CORE: New key and the index is full
+ */
+FRESULT KV_Set( KV_Store* kv, uint16_t key, const void* data, uint16_t len, uint8_t commit )
+{
+	FRESULT res;
+
+	if ( key == KV_NO_KEY || len > KV_VALUE_MAX )
+		return FR_INVALID_PARAMETER;
+	if ( *KV_Entry( kv, KV_Lookup( kv, key ) ) == KV_EMPTY && kv->Keys >= KV_MaxKeys( kv ) )
+		return FR_NOT_ENOUGH_CORE;
+	res = KV_Room( kv, KV_RecSize( len ) );
+	if ( res == FR_OK )
+		res = KV_Append( kv, key, 0, data, len, 1 );
+	if ( res == FR_OK )
+		res = KV_IndexSet( kv, key, kv->Page.Seq % kv->Pages );
+	if ( res == FR_OK && commit )
+		res = KV_Commit( kv );
+	return res;
+}
+
+/**
+ * @brief  Delete the key
+ * @param  kv: Store object
+ * @param  key: Key
+ * @param  commit: Nonzero to make the deletion durable before return
+ * @retval FatFs result, FR_NO_FILE if there is no such key
+ */
+FRESULT KV_Delete( KV_Store* kv, uint16_t key, uint8_t commit )
+{
+	FRESULT res;
+
+	if ( key == KV_NO_KEY || *KV_Entry( kv, KV_Lookup( kv, key ) ) == KV_EMPTY )
+		return FR_NO_FILE;
+	res = KV_Room( kv, KV_RecSize( 0 ) );
+	if ( res == FR_OK )
+		res = KV_Append( kv, key, KV_REC_DELETED, &key, 0, 1 );
+	if ( res == FR_OK )
+	{
+		KV_IndexDelete( kv, key );
+		if ( commit )
+			res = KV_Commit( kv );
+	}
+	return res;
+}
+
+/**
+ * @brief  Make set values durable: the open page is written and the disk is synced,
+ *         directory entry and FAT are not updated
+ * @param  kv: Store object
+ * @retval FatFs result
+ */
+FRESULT KV_Commit( KV_Store* kv )
+{
+	return KV_Flush( kv, 0 );
+}
+
+/**
+ * @brief  Compact tail pages ahead of time while less than half of the ring is free,
+ *         so KV_Set rarely has to (call it when the owner task is idle)
+ * @param  kv: Store object
+ * @param  pages: Most pages to compact
+ * @retval FatFs result
+ */
+FRESULT KV_Compact( KV_Store* kv, uint32_t pages )
+{
+	FRESULT res = FR_OK;
+	uint32_t n;
+
+	for ( n = 0; n < pages && res == FR_OK && kv->Tail != kv->Page.Seq && KV_FreePages( kv ) < kv->Pages / 2 &&
+			KV_FreePages( kv ) >= 1; ++n )
+		res = KV_CompactPage( kv );
+	if ( res == FR_OK && n != 0 )
+		res = KV_Flush( kv, 1 );
+	return res;
+}
+
+/**
+ * @brief  Commit set values and close the store
+ * @param  kv: Store object
+ * @retval FatFs result
+ */
+FRESULT KV_Close( KV_Store* kv )
+{
+	FRESULT res;
+
+	res = KV_Commit( kv );
+	if ( res == FR_OK )
+		res = f_close( &kv->File );
+	else
+		f_close( &kv->File );
+	KV_Free( kv );
+	return res;
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#endif /* USE_FAT_KV */
@@ -0,0 +1,152 @@
+/**
+ ******************************************************************************
+ * @file    ffkv.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Log-structured key-value store in a preallocated FatFs file.
+ *          Small values (settings, counters) are appended as records to
+ *          sector-sized pages, and the pages go around the file as a ring,
+ *          so an update is a sequential append instead of rewriting a data
+ *          sector and a directory entry. The page being filled is written
+ *          alternately into its own slot and into the following one, as the
+ *          frames of fflog.h, so a commit never destroys committed records.
+ *          A hash index in pool blocks maps each key to the page holding its
+ *          latest value; it is rebuilt by KV_Open from the pages. The oldest
+ *          pages are compacted (live records moved to the head) by KV_Set
+ *          when the ring runs out of free pages, and ahead of time by
+ *          KV_Compact called when the owner task is idle.
+ *
+ *          Record in a page (all fields are little endian):
+ *            0: key (16 bits, 0xFFFF is not a key)
+ *            2: value length, KV_VALUE_MAX at most
+ *            3: flags (KV_REC_*)
+ *            4: value, padded to a multiple of 4 bytes
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef FFKV_H
+#define FFKV_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "ff.h"
+
+#include <stdint.h>
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Constants
+ * @{
+ */
+
+/**
+ * @brief  Page size (one sector) and its payload size
+ */
+#define KV_PAGE_SIZE			512
+#define KV_PAGE_DATA			( KV_PAGE_SIZE - 24 )
+
+/**
+ * @brief  Maximum length of a value
+ */
+#define KV_VALUE_MAX			252
+
+/**
+ * @brief  Maximum number of pool blocks of the index (128 keys per block, 7/8 of them usable)
+ */
+#define KV_INDEX_BLOCKS			8
+
+/**
+ * @}
+ *//* STM32_Exported_Constants */
+
+/** @defgroup STM32_Exported_Types
+ * @{
+ */
+
+/**
+ * @brief  Page, occupies one sector of the store file: page Seq lives in slot Seq % Pages
+ */
+typedef struct
+{
+	uint32_t	Magic;					/*!< KV_PAGE_MAGIC */
+	uint32_t	Seq;					/*!< Page number from the creation of the store */
+	uint32_t	Tail;					/*!< Seq of the oldest live page when this one was written */
+	uint16_t	Ver;					/*!< Version of the page, incremented on each rewrite */
+	uint16_t	Len;					/*!< Number of used payload bytes */
+	uint32_t	Reserved;
+	uint8_t		Data[ KV_PAGE_DATA ];	/*!< Records */
+	uint32_t	Crc;					/*!< CRC32 of all preceding words */
+} KV_Page;
+
+/**
+ * @brief  Key-value store object, owned by one task
+ */
+typedef struct
+{
+	FIL			File;			/*!< FatFs file object */
+	uint32_t	Pages;			/*!< Number of page slots */
+	uint32_t	Tail;			/*!< Oldest live page */
+	uint32_t	SyncedTail;		/*!< Tail stored on the card: slots up to it are free */
+	uint32_t	WrittenTail;	/*!< Tail of the last written page, stored on the card by the next sync */
+	uint32_t	Keys;			/*!< Number of keys */
+	uint32_t	Entries;		/*!< Number of index entries */
+	uint32_t*	Index[ KV_INDEX_BLOCKS ];	/*!< Hash index: key << 16 | slot of its page (pool blocks) */
+	KV_Page*	Read;			/*!< Buffer of pages read from the card (pool block) */
+	uint32_t	Compacted;		/*!< Number of pages compacted since KV_Open */
+	uint32_t	Lost;			/*!< Number of damaged pages skipped by KV_Open */
+	uint8_t		Shadow;			/*!< Slot with the latest copy of the open page: 0:none, 1:own, 2:following */
+	uint8_t		Dirty;			/*!< Open page has records which are not written yet */
+	KV_Page		Page;			/*!< Open page (the head of the ring) */
+} KV_Store;
+
+/**
+ * @}
+ *//* STM32_Exported_Types */
+
+/** @defgroup STM32_Exported_Macros
+ * @{
+ */
+
+/**
+ * @brief  Number of page slots free for appends (the open page and its next slot are in use)
+ */
+#define KV_FreePages( kv )		( (kv)->Pages - ( (kv)->Page.Seq - (kv)->SyncedTail ) - 2 )
+
+/**
+ * @}
+ *//* STM32_Exported_Macros */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+FRESULT KV_Open( KV_Store* kv, const TCHAR* path, uint32_t size, uint8_t index_blocks );
+FRESULT KV_Get( KV_Store* kv, uint16_t key, void* buf, uint16_t size, uint16_t* len );
+FRESULT KV_Set( KV_Store* kv, uint16_t key, const void* data, uint16_t len, uint8_t commit );
+FRESULT KV_Delete( KV_Store* kv, uint16_t key, uint8_t commit );
+FRESULT KV_Commit( KV_Store* kv );
+FRESULT KV_Compact( KV_Store* kv, uint32_t pages );
+FRESULT KV_Close( KV_Store* kv );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FFKV_H */
@@ -0,0 +1,473 @@
+/**
+ ******************************************************************************
+ * @file    fflog.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Journaled append-only log file on top of FatFs.
+ *          Frame N of the log lives in sector N of the file ("own" slot).
+ *          While frame N is being filled, each rewrite goes to the slot
+ *          which does not hold its latest copy: own slot N or slot N + 1
+ *          ("shadow"), so the previous copy survives a torn write. When
+ *          the frame is full, its latest copy is placed into the own slot
+ *          and frame N + 1 reuses slot N + 1.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#ifdef USE_FAT_LOG
+
+#include "fflog.h"
+#include "stm32_chksum.h"
+
+#include <string.h>
+
+#if !_USE_EXPAND || _FS_MINIMIZE > 2 || _FS_READONLY
+#error USE_FAT_LOG needs f_expand, f_lseek and writing functions of FatFs (see ffconf.h)
+#endif
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  Marker of log frames ("FLOG")
+ */
+#define LOG_FRAME_MAGIC			0x474F4C46
+
+/**
+ * @brief  Slots holding the latest copy of the open frame (LOG_File.Shadow)
+ */
+#define LOG_SLOT_NONE			0
+#define LOG_SLOT_OWN			1
+#define LOG_SLOT_SHADOW			2
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Calculates CRC32 of the frame (all words before Crc field) by the CRC unit
+ * @param  frame: Frame
+ * @retval CRC32
+ */
+static uint32_t LOG_FrameCrc( const LOG_Frame* frame )
+{
+	return CHK_Crc32( frame, LOG_FRAME_SIZE - 4 );
+}
+
+/**
+ * @brief  Check if the frame is an intact frame of the log
+ * @param  log: Log file object (Gen is checked)
+ * @param  frame: Frame
+ * @param  seq: Expected frame number
+ * @retval Nonzero if frame is valid
+ */
+static uint8_t LOG_FrameValid( const LOG_File* log, const LOG_Frame* frame, uint32_t seq )
+{
+	return ( frame->Magic == LOG_FRAME_MAGIC && frame->Gen == log->Gen && frame->Seq == seq &&
+			frame->Len <= LOG_FRAME_DATA && frame->Crc == LOG_FrameCrc( frame ) );
+}
+
+/**
+ * @brief  Read sector of the log file
+ * @param  log: Log file object
+ * @param  slot: Sector number in the file
+ * @param  frame: Buffer for the frame
+ * @retval FatFs result
+ */
+static FRESULT LOG_ReadSlot( LOG_File* log, uint32_t slot, LOG_Frame* frame )
+{
+	FRESULT res;
+	UINT br;
+
+	res = f_lseek( &log->File, slot * LOG_FRAME_SIZE );
+	if ( res == FR_OK )
+		res = f_read( &log->File, frame, LOG_FRAME_SIZE, &br );
+	if ( res == FR_OK && br != LOG_FRAME_SIZE )
+		res = FR_INT_ERR;
+	return res;
+}
+
+/**
+ * @brief  Write open frame into sector of the log file (aligned whole sector goes
+ *         directly to the disk, FAT and directory entry are not touched)
+ * @param  log: Log file object
+ * @param  slot: Sector number in the file
+ * @retval FatFs result
+ */
+static FRESULT LOG_WriteSlot( LOG_File* log, uint32_t slot )
+{
+	FRESULT res;
+	UINT bw;
+
+	res = f_lseek( &log->File, slot * LOG_FRAME_SIZE );
+	if ( res == FR_OK )
+		res = f_write( &log->File, &log->Frame, LOG_FRAME_SIZE, &bw );
+	if ( res == FR_OK && bw != LOG_FRAME_SIZE )
+		res = FR_INT_ERR;
+	return res;
+}
+
+/**
+ * @brief  Write new version of the open frame into the slot not holding its latest copy
+ * @param  log: Log file object
+ * @retval FatFs result
+ */
+static FRESULT LOG_WriteFrame( LOG_File* log )
+{
+	FRESULT res;
+	uint32_t slot;
+
+	if ( log->Shadow != LOG_SLOT_NONE )
+		log->Frame.Ver++;
+	log->Frame.Magic = LOG_FRAME_MAGIC;
+	log->Frame.Gen = log->Gen;
+	log->Frame.Crc = LOG_FrameCrc( &log->Frame );
+
+	slot = log->Frame.Seq + ( ( log->Shadow == LOG_SLOT_OWN ) ? 1 : 0 );
+	res = LOG_WriteSlot( log, slot );
+	if ( res == FR_OK )
+	{
+		log->Shadow = ( slot == log->Frame.Seq ) ? LOG_SLOT_OWN : LOG_SLOT_SHADOW;
+		log->Dirty = 0;
+	}
+	return res;
+}
+
+/**
+ * @brief  Finish the open frame (its latest copy is placed into own slot) and start the next one
+ * @param  log: Log file object
+ * @retval FatFs result, FR_DENIED if the log is full
+ */
+static FRESULT LOG_NextFrame( LOG_File* log )
+{
+	FRESULT res = FR_OK;
+
+	/* next frame needs its own slot and a shadow one */
+	if ( log->Frame.Seq + 2 >= log->Frames )
+		return FR_DENIED;
+
+	if ( log->Dirty )
+		res = LOG_WriteFrame( log );
+	if ( res == FR_OK && log->Shadow == LOG_SLOT_SHADOW )
+	{	/* shadow slot becomes own slot of the next frame: own copy has to be on the card first */
+		res = LOG_WriteSlot( log, log->Frame.Seq );
+		if ( res == FR_OK )
+			res = f_datasync( &log->File );
+	}
+	if ( res == FR_OK )
+	{
+		log->Frame.Seq++;
+		log->Frame.Ver = 0;
+		log->Frame.Len = 0;
+		log->Shadow = LOG_SLOT_NONE;
+	}
+	return res;
+}
+
+/**
+ * @brief  Find the end of the log: the last frame which has an intact copy
+ * @param  log: Log file object, Gen is known
+ * @retval FatFs result
+ */
+static FRESULT LOG_Recover( LOG_File* log )
+{
+	FRESULT res;
+	uint32_t lo, hi, mid;
+	uint16_t ver = 0;
+	uint8_t shadow = 0;
+
+	/* finished frames are intact in own slots: find the first slot which is not */
+	lo = 0;
+	hi = log->Frames - 1;
+	while ( hi - lo > 1 )
+	{
+		mid = lo + ( hi - lo ) / 2;
+		res = LOG_ReadSlot( log, mid, &log->Frame );
+		if ( res != FR_OK )
+			return res;
+		if ( LOG_FrameValid( log, &log->Frame, mid ) )
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	/* open frame is hi (its own slot got torn, copy is in the shadow one) or hi - 1 */
+	if ( hi + 1 < log->Frames )
+	{
+		res = LOG_ReadSlot( log, hi + 1, &log->Frame );
+		if ( res != FR_OK )
+			return res;
+		if ( LOG_FrameValid( log, &log->Frame, hi ) )
+		{
+			log->Shadow = LOG_SLOT_SHADOW;
+			return FR_OK;
+		}
+	}
+	res = LOG_ReadSlot( log, hi, &log->Frame );
+	if ( res != FR_OK )
+		return res;
+	if ( LOG_FrameValid( log, &log->Frame, hi - 1 ) )
+	{
+		shadow = 1;
+		ver = log->Frame.Ver;
+	}
+	res = LOG_ReadSlot( log, hi - 1, &log->Frame );
+	if ( res != FR_OK )
+		return res;
+	if ( LOG_FrameValid( log, &log->Frame, hi - 1 ) &&
+			( !shadow || (int16_t)( ver - log->Frame.Ver ) <= 0 ) )
+	{
+		log->Shadow = LOG_SLOT_OWN;
+		return FR_OK;
+	}
+	if ( !shadow )
+		return FR_INT_ERR;
+	log->Shadow = LOG_SLOT_SHADOW;
+	return LOG_ReadSlot( log, hi, &log->Frame );
+}
+
+/**
+ * @brief  Create the log in the empty file: preallocate contiguous block and write the first frame
+ * @param  log: Log file object, file is open
+ * @param  size: Size of the log in bytes
+ * @retval FatFs result
+ */
+static FRESULT LOG_Create( LOG_File* log, uint32_t size )
+{
+	FRESULT res;
+
+	res = f_expand( &log->File, size, 1 );
+	if ( res == FR_OK )
+		res = f_lseek( &log->File, size );
+	if ( res == FR_OK && log->File.fsize != size )
+		res = FR_DENIED;
+	if ( res != FR_OK )
+		return res;
+
+	/* new generation differs from the one of stale frames in the block */
+	res = LOG_ReadSlot( log, 0, &log->Frame );
+	if ( res != FR_OK )
+		return res;
+	if ( log->Frame.Magic == LOG_FRAME_MAGIC )
+		log->Gen = log->Frame.Gen + 1;
+	else
+		log->Gen = get_msec() ^ log->File.sclust;
+
+	/* empty frame 0 goes to own and shadow slots, stale copies of frame 0 are overwritten */
+	memset( &log->Frame, 0, sizeof( log->Frame ) );
+	log->Shadow = LOG_SLOT_NONE;
+	res = LOG_WriteFrame( log );
+	if ( res == FR_OK )
+		res = LOG_WriteSlot( log, 1 );
+	if ( res == FR_OK )
+		res = f_datasync( &log->File );
+	return res;
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Open the log file, create it if it doesn't exist. Existing log keeps its size,
+ *         the end of the log is found by scanning its frames.
+ * @param  log: Log file object
+ * @param  path: File name
+ * @param  size: Size of the new log in bytes (rounded down to LOG_FRAME_SIZE, at least 3 frames),
+ *         ignored if the log exists
+ * @retval FatFs result:
+ *         - FR_DENIED: No contiguous block for the new log or the file is not a log
+ *         - FR_INT_ERR: Log is damaged
+ */
+FRESULT LOG_Open( LOG_File* log, const TCHAR* path, uint32_t size )
+{
+	FRESULT res;
+
+	memset( log, 0, sizeof( *log ) );
+	size -= size % LOG_FRAME_SIZE;
+
+	res = f_open( &log->File, path, FA_READ | FA_WRITE | FA_OPEN_ALWAYS );
+	if ( res != FR_OK )
+		return res;
+	if ( log->File.fsize == 0 )
+	{	/* directory entry gets the final size once, after frame 0 is written */
+		res = ( size < 3 * LOG_FRAME_SIZE ) ? FR_INVALID_PARAMETER : LOG_Create( log, size );
+		if ( res == FR_OK )
+			res = f_close( &log->File );
+		else
+			f_close( &log->File );
+		if ( res == FR_OK )
+			res = f_open( &log->File, path, FA_READ | FA_WRITE | FA_OPEN_EXISTING );
+		if ( res != FR_OK )
+			return res;
+	}
+	log->Frames = log->File.fsize / LOG_FRAME_SIZE;
+	if ( log->Frames < 3 )
+		res = FR_DENIED;
+
+	/* generation is taken from frame 0 (own slot or its shadow) */
+	if ( res == FR_OK )
+		res = LOG_ReadSlot( log, 0, &log->Frame );
+	if ( res == FR_OK )
+	{
+		log->Gen = log->Frame.Gen;
+		if ( !LOG_FrameValid( log, &log->Frame, 0 ) )
+		{
+			res = LOG_ReadSlot( log, 1, &log->Frame );
+			log->Gen = log->Frame.Gen;
+			if ( res == FR_OK && !LOG_FrameValid( log, &log->Frame, 0 ) )
+				res = FR_DENIED;
+		}
+	}
+	if ( res == FR_OK )
+		res = LOG_Recover( log );
+	if ( res != FR_OK )
+		f_close( &log->File );
+	return res;
+}
+
+/**
+ * @brief  Append record to the log
+ * @param  log: Log file object
+ * @param  data: Record
+ * @param  len: Record length (up to LOG_RECORD_MAX bytes)
+ * @param  commit: Nonzero to make the record durable before return (see LOG_Commit)
+ * @retval FatFs result, FR_DENIED if the log is full
+ */
+FRESULT LOG_Append( LOG_File* log, const void* data, uint16_t len, uint8_t commit )
+{
+	FRESULT res;
+	uint8_t* p;
+
+	if ( len > LOG_RECORD_MAX )
+		return FR_INVALID_PARAMETER;
+	if ( log->Frame.Len + 2 + len > LOG_FRAME_DATA )
+	{
+		res = LOG_NextFrame( log );
+		if ( res != FR_OK )
+			return res;
+	}
+
+	p = log->Frame.Data + log->Frame.Len;
+	p[ 0 ] = (uint8_t)len;
+	p[ 1 ] = (uint8_t)( len >> 8 );
+	memcpy( p + 2, data, len );
+	log->Frame.Len += 2 + len;
+	log->Dirty = 1;
+
+	return commit ? LOG_Commit( log ) : FR_OK;
+}
+
+/**
+ * @brief  Make appended records durable: the open frame is written and the disk is synced,
+ *         directory entry and FAT are not updated
+ * @param  log: Log file object
+ * @retval FatFs result
+ */
+FRESULT LOG_Commit( LOG_File* log )
+{
+	FRESULT res;
+
+	if ( !log->Dirty )
+		return FR_OK;
+	res = LOG_WriteFrame( log );
+	if ( res == FR_OK )
+		res = f_datasync( &log->File );
+	return res;
+}
+
+/**
+ * @brief  Commit appended records and close the log file
+ * @param  log: Log file object
+ * @retval FatFs result
+ */
+FRESULT LOG_Close( LOG_File* log )
+{
+	FRESULT res;
+
+	res = LOG_Commit( log );
+	if ( res == FR_OK )
+		res = f_close( &log->File );
+	return res;
+}
+
+/**
+ * @brief  Read the next record of the log
+ * @param  log: Log file object
+ * @param  rd: Reader (zeroed to start from the first record)
+ * @param  buf: Buffer for the record
+ * @param  size: Buffer size, longer record is truncated
+ * @param  len: Length of the read record, 0 at the end of the log
+ * @retval FatFs result, FR_INT_ERR if a finished frame is damaged
+ */
+FRESULT LOG_Read( LOG_File* log, LOG_Reader* rd, void* buf, uint16_t size, uint16_t* len )
+{
+	FRESULT res;
+	const LOG_Frame* frame;
+	uint16_t n;
+
+	*len = 0;
+	for ( ;; )
+	{
+		if ( rd->Seq > log->Frame.Seq )
+			return FR_OK;
+		if ( rd->Seq == log->Frame.Seq )
+			frame = &log->Frame;
+		else
+		{
+			if ( !rd->Loaded )
+			{
+				res = LOG_ReadSlot( log, rd->Seq, &rd->Frame );
+				if ( res != FR_OK )
+					return res;
+				if ( !LOG_FrameValid( log, &rd->Frame, rd->Seq ) )
+					return FR_INT_ERR;
+				rd->Loaded = 1;
+			}
+			frame = &rd->Frame;
+		}
+		if ( rd->Offset + 2 <= frame->Len )
+			break;
+		if ( rd->Seq == log->Frame.Seq )
+			return FR_OK;
+		rd->Seq++;
+		rd->Offset = 0;
+		rd->Loaded = 0;
+	}
+
+	n = frame->Data[ rd->Offset ] | ( frame->Data[ rd->Offset + 1 ] << 8 );
+	if ( rd->Offset + 2 + n > frame->Len )
+		return FR_INT_ERR;
+	*len = ( n < size ) ? n : size;
+	memcpy( buf, frame->Data + rd->Offset + 2, *len );
+	rd->Offset += 2 + n;
+	return FR_OK;
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#endif /* USE_FAT_LOG */
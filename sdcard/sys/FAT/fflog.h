@@ -0,0 +1,124 @@
+/**
+ ******************************************************************************
+ * @file    fflog.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Journaled append-only log file on top of FatFs.
+ *          Log file is preallocated as one contiguous block, so appending
+ *          never touches FAT or directory entry. Records are packed into
+ *          self-describing sector-sized frames (generation, sequence number,
+ *          CRC), the frame being filled is written alternately into its own
+ *          sector and into the following one, so power loss while it is
+ *          rewritten never destroys committed records. LOG_Open finds the
+ *          true end of the log by binary search over the frames.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef FFLOG_H
+#define FFLOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "ff.h"
+
+#include <stdint.h>
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Constants
+ * @{
+ */
+
+/**
+ * @brief  Frame size (one sector) and its payload size
+ */
+#define LOG_FRAME_SIZE			512
+#define LOG_FRAME_DATA			( LOG_FRAME_SIZE - 20 )
+
+/**
+ * @brief  Maximum length of one record (2 bytes of the frame store its length)
+ */
+#define LOG_RECORD_MAX			( LOG_FRAME_DATA - 2 )
+
+/**
+ * @}
+ *//* STM32_Exported_Constants */
+
+/** @defgroup STM32_Exported_Types
+ * @{
+ */
+
+/**
+ * @brief  Log frame, occupies one sector of the log file
+ */
+typedef struct
+{
+	uint32_t	Magic;					/*!< LOG_FRAME_MAGIC */
+	uint32_t	Gen;					/*!< Generation of the log, frames of older logs in the same clusters are ignored */
+	uint32_t	Seq;					/*!< Frame number from the beginning of the log */
+	uint16_t	Ver;					/*!< Version of the frame, incremented on each rewrite */
+	uint16_t	Len;					/*!< Number of used payload bytes */
+	uint8_t		Data[ LOG_FRAME_DATA ];	/*!< Records: 2 bytes of length (LSB first) followed by the data */
+	uint32_t	Crc;					/*!< CRC32 of all preceding words */
+} LOG_Frame;
+
+/**
+ * @brief  Log file object
+ */
+typedef struct
+{
+	FIL			File;			/*!< FatFs file object */
+	uint32_t	Frames;			/*!< Capacity in frames (the last sector is shadow of the last frame) */
+	uint32_t	Gen;			/*!< Generation of the log */
+	uint8_t		Shadow;			/*!< Slot with the latest copy of the open frame: 0:none, 1:own, 2:following */
+	uint8_t		Dirty;			/*!< Open frame has records which are not written yet */
+	LOG_Frame	Frame;			/*!< Open frame (the last one of the log) */
+} LOG_File;
+
+/**
+ * @brief  Record reader (see LOG_Read), zero it to read from the beginning of the log
+ */
+typedef struct
+{
+	uint32_t	Seq;			/*!< Frame number */
+	uint16_t	Offset;			/*!< Offset of the next record in the frame payload */
+	uint8_t		Loaded;			/*!< Frame is loaded to the buffer */
+	LOG_Frame	Frame;			/*!< Frame buffer (the open frame is read from the log object) */
+} LOG_Reader;
+
+/**
+ * @}
+ *//* STM32_Exported_Types */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+FRESULT LOG_Open( LOG_File* log, const TCHAR* path, uint32_t size );
+FRESULT LOG_Append( LOG_File* log, const void* data, uint16_t len, uint8_t commit );
+FRESULT LOG_Commit( LOG_File* log );
+FRESULT LOG_Close( LOG_File* log );
+FRESULT LOG_Read( LOG_File* log, LOG_Reader* rd, void* buf, uint16_t size, uint16_t* len );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FFLOG_H */
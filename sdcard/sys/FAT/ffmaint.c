@@ -0,0 +1,147 @@
+/**
+ ******************************************************************************
+ * @file    ffmaint.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Background maintenance of mounted FatFs volumes (see ffmaint.h).
+ *          Each FatFs call holds the volume lock only for a short step:
+ *          f_maintain looks at a few FAT sectors and passes free runs to
+ *          SD_IO_Discard, which returns at once. Only the first free cluster
+ *          count after mount reads the whole FAT.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#ifdef USE_FAT_MAINTENANCE
+
+#include "ffmaint.h"
+#include "ff.h"
+
+#include "stm32_sd_io.h"
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#if !_USE_MAINTAIN || !_USE_ERASE || _FS_READONLY
+#error USE_FAT_MAINTENANCE needs f_maintain, f_getfree and _USE_ERASE of FatFs (see ffconf.h)
+#endif
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  Maintenance task: the lowest priority, any other task preempts it
+ */
+#define FMAINT_TASK_PRIO		( tskIDLE_PRIORITY )
+#define FMAINT_TASK_STACK		( configMINIMAL_STACK_SIZE * 2 )
+
+/**
+ * @brief  The volumes are looked at this often, if SD I/O task has had no request
+ *         for FMAINT_IDLE_TICKS
+ */
+#define FMAINT_PERIOD_TICKS		((portTickType)( 1000 / portTICK_RATE_MS ))
+#define FMAINT_IDLE_TICKS		((portTickType)( 500 / portTICK_RATE_MS ))
+
+/**
+ * @brief  Number of erase blocks (AUs of SD Card) kept erased after the allocation point
+ */
+#define FMAINT_ERASE_AHEAD		2
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Variables
+ * @{
+ */
+
+static volatile uint32_t FMAINT_Runs_;		/* number of volume maintenance runs done */
+static xStaticTask FMAINT_TaskBuffer;
+static portSTACK_TYPE FMAINT_TaskStack[ FMAINT_TASK_STACK ];
+
+/**
+ * @}
+ *//* STM32_Private_Variables */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Maintenance task
+ * @param  pvParameters not used
+ * @retval None
+ */
+static void FMAINT_Task( void* pvParameters )
+{
+	TCHAR path[ 3 ] = { '0', ':', 0 };
+	FATFS* fs;
+	DWORD n;
+	BYTE vol;
+
+	(void)pvParameters;
+	for ( ;; )
+	{
+		vTaskDelay( FMAINT_PERIOD_TICKS );
+		for ( vol = 0; vol < _VOLUMES; ++vol )
+		{
+			if ( SD_IO_IdleTime() < FMAINT_IDLE_TICKS )
+				break;		/* the application uses the card */
+			path[ 0 ] = '0' + vol;
+			if ( f_getfree( path, &n, &fs ) != FR_OK )
+				continue;	/* no volume registered or no card */
+			if ( f_maintain( path, FMAINT_ERASE_AHEAD ) == FR_OK )
+				FMAINT_Runs_++;
+		}
+	}
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Creates the maintenance task, has to be called before scheduler is started
+ * @param  None
+ * @retval None
+ */
+void FMAINT_Init( void )
+{
+	xTaskCreateStatic( FMAINT_Task, (const signed char* const)"MNT", FMAINT_TASK_STACK, NULL, FMAINT_TASK_PRIO, NULL, FMAINT_TaskStack, &FMAINT_TaskBuffer );
+}
+
+/**
+ * @brief  Number of volume maintenance runs done so far (for statistics)
+ * @param  None
+ * @retval Number of runs
+ */
+uint32_t FMAINT_Runs( void )
+{
+	return FMAINT_Runs_;
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#endif /* USE_FAT_MAINTENANCE */
@@ -0,0 +1,58 @@
+/**
+ ******************************************************************************
+ * @file    ffmaint.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Background maintenance of mounted FatFs volumes. A task of the
+ *          lowest priority waits until SD I/O task has had no request for
+ *          a while (the logger is idle), then for each registered volume:
+ *          - counts free clusters once after mount (f_getfree), which also
+ *            rebuilds the free cluster map and makes FSInfo valid,
+ *          - keeps free clusters of the next erase blocks after the
+ *            allocation point erased (f_maintain), the erase itself is done
+ *            by SD I/O task chunk by chunk between foreground requests,
+ *          - writes outdated FSInfo (f_maintain).
+ *          So the foreground writes go to erased flash at a steady speed.
+ *          The maintenance doesn't mount volumes registered by f_mount
+ *          itself: FatFs mounts them on first access as usual.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef FFMAINT_H
+#define FFMAINT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include <stdint.h>
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+void FMAINT_Init( void );
+uint32_t FMAINT_Runs( void );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FFMAINT_H */
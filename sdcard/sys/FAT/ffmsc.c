@@ -0,0 +1,880 @@
+/**
+ ******************************************************************************
+ * @file    ffmsc.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   USB mass storage export of the SD Card (see ffmsc.h).
+ *          The callbacks of the USB driver (interrupt context) only open the
+ *          bulk endpoints and pass events to the MSC task, which runs the
+ *          Bulk-Only Transport: it receives a command block (CBW), moves the
+ *          data of the command and sends the status (CSW), a command which
+ *          moves less data than the host expects halts the pipe of the data
+ *          (the residue is reported after the host clears it), an invalid
+ *          command block halts both pipes until the class reset.
+ *          The sectors of SCSI commands are card blocks: the card is passed
+ *          as it is, partition table and all volumes on it.
+ *          Card removal and insertion are reported by sense codes (MEDIUM
+ *          NOT PRESENT, NOT READY TO READY CHANGE), the claim of SD I/O is
+ *          taken again for the new card.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#ifdef USE_USB_MSC
+
+#include "ffmsc.h"
+#include "ff.h"
+
+#include "stm32_usb.h"
+#include "stm32_sd_io.h"
+#include "stm32_mem.h"
+#include "stm32_irq.h"
+
+#include <string.h>
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#if _MAX_SS != 512
+#error USE_USB_MSC passes card blocks, sectors of FatFs have to be 512 bytes (see ffconf.h)
+#endif
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  MSC task
+ */
+#define FMSC_TASK_PRIO			( tskIDLE_PRIORITY + 2 )
+#define FMSC_TASK_STACK			( configMINIMAL_STACK_SIZE * 2 )
+
+/**
+ * @brief  Bulk endpoints (full speed packets)
+ */
+#define FMSC_EP_IN				( USB_DIR_IN | 1 )
+#define FMSC_EP_OUT				1
+#define FMSC_PACKET				64
+
+/**
+ * @brief  Class requests
+ */
+#define FMSC_GET_MAX_LUN		0xFE
+#define FMSC_BOT_RESET			0xFF
+
+/**
+ * @brief  Command and status wrappers
+ */
+#define FMSC_CBW_SIGNATURE		0x43425355
+#define FMSC_CBW_LENGTH			31
+#define FMSC_CSW_SIGNATURE		0x53425355
+#define FMSC_CSW_LENGTH			13
+
+/**
+ * @brief  Events passed from the interrupt handler to the task
+ */
+#define FMSC_EVT_RESET			0x01	/* bus reset or configuration 0 */
+#define FMSC_EVT_CONFIGURED		0x02	/* configuration 1 set, endpoints opened */
+#define FMSC_EVT_BOT_RESET		0x04	/* class reset */
+#define FMSC_EVT_IN				0x08	/* IN transfer done */
+#define FMSC_EVT_OUT			0x10	/* OUT transfer done */
+#define FMSC_EVT_CLEARED		0x20	/* halt of a bulk endpoint cleared */
+#define FMSC_EVT_ABORT			( FMSC_EVT_RESET | FMSC_EVT_BOT_RESET )
+
+/**
+ * @brief  Command status of CSW, FMSC_ABORTED sends none (a reset came)
+ */
+#define FMSC_PASSED				0
+#define FMSC_FAILED				1
+#define FMSC_PHASE_ERROR		2
+#define FMSC_ABORTED			0xFF
+
+/**
+ * @brief  SCSI commands
+ */
+#define SCSI_TEST_UNIT_READY	0x00
+#define SCSI_REQUEST_SENSE		0x03
+#define SCSI_INQUIRY			0x12
+#define SCSI_MODE_SENSE6		0x1A
+#define SCSI_START_STOP_UNIT	0x1B
+#define SCSI_PREVENT_ALLOW		0x1E
+#define SCSI_READ_FORMAT_CAPS	0x23
+#define SCSI_READ_CAPACITY10	0x25
+#define SCSI_READ10				0x28
+#define SCSI_WRITE10			0x2A
+#define SCSI_VERIFY10			0x2F
+#define SCSI_SYNC_CACHE10		0x35
+#define SCSI_MODE_SENSE10		0x5A
+
+/**
+ * @brief  Sense keys and additional sense codes
+ */
+#define SENSE_NOT_READY			0x02
+#define SENSE_MEDIUM_ERROR		0x03
+#define SENSE_ILLEGAL_REQUEST	0x05
+#define SENSE_UNIT_ATTENTION	0x06
+
+#define ASC_NOT_READY			0x04	/* logical unit not ready (another raw user has sectors of the card) */
+#define ASC_WRITE_ERROR			0x0C
+#define ASC_READ_ERROR			0x11
+#define ASC_INVALID_COMMAND		0x20
+#define ASC_OUT_OF_RANGE		0x21
+#define ASC_INVALID_FIELD		0x24
+#define ASC_MEDIUM_CHANGED		0x28
+#define ASC_NO_MEDIUM			0x3A
+
+/**
+ * @brief  Length of the string descriptor of n characters
+ */
+#define FMSC_STRING( n )		( 2 + 2 * ( n ) )
+
+/**
+ * @brief  Unique device ID of STM32F2 (96 bits), the serial number of the device
+ */
+#define FMSC_UID				((const uint8_t*)0x1FFF7A10)
+#define FMSC_UID_BYTES			12
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Variables
+ * @{
+ */
+
+static const uint8_t FMSC_DeviceDesc[ 18 ] =
+{
+	18, USB_DESC_DEVICE, 0x00, 0x02,		/* USB 2.0 */
+	0x00, 0x00, 0x00, USB_EP0_SIZE,			/* class is set by the interface */
+	FMSC_VID & 0xFF, FMSC_VID >> 8, FMSC_PID & 0xFF, FMSC_PID >> 8,
+	0x00, 0x01, 1, 2, 3, 1					/* release 1.0, strings, one configuration */
+};
+
+static const uint8_t FMSC_ConfigDesc[ 32 ] =
+{
+	9, USB_DESC_CONFIG, 32, 0, 1, 1, 0, 0xC0, 50,				/* self powered, 100 mA */
+	9, USB_DESC_INTERFACE, 0, 0, 2, 0x08, 0x06, 0x50, 0,		/* mass storage, SCSI, Bulk-Only */
+	7, USB_DESC_ENDPOINT, FMSC_EP_IN, USB_EP_BULK, FMSC_PACKET, 0, 0,
+	7, USB_DESC_ENDPOINT, FMSC_EP_OUT, USB_EP_BULK, FMSC_PACKET, 0, 0
+};
+
+static const uint8_t FMSC_LangDesc[ 4 ] = { 4, USB_DESC_STRING, 0x09, 0x04 };	/* English (US) */
+static const uint8_t FMSC_VendorDesc[ FMSC_STRING( 5 ) ] =
+	{ FMSC_STRING( 5 ), USB_DESC_STRING, 'S', 0, 'T', 0, 'M', 0, '3', 0, '2', 0 };
+static const uint8_t FMSC_ProductDesc[ FMSC_STRING( 7 ) ] =
+	{ FMSC_STRING( 7 ), USB_DESC_STRING, 'S', 0, 'D', 0, ' ', 0, 'C', 0, 'a', 0, 'r', 0, 'd', 0 };
+static uint8_t FMSC_SerialDesc[ FMSC_STRING( 2 * FMSC_UID_BYTES ) ];	/* hex digits of the unique ID */
+static const uint8_t* const FMSC_Strings[ 4 ] = { FMSC_LangDesc, FMSC_VendorDesc, FMSC_ProductDesc, FMSC_SerialDesc };
+
+static const uint8_t FMSC_Inquiry[ 36 ] =		/* direct access, removable, SPC-2 */
+	"\x00\x80\x02\x02\x1F\x00\x00\x00" FMSC_VENDOR FMSC_PRODUCT FMSC_REVISION;
+
+static const uint8_t FMSC_MaxLun = 0;
+
+static uint8_t FMSC_Buf[ 2 ][ FMSC_BUFFER_SECTORS * 512 ] MEM_DMA_BUFFER;	/* data of READ(10) and WRITE(10) */
+static uint8_t FMSC_Cbw[ FMSC_PACKET ] __attribute__(( aligned( 4 ) ));		/* received command block */
+static uint8_t FMSC_Csw[ FMSC_CSW_LENGTH ] __attribute__(( aligned( 4 ) ));
+static uint8_t FMSC_Answer[ 18 ] __attribute__(( aligned( 4 ) ));			/* data of the short answers */
+static SD_IO_Request FMSC_Req[ 2 ];			/* card requests of the two buffers */
+static SD_IO_Region FMSC_Region;			/* the whole card, claimed while the host has it */
+
+static uint32_t FMSC_Expect;				/* data length of the command the host expects */
+static uint32_t FMSC_Moved;					/* data bytes of the command moved so far */
+static uint8_t FMSC_DirIn;					/* the host expects data-in */
+static uint8_t FMSC_Sense[ 3 ];				/* sense key, ASC and ASCQ of the last command */
+
+static uint32_t FMSC_Blocks;				/* blocks of the claimed card, 0 if it isn't claimed */
+static uint32_t FMSC_Card;					/* SD_IO_CardChanges() of the claimed card */
+static uint8_t FMSC_Loaded;					/* the host hasn't ejected the medium */
+static uint8_t FMSC_Exported;				/* the volumes are handed over (f_eject) */
+
+static volatile uint32_t FMSC_Events;		/* FMSC_EVT_*, set by the interrupt handler */
+static volatile uint8_t FMSC_Configured;	/* configuration 1 is set */
+static volatile uint8_t FMSC_Suspended;		/* the bus is suspended */
+static volatile uint8_t FMSC_Halted;		/* invalid CBW: bulk endpoints stay halted until the class reset */
+static volatile portTickType FMSC_IdleSince;	/* tick count of the last suspend or reset */
+
+static xTaskHandle FMSC_Handle;
+static xStaticTask FMSC_TaskBuffer;
+static portSTACK_TYPE FMSC_TaskStack[ FMSC_TASK_STACK ];
+
+/**
+ * @}
+ *//* STM32_Private_Variables */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Big and little endian fields of SCSI and BOT
+ */
+static uint32_t FMSC_GetBE32( const uint8_t* p )
+{
+	return ( (uint32_t)p[ 0 ] << 24 ) | ( (uint32_t)p[ 1 ] << 16 ) | ( (uint32_t)p[ 2 ] << 8 ) | p[ 3 ];
+}
+
+static void FMSC_PutBE32( uint8_t* p, uint32_t v )
+{
+	p[ 0 ] = (uint8_t)( v >> 24 );
+	p[ 1 ] = (uint8_t)( v >> 16 );
+	p[ 2 ] = (uint8_t)( v >> 8 );
+	p[ 3 ] = (uint8_t)v;
+}
+
+static uint32_t FMSC_GetLE32( const uint8_t* p )
+{
+	return ( (uint32_t)p[ 3 ] << 24 ) | ( (uint32_t)p[ 2 ] << 16 ) | ( (uint32_t)p[ 1 ] << 8 ) | p[ 0 ];
+}
+
+static void FMSC_PutLE32( uint8_t* p, uint32_t v )
+{
+	p[ 0 ] = (uint8_t)v;
+	p[ 1 ] = (uint8_t)( v >> 8 );
+	p[ 2 ] = (uint8_t)( v >> 16 );
+	p[ 3 ] = (uint8_t)( v >> 24 );
+}
+
+/**
+ * @brief  Passes events to the task (interrupt context)
+ * @param  ev: FMSC_EVT_*
+ * @retval None
+ */
+static void FMSC_Signal( uint32_t ev )
+{
+	FMSC_Events |= ev;
+	IRQ_Notify( FMSC_Handle );
+}
+
+/**
+ * @brief  Bus events of the USB driver: the bulk endpoints are opened once configured
+ * @param  event: Event
+ * @retval None
+ */
+static void FMSC_Event( USB_Event event )
+{
+	switch ( event )
+	{
+	case USB_EVENT_RESET:
+		FMSC_Configured = 0;
+		FMSC_Suspended = 0;
+		FMSC_Halted = 0;
+		FMSC_IdleSince = xTaskGetTickCountFromISR();
+		FMSC_Events = 0;		/* transfers are gone */
+		FMSC_Signal( FMSC_EVT_RESET );
+		break;
+	case USB_EVENT_CONFIGURED:
+		USB_EP_Open( FMSC_EP_IN, USB_EP_BULK, FMSC_PACKET );
+		USB_EP_Open( FMSC_EP_OUT, USB_EP_BULK, FMSC_PACKET );
+		FMSC_Configured = 1;
+		FMSC_Signal( FMSC_EVT_CONFIGURED );
+		break;
+	case USB_EVENT_SUSPEND:
+		FMSC_Suspended = 1;
+		FMSC_IdleSince = xTaskGetTickCountFromISR();
+		IRQ_Notify( FMSC_Handle );
+		break;
+	case USB_EVENT_RESUME:
+		FMSC_Suspended = 0;
+		IRQ_Notify( FMSC_Handle );
+		break;
+	}
+}
+
+/**
+ * @brief  Class requests: GET MAX LUN and Bulk-Only Mass Storage Reset
+ * @param  req: SETUP packet
+ * @param  data: Receives IN data
+ * @retval Length of IN data, -1 stalls the request
+ */
+static int32_t FMSC_Request( const USB_Request* req, const uint8_t** data )
+{
+	if ( ( req->bmRequestType & ( USB_REQ_TYPE | USB_REQ_RECIPIENT ) ) != ( USB_REQ_CLASS | USB_REQ_INTERFACE ) ||
+			req->wIndex != 0 || req->wValue != 0 )
+		return -1;
+	switch ( req->bRequest )
+	{
+	case FMSC_GET_MAX_LUN:
+		if ( !( req->bmRequestType & USB_DIR_IN ) )
+			return -1;
+		*data = &FMSC_MaxLun;
+		return 1;
+	case FMSC_BOT_RESET:
+		if ( ( req->bmRequestType & USB_DIR_IN ) || req->wLength != 0 )
+			return -1;
+		FMSC_Halted = 0;
+		FMSC_Events &= ~( FMSC_EVT_IN | FMSC_EVT_OUT | FMSC_EVT_CLEARED );
+		FMSC_Signal( FMSC_EVT_BOT_RESET );
+		return 0;
+	}
+	return -1;
+}
+
+/**
+ * @brief  End of a transfer of a bulk endpoint
+ * @param  ep: Endpoint address
+ * @retval None
+ */
+static void FMSC_Transferred( uint8_t ep )
+{
+	FMSC_Signal( ( ep & USB_DIR_IN ) ? FMSC_EVT_IN : FMSC_EVT_OUT );
+}
+
+/**
+ * @brief  The host has cleared the halt of a bulk endpoint: after an invalid CBW
+ *         it is halted again, only the class reset brings the pipes back
+ * @param  ep: Endpoint address
+ * @retval None
+ */
+static void FMSC_Cleared( uint8_t ep )
+{
+	if ( FMSC_Halted )
+		USB_EP_Stall( ep );
+	else
+		FMSC_Signal( FMSC_EVT_CLEARED );
+}
+
+static const USB_Class FMSC_Class =
+{
+	FMSC_DeviceDesc, FMSC_ConfigDesc, FMSC_Strings, 4,
+	FMSC_Event, FMSC_Request, FMSC_Transferred, FMSC_Cleared
+};
+
+/**
+ * @brief  Takes events set by the interrupt handler, waits for a notification if there are none
+ * @param  mask: Events to take
+ * @param  timeout: Wait in ticks
+ * @retval Events taken, 0 on timeout or on a notification of other events
+ */
+static uint32_t FMSC_Take( uint32_t mask, portTickType timeout )
+{
+	uint32_t ev;
+	uint8_t wait;
+
+	for ( wait = 1; ; wait = 0 )
+	{
+		taskENTER_CRITICAL();
+		ev = FMSC_Events & mask;
+		FMSC_Events &= ~ev;
+		taskEXIT_CRITICAL();
+		if ( ev != 0 || !wait || ulTaskNotifyTake( pdTRUE, timeout ) == 0 )
+			return ev;
+	}
+}
+
+/**
+ * @brief  Checks if the host is gone: the bus has been suspended or unconfigured
+ *         for FMSC_DETACH_MS (the cable is pulled)
+ * @param  None
+ * @retval Nonzero if it is
+ */
+static uint8_t FMSC_Detached( void )
+{
+	return ( FMSC_Suspended || !FMSC_Configured ) &&
+			xTaskGetTickCount() - FMSC_IdleSince >= FMSC_DETACH_MS / portTICK_RATE_MS;
+}
+
+/**
+ * @brief  Waits for an event of a transfer of the command
+ * @param  mask: Events
+ * @retval 0 if a reset came or the host is gone
+ */
+static uint8_t FMSC_Wait( uint32_t mask )
+{
+	for ( ;; )
+	{
+		if ( FMSC_Events & FMSC_EVT_ABORT )
+			return 0;		/* taken by FMSC_Task */
+		if ( FMSC_Take( mask, FMSC_DETACH_MS / portTICK_RATE_MS ) )
+			return 1;
+		if ( FMSC_Detached() )
+			return 0;
+	}
+}
+
+/**
+ * @brief  Sets the sense of a failed command
+ * @param  key: Sense key
+ * @param  asc: Additional sense code (ASCQ is 0)
+ * @retval FMSC_FAILED
+ */
+static uint8_t FMSC_Fail( uint8_t key, uint8_t asc )
+{
+	FMSC_Sense[ 0 ] = key;
+	FMSC_Sense[ 1 ] = asc;
+	FMSC_Sense[ 2 ] = 0;
+	return FMSC_FAILED;
+}
+
+/**
+ * @brief  Executes a card request of the first buffer
+ * @param  op: Operation
+ * @param  buf: Data
+ * @retval Result of SD I/O
+ */
+static SD_Error FMSC_Execute( SD_IO_Op op, void* buf )
+{
+	FMSC_Req[ 0 ].Op = op;
+	FMSC_Req[ 0 ].Sector = 0;
+	FMSC_Req[ 0 ].Count = 0;
+	FMSC_Req[ 0 ].Buffer = buf;
+	return SD_IO_Execute( &FMSC_Req[ 0 ] );
+}
+
+/**
+ * @brief  Submits a transfer of a buffer to or from the card, waits while the queue is full
+ * @param  i: Buffer
+ * @param  op: SD_IO_READ or SD_IO_WRITE
+ * @param  sector: First block
+ * @param  count: Number of blocks
+ * @retval None
+ */
+static void FMSC_Submit( uint8_t i, SD_IO_Op op, uint32_t sector, uint32_t count )
+{
+	FMSC_Req[ i ].Op = op;
+	FMSC_Req[ i ].Sector = sector;
+	FMSC_Req[ i ].Count = count;
+	FMSC_Req[ i ].Buffer = FMSC_Buf[ i ];
+	while ( SD_IO_Submit( &FMSC_Req[ i ] ) != SD_RESPONSE_NO_ERROR )
+		vTaskDelay( 1 );
+}
+
+/**
+ * @brief  Drops the claim of the card
+ * @param  None
+ * @retval None
+ */
+static void FMSC_Unclaim( void )
+{
+	if ( FMSC_Blocks != 0 )
+	{
+		FMSC_Execute( SD_IO_SYNC, NULL );
+		SD_IO_Release( &FMSC_Region );
+		FMSC_Blocks = 0;
+	}
+}
+
+/**
+ * @brief  Hands the volumes of the card over to the host (or takes them back)
+ * @param  on: 1 to export, 0 to give the card back to FatFs
+ * @retval None
+ */
+static void FMSC_Export( uint8_t on )
+{
+	uint8_t vol;
+
+	if ( on == FMSC_Exported )
+		return;
+	if ( !on )
+		FMSC_Unclaim();
+	for ( vol = 0; vol < _VOLUMES; ++vol )
+		f_eject( LD2PD( vol ), on );
+	FMSC_Exported = on;
+}
+
+/**
+ * @brief  Gets the card ready for a media command: volumes are handed over, the card
+ *         is initialized and claimed, a new claim is reported as a medium change
+ * @param  None
+ * @retval FMSC_PASSED, or FMSC_FAILED with the sense set
+ */
+static uint8_t FMSC_Medium( void )
+{
+	SD_CardInfo info;
+
+	if ( !FMSC_Loaded )
+		return FMSC_Fail( SENSE_NOT_READY, ASC_NO_MEDIUM );
+	FMSC_Export( 1 );
+	if ( FMSC_Blocks != 0 && ( SD_IO_Detect() == SD_NOT_PRESENT || FMSC_Card != SD_IO_CardChanges() ) )
+	{
+		SD_IO_Release( &FMSC_Region );
+		FMSC_Blocks = 0;
+	}
+	if ( FMSC_Blocks != 0 )
+		return FMSC_PASSED;
+
+	if ( SD_IO_Detect() == SD_NOT_PRESENT ||
+			( !SD_IO_Ready() && FMSC_Execute( SD_IO_INIT, NULL ) != SD_RESPONSE_NO_ERROR ) ||
+			FMSC_Execute( SD_IO_INFO, &info ) != SD_RESPONSE_NO_ERROR || info.CardCapacity == 0 )
+		return FMSC_Fail( SENSE_NOT_READY, ASC_NO_MEDIUM );
+	FMSC_Card = SD_IO_CardChanges();
+	FMSC_Blocks = ( info.CardCapacity < 0x80000000 ) ? info.CardCapacity * 2 : 0xFFFFFFFF;	/* Kbytes to blocks */
+	if ( SD_IO_Claim( &FMSC_Region, 0, FMSC_Blocks ) != SD_RESPONSE_NO_ERROR )
+	{
+		FMSC_Blocks = 0;
+		return FMSC_Fail( SENSE_NOT_READY, ASC_NOT_READY );
+	}
+	return FMSC_Fail( SENSE_UNIT_ATTENTION, ASC_MEDIUM_CHANGED );
+}
+
+/**
+ * @brief  Sends data-in of a short answer, truncated to the length the host expects
+ * @param  buf: Data (static)
+ * @param  len: Number of bytes
+ * @retval Status of the command
+ */
+static uint8_t FMSC_Reply( const void* buf, uint32_t len )
+{
+	if ( FMSC_Expect == 0 || !FMSC_DirIn )
+		return FMSC_PHASE_ERROR;
+	if ( len > FMSC_Expect )
+		len = FMSC_Expect;
+	if ( len > 0 )
+	{
+		USB_EP_Transmit( FMSC_EP_IN, buf, len );
+		if ( !FMSC_Wait( FMSC_EVT_IN ) )
+			return FMSC_ABORTED;
+	}
+	FMSC_Moved = len;
+	return FMSC_PASSED;
+}
+
+/**
+ * @brief  Checks the block range of a command, and the data phase the host expects
+ *         if the blocks are moved
+ * @param  lba: First block
+ * @param  blocks: Number of blocks
+ * @param  dir: 1 for data-in, 0 for data-out, 2 if there are no data
+ * @retval FMSC_PASSED if the blocks can be moved
+ */
+static uint8_t FMSC_Range( uint32_t lba, uint32_t blocks, uint8_t dir )
+{
+	uint8_t status = FMSC_Medium();
+
+	if ( status != FMSC_PASSED )
+		return status;
+	if ( lba >= FMSC_Blocks || blocks > FMSC_Blocks - lba )
+		return FMSC_Fail( SENSE_ILLEGAL_REQUEST, ASC_OUT_OF_RANGE );
+	if ( dir < 2 && blocks > 0 && ( FMSC_DirIn != dir || FMSC_Expect < blocks * 512 ) )
+		return FMSC_PHASE_ERROR;
+	return FMSC_PASSED;
+}
+
+/**
+ * @brief  READ(10): the card reads the next buffer while the previous one is sent
+ * @param  lba: First block
+ * @param  blocks: Number of blocks
+ * @retval Status of the command
+ */
+static uint8_t FMSC_Read( uint32_t lba, uint32_t blocks )
+{
+	uint32_t sent = 0, n;
+	uint8_t status = FMSC_Range( lba, blocks, 1 );
+	uint8_t cur = 0, busy = 0;
+
+	if ( status != FMSC_PASSED || blocks == 0 )
+		return status;
+	FMSC_Submit( 0, SD_IO_READ, lba, ( blocks < FMSC_BUFFER_SECTORS ) ? blocks : FMSC_BUFFER_SECTORS );
+	busy = 1;
+	while ( busy & ( 1 << cur ) )
+	{
+		busy &= ~( 1 << cur );
+		if ( SD_IO_Wait( &FMSC_Req[ cur ], portMAX_DELAY ) != SD_RESPONSE_NO_ERROR )
+		{
+			status = FMSC_Fail( SENSE_MEDIUM_ERROR, ASC_READ_ERROR );
+			break;
+		}
+		n = FMSC_Req[ cur ].Count;
+		if ( sent + n < blocks )
+		{
+			FMSC_Submit( cur ^ 1, SD_IO_READ, lba + sent + n,
+					( blocks - sent - n < FMSC_BUFFER_SECTORS ) ? blocks - sent - n : FMSC_BUFFER_SECTORS );
+			busy |= 1 << ( cur ^ 1 );
+		}
+		USB_EP_Transmit( FMSC_EP_IN, FMSC_Buf[ cur ], n * 512 );
+		if ( !FMSC_Wait( FMSC_EVT_IN ) )
+		{
+			status = FMSC_ABORTED;
+			break;
+		}
+		sent += n;
+		FMSC_Moved += n * 512;
+		cur ^= 1;
+	}
+	if ( busy )		/* the buffer is reused by the next command */
+		SD_IO_Wait( &FMSC_Req[ ( busy & 1 ) ? 0 : 1 ], portMAX_DELAY );
+	return status;
+}
+
+/**
+ * @brief  WRITE(10): the next buffer is received while the card writes the previous one
+ * @param  lba: First block
+ * @param  blocks: Number of blocks
+ * @retval Status of the command
+ */
+static uint8_t FMSC_Write( uint32_t lba, uint32_t blocks )
+{
+	uint32_t got = 0, n, k;
+	uint8_t status = FMSC_Range( lba, blocks, 0 );
+	uint8_t cur = 0, busy = 0, i;
+
+	if ( status != FMSC_PASSED || blocks == 0 )
+		return status;
+	n = ( blocks < FMSC_BUFFER_SECTORS ) ? blocks : FMSC_BUFFER_SECTORS;
+	USB_EP_Receive( FMSC_EP_OUT, FMSC_Buf[ 0 ], n * 512 );
+	while ( got < blocks )
+	{
+		if ( !FMSC_Wait( FMSC_EVT_OUT ) )
+		{
+			status = FMSC_ABORTED;
+			break;
+		}
+		FMSC_Moved += USB_EP_Count( FMSC_EP_OUT );
+		k = USB_EP_Count( FMSC_EP_OUT ) / 512;
+		if ( k > 0 )
+		{
+			FMSC_Submit( cur, SD_IO_WRITE, lba + got, k );
+			busy |= 1 << cur;
+			got += k;
+		}
+		if ( k < n )
+		{	/* short packet: the host has less data than it said */
+			status = FMSC_PHASE_ERROR;
+			break;
+		}
+		cur ^= 1;
+		if ( busy & ( 1 << cur ) )
+		{
+			busy &= ~( 1 << cur );
+			if ( SD_IO_Wait( &FMSC_Req[ cur ], portMAX_DELAY ) != SD_RESPONSE_NO_ERROR )
+			{	/* the rest isn't taken, the OUT pipe is halted */
+				status = FMSC_Fail( SENSE_MEDIUM_ERROR, ASC_WRITE_ERROR );
+				break;
+			}
+		}
+		if ( got < blocks )
+		{
+			n = ( blocks - got < FMSC_BUFFER_SECTORS ) ? blocks - got : FMSC_BUFFER_SECTORS;
+			USB_EP_Receive( FMSC_EP_OUT, FMSC_Buf[ cur ], n * 512 );
+		}
+	}
+	for ( i = 0; i < 2; ++i )
+	{
+		if ( ( busy & ( 1 << i ) ) && SD_IO_Wait( &FMSC_Req[ i ], portMAX_DELAY ) != SD_RESPONSE_NO_ERROR &&
+				status == FMSC_PASSED )
+			status = FMSC_Fail( SENSE_MEDIUM_ERROR, ASC_WRITE_ERROR );
+	}
+	return status;
+}
+
+/**
+ * @brief  Executes the SCSI command of the CBW
+ * @param  cdb: Command block
+ * @retval Status of the command
+ */
+static uint8_t FMSC_Scsi( const uint8_t* cdb )
+{
+	uint16_t len10 = ( cdb[ 7 ] << 8 ) | cdb[ 8 ];		/* transfer or allocation length of 10-byte commands */
+	uint8_t* a = FMSC_Answer;
+	uint8_t status;
+
+	if ( cdb[ 0 ] != SCSI_REQUEST_SENSE && cdb[ 0 ] != SCSI_INQUIRY )
+		memset( FMSC_Sense, 0, sizeof( FMSC_Sense ) );		/* sense of the previous command is dropped */
+	switch ( cdb[ 0 ] )
+	{
+	case SCSI_TEST_UNIT_READY:
+		return FMSC_Medium();
+	case SCSI_REQUEST_SENSE:
+		memset( a, 0, 18 );
+		a[ 0 ] = 0x70;
+		a[ 2 ] = FMSC_Sense[ 0 ];
+		a[ 7 ] = 18 - 8;
+		a[ 12 ] = FMSC_Sense[ 1 ];
+		a[ 13 ] = FMSC_Sense[ 2 ];
+		memset( FMSC_Sense, 0, sizeof( FMSC_Sense ) );
+		return FMSC_Reply( a, ( cdb[ 4 ] < 18 ) ? cdb[ 4 ] : 18 );
+	case SCSI_INQUIRY:
+		if ( cdb[ 1 ] & 0x01 )		/* vital product data pages aren't supported */
+			return FMSC_Fail( SENSE_ILLEGAL_REQUEST, ASC_INVALID_FIELD );
+		return FMSC_Reply( FMSC_Inquiry, ( cdb[ 4 ] < sizeof( FMSC_Inquiry ) ) ? cdb[ 4 ] : sizeof( FMSC_Inquiry ) );
+	case SCSI_MODE_SENSE6:
+		memset( a, 0, 4 );
+		a[ 0 ] = 3;				/* no block descriptor, no pages, not write protected */
+		return FMSC_Reply( a, ( cdb[ 4 ] < 4 ) ? cdb[ 4 ] : 4 );
+	case SCSI_MODE_SENSE10:
+		memset( a, 0, 8 );
+		a[ 1 ] = 6;
+		return FMSC_Reply( a, ( len10 < 8 ) ? len10 : 8 );
+	case SCSI_START_STOP_UNIT:
+		if ( cdb[ 4 ] & 0x02 )
+		{	/* load or eject: the volumes get the card back on eject */
+			FMSC_Loaded = cdb[ 4 ] & 0x01;
+			if ( !FMSC_Loaded )
+				FMSC_Export( 0 );
+		}
+		return FMSC_PASSED;
+	case SCSI_PREVENT_ALLOW:
+		return FMSC_PASSED;
+	case SCSI_READ_FORMAT_CAPS:
+		status = FMSC_Medium();
+		if ( status != FMSC_PASSED )
+			return status;
+		memset( a, 0, 12 );
+		a[ 3 ] = 8;
+		FMSC_PutBE32( a + 4, FMSC_Blocks );
+		a[ 8 ] = 0x02;			/* formatted media */
+		a[ 10 ] = 512 >> 8;
+		return FMSC_Reply( a, ( len10 < 12 ) ? len10 : 12 );
+	case SCSI_READ_CAPACITY10:
+		status = FMSC_Medium();
+		if ( status != FMSC_PASSED )
+			return status;
+		FMSC_PutBE32( a, FMSC_Blocks - 1 );
+		FMSC_PutBE32( a + 4, 512 );
+		return FMSC_Reply( a, 8 );
+	case SCSI_READ10:
+		return FMSC_Read( FMSC_GetBE32( cdb + 2 ), len10 );
+	case SCSI_WRITE10:
+		return FMSC_Write( FMSC_GetBE32( cdb + 2 ), len10 );
+	case SCSI_VERIFY10:
+		if ( cdb[ 1 ] & 0x02 )		/* compare with data of the host isn't supported */
+			return FMSC_Fail( SENSE_ILLEGAL_REQUEST, ASC_INVALID_FIELD );
+		return FMSC_Range( FMSC_GetBE32( cdb + 2 ), len10, 2 );
+	case SCSI_SYNC_CACHE10:
+		status = FMSC_Medium();
+		if ( status == FMSC_PASSED && FMSC_Execute( SD_IO_SYNC, NULL ) != SD_RESPONSE_NO_ERROR )
+			status = FMSC_Fail( SENSE_MEDIUM_ERROR, ASC_WRITE_ERROR );
+		return status;
+	}
+	return FMSC_Fail( SENSE_ILLEGAL_REQUEST, ASC_INVALID_COMMAND );
+}
+
+/**
+ * @brief  Waits for the host to clear the halt of a bulk endpoint
+ * @param  ep: Endpoint address
+ * @retval 0 if a reset came or the host is gone
+ */
+static uint8_t FMSC_Halt( uint8_t ep )
+{
+	USB_EP_Stall( ep );
+	return FMSC_Wait( FMSC_EVT_CLEARED );
+}
+
+/**
+ * @brief  Prepares the OUT endpoint for the next CBW
+ * @param  None
+ * @retval None
+ */
+static void FMSC_ReceiveCbw( void )
+{
+	USB_EP_Receive( FMSC_EP_OUT, FMSC_Cbw, sizeof( FMSC_Cbw ) );
+}
+
+/**
+ * @brief  Runs the command of the received CBW: data phase and CSW
+ * @param  None
+ * @retval None
+ */
+static void FMSC_Command( void )
+{
+	uint8_t status;
+
+	if ( USB_EP_Count( FMSC_EP_OUT ) != FMSC_CBW_LENGTH || FMSC_GetLE32( FMSC_Cbw ) != FMSC_CBW_SIGNATURE ||
+			( FMSC_Cbw[ 13 ] & 0x0F ) != 0 || FMSC_Cbw[ 14 ] == 0 || FMSC_Cbw[ 14 ] > 16 )
+	{	/* invalid CBW: both pipes halted until the class reset */
+		FMSC_Halted = 1;
+		USB_EP_Stall( FMSC_EP_IN );
+		USB_EP_Stall( FMSC_EP_OUT );
+		return;
+	}
+	FMSC_Expect = FMSC_GetLE32( FMSC_Cbw + 8 );
+	FMSC_DirIn = ( FMSC_Cbw[ 12 ] & 0x80 ) != 0;
+	FMSC_Moved = 0;
+
+	status = FMSC_Scsi( FMSC_Cbw + 15 );
+	if ( status == FMSC_ABORTED )
+		return;
+	if ( FMSC_Moved < FMSC_Expect && !FMSC_Halt( FMSC_DirIn ? FMSC_EP_IN : FMSC_EP_OUT ) )
+		return;
+
+	memcpy( FMSC_Csw, FMSC_Cbw, 8 );	/* (tag) */
+	FMSC_PutLE32( FMSC_Csw, FMSC_CSW_SIGNATURE );
+	FMSC_PutLE32( FMSC_Csw + 8, FMSC_Expect - FMSC_Moved );
+	FMSC_Csw[ 12 ] = status;
+	USB_EP_Transmit( FMSC_EP_IN, FMSC_Csw, FMSC_CSW_LENGTH );
+	if ( FMSC_Wait( FMSC_EVT_IN ) )
+		FMSC_ReceiveCbw();
+}
+
+/**
+ * @brief  MSC task: serves the host from its configuration on, the card goes back to
+ *         the volumes when the host ejects it or is gone
+ * @param  pvParameters: Not used
+ * @retval None
+ */
+static void FMSC_Task( void* pvParameters )
+{
+	uint32_t ev;
+
+	(void)pvParameters;
+	USB_Init( &FMSC_Class );
+	USB_Connect( ENABLE );
+	for ( ;; )
+	{
+		ev = FMSC_Take( FMSC_EVT_RESET | FMSC_EVT_CONFIGURED | FMSC_EVT_BOT_RESET | FMSC_EVT_OUT, FMSC_DETACH_MS / portTICK_RATE_MS );
+		if ( ev & FMSC_EVT_CONFIGURED )
+			FMSC_Loaded = 1;		/* a new host or a new session of the host */
+		if ( ev & FMSC_EVT_BOT_RESET )
+			USB_EP_Flush( FMSC_EP_IN );
+		if ( ( ev & ( FMSC_EVT_CONFIGURED | FMSC_EVT_BOT_RESET ) ) && FMSC_Configured )
+			FMSC_ReceiveCbw();
+		else if ( ev & FMSC_EVT_OUT )
+			FMSC_Command();
+		if ( FMSC_Exported && FMSC_Detached() )
+			FMSC_Export( 0 );
+	}
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Creates the MSC task, it sets up OTG FS and connects the device
+ * @param  None
+ * @retval None
+ */
+void FMSC_Init( void )
+{
+	static const char hex[] = "0123456789ABCDEF";
+	uint8_t i;
+
+	FMSC_SerialDesc[ 0 ] = sizeof( FMSC_SerialDesc );
+	FMSC_SerialDesc[ 1 ] = USB_DESC_STRING;
+	for ( i = 0; i < 2 * FMSC_UID_BYTES; ++i )
+	{
+		FMSC_SerialDesc[ 2 + 2 * i ] = hex[ ( FMSC_UID[ i / 2 ] >> ( ( i & 1 ) ? 0 : 4 ) ) & 0x0F ];
+		FMSC_SerialDesc[ 3 + 2 * i ] = 0;
+	}
+	for ( i = 0; i < 2; ++i )
+	{
+		SD_IO_RequestInit( &FMSC_Req[ i ] );
+		FMSC_Req[ i ].Region = &FMSC_Region;
+	}
+	xTaskCreateStatic( FMSC_Task, (const signed char* const)"MSC", FMSC_TASK_STACK, NULL, FMSC_TASK_PRIO, &FMSC_Handle, FMSC_TaskStack, &FMSC_TaskBuffer );
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#endif /* USE_USB_MSC */
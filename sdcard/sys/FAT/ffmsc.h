@@ -0,0 +1,80 @@
+/**
+ ******************************************************************************
+ * @file    ffmsc.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Export of the SD Card as a USB mass storage device (Bulk-Only
+ *          Transport, SCSI transparent command set) on OTG FS, so a PC
+ *          reads and writes the card in place without removing it.
+ *          While a host has the card, FatFs doesn't: the volumes are synced
+ *          and forgotten (f_eject) when the host configures the device, the
+ *          whole card is claimed from SD I/O, and the volumes see no medium
+ *          until the host ejects it (START STOP UNIT) or the cable is pulled
+ *          (the bus stays suspended for FMSC_DETACH_MS); they are mounted
+ *          again on their next access, the host may have changed anything.
+ *          READ(10) and WRITE(10) go through two buffers (FMSC_BUFFER_SECTORS
+ *          each, storage_conf.h): the card transfers one of them as a single
+ *          multiple block request while the other one is on the bus.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef FFMSC_H
+#define FFMSC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include <stdint.h>
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Constants
+ * @{
+ */
+
+/**
+ * @brief  Suspend of the bus which is taken for a pulled cable (no VBUS sensing):
+ *         the volumes get the card back after it
+ */
+#define FMSC_DETACH_MS			1000
+
+/**
+ * @brief  Vendor and product ID (ST mass storage), identification of INQUIRY (8, 16 and 4 characters)
+ */
+#define FMSC_VID				0x0483
+#define FMSC_PID				0x5720
+#define FMSC_VENDOR				"STM32   "
+#define FMSC_PRODUCT			"SD Card         "
+#define FMSC_REVISION			"1.0 "
+
+/**
+ * @}
+ *//* STM32_Exported_Constants */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+void FMSC_Init( void );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FFMSC_H */
@@ -0,0 +1,1097 @@
+/**
+ ******************************************************************************
+ * @file    ffnet.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   File retrieval over Ethernet (HTTP/1.0 on a minimal IPv4 stack).
+ *          One task does everything: it takes received frames from the
+ *          MAC, answers ARP and ICMP echo requests at once, runs the TCP
+ *          connection and refills the data ring from the file between the
+ *          frames. The stream of the connection is the answer header (in
+ *          FNET_Head) followed by the body (in the ring): a segment is sent
+ *          from either of them in place and stays there until it is
+ *          acknowledged, retransmission goes back to the first byte not
+ *          acknowledged (go-back-N, the peer drops nothing in order anyway).
+ *          Ring space is reused once it is both acknowledged and no longer
+ *          being sent by the DMA (a retransmitted segment may still be in a
+ *          transmit descriptor after its ACK came).
+ *          Sending follows the window of the peer and a congestion window
+ *          which grows by a segment per ACK and falls back to one segment
+ *          on a timeout; the receive side takes only in order data: the
+ *          request line, the header fields after it are acknowledged and
+ *          dropped. The service doesn't mount volumes, paths refer to
+ *          volumes mounted by the application.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#ifdef USE_NET_FILE_SERVICE
+
+#include "ffnet.h"
+#include "ff.h"
+
+#include "stm32_eth.h"
+#include "stm32_mem.h"
+#include "stm32_sd_io.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Types
+ * @{
+ */
+
+/**
+ * @brief  State of the connection (the service sends first FIN and forgets the
+ *         connection when both FINs are acknowledged: there is no TIME-WAIT)
+ */
+typedef enum
+{
+	FNET_CLOSED = 0,			/*!< Listening */
+	FNET_SYN_RCVD,				/*!< SYN answered, waiting for its ACK */
+	FNET_ESTABLISHED			/*!< Request received and answered, up to the end */
+} FNET_State;
+
+/**
+ * @brief  Addresses of the peer, from the frames it sent
+ */
+typedef struct
+{
+	uint8_t			Mac[ 6 ];
+	uint8_t			Ip[ 4 ];
+	uint16_t		Port;
+} FNET_Peer;
+
+/**
+ * @brief  The TCP connection. Sequence numbers of the stream start at Iss + 1.
+ */
+typedef struct
+{
+	FNET_State		State;
+	FNET_Peer		Peer;
+	uint16_t		Mss;			/*!< Largest segment the peer takes */
+	uint32_t		Iss;			/*!< Sequence number of the SYN */
+	uint32_t		RcvNxt;			/*!< Next sequence number expected from the peer */
+	uint32_t		SndUna;			/*!< First sequence number not acknowledged */
+	uint32_t		SndNxt;			/*!< Next sequence number to send */
+	uint32_t		SndMax;			/*!< Highest sequence number sent + 1 */
+	uint32_t		Wnd;			/*!< Window of the peer */
+	uint32_t		Cwnd;			/*!< Congestion window */
+	portTickType	Rto;			/*!< Retransmission timeout */
+	portTickType	Sent;			/*!< Start of the retransmission timeout */
+	portTickType	Heard;			/*!< Last segment from the peer */
+	uint8_t			Timing;			/*!< Retransmission timer runs */
+	uint8_t			Retries;		/*!< Timeouts without progress */
+	uint8_t			DupAcks;		/*!< Repeated ACKs in a row */
+	uint8_t			Probe;			/*!< One segment may go past a closed window */
+	uint8_t			Answered;		/*!< The request line is taken, FNET_Head is the answer */
+	uint8_t			PeerFin;		/*!< The peer has sent FIN */
+	uint16_t		ReqLen;			/*!< Bytes of the request line received */
+} FNET_Conn;
+
+/**
+ * @brief  Source of the body
+ */
+typedef enum
+{
+	FNET_NONE = 0,				/*!< No body, or all of it is in the ring */
+	FNET_FILE,					/*!< Data of FNET_File */
+	FNET_LIST					/*!< Entries of FNET_Dir */
+} FNET_Source;
+
+/**
+ * @}
+ *//* STM32_Private_Types */
+
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  Service task (the listing is formatted by snprintf)
+ */
+#define FNET_TASK_PRIO			( tskIDLE_PRIORITY + 1 )
+#define FNET_TASK_STACK			( configMINIMAL_STACK_SIZE * 3 )
+
+/**
+ * @brief  Directories are listed if FatFs has f_opendir and f_readdir
+ */
+#if _FS_MINIMIZE <= 1
+#define FNET_LISTING
+#endif /* _FS_MINIMIZE */
+
+/**
+ * @brief  Frame layout: Ethernet header, IPv4 header without options, TCP header
+ */
+#define FNET_ETH				14
+#define FNET_IP					20
+#define FNET_TCP				20
+#define FNET_HEADERS			( FNET_ETH + FNET_IP + FNET_TCP )
+#define FNET_ARP				28
+
+#define FNET_TYPE_IP			0x0800
+#define FNET_TYPE_ARP			0x0806
+#define FNET_PROTO_ICMP			1
+#define FNET_PROTO_TCP			6
+#define FNET_ICMP_ECHO			8
+#define FNET_ICMP_REPLY			0
+
+/**
+ * @brief  TCP header flags
+ */
+#define FNET_FIN				0x01
+#define FNET_SYN				0x02
+#define FNET_RST				0x04
+#define FNET_PSH				0x08
+#define FNET_ACK				0x10
+
+/**
+ * @brief  Segment size for 1500 bytes MTU, and the one assumed if the peer doesn't tell
+ */
+#define FNET_MSS				1460
+#define FNET_MSS_DEFAULT		536
+
+/**
+ * @brief  Receive window advertised (data after the request line are dropped anyway)
+ */
+#define FNET_WINDOW				4096
+
+/**
+ * @brief  Wait of the task for a frame, timer resolution
+ */
+#define FNET_TICK				( 10 / portTICK_RATE_MS )
+
+/**
+ * @brief  Retransmission timeout range, timeouts without progress before the
+ *         connection is reset, silence of the peer before it is reset, wait
+ *         for FIN of the peer after the whole answer is acknowledged
+ */
+#define FNET_RTO_MIN			( 200 / portTICK_RATE_MS )
+#define FNET_RTO_MAX			( 3000 / portTICK_RATE_MS )
+#define FNET_RETRIES			8
+#define FNET_IDLE_TIMEOUT		( 10000 / portTICK_RATE_MS )
+#define FNET_LINGER				( 2000 / portTICK_RATE_MS )
+
+/**
+ * @brief  Link polling period
+ */
+#define FNET_LINK_POLL			( 500 / portTICK_RATE_MS )
+
+/**
+ * @brief  Longest request line (method, percent-encoded path, version), answer header
+ *         and line of a listing
+ */
+#define FNET_REQUEST_MAX		( _MAX_LFN + 64 )
+#define FNET_HEAD_MAX			160
+#define FNET_LINE_MAX			( 14 + _MAX_LFN + 3 )
+
+/**
+ * @brief  Body ring, and the smallest read into it (unless it ends the ring or the file)
+ */
+#define FNET_RING				( FNET_BUFFER_SECTORS * 512 )
+#define FNET_READ_MIN			( 4 * 512 )
+
+/**
+ * @brief  Sequence number comparisons (modulo 2^32)
+ */
+#define FNET_SEQ_LT( a, b )		( (int32_t)( (a) - (b) ) < 0 )
+#define FNET_SEQ_LE( a, b )		( (int32_t)( (a) - (b) ) <= 0 )
+
+#if FNET_BUFFER_SECTORS < 8
+#error FNET_BUFFER_SECTORS has to hold a few segments and reads (see storage_conf.h)
+#endif
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Variables
+ * @{
+ */
+
+static const uint8_t FNET_Mac[ 6 ] = { MAC_ADDR0, MAC_ADDR1, MAC_ADDR2, MAC_ADDR3, MAC_ADDR4, MAC_ADDR5 };
+static const uint8_t FNET_Addr[ 4 ] = { IP_ADDR0, IP_ADDR1, IP_ADDR2, IP_ADDR3 };
+static const uint8_t FNET_Broadcast[ 6 ] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+static FNET_Conn FNET_C;
+static uint16_t FNET_IpId;						/* identification of IPv4 datagrams */
+static uint32_t FNET_Connections;				/* accepted so far, varies the ISS */
+
+static char FNET_Req[ FNET_REQUEST_MAX + 1 ];	/* request line (NUL terminated) */
+static uint8_t FNET_Head[ FNET_HEAD_MAX ] MEM_DMA_BUFFER;	/* answer header, sent in place */
+static uint32_t FNET_HeadLen;
+static uint8_t FNET_Ring[ FNET_RING ] MEM_DMA_BUFFER;	/* body, sent in place */
+static uint32_t FNET_Filled;					/* body bytes put into the ring */
+static uint32_t FNET_Freed;						/* body bytes whose ring space is free again */
+static FNET_Source FNET_Src;
+static FIL FNET_File;
+#ifdef FNET_LISTING
+static DIR FNET_Dir;
+static char FNET_Line[ FNET_LINE_MAX + 1 ];
+#if _USE_LFN
+static TCHAR FNET_Lfn[ _MAX_LFN + 1 ];
+#endif /* _USE_LFN */
+#endif /* FNET_LISTING */
+
+static xTaskHandle FNET_Handle;
+static xStaticTask FNET_TaskBuffer;
+static portSTACK_TYPE FNET_TaskStack[ FNET_TASK_STACK ];
+
+/**
+ * @}
+ *//* STM32_Private_Variables */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Read and write big endian (network order) fields of frames
+ */
+static uint16_t FNET_Get16( const uint8_t* p )
+{
+	return ( p[ 0 ] << 8 ) | p[ 1 ];
+}
+
+static uint32_t FNET_Get32( const uint8_t* p )
+{
+	return ( (uint32_t)p[ 0 ] << 24 ) | ( p[ 1 ] << 16 ) | ( p[ 2 ] << 8 ) | p[ 3 ];
+}
+
+static void FNET_Put16( uint8_t* p, uint16_t v )
+{
+	p[ 0 ] = (uint8_t)( v >> 8 );
+	p[ 1 ] = (uint8_t)v;
+}
+
+static void FNET_Put32( uint8_t* p, uint32_t v )
+{
+	FNET_Put16( p, (uint16_t)( v >> 16 ) );
+	FNET_Put16( p + 2, (uint16_t)v );
+}
+
+/**
+ * @brief  Writes Ethernet and IPv4 headers (the MAC inserts the header checksum)
+ * @param  f: Frame
+ * @param  to: Destination
+ * @param  proto: IP protocol
+ * @param  len: Length of the payload of the IPv4 datagram
+ * @retval Start of the IPv4 payload
+ */
+static uint8_t* FNET_IpHeader( uint8_t* f, const FNET_Peer* to, uint8_t proto, uint32_t len )
+{
+	uint8_t* ip = f + FNET_ETH;
+
+	memcpy( f, to->Mac, 6 );
+	memcpy( f + 6, FNET_Mac, 6 );
+	FNET_Put16( f + 12, FNET_TYPE_IP );
+	ip[ 0 ] = 0x45;
+	ip[ 1 ] = 0;
+	FNET_Put16( ip + 2, (uint16_t)( FNET_IP + len ) );
+	FNET_Put16( ip + 4, FNET_IpId++ );
+	FNET_Put16( ip + 6, 0x4000 );		/* don't fragment */
+	ip[ 8 ] = 64;
+	ip[ 9 ] = proto;
+	FNET_Put16( ip + 10, 0 );
+	memcpy( ip + 12, FNET_Addr, 4 );
+	memcpy( ip + 16, to->Ip, 4 );
+	return ip + FNET_IP;
+}
+
+/**
+ * @brief  Sends TCP segment, the payload goes in place (the MAC inserts the checksum)
+ * @param  to: Destination
+ * @param  flags: TCP flags (SYN adds MSS option)
+ * @param  seq: Sequence number
+ * @param  ack: Acknowledgement number (if flags have FNET_ACK)
+ * @param  data: Payload, unchanged until the frame is sent
+ * @param  len: Payload length
+ * @param  tag: Body offset of the payload, EMAC_NO_TAG if it isn't in the ring
+ * @retval Zero if no transmit descriptor is free (the segment isn't sent)
+ */
+static uint8_t FNET_Segment( const FNET_Peer* to, uint8_t flags, uint32_t seq, uint32_t ack,
+		const uint8_t* data, uint32_t len, uint32_t tag )
+{
+	uint8_t* f = EMAC_TxSlot();
+	uint8_t* t;
+	uint32_t tcp = FNET_TCP + ( ( flags & FNET_SYN ) ? 4 : 0 );
+
+	if ( f == NULL )
+		return 0;
+	t = FNET_IpHeader( f, to, FNET_PROTO_TCP, tcp + len );
+	FNET_Put16( t, FNET_PORT );
+	FNET_Put16( t + 2, to->Port );
+	FNET_Put32( t + 4, seq );
+	FNET_Put32( t + 8, ( flags & FNET_ACK ) ? ack : 0 );
+	FNET_Put16( t + 12, (uint16_t)( ( tcp / 4 ) << 12 ) | flags );
+	FNET_Put16( t + 14, FNET_WINDOW );
+	FNET_Put16( t + 16, 0 );
+	FNET_Put16( t + 18, 0 );
+	if ( flags & FNET_SYN )
+	{
+		t[ 20 ] = 2;
+		t[ 21 ] = 4;
+		FNET_Put16( t + 22, FNET_MSS );
+	}
+	EMAC_Transmit( FNET_ETH + FNET_IP + tcp, data, len, tag );
+	return 1;
+}
+
+/**
+ * @brief  Sends ACK of the connection (nothing if no descriptor is free: the peer repeats)
+ * @param  None
+ * @retval None
+ */
+static void FNET_SendAck( void )
+{
+	FNET_Segment( &FNET_C.Peer, FNET_ACK, FNET_C.SndNxt, FNET_C.RcvNxt, NULL, 0, EMAC_NO_TAG );
+}
+
+/**
+ * @brief  Sends ARP packet from the address of the service
+ * @param  dst: Destination MAC address of the frame
+ * @param  oper: 1 request, 2 reply
+ * @param  tha: Target hardware address
+ * @param  tpa: Target protocol address
+ * @retval None
+ */
+static void FNET_ArpSend( const uint8_t* dst, uint16_t oper, const uint8_t* tha, const uint8_t* tpa )
+{
+	uint8_t* f = EMAC_TxSlot();
+	uint8_t* a;
+
+	if ( f == NULL )
+		return;
+	memcpy( f, dst, 6 );
+	memcpy( f + 6, FNET_Mac, 6 );
+	FNET_Put16( f + 12, FNET_TYPE_ARP );
+	a = f + FNET_ETH;
+	FNET_Put16( a, 1 );
+	FNET_Put16( a + 2, FNET_TYPE_IP );
+	a[ 4 ] = 6;
+	a[ 5 ] = 4;
+	FNET_Put16( a + 6, oper );
+	memcpy( a + 8, FNET_Mac, 6 );
+	memcpy( a + 14, FNET_Addr, 4 );
+	memcpy( a + 18, tha, 6 );
+	memcpy( a + 24, tpa, 4 );
+	EMAC_Transmit( FNET_ETH + FNET_ARP, NULL, 0, EMAC_NO_TAG );		/* the MAC pads it */
+}
+
+/**
+ * @brief  Closes the connection (the source of the body is closed too). Frames of
+ *         the connection still in the descriptors are sent before a new connection
+ *         can have the header and the ring rewritten: it needs a round trip first.
+ * @param  reset: Nonzero to send RST to the peer
+ * @retval None
+ */
+static void FNET_Close( uint8_t reset )
+{
+	if ( reset )
+		FNET_Segment( &FNET_C.Peer, FNET_RST | FNET_ACK, FNET_C.SndNxt, FNET_C.RcvNxt, NULL, 0, EMAC_NO_TAG );
+	if ( FNET_Src == FNET_FILE )
+		f_close( &FNET_File );
+	FNET_Src = FNET_NONE;
+	FNET_C.State = FNET_CLOSED;
+}
+
+/**
+ * @brief  Sequence number after the whole answer, valid once the body is complete
+ * @param  None
+ * @retval Sequence number of our FIN
+ */
+static uint32_t FNET_End( void )
+{
+	return FNET_C.Iss + 1 + FNET_HeadLen + FNET_Filled;
+}
+
+/**
+ * @brief  Gets the piece of the stream at the offset, contiguous in the header or the ring
+ * @param  off: Offset in the stream (sent and not yet freed)
+ * @param  p: Receives the start of the piece
+ * @param  tag: Receives the tag of the piece for EMAC_Transmit
+ * @retval Length of the piece
+ */
+static uint32_t FNET_Data( uint32_t off, const uint8_t** p, uint32_t* tag )
+{
+	uint32_t pos, n;
+
+	if ( off < FNET_HeadLen )
+	{
+		*p = FNET_Head + off;
+		*tag = 0;			/* holds the whole ring while it is being sent */
+		return FNET_HeadLen - off;
+	}
+	off -= FNET_HeadLen;
+	pos = off % FNET_RING;
+	n = FNET_Filled - off;
+	if ( n > FNET_RING - pos )
+		n = FNET_RING - pos;
+	*p = FNET_Ring + pos;
+	*tag = off;
+	return n;
+}
+
+/**
+ * @brief  Decodes %XX escapes of the path in place
+ * @param  s: Path
+ * @retval None
+ */
+static void FNET_Unescape( char* s )
+{
+	char* d = s;
+	uint8_t i, v, c;
+
+	while ( *s )
+	{
+		if ( *s == '%' )
+		{
+			for ( i = 1, v = 0; i < 3; ++i )
+			{
+				c = (uint8_t)s[ i ];
+				if ( c >= '0' && c <= '9' )
+					c -= '0';
+				else if ( ( c | 0x20 ) >= 'a' && ( c | 0x20 ) <= 'f' )
+					c = ( c | 0x20 ) - 'a' + 10;
+				else
+					break;
+				v = ( v << 4 ) | c;
+			}
+			if ( i == 3 )
+			{
+				*d++ = (char)v;
+				s += 3;
+				continue;
+			}
+		}
+		*d++ = *s++;
+	}
+	*d = 0;
+}
+
+/**
+ * @brief  Answers the request line in FNET_Req: builds the header in FNET_Head and
+ *         opens the source of the body
+ * @param  None
+ * @retval None
+ */
+static void FNET_Answer( void )
+{
+	const char* status;
+	const char* type = "text/plain";
+	char* method = FNET_Req;
+	char* path = NULL;
+	char* p;
+	uint8_t head = 0, length = 1;
+	FRESULT res;
+	uint32_t size = 0;
+
+	FNET_Src = FNET_NONE;
+	FNET_Filled = FNET_Freed = 0;
+	p = strchr( method, ' ' );
+	if ( p != NULL )
+	{
+		*p++ = 0;
+		path = p;
+		p = strpbrk( path, " ?" );
+		if ( p != NULL )
+			*p = 0;
+		FNET_Unescape( path );
+		if ( path[ 0 ] == '/' && path[ 1 ] >= '0' && path[ 1 ] <= '9' && path[ 2 ] == ':' )
+			++path;			/* "/1:/DIR" is "1:/DIR", "/DIR" is on drive 0 */
+	}
+	head = ( strcmp( method, "HEAD" ) == 0 );
+	if ( path == NULL || path[ 0 ] == 0 )
+		status = "400 Bad Request";
+	else if ( !head && strcmp( method, "GET" ) != 0 )
+		status = "501 Not Implemented";
+	else
+	{
+#ifdef FNET_LISTING
+		res = f_opendir( &FNET_Dir, path );
+		if ( res == FR_OK )
+		{
+			FNET_Src = FNET_LIST;
+			length = 0;		/* the end of the connection ends the listing */
+		}
+		else
+#endif /* FNET_LISTING */
+		{
+			res = f_open( &FNET_File, path, FA_READ );
+			if ( res == FR_OK )
+			{
+				FNET_Src = FNET_FILE;
+				size = FNET_File.fsize;
+				type = "application/octet-stream";
+			}
+		}
+		switch ( res )
+		{
+		case FR_OK:
+			status = "200 OK";
+			break;
+		case FR_NO_FILE:
+		case FR_NO_PATH:
+		case FR_INVALID_NAME:
+		case FR_INVALID_DRIVE:
+		case FR_NOT_ENABLED:
+		case FR_NO_FILESYSTEM:
+			status = "404 Not Found";
+			break;
+		case FR_NOT_READY:
+		case FR_LOCKED:
+		case FR_TIMEOUT:
+			status = "503 Service Unavailable";
+			break;
+		default:
+			status = "500 Internal Server Error";
+			break;
+		}
+	}
+	if ( head && FNET_Src == FNET_FILE )
+		f_close( &FNET_File );
+	if ( head )
+		FNET_Src = FNET_NONE;
+
+	if ( length )
+		FNET_HeadLen = snprintf( (char*)FNET_Head, FNET_HEAD_MAX,
+				"HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n",
+				status, type, (unsigned long)size );
+	else
+		FNET_HeadLen = snprintf( (char*)FNET_Head, FNET_HEAD_MAX,
+				"HTTP/1.0 %s\r\nContent-Type: %s\r\nConnection: close\r\n\r\n", status, type );
+	FNET_C.Answered = 1;
+}
+
+/**
+ * @brief  Takes in order data of the peer: the request line until its end
+ * @param  data: Payload of the segment
+ * @param  len: Payload length
+ * @retval None
+ */
+static void FNET_Request( const uint8_t* data, uint32_t len )
+{
+	uint32_t i;
+
+	for ( i = 0; i < len && !FNET_C.Answered; ++i )
+	{
+		if ( data[ i ] == '\n' )
+		{
+			if ( FNET_C.ReqLen > 0 && FNET_Req[ FNET_C.ReqLen - 1 ] == '\r' )
+				--FNET_C.ReqLen;
+			FNET_Req[ FNET_C.ReqLen ] = 0;
+			FNET_Answer();
+		}
+		else if ( FNET_C.ReqLen == FNET_REQUEST_MAX )
+		{	/* too long a line is answered as a bad one */
+			FNET_Req[ 0 ] = 0;
+			FNET_Answer();
+		}
+		else
+			FNET_Req[ FNET_C.ReqLen++ ] = (char)data[ i ];
+	}
+}
+
+/**
+ * @brief  Accepts a connection: answers SYN of the peer
+ * @param  from: Peer
+ * @param  seq: Sequence number of the SYN
+ * @param  wnd: Window of the peer
+ * @param  opt: TCP options of the SYN
+ * @param  optlen: Length of the options
+ * @retval None
+ */
+static void FNET_Accept( const FNET_Peer* from, uint32_t seq, uint16_t wnd, const uint8_t* opt, uint32_t optlen )
+{
+	uint32_t i;
+
+	memset( &FNET_C, 0, sizeof( FNET_C ) );
+	FNET_C.Peer = *from;
+	FNET_C.Mss = FNET_MSS_DEFAULT;
+	for ( i = 0; i < optlen && opt[ i ] != 0; )
+	{
+		if ( opt[ i ] == 1 )
+		{
+			++i;
+			continue;
+		}
+		if ( i + 1 >= optlen || opt[ i + 1 ] < 2 )
+			break;
+		if ( opt[ i ] == 2 && opt[ i + 1 ] == 4 && i + 4 <= optlen )
+			FNET_C.Mss = FNET_Get16( opt + i + 2 );
+		i += opt[ i + 1 ];
+	}
+	if ( FNET_C.Mss > FNET_MSS )
+		FNET_C.Mss = FNET_MSS;
+	FNET_C.Iss = xTaskGetTickCount() * 2654435761u + ( ++FNET_Connections << 16 ) + from->Port;
+	FNET_C.RcvNxt = seq + 1;
+	FNET_C.SndUna = FNET_C.Iss;
+	FNET_C.SndNxt = FNET_C.SndMax = FNET_C.Iss + 1;
+	FNET_C.Wnd = wnd;
+	FNET_C.Cwnd = 4 * FNET_C.Mss;
+	FNET_C.Rto = FNET_RTO_MIN;
+	FNET_C.Heard = FNET_C.Sent = xTaskGetTickCount();
+	FNET_C.Timing = 1;
+	FNET_C.State = FNET_SYN_RCVD;
+	FNET_Segment( &FNET_C.Peer, FNET_SYN | FNET_ACK, FNET_C.Iss, FNET_C.RcvNxt, NULL, 0, EMAC_NO_TAG );
+}
+
+/**
+ * @brief  Processes the acknowledgement of a segment of the connection
+ * @param  ack: Acknowledgement number
+ * @param  wnd: Window of the peer
+ * @param  pure: Nonzero if the segment has neither data nor FIN (may be a repeated ACK)
+ * @retval None
+ */
+static void FNET_Acked( uint32_t ack, uint16_t wnd, uint8_t pure )
+{
+	if ( FNET_C.State == FNET_SYN_RCVD )
+	{
+		if ( ack != FNET_C.Iss + 1 )
+			return;
+		FNET_C.State = FNET_ESTABLISHED;
+		FNET_C.SndUna = ack;
+		FNET_C.Timing = 0;
+		FNET_C.Retries = 0;
+	}
+	else if ( FNET_SEQ_LT( FNET_C.SndUna, ack ) && FNET_SEQ_LE( ack, FNET_C.SndMax ) )
+	{
+		FNET_C.SndUna = ack;
+		if ( FNET_SEQ_LT( FNET_C.SndNxt, ack ) )
+			FNET_C.SndNxt = ack;
+		FNET_C.DupAcks = FNET_C.Retries = 0;
+		FNET_C.Rto = FNET_RTO_MIN;
+		if ( FNET_C.Cwnd < 0xFFFF )
+			FNET_C.Cwnd += FNET_C.Mss;
+		FNET_C.Timing = ( ack != FNET_C.SndMax );
+		FNET_C.Sent = xTaskGetTickCount();
+	}
+	else if ( ack == FNET_C.SndUna && pure && ack != FNET_C.SndMax && wnd == FNET_C.Wnd && ++FNET_C.DupAcks == 3 )
+	{	/* fast retransmit: the peer misses the segment at ack */
+		FNET_C.Cwnd /= 2;
+		if ( FNET_C.Cwnd < 2 * (uint32_t)FNET_C.Mss )
+			FNET_C.Cwnd = 2 * FNET_C.Mss;
+		FNET_C.SndNxt = ack;
+	}
+	FNET_C.Wnd = wnd;
+}
+
+/**
+ * @brief  Processes TCP segment
+ * @param  from: Sender (port is set here)
+ * @param  seg: Segment
+ * @param  len: Segment length (header and payload)
+ * @retval None
+ */
+static void FNET_TcpInput( FNET_Peer* from, const uint8_t* seg, uint32_t len )
+{
+	uint32_t seq, ack, off, dlen;
+	uint16_t wnd;
+	uint8_t flags;
+
+	if ( len < FNET_TCP )
+		return;
+	off = ( seg[ 12 ] >> 4 ) * 4;
+	if ( off < FNET_TCP || off > len )
+		return;
+	from->Port = FNET_Get16( seg );
+	seq = FNET_Get32( seg + 4 );
+	ack = FNET_Get32( seg + 8 );
+	flags = seg[ 13 ];
+	wnd = FNET_Get16( seg + 14 );
+	dlen = len - off;
+
+	if ( FNET_Get16( seg + 2 ) != FNET_PORT || FNET_C.State == FNET_CLOSED ||
+			from->Port != FNET_C.Peer.Port || memcmp( from->Ip, FNET_C.Peer.Ip, 4 ) != 0 )
+	{	/* not the connection: a new one, or reset */
+		if ( flags & FNET_RST )
+			return;
+		if ( ( flags & ( FNET_SYN | FNET_ACK ) ) == FNET_SYN && FNET_C.State == FNET_CLOSED &&
+				FNET_Get16( seg + 2 ) == FNET_PORT )
+			FNET_Accept( from, seq, wnd, seg + FNET_TCP, off - FNET_TCP );
+		else if ( flags & FNET_ACK )
+			FNET_Segment( from, FNET_RST, ack, 0, NULL, 0, EMAC_NO_TAG );
+		else
+			FNET_Segment( from, FNET_RST | FNET_ACK, 0, seq + dlen + ( ( flags & FNET_SYN ) ? 1 : 0 ) + ( flags & FNET_FIN ),
+					NULL, 0, EMAC_NO_TAG );
+		return;
+	}
+
+	if ( flags & FNET_RST )
+	{
+		if ( seq - FNET_C.RcvNxt < FNET_WINDOW )
+			FNET_Close( 0 );
+		return;
+	}
+	if ( flags & FNET_SYN )
+	{	/* SYN-ACK lost: the peer repeats its SYN */
+		if ( FNET_C.State == FNET_SYN_RCVD && seq + 1 == FNET_C.RcvNxt )
+			FNET_Segment( &FNET_C.Peer, FNET_SYN | FNET_ACK, FNET_C.Iss, FNET_C.RcvNxt, NULL, 0, EMAC_NO_TAG );
+		return;
+	}
+	if ( !( flags & FNET_ACK ) )
+		return;
+	memcpy( FNET_C.Peer.Mac, from->Mac, 6 );		/* follows the router if the route changes */
+	FNET_C.Heard = xTaskGetTickCount();
+	FNET_Acked( ack, wnd, dlen == 0 && !( flags & FNET_FIN ) );
+	if ( FNET_C.State != FNET_ESTABLISHED || ( dlen == 0 && !( flags & FNET_FIN ) ) )
+		return;
+
+	if ( seq == FNET_C.RcvNxt && !FNET_C.PeerFin )
+	{
+		FNET_Request( seg + off, dlen );
+		FNET_C.RcvNxt += dlen;
+		if ( flags & FNET_FIN )
+		{
+			++FNET_C.RcvNxt;
+			FNET_C.PeerFin = 1;
+			if ( !FNET_C.Answered )
+			{	/* the request ends without a line end */
+				FNET_Req[ FNET_C.ReqLen ] = 0;
+				FNET_Answer();
+			}
+		}
+	}
+	FNET_SendAck();		/* also repeats the ACK of out of order data */
+}
+
+/**
+ * @brief  Processes received frame
+ * @param  f: Frame
+ * @param  len: Frame length without CRC
+ * @retval None
+ */
+static void FNET_Input( const uint8_t* f, uint32_t len )
+{
+	const uint8_t* a = f + FNET_ETH;
+	uint8_t* r;
+	FNET_Peer from;
+	uint32_t ihl, tot;
+
+	if ( len < FNET_ETH + FNET_ARP )
+		return;
+	if ( FNET_Get16( f + 12 ) == FNET_TYPE_ARP )
+	{	/* request for the address of the service */
+		if ( FNET_Get16( a ) == 1 && FNET_Get16( a + 2 ) == FNET_TYPE_IP && a[ 4 ] == 6 && a[ 5 ] == 4 &&
+				FNET_Get16( a + 6 ) == 1 && memcmp( a + 24, FNET_Addr, 4 ) == 0 )
+			FNET_ArpSend( a + 8, 2, a + 8, a + 14 );
+		return;
+	}
+	if ( FNET_Get16( f + 12 ) != FNET_TYPE_IP || ( a[ 0 ] >> 4 ) != 4 )
+		return;
+	ihl = ( a[ 0 ] & 0x0F ) * 4;
+	tot = FNET_Get16( a + 2 );
+	if ( ihl < FNET_IP || tot < ihl || FNET_ETH + tot > len || ( FNET_Get16( a + 6 ) & 0x3FFF ) != 0 ||
+			memcmp( a + 16, FNET_Addr, 4 ) != 0 )
+		return;		/* not for the service, or a fragment */
+	memcpy( from.Mac, f + 6, 6 );
+	memcpy( from.Ip, a + 12, 4 );
+	from.Port = 0;
+
+	switch ( a[ 9 ] )
+	{
+	case FNET_PROTO_ICMP:
+		/* echo reply from the header slot: pings of up to 74 bytes of data */
+		if ( tot - ihl < 8 || a[ ihl ] != FNET_ICMP_ECHO || FNET_ETH + FNET_IP + tot - ihl > EMAC_TX_SLOT )
+			break;
+		r = EMAC_TxSlot();
+		if ( r == NULL )
+			break;
+		r = FNET_IpHeader( r, &from, FNET_PROTO_ICMP, tot - ihl );
+		memcpy( r, a + ihl, tot - ihl );
+		r[ 0 ] = FNET_ICMP_REPLY;
+		FNET_Put16( r + 2, 0 );
+		EMAC_Transmit( FNET_ETH + FNET_IP + tot - ihl, NULL, 0, EMAC_NO_TAG );
+		break;
+	case FNET_PROTO_TCP:
+		FNET_TcpInput( &from, a + ihl, tot - ihl );
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * @brief  Sends what the windows allow of the answer, then FIN after it
+ * @param  None
+ * @retval None
+ */
+static void FNET_Output( void )
+{
+	uint32_t avail, limit, win, n, tag;
+	const uint8_t* p;
+
+	if ( FNET_C.State != FNET_ESTABLISHED || !FNET_C.Answered )
+		return;
+	avail = FNET_C.Iss + 1 + FNET_HeadLen + FNET_Filled;
+	win = ( FNET_C.Wnd < FNET_C.Cwnd ) ? FNET_C.Wnd : FNET_C.Cwnd;
+	limit = FNET_C.SndUna + win;
+	if ( FNET_C.Probe && FNET_SEQ_LE( limit, FNET_C.SndNxt ) )
+		limit = FNET_C.SndNxt + 1;		/* probe of a closed window */
+	while ( FNET_SEQ_LT( FNET_C.SndNxt, avail ) && FNET_SEQ_LT( FNET_C.SndNxt, limit ) )
+	{
+		n = FNET_Data( FNET_C.SndNxt - FNET_C.Iss - 1, &p, &tag );
+		if ( n > FNET_C.Mss )
+			n = FNET_C.Mss;
+		if ( n > limit - FNET_C.SndNxt )
+			n = limit - FNET_C.SndNxt;
+		if ( !FNET_Segment( &FNET_C.Peer, FNET_ACK | ( ( FNET_C.SndNxt + n == avail ) ? FNET_PSH : 0 ),
+				FNET_C.SndNxt, FNET_C.RcvNxt, p, n, tag ) )
+			break;
+		FNET_C.SndNxt += n;
+		FNET_C.Probe = 0;
+		if ( FNET_SEQ_LT( FNET_C.SndMax, FNET_C.SndNxt ) )
+			FNET_C.SndMax = FNET_C.SndNxt;
+		if ( !FNET_C.Timing )
+		{
+			FNET_C.Timing = 1;
+			FNET_C.Sent = xTaskGetTickCount();
+		}
+	}
+
+	if ( FNET_Src == FNET_NONE && FNET_C.SndNxt == avail &&
+			FNET_Segment( &FNET_C.Peer, FNET_FIN | FNET_ACK, FNET_C.SndNxt, FNET_C.RcvNxt, NULL, 0, EMAC_NO_TAG ) )
+	{
+		++FNET_C.SndNxt;
+		if ( FNET_SEQ_LT( FNET_C.SndMax, FNET_C.SndNxt ) )
+			FNET_C.SndMax = FNET_C.SndNxt;
+		if ( !FNET_C.Timing )
+		{
+			FNET_C.Timing = 1;
+			FNET_C.Sent = xTaskGetTickCount();
+		}
+	}
+	else if ( !FNET_C.Timing && FNET_SEQ_LT( FNET_C.SndNxt, avail ) && FNET_C.SndUna == FNET_C.SndMax )
+	{	/* nothing in flight and the window is closed: the timer makes the probe */
+		FNET_C.Timing = 1;
+		FNET_C.Sent = xTaskGetTickCount();
+	}
+}
+
+/**
+ * @brief  Runs the timers of the connection
+ * @param  now: Current tick count
+ * @retval None
+ */
+static void FNET_Timer( portTickType now )
+{
+	if ( FNET_C.State == FNET_CLOSED )
+		return;
+	if ( now - FNET_C.Heard >= FNET_IDLE_TIMEOUT )
+	{
+		FNET_Close( 1 );
+		return;
+	}
+	if ( FNET_C.Answered && FNET_Src == FNET_NONE && FNET_C.SndUna == FNET_End() + 1 )
+	{	/* all acknowledged, FIN included */
+		if ( FNET_C.PeerFin || now - FNET_C.Heard >= FNET_LINGER )
+			FNET_Close( 0 );
+		return;
+	}
+	if ( !FNET_C.Timing || now - FNET_C.Sent < FNET_C.Rto )
+		return;
+	if ( ++FNET_C.Retries > FNET_RETRIES )
+	{
+		FNET_Close( 1 );
+		return;
+	}
+	FNET_C.Rto = ( FNET_C.Rto * 2 < FNET_RTO_MAX ) ? FNET_C.Rto * 2 : FNET_RTO_MAX;
+	FNET_C.Cwnd = FNET_C.Mss;
+	FNET_C.DupAcks = 0;
+	FNET_C.Probe = 1;
+	FNET_C.Sent = now;
+	if ( FNET_C.State == FNET_SYN_RCVD )
+		FNET_Segment( &FNET_C.Peer, FNET_SYN | FNET_ACK, FNET_C.Iss, FNET_C.RcvNxt, NULL, 0, EMAC_NO_TAG );
+	else
+		FNET_C.SndNxt = FNET_C.SndUna;		/* go back to the first byte not acknowledged */
+}
+
+#ifdef FNET_LISTING
+/**
+ * @brief  Appends bytes to the body in the ring (they fit)
+ * @param  s: Bytes
+ * @param  n: Number of bytes
+ * @retval None
+ */
+static void FNET_Append( const char* s, uint32_t n )
+{
+	uint32_t pos = FNET_Filled % FNET_RING;
+	uint32_t m = ( n < FNET_RING - pos ) ? n : FNET_RING - pos;
+
+	memcpy( FNET_Ring + pos, s, m );
+	memcpy( FNET_Ring, s + m, n - m );
+	FNET_Filled += n;
+}
+#endif /* FNET_LISTING */
+
+/**
+ * @brief  Frees acknowledged ring space and refills it from the source of the body:
+ *         one f_read of whole sectors straight into the ring, or listing lines
+ * @param  None
+ * @retval Nonzero if more may be put into the ring at once
+ */
+static uint8_t FNET_Fill( void )
+{
+	uint32_t acked, tag, pos, n;
+	FRESULT res;
+	UINT br;
+#ifdef FNET_LISTING
+	FILINFO fno;
+	const TCHAR* name;
+#endif /* FNET_LISTING */
+
+	if ( FNET_C.State != FNET_ESTABLISHED || FNET_Src == FNET_NONE )
+		return 0;
+	acked = FNET_C.SndUna - FNET_C.Iss - 1;
+	acked = ( acked > FNET_HeadLen ) ? acked - FNET_HeadLen : 0;
+	if ( acked > FNET_Filled )
+		acked = FNET_Filled;
+	EMAC_TxPending( &tag );
+	FNET_Freed = ( tag < acked ) ? tag : acked;
+
+	pos = FNET_Filled % FNET_RING;
+	n = FNET_RING - ( FNET_Filled - FNET_Freed );
+	if ( n > FNET_RING - pos )
+		n = FNET_RING - pos;
+
+	if ( FNET_Src == FNET_FILE )
+	{
+		n &= ~511UL;		/* the file offset stays at a sector boundary */
+		if ( n == 0 || ( n < FNET_READ_MIN && n < FNET_RING - pos && n < FNET_File.fsize - FNET_File.fptr ) )
+			return 0;
+		res = f_read( &FNET_File, FNET_Ring + pos, n, &br );
+		if ( res != FR_OK )
+		{	/* the header is gone: only a reset tells the peer */
+			FNET_Close( 1 );
+			return 0;
+		}
+		FNET_Filled += br;
+		if ( br < n )
+		{
+			f_close( &FNET_File );
+			FNET_Src = FNET_NONE;
+			return 0;
+		}
+		return 1;
+	}
+
+#ifdef FNET_LISTING
+#if _USE_LFN
+	fno.lfname = FNET_Lfn;
+	fno.lfsize = sizeof( FNET_Lfn );
+#endif /* _USE_LFN */
+	while ( FNET_RING - ( FNET_Filled - FNET_Freed ) >= FNET_LINE_MAX )
+	{
+		res = f_readdir( &FNET_Dir, &fno );
+		if ( res != FR_OK || fno.fname[ 0 ] == 0 )
+		{
+			FNET_Src = FNET_NONE;
+			break;
+		}
+		if ( fno.fname[ 0 ] == '.' )
+			continue;
+		name = fno.fname;
+#if _USE_LFN
+		if ( fno.lfname[ 0 ] )
+			name = fno.lfname;
+#endif /* _USE_LFN */
+		FNET_Append( FNET_Line, snprintf( FNET_Line, sizeof( FNET_Line ), "%10lu %s%s\r\n",
+				(unsigned long)fno.fsize, name, ( fno.fattrib & AM_DIR ) ? "/" : "" ) );
+	}
+#endif /* FNET_LISTING */
+	return 0;
+}
+
+/**
+ * @brief  Service task: starts the MAC, then serves frames, timers and the body
+ * @param  pvParameters: Not used
+ * @retval None
+ */
+static void FNET_Task( void* pvParameters )
+{
+	uint8_t* frame;
+	uint32_t len;
+	uint8_t link = 0, more = 0;
+	portTickType now, polled;
+
+	(void)pvParameters;
+	if ( EMAC_Init( FNET_Mac, FNET_Handle ) != SUCCESS )
+	{
+		printf( "Ethernet MAC doesn't start: no clock from the PHY\n" );
+		for ( ;; )
+			ulTaskNotifyTake( pdTRUE, portMAX_DELAY );		/* never notified */
+	}
+#ifdef USE_SD_IO_PRIORITY
+	SD_IO_SetTaskClass( NULL, SD_IO_INTERACTIVE, 0 );	/* the peer waits for the data */
+#endif /* USE_SD_IO_PRIORITY */
+	polled = xTaskGetTickCount() - FNET_LINK_POLL;
+	for ( ;; )
+	{
+		ulTaskNotifyTake( pdTRUE, more ? 0 : FNET_TICK );
+		now = xTaskGetTickCount();
+		if ( now - polled >= FNET_LINK_POLL )
+		{
+			polled = now;
+			if ( EMAC_Link() )
+			{
+				if ( !link )		/* announce the address (gratuitous ARP) */
+					FNET_ArpSend( FNET_Broadcast, 1, FNET_Broadcast, FNET_Addr );
+				link = 1;
+			}
+			else
+				link = 0;
+		}
+		while ( ( len = EMAC_Receive( &frame ) ) != 0 )
+		{
+			FNET_Input( frame, len );
+			EMAC_Release();
+		}
+		FNET_Timer( now );
+		FNET_Output();
+		more = FNET_Fill();
+		FNET_Output();
+	}
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Creates the service task, it starts the MAC and the PHY
+ * @param  None
+ * @retval None
+ */
+void FNET_Init( void )
+{
+	xTaskCreateStatic( FNET_Task, (const signed char* const)"NET", FNET_TASK_STACK, NULL, FNET_TASK_PRIO, &FNET_Handle, FNET_TaskStack, &FNET_TaskBuffer );
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#endif /* USE_NET_FILE_SERVICE */
@@ -0,0 +1,76 @@
+/**
+ ******************************************************************************
+ * @file    ffnet.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   File retrieval over Ethernet: files of mounted FatFs volumes are
+ *          served by HTTP/1.0 GET (and HEAD) on port FNET_PORT at the MAC and
+ *          IP address set in main.h, so any HTTP client pulls them:
+ *            curl -O http://192.168.0.20/0:/LOG/DATA.BIN
+ *          A path without a drive number refers to drive 0, a directory is
+ *          answered by a plain text listing when FatFs has f_readdir.
+ *          The service has its own minimal IPv4 stack: ARP replies, ICMP
+ *          echo and one TCP connection at a time, which is all a download
+ *          needs. Answers go to the link-layer source of the request, so the
+ *          netmask and the gateway are never looked up (DHCP isn't done).
+ *          File data are read by f_read in whole sectors straight into a
+ *          ring (FNET_BUFFER_SECTORS, storage_conf.h), the MAC sends each TCP
+ *          segment by DMA from the ring with the headers in front of it and
+ *          inserts the checksums, so the CPU never touches the data and the
+ *          next read runs while the ring drains: a download is limited by
+ *          the card, not by the 100 Mbit/s link.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef FFNET_H
+#define FFNET_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include <stdint.h>
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Constants
+ * @{
+ */
+
+/**
+ * @brief  TCP port of the service
+ */
+#ifndef FNET_PORT
+#define FNET_PORT				80
+#endif /* FNET_PORT */
+
+/**
+ * @}
+ *//* STM32_Exported_Constants */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+void FNET_Init( void );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FFNET_H */
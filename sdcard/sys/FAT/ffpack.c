@@ -0,0 +1,394 @@
+/**
+ ******************************************************************************
+ * @file    ffpack.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Compression stage in front of f_write (stream format is in ffpack.h).
+ *          LZ4 finds matches by a 256 entry hash table of 4-byte sequences
+ *          (positions inside a match are not inserted): one multiply and
+ *          one compare per byte, the chunk is small enough for 16-bit
+ *          positions. A chunk is packed into the free room of the sector,
+ *          if it doesn't fit (and wouldn't fit stored) the sector is written
+ *          and the chunk is packed again into the next one. A chunk which
+ *          doesn't get smaller is stored.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#ifdef USE_FAT_PACK
+
+#include "ffpack.h"
+#include "stm32_pool.h"
+
+#include <string.h>
+
+#if _FS_READONLY
+#error USE_FAT_PACK needs writing functions of FatFs (see ffconf.h)
+#endif
+
+#if POOL_BLOCK_SIZE < PACK_SECTOR
+#error Buffers of the packed stream are pool blocks (see stm32_pool.h)
+#endif
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  LZ4 match finder: hash table size, empty entry, shortest match,
+ *         literals at the end of a block and the last match start (LZ4 block rules)
+ */
+#define PACK_HASH_BITS			8
+#define PACK_HASH_EMPTY			0xFFFF
+#define PACK_LZ4_MINMATCH		4
+#define PACK_LZ4_LASTLITERALS	5
+#define PACK_LZ4_MFLIMIT		12
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Reads unaligned little endian word
+ */
+static uint32_t PACK_Get32( const uint8_t* p )
+{
+	return p[ 0 ] | ( p[ 1 ] << 8 ) | ( p[ 2 ] << 16 ) | ( (uint32_t)p[ 3 ] << 24 );
+}
+
+/**
+ * @brief  Size of LZ4 length field of the value above the token nibble
+ * @param  len: Length
+ * @retval Number of extra bytes
+ */
+static uint16_t PACK_Lz4LenSize( uint16_t len )
+{
+	return ( len < 15 ) ? 0 : 1 + ( len - 15 ) / 255;
+}
+
+/**
+ * @brief  Writes LZ4 extra length bytes
+ * @param  op: Output
+ * @param  len: Length (15 or more)
+ * @retval Output after the bytes
+ */
+static uint8_t* PACK_Lz4Len( uint8_t* op, uint16_t len )
+{
+	for ( len -= 15; len >= 255; len -= 255 )
+		*op++ = 255;
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+/**
+ * @brief  Writes LZ4 sequence: literals, then match if there is one
+ * @param  op: Output
+ * @param  oend: End of output room
+ * @param  lit: Literals
+ * @param  nlit: Number of literals
+ * @param  off: Match offset, 0 for the last literals of the block
+ * @param  mlen: Match length
+ * @retval Output after the sequence, NULL if it doesn't fit
+ */
+static uint8_t* PACK_Lz4Seq( uint8_t* op, const uint8_t* oend, const uint8_t* lit, uint16_t nlit, uint16_t off, uint16_t mlen )
+{
+	uint8_t* token = op;
+	uint16_t ml = ( off != 0 ) ? mlen - PACK_LZ4_MINMATCH : 0;
+
+	if ( 1 + PACK_Lz4LenSize( nlit ) + nlit + ( ( off != 0 ) ? 2 + PACK_Lz4LenSize( ml ) : 0 ) > oend - op )
+		return NULL;
+	*op++ = (uint8_t)( ( ( nlit < 15 ) ? nlit : 15 ) << 4 );
+	if ( nlit >= 15 )
+		op = PACK_Lz4Len( op, nlit );
+	memcpy( op, lit, nlit );
+	op += nlit;
+	if ( off == 0 )
+		return op;
+	*op++ = (uint8_t)off;
+	*op++ = (uint8_t)( off >> 8 );
+	*token |= ( ml < 15 ) ? ml : 15;
+	if ( ml >= 15 )
+		op = PACK_Lz4Len( op, ml );
+	return op;
+}
+
+/**
+ * @brief  Compresses the chunk into LZ4 block
+ * @param  ps: Packed stream
+ * @param  dst: Output
+ * @param  cap: Output room
+ * @retval Packed length, 0 if it doesn't fit
+ */
+static uint16_t PACK_Lz4( PACK_Stream* ps, uint8_t* dst, uint16_t cap )
+{
+	const uint8_t* src = ps->In;
+	const uint8_t* ip = src;
+	const uint8_t* anchor = src;
+	const uint8_t* end = src + ps->InLen;
+	const uint8_t* oend = dst + cap;
+	uint8_t* op = dst;
+	uint32_t seq;
+	uint16_t h, ref, mlen;
+
+	memset( ps->Hash, 0xFF, sizeof( uint16_t ) << PACK_HASH_BITS );
+	while ( ps->InLen > PACK_LZ4_MFLIMIT && ip <= end - PACK_LZ4_MFLIMIT )
+	{
+		seq = PACK_Get32( ip );
+		h = (uint16_t)( ( seq * 2654435761U ) >> ( 32 - PACK_HASH_BITS ) );
+		ref = ps->Hash[ h ];
+		ps->Hash[ h ] = (uint16_t)( ip - src );
+		if ( ref == PACK_HASH_EMPTY || PACK_Get32( src + ref ) != seq )
+		{
+			++ip;
+			continue;
+		}
+		/* the match ends before the last literals */
+		for ( mlen = PACK_LZ4_MINMATCH; ip + mlen < end - PACK_LZ4_LASTLITERALS && ip[ mlen ] == src[ ref + mlen ]; ++mlen ) ;
+		op = PACK_Lz4Seq( op, oend, anchor, (uint16_t)( ip - anchor ), (uint16_t)( ip - src - ref ), mlen );
+		if ( op == NULL )
+			return 0;
+		ip += mlen;
+		anchor = ip;
+	}
+	op = PACK_Lz4Seq( op, oend, anchor, (uint16_t)( end - anchor ), 0, 0 );
+	return ( op != NULL ) ? (uint16_t)( op - dst ) : 0;
+}
+
+/**
+ * @brief  Codes differences of 32-bit samples of the chunk as zigzag varints
+ * @param  ps: Packed stream
+ * @param  dst: Output
+ * @param  cap: Output room
+ * @retval Packed length, 0 if it doesn't fit
+ */
+static uint16_t PACK_Delta( PACK_Stream* ps, uint8_t* dst, uint16_t cap )
+{
+	uint32_t prev = 0, v, z;
+	uint16_t i, n = 0;
+
+	for ( i = 0; i + 4 <= ps->InLen; i += 4 )
+	{
+		v = PACK_Get32( ps->In + i );
+		z = v - prev;
+		z = ( z << 1 ) ^ (uint32_t)( (int32_t)z >> 31 );
+		prev = v;
+		for ( ; z >= 0x80; z >>= 7 )
+		{
+			if ( n == cap )
+				return 0;
+			dst[ n++ ] = (uint8_t)( z | 0x80 );
+		}
+		if ( n == cap )
+			return 0;
+		dst[ n++ ] = (uint8_t)z;
+	}
+	return n;
+}
+
+/**
+ * @brief  Pads the sector and writes it to the file
+ * @param  ps: Packed stream
+ * @retval FatFs result
+ */
+static FRESULT PACK_WriteSector( PACK_Stream* ps )
+{
+	FRESULT res;
+	UINT bw;
+
+	memset( ps->Out + ps->OutLen, 0, PACK_SECTOR - ps->OutLen );
+	res = f_write( ps->File, ps->Out, PACK_SECTOR, &bw );
+	if ( res == FR_OK && bw != PACK_SECTOR )
+		res = FR_DENIED;		/* volume is full */
+	if ( res == FR_OK )
+	{
+		ps->OutLen = 0;
+		ps->Sectors++;
+	}
+	return res;
+}
+
+/**
+ * @brief  Packs the collected chunk into the sector, the full sector is written first
+ * @param  ps: Packed stream
+ * @retval FatFs result
+ */
+static FRESULT PACK_Chunk( PACK_Stream* ps )
+{
+	FRESULT res;
+	uint8_t* p;
+	uint16_t room, n;
+	uint8_t codec;
+
+	for ( ;; )
+	{
+		room = PACK_SECTOR - ps->OutLen;
+		if ( room > PACK_HEADER )
+		{
+			room -= PACK_HEADER;
+			p = ps->Out + ps->OutLen + PACK_HEADER;
+			codec = ps->Codec;
+			n = ( codec == PACK_LZ4 ) ? PACK_Lz4( ps, p, ( room < ps->InLen ) ? room : ps->InLen - 1 )
+									  : PACK_Delta( ps, p, ( room < ps->InLen ) ? room : ps->InLen - 1 );
+			if ( n == 0 && ps->InLen <= room )
+			{
+				memcpy( p, ps->In, ps->InLen );
+				n = ps->InLen;
+				codec = PACK_STORED;
+			}
+			if ( n != 0 )
+				break;
+		}
+		res = PACK_WriteSector( ps );
+		if ( res != FR_OK )
+			return res;
+	}
+
+	p -= PACK_HEADER;
+	p[ 0 ] = (uint8_t)n;
+	p[ 1 ] = (uint8_t)( n >> 8 );
+	p[ 2 ] = (uint8_t)ps->InLen;
+	p[ 3 ] = (uint8_t)( ( ps->InLen >> 8 ) | ( codec << 6 ) );
+	ps->OutLen += PACK_HEADER + n;
+	ps->InLen = 0;
+	return FR_OK;
+}
+
+/**
+ * @brief  Returns the pool blocks of the stream
+ * @param  ps: Packed stream
+ * @retval None
+ */
+static void PACK_Free( PACK_Stream* ps )
+{
+	if ( ps->In != NULL )
+		POOL_Free( ps->In );
+	if ( ps->Out != NULL )
+		POOL_Free( ps->Out );
+	if ( ps->Hash != NULL )
+		POOL_Free( ps->Hash );
+	ps->In = ps->Out = NULL;
+	ps->Hash = NULL;
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Starts packed stream into the open file, working memory is taken from the pool
+ * @param  ps: Packed stream object
+ * @param  file: File open for writing, positioned at a sector boundary (e.g. new file)
+ * @param  codec: PACK_LZ4 or PACK_DELTA (writes of whole 32-bit samples)
+ * @retval FatFs result:
+ *         - FR_NOT_ENOUGH_CORE: Pool has no free blocks
+ */
+FRESULT PACK_Open( PACK_Stream* ps, FIL* file, uint8_t codec )
+{
+	memset( ps, 0, sizeof( *ps ) );
+	if ( ( codec != PACK_LZ4 && codec != PACK_DELTA ) || file->fptr % PACK_SECTOR != 0 )
+		return FR_INVALID_PARAMETER;
+	ps->File = file;
+	ps->Codec = codec;
+	ps->In = POOL_Alloc();
+	ps->Out = POOL_Alloc();
+	if ( codec == PACK_LZ4 )
+		ps->Hash = POOL_Alloc();
+	if ( ps->In == NULL || ps->Out == NULL || ( codec == PACK_LZ4 && ps->Hash == NULL ) )
+	{
+		PACK_Free( ps );
+		return FR_NOT_ENOUGH_CORE;
+	}
+	return FR_OK;
+}
+
+/**
+ * @brief  Writes data to the stream, full sectors go to the file
+ * @param  ps: Packed stream object
+ * @param  data: Data
+ * @param  len: Number of bytes (multiple of 4 for PACK_DELTA)
+ * @retval FatFs result
+ */
+FRESULT PACK_Write( PACK_Stream* ps, const void* data, uint32_t len )
+{
+	const uint8_t* p = (const uint8_t*)data;
+	FRESULT res;
+	uint32_t n;
+
+	if ( ps->In == NULL || ( ps->Codec == PACK_DELTA && len % 4 != 0 ) )
+		return FR_INVALID_PARAMETER;
+	while ( len > 0 )
+	{
+		n = PACK_CHUNK - ps->InLen;
+		if ( n > len )
+			n = len;
+		memcpy( ps->In + ps->InLen, p, n );
+		ps->InLen += n;
+		ps->Raw += n;
+		p += n;
+		len -= n;
+		if ( ps->InLen == PACK_CHUNK )
+		{
+			res = PACK_Chunk( ps );
+			if ( res != FR_OK )
+				return res;
+		}
+	}
+	return FR_OK;
+}
+
+/**
+ * @brief  Packs the collected data and writes the partly filled sector (padded), call
+ *         f_sync after it to make the data durable
+ * @param  ps: Packed stream object
+ * @retval FatFs result
+ */
+FRESULT PACK_Flush( PACK_Stream* ps )
+{
+	FRESULT res = FR_OK;
+
+	if ( ps->InLen > 0 )
+		res = PACK_Chunk( ps );
+	if ( res == FR_OK && ps->OutLen > 0 )
+		res = PACK_WriteSector( ps );
+	return res;
+}
+
+/**
+ * @brief  Flushes the stream and returns its working memory (the file stays open)
+ * @param  ps: Packed stream object
+ * @retval FatFs result
+ */
+FRESULT PACK_Close( PACK_Stream* ps )
+{
+	FRESULT res = PACK_Flush( ps );
+
+	PACK_Free( ps );
+	return res;
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#endif /* USE_FAT_PACK */
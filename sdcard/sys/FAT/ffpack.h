@@ -0,0 +1,112 @@
+/**
+ ******************************************************************************
+ * @file    ffpack.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Compression stage in front of f_write for log data.
+ *          Written data are collected into chunks of PACK_CHUNK bytes, each
+ *          chunk is compressed (LZ4 block format, or delta + varint of
+ *          32-bit samples) and the packed chunks are laid into sector
+ *          buffers which go to f_write whole, so the card gets only full
+ *          aligned sectors and several samples' worth of data per sector.
+ *          A sector holds whole chunks only, each of them decodes on its
+ *          own (delta starts from 0), so a damaged sector loses only its
+ *          own data (host side is tools/pack_decode.py).
+ *
+ *          Chunk (all fields are little endian):
+ *            0: packed length (16 bits), 0 marks padding up to the sector end
+ *            2: raw length (bits 0..13) and codec (bits 14..15, PACK_*)
+ *            4: packed data
+ *          Working memory is 2 blocks of the pool (3 with LZ4: hash table).
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef FFPACK_H
+#define FFPACK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "ff.h"
+
+#include <stdint.h>
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Constants
+ * @{
+ */
+
+/**
+ * @brief  Codecs of chunks
+ */
+#define PACK_STORED				0	/* Chunk didn't compress, data as written */
+#define PACK_LZ4				1	/* LZ4 block of any data */
+#define PACK_DELTA				2	/* Differences of 32-bit samples, zigzag varint coded */
+
+/**
+ * @brief  Sector of the packed stream, size of chunk header and raw data of a chunk
+ *         (a stored chunk fits into an empty sector)
+ */
+#define PACK_SECTOR				512
+#define PACK_HEADER				4
+#define PACK_CHUNK				( PACK_SECTOR - PACK_HEADER - 4 )
+
+/**
+ * @}
+ *//* STM32_Exported_Constants */
+
+/** @defgroup STM32_Exported_Types
+ * @{
+ */
+
+/**
+ * @brief  Packed stream object
+ */
+typedef struct
+{
+	FIL*		File;			/*!< Open file, its position is sector aligned */
+	uint8_t		Codec;			/*!< PACK_LZ4 or PACK_DELTA */
+	uint8_t*	In;				/*!< Raw data of the chunk being collected (pool block) */
+	uint16_t	InLen;
+	uint8_t*	Out;			/*!< Sector being filled with packed chunks (pool block) */
+	uint16_t	OutLen;
+	uint16_t*	Hash;			/*!< LZ4 match finder: last position of each hash (pool block) */
+	uint32_t	Raw;			/*!< Bytes written to the stream */
+	uint32_t	Sectors;		/*!< Sectors written to the file */
+} PACK_Stream;
+
+/**
+ * @}
+ *//* STM32_Exported_Types */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+FRESULT PACK_Open( PACK_Stream* ps, FIL* file, uint8_t codec );
+FRESULT PACK_Write( PACK_Stream* ps, const void* data, uint32_t len );
+FRESULT PACK_Flush( PACK_Stream* ps );
+FRESULT PACK_Close( PACK_Stream* ps );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FFPACK_H */
@@ -0,0 +1,209 @@
+/**
+ ******************************************************************************
+ * @file    ffremap.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Bad block remap table in a contiguous FatFs file: REMAP_Open
+ *          loads the table from the file (or creates the file) and attaches
+ *          it to the drive of the volume, diskio.c takes spare blocks and
+ *          stores the table from then on. Sectors read while mounting the
+ *          volume, before the table is attached, come from their original
+ *          blocks. FatFs must not access the file while the table is attached.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#ifdef USE_DISK_REMAP
+
+#include "ffremap.h"
+#include "diskio.h"
+
+#include <string.h>
+
+#if !_USE_EXPAND || _FS_MINIMIZE > 2 || _FS_READONLY
+#error USE_DISK_REMAP needs f_expand, f_lseek and writing functions of FatFs (see ffconf.h)
+#endif
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  Marker of remap tables ("RMAP")
+ */
+#define REMAP_TABLE_MAGIC		0x50414D52
+
+/**
+ * @brief  Size of the table and of spare blocks (card blocks)
+ */
+#define REMAP_BLOCK				sizeof( REMAP_Table )
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Drop copies of the file sectors held by FatFs and diskio: the table is written
+ *         around FatFs, so later reads through FatFs have to get it from the card
+ * @param  remap: Remap file object
+ * @retval None
+ */
+static void REMAP_DropCache( REMAP_File* remap )
+{
+	DWORD first = remap->Table.Base / DISK_BLOCKS;
+
+	f_invalidate( remap->Drv, first, ( remap->Table.Base + 2 + remap->Table.Spares - 1 ) / DISK_BLOCKS - first + 1 );
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Calculates check word of the table (diskio.c stores the table too)
+ * @param  table: Remap table
+ * @retval Check word
+ */
+uint32_t REMAP_Check( const REMAP_Table* table )
+{
+	const uint32_t* word = (const uint32_t*)table;
+	uint32_t check = 0;
+	uint32_t i;
+
+	for ( i = 0; i < sizeof( REMAP_Table ) / 4 - 1; ++i )
+		check ^= word[ i ];
+	return ~check;
+}
+
+/**
+ * @brief  Open the remap file of the volume and attach its table to the drive, create
+ *         the file if it doesn't exist. Existing file keeps its spare blocks and the spare
+ *         blocks taken so far, stored in the newer table copy.
+ * @param  remap: Remap file object
+ * @param  path: File name
+ * @param  spares: Number of spare blocks of the new file (1 .. REMAP_MAX), ignored if the file exists
+ * @retval FatFs result:
+ *         - FR_DENIED: No contiguous block for the new file or the file is not a remap table
+ *         - FR_INVALID_PARAMETER: The drive doesn't remap blocks (RAID)
+ */
+FRESULT REMAP_Open( REMAP_File* remap, const TCHAR* path, uint32_t spares )
+{
+	REMAP_Table* table = &remap->Table;
+	FRESULT res;
+	FIL file;
+	UINT n;
+	uint32_t seq = 0, i;
+	uint8_t valid = 0, pick = 0;
+
+	res = f_open( &file, path, FA_READ | FA_WRITE | FA_OPEN_ALWAYS );
+	if ( res != FR_OK )
+		return res;
+	remap->Drv = file.fs->drv;
+	disk_ioctl( remap->Drv, CTRL_REMAP, NULL );		/* the table is read as it is on the card */
+	memset( table, 0, sizeof( REMAP_Table ) );
+
+	if ( file.fsize == 0 )
+	{	/* new file: contiguous block and two empty tables */
+		if ( spares == 0 || spares > REMAP_MAX )
+			res = FR_INVALID_PARAMETER;
+		if ( res == FR_OK )
+			res = f_expand( &file, ( 2 + spares ) * REMAP_BLOCK, 1 );
+		if ( res == FR_OK )
+			res = f_lseek( &file, ( 2 + spares ) * REMAP_BLOCK );
+		if ( res == FR_OK && file.fsize != ( 2 + spares ) * REMAP_BLOCK )
+			res = FR_DENIED;
+		table->Spares = spares;
+		for ( i = 0; i < 2 && res == FR_OK; ++i )
+		{
+			table->Magic = REMAP_TABLE_MAGIC;
+			table->Seq++;
+			table->Check = REMAP_Check( table );
+			res = f_lseek( &file, ( table->Seq & 1 ) * REMAP_BLOCK );
+			if ( res == FR_OK )
+				res = f_write( &file, table, REMAP_BLOCK, &n );
+			if ( res == FR_OK && n != REMAP_BLOCK )
+				res = FR_DENIED;
+		}
+	}
+	else
+	{	/* existing file: the newer intact table copy */
+		spares = file.fsize / REMAP_BLOCK - 2;
+		for ( i = 0; i < 2 && res == FR_OK; ++i )
+		{
+			res = f_lseek( &file, i * REMAP_BLOCK );
+			if ( res == FR_OK )
+				res = f_read( &file, table, REMAP_BLOCK, &n );
+			if ( res == FR_OK && n == REMAP_BLOCK && table->Magic == REMAP_TABLE_MAGIC &&
+					table->Check == REMAP_Check( table ) && table->Spares == spares && table->Used <= spares &&
+					( !valid || (int32_t)( table->Seq - seq ) > 0 ) )
+			{
+				seq = table->Seq;
+				pick = i;
+				valid = 1;
+			}
+		}
+		if ( res == FR_OK && !valid )
+			res = FR_DENIED;
+		if ( res == FR_OK && pick == 0 )
+		{	/* the second copy was read last: read the first one again */
+			res = f_lseek( &file, 0 );
+			if ( res == FR_OK )
+				res = f_read( &file, table, REMAP_BLOCK, &n );
+			if ( res == FR_OK && ( n != REMAP_BLOCK || table->Seq != seq ) )
+				res = FR_DENIED;
+		}
+	}
+	table->Base = clust2sect( file.fs, file.sclust ) * DISK_BLOCKS;
+	if ( res == FR_OK && table->Base == 0 )
+		res = FR_DENIED;
+
+	/* directory entry is final from now on, the table goes around FatFs */
+	if ( res == FR_OK )
+		res = f_close( &file );
+	else
+		f_close( &file );
+	if ( res == FR_OK )
+	{
+		REMAP_DropCache( remap );
+		if ( disk_ioctl( remap->Drv, CTRL_REMAP, table ) != RES_OK )
+			res = FR_INVALID_PARAMETER;
+	}
+	return res;
+}
+
+/**
+ * @brief  Detach the table from the drive (the table is stored already)
+ * @param  remap: Remap file object
+ * @retval FatFs result
+ */
+FRESULT REMAP_Close( REMAP_File* remap )
+{
+	return ( disk_ioctl( remap->Drv, CTRL_REMAP, NULL ) == RES_OK ) ? FR_OK : FR_INVALID_PARAMETER;
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#endif /* USE_DISK_REMAP */
@@ -0,0 +1,99 @@
+/**
+ ******************************************************************************
+ * @file    ffremap.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Bad block remap table in a contiguous FatFs file.
+ *          The file is preallocated once through FatFs: card blocks 0 and 1
+ *          hold two copies of the table (see REMAP_Table), blocks from 2 on
+ *          are spare blocks. SD drive of diskio.c sends transfers of
+ *          remapped card blocks to their spare blocks; a block which fails
+ *          to be written (or verified, see USE_DISK_VERIFY) while the card
+ *          still responds takes the next spare block and the table is
+ *          rewritten alternately into both copies.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef FFREMAP_H
+#define FFREMAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "ff.h"
+
+#include <stdint.h>
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Types
+ * @{
+ */
+
+/**
+ * @brief  Number of spare blocks a table holds
+ */
+#define REMAP_MAX				120
+
+/**
+ * @brief  Entry of a spare block which failed itself (it replaces nothing)
+ */
+#define REMAP_BAD				0xFFFFFFFF
+
+/**
+ * @brief  Remap table, occupies one card block (all fields are little endian)
+ */
+typedef struct
+{
+	uint32_t	Magic;				/*!< REMAP_TABLE_MAGIC */
+	uint32_t	Seq;				/*!< Incremented on each table write, the newer copy wins */
+	uint32_t	Base;				/*!< Card block of the first table copy (set by REMAP_Open) */
+	uint32_t	Spares;				/*!< Number of spare blocks (up to REMAP_MAX) */
+	uint32_t	Used;				/*!< Number of spare blocks taken */
+	uint32_t	From[ REMAP_MAX ];	/*!< Card block replaced by spare block i (the last entry of a block wins) */
+	uint8_t		Reserved[ 512 - 24 - 4 * REMAP_MAX ];
+	uint32_t	Check;				/*!< Inverted XOR of the words above (at the end: torn write is detected) */
+} REMAP_Table;
+
+/**
+ * @brief  Remap file object
+ */
+typedef struct
+{
+	uint8_t			Drv;			/*!< Physical drive the table is attached to */
+	REMAP_Table		Table;			/*!< Table, used by diskio while it is attached */
+} REMAP_File;
+
+/**
+ * @}
+ *//* STM32_Exported_Types */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+FRESULT REMAP_Open( REMAP_File* remap, const TCHAR* path, uint32_t spares );
+FRESULT REMAP_Close( REMAP_File* remap );
+uint32_t REMAP_Check( const REMAP_Table* table );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FFREMAP_H */
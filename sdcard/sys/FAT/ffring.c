@@ -0,0 +1,378 @@
+/**
+ ******************************************************************************
+ * @file    ffring.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Raw ring buffer storage in a contiguous FatFs file.
+ *          Data writes are submitted to SD I/O task and complete in the
+ *          background: the buffer passed to RING_Write has to stay valid
+ *          until the next RING_Write/RING_Wait/RING_Sync call returns, so
+ *          two buffers filled alternately keep the card busy all the time.
+ *          The header is rewritten every RING_SYNC_SECTORS data sectors and
+ *          on RING_Sync, alternately into both copies.
+ *          The sectors of the file are claimed in SD I/O while the ring is
+ *          open: FatFs may read the file (its copies are dropped on each
+ *          RING_Sync), writes to it from elsewhere fail.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#ifdef USE_FAT_RING
+
+#include "ffring.h"
+#include "diskio.h"
+
+#include <string.h>
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#if !_USE_EXPAND || _FS_MINIMIZE > 2 || _FS_READONLY
+#error USE_FAT_RING needs f_expand, f_lseek and writing functions of FatFs (see ffconf.h)
+#endif
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  Marker of ring headers ("RING")
+ */
+#define RING_HEADER_MAGIC		0x474E4952
+
+/**
+ * @brief  Header is rewritten after this number of data sectors (1 Mb),
+ *         it is the most data lost on power failure without RING_Sync
+ */
+#define RING_SYNC_SECTORS		2048
+
+/**
+ * @brief  Requests of the ring object
+ */
+#define RING_REQ_DATA			0
+#define RING_REQ_WRAP			1
+#define RING_REQ_HEADER			2
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Calculates check word of the header
+ * @param  hdr: Header
+ * @retval Check word
+ */
+static uint32_t RING_HeaderCheck( const RING_Header* hdr )
+{
+	return ~( hdr->Magic ^ hdr->Seq ^ hdr->Capacity ^ hdr->Total );
+}
+
+/**
+ * @brief  Check if the header is intact
+ * @param  hdr: Header
+ * @retval Nonzero if header is valid
+ */
+static uint8_t RING_HeaderValid( const RING_Header* hdr )
+{
+	return ( hdr->Magic == RING_HEADER_MAGIC && hdr->Check == RING_HeaderCheck( hdr ) );
+}
+
+/**
+ * @brief  Fill header buffer with the current state
+ * @param  ring: Ring file object
+ * @retval None
+ */
+static void RING_HeaderFill( RING_File* ring )
+{
+	ring->Header.Magic = RING_HEADER_MAGIC;
+	ring->Header.Seq++;
+	ring->Header.Capacity = ring->Capacity;
+	ring->Header.Total = ring->Total;
+	ring->Header.Check = RING_HeaderCheck( &ring->Header );
+}
+
+/**
+ * @brief  Pass request to SD I/O task, wait for free place in the queue if it is full
+ * @param  ring: Ring file object
+ * @param  req: Request of the ring
+ * @param  sector: First sector number
+ * @param  count: Number of sectors
+ * @param  buf: Data buffer
+ * @retval None
+ */
+static void RING_Submit( RING_File* ring, SD_IO_Request* req, uint32_t sector, uint32_t count, const void* buf )
+{
+	req->Op = SD_IO_WRITE;
+	req->Sector = sector;
+	req->Count = count;
+	req->Buffer = (void*)buf;
+	while ( SD_IO_Submit( req ) != SD_RESPONSE_NO_ERROR )
+		vTaskDelay( 1 );
+	ring->Busy |= 1 << ( req - ring->Req );
+}
+
+/**
+ * @brief  Drop copies of the ring sectors held by FatFs and diskio: they are written
+ *         around FatFs, so later reads through FatFs have to get them from the card
+ * @param  ring: Ring file object
+ * @retval None
+ */
+static void RING_DropCache( RING_File* ring )
+{
+	DWORD first = ring->Base / DISK_BLOCKS;
+
+	f_invalidate( ring->Drv, first, ( ring->Base + 2 + ring->Capacity - 1 ) / DISK_BLOCKS - first + 1 );
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Open the ring file, create it if it doesn't exist. Existing ring keeps its size,
+ *         writing continues after the data stored in the newer header copy.
+ * @param  ring: Ring file object
+ * @param  path: File name
+ * @param  size: Size of the new file in bytes (rounded down to sectors, at least 3 sectors),
+ *         ignored if the file exists
+ * @retval FatFs result:
+ *         - FR_DENIED: No contiguous block for the new file, the file is not a ring
+ *           or its sectors are claimed by another raw user
+ */
+FRESULT RING_Open( RING_File* ring, const TCHAR* path, uint32_t size )
+{
+	FRESULT res;
+	FIL file;
+	UINT n;
+	uint32_t seq = 0, total = 0;
+	uint8_t i, valid = 0;
+
+	SD_IO_Release( &ring->Region );		/* opened again without RING_Close */
+	for ( i = 0; i < 3; ++i )
+	{
+		if ( ring->Req[ i ].Done == NULL )
+			SD_IO_RequestInit( &ring->Req[ i ] );
+		ring->Req[ i ].Region = &ring->Region;
+	}
+	ring->Busy = 0;
+	memset( &ring->Header, 0, sizeof( ring->Header ) );
+	size -= size % sizeof( RING_Header );
+
+	res = f_open( &file, path, FA_READ | FA_WRITE | FA_OPEN_ALWAYS );
+	if ( res != FR_OK )
+		return res;
+	if ( file.fsize == 0 )
+	{	/* new ring: contiguous block and two empty headers */
+		if ( size < 3 * sizeof( RING_Header ) )
+			res = FR_INVALID_PARAMETER;
+		if ( res == FR_OK )		/* at an AU of the card if there is room for it */
+			res = f_expand( &file, size, 3 );
+		if ( res == FR_DENIED )
+			res = f_expand( &file, size, 1 );
+		if ( res == FR_OK )
+			res = f_lseek( &file, size );
+		if ( res == FR_OK && file.fsize != size )
+			res = FR_DENIED;
+		ring->Capacity = size / sizeof( RING_Header ) - 2;
+		ring->Total = 0;
+		for ( i = 0; i < 2 && res == FR_OK; ++i )
+		{
+			RING_HeaderFill( ring );
+			res = f_lseek( &file, ( ring->Header.Seq & 1 ) * sizeof( RING_Header ) );
+			if ( res == FR_OK )
+				res = f_write( &file, &ring->Header, sizeof( RING_Header ), &n );
+			if ( res == FR_OK && n != sizeof( RING_Header ) )
+				res = FR_DENIED;
+		}
+	}
+	else
+	{	/* existing ring: the newer intact header copy */
+		ring->Capacity = file.fsize / sizeof( RING_Header ) - 2;
+		for ( i = 0; i < 2 && res == FR_OK; ++i )
+		{
+			res = f_lseek( &file, i * sizeof( RING_Header ) );
+			if ( res == FR_OK )
+				res = f_read( &file, &ring->Header, sizeof( RING_Header ), &n );
+			if ( res == FR_OK && n == sizeof( RING_Header ) && RING_HeaderValid( &ring->Header ) &&
+					ring->Header.Capacity == ring->Capacity &&
+					( !valid || (int32_t)( ring->Header.Seq - seq ) > 0 ) )
+			{
+				seq = ring->Header.Seq;
+				total = ring->Header.Total;
+				valid = 1;
+			}
+		}
+		if ( res == FR_OK && !valid )
+			res = FR_DENIED;
+		ring->Header.Seq = seq;
+		ring->Total = total;
+	}
+	ring->Synced = ring->Total;
+	ring->Base = clust2sect( file.fs, file.sclust ) * DISK_BLOCKS;
+	ring->Drv = file.fs->drv;
+	if ( res == FR_OK && ring->Base == 0 )
+		res = FR_DENIED;
+
+	/* directory entry is final from now on (f_close has flushed the headers), data go around FatFs */
+	if ( res == FR_OK )
+		res = f_close( &file );
+	else
+		f_close( &file );
+	if ( res == FR_OK && SD_IO_Claim( &ring->Region, ring->Base, 2 + ring->Capacity ) != SD_RESPONSE_NO_ERROR )
+		res = FR_DENIED;
+	if ( res == FR_OK )
+		RING_DropCache( ring );
+	return res;
+}
+
+/**
+ * @brief  Submit data sectors to the ring (previous write is completed first)
+ * @param  ring: Ring file object
+ * @param  buf: Data, has to stay valid until the next call of ring functions returns
+ * @param  count: Number of sectors (up to Capacity)
+ * @retval FatFs result (of the previous write)
+ */
+FRESULT RING_Write( RING_File* ring, const void* buf, uint32_t count )
+{
+	FRESULT res;
+	uint32_t pos, n;
+
+	if ( count == 0 || count > ring->Capacity )
+		return FR_INVALID_PARAMETER;
+	res = RING_Wait( ring );
+	if ( res != FR_OK )
+		return res;
+
+	/* header covers only the data written already (and is rewritten at once if the ring
+	   went behind it by RING_Discard: the difference wraps around) */
+	if ( ring->Total - ring->Synced >= RING_SYNC_SECTORS )
+	{
+		RING_HeaderFill( ring );
+		RING_Submit( ring, &ring->Req[ RING_REQ_HEADER ], ring->Base + ( ring->Header.Seq & 1 ), 1, &ring->Header );
+		ring->Synced = ring->Total;
+	}
+
+	pos = ring->Total % ring->Capacity;
+	n = ring->Capacity - pos;
+	if ( n > count )
+		n = count;
+	RING_Submit( ring, &ring->Req[ RING_REQ_DATA ], ring->Base + 2 + pos, n, buf );
+	if ( n < count )
+		RING_Submit( ring, &ring->Req[ RING_REQ_WRAP ], ring->Base + 2, count - n, (const uint8_t*)buf + n * sizeof( RING_Header ) );
+	ring->Total += count;
+	return FR_OK;
+}
+
+/**
+ * @brief  Take back the last submitted sectors (e.g. an incomplete record), the next
+ *         RING_Write overwrites them. If a stored header counts them already, the ring
+ *         is behind it now, so the next RING_Write or RING_Sync rewrites the header.
+ *         After a wrap the sectors keep the discarded data instead of the oldest ones.
+ * @param  ring: Ring file object
+ * @param  count: Number of sectors (up to Total and Capacity)
+ * @retval FatFs result
+ */
+FRESULT RING_Discard( RING_File* ring, uint32_t count )
+{
+	if ( count > ring->Total || count > ring->Capacity )
+		return FR_INVALID_PARAMETER;
+	ring->Total -= count;
+	return FR_OK;
+}
+
+/**
+ * @brief  Wait for completion of submitted writes
+ * @param  ring: Ring file object
+ * @retval FatFs result
+ */
+FRESULT RING_Wait( RING_File* ring )
+{
+	FRESULT res = FR_OK;
+	uint8_t i;
+
+	for ( i = 0; i < 3; ++i )
+	{
+		if ( ( ring->Busy & ( 1 << i ) ) &&
+				SD_IO_Wait( &ring->Req[ i ], portMAX_DELAY ) != SD_RESPONSE_NO_ERROR )
+			res = FR_DISK_ERR;
+	}
+	ring->Busy = 0;
+	return res;
+}
+
+/**
+ * @brief  Make written data durable: wait for data, flush the card, then store the header
+ * @param  ring: Ring file object
+ * @retval FatFs result
+ */
+FRESULT RING_Sync( RING_File* ring )
+{
+	SD_IO_Request* req = &ring->Req[ RING_REQ_HEADER ];
+	FRESULT res;
+
+	res = RING_Wait( ring );
+	if ( res != FR_OK || ring->Total == ring->Synced )
+		return res;
+
+	req->Op = SD_IO_SYNC;
+	if ( SD_IO_Execute( req ) != SD_RESPONSE_NO_ERROR )
+		return FR_DISK_ERR;
+
+	RING_HeaderFill( ring );
+	req->Op = SD_IO_WRITE;
+	req->Sector = ring->Base + ( ring->Header.Seq & 1 );
+	req->Count = 1;
+	req->Buffer = &ring->Header;
+	if ( SD_IO_Execute( req ) != SD_RESPONSE_NO_ERROR )
+		return FR_DISK_ERR;
+	ring->Synced = ring->Total;
+
+	RING_DropCache( ring );
+	req->Op = SD_IO_SYNC;
+	return ( SD_IO_Execute( req ) == SD_RESPONSE_NO_ERROR ) ? FR_OK : FR_DISK_ERR;
+}
+
+/**
+ * @brief  Close the ring: finish writes, store the header and release the sectors
+ *         (the file is closed already)
+ * @param  ring: Ring file object
+ * @retval FatFs result (of RING_Sync)
+ */
+FRESULT RING_Close( RING_File* ring )
+{
+	FRESULT res;
+
+	res = RING_Sync( ring );
+	if ( res != FR_OK )
+		RING_Wait( ring );
+	SD_IO_Release( &ring->Region );
+	return res;
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#endif /* USE_FAT_RING */
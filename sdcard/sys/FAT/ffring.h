@@ -0,0 +1,100 @@
+/**
+ ******************************************************************************
+ * @file    ffring.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Raw ring buffer storage in a contiguous FatFs file.
+ *          The file is preallocated once through FatFs, then data sectors
+ *          are written directly by SD I/O requests (streaming sessions of
+ *          the SD Card driver), so high rate capture doesn't pass through
+ *          FatFs at all. The file stays an ordinary file readable on a PC:
+ *          sectors 0 and 1 hold two copies of the header (see RING_Header),
+ *          sectors from 2 on hold the data ring. If Total <= Capacity the
+ *          data are data sectors 0 .. Total - 1, otherwise the oldest data
+ *          sector is Total % Capacity and the data wraps around.
+ *          SD I/O refuses writes to the file by others until RING_Close.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef FFRING_H
+#define FFRING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "ff.h"
+#include "stm32_sd_io.h"
+
+#include <stdint.h>
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Types
+ * @{
+ */
+
+/**
+ * @brief  Ring header, occupies one sector (all fields are little endian)
+ */
+typedef struct
+{
+	uint32_t	Magic;				/*!< RING_HEADER_MAGIC */
+	uint32_t	Seq;				/*!< Incremented on each header write, the newer copy wins */
+	uint32_t	Capacity;			/*!< Number of data sectors */
+	uint32_t	Total;				/*!< Number of data sectors written since the ring was created */
+	uint8_t		Reserved[ 512 - 20 ];
+	uint32_t	Check;				/*!< Inverted XOR of the words above (at the end: torn write is detected) */
+} RING_Header;
+
+/**
+ * @brief  Ring file object, zero it before the first RING_Open (requests are created once)
+ */
+typedef struct
+{
+	uint32_t		Base;			/*!< Card block of the first header copy (sectors of the ring are card blocks) */
+	uint8_t			Drv;			/*!< Physical drive of the file (its cached sectors are dropped) */
+	uint32_t		Capacity;		/*!< Number of data sectors */
+	uint32_t		Total;			/*!< Number of data sectors submitted */
+	uint32_t		Synced;			/*!< Total stored in the last written header */
+	uint8_t			Busy;			/*!< Number of submitted requests (data parts and header) */
+	SD_IO_Request	Req[ 3 ];		/*!< Requests: data before wrap, data after wrap, header */
+	SD_IO_Region	Region;			/*!< Sectors of the file, claimed while the ring is open */
+	RING_Header		Header;			/*!< Header buffer */
+} RING_File;
+
+/**
+ * @}
+ *//* STM32_Exported_Types */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+FRESULT RING_Open( RING_File* ring, const TCHAR* path, uint32_t size );
+FRESULT RING_Write( RING_File* ring, const void* buf, uint32_t count );
+FRESULT RING_Discard( RING_File* ring, uint32_t count );
+FRESULT RING_Wait( RING_File* ring );
+FRESULT RING_Sync( RING_File* ring );
+FRESULT RING_Close( RING_File* ring );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FFRING_H */
@@ -0,0 +1,722 @@
+/**
+ ******************************************************************************
+ * @file    ffserv.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   File service over a COM port (frame format is in ffserv.h).
+ *          Received bytes go from RXNE interrupt to a queue, the service
+ *          task assembles request frames from it. Answers are sent by TX
+ *          DMA from two frame buffers: the next DATA block is read by f_read
+ *          while the previous one is on the line. With f_forward (tiny FatFs)
+ *          the payload of DATA goes by DMA straight from the sector window
+ *          of the volume between the header and the CRC in the frame buffer,
+ *          which then holds only the smaller answers (4 Kb less RAM), and
+ *          the CRC unit is fed piece by piece.
+ *          READ is a go-back-N transfer: up to window DATA frames are sent
+ *          ahead of the host ACK, on a repeated ACK or an ACK timeout the
+ *          transfer restarts at the acknowledged offset.
+ *          The service doesn't mount volumes, paths refer to volumes mounted
+ *          by the application (FR_NOT_ENABLED is returned for others).
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#ifdef USE_FILE_SERVICE
+
+#include "ffserv.h"
+#include "ff.h"
+
+#include "stm32_usart.h"
+#include "stm32_mem.h"
+#include "stm32_irq.h"
+#include "stm32_chksum.h"
+#include "stm32_sd_io.h"
+
+#include <string.h>
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+#if _FS_MINIMIZE != 0
+#error USE_FILE_SERVICE needs f_opendir, f_readdir, f_stat and f_unlink of FatFs (see ffconf.h)
+#endif
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  COM port and its TX DMA stream (stm32_pins.h)
+ */
+#define FSERV_COM				( (COM_TypeDef)( FILE_SERVICE_PORT - 1 ) )
+#define FSERV_USART				( COM_USART[ FSERV_COM ] )
+#if FILE_SERVICE_PORT == 2
+#define FSERV_DMA_CLK			EVAL_COM2_DMA_CLK
+#define FSERV_DMA_CHANNEL		EVAL_COM2_DMA_CHANNEL
+#define FSERV_DMA_STREAM		EVAL_COM2_DMA_STREAM_TX
+#define FSERV_DMA_IRQn			EVAL_COM2_DMA_TX_IRQn
+#else
+#define FSERV_DMA_CLK			EVAL_COM1_DMA_CLK
+#define FSERV_DMA_CHANNEL		EVAL_COM1_DMA_CHANNEL
+#define FSERV_DMA_STREAM		EVAL_COM1_DMA_STREAM_TX
+#define FSERV_DMA_IRQn			EVAL_COM1_DMA_TX_IRQn
+#endif /* FILE_SERVICE_PORT */
+
+/**
+ * @brief  Service task
+ */
+#define FSERV_TASK_PRIO			( tskIDLE_PRIORITY + 1 )
+#define FSERV_TASK_STACK		( configMINIMAL_STACK_SIZE * 2 )
+
+/**
+ * @brief  Frame layout
+ */
+#define FSERV_HEADER			8
+#define FSERV_FRAME( len )		( FSERV_HEADER + ( len ) + 4 )
+
+/**
+ * @brief  Received bytes waiting for the task (the host sends only short requests and ACKs)
+ */
+#define FSERV_RX_QUEUE			64
+
+/**
+ * @brief  READ transfer: ACK timeout and number of restarts without progress before it is aborted
+ */
+#define FSERV_ACK_TIMEOUT		( 500 / portTICK_RATE_MS )
+#define FSERV_RETRIES			10
+
+/**
+ * @brief  Largest window of READ
+ */
+#define FSERV_WINDOW_MAX		16
+
+/**
+ * @brief  Directory entries read at once by LIST
+ */
+#define FSERV_LIST_BATCH		16
+
+/**
+ * @brief  Largest payload sent from the frame buffers: ENTRY with the longest name
+ *         if DATA is forwarded from the sector window of FatFs
+ */
+#if _USE_FORWARD && _FS_TINY
+#define FSERV_FORWARD
+#define FSERV_TX_MAX			( 9 + _MAX_LFN + 1 )
+#else
+#define FSERV_TX_MAX			FSERV_BLOCK
+#endif /* _USE_FORWARD && _FS_TINY */
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Variables
+ * @{
+ */
+
+static uint8_t FSERV_Tx[ 2 ][ FSERV_FRAME( FSERV_TX_MAX ) ] MEM_DMA_BUFFER;	/* frames of answers, sent alternately */
+static uint8_t FSERV_TxNext;						/* index of the buffer to be filled */
+static uint8_t FSERV_Rx[ FSERV_FRAME( FSERV_REQUEST_MAX ) + 1 ] __attribute__(( aligned( 4 ) ));	/* request (NUL after payload) */
+static uint16_t FSERV_RxLen;						/* bytes of the request received */
+static xQueueHandle FSERV_RxQueue;
+static xStaticQueue FSERV_RxQueueBuffer;
+static uint8_t FSERV_RxQueueStorage[ FSERV_RX_QUEUE ];
+static xTaskHandle FSERV_Handle;					/* the service task, notified when TX DMA is over */
+static xStaticTask FSERV_TaskBuffer;
+static portSTACK_TYPE FSERV_TaskStack[ FSERV_TASK_STACK ];
+static volatile uint8_t FSERV_TxBusy;				/* set while TX DMA sends a frame */
+#if _USE_LFN
+static TCHAR FSERV_Lfn[ _MAX_LFN + 1 ];
+#endif /* _USE_LFN */
+#if _FS_LISTNAME
+static FILENT FSERV_Ents[ FSERV_LIST_BATCH ];		/* batch of LIST */
+#endif /* _FS_LISTNAME */
+#ifdef USE_HW_HASH
+static uint32_t FSERV_Hashed;						/* READ data are hashed up to this offset */
+#ifdef FSERV_FORWARD
+static uint32_t FSERV_FwdPos;						/* file offset of the next forwarded byte */
+#endif /* FSERV_FORWARD */
+#endif /* USE_HW_HASH */
+
+/**
+ * @}
+ *//* STM32_Private_Variables */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Read and write little endian fields of frames
+ */
+static uint16_t FSERV_Get16( const uint8_t* p )
+{
+	return p[ 0 ] | ( p[ 1 ] << 8 );
+}
+
+static uint32_t FSERV_Get32( const uint8_t* p )
+{
+	return p[ 0 ] | ( p[ 1 ] << 8 ) | ( p[ 2 ] << 16 ) | ( (uint32_t)p[ 3 ] << 24 );
+}
+
+static void FSERV_Put16( uint8_t* p, uint16_t v )
+{
+	p[ 0 ] = (uint8_t)v;
+	p[ 1 ] = (uint8_t)( v >> 8 );
+}
+
+static void FSERV_Put32( uint8_t* p, uint32_t v )
+{
+	FSERV_Put16( p, (uint16_t)v );
+	FSERV_Put16( p + 2, (uint16_t)( v >> 16 ) );
+}
+
+/**
+ * @brief  Calculates CRC32 of the frame (as zlib crc32) by the CRC unit
+ * @param  frame: Frame, its payload length is set
+ * @retval CRC32 of bytes 1 .. 7 + length
+ */
+static uint32_t FSERV_Crc( const uint8_t* frame )
+{
+	return CHK_Crc32( frame + 1, FSERV_HEADER - 1 + FSERV_Get16( frame + 2 ) );
+}
+
+/**
+ * @brief  Buffer for the next answer, it is free: DMA sends at most the other one
+ * @param  None
+ * @retval Frame buffer
+ */
+static uint8_t* FSERV_Frame( void )
+{
+	return FSERV_Tx[ FSERV_TxNext ];
+}
+
+/**
+ * @brief  Waits until TX DMA is over
+ * @param  None
+ * @retval None
+ */
+static void FSERV_TxWait( void )
+{
+	while ( FSERV_TxBusy )
+		ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+}
+
+/**
+ * @brief  Starts TX DMA of bytes when the previous ones are on the line
+ * @param  buf: Bytes, unchanged until DMA is over
+ * @param  len: Number of bytes
+ * @retval None
+ */
+static void FSERV_TxStart( const void* buf, uint16_t len )
+{
+	FSERV_TxWait();
+	FSERV_TxBusy = 1;
+	DMA_ClearFlag( FSERV_DMA_STREAM, EVAL_COM_TX_DMA_FLAG_FEIF | EVAL_COM_TX_DMA_FLAG_DMEIF |
+			EVAL_COM_TX_DMA_FLAG_TEIF | EVAL_COM_TX_DMA_FLAG_HTIF | EVAL_COM_TX_DMA_FLAG_TCIF );
+	FSERV_DMA_STREAM->M0AR = (uint32_t)buf;
+	DMA_SetCurrDataCounter( FSERV_DMA_STREAM, len );
+	DMA_Cmd( FSERV_DMA_STREAM, ENABLE );
+}
+
+/**
+ * @brief  Completes the frame got by FSERV_Frame() and starts sending it when
+ *         the previous frame is on the line
+ * @param  type: Frame type
+ * @param  len: Payload length (payload is already in the frame)
+ * @param  arg: Frame argument
+ * @retval None
+ */
+static void FSERV_Send( uint8_t type, uint16_t len, uint32_t arg )
+{
+	uint8_t* frame = FSERV_Tx[ FSERV_TxNext ];
+
+	frame[ 0 ] = FSERV_SYNC;
+	frame[ 1 ] = type;
+	FSERV_Put16( frame + 2, len );
+	FSERV_Put32( frame + 4, arg );
+	FSERV_Put32( frame + FSERV_HEADER + len, FSERV_Crc( frame ) );
+
+	FSERV_TxStart( frame, FSERV_FRAME( len ) );
+	FSERV_TxNext ^= 1;
+}
+
+#ifdef FSERV_FORWARD
+/**
+ * @brief  Streaming function of f_forward: sends a piece of DATA payload from the sector
+ *         window by DMA and waits until it is on the line (FatFs reuses the window then)
+ * @param  p: Bytes in the window, NULL to check if the stream is ready
+ * @param  n: Number of bytes
+ * @retval Number of bytes sent, nonzero if ready
+ */
+static UINT FSERV_Forward( const BYTE* p, UINT n )
+{
+	if ( n == 0 )
+		return 1;
+	FSERV_TxStart( p, n );
+	CHK_Crc32Update( p, n );		/* while the first bytes go out */
+#ifdef USE_HW_HASH
+	if ( FSERV_FwdPos <= FSERV_Hashed && FSERV_FwdPos + n > FSERV_Hashed )
+	{
+		CHK_Sha1Update( p + ( FSERV_Hashed - FSERV_FwdPos ), FSERV_FwdPos + n - FSERV_Hashed );
+		FSERV_Hashed = FSERV_FwdPos + n;
+	}
+	FSERV_FwdPos += n;
+#endif /* USE_HW_HASH */
+	FSERV_TxWait();
+	return n;
+}
+
+/**
+ * @brief  Sends DATA frame with the payload forwarded from the file
+ * @param  file: File, at the offset of the frame
+ * @param  pos: Offset of the frame
+ * @param  len: Payload length
+ * @retval FatFs result (a frame cut short by an error is dropped by the host on its CRC):
+ *         - FR_INT_ERR: The file shrank
+ */
+static FRESULT FSERV_SendData( FIL* file, uint32_t pos, UINT len )
+{
+	uint8_t* frame = FSERV_Tx[ FSERV_TxNext ];
+	FRESULT res;
+	UINT n;
+
+	frame[ 0 ] = FSERV_SYNC;
+	frame[ 1 ] = FSERV_DATA;
+	FSERV_Put16( frame + 2, len );
+	FSERV_Put32( frame + 4, pos );
+	FSERV_TxStart( frame, FSERV_HEADER );
+
+#ifdef USE_HW_HASH
+	FSERV_FwdPos = pos;
+#endif /* USE_HW_HASH */
+	CHK_Crc32Start();
+	CHK_Crc32Update( frame + 1, FSERV_HEADER - 1 );
+	res = f_forward( file, FSERV_Forward, len, &n );
+	FSERV_Put32( frame + FSERV_HEADER, CHK_Crc32Finish() );
+
+	FSERV_TxStart( frame + FSERV_HEADER, 4 );
+	FSERV_TxNext ^= 1;
+	return ( res == FR_OK && n != len ) ? FR_INT_ERR : res;
+}
+#endif /* FSERV_FORWARD */
+
+/**
+ * @brief  Assembles the next intact request frame from received bytes
+ * @param  timeout: Longest wait for a byte in ticks
+ * @retval Nonzero if FSERV_Rx holds a frame, zero on timeout
+ */
+static uint8_t FSERV_Receive( portTickType timeout )
+{
+	uint8_t b;
+	uint16_t len;
+
+	while ( xQueueReceive( FSERV_RxQueue, &b, timeout ) == pdTRUE )
+	{
+		if ( FSERV_RxLen == 0 && b != FSERV_SYNC )
+			continue;
+		FSERV_Rx[ FSERV_RxLen++ ] = b;
+		if ( FSERV_RxLen < FSERV_HEADER )
+			continue;
+		len = FSERV_Get16( FSERV_Rx + 2 );
+		if ( len > FSERV_REQUEST_MAX )
+		{	/* not a frame: hunt for the next sync byte */
+			FSERV_RxLen = 0;
+			continue;
+		}
+		if ( FSERV_RxLen < FSERV_FRAME( len ) )
+			continue;
+		FSERV_RxLen = 0;
+		if ( FSERV_Get32( FSERV_Rx + FSERV_HEADER + len ) == FSERV_Crc( FSERV_Rx ) )
+		{
+			FSERV_Rx[ FSERV_HEADER + len ] = 0;		/* path is terminated even if the host didn't */
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief  Sends ENTRY frame
+ * @param  fsize: File size
+ * @param  fdate: Last modified date
+ * @param  ftime: Last modified time
+ * @param  fattrib: Attributes
+ * @param  name: Long file name or short one
+ * @retval None
+ */
+static void FSERV_SendEntry( DWORD fsize, WORD fdate, WORD ftime, BYTE fattrib, const TCHAR* name )
+{
+	uint8_t* p = FSERV_Frame() + FSERV_HEADER;
+	uint16_t n;
+
+	FSERV_Put32( p, fsize );
+	FSERV_Put16( p + 4, fdate );
+	FSERV_Put16( p + 6, ftime );
+	p[ 8 ] = fattrib;
+	n = strlen( name ) + 1;
+	memcpy( p + 9, name, n );
+	FSERV_Send( FSERV_ENTRY, 9 + n, 0 );
+}
+
+/**
+ * @brief  Sends ENTRY frame of file information
+ * @param  fno: File information
+ * @retval None
+ */
+static void FSERV_SendInfo( const FILINFO* fno )
+{
+	const TCHAR* name = fno->fname;
+
+#if _USE_LFN
+	if ( fno->lfname[ 0 ] )
+		name = fno->lfname;
+#endif /* _USE_LFN */
+	FSERV_SendEntry( fno->fsize, fno->fdate, fno->ftime, fno->fattrib, name );
+}
+
+/**
+ * @brief  Prepares file information structure (long name buffer)
+ * @param  fno: File information
+ * @retval None
+ */
+static void FSERV_InfoInit( FILINFO* fno )
+{
+#if _USE_LFN
+	fno->lfname = FSERV_Lfn;
+	fno->lfsize = sizeof( FSERV_Lfn );
+#else
+	(void)fno;
+#endif /* _USE_LFN */
+}
+
+/**
+ * @brief  LIST request: entries of the directory, "." and ".." are skipped
+ * @param  path: Directory
+ * @retval FatFs result
+ */
+static FRESULT FSERV_List( const TCHAR* path )
+{
+	FRESULT res;
+	DIR dir;
+#if _FS_LISTNAME
+	UINT i, n = FSERV_LIST_BATCH;
+
+	res = f_opendir( &dir, path );
+	while ( res == FR_OK && n == FSERV_LIST_BATCH )
+	{	/* entries are read in batches, the volume is free while they are sent */
+		res = f_listdir( &dir, FSERV_Ents, FSERV_LIST_BATCH, &n );
+		for ( i = 0; res == FR_OK && i < n; ++i )
+		{
+			if ( strcmp( FSERV_Ents[ i ].fname, "." ) != 0 && strcmp( FSERV_Ents[ i ].fname, ".." ) != 0 )
+				FSERV_SendEntry( FSERV_Ents[ i ].fsize, FSERV_Ents[ i ].fdate, FSERV_Ents[ i ].ftime,
+						FSERV_Ents[ i ].fattrib, FSERV_Ents[ i ].fname );
+		}
+	}
+#else
+	FILINFO fno;
+
+	FSERV_InfoInit( &fno );
+	res = f_opendir( &dir, path );
+	while ( res == FR_OK )
+	{
+		res = f_readdir( &dir, &fno );
+		if ( res != FR_OK || fno.fname[ 0 ] == 0 )
+			break;
+		if ( fno.fname[ 0 ] != '.' )
+			FSERV_SendInfo( &fno );
+	}
+#endif /* _FS_LISTNAME */
+	return res;
+}
+
+/**
+ * @brief  STAT request
+ * @param  path: File or directory
+ * @retval FatFs result
+ */
+static FRESULT FSERV_Stat( const TCHAR* path )
+{
+	FRESULT res;
+	FILINFO fno;
+
+	FSERV_InfoInit( &fno );
+	res = f_stat( path, &fno );
+	if ( res == FR_OK )
+		FSERV_SendInfo( &fno );
+	return res;
+}
+
+/**
+ * @brief  READ request: go-back-N transfer of file data
+ * @param  path: File
+ * @param  offset: First byte
+ * @param  length: Number of bytes (clipped at the end of file)
+ * @param  window: Number of DATA frames sent ahead of ACK
+ * @retval FatFs result:
+ *         - FR_TIMEOUT: The host stopped acknowledging data
+ */
+static FRESULT FSERV_Read( const TCHAR* path, uint32_t offset, uint32_t length, uint8_t window )
+{
+	FRESULT res;
+	FIL file;
+	UINT n;
+	uint32_t end, pos, acked, ack;
+	uint8_t retries = 0, rewound = 0;
+#ifdef USE_HW_HASH
+	uint8_t digest[ CHK_SHA1_SIZE ];
+#endif /* USE_HW_HASH */
+
+	if ( window == 0 || window > FSERV_WINDOW_MAX )
+		window = FSERV_WINDOW_MAX;
+	res = f_open( &file, path, FA_READ );
+	if ( res != FR_OK )
+		return res;
+	end = ( offset < file.fsize ) ? offset : file.fsize;
+	end += ( length < file.fsize - end ) ? length : file.fsize - end;
+	acked = pos = offset;
+	res = f_lseek( &file, pos );
+#ifdef USE_HW_HASH
+	/* bytes are hashed when read the first time (blocks read again after a restart are skipped) */
+	offset = ( offset < file.fsize ) ? offset : file.fsize;
+	FSERV_Hashed = offset;
+	CHK_Sha1Start();
+#endif /* USE_HW_HASH */
+
+	while ( res == FR_OK && acked < end )
+	{
+		/* fill the window, the next block is read while DMA sends the previous one */
+		while ( res == FR_OK && pos < end && pos - acked < (uint32_t)window * FSERV_BLOCK )
+		{
+			n = ( end - pos < FSERV_BLOCK ) ? end - pos : FSERV_BLOCK;
+#ifdef FSERV_FORWARD
+			res = FSERV_SendData( &file, pos, n );
+			if ( res == FR_OK )
+				pos += n;
+#else
+			res = f_read( &file, FSERV_Frame() + FSERV_HEADER, n, &n );
+			if ( res == FR_OK && n == 0 )
+				res = FR_INT_ERR;		/* file shrank */
+			if ( res == FR_OK )
+			{
+#ifdef USE_HW_HASH
+				if ( pos <= FSERV_Hashed && pos + n > FSERV_Hashed )
+				{
+					CHK_Sha1Update( FSERV_Frame() + FSERV_HEADER + ( FSERV_Hashed - pos ), pos + n - FSERV_Hashed );
+					FSERV_Hashed = pos + n;
+				}
+#endif /* USE_HW_HASH */
+				FSERV_Send( FSERV_DATA, n, pos );
+				pos += n;
+			}
+#endif /* FSERV_FORWARD */
+		}
+		if ( res != FR_OK )
+			break;
+
+		if ( FSERV_Receive( FSERV_ACK_TIMEOUT ) )
+		{
+			if ( FSERV_Rx[ 1 ] != FSERV_ACK )
+				continue;		/* another request in the middle of the transfer is dropped */
+			ack = FSERV_Get32( FSERV_Rx + 4 );
+			if ( ack > acked && ack <= pos )
+			{
+				acked = ack;
+				retries = rewound = 0;
+				continue;
+			}
+			if ( ack != acked || rewound )
+				continue;		/* stale, or repeated ACK of frames sent before the restart */
+		}
+		else if ( ++retries > FSERV_RETRIES )
+		{
+			res = FR_TIMEOUT;
+			break;
+		}
+		/* frame lost: restart at the first byte the host doesn't have */
+		pos = acked;
+		rewound = 1;
+		res = f_lseek( &file, pos );
+	}
+
+#ifdef USE_HW_HASH
+	CHK_Sha1Finish( digest );
+	if ( res == FR_OK )
+	{
+		memcpy( FSERV_Frame() + FSERV_HEADER, digest, CHK_SHA1_SIZE );
+		FSERV_Send( FSERV_DIGEST, CHK_SHA1_SIZE, offset );
+	}
+#endif /* USE_HW_HASH */
+	if ( res == FR_OK )
+		res = f_close( &file );
+	else
+		f_close( &file );
+	return res;
+}
+
+/**
+ * @brief  Service task: answers requests of the host
+ * @param  pvParameters: Not used
+ * @retval None
+ */
+static void FSERV_Task( void* pvParameters )
+{
+	FRESULT res;
+	const TCHAR* path = (const TCHAR*)( FSERV_Rx + FSERV_HEADER );
+
+	(void)pvParameters;
+#ifdef USE_SD_IO_PRIORITY
+	SD_IO_SetTaskClass( NULL, SD_IO_INTERACTIVE, 0 );	/* the host waits for the answers */
+#endif /* USE_SD_IO_PRIORITY */
+	for ( ;; )
+	{
+		if ( !FSERV_Receive( portMAX_DELAY ) )
+			continue;
+		switch ( FSERV_Rx[ 1 ] )
+		{
+		case FSERV_LIST:
+			res = FSERV_List( path );
+			break;
+		case FSERV_STAT:
+			res = FSERV_Stat( path );
+			break;
+		case FSERV_READ:
+			if ( FSERV_Get16( FSERV_Rx + 2 ) < 6 )
+			{
+				res = FR_INVALID_PARAMETER;
+				break;
+			}
+			res = FSERV_Read( path + 5, FSERV_Get32( FSERV_Rx + 4 ), FSERV_Get32( FSERV_Rx + FSERV_HEADER ),
+					FSERV_Rx[ FSERV_HEADER + 4 ] );
+			break;
+		case FSERV_DELETE:
+#if _FS_READONLY
+			res = FR_WRITE_PROTECTED;
+#else
+			res = f_unlink( path );
+#endif /* _FS_READONLY */
+			break;
+		case FSERV_ACK:
+			continue;		/* late ACK of a finished transfer */
+		default:
+			res = FR_INVALID_PARAMETER;
+			break;
+		}
+		FSERV_Send( FSERV_END, 0, res );
+	}
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Initialize COM port FILE_SERVICE_PORT at FILE_SERVICE_BAUDRATE with TX DMA,
+ *         and create the service task
+ * @param  None
+ * @retval None
+ */
+void FSERV_Init( void )
+{
+	USART_InitTypeDef USART_InitStructure;
+	DMA_InitTypeDef DMA_InitStructure;
+
+	FSERV_RxQueue = xQueueCreateStatic( FSERV_RX_QUEUE, sizeof( uint8_t ), FSERV_RxQueueStorage, &FSERV_RxQueueBuffer );
+
+	USART_InitStructure.USART_BaudRate = FILE_SERVICE_BAUDRATE;
+	USART_InitStructure.USART_WordLength = USART_WordLength_8b;
+	USART_InitStructure.USART_StopBits = USART_StopBits_1;
+	USART_InitStructure.USART_Parity = USART_Parity_No;
+	USART_InitStructure.USART_HardwareFlowControl = USART_HardwareFlowControl_None;
+	USART_InitStructure.USART_Mode = USART_Mode_Rx | USART_Mode_Tx;
+	STM_EVAL_COMInit( FSERV_COM, &USART_InitStructure );
+
+	/* TX DMA stream: memory address and length are set for each frame */
+	RCC_AHB1PeriphClockCmd( FSERV_DMA_CLK, ENABLE );
+	DMA_DeInit( FSERV_DMA_STREAM );
+	DMA_InitStructure.DMA_Channel = FSERV_DMA_CHANNEL;
+	DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&FSERV_USART->DR;
+	DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t)FSERV_Tx[ 0 ];
+	DMA_InitStructure.DMA_DIR = DMA_DIR_MemoryToPeripheral;
+	DMA_InitStructure.DMA_BufferSize = 1;
+	DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+	DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+	DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+	DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+	DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+	DMA_InitStructure.DMA_Priority = DMA_Priority_Low;
+	DMA_InitStructure.DMA_FIFOMode = DMA_FIFOMode_Disable;
+	DMA_InitStructure.DMA_FIFOThreshold = DMA_FIFOThreshold_Full;
+	DMA_InitStructure.DMA_MemoryBurst = DMA_MemoryBurst_Single;
+	DMA_InitStructure.DMA_PeripheralBurst = DMA_PeripheralBurst_Single;
+	DMA_Init( FSERV_DMA_STREAM, &DMA_InitStructure );
+	DMA_ITConfig( FSERV_DMA_STREAM, DMA_IT_TC, ENABLE );
+	USART_DMACmd( FSERV_USART, USART_DMAReq_Tx, ENABLE );
+
+	IRQ_Enable( FSERV_DMA_IRQn, IRQ_PRIO_COM_DMA );
+
+	/* received bytes are passed to the task by RXNE interrupt */
+	IRQ_Enable( (IRQn_Type)COM_IRQn[ FSERV_COM ], IRQ_PRIO_COM );
+	USART_ITConfig( FSERV_USART, USART_IT_RXNE, ENABLE );
+
+	xTaskCreateStatic( FSERV_Task, (const signed char* const)"FSRV", FSERV_TASK_STACK, NULL, FSERV_TASK_PRIO, &FSERV_Handle, FSERV_TaskStack, &FSERV_TaskBuffer );
+}
+
+/**
+ * @brief  Handles RXNE interrupt of the COM port (overrun is cleared by the same read)
+ * @param  None
+ * @retval None
+ */
+void FSERV_IRQHandler( void )
+{
+	portBASE_TYPE woken = pdFALSE;
+	uint8_t b;
+
+	if ( FSERV_USART->SR & ( USART_FLAG_RXNE | USART_FLAG_ORE ) )
+	{
+		b = (uint8_t)USART_ReceiveData( FSERV_USART );
+		xQueueSendFromISR( FSERV_RxQueue, &b, &woken );		/* lost if the queue is full, CRC catches it */
+	}
+	portYIELD_FROM_ISR( woken );
+}
+
+/**
+ * @brief  Handles transfer complete interrupt of TX DMA stream
+ * @param  None
+ * @retval None
+ */
+void FSERV_DMA_IRQHandler( void )
+{
+	if ( DMA_GetITStatus( FSERV_DMA_STREAM, EVAL_COM_TX_DMA_IT_TCIF ) != RESET )
+	{
+		DMA_ClearITPendingBit( FSERV_DMA_STREAM, EVAL_COM_TX_DMA_IT_TCIF );
+		FSERV_TxBusy = 0;
+		IRQ_Notify( FSERV_Handle );
+	}
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#endif /* USE_FILE_SERVICE */
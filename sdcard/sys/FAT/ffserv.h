@@ -0,0 +1,108 @@
+/**
+ ******************************************************************************
+ * @file    ffserv.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   File service over a COM port: a PC lists directories, gets file
+ *          status, downloads and deletes files of mounted FatFs volumes
+ *          without removing the card (host side is tools/ffserv.py).
+ *          Frames are sent by DMA, file data are read by f_read in blocks
+ *          of FSERV_BLOCK bytes (whole sectors go directly from the card to
+ *          the frame buffer) or, on tiny FatFs with _USE_FORWARD, forwarded
+ *          from the sector window by f_forward, so download speed is set by
+ *          the baud rate.
+ *
+ *          Frame (all fields are little endian):
+ *            0: FSERV_SYNC
+ *            1: type (FSERV_*)
+ *            2: payload length (16 bits)
+ *            4: argument (32 bits, meaning depends on type)
+ *            8: payload
+ *            8 + length: CRC32 (as zlib crc32) of bytes 1 .. 7 + length
+ *          Frames with bad CRC are dropped, requests are then repeated by
+ *          the host after a timeout.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef FFSERV_H
+#define FFSERV_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include <stdint.h>
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Constants
+ * @{
+ */
+
+/**
+ * @brief  First byte of each frame
+ */
+#define FSERV_SYNC				0xA5
+
+/**
+ * @brief  Largest payload: data of one DATA frame (multiple of sector size)
+ */
+#define FSERV_BLOCK				2048
+
+/**
+ * @brief  Largest payload of requests (READ header and path of up to 255 characters),
+ *         longer frames are dropped
+ */
+#define FSERV_REQUEST_MAX		264
+
+/**
+ * @brief  Requests (host to device), payload is NUL terminated path unless noted
+ */
+#define FSERV_LIST				0x01	/* Directory entries: ENTRY frames, then END */
+#define FSERV_STAT				0x02	/* Status of file or directory: ENTRY frame, then END */
+#define FSERV_READ				0x03	/* Argument: offset; payload: length (32 bits), window (frames), path.
+										   Answer: DATA frames, then END */
+#define FSERV_DELETE			0x04	/* Delete file or empty directory: END */
+#define FSERV_ACK				0x05	/* Argument: offset of the first missing byte of READ data */
+
+/**
+ * @brief  Answers (device to host)
+ */
+#define FSERV_ENTRY				0x81	/* Payload: size (32 bits), date, time (16 bits), attributes (8 bits), name */
+#define FSERV_DATA				0x82	/* Argument: offset in the file; payload: data */
+#define FSERV_END				0x83	/* Argument: FatFs result (FRESULT) */
+#define FSERV_DIGEST			0x84	/* Argument: offset of the first byte; payload: SHA-1 of the READ data,
+										   sent before END of a complete transfer (USE_HW_HASH) */
+
+/**
+ * @}
+ *//* STM32_Exported_Constants */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+void FSERV_Init( void );
+void FSERV_IRQHandler( void );
+void FSERV_DMA_IRQHandler( void );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FFSERV_H */
@@ -0,0 +1,361 @@
+/**
+ ******************************************************************************
+ * @file    ffstate.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Volume state snapshots of FatFs in backup SRAM: one slot for each
+ *          logical drive. A slot is invalidated before FatFs rewrites it and
+ *          validated by its check word afterwards, so reset in the middle of
+ *          an update leaves no snapshot rather than a torn one. Without a slot
+ *          the snapshot copied into the boot cache is offered (USE_BOOT_CACHE),
+ *          marked cold, so FatFs checks it against FSInfo. Cached config files
+ *          are records of the path, the directory entry and the contents.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "ffstate.h"
+
+#include "stm32f2xx.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#ifdef USE_BOOT_CACHE
+#include "stm32_bootcache.h"
+#include "stm32_chksum.h"
+#endif /* USE_BOOT_CACHE */
+
+#if _FS_WARM
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  Marker of valid slots ("FFST")
+ */
+#define FF_STATE_MAGIC			0x54534646
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Types
+ * @{
+ */
+
+/**
+ * @brief  Slot of one logical drive
+ */
+typedef struct
+{
+	volatile uint32_t	Magic;		/*!< FF_STATE_MAGIC if the slot is valid */
+	FFSTATE		State;				/*!< Snapshot */
+	uint32_t	Check;				/*!< Inverted XOR of the words above */
+} FF_StateSlot;
+
+#ifdef USE_BOOT_CACHE
+/**
+ * @brief  Header of a cached config file, its contents follow
+ */
+typedef struct
+{
+	uint32_t	Size;				/*!< File size */
+	uint32_t	Clust;				/*!< Start cluster */
+	uint32_t	Stamp;				/*!< Modification time and date of the directory entry */
+	TCHAR		Name[ FF_CONFIG_NAME ];	/*!< Path, padded with nulls */
+} FF_ConfigHead;
+#endif /* USE_BOOT_CACHE */
+
+/**
+ * @}
+ *//* STM32_Private_Types */
+
+
+/** @defgroup STM32_Private_Variables
+ * @{
+ */
+
+/**
+ * @brief  Slots at the start of backup SRAM (4 Kb)
+ */
+#define FF_STATE_SLOTS			( (FF_StateSlot*)BKPSRAM_BASE )
+
+#if _VOLUMES * 512 > 4096 || _FS_FMAP > 512 - 64
+#error Snapshots of all volumes do not fit into backup SRAM (see _VOLUMES and _FS_FREEMAP)
+#endif
+
+/**
+ * @}
+ *//* STM32_Private_Variables */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Calculates check word of the slot
+ * @param  slot: Slot
+ * @retval Check word
+ */
+static uint32_t FF_StateCheck( const FF_StateSlot* slot )
+{
+	const uint32_t* w = (const uint32_t*)slot;
+	uint32_t check = 0;
+	uint32_t i;
+
+	for ( i = 0; i < offsetof( FF_StateSlot, Check ) / sizeof( uint32_t ); ++i )
+		check ^= w[ i ];
+	return ~check;
+}
+
+#ifdef USE_BOOT_CACHE
+/**
+ * @brief  Opens a config file for reading and describes it
+ * @param  file: File object
+ * @param  path: Path of the file
+ * @param  head: Receives header of its record
+ * @param  key: Receives key of its record
+ * @retval FatFs result, FR_INVALID_NAME if the path is too long,
+ *         FR_DENIED if the directory entry can't be told (the file is open then)
+ */
+static FRESULT FF_ConfigOpen( FIL* file, const TCHAR* path, FF_ConfigHead* head, uint32_t* key )
+{
+	FRESULT res;
+	UINT i;
+
+	memset( head, 0, sizeof( *head ) );
+	for ( i = 0; path[ i ] != 0; ++i )
+	{
+		if ( i == FF_CONFIG_NAME - 1 )
+			return FR_INVALID_NAME;
+		head->Name[ i ] = path[ i ];
+	}
+	*key = CHK_Crc32( head->Name, sizeof( head->Name ) );
+
+	res = f_open( file, path, FA_OPEN_EXISTING | FA_READ );
+	if ( res != FR_OK )
+		return res;
+	head->Size = file->fsize;
+	head->Clust = file->sclust;
+	/* the entry is in the window (or the exFAT entry made of the set) right after f_open,
+	   unless another task has moved the window since */
+	if ( file->dir_ptr >= file->fs->win && file->dir_ptr < file->fs->win + sizeof( file->fs->win ) &&
+		 file->fs->winsect != file->dir_sect )
+		return FR_DENIED;
+	head->Stamp = file->dir_ptr[ 22 ] | file->dir_ptr[ 23 ] << 8 |
+				  file->dir_ptr[ 24 ] << 16 | (uint32_t)file->dir_ptr[ 25 ] << 24;	/* DIR_WrtTime, DIR_WrtDate */
+	return FR_OK;
+}
+#endif /* USE_BOOT_CACHE */
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Enables backup SRAM and drops snapshots after power-on or brown-out reset,
+ *         call it at startup before FatFs mounts a volume
+ * @param  None
+ * @retval None
+ */
+void FF_StateInit( void )
+{
+	uint8_t vol;
+
+	RCC_APB1PeriphClockCmd( RCC_APB1Periph_PWR, ENABLE );
+	PWR_BackupAccessCmd( ENABLE );
+	RCC_AHB1PeriphClockCmd( RCC_AHB1Periph_BKPSRAM, ENABLE );
+
+	if ( RCC_GetFlagStatus( RCC_FLAG_PORRST ) == SET || RCC_GetFlagStatus( RCC_FLAG_BORRST ) == SET )
+	{
+		for ( vol = 0; vol < _VOLUMES; ++vol )
+			FF_STATE_SLOTS[ vol ].Magic = 0;
+	}
+	RCC_ClearFlag();
+}
+
+/**
+ * @brief  Gets valid snapshot of the volume (FatFs checks that it is the same card and volume)
+ * @param  vol: Logical drive number
+ * @retval Snapshot, 0 if there is none
+ */
+const FFSTATE* ff_state_get( BYTE vol )
+{
+	FF_StateSlot* slot = &FF_STATE_SLOTS[ vol ];
+
+#ifdef USE_BOOT_CACHE
+	const FFSTATE* st;
+	uint16_t len;
+#endif /* USE_BOOT_CACHE */
+
+	if ( slot->Magic != FF_STATE_MAGIC || slot->Check != FF_StateCheck( slot ) )
+	{
+#ifdef USE_BOOT_CACHE
+		/* cold snapshot saved before a power-off */
+		st = (const FFSTATE*)BOOT_Find( BOOT_TAG_STATE, vol, &len );
+		if ( st != 0 && len == sizeof( FFSTATE ) )
+			return st;
+#endif /* USE_BOOT_CACHE */
+		return 0;
+	}
+	return &slot->State;
+}
+
+/**
+ * @brief  Invalidates snapshot of the volume to rewrite it
+ * @param  vol: Logical drive number
+ * @retval Storage of the snapshot
+ */
+FFSTATE* ff_state_begin( BYTE vol )
+{
+	FF_StateSlot* slot = &FF_STATE_SLOTS[ vol ];
+
+	slot->Magic = 0;
+	return &slot->State;
+}
+
+/**
+ * @brief  Validates snapshot of the volume written after ff_state_begin
+ * @param  vol: Logical drive number
+ * @retval None
+ */
+void ff_state_end( BYTE vol )
+{
+	FF_StateSlot* slot = &FF_STATE_SLOTS[ vol ];
+
+	slot->Magic = FF_STATE_MAGIC;
+	slot->Check = FF_StateCheck( slot );
+}
+
+#ifdef USE_BOOT_CACHE
+/**
+ * @brief  Copies snapshot of the volume into the boot cache for the next power-on, call it
+ *         after f_mount( vol, NULL ) (FSInfo is written then): writes to the card after
+ *         this call, and writes elsewhere, make the next mount skip the copy. FLASH is
+ *         written only if the snapshot has changed.
+ * @param  vol: Logical drive number
+ * @retval ERROR if there is no snapshot or FLASH wasn't written
+ */
+ErrorStatus FF_StateSave( BYTE vol )
+{
+	const FFSTATE* st = ff_state_get( vol );
+	FFSTATE cold;
+
+	if ( st == 0 )
+		return ERROR;
+	memcpy( &cold, st, sizeof( cold ) );
+	cold.cold = 1;
+	return BOOT_Put( BOOT_TAG_STATE, vol, NULL, 0, &cold, sizeof( cold ) );
+}
+
+/**
+ * @brief  Reads a config file, from its copy in the boot cache if the volume was mounted
+ *         from a snapshot (it wasn't written elsewhere) and the directory entry matches.
+ *         Files read via the card are cached (if they fit a record). Rewrite cached files
+ *         by FF_ConfigWrite: writes which keep the entry (the same size and clusters, no
+ *         clock for a new time) aren't told from the cached contents otherwise.
+ * @param  path: Path of the file (shorter than FF_CONFIG_NAME)
+ * @param  buf: Buffer for the contents
+ * @param  size: Size of the buffer
+ * @param  len: Receives number of bytes read (up to the file size)
+ * @retval FatFs result
+ */
+FRESULT FF_ConfigRead( const TCHAR* path, void* buf, UINT size, UINT* len )
+{
+	FF_ConfigHead head;
+	const uint8_t* rec;
+	uint16_t n;
+	uint32_t key;
+	uint8_t known;
+	FIL file;
+	FRESULT res;
+
+	*len = 0;
+	res = FF_ConfigOpen( &file, path, &head, &key );
+	if ( res != FR_OK && res != FR_DENIED )
+		return res;
+	known = ( res == FR_OK );
+	if ( known && file.fs->st_used )
+	{
+		rec = (const uint8_t*)BOOT_Find( BOOT_TAG_CONFIG, key, &n );
+		if ( rec != NULL && n == sizeof( head ) + head.Size && memcmp( rec, &head, sizeof( head ) ) == 0 )
+		{
+			*len = ( size < head.Size ) ? size : head.Size;
+			memcpy( buf, rec + sizeof( head ), *len );
+			return f_close( &file );
+		}
+	}
+
+	res = f_read( &file, buf, size, len );
+	if ( f_close( &file ) != FR_OK && res == FR_OK )
+		res = FR_DISK_ERR;
+	if ( res == FR_OK && known && *len == head.Size && sizeof( head ) + head.Size <= BOOT_RECORD_MAX )
+		BOOT_Put( BOOT_TAG_CONFIG, key, &head, sizeof( head ), buf, *len );
+	return res;
+}
+
+/**
+ * @brief  Writes a config file and its copy in the boot cache
+ * @param  path: Path of the file (shorter than FF_CONFIG_NAME)
+ * @param  data: New contents
+ * @param  len: Number of bytes (the copy is dropped if it doesn't fit a record)
+ * @retval FatFs result
+ */
+FRESULT FF_ConfigWrite( const TCHAR* path, const void* data, UINT len )
+{
+	FF_ConfigHead head;
+	uint32_t key;
+	FIL file;
+	FRESULT res;
+	UINT n;
+
+	res = f_open( &file, path, FA_CREATE_ALWAYS | FA_WRITE );
+	if ( res != FR_OK )
+		return res;
+	res = f_write( &file, data, len, &n );
+	if ( res == FR_OK && n != len )
+		res = FR_DENIED;
+	if ( f_close( &file ) != FR_OK && res == FR_OK )
+		res = FR_DISK_ERR;
+
+	/* the entry is final now */
+	if ( res == FR_OK )
+	{
+		res = FF_ConfigOpen( &file, path, &head, &key );
+		if ( res == FR_OK || res == FR_DENIED )
+			f_close( &file );
+		if ( res == FR_OK && sizeof( head ) + len <= BOOT_RECORD_MAX )
+			BOOT_Put( BOOT_TAG_CONFIG, key, &head, sizeof( head ), data, len );
+		else if ( res != FR_INVALID_NAME )
+			BOOT_Drop( BOOT_TAG_CONFIG, key );
+		res = ( res == FR_DENIED || res == FR_INVALID_NAME ) ? FR_OK : res;
+	}
+	return res;
+}
+#endif /* USE_BOOT_CACHE */
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#endif /* _FS_WARM */
@@ -0,0 +1,83 @@
+/**
+ ******************************************************************************
+ * @file    ffstate.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Volume state snapshots of FatFs (_FS_WARMSTATE) in backup SRAM.
+ *          Backup SRAM keeps its contents over system resets (watchdog,
+ *          software, reset pin), so mount after such a reset takes the
+ *          free cluster count and map of the volume from the snapshot.
+ *          Snapshots are dropped on power-on and brown-out resets: the card
+ *          may have been changed or written elsewhere while the board was off.
+ *          With USE_BOOT_CACHE, FF_StateSave copies the snapshot into the boot
+ *          cache in FLASH (see stm32_bootcache.h) after unmount, and mount
+ *          after power-on takes that cold snapshot if FSInfo on the card still
+ *          matches it. Small config files are cached there too: FF_ConfigRead
+ *          returns the copy from FLASH without reading file data while the
+ *          volume was mounted from a snapshot and the directory entry is the
+ *          same (size, start cluster, modification time).
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef FFSTATE_H
+#define FFSTATE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "ff.h"
+
+#include "stm32f2xx.h"
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Constants
+ * @{
+ */
+
+/**
+ * @brief  Longest path of a cached config file (with the terminating null)
+ */
+#define FF_CONFIG_NAME			32
+
+/**
+ * @}
+ *//* STM32_Exported_Constants */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+#if _FS_WARM
+void FF_StateInit( void );
+#else
+#define FF_StateInit()			do {} while ( 0 )
+#endif /* _FS_WARM */
+
+#if _FS_WARM && defined(USE_BOOT_CACHE)
+ErrorStatus FF_StateSave( BYTE vol );
+FRESULT FF_ConfigRead( const TCHAR* path, void* buf, UINT size, UINT* len );
+FRESULT FF_ConfigWrite( const TCHAR* path, const void* data, UINT len );
+#endif /* _FS_WARM && USE_BOOT_CACHE */
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FFSTATE_H */
@@ -0,0 +1,467 @@
+/**
+ ******************************************************************************
+ * @file    fftable.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Lookup tables on the card: sorted fixed-size records, sparse
+ *          index of first keys per sector in RAM, binary search in RAM and
+ *          then in the data sector found. Sectors are mapped in place from
+ *          the sector cache (f_view), read into a pool block if the cache
+ *          can't pin them. A table is read by one owner at a time (the file
+ *          object is shared by lookups), it is opened for reading only, so
+ *          f_lseek to the data sector uses the fast seek table of the file
+ *          (_FS_CLMT_FILES) instead of following the FAT chain.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#ifdef USE_FAT_TABLE
+
+#include "fftable.h"
+#include "stm32_pool.h"
+
+#include <string.h>
+
+#if _FS_MINIMIZE > 2 || _FS_READONLY
+#error USE_FAT_TABLE needs f_lseek and writing functions of FatFs (see ffconf.h)
+#endif
+
+#if POOL_BLOCK_SIZE < TABLE_SECTOR
+#error Sector buffer of the table is a pool block (see stm32_pool.h)
+#endif
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  Marker of table headers ("TBL1")
+ */
+#define TABLE_HEADER_MAGIC		0x314C4254
+
+/**
+ * @brief  Index entries per index sector
+ */
+#define TABLE_INDEX_KEYS		( TABLE_SECTOR / TABLE_KEY )
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Reads unaligned little endian word
+ */
+static uint32_t TABLE_Get32( const uint8_t* p )
+{
+	return p[ 0 ] | ( p[ 1 ] << 8 ) | ( p[ 2 ] << 16 ) | ( (uint32_t)p[ 3 ] << 24 );
+}
+
+/**
+ * @brief  Calculates check word of the header
+ * @param  hdr: Header
+ * @retval Check word
+ */
+static uint32_t TABLE_HeaderCheck( const TABLE_Header* hdr )
+{
+	return ~( hdr->Magic ^ ( hdr->RecSize | ( (uint32_t)hdr->Reserved << 16 ) ) ^ hdr->Records ^
+			hdr->Sectors ^ hdr->IndexSectors );
+}
+
+/**
+ * @brief  Reads a sector of the file: maps it in the sector cache, or reads it into Buf
+ *         if the cache can't pin it
+ * @param  t: Table file object
+ * @param  sector: Sector of the file
+ * @param  data: Receives sector data, valid until TABLE_Unmap
+ * @retval FatFs result
+ */
+static FRESULT TABLE_Map( TABLE_File* t, uint32_t sector, const uint8_t** data )
+{
+	FRESULT res;
+	UINT n = 0;
+
+	res = f_lseek( &t->File, (DWORD)sector * TABLE_SECTOR );
+#if _USE_VIEW
+	if ( res == FR_OK )
+	{
+		res = f_view( &t->File, &t->View, TABLE_SECTOR, &n );
+		if ( res == FR_OK && n == TABLE_SECTOR )
+		{
+			*data = t->View.data;
+			return FR_OK;
+		}
+		if ( res == FR_OK )
+			f_unview( &t->View );
+		else if ( res == FR_DENIED )
+			res = FR_OK;		/* no slot to pin, the file position is kept */
+		n = 0;
+	}
+#endif /* _USE_VIEW */
+	if ( res == FR_OK )
+		res = f_read( &t->File, t->Buf, TABLE_SECTOR, &n );
+	if ( res == FR_OK && n != TABLE_SECTOR )
+		res = FR_INT_ERR;		/* size was checked by TABLE_Open */
+	*data = t->Buf;
+	return res;
+}
+
+/**
+ * @brief  Releases the sector read by TABLE_Map
+ * @param  t: Table file object
+ * @retval None
+ */
+static void TABLE_Unmap( TABLE_File* t )
+{
+#if _USE_VIEW
+	f_unview( &t->View );
+#else
+	(void)t;
+#endif /* _USE_VIEW */
+}
+
+/**
+ * @brief  Writes the sector buffer to the file
+ * @param  t: Table file object
+ * @retval FatFs result
+ */
+static FRESULT TABLE_WriteBuf( TABLE_File* t )
+{
+	FRESULT res;
+	UINT n;
+
+	res = f_write( &t->File, t->Buf, TABLE_SECTOR, &n );
+	if ( res == FR_OK && n != TABLE_SECTOR )
+		res = FR_DENIED;		/* disk full */
+	memset( t->Buf, 0, TABLE_SECTOR );
+	return res;
+}
+
+/**
+ * @brief  Ends use of the table: closes the file and frees the buffer
+ * @param  t: Table file object
+ * @param  res: Result so far
+ * @retval FatFs result: res, or the result of f_close
+ */
+static FRESULT TABLE_Release( TABLE_File* t, FRESULT res )
+{
+	if ( res == FR_OK )
+		res = f_close( &t->File );
+	else
+		f_close( &t->File );
+	POOL_Free( t->Buf );
+	t->Buf = NULL;
+	t->Writing = 0;
+	return res;
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Open the table for lookups and load its index
+ * @param  t: Table file object
+ * @param  path: File name
+ * @param  index: Array of index entries, stays in use until TABLE_Close
+ * @param  index_len: Number of entries, TABLE_IndexLen( RecSize, Records ) of them for
+ *         lookups in one data sector
+ * @retval FatFs result:
+ *         - FR_DENIED: The file is not a table
+ *         - FR_NOT_ENOUGH_CORE: No free pool block
+ */
+FRESULT TABLE_Open( TABLE_File* t, const TCHAR* path, uint32_t* index, uint32_t index_len )
+{
+	FRESULT res;
+	TABLE_Header hdr;
+	uint32_t i;
+	UINT n;
+
+	if ( index == NULL || index_len == 0 )
+		return FR_INVALID_PARAMETER;
+	t->Buf = (uint8_t*)POOL_Alloc();
+	if ( t->Buf == NULL )
+		return FR_NOT_ENOUGH_CORE;
+	t->Writing = 0;
+	res = f_open( &t->File, path, FA_READ | FA_OPEN_EXISTING );
+	if ( res != FR_OK )
+	{
+		POOL_Free( t->Buf );
+		t->Buf = NULL;
+		return res;
+	}
+
+	res = f_read( &t->File, t->Buf, TABLE_SECTOR, &n );
+	memcpy( &hdr, t->Buf, sizeof( hdr ) );
+	if ( res == FR_OK && ( n != TABLE_SECTOR || hdr.Magic != TABLE_HEADER_MAGIC ||
+			hdr.Check != TABLE_HeaderCheck( &hdr ) ||
+			hdr.RecSize < TABLE_KEY || hdr.RecSize > TABLE_SECTOR ||
+			hdr.Sectors != TABLE_IndexLen( hdr.RecSize, hdr.Records ) ||
+			hdr.IndexSectors < ( hdr.Sectors + TABLE_INDEX_KEYS - 1 ) / TABLE_INDEX_KEYS ||
+			t->File.fsize != ( 1 + hdr.IndexSectors + hdr.Sectors ) * TABLE_SECTOR ) )
+		res = FR_DENIED;
+	if ( res != FR_OK )
+		return TABLE_Release( t, res );
+	t->RecSize = hdr.RecSize;
+	t->PerSector = TABLE_SECTOR / hdr.RecSize;
+	t->Records = hdr.Records;
+	t->Sectors = hdr.Sectors;
+	t->IndexSectors = hdr.IndexSectors;
+	t->Index = index;
+	t->IndexLen = index_len;
+	t->Stride = ( t->Sectors + index_len - 1 ) / index_len;
+	if ( t->Stride == 0 )
+		t->Stride = 1;
+#if _USE_VIEW
+	t->View.sect = 0;
+#endif /* _USE_VIEW */
+
+	/* index sectors follow the header: keep every Stride-th key */
+	for ( i = 0; i < t->Sectors && res == FR_OK; ++i )
+	{
+		if ( i % TABLE_INDEX_KEYS == 0 )
+		{
+			res = f_read( &t->File, t->Buf, TABLE_SECTOR, &n );
+			if ( res == FR_OK && n != TABLE_SECTOR )
+				res = FR_INT_ERR;
+		}
+		if ( i % t->Stride == 0 )
+			index[ i / t->Stride ] = TABLE_Get32( t->Buf + ( i % TABLE_INDEX_KEYS ) * TABLE_KEY );
+	}
+	if ( res != FR_OK )
+		res = TABLE_Release( t, res );
+	return res;
+}
+
+/**
+ * @brief  Find the record of the key
+ * @param  t: Table file object, open by TABLE_Open
+ * @param  key: Key
+ * @param  record: Receives the record (RecSize bytes)
+ * @param  exact: Zero to get the record of the greatest key not above key (e.g. the lower
+ *         point for interpolation of calibration data), nonzero for key only
+ * @retval FatFs result:
+ *         - FR_NO_FILE: No such record
+ */
+FRESULT TABLE_Find( TABLE_File* t, uint32_t key, void* record, uint8_t exact )
+{
+	FRESULT res;
+	const uint8_t* data;
+	uint32_t lo, hi, mid, count;
+
+	if ( t->Buf == NULL || t->Writing )
+		return FR_INVALID_OBJECT;
+	if ( t->Records == 0 || key < t->Index[ 0 ] )
+		return FR_NO_FILE;
+
+	/* index entry: the last one with the first key not above key */
+	lo = 0;
+	hi = ( t->Sectors - 1 ) / t->Stride;
+	while ( lo < hi )
+	{
+		mid = ( lo + hi + 1 ) / 2;
+		if ( t->Index[ mid ] <= key )
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	/* sparse index: the data sector among Stride of them by their first keys */
+	lo *= t->Stride;
+	hi = lo + t->Stride - 1;
+	if ( hi > t->Sectors - 1 )
+		hi = t->Sectors - 1;
+	while ( lo < hi )
+	{
+		mid = ( lo + hi + 1 ) / 2;
+		res = TABLE_Map( t, 1 + t->IndexSectors + mid, &data );
+		if ( res != FR_OK )
+			return res;
+		if ( TABLE_Get32( data ) <= key )
+			lo = mid;
+		else
+			hi = mid - 1;
+		TABLE_Unmap( t );
+	}
+
+	res = TABLE_Map( t, 1 + t->IndexSectors + lo, &data );
+	if ( res != FR_OK )
+		return res;
+	count = t->Records - lo * t->PerSector;
+	if ( count > t->PerSector )
+		count = t->PerSector;
+	lo = 0;
+	hi = count - 1;
+	while ( lo < hi )
+	{
+		mid = ( lo + hi + 1 ) / 2;
+		if ( TABLE_Get32( data + mid * t->RecSize ) <= key )
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	data += lo * t->RecSize;
+	if ( exact && TABLE_Get32( data ) != key )
+		res = FR_NO_FILE;
+	else
+		memcpy( record, data, t->RecSize );
+	TABLE_Unmap( t );
+	return res;
+}
+
+/**
+ * @brief  Create the table file to be filled by TABLE_Append
+ * @param  t: Table file object
+ * @param  path: File name, an existing file is overwritten
+ * @param  rec_size: Record size in bytes (TABLE_KEY .. TABLE_SECTOR)
+ * @param  index: Array of index entries, stays in use until TABLE_Close
+ * @param  index_len: Number of entries, TABLE_IndexLen( rec_size, records ) of them for
+ *         up to records records
+ * @retval FatFs result:
+ *         - FR_NOT_ENOUGH_CORE: No free pool block
+ */
+FRESULT TABLE_Create( TABLE_File* t, const TCHAR* path, uint16_t rec_size, uint32_t* index, uint32_t index_len )
+{
+	FRESULT res;
+	DWORD base;
+
+	if ( rec_size < TABLE_KEY || rec_size > TABLE_SECTOR || index == NULL || index_len == 0 )
+		return FR_INVALID_PARAMETER;
+	t->Buf = (uint8_t*)POOL_Alloc();
+	if ( t->Buf == NULL )
+		return FR_NOT_ENOUGH_CORE;
+	memset( t->Buf, 0, TABLE_SECTOR );
+	t->RecSize = rec_size;
+	t->PerSector = TABLE_SECTOR / rec_size;
+	t->Records = 0;
+	t->Sectors = 0;
+	t->IndexSectors = ( index_len + TABLE_INDEX_KEYS - 1 ) / TABLE_INDEX_KEYS;
+	t->Index = index;
+	t->IndexLen = index_len;
+	t->Stride = 1;
+	t->LastKey = 0;
+	t->Writing = 1;
+	res = f_open( &t->File, path, FA_WRITE | FA_CREATE_ALWAYS );
+	if ( res != FR_OK )
+	{
+		POOL_Free( t->Buf );
+		t->Buf = NULL;
+		t->Writing = 0;
+		return res;
+	}
+
+	/* data go after the space of header and index, they are written by TABLE_Close;
+	   empty header until then: new clusters may hold a valid header of an old table */
+	base = ( 1 + t->IndexSectors ) * TABLE_SECTOR;
+	res = TABLE_WriteBuf( t );
+	if ( res == FR_OK )
+		res = f_lseek( &t->File, base );
+	if ( res == FR_OK && t->File.fptr != base )
+		res = FR_DENIED;		/* disk full */
+	if ( res != FR_OK )
+		res = TABLE_Release( t, res );
+	return res;
+}
+
+/**
+ * @brief  Append a record to the table being created, keys have to increase
+ * @param  t: Table file object, open by TABLE_Create
+ * @param  record: Record (RecSize bytes), key is its first word (little endian)
+ * @retval FatFs result:
+ *         - FR_INVALID_PARAMETER: Key is not above the key of the previous record
+ *         - FR_DENIED: Index is full (index_len of TABLE_Create) or disk is full
+ */
+FRESULT TABLE_Append( TABLE_File* t, const void* record )
+{
+	uint32_t key = TABLE_Get32( (const uint8_t*)record );
+	uint32_t pos = t->Records % t->PerSector;
+
+	if ( t->Buf == NULL || !t->Writing )
+		return FR_INVALID_OBJECT;
+	if ( t->Records != 0 && key <= t->LastKey )
+		return FR_INVALID_PARAMETER;
+	if ( pos == 0 )
+	{	/* new data sector */
+		if ( t->Sectors == t->IndexLen )
+			return FR_DENIED;
+		t->Index[ t->Sectors++ ] = key;
+	}
+	memcpy( t->Buf + pos * t->RecSize, record, t->RecSize );
+	t->Records++;
+	t->LastKey = key;
+	return ( pos + 1 == t->PerSector ) ? TABLE_WriteBuf( t ) : FR_OK;
+}
+
+/**
+ * @brief  Close the table. A table being created gets its last data sector,
+ *         the index and the header (the header last: a table interrupted
+ *         before it is not opened by TABLE_Open).
+ * @param  t: Table file object
+ * @retval FatFs result
+ */
+FRESULT TABLE_Close( TABLE_File* t )
+{
+	FRESULT res = FR_OK;
+	TABLE_Header hdr;
+	uint32_t i, n;
+
+	if ( t->Buf == NULL )
+		return FR_INVALID_OBJECT;
+	if ( t->Writing )
+	{
+		if ( t->Records % t->PerSector != 0 )
+			res = TABLE_WriteBuf( t );
+		for ( i = 0; i < t->IndexSectors && res == FR_OK; ++i )
+		{
+			n = t->Sectors - i * TABLE_INDEX_KEYS;
+			if ( (int32_t)n > 0 )
+				memcpy( t->Buf, t->Index + i * TABLE_INDEX_KEYS, ( ( n > TABLE_INDEX_KEYS ) ? TABLE_INDEX_KEYS : n ) * TABLE_KEY );
+			res = f_lseek( &t->File, ( 1 + i ) * TABLE_SECTOR );
+			if ( res == FR_OK )
+				res = TABLE_WriteBuf( t );
+		}
+		if ( res == FR_OK )
+			res = f_sync( &t->File );
+		if ( res == FR_OK )
+		{
+			memset( &hdr, 0, sizeof( hdr ) );
+			hdr.Magic = TABLE_HEADER_MAGIC;
+			hdr.RecSize = t->RecSize;
+			hdr.Records = t->Records;
+			hdr.Sectors = t->Sectors;
+			hdr.IndexSectors = t->IndexSectors;
+			hdr.Check = TABLE_HeaderCheck( &hdr );
+			memcpy( t->Buf, &hdr, sizeof( hdr ) );
+			res = f_lseek( &t->File, 0 );
+		}
+		if ( res == FR_OK )
+			res = TABLE_WriteBuf( t );
+	}
+	return TABLE_Release( t, res );
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#endif /* USE_FAT_TABLE */
@@ -0,0 +1,145 @@
+/**
+ ******************************************************************************
+ * @file    fftable.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Lookup tables on the card: file of fixed-size records sorted by
+ *          a 32-bit key, found by binary search instead of a linear scan.
+ *          Data sectors hold whole records only (the rest of a sector is
+ *          padding), and the first key of every data sector is stored in
+ *          index sectors ahead of the data. TABLE_Open loads the index into
+ *          a RAM array of the caller, so a lookup is a binary search in RAM,
+ *          one f_lseek (fast seek of the file opened for reading) and one
+ *          sector, in place in the sector cache with f_view. A shorter RAM
+ *          array keeps the first key of every Stride-th sector, a lookup
+ *          reads log2( Stride ) more sectors then.
+ *
+ *          File (TABLE_SECTOR sectors, all fields are little endian):
+ *            0: header (TABLE_Header)
+ *            1 .. IndexSectors: first key of each data sector (32 bits)
+ *            1 + IndexSectors ..: data sectors, record key is its first word
+ *          Tables are built on the card by TABLE_Create/TABLE_Append, or on
+ *          a PC by tools/table_build.py.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef FFTABLE_H
+#define FFTABLE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "ff.h"
+
+#include <stdint.h>
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Constants
+ * @{
+ */
+
+/**
+ * @brief  Sector of the table file, records per data sector are TABLE_SECTOR / RecSize
+ */
+#define TABLE_SECTOR			512
+
+/**
+ * @brief  Size of the record key (the first word of the record)
+ */
+#define TABLE_KEY				4
+
+/**
+ * @}
+ *//* STM32_Exported_Constants */
+
+/** @defgroup STM32_Exported_Types
+ * @{
+ */
+
+/**
+ * @brief  Table header, at the beginning of sector 0 (the rest of the sector is zero)
+ */
+typedef struct
+{
+	uint32_t	Magic;				/*!< TABLE_HEADER_MAGIC */
+	uint16_t	RecSize;			/*!< Record size in bytes, TABLE_KEY .. TABLE_SECTOR */
+	uint16_t	Reserved;
+	uint32_t	Records;			/*!< Number of records */
+	uint32_t	Sectors;			/*!< Number of data sectors */
+	uint32_t	IndexSectors;		/*!< Number of index sectors */
+	uint32_t	Check;				/*!< Inverted XOR of the words above */
+} TABLE_Header;
+
+/**
+ * @brief  Table file object
+ */
+typedef struct
+{
+	FIL			File;			/*!< Table file */
+	uint16_t	RecSize;		/*!< Record size in bytes */
+	uint16_t	PerSector;		/*!< Records per data sector */
+	uint32_t	Records;		/*!< Number of records */
+	uint32_t	Sectors;		/*!< Number of data sectors */
+	uint32_t	IndexSectors;	/*!< Number of index sectors */
+	uint32_t*	Index;			/*!< First keys of every Stride-th data sector (array of the caller) */
+	uint32_t	IndexLen;		/*!< Number of entries of the array */
+	uint32_t	Stride;			/*!< Data sectors per index entry */
+	uint8_t*	Buf;			/*!< Sector being built, or read without f_view (pool block) */
+#if _USE_VIEW
+	FVIEW		View;			/*!< Sector mapped by a lookup */
+#endif /* _USE_VIEW */
+	uint32_t	LastKey;		/*!< Key of the last appended record */
+	uint8_t		Writing;		/*!< Table is being built */
+} TABLE_File;
+
+/**
+ * @}
+ *//* STM32_Exported_Types */
+
+/** @defgroup STM32_Exported_Macros
+ * @{
+ */
+
+/**
+ * @brief  Number of index entries (uint32_t) for a lookup in one data sector,
+ *         and for building a table of up to the given number of records
+ */
+#define TABLE_IndexLen( rec_size, records ) \
+	( ( (records) + TABLE_SECTOR / (rec_size) - 1 ) / ( TABLE_SECTOR / (rec_size) ) )
+
+/**
+ * @}
+ *//* STM32_Exported_Macros */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+FRESULT TABLE_Open( TABLE_File* t, const TCHAR* path, uint32_t* index, uint32_t index_len );
+FRESULT TABLE_Find( TABLE_File* t, uint32_t key, void* record, uint8_t exact );
+FRESULT TABLE_Create( TABLE_File* t, const TCHAR* path, uint16_t rec_size, uint32_t* index, uint32_t index_len );
+FRESULT TABLE_Append( TABLE_File* t, const void* record );
+FRESULT TABLE_Close( TABLE_File* t );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FFTABLE_H */
@@ -0,0 +1,338 @@
+/**
+ ******************************************************************************
+ * @file    ffwq.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Write queues of FatFs files served by one writer task (see ffwq.h).
+ *          The writer holds the list lock for a whole pass over the files, so
+ *          FWQ_Close unlinks a file only between two passes. Each file stands
+ *          as the consumer of its queue: a commit completing a sector wakes
+ *          the writer, and a pass which has written nothing puts it to sleep.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#ifdef USE_FAT_WRITE_QUEUE
+
+#include "ffwq.h"
+
+#include <string.h>
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#if _FS_MINIMIZE > 2 || _FS_READONLY || !_FS_REENTRANT
+#error USE_FAT_WRITE_QUEUE needs f_lseek, writing functions and reentrancy of FatFs (see ffconf.h)
+#endif
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Private_Defines
+ * @{
+ */
+
+/**
+ * @brief  Writer task: above the producers, so a queued sector goes out as soon as
+ *         it is complete instead of when the producer blocks
+ */
+#define FWQ_TASK_PRIO			( tskIDLE_PRIORITY + 2 )
+#define FWQ_TASK_STACK			( configMINIMAL_STACK_SIZE * 2 )
+
+/**
+ * @brief  Unit of the turns, a turn ends on a multiple of it in the file
+ */
+#define FWQ_SECTOR				_MAX_SS
+
+/**
+ * @}
+ *//* STM32_Private_Defines */
+
+
+/** @defgroup STM32_Private_Variables
+ * @{
+ */
+
+static FWQ_File* FWQ_Files;				/* open files in the order of FWQ_Open */
+static xSemaphoreHandle FWQ_Lock;		/* guards the list, held by the writer for a pass */
+static xStaticSemaphore FWQ_LockBuffer;
+static xTaskHandle FWQ_Handle;
+static xStaticTask FWQ_TaskBuffer;
+static portSTACK_TYPE FWQ_TaskStack[ FWQ_TASK_STACK ];
+
+/**
+ * @}
+ *//* STM32_Private_Variables */
+
+
+/** @defgroup STM32_Private_Functions
+ * @{
+ */
+
+/**
+ * @brief  Number of bytes the file writes in its turn: up to Quantum, ending on
+ *         a sector boundary of the file unless the turn writes the last bytes for FWQ_Sync
+ * @param  wf: Queued file object
+ * @retval Number of bytes, 0 if no sector of the file is complete
+ */
+static uint32_t FWQ_TurnBytes( FWQ_File* wf )
+{
+	uint32_t n = STREAM_Available( &wf->Queue );
+	uint32_t pos = wf->File.fptr, end;
+
+	if ( wf->Flush && n <= wf->Quantum )
+		return n;
+	if ( n > wf->Quantum )
+		n = wf->Quantum;
+	end = ( pos + n ) & ~( FWQ_SECTOR - 1 );
+	return ( end > pos ) ? end - pos : 0;
+}
+
+/**
+ * @brief  Gives the file its turn: writes queued data, and completes FWQ_Sync
+ *         when the queue is empty. Data are dropped after an error (kept in Result),
+ *         so the producer is never blocked by a failed file.
+ * @param  wf: Queued file object
+ * @retval Nonzero if the file has done something
+ */
+static uint8_t FWQ_Turn( FWQ_File* wf )
+{
+	FRESULT res;
+	xTaskHandle task;
+	void* region;
+	uint32_t n = FWQ_TurnBytes( wf ), part;
+	UINT bw;
+
+	if ( n == 0 && !wf->Flush )
+		return 0;
+	if ( n != 0 )
+		wf->Turns++;
+	while ( n != 0 )
+	{	/* two parts if the data wrap around the end of the queue */
+		part = STREAM_Peek( &wf->Queue, &region );
+		if ( part > n )
+			part = n;
+		if ( wf->Result == FR_OK )
+		{
+			res = f_write( &wf->File, region, part, &bw );
+			if ( res == FR_OK && bw != part )
+				res = FR_DENIED;	/* volume is full */
+			wf->Result = res;
+		}
+		STREAM_Release( &wf->Queue, part );
+		n -= part;
+	}
+
+	if ( wf->Flush && STREAM_Available( &wf->Queue ) == 0 )
+	{
+		res = f_sync( &wf->File );
+		if ( wf->Result == FR_OK )
+			wf->Result = res;
+		wf->Flush = 0;
+		task = wf->Syncer;
+		if ( task != NULL )
+		{
+			wf->Syncer = NULL;
+			xTaskNotifyGive( task );
+		}
+	}
+	return 1;
+}
+
+/**
+ * @brief  Writer task: passes over the open files, each pass gives one turn to each
+ *         file, until a pass finds nothing to do
+ * @param  pvParameters: Not used
+ * @retval None
+ */
+static void FWQ_Task( void* pvParameters )
+{
+	FWQ_File* wf;
+	uint8_t busy;
+
+	(void)pvParameters;
+	for ( ;; )
+	{
+		busy = 0;
+		xSemaphoreTake( FWQ_Lock, portMAX_DELAY );
+		for ( wf = FWQ_Files; wf != NULL; wf = wf->Next )
+		{
+			wf->Queue.Reader = FWQ_Handle;		/* re-armed before the check, see stm32_stream.c */
+			busy |= FWQ_Turn( wf );
+		}
+		xSemaphoreGive( FWQ_Lock );
+		if ( !busy )
+			ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+	}
+}
+
+/**
+ * @}
+ *//* STM32_Private_Functions */
+
+
+/** @defgroup STM32_Public_Functions
+ * @{
+ */
+
+/**
+ * @brief  Creates the writer task, has to be called before scheduler is started
+ * @param  None
+ * @retval None
+ */
+void FWQ_Init( void )
+{
+	FWQ_Lock = xSemaphoreCreateMutexStatic( &FWQ_LockBuffer );
+	xTaskCreateStatic( FWQ_Task, (const signed char* const)"FWQ", FWQ_TASK_STACK, NULL, FWQ_TASK_PRIO, &FWQ_Handle, FWQ_TaskStack, &FWQ_TaskBuffer );
+}
+
+/**
+ * @brief  Opens the file for appending (creates it if it doesn't exist) and adds it
+ *         to the files served by the writer task
+ * @param  wf: Queued file object
+ * @param  path: File name
+ * @param  buf: Storage of the queue, has to stay valid until FWQ_Close
+ * @param  size: Size of the storage in bytes, power of 2 (at least two turns of
+ *         the file keep the producer going while one is written)
+ * @param  quantum: Sectors written in one turn of the file (1 .. size / sector),
+ *         the share of the card bandwidth the file gets while others are busy
+ * @retval FatFs result
+ */
+FRESULT FWQ_Open( FWQ_File* wf, const TCHAR* path, void* buf, uint32_t size, uint32_t quantum )
+{
+	FRESULT res;
+
+	if ( quantum == 0 || quantum > size / FWQ_SECTOR ||
+			STREAM_Init( &wf->Queue, buf, size, FWQ_SECTOR ) != SUCCESS )
+		return FR_INVALID_PARAMETER;
+	res = f_open( &wf->File, path, FA_WRITE | FA_OPEN_ALWAYS );
+	if ( res != FR_OK )
+		return res;
+	res = f_lseek( &wf->File, wf->File.fsize );
+	if ( res != FR_OK )
+	{
+		f_close( &wf->File );
+		return res;
+	}
+
+	wf->Quantum = quantum * FWQ_SECTOR;
+	wf->Flush = 0;
+	wf->Syncer = NULL;
+	wf->Result = FR_OK;
+	wf->Turns = 0;
+	wf->Next = NULL;
+
+	xSemaphoreTake( FWQ_Lock, portMAX_DELAY );
+	if ( FWQ_Files == NULL )
+		FWQ_Files = wf;
+	else
+	{
+		FWQ_File* last = FWQ_Files;
+
+		while ( last->Next != NULL )
+			last = last->Next;
+		last->Next = wf;
+	}
+	xSemaphoreGive( FWQ_Lock );
+	return FR_OK;
+}
+
+/**
+ * @brief  Queues data of the file (the producer task of the file only)
+ * @param  wf: Queued file object
+ * @param  data: Data, copied into the queue
+ * @param  len: Number of bytes
+ * @param  timeout: Timeout of each wait for free space in ticks
+ * @retval Number of bytes queued, less than len on timeout
+ */
+uint32_t FWQ_Write( FWQ_File* wf, const void* data, uint32_t len, portTickType timeout )
+{
+	void* region;
+	uint32_t done = 0, n;
+
+	while ( done < len )
+	{
+		n = STREAM_Acquire( &wf->Queue, &region );
+		if ( n == 0 )
+		{	/* queue is full: wait for a turn of the file */
+			n = len - done;
+			if ( n > wf->Quantum )
+				n = wf->Quantum;
+			if ( STREAM_WaitSpace( &wf->Queue, n, timeout ) < n )
+				break;
+			continue;
+		}
+		if ( n > len - done )
+			n = len - done;
+		memcpy( region, (const uint8_t*)data + done, n );
+		STREAM_Commit( &wf->Queue, n );
+		done += n;
+	}
+	return done;
+}
+
+/**
+ * @brief  Waits until all queued data of the file are written, then syncs the file
+ *         (the producer task of the file only)
+ * @param  wf: Queued file object
+ * @retval FatFs result: the first error of the file since FWQ_Open
+ */
+FRESULT FWQ_Sync( FWQ_File* wf )
+{
+	wf->Flush = 1;
+	xTaskNotifyGive( FWQ_Handle );
+	for ( ;; )
+	{
+		wf->Syncer = xTaskGetCurrentTaskHandle();
+		if ( !wf->Flush )
+			break;
+		ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+	}
+	wf->Syncer = NULL;
+	return wf->Result;
+}
+
+/**
+ * @brief  Writes queued data, removes the file from the writer task and closes it
+ * @param  wf: Queued file object
+ * @retval FatFs result: the first error of the file since FWQ_Open
+ */
+FRESULT FWQ_Close( FWQ_File* wf )
+{
+	FWQ_File** link;
+	FRESULT res = FWQ_Sync( wf );
+
+	xSemaphoreTake( FWQ_Lock, portMAX_DELAY );
+	for ( link = &FWQ_Files; *link != NULL; link = &( *link )->Next )
+	{
+		if ( *link == wf )
+		{
+			*link = wf->Next;
+			break;
+		}
+	}
+	xSemaphoreGive( FWQ_Lock );
+
+	wf->Queue.Reader = NULL;
+	if ( res == FR_OK )
+		res = f_close( &wf->File );
+	else
+		f_close( &wf->File );
+	return res;
+}
+
+/**
+ * @}
+ *//* STM32_Public_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#endif /* USE_FAT_WRITE_QUEUE */
@@ -0,0 +1,93 @@
+/**
+ ******************************************************************************
+ * @file    ffwq.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Write queues of FatFs files served by one writer task.
+ *          Each open file has its own stream buffer: the producer task of the
+ *          file only copies data into it, the writer task visits the files
+ *          round-robin and gives each file with a full sector queued one turn
+ *          of up to Quantum sectors, written by one f_write ending on a sector
+ *          boundary of the file. So a high rate file and a few low rate logs
+ *          share the card in sector-sized batches: data sectors go straight
+ *          from the queues to the card, and a small write of one log never
+ *          moves the FatFs window away from the state of another file between
+ *          two of its sectors. Data of less than a sector stay queued until
+ *          FWQ_Sync or FWQ_Close of the file.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef FFWQ_H
+#define FFWQ_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "ff.h"
+#include "stm32_stream.h"
+
+#include <stdint.h>
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/** @addtogroup Utilities
+ * @{
+ */
+
+/** @defgroup STM32_Exported_Types
+ * @{
+ */
+
+/**
+ * @brief  Queued file object, owned by one producer task while it is open
+ */
+typedef struct _FWQ_File FWQ_File;
+
+struct _FWQ_File
+{
+	FIL						File;		/*!< FatFs file, accessed only by the writer task while it is open */
+	STREAM_Buffer			Queue;		/*!< Data waiting for the writer task */
+	uint32_t				Quantum;	/*!< Bytes written in one turn of the file (whole sectors) */
+	volatile uint8_t		Flush;		/*!< FWQ_Sync waits for the queue to be written and synced */
+	xTaskHandle volatile	Syncer;		/*!< Task blocked in FWQ_Sync, or NULL */
+	volatile FRESULT		Result;		/*!< First error of the writer task, FR_OK if none */
+	uint32_t				Turns;		/*!< Turns given to the file (for statistics) */
+	FWQ_File*				Next;		/*!< Next open file */
+};
+
+/**
+ * @}
+ *//* STM32_Exported_Types */
+
+/** @defgroup STM32_Exported_Functions
+ * @{
+ */
+
+void FWQ_Init( void );
+
+FRESULT FWQ_Open( FWQ_File* wf, const TCHAR* path, void* buf, uint32_t size, uint32_t quantum );
+uint32_t FWQ_Write( FWQ_File* wf, const void* data, uint32_t len, portTickType timeout );
+FRESULT FWQ_Sync( FWQ_File* wf );
+FRESULT FWQ_Close( FWQ_File* wf );
+
+/**
+ * @}
+ *//* STM32_Exported_Functions */
+
+/**
+ * @}
+ *//* Utilities */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FFWQ_H */
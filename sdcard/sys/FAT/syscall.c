@@ -0,0 +1,122 @@
+/*------------------------------------------------------------------------*/
+/* OS dependent controls for FatFs R0.09 on FreeRTOS                      */
+/*------------------------------------------------------------------------*/
+/* Each volume has its own mutex, so tasks working on different volumes  */
+/* do not wait for each other. Mutex (not binary semaphore) is used to   */
+/* get priority inheritance while the owner waits for the SD I/O task.   */
+/*------------------------------------------------------------------------*/
+
+#include "ff.h"
+
+#ifdef USE_WATCHDOG
+#include "watchdog.h"
+#endif
+
+#if _FS_PROGRESS
+
+static void (*ff_progress_func)(DWORD, DWORD);	/* Callback of the application */
+
+/*------------------------------------------------------------------------*/
+/* Report Progress of a Long Operation                                    */
+/*------------------------------------------------------------------------*/
+/* This function is called by the full FAT scan of f_getfree() after each
+/  sector. It kicks the watchdog: the volume is locked and the scan of a
+/  large card takes seconds. */
+
+void ff_progress (
+	DWORD done,			/* Number of sectors done */
+	DWORD total			/* Number of sectors of the operation */
+)
+{
+#ifdef USE_WATCHDOG
+	Watchdog_Kick();
+#endif
+	if (ff_progress_func) ff_progress_func(done, total);
+}
+
+
+
+/*------------------------------------------------------------------------*/
+/* Set Progress Callback                                                  */
+/*------------------------------------------------------------------------*/
+/* The callback runs in the task calling FatFs with the volume locked, so
+/  it must not call FatFs functions of the volume. */
+
+void ff_set_progress (
+	void (*func)(DWORD, DWORD)	/* Callback, 0 to remove it */
+)
+{
+	ff_progress_func = func;
+}
+
+#endif	/* _FS_PROGRESS */
+
+
+
+#if _FS_REENTRANT
+
+/*------------------------------------------------------------------------*/
+/* Create a Synchronization Object                                        */
+/*------------------------------------------------------------------------*/
+/* This function is called by f_mount() to create a new sync object for
+/  the volume. When the function returns 0, f_mount() fails with FR_INT_ERR.
+/  The mutex of each volume has its own memory (no heap), f_mount() deletes
+/  the old one before it is created again. */
+
+static xStaticSemaphore ff_syncobj_buf[_VOLUMES];
+
+int ff_cre_syncobj (	/* 1:Function succeeded, 0:Could not create due to any error */
+	BYTE vol,			/* Corresponding logical drive being processed */
+	_SYNC_t *sobj		/* Pointer to return the created sync object */
+)
+{
+	*sobj = xSemaphoreCreateMutexStatic(&ff_syncobj_buf[vol]);
+	return (*sobj != NULL) ? 1 : 0;
+}
+
+
+
+/*------------------------------------------------------------------------*/
+/* Delete a Synchronization Object                                        */
+/*------------------------------------------------------------------------*/
+/* This function is called by f_mount() to delete the sync object of the
+/  volume being unregistered. */
+
+int ff_del_syncobj (	/* 1:Function succeeded, 0:Could not delete due to any error */
+	_SYNC_t sobj		/* Sync object tied to the logical drive to be deleted */
+)
+{
+	vQueueDelete(sobj);
+	return 1;
+}
+
+
+
+/*------------------------------------------------------------------------*/
+/* Request Grant to Access the Volume                                     */
+/*------------------------------------------------------------------------*/
+/* This function is called on entering file functions to lock the volume.
+/  When it returns 0, the file function fails with FR_TIMEOUT. */
+
+int ff_req_grant (	/* 1:Got a grant to access the volume, 0:Could not get a grant */
+	_SYNC_t sobj	/* Sync object to wait */
+)
+{
+	return (xSemaphoreTake(sobj, _FS_TIMEOUT) == pdTRUE) ? 1 : 0;
+}
+
+
+
+/*------------------------------------------------------------------------*/
+/* Release Grant to Access the Volume                                     */
+/*------------------------------------------------------------------------*/
+/* This function is called on leaving file functions to unlock the volume. */
+
+void ff_rel_grant (
+	_SYNC_t sobj	/* Sync object to be signaled */
+)
+{
+	xSemaphoreGive(sobj);
+}
+
+#endif	/* _FS_REENTRANT */
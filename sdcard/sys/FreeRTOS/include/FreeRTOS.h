@@ -144,6 +144,51 @@ typedef portBASE_TYPE (*pdTASK_HOOK_CODE)( void * );
 	#define configUSE_RECURSIVE_MUTEXES 0
 #endif
 
+#ifndef configUSE_TICKLESS_IDLE
+	#define configUSE_TICKLESS_IDLE 0
+#endif
+
+#ifndef configUSE_TASK_NOTIFICATIONS
+	#define configUSE_TASK_NOTIFICATIONS 0
+#endif
+
+#ifndef configUSE_TIMERS
+	#define configUSE_TIMERS 0
+#endif
+
+#if ( configUSE_TIMERS == 1 )
+
+	#ifndef configTIMER_TASK_PRIORITY
+		#error If configUSE_TIMERS is set to 1 then configTIMER_TASK_PRIORITY must also be defined.
+	#endif /* configTIMER_TASK_PRIORITY */
+
+	#ifndef configTIMER_QUEUE_LENGTH
+		#error If configUSE_TIMERS is set to 1 then configTIMER_QUEUE_LENGTH must also be defined.
+	#endif /* configTIMER_QUEUE_LENGTH */
+
+	#ifndef configTIMER_TASK_STACK_DEPTH
+		#error If configUSE_TIMERS is set to 1 then configTIMER_TASK_STACK_DEPTH must also be defined.
+	#endif /* configTIMER_TASK_STACK_DEPTH */
+
+#endif /* configUSE_TIMERS */
+
+#ifndef configSUPPORT_STATIC_ALLOCATION
+	#define configSUPPORT_STATIC_ALLOCATION 0
+#endif
+
+#ifndef configUSE_PORT_OPTIMISED_TASK_SELECTION
+	#define configUSE_PORT_OPTIMISED_TASK_SELECTION 0
+#endif
+
+#ifndef configUSE_NEWLIB_REENTRANT
+	#define configUSE_NEWLIB_REENTRANT 0
+#endif
+
+#if ( configUSE_NEWLIB_REENTRANT == 1 )
+	/* Each TCB holds a newlib reent structure. */
+	#include <reent.h>
+#endif
+
 #ifndef configUSE_MUTEXES
 	#define configUSE_MUTEXES 0
 #endif
@@ -416,5 +461,79 @@ typedef portBASE_TYPE (*pdTASK_HOOK_CODE)( void * );
 	#define vPortFreeAligned( pvBlockToFree ) vPortFree( pvBlockToFree )
 #endif
 
+#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+
+	#include "list.h"
+
+	/*
+	 * Memory of kernel objects created by the application: xTaskCreateStatic(),
+	 * xQueueCreateStatic(), the static semaphore macros and xTimerCreateStatic().
+	 * The structures have the size and alignment of the private structures of
+	 * the kernel (checked when tasks.c, queue.c and timers.c are compiled), so
+	 * objects can be defined as ordinary variables and placed by the linker.
+	 * The members are not to be used.
+	 */
+	typedef struct xSTATIC_TCB
+	{
+		void					*pxDummy1;
+		#if ( portUSING_MPU_WRAPPERS == 1 )
+			xMPU_SETTINGS		xDummy2;
+		#endif
+		xListItem				xDummy3[ 2 ];
+		unsigned portBASE_TYPE	uxDummy4;
+		void					*pxDummy5;
+		signed char				ucDummy6[ configMAX_TASK_NAME_LEN ];
+		#if ( portSTACK_GROWTH > 0 )
+			void				*pxDummy7;
+		#endif
+		#if ( portCRITICAL_NESTING_IN_TCB == 1 )
+			unsigned portBASE_TYPE uxDummy8;
+		#endif
+		#if ( configUSE_TRACE_FACILITY == 1 )
+			unsigned portBASE_TYPE uxDummy9;
+		#endif
+		#if ( configUSE_MUTEXES == 1 )
+			unsigned portBASE_TYPE uxDummy10;
+		#endif
+		#if ( configUSE_APPLICATION_TASK_TAG == 1 )
+			void				*pxDummy11;
+		#endif
+		#if ( configGENERATE_RUN_TIME_STATS == 1 )
+			unsigned long		ulDummy12;
+		#endif
+		#if ( configUSE_TASK_NOTIFICATIONS == 1 )
+			unsigned long		ulDummy13;
+			unsigned char		ucDummy14;
+		#endif
+		#if ( configUSE_NEWLIB_REENTRANT == 1 )
+			struct _reent		xDummy15;
+		#endif
+		unsigned char			ucDummy16;
+	} xStaticTask;
+
+	typedef struct xSTATIC_QUEUE
+	{
+		void					*pvDummy1[ 4 ];
+		xList					xDummy2[ 2 ];
+		unsigned portBASE_TYPE	uxDummy3[ 3 ];
+		signed portBASE_TYPE	xDummy4[ 2 ];
+		unsigned char			ucDummy5;
+	} xStaticQueue;
+
+	/* Semaphores and mutexes are queues. */
+	typedef xStaticQueue xStaticSemaphore;
+
+	typedef struct xSTATIC_TIMER
+	{
+		const void				*pvDummy1;
+		portTickType			xDummy2[ 2 ];
+		unsigned portBASE_TYPE	uxDummy3;
+		void					*pvDummy4[ 3 ];
+		unsigned portBASE_TYPE	uxDummy5;
+		unsigned char			ucDummy6;
+	} xStaticTimer;
+
+#endif /* configSUPPORT_STATIC_ALLOCATION */
+
 #endif /* INC_FREERTOS_H */
 
@@ -356,6 +356,8 @@ void *pvPortMalloc( size_t xSize ) PRIVILEGED_FUNCTION;
 void vPortFree( void *pv ) PRIVILEGED_FUNCTION;
 void vPortInitialiseBlocks( void ) PRIVILEGED_FUNCTION;
 size_t xPortGetFreeHeapSize( void ) PRIVILEGED_FUNCTION;
+size_t xPortGetMinimumEverFreeHeapSize( void ) PRIVILEGED_FUNCTION;	/* heap_4.c only */
+size_t xPortGetLargestFreeBlock( void ) PRIVILEGED_FUNCTION;		/* heap_4.c only */
 
 /*
  * Setup the hardware ready for the scheduler to take control.  This generally
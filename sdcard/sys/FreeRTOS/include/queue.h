@@ -135,6 +135,47 @@ typedef void * xQueueHandle;
  */
 xQueueHandle xQueueCreate( unsigned portBASE_TYPE uxQueueLength, unsigned portBASE_TYPE uxItemSize );
 
+/**
+ * queue. h
+ * <pre>
+ xQueueHandle xQueueCreateStatic(
+							  unsigned portBASE_TYPE uxQueueLength,
+							  unsigned portBASE_TYPE uxItemSize,
+							  unsigned char *pucQueueStorage,
+							  xStaticQueue *pxQueueBuffer
+						  );
+ * </pre>
+ *
+ * As xQueueCreate(), but the storage area and the queue structure are given
+ * by the caller, nothing is taken from the heap.  vQueueDelete() doesn't free
+ * them.  Only available if configSUPPORT_STATIC_ALLOCATION is set to 1.
+ *
+ * @param pucQueueStorage Array of at least uxQueueLength * uxItemSize bytes
+ * which holds the items, may be NULL if uxItemSize is 0.
+ *
+ * @param pxQueueBuffer Variable which holds the queue structure.
+ *
+ * @return Handle to the created queue, NULL if a parameter is invalid.
+ *
+ * Example usage:
+   <pre>
+ static unsigned char ucStorage[ 10 * sizeof( unsigned long ) ];
+ static xStaticQueue xQueueBuffer;
+
+ void vATask( void *pvParameters )
+ {
+ xQueueHandle xQueue;
+
+	xQueue = xQueueCreateStatic( 10, sizeof( unsigned long ), ucStorage, &xQueueBuffer );
+ }
+ </pre>
+ * \defgroup xQueueCreateStatic xQueueCreateStatic
+ * \ingroup QueueManagement
+ */
+#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+	xQueueHandle xQueueCreateStatic( unsigned portBASE_TYPE uxQueueLength, unsigned portBASE_TYPE uxItemSize, unsigned char *pucQueueStorage, xStaticQueue *pxQueueBuffer );
+#endif
+
 /**
  * queue. h
  * <pre>
@@ -1218,6 +1259,10 @@ signed portBASE_TYPE xQueueCRReceive( xQueueHandle pxQueue, void *pvBuffer, port
  */
 xQueueHandle xQueueCreateMutex( void );
 xQueueHandle xQueueCreateCountingSemaphore( unsigned portBASE_TYPE uxCountValue, unsigned portBASE_TYPE uxInitialCount );
+#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+	xQueueHandle xQueueCreateMutexStatic( xStaticQueue *pxQueueBuffer );
+	xQueueHandle xQueueCreateCountingSemaphoreStatic( unsigned portBASE_TYPE uxCountValue, unsigned portBASE_TYPE uxInitialCount, xStaticQueue *pxQueueBuffer );
+#endif
 
 /*
  * For internal use only.  Use xSemaphoreTakeMutexRecursive() or
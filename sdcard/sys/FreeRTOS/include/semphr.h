@@ -705,6 +705,49 @@ typedef xQueueHandle xSemaphoreHandle;
  */
 #define xSemaphoreCreateCounting( uxMaxCount, uxInitialCount ) xQueueCreateCountingSemaphore( uxMaxCount, uxInitialCount )
 
+/**
+ * semphr. h
+ * <pre>vSemaphoreCreateBinaryStatic( xSemaphoreHandle xSemaphore, xStaticSemaphore *pxSemaphoreBuffer )</pre>
+ * <pre>xSemaphoreHandle xSemaphoreCreateMutexStatic( xStaticSemaphore *pxSemaphoreBuffer )</pre>
+ * <pre>xSemaphoreHandle xSemaphoreCreateCountingStatic( unsigned portBASE_TYPE uxMaxCount, unsigned portBASE_TYPE uxInitialCount, xStaticSemaphore *pxSemaphoreBuffer )</pre>
+ *
+ * <i>Macros</i> which create semaphores as vSemaphoreCreateBinary(),
+ * xSemaphoreCreateMutex() and xSemaphoreCreateCounting() do, but in the
+ * variable pxSemaphoreBuffer given by the caller instead of the heap.  The
+ * variable has to exist as long as the semaphore is used, vQueueDelete()
+ * doesn't free it.  Only available if configSUPPORT_STATIC_ALLOCATION is set
+ * to 1.
+ *
+ * Example usage:
+ <pre>
+ static xStaticSemaphore xSemaphoreBuffer, xMutexBuffer;
+ xSemaphoreHandle xSemaphore, xMutex;
+
+ void vATask( void * pvParameters )
+ {
+    vSemaphoreCreateBinaryStatic( xSemaphore, &xSemaphoreBuffer );
+    xMutex = xSemaphoreCreateMutexStatic( &xMutexBuffer );
+ }
+ </pre>
+ * \defgroup vSemaphoreCreateBinaryStatic vSemaphoreCreateBinaryStatic
+ * \ingroup Semaphores
+ */
+#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+
+	#define vSemaphoreCreateBinaryStatic( xSemaphore, pxSemaphoreBuffer )	{																												\
+																				xSemaphore = xQueueCreateStatic( ( unsigned portBASE_TYPE ) 1, semSEMAPHORE_QUEUE_ITEM_LENGTH, NULL, ( pxSemaphoreBuffer ) );	\
+																				if( xSemaphore != NULL )																					\
+																				{																											\
+																					xSemaphoreGive( xSemaphore );																			\
+																				}																											\
+																			}
+
+	#define xSemaphoreCreateMutexStatic( pxSemaphoreBuffer ) xQueueCreateMutexStatic( pxSemaphoreBuffer )
+
+	#define xSemaphoreCreateCountingStatic( uxMaxCount, uxInitialCount, pxSemaphoreBuffer ) xQueueCreateCountingSemaphoreStatic( ( uxMaxCount ), ( uxInitialCount ), ( pxSemaphoreBuffer ) )
+
+#endif /* configSUPPORT_STATIC_ALLOCATION */
+
 
 #endif /* SEMAPHORE_H */
 
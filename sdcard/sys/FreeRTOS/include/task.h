@@ -271,6 +271,50 @@ typedef struct xTASK_PARAMTERS
  */
 #define xTaskCreate( pvTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pxCreatedTask ) xTaskGenericCreate( ( pvTaskCode ), ( pcName ), ( usStackDepth ), ( pvParameters ), ( uxPriority ), ( pxCreatedTask ), ( NULL ), ( NULL ) )
 
+/**
+ * task. h
+ *<pre>
+ portBASE_TYPE xTaskCreateStatic(
+							  pdTASK_CODE pvTaskCode,
+							  const char * const pcName,
+							  unsigned short usStackDepth,
+							  void *pvParameters,
+							  unsigned portBASE_TYPE uxPriority,
+							  xTaskHandle *pvCreatedTask,
+							  portSTACK_TYPE *puxStackBuffer,
+							  xStaticTask *pxTaskBuffer
+						  );</pre>
+ *
+ * As xTaskCreate(), but the stack and the TCB of the task are given by the
+ * caller, nothing is taken from the heap.  Both buffers have to exist for the
+ * lifetime of the task, they are not freed when it is deleted.  Only
+ * available if configSUPPORT_STATIC_ALLOCATION is set to 1.
+ *
+ * @param puxStackBuffer Array of at least usStackDepth words used as the
+ * stack of the task.
+ *
+ * @param pxTaskBuffer Variable which holds the TCB of the task.
+ *
+ * @return pdPASS if the task was created, otherwise an error code defined
+ * in the file errors. h.  Fails if either buffer is NULL.
+ *
+ * Example usage:
+   <pre>
+ static portSTACK_TYPE uxStack[ STACK_SIZE ];
+ static xStaticTask xTask;
+
+ void vOtherFunction( void )
+ {
+	 xTaskCreateStatic( vTaskCode, "NAME", STACK_SIZE, NULL, tskIDLE_PRIORITY, NULL, uxStack, &xTask );
+ }
+   </pre>
+ * \defgroup xTaskCreateStatic xTaskCreateStatic
+ * \ingroup Tasks
+ */
+#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+	signed portBASE_TYPE xTaskCreateStatic( pdTASK_CODE pvTaskCode, const signed char * const pcName, unsigned short usStackDepth, void *pvParameters, unsigned portBASE_TYPE uxPriority, xTaskHandle *pxCreatedTask, portSTACK_TYPE *puxStackBuffer, xStaticTask *pxTaskBuffer ) PRIVILEGED_FUNCTION;
+#endif
+
 /**
  * task. h
  *<pre>
@@ -1028,6 +1072,27 @@ unsigned portBASE_TYPE uxTaskGetNumberOfTasks( void ) PRIVILEGED_FUNCTION;
  */
 void vTaskList( signed char *pcWriteBuffer ) PRIVILEGED_FUNCTION;
 
+/**
+ * task. h
+ * <PRE>unsigned portBASE_TYPE uxTaskGetLowestStackHighWaterMark( const signed char **ppcTaskName );</PRE>
+ *
+ * configUSE_TRACE_FACILITY must be defined as 1 for this function to be
+ * available.
+ *
+ * Looks at the stacks of all the tasks as vTaskList does, with the scheduler
+ * suspended, but only returns the smallest high water mark, so a monitor can
+ * sample it without a text buffer.
+ *
+ * @param ppcTaskName If not NULL, set to the name of the task with that stack.
+ *
+ * @return The least number of words left on a task stack since the tasks
+ * were created.
+ *
+ * \page uxTaskGetLowestStackHighWaterMark uxTaskGetLowestStackHighWaterMark
+ * \ingroup TaskUtils
+ */
+unsigned portBASE_TYPE uxTaskGetLowestStackHighWaterMark( const signed char **ppcTaskName ) PRIVILEGED_FUNCTION;
+
 /**
  * task. h
  * <PRE>void vTaskGetRunTimeStats( char *pcWriteBuffer );</PRE>
@@ -1144,6 +1209,59 @@ pdTASK_HOOK_CODE xTaskGetApplicationTaskTag( xTaskHandle xTask ) PRIVILEGED_FUNC
  */
 portBASE_TYPE xTaskCallApplicationTaskHook( xTaskHandle xTask, void *pvParameter ) PRIVILEGED_FUNCTION;
 
+#if ( configUSE_TASK_NOTIFICATIONS == 1 )
+/**
+ * task.h
+ * <pre>unsigned long ulTaskNotifyTake( portBASE_TYPE xClearCountOnExit, portTickType xTicksToWait );</pre>
+ *
+ * configUSE_TASK_NOTIFICATIONS must be set to 1 in FreeRTOSConfig.h for the
+ * notification functions to be available.
+ *
+ * Each task has a notification count, a lighter replacement of a binary or
+ * counting semaphore used by that task only: no queue object is created and
+ * giving it takes a fraction of the time of xSemaphoreGiveFromISR().  The
+ * notifications of a task can be given by several tasks and interrupts but
+ * only the task itself can take them.
+ *
+ * Waits until the notification count of the calling task is nonzero.
+ *
+ * @param xClearCountOnExit If pdFALSE the count is decremented on exit (as a
+ * counting semaphore), otherwise it is cleared (as a binary semaphore).
+ *
+ * @param xTicksToWait The maximum time to wait in the Blocked state, zero
+ * only polls.  portMAX_DELAY waits without a timeout if INCLUDE_vTaskSuspend
+ * is 1.
+ *
+ * @return The count before it was decremented or cleared, zero on timeout.
+ */
+unsigned long ulTaskNotifyTake( portBASE_TYPE xClearCountOnExit, portTickType xTicksToWait ) PRIVILEGED_FUNCTION;
+
+/**
+ * task.h
+ * <pre>signed portBASE_TYPE xTaskNotifyGive( xTaskHandle xTaskToNotify );</pre>
+ *
+ * Increments the notification count of xTaskToNotify, the task is unblocked
+ * if it waits in ulTaskNotifyTake().  Must not be called from an interrupt.
+ *
+ * @return pdPASS.
+ */
+signed portBASE_TYPE xTaskNotifyGive( xTaskHandle xTaskToNotify ) PRIVILEGED_FUNCTION;
+
+/**
+ * task.h
+ * <pre>void vTaskNotifyGiveFromISR( xTaskHandle xTaskToNotify, signed portBASE_TYPE *pxHigherPriorityTaskWoken );</pre>
+ *
+ * Version of xTaskNotifyGive() that can be called from an interrupt service
+ * routine (at configMAX_SYSCALL_INTERRUPT_PRIORITY or below).
+ *
+ * @param pxHigherPriorityTaskWoken Set to pdTRUE if the task unblocked has a
+ * priority not lower than the interrupted one, a context switch should then
+ * be requested before the interrupt exits (portYIELD_FROM_ISR). It is left
+ * unchanged otherwise.
+ */
+void vTaskNotifyGiveFromISR( xTaskHandle xTaskToNotify, signed portBASE_TYPE *pxHigherPriorityTaskWoken ) PRIVILEGED_FUNCTION;
+#endif /* configUSE_TASK_NOTIFICATIONS */
+
 
 /*-----------------------------------------------------------
  * SCHEDULER INTERNALS AVAILABLE FOR PORTING PURPOSES
@@ -1161,6 +1279,22 @@ portBASE_TYPE xTaskCallApplicationTaskHook( xTaskHandle xTask, void *pvParameter
  */
 void vTaskIncrementTick( void ) PRIVILEGED_FUNCTION;
 
+#if ( configUSE_TICKLESS_IDLE == 1 )
+/*
+ * THESE FUNCTIONS MUST NOT BE USED FROM APPLICATION CODE.  THEY ARE ONLY
+ * INTENDED FOR THE IDLE HOOK WHICH SUPPRESSES TICK INTERRUPTS.
+ *
+ * Both are called with the scheduler suspended and interrupts masked.
+ * xTaskGetExpectedIdleTime() returns the number of ticks until the first
+ * delayed task is due, portMAX_DELAY if all tasks wait without a timeout, or
+ * 0 if another task is ready (or was readied by an interrupt) so the idle
+ * task must not sleep.  vTaskStepTick() accounts for ticks that were
+ * suppressed, they are processed when the scheduler is resumed.
+ */
+portTickType xTaskGetExpectedIdleTime( void ) PRIVILEGED_FUNCTION;
+void vTaskStepTick( portTickType xTicksToJump ) PRIVILEGED_FUNCTION;
+#endif
+
 /*
  * THIS FUNCTION MUST NOT BE USED FROM APPLICATION CODE.  IT IS AN
  * INTERFACE WHICH IS FOR THE EXCLUSIVE USE OF THE SCHEDULER.
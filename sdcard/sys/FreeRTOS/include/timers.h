@@ -0,0 +1,95 @@
+/*
+    Software timer service for FreeRTOS V6.1.0 of this project, with the API
+    of the timers of later FreeRTOS versions (the subset used here).
+
+    Timers are kept and expired by the timer service task (daemon), other
+    tasks and interrupts pass commands to it through the timer command queue.
+    Callbacks run in the timer service task: they share its stack, so a
+    feature needs no task of its own for periodic or deferred work.  They may
+    block, but the other timers are late meanwhile.
+*/
+
+#ifndef INC_FREERTOS_H
+	#error "#include FreeRTOS.h" must appear in source files before "#include timers.h"
+#endif
+
+#ifndef TIMERS_H
+#define TIMERS_H
+
+#include "task.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* IDs of commands passed to the timer service task. */
+#define tmrCOMMAND_START					0
+#define tmrCOMMAND_STOP						1
+#define tmrCOMMAND_CHANGE_PERIOD			2
+#define tmrCOMMAND_DELETE					3
+
+/* Handle of a timer. */
+typedef void * xTimerHandle;
+
+/* Prototype of timer callbacks. */
+typedef void (*tmrTIMER_CALLBACK)( xTimerHandle xTimer );
+
+/*
+ * Creates a dormant timer (from the heap), xTimerStart() starts it.  The
+ * callback is called xTimerPeriodInTicks after the start and then every
+ * xTimerPeriodInTicks if uxAutoReload is pdTRUE.  Returns NULL if there is
+ * no heap for the timer.
+ */
+xTimerHandle xTimerCreate( const signed char *pcTimerName, portTickType xTimerPeriodInTicks, unsigned portBASE_TYPE uxAutoReload, void *pvTimerID, tmrTIMER_CALLBACK pxCallbackFunction ) PRIVILEGED_FUNCTION;
+
+/*
+ * As xTimerCreate(), but the timer is held in the variable given by the
+ * caller instead of the heap.  Deleting the timer doesn't free it.  Only
+ * available if configSUPPORT_STATIC_ALLOCATION is set to 1.
+ */
+#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+	xTimerHandle xTimerCreateStatic( const signed char *pcTimerName, portTickType xTimerPeriodInTicks, unsigned portBASE_TYPE uxAutoReload, void *pvTimerID, tmrTIMER_CALLBACK pxCallbackFunction, xStaticTimer *pxTimerBuffer ) PRIVILEGED_FUNCTION;
+#endif
+
+/*
+ * Returns the ID given to xTimerCreate(), so one callback serves several
+ * timers.
+ */
+void *pvTimerGetTimerID( xTimerHandle xTimer ) PRIVILEGED_FUNCTION;
+
+/*
+ * Returns pdTRUE if the timer runs, as of the last command the timer service
+ * task has processed.
+ */
+portBASE_TYPE xTimerIsTimerActive( xTimerHandle xTimer ) PRIVILEGED_FUNCTION;
+
+/*
+ * Commands of a timer.  A task waits up to xBlockTime for room in the
+ * command queue (not before the scheduler is started), an interrupt passes
+ * pxHigherPriorityTaskWoken instead.  Returns pdFAIL if the queue is full.
+ * Start (and reset) counts the period from the time the timer service task
+ * gets the command.
+ */
+portBASE_TYPE xTimerGenericCommand( xTimerHandle xTimer, portBASE_TYPE xCommandID, portTickType xOptionalValue, signed portBASE_TYPE *pxHigherPriorityTaskWoken, portTickType xBlockTime ) PRIVILEGED_FUNCTION;
+
+#define xTimerStart( xTimer, xBlockTime ) xTimerGenericCommand( ( xTimer ), tmrCOMMAND_START, 0U, NULL, ( xBlockTime ) )
+#define xTimerStop( xTimer, xBlockTime ) xTimerGenericCommand( ( xTimer ), tmrCOMMAND_STOP, 0U, NULL, ( xBlockTime ) )
+#define xTimerChangePeriod( xTimer, xNewPeriod, xBlockTime ) xTimerGenericCommand( ( xTimer ), tmrCOMMAND_CHANGE_PERIOD, ( xNewPeriod ), NULL, ( xBlockTime ) )
+#define xTimerDelete( xTimer, xBlockTime ) xTimerGenericCommand( ( xTimer ), tmrCOMMAND_DELETE, 0U, NULL, ( xBlockTime ) )
+#define xTimerReset( xTimer, xBlockTime ) xTimerGenericCommand( ( xTimer ), tmrCOMMAND_START, 0U, NULL, ( xBlockTime ) )
+
+#define xTimerStartFromISR( xTimer, pxHigherPriorityTaskWoken ) xTimerGenericCommand( ( xTimer ), tmrCOMMAND_START, 0U, ( pxHigherPriorityTaskWoken ), 0U )
+#define xTimerStopFromISR( xTimer, pxHigherPriorityTaskWoken ) xTimerGenericCommand( ( xTimer ), tmrCOMMAND_STOP, 0U, ( pxHigherPriorityTaskWoken ), 0U )
+#define xTimerChangePeriodFromISR( xTimer, xNewPeriod, pxHigherPriorityTaskWoken ) xTimerGenericCommand( ( xTimer ), tmrCOMMAND_CHANGE_PERIOD, ( xNewPeriod ), ( pxHigherPriorityTaskWoken ), 0U )
+#define xTimerResetFromISR( xTimer, pxHigherPriorityTaskWoken ) xTimerGenericCommand( ( xTimer ), tmrCOMMAND_START, 0U, ( pxHigherPriorityTaskWoken ), 0U )
+
+/*
+ * Functions beyond this part are not part of the public API and are intended
+ * for use by the kernel only.
+ */
+portBASE_TYPE xTimerCreateTimerTask( void ) PRIVILEGED_FUNCTION;
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* TIMERS_H */
@@ -195,6 +195,12 @@ void vPortYieldFromISR( void )
 {
 	/* Set a PendSV to request a context switch. */
 	*(portNVIC_INT_CTRL) = portNVIC_PENDSVSET;
+
+	/* Barriers normally not required but do ensure the code is completely
+	within the specified behaviour for the architecture: a task which yields
+	is switched out at once, not a few instructions later. */
+	__asm volatile( "dsb" ::: "memory" );
+	__asm volatile( "isb" );
 }
 /*-----------------------------------------------------------*/
 
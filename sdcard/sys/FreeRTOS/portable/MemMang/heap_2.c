@@ -71,6 +71,9 @@ task.h is included from an application file. */
 
 #undef MPU_WRAPPERS_INCLUDED_FROM_API_FILE
 
+/* Task stacks are allocated here: the heap is placed in SRAM2 */
+#include "stm32_mem.h"
+
 /* Allocate the memory for the heap.  The struct is used to force byte
 alignment without using any non-portable code. */
 static union xRTOS_HEAP
@@ -81,7 +84,7 @@ static union xRTOS_HEAP
 		volatile unsigned long ulDummy;
 	#endif
 	unsigned char ucHeap[ configTOTAL_HEAP_SIZE ];
-} xHeap;
+} xHeap MEM_FAST_STACK;
 
 /* Define the linked list structure.  This is used to link free blocks in order
 of their size. */
@@ -0,0 +1,419 @@
+/*
+    FreeRTOS V6.1.0 - Copyright (C) 2010 Real Time Engineers Ltd.
+
+    ***************************************************************************
+    *                                                                         *
+    * If you are:                                                             *
+    *                                                                         *
+    *    + New to FreeRTOS,                                                   *
+    *    + Wanting to learn FreeRTOS or multitasking in general quickly       *
+    *    + Looking for basic training,                                        *
+    *    + Wanting to improve your FreeRTOS skills and productivity           *
+    *                                                                         *
+    * then take a look at the FreeRTOS books - available as PDF or paperback  *
+    *                                                                         *
+    *        "Using the FreeRTOS Real Time Kernel - a Practical Guide"        *
+    *                  http://www.FreeRTOS.org/Documentation                  *
+    *                                                                         *
+    * A pdf reference manual is also available.  Both are usually delivered   *
+    * to your inbox within 20 minutes to two hours when purchased between 8am *
+    * and 8pm GMT (although please allow up to 24 hours in case of            *
+    * exceptional circumstances).  Thank you for your support!                *
+    *                                                                         *
+    ***************************************************************************
+
+    This file is part of the FreeRTOS distribution.
+
+    FreeRTOS is free software; you can redistribute it and/or modify it under
+    the terms of the GNU General Public License (version 2) as published by the
+    Free Software Foundation AND MODIFIED BY the FreeRTOS exception.
+    ***NOTE*** The exception to the GPL is included to allow you to distribute
+    a combined work that includes FreeRTOS without being obliged to provide the
+    source code for proprietary components outside of the FreeRTOS kernel.
+    FreeRTOS is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+    more details. You should have received a copy of the GNU General Public 
+    License and the FreeRTOS license exception along with FreeRTOS; if not it 
+    can be viewed here: http://www.freertos.org/a00114.html and also obtained 
+    by writing to Richard Barry, contact details for whom are available on the
+    FreeRTOS WEB site.
+
+    1 tab == 4 spaces!
+
+    http://www.FreeRTOS.org - Documentation, latest information, license and
+    contact details.
+
+    http://www.SafeRTOS.com - A version that is certified for use in safety
+    critical systems.
+
+    http://www.OpenRTOS.com - Commercial support, development, porting,
+    licensing and training services.
+*/
+
+/*
+ * A sample implementation of pvPortMalloc() and vPortFree() that combines
+ * adjacent free blocks into a single larger block, so blocks of different
+ * sizes can be allocated and freed without fragmenting the heap.
+ *
+ * Free blocks are kept in a list ordered by their address - a block being
+ * freed is merged with its neighbours when they are free too.  Allocation is
+ * first fit.  Small blocks (up to heapFAST_BIN_MAX bytes) are kept in bins of
+ * exact sizes when they are freed and are taken from there again by
+ * allocations of the same size in constant time; the bins are merged into the
+ * list when an allocation can't be satisfied otherwise.
+ *
+ * xPortGetMinimumEverFreeHeapSize() and xPortGetLargestFreeBlock() report the
+ * worst case so far and the current fragmentation for capacity planning.
+ *
+ * See heap_1.c, heap_2.c and heap_3.c for alternative implementations, and the
+ * memory management pages of http://www.FreeRTOS.org for more information.
+ */
+#include <stdlib.h>
+
+/* Defining MPU_WRAPPERS_INCLUDED_FROM_API_FILE prevents task.h from redefining
+all the API functions to use the MPU wrappers.  That should only be done when
+task.h is included from an application file. */
+#define MPU_WRAPPERS_INCLUDED_FROM_API_FILE
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#undef MPU_WRAPPERS_INCLUDED_FROM_API_FILE
+
+/* Task stacks are allocated here: the heap is placed in SRAM2 */
+#include "stm32_mem.h"
+
+/* Allocate the memory for the heap.  The struct is used to force byte
+alignment without using any non-portable code. */
+static union xRTOS_HEAP
+{
+	#if portBYTE_ALIGNMENT == 8
+		volatile portDOUBLE dDummy;
+	#else
+		volatile unsigned long ulDummy;
+	#endif
+	unsigned char ucHeap[ configTOTAL_HEAP_SIZE ];
+} xHeap MEM_FAST_STACK;
+
+/* Define the linked list structure.  This is used to link free blocks in order
+of their address. */
+typedef struct A_BLOCK_LINK
+{
+	struct A_BLOCK_LINK *pxNextFreeBlock;	/*<< The next free block in the list. */
+	size_t xBlockSize;						/*<< The size of the block, including this structure. */
+} xBlockLink;
+
+
+#define heapSTRUCT_SIZE			( ( sizeof( xBlockLink ) + portBYTE_ALIGNMENT_MASK ) & ~portBYTE_ALIGNMENT_MASK )
+#define heapMINIMUM_BLOCK_SIZE	( ( size_t ) ( heapSTRUCT_SIZE * 2 ) )
+#define heapHEAP_SIZE			( configTOTAL_HEAP_SIZE & ~portBYTE_ALIGNMENT_MASK )
+
+/* Blocks up to this size (including the structure) are binned by size when
+they are freed, one bin for each multiple of portBYTE_ALIGNMENT. */
+#define heapFAST_BIN_MAX		( ( size_t ) 128 )
+#define heapFAST_BINS			( ( heapFAST_BIN_MAX - heapMINIMUM_BLOCK_SIZE ) / portBYTE_ALIGNMENT + 1 )
+#define heapFAST_BIN( xSize )	( ( ( xSize ) - heapMINIMUM_BLOCK_SIZE ) / portBYTE_ALIGNMENT )
+
+/* Create a couple of list links to mark the start and end of the list.  The
+end marker is the last structure of the heap itself: it must have a higher
+address than any block for the ordered insertion. */
+static xBlockLink xStart, *pxEnd = NULL;
+
+/* Bins of free small blocks, each is a stack of blocks of one size. */
+static xBlockLink *pxFastBin[ heapFAST_BINS ];
+
+/* Keeps track of the number of free bytes remaining (in the list and in the
+bins), and the lowest number there has ever been. */
+static size_t xFreeBytesRemaining = heapHEAP_SIZE - heapSTRUCT_SIZE;
+static size_t xMinimumEverFreeBytesRemaining = heapHEAP_SIZE - heapSTRUCT_SIZE;
+
+static portBASE_TYPE xHeapHasBeenInitialised = pdFALSE;
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Insert a block into the list of free blocks - which is ordered by address
+ * of the block - merging it with the free blocks just before and just after
+ * it.
+ */
+static void prvInsertBlockIntoFreeList( xBlockLink *pxBlockToInsert )
+{
+xBlockLink *pxIterator;
+
+	/* Iterate through the list until a block is found that has a higher
+	address than the block we are inserting. */
+	for( pxIterator = &xStart; pxIterator->pxNextFreeBlock < pxBlockToInsert; pxIterator = pxIterator->pxNextFreeBlock )
+	{
+		/* There is nothing to do here - just iterate to the correct position. */
+	}
+
+	/* Does the block being inserted follow the free block before it? */
+	if( ( pxIterator != &xStart ) && ( ( ( unsigned char * ) pxIterator ) + pxIterator->xBlockSize == ( unsigned char * ) pxBlockToInsert ) )
+	{
+		pxIterator->xBlockSize += pxBlockToInsert->xBlockSize;
+		pxBlockToInsert = pxIterator;
+	}
+
+	/* Is it followed by the next free block? */
+	if( ( pxIterator->pxNextFreeBlock != pxEnd ) && ( ( ( unsigned char * ) pxBlockToInsert ) + pxBlockToInsert->xBlockSize == ( unsigned char * ) pxIterator->pxNextFreeBlock ) )
+	{
+		pxBlockToInsert->xBlockSize += pxIterator->pxNextFreeBlock->xBlockSize;
+		pxBlockToInsert->pxNextFreeBlock = pxIterator->pxNextFreeBlock->pxNextFreeBlock;
+	}
+	else
+	{
+		pxBlockToInsert->pxNextFreeBlock = pxIterator->pxNextFreeBlock;
+	}
+
+	/* If the block filled a gap the block before it already points to it. */
+	if( pxIterator != pxBlockToInsert )
+	{
+		pxIterator->pxNextFreeBlock = pxBlockToInsert;
+	}
+}
+/*-----------------------------------------------------------*/
+
+/*
+ * Move all binned blocks into the list of free blocks, so they are merged
+ * with their neighbours.  Returns pdTRUE if there was any.
+ */
+static portBASE_TYPE prvFlushFastBins( void )
+{
+xBlockLink *pxBlock;
+unsigned portBASE_TYPE uxBin;
+portBASE_TYPE xFlushed = pdFALSE;
+
+	for( uxBin = 0; uxBin < heapFAST_BINS; uxBin++ )
+	{
+		while( pxFastBin[ uxBin ] != NULL )
+		{
+			pxBlock = pxFastBin[ uxBin ];
+			pxFastBin[ uxBin ] = pxBlock->pxNextFreeBlock;
+			prvInsertBlockIntoFreeList( pxBlock );
+			xFlushed = pdTRUE;
+		}
+	}
+
+	return xFlushed;
+}
+/*-----------------------------------------------------------*/
+
+static void prvHeapInit( void )
+{
+xBlockLink *pxFirstFreeBlock;
+
+	/* xStart is used to hold a pointer to the first item in the list of free
+	blocks.  The void cast is used to prevent compiler warnings. */
+	xStart.pxNextFreeBlock = ( void * ) xHeap.ucHeap;
+	xStart.xBlockSize = ( size_t ) 0;
+
+	/* pxEnd is used to mark the end of the list of free blocks. */
+	pxEnd = ( void * ) ( xHeap.ucHeap + heapHEAP_SIZE - heapSTRUCT_SIZE );
+	pxEnd->xBlockSize = ( size_t ) 0;
+	pxEnd->pxNextFreeBlock = NULL;
+
+	/* To start with there is a single free block that is sized to take up the
+	entire heap space except the end marker. */
+	pxFirstFreeBlock = ( void * ) xHeap.ucHeap;
+	pxFirstFreeBlock->xBlockSize = heapHEAP_SIZE - heapSTRUCT_SIZE;
+	pxFirstFreeBlock->pxNextFreeBlock = pxEnd;
+
+	xHeapHasBeenInitialised = pdTRUE;
+}
+/*-----------------------------------------------------------*/
+
+void *pvPortMalloc( size_t xWantedSize )
+{
+xBlockLink *pxBlock, *pxPreviousBlock, *pxNewBlockLink;
+void *pvReturn = NULL;
+
+	vTaskSuspendAll();
+	{
+		/* If this is the first call to malloc then the heap will require
+		initialisation to setup the list of free blocks. */
+		if( xHeapHasBeenInitialised == pdFALSE )
+		{
+			prvHeapInit();
+		}
+
+		/* The wanted size is increased so it can contain a xBlockLink
+		structure in addition to the requested amount of bytes. */
+		if( ( xWantedSize > 0 ) && ( xWantedSize < heapHEAP_SIZE ) )
+		{
+			xWantedSize += heapSTRUCT_SIZE;
+
+			/* Ensure that blocks are always aligned to the required number of
+			bytes, and are large enough to be freed into the list. */
+			xWantedSize = ( xWantedSize + portBYTE_ALIGNMENT_MASK ) & ~portBYTE_ALIGNMENT_MASK;
+			if( xWantedSize < heapMINIMUM_BLOCK_SIZE )
+			{
+				xWantedSize = heapMINIMUM_BLOCK_SIZE;
+			}
+		}
+		else
+		{
+			xWantedSize = 0;
+		}
+
+		/* Fast path: a freed block of exactly this size. */
+		if( ( xWantedSize > 0 ) && ( xWantedSize <= heapFAST_BIN_MAX ) && ( pxFastBin[ heapFAST_BIN( xWantedSize ) ] != NULL ) )
+		{
+			pxBlock = pxFastBin[ heapFAST_BIN( xWantedSize ) ];
+			pxFastBin[ heapFAST_BIN( xWantedSize ) ] = pxBlock->pxNextFreeBlock;
+			pvReturn = ( void * ) ( ( ( unsigned char * ) pxBlock ) + heapSTRUCT_SIZE );
+			xFreeBytesRemaining -= pxBlock->xBlockSize;
+		}
+
+		while( ( xWantedSize > 0 ) && ( pvReturn == NULL ) )
+		{
+			/* Blocks are stored in address order - traverse the list from the
+			start until one of adequate size is found. */
+			pxPreviousBlock = &xStart;
+			pxBlock = xStart.pxNextFreeBlock;
+			while( ( pxBlock->xBlockSize < xWantedSize ) && ( pxBlock->pxNextFreeBlock ) )
+			{
+				pxPreviousBlock = pxBlock;
+				pxBlock = pxBlock->pxNextFreeBlock;
+			}
+
+			/* If we found the end marker then a block of adequate size was not
+			found - unless merging the binned blocks makes one. */
+			if( pxBlock == pxEnd )
+			{
+				if( prvFlushFastBins() == pdFALSE )
+				{
+					break;
+				}
+				continue;
+			}
+
+			/* Return the memory space - jumping over the xBlockLink structure
+			at its start. */
+			pvReturn = ( void * ) ( ( ( unsigned char * ) pxBlock ) + heapSTRUCT_SIZE );
+
+			/* This block is being returned for use so must be taken out of the
+			list of free blocks. */
+			pxPreviousBlock->pxNextFreeBlock = pxBlock->pxNextFreeBlock;
+
+			/* If the block is larger than required it can be split into two. */
+			if( ( pxBlock->xBlockSize - xWantedSize ) >= heapMINIMUM_BLOCK_SIZE )
+			{
+				/* This block is to be split into two.  Create a new block
+				following the number of bytes requested. The void cast is
+				used to prevent byte alignment warnings from the compiler. */
+				pxNewBlockLink = ( void * ) ( ( ( unsigned char * ) pxBlock ) + xWantedSize );
+
+				/* Calculate the sizes of two blocks split from the single
+				block. */
+				pxNewBlockLink->xBlockSize = pxBlock->xBlockSize - xWantedSize;
+				pxBlock->xBlockSize = xWantedSize;
+
+				/* The rest stays where the block was in the list. */
+				pxNewBlockLink->pxNextFreeBlock = pxPreviousBlock->pxNextFreeBlock;
+				pxPreviousBlock->pxNextFreeBlock = pxNewBlockLink;
+			}
+
+			xFreeBytesRemaining -= pxBlock->xBlockSize;
+		}
+
+		if( xFreeBytesRemaining < xMinimumEverFreeBytesRemaining )
+		{
+			xMinimumEverFreeBytesRemaining = xFreeBytesRemaining;
+		}
+	}
+	xTaskResumeAll();
+
+	#if( configUSE_MALLOC_FAILED_HOOK == 1 )
+	{
+		if( pvReturn == NULL )
+		{
+			extern void vApplicationMallocFailedHook( void );
+			vApplicationMallocFailedHook();
+		}
+	}
+	#endif
+
+	return pvReturn;
+}
+/*-----------------------------------------------------------*/
+
+void vPortFree( void *pv )
+{
+unsigned char *puc = ( unsigned char * ) pv;
+xBlockLink *pxLink;
+
+	if( pv )
+	{
+		/* The memory being freed will have an xBlockLink structure immediately
+		before it. */
+		puc -= heapSTRUCT_SIZE;
+
+		/* This casting is to keep the compiler from issuing warnings. */
+		pxLink = ( void * ) puc;
+
+		vTaskSuspendAll();
+		{
+			xFreeBytesRemaining += pxLink->xBlockSize;
+
+			/* Small blocks are binned by size, others go to the list. */
+			if( pxLink->xBlockSize <= heapFAST_BIN_MAX )
+			{
+				pxLink->pxNextFreeBlock = pxFastBin[ heapFAST_BIN( pxLink->xBlockSize ) ];
+				pxFastBin[ heapFAST_BIN( pxLink->xBlockSize ) ] = pxLink;
+			}
+			else
+			{
+				prvInsertBlockIntoFreeList( pxLink );
+			}
+		}
+		xTaskResumeAll();
+	}
+}
+/*-----------------------------------------------------------*/
+
+size_t xPortGetFreeHeapSize( void )
+{
+	return xFreeBytesRemaining;
+}
+/*-----------------------------------------------------------*/
+
+size_t xPortGetMinimumEverFreeHeapSize( void )
+{
+	return xMinimumEverFreeBytesRemaining;
+}
+/*-----------------------------------------------------------*/
+
+size_t xPortGetLargestFreeBlock( void )
+{
+xBlockLink *pxBlock;
+size_t xLargest = 0;
+
+	vTaskSuspendAll();
+	{
+		if( xHeapHasBeenInitialised == pdFALSE )
+		{
+			prvHeapInit();
+		}
+
+		/* Binned blocks are merged first, they would be on a failed allocation. */
+		prvFlushFastBins();
+		for( pxBlock = xStart.pxNextFreeBlock; pxBlock != pxEnd; pxBlock = pxBlock->pxNextFreeBlock )
+		{
+			if( pxBlock->xBlockSize > xLargest )
+			{
+				xLargest = pxBlock->xBlockSize;
+			}
+		}
+	}
+	xTaskResumeAll();
+
+	/* Bytes available to the caller of pvPortMalloc(). */
+	return ( xLargest > heapSTRUCT_SIZE ) ? xLargest - heapSTRUCT_SIZE : 0;
+}
+/*-----------------------------------------------------------*/
+
+void vPortInitialiseBlocks( void )
+{
+	/* This just exists to keep the linker quiet. */
+}
@@ -113,6 +113,10 @@ typedef struct QueueDefinition
 	signed portBASE_TYPE xRxLock;			/*< Stores the number of items received from the queue (removed from the queue) while the queue was locked.  Set to queueUNLOCKED when the queue is not locked. */
 	signed portBASE_TYPE xTxLock;			/*< Stores the number of items transmitted to the queue (added to the queue) while the queue was locked.  Set to queueUNLOCKED when the queue is not locked. */
 
+	#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+		unsigned char ucStaticallyAllocated;	/*< pdTRUE if the memory of the queue was given by the application, vQueueDelete() doesn't free it. */
+	#endif
+
 } xQUEUE;
 /*-----------------------------------------------------------*/
 
@@ -137,6 +141,11 @@ signed portBASE_TYPE xQueueGenericReceive( xQueueHandle pxQueue, void * const pv
 signed portBASE_TYPE xQueueReceiveFromISR( xQueueHandle pxQueue, void * const pvBuffer, signed portBASE_TYPE *pxTaskWoken ) PRIVILEGED_FUNCTION;
 xQueueHandle xQueueCreateMutex( void ) PRIVILEGED_FUNCTION;
 xQueueHandle xQueueCreateCountingSemaphore( unsigned portBASE_TYPE uxCountValue, unsigned portBASE_TYPE uxInitialCount ) PRIVILEGED_FUNCTION;
+#if configSUPPORT_STATIC_ALLOCATION == 1
+	xQueueHandle xQueueCreateStatic( unsigned portBASE_TYPE uxQueueLength, unsigned portBASE_TYPE uxItemSize, unsigned char *pucQueueStorage, xStaticQueue *pxQueueBuffer ) PRIVILEGED_FUNCTION;
+	xQueueHandle xQueueCreateMutexStatic( xStaticQueue *pxQueueBuffer ) PRIVILEGED_FUNCTION;
+	xQueueHandle xQueueCreateCountingSemaphoreStatic( unsigned portBASE_TYPE uxCountValue, unsigned portBASE_TYPE uxInitialCount, xStaticQueue *pxQueueBuffer ) PRIVILEGED_FUNCTION;
+#endif
 portBASE_TYPE xQueueTakeMutexRecursive( xQueueHandle xMutex, portTickType xBlockTime ) PRIVILEGED_FUNCTION;
 portBASE_TYPE xQueueGiveMutexRecursive( xQueueHandle xMutex ) PRIVILEGED_FUNCTION;
 signed portBASE_TYPE xQueueAltGenericSend( xQueueHandle pxQueue, const void * const pvItemToQueue, portTickType xTicksToWait, portBASE_TYPE xCopyPosition ) PRIVILEGED_FUNCTION;
@@ -182,6 +191,19 @@ unsigned portBASE_TYPE uxQueueMessagesWaitingFromISR( const xQueueHandle pxQueue
 	void vQueueAddToRegistry( xQueueHandle xQueue, signed char *pcQueueName ) PRIVILEGED_FUNCTION;
 #endif
 
+/*
+ * Sets up the members of a new queue whose structure and storage area are
+ * allocated already.  pcStorage may be NULL if the items have no size.
+ */
+static void prvInitialiseNewQueue( xQUEUE *pxNewQueue, unsigned portBASE_TYPE uxQueueLength, unsigned portBASE_TYPE uxItemSize, signed char *pcStorage ) PRIVILEGED_FUNCTION;
+
+/*
+ * Sets up a new queue structure as a mutex and gives it.
+ */
+#if ( configUSE_MUTEXES == 1 )
+	static void prvInitialiseMutex( xQUEUE *pxNewQueue ) PRIVILEGED_FUNCTION;
+#endif
+
 /*
  * Unlocks a queue locked by a call to prvLockQueue.  Locking a queue does not
  * prevent an ISR from adding or removing items to the queue, but does prevent
@@ -244,10 +266,44 @@ static void prvCopyDataFromQueue( xQUEUE * const pxQueue, const void *pvBuffer )
  * PUBLIC QUEUE MANAGEMENT API documented in queue.h
  *----------------------------------------------------------*/
 
+static void prvInitialiseNewQueue( xQUEUE *pxNewQueue, unsigned portBASE_TYPE uxQueueLength, unsigned portBASE_TYPE uxItemSize, signed char *pcStorage )
+{
+	if( pcStorage == NULL )
+	{
+		/* Items of semaphores are not stored.  pcHead must not be NULL as that
+		would mark a mutex, so it points to the queue structure itself. */
+		pcStorage = ( signed char * ) pxNewQueue;
+	}
+
+	/* Initialise the queue members as described above where the queue type
+	is defined. */
+	pxNewQueue->pcHead = pcStorage;
+	pxNewQueue->pcTail = pxNewQueue->pcHead + ( uxQueueLength * uxItemSize );
+	pxNewQueue->uxMessagesWaiting = 0;
+	pxNewQueue->pcWriteTo = pxNewQueue->pcHead;
+	pxNewQueue->pcReadFrom = pxNewQueue->pcHead + ( ( uxQueueLength - 1 ) * uxItemSize );
+	pxNewQueue->uxLength = uxQueueLength;
+	pxNewQueue->uxItemSize = uxItemSize;
+	pxNewQueue->xRxLock = queueUNLOCKED;
+	pxNewQueue->xTxLock = queueUNLOCKED;
+
+	#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+	{
+		pxNewQueue->ucStaticallyAllocated = pdFALSE;
+	}
+	#endif
+
+	/* Likewise ensure the event queues start with the correct state. */
+	vListInitialise( &( pxNewQueue->xTasksWaitingToSend ) );
+	vListInitialise( &( pxNewQueue->xTasksWaitingToReceive ) );
+}
+/*-----------------------------------------------------------*/
+
 xQueueHandle xQueueCreate( unsigned portBASE_TYPE uxQueueLength, unsigned portBASE_TYPE uxItemSize )
 {
 xQUEUE *pxNewQueue;
 size_t xQueueSizeInBytes;
+signed char *pcStorage;
 
 	/* Allocate the new queue structure. */
 	if( uxQueueLength > ( unsigned portBASE_TYPE ) 0 )
@@ -259,23 +315,10 @@ size_t xQueueSizeInBytes;
 			longer than asked for to make wrap checking easier/faster. */
 			xQueueSizeInBytes = ( size_t ) ( uxQueueLength * uxItemSize ) + ( size_t ) 1;
 
-			pxNewQueue->pcHead = ( signed char * ) pvPortMalloc( xQueueSizeInBytes );
-			if( pxNewQueue->pcHead != NULL )
+			pcStorage = ( signed char * ) pvPortMalloc( xQueueSizeInBytes );
+			if( pcStorage != NULL )
 			{
-				/* Initialise the queue members as described above where the
-				queue type is defined. */
-				pxNewQueue->pcTail = pxNewQueue->pcHead + ( uxQueueLength * uxItemSize );
-				pxNewQueue->uxMessagesWaiting = 0;
-				pxNewQueue->pcWriteTo = pxNewQueue->pcHead;
-				pxNewQueue->pcReadFrom = pxNewQueue->pcHead + ( ( uxQueueLength - 1 ) * uxItemSize );
-				pxNewQueue->uxLength = uxQueueLength;
-				pxNewQueue->uxItemSize = uxItemSize;
-				pxNewQueue->xRxLock = queueUNLOCKED;
-				pxNewQueue->xTxLock = queueUNLOCKED;
-
-				/* Likewise ensure the event queues start with the correct state. */
-				vListInitialise( &( pxNewQueue->xTasksWaitingToSend ) );
-				vListInitialise( &( pxNewQueue->xTasksWaitingToReceive ) );
+				prvInitialiseNewQueue( pxNewQueue, uxQueueLength, uxItemSize, pcStorage );
 
 				traceQUEUE_CREATE( pxNewQueue );
 				return  pxNewQueue;
@@ -294,8 +337,67 @@ size_t xQueueSizeInBytes;
 }
 /*-----------------------------------------------------------*/
 
+#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+
+	xQueueHandle xQueueCreateStatic( unsigned portBASE_TYPE uxQueueLength, unsigned portBASE_TYPE uxItemSize, unsigned char *pucQueueStorage, xStaticQueue *pxQueueBuffer )
+	{
+	xQUEUE *pxNewQueue = ( xQUEUE * ) pxQueueBuffer;
+
+		/* The storage area is needed unless the items have no size. */
+		if( ( uxQueueLength == ( unsigned portBASE_TYPE ) 0 ) || ( pxNewQueue == NULL ) ||
+			( ( pucQueueStorage == NULL ) && ( uxItemSize != ( unsigned portBASE_TYPE ) 0 ) ) )
+		{
+			traceQUEUE_CREATE_FAILED();
+			return NULL;
+		}
+
+		prvInitialiseNewQueue( pxNewQueue, uxQueueLength, uxItemSize, ( signed char * ) pucQueueStorage );
+		pxNewQueue->ucStaticallyAllocated = pdTRUE;
+
+		traceQUEUE_CREATE( pxNewQueue );
+		return pxNewQueue;
+	}
+
+#endif /* configSUPPORT_STATIC_ALLOCATION */
+/*-----------------------------------------------------------*/
+
 #if ( configUSE_MUTEXES == 1 )
 
+	static void prvInitialiseMutex( xQUEUE *pxNewQueue )
+	{
+		/* Information required for priority inheritance. */
+		pxNewQueue->pxMutexHolder = NULL;
+		pxNewQueue->uxQueueType = queueQUEUE_IS_MUTEX;
+
+		/* Queues used as a mutex no data is actually copied into or out
+		of the queue. */
+		pxNewQueue->pcWriteTo = NULL;
+		pxNewQueue->pcReadFrom = NULL;
+
+		/* Each mutex has a length of 1 (like a binary semaphore) and
+		an item size of 0 as nothing is actually copied into or out
+		of the mutex. */
+		pxNewQueue->uxMessagesWaiting = 0;
+		pxNewQueue->uxLength = 1;
+		pxNewQueue->uxItemSize = 0;
+		pxNewQueue->xRxLock = queueUNLOCKED;
+		pxNewQueue->xTxLock = queueUNLOCKED;
+
+		#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+		{
+			pxNewQueue->ucStaticallyAllocated = pdFALSE;
+		}
+		#endif
+
+		/* Ensure the event queues start with the correct state. */
+		vListInitialise( &( pxNewQueue->xTasksWaitingToSend ) );
+		vListInitialise( &( pxNewQueue->xTasksWaitingToReceive ) );
+
+		/* Start with the semaphore in the expected state. */
+		xQueueGenericSend( pxNewQueue, NULL, 0, queueSEND_TO_BACK );
+	}
+	/*-----------------------------------------------------------*/
+
 	xQueueHandle xQueueCreateMutex( void )
 	{
 	xQUEUE *pxNewQueue;
@@ -304,30 +406,7 @@ size_t xQueueSizeInBytes;
 		pxNewQueue = ( xQUEUE * ) pvPortMalloc( sizeof( xQUEUE ) );
 		if( pxNewQueue != NULL )
 		{
-			/* Information required for priority inheritance. */
-			pxNewQueue->pxMutexHolder = NULL;
-			pxNewQueue->uxQueueType = queueQUEUE_IS_MUTEX;
-
-			/* Queues used as a mutex no data is actually copied into or out
-			of the queue. */
-			pxNewQueue->pcWriteTo = NULL;
-			pxNewQueue->pcReadFrom = NULL;
-
-			/* Each mutex has a length of 1 (like a binary semaphore) and
-			an item size of 0 as nothing is actually copied into or out
-			of the mutex. */
-			pxNewQueue->uxMessagesWaiting = 0;
-			pxNewQueue->uxLength = 1;
-			pxNewQueue->uxItemSize = 0;
-			pxNewQueue->xRxLock = queueUNLOCKED;
-			pxNewQueue->xTxLock = queueUNLOCKED;
-
-			/* Ensure the event queues start with the correct state. */
-			vListInitialise( &( pxNewQueue->xTasksWaitingToSend ) );
-			vListInitialise( &( pxNewQueue->xTasksWaitingToReceive ) );
-
-			/* Start with the semaphore in the expected state. */
-			xQueueGenericSend( pxNewQueue, NULL, 0, queueSEND_TO_BACK );
+			prvInitialiseMutex( pxNewQueue );
 
 			traceCREATE_MUTEX( pxNewQueue );
 		}
@@ -338,6 +417,30 @@ size_t xQueueSizeInBytes;
 
 		return pxNewQueue;
 	}
+	/*-----------------------------------------------------------*/
+
+	#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+
+		xQueueHandle xQueueCreateMutexStatic( xStaticQueue *pxQueueBuffer )
+		{
+		xQUEUE *pxNewQueue = ( xQUEUE * ) pxQueueBuffer;
+
+			if( pxNewQueue != NULL )
+			{
+				prvInitialiseMutex( pxNewQueue );
+				pxNewQueue->ucStaticallyAllocated = pdTRUE;
+
+				traceCREATE_MUTEX( pxNewQueue );
+			}
+			else
+			{
+				traceCREATE_MUTEX_FAILED();
+			}
+
+			return pxNewQueue;
+		}
+
+	#endif /* configSUPPORT_STATIC_ALLOCATION */
 
 #endif /* configUSE_MUTEXES */
 /*-----------------------------------------------------------*/
@@ -444,6 +547,31 @@ size_t xQueueSizeInBytes;
 
 		return pxHandle;
 	}
+	/*-----------------------------------------------------------*/
+
+	#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+
+		xQueueHandle xQueueCreateCountingSemaphoreStatic( unsigned portBASE_TYPE uxCountValue, unsigned portBASE_TYPE uxInitialCount, xStaticQueue *pxQueueBuffer )
+		{
+		xQueueHandle pxHandle;
+
+			pxHandle = xQueueCreateStatic( ( unsigned portBASE_TYPE ) uxCountValue, queueSEMAPHORE_QUEUE_ITEM_LENGTH, NULL, pxQueueBuffer );
+
+			if( pxHandle != NULL )
+			{
+				pxHandle->uxMessagesWaiting = uxInitialCount;
+
+				traceCREATE_COUNTING_SEMAPHORE();
+			}
+			else
+			{
+				traceCREATE_COUNTING_SEMAPHORE_FAILED();
+			}
+
+			return pxHandle;
+		}
+
+	#endif /* configSUPPORT_STATIC_ALLOCATION */
 
 #endif /* configUSE_COUNTING_SEMAPHORES */
 /*-----------------------------------------------------------*/
@@ -1041,6 +1169,17 @@ void vQueueDelete( xQueueHandle pxQueue )
 {
 	traceQUEUE_DELETE( pxQueue );
 	vQueueUnregisterQueue( pxQueue );
+
+	#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+	{
+		if( pxQueue->ucStaticallyAllocated != pdFALSE )
+		{
+			/* The memory belongs to the application, it may be used again. */
+			return;
+		}
+	}
+	#endif
+
 	vPortFree( pxQueue->pcHead );
 	vPortFree( pxQueue );
 }
@@ -65,6 +65,10 @@ task.h is included from an application file. */
 #include "task.h"
 #include "StackMacros.h"
 
+#if ( configUSE_TIMERS == 1 )
+	#include "timers.h"
+#endif
+
 #undef MPU_WRAPPERS_INCLUDED_FROM_API_FILE
 
 /*
@@ -114,8 +118,31 @@ typedef struct tskTaskControlBlock
 		unsigned long ulRunTimeCounter;		/*< Used for calculating how much CPU time each task is utilising. */
 	#endif
 
+	#if ( configUSE_TASK_NOTIFICATIONS == 1 )
+		volatile unsigned long ulNotifiedValue;	/*< Number of notifications not taken yet. */
+		volatile unsigned char ucNotifyState;	/*< One of the tskNOTIFY_* states. */
+	#endif
+
+	#if ( configUSE_NEWLIB_REENTRANT == 1 )
+		struct _reent xNewLib_reent;			/*< newlib state of the task (errno, stdio streams, etc.), _impure_ptr points to it while the task runs. */
+	#endif
+
+	#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+		unsigned char ucStaticallyAllocated;	/*< tskSTATIC_* flags of the memory given by the application, prvDeleteTCB() doesn't free it. */
+	#endif
+
 } tskTCB;
 
+#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+	/* Memory of the task which isn't from the heap. */
+	#define tskSTATIC_STACK		( ( unsigned char ) 0x01 )
+	#define tskSTATIC_TCB		( ( unsigned char ) 0x02 )
+
+	/* xStaticTask of FreeRTOS.h has to match the TCB, the array gets a negative
+	size if it doesn't. */
+	typedef char tskSTATIC_TCB_SIZE_CHECK[ ( sizeof( xStaticTask ) == sizeof( tskTCB ) ) ? 1 : -1 ];
+#endif
+
 
 /*
  * Some kernel aware debuggers require data to be viewed to be global, rather
@@ -182,6 +209,16 @@ PRIVILEGED_DATA static unsigned portBASE_TYPE uxTaskNumber 						= ( unsigned po
  * Macros used by vListTask to indicate which state a task is in.
  */
 #define tskBLOCKED_CHAR		( ( signed char ) 'B' )
+
+/*
+ * States of the notification of a task.  A waiting task is in a delayed list
+ * (or the suspended list if it waits without a timeout), never in an event
+ * list, so its event list item is free to be placed in the pending ready list
+ * by an interrupt that notifies it while the scheduler is suspended.
+ */
+#define tskNOTIFY_NOT_WAITING	( ( unsigned char ) 0 )
+#define tskNOTIFY_WAITING		( ( unsigned char ) 1 )
+#define tskNOTIFY_RECEIVED		( ( unsigned char ) 2 )
 #define tskREADY_CHAR		( ( signed char ) 'R' )
 #define tskDELETED_CHAR		( ( signed char ) 'D' )
 #define tskSUSPENDED_CHAR	( ( signed char ) 'S' )
@@ -240,6 +277,25 @@ PRIVILEGED_DATA static unsigned portBASE_TYPE uxTaskNumber 						= ( unsigned po
 #endif
 /*-----------------------------------------------------------*/
 
+/*
+ * uxTopReadyPriority holds the highest priority which may have ready tasks,
+ * or with configUSE_PORT_OPTIMISED_TASK_SELECTION a bit of each priority
+ * which may have them.  Either way it is brought down lazily when the
+ * scheduler finds the ready list of that priority empty.
+ */
+#if ( configUSE_PORT_OPTIMISED_TASK_SELECTION == 1 )
+	#define taskRECORD_READY_PRIORITY( uxPriority )	portRECORD_READY_PRIORITY( ( uxPriority ), uxTopReadyPriority )
+#else
+	#define taskRECORD_READY_PRIORITY( uxPriority )	\
+	{												\
+		if( ( uxPriority ) > uxTopReadyPriority )	\
+		{											\
+			uxTopReadyPriority = ( uxPriority );	\
+		}											\
+	}
+#endif
+/*-----------------------------------------------------------*/
+
 /*
  * Place the task represented by pxTCB into the appropriate ready queue for
  * the task.  It is inserted at the end of the list.  One quirk of this is
@@ -249,10 +305,7 @@ PRIVILEGED_DATA static unsigned portBASE_TYPE uxTaskNumber 						= ( unsigned po
  */
 #define prvAddTaskToReadyQueue( pxTCB )																			\
 {																												\
-	if( pxTCB->uxPriority > uxTopReadyPriority )																\
-	{																											\
-		uxTopReadyPriority = pxTCB->uxPriority;																	\
-	}																											\
+	taskRECORD_READY_PRIORITY( pxTCB->uxPriority );																\
 	vListInsertEnd( ( xList * ) &( pxReadyTasksLists[ pxTCB->uxPriority ] ), &( pxTCB->xGenericListItem ) );	\
 }
 /*-----------------------------------------------------------*/
@@ -344,9 +397,16 @@ static void prvCheckTasksWaitingTermination( void ) PRIVILEGED_FUNCTION;
 
 /*
  * Allocates memory from the heap for a TCB and associated stack.  Checks the
- * allocation was successful.
+ * allocation was successful.  The TCB (pxTaskBuffer) and the stack
+ * (puxStackBuffer) may be given by the caller instead.
  */
-static tskTCB *prvAllocateTCBAndStack( unsigned short usStackDepth, portSTACK_TYPE *puxStackBuffer ) PRIVILEGED_FUNCTION;
+static tskTCB *prvAllocateTCBAndStack( unsigned short usStackDepth, portSTACK_TYPE *puxStackBuffer, tskTCB *pxTaskBuffer ) PRIVILEGED_FUNCTION;
+
+/*
+ * Sets up the TCB and stack of a new task and makes it ready to run.
+ * pxNewTCB is NULL if they could not be allocated.
+ */
+static signed portBASE_TYPE prvAddNewTask( tskTCB *pxNewTCB, pdTASK_CODE pxTaskCode, const signed char * const pcName, unsigned short usStackDepth, void *pvParameters, unsigned portBASE_TYPE uxPriority, xTaskHandle *pxCreatedTask, const xMemoryRegion * const xRegions ) PRIVILEGED_FUNCTION;
 
 /*
  * Called from vTaskList.  vListTasks details all the tasks currently under
@@ -361,6 +421,10 @@ static tskTCB *prvAllocateTCBAndStack( unsigned short usStackDepth, portSTACK_TY
 
 	static void prvListTaskWithinSingleList( const signed char *pcWriteBuffer, xList *pxList, signed char cStatus ) PRIVILEGED_FUNCTION;
 
+	/* The same walk for uxTaskGetLowestStackHighWaterMark, pxLowest is
+	updated if a task of pxList has less stack left. */
+	static void prvLowestStackWithinSingleList( xList *pxList, unsigned short *pusLowest, volatile tskTCB **pxLowest ) PRIVILEGED_FUNCTION;
+
 #endif
 
 /*
@@ -385,12 +449,37 @@ static tskTCB *prvAllocateTCBAndStack( unsigned short usStackDepth, portSTACK_TY
 
 signed portBASE_TYPE xTaskGenericCreate( pdTASK_CODE pxTaskCode, const signed char * const pcName, unsigned short usStackDepth, void *pvParameters, unsigned portBASE_TYPE uxPriority, xTaskHandle *pxCreatedTask, portSTACK_TYPE *puxStackBuffer, const xMemoryRegion * const xRegions )
 {
-signed portBASE_TYPE xReturn;
 tskTCB * pxNewTCB;
 
 	/* Allocate the memory required by the TCB and stack for the new task,
 	checking that the allocation was successful. */
-	pxNewTCB = prvAllocateTCBAndStack( usStackDepth, puxStackBuffer );
+	pxNewTCB = prvAllocateTCBAndStack( usStackDepth, puxStackBuffer, NULL );
+
+	return prvAddNewTask( pxNewTCB, pxTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pxCreatedTask, xRegions );
+}
+/*-----------------------------------------------------------*/
+
+#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+
+	signed portBASE_TYPE xTaskCreateStatic( pdTASK_CODE pxTaskCode, const signed char * const pcName, unsigned short usStackDepth, void *pvParameters, unsigned portBASE_TYPE uxPriority, xTaskHandle *pxCreatedTask, portSTACK_TYPE *puxStackBuffer, xStaticTask *pxTaskBuffer )
+	{
+	tskTCB * pxNewTCB = NULL;
+
+		/* Nothing is taken from the heap. */
+		if( ( puxStackBuffer != NULL ) && ( pxTaskBuffer != NULL ) )
+		{
+			pxNewTCB = prvAllocateTCBAndStack( usStackDepth, puxStackBuffer, ( tskTCB * ) pxTaskBuffer );
+		}
+
+		return prvAddNewTask( pxNewTCB, pxTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pxCreatedTask, NULL );
+	}
+
+#endif /* configSUPPORT_STATIC_ALLOCATION */
+/*-----------------------------------------------------------*/
+
+static signed portBASE_TYPE prvAddNewTask( tskTCB *pxNewTCB, pdTASK_CODE pxTaskCode, const signed char * const pcName, unsigned short usStackDepth, void *pvParameters, unsigned portBASE_TYPE uxPriority, xTaskHandle *pxCreatedTask, const xMemoryRegion * const xRegions )
+{
+signed portBASE_TYPE xReturn;
 
 	if( pxNewTCB != NULL )
 	{
@@ -1047,7 +1136,27 @@ void vTaskStartScheduler( void )
 portBASE_TYPE xReturn;
 
 	/* Add the idle task at the lowest priority. */
-	xReturn = xTaskCreate( prvIdleTask, ( signed char * ) "IDLE", tskIDLE_STACK_SIZE, ( void * ) NULL, ( tskIDLE_PRIORITY | portPRIVILEGE_BIT ), ( xTaskHandle * ) NULL );
+	#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+	{
+	static portSTACK_TYPE uxIdleTaskStack[ tskIDLE_STACK_SIZE ];
+	static xStaticTask xIdleTaskTCB;
+
+		xReturn = xTaskCreateStatic( prvIdleTask, ( signed char * ) "IDLE", tskIDLE_STACK_SIZE, ( void * ) NULL, ( tskIDLE_PRIORITY | portPRIVILEGE_BIT ), ( xTaskHandle * ) NULL, uxIdleTaskStack, &xIdleTaskTCB );
+	}
+	#else
+	{
+		xReturn = xTaskCreate( prvIdleTask, ( signed char * ) "IDLE", tskIDLE_STACK_SIZE, ( void * ) NULL, ( tskIDLE_PRIORITY | portPRIVILEGE_BIT ), ( xTaskHandle * ) NULL );
+	}
+	#endif
+
+	#if ( configUSE_TIMERS == 1 )
+	{
+		if( xReturn == pdPASS )
+		{
+			xReturn = xTimerCreateTimerTask();
+		}
+	}
+	#endif
 
 	if( xReturn == pdPASS )
 	{
@@ -1069,6 +1178,13 @@ portBASE_TYPE xReturn;
 		the run time counter time base. */
 		portCONFIGURE_TIMER_FOR_RUN_TIME_STATS();
 
+		#if ( configUSE_NEWLIB_REENTRANT == 1 )
+		{
+			/* The first task is started without a context switch. */
+			_impure_ptr = &( pxCurrentTCB->xNewLib_reent );
+		}
+		#endif
+
 		/* Setting up the timer tick is hardware specific and thus in the
 		portable interface. */
 		if( xPortStartScheduler() )
@@ -1274,6 +1390,55 @@ unsigned portBASE_TYPE uxTaskGetNumberOfTasks( void )
 		xTaskResumeAll();
 	}
 
+	unsigned portBASE_TYPE uxTaskGetLowestStackHighWaterMark( const signed char **ppcTaskName )
+	{
+	unsigned portBASE_TYPE uxQueue;
+	unsigned short usLowest = 0;
+	volatile tskTCB *pxLowest = NULL;
+
+		vTaskSuspendAll();
+		{
+			uxQueue = uxTopUsedPriority + 1;
+
+			do
+			{
+				uxQueue--;
+
+				if( !listLIST_IS_EMPTY( &( pxReadyTasksLists[ uxQueue ] ) ) )
+				{
+					prvLowestStackWithinSingleList( ( xList * ) &( pxReadyTasksLists[ uxQueue ] ), &usLowest, &pxLowest );
+				}
+			}while( uxQueue > ( unsigned short ) tskIDLE_PRIORITY );
+
+			if( !listLIST_IS_EMPTY( pxDelayedTaskList ) )
+			{
+				prvLowestStackWithinSingleList( ( xList * ) pxDelayedTaskList, &usLowest, &pxLowest );
+			}
+
+			if( !listLIST_IS_EMPTY( pxOverflowDelayedTaskList ) )
+			{
+				prvLowestStackWithinSingleList( ( xList * ) pxOverflowDelayedTaskList, &usLowest, &pxLowest );
+			}
+
+			#if ( INCLUDE_vTaskSuspend == 1 )
+			{
+				if( !listLIST_IS_EMPTY( &xSuspendedTaskList ) )
+				{
+					prvLowestStackWithinSingleList( ( xList * ) &xSuspendedTaskList, &usLowest, &pxLowest );
+				}
+			}
+			#endif
+
+			if( ppcTaskName != NULL )
+			{
+				*ppcTaskName = ( pxLowest != NULL ) ? ( const signed char * ) pxLowest->pcTaskName : NULL;
+			}
+		}
+		xTaskResumeAll();
+
+		return ( unsigned portBASE_TYPE ) usLowest;
+	}
+
 #endif
 /*----------------------------------------------------------*/
 
@@ -1284,6 +1449,10 @@ unsigned portBASE_TYPE uxTaskGetNumberOfTasks( void )
 	unsigned portBASE_TYPE uxQueue;
 	unsigned long ulTotalRunTime = portGET_RUN_TIME_COUNTER_VALUE();
 
+		/* Percentages are computed by dividing by the hundredth of the
+		total. */
+		ulTotalRunTime /= 100UL;
+
 		/* This is a VERY costly function that should be used for debug only.
 		It leaves interrupts disabled for a LONG time. */
 
@@ -1440,6 +1609,199 @@ void vTaskIncrementTick( void )
 }
 /*-----------------------------------------------------------*/
 
+#if ( configUSE_TICKLESS_IDLE == 1 )
+
+	portTickType xTaskGetExpectedIdleTime( void )
+	{
+	tskTCB *pxTCB;
+
+		/* Another task of the idle priority is ready, a task was readied by an
+		interrupt while the scheduler was suspended, or a tick has been missed
+		already - the caller must not sleep. */
+		if( ( listCURRENT_LIST_LENGTH( &( pxReadyTasksLists[ tskIDLE_PRIORITY ] ) ) > ( unsigned portBASE_TYPE ) 1 ) ||
+			( listCURRENT_LIST_LENGTH( &xPendingReadyList ) != ( unsigned portBASE_TYPE ) 0 ) ||
+			( uxMissedTicks != ( unsigned portBASE_TYPE ) 0 ) || ( xMissedYield != pdFALSE ) )
+		{
+			return ( portTickType ) 0;
+		}
+
+		if( !listLIST_IS_EMPTY( pxDelayedTaskList ) )
+		{
+			/* The list is ordered by wake time, the head is the first task due. */
+			pxTCB = ( tskTCB * ) listGET_OWNER_OF_HEAD_ENTRY( pxDelayedTaskList );
+			return listGET_LIST_ITEM_VALUE( &( pxTCB->xGenericListItem ) ) - xTickCount;
+		}
+
+		if( !listLIST_IS_EMPTY( pxOverflowDelayedTaskList ) )
+		{
+			/* Delayed tasks are due after the tick count wraps, wake up at the
+			wrap so the lists are swapped. */
+			return ( portTickType ) 0 - xTickCount;
+		}
+
+		return portMAX_DELAY;
+	}
+	/*-----------------------------------------------------------*/
+
+	void vTaskStepTick( portTickType xTicksToJump )
+	{
+		/* The scheduler is suspended, so the ticks are unwound one by one by
+		xTaskResumeAll() exactly as if the tick interrupt had occurred. */
+		uxMissedTicks += ( unsigned portBASE_TYPE ) xTicksToJump;
+	}
+
+#endif /* configUSE_TICKLESS_IDLE */
+/*-----------------------------------------------------------*/
+
+#if ( configUSE_TASK_NOTIFICATIONS == 1 )
+
+	unsigned long ulTaskNotifyTake( portBASE_TYPE xClearCountOnExit, portTickType xTicksToWait )
+	{
+	portTickType xTimeToWake;
+	unsigned long ulReturn;
+
+		taskENTER_CRITICAL();
+		{
+			/* Only block if there is no notification pending already. */
+			if( pxCurrentTCB->ulNotifiedValue == 0UL )
+			{
+				pxCurrentTCB->ucNotifyState = tskNOTIFY_WAITING;
+
+				if( xTicksToWait > ( portTickType ) 0 )
+				{
+					/* Interrupts are masked so nothing else can access the
+					ready and delayed lists. */
+					vListRemove( ( xListItem * ) &( pxCurrentTCB->xGenericListItem ) );
+
+					#if ( INCLUDE_vTaskSuspend == 1 )
+					if( xTicksToWait == portMAX_DELAY )
+					{
+						/* Wait without a timeout, no tick can wake us up. */
+						vListInsertEnd( ( xList * ) &xSuspendedTaskList, ( xListItem * ) &( pxCurrentTCB->xGenericListItem ) );
+					}
+					else
+					#endif
+					{
+						/* This may overflow but this doesn't matter. */
+						xTimeToWake = xTickCount + xTicksToWait;
+						listSET_LIST_ITEM_VALUE( &( pxCurrentTCB->xGenericListItem ), xTimeToWake );
+
+						if( xTimeToWake < xTickCount )
+						{
+							vListInsert( ( xList * ) pxOverflowDelayedTaskList, ( xListItem * ) &( pxCurrentTCB->xGenericListItem ) );
+						}
+						else
+						{
+							vListInsert( ( xList * ) pxDelayedTaskList, ( xListItem * ) &( pxCurrentTCB->xGenericListItem ) );
+						}
+					}
+
+					/* The switch is pended, it happens as soon as the critical
+					section is left. */
+					portYIELD_WITHIN_API();
+				}
+			}
+		}
+		taskEXIT_CRITICAL();
+
+		taskENTER_CRITICAL();
+		{
+			ulReturn = pxCurrentTCB->ulNotifiedValue;
+
+			if( ulReturn != 0UL )
+			{
+				if( xClearCountOnExit != pdFALSE )
+				{
+					pxCurrentTCB->ulNotifiedValue = 0UL;
+				}
+				else
+				{
+					pxCurrentTCB->ulNotifiedValue = ulReturn - 1UL;
+				}
+			}
+
+			pxCurrentTCB->ucNotifyState = tskNOTIFY_NOT_WAITING;
+		}
+		taskEXIT_CRITICAL();
+
+		return ulReturn;
+	}
+	/*-----------------------------------------------------------*/
+
+	signed portBASE_TYPE xTaskNotifyGive( xTaskHandle xTaskToNotify )
+	{
+	tskTCB *pxTCB = ( tskTCB * ) xTaskToNotify;
+	unsigned char ucOriginalNotifyState;
+
+		taskENTER_CRITICAL();
+		{
+			ucOriginalNotifyState = pxTCB->ucNotifyState;
+			pxTCB->ucNotifyState = tskNOTIFY_RECEIVED;
+			( pxTCB->ulNotifiedValue )++;
+
+			if( ucOriginalNotifyState == tskNOTIFY_WAITING )
+			{
+				if( uxSchedulerSuspended == ( unsigned portBASE_TYPE ) pdFALSE )
+				{
+					vListRemove( &( pxTCB->xGenericListItem ) );
+					prvAddTaskToReadyQueue( pxTCB );
+				}
+				else
+				{
+					/* Moved to the ready list when the scheduler is resumed. */
+					vListInsertEnd( ( xList * ) &( xPendingReadyList ), &( pxTCB->xEventListItem ) );
+				}
+
+				if( pxTCB->uxPriority > pxCurrentTCB->uxPriority )
+				{
+					portYIELD_WITHIN_API();
+				}
+			}
+		}
+		taskEXIT_CRITICAL();
+
+		return pdPASS;
+	}
+	/*-----------------------------------------------------------*/
+
+	void vTaskNotifyGiveFromISR( xTaskHandle xTaskToNotify, signed portBASE_TYPE *pxHigherPriorityTaskWoken )
+	{
+	tskTCB *pxTCB = ( tskTCB * ) xTaskToNotify;
+	unsigned char ucOriginalNotifyState;
+	unsigned portBASE_TYPE uxSavedInterruptStatus;
+
+		uxSavedInterruptStatus = portSET_INTERRUPT_MASK_FROM_ISR();
+		{
+			ucOriginalNotifyState = pxTCB->ucNotifyState;
+			pxTCB->ucNotifyState = tskNOTIFY_RECEIVED;
+			( pxTCB->ulNotifiedValue )++;
+
+			if( ucOriginalNotifyState == tskNOTIFY_WAITING )
+			{
+				if( uxSchedulerSuspended == ( unsigned portBASE_TYPE ) pdFALSE )
+				{
+					vListRemove( &( pxTCB->xGenericListItem ) );
+					prvAddTaskToReadyQueue( pxTCB );
+				}
+				else
+				{
+					/* The delayed and ready lists cannot be accessed, the task
+					is held pending until the scheduler is resumed. */
+					vListInsertEnd( ( xList * ) &( xPendingReadyList ), &( pxTCB->xEventListItem ) );
+				}
+
+				if( pxTCB->uxPriority >= pxCurrentTCB->uxPriority )
+				{
+					*pxHigherPriorityTaskWoken = pdTRUE;
+				}
+			}
+		}
+		portCLEAR_INTERRUPT_MASK_FROM_ISR( uxSavedInterruptStatus );
+	}
+
+#endif /* configUSE_TASK_NOTIFICATIONS */
+/*-----------------------------------------------------------*/
+
 #if ( ( INCLUDE_vTaskCleanUpResources == 1 ) && ( INCLUDE_vTaskSuspend == 1 ) )
 
 	void vTaskCleanUpResources( void )
@@ -1609,15 +1971,46 @@ void vTaskSwitchContext( void )
 	taskFIRST_CHECK_FOR_STACK_OVERFLOW();
 	taskSECOND_CHECK_FOR_STACK_OVERFLOW();
 
-	/* Find the highest priority queue that contains ready tasks. */
-	while( listLIST_IS_EMPTY( &( pxReadyTasksLists[ uxTopReadyPriority ] ) ) )
+	#if ( configUSE_PORT_OPTIMISED_TASK_SELECTION == 1 )
+	{
+	unsigned portBASE_TYPE uxTopPriority;
+
+		/* Find the highest priority queue that contains ready tasks: the
+		highest bit set, a bit of an emptied queue is cleared here. */
+		for( ;; )
+		{
+			portGET_HIGHEST_PRIORITY( uxTopPriority, uxTopReadyPriority );
+			if( !listLIST_IS_EMPTY( &( pxReadyTasksLists[ uxTopPriority ] ) ) )
+			{
+				break;
+			}
+			portRESET_READY_PRIORITY( uxTopPriority, uxTopReadyPriority );
+		}
+
+		/* listGET_OWNER_OF_NEXT_ENTRY walks through the list, so the tasks of the
+		same priority get an equal share of the processor time. */
+		listGET_OWNER_OF_NEXT_ENTRY( pxCurrentTCB, &( pxReadyTasksLists[ uxTopPriority ] ) );
+	}
+	#else
 	{
-		--uxTopReadyPriority;
+		/* Find the highest priority queue that contains ready tasks. */
+		while( listLIST_IS_EMPTY( &( pxReadyTasksLists[ uxTopReadyPriority ] ) ) )
+		{
+			--uxTopReadyPriority;
+		}
+
+		/* listGET_OWNER_OF_NEXT_ENTRY walks through the list, so the tasks of the
+		same priority get an equal share of the processor time. */
+		listGET_OWNER_OF_NEXT_ENTRY( pxCurrentTCB, &( pxReadyTasksLists[ uxTopReadyPriority ] ) );
 	}
+	#endif
 
-	/* listGET_OWNER_OF_NEXT_ENTRY walks through the list, so the tasks of the
-	same priority get an equal share of the processor time. */
-	listGET_OWNER_OF_NEXT_ENTRY( pxCurrentTCB, &( pxReadyTasksLists[ uxTopReadyPriority ] ) );
+	#if ( configUSE_NEWLIB_REENTRANT == 1 )
+	{
+		/* newlib functions called by the task use its own state. */
+		_impure_ptr = &( pxCurrentTCB->xNewLib_reent );
+	}
+	#endif
 
 	traceTASK_SWITCHED_IN();
 	vWriteTraceToBuffer();
@@ -1926,6 +2319,19 @@ static void prvInitialiseTCBVariables( tskTCB *pxTCB, const signed char * const
 	}
 	#endif
 
+	#if ( configUSE_TASK_NOTIFICATIONS == 1 )
+	{
+		pxTCB->ulNotifiedValue = 0UL;
+		pxTCB->ucNotifyState = tskNOTIFY_NOT_WAITING;
+	}
+	#endif
+
+	#if ( configUSE_NEWLIB_REENTRANT == 1 )
+	{
+		_REENT_INIT_PTR( ( &( pxTCB->xNewLib_reent ) ) );
+	}
+	#endif
+
 	#if ( portUSING_MPU_WRAPPERS == 1 )
 	{
 		vPortStoreTaskMPUSettings( &( pxTCB->xMPUSettings ), xRegions, pxTCB->pxStack, usStackDepth );
@@ -2025,13 +2431,20 @@ static void prvCheckTasksWaitingTermination( void )
 }
 /*-----------------------------------------------------------*/
 
-static tskTCB *prvAllocateTCBAndStack( unsigned short usStackDepth, portSTACK_TYPE *puxStackBuffer )
+static tskTCB *prvAllocateTCBAndStack( unsigned short usStackDepth, portSTACK_TYPE *puxStackBuffer, tskTCB *pxTaskBuffer )
 {
 tskTCB *pxNewTCB;
 
 	/* Allocate space for the TCB.  Where the memory comes from depends on
 	the implementation of the port malloc function. */
-	pxNewTCB = ( tskTCB * ) pvPortMalloc( sizeof( tskTCB ) );
+	if( pxTaskBuffer != NULL )
+	{
+		pxNewTCB = pxTaskBuffer;
+	}
+	else
+	{
+		pxNewTCB = ( tskTCB * ) pvPortMalloc( sizeof( tskTCB ) );
+	}
 
 	if( pxNewTCB != NULL )
 	{
@@ -2043,13 +2456,30 @@ tskTCB *pxNewTCB;
 		if( pxNewTCB->pxStack == NULL )
 		{
 			/* Could not allocate the stack.  Delete the allocated TCB. */
-			vPortFree( pxNewTCB );
+			if( pxTaskBuffer == NULL )
+			{
+				vPortFree( pxNewTCB );
+			}
 			pxNewTCB = NULL;
 		}
 		else
 		{
 			/* Just to help debugging. */
 			memset( pxNewTCB->pxStack, tskSTACK_FILL_BYTE, usStackDepth * sizeof( portSTACK_TYPE ) );
+
+			#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+			{
+				pxNewTCB->ucStaticallyAllocated = 0;
+				if( puxStackBuffer != NULL )
+				{
+					pxNewTCB->ucStaticallyAllocated |= tskSTATIC_STACK;
+				}
+				if( pxTaskBuffer != NULL )
+				{
+					pxNewTCB->ucStaticallyAllocated |= tskSTATIC_TCB;
+				}
+			}
+			#endif
 		}
 	}
 
@@ -2085,6 +2515,34 @@ tskTCB *pxNewTCB;
 		} while( pxNextTCB != pxFirstTCB );
 	}
 
+	static void prvLowestStackWithinSingleList( xList *pxList, unsigned short *pusLowest, volatile tskTCB **pxLowest )
+	{
+	volatile tskTCB *pxNextTCB, *pxFirstTCB;
+	unsigned short usStackRemaining;
+
+		listGET_OWNER_OF_NEXT_ENTRY( pxFirstTCB, pxList );
+		do
+		{
+			listGET_OWNER_OF_NEXT_ENTRY( pxNextTCB, pxList );
+			#if ( portSTACK_GROWTH > 0 )
+			{
+				usStackRemaining = usTaskCheckFreeStackSpace( ( unsigned char * ) pxNextTCB->pxEndOfStack );
+			}
+			#else
+			{
+				usStackRemaining = usTaskCheckFreeStackSpace( ( unsigned char * ) pxNextTCB->pxStack );
+			}
+			#endif
+
+			if( *pxLowest == NULL || usStackRemaining < *pusLowest )
+			{
+				*pusLowest = usStackRemaining;
+				*pxLowest = pxNextTCB;
+			}
+
+		} while( pxNextTCB != pxFirstTCB );
+	}
+
 #endif
 /*-----------------------------------------------------------*/
 
@@ -2102,7 +2560,8 @@ tskTCB *pxNewTCB;
 			/* Get next TCB in from the list. */
 			listGET_OWNER_OF_NEXT_ENTRY( pxNextTCB, pxList );
 
-			/* Divide by zero check. */
+			/* Divide by zero check (the total is in hundredths, see the
+			caller). */
 			if( ulTotalRunTime > 0UL )
 			{
 				/* Has the task run at all? */
@@ -2114,8 +2573,10 @@ tskTCB *pxNewTCB;
 				else
 				{
 					/* What percentage of the total run time as the task used?
-					This will always be rounded down to the nearest integer. */
-					ulStatsAsPercentage = ( 100UL * pxNextTCB->ulRunTimeCounter ) / ulTotalRunTime;
+					This will always be rounded down to the nearest integer.
+					The counter isn't multiplied by 100, that would overflow
+					once the counter is above 0x28F5C28. */
+					ulStatsAsPercentage = pxNextTCB->ulRunTimeCounter / ulTotalRunTime;
 
 					if( ulStatsAsPercentage > 0UL )
 					{
@@ -2192,8 +2653,31 @@ tskTCB *pxNewTCB;
 	{
 		/* Free up the memory allocated by the scheduler for the task.  It is up to
 		the task to free any memory allocated at the application level. */
-		vPortFreeAligned( pxTCB->pxStack );
-		vPortFree( pxTCB );
+		#if ( configUSE_NEWLIB_REENTRANT == 1 )
+		{
+			/* Buffers of stdio streams the task has used are in the newlib heap. */
+			_reclaim_reent( &( pxTCB->xNewLib_reent ) );
+		}
+		#endif
+
+		#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+		{
+			/* Memory given by the application may be used for a new task. */
+			if( ( pxTCB->ucStaticallyAllocated & tskSTATIC_STACK ) == 0 )
+			{
+				vPortFreeAligned( pxTCB->pxStack );
+			}
+			if( ( pxTCB->ucStaticallyAllocated & tskSTATIC_TCB ) == 0 )
+			{
+				vPortFree( pxTCB );
+			}
+		}
+		#else
+		{
+			vPortFreeAligned( pxTCB->pxStack );
+			vPortFree( pxTCB );
+		}
+		#endif
 	}
 
 #endif
@@ -0,0 +1,404 @@
+/*
+    Software timer service for FreeRTOS V6.1.0 of this project, see timers.h.
+
+    The service task keeps the running timers in an unsorted list: there are
+    a few of them, so each wakeup looks at all of them and sleeps on the
+    command queue until the nearest expiry.  Expiry times are compared by
+    their signed distance from the tick count, so they survive its wrap as
+    long as periods are below half of the tick range.
+*/
+
+#include <stdlib.h>
+
+/* Defining MPU_WRAPPERS_INCLUDED_FROM_API_FILE prevents task.h from redefining
+all the API functions to use the MPU wrappers.  That should only be done when
+task.h is included from an application file. */
+#define MPU_WRAPPERS_INCLUDED_FROM_API_FILE
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "timers.h"
+
+#undef MPU_WRAPPERS_INCLUDED_FROM_API_FILE
+
+/* This entire source file will be skipped if the application is not configured
+to include software timer functionality. */
+#if ( configUSE_TIMERS == 1 )
+
+/* The definition of the timers themselves. */
+typedef struct tmrTimerControl
+{
+	const signed char		*pcTimerName;		/*<< Text name, debugging only. */
+	portTickType			xTimerPeriodInTicks;/*<< How quickly and often the timer expires. */
+	portTickType			xExpiryTime;		/*<< Tick count the running timer expires at. */
+	unsigned portBASE_TYPE	uxAutoReload;		/*<< pdTRUE: restarted on expiry, pdFALSE: one-shot. */
+	void					*pvTimerID;			/*<< ID of the timer for its callback. */
+	tmrTIMER_CALLBACK		pxCallbackFunction;	/*<< Called on expiry. */
+	struct tmrTimerControl	*pxNext;			/*<< Next running timer. */
+	unsigned portBASE_TYPE	uxActive;			/*<< pdTRUE while the timer is in the running list. */
+	#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+		unsigned char		ucStaticallyAllocated;	/*<< pdTRUE if the memory was given by the application, tmrCOMMAND_DELETE doesn't free it. */
+	#endif
+} xTIMER;
+
+#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+	/* xStaticTimer of FreeRTOS.h has to match, the array gets a negative size
+	if it doesn't. */
+	typedef char tmrSTATIC_TIMER_SIZE_CHECK[ ( sizeof( xStaticTimer ) == sizeof( xTIMER ) ) ? 1 : -1 ];
+#endif
+
+/* The definition of messages that can be sent and received on the timer
+queue. */
+typedef struct tmrTimerQueueMessage
+{
+	portBASE_TYPE			xMessageID;			/*<< The command being sent to the timer service task. */
+	portTickType			xMessageValue;		/*<< New period of tmrCOMMAND_CHANGE_PERIOD. */
+	xTIMER					*pxTimer;			/*<< The timer to which the command will be applied. */
+} xTIMER_MESSAGE;
+
+/* Running timers, accessed by the timer service task only. */
+PRIVILEGED_DATA static xTIMER *pxActiveTimers = NULL;
+
+/* Commands for the timer service task. */
+PRIVILEGED_DATA static xQueueHandle xTimerQueue = NULL;
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Creates the command queue if it doesn't exist yet.
+ */
+static void prvCheckForValidQueue( void ) PRIVILEGED_FUNCTION;
+
+/*
+ * Sets up the members of a new dormant timer.
+ */
+static void prvInitialiseNewTimer( xTIMER *pxNewTimer, const signed char *pcTimerName, portTickType xTimerPeriodInTicks, unsigned portBASE_TYPE uxAutoReload, void *pvTimerID, tmrTIMER_CALLBACK pxCallbackFunction ) PRIVILEGED_FUNCTION;
+
+/*
+ * Links a timer into the running list, or takes it out.
+ */
+static void prvInsertTimer( xTIMER *pxTimer, portTickType xExpiryTime ) PRIVILEGED_FUNCTION;
+static void prvRemoveTimer( xTIMER *pxTimer ) PRIVILEGED_FUNCTION;
+
+/*
+ * Calls the callbacks of the expired timers, returns the number of ticks
+ * to the nearest expiry or portMAX_DELAY if no timer runs.
+ */
+static portTickType prvProcessExpiredTimers( void ) PRIVILEGED_FUNCTION;
+
+/*
+ * Applies a command received on the queue.
+ */
+static void prvProcessCommand( const xTIMER_MESSAGE *pxMessage ) PRIVILEGED_FUNCTION;
+
+/*
+ * The timer service task (daemon).
+ */
+static void prvTimerTask( void *pvParameters ) PRIVILEGED_FUNCTION;
+
+/*-----------------------------------------------------------*/
+
+portBASE_TYPE xTimerCreateTimerTask( void )
+{
+portBASE_TYPE xReturn = pdFAIL;
+
+	/* This function is called when the scheduler is started. */
+	prvCheckForValidQueue();
+
+	if( xTimerQueue != NULL )
+	{
+		#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+		{
+		static portSTACK_TYPE uxTimerTaskStack[ configTIMER_TASK_STACK_DEPTH ];
+		static xStaticTask xTimerTaskTCB;
+
+			xReturn = xTaskCreateStatic( prvTimerTask, ( const signed char * ) "Tmr Svc", ( unsigned short ) configTIMER_TASK_STACK_DEPTH, NULL, ( unsigned portBASE_TYPE ) configTIMER_TASK_PRIORITY, NULL, uxTimerTaskStack, &xTimerTaskTCB );
+		}
+		#else
+		{
+			xReturn = xTaskCreate( prvTimerTask, ( const signed char * ) "Tmr Svc", ( unsigned short ) configTIMER_TASK_STACK_DEPTH, NULL, ( unsigned portBASE_TYPE ) configTIMER_TASK_PRIORITY, NULL );
+		}
+		#endif
+	}
+
+	return xReturn;
+}
+/*-----------------------------------------------------------*/
+
+xTimerHandle xTimerCreate( const signed char *pcTimerName, portTickType xTimerPeriodInTicks, unsigned portBASE_TYPE uxAutoReload, void *pvTimerID, tmrTIMER_CALLBACK pxCallbackFunction )
+{
+xTIMER *pxNewTimer = NULL;
+
+	if( xTimerPeriodInTicks > ( portTickType ) 0 )
+	{
+		/* Commands may be sent before the scheduler is started. */
+		prvCheckForValidQueue();
+
+		pxNewTimer = ( xTIMER * ) pvPortMalloc( sizeof( xTIMER ) );
+		if( pxNewTimer != NULL )
+		{
+			prvInitialiseNewTimer( pxNewTimer, pcTimerName, xTimerPeriodInTicks, uxAutoReload, pvTimerID, pxCallbackFunction );
+		}
+	}
+
+	return ( xTimerHandle ) pxNewTimer;
+}
+/*-----------------------------------------------------------*/
+
+#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+
+	xTimerHandle xTimerCreateStatic( const signed char *pcTimerName, portTickType xTimerPeriodInTicks, unsigned portBASE_TYPE uxAutoReload, void *pvTimerID, tmrTIMER_CALLBACK pxCallbackFunction, xStaticTimer *pxTimerBuffer )
+	{
+	xTIMER *pxNewTimer = NULL;
+
+		if( ( xTimerPeriodInTicks > ( portTickType ) 0 ) && ( pxTimerBuffer != NULL ) )
+		{
+			/* Commands may be sent before the scheduler is started. */
+			prvCheckForValidQueue();
+
+			pxNewTimer = ( xTIMER * ) pxTimerBuffer;
+			prvInitialiseNewTimer( pxNewTimer, pcTimerName, xTimerPeriodInTicks, uxAutoReload, pvTimerID, pxCallbackFunction );
+			pxNewTimer->ucStaticallyAllocated = pdTRUE;
+		}
+
+		return ( xTimerHandle ) pxNewTimer;
+	}
+
+#endif /* configSUPPORT_STATIC_ALLOCATION */
+/*-----------------------------------------------------------*/
+
+static void prvInitialiseNewTimer( xTIMER *pxNewTimer, const signed char *pcTimerName, portTickType xTimerPeriodInTicks, unsigned portBASE_TYPE uxAutoReload, void *pvTimerID, tmrTIMER_CALLBACK pxCallbackFunction )
+{
+	pxNewTimer->pcTimerName = pcTimerName;
+	pxNewTimer->xTimerPeriodInTicks = xTimerPeriodInTicks;
+	pxNewTimer->xExpiryTime = ( portTickType ) 0;
+	pxNewTimer->uxAutoReload = uxAutoReload;
+	pxNewTimer->pvTimerID = pvTimerID;
+	pxNewTimer->pxCallbackFunction = pxCallbackFunction;
+	pxNewTimer->pxNext = NULL;
+	pxNewTimer->uxActive = pdFALSE;
+
+	#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+	{
+		pxNewTimer->ucStaticallyAllocated = pdFALSE;
+	}
+	#endif
+}
+/*-----------------------------------------------------------*/
+
+portBASE_TYPE xTimerGenericCommand( xTimerHandle xTimer, portBASE_TYPE xCommandID, portTickType xOptionalValue, signed portBASE_TYPE *pxHigherPriorityTaskWoken, portTickType xBlockTime )
+{
+portBASE_TYPE xReturn = pdFAIL;
+xTIMER_MESSAGE xMessage;
+
+	if( xTimerQueue != NULL )
+	{
+		xMessage.xMessageID = xCommandID;
+		xMessage.xMessageValue = xOptionalValue;
+		xMessage.pxTimer = ( xTIMER * ) xTimer;
+
+		if( pxHigherPriorityTaskWoken != NULL )
+		{
+			xReturn = xQueueSendToBackFromISR( xTimerQueue, &xMessage, pxHigherPriorityTaskWoken );
+		}
+		else
+		{
+			if( xTaskGetSchedulerState() != taskSCHEDULER_RUNNING )
+			{
+				/* Nobody could make room in the queue. */
+				xBlockTime = ( portTickType ) 0;
+			}
+			xReturn = xQueueSendToBack( xTimerQueue, &xMessage, xBlockTime );
+		}
+	}
+
+	return xReturn;
+}
+/*-----------------------------------------------------------*/
+
+void *pvTimerGetTimerID( xTimerHandle xTimer )
+{
+	return ( ( xTIMER * ) xTimer )->pvTimerID;
+}
+/*-----------------------------------------------------------*/
+
+portBASE_TYPE xTimerIsTimerActive( xTimerHandle xTimer )
+{
+	return ( portBASE_TYPE ) ( ( xTIMER * ) xTimer )->uxActive;
+}
+/*-----------------------------------------------------------*/
+
+static void prvCheckForValidQueue( void )
+{
+	taskENTER_CRITICAL();
+	{
+		if( xTimerQueue == NULL )
+		{
+			#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+			{
+			static unsigned char ucTimerQueueStorage[ configTIMER_QUEUE_LENGTH * sizeof( xTIMER_MESSAGE ) ];
+			static xStaticQueue xTimerQueueBuffer;
+
+				xTimerQueue = xQueueCreateStatic( ( unsigned portBASE_TYPE ) configTIMER_QUEUE_LENGTH, sizeof( xTIMER_MESSAGE ), ucTimerQueueStorage, &xTimerQueueBuffer );
+			}
+			#else
+			{
+				xTimerQueue = xQueueCreate( ( unsigned portBASE_TYPE ) configTIMER_QUEUE_LENGTH, sizeof( xTIMER_MESSAGE ) );
+			}
+			#endif
+		}
+	}
+	taskEXIT_CRITICAL();
+}
+/*-----------------------------------------------------------*/
+
+static void prvInsertTimer( xTIMER *pxTimer, portTickType xExpiryTime )
+{
+	pxTimer->xExpiryTime = xExpiryTime;
+	if( pxTimer->uxActive == pdFALSE )
+	{
+		pxTimer->pxNext = pxActiveTimers;
+		pxActiveTimers = pxTimer;
+		pxTimer->uxActive = pdTRUE;
+	}
+}
+/*-----------------------------------------------------------*/
+
+static void prvRemoveTimer( xTIMER *pxTimer )
+{
+xTIMER **ppxLink;
+
+	for( ppxLink = &pxActiveTimers; *ppxLink != NULL; ppxLink = &( ( *ppxLink )->pxNext ) )
+	{
+		if( *ppxLink == pxTimer )
+		{
+			*ppxLink = pxTimer->pxNext;
+			break;
+		}
+	}
+	pxTimer->pxNext = NULL;
+	pxTimer->uxActive = pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+static portTickType prvProcessExpiredTimers( void )
+{
+xTIMER *pxTimer;
+portTickType xTimeNow, xNextWait;
+long lRemaining;
+
+	for( ;; )
+	{
+		xTimeNow = xTaskGetTickCount();
+		xNextWait = portMAX_DELAY;
+
+		for( pxTimer = pxActiveTimers; pxTimer != NULL; pxTimer = pxTimer->pxNext )
+		{
+			lRemaining = ( long ) ( pxTimer->xExpiryTime - xTimeNow );
+			if( lRemaining <= 0L )
+			{
+				break;
+			}
+			if( ( portTickType ) lRemaining < xNextWait )
+			{
+				xNextWait = ( portTickType ) lRemaining;
+			}
+		}
+
+		if( pxTimer == NULL )
+		{
+			/* Nothing has expired. */
+			return xNextWait;
+		}
+
+		/* The list is updated before the callback, which may send commands of
+		this timer.  An auto-reload timer late by more than a period skips the
+		missed expiries. */
+		if( pxTimer->uxAutoReload == pdTRUE )
+		{
+			pxTimer->xExpiryTime += pxTimer->xTimerPeriodInTicks;
+			if( ( long ) ( pxTimer->xExpiryTime - xTimeNow ) <= 0L )
+			{
+				pxTimer->xExpiryTime = xTimeNow + pxTimer->xTimerPeriodInTicks;
+			}
+		}
+		else
+		{
+			prvRemoveTimer( pxTimer );
+		}
+		pxTimer->pxCallbackFunction( ( xTimerHandle ) pxTimer );
+	}
+}
+/*-----------------------------------------------------------*/
+
+static void prvProcessCommand( const xTIMER_MESSAGE *pxMessage )
+{
+xTIMER *pxTimer = pxMessage->pxTimer;
+
+	switch( pxMessage->xMessageID )
+	{
+		case tmrCOMMAND_START :
+			prvInsertTimer( pxTimer, xTaskGetTickCount() + pxTimer->xTimerPeriodInTicks );
+			break;
+
+		case tmrCOMMAND_STOP :
+			prvRemoveTimer( pxTimer );
+			break;
+
+		case tmrCOMMAND_CHANGE_PERIOD :
+			/* The new period starts now, a dormant timer is started. */
+			if( pxMessage->xMessageValue > ( portTickType ) 0 )
+			{
+				pxTimer->xTimerPeriodInTicks = pxMessage->xMessageValue;
+			}
+			prvInsertTimer( pxTimer, xTaskGetTickCount() + pxTimer->xTimerPeriodInTicks );
+			break;
+
+		case tmrCOMMAND_DELETE :
+			prvRemoveTimer( pxTimer );
+			#if ( configSUPPORT_STATIC_ALLOCATION == 1 )
+			{
+				if( pxTimer->ucStaticallyAllocated == pdFALSE )
+				{
+					vPortFree( pxTimer );
+				}
+			}
+			#else
+			{
+				vPortFree( pxTimer );
+			}
+			#endif
+			break;
+
+		default :
+			/* Don't expect to get here. */
+			break;
+	}
+}
+/*-----------------------------------------------------------*/
+
+static void prvTimerTask( void *pvParameters )
+{
+xTIMER_MESSAGE xMessage;
+portTickType xWait;
+
+	/* Just to avoid compiler warnings. */
+	( void ) pvParameters;
+
+	for( ;; )
+	{
+		xWait = prvProcessExpiredTimers();
+
+		/* Sleep until the nearest expiry or a command, then take all of the
+		commands waiting. */
+		while( xQueueReceive( xTimerQueue, &xMessage, xWait ) != pdFALSE )
+		{
+			prvProcessCommand( &xMessage );
+			xWait = ( portTickType ) 0;
+		}
+	}
+}
+/*-----------------------------------------------------------*/
+
+#endif /* configUSE_TIMERS == 1 */
@@ -66,21 +66,64 @@
  * See http://www.freertos.org/a00110.html.
  *----------------------------------------------------------*/
 
+#include "main.h"
+
 #define configUSE_PREEMPTION			1
+#ifdef USE_LOW_POWER_IDLE
+/* Idle hook sleeps with the tick interrupt suppressed (sys/power.c) */
+#define configUSE_IDLE_HOOK				1
+#define configUSE_TICKLESS_IDLE			1
+#elif defined( USE_WATCHDOG )
+/* Idle hook kicks the watchdog (sys/watchdog.c) */
+#define configUSE_IDLE_HOOK				1
+#else
 #define configUSE_IDLE_HOOK				0
+#endif /* USE_LOW_POWER_IDLE */
 #define configUSE_TICK_HOOK				0
 #define configCPU_CLOCK_HZ				( ( unsigned long ) 120000000 )
 #define configTICK_RATE_HZ				( ( portTickType ) 1000 )
 #define configMAX_PRIORITIES			( ( unsigned portBASE_TYPE ) 7 )
+#define configUSE_PORT_OPTIMISED_TASK_SELECTION	1	/* ready priorities in a bit map, the top one found by CLZ */
 #define configMINIMAL_STACK_SIZE		( ( unsigned short ) 128 )
-#define configTOTAL_HEAP_SIZE			( ( size_t ) ( 14 * 1024 ) )
+/* Tasks, queues, semaphores and timers are created in static memory placed by the linker
+   (xTaskCreateStatic etc.), the system starts without heap allocation. The heap only serves
+   the benchmarks: sector buffer of sd_bench.c and the task of rtos_bench.c */
+#define configSUPPORT_STATIC_ALLOCATION	1
+#if defined( __GNUC__ ) && !defined( USE_TINY_PRINTF )
+/* newlib printf() is called by several tasks: each task has its own newlib state (errno, stdout
+   and its buffer) in its TCB, about 1 Kb more per task, newlib malloc is locked against
+   the other tasks (GCC-ARM/syscalls.c). USE_TINY_PRINTF doesn't use the state of newlib */
+#define configUSE_NEWLIB_REENTRANT		1
+#define configTOTAL_HEAP_SIZE			( ( size_t ) ( 6 * 1024 + sizeof( struct _reent ) ) )
+#else
+#define configUSE_NEWLIB_REENTRANT		0
+#define configTOTAL_HEAP_SIZE			( ( size_t ) ( 6 * 1024 ) )
+#endif /* __GNUC__ && !USE_TINY_PRINTF */
 #define configMAX_TASK_NAME_LEN			( 16 )
 #define configUSE_TRACE_FACILITY		1
 #define configUSE_16_BIT_TICKS			0
 #define configIDLE_SHOULD_YIELD			1
 #define configUSE_MUTEXES				1
 #define configUSE_COUNTING_SEMAPHORES	1
-#define configUSE_MALLOC_FAILED_HOOK	0
+#define configUSE_MALLOC_FAILED_HOOK	1	/* reported by main.c */
+#define configUSE_TASK_NOTIFICATIONS	1	/* direct to task completion of SD transfers and COM DMA */
+
+/* Software timers (sys/FreeRTOS/timers.c): deadline of write-back cache flush and button debounce
+   run in the timer service task instead of tasks of their own. Cache flush blocks on SD I/O, so
+   the service runs at the priority of SD I/O task with the stack of a FatFs caller */
+#define configUSE_TIMERS				1
+#define configTIMER_TASK_PRIORITY		( 2 )
+#define configTIMER_QUEUE_LENGTH		8
+#define configTIMER_TASK_STACK_DEPTH	( configMINIMAL_STACK_SIZE * 2 )
+#ifdef USE_TASK_STATS
+/* CPU time of tasks counted by TIM2 (sys/task_stats.c) */
+#include "task_stats.h"
+#define configGENERATE_RUN_TIME_STATS	1
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()	TaskStats_TimerInit()
+#define portGET_RUN_TIME_COUNTER_VALUE()			TaskStats_Counter()
+#else
+#define configGENERATE_RUN_TIME_STATS	0
+#endif /* USE_TASK_STATS */
 
 
 /* Co-routine definitions. */
@@ -94,9 +137,12 @@ to exclude the API function. */
 #define INCLUDE_uxTaskPriorityGet		1
 #define INCLUDE_vTaskDelete				1
 #define INCLUDE_vTaskCleanUpResources	0
-#define INCLUDE_vTaskSuspend			0
+#define INCLUDE_vTaskSuspend			1	/* portMAX_DELAY waits have no timeout (tickless idle can sleep through them) */
 #define INCLUDE_vTaskDelayUntil			1
 #define INCLUDE_vTaskDelay				1
+#define INCLUDE_xTaskGetSchedulerState	1
+#define INCLUDE_uxTaskGetStackHighWaterMark	1
+#define INCLUDE_xTaskGetCurrentTaskHandle	1
 
 /* This is the raw value as per the Cortex-M3 NVIC.  Values can be 255
 (lowest) to 0 (1?) (highest). */
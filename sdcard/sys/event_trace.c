@@ -0,0 +1,129 @@
+/**
+ ******************************************************************************
+ * @file    event_trace.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Binary event trace ring and its stream to ITM (SWO)
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "event_trace.h"
+
+#ifdef USE_EVENT_TRACE
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Private typedef -----------------------------------------------------------*/
+/* Private define ------------------------------------------------------------*/
+
+#define EVENT_TRACE_TASK_PRIO		( tskIDLE_PRIORITY )
+
+/* Ticks between checks of the stream while it is off (doesn't wake up tickless idle every tick) */
+#define EVENT_TRACE_POLL_OFF		( 100 / portTICK_RATE_MS )
+
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+
+EventTrace_Record EventTrace_Ring[ EVENT_TRACE_SIZE ];
+volatile uint32_t EventTrace_Head;			/* Number of records stored since start */
+
+static uint32_t EventTrace_Tail;			/* Number of records streamed */
+static xStaticTask EventTrace_TaskBuffer;
+static portSTACK_TYPE EventTrace_TaskStack[ configMINIMAL_STACK_SIZE ];
+
+/* Private function prototypes -----------------------------------------------*/
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Checks if debugger has enabled ITM and the stimulus port of the stream
+ * @param  None
+ * @retval Nonzero if the stream goes out through SWO
+ */
+static uint8_t EventTrace_ItmOn( void )
+{
+	return ( CoreDebug->DEMCR & CoreDebug_DEMCR_TRCENA_Msk ) && ( ITM->TCR & ITM_TCR_ITMENA_Msk ) &&
+		( ITM->TER & ( 1UL << EVENT_TRACE_ITM_PORT ) );
+}
+
+/**
+ * @brief  Sends one word to the stimulus port
+ * @param  w: Word
+ * @retval None
+ */
+static void EventTrace_ItmWord( uint32_t w )
+{
+	while ( ITM->PORT[ EVENT_TRACE_ITM_PORT ].u32 == 0 ) {}
+	ITM->PORT[ EVENT_TRACE_ITM_PORT ].u32 = w;
+}
+
+/**
+ * @brief  Streams records stored since the last call, the records which were
+ *         overwritten meanwhile are reported by EVT_TRACE_LOST record
+ * @param  None
+ * @retval None
+ */
+static void EventTrace_Flush( void )
+{
+	EventTrace_Record rec;
+	uint32_t head = EventTrace_Head;
+
+	if ( head - EventTrace_Tail > EVENT_TRACE_SIZE )
+	{
+		rec.Cycles = DWT_GetCycles();
+		rec.Id = EVT_TRACE_LOST;
+		rec.Seq = 0;
+		rec.Arg[ 0 ] = head - EventTrace_Tail - EVENT_TRACE_SIZE;
+		rec.Arg[ 1 ] = 0;
+		EventTrace_Tail = head - EVENT_TRACE_SIZE;
+	}
+	else if ( head == EventTrace_Tail )
+		return;
+	else
+		rec = EventTrace_Ring[ ( EventTrace_Tail++ ) & ( EVENT_TRACE_SIZE - 1 ) ];
+
+	/* the record may have been overwritten while it was copied, the decoder sees that by Seq */
+	EventTrace_ItmWord( rec.Cycles );
+	EventTrace_ItmWord( rec.Id | ( (uint32_t)rec.Seq << 16 ) );
+	EventTrace_ItmWord( rec.Arg[ 0 ] );
+	EventTrace_ItmWord( rec.Arg[ 1 ] );
+}
+
+/**
+ * @brief  Streams the ring to ITM while there is nothing else to do
+ * @param  pvParameters: Not used
+ * @retval None
+ */
+static void EventTrace_Task( void* pvParameters )
+{
+	(void)pvParameters;
+
+	for ( ;; )
+	{
+		if ( !EventTrace_ItmOn() )
+			vTaskDelay( EVENT_TRACE_POLL_OFF );
+		else if ( EventTrace_Head != EventTrace_Tail )
+			EventTrace_Flush();
+		else
+			vTaskDelay( 1 );
+	}
+}
+
+/**
+ * @brief  Starts cycle counter and creates the task which streams the ring
+ * @param  None
+ * @retval None
+ */
+void EventTrace_Init( void )
+{
+	DWT_Enable();
+	xTaskCreateStatic( EventTrace_Task, (const signed char* const)"TRC", configMINIMAL_STACK_SIZE, NULL, EVENT_TRACE_TASK_PRIO, NULL,
+			EventTrace_TaskStack, &EventTrace_TaskBuffer );
+}
+
+#endif /* USE_EVENT_TRACE */
@@ -0,0 +1,107 @@
+/**
+ ******************************************************************************
+ * @file    event_trace.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Binary event trace: fixed size records (event id, DWT cycle counter,
+ *          two arguments) are stored into a RAM ring by TRACE_EVENT, which
+ *          takes a few dozen cycles and can stay enabled in production.
+ *          A low priority task streams the ring to ITM stimulus port
+ *          EVENT_TRACE_ITM_PORT when a debugger has enabled SWO, otherwise
+ *          the ring keeps the latest events for inspection after a failure.
+ *          tools/trace_decode.py turns the stream into a timeline.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef EVENT_TRACE_H
+#define EVENT_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "stm32f2xx.h"
+#include "stm32_dwt.h"
+
+/* Exported types ------------------------------------------------------------*/
+
+/* Trace record (16 bytes, this layout is read by tools/trace_decode.py) */
+typedef struct
+{
+	uint32_t	Cycles;			/* DWT cycle counter */
+	uint16_t	Id;				/* Event (EVT_*) */
+	uint16_t	Seq;			/* Low bits of record number, gaps show lost records */
+	uint32_t	Arg[ 2 ];		/* Arguments of the event */
+} EventTrace_Record;
+
+/* Exported constants --------------------------------------------------------*/
+
+/* Number of records in the ring EVENT_TRACE_SIZE is in storage_conf.h */
+
+/* ITM stimulus port of the stream (port 0 is left for text) */
+#define EVENT_TRACE_ITM_PORT	1
+
+/* Events and their arguments (keep tools/trace_decode.py in sync) */
+#define EVT_TRACE_LOST			0x0001	/* Records overwritten before they were streamed: number */
+#define EVT_SD_CMD				0x0100	/* SPI command sent: index, argument */
+#define EVT_SD_RESP				0x0101	/* R1 response: index, response */
+#define EVT_SD_RX_BEGIN			0x0102	/* Data block started: length */
+#define EVT_SD_RX_END			0x0103	/* Data block received: length, result */
+#define EVT_SD_TX_BEGIN			0x0104	/* Data block sent: token */
+#define EVT_SD_TX_END			0x0105	/* Data response: token, response */
+#define EVT_SD_BUSY_BEGIN		0x0106	/* Card programming started: timeout (ms) */
+#define EVT_SD_BUSY_END			0x0107	/* Card is ready: delay (ms or tries), result */
+#define EVT_IO_BEGIN			0x0200	/* SD I/O request started: sector, operation | count << 8 */
+#define EVT_IO_END				0x0201	/* SD I/O request finished: sector, result */
+
+/* Exported macro ------------------------------------------------------------*/
+
+#ifdef USE_EVENT_TRACE
+#define TRACE_EVENT( id, a0, a1 )	EventTrace_Add( (id), (uint32_t)(a0), (uint32_t)(a1) )
+#else
+#define TRACE_EVENT( id, a0, a1 )	do {} while ( 0 )
+#endif /* USE_EVENT_TRACE */
+
+/* Exported functions ------------------------------------------------------- */
+
+#ifdef USE_EVENT_TRACE
+extern EventTrace_Record EventTrace_Ring[ EVENT_TRACE_SIZE ];
+extern volatile uint32_t EventTrace_Head;
+
+void EventTrace_Init( void );
+
+/**
+ * @brief  Stores event into the ring, the oldest record is overwritten if it is full
+ * @param  id: Event
+ * @param  a0: First argument
+ * @param  a1: Second argument
+ * @retval None
+ */
+static __INLINE void EventTrace_Add( uint16_t id, uint32_t a0, uint32_t a1 )
+{
+	uint32_t primask = __get_PRIMASK();
+	EventTrace_Record* rec;
+	uint32_t n;
+
+	__disable_irq();
+	n = EventTrace_Head++;
+	rec = &EventTrace_Ring[ n & ( EVENT_TRACE_SIZE - 1 ) ];
+	rec->Cycles = DWT_GetCycles();
+	rec->Id = id;
+	rec->Seq = (uint16_t)n;
+	rec->Arg[ 0 ] = a0;
+	rec->Arg[ 1 ] = a1;
+	__set_PRIMASK( primask );
+}
+#endif /* USE_EVENT_TRACE */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT_TRACE_H */
@@ -0,0 +1,107 @@
+/**
+ ******************************************************************************
+ * @file    init_profile.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Startup profile: timestamps of startup phases
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "init_profile.h"
+
+#ifdef USE_INIT_PROFILE
+
+#include "stm32f2xx.h"
+#include "stm32_dwt.h"
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <stdio.h>
+
+#if !INCLUDE_xTaskGetSchedulerState
+#error USE_INIT_PROFILE needs INCLUDE_xTaskGetSchedulerState (see FreeRTOSConfig.h)
+#endif
+
+/* Private typedef -----------------------------------------------------------*/
+
+/* Mark of a phase end */
+typedef struct
+{
+	const char*	Name;
+	uint32_t	Us;				/* time since the first mark */
+} InitProfile_Entry;
+
+/* Private define ------------------------------------------------------------*/
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+
+static InitProfile_Entry InitProfile_Marks[ INIT_PROFILE_MARKS ];
+static uint32_t InitProfile_Count;		/* marks made, including lost ones */
+static uint32_t InitProfile_Start;		/* cycle counter at the first mark */
+static uint32_t InitProfile_SchedUs;	/* time of the last mark before the scheduler started */
+
+/* Private function prototypes -----------------------------------------------*/
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Stores the end of a startup phase (from main() or a task)
+ * @param  name: Phase name (a string constant, it isn't copied)
+ * @retval None
+ */
+void InitProfile_Mark( const char* name )
+{
+	uint32_t us;
+
+	if ( xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED )
+	{	/* the first mark starts the cycle counter (other users keep it running) */
+		if ( InitProfile_Count == 0 )
+		{
+			DWT_Enable();
+			InitProfile_Start = DWT_GetCycles();
+		}
+		us = InitProfile_SchedUs = DWT_CyclesToUs( DWT_GetCycles() - InitProfile_Start );
+	}
+	else
+	{	/* the tick counts from zero since the scheduler started */
+		us = InitProfile_SchedUs + xTaskGetTickCount() * portTICK_RATE_MS * 1000;
+	}
+
+	taskENTER_CRITICAL();
+	if ( InitProfile_Count < INIT_PROFILE_MARKS )
+	{
+		InitProfile_Marks[ InitProfile_Count ].Name = name;
+		InitProfile_Marks[ InitProfile_Count ].Us = us;
+	}
+	++InitProfile_Count;
+	taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief  Prints the startup timeline: time of each mark and time since the previous one
+ * @param  None
+ * @retval None
+ */
+void InitProfile_Print( void )
+{
+	uint32_t i, n = InitProfile_Count, prev = 0;
+
+	if ( n > INIT_PROFILE_MARKS )
+		n = INIT_PROFILE_MARKS;
+	printf( "Startup        at us   +us\n" );
+	for ( i = 0; i < n; ++i )
+	{
+		printf( "%10lu %8lu  %s\n", (unsigned long)InitProfile_Marks[ i ].Us,
+				(unsigned long)( InitProfile_Marks[ i ].Us - prev ), InitProfile_Marks[ i ].Name );
+		prev = InitProfile_Marks[ i ].Us;
+	}
+	if ( InitProfile_Count > n )
+		printf( "%lu marks lost\n", (unsigned long)( InitProfile_Count - n ) );
+}
+
+#endif /* USE_INIT_PROFILE */
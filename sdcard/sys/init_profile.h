@@ -0,0 +1,55 @@
+/**
+ ******************************************************************************
+ * @file    init_profile.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Startup profile: INIT_MARK( name ) stores the time a phase of the
+ *          startup has ended, InitProfile_Print shows the timeline (time since
+ *          main() and since the previous mark). Before the scheduler starts
+ *          the time is taken from the DWT cycle counter (microseconds), after
+ *          that from the tick (milliseconds): the cycle counter stops while
+ *          the idle hook sleeps. Marks of tasks running in parallel (e.g. card
+ *          identification in SD I/O task) interleave in the timeline.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef INIT_PROFILE_H
+#define INIT_PROFILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include <stdint.h>
+
+/* Exported types ------------------------------------------------------------*/
+/* Exported constants --------------------------------------------------------*/
+
+/* Number of marks kept, later ones are counted as lost */
+#define INIT_PROFILE_MARKS		24
+
+/* Exported macro ------------------------------------------------------------*/
+
+#ifdef USE_INIT_PROFILE
+#define INIT_MARK( name )		InitProfile_Mark( name )
+#else
+#define INIT_MARK( name )		do {} while ( 0 )
+#endif /* USE_INIT_PROFILE */
+
+/* Exported functions ------------------------------------------------------- */
+
+#ifdef USE_INIT_PROFILE
+void InitProfile_Mark( const char* name );
+void InitProfile_Print( void );
+#endif /* USE_INIT_PROFILE */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INIT_PROFILE_H */
@@ -0,0 +1,345 @@
+/**
+ ******************************************************************************
+ * @file    metrics.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Storage metrics export (see metrics.h). A sample only reads
+ *          counters the drivers keep anyway: no card access, one walk over
+ *          the unused part of the task stacks with the scheduler suspended,
+ *          the cache mutex for a moment. Writing the record to the file is
+ *          not counted in the collection time.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "metrics.h"
+
+#ifdef USE_METRICS
+
+#include "stm32_dwt.h"
+#include "stm32_pool.h"
+#include "stm32_chksum.h"
+#include "stm32_sd_spi.h"
+#include "stm32_sd_io.h"
+#include "serial_debug.h"
+
+#include "ff.h"
+#include "diskio.h"
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if configUSE_TRACE_FACILITY != 1
+#error USE_METRICS needs configUSE_TRACE_FACILITY for the stack high water marks (see FreeRTOSConfig.h)
+#endif
+
+#if !defined(SERIAL_DEBUG) && !defined(METRICS_FILE)
+#error USE_METRICS needs SERIAL_DEBUG or METRICS_FILE: records have to go somewhere!
+#endif
+
+/* Private typedef -----------------------------------------------------------*/
+/* Private define ------------------------------------------------------------*/
+
+#define METRICS_TASK_PRIO		( tskIDLE_PRIORITY )
+/* Records are formatted by snprintf */
+#ifdef USE_TINY_PRINTF
+#define METRICS_TASK_STACK		( configMINIMAL_STACK_SIZE * 2 )
+#else
+#define METRICS_TASK_STACK		( configMINIMAL_STACK_SIZE * 3 )
+#endif /* USE_TINY_PRINTF */
+
+/* Longest record: a CSV line of a sample, or a binary frame */
+#define METRICS_RECORD_SIZE		( 4 + 11 * ( sizeof( Metrics_Sample ) / 4 ) + 2 )
+
+/* Period while export is stopped by Metrics_SetPeriod( 0 ) */
+#define METRICS_POLL_OFF		( 1000 / portTICK_RATE_MS )
+
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+
+/* Names of the CSV fields, in the order of Metrics_Sample and Metrics_Card */
+static const char Metrics_SampleHeader[] = "#M,seq,msec,collect_us,collect_max_us,heap_free,heap_min_free,"
+	"pool_free,pool_min_free,stack_min_free,cache_hits,cache_misses,cache2_hits,io_waiting,io_requests,"
+	"io_avg_ms,io_max_ms,io_missed,sd_cmd_errors,sd_crc_errors,sd_write_errors,sd_timeouts,sd_retries,"
+	"sd_reinits,sd_unrecovered\n";
+static const char Metrics_CardHeader[] = "#C,seq,msec,changes,capacity_kb,cid\n";
+
+static volatile uint32_t Metrics_PeriodMs = METRICS_PERIOD_MS;
+static uint32_t Metrics_Seq;				/* Records written */
+static uint32_t Metrics_LastUs;				/* Collection time of the previous sample */
+static uint32_t Metrics_MaxUs;				/* Longest collection time */
+#ifdef USE_SDCARD
+static uint32_t Metrics_CardChanges = 0xFFFFFFFF;	/* Card changes when the identity was written */
+#endif /* USE_SDCARD */
+#ifdef METRICS_FILE
+static FIL Metrics_File;
+static uint8_t Metrics_FileOpen;
+#endif /* METRICS_FILE */
+static char Metrics_Record[ METRICS_RECORD_SIZE ];
+static xStaticTask Metrics_TaskBuffer;
+static portSTACK_TYPE Metrics_TaskStack[ METRICS_TASK_STACK ];
+
+/* Private function prototypes -----------------------------------------------*/
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Takes a sample of the counters and measures the time it takes
+ * @param  m: Sample
+ * @retval None
+ */
+static void Metrics_Collect( Metrics_Sample* m )
+{
+	uint32_t start = DWT_GetCycles();
+#ifdef USE_DISK_CACHE
+	DWORD cache[ 3 ];
+#endif /* USE_DISK_CACHE */
+#ifdef USE_SD_IO_PRIORITY
+	SD_IO_ClassStats io;
+	uint32_t ticks = 0;
+	uint8_t k;
+#endif /* USE_SD_IO_PRIORITY */
+#ifdef USE_SD_STATS
+	SD_Stats sd;
+#endif /* USE_SD_STATS */
+
+	memset( m, 0, sizeof( *m ) );
+	m->Seq = Metrics_Seq;
+	m->Msec = xTaskGetTickCount() * portTICK_RATE_MS;
+	m->CollectUs = Metrics_LastUs;
+	m->CollectMaxUs = Metrics_MaxUs;
+	m->HeapFree = xPortGetFreeHeapSize();
+	m->HeapMinFree = xPortGetMinimumEverFreeHeapSize();
+	m->PoolFree = POOL_FreeCount();
+	m->PoolMinFree = POOL_MinFreeCount();
+	m->StackMinFree = uxTaskGetLowestStackHighWaterMark( NULL );
+#ifdef USE_DISK_CACHE
+	if ( disk_ioctl( 0, CTRL_CACHE_STATS, cache ) == RES_OK )
+	{
+		m->CacheHits = cache[ 0 ];
+		m->CacheMisses = cache[ 1 ];
+		m->Cache2Hits = cache[ 2 ];
+	}
+#endif /* USE_DISK_CACHE */
+#ifdef USE_SD_IO_TASK
+	m->IoWaiting = SD_IO_QueueDepth();
+#endif /* USE_SD_IO_TASK */
+#ifdef USE_SD_IO_PRIORITY
+	for ( k = 0; k < SD_IO_CLASSES; ++k )
+	{
+		SD_IO_GetClassStats( (SD_IO_Class)k, &io );
+		m->IoRequests += io.Requests;
+		ticks += io.TotalTicks;
+		if ( io.MaxTicks * portTICK_RATE_MS > m->IoMaxMs )
+			m->IoMaxMs = io.MaxTicks * portTICK_RATE_MS;
+		m->IoMissed += io.Missed;
+	}
+	if ( m->IoRequests )
+		m->IoAvgMs = ticks / m->IoRequests * portTICK_RATE_MS;
+#endif /* USE_SD_IO_PRIORITY */
+#ifdef USE_SD_STATS
+	SD_GetStats( &SD_Card, &sd );
+	m->SdCmdErrors = sd.CmdErrors;
+	m->SdCrcErrors = sd.CrcErrors;
+	m->SdWriteErrors = sd.WriteErrors;
+	m->SdTimeouts = sd.Timeouts;
+	m->SdRetries = sd.Retries;
+	m->SdReinits = sd.Reinits;
+	m->SdUnrecovered = sd.Unrecovered;
+#endif /* USE_SD_STATS */
+
+	Metrics_LastUs = DWT_CyclesToUs( DWT_GetCycles() - start );
+	if ( Metrics_LastUs > Metrics_MaxUs )
+		Metrics_MaxUs = Metrics_LastUs;
+}
+
+#ifdef USE_SDCARD
+/**
+ * @brief  Takes identity of the card if it hasn't been written for this card yet
+ * @param  c: Identity
+ * @retval Nonzero if there is a new card to report
+ */
+static uint8_t Metrics_CollectCard( Metrics_Card* c )
+{
+	SD_CardInfo info;
+	uint32_t changes = SD_IO_CardChanges();
+
+	if ( changes == Metrics_CardChanges || SD_GetCardInfo( &SD_Card, &info ) != SD_RESPONSE_NO_ERROR )
+		return 0;
+	Metrics_CardChanges = changes;
+	c->Seq = Metrics_Seq;
+	c->Msec = xTaskGetTickCount() * portTICK_RATE_MS;
+	c->Changes = changes;
+	c->CapacityKb = info.CardCapacity;
+	memcpy( c->CID, info.CID, sizeof( c->CID ) );
+	return 1;
+}
+#endif /* USE_SDCARD */
+
+/**
+ * @brief  Formats a record in METRICS_FORMAT
+ * @param  type: METRICS_TYPE_SAMPLE or METRICS_TYPE_CARD
+ * @param  rec: Record (Metrics_Sample or Metrics_Card)
+ * @param  len: Size of the record
+ * @retval Number of bytes in Metrics_Record
+ */
+static uint32_t Metrics_Format( uint8_t type, const void* rec, uint32_t len )
+{
+	uint8_t* p = (uint8_t*)Metrics_Record;
+#if METRICS_FORMAT == METRICS_BINARY
+	uint32_t crc;
+
+	p[ 0 ] = METRICS_SYNC;
+	p[ 1 ] = type;
+	p[ 2 ] = (uint8_t)len;
+	p[ 3 ] = (uint8_t)( len >> 8 );
+	memcpy( p + 4, rec, len );		/* Cortex-M3 is little endian */
+	crc = CHK_Crc32( p + 1, 3 + len );
+	memcpy( p + 4 + len, &crc, 4 );
+	return 4 + len + 4;
+#else
+	const uint32_t* w = (const uint32_t*)rec;
+	uint32_t n = 0, i;
+
+	p[ n++ ] = type;
+	if ( type == METRICS_TYPE_CARD )
+	{	/* words, then the CID in hex */
+		for ( i = 0; i < 4; ++i )
+			n += snprintf( Metrics_Record + n, sizeof( Metrics_Record ) - n, ",%lu", (unsigned long)w[ i ] );
+		p[ n++ ] = ',';
+		for ( i = 0; i < 16; ++i )
+			n += snprintf( Metrics_Record + n, sizeof( Metrics_Record ) - n, "%02X", ((const Metrics_Card*)rec)->CID[ i ] );
+	}
+	else
+	{
+		for ( i = 0; i < len / 4; ++i )
+			n += snprintf( Metrics_Record + n, sizeof( Metrics_Record ) - n, ",%lu", (unsigned long)w[ i ] );
+	}
+	p[ n++ ] = '\n';
+	return n;
+#endif /* METRICS_FORMAT */
+}
+
+#ifdef METRICS_FILE
+/**
+ * @brief  Appends data to the metrics file and syncs it, the file is opened on the first
+ *         write once volume 0 is registered (and again after an error)
+ * @param  data: Data
+ * @param  len: Number of bytes
+ * @retval None
+ */
+static void Metrics_FileWrite( const void* data, uint32_t len )
+{
+	FRESULT res = FR_OK;
+	UINT n;
+
+	if ( !Metrics_FileOpen )
+	{
+		if ( f_open( &Metrics_File, METRICS_FILE, FA_WRITE | FA_OPEN_ALWAYS ) != FR_OK )
+			return;		/* no volume yet, the record goes to the console only */
+		res = f_lseek( &Metrics_File, Metrics_File.fsize );
+#if METRICS_FORMAT == METRICS_CSV
+		if ( res == FR_OK && Metrics_File.fsize == 0 )
+			res = f_write( &Metrics_File, Metrics_SampleHeader, sizeof( Metrics_SampleHeader ) - 1, &n );
+		if ( res == FR_OK && Metrics_File.fsize == sizeof( Metrics_SampleHeader ) - 1 )
+			res = f_write( &Metrics_File, Metrics_CardHeader, sizeof( Metrics_CardHeader ) - 1, &n );
+#endif /* METRICS_FORMAT */
+		Metrics_FileOpen = 1;
+	}
+	if ( res == FR_OK )
+		res = f_write( &Metrics_File, data, len, &n );
+	if ( res == FR_OK )
+		res = f_sync( &Metrics_File );
+	if ( res != FR_OK )
+	{	/* e.g. the card was removed, the file is opened again */
+		f_close( &Metrics_File );
+		Metrics_FileOpen = 0;
+	}
+}
+#endif /* METRICS_FILE */
+
+/**
+ * @brief  Writes a record to the console and to the metrics file
+ * @param  type: METRICS_TYPE_SAMPLE or METRICS_TYPE_CARD
+ * @param  rec: Record
+ * @param  len: Size of the record
+ * @retval None
+ */
+static void Metrics_Write( uint8_t type, const void* rec, uint32_t len )
+{
+	uint32_t n = Metrics_Format( type, rec, len );
+
+#ifdef SERIAL_DEBUG
+	DebugComPort_Write( Metrics_Record, n );
+#endif /* SERIAL_DEBUG */
+#ifdef METRICS_FILE
+	Metrics_FileWrite( Metrics_Record, n );
+#endif /* METRICS_FILE */
+	++Metrics_Seq;
+}
+
+/**
+ * @brief  Writes a sample every period, and identity of each new card before it
+ * @param  pvParameters: Not used
+ * @retval None
+ */
+static void Metrics_Task( void* pvParameters )
+{
+	Metrics_Sample sample;
+#ifdef USE_SDCARD
+	Metrics_Card card;
+#endif /* USE_SDCARD */
+	portTickType wake = xTaskGetTickCount();
+
+	(void)pvParameters;
+#if defined(SERIAL_DEBUG) && METRICS_FORMAT == METRICS_CSV
+	DebugComPort_Write( Metrics_SampleHeader, sizeof( Metrics_SampleHeader ) - 1 );
+	DebugComPort_Write( Metrics_CardHeader, sizeof( Metrics_CardHeader ) - 1 );
+#endif /* SERIAL_DEBUG && METRICS_CSV */
+	for ( ;; )
+	{
+		if ( Metrics_PeriodMs == 0 )
+		{
+			vTaskDelay( METRICS_POLL_OFF );
+			wake = xTaskGetTickCount();
+			continue;
+		}
+		vTaskDelayUntil( &wake, Metrics_PeriodMs / portTICK_RATE_MS );
+#ifdef USE_SDCARD
+		if ( Metrics_CollectCard( &card ) )
+			Metrics_Write( METRICS_TYPE_CARD, &card, sizeof( card ) );
+#endif /* USE_SDCARD */
+		Metrics_Collect( &sample );
+		Metrics_Write( METRICS_TYPE_SAMPLE, &sample, sizeof( sample ) );
+	}
+}
+
+/**
+ * @brief  Starts cycle counter and creates the metrics task
+ * @param  None
+ * @retval None
+ */
+void Metrics_Init( void )
+{
+	DWT_Enable();
+	xTaskCreateStatic( Metrics_Task, (const signed char* const)"MTR", METRICS_TASK_STACK, NULL, METRICS_TASK_PRIO, NULL,
+			Metrics_TaskStack, &Metrics_TaskBuffer );
+}
+
+/**
+ * @brief  Changes the sampling period, the next sample is taken one new period after the last one
+ * @param  msec: Period in milliseconds (at least a tick), 0 stops the export
+ * @retval None
+ */
+void Metrics_SetPeriod( uint32_t msec )
+{
+	Metrics_PeriodMs = msec;
+}
+
+#endif /* USE_METRICS */
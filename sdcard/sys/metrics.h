@@ -0,0 +1,97 @@
+/**
+ ******************************************************************************
+ * @file    metrics.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Storage metrics export: a low priority task takes a sample of the
+ *          counters of the storage stack every period (driver errors, sector
+ *          cache hits, SD I/O queue and latencies, heap, sector pool and the
+ *          least free task stack) and writes it as one record to the console
+ *          and, with METRICS_FILE, appended to a file on volume 0. Identity
+ *          of the card (CID, capacity) goes out once per inserted card.
+ *          Records are CSV lines or binary frames (METRICS_FORMAT), the time
+ *          the task took to collect each sample is in the next one.
+ *          tools/metrics_decode.py turns binary frames into CSV.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef METRICS_H
+#define METRICS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include <stdint.h>
+
+/* Exported types ------------------------------------------------------------*/
+
+/* Sample of the counters (all fields are little endian words in binary frames, this
+   layout is read by tools/metrics_decode.py), counters of disabled options are 0 */
+typedef struct
+{
+	uint32_t	Seq;			/* Record number since start */
+	uint32_t	Msec;			/* Time since start (ms) */
+	uint32_t	CollectUs;		/* Time taken to collect the previous sample (us) */
+	uint32_t	CollectMaxUs;	/* Longest collection so far (us) */
+	uint32_t	HeapFree;		/* Free heap now and the least so far (bytes) */
+	uint32_t	HeapMinFree;
+	uint32_t	PoolFree;		/* Free sector buffers now and the least so far */
+	uint32_t	PoolMinFree;
+	uint32_t	StackMinFree;	/* Least free stack of a task (words never used) */
+	uint32_t	CacheHits;		/* Sector cache of diskio (USE_DISK_CACHE), since start */
+	uint32_t	CacheMisses;
+	uint32_t	Cache2Hits;
+	uint32_t	IoWaiting;		/* Requests waiting for SD I/O task (USE_SD_IO_TASK) */
+	uint32_t	IoRequests;		/* Requests of all classes (USE_SD_IO_PRIORITY), since start */
+	uint32_t	IoAvgMs;		/* Average and longest latency of them (ms) */
+	uint32_t	IoMaxMs;
+	uint32_t	IoMissed;		/* Deadlines missed */
+	uint32_t	SdCmdErrors;	/* SD Card driver (USE_SD_STATS), since start */
+	uint32_t	SdCrcErrors;
+	uint32_t	SdWriteErrors;
+	uint32_t	SdTimeouts;
+	uint32_t	SdRetries;
+	uint32_t	SdReinits;
+	uint32_t	SdUnrecovered;
+} Metrics_Sample;
+
+/* Identity of the card */
+typedef struct
+{
+	uint32_t	Seq;			/* Record number since start */
+	uint32_t	Msec;			/* Time since start (ms) */
+	uint32_t	Changes;		/* SD_IO_CardChanges() of the card */
+	uint32_t	CapacityKb;		/* Capacity of the card (Kbytes) */
+	uint8_t		CID[ 16 ];		/* CID register as received from the card */
+} Metrics_Card;
+
+/* Exported constants --------------------------------------------------------*/
+
+/* Formats of the records (METRICS_FORMAT is set in main.h) */
+#define METRICS_CSV				0	/* Text lines "M,..." and "C,...", a "#" line names the fields first */
+#define METRICS_BINARY			1	/* Frames: sync, type, length (16 bits), record, CRC32 (as zlib crc32) of type .. record */
+
+/* Binary frames (keep tools/metrics_decode.py in sync) */
+#define METRICS_SYNC			0xA5
+#define METRICS_TYPE_SAMPLE		0x4D	/* Metrics_Sample */
+#define METRICS_TYPE_CARD		0x43	/* Metrics_Card */
+
+/* Exported macro ------------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+
+#ifdef USE_METRICS
+void Metrics_Init( void );
+void Metrics_SetPeriod( uint32_t msec );
+#endif /* USE_METRICS */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* METRICS_H */
@@ -0,0 +1,165 @@
+/**
+ ******************************************************************************
+ * @file    power.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Low-power idle hook: tickless sleep and STOP mode
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "power.h"
+#include "watchdog.h"
+
+#ifdef USE_LOW_POWER_IDLE
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Private typedef -----------------------------------------------------------*/
+/* Private define ------------------------------------------------------------*/
+
+/* SysTick counts for one tick, and the longest sleep its 24-bit counter can time (139 ticks at 120 MHz) */
+#define POWER_TICK_COUNTS		( configCPU_CLOCK_HZ / configTICK_RATE_HZ )
+#define POWER_SLEEP_MAX			( SysTick_LOAD_RELOAD_Msk / POWER_TICK_COUNTS )
+
+/* Shorter idle periods are slept through with the tick running (reprogramming SysTick isn't worth it) */
+#define POWER_SLEEP_MIN			2
+
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+
+#ifdef USE_LOW_POWER_STOP
+volatile uint32_t Power_BusyCount;			/* Busy tokens held by drivers */
+#endif /* USE_LOW_POWER_STOP */
+
+/* Private function prototypes -----------------------------------------------*/
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Sleeps by WFI (interrupts are masked by PRIMASK, a pending one still
+ *         wakes the core up) with SysTick set to interrupt after idle ticks,
+ *         then accounts for the ticks which were suppressed
+ * @param  idle: Expected idle time in ticks
+ * @retval None
+ */
+static void Power_Sleep( portTickType idle )
+{
+	uint32_t reload, ctrl, done, elapsed;
+
+	if ( idle > POWER_SLEEP_MAX )
+		idle = POWER_SLEEP_MAX;
+
+	SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
+	if ( SCB->ICSR & SCB_ICSR_PENDSTSET_Msk )
+	{	/* tick is due right now */
+		SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+		return;
+	}
+	/* rest of the current tick period and idle - 1 whole ones */
+	reload = SysTick->VAL + POWER_TICK_COUNTS * ( idle - 1 );
+	SysTick->LOAD = reload;
+	SysTick->VAL = 0;
+	SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+
+	__DSB();
+	__WFI();
+	__ISB();
+
+	ctrl = SysTick->CTRL;
+	SysTick->CTRL = ctrl & ~SysTick_CTRL_ENABLE_Msk;
+	if ( ctrl & SysTick_CTRL_COUNTFLAG_Msk )
+	{	/* slept the whole period, its tick interrupt is pending and counts the last tick */
+		reload = ( POWER_TICK_COUNTS - 1 ) - ( reload - SysTick->VAL );
+		if ( reload >= POWER_TICK_COUNTS )
+			reload = POWER_TICK_COUNTS - 1;
+		SysTick->LOAD = reload;
+		done = idle - 1;
+	}
+	else
+	{	/* another interrupt: whole ticks elapsed, the next one comes at the end of the current period */
+		elapsed = POWER_TICK_COUNTS * idle - SysTick->VAL;
+		done = elapsed / POWER_TICK_COUNTS;
+		SysTick->LOAD = ( done + 1 ) * POWER_TICK_COUNTS - elapsed;
+	}
+	SysTick->VAL = 0;
+	SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+	vTaskStepTick( done );
+	SysTick->LOAD = POWER_TICK_COUNTS - 1;
+}
+
+#ifdef USE_LOW_POWER_STOP
+/**
+ * @brief  Enters STOP mode until an EXTI line (buttons, card detect) wakes the core up,
+ *         then restarts HSE and PLL (the core runs from HSI after STOP). The tick
+ *         doesn't count meanwhile: no task waits for a timeout then.
+ * @param  None
+ * @retval None
+ */
+static void Power_Stop( void )
+{
+	SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
+	PWR_EnterSTOPMode( PWR_Regulator_LowPower, PWR_STOPEntry_WFI );
+
+	/* PLL configuration survives STOP mode */
+	RCC_HSEConfig( RCC_HSE_ON );
+	if ( RCC_WaitForHSEStartUp() == SUCCESS )
+	{
+		RCC_PLLCmd( ENABLE );
+		while ( RCC_GetFlagStatus( RCC_FLAG_PLLRDY ) == RESET ) {}
+		RCC_SYSCLKConfig( RCC_SYSCLKSource_PLLCLK );
+		while ( RCC_GetSYSCLKSource() != 0x08 ) {}
+	}
+	SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+}
+#endif /* USE_LOW_POWER_STOP */
+
+/**
+ * @brief  Enables PWR interface for STOP mode
+ * @param  None
+ * @retval None
+ */
+void Power_Init( void )
+{
+#ifdef USE_LOW_POWER_STOP
+	RCC_APB1PeriphClockCmd( RCC_APB1Periph_PWR, ENABLE );
+#endif /* USE_LOW_POWER_STOP */
+}
+
+/**
+ * @brief  Idle hook of the scheduler: kicks the watchdog, sleeps until the next task is due
+ *         (at most POWER_SLEEP_MAX ticks, well within WATCHDOG_TIMEOUT_MS)
+ * @param  None
+ * @retval None
+ */
+void vApplicationIdleHook( void )
+{
+	portTickType idle;
+
+	WATCHDOG_KICK();
+
+	/* no task can be readied by the kernel, interrupts which ready one are held pending */
+	vTaskSuspendAll();
+	__disable_irq();
+	idle = xTaskGetExpectedIdleTime();
+#ifdef USE_LOW_POWER_STOP
+	if ( idle == portMAX_DELAY && Power_BusyCount == 0 )
+		Power_Stop();
+	else
+#endif /* USE_LOW_POWER_STOP */
+	if ( idle >= POWER_SLEEP_MIN )
+		Power_Sleep( idle );
+	else if ( idle != 0 )
+	{
+		__DSB();
+		__WFI();
+	}
+	__enable_irq();
+	xTaskResumeAll();
+}
+
+#endif /* USE_LOW_POWER_IDLE */
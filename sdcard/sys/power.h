@@ -0,0 +1,85 @@
+/**
+ ******************************************************************************
+ * @file    power.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Low-power idle. The idle hook stops the core by WFI with the tick
+ *          interrupt suppressed until the first delayed task is due (sleep
+ *          mode: DMA and peripherals keep running). With USE_LOW_POWER_STOP
+ *          it enters STOP mode when all tasks wait without a timeout and
+ *          nobody holds a busy token: drivers hold one while a DMA transfer
+ *          is in flight or the card is programming, since clocks of SPI,
+ *          SDIO and DMA are stopped in STOP mode.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef POWER_H
+#define POWER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "stm32f2xx.h"
+
+/* Exported types ------------------------------------------------------------*/
+/* Exported constants --------------------------------------------------------*/
+/* Exported macro ------------------------------------------------------------*/
+
+#ifdef USE_LOW_POWER_STOP
+#define POWER_BUSY()		Power_Busy()
+#define POWER_RELEASE()		Power_Release()
+#else
+#define POWER_BUSY()		do {} while ( 0 )
+#define POWER_RELEASE()		do {} while ( 0 )
+#endif /* USE_LOW_POWER_STOP */
+
+/* Exported functions ------------------------------------------------------- */
+
+#ifdef USE_LOW_POWER_IDLE
+void Power_Init( void );
+#endif /* USE_LOW_POWER_IDLE */
+
+#ifdef USE_LOW_POWER_STOP
+extern volatile uint32_t Power_BusyCount;
+
+/**
+ * @brief  Takes a busy token: STOP mode is not entered until it is released
+ *         (callable from interrupt handlers)
+ * @param  None
+ * @retval None
+ */
+static __INLINE void Power_Busy( void )
+{
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	++Power_BusyCount;
+	__set_PRIMASK( primask );
+}
+
+/**
+ * @brief  Releases a busy token taken by Power_Busy()
+ * @param  None
+ * @retval None
+ */
+static __INLINE void Power_Release( void )
+{
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	--Power_BusyCount;
+	__set_PRIMASK( primask );
+}
+#endif /* USE_LOW_POWER_STOP */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* POWER_H */
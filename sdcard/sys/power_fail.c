@@ -0,0 +1,313 @@
+/**
+ ******************************************************************************
+ * @file    power_fail.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Power failure detection (see power_fail.h). The interrupt handler
+ *          only stamps the time and wakes the task; the task runs above SD
+ *          I/O task and each writer, so once it is woken only the writes it
+ *          waits for go on. Volumes are committed by the path itself (no
+ *          shortcut for the probe), so the time measured at start is the
+ *          time of a failure with every slot of the sector cache dirty.
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "power_fail.h"
+
+#ifdef USE_POWER_FAIL
+
+#include "stm32_irq.h"
+#include "stm32_dwt.h"
+#include "stm32_pool.h"
+#include "stm32_sd_io.h"
+
+#include "diskio.h"
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if _FS_READONLY
+#error USE_POWER_FAIL needs write functions of FatFs (_FS_READONLY 0 in ffconf.h)!
+#endif
+
+#if !configUSE_TASK_NOTIFICATIONS
+#error USE_POWER_FAIL needs configUSE_TASK_NOTIFICATIONS (see FreeRTOSConfig.h)
+#endif
+
+/* Private typedef -----------------------------------------------------------*/
+/* Private define ------------------------------------------------------------*/
+
+/* Above SD I/O task and all writers: they can't add dirty sectors meanwhile */
+#define POWER_FAIL_TASK_PRIO		( tskIDLE_PRIORITY + 3 )
+/* The report is formatted by printf */
+#ifdef USE_TINY_PRINTF
+#define POWER_FAIL_TASK_STACK		( configMINIMAL_STACK_SIZE * 2 )
+#else
+#define POWER_FAIL_TASK_STACK		( configMINIMAL_STACK_SIZE * 3 )
+#endif /* USE_TINY_PRINTF */
+
+/* PVD threshold: 2.9 V of falling supply on STM32F2, the card works down to 2.7 V */
+#define POWER_FAIL_PVD_LEVEL		PWR_PVDLevel_7
+
+/* Time from the PVD interrupt until the supply falls below 2.7 V at the full load of the board,
+   set by its bulk capacitance: measure it on the board (supply cut, scope on VDD) */
+#ifndef POWER_FAIL_HOLDUP_US
+#define POWER_FAIL_HOLDUP_US		10000
+#endif /* POWER_FAIL_HOLDUP_US */
+
+/* Files of which data and directory entries are committed (PowerFail_Watch) */
+#define POWER_FAIL_FILES			4
+
+/* Probe file on volume 0: every second sector of it is made dirty, so the cache can't merge
+   them into longer writes, then the path is timed. 0 sectors: the path isn't measured */
+#define POWER_FAIL_PROBE_FILE		"PFAIL.BIN"
+#ifdef USE_DISK_CACHE
+#define POWER_FAIL_PROBE_SECTORS	DISK_CACHE_SLOTS
+#else
+#define POWER_FAIL_PROBE_SECTORS	4
+#endif /* USE_DISK_CACHE */
+
+/* The supply above the threshold for this long after a failure: the board restarts */
+#define POWER_FAIL_RECOVER_MS		100
+#define POWER_FAIL_POLL_MS			10
+
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+
+static FIL* volatile PowerFail_Files[ POWER_FAIL_FILES ];
+static volatile uint32_t PowerFail_Stamp;		/* Cycle counter at the interrupt */
+static uint32_t PowerFail_Us;					/* Time the last commit took */
+static xTaskHandle PowerFail_Task;
+static xStaticTask PowerFail_TaskBuffer;
+static portSTACK_TYPE PowerFail_TaskStack[ POWER_FAIL_TASK_STACK ];
+#if POWER_FAIL_PROBE_SECTORS
+static FATFS PowerFail_Fs;
+static FIL PowerFail_File;
+#endif /* POWER_FAIL_PROBE_SECTORS */
+
+/* Private function prototypes -----------------------------------------------*/
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Emergency path: stops writes of other tasks, commits files and volumes into
+ *         the cache, writes the dirty sectors and syncs the drives
+ * @param  None
+ * @retval FatFs result, FR_DISK_ERR if a sector couldn't be written
+ */
+static FRESULT PowerFail_Commit( void )
+{
+	FRESULT res;
+	BYTE state = DISK_POWER_HOLD;
+
+	disk_ioctl( 0, CTRL_POWER_FAIL, &state );
+	res = f_commit( (FIL* const*)PowerFail_Files, POWER_FAIL_FILES );
+	state = DISK_POWER_DOWN;
+	if ( disk_ioctl( 0, CTRL_POWER_FAIL, &state ) != RES_OK )
+		res = FR_DISK_ERR;
+	return res;
+}
+
+#if POWER_FAIL_PROBE_SECTORS
+/**
+ * @brief  Makes POWER_FAIL_PROBE_SECTORS sectors of the probe file dirty and times the
+ *         emergency path, then lets the writes go on. It runs before other tasks do,
+ *         so no writer is refused, and volume 0 is mounted again by the next user.
+ * @param  None
+ * @retval None
+ */
+static void PowerFail_Probe( void )
+{
+	FRESULT res;
+	BYTE* buf;
+	BYTE state = DISK_POWER_ON;
+	uint32_t i, start;
+	UINT n;
+
+	buf = POOL_Alloc();
+	if ( buf == NULL )
+	{
+		printf( "Power fail : no sector buffer for the probe\n" );
+		return;
+	}
+	memset( buf, 0, POOL_BLOCK_SIZE );
+	res = f_mount( 0, &PowerFail_Fs );
+	if ( res == FR_OK )
+		res = f_open( &PowerFail_File, POWER_FAIL_PROBE_FILE, FA_WRITE | FA_OPEN_ALWAYS );
+	if ( res == FR_OK )
+	{	/* clusters are allocated before the timed writes */
+		res = f_lseek( &PowerFail_File, 2 * POWER_FAIL_PROBE_SECTORS * POOL_BLOCK_SIZE );
+		if ( res == FR_OK && PowerFail_File.fsize != 2 * POWER_FAIL_PROBE_SECTORS * POOL_BLOCK_SIZE )
+			res = FR_DENIED;	/* the disk is full */
+		if ( res == FR_OK )
+			res = f_sync( &PowerFail_File );
+		for ( i = 0; i < POWER_FAIL_PROBE_SECTORS && res == FR_OK; ++i )
+		{
+			res = f_lseek( &PowerFail_File, 2 * i * POOL_BLOCK_SIZE );
+			if ( res == FR_OK )
+				res = f_write( &PowerFail_File, buf, POOL_BLOCK_SIZE, &n );
+		}
+		if ( res == FR_OK )
+		{
+			PowerFail_Watch( &PowerFail_File );
+			start = DWT_GetCycles();
+			res = PowerFail_Commit();
+			PowerFail_Us = DWT_CyclesToUs( DWT_GetCycles() - start );
+			disk_ioctl( 0, CTRL_POWER_FAIL, &state );
+			PowerFail_Unwatch( &PowerFail_File );
+		}
+		f_close( &PowerFail_File );
+	}
+	POOL_Free( buf );
+
+	if ( res != FR_OK )
+	{
+		printf( "Power fail : probe file " POWER_FAIL_PROBE_FILE " failed with code %d, hold-up %lu us\n",
+				res, (uint32_t)POWER_FAIL_HOLDUP_US );
+		return;
+	}
+	printf( "Power fail : commit of %u sectors takes %lu us of %lu us hold-up%s\n", POWER_FAIL_PROBE_SECTORS,
+			PowerFail_Us, (uint32_t)POWER_FAIL_HOLDUP_US, ( PowerFail_Us > POWER_FAIL_HOLDUP_US ) ? ", NOT ENOUGH" : "" );
+	printf( "PFAIL,%u,%lu,%lu\n", POWER_FAIL_PROBE_SECTORS, PowerFail_Us, (uint32_t)POWER_FAIL_HOLDUP_US );
+}
+#endif /* POWER_FAIL_PROBE_SECTORS */
+
+/**
+ * @brief  Measures the path, then waits for the interrupt and commits the volumes;
+ *         writes stay refused until the supply is back for POWER_FAIL_RECOVER_MS
+ * @param  pvParameters: Not used
+ * @retval None
+ */
+static void PowerFail_TaskFn( void* pvParameters )
+{
+	FRESULT res;
+	uint32_t ok = 0;
+
+	(void)pvParameters;
+#ifdef USE_SD_IO_PRIORITY
+	SD_IO_SetTaskClass( NULL, SD_IO_INTERACTIVE, 0 );
+#endif /* USE_SD_IO_PRIORITY */
+#if POWER_FAIL_PROBE_SECTORS
+	if ( ulTaskNotifyTake( pdTRUE, 0 ) == 0 )
+		PowerFail_Probe();
+	else
+		xTaskNotifyGive( PowerFail_Task );		/* the supply is failing already */
+#endif /* POWER_FAIL_PROBE_SECTORS */
+
+	ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+	res = PowerFail_Commit();
+	PowerFail_Us = DWT_CyclesToUs( DWT_GetCycles() - PowerFail_Stamp );
+
+	/* still running: the supply dropped for a moment */
+	while ( ok < POWER_FAIL_RECOVER_MS )
+	{
+		vTaskDelay( POWER_FAIL_POLL_MS / portTICK_RATE_MS );
+		ok = ( PWR_GetFlagStatus( PWR_FLAG_PVDO ) == RESET ) ? ok + POWER_FAIL_POLL_MS : 0;
+	}
+	printf( "Power fail : supply is back, commit took %lu us with code %d, restart\n", PowerFail_Us, res );
+	vTaskDelay( POWER_FAIL_POLL_MS / portTICK_RATE_MS );		/* the console sends the line */
+	NVIC_SystemReset();
+}
+
+/* Public functions ----------------------------------------------------------*/
+
+/**
+ * @brief  Creates the task and enables PVD interrupt (EXTI line 16, rising edge:
+ *         PVD output goes high when the supply falls below the threshold)
+ * @param  None
+ * @retval None
+ */
+void PowerFail_Init( void )
+{
+	EXTI_InitTypeDef EXTI_InitStructure;
+
+	DWT_Enable();
+	xTaskCreateStatic( PowerFail_TaskFn, (const signed char* const)"PWF", POWER_FAIL_TASK_STACK, NULL,
+			POWER_FAIL_TASK_PRIO, &PowerFail_Task, PowerFail_TaskStack, &PowerFail_TaskBuffer );
+
+	RCC_APB1PeriphClockCmd( RCC_APB1Periph_PWR, ENABLE );
+	PWR_PVDLevelConfig( POWER_FAIL_PVD_LEVEL );
+	PWR_PVDCmd( ENABLE );
+
+	EXTI_ClearITPendingBit( EXTI_Line16 );
+	EXTI_InitStructure.EXTI_Line = EXTI_Line16;
+	EXTI_InitStructure.EXTI_Mode = EXTI_Mode_Interrupt;
+	EXTI_InitStructure.EXTI_Trigger = EXTI_Trigger_Rising;
+	EXTI_InitStructure.EXTI_LineCmd = ENABLE;
+	EXTI_Init( &EXTI_InitStructure );
+	IRQ_Enable( PVD_IRQn, IRQ_PRIO_PVD );
+}
+
+/**
+ * @brief  Adds a file open for writing to the files committed on power failure
+ *         (e.g. a log which defers its directory entry by _FS_DIR_SYNC_MS)
+ * @param  fp: File object
+ * @retval 1 if added, 0 if POWER_FAIL_FILES files are watched already
+ */
+uint8_t PowerFail_Watch( FIL* fp )
+{
+	uint8_t i, done = 0;
+
+	taskENTER_CRITICAL();
+	for ( i = 0; i < POWER_FAIL_FILES && !done; ++i )
+	{
+		if ( PowerFail_Files[ i ] == NULL )
+		{
+			PowerFail_Files[ i ] = fp;
+			done = 1;
+		}
+	}
+	taskEXIT_CRITICAL();
+	return done;
+}
+
+/**
+ * @brief  Removes a file from the watched ones, call it before f_close
+ * @param  fp: File object
+ * @retval None
+ */
+void PowerFail_Unwatch( FIL* fp )
+{
+	uint8_t i;
+
+	for ( i = 0; i < POWER_FAIL_FILES; ++i )
+	{
+		if ( PowerFail_Files[ i ] == fp )
+			PowerFail_Files[ i ] = NULL;
+	}
+}
+
+/**
+ * @brief  Time the emergency path took: at start the probe, after a supply drop which
+ *         didn't reset the board the time from the interrupt to the end of the commit
+ * @param  None
+ * @retval Microseconds, 0 if not measured
+ */
+uint32_t PowerFail_LatencyUs( void )
+{
+	return PowerFail_Us;
+}
+
+/**
+ * @brief  PVD interrupt handler (EXTI line 16): wakes the task
+ * @param  None
+ * @retval None
+ */
+void PowerFail_IRQHandler( void )
+{
+	if ( EXTI_GetITStatus( EXTI_Line16 ) != RESET )
+	{
+		EXTI_ClearITPendingBit( EXTI_Line16 );
+		PowerFail_Stamp = DWT_GetCycles();
+		IRQ_Notify( PowerFail_Task );
+	}
+}
+
+#endif /* USE_POWER_FAIL */
@@ -0,0 +1,54 @@
+/**
+ ******************************************************************************
+ * @file    power_fail.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Power failure detection and emergency commit of the volumes.
+ *          The programmable voltage detector (PVD) interrupts when the supply
+ *          falls below POWER_FAIL_PVD_LEVEL, the task of the highest priority
+ *          then has the hold-up time of the supply until the card stops
+ *          working: diskio refuses writes of other tasks, data and directory
+ *          entries of the watched files, windows and FSInfo of each volume
+ *          go into the sector cache (f_commit), the dirty sectors are written
+ *          in one pass in ascending order, SD I/O task closes its write
+ *          stream. Each write is refused from then on; if the supply comes
+ *          back instead, the board restarts.
+ *          The time the path takes is measured once after start on a probe
+ *          file and printed with the hold-up time the board is designed for.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef POWER_FAIL_H
+#define POWER_FAIL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "ff.h"
+
+#include <stdint.h>
+
+/* Exported types ------------------------------------------------------------*/
+/* Exported constants --------------------------------------------------------*/
+/* Exported macro ------------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+
+#ifdef USE_POWER_FAIL
+void PowerFail_Init( void );
+uint8_t PowerFail_Watch( FIL* fp );
+void PowerFail_Unwatch( FIL* fp );
+uint32_t PowerFail_LatencyUs( void );
+void PowerFail_IRQHandler( void );
+#endif /* USE_POWER_FAIL */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* POWER_FAIL_H */
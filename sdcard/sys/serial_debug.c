@@ -4,7 +4,10 @@
  * @author  Alexei Troussov
  * @version V1.0
  * @date    21-June-2012
- * @brief   Serail port debugging console. Retargets printf() function to USART
+ * @brief   Serail port debugging console. Retargets printf() function to USART.
+ *          With USE_TINY_PRINTF printf() family of the C library is replaced
+ *          by a small formatter: no heap, no locks, a few hundred bytes of
+ *          stack, output goes to the port in chunks instead of characters.
  ******************************************************************************
  */
 
@@ -15,11 +18,23 @@
 #include "serial_debug.h"
 
 #include "stm32_usart.h"
+#include "stm32_irq.h"
 
 #include <stdio.h>
+#ifdef USE_TINY_PRINTF
+#include <stdarg.h>
+#include <string.h>
+#endif /* USE_TINY_PRINTF */
 
 #ifdef SERIAL_DEBUG
 
+#if defined(USE_SERIAL_TX_RING) || defined(USE_CONSOLE_SHELL)
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#endif /* USE_SERIAL_TX_RING || USE_CONSOLE_SHELL */
+
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
 
@@ -31,14 +46,107 @@
 #define PUTCHAR_PROTOTYPE int fputc(int ch, FILE *f)
 #endif /* __GNUC__ */
 
+/* Line of DebugComPort_HexDump: address, 16 bytes in hex, the same as characters */
+#define DEBUG_HEX_BYTES			16
+#define DEBUG_HEX_LINE			( 8 + 1 + DEBUG_HEX_BYTES * 3 + 2 + DEBUG_HEX_BYTES + 1 )
+
+/* COM port of the console */
+#define DEBUG_COM				( (COM_TypeDef)( SERIAL_DEBUG_PORT - 1 ) )
+#define DEBUG_USART				( COM_USART[ DEBUG_COM ] )
+
+#ifdef USE_SERIAL_TX_RING
+/* Overflow policies of the transmit ring */
+#define DEBUG_TX_DROP			0	/* Characters which don't fit are lost, printf() never waits */
+#define DEBUG_TX_BLOCK			1	/* Caller waits until the port frees place in the ring */
+
+#define DEBUG_TX_POLICY			DEBUG_TX_DROP	/* Size of the ring DEBUG_TX_SIZE is in storage_conf.h */
+#endif /* USE_SERIAL_TX_RING */
+
+#ifdef USE_CONSOLE_SHELL
+/* Received characters waiting for the shell (a typed line, pasted ones may be lost) */
+#define DEBUG_RX_QUEUE			32
+#endif /* USE_CONSOLE_SHELL */
+
+#ifdef USE_TINY_PRINTF
+/* Characters formatted on the stack before they are passed to the port */
+#define DEBUG_FMT_CHUNK			32
+
+/* Digits of the longest number (64-bit octal, or integer and fraction of %f) */
+#define DEBUG_FMT_DIGITS		32
+
+/* Most digits after the point of %f */
+#define DEBUG_FMT_PREC			9
+
+/* Flags of a conversion */
+#define DEBUG_FMT_LEFT			0x01	/* '-' */
+#define DEBUG_FMT_ZERO			0x02	/* '0' */
+#define DEBUG_FMT_PLUS			0x04	/* '+' */
+#define DEBUG_FMT_SPACE			0x08	/* ' ' */
+#define DEBUG_FMT_ALT			0x10	/* '#' */
+#endif /* USE_TINY_PRINTF */
+
 /* Private macro -------------------------------------------------------------*/
+#ifdef USE_TINY_PRINTF
+/* Output of the formatter: a chunk on the stack sent to the port when full (Buf),
+   or a string which keeps counting the characters that don't fit (Buf is NULL) */
+typedef struct
+{
+	char*		Next;		/* Place of the next character */
+	uint32_t	Left;		/* Room left at Next */
+	char*		Buf;		/* Start of the chunk */
+	int			Count;		/* Characters produced */
+} DebugFmt_Out;
+#endif /* USE_TINY_PRINTF */
+
 /* Private variables ---------------------------------------------------------*/
+
+#ifdef USE_SERIAL_TX_RING
+static uint8_t DebugTx_Ring[ DEBUG_TX_SIZE ];
+static volatile uint16_t DebugTx_Head;		/* Next free place, moved by callers of printf() */
+static volatile uint16_t DebugTx_Tail;		/* Next character to send, moved by TXE interrupt */
+#endif /* USE_SERIAL_TX_RING */
+#ifdef USE_CONSOLE_SHELL
+static xQueueHandle DebugRx_Queue;			/* Characters received by RXNE interrupt */
+static xStaticQueue DebugRx_QueueBuffer;
+static uint8_t DebugRx_QueueStorage[ DEBUG_RX_QUEUE ];
+#endif /* USE_CONSOLE_SHELL */
+
+static const char DebugHex[ 16 ] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
+#ifdef USE_TINY_PRINTF
+static const char DebugHexLower[ 16 ] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+#ifdef USE_TINY_PRINTF_FLOAT
+static const uint32_t DebugFmt_Scale[ DEBUG_FMT_PREC + 1 ] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+#endif /* USE_TINY_PRINTF_FLOAT */
+#endif /* USE_TINY_PRINTF */
+
 /* Private function prototypes -----------------------------------------------*/
 /* Private functions ---------------------------------------------------------*/
 
+#ifdef USE_SERIAL_TX_RING
+/**
+ * @brief  Sends the next character of the ring if the port is ready, the interrupt
+ *         is disabled once the ring is empty. Called from TXE interrupt, or by
+ *         the caller inside a critical section when it waits for place in the ring.
+ * @param  None
+ * @retval None
+ */
+static void DebugComPort_SendNext( void )
+{
+	if ( USART_GetFlagStatus( DEBUG_USART, USART_FLAG_TXE ) == RESET )
+		return;
+	if ( DebugTx_Tail != DebugTx_Head )
+	{
+		USART_SendData( DEBUG_USART, DebugTx_Ring[ DebugTx_Tail ] );
+		DebugTx_Tail = ( DebugTx_Tail + 1 ) & ( DEBUG_TX_SIZE - 1 );
+	}
+	if ( DebugTx_Tail == DebugTx_Head )
+		USART_ITConfig( DEBUG_USART, USART_IT_TXE, DISABLE );
+}
+#endif /* USE_SERIAL_TX_RING */
+
 /**
- * @brief  Initialize COM1 interface for serial debug
- * @note   COM1 interface is defined in stm3210g_eval.h file (under Utilities\STM32_EVAL\STM322xG_EVAL)
+ * @brief  Initialize COM port SERIAL_DEBUG_PORT for serial debug at SERIAL_DEBUG_BAUDRATE
+ * @note   COM ports are defined in stm32_pins.h
  * @param  None
  * @retval None
  */
@@ -47,21 +155,186 @@ void DebugComPort_Init( void )
 	USART_InitTypeDef USART_InitStructure;
 
 	/* USARTx configured as follow:
-	   - BaudRate = 115200 baud
+	   - BaudRate = SERIAL_DEBUG_BAUDRATE
 	   - Word Length = 8 Bits
 	   - One Stop Bit
 	   - No parity
 	   - Hardware flow control disabled (RTS and CTS signals)
 	   - Receive and transmit enabled
 	*/
-	USART_InitStructure.USART_BaudRate = 115200;
+	USART_InitStructure.USART_BaudRate = SERIAL_DEBUG_BAUDRATE;
 	USART_InitStructure.USART_WordLength = USART_WordLength_8b;
 	USART_InitStructure.USART_StopBits = USART_StopBits_1;
 	USART_InitStructure.USART_Parity = USART_Parity_No;
 	USART_InitStructure.USART_HardwareFlowControl = USART_HardwareFlowControl_None;
 	USART_InitStructure.USART_Mode = USART_Mode_Rx | USART_Mode_Tx;
 
-	STM_EVAL_COMInit( COM1, &USART_InitStructure );
+	STM_EVAL_COMInit( DEBUG_COM, &USART_InitStructure );
+
+#ifdef USE_CONSOLE_SHELL
+	/* RXNE interrupt passes received characters to the shell */
+	DebugRx_Queue = xQueueCreateStatic( DEBUG_RX_QUEUE, sizeof( uint8_t ), DebugRx_QueueStorage, &DebugRx_QueueBuffer );
+	USART_ITConfig( DEBUG_USART, USART_IT_RXNE, ENABLE );
+#endif /* USE_CONSOLE_SHELL */
+#if defined(USE_SERIAL_TX_RING) || defined(USE_CONSOLE_SHELL)
+	/* TXE interrupt drains the ring, it is enabled while there is something to send */
+	IRQ_Enable( (IRQn_Type)COM_IRQn[ DEBUG_COM ], IRQ_PRIO_COM );
+#endif /* USE_SERIAL_TX_RING || USE_CONSOLE_SHELL */
+}
+
+/**
+ * @brief  Changes baud rate of the console (e.g. several Mbaud on COM2 for bulk dumps),
+ *         the output given to printf() before is sent at the old rate
+ * @param  baudRate: New baud rate (up to STM_EVAL_COMMaxBaudRate of the port)
+ * @retval ERROR if the port can't run at this rate
+ */
+ErrorStatus DebugComPort_SetBaudRate( uint32_t baudRate )
+{
+	if ( baudRate == 0 || baudRate > STM_EVAL_COMMaxBaudRate( DEBUG_COM ) )
+		return ERROR;
+#ifdef USE_SERIAL_TX_RING
+	while ( DebugTx_Tail != DebugTx_Head )
+	{
+		if ( __get_PRIMASK() || xTaskGetSchedulerState() != taskSCHEDULER_RUNNING )
+		{	/* the interrupt can't drain the ring */
+			taskENTER_CRITICAL();
+			DebugComPort_SendNext();
+			taskEXIT_CRITICAL();
+		}
+	}
+#endif /* USE_SERIAL_TX_RING */
+	return STM_EVAL_COMSetBaudRate( DEBUG_COM, baudRate );
+}
+
+#if defined(USE_SERIAL_TX_RING) || defined(USE_CONSOLE_SHELL)
+/**
+ * @brief  Handles TXE and RXNE interrupts of COM port (overrun is cleared by the same read)
+ * @param  None
+ * @retval None
+ */
+void DebugComPort_IRQHandler( void )
+{
+#ifdef USE_CONSOLE_SHELL
+	portBASE_TYPE woken = pdFALSE;
+	uint8_t b;
+
+	if ( DEBUG_USART->SR & ( USART_FLAG_RXNE | USART_FLAG_ORE ) )
+	{
+		b = (uint8_t)USART_ReceiveData( DEBUG_USART );
+		xQueueSendFromISR( DebugRx_Queue, &b, &woken );		/* lost if the queue is full */
+	}
+#endif /* USE_CONSOLE_SHELL */
+#ifdef USE_SERIAL_TX_RING
+	DebugComPort_SendNext();
+#endif /* USE_SERIAL_TX_RING */
+#ifdef USE_CONSOLE_SHELL
+	portYIELD_FROM_ISR( woken );
+#endif /* USE_CONSOLE_SHELL */
+}
+#endif /* USE_SERIAL_TX_RING || USE_CONSOLE_SHELL */
+
+#ifdef USE_CONSOLE_SHELL
+/**
+ * @brief  Takes a character received by the console
+ * @param  timeout: Maximum time to wait for it (in RTOS ticks)
+ * @retval Character, -1 on timeout
+ */
+int DebugComPort_GetChar( portTickType timeout )
+{
+	uint8_t b;
+
+	if ( DebugRx_Queue == NULL || xQueueReceive( DebugRx_Queue, &b, timeout ) != pdTRUE )
+		return -1;
+	return b;
+}
+#endif /* USE_CONSOLE_SHELL */
+
+/**
+ * @brief  Sends characters to the console as a whole: each piece of up to half of the ring
+ *         is copied at once, the caller waits for room in the ring (whatever the overflow
+ *         policy of printf() is), so lines of bulk output aren't lost nor torn apart
+ * @param  buf: Characters
+ * @param  len: Number of characters
+ * @retval None
+ */
+void DebugComPort_Write( const char* buf, uint32_t len )
+{
+#ifdef USE_SERIAL_TX_RING
+	uint16_t head, n, i;
+
+	while ( len > 0 )
+	{
+		n = ( len < DEBUG_TX_SIZE / 2 ) ? len : DEBUG_TX_SIZE / 2;
+		taskENTER_CRITICAL();
+		if ( ( ( DebugTx_Tail - DebugTx_Head - 1 ) & ( DEBUG_TX_SIZE - 1 ) ) >= n )
+		{
+			head = DebugTx_Head;
+			for ( i = 0; i < n; ++i )
+			{
+				DebugTx_Ring[ head ] = (uint8_t)buf[ i ];
+				head = ( head + 1 ) & ( DEBUG_TX_SIZE - 1 );
+			}
+			DebugTx_Head = head;
+			USART_ITConfig( DEBUG_USART, USART_IT_TXE, ENABLE );
+			buf += n;
+			len -= n;
+			n = 0;
+		}
+		else if ( xTaskGetSchedulerState() != taskSCHEDULER_RUNNING )
+			DebugComPort_SendNext();	/* interrupts are masked before scheduler is started */
+		taskEXIT_CRITICAL();
+		if ( n != 0 && xTaskGetSchedulerState() == taskSCHEDULER_RUNNING )
+			vTaskDelay( 1 );
+	}
+#else
+	for ( ; len > 0; --len )
+	{
+		USART_SendData( DEBUG_USART, (uint8_t)*buf++ );
+		while ( USART_GetFlagStatus( DEBUG_USART, USART_FLAG_TXE ) == RESET ) {}
+	}
+	while ( USART_GetFlagStatus( DEBUG_USART, USART_FLAG_TC ) == RESET ) {}
+#endif /* USE_SERIAL_TX_RING */
+}
+
+/**
+ * @brief  Prints data as hex dump, one DebugComPort_Write per line of 16 bytes:
+ *         address, bytes in hex (nibbles through a table) and printable characters
+ * @param  data: Data
+ * @param  len: Number of bytes
+ * @param  addr: Address printed for the first byte
+ * @retval None
+ */
+void DebugComPort_HexDump( const void* data, uint32_t len, uint32_t addr )
+{
+	const uint8_t* p = (const uint8_t*)data;
+	char line[ DEBUG_HEX_LINE ];
+	char* o;
+	uint32_t n, i;
+	int8_t sh;
+
+	while ( len > 0 )
+	{
+		n = ( len < DEBUG_HEX_BYTES ) ? len : DEBUG_HEX_BYTES;
+		o = line;
+		for ( sh = 28; sh >= 0; sh -= 4 )
+			*o++ = DebugHex[ ( addr >> sh ) & 0xF ];
+		*o++ = ' ';
+		for ( i = 0; i < DEBUG_HEX_BYTES; ++i )
+		{
+			*o++ = ' ';
+			*o++ = ( i < n ) ? DebugHex[ p[ i ] >> 4 ] : ' ';
+			*o++ = ( i < n ) ? DebugHex[ p[ i ] & 0xF ] : ' ';
+		}
+		*o++ = ' ';
+		*o++ = ' ';
+		for ( i = 0; i < n; ++i )
+			*o++ = ( p[ i ] >= ' ' && p[ i ] < 0x7F ) ? (char)p[ i ] : '.';
+		*o++ = '\n';
+		DebugComPort_Write( line, o - line );
+		p += n;
+		addr += n;
+		len -= n;
+	}
 }
 
 /**
@@ -71,14 +344,462 @@ void DebugComPort_Init( void )
  */
 PUTCHAR_PROTOTYPE
 {
+#ifdef USE_SERIAL_TX_RING
+	uint16_t next;
+
+	/* critical section keeps callers and TXE interrupt apart (it is masked there) */
+	taskENTER_CRITICAL();
+	next = ( DebugTx_Head + 1 ) & ( DEBUG_TX_SIZE - 1 );
+	while ( next == DebugTx_Tail )
+	{	/* full: before scheduler is started interrupts are masked, the port is polled then */
+		if ( DEBUG_TX_POLICY == DEBUG_TX_DROP && xTaskGetSchedulerState() == taskSCHEDULER_RUNNING )
+		{
+			taskEXIT_CRITICAL();
+			return ch;
+		}
+		DebugComPort_SendNext();
+	}
+	DebugTx_Ring[ DebugTx_Head ] = (uint8_t)ch;
+	DebugTx_Head = next;
+	USART_ITConfig( DEBUG_USART, USART_IT_TXE, ENABLE );
+	taskEXIT_CRITICAL();
+#else
 	/* Place your implementation of fputc here */
 	/* e.g. write a character to the USART */
-	USART_SendData( EVAL_COM1, (uint8_t)ch );
+	USART_SendData( DEBUG_USART, (uint8_t)ch );
 
 	/* Loop until the end of transmission */
-	while ( USART_GetFlagStatus( EVAL_COM1, USART_FLAG_TC ) == RESET ) {}
+	while ( USART_GetFlagStatus( DEBUG_USART, USART_FLAG_TC ) == RESET ) {}
+#endif /* USE_SERIAL_TX_RING */
+
+	return ch;
+}
+
+#ifdef USE_TINY_PRINTF
+/**
+ * @brief  Sends output of printf(): like DebugComPort_Write, except that with DEBUG_TX_DROP
+ *         policy the characters which don't fit into the ring are lost instead of waited for
+ * @param  buf: Characters
+ * @param  len: Number of characters
+ * @retval None
+ */
+static void DebugComPort_Print( const char* buf, uint32_t len )
+{
+#if defined(USE_SERIAL_TX_RING) && DEBUG_TX_POLICY == DEBUG_TX_DROP
+	uint16_t head, n;
+
+	if ( xTaskGetSchedulerState() == taskSCHEDULER_RUNNING )
+	{
+		taskENTER_CRITICAL();
+		n = ( DebugTx_Tail - DebugTx_Head - 1 ) & ( DEBUG_TX_SIZE - 1 );
+		if ( n > len )
+			n = len;
+		head = DebugTx_Head;
+		for ( ; n > 0; --n )
+		{
+			DebugTx_Ring[ head ] = (uint8_t)*buf++;
+			head = ( head + 1 ) & ( DEBUG_TX_SIZE - 1 );
+		}
+		DebugTx_Head = head;
+		USART_ITConfig( DEBUG_USART, USART_IT_TXE, ENABLE );
+		taskEXIT_CRITICAL();
+		return;
+	}
+#endif /* USE_SERIAL_TX_RING && DEBUG_TX_DROP */
+	DebugComPort_Write( buf, len );
+}
+
+/**
+ * @brief  Sends the chunk of the formatter to the port and starts a new one
+ * @param  out: Output of the formatter
+ * @retval None
+ */
+static void DebugFmt_Flush( DebugFmt_Out* out )
+{
+	if ( out->Next != out->Buf )
+		DebugComPort_Print( out->Buf, out->Next - out->Buf );
+	out->Next = out->Buf;
+	out->Left = DEBUG_FMT_CHUNK;
+}
+
+/**
+ * @brief  Appends a character to the output
+ * @param  out: Output of the formatter
+ * @param  c: Character
+ * @retval None
+ */
+static void DebugFmt_Put( DebugFmt_Out* out, char c )
+{
+	++out->Count;
+	if ( out->Left == 0 )
+	{
+		if ( out->Buf == NULL )
+			return;		/* string is full */
+		DebugFmt_Flush( out );
+	}
+	*out->Next++ = c;
+	--out->Left;
+}
+
+/**
+ * @brief  Converts a number to digits, 32-bit divisions once the value fits
+ * @param  end: End of the digit buffer, digits are stored before it
+ * @param  v: Value
+ * @param  base: 8, 10 or 16
+ * @param  digits: Digit characters
+ * @retval First digit
+ */
+static char* DebugFmt_Digits( char* end, unsigned long long v, uint8_t base, const char* digits )
+{
+	uint32_t w;
+
+	for ( ; v > 0xFFFFFFFFUL; v /= base )
+		*--end = digits[ v % base ];
+	w = (uint32_t)v;
+	do
+	{
+		*--end = digits[ w % base ];
+		w /= base;
+	} while ( w != 0 );
+	return end;
+}
+
+/**
+ * @brief  Appends a field padded to its width: spaces, prefix, zeros, text, spaces
+ * @param  out: Output of the formatter
+ * @param  prefix: Sign or "0x"
+ * @param  s: Text
+ * @param  len: Length of the text
+ * @param  zeros: Zeros before the text (precision of a number)
+ * @param  width: Minimum width of the field
+ * @param  flags: DEBUG_FMT_LEFT, DEBUG_FMT_ZERO (pads by zeros)
+ * @retval None
+ */
+static void DebugFmt_Field( DebugFmt_Out* out, const char* prefix, const char* s, int len,
+							int zeros, int width, uint8_t flags )
+{
+	int pad = width - (int)strlen( prefix ) - zeros - len;
+
+	if ( ( flags & ( DEBUG_FMT_ZERO | DEBUG_FMT_LEFT ) ) == DEBUG_FMT_ZERO && pad > 0 )
+	{
+		zeros += pad;
+		pad = 0;
+	}
+	for ( ; !( flags & DEBUG_FMT_LEFT ) && pad > 0; --pad )
+		DebugFmt_Put( out, ' ' );
+	while ( *prefix )
+		DebugFmt_Put( out, *prefix++ );
+	for ( ; zeros > 0; --zeros )
+		DebugFmt_Put( out, '0' );
+	for ( ; len > 0; --len )
+		DebugFmt_Put( out, *s++ );
+	for ( ; pad > 0; --pad )
+		DebugFmt_Put( out, ' ' );
+}
+
+/**
+ * @brief  Formats like vprintf(): flags '-', '0', '+', ' ', '#', width and precision
+ *         (also '*'), sizes 'h', 'l', 'll', 'z', conversions d i u o x X c s p %
+ *         and with USE_TINY_PRINTF_FLOAT f (up to DEBUG_FMT_PREC digits after the point)
+ * @param  out: Output of the formatter
+ * @param  fmt: Format string
+ * @param  ap: Arguments
+ * @retval None
+ */
+static void DebugFmt_Format( DebugFmt_Out* out, const char* fmt, va_list ap )
+{
+	char num[ DEBUG_FMT_DIGITS ];
+	const char* prefix;
+	const char* s;
+	unsigned long long v;
+	long long sv;
+	int width, prec, len, zeros;
+	uint8_t flags, size, base;
+	char c;
+#ifdef USE_TINY_PRINTF_FLOAT
+	double d;
+	unsigned long long ip;
+	uint32_t fr;
+	char* p;
+	int i;
+#endif /* USE_TINY_PRINTF_FLOAT */
+
+	while ( ( c = *fmt++ ) != 0 )
+	{
+		if ( c != '%' )
+		{
+			DebugFmt_Put( out, c );
+			continue;
+		}
+		flags = 0;
+		for ( ;; )
+		{
+			c = *fmt++;
+			if ( c == '-' )
+				flags |= DEBUG_FMT_LEFT;
+			else if ( c == '0' )
+				flags |= DEBUG_FMT_ZERO;
+			else if ( c == '+' )
+				flags |= DEBUG_FMT_PLUS;
+			else if ( c == ' ' )
+				flags |= DEBUG_FMT_SPACE;
+			else if ( c == '#' )
+				flags |= DEBUG_FMT_ALT;
+			else
+				break;
+		}
+		width = 0;
+		if ( c == '*' )
+		{
+			width = va_arg( ap, int );
+			if ( width < 0 )
+			{
+				flags |= DEBUG_FMT_LEFT;
+				width = -width;
+			}
+			c = *fmt++;
+		}
+		for ( ; c >= '0' && c <= '9'; c = *fmt++ )
+			width = width * 10 + ( c - '0' );
+		prec = -1;
+		if ( c == '.' )
+		{
+			prec = 0;
+			c = *fmt++;
+			if ( c == '*' )
+			{
+				prec = va_arg( ap, int );
+				c = *fmt++;
+			}
+			for ( ; c >= '0' && c <= '9'; c = *fmt++ )
+				prec = prec * 10 + ( c - '0' );
+		}
+		size = 0;
+		for ( ; c == 'l' || c == 'h' || c == 'z'; c = *fmt++ )
+		{
+			if ( c == 'l' )
+				++size;
+		}
+		if ( c == 0 )
+			break;
+
+		prefix = ( flags & DEBUG_FMT_PLUS ) ? "+" : ( flags & DEBUG_FMT_SPACE ) ? " " : "";
+		base = 0;
+		len = -1;
+		v = 0;
+		switch ( c )
+		{
+		case 'd':
+		case 'i':
+			sv = ( size > 1 ) ? va_arg( ap, long long ) : ( size ? va_arg( ap, long ) : va_arg( ap, int ) );
+			if ( sv < 0 )
+			{
+				prefix = "-";
+				v = -(unsigned long long)sv;
+			}
+			else
+				v = (unsigned long long)sv;
+			base = 10;
+			break;
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+			v = ( size > 1 ) ? va_arg( ap, unsigned long long ) : ( size ? va_arg( ap, unsigned long ) : va_arg( ap, unsigned int ) );
+			base = ( c == 'u' ) ? 10 : ( c == 'o' ) ? 8 : 16;
+			prefix = "";
+			if ( ( flags & DEBUG_FMT_ALT ) && v != 0 && c != 'u' )
+				prefix = ( c == 'o' ) ? "0" : ( c == 'x' ) ? "0x" : "0X";
+			break;
+		case 'p':
+			v = (uint32_t)va_arg( ap, void* );
+			base = 16;
+			prefix = "0x";
+			break;
+		case 'c':
+			num[ 0 ] = (char)va_arg( ap, int );
+			s = num;
+			len = 1;
+			prefix = "";
+			flags &= ~DEBUG_FMT_ZERO;
+			break;
+		case 's':
+			s = va_arg( ap, const char* );
+			if ( s == NULL )
+				s = "(null)";
+			for ( len = 0; s[ len ] != 0 && ( prec < 0 || len < prec ); ++len ) {}
+			prefix = "";
+			flags &= ~DEBUG_FMT_ZERO;
+			break;
+#ifdef USE_TINY_PRINTF_FLOAT
+		case 'f':
+		case 'F':
+			d = va_arg( ap, double );
+			if ( d < 0 )
+			{
+				prefix = "-";
+				d = -d;
+			}
+			if ( d != d || d >= 1e19 )
+			{	/* NaN, infinity or beyond 64-bit integer part */
+				s = ( d != d ) ? "nan" : "inf";
+				len = 3;
+				flags &= ~DEBUG_FMT_ZERO;
+				break;
+			}
+			if ( prec < 0 )
+				prec = 6;
+			if ( prec > DEBUG_FMT_PREC )
+				prec = DEBUG_FMT_PREC;
+			ip = (unsigned long long)d;
+			fr = (uint32_t)( ( d - (double)ip ) * DebugFmt_Scale[ prec ] + 0.5 );
+			if ( fr >= DebugFmt_Scale[ prec ] )
+			{	/* rounded up to the next integer */
+				fr -= DebugFmt_Scale[ prec ];
+				++ip;
+			}
+			p = num + sizeof( num );
+			for ( i = 0; i < prec; ++i )
+			{
+				*--p = (char)( '0' + fr % 10 );
+				fr /= 10;
+			}
+			if ( prec > 0 || ( flags & DEBUG_FMT_ALT ) )
+				*--p = '.';
+			s = DebugFmt_Digits( p, ip, 10, DebugHex );
+			len = num + sizeof( num ) - s;
+			break;
+#endif /* USE_TINY_PRINTF_FLOAT */
+		case '%':
+			DebugFmt_Put( out, '%' );
+			break;
+		default:	/* unknown conversion is printed as it is */
+			DebugFmt_Put( out, '%' );
+			DebugFmt_Put( out, c );
+			break;
+		}
+
+		if ( base != 0 )
+		{
+			s = DebugFmt_Digits( num + sizeof( num ), v, base, ( c == 'X' ) ? DebugHex : DebugHexLower );
+			len = num + sizeof( num ) - s;
+			zeros = 0;
+			if ( prec >= 0 )
+			{	/* precision is the minimum number of digits, '0' flag is ignored then */
+				flags &= ~DEBUG_FMT_ZERO;
+				if ( prec > len )
+					zeros = prec - len;
+			}
+			DebugFmt_Field( out, prefix, s, len, zeros, width, flags );
+		}
+		else if ( len >= 0 )
+			DebugFmt_Field( out, prefix, s, len, 0, width, flags );
+	}
+}
+
+/**
+ * @brief  printf() is formatted in chunks on the stack of the caller,
+ *         each chunk goes to the port at once
+ * @param  fmt: Format string (see DebugFmt_Format)
+ * @param  ap: Arguments
+ * @retval Number of characters
+ */
+int vprintf( const char* fmt, va_list ap )
+{
+	char buf[ DEBUG_FMT_CHUNK ];
+	DebugFmt_Out out;
+
+	out.Buf = out.Next = buf;
+	out.Left = DEBUG_FMT_CHUNK;
+	out.Count = 0;
+	DebugFmt_Format( &out, fmt, ap );
+	DebugFmt_Flush( &out );
+	return out.Count;
+}
+
+int printf( const char* fmt, ... )
+{
+	va_list ap;
+	int n;
+
+	va_start( ap, fmt );
+	n = vprintf( fmt, ap );
+	va_end( ap );
+	return n;
+}
+
+/**
+ * @brief  Formats into a string of up to size - 1 characters and the terminating zero
+ * @param  str: Destination
+ * @param  size: Size of the destination, nothing is stored if it is 0
+ * @param  fmt: Format string (see DebugFmt_Format)
+ * @param  ap: Arguments
+ * @retval Length of the whole output (also the part which didn't fit)
+ */
+int vsnprintf( char* str, size_t size, const char* fmt, va_list ap )
+{
+	DebugFmt_Out out;
+
+	out.Buf = NULL;
+	out.Next = str;
+	out.Left = ( size > 0 ) ? size - 1 : 0;
+	out.Count = 0;
+	DebugFmt_Format( &out, fmt, ap );
+	if ( size > 0 )
+		*out.Next = 0;
+	return out.Count;
+}
+
+int snprintf( char* str, size_t size, const char* fmt, ... )
+{
+	va_list ap;
+	int n;
+
+	va_start( ap, fmt );
+	n = vsnprintf( str, size, fmt, ap );
+	va_end( ap );
+	return n;
+}
+
+int sprintf( char* str, const char* fmt, ... )
+{
+	va_list ap;
+	int n;
+
+	va_start( ap, fmt );
+	n = vsnprintf( str, ~(size_t)0, fmt, ap );
+	va_end( ap );
+	return n;
+}
+
+/**
+ * @brief  The compiler turns printf() of plain strings and characters into these
+ */
+int puts( const char* s )
+{
+	uint32_t len = strlen( s );
+	char buf[ DEBUG_FMT_CHUNK ];
+
+	while ( len >= DEBUG_FMT_CHUNK )
+	{	/* the newline goes with the last piece */
+		DebugComPort_Print( s, DEBUG_FMT_CHUNK );
+		s += DEBUG_FMT_CHUNK;
+		len -= DEBUG_FMT_CHUNK;
+	}
+	memcpy( buf, s, len );
+	buf[ len ] = '\n';
+	DebugComPort_Print( buf, len + 1 );
+	return 1;
+}
+
+#undef putchar
+int putchar( int ch )
+{
+	char c = (char)ch;
 
+	DebugComPort_Print( &c, 1 );
 	return ch;
 }
+#endif /* USE_TINY_PRINTF */
 
 #endif /* SERIAL_DEBUG */
@@ -18,11 +18,66 @@
 
 /* Exported types ------------------------------------------------------------*/
 /* Exported constants --------------------------------------------------------*/
+
+/* Trace levels (TRACE_LEVEL is set in main.h) */
+#define TRACE_LEVEL_OFF			0	/* no output at all */
+#define TRACE_LEVEL_ERROR		1	/* failures only */
+#define TRACE_LEVEL_INFO		2	/* + rare events (card detection, initialization, etc.) */
+#define TRACE_LEVEL_VERBOSE		3	/* + every I/O request (slows I/O down a lot!) */
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL				TRACE_LEVEL_ERROR
+#endif /* TRACE_LEVEL */
+
 /* Exported macro ------------------------------------------------------------*/
+
+/* Leveled tracing: calls compile to nothing if their level is above TRACE_LEVEL
+ * or if printf() isn't retargeted to COM port */
+#if defined(SERIAL_DEBUG) && TRACE_LEVEL > TRACE_LEVEL_OFF
+#include <stdio.h>
+#define TRACE_PRINTF( ... )		printf( __VA_ARGS__ )
+#else
+#define TRACE_PRINTF( ... )		do {} while ( 0 )
+#endif /* SERIAL_DEBUG && TRACE_LEVEL */
+
+#if TRACE_LEVEL >= TRACE_LEVEL_ERROR
+#define TRACE_ERROR( ... )		TRACE_PRINTF( __VA_ARGS__ )
+#else
+#define TRACE_ERROR( ... )		do {} while ( 0 )
+#endif /* TRACE_LEVEL_ERROR */
+
+#if TRACE_LEVEL >= TRACE_LEVEL_INFO
+#define TRACE_INFO( ... )		TRACE_PRINTF( __VA_ARGS__ )
+#else
+#define TRACE_INFO( ... )		do {} while ( 0 )
+#endif /* TRACE_LEVEL_INFO */
+
+#if TRACE_LEVEL >= TRACE_LEVEL_VERBOSE
+#define TRACE_VERBOSE( ... )	TRACE_PRINTF( __VA_ARGS__ )
+#else
+#define TRACE_VERBOSE( ... )	do {} while ( 0 )
+#endif /* TRACE_LEVEL_VERBOSE */
+
 /* Exported functions ------------------------------------------------------- */
 
 #ifdef SERIAL_DEBUG
+#include "stm32f2xx.h"
+
+#ifdef USE_CONSOLE_SHELL
+/* Scheduler */
+#include "FreeRTOS.h"
+#endif /* USE_CONSOLE_SHELL */
+
 void DebugComPort_Init( void );
+ErrorStatus DebugComPort_SetBaudRate( uint32_t baudRate );
+void DebugComPort_Write( const char* buf, uint32_t len );
+void DebugComPort_HexDump( const void* data, uint32_t len, uint32_t addr );
+#if defined(USE_SERIAL_TX_RING) || defined(USE_CONSOLE_SHELL)
+void DebugComPort_IRQHandler( void );
+#endif /* USE_SERIAL_TX_RING || USE_CONSOLE_SHELL */
+#ifdef USE_CONSOLE_SHELL
+int DebugComPort_GetChar( portTickType timeout );
+#endif /* USE_CONSOLE_SHELL */
 #endif /* SERIAL_DEBUG */
 
 #endif /* SERIAL_DEBUG_H */
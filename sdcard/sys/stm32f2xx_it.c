@@ -16,6 +16,19 @@
 #include "stm32f2xx_it.h"
 
 #include "stm32_buttons.h"
+#include "stm32_spi.h"
+#include "stm32_sd_sdio.h"
+#include "stm32_sd_io.h"
+#include "stm32_calendar.h"
+#include "stm32_camera.h"
+#include "stm32_sampler.h"
+#include "stm32_usb.h"
+#include "stm32_eth.h"
+#include "serial_debug.h"
+#include "power_fail.h"
+#include "ffserv.h"
+#include "tasks_misc.h"
+#include "rtos_bench.h"
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
@@ -127,8 +140,6 @@ void SysTick_Handler( void )
 /*  file (startup_stm32f2xx.S).                                               */
 /******************************************************************************/
 
-uint8_t PB_Touch_flag;
-
 void EXTI0_IRQHandler( void )
 {
 }
@@ -142,23 +153,31 @@ void EXTI15_10_IRQHandler( void )
 {
 	if ( EXTI_GetITStatus( WAKEUP_BUTTON_EXTI_LINE ) != RESET )		// PC10
 	{
-		PB_Touch_flag |= 0x1;
+		HandleButtons_Signal( 0x1 );
 		/* Clear the interrupt flags */
 		EXTI_ClearITPendingBit( WAKEUP_BUTTON_EXTI_LINE );
 	}
 	if ( EXTI_GetITStatus( RIGHT_BUTTON_EXTI_LINE ) != RESET )		// PD13
 	{
-		PB_Touch_flag |= (0x1 << 3);
+		HandleButtons_Signal( 0x1 << 3 );
 		/* Clear the interrupt flags */
 		EXTI_ClearITPendingBit( RIGHT_BUTTON_EXTI_LINE );
 	}
+#ifdef USE_SD_DETECT_EXTI
+	if ( EXTI_GetITStatus( SD_DETECT_EXTI_LINE ) != RESET )			// PB12
+	{
+		SD_IO_DetectIRQHandler();
+		/* Clear the interrupt flags */
+		EXTI_ClearITPendingBit( SD_DETECT_EXTI_LINE );
+	}
+#endif /* USE_SD_DETECT_EXTI */
 }
 
 void EXTI3_IRQHandler( void )
 {
 	if ( EXTI_GetITStatus( TAMPER_BUTTON_EXTI_LINE ) != RESET )		// PD3
 	{
-		PB_Touch_flag |= (0x1 << 1);
+		HandleButtons_Signal( 0x1 << 1 );
 		/* Clear the interrupt flags */
 		EXTI_ClearITPendingBit( TAMPER_BUTTON_EXTI_LINE );
 	}
@@ -168,20 +187,194 @@ void EXTI9_5_IRQHandler( void )
 {
 	if ( EXTI_GetITStatus( KEY_BUTTON_EXTI_LINE ) != RESET )		// PD6
 	{
-		PB_Touch_flag |= (0x1 << 2);
+		HandleButtons_Signal( 0x1 << 2 );
 		/* Clear the interrupt flags */
 		EXTI_ClearITPendingBit( KEY_BUTTON_EXTI_LINE );
 	}
 #ifdef USE_TOUCHSCREEN
 	if ( EXTI_GetITStatus( TOUCH_PEN_EXTI_LINE ) != RESET )			// Touch screen
 	{
-		PB_Touch_flag |= (0x1 << 4);
+		HandleButtons_Signal( 0x1 << 4 );
 		/* Clear the interrupt flags */
 		EXTI_ClearITPendingBit( TOUCH_PEN_EXTI_LINE );
 	}
 #endif /* USE_TOUCHSCREEN */
 }
 
+#ifdef USE_SPI_DMA
+/**
+ * @brief  This function handles SPI RX DMA stream interrupt request.
+ * @param  None
+ * @retval None
+ */
+void SPIx_SPI_DMA_RX_IRQHandler( void )
+{
+	STM_EVAL_SPI_DMA_IRQHandler( &SPIx_Bus );
+}
+
+#ifdef USE_SD_CARD2
+/**
+ * @brief  This function handles RX DMA stream interrupt request of the second SPI bus.
+ * @param  None
+ * @retval None
+ */
+void SPIy_SPI_DMA_RX_IRQHandler( void )
+{
+	STM_EVAL_SPI_DMA_IRQHandler( &SPIy_Bus );
+}
+#endif /* USE_SD_CARD2 */
+#endif /* USE_SPI_DMA */
+
+#ifdef USE_SD_SDIO
+/**
+ * @brief  This function handles SDIO interrupt request.
+ * @param  None
+ * @retval None
+ */
+void SDIO_IRQHandler( void )
+{
+	SD_SDIO_IRQHandler();
+}
+#endif /* USE_SD_SDIO */
+
+#ifdef USE_RTC_CALENDAR
+/**
+ * @brief  This function handles RTC wakeup interrupt request (EXTI line 22).
+ * @param  None
+ * @retval None
+ */
+void RTC_WKUP_IRQHandler( void )
+{
+	CALENDAR_IRQHandler();
+}
+#endif /* USE_RTC_CALENDAR */
+
+#ifdef USE_CAMERA_RECORD
+/**
+ * @brief  This function handles DCMI interrupt request.
+ * @param  None
+ * @retval None
+ */
+void DCMI_IRQHandler( void )
+{
+	CAMERA_IRQHandler();
+}
+
+/**
+ * @brief  This function handles DCMI DMA stream interrupt request.
+ * @param  None
+ * @retval None
+ */
+void CAMERA_DMA_STREAM_IRQHandler( void )
+{
+	CAMERA_DMA_IRQHandler();
+}
+#endif /* USE_CAMERA_RECORD */
+
+#ifdef USE_ADC_LOGGER
+/**
+ * @brief  This function handles ADC1, ADC2 and ADC3 interrupt request.
+ * @param  None
+ * @retval None
+ */
+void ADC_IRQHandler( void )
+{
+	SAMPLER_IRQHandler();
+}
+
+/**
+ * @brief  This function handles ADC3 DMA stream interrupt request.
+ * @param  None
+ * @retval None
+ */
+void SAMPLER_DMA_STREAM_IRQHandler( void )
+{
+	SAMPLER_DMA_IRQHandler();
+}
+#endif /* USE_ADC_LOGGER */
+
+#ifdef USE_POWER_FAIL
+/**
+ * @brief  This function handles PVD through EXTI line 16 interrupt request.
+ * @param  None
+ * @retval None
+ */
+void PVD_IRQHandler( void )
+{
+	PowerFail_IRQHandler();
+}
+#endif /* USE_POWER_FAIL */
+
+#ifdef USE_USB_MSC
+/**
+ * @brief  This function handles USB On The Go FS interrupt request.
+ * @param  None
+ * @retval None
+ */
+void OTG_FS_IRQHandler( void )
+{
+	USB_IRQHandler();
+}
+#endif /* USE_USB_MSC */
+
+#if defined(SERIAL_DEBUG) && ( defined(USE_SERIAL_TX_RING) || defined(USE_CONSOLE_SHELL) )
+/**
+ * @brief  This function handles interrupt request of the console COM port.
+ * @param  None
+ * @retval None
+ */
+#if SERIAL_DEBUG_PORT == 2
+void EVAL_COM2_IRQHandler( void )
+#else
+void EVAL_COM1_IRQHandler( void )
+#endif /* SERIAL_DEBUG_PORT */
+{
+	DebugComPort_IRQHandler();
+}
+#endif /* SERIAL_DEBUG && ( USE_SERIAL_TX_RING || USE_CONSOLE_SHELL ) */
+
+#ifdef USE_FILE_SERVICE
+/**
+ * @brief  This function handles interrupt request of the file service COM port.
+ * @param  None
+ * @retval None
+ */
+#if FILE_SERVICE_PORT == 2
+void EVAL_COM2_IRQHandler( void )
+#else
+void EVAL_COM1_IRQHandler( void )
+#endif /* FILE_SERVICE_PORT */
+{
+	FSERV_IRQHandler();
+}
+
+/**
+ * @brief  This function handles TX DMA stream interrupt request of the file service COM port.
+ * @param  None
+ * @retval None
+ */
+#if FILE_SERVICE_PORT == 2
+void EVAL_COM2_DMA_TX_IRQHandler( void )
+#else
+void EVAL_COM1_DMA_TX_IRQHandler( void )
+#endif /* FILE_SERVICE_PORT */
+{
+	FSERV_DMA_IRQHandler();
+}
+#endif /* USE_FILE_SERVICE */
+
+#ifdef USE_RTOS_BENCH
+/**
+ * @brief  This function handles HASH and RNG interrupt request: software interrupt of the kernel benchmark.
+ * @param  None
+ * @retval None
+ */
+void HASH_RNG_IRQHandler( void )
+{
+	RTOSBench_IRQHandler();
+}
+#endif /* USE_RTOS_BENCH */
+
 ///**
 // * @brief  This function handles PPP interrupt request.
 // * @param  None
@@ -198,4 +391,7 @@ void EXTI9_5_IRQHandler( void )
  */
 void ETH_IRQHandler( void )
 {
+#ifdef USE_NET_FILE_SERVICE
+	EMAC_IRQHandler();
+#endif /* USE_NET_FILE_SERVICE */
 }
@@ -24,16 +24,6 @@ extern "C" {
 /* Exported macro ------------------------------------------------------------*/
 /* Exported functions ------------------------------------------------------- */
 
-/**
- * Bitmask with flags for buttons pressed and touchscreen
- * Bit 0 - BTN1
- * Bit 1 - BTN2
- * Bit 2 - BTN3
- * Bit 3 - BTN4
- * Bit 4 - Touch screen
- */
-extern uint8_t PB_Touch_flag;
-
 void NMI_Handler( void );
 void HardFault_Handler( void );
 void MemManage_Handler( void );
@@ -0,0 +1,140 @@
+/**
+ ******************************************************************************
+ * @file    task_stats.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Run time statistics of tasks and their stack high-water marks
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "task_stats.h"
+
+#ifdef USE_TASK_STATS
+
+#include "stm32f2xx.h"
+#include "stm32f2xx_rcc.h"
+#include "stm32f2xx_tim.h"
+#include "stm32_pool.h"
+
+/* Scheduler */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <stdio.h>
+
+#if configGENERATE_RUN_TIME_STATS != 1 || configUSE_TRACE_FACILITY != 1
+#error USE_TASK_STATS needs configGENERATE_RUN_TIME_STATS and configUSE_TRACE_FACILITY (see FreeRTOSConfig.h)
+#endif
+
+/* Private typedef -----------------------------------------------------------*/
+/* Private define ------------------------------------------------------------*/
+
+/* Longest line of vTaskList / vTaskGetRunTimeStats: name, tabs, numbers and CR LF */
+#define TASK_STATS_LINE			( configMAX_TASK_NAME_LEN + 32 )
+
+/* Fill of the main stack, the bytes still holding it were never used */
+#define TASK_STATS_STACK_FILL	0xA5
+
+/* Bytes left around the SP of TaskStats_PaintMainStack for its own frame */
+#define TASK_STATS_STACK_GAP	32
+
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+
+/* Main stack, _Min_Stack_Size below _estack (stm32_flash.ld) */
+extern uint8_t _espare[], _estack[];
+/* Private function prototypes -----------------------------------------------*/
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Fills the unused part of the main stack, call at the start of main(): the
+ *         depth reached by main() and interrupt handlers is reported by TaskStats_Print
+ * @param  None
+ * @retval None
+ */
+void TaskStats_PaintMainStack( void )
+{
+	uint8_t* p = _espare;
+	uint8_t* sp = (uint8_t*)__get_MSP() - TASK_STATS_STACK_GAP;
+
+	while ( p < sp )
+		*p++ = TASK_STATS_STACK_FILL;
+}
+
+/**
+ * @brief  Starts TIM2 counting at TASK_STATS_HZ, called by the scheduler when it starts
+ * @param  None
+ * @retval None
+ */
+void TaskStats_TimerInit( void )
+{
+	TIM_TimeBaseInitTypeDef tb;
+	RCC_ClocksTypeDef clocks;
+	uint32_t clk;
+
+	/* timers of APB1 run at twice PCLK1 when APB1 is divided */
+	RCC_GetClocksFreq( &clocks );
+	clk = clocks.PCLK1_Frequency;
+	if ( clocks.HCLK_Frequency != clocks.PCLK1_Frequency )
+		clk *= 2;
+
+	RCC_APB1PeriphClockCmd( RCC_APB1Periph_TIM2, ENABLE );
+	TIM_TimeBaseStructInit( &tb );
+	tb.TIM_Prescaler = clk / TASK_STATS_HZ - 1;
+	tb.TIM_Period = 0xFFFFFFFF;
+	tb.TIM_CounterMode = TIM_CounterMode_Up;
+	TIM_TimeBaseInit( TIM2, &tb );
+	TIM_Cmd( TIM2, ENABLE );
+}
+
+/**
+ * @brief  Run time counter read by the scheduler on context switches
+ * @param  None
+ * @retval Counts of TASK_STATS_HZ since the scheduler started
+ */
+uint32_t TaskStats_Counter( void )
+{
+	return TIM2->CNT;
+}
+
+/**
+ * @brief  Prints the depth reached on the main stack, state, priority and free stack
+ *         (words never used) of each task, then CPU time of each task (the idle task
+ *         has the time left), the text is made in a sector buffer of the pool
+ * @param  None
+ * @retval None
+ */
+void TaskStats_Print( void )
+{
+	signed char* buf;
+	uint8_t* p = _espare;
+
+	while ( p < _estack && *p == TASK_STATS_STACK_FILL )
+		++p;
+	printf( "Main stack : %u of %u bytes used\n", (unsigned)( _estack - p ), (unsigned)( _estack - _espare ) );
+
+	if ( ( uxTaskGetNumberOfTasks() + 1 ) * TASK_STATS_LINE > POOL_BLOCK_SIZE )
+	{
+		printf( "Too many tasks for task statistics\n" );
+		return;
+	}
+	buf = POOL_Alloc();
+	if ( buf == NULL )
+	{
+		printf( "No buffer for task statistics\n" );
+		return;
+	}
+
+	vTaskList( buf );
+	printf( "Task\t\tState\tPrio\tStack\tNum%s", (char*)buf );
+	vTaskGetRunTimeStats( buf );
+	printf( "Task\t\tTime (1/%u s)\tCPU%s", TASK_STATS_HZ, (char*)buf );
+
+	POOL_Free( buf );
+}
+
+#endif /* USE_TASK_STATS */
@@ -0,0 +1,50 @@
+/**
+ ******************************************************************************
+ * @file    task_stats.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Run time statistics of tasks: TIM2 is a free running 32-bit counter
+ *          of TASK_STATS_HZ which the scheduler reads on each context switch
+ *          to charge the time to the task switched out (it is 10 times finer
+ *          than the tick, so short bursts of a task between ticks are seen).
+ *          TaskStats_Print shows CPU time per task and the stack high-water mark
+ *          (words never used) of each task for sizing the stacks, and the depth
+ *          reached on the main stack by main() and interrupt handlers.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef TASK_STATS_H
+#define TASK_STATS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include <stdint.h>
+
+/* Exported types ------------------------------------------------------------*/
+/* Exported constants --------------------------------------------------------*/
+
+/* Counter frequency: the 32-bit counter wraps after 119 hours, percentages are wrong after that */
+#define TASK_STATS_HZ		10000
+
+/* Exported macro ------------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+
+#ifdef USE_TASK_STATS
+void TaskStats_PaintMainStack( void );
+void TaskStats_TimerInit( void );
+uint32_t TaskStats_Counter( void );
+void TaskStats_Print( void );
+#endif /* USE_TASK_STATS */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TASK_STATS_H */
@@ -0,0 +1,76 @@
+/**
+ ******************************************************************************
+ * @file    watchdog.c
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Independent watchdog: start and the reset cause
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "watchdog.h"
+
+#ifdef USE_WATCHDOG
+
+/* Private typedef -----------------------------------------------------------*/
+/* Private define ------------------------------------------------------------*/
+
+/* LSI / 64: one count is 2 ms at 32 kHz */
+#define WATCHDOG_COUNT_MS		2
+
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+
+static uint8_t Watchdog_Reset;		/* Last reset was caused by the watchdog */
+
+/* Private function prototypes -----------------------------------------------*/
+/* Private functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Starts the watchdog (it can't be stopped until reset), remembers
+ *         whether it caused the last reset and clears reset flags
+ * @param  None
+ * @retval None
+ */
+void Watchdog_Init( void )
+{
+	Watchdog_Reset = ( RCC_GetFlagStatus( RCC_FLAG_IWDGRST ) != RESET );
+	RCC_ClearFlag();
+
+	/* counter stops while the core is halted by debugger */
+	DBGMCU_APB1PeriphConfig( DBGMCU_IWDG_STOP, ENABLE );
+
+	IWDG_WriteAccessCmd( IWDG_WriteAccess_Enable );
+	IWDG_SetPrescaler( IWDG_Prescaler_64 );
+	IWDG_SetReload( WATCHDOG_TIMEOUT_MS / WATCHDOG_COUNT_MS );
+	IWDG_ReloadCounter();
+	IWDG_Enable();		/* LSI is started by hardware */
+}
+
+/**
+ * @brief  Tells whether the last reset was caused by the watchdog
+ * @param  None
+ * @retval Nonzero after watchdog reset
+ */
+uint8_t Watchdog_CausedReset( void )
+{
+	return Watchdog_Reset;
+}
+
+#ifndef USE_LOW_POWER_IDLE
+/**
+ * @brief  Idle hook of the scheduler: all tasks have given the CPU away, kicks the watchdog
+ *         (with USE_LOW_POWER_IDLE it is kicked by the hook in sys/power.c)
+ * @param  None
+ * @retval None
+ */
+void vApplicationIdleHook( void )
+{
+	Watchdog_Kick();
+}
+#endif /* USE_LOW_POWER_IDLE */
+
+#endif /* USE_WATCHDOG */
@@ -0,0 +1,68 @@
+/**
+ ******************************************************************************
+ * @file    watchdog.h
+ * @author  Alexei Troussov
+ * @version V1.0
+ * @brief   Independent watchdog (IWDG). The idle hook kicks it, so it resets
+ *          the board when tasks keep the CPU busy or the system hangs for
+ *          longer than WATCHDOG_TIMEOUT_MS. Long storage operations (BUSY of
+ *          card erase, erase of large ranges, FAT scan of f_getfree) kick it
+ *          too while they make progress, so they proceed at full speed with
+ *          the watchdog running; each of their waits is bounded by its own
+ *          timeout, so a card which never finishes still resets the board.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+
+#include "main.h"
+
+#include "stm32f2xx.h"
+
+/* Exported types ------------------------------------------------------------*/
+/* Exported constants --------------------------------------------------------*/
+
+/* Reset after this time without a kick (up to 8190 ms), at nominal LSI frequency of 32 kHz:
+   LSI runs from 17 to 47 kHz, so the actual time is 0.68 .. 1.88 of it */
+#ifndef WATCHDOG_TIMEOUT_MS
+#define WATCHDOG_TIMEOUT_MS		2000
+#endif /* WATCHDOG_TIMEOUT_MS */
+
+/* Exported macro ------------------------------------------------------------*/
+
+#ifdef USE_WATCHDOG
+#define WATCHDOG_KICK()		Watchdog_Kick()
+#else
+#define WATCHDOG_KICK()		do {} while ( 0 )
+#endif /* USE_WATCHDOG */
+
+/* Exported functions ------------------------------------------------------- */
+
+#ifdef USE_WATCHDOG
+void Watchdog_Init( void );
+uint8_t Watchdog_CausedReset( void );
+
+/**
+ * @brief  Reloads the watchdog counter (callable from interrupt handlers)
+ * @param  None
+ * @retval None
+ */
+static __INLINE void Watchdog_Kick( void )
+{
+	IWDG->KR = 0xAAAA;
+}
+#endif /* USE_WATCHDOG */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WATCHDOG_H */
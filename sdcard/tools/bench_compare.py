@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+"""Comparison of two SD Card benchmark runs (src/sd_bench.c).
+
+Inputs are serial logs of the benchmark of two builds, e.g. before and after
+USE_FAST_IO_CODE or USE_RAM_FUNC of src/main.h. The PROFILE, VERIFY and BENCH
+lines are taken from them, other lines are ignored. Output is a table: the
+value of each run and the change in percent (positive is better: higher
+throughput, fewer cycles, lower latency).
+
+    tools/bench_compare.py before.log after.log
+    tools/bench_compare.py --latency before.log after.log
+"""
+
+import argparse
+import sys
+
+
+def parse(path):
+    """Returns profile, verify and test results of the log: {key: {column: value}}."""
+    runs = {}
+    with open(path, errors="replace") as f:
+        for line in f:
+            fields = line.strip().split(",")
+            try:
+                if fields[0] == "PROFILE" and len(fields) == 5:
+                    runs["profile"] = {"fast": int(fields[1]), "ram": int(fields[2]),
+                                       "cycles": int(fields[3]), "bus": int(fields[4])}
+                elif fields[0] == "VERIFY" and len(fields) == 6:
+                    runs["verify"] = {"write": int(fields[2]), "read": int(fields[3]), "verify": int(fields[4])}
+                elif fields[0] == "BENCH" and len(fields) == 12:
+                    key = " ".join(fields[1:4]) + " %3s" % fields[4]
+                    runs[key] = {"kbps": int(fields[6]), "iops": int(fields[7]), "p50": int(fields[8]),
+                                 "p99": int(fields[10])}
+            except ValueError:
+                continue		# line broken by other output
+    return runs
+
+
+def change(old, new, lower_better):
+    if old == 0:
+        return "     -"
+    pct = (new - old) * 100.0 / old
+    return "%+6.1f" % (-pct if lower_better else pct)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("before")
+    ap.add_argument("after")
+    ap.add_argument("--latency", action="store_true", help="compare p50 and p99 latencies instead of throughput")
+    args = ap.parse_args()
+
+    a = parse(args.before)
+    b = parse(args.after)
+    if not a or not b:
+        print("no benchmark lines in %s" % (args.before if not a else args.after), file=sys.stderr)
+        return 1
+
+    if "profile" in a and "profile" in b:
+        pa, pb = a["profile"], b["profile"]
+        print("code profile    fast I/O %d -> %d, RAM functions %d -> %d" % (pa["fast"], pb["fast"], pa["ram"], pb["ram"]))
+        print("polled block    %8d %8d cycles %s%%  (bus %d cycles)" % (pa["cycles"], pb["cycles"],
+              change(pa["cycles"], pb["cycles"], True), pb["bus"]))
+    if "verify" in a and "verify" in b:
+        for col in ("write", "read", "verify"):
+            print("loopback %-6s %8d %8d KB/s   %s%%" % (col, a["verify"][col], b["verify"][col],
+                  change(a["verify"][col], b["verify"][col], False)))
+
+    cols = ("p50", "p99") if args.latency else ("kbps", "iops")
+    print("test            " + "".join("%9s %9s %7s" % (c + " 1", c + " 2", "%") for c in cols))
+    for key in a:
+        if key in ("profile", "verify") or key not in b:
+            continue
+        print("%-15s " % key + "".join("%9d %9d %7s" % (a[key][c], b[key][c], change(a[key][c], b[key][c], args.latency))
+                                      for c in cols))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
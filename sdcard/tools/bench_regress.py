@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+"""Regression check of SD Card benchmark runs against baselines of each card.
+
+Runs come from serial logs of the benchmark (src/sd_bench.c), or with --port
+the benchmark is started by the "bench" command of the console shell
+(USE_CONSOLE_SHELL, USE_SD_BENCH) on each fixture and its output is read
+until the DONE line (needs pyserial). The card of a run is identified by the
+CID of its CARD line, or of the "C," line of CSV metrics (sys/metrics.h) if
+the log has no CARD line. With --runs the suite is repeated and the median
+of each value is taken.
+
+Each test is compared with the baseline of the card: throughput (KB/s,
+IOPS) lower by more than --threshold percent, or latency (p50, p90, p99)
+higher by more than --latency-threshold percent is a regression (the change
+is printed positive when it is better, as by tools/bench_compare.py). Exit status
+is 1 if a run failed or regressed, so the check can gate a change. --update
+stores the runs as the new baselines of their cards (only complete runs).
+
+    tools/bench_regress.py card1.log card2.log
+    tools/bench_regress.py -p /dev/ttyUSB0 -p /dev/ttyUSB1 --runs 3
+    tools/bench_regress.py --update -p /dev/ttyUSB0 --runs 5
+"""
+
+import argparse
+import json
+import statistics
+import sys
+import time
+
+THROUGHPUT = ("kbps", "iops")
+LATENCY = ("p50", "p90", "p99")
+
+
+def parse(lines):
+    """Returns the run of the log: {"cid", "capacity_kb", "speed_class", "done", "tests": {key: {column: value}}}."""
+    run = {"cid": None, "capacity_kb": 0, "speed_class": 0, "done": None, "tests": {}}
+    for line in lines:
+        fields = line.strip().split(",")
+        try:
+            if fields[0] == "CARD" and len(fields) == 4 and len(fields[1]) == 32:
+                run["cid"] = fields[1].upper()
+                run["capacity_kb"] = int(fields[2])
+                run["speed_class"] = int(fields[3])
+            elif fields[0] == "C" and len(fields) == 6 and len(fields[5]) == 32 and run["cid"] is None:
+                run["cid"] = fields[5].upper()
+                run["capacity_kb"] = int(fields[4])
+            elif fields[0] == "VERIFY" and len(fields) == 6:
+                run["tests"]["loopback"] = {"write": int(fields[2]), "read": int(fields[3]), "verify": int(fields[4])}
+            elif fields[0] == "BENCH" and len(fields) == 12:
+                key = " ".join(fields[1:4]) + " %3s" % fields[4]
+                run["tests"][key] = {"kbps": int(fields[6]), "iops": int(fields[7]), "p50": int(fields[8]),
+                                     "p90": int(fields[9]), "p99": int(fields[10])}
+            elif fields[0] == "DONE" and len(fields) == 2:
+                run["done"] = fields[1] == "1"
+        except ValueError:
+            continue		# line broken by other output
+    return run
+
+
+def capture(port, baud, timeout):
+    """Starts the benchmark by the console shell and returns its output lines up to DONE."""
+    import serial
+
+    lines = []
+    with serial.Serial(port, baud, timeout=0.5) as com:
+        com.reset_input_buffer()
+        com.write(b"bench\r")
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            line = com.readline().decode("ascii", errors="replace")
+            if line:
+                lines.append(line)
+                if line.startswith("DONE,"):
+                    break
+    return lines
+
+
+def median(runs):
+    """Merges repeated runs of one card: the median of each value, done if each run is done."""
+    merged = dict(runs[0])
+    merged["done"] = all(r["done"] for r in runs)
+    merged["tests"] = {}
+    for key in runs[0]["tests"]:
+        if all(key in r["tests"] for r in runs):
+            cols = runs[0]["tests"][key]
+            merged["tests"][key] = {c: int(statistics.median(r["tests"][key][c] for r in runs)) for c in cols}
+    return merged
+
+
+def compare(run, base, threshold, latency_threshold):
+    """Prints the table of the card, returns the number of regressions."""
+    bad = 0
+    print("card %s  %d KB  class %d" % (run["cid"], run["capacity_kb"], run["speed_class"]))
+    print("  %-15s %-6s %9s %9s %7s" % ("test", "value", "baseline", "now", "%"))
+    for key, cols in run["tests"].items():
+        if key not in base["tests"]:
+            print("  %-15s no baseline" % key)
+            continue
+        for col, now in cols.items():
+            old = base["tests"][key].get(col)
+            if not old:
+                continue
+            lower_better = col in LATENCY
+            pct = (now - old) * 100.0 / old
+            worse = pct > latency_threshold if lower_better else -pct > threshold
+            flag = "  REGRESSION" if worse else ""
+            bad += worse
+            print("  %-15s %-6s %9d %9d %+7.1f%s" % (key, col, old, now, (-pct if lower_better else pct) + 0.0, flag))
+    for key in base["tests"]:
+        if key not in run["tests"]:
+            print("  %-15s missing in the run  REGRESSION" % key)
+            bad += 1
+    return bad
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("logs", nargs="*", help="serial logs of benchmark runs")
+    ap.add_argument("-p", "--port", action="append", default=[], help="COM port of a fixture (repeat for each one)")
+    ap.add_argument("-b", "--baud", type=int, default=115200)
+    ap.add_argument("--timeout", type=float, default=600.0, help="seconds a benchmark run may take")
+    ap.add_argument("--runs", type=int, default=1, help="runs of each fixture, the median is compared")
+    ap.add_argument("--baselines", default="bench_baselines.json", help="baselines of the cards (JSON)")
+    ap.add_argument("--threshold", type=float, default=10.0, help="throughput drop flagged, percent")
+    ap.add_argument("--latency-threshold", type=float, default=25.0, help="latency rise flagged, percent")
+    ap.add_argument("--update", action="store_true", help="store the runs as baselines of their cards")
+    args = ap.parse_args()
+
+    if not args.logs and not args.port:
+        ap.error("give logs or --port")
+    sources = []
+    for path in args.logs:
+        with open(path, errors="replace") as f:
+            sources.append((path, [parse(f)]))
+    for port in args.port:
+        sources.append((port, [parse(capture(port, args.baud, args.timeout)) for _ in range(args.runs)]))
+
+    try:
+        with open(args.baselines) as f:
+            baselines = json.load(f)
+    except FileNotFoundError:
+        baselines = {}
+
+    failed = 0
+    for name, runs in sources:
+        cids = set(r["cid"] for r in runs)
+        if None in cids or len(cids) != 1:
+            print("%s: no card identity or the card changed between runs" % name)
+            failed += 1
+            continue
+        run = median(runs)
+        if not run["done"] or not run["tests"]:
+            print("%s: benchmark of card %s did not complete" % (name, run["cid"]))
+            failed += 1
+            continue
+        if args.update:
+            baselines[run["cid"]] = {k: run[k] for k in ("capacity_kb", "speed_class", "tests")}
+            print("%s: baseline of card %s stored (%d tests)" % (name, run["cid"], len(run["tests"])))
+        elif run["cid"] not in baselines:
+            print("%s: card %s has no baseline, store one with --update" % (name, run["cid"]))
+        else:
+            failed += compare(run, baselines[run["cid"]], args.threshold, args.latency_threshold) > 0
+
+    if args.update:
+        with open(args.baselines, "w") as f:
+            json.dump(baselines, f, indent=1, sort_keys=True)
+    if failed:
+        print("%d of %d fixtures failed or regressed" % (failed, len(sources)))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+"""Host side of the serial file service (sys/FAT/ffserv.h).
+
+Lists directories, shows file status, downloads and deletes files of volumes
+mounted on the board, over the COM port of FILE_SERVICE_PORT (needs pyserial).
+
+    tools/ffserv.py -p /dev/ttyUSB0 list 0:/
+    tools/ffserv.py -p /dev/ttyUSB0 stat 0:/log/run1.bin
+    tools/ffserv.py -p /dev/ttyUSB0 get 0:/log/run1.bin run1.bin
+    tools/ffserv.py -p /dev/ttyUSB0 rm 0:/log/run1.bin
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+import time
+import zlib
+
+import serial
+
+SYNC = 0xA5
+HEADER = struct.Struct("<BBHI")
+
+# keep in sync with FSERV_* of sys/FAT/ffserv.h
+LIST, STAT, READ, DELETE, ACK = 0x01, 0x02, 0x03, 0x04, 0x05
+ENTRY, DATA, END, DIGEST = 0x81, 0x82, 0x83, 0x84
+BLOCK = 2048
+REQUEST_MAX = 264
+
+FRESULT = ("OK", "DISK_ERR", "INT_ERR", "NOT_READY", "NO_FILE", "NO_PATH", "INVALID_NAME", "DENIED",
+           "EXIST", "INVALID_OBJECT", "WRITE_PROTECTED", "INVALID_DRIVE", "NOT_ENABLED", "NO_FILESYSTEM",
+           "MKFS_ABORTED", "TIMEOUT", "LOCKED", "NOT_ENOUGH_CORE", "TOO_MANY_OPEN_FILES", "INVALID_PARAMETER")
+
+
+class ServiceError(Exception):
+    pass
+
+
+class Service:
+    def __init__(self, port, baud, timeout):
+        self.port = serial.Serial(port, baud, timeout=0.05)
+        self.timeout = timeout
+        self.buf = bytearray()
+
+    def send(self, ftype, arg=0, payload=b""):
+        if len(payload) > REQUEST_MAX:
+            raise ServiceError("request too long")
+        frame = HEADER.pack(SYNC, ftype, len(payload), arg) + payload
+        self.port.write(frame + struct.pack("<I", zlib.crc32(frame[1:]) & 0xFFFFFFFF))
+
+    def receive(self, timeout=None):
+        """Next intact frame as (type, arg, payload), None on timeout."""
+        deadline = time.monotonic() + (self.timeout if timeout is None else timeout)
+        while True:
+            while len(self.buf) >= HEADER.size:
+                if self.buf[0] != SYNC:
+                    del self.buf[0]
+                    continue
+                _, ftype, length, arg = HEADER.unpack_from(self.buf)
+                if length > BLOCK:
+                    del self.buf[0]
+                    continue
+                size = HEADER.size + length + 4
+                if len(self.buf) < size:
+                    break
+                frame = bytes(self.buf[:size])
+                crc, = struct.unpack_from("<I", frame, size - 4)
+                if crc != zlib.crc32(frame[1:size - 4]) & 0xFFFFFFFF:
+                    del self.buf[0]		# resync inside the damaged frame
+                    continue
+                del self.buf[:size]
+                return ftype, arg, frame[HEADER.size:size - 4]
+            if time.monotonic() > deadline:
+                return None
+            self.buf += self.port.read(max(1, self.port.in_waiting))
+
+    def request(self, ftype, path, arg=0, prefix=b"", retries=3):
+        """Sends the request until answered, yields ENTRY payloads, returns at END."""
+        payload = prefix + path.encode("latin-1") + b"\0"
+        for _ in range(retries):
+            self.send(ftype, arg, payload)
+            frame = self.receive()
+            while frame is not None:
+                ftype_in, arg_in, data = frame
+                if ftype_in == END:
+                    check(arg_in)
+                    return
+                if ftype_in == ENTRY:
+                    yield entry(data)
+                frame = self.receive()
+                if frame is None:
+                    raise ServiceError("answer cut short")		# repeating would list entries twice
+        raise ServiceError("no answer")
+
+    def read(self, path, out, offset=0, length=0xFFFFFFFF, window=8, progress=None):
+        """Go-back-N download: in-order DATA frames are acknowledged, the first frame after
+        a gap is answered by ACK of the expected offset once, the device restarts there.
+        If the device sends SHA-1 of the data (USE_HW_HASH), the received data are checked."""
+        self.send(READ, offset, struct.pack("<IB", length, window) + path.encode("latin-1") + b"\0")
+        expected = offset
+        gap = False
+        sha1 = hashlib.sha1()
+        while True:
+            frame = self.receive()
+            if frame is None:
+                raise ServiceError("transfer stalled at %d" % expected)
+            ftype, arg, data = frame
+            if ftype == END:
+                check(arg)
+                return expected - offset
+            if ftype == DIGEST and arg == offset:
+                if data != sha1.digest():
+                    raise ServiceError("SHA-1 mismatch of received data")
+                continue
+            if ftype != DATA:
+                continue
+            if arg == expected:
+                out.write(data)
+                sha1.update(data)
+                expected += len(data)
+                gap = False
+                self.send(ACK, expected)
+                if progress:
+                    progress(expected - offset)
+            elif not gap:
+                gap = True
+                self.send(ACK, expected)
+
+
+def check(res):
+    if res:
+        raise ServiceError(FRESULT[res] if res < len(FRESULT) else "FRESULT %d" % res)
+
+
+def entry(data):
+    size, fdate, ftime, attr = struct.unpack_from("<IHHB", data)
+    name = data[9:].split(b"\0")[0].decode("latin-1")
+    stamp = "%04d-%02d-%02d %02d:%02d:%02d" % ((fdate >> 9) + 1980, (fdate >> 5) & 15, fdate & 31,
+                                              ftime >> 11, (ftime >> 5) & 63, (ftime & 31) * 2)
+    return name, size, stamp, attr
+
+
+def show(e):
+    name, size, stamp, attr = e
+    print("%s %10s  %s  %s" % ("d" if attr & 0x10 else "-", "" if attr & 0x10 else size, stamp, name))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("-p", "--port", required=True)
+    ap.add_argument("-b", "--baud", type=int, default=3000000, help="FILE_SERVICE_BAUDRATE")
+    ap.add_argument("-t", "--timeout", type=float, default=2.0, help="answer timeout in seconds")
+    ap.add_argument("-w", "--window", type=int, default=8, help="DATA frames in flight (1..16)")
+    ap.add_argument("command", choices=("list", "stat", "get", "rm"))
+    ap.add_argument("path")
+    ap.add_argument("output", nargs="?", help="local file of get (default: name of the remote one)")
+    args = ap.parse_args()
+
+    svc = Service(args.port, args.baud, args.timeout)
+    try:
+        if args.command == "list":
+            for e in svc.request(LIST, args.path):
+                show(e)
+        elif args.command == "stat":
+            for e in svc.request(STAT, args.path):
+                show(e)
+        elif args.command == "rm":
+            list(svc.request(DELETE, args.path, retries=1))
+        else:
+            output = args.output or args.path.replace("\\", "/").split("/")[-1].split(":")[-1]
+            start = time.monotonic()
+            with open(output, "wb") as out:
+                n = svc.read(args.path, out, window=args.window,
+                             progress=lambda n: sys.stderr.write("\r%d bytes" % n))
+            took = time.monotonic() - start
+            sys.stderr.write("\r%d bytes in %.1f s (%.0f kB/s)\n" % (n, took, n / 1024 / took if took else 0))
+    except ServiceError as e:
+        print("%s: %s" % (args.path, e), file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""Decoder of the binary storage metrics frames (sys/metrics.h, METRICS_BINARY).
+
+Input is a capture of the console (or METRICS_FILE) with frames of sync byte
+0xA5, type, 16-bit length, record and CRC32 (zlib) of type .. record. Bytes
+between frames (e.g. printf output on the same port) and frames failing the
+CRC are skipped. Output is CSV in the format of METRICS_CSV: "M" lines for
+samples, "C" lines for card identity, each kind named once by a "#" line.
+
+    tools/metrics_decode.py console.bin > metrics.csv
+"""
+
+import argparse
+import struct
+import sys
+import zlib
+
+SYNC = 0xA5
+HEADER = struct.Struct("<BH")
+
+# keep in sync with Metrics_Sample and Metrics_Card of sys/metrics.h
+SAMPLE_FIELDS = ("seq", "msec", "collect_us", "collect_max_us", "heap_free", "heap_min_free",
+                 "pool_free", "pool_min_free", "stack_min_free", "cache_hits", "cache_misses",
+                 "cache2_hits", "io_waiting", "io_requests", "io_avg_ms", "io_max_ms", "io_missed",
+                 "sd_cmd_errors", "sd_crc_errors", "sd_write_errors", "sd_timeouts", "sd_retries",
+                 "sd_reinits", "sd_unrecovered")
+CARD_FIELDS = ("seq", "msec", "changes", "capacity_kb", "cid")
+
+TYPES = {
+    0x4D: ("M", SAMPLE_FIELDS),
+    0x43: ("C", CARD_FIELDS),
+}
+
+
+def frames(data):
+    """Yields (type, payload) of the frames with valid CRC, and the number of skipped bytes."""
+    i = 0
+    skipped = 0
+    while i + 1 + HEADER.size + 4 <= len(data):
+        if data[i] != SYNC:
+            i += 1
+            skipped += 1
+            continue
+        rtype, n = HEADER.unpack_from(data, i + 1)
+        end = i + 1 + HEADER.size + n
+        if rtype not in TYPES or end + 4 > len(data) or \
+                zlib.crc32(data[i + 1:end]) != struct.unpack_from("<I", data, end)[0]:
+            i += 1		# not a frame, resynchronize at the next sync byte
+            skipped += 1
+            continue
+        yield rtype, data[end - n:end]
+        i = end + 4
+    yield None, skipped + len(data) - i
+
+
+def fields(rtype, payload):
+    if rtype == 0x43:
+        return list(struct.unpack_from("<4I", payload)) + [payload[16:32].hex().upper()]
+    return list(struct.unpack_from("<%dI" % (len(payload) // 4), payload))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("file")
+    args = ap.parse_args()
+
+    with open(args.file, "rb") as f:
+        data = f.read()
+
+    named = set()
+    last = None
+    for rtype, payload in frames(data):
+        if rtype is None:
+            if payload:
+                print("%d bytes outside of valid frames skipped" % payload, file=sys.stderr)
+            break
+        tag, names = TYPES[rtype]
+        if tag not in named:
+            print("#%s,%s" % (tag, ",".join(names)))
+            named.add(tag)
+        values = fields(rtype, payload)
+        if last is not None and values[0] != (last + 1) & 0xFFFFFFFF:
+            print("# gap of %d records" % ((values[0] - last - 1) & 0xFFFFFFFF))
+        last = values[0]
+        print("%s,%s" % (tag, ",".join(str(v) for v in values)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+"""Decoder of packed streams (sys/FAT/ffpack.h).
+
+The file is a sequence of 512-byte sectors holding whole chunks: packed
+length (16 bits, 0 pads to the end of the sector), raw length and codec
+(14 + 2 bits), packed data. Raw data of all chunks are written in order;
+a damaged sector is reported and skipped, the following ones still decode.
+
+    tools/pack_decode.py LOG.PCK log.bin
+    tools/pack_decode.py --stats LOG.PCK
+"""
+
+import argparse
+import struct
+import sys
+
+SECTOR = 512
+HEADER = 4
+
+# keep in sync with PACK_* of sys/FAT/ffpack.h
+STORED, LZ4, DELTA = 0, 1, 2
+
+
+class DecodeError(Exception):
+    pass
+
+
+def lz4_block(data, size):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        token = data[i]
+        i += 1
+        n = token >> 4
+        if n == 15:
+            while True:
+                b = data[i]
+                i += 1
+                n += b
+                if b != 255:
+                    break
+        out += data[i:i + n]
+        i += n
+        if i == len(data):
+            break		# last literals
+        off = data[i] | data[i + 1] << 8
+        i += 2
+        n = (token & 15) + 4
+        if token & 15 == 15:
+            while True:
+                b = data[i]
+                i += 1
+                n += b
+                if b != 255:
+                    break
+        if off == 0 or off > len(out):
+            raise DecodeError("bad LZ4 offset")
+        for _ in range(n):		# match may overlap its own output
+            out.append(out[-off])
+    if len(out) != size:
+        raise DecodeError("LZ4 block of %d bytes, expected %d" % (len(out), size))
+    return bytes(out)
+
+
+def delta(data, size):
+    out = bytearray()
+    prev = 0
+    z = shift = 0
+    for b in data:
+        z |= (b & 0x7F) << shift
+        shift += 7
+        if b & 0x80:
+            continue
+        d = (z >> 1) ^ -(z & 1)
+        prev = (prev + d) & 0xFFFFFFFF
+        out += struct.pack("<I", prev)
+        z = shift = 0
+    if len(out) != size:
+        raise DecodeError("delta chunk of %d bytes, expected %d" % (len(out), size))
+    return bytes(out)
+
+
+def chunks(sector):
+    i = 0
+    while i + HEADER <= len(sector):
+        packed, raw = struct.unpack_from("<HH", sector, i)
+        if packed == 0:
+            return
+        codec, raw = raw >> 14, raw & 0x3FFF
+        data = sector[i + HEADER:i + HEADER + packed]
+        if len(data) != packed:
+            raise DecodeError("chunk crosses the sector end")
+        yield codec, raw, data
+        i += HEADER + packed
+
+
+def decode(codec, raw, data):
+    if codec == STORED:
+        if len(data) != raw:
+            raise DecodeError("stored chunk of %d bytes, expected %d" % (len(data), raw))
+        return data
+    if codec == LZ4:
+        return lz4_block(data, raw)
+    if codec == DELTA:
+        return delta(data, raw)
+    raise DecodeError("unknown codec %d" % codec)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("file")
+    ap.add_argument("output", nargs="?", help="raw data (default: only check the stream)")
+    ap.add_argument("--stats", action="store_true", help="print sizes and ratio")
+    args = ap.parse_args()
+
+    with open(args.file, "rb") as f:
+        data = f.read()
+    out = open(args.output, "wb") if args.output else None
+    raw_total = bad = n_chunks = 0
+    for s in range(0, len(data), SECTOR):
+        try:
+            for codec, raw, packed in chunks(data[s:s + SECTOR]):
+                chunk = decode(codec, raw, packed)
+                n_chunks += 1
+                raw_total += len(chunk)
+                if out:
+                    out.write(chunk)
+        except (DecodeError, IndexError) as e:
+            bad += 1
+            print("sector %d: %s" % (s // SECTOR, e), file=sys.stderr)
+    if out:
+        out.close()
+    if args.stats:
+        print("%d sectors, %d chunks, %d raw bytes, ratio %.2f" %
+              (len(data) // SECTOR, n_chunks, raw_total, raw_total / len(data) if data else 0))
+    return 1 if bad else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+"""Size report per module from the linker map of the firmware (GCC-ARM/Makefile).
+
+Input sections kept by the linker (after --gc-sections) are summed per module,
+the source directory of the object (src, sys/BSP, sys/FAT, ...) or the library.
+FLASH holds code, constants and initial values of .data (and .ramfunc code),
+RAM holds .data, .bss and the NOLOAD buffers. With --total one line is printed
+for scripts, to be kept per commit:
+
+    SIZE,name,flash,ram
+
+With --footprint the RAM is shown instead: size of each RAM section, the largest
+objects (input sections of -fdata-sections are named after their variables) and
+the spare SRAM1 left between the sections and the main stack (_sspare, _espare),
+which USE_SPARE_RAM_CACHE gives to the sector cache (sizes in src/storage_conf.h).
+With --total its line is
+
+    FOOTPRINT,name,ram,spare,cache sectors
+
+    tools/size_report.py GCC-ARM/build/release/sdcard.map
+    tools/size_report.py --total --name release GCC-ARM/build/release/sdcard.map
+    tools/size_report.py --footprint --top 30 GCC-ARM/build/release/sdcard.map
+
+With LTO the objects are replaced by partitions of the link, so the modules
+show as ltrans and only the totals are meaningful.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+# output sections of GCC-ARM/stm32_flash.ld: (counted in FLASH, counted in RAM)
+REGIONS = {
+    ".isr_vector": (1, 0), ".text": (1, 0), ".ARM.extab": (1, 0), ".ARM": (1, 0),
+    ".preinit_array": (1, 0), ".init_array": (1, 0), ".fini_array": (1, 0),
+    ".data": (1, 1), ".dma_buffers": (0, 1), ".bss": (0, 1), ".fs_cache": (0, 1),
+    "._user_heap": (0, 1), ".fast_stacks": (0, 1), ".ext_sram": (0, 0), ".memory_b1_text": (0, 0),
+}
+
+# sector and slot of the spare SRAM cache (CACHE_SLOT of sys/FAT/diskio.c)
+CACHE_SECTOR = 512 + 16
+
+INPUT = re.compile(r"^ (\S+)?\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$")
+OUTPUT = re.compile(r"^(\.\S+)(\s+0x[0-9a-fA-F]+\s+0x[0-9a-fA-F]+)?")
+SYMBOL = re.compile(r"^\s+0x([0-9a-fA-F]+)\s+(_sspare|_espare)\s+=")
+
+
+def module(path):
+    m = re.match(r".*/lib([^/]+)\.a\(.*\)$", path)
+    if m:
+        return "lib" + m.group(1)
+    if "ltrans" in path:
+        return "ltrans"
+    path = path.replace("\\", "/")
+    if "/obj/" in path:
+        path = path.split("/obj/", 1)[1]
+    return os.path.dirname(path) or "."
+
+
+def parse(path):
+    """Returns {module: [flash, ram]}, RAM objects [(size, section, name, module)] and
+    {symbol: address} of the spare SRAM."""
+    sizes = {}
+    objects = []
+    symbols = {}
+    section = None
+    name = None
+    pending = False		# input section name on its own line, address and size follow
+    started = False
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.rstrip("\n\r")
+            if not started:
+                started = line.startswith("Linker script and memory map")
+                continue
+            m = SYMBOL.match(line)
+            if m:
+                symbols[m.group(2)] = int(m.group(1), 16)
+                continue
+            m = OUTPUT.match(line)
+            if m:
+                section = m.group(1)
+                pending = False
+                continue
+            m = INPUT.match(line)
+            if m and (m.group(1) or pending) and not m.group(4).startswith("0x"):
+                if m.group(1):
+                    name = m.group(1)
+                pending = False
+                size = int(m.group(3), 16)
+                flash, ram = REGIONS.get(section, (0, 0))
+                if size and (flash or ram):
+                    mod = module(m.group(4).strip())
+                    s = sizes.setdefault(mod, [0, 0])
+                    s[0] += size * flash
+                    s[1] += size * ram
+                    if ram:
+                        objects.append((size, section, name, mod))
+                continue
+            pending = re.match(r"^ \S+$", line) is not None
+            if pending:
+                name = line.strip()
+    return sizes, objects, symbols
+
+
+def variable(name, section):
+    """Name of the variable of an input section, e.g. .bss.cache_slot."""
+    for prefix in (section + ".", ".bss.", ".data.", ".dma_buffers.", ".fs_cache.", ".fast_stacks."):
+        if name.startswith(prefix):
+            return name[len(prefix):]
+    return name
+
+
+def footprint(args, sizes, objects, symbols):
+    ram = sum(s[1] for s in sizes.values())
+    spare = symbols.get("_espare", 0) - symbols.get("_sspare", 0)
+    if args.total:
+        print("FOOTPRINT,%s,%d,%d,%d" % (args.name or os.path.basename(os.path.dirname(os.path.abspath(args.map))),
+                                         ram, spare, max(spare, 0) // CACHE_SECTOR))
+        return 0
+    sections = {}
+    for size, section, _, _ in objects:
+        sections[section] = sections.get(section, 0) + size
+    print("%-16s %9s" % ("section", "ram"))
+    for section, size in sorted(sections.items(), key=lambda i: -i[1]):
+        print("%-16s %9d" % (section, size))
+    print("%-16s %9d" % ("total", ram))
+    print("%-16s %9d  (%d sectors of the spare RAM cache)" % ("spare", spare, max(spare, 0) // CACHE_SECTOR))
+    print()
+    objects = sorted(objects, key=lambda o: -o[0])[:args.top]
+    w = max([len(variable(o[2] or "", o[1])) for o in objects] + [6])
+    print("%-*s %9s  %-14s %s" % (w, "object", "ram", "section", "module"))
+    for size, section, name, mod in objects:
+        print("%-*s %9d  %-14s %s" % (w, variable(name or "", section), size, section, mod))
+    return 0
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("map")
+    ap.add_argument("--total", action="store_true", help="print the SIZE line only")
+    ap.add_argument("--name", default="", help="name of the build in the SIZE or FOOTPRINT line")
+    ap.add_argument("--footprint", action="store_true", help="RAM by sections and objects, spare SRAM")
+    ap.add_argument("--top", type=int, default=20, help="number of the largest objects with --footprint")
+    args = ap.parse_args()
+
+    sizes, objects, symbols = parse(args.map)
+    if not sizes:
+        print("no sections in %s" % args.map, file=sys.stderr)
+        return 1
+    if args.footprint:
+        return footprint(args, sizes, objects, symbols)
+    flash = sum(s[0] for s in sizes.values())
+    ram = sum(s[1] for s in sizes.values())
+    if args.total:
+        print("SIZE,%s,%d,%d" % (args.name or os.path.basename(os.path.dirname(os.path.abspath(args.map))), flash, ram))
+        return 0
+    w = max(len(name) for name in sizes)
+    print("%-*s %9s %9s" % (w, "module", "flash", "ram"))
+    for name, (f, r) in sorted(sizes.items(), key=lambda i: -i[1][0]):
+        print("%-*s %9d %9d" % (w, name, f, r))
+    print("%-*s %9d %9d" % (w, "total", flash, ram))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+"""Builder of lookup table files (sys/FAT/fftable.h).
+
+Input is a CSV text file: the first column is the 32-bit unsigned key, the
+other columns are the values packed after it by --values (struct format
+characters, little endian), e.g. "ff" for two floats. Records are sorted by
+key, a repeated key is an error. With --dump the table is listed back.
+
+    tools/table_build.py --values ff calib.csv CALIB.TBL
+    tools/table_build.py --dump CALIB.TBL --values ff
+"""
+
+import argparse
+import csv
+import struct
+import sys
+
+SECTOR = 512
+KEY = 4
+
+# keep in sync with TABLE_Header of sys/FAT/fftable.h
+MAGIC = 0x314C4254
+HEADER = struct.Struct("<IHHIIII")
+
+
+def check(rec_size, records, sectors, index_sectors):
+    return ~(MAGIC ^ rec_size ^ records ^ sectors ^ index_sectors) & 0xFFFFFFFF
+
+
+def build(rows, values):
+    rec = struct.Struct("<I" + values)
+    per_sector = SECTOR // rec.size
+    if rec.size > SECTOR:
+        raise ValueError("record of %d bytes doesn't fit into a sector" % rec.size)
+    rows.sort(key=lambda r: r[0])
+    for a, b in zip(rows, rows[1:]):
+        if a[0] == b[0]:
+            raise ValueError("key %d is repeated" % a[0])
+    sectors = (len(rows) + per_sector - 1) // per_sector
+    index_sectors = max(1, (sectors * KEY + SECTOR - 1) // SECTOR)
+
+    index = bytearray()
+    data = bytearray()
+    for s in range(sectors):
+        part = rows[s * per_sector:(s + 1) * per_sector]
+        index += struct.pack("<I", part[0][0])
+        sector = b"".join(rec.pack(*r) for r in part)
+        data += sector + bytes(SECTOR - len(sector))
+    header = HEADER.pack(MAGIC, rec.size, 0, len(rows), sectors, index_sectors,
+                         check(rec.size, len(rows), sectors, index_sectors))
+    index += bytes(index_sectors * SECTOR - len(index))
+    return header + bytes(SECTOR - HEADER.size) + index + data
+
+
+def dump(data, values):
+    magic, rec_size, _, records, sectors, index_sectors, chk = HEADER.unpack_from(data)
+    if magic != MAGIC or chk != check(rec_size, records, sectors, index_sectors):
+        raise ValueError("not a table")
+    rec = struct.Struct("<I" + values)
+    if rec.size != rec_size:
+        raise ValueError("records are %d bytes, --values gives %d" % (rec_size, rec.size))
+    per_sector = SECTOR // rec_size
+    base = (1 + index_sectors) * SECTOR
+    for i in range(records):
+        off = base + (i // per_sector) * SECTOR + (i % per_sector) * rec_size
+        print(",".join(str(v) for v in rec.unpack_from(data, off)))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("input")
+    ap.add_argument("output", nargs="?")
+    ap.add_argument("--values", default="I", help="struct format of the values after the key")
+    ap.add_argument("--dump", action="store_true", help="list records of the table file")
+    args = ap.parse_args()
+
+    try:
+        if args.dump:
+            with open(args.input, "rb") as f:
+                dump(f.read(), args.values)
+            return 0
+        if args.output is None:
+            ap.error("output file is needed")
+        conv = [float if c in "fd" else int for c in struct.Struct("<" + args.values).format if c.isalpha()]
+        rows = []
+        with open(args.input, newline="") as f:
+            for line in csv.reader(f):
+                if not line or line[0].lstrip().startswith("#"):
+                    continue
+                rows.append((int(line[0], 0),) + tuple(c(v, 0) if c is int else c(v) for c, v in zip(conv, line[1:])))
+        with open(args.output, "wb") as f:
+            f.write(build(rows, args.values))
+    except (ValueError, struct.error) as e:
+        print("table_build: %s" % e, file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
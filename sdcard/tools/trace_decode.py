@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""Decoder of the binary event trace (sys/event_trace.h).
+
+Input is either the SWO capture of ITM stimulus port 1 (raw ITM packets, as
+written by OpenOCD "tpiu config ... -output file" or ST-Link utility), or with
+--raw a memory dump of EventTrace_Ring (16-byte records, EventTrace_Head % 256
+is the oldest one after a wrap, pass it with --head).
+
+Output is a timeline: time since the first record in microseconds, event and
+its arguments, and for *_END events the duration of the phase that ended.
+
+    tools/trace_decode.py swo.bin
+    tools/trace_decode.py --raw ring.bin --head 0x1234 --mhz 120
+"""
+
+import argparse
+import struct
+import sys
+
+RECORD = struct.Struct("<IHHII")
+
+# keep in sync with EVT_* of sys/event_trace.h
+EVENTS = {
+    0x0001: ("TRACE_LOST", "lost={0}"),
+    0x0100: ("SD_CMD", "CMD{0} arg=0x{1:08X}"),
+    0x0101: ("SD_RESP", "CMD{0} r1=0x{1:02X}"),
+    0x0102: ("SD_RX_BEGIN", "len={0}"),
+    0x0103: ("SD_RX_END", "len={0} res=0x{1:02X}"),
+    0x0104: ("SD_TX_BEGIN", "token=0x{0:02X}"),
+    0x0105: ("SD_TX_END", "token=0x{0:02X} resp=0x{1:02X}"),
+    0x0106: ("SD_BUSY_BEGIN", "timeout={0}ms"),
+    0x0107: ("SD_BUSY_END", "delay={0} res=0x{1:02X}"),
+    0x0200: ("IO_BEGIN", "sector={0} {op} count={count}"),
+    0x0201: ("IO_END", "sector={0} res=0x{1:02X}"),
+}
+
+# phase which an *_END event closes
+BEGIN_OF = {0x0103: 0x0102, 0x0105: 0x0104, 0x0107: 0x0106, 0x0201: 0x0200, 0x0101: 0x0100}
+
+IO_OPS = ("INIT", "READ", "WRITE", "ERASE", "INFO", "SYNC", "VERIFY", "RECORD")
+
+
+def itm_payload(data, port):
+    """Yields payload bytes of software packets of the stimulus port."""
+    i = 0
+    while i < len(data):
+        h = data[i]
+        i += 1
+        size = h & 3
+        if size == 0:
+            if h == 0x00:		# synchronization: zeros ended by 0x80
+                while i < len(data) and data[i] == 0x00:
+                    i += 1
+                i += 1
+            elif h & 0x80:		# protocol packet with continuation bytes
+                while i < len(data) and data[i] & 0x80:
+                    i += 1
+                i += 1
+            continue		# overflow packet (0x70) has no payload
+        n = (1, 2, 4)[size - 1]
+        if not h & 4 and h >> 3 == port:
+            yield from data[i:i + n]
+        i += n
+
+
+def records(buf):
+    for off in range(0, len(buf) - RECORD.size + 1, RECORD.size):
+        yield RECORD.unpack_from(buf, off)
+
+
+def describe(eid, a0, a1):
+    name, fmt = EVENTS.get(eid, ("EVT_0x%04X" % eid, "{0} {1}"))
+    op = IO_OPS[a1 & 0xFF] if (a1 & 0xFF) < len(IO_OPS) else str(a1 & 0xFF)
+    return name, fmt.format(a0, a1, op=op, count=a1 >> 8)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("file")
+    ap.add_argument("--raw", action="store_true", help="input is a dump of EventTrace_Ring")
+    ap.add_argument("--head", type=lambda s: int(s, 0), default=0, help="EventTrace_Head of the dump")
+    ap.add_argument("--port", type=int, default=1, help="ITM stimulus port (EVENT_TRACE_ITM_PORT)")
+    ap.add_argument("--mhz", type=float, default=120.0, help="core clock (SystemCoreClock) in MHz")
+    args = ap.parse_args()
+
+    with open(args.file, "rb") as f:
+        data = f.read()
+    if args.raw:
+        recs = list(records(data))
+        first = args.head % len(recs) if recs else 0
+        recs = recs[first:] + recs[:first]
+    else:
+        recs = list(records(bytes(itm_payload(data, args.port))))
+
+    elapsed = 0
+    last = None
+    seq = None
+    begin = {}
+    for cycles, eid, rseq, a0, a1 in recs:
+        if args.raw and cycles == 0 and eid == 0:
+            continue		# never written
+        if last is not None:
+            elapsed += (cycles - last) & 0xFFFFFFFF		# counter wraps every 35 s at 120 MHz
+        last = cycles
+        if eid != 0x0001 and seq is not None and rseq != (seq + 1) & 0xFFFF:
+            print("%12s  -- gap of %d records --" % ("", (rseq - seq - 1) & 0xFFFF))
+        if eid != 0x0001:
+            seq = rseq
+        us = elapsed / args.mhz
+        name, text = describe(eid, a0, a1)
+        if eid in BEGIN_OF.values():
+            begin[eid] = us
+        took = ""
+        if eid in BEGIN_OF and BEGIN_OF[eid] in begin:
+            took = "  (%.1f us)" % (us - begin.pop(BEGIN_OF[eid]))
+        print("%12.1f  %-14s %s%s" % (us, name, text, took))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())